@@ -0,0 +1,11 @@
+# included only if ENABLE_TESTS=1 and ENABLE_BENCHMARKS=1
+
+find_package(benchmark)
+
+if (TARGET benchmark::benchmark)
+    set(USE_BENCHMARK 1)
+else ()
+    message (${RECONFIGURE_MESSAGE_LEVEL} "Can't find system Google Benchmark")
+endif ()
+
+message (STATUS "Using benchmark=${USE_BENCHMARK}")
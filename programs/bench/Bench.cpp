@@ -0,0 +1,694 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <set>
+#include <thread>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <Common/Exception.h>
+#include <Common/LogLinearHistogram.h>
+#include <Common/TerminalSize.h>
+#include <fmt/format.h>
+#include <ZooKeeper/ZooKeeper.h>
+#include <ZooKeeper/ZooKeeperImpl.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/ConsoleChannel.h>
+#include <Poco/Logger.h>
+#include <Poco/Net/StreamSocket.h>
+
+/** Load generator speaking ZooKeeper protocol by the in-tree client, see benchmark/README.md.
+  *
+  * Load is open loop: every thread issues requests on a schedule of rate / threads a second, spread over its sessions,
+  * whether the previous ones are answered or not, and latency is measured from the time a request is scheduled at. So a
+  * stall of the server is seen as latency of all the requests scheduled during it, which a closed loop client would not
+  * send. A session has at most max-inflight requests in flight, a request waiting for it is still measured from its
+  * scheduled time. With rate 0 sessions keep max-inflight requests in flight.
+  *
+  * Latencies are in microseconds, the distribution of all requests is printed in HdrHistogram percentile format.
+  *
+  * For soak runs of hours, sessions are replaced at session-churn a second, which drops their ephemeral nodes and
+  * watches, and servers are asked to create snapshots every snapshot-interval seconds. With soak-output, resources of
+  * servers by 4lw commands mntr and dirs, and latency of the last interval are appended to it every sample-interval
+  * seconds, so that growth of memory, fds and data dirs over the run is seen.
+  */
+
+namespace
+{
+
+using namespace RK;
+using Clock = std::chrono::steady_clock;
+
+enum Op : UInt8
+{
+    CREATE,
+    REMOVE,
+    GET,
+    SET,
+    LIST,
+    EXISTS,
+    /// Create an ephemeral node, it is removed when the session is closed by churn
+    EPHEMERAL,
+    /// Exists with a watch, which is fired by set of the node
+    WATCH,
+    OP_COUNT,
+};
+
+const char * op_names[OP_COUNT] = {"create", "remove", "get", "set", "list", "exists", "ephemeral", "watch"};
+
+/// Weights of operations, like "create:1,set:8,get:45,list:45,remove:1"
+using Mix = std::array<UInt64, OP_COUNT>;
+
+Mix parseMix(const String & spec)
+{
+    /// Workloads of benchmark/README.md
+    if (spec == "create")
+        return parseMix("create:100");
+    if (spec == "mixed")
+        return parseMix("create:1,set:8,get:45,list:45,remove:1");
+    if (spec == "soak")
+        return parseMix("create:2,remove:2,set:10,get:40,list:20,exists:10,ephemeral:6,watch:10");
+
+    Mix mix{};
+    Strings items;
+    boost::split(items, spec, boost::is_any_of(","));
+    for (const auto & item : items)
+    {
+        auto pos = item.find(':');
+        auto it = std::find(std::begin(op_names), std::end(op_names), item.substr(0, pos));
+        if (pos == String::npos || it == std::end(op_names))
+            throw std::invalid_argument("Bad operation in mix: " + item);
+        mix[static_cast<size_t>(it - std::begin(op_names))] = std::stoull(item.substr(pos + 1));
+    }
+    if (std::all_of(mix.begin(), mix.end(), [](UInt64 weight) { return weight == 0; }))
+        throw std::invalid_argument("Empty mix: " + spec);
+    return mix;
+}
+
+struct Options
+{
+    Coordination::ZooKeeper::Nodes nodes;
+    size_t threads;
+    size_t sessions;
+    double rate;
+    size_t max_inflight;
+    Mix mix;
+    String root;
+    size_t data_size;
+    size_t nodes_count;
+    size_t list_children;
+    size_t list_child_size;
+    /// Sessions replaced a second of all threads
+    double session_churn;
+    Coordination::ZooKeeper::BatchingSettings batching;
+
+    String dataRoot() const { return root + "/data"; }
+    String listRoot() const { return root + "/list"; }
+    String createRoot() const { return root + "/create"; }
+};
+
+struct Stats
+{
+    /// Of every operation, and of all at OP_COUNT
+    std::array<std::unique_ptr<LogLinearHistogram>, OP_COUNT + 1> latency_us;
+    std::array<std::atomic<UInt64>, OP_COUNT> errors{};
+
+    /// Of all operations since the last sample, reset by it
+    LogLinearHistogram interval_latency_us;
+    std::atomic<UInt64> interval_errors{0};
+
+    std::atomic<UInt64> watch_events{0};
+    std::atomic<UInt64> churned_sessions{0};
+
+    Stats()
+    {
+        for (auto & histogram : latency_us)
+            histogram = std::make_unique<LogLinearHistogram>();
+    }
+
+    void add(Op op, UInt64 latency)
+    {
+        latency_us[op]->add(latency);
+        latency_us[OP_COUNT]->add(latency);
+        interval_latency_us.add(latency);
+    }
+
+    void addError(Op op)
+    {
+        errors[op]++;
+        interval_errors++;
+    }
+
+    void reset()
+    {
+        for (auto & histogram : latency_us)
+            histogram->reset();
+        for (auto & op_errors : errors)
+            op_errors = 0;
+        interval_latency_us.reset();
+        interval_errors = 0;
+    }
+};
+
+class Worker
+{
+public:
+    Worker(const Options & options_, size_t worker_id_, Stats & stats_)
+        : options(options_), worker_id(worker_id_), stats(stats_), rng(worker_id_), data(options.data_size, 'x')
+    {
+        for (size_t i = 0; i < options.sessions; ++i)
+            sessions.push_back(std::make_unique<Session>(options));
+        for (size_t op = 0; op < OP_COUNT; ++op)
+            for (UInt64 i = 0; i < options.mix[op]; ++i)
+                weighted_ops.push_back(static_cast<Op>(op));
+    }
+
+    void run(Clock::time_point start, Clock::time_point end)
+    {
+        auto interval = options.rate > 0 ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(
+                            static_cast<double>(options.threads) / options.rate))
+                                         : Clock::duration::zero();
+        auto churn_interval = options.session_churn > 0
+            ? std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(options.threads) / options.session_churn))
+            : Clock::duration::zero();
+        auto next_churn = start + churn_interval;
+
+        auto scheduled = start;
+        size_t next_session = 0;
+        while (Clock::now() < end)
+        {
+            if (churn_interval.count() && Clock::now() >= next_churn)
+            {
+                churnSession();
+                next_churn += churn_interval;
+            }
+
+            if (interval.count())
+            {
+                scheduled += interval;
+                std::this_thread::sleep_until(scheduled);
+            }
+
+            /// Session with room for a request
+            Session * session = nullptr;
+            while (!session && Clock::now() < end)
+            {
+                for (size_t i = 0; i < sessions.size() && !session; ++i)
+                {
+                    auto & candidate = *sessions[(next_session + i) % sessions.size()];
+                    if (candidate.inflight < options.max_inflight)
+                    {
+                        session = &candidate;
+                        next_session += i + 1;
+                    }
+                }
+                if (!session)
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+            if (!session)
+                break;
+
+            if (!interval.count())
+                scheduled = Clock::now();
+            issue(*session, weighted_ops[std::uniform_int_distribution<size_t>(0, weighted_ops.size() - 1)(rng)], scheduled);
+        }
+    }
+
+    /// Wait for requests in flight
+    void finish()
+    {
+        for (auto & session : sessions)
+            while (session->inflight && !session->zookeeper->isExpired())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        for (auto & session : retired)
+            while (session->inflight && !session->zookeeper->isExpired())
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        retired.clear();
+    }
+
+private:
+    struct Session
+    {
+        explicit Session(const Options & options)
+            : zookeeper(std::make_unique<Coordination::ZooKeeper>(
+                options.nodes,
+                "",
+                "",
+                "",
+                Poco::Timespan(Coordination::DEFAULT_SESSION_TIMEOUT_MS * 1000),
+                Poco::Timespan(CONNECTION_TIMEOUT_MS * 1000),
+                Poco::Timespan(Coordination::DEFAULT_OPERATION_TIMEOUT_MS * 1000),
+                options.batching))
+        {
+        }
+
+        static constexpr Int64 CONNECTION_TIMEOUT_MS = 10000;
+
+        std::unique_ptr<Coordination::ZooKeeper> zookeeper;
+        std::atomic<size_t> inflight{0};
+    };
+
+    /// Replace a session by a new one. The old one is closed once its requests are answered, for their callbacks
+    /// refer to it.
+    void churnSession()
+    {
+        std::unique_ptr<Session> fresh;
+        try
+        {
+            fresh = std::make_unique<Session>(options);
+        }
+        catch (...)
+        {
+            /// Keep the old one, it is tried again by the next churn
+            return;
+        }
+
+        auto & session = sessions[next_churn_session++ % sessions.size()];
+        retired.push_back(std::move(session));
+        session = std::move(fresh);
+        stats.churned_sessions++;
+
+        std::erase_if(retired, [](const auto & retired_session) { return retired_session->inflight == 0; });
+    }
+
+    void issue(Session & session, Op op, Clock::time_point scheduled)
+    {
+        String path;
+        if (op == REMOVE)
+        {
+            std::lock_guard lock(created_mutex);
+            if (created.empty())
+            {
+                /// Nothing created by this worker yet
+                op = CREATE;
+            }
+            else
+            {
+                path = std::move(created.front());
+                created.pop_front();
+            }
+        }
+        if (op == CREATE || op == EPHEMERAL)
+            path = options.createRoot() + "/" + std::to_string(worker_id) + "-" + std::to_string(next_node++);
+        else if (op == GET || op == SET || op == EXISTS || op == WATCH)
+            path = options.dataRoot() + "/n" + std::to_string(std::uniform_int_distribution<size_t>(0, options.nodes_count - 1)(rng));
+
+        auto callback = [this, &session, op, scheduled, path](const auto & response)
+        {
+            auto latency_us = static_cast<UInt64>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - scheduled).count());
+            stats.add(op, latency_us);
+            if (response.error != Coordination::Error::ZOK)
+                stats.addError(op);
+            else if (op == CREATE)
+            {
+                std::lock_guard lock(created_mutex);
+                created.push_back(path);
+            }
+            session.inflight--;
+        };
+
+        session.inflight++;
+        try
+        {
+            auto & zookeeper = *session.zookeeper;
+            switch (op)
+            {
+                case CREATE:
+                    zookeeper.create(path, data, false, false, {}, callback);
+                    break;
+                case REMOVE:
+                    zookeeper.remove(path, -1, callback);
+                    break;
+                case GET:
+                    zookeeper.get(path, callback, {});
+                    break;
+                case SET:
+                    zookeeper.set(path, data, -1, callback);
+                    break;
+                case LIST:
+                    zookeeper.list(options.listRoot(), callback, {});
+                    break;
+                case EXISTS:
+                    zookeeper.exists(path, callback, {});
+                    break;
+                case EPHEMERAL:
+                    zookeeper.create(path, data, true, false, {}, callback);
+                    break;
+                case WATCH:
+                    zookeeper.exists(path, callback, [this](const Coordination::WatchResponse &) { stats.watch_events++; });
+                    break;
+                case OP_COUNT:
+                    break;
+            }
+        }
+        catch (...)
+        {
+            /// Callback is not invoked, the session is expired
+            stats.addError(op);
+            session.inflight--;
+        }
+    }
+
+    const Options & options;
+    const size_t worker_id;
+    Stats & stats;
+    std::mt19937_64 rng;
+    const String data;
+
+    std::vector<std::unique_ptr<Session>> sessions;
+    /// Sessions replaced by churn with requests in flight
+    std::vector<std::unique_ptr<Session>> retired;
+    size_t next_churn_session = 0;
+    std::vector<Op> weighted_ops;
+
+    UInt64 next_node = 0;
+    /// Nodes created and not removed yet, removed in order of creation
+    std::mutex created_mutex;
+    std::deque<String> created;
+};
+
+void prepare(const Options & options, const String & hosts)
+{
+    zkutil::ZooKeeper zookeeper(hosts);
+    zookeeper.createAncestors(options.dataRoot());
+    zookeeper.createIfNotExists(options.dataRoot(), "");
+    zookeeper.createIfNotExists(options.listRoot(), "");
+    zookeeper.createIfNotExists(options.createRoot(), "");
+
+    String data(options.data_size, 'x');
+    for (size_t i = 0; i < options.nodes_count; ++i)
+        zookeeper.createIfNotExists(options.dataRoot() + "/n" + std::to_string(i), data);
+
+    String child_data(options.list_child_size, 'x');
+    for (size_t i = 0; i < options.list_children; ++i)
+        zookeeper.createIfNotExists(options.listRoot() + "/c" + std::to_string(i), child_data);
+}
+
+void printSummary(const Stats & stats, double seconds)
+{
+    std::cout << fmt::format(
+        "{:<8}{:>12}{:>12}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n",
+        "op", "count", "ops/s", "errors", "avg_us", "p50_us", "p90_us", "p99_us", "p999_us", "max_us");
+    for (size_t op = 0; op <= OP_COUNT; ++op)
+    {
+        auto snapshot = stats.latency_us[op]->getSnapshot();
+        if (snapshot.count == 0)
+            continue;
+
+        UInt64 errors = 0;
+        if (op < OP_COUNT)
+            errors = stats.errors[op];
+        else
+            for (const auto & op_errors : stats.errors)
+                errors += op_errors;
+
+        std::cout << fmt::format(
+            "{:<8}{:>12}{:>12.0f}{:>10}{:>10}{:>10.0f}{:>10.0f}{:>10.0f}{:>10.0f}{:>10.0f}\n",
+            op < OP_COUNT ? op_names[op] : "total",
+            snapshot.count,
+            static_cast<double>(snapshot.count) / seconds,
+            errors,
+            snapshot.sum / snapshot.count,
+            snapshot.quantile(0.5),
+            snapshot.quantile(0.9),
+            snapshot.quantile(0.99),
+            snapshot.quantile(0.999),
+            snapshot.quantile(1));
+    }
+}
+
+/// Percentile distribution in the format of HdrHistogram outputPercentileDistribution, which its plotter takes
+void writeHdr(std::ostream & out, const LogLinearHistogram::Snapshot & snapshot)
+{
+    out << fmt::format("{:>12} {:>14} {:>10} {:>14}\n\n", "Value", "Percentile", "TotalCount", "1/(1-Percentile)");
+
+    UInt64 seen = 0;
+    UInt64 max = 0;
+    for (size_t bucket = 0; bucket < LogLinearHistogram::BUCKETS; ++bucket)
+    {
+        if (!snapshot.counts[bucket])
+            continue;
+        seen += snapshot.counts[bucket];
+        max = LogLinearHistogram::lowerBound(bucket) + LogLinearHistogram::width(bucket) - 1;
+        double percentile = static_cast<double>(seen) / static_cast<double>(snapshot.count);
+        if (seen == snapshot.count)
+            out << fmt::format("{:12.3f} {:1.12f} {:10d}\n", static_cast<double>(max), percentile, seen);
+        else
+            out << fmt::format("{:12.3f} {:1.12f} {:10d} {:14.2f}\n", static_cast<double>(max), percentile, seen, 1 / (1 - percentile));
+    }
+
+    double mean = snapshot.count ? static_cast<double>(snapshot.sum) / static_cast<double>(snapshot.count) : 0;
+    out << fmt::format("#[Mean    = {:12.3f}]\n", mean);
+    out << fmt::format("#[Max     = {:12.3f}, Total count    = {:12d}]\n", static_cast<double>(max), snapshot.count);
+    out << fmt::format(
+        "#[Buckets = {:12d}, SubBuckets     = {:12d}]\n", LogLinearHistogram::BUCKETS / LogLinearHistogram::SUB_BUCKETS,
+        LogLinearHistogram::SUB_BUCKETS);
+}
+
+/// Response of a 4lw command, empty if the server is not reachable
+String sendFourLetterCommand(const Poco::Net::SocketAddress & address, const String & command)
+{
+    static constexpr Int64 FOUR_LETTER_TIMEOUT_MS = 5000;
+    try
+    {
+        Poco::Net::StreamSocket socket;
+        socket.connect(address, Poco::Timespan(FOUR_LETTER_TIMEOUT_MS * 1000));
+        socket.setReceiveTimeout(Poco::Timespan(FOUR_LETTER_TIMEOUT_MS * 1000));
+        socket.sendBytes(command.data(), static_cast<int>(command.size()));
+        socket.shutdownSend();
+
+        String response;
+        std::array<char, 4096> buf;
+        int received;
+        while ((received = socket.receiveBytes(buf.data(), static_cast<int>(buf.size()))) > 0)
+            response.append(buf.data(), received);
+        return response;
+    }
+    catch (...)
+    {
+        return {};
+    }
+}
+
+/// Metrics of mntr kept in samples, and the ones of memory by component
+bool isSampledMetric(const String & key)
+{
+    static const std::set<String> sampled = {
+        "num_alive_connections", "outstanding_requests", "znode_count", "watch_count", "ephemerals_count",
+        "approximate_data_size", "open_file_descriptor_count"};
+    return sampled.contains(key) || (key.starts_with("memory_") && key.ends_with("_bytes"));
+}
+
+/// Append resources of servers and latency of the interval since the last sample as rows "elapsed,source,metric,value"
+void writeSample(std::ostream & out, double elapsed, const Options & options, const Strings & hosts, Stats & stats, double seconds)
+{
+    auto write = [&](const String & source, const String & metric, const auto & value)
+    { out << fmt::format("{:.0f},{},{},{}\n", elapsed, source, metric, value); };
+
+    for (size_t i = 0; i < hosts.size(); ++i)
+    {
+        Strings lines;
+        String mntr = sendFourLetterCommand(options.nodes[i].address, "mntr");
+        boost::split(lines, mntr, boost::is_any_of("\n"));
+        for (const auto & line : lines)
+        {
+            /// Like "zk_znode_count\t1000"
+            auto pos = line.find('\t');
+            if (!line.starts_with("zk_") || pos == String::npos || !isSampledMetric(line.substr(3, pos - 3)))
+                continue;
+            write(hosts[i], line.substr(3, pos - 3), line.substr(pos + 1));
+        }
+
+        String dirs = sendFourLetterCommand(options.nodes[i].address, "dirs");
+        boost::split(lines, dirs, boost::is_any_of("\n"));
+        for (const auto & line : lines)
+        {
+            /// Like "log_dir_size: 1024"
+            auto pos = line.find(": ");
+            if (pos != String::npos)
+                write(hosts[i], line.substr(0, pos), line.substr(pos + 2));
+        }
+    }
+
+    auto snapshot = stats.interval_latency_us.getSnapshot();
+    stats.interval_latency_us.reset();
+    write("client", "ops_per_second", fmt::format("{:.0f}", static_cast<double>(snapshot.count) / seconds));
+    write("client", "errors", stats.interval_errors.exchange(0));
+    write("client", "p50_us", fmt::format("{:.0f}", snapshot.quantile(0.5)));
+    write("client", "p99_us", fmt::format("{:.0f}", snapshot.quantile(0.99)));
+    write("client", "p999_us", fmt::format("{:.0f}", snapshot.quantile(0.999)));
+    write("client", "max_us", fmt::format("{:.0f}", snapshot.quantile(1)));
+    write("client", "watch_events", stats.watch_events.load());
+    write("client", "churned_sessions", stats.churned_sessions.load());
+    out.flush();
+}
+
+}
+
+int mainEntryRaftKeeperBench(int argc, char ** argv)
+{
+    using namespace RK;
+    namespace po = boost::program_options;
+
+    po::options_description desc = createOptionsDescription("Allowed options", getTerminalWidth());
+    auto opt_list = desc.add_options();
+
+    opt_list("help,h", "produce help message");
+    opt_list("hosts", po::value<std::string>()->default_value("localhost:8101"), "Comma separated host:port of servers");
+    opt_list("threads", po::value<size_t>()->default_value(4), "Threads issuing requests");
+    opt_list("sessions", po::value<size_t>()->default_value(16), "Sessions of a thread");
+    opt_list("rate", po::value<double>()->default_value(10000), "Requests a second of all threads, 0 for as many as max-inflight allows");
+    opt_list("max-inflight", po::value<size_t>()->default_value(64), "Requests in flight of a session");
+    opt_list("duration", po::value<double>()->default_value(60), "Seconds to run after warmup");
+    opt_list("warmup", po::value<double>()->default_value(5), "Seconds to run before measuring");
+    opt_list(
+        "mix",
+        po::value<std::string>()->default_value("mixed"),
+        "Weights of operations create, remove, get, set, list, exists, ephemeral and watch like 'get:9,set:1', or workloads "
+        "'create', 'mixed' and 'soak' of benchmark/README.md");
+    opt_list("root", po::value<std::string>()->default_value("/raftkeeper-bench"), "Node holding the nodes of benchmark");
+    opt_list("data-size", po::value<size_t>()->default_value(100), "Bytes of data of created, set and prepared nodes");
+    opt_list("nodes", po::value<size_t>()->default_value(1000), "Prepared nodes which get, set and exists pick at random");
+    opt_list("list-children", po::value<size_t>()->default_value(100), "Children of the listed node");
+    opt_list("list-child-size", po::value<size_t>()->default_value(50), "Bytes of data of a child of the listed node");
+    opt_list("batch-size", po::value<size_t>()->default_value(0), "Requests of a session sent together as a multi, 0 disables batching");
+    opt_list("batch-linger-ms", po::value<UInt64>()->default_value(0), "Milliseconds to wait for more requests to join a batch");
+    opt_list("batch-writes", "Batch writes as well as reads, a failing write fails the others of its batch");
+    opt_list("hdr-output", po::value<std::string>(), "File to write latency distribution of all requests to");
+    opt_list("cleanup", "Remove root node after benchmark");
+    opt_list("session-churn", po::value<double>()->default_value(0), "Sessions replaced a second of all threads, for soak runs");
+    opt_list("snapshot-interval", po::value<size_t>()->default_value(0), "Seconds between snapshots servers are asked to create by csnp");
+    opt_list("soak-output", po::value<std::string>(), "File to append resources of servers and latency to every sample-interval");
+    opt_list("sample-interval", po::value<size_t>()->default_value(60), "Seconds between samples of soak-output");
+
+    po::variables_map options;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
+    po::notify(options);
+
+    if (options.count("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " --hosts localhost:8101 --rate 20000 --mix create:1,set:8,get:45,list:45,remove:1"
+                  << std::endl;
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    Poco::AutoPtr<Poco::ConsoleChannel> console_channel(new Poco::ConsoleChannel);
+    Poco::Logger::root().setChannel(console_channel);
+    Poco::Logger::root().setLevel("warning");
+
+    try
+    {
+        Options bench_options;
+        String hosts = options["hosts"].as<std::string>();
+        Strings host_strings;
+        boost::split(host_strings, hosts, boost::is_any_of(","));
+        for (const auto & host : host_strings)
+            bench_options.nodes.push_back({Poco::Net::SocketAddress(host), false});
+        bench_options.threads = std::max(options["threads"].as<size_t>(), size_t(1));
+        bench_options.sessions = std::max(options["sessions"].as<size_t>(), size_t(1));
+        bench_options.rate = options["rate"].as<double>();
+        bench_options.max_inflight = std::max(options["max-inflight"].as<size_t>(), size_t(1));
+        bench_options.mix = parseMix(options["mix"].as<std::string>());
+        bench_options.root = options["root"].as<std::string>();
+        bench_options.data_size = options["data-size"].as<size_t>();
+        bench_options.nodes_count = std::max(options["nodes"].as<size_t>(), size_t(1));
+        bench_options.list_children = options["list-children"].as<size_t>();
+        bench_options.list_child_size = options["list-child-size"].as<size_t>();
+        bench_options.session_churn = options["session-churn"].as<double>();
+        bench_options.batching.max_batch_size = options["batch-size"].as<size_t>();
+        bench_options.batching.linger_ms = options["batch-linger-ms"].as<UInt64>();
+        bench_options.batching.batch_writes = options.count("batch-writes");
+
+        prepare(bench_options, hosts);
+
+        Stats stats;
+        std::vector<std::unique_ptr<Worker>> workers;
+        for (size_t i = 0; i < bench_options.threads; ++i)
+            workers.push_back(std::make_unique<Worker>(bench_options, i, stats));
+
+        auto to_duration
+            = [](double seconds) { return std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds)); };
+        auto start = Clock::now();
+        auto measure_start = start + to_duration(options["warmup"].as<double>());
+        auto end = measure_start + to_duration(options["duration"].as<double>());
+
+        std::vector<std::thread> threads;
+        for (auto & worker : workers)
+            threads.emplace_back([&worker, start, end] { worker->run(start, end); });
+
+        size_t snapshot_interval = options["snapshot-interval"].as<size_t>();
+        size_t sample_interval = std::max(options["sample-interval"].as<size_t>(), size_t(1));
+        std::ofstream soak_out;
+        if (options.count("soak-output"))
+        {
+            soak_out.open(options["soak-output"].as<std::string>());
+            soak_out << "elapsed,source,metric,value\n";
+        }
+
+        std::this_thread::sleep_until(measure_start);
+        stats.reset();
+
+        /// Progress once a second
+        UInt64 last_count = 0;
+        size_t second = 0;
+        for (auto next = measure_start + std::chrono::seconds(1); next <= end; next += std::chrono::seconds(1))
+        {
+            std::this_thread::sleep_until(next);
+            ++second;
+            auto snapshot = stats.latency_us[OP_COUNT]->getSnapshot();
+            std::cerr << fmt::format(
+                "{:.0f}s: {} ops/s, p99 {:.0f}us\n",
+                std::chrono::duration<double>(next - measure_start).count(),
+                snapshot.count - last_count,
+                snapshot.quantile(0.99));
+            last_count = snapshot.count;
+
+            if (snapshot_interval && second % snapshot_interval == 0)
+                for (const auto & node : bench_options.nodes)
+                    sendFourLetterCommand(node.address, "csnp");
+            if (soak_out.is_open() && second % sample_interval == 0)
+                writeSample(
+                    soak_out, static_cast<double>(second), bench_options, host_strings, stats, static_cast<double>(sample_interval));
+        }
+
+        for (auto & thread : threads)
+            thread.join();
+        for (auto & worker : workers)
+            worker->finish();
+        double seconds = std::chrono::duration<double>(Clock::now() - measure_start).count();
+
+        printSummary(stats, seconds);
+
+        auto snapshot = stats.latency_us[OP_COUNT]->getSnapshot();
+        if (options.count("hdr-output"))
+        {
+            std::ofstream out(options["hdr-output"].as<std::string>());
+            writeHdr(out, snapshot);
+        }
+        else
+        {
+            std::cout << '\n';
+            writeHdr(std::cout, snapshot);
+        }
+
+        workers.clear();
+        if (options.count("cleanup"))
+            zkutil::ZooKeeper(hosts).tryRemoveRecursive(bench_options.root);
+    }
+    catch (...)
+    {
+        std::cerr << getCurrentExceptionMessage(true) << '\n';
+        return getCurrentExceptionCode();
+    }
+
+    return 0;
+}
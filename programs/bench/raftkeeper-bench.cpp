@@ -0,0 +1,5 @@
+int mainEntryRaftKeeperBench(int argc, char ** argv);
+int main(int argc_, char ** argv_)
+{
+    return mainEntryRaftKeeperBench(argc_, argv_);
+}
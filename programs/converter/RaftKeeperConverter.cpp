@@ -1,3 +1,5 @@
+#include <atomic>
+#include <csignal>
 #include <iostream>
 #include <optional>
 #include <boost/program_options.hpp>
@@ -8,6 +10,18 @@
 #include <Poco/ConsoleChannel.h>
 #include <Poco/Logger.h>
 
+namespace
+{
+
+/// Set by SIGINT or SIGTERM, which is the cutover of following ZooKeeper logs
+std::atomic<bool> cutover_requested{false};
+
+void requestCutover(int)
+{
+    cutover_requested = true;
+}
+
+}
 
 int mainEntryRaftKeeperConverter(int argc, char ** argv)
 {
@@ -21,6 +35,12 @@ int mainEntryRaftKeeperConverter(int argc, char ** argv)
     opt_list("zookeeper-logs-dir", po::value<std::string>(), "Path to directory with ZooKeeper logs");
     opt_list("zookeeper-snapshots-dir", po::value<std::string>(), "Path to directory with ZooKeeper snapshots");
     opt_list("output-dir", po::value<std::string>(), "Directory to place output raftkeeper snapshot");
+    opt_list(
+        "follow",
+        po::bool_switch()->default_value(false),
+        "Follow logs of a running ZooKeeper until SIGINT or SIGTERM, so that migration needs downtime only for the rest of "
+        "logs and writing snapshot");
+    opt_list("follow-interval-ms", po::value<UInt64>()->default_value(100), "Interval of polling logs when following ZooKeeper");
 
     po::variables_map options;
     po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
@@ -53,7 +73,20 @@ int mainEntryRaftKeeperConverter(int argc, char ** argv)
             store.getSessionCount(),
             store.getSessionIDCounter(),
             store.getZxid());
-        RK::deserializeLogsAndApplyToStore(store, options["zookeeper-logs-dir"].as<std::string>(), logger);
+        if (options["follow"].as<bool>())
+        {
+            std::signal(SIGINT, requestCutover);
+            std::signal(SIGTERM, requestCutover);
+            std::cout << "Following ZooKeeper logs, stop ZooKeeper and send SIGINT or SIGTERM to cut over" << std::endl;
+            RK::followLogsAndApplyToStore(
+                store,
+                options["zookeeper-logs-dir"].as<std::string>(),
+                [] { return cutover_requested.load(); },
+                options["follow-interval-ms"].as<UInt64>(),
+                logger);
+        }
+        else
+            RK::deserializeLogsAndApplyToStore(store, options["zookeeper-logs-dir"].as<std::string>(), logger);
         LOG_INFO(
             logger,
             "Deserialize logs to store done: nodes {}, ephemeral nodes {}, sessions {}, session_id_counter {}, zxid {}",
@@ -65,7 +98,10 @@ int mainEntryRaftKeeperConverter(int argc, char ** argv)
         nuraft::ptr<snapshot> new_snapshot(nuraft::cs_new<snapshot>(store.getZxid(), 1, std::make_shared<nuraft::cluster_config>()));
         nuraft::ptr<KeeperSnapshotManager> snap_mgr = nuraft::cs_new<KeeperSnapshotManager>(
             options["output-dir"].as<std::string>(), 3600 * 1, MAX_OBJECT_NODE_SIZE);
-        snap_mgr->createSnapshot(*new_snapshot, store, store.getZxid(), store.getSessionIDCounter());
+        /// Buckets of data tree are written to objects in parallel
+        nuraft::async_result<bool>::handler_type when_done = [](bool &, nuraft::ptr<std::exception> &) { };
+        SnapTask snap_task(new_snapshot, store, when_done);
+        snap_mgr->createSnapshotAsync(snap_task);
         std::cout << "Snapshot serialized to path:" << options["output-dir"].as<std::string>() << std::endl;
     }
     catch (...)
@@ -14,6 +14,8 @@
 
 int mainEntryRaftKeeperServer(int argc, char ** argv);
 int mainEntryRaftKeeperConverter(int argc, char ** argv);
+int mainEntryRaftKeeperBench(int argc, char ** argv);
+int mainEntryRaftKeeperReplay(int argc, char ** argv);
 
 namespace
 {
@@ -25,6 +27,8 @@ using MainFunc = int (*)(int, char **);
 std::pair<const char *, MainFunc> raftkeeper_applications[] = {
     {"server", mainEntryRaftKeeperServer},
     {"converter", mainEntryRaftKeeperConverter},
+    {"bench", mainEntryRaftKeeperBench},
+    {"replay", mainEntryRaftKeeperReplay},
 };
 
 
@@ -0,0 +1,275 @@
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <Common/Exception.h>
+#include <Common/IO/ReadBufferFromMemory.h>
+#include <Common/LogLinearHistogram.h>
+#include <Common/TerminalSize.h>
+#include <fmt/format.h>
+#include <Service/RequestCapture.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+#include <ZooKeeper/ZooKeeperImpl.h>
+#include <Poco/AutoPtr.h>
+#include <Poco/ConsoleChannel.h>
+#include <Poco/Logger.h>
+
+/** Replayer of requests captured by RequestCapture, see 4lw command cpon. Every captured session is a session of the
+  * replay opened by its first request, and a request is sent at its captured time since the start, divided by speed,
+  * whether the previous ones are answered or not. Close requests close the session, heartbeats, auth and set watches
+  * are not sent, as the client sends its own.
+  *
+  * Paths are replayed as captured, so the cluster should have the tree the captured cluster had, like restored from its
+  * snapshot. Latency is measured from the time a request is due, and lag is how late it is sent, which is the replayer
+  * not keeping up. Latencies are in microseconds.
+  */
+
+namespace
+{
+
+using namespace RK;
+using Clock = std::chrono::steady_clock;
+
+struct OpStats
+{
+    LogLinearHistogram latency_us;
+    std::atomic<UInt64> errors{0};
+};
+
+class Replayer
+{
+public:
+    Replayer(const Coordination::ZooKeeper::Nodes & nodes_, double speed_, Int64 session_timeout_ms_)
+        : nodes(nodes_), speed(speed_), session_timeout_ms(session_timeout_ms_)
+    {
+    }
+
+    void run(const String & file)
+    {
+        RequestCapture::Reader reader(file);
+        RequestCapture::Record record;
+        auto start = Clock::now();
+        auto next_progress = start + std::chrono::seconds(1);
+
+        while (reader.next(record))
+        {
+            auto due = start
+                + std::chrono::duration_cast<Clock::duration>(
+                           std::chrono::duration<double, std::micro>(static_cast<double>(record.time_us) / speed));
+            std::this_thread::sleep_until(due);
+            lag_us.add(static_cast<UInt64>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count()));
+            send(record, due);
+
+            if (Clock::now() >= next_progress)
+            {
+                std::cerr << fmt::format(
+                    "{:.0f}s: {} requests, {} sessions, {} in flight, lag p99 {:.0f}us\n",
+                    std::chrono::duration<double>(Clock::now() - start).count(),
+                    sent,
+                    sessions.size(),
+                    inflight.load(),
+                    lag_us.getSnapshot().quantile(0.99));
+                next_progress += std::chrono::seconds(1);
+            }
+        }
+        seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    /// Wait for requests in flight and close sessions
+    void finish()
+    {
+        auto deadline = Clock::now() + std::chrono::milliseconds(session_timeout_ms);
+        while (inflight && Clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        sessions.clear();
+    }
+
+    void printSummary() const
+    {
+        std::cout << fmt::format("replayed {} requests in {:.1f} s, skipped {}\n", sent, seconds, skipped);
+        std::cout << fmt::format(
+            "{:<14}{:>12}{:>10}{:>10}{:>10}{:>10}{:>10}{:>10}\n", "op", "count", "errors", "p50_us", "p90_us", "p99_us", "p999_us",
+            "max_us");
+        auto print = [](const String & name, const LogLinearHistogram::Snapshot & snapshot, UInt64 errors)
+        {
+            std::cout << fmt::format(
+                "{:<14}{:>12}{:>10}{:>10.0f}{:>10.0f}{:>10.0f}{:>10.0f}{:>10.0f}\n",
+                name,
+                snapshot.count,
+                errors,
+                snapshot.quantile(0.5),
+                snapshot.quantile(0.9),
+                snapshot.quantile(0.99),
+                snapshot.quantile(0.999),
+                snapshot.quantile(1));
+        };
+        for (const auto & [opnum, op_stats] : stats)
+            print(Coordination::toString(opnum), op_stats->latency_us.getSnapshot(), op_stats->errors);
+        print("lag", lag_us.getSnapshot(), 0);
+    }
+
+private:
+    void send(const RequestCapture::Record & record, Clock::time_point due)
+    {
+        Coordination::ZooKeeperRequestPtr request;
+        try
+        {
+            ReadBufferFromMemory in(record.body.data(), record.body.size());
+            Coordination::XID xid;
+            Coordination::OpNum opnum;
+            Coordination::read(xid, in);
+            Coordination::read(opnum, in);
+
+            if (opnum == Coordination::OpNum::Heartbeat || opnum == Coordination::OpNum::Auth
+                || opnum == Coordination::OpNum::SetWatches)
+            {
+                skipped++;
+                return;
+            }
+
+            request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
+            request->readImpl(in);
+        }
+        catch (...)
+        {
+            skipped++;
+            return;
+        }
+
+        if (request->getOpNum() == Coordination::OpNum::Close)
+        {
+            /// Destroying the client closes the session
+            if (sessions.erase(record.session_id))
+                sent++;
+            else
+                skipped++;
+            return;
+        }
+        auto & zookeeper = getSession(record.session_id);
+
+        auto & op_stats = stats[request->getOpNum()];
+        if (!op_stats)
+            op_stats = std::make_unique<OpStats>();
+
+        inflight++;
+        sent++;
+        try
+        {
+            zookeeper.submit(
+                request,
+                [this, &op = *op_stats, due](const Coordination::Response & response)
+                {
+                    op.latency_us.add(
+                        static_cast<UInt64>(std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - due).count()));
+                    if (response.error != Coordination::Error::ZOK)
+                        op.errors++;
+                    inflight--;
+                },
+                {});
+        }
+        catch (...)
+        {
+            /// Callback is not invoked, the session is expired and is opened again by next request
+            op_stats->errors++;
+            inflight--;
+            sessions.erase(record.session_id);
+        }
+    }
+
+    Coordination::ZooKeeper & getSession(int64_t session_id)
+    {
+        auto & session = sessions[session_id];
+        if (!session)
+            session = std::make_unique<Coordination::ZooKeeper>(
+                nodes,
+                "",
+                "",
+                "",
+                Poco::Timespan(session_timeout_ms * 1000),
+                Poco::Timespan(CONNECTION_TIMEOUT_MS * 1000),
+                Poco::Timespan(Coordination::DEFAULT_OPERATION_TIMEOUT_MS * 1000));
+        return *session;
+    }
+
+    static constexpr Int64 CONNECTION_TIMEOUT_MS = 10000;
+
+    const Coordination::ZooKeeper::Nodes nodes;
+    const double speed;
+    const Int64 session_timeout_ms;
+
+    /// By captured session id
+    std::unordered_map<int64_t, std::unique_ptr<Coordination::ZooKeeper>> sessions;
+    /// Added by the replay thread only, callbacks keep their entry
+    std::map<Coordination::OpNum, std::unique_ptr<OpStats>> stats;
+    LogLinearHistogram lag_us;
+    std::atomic<UInt64> inflight{0};
+    UInt64 sent = 0;
+    UInt64 skipped = 0;
+    double seconds = 0;
+};
+
+}
+
+int mainEntryRaftKeeperReplay(int argc, char ** argv)
+{
+    using namespace RK;
+    namespace po = boost::program_options;
+
+    po::options_description desc = createOptionsDescription("Allowed options", getTerminalWidth());
+    auto opt_list = desc.add_options();
+
+    opt_list("help,h", "produce help message");
+    opt_list("hosts", po::value<std::string>()->default_value("localhost:8101"), "Comma separated host:port of servers");
+    opt_list("file", po::value<std::string>(), "Capture file written by 4lw command cpon");
+    opt_list("speed", po::value<double>()->default_value(1), "Times faster than captured");
+    opt_list(
+        "session-timeout-ms",
+        po::value<Int64>()->default_value(Coordination::DEFAULT_SESSION_TIMEOUT_MS),
+        "Session timeout of replayed sessions");
+
+    po::variables_map options;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
+    po::notify(options);
+
+    if (options.count("help") || !options.count("file"))
+    {
+        std::cout << "Usage: " << argv[0] << " --hosts localhost:8101 --file capture_1791966063128.bin --speed 2" << std::endl;
+        std::cout << desc << std::endl;
+        return options.count("help") ? 0 : 1;
+    }
+
+    Poco::AutoPtr<Poco::ConsoleChannel> console_channel(new Poco::ConsoleChannel);
+    Poco::Logger::root().setChannel(console_channel);
+    Poco::Logger::root().setLevel("warning");
+
+    try
+    {
+        Coordination::ZooKeeper::Nodes nodes;
+        Strings host_strings;
+        boost::split(host_strings, options["hosts"].as<std::string>(), boost::is_any_of(","));
+        for (const auto & host : host_strings)
+            nodes.push_back({Poco::Net::SocketAddress(host), false});
+
+        double speed = options["speed"].as<double>();
+        if (speed <= 0)
+            throw std::invalid_argument("Speed must be positive");
+
+        Replayer replayer(nodes, speed, options["session-timeout-ms"].as<Int64>());
+        replayer.run(options["file"].as<std::string>());
+        replayer.finish();
+        replayer.printSummary();
+    }
+    catch (...)
+    {
+        std::cerr << getCurrentExceptionMessage(true) << '\n';
+        return getCurrentExceptionCode();
+    }
+
+    return 0;
+}
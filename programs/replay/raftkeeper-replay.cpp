@@ -0,0 +1,5 @@
+int mainEntryRaftKeeperReplay(int argc, char ** argv);
+int main(int argc_, char ** argv_)
+{
+    return mainEntryRaftKeeperReplay(argc_, argv_);
+}
@@ -1,14 +1,19 @@
 #include "Server.h"
 
+#include <algorithm>
+#include <filesystem>
 #include <memory>
+#include <mutex>
 #include <sys/resource.h>
 
 #include <Poco/Net/HTTPServer.h>
+#include <Poco/Net/HTTPServerParams.h>
 #include <Poco/Net/NetException.h>
 #include <Poco/Util/HelpFormatter.h>
 
 #include <Common/Config/ConfigReloader.h>
 #include <Common/CurrentMetrics.h>
+#include <Common/HugePages.h>
 #include <Network/SocketAcceptor.h>
 #include <Common/config_version.h>
 #include <Common/getExecutablePath.h>
@@ -19,6 +24,8 @@
 #include <Service/Context.h>
 #include <Service/ForwardConnectionHandler.h>
 #include <Service/FourLetterCommand.h>
+#include <Service/PrometheusMetricsWriter.h>
+#include <Service/TLSContext.h>
 #include <ZooKeeper/ZooKeeper.h>
 #include <ZooKeeper/ZooKeeperNodeCache.h>
 
@@ -27,6 +34,52 @@ namespace RK
 namespace ErrorCodes
 {
     extern const int NETWORK_ERROR;
+    extern const int INVALID_CONFIG_PARAMETER;
+}
+
+namespace
+{
+
+/// Create listeners on address and io reactors serving them. If listener_count is more than 1, every listener is bound
+/// with SO_REUSEPORT and has its own accept reactor, so the kernel balances new connections between listeners.
+/// io_thread_count reactors are divided between listeners. If next_cpu is not negative, the reactors are bound to
+/// cpus from it, and it is moved past them.
+template <class ServiceHandler>
+void createListeners(
+    const String & name,
+    Context & context,
+    const Poco::Net::SocketAddress & address,
+    size_t listener_count,
+    size_t io_thread_count,
+    const Poco::Timespan & timeout,
+    const typename SocketAcceptor<ServiceHandler>::SocketConfigurator & socket_configurator,
+    int & next_cpu,
+    std::vector<AsyncSocketReactorPtr> & accept_reactors,
+    std::vector<std::shared_ptr<SocketAcceptor<ServiceHandler>>> & acceptors)
+{
+    if (io_thread_count == 0)
+        throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "IO thread count of {} can not be 0", name);
+    listener_count = std::clamp(listener_count, size_t(1), io_thread_count);
+
+    for (size_t i = 0; i < listener_count; ++i)
+    {
+        Poco::Net::ServerSocket socket;
+        socket.bind(address, true, listener_count > 1);
+        socket.listen();
+        socket.setBlocking(false);
+
+        String suffix = listener_count > 1 ? "#" + std::to_string(i) : "";
+        accept_reactors.push_back(std::make_shared<AsyncSocketReactor>(timeout, "IO-" + name + "Acptr" + suffix));
+
+        size_t worker_count = io_thread_count / listener_count + (i < io_thread_count % listener_count);
+        acceptors.push_back(std::make_shared<SocketAcceptor<ServiceHandler>>(
+            "IO-" + name + "Hdlr" + suffix, context, socket, accept_reactors.back(), timeout, worker_count, socket_configurator, next_cpu));
+
+        if (next_cpu >= 0)
+            next_cpu = static_cast<int>((static_cast<size_t>(next_cpu) + worker_count) % Poco::Environment::processorCount());
+    }
+}
+
 }
 
 
@@ -143,66 +196,161 @@ int Server::main(const std::vector<std::string> & /*args*/)
     /// Init global thread pool
     GlobalThreadPool::initialize(config().getUInt("max_thread_pool_size", 1000));
 
+    /// Before the data tree is loaded by dispatcher
+    HugePages::setMode(HugePages::parseMode(config().getString("keeper.data_tree_huge_pages", "none")));
+
+    /// Forwarding connections are set up by dispatcher
+    TLSContext::instance().initialize(config());
+
     global_context.initializeDispatcher();
     FourLetterCommandFactory::registerCommands(*global_context.getDispatcher());
 
+    /// Reactors of client, forwarding and unix socket ports
+    PollSet::setDefaultBackend(PollSet::parseBackend(config().getString("keeper.network_reactor", "epoll")));
+
     uint64_t operation_timeout_ms
         = global_context.getConfigRef().getUInt("keeper.raft_settings.operation_timeout_ms", Coordination::DEFAULT_OPERATION_TIMEOUT_MS);
 
     /// start server
-    AsyncSocketReactorPtr server;
-    std::shared_ptr<SocketAcceptor<ConnectionHandler>> conn_acceptor;
+    std::vector<AsyncSocketReactorPtr> servers;
+    std::vector<std::shared_ptr<SocketAcceptor<ConnectionHandler>>> conn_acceptors;
     int32_t port = config().getInt("keeper.port", 8101);
 
     auto cpu_core_size = getNumberOfPhysicalCPUCores();
+    size_t io_thread_count = config().getUInt("keeper.io_thread_count", cpu_core_size);
+    size_t listener_count = config().getUInt("keeper.listener_count", 1);
 
-    auto socket_configurator = [&global_context](StreamSocket & sock)
+    /// Io reactors of client port take cpus from 0, the ones of forwarding port and unix socket follow them.
+    int next_cpu = config().getBool("keeper.io_thread_cpu_affinity", false) ? 0 : -1;
+
+    auto socket_configurator = [&global_context, log](StreamSocket & sock)
     {
         bool no_delay = global_context.getConfigRef().getBool("keeper.socket_option_no_delay", false);
         sock.setNoDelay(no_delay);
         sock.setBlocking(false);
+
+        if (int busy_poll_us = global_context.getConfigRef().getInt("keeper.busy_poll_us", 0))
+        {
+#if defined(SO_BUSY_POLL)
+            if (setsockopt(sock.impl()->sockfd(), SOL_SOCKET, SO_BUSY_POLL, &busy_poll_us, sizeof(busy_poll_us)))
+            {
+                static std::once_flag warned;
+                std::call_once(warned, [&] { LOG_WARNING(log, "Cannot set SO_BUSY_POLL of socket, errno {}", errno); });
+            }
+#endif
+        }
     };
 
+    Poco::Timespan timeout(operation_timeout_ms * 1000);
+
     createServer(
         listen_host,
         port,
         listen_try,
         [&](UInt16 listen_port)
         {
-            Poco::Net::ServerSocket socket(listen_port);
-            socket.setBlocking(false);
-
-            Poco::Timespan timeout(operation_timeout_ms * 1000);
-            server = std::make_shared<AsyncSocketReactor>(timeout, "IO-Acptr");
-
-            /// TODO add io thread count to config
-            conn_acceptor = std::make_shared<SocketAcceptor<ConnectionHandler>>(
-                "IO-Hdlr", global_context, socket, server, timeout, cpu_core_size, socket_configurator);
-            LOG_INFO(log, "Listening for user connections on {}", socket.address().toString());
+            createListeners<ConnectionHandler>(
+                "",
+                global_context,
+                Poco::Net::SocketAddress(listen_port),
+                listener_count,
+                io_thread_count,
+                timeout,
+                socket_configurator,
+                next_cpu,
+                servers,
+                conn_acceptors);
+            LOG_INFO(
+                log,
+                "Listening for user connections on port {} with {} listeners and {} io threads",
+                listen_port,
+                conn_acceptors.size(),
+                io_thread_count);
         });
 
     /// start forwarding server
-    AsyncSocketReactorPtr forwarding_server;
-    std::shared_ptr<SocketAcceptor<ForwardConnectionHandler>> forwarding_conn_acceptor;
+    std::vector<AsyncSocketReactorPtr> forwarding_servers;
+    std::vector<std::shared_ptr<SocketAcceptor<ForwardConnectionHandler>>> forwarding_conn_acceptors;
     int32_t forwarding_port = config().getInt("keeper.forwarding_port", 8102);
 
+    size_t forwarding_io_thread_count = config().getUInt("keeper.forwarding_io_thread_count", cpu_core_size);
+    size_t forwarding_listener_count = config().getUInt("keeper.forwarding_listener_count", 1);
+
     createServer(
         listen_host,
         forwarding_port,
         listen_try,
         [&](UInt16 listen_port)
         {
-            Poco::Net::ServerSocket socket(listen_port);
-            socket.setBlocking(false);
+            createListeners<ForwardConnectionHandler>(
+                "Fwd",
+                global_context,
+                Poco::Net::SocketAddress(listen_port),
+                forwarding_listener_count,
+                forwarding_io_thread_count,
+                timeout,
+                socket_configurator,
+                next_cpu,
+                forwarding_servers,
+                forwarding_conn_acceptors);
+            LOG_INFO(
+                log,
+                "Listening for forwarding connections on port {} with {} listeners and {} io threads",
+                listen_port,
+                forwarding_conn_acceptors.size(),
+                forwarding_io_thread_count);
+        });
 
-            Poco::Timespan timeout(operation_timeout_ms * 1000);
-            forwarding_server = std::make_shared<AsyncSocketReactor>(timeout, "IO-FwdAcptr");
+    /// Unix domain socket for clients on the same host, its connections are served like the ones of client port.
+    String unix_socket_path = config().getString("keeper.unix_socket_path", "");
+    if (!unix_socket_path.empty())
+    {
+        /// Socket file left by last run, binding fails if it exists
+        if (std::filesystem::is_socket(unix_socket_path))
+            std::filesystem::remove(unix_socket_path);
+
+        size_t unix_socket_io_thread_count = config().getUInt("keeper.unix_socket_io_thread_count", 1);
+        auto unix_socket_configurator = [](StreamSocket & sock) { sock.setBlocking(false); };
+
+        createListeners<ConnectionHandler>(
+            "Unix",
+            global_context,
+            Poco::Net::SocketAddress(Poco::Net::SocketAddress::UNIX_LOCAL, unix_socket_path),
+            1,
+            unix_socket_io_thread_count,
+            timeout,
+            unix_socket_configurator,
+            next_cpu,
+            servers,
+            conn_acceptors);
+        LOG_INFO(log, "Listening for user connections on unix socket {} with {} io threads", unix_socket_path, unix_socket_io_thread_count);
+    }
 
-            /// TODO add io thread count to config
-            forwarding_conn_acceptor = std::make_shared<SocketAcceptor<ForwardConnectionHandler>>(
-                "IO-FwdHdlr", global_context, socket, forwarding_server, timeout, cpu_core_size, socket_configurator);
-            LOG_INFO(log, "Listening for forwarding connections on {}", socket.address().toString());
-        });
+    /// Prometheus metrics are served by HTTP threads of their own rather than IO reactors
+    std::unique_ptr<Poco::Net::HTTPServer> prometheus_server;
+    if (config().has("keeper.prometheus.port"))
+    {
+        int prometheus_port = config().getInt("keeper.prometheus.port");
+        String endpoint = config().getString("keeper.prometheus.endpoint", "/metrics");
+
+        createServer(
+            listen_host,
+            prometheus_port,
+            listen_try,
+            [&](UInt16 listen_port)
+            {
+                Poco::Net::ServerSocket socket(Poco::Net::SocketAddress(listen_host, listen_port));
+                Poco::Net::HTTPServerParams::Ptr params = new Poco::Net::HTTPServerParams;
+                params->setMaxThreads(config().getInt("keeper.prometheus.threads", 2));
+                params->setTimeout(timeout);
+                params->setKeepAlive(true);
+
+                prometheus_server = std::make_unique<Poco::Net::HTTPServer>(
+                    new PrometheusRequestHandlerFactory(*global_context.getDispatcher(), endpoint), socket, params);
+                prometheus_server->start();
+                LOG_INFO(log, "Listening for Prometheus metrics on port {} endpoint {}", listen_port, endpoint);
+            });
+    }
 
     zkutil::EventPtr unused_event = std::make_shared<Poco::Event>();
     zkutil::ZooKeeperNodeCache unused_cache([] { return nullptr; });
@@ -236,12 +384,21 @@ int Server::main(const std::vector<std::string> & /*args*/)
 
         /// shutdown TCP servers
         LOG_INFO(log, "Waiting for current connections to close.");
-        if (server)
+        for (auto & server : servers)
             server->stop();
 
-        if (forwarding_server)
+        for (auto & forwarding_server : forwarding_servers)
             forwarding_server->stop();
 
+        if (prometheus_server)
+            prometheus_server->stop();
+
+        if (!unix_socket_path.empty())
+        {
+            std::error_code ec;
+            std::filesystem::remove(unix_socket_path, ec);
+        }
+
         LOG_INFO(log, "RaftKeeper shutdown gracefully.");
         _exit(Application::EXIT_OK);
     });
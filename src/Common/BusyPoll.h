@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <optional>
+
+#if defined(__x86_64__)
+#    include <immintrin.h>
+#endif
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Busy polling trades cpu for latency. Before a thread parks on a condition variable or blocks in epoll_wait,
+  * it spins checking whether there is anything to do for up to the budget, so that a request hopping between
+  * pipeline threads does not pay a wake up at every hop.
+  *
+  * The budget is process wide, it is set once at startup. 0 means disabled, which is the default.
+  */
+class BusyPoll
+{
+public:
+    static void setBudget(UInt64 microseconds) { budget_microseconds.store(microseconds, std::memory_order_relaxed); }
+
+    static UInt64 budget() { return budget_microseconds.load(std::memory_order_relaxed); }
+
+    static bool enabled() { return budget() != 0; }
+
+    /// Spin until done returns true or the budget expires, the spin is also bounded by timeout if any.
+    /// Returns whether done returned true.
+    template <typename Done>
+    static bool spin(Done && done, std::optional<UInt64> timeout_milliseconds = std::nullopt)
+    {
+        UInt64 spin_microseconds = budget();
+        if (!spin_microseconds)
+            return false;
+        if (timeout_milliseconds)
+            spin_microseconds = std::min(spin_microseconds, *timeout_milliseconds * 1000);
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(spin_microseconds);
+        for (size_t i = 1;; ++i)
+        {
+            if (done())
+                return true;
+            /// Reading clock is not free, check it once in a while
+            if (i % CLOCK_CHECK_INTERVAL == 0 && std::chrono::steady_clock::now() >= deadline)
+                return false;
+            pause();
+        }
+    }
+
+private:
+    static constexpr size_t CLOCK_CHECK_INTERVAL = 16;
+
+    static inline std::atomic<UInt64> budget_microseconds{0};
+
+    static void pause()
+    {
+#if defined(__x86_64__)
+        _mm_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#endif
+    }
+};
+
+}
@@ -0,0 +1,78 @@
+#include <Common/CoarseClock.h>
+
+#include <Common/Stopwatch.h>
+#include <Common/setThreadName.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+CoarseClock & CoarseClock::instance()
+{
+    static CoarseClock clock;
+    return clock;
+}
+
+CoarseClock::~CoarseClock()
+{
+    shutdown();
+}
+
+UInt64 CoarseClock::readRealtimeMilliseconds()
+{
+    return clock_gettime_ns(CLOCK_REALTIME) / 1000000;
+}
+
+UInt64 CoarseClock::readMonotonicMilliseconds()
+{
+    return clock_gettime_ns(CLOCK_MONOTONIC) / 1000000;
+}
+
+void CoarseClock::initialize(UInt64 resolution_ms_)
+{
+    shutdown();
+
+    {
+        std::lock_guard lock(mutex);
+        resolution_ms = resolution_ms_;
+        shutdown_called = false;
+    }
+
+    if (!resolution_ms)
+        return;
+
+    /// Cached before the thread starts, so that reads after initialize do not go back to the clocks
+    realtime_ms.store(readRealtimeMilliseconds(), std::memory_order_relaxed);
+    monotonic_ms.store(readMonotonicMilliseconds(), std::memory_order_relaxed);
+    update_thread = ThreadFromGlobalPool([this] { updateThread(); });
+    LOG_INFO(&Poco::Logger::get("CoarseClock"), "Timestamps of requests are updated every {} ms", resolution_ms);
+}
+
+void CoarseClock::shutdown()
+{
+    {
+        std::lock_guard lock(mutex);
+        shutdown_called = true;
+    }
+    cv.notify_all();
+
+    if (update_thread.joinable())
+        update_thread.join();
+
+    realtime_ms.store(0, std::memory_order_relaxed);
+    monotonic_ms.store(0, std::memory_order_relaxed);
+}
+
+void CoarseClock::updateThread()
+{
+    setThreadName("CoarseClock");
+
+    std::unique_lock lock(mutex);
+    while (!cv.wait_for(lock, std::chrono::milliseconds(resolution_ms), [this] { return shutdown_called; }))
+    {
+        realtime_ms.store(readRealtimeMilliseconds(), std::memory_order_relaxed);
+        monotonic_ms.store(readMonotonicMilliseconds(), std::memory_order_relaxed);
+    }
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <Common/ThreadPool.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/** Process-wide clock of milliseconds for timestamps which need not be precise, such as create time of requests,
+  * ctime and mtime of nodes, session expiry and deadlines. A thread updates the cached times every resolution, so
+  * reading them is a relaxed atomic load instead of a clock read per request. They lag behind at most a resolution
+  * and the time the thread waits to be scheduled.
+  *
+  * Before start and after shutdown reads fall back to the clocks, so tools and tests not starting it are precise.
+  * Timing stages of requests and tracing use microseconds and keep reading the clocks.
+  */
+class CoarseClock
+{
+public:
+    static CoarseClock & instance();
+
+    ~CoarseClock();
+
+    /// Start updating the cached times every resolution_ms, 0 stops it so that reads are precise
+    void initialize(UInt64 resolution_ms_);
+
+    void shutdown();
+
+    /// Milliseconds of system clock since epoch
+    static UInt64 nowMilliseconds()
+    {
+        UInt64 now = realtime_ms.load(std::memory_order_relaxed);
+        return now ? now : readRealtimeMilliseconds();
+    }
+
+    /// Milliseconds of monotonic clock
+    static UInt64 monotonicMilliseconds()
+    {
+        UInt64 now = monotonic_ms.load(std::memory_order_relaxed);
+        return now ? now : readMonotonicMilliseconds();
+    }
+
+    UInt64 getResolutionMs() const { return resolution_ms; }
+
+    static constexpr UInt64 DEFAULT_RESOLUTION_MS = 1;
+
+private:
+    CoarseClock() = default;
+
+    static UInt64 readRealtimeMilliseconds();
+    static UInt64 readMonotonicMilliseconds();
+
+    void updateThread();
+
+    /// 0 if the clock is not running
+    static inline std::atomic<UInt64> realtime_ms{0};
+    static inline std::atomic<UInt64> monotonic_ms{0};
+
+    UInt64 resolution_ms = 0;
+
+    ThreadFromGlobalPool update_thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool shutdown_called = false;
+};
+
+}
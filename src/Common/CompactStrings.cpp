@@ -19,7 +19,7 @@ void CompactStrings::reserve(size_t n, size_t total_size_)
     if (total_size_)
         data.reserve(total_size_);
     else
-        data.reserve(AVG_ELEMENT_SIZE_HINT * total_size_);
+        data.reserve(AVG_ELEMENT_SIZE_HINT * n);
 }
 
 StringRef CompactStrings::operator[](int64_t i) const
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include <Common/BitHelpers.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Counting Bloom filter of hashes. It answers whether a hash may have been added, a negative answer is exact.
+  *
+  * It is blocked: all counters of a hash are in one cache line, so a query costs at most one cache miss.
+  * Counters are one byte, they saturate and are never decreased after that, so removing never makes
+  * a present hash look absent, the price is a few more false positives.
+  *
+  * The filter is sized for a capacity, the owner should rebuild it with a larger one when size() exceeds it,
+  * or the false positive rate grows. With counters of 10 bytes per element it is about 2% at capacity.
+  *
+  * Not thread-safe.
+  */
+class CountingBloomFilter
+{
+public:
+    static constexpr size_t HASH_NUM = 3;
+    static constexpr size_t COUNTERS_PER_ELEMENT = 10;
+    static constexpr size_t BLOCK_SIZE = 64;
+    static constexpr size_t MIN_CAPACITY = 64;
+
+    explicit CountingBloomFilter(size_t capacity_ = MIN_CAPACITY) { reset(capacity_); }
+
+    /// Remove all hashes and resize for the capacity.
+    void reset(size_t capacity_)
+    {
+        capacity = std::max(capacity_, MIN_CAPACITY);
+        size_t block_num = roundUpToPowerOfTwoOrZero(capacity * COUNTERS_PER_ELEMENT / BLOCK_SIZE + 1);
+        counters.assign(block_num * BLOCK_SIZE, 0);
+        block_mask = block_num - 1;
+        count = 0;
+    }
+
+    void add(size_t hash)
+    {
+        UInt64 mixed = mix(hash);
+        UInt8 * block = counters.data() + blockOffset(mixed);
+        for (size_t i = 0; i < HASH_NUM; ++i)
+        {
+            UInt8 & counter = block[offsetInBlock(mixed, i)];
+            if (counter != SATURATED)
+                ++counter;
+        }
+        ++count;
+    }
+
+    /// The hash must have been added.
+    void remove(size_t hash)
+    {
+        UInt64 mixed = mix(hash);
+        UInt8 * block = counters.data() + blockOffset(mixed);
+        for (size_t i = 0; i < HASH_NUM; ++i)
+        {
+            UInt8 & counter = block[offsetInBlock(mixed, i)];
+            if (counter != SATURATED && counter != 0)
+                --counter;
+        }
+        if (count)
+            --count;
+    }
+
+    bool mayContain(size_t hash) const
+    {
+        UInt64 mixed = mix(hash);
+        const UInt8 * block = counters.data() + blockOffset(mixed);
+        for (size_t i = 0; i < HASH_NUM; ++i)
+            if (block[offsetInBlock(mixed, i)] == 0)
+                return false;
+        return true;
+    }
+
+    size_t size() const { return count; }
+    size_t getCapacity() const { return capacity; }
+    size_t getBufferSizeInBytes() const { return counters.size(); }
+
+private:
+    static constexpr UInt8 SATURATED = 255;
+
+    /// Hashes are std::hash of paths, which also choose data tree buckets by their low bits, so mix them first.
+    static UInt64 mix(UInt64 x)
+    {
+        x ^= x >> 33;
+        x *= 0xff51afd7ed558ccdULL;
+        x ^= x >> 33;
+        x *= 0xc4ceb9fe1a85ec53ULL;
+        x ^= x >> 33;
+        return x;
+    }
+
+    size_t blockOffset(UInt64 mixed) const { return (mixed & block_mask) * BLOCK_SIZE; }
+
+    /// Offsets inside the block come from the high bits of the mixed hash, which do not choose the block.
+    static size_t offsetInBlock(UInt64 mixed, size_t i) { return (mixed >> (64 - 6 * (i + 1))) & (BLOCK_SIZE - 1); }
+
+    std::vector<UInt8> counters;
+    size_t block_mask = 0;
+    size_t capacity = 0;
+    size_t count = 0;
+};
+
+}
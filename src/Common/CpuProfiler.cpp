@@ -0,0 +1,311 @@
+#include <Common/CpuProfiler.h>
+
+#include <algorithm>
+#include <random>
+#include <unordered_map>
+
+#include <time.h>
+
+#include <Common/Exception.h>
+#include <Common/ProfileEvents.h>
+#include <Common/SymbolIndex.h>
+#include <Common/setThreadName.h>
+#include <Common/thread_local_rng.h>
+#include <common/demangle.h>
+#include <common/getThreadId.h>
+#include <common/logger_useful.h>
+
+namespace ProfileEvents
+{
+    extern const Event CpuProfilerSamples;
+    extern const Event CpuProfilerDroppedSamples;
+}
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int CANNOT_SET_SIGNAL_HANDLER;
+}
+
+namespace
+{
+
+/// Index of the class the current thread is sampled as, -1 if it is not sampled. Read by the signal handler.
+thread_local int sampled_class = -1;
+
+#if defined(OS_LINUX)
+struct ThreadTimer
+{
+    timer_t id{};
+    bool created = false;
+
+    ~ThreadTimer() { destroy(); }
+
+    void destroy()
+    {
+        if (!created)
+            return;
+        timer_delete(id);
+        created = false;
+    }
+};
+
+thread_local ThreadTimer thread_timer;
+#endif
+
+timespec toTimespec(UInt64 ns)
+{
+    timespec res{};
+    res.tv_sec = static_cast<time_t>(ns / 1000000000);
+    res.tv_nsec = static_cast<long>(ns % 1000000000);
+    return res;
+}
+
+}
+
+CpuProfiler & CpuProfiler::instance()
+{
+    static CpuProfiler profiler;
+    return profiler;
+}
+
+void CpuProfiler::initialize(bool enabled_, UInt64 frequency_, size_t max_stacks_)
+{
+    shutdown();
+    collect();
+
+    {
+        std::lock_guard lock(mutex);
+        frequency = std::clamp(frequency_, UInt64(1), UInt64(1000000000));
+        max_stacks = max_stacks_;
+        stacks.clear();
+        sample_count = 0;
+        shutdown_called = false;
+    }
+
+    if (!enabled_)
+        return;
+
+#if defined(OS_LINUX)
+    static std::once_flag handler_installed;
+    std::call_once(handler_installed, []
+    {
+        struct sigaction sa{};
+        sa.sa_sigaction = signalHandler;
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        if (sigemptyset(&sa.sa_mask) || sigaction(SIGPROF, &sa, nullptr))
+            throwFromErrno("Failed to set handler of SIGPROF", ErrorCodes::CANNOT_SET_SIGNAL_HANDLER);
+    });
+
+    collect_thread = ThreadFromGlobalPool([this] { collectThread(); });
+    enabled.store(true, std::memory_order_relaxed);
+    LOG_INFO(&Poco::Logger::get("CpuProfiler"), "Sampling threads {} times a second of their cpu time", frequency);
+#else
+    LOG_WARNING(&Poco::Logger::get("CpuProfiler"), "Cpu profiler is supported only on Linux");
+#endif
+}
+
+void CpuProfiler::registerCurrentThread(const String & thread_class)
+{
+    if (!isEnabled())
+        return;
+
+#if defined(OS_LINUX)
+    auto * log = &Poco::Logger::get("CpuProfiler");
+    size_t index;
+    UInt64 period_ns;
+    {
+        std::lock_guard lock(mutex);
+        auto it = std::find(thread_classes.begin(), thread_classes.end(), thread_class);
+        if (it == thread_classes.end())
+        {
+            if (thread_classes.size() >= MAX_THREAD_CLASSES)
+            {
+                LOG_WARNING(log, "Too many thread classes, threads of {} are not sampled", thread_class);
+                return;
+            }
+            it = thread_classes.insert(thread_classes.end(), thread_class);
+        }
+        index = static_cast<size_t>(it - thread_classes.begin());
+        period_ns = 1000000000 / frequency;
+    }
+
+    if (!thread_timer.created)
+    {
+        sigevent sev{};
+        sev.sigev_notify = SIGEV_THREAD_ID;
+        sev.sigev_signo = SIGPROF;
+        sev._sigev_un._tid = static_cast<pid_t>(getThreadId());
+        if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &thread_timer.id))
+        {
+            LOG_WARNING(log, "Failed to create timer for thread of {}, errno {}", thread_class, errno);
+            return;
+        }
+        thread_timer.created = true;
+
+        /// First sample at random, so that threads doing the same work are not sampled at the same points of it
+        itimerspec spec{};
+        spec.it_value = toTimespec(std::uniform_int_distribution<UInt64>(1, period_ns)(thread_local_rng));
+        spec.it_interval = toTimespec(period_ns);
+        if (timer_settime(thread_timer.id, 0, &spec, nullptr))
+        {
+            LOG_WARNING(log, "Failed to start timer for thread of {}, errno {}", thread_class, errno);
+            thread_timer.destroy();
+            return;
+        }
+    }
+    sampled_class = static_cast<int>(index);
+#else
+    UNUSED(thread_class);
+#endif
+}
+
+void CpuProfiler::unregisterCurrentThread()
+{
+    if (sampled_class < 0)
+        return;
+    sampled_class = -1;
+#if defined(OS_LINUX)
+    thread_timer.destroy();
+#endif
+}
+
+void CpuProfiler::signalHandler(int, siginfo_t *, void * context)
+{
+    int thread_class = sampled_class;
+    if (thread_class < 0 || !instance().isEnabled())
+        return;
+
+    auto saved_errno = errno;
+
+    const StackTrace stack_trace(*reinterpret_cast<const ucontext_t *>(context));
+    Sample sample;
+    sample.thread_class = static_cast<UInt8>(thread_class);
+    sample.size = static_cast<UInt8>(stack_trace.getSize() - stack_trace.getOffset());
+    std::copy_n(stack_trace.getFramePointers().begin() + stack_trace.getOffset(), sample.size, sample.frames.begin());
+
+    if (instance().samples.tryPush(sample))
+        ProfileEvents::increment(ProfileEvents::CpuProfilerSamples);
+    else
+        ProfileEvents::increment(ProfileEvents::CpuProfilerDroppedSamples);
+
+    errno = saved_errno;
+}
+
+void CpuProfiler::collectThread()
+{
+    setThreadName("CpuProfiler");
+
+    bool stop = false;
+    while (!stop)
+    {
+        {
+            std::unique_lock lock(mutex);
+            stop = cv.wait_for(lock, std::chrono::milliseconds(COLLECT_INTERVAL_MS), [this] { return shutdown_called; });
+        }
+        collect();
+    }
+}
+
+void CpuProfiler::collect()
+{
+    std::lock_guard lock(mutex);
+    Sample sample;
+    while (samples.tryPop(sample))
+    {
+        /// Captured from innermost, folded stacks start from outermost
+        std::pair<UInt8, std::vector<void *>> key{sample.thread_class, {}};
+        key.second.assign(sample.frames.rend() - sample.size, sample.frames.rend());
+
+        auto it = stacks.find(key);
+        if (it != stacks.end())
+            ++it->second;
+        else if (stacks.size() < max_stacks)
+            stacks.emplace(std::move(key), 1);
+        else
+            /// Stacks over max_stacks are counted as an empty stack of their class
+            ++stacks[{sample.thread_class, {}}];
+        ++sample_count;
+    }
+}
+
+String CpuProfiler::getFoldedStacks()
+{
+    collect();
+
+    std::vector<std::pair<std::pair<UInt8, std::vector<void *>>, UInt64>> res;
+    std::vector<String> classes;
+    {
+        std::lock_guard lock(mutex);
+        res.assign(stacks.begin(), stacks.end());
+        classes = thread_classes;
+    }
+    std::stable_sort(res.begin(), res.end(), [](const auto & lhs, const auto & rhs) { return lhs.second > rhs.second; });
+
+#if defined(__ELF__) && !defined(__FreeBSD__)
+    auto symbol_index = SymbolIndex::instance();
+#endif
+    std::unordered_map<const void *, String> symbols;
+    auto symbolize = [&](const void * address) -> const String &
+    {
+        auto [it, inserted] = symbols.try_emplace(address);
+        if (!inserted)
+            return it->second;
+#if defined(__ELF__) && !defined(__FreeBSD__)
+        if (const auto * symbol = symbol_index->findSymbol(address))
+        {
+            it->second = demangle(symbol->name);
+            return it->second;
+        }
+#endif
+        it->second = fmt::format("{}", address);
+        return it->second;
+    };
+
+    String folded;
+    for (const auto & [stack, count] : res)
+    {
+        folded += classes[stack.first];
+        if (stack.second.empty())
+            folded += ";[other]";
+        for (const void * address : stack.second)
+        {
+            folded += ';';
+            folded += symbolize(address);
+        }
+        folded += fmt::format(" {}\n", count);
+    }
+    return folded;
+}
+
+UInt64 CpuProfiler::getSampleCount()
+{
+    collect();
+    std::lock_guard lock(mutex);
+    return sample_count;
+}
+
+void CpuProfiler::reset()
+{
+    collect();
+    std::lock_guard lock(mutex);
+    stacks.clear();
+    sample_count = 0;
+}
+
+void CpuProfiler::shutdown()
+{
+    enabled.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard lock(mutex);
+        shutdown_called = true;
+    }
+    cv.notify_all();
+
+    if (collect_thread.joinable())
+        collect_thread.join();
+}
+
+}
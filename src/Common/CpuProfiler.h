@@ -0,0 +1,97 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <signal.h>
+
+#include <Common/LockFreeBoundedQueue.h>
+#include <Common/StackTrace.h>
+#include <Common/ThreadPool.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/** Sampling cpu profiler which is cheap enough to stay on. A thread registered with its class gets a timer on its own
+  * cpu time (CLOCK_THREAD_CPUTIME_ID), which sends it SIGPROF every 1/frequency seconds of cpu it uses, so idle threads
+  * are not sampled. The signal handler captures the stack into a lock free queue, a collector thread aggregates the
+  * stacks by class once a second.
+  *
+  * Stacks are exported as folded stacks, one "class;outermost;...;innermost count" line per stack, which flamegraph.pl
+  * and speedscope take as is, see 4lw command prof.
+  *
+  * Threads registered before initialize are not sampled. Sampling is supported only on Linux.
+  */
+class CpuProfiler
+{
+public:
+    static CpuProfiler & instance();
+
+    /// Samples per second of cpu time of a thread
+    void initialize(bool enabled_, UInt64 frequency_, size_t max_stacks_);
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    /// Start sampling the current thread as one of thread_class, invoked by the thread.
+    void registerCurrentThread(const String & thread_class);
+
+    /// Stop sampling the current thread, invoked by pools when a job finishes so that the next one is not sampled as
+    /// the class of the previous one. Cheap if the thread is not sampled.
+    static void unregisterCurrentThread();
+
+    /// Folded stacks of samples taken since start or reset, most sampled first
+    String getFoldedStacks();
+
+    /// Samples aggregated
+    UInt64 getSampleCount();
+
+    void reset();
+
+    void shutdown();
+
+    static constexpr UInt64 DEFAULT_FREQUENCY = 10;
+    static constexpr size_t DEFAULT_MAX_STACKS = 10000;
+
+private:
+    CpuProfiler() = default;
+
+    struct Sample
+    {
+        UInt8 thread_class = 0;
+        UInt8 size = 0;
+        std::array<void *, StackTrace::capacity> frames{};
+    };
+
+    static void signalHandler(int sig, siginfo_t * info, void * context);
+
+    void collectThread();
+    /// Move samples from queue to stacks
+    void collect();
+
+    std::atomic<bool> enabled{false};
+    UInt64 frequency = DEFAULT_FREQUENCY;
+
+    static constexpr size_t MAX_THREAD_CLASSES = 64;
+    static constexpr size_t QUEUE_SIZE = 4096;
+    static constexpr UInt64 COLLECT_INTERVAL_MS = 1000;
+
+    /// Pushed by signal handler without waiting, it never blocks as the collector does not park on it
+    LockFreeBoundedQueue<Sample> samples{QUEUE_SIZE};
+
+    std::mutex mutex;
+    std::vector<String> thread_classes;
+    size_t max_stacks = DEFAULT_MAX_STACKS;
+    /// Thread class index and frames from outermost to samples count
+    std::map<std::pair<UInt8, std::vector<void *>>, UInt64> stacks;
+    UInt64 sample_count = 0;
+
+    std::condition_variable cv;
+    bool shutdown_called = false;
+    ThreadFromGlobalPool collect_thread;
+};
+
+}
@@ -90,6 +90,8 @@
     M(79, EPOLL_CREATE)          \
     M(80, EPOLL_WAIT)          \
     M(81, POLL_EVENT)          \
+    M(82, IO_URING_INIT_FAILED)          \
+    M(83, IO_URING_SUBMIT_FAILED)          \
                                  \
     M(102, KEEPER_EXCEPTION) \
     M(103, POCO_EXCEPTION) \
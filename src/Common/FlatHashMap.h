@@ -0,0 +1,495 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <common/defines.h>
+
+#ifdef __SSE2__
+#    include <emmintrin.h>
+#endif
+
+
+namespace RK
+{
+
+/** Open addressing hash map in the spirit of Swiss tables.
+  *
+  * Slots are stored in one flat array, next to it there is an array of control bytes, one per slot.
+  * A control byte is either EMPTY, DELETED or the 7 high bits of the hash of the key in the slot.
+  * Slots are grouped by GROUP_WIDTH, a lookup walks groups in triangular order and compares
+  * the whole group of control bytes with the hash fragment at once (SSE2 if available),
+  * so the key itself is compared only for the few candidates whose fragment matched.
+  *
+  * Compared to std::unordered_map there is no heap node per entry, no bucket pointer array
+  * and no full rehash of linked lists, which makes lookups mostly a single cache miss.
+  *
+  * Note that unlike std::unordered_map references to elements are invalidated by insertions.
+  * Not thread-safe.
+  */
+template <typename Key, typename Mapped, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap
+{
+public:
+    using key_type = Key;
+    using mapped_type = Mapped;
+    using value_type = std::pair<Key, Mapped>;
+    using size_type = size_t;
+
+    static constexpr size_t GROUP_WIDTH = 16;
+
+private:
+    using Ctrl = int8_t;
+
+    static constexpr Ctrl EMPTY = -128; /// 0b10000000
+    static constexpr Ctrl DELETED = -2; /// 0b11111110
+
+    /// Bit mask of matched positions in a group.
+    using BitMask = uint32_t;
+
+    static inline bool isFull(Ctrl c) { return c >= 0; }
+
+    /// The user hash is often used by the caller to select a bucket among several maps,
+    /// so its low bits may be the same for all keys here. Mix it before splitting.
+    static inline size_t mix(size_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static inline size_t h1(size_t mixed) { return mixed >> 7; }
+    static inline Ctrl h2(size_t mixed) { return static_cast<Ctrl>(mixed & 0x7F); }
+
+    struct Group
+    {
+#ifdef __SSE2__
+        __m128i ctrl;
+
+        explicit Group(const Ctrl * pos) { ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pos)); }
+
+        BitMask match(Ctrl hash) const
+        {
+            return static_cast<BitMask>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(hash), ctrl)));
+        }
+
+        BitMask matchEmpty() const { return match(EMPTY); }
+
+        /// EMPTY and DELETED both have the sign bit set.
+        BitMask matchEmptyOrDeleted() const { return static_cast<BitMask>(_mm_movemask_epi8(ctrl)); }
+#else
+        Ctrl ctrl[GROUP_WIDTH];
+
+        explicit Group(const Ctrl * pos) { memcpy(ctrl, pos, GROUP_WIDTH); }
+
+        BitMask match(Ctrl hash) const
+        {
+            BitMask res = 0;
+            for (size_t i = 0; i < GROUP_WIDTH; ++i)
+                res |= static_cast<BitMask>(ctrl[i] == hash) << i;
+            return res;
+        }
+
+        BitMask matchEmpty() const { return match(EMPTY); }
+
+        BitMask matchEmptyOrDeleted() const
+        {
+            BitMask res = 0;
+            for (size_t i = 0; i < GROUP_WIDTH; ++i)
+                res |= static_cast<BitMask>(ctrl[i] < 0) << i;
+            return res;
+        }
+#endif
+    };
+
+    template <bool is_const>
+    class IteratorImpl
+    {
+        friend class FlatHashMap;
+        template <bool>
+        friend class IteratorImpl;
+        using Map = std::conditional_t<is_const, const FlatHashMap, FlatHashMap>;
+
+        Map * map = nullptr;
+        size_t pos = 0;
+
+        IteratorImpl(Map * map_, size_t pos_) : map(map_), pos(pos_) { skipEmpty(); }
+
+        void skipEmpty()
+        {
+            while (pos < map->capacity && !isFull(map->ctrl[pos]))
+                ++pos;
+        }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = FlatHashMap::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<is_const, const value_type *, value_type *>;
+        using reference = std::conditional_t<is_const, const value_type &, value_type &>;
+
+        IteratorImpl() = default;
+
+        /// Allow conversion iterator -> const_iterator
+        template <bool other_const, typename = std::enable_if_t<is_const && !other_const>>
+        IteratorImpl(const IteratorImpl<other_const> & other) : map(other.map), pos(other.pos) /// NOLINT
+        {
+        }
+
+        reference operator*() const { return map->slots[pos]; }
+        pointer operator->() const { return &map->slots[pos]; }
+
+        IteratorImpl & operator++()
+        {
+            ++pos;
+            skipEmpty();
+            return *this;
+        }
+
+        IteratorImpl operator++(int)
+        {
+            auto res = *this;
+            ++*this;
+            return res;
+        }
+
+        bool operator==(const IteratorImpl & rhs) const { return pos == rhs.pos && map == rhs.map; }
+        bool operator!=(const IteratorImpl & rhs) const { return !(*this == rhs); }
+    };
+
+public:
+    using iterator = IteratorImpl<false>;
+    using const_iterator = IteratorImpl<true>;
+
+    FlatHashMap() = default;
+
+    explicit FlatHashMap(size_t reserve_size) { reserve(reserve_size); }
+
+    FlatHashMap(const FlatHashMap & rhs) : hasher(rhs.hasher), key_equal(rhs.key_equal)
+    {
+        reserve(rhs.size());
+        for (const auto & [key, value] : rhs)
+            insert_or_assign(key, value);
+    }
+
+    FlatHashMap(FlatHashMap && rhs) noexcept { swap(rhs); }
+
+    FlatHashMap & operator=(FlatHashMap rhs) noexcept
+    {
+        swap(rhs);
+        return *this;
+    }
+
+    ~FlatHashMap() { destroy(); }
+
+    void swap(FlatHashMap & rhs) noexcept
+    {
+        std::swap(ctrl, rhs.ctrl);
+        std::swap(slots, rhs.slots);
+        std::swap(capacity, rhs.capacity);
+        std::swap(num_elements, rhs.num_elements);
+        std::swap(num_deleted, rhs.num_deleted);
+        std::swap(hasher, rhs.hasher);
+        std::swap(key_equal, rhs.key_equal);
+    }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, capacity); }
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, capacity); }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    size_t size() const { return num_elements; }
+    bool empty() const { return num_elements == 0; }
+
+    /// Number of slots, always a multiple of GROUP_WIDTH.
+    size_t bucket_count() const { return capacity; } /// NOLINT
+
+    iterator find(const Key & key) { return iterator(this, findIndex(key, hasher(key))); }
+    const_iterator find(const Key & key) const { return const_iterator(this, findIndex(key, hasher(key))); }
+
+    size_t count(const Key & key) const { return findIndex(key, hasher(key)) != capacity; }
+    bool contains(const Key & key) const { return count(key); }
+
+    template <typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key & key, M && value) /// NOLINT
+    {
+        return insertOrAssignHashed(key, hasher(key), std::forward<M>(value));
+    }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key & key, Args &&... args) /// NOLINT
+    {
+        return tryEmplaceHashed(key, hasher(key), std::forward<Args>(args)...);
+    }
+
+    std::pair<iterator, bool> insert(value_type && value)
+    {
+        auto [index, inserted] = findOrPrepareInsert(value.first, hasher(value.first));
+        if (inserted)
+            new (&slots[index]) value_type(std::move(value));
+        return {iterator(this, index), inserted};
+    }
+
+    Mapped & operator[](const Key & key) { return try_emplace(key).first->second; }
+
+    /// Variants with pre-computed hash, the hash must be equal to Hash()(key).
+    /// They are useful when the caller hashes the key only once for several lookups.
+    /// The key may be of another type comparable with Key, like std::string_view for String keys,
+    /// then a Key is constructed only when it is inserted.
+
+    template <typename K>
+    iterator findHashed(const K & key, size_t hash) { return iterator(this, findIndex(key, hash)); }
+    template <typename K>
+    const_iterator findHashed(const K & key, size_t hash) const { return const_iterator(this, findIndex(key, hash)); }
+
+    template <typename K, typename M>
+    std::pair<iterator, bool> insertOrAssignHashed(const K & key, size_t hash, M && value)
+    {
+        auto [index, inserted] = findOrPrepareInsert(key, hash);
+        if (inserted)
+            new (&slots[index]) value_type(key, std::forward<M>(value));
+        else
+            slots[index].second = std::forward<M>(value);
+        return {iterator(this, index), inserted};
+    }
+
+    template <typename K, typename... Args>
+    std::pair<iterator, bool> tryEmplaceHashed(const K & key, size_t hash, Args &&... args)
+    {
+        auto [index, inserted] = findOrPrepareInsert(key, hash);
+        if (inserted)
+            new (&slots[index]) value_type(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        return {iterator(this, index), inserted};
+    }
+
+    template <typename K>
+    size_t eraseHashed(const K & key, size_t hash)
+    {
+        size_t index = findIndex(key, hash);
+        if (index == capacity)
+            return 0;
+        eraseAt(index);
+        return 1;
+    }
+
+    size_t erase(const Key & key) { return eraseHashed(key, hasher(key)); }
+
+    void erase(const_iterator it) { eraseAt(it.pos); }
+
+    void clear()
+    {
+        destroy();
+        ctrl = nullptr;
+        slots = nullptr;
+        capacity = 0;
+        num_elements = 0;
+        num_deleted = 0;
+    }
+
+    void reserve(size_t n)
+    {
+        size_t required = capacityFor(n);
+        if (required > capacity)
+            resize(required);
+    }
+
+    /// Memory used by slots and control bytes.
+    size_t getBufferSizeInBytes() const { return capacity * (sizeof(value_type) + sizeof(Ctrl)); }
+
+    /// Average groups probed to find a key, 1 means every key is in the group its hash points to. It rehashes
+    /// all keys, for measuring hash functions in benchmarks and tests.
+    double averageProbeGroups() const
+    {
+        if (num_elements == 0)
+            return 0;
+
+        size_t probed = 0;
+        for (size_t i = 0; i < capacity; ++i)
+        {
+            if (!isFull(ctrl[i]))
+                continue;
+            size_t group = h1(mix(hasher(slots[i].first))) & groupMask();
+            size_t groups = 1;
+            for (size_t step = 1; group != i / GROUP_WIDTH; ++step, ++groups)
+                group = (group + step) & groupMask();
+            probed += groups;
+        }
+        return static_cast<double>(probed) / static_cast<double>(num_elements);
+    }
+
+private:
+    /// Max load factor is 7/8
+    static size_t capacityFor(size_t n)
+    {
+        size_t required = n + n / 7 + 1;
+        size_t res = GROUP_WIDTH;
+        while (res < required)
+            res <<= 1;
+        return res;
+    }
+
+    size_t growthLimit() const { return capacity - capacity / 8; }
+
+    size_t groupMask() const { return capacity / GROUP_WIDTH - 1; }
+
+    template <typename K>
+    bool keyEquals(const Key & slot_key, const K & key) const
+    {
+        if constexpr (std::is_same_v<K, Key>)
+            return key_equal(slot_key, key);
+        else
+            return slot_key == key;
+    }
+
+    /// Return slot index of the key or capacity if not found.
+    template <typename K>
+    size_t findIndex(const K & key, size_t hash) const
+    {
+        if (capacity == 0)
+            return capacity;
+
+        size_t mixed = mix(hash);
+        Ctrl fragment = h2(mixed);
+        size_t group = h1(mixed) & groupMask();
+
+        for (size_t step = 1;; ++step)
+        {
+            size_t base = group * GROUP_WIDTH;
+            Group g(ctrl + base);
+
+            for (BitMask m = g.match(fragment); m; m &= m - 1)
+            {
+                size_t index = base + __builtin_ctz(m);
+                if (likely(keyEquals(slots[index].first, key)))
+                    return index;
+            }
+
+            if (g.matchEmpty())
+                return capacity;
+
+            /// Triangular probing visits every group when the group count is a power of two.
+            group = (group + step) & groupMask();
+        }
+    }
+
+    /// Return slot index and whether the slot is free and should be constructed by caller.
+    template <typename K>
+    std::pair<size_t, bool> findOrPrepareInsert(const K & key, size_t hash)
+    {
+        size_t index = findIndex(key, hash);
+        if (index != capacity)
+            return {index, false};
+
+        if (num_elements + num_deleted + 1 > growthLimit())
+        {
+            /// Too many tombstones, just clean them without growing.
+            if (num_deleted > capacity / 4)
+                resize(capacity);
+            else
+                resize(capacity == 0 ? GROUP_WIDTH : capacity * 2);
+        }
+
+        index = findFirstNonFull(hash);
+        if (ctrl[index] == DELETED)
+            --num_deleted;
+        ctrl[index] = h2(mix(hash));
+        ++num_elements;
+        return {index, true};
+    }
+
+    size_t findFirstNonFull(size_t hash) const
+    {
+        size_t group = h1(mix(hash)) & groupMask();
+        for (size_t step = 1;; ++step)
+        {
+            size_t base = group * GROUP_WIDTH;
+            if (BitMask m = Group(ctrl + base).matchEmptyOrDeleted())
+                return base + __builtin_ctz(m);
+            group = (group + step) & groupMask();
+        }
+    }
+
+    void eraseAt(size_t index)
+    {
+        slots[index].~value_type();
+        --num_elements;
+
+        /// If the group still has an empty slot, no probe sequence has ever passed through it,
+        /// so the slot can be marked as empty instead of leaving a tombstone.
+        size_t base = index / GROUP_WIDTH * GROUP_WIDTH;
+        if (Group(ctrl + base).matchEmpty())
+        {
+            ctrl[index] = EMPTY;
+        }
+        else
+        {
+            ctrl[index] = DELETED;
+            ++num_deleted;
+        }
+    }
+
+    void resize(size_t new_capacity)
+    {
+        Ctrl * old_ctrl = ctrl;
+        value_type * old_slots = slots;
+        size_t old_capacity = capacity;
+
+        ctrl = static_cast<Ctrl *>(::operator new(new_capacity * sizeof(Ctrl)));
+        memset(ctrl, EMPTY, new_capacity);
+        slots = std::allocator<value_type>().allocate(new_capacity);
+        capacity = new_capacity;
+        num_deleted = 0;
+
+        for (size_t i = 0; i < old_capacity; ++i)
+        {
+            if (!isFull(old_ctrl[i]))
+                continue;
+
+            size_t hash = hasher(old_slots[i].first);
+            size_t index = findFirstNonFull(hash);
+            ctrl[index] = h2(mix(hash));
+            new (&slots[index]) value_type(std::move(old_slots[i]));
+            old_slots[i].~value_type();
+        }
+
+        if (old_ctrl)
+        {
+            ::operator delete(old_ctrl);
+            std::allocator<value_type>().deallocate(old_slots, old_capacity);
+        }
+    }
+
+    void destroy()
+    {
+        if (!ctrl)
+            return;
+
+        for (size_t i = 0; i < capacity; ++i)
+            if (isFull(ctrl[i]))
+                slots[i].~value_type();
+
+        ::operator delete(ctrl);
+        std::allocator<value_type>().deallocate(slots, capacity);
+    }
+
+    Ctrl * ctrl = nullptr;
+    value_type * slots = nullptr;
+    size_t capacity = 0;
+    size_t num_elements = 0;
+    size_t num_deleted = 0;
+
+    Hash hasher;
+    KeyEqual key_equal;
+};
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string_view>
+#include <city.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Hash of paths and other strings keying hot hash maps, like the data tree, watches and the response cache.
+  * CityHash64 reads a path by 16 bytes at a time and is well distributed in all bits, so both the bucket chosen by
+  * hash % buckets and the group and fragment chosen by FlatHashMap are spread evenly. It accepts std::string_view,
+  * so parts of paths hash the same as the strings copied out of them.
+  */
+struct StringHash
+{
+    using is_transparent = void;
+
+    size_t operator()(std::string_view value) const { return CityHash_v1_0_2::CityHash64(value.data(), value.size()); }
+};
+
+/// Finalizer of MurmurHash3, every bit of the result depends on every bit of x. std::hash of integers is identity.
+inline UInt64 intHash64(UInt64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/// Hash of a pair of ids. Unlike XOR of their hashes it differs for (a, b) and (b, a), and is not 0 for equal ids.
+inline size_t hashPair(UInt64 first, UInt64 second)
+{
+    return intHash64(intHash64(first) + 0x9e3779b97f4a7c15ULL + second);
+}
+
+}
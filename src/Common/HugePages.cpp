@@ -0,0 +1,112 @@
+#include <Common/HugePages.h>
+
+#include <cstdint>
+#include <new>
+#include <sys/mman.h>
+
+#include <Common/Exception.h>
+
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int BAD_ARGUMENTS;
+}
+
+namespace
+{
+    std::atomic<HugePagesMode> huge_pages_mode{HugePagesMode::NONE};
+    std::atomic<UInt64> huge_pages_hits{0};
+    std::atomic<UInt64> huge_pages_misses{0};
+
+    constexpr size_t PAGE_SIZE = 4096;
+
+#if defined(OS_LINUX)
+    void * mapExplicit(size_t size)
+    {
+        void * ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    }
+
+    void * mapTransparent(size_t size)
+    {
+        /// Map a huge page more and cut the unaligned head and tail, so that the whole block can be huge pages
+        size_t mapped_size = size + HugePages::HUGE_PAGE_SIZE;
+        void * mapped = ::mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapped == MAP_FAILED)
+            return nullptr;
+
+        char * begin = static_cast<char *>(mapped);
+        char * aligned = reinterpret_cast<char *>(
+            (reinterpret_cast<uintptr_t>(begin) + HugePages::HUGE_PAGE_SIZE - 1) & ~(HugePages::HUGE_PAGE_SIZE - 1));
+        if (aligned != begin)
+            ::munmap(begin, static_cast<size_t>(aligned - begin));
+        char * end = begin + mapped_size;
+        if (aligned + size != end)
+            ::munmap(aligned + size, static_cast<size_t>(end - aligned - size));
+
+        if (::madvise(aligned, size, MADV_HUGEPAGE) != 0)
+        {
+            ::munmap(aligned, size);
+            return nullptr;
+        }
+        return aligned;
+    }
+#endif
+}
+
+void HugePages::setMode(HugePagesMode mode)
+{
+    huge_pages_mode.store(mode, std::memory_order_relaxed);
+}
+
+HugePagesMode HugePages::getMode()
+{
+    return huge_pages_mode.load(std::memory_order_relaxed);
+}
+
+HugePagesMode HugePages::parseMode(const String & mode)
+{
+    if (mode == "none")
+        return HugePagesMode::NONE;
+    if (mode == "transparent")
+        return HugePagesMode::TRANSPARENT;
+    if (mode == "explicit")
+        return HugePagesMode::EXPLICIT;
+    throw Exception(ErrorCodes::BAD_ARGUMENTS, "Unknown huge pages mode {}, valid values are none, transparent and explicit", mode);
+}
+
+void * HugePages::allocate(size_t size, size_t alignment)
+{
+    HugePagesMode mode = getMode();
+    if (mode != HugePagesMode::NONE && alignment <= PAGE_SIZE && size % HUGE_PAGE_SIZE == 0)
+    {
+        void * ptr = nullptr;
+#if defined(OS_LINUX)
+        ptr = mode == HugePagesMode::EXPLICIT ? mapExplicit(size) : mapTransparent(size);
+#endif
+        if (ptr)
+        {
+            huge_pages_hits.fetch_add(1, std::memory_order_relaxed);
+            return ptr;
+        }
+    }
+
+    if (mode != HugePagesMode::NONE)
+        huge_pages_misses.fetch_add(1, std::memory_order_relaxed);
+    return ::operator new(size, std::align_val_t(alignment));
+}
+
+UInt64 HugePages::hits()
+{
+    return huge_pages_hits.load(std::memory_order_relaxed);
+}
+
+UInt64 HugePages::misses()
+{
+    return huge_pages_misses.load(std::memory_order_relaxed);
+}
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+enum class HugePagesMode
+{
+    /// Memory of the allocator, pages are the ones the kernel decides
+    NONE,
+    /// Anonymous mapping aligned to huge page and advised by madvise(MADV_HUGEPAGE)
+    TRANSPARENT,
+    /// Mapping from the pool of preallocated huge pages by MAP_HUGETLB (vm.nr_hugepages)
+    EXPLICIT,
+};
+
+/** Source of big long living memory blocks, like slabs of the data tree, which may be backed by huge pages.
+  *
+  * A data tree of tens of millions of nodes is spread over gigabytes, and random lookups in it miss the TLB further
+  * than they miss the cache, one huge page entry covers 512 small ones. Blocks are never returned to system.
+  *
+  * If huge pages can not be had, for example the hugetlb pool is exhausted or THP is disabled, the block falls
+  * back to allocator memory and is counted as a miss, so hits and misses show the share of blocks backed as asked.
+  */
+class HugePages
+{
+public:
+    static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    /// Should be set before the blocks are allocated, blocks allocated before are kept as they are
+    static void setMode(HugePagesMode mode);
+    static HugePagesMode getMode();
+
+    /// Parse "none", "transparent" or "explicit", throws on others
+    static HugePagesMode parseMode(const String & mode);
+
+    /// Block of size bytes aligned to alignment, size should be multiple of HUGE_PAGE_SIZE
+    static void * allocate(size_t size, size_t alignment);
+
+    /// Blocks backed by huge pages as asked by mode
+    static UInt64 hits();
+    /// Blocks fell back to allocator memory while mode is not NONE
+    static UInt64 misses();
+};
+
+}
@@ -20,6 +20,10 @@ namespace detail
     class StringHolder
     {
     protected:
+        StringHolder() = default;
+        /// Reuse memory of value_, its content is overwritten.
+        explicit StringHolder(std::string && value_) : value(std::move(value_)) { value.resize(value.capacity()); }
+
         std::string value;
     };
 }
@@ -29,6 +33,8 @@ class WriteBufferFromOwnString : public detail::StringHolder, public WriteBuffer
 {
 public:
     WriteBufferFromOwnString() : WriteBufferFromString(value) {}
+    /// Write into memory of a string no longer used, avoid allocation if it is large enough.
+    explicit WriteBufferFromOwnString(std::string && buffer) : detail::StringHolder(std::move(buffer)), WriteBufferFromString(value) {}
 
     StringRef stringRef() const { return isFinished() ? StringRef(value) : StringRef(value.data(), pos - value.data()); }
 
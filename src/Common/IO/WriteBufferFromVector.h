@@ -84,6 +84,24 @@ public:
 
     bool isFinished() const { return is_finished; }
 
+    /// Make room for n more bytes at once, so that writing them does not grow the vector step by step.
+    void reserve(size_t n)
+    {
+        if (available() >= n)
+            return;
+        if (is_finished)
+            throw Exception("WriteBufferFromVector is finished", ErrorCodes::CANNOT_WRITE_AFTER_END_OF_BUFFER);
+
+        /// Working buffer keeps its begin, so that offset and count do not change
+        size_t begin_offset = working_buffer.begin() - reinterpret_cast<Position>(vector.data());
+        size_t pos_offset = pos - reinterpret_cast<Position>(vector.data());
+        vector.resize(std::max(vector.size() * size_multiplier, pos_offset + n));
+        internal_buffer = Buffer(
+            reinterpret_cast<Position>(vector.data() + begin_offset), reinterpret_cast<Position>(vector.data() + vector.size()));
+        working_buffer = internal_buffer;
+        pos = reinterpret_cast<Position>(vector.data() + pos_offset);
+    }
+
     void restart()
     {
         if (vector.empty())
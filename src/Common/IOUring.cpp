@@ -0,0 +1,265 @@
+#if defined(OS_LINUX)
+
+#include "IOUring.h"
+#include <cstring>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <Common/Exception.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int IO_URING_INIT_FAILED;
+    extern const int IO_URING_SUBMIT_FAILED;
+}
+
+namespace
+{
+    unsigned loadAcquire(const unsigned * ptr)
+    {
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+    }
+
+    void storeRelease(unsigned * ptr, unsigned value)
+    {
+        __atomic_store_n(ptr, value, __ATOMIC_RELEASE);
+    }
+
+    template <typename T>
+    T * at(void * ring, UInt32 offset)
+    {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+}
+
+IOUring::IOUring(unsigned entries)
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    ring_fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+    if (ring_fd < 0)
+        throwFromErrno("Cannot set up io_uring", ErrorCodes::IO_URING_INIT_FAILED);
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+    auto map = [this](size_t size, off_t offset) -> void *
+    {
+        void * ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, offset);
+        return ptr == MAP_FAILED ? nullptr : ptr;
+    };
+
+    sq_ring = map(sq_ring_size, IORING_OFF_SQ_RING);
+    cq_ring = map(cq_ring_size, IORING_OFF_CQ_RING);
+    sqes = static_cast<io_uring_sqe *>(map(sqes_size, IORING_OFF_SQES));
+
+    if (!sq_ring || !cq_ring || !sqes)
+    {
+        int saved_errno = errno;
+        release();
+        errno = saved_errno;
+        throwFromErrno("Cannot map io_uring", ErrorCodes::IO_URING_INIT_FAILED);
+    }
+
+    sq_head = at<unsigned>(sq_ring, params.sq_off.head);
+    sq_tail = at<unsigned>(sq_ring, params.sq_off.tail);
+    sq_array = at<unsigned>(sq_ring, params.sq_off.array);
+    sq_mask = *at<unsigned>(sq_ring, params.sq_off.ring_mask);
+    sq_entries = params.sq_entries;
+
+    cq_head = at<unsigned>(cq_ring, params.cq_off.head);
+    cq_tail = at<unsigned>(cq_ring, params.cq_off.tail);
+    cqes = at<io_uring_cqe>(cq_ring, params.cq_off.cqes);
+    cq_mask = *at<unsigned>(cq_ring, params.cq_off.ring_mask);
+    features = params.features;
+}
+
+IOUring::~IOUring()
+{
+    release();
+}
+
+void IOUring::release()
+{
+    if (sqes)
+        munmap(sqes, sqes_size);
+    if (cq_ring)
+        munmap(cq_ring, cq_ring_size);
+    if (sq_ring)
+        munmap(sq_ring, sq_ring_size);
+    if (ring_fd >= 0)
+        close(ring_fd);
+
+    sqes = nullptr;
+    cq_ring = nullptr;
+    sq_ring = nullptr;
+    ring_fd = -1;
+}
+
+io_uring_sqe * IOUring::getSqe(UInt64 user_data)
+{
+    /// Queue is full, hand the queued requests to the kernel, it takes them right away
+    if (*sq_tail + to_submit - loadAcquire(sq_head) >= sq_entries)
+        submitUnlocked();
+
+    unsigned index = (*sq_tail + to_submit) & sq_mask;
+    io_uring_sqe * sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = user_data;
+    sq_array[index] = index;
+    ++to_submit;
+    return sqe;
+}
+
+void IOUring::prepareWritev(int fd, const iovec * vec, unsigned vec_size, UInt64 offset, UInt64 user_data, bool link, bool drain)
+{
+    std::lock_guard lock(sq_mutex);
+    io_uring_sqe * sqe = getSqe(user_data);
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->addr = reinterpret_cast<UInt64>(vec);
+    sqe->len = vec_size;
+    sqe->off = offset;
+    sqe->flags = (link ? IOSQE_IO_LINK : 0) | (drain ? IOSQE_IO_DRAIN : 0);
+}
+
+void IOUring::prepareFdatasync(int fd, UInt64 user_data, bool drain)
+{
+    std::lock_guard lock(sq_mutex);
+    io_uring_sqe * sqe = getSqe(user_data);
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    sqe->flags = drain ? IOSQE_IO_DRAIN : 0;
+}
+
+void IOUring::prepareNop(UInt64 user_data)
+{
+    std::lock_guard lock(sq_mutex);
+    io_uring_sqe * sqe = getSqe(user_data);
+    sqe->opcode = IORING_OP_NOP;
+}
+
+void IOUring::preparePoll(int fd, UInt32 poll_mask, UInt64 user_data)
+{
+    std::lock_guard lock(sq_mutex);
+    io_uring_sqe * sqe = getSqe(user_data);
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = poll_mask;
+}
+
+void IOUring::preparePollRemove(UInt64 target_user_data, UInt64 user_data)
+{
+    std::lock_guard lock(sq_mutex);
+    io_uring_sqe * sqe = getSqe(user_data);
+    sqe->opcode = IORING_OP_POLL_REMOVE;
+    sqe->fd = -1;
+    sqe->addr = target_user_data;
+}
+
+int IOUring::enter(unsigned to_submit_, unsigned min_complete, unsigned flags, const void * arg, size_t arg_size) const
+{
+    int ret;
+    do
+        ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit_, min_complete, flags, arg, arg_size));
+    while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+void IOUring::submit()
+{
+    std::lock_guard lock(sq_mutex);
+    submitUnlocked();
+}
+
+void IOUring::submitUnlocked()
+{
+    /// Publish the queued entries, the kernel reads them after it sees the tail
+    storeRelease(sq_tail, *sq_tail + to_submit);
+    to_submit = 0;
+
+    /// Entries not taken by the kernel stay in the queue if it fails, they are submitted by the next call
+    for (unsigned queued; (queued = *sq_tail - loadAcquire(sq_head)) != 0;)
+    {
+        if (enter(queued, 0, 0) < 0)
+        {
+            /// Kernel is short of memory for requests, try again
+            if (errno == EAGAIN || errno == EBUSY)
+                continue;
+            throwFromErrno("Cannot submit io_uring requests", ErrorCodes::IO_URING_SUBMIT_FAILED);
+        }
+    }
+}
+
+void IOUring::wait()
+{
+    {
+        std::lock_guard lock(cq_mutex);
+        if (loadAcquire(cq_tail) != *cq_head)
+            return;
+    }
+
+    if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+        throwFromErrno("Cannot wait for io_uring completions", ErrorCodes::IO_URING_SUBMIT_FAILED);
+}
+
+void IOUring::submitAndWait(UInt64 timeout_ms)
+{
+    unsigned queued;
+    {
+        /// Published under the mutex, the kernel takes them by any enter, so waiting does not hold up prepare*.
+        std::lock_guard lock(sq_mutex);
+        storeRelease(sq_tail, *sq_tail + to_submit);
+        to_submit = 0;
+        queued = *sq_tail - loadAcquire(sq_head);
+    }
+
+    int ret;
+    if (timeout_ms == 0)
+    {
+        ret = enter(queued, 0, IORING_ENTER_GETEVENTS);
+    }
+    else
+    {
+        {
+            std::lock_guard lock(cq_mutex);
+            if (loadAcquire(cq_tail) != *cq_head)
+                timeout_ms = 0;
+        }
+
+        __kernel_timespec ts{};
+        ts.tv_sec = static_cast<Int64>(timeout_ms / 1000);
+        ts.tv_nsec = static_cast<Int64>(timeout_ms % 1000 * 1000000);
+        io_uring_getevents_arg arg{};
+        arg.ts = reinterpret_cast<UInt64>(&ts);
+        ret = enter(queued, timeout_ms ? 1 : 0, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    /// Timed out, or the kernel is short of memory for requests and they are submitted by the next call
+    if (ret < 0 && errno != ETIME && errno != EAGAIN && errno != EBUSY)
+        throwFromErrno("Cannot wait for io_uring completions", ErrorCodes::IO_URING_SUBMIT_FAILED);
+}
+
+bool IOUring::popCompletion(UInt64 & user_data, int & result)
+{
+    std::lock_guard lock(cq_mutex);
+    unsigned head = *cq_head;
+    if (head == loadAcquire(cq_tail))
+        return false;
+
+    const io_uring_cqe & cqe = cqes[head & cq_mask];
+    user_data = cqe.user_data;
+    result = cqe.res;
+    storeRelease(cq_head, head + 1);
+    return true;
+}
+
+}
+#endif
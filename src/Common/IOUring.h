@@ -0,0 +1,101 @@
+#pragma once
+#if defined(OS_LINUX)
+
+#include <mutex>
+#include <sys/uio.h>
+#include <boost/noncopyable.hpp>
+#include <common/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+namespace RK
+{
+
+/** Minimal io_uring ring, used for asynchronous writes and fdatasync of Raft log segments, and for polling sockets
+  * of network reactors.
+  *
+  * It talks to the kernel with raw syscalls, no liburing is needed. The constructor throws if the kernel
+  * does not have io_uring (before 5.1) or it is disabled, callers then fall back to plain writes.
+  * Requests are queued by prepare* and handed to the kernel by submit, or by prepare* when the queue
+  * is full. Completions are taken by popCompletion.
+  *
+  * Thread-safe, submitting and reaping are protected by separate mutexes, so one thread may wait for
+  * completions while another submits.
+  */
+class IOUring : private boost::noncopyable
+{
+public:
+    explicit IOUring(unsigned entries);
+    ~IOUring();
+
+    /// Queue a writev of the buffers at the offset, buffers must be alive until completion.
+    /// If link, the next request starts only after this one succeeds, otherwise it is canceled.
+    /// If drain, the request starts only after all requests submitted before complete.
+    void prepareWritev(int fd, const iovec * vec, unsigned vec_size, UInt64 offset, UInt64 user_data, bool link, bool drain);
+
+    /// Queue an fdatasync of the file, see prepareWritev for drain.
+    void prepareFdatasync(int fd, UInt64 user_data, bool drain);
+
+    /// Queue a request doing nothing, it is used to wake up a waiting thread.
+    void prepareNop(UInt64 user_data);
+
+    /// Queue a one shot poll of the fd for poll_mask (POLLIN, POLLOUT), result is the events happened.
+    void preparePoll(int fd, UInt32 poll_mask, UInt64 user_data);
+
+    /// Queue canceling the poll queued with target_user_data, the poll completes with -ECANCELED.
+    void preparePollRemove(UInt64 target_user_data, UInt64 user_data);
+
+    /// Hand queued requests to the kernel, throws on error. Requests not taken are submitted again by the next call.
+    void submit();
+
+    /// Wait until there is at least one completion, throws on error.
+    void wait();
+
+    /// Hand queued requests to the kernel and wait for at least one completion by one syscall, at most timeout_ms.
+    /// If timeout_ms is 0 it does not wait. Needs IORING_FEAT_EXT_ARG (5.11), throws on error.
+    void submitAndWait(UInt64 timeout_ms);
+
+    /// Take a completion, result is what the syscall returns or -errno. Return false if there is none.
+    bool popCompletion(UInt64 & user_data, int & result);
+
+    unsigned getEntries() const { return sq_entries; }
+
+    /// IORING_FEAT_* the kernel has
+    UInt32 getFeatures() const { return features; }
+
+private:
+    void release();
+    io_uring_sqe * getSqe(UInt64 user_data);
+    void submitUnlocked();
+    int enter(unsigned to_submit, unsigned min_complete, unsigned flags, const void * arg = nullptr, size_t arg_size = 0) const;
+
+    int ring_fd = -1;
+
+    void * sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void * cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    io_uring_sqe * sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned * sq_head = nullptr;
+    unsigned * sq_tail = nullptr;
+    unsigned * sq_array = nullptr;
+    unsigned sq_mask = 0;
+    unsigned sq_entries = 0;
+    UInt32 features = 0;
+    /// Requests queued but not submitted
+    unsigned to_submit = 0;
+
+    unsigned * cq_head = nullptr;
+    unsigned * cq_tail = nullptr;
+    io_uring_cqe * cqes = nullptr;
+    unsigned cq_mask = 0;
+
+    std::mutex sq_mutex;
+    std::mutex cq_mutex;
+};
+
+}
+#endif
@@ -0,0 +1,301 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+#include <Common/BusyPoll.h>
+#include <common/defines.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Bounded multi producer multi consumer queue on a ring buffer, every cell carries a sequence number
+  * which tells whether it is ready for the next push or pop (D. Vyukov's algorithm). Push and pop
+  * don't take lock and touch only the cell and one of the two positions.
+  *
+  * Blocking operations spin for a while, and for the budget of BusyPoll if it is enabled, and then park on
+  * a condition variable. The mutex is taken only by parked threads and by the other side to wake them up,
+  * so it is not touched while the queue keeps flowing.
+  *
+  * The interface mirrors ConcurrentBoundedQueue. Capacity is rounded up to a power of two.
+  */
+template <typename T>
+class LockFreeBoundedQueue
+{
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static constexpr size_t SPIN_COUNT = 64;
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    std::vector<Cell> buffer;
+    const size_t mask;
+    /// Most objects in the queue, at most the size of buffer, it can be lowered and raised again at runtime
+    std::atomic<size_t> limit;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> push_pos{0};
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> pop_pos{0};
+
+    /// Threads parked in push or pop
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> push_waiters{0};
+    std::atomic<size_t> pop_waiters{0};
+
+    std::mutex park_mutex;
+    std::condition_variable push_condition;
+    std::condition_variable pop_condition;
+
+    static size_t roundUpToPowerOfTwo(size_t n)
+    {
+        size_t res = 1;
+        while (res < n)
+            res <<= 1;
+        return res;
+    }
+
+    template <typename U>
+    bool tryPushImpl(U && x)
+    {
+        size_t pos = push_pos.load(std::memory_order_relaxed);
+        const size_t current_limit = limit.load(std::memory_order_relaxed);
+        while (true)
+        {
+            if (current_limit < buffer.size())
+            {
+                size_t popped = pop_pos.load(std::memory_order_relaxed);
+                if (pos >= popped && pos - popped >= current_limit)
+                    return false; /// full
+            }
+
+            Cell & cell = buffer[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<Int64>(sequence) - static_cast<Int64>(pos);
+
+            if (diff == 0)
+            {
+                if (push_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    cell.value = std::forward<U>(x);
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; /// full
+            else
+                pos = push_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    bool tryPopImpl(T & x)
+    {
+        size_t pos = pop_pos.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell & cell = buffer[pos & mask];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            auto diff = static_cast<Int64>(sequence) - static_cast<Int64>(pos + 1);
+
+            if (diff == 0)
+            {
+                if (pop_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    x = std::move(cell.value);
+                    cell.value = T{};
+                    cell.sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false; /// empty
+            else
+                pos = pop_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    /// Wake up a thread parked on the other side. Both sides do read-modify-write on waiters, so the waiter
+    /// either sees our change when it checks again or is seen by us.
+    void notify(std::atomic<size_t> & waiters, std::condition_variable & condition, bool notify_all = false)
+    {
+        if (waiters.fetch_add(0, std::memory_order_acq_rel))
+        {
+            std::lock_guard lock(park_mutex);
+            if (notify_all)
+                condition.notify_all();
+            else
+                condition.notify_one();
+        }
+    }
+
+    /// Spin and then park until try_once succeeds or timeout expires.
+    template <typename TryOnce>
+    bool wait(
+        std::optional<UInt64> timeout_milliseconds,
+        std::atomic<size_t> & waiters,
+        std::condition_variable & condition,
+        TryOnce && try_once)
+    {
+        if (try_once())
+            return true;
+
+        if (timeout_milliseconds && *timeout_milliseconds == 0)
+            return false;
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_milliseconds.value_or(0));
+
+        for (size_t i = 0; i < SPIN_COUNT; ++i)
+        {
+            std::this_thread::yield();
+            if (try_once())
+                return true;
+        }
+
+        if (BusyPoll::spin(try_once, timeout_milliseconds))
+            return true;
+
+        std::unique_lock lock(park_mutex);
+        waiters.fetch_add(1, std::memory_order_acq_rel);
+
+        bool res = false;
+        while (!(res = try_once()))
+        {
+            if (!timeout_milliseconds)
+                condition.wait(lock);
+            else if (condition.wait_until(lock, deadline) == std::cv_status::timeout)
+            {
+                res = try_once();
+                break;
+            }
+        }
+
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return res;
+    }
+
+    template <typename U>
+    bool pushImpl(std::optional<UInt64> timeout_milliseconds, U && x)
+    {
+        if (!wait(timeout_milliseconds, push_waiters, push_condition, [&] { return tryPushImpl(std::forward<U>(x)); }))
+            return false;
+
+        notify(pop_waiters, pop_condition);
+        return true;
+    }
+
+    bool popImpl(std::optional<UInt64> timeout_milliseconds, T & x)
+    {
+        if (!wait(timeout_milliseconds, pop_waiters, pop_condition, [&] { return tryPopImpl(x); }))
+            return false;
+
+        notify(push_waiters, push_condition);
+        return true;
+    }
+
+public:
+    explicit LockFreeBoundedQueue(size_t max_fill)
+        : buffer(roundUpToPowerOfTwo(std::max(max_fill, size_t(2)))), mask(buffer.size() - 1), limit(buffer.size())
+    {
+        for (size_t i = 0; i < buffer.size(); ++i)
+            buffer[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(const T & x) { return pushImpl(std::nullopt, x); }
+
+    bool push(T && x) { return pushImpl(std::nullopt, std::move(x)); }
+
+    /// Returns false if object was not pushed during timeout
+    bool tryPush(const T & x, UInt64 milliseconds = 0) { return pushImpl(milliseconds, x); }
+
+    /// Returns false if object was not pushed during timeout
+    bool tryPush(T && x, UInt64 milliseconds = 0) { return pushImpl(milliseconds, std::move(x)); }
+
+    bool pop(T & x) { return popImpl(std::nullopt, x); }
+
+    void pop()
+    {
+        T x;
+        popImpl(std::nullopt, x);
+    }
+
+    /// Returns false if object was not popped during timeout
+    bool tryPop(T & x, UInt64 milliseconds = 0) { return popImpl(milliseconds, x); }
+
+    /// Pop at most max_size objects without waiting, returns how many were popped.
+    size_t tryPopBatch(std::vector<T> & res, size_t max_size)
+    {
+        size_t popped = 0;
+        T x;
+        while (popped < max_size && tryPopImpl(x))
+        {
+            res.push_back(std::move(x));
+            ++popped;
+        }
+
+        if (popped)
+            notify(push_waiters, push_condition, /* notify_all */ popped > 1);
+        return popped;
+    }
+
+    /// Copy the front object. Only valid when there is a single consumer.
+    bool peek(T & x)
+    {
+        size_t pos = pop_pos.load(std::memory_order_relaxed);
+        Cell & cell = buffer[pos & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+            return false;
+        x = cell.value;
+        return true;
+    }
+
+    /// Front object without popping or copying it, nullptr if the queue is empty. Only valid when there is a single
+    /// consumer, the object stays valid until it pops.
+    T * front()
+    {
+        size_t pos = pop_pos.load(std::memory_order_relaxed);
+        Cell & cell = buffer[pos & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1)
+            return nullptr;
+        return &cell.value;
+    }
+
+    /// Approximate size, it may be stale when there are concurrent operations.
+    size_t size() const
+    {
+        size_t popped = pop_pos.load(std::memory_order_acquire);
+        size_t pushed = push_pos.load(std::memory_order_acquire);
+        return pushed > popped ? std::min(pushed - popped, buffer.size()) : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+
+    size_t capacity() const { return buffer.size(); }
+
+    /// Push fails or waits while there are new_limit objects, it is capped by capacity, which is allocated up front
+    /// and can not grow. Objects already in the queue are kept when it is lowered. Returns the limit applied.
+    size_t setLimit(size_t new_limit)
+    {
+        new_limit = std::clamp(new_limit, size_t(1), buffer.size());
+        if (limit.exchange(new_limit, std::memory_order_relaxed) < new_limit)
+            notify(push_waiters, push_condition, /* notify_all */ true);
+        return new_limit;
+    }
+
+    size_t getLimit() const { return limit.load(std::memory_order_relaxed); }
+
+    /// Bytes of the ring buffer, all cells are allocated up front
+    size_t getBufferSizeInBytes() const { return buffer.size() * sizeof(Cell); }
+};
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <vector>
+
+#include <Common/ShardedCounter.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/** Histogram of non-negative integers with log-linear buckets, like HDR histogram. Every power of two range is divided
+  * into SUB_BUCKETS linear buckets, so the relative error of a value taken from its bucket is less than 1 / SUB_BUCKETS,
+  * values less than SUB_BUCKETS have exact buckets. Bucket boundaries are fixed, so histograms of different nodes can be
+  * added up.
+  *
+  * Recording is lock free: a thread adds to one of the shards of counters chosen once per thread, shards are merged
+  * when reading. Every shard takes BUCKETS counters, histograms recorded by few threads may have fewer shards. Reading
+  * concurrently with recording may miss the values being recorded.
+  */
+class LogLinearHistogram
+{
+public:
+    static constexpr size_t SUB_BUCKET_BITS = 5;
+    static constexpr size_t SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    /// Exact buckets of [0, SUB_BUCKETS) and SUB_BUCKETS buckets of every [2^e, 2^(e+1)) of e in [SUB_BUCKET_BITS, 64)
+    static constexpr size_t BUCKETS = SUB_BUCKETS * (64 - SUB_BUCKET_BITS + 1);
+    static constexpr size_t DEFAULT_SHARDS = 16;
+
+    explicit LogLinearHistogram(size_t shards_num = DEFAULT_SHARDS) : shards(std::max(shards_num, size_t(1))) { }
+
+    static size_t bucketOf(UInt64 value)
+    {
+        if (value < SUB_BUCKETS)
+            return value;
+        size_t exponent = 63 - static_cast<size_t>(std::countl_zero(value));
+        size_t sub_bucket = (value >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub_bucket;
+    }
+
+    /// Smallest value of bucket
+    static UInt64 lowerBound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+        size_t exponent = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        UInt64 sub_bucket = bucket % SUB_BUCKETS;
+        return (SUB_BUCKETS + sub_bucket) << (exponent - SUB_BUCKET_BITS);
+    }
+
+    /// Values in bucket
+    static UInt64 width(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return 1;
+        return UInt64(1) << (bucket / SUB_BUCKETS - 1);
+    }
+
+    void add(UInt64 value)
+    {
+        auto & shard = shards[shardOfCurrentThread(shards.size())];
+        shard.counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    struct Snapshot
+    {
+        std::vector<UInt64> counts = std::vector<UInt64>(BUCKETS);
+        UInt64 count = 0;
+        UInt64 sum = 0;
+
+        /// Middle of the bucket holding the value of rank quantile * count, 0 if empty
+        double quantile(double level) const
+        {
+            if (count == 0)
+                return 0;
+            auto rank = static_cast<UInt64>(level * static_cast<double>(count - 1));
+            UInt64 seen = 0;
+            for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+            {
+                seen += counts[bucket];
+                if (seen > rank)
+                    return static_cast<double>(lowerBound(bucket)) + static_cast<double>(width(bucket) - 1) / 2;
+            }
+            return static_cast<double>(lowerBound(BUCKETS - 1));
+        }
+
+        /// Values less than bound, exact if bound is a bucket boundary
+        UInt64 countLessThan(UInt64 bound) const
+        {
+            UInt64 res = 0;
+            for (size_t bucket = 0; bucket < BUCKETS && lowerBound(bucket) < bound; ++bucket)
+                res += counts[bucket];
+            return res;
+        }
+    };
+
+    Snapshot getSnapshot() const
+    {
+        Snapshot snapshot;
+        for (const auto & shard : shards)
+        {
+            for (size_t bucket = 0; bucket < BUCKETS; ++bucket)
+            {
+                UInt64 bucket_count = shard.counts[bucket].load(std::memory_order_relaxed);
+                snapshot.counts[bucket] += bucket_count;
+                snapshot.count += bucket_count;
+            }
+            snapshot.sum += shard.sum.load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+    void reset()
+    {
+        for (auto & shard : shards)
+        {
+            for (auto & bucket_count : shard.counts)
+                bucket_count.store(0, std::memory_order_relaxed);
+            shard.sum.store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::array<std::atomic<UInt64>, BUCKETS> counts{};
+        std::atomic<UInt64> sum{0};
+    };
+
+    std::vector<Shard> shards;
+};
+
+}
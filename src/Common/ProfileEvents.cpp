@@ -88,6 +88,7 @@
     M(ZooKeeperWaitMicroseconds, "") \
     M(ZooKeeperBytesSent, "") \
     M(ZooKeeperBytesReceived, "") \
+    M(ZooKeeperBatchedRequests, "Requests sent in multi requests by auto batching of the ZooKeeper client") \
     \
     M(ServiceKeeperInit, "") \
     M(ServiceKeeperTransactions, "") \
@@ -181,6 +182,11 @@
     M(RWLockAcquiredWriteLocks, "") \
     M(RWLockReadersWaitMilliseconds, "") \
     M(RWLockWritersWaitMilliseconds, "") \
+    M(MutexLockContended, "Number of times a profiled mutex was locked after waiting for another thread, see 4lw command lock.") \
+    M(MutexLockWaitMicroseconds, "Time threads waited for profiled mutexes held by other threads.") \
+    M(MutexLockHoldMicroseconds, "Time profiled mutexes were held exclusively.") \
+    M(CpuProfilerSamples, "Stacks sampled by cpu profiler, see 4lw command prof.") \
+    M(CpuProfilerDroppedSamples, "Stacks sampled by cpu profiler and dropped because the collector fell behind.") \
     M(DNSError, "Total count of errors in DNS resolution") \
     \
     M(RealTimeMicroseconds, "Total (wall clock) time spent in processing (queries and other tasks) threads (not that this is a sum).") \
@@ -0,0 +1,141 @@
+#include <Common/ProfiledMutex.h>
+
+#include <algorithm>
+#include <tuple>
+#include <unordered_map>
+
+#include <Common/ProfileEvents.h>
+
+namespace ProfileEvents
+{
+    extern const Event MutexLockContended;
+    extern const Event MutexLockWaitMicroseconds;
+    extern const Event MutexLockHoldMicroseconds;
+}
+
+namespace RK
+{
+
+namespace
+{
+
+/// Times of a thread not added to ProfileEvents yet, so that a lock does not touch the global counters
+struct PendingTimes
+{
+    UInt64 wait_ns = 0;
+    UInt64 contentions = 0;
+    UInt64 hold_ns = 0;
+};
+
+thread_local PendingTimes pending_times;
+
+void addToItem(LockProfiler::Item & item, const LockStats & stats)
+{
+    item.acquisitions += stats.acquisitions.load(std::memory_order_relaxed);
+    item.contentions += stats.contentions.load(std::memory_order_relaxed);
+    item.wait_us += stats.wait_ns.load(std::memory_order_relaxed) / 1000;
+    item.max_wait_us = std::max(item.max_wait_us, stats.max_wait_ns.load(std::memory_order_relaxed) / 1000);
+    item.hold_us += stats.hold_ns.load(std::memory_order_relaxed) / 1000;
+    item.max_hold_us = std::max(item.max_hold_us, stats.max_hold_ns.load(std::memory_order_relaxed) / 1000);
+}
+
+}
+
+void LockStats::reset()
+{
+    acquisitions.store(0, std::memory_order_relaxed);
+    contentions.store(0, std::memory_order_relaxed);
+    wait_ns.store(0, std::memory_order_relaxed);
+    max_wait_ns.store(0, std::memory_order_relaxed);
+    hold_ns.store(0, std::memory_order_relaxed);
+    max_hold_ns.store(0, std::memory_order_relaxed);
+}
+
+LockProfiler & LockProfiler::instance()
+{
+    static LockProfiler profiler;
+    return profiler;
+}
+
+void LockProfiler::registerLock(const char * name, LockStats * stats)
+{
+    std::lock_guard lock(mutex);
+    locks.push_back({name, stats});
+}
+
+void LockProfiler::unregisterLock(const char * name, LockStats * stats)
+{
+    std::lock_guard lock(mutex);
+    auto it = std::find_if(locks.begin(), locks.end(), [stats](const Entry & entry) { return entry.stats == stats; });
+    if (it == locks.end())
+        return;
+    locks.erase(it);
+
+    auto retired_it = std::find_if(retired.begin(), retired.end(), [name](const auto & item) { return item.first == name; });
+    if (retired_it == retired.end())
+    {
+        retired_it = retired.emplace(retired.end());
+        retired_it->first = name;
+        retired_it->second.name = name;
+    }
+    addToItem(retired_it->second, *stats);
+}
+
+std::vector<LockProfiler::Item> LockProfiler::getReport() const
+{
+    std::unordered_map<String, Item> items;
+    {
+        std::lock_guard lock(mutex);
+        for (const auto & [name, item] : retired)
+            items[name] = item;
+        for (const auto & entry : locks)
+        {
+            auto & item = items[entry.name];
+            item.name = entry.name;
+            ++item.instances;
+            addToItem(item, *entry.stats);
+        }
+    }
+
+    std::vector<Item> res;
+    res.reserve(items.size());
+    for (auto & [_, item] : items)
+        res.push_back(std::move(item));
+    std::sort(res.begin(), res.end(), [](const Item & lhs, const Item & rhs)
+    {
+        return std::tie(rhs.wait_us, rhs.contentions, lhs.name) < std::tie(lhs.wait_us, lhs.contentions, rhs.name);
+    });
+    return res;
+}
+
+void LockProfiler::reset()
+{
+    std::lock_guard lock(mutex);
+    retired.clear();
+    /// Counters are reset by other threads than the holders, a concurrent update may be kept
+    for (const auto & entry : locks)
+        entry.stats->reset();
+}
+
+void LockProfiler::onWait(UInt64 wait_ns)
+{
+    pending_times.wait_ns += wait_ns;
+    ++pending_times.contentions;
+    if (pending_times.wait_ns < PROFILE_EVENTS_FLUSH_NS)
+        return;
+    ProfileEvents::increment(ProfileEvents::MutexLockContended, pending_times.contentions);
+    ProfileEvents::increment(ProfileEvents::MutexLockWaitMicroseconds, pending_times.wait_ns / 1000);
+    pending_times.wait_ns %= 1000;
+    pending_times.contentions = 0;
+}
+
+void LockProfiler::onHold(UInt64 hold_ns)
+{
+    pending_times.hold_ns += hold_ns;
+    if (pending_times.hold_ns < PROFILE_EVENTS_FLUSH_NS)
+        return;
+    ProfileEvents::increment(ProfileEvents::MutexLockHoldMicroseconds, pending_times.hold_ns / 1000);
+    pending_times.hold_ns %= 1000;
+}
+
+}
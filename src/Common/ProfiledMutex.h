@@ -0,0 +1,202 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+#include <Common/Stopwatch.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Counters of a profiled mutex, times are in nanoseconds
+struct LockStats
+{
+    std::atomic<UInt64> acquisitions{0};
+    /// Acquisitions which waited for another thread
+    std::atomic<UInt64> contentions{0};
+    std::atomic<UInt64> wait_ns{0};
+    std::atomic<UInt64> max_wait_ns{0};
+    /// Of exclusive acquisitions only, shared ones may overlap
+    std::atomic<UInt64> hold_ns{0};
+    std::atomic<UInt64> max_hold_ns{0};
+
+    void reset();
+};
+
+/** Registry of profiled mutexes. Mutexes of the same name are reported together, for example shards of a map, and
+  * counters of destroyed ones are kept. Profiling is enabled by default, keeper.lock_profiling.enabled turns it off,
+  * then a profiled mutex costs a relaxed load.
+  */
+class LockProfiler
+{
+public:
+    static LockProfiler & instance();
+
+    static bool isEnabled() { return enabled.load(std::memory_order_relaxed); }
+    static void setEnabled(bool value) { enabled.store(value, std::memory_order_relaxed); }
+
+    void registerLock(const char * name, LockStats * stats);
+    void unregisterLock(const char * name, LockStats * stats);
+
+    struct Item
+    {
+        String name;
+        size_t instances = 0;
+        UInt64 acquisitions = 0;
+        UInt64 contentions = 0;
+        UInt64 wait_us = 0;
+        UInt64 max_wait_us = 0;
+        UInt64 hold_us = 0;
+        UInt64 max_hold_us = 0;
+    };
+
+    /// Most contended first, by wait time
+    std::vector<Item> getReport() const;
+
+    void reset();
+
+    /// Wait and hold times are added to ProfileEvents by a thread when it has this much of them
+    static constexpr UInt64 PROFILE_EVENTS_FLUSH_NS = 1000000;
+
+    /// Invoked by profiled mutexes
+    static void onWait(UInt64 wait_ns);
+    static void onHold(UInt64 hold_ns);
+
+private:
+    LockProfiler() = default;
+
+    struct Entry
+    {
+        const char * name;
+        LockStats * stats;
+    };
+
+    static inline std::atomic<bool> enabled{true};
+
+    mutable std::mutex mutex;
+    std::vector<Entry> locks;
+    /// Counters of destroyed mutexes by name
+    std::vector<std::pair<String, Item>> retired;
+};
+
+/** Mutex which records acquisitions, contended acquisitions and their wait time and how long it is held to
+  * LockProfiler and ProfileEvents. An acquisition is contended if try_lock fails, so an uncontended one costs reading
+  * the clock twice for hold time. Name should be a string literal.
+  */
+template <typename Mutex>
+class ProfiledMutexBase
+{
+public:
+    explicit ProfiledMutexBase(const char * name_) : name(name_) { LockProfiler::instance().registerLock(name, &stats); }
+    ~ProfiledMutexBase() { LockProfiler::instance().unregisterLock(name, &stats); }
+
+    ProfiledMutexBase(const ProfiledMutexBase &) = delete;
+    ProfiledMutexBase & operator=(const ProfiledMutexBase &) = delete;
+
+    void lock()
+    {
+        if (!LockProfiler::isEnabled())
+        {
+            mutex.lock();
+            locked_at_ns = 0;
+            return;
+        }
+
+        if (!mutex.try_lock())
+            waitFor([this] { mutex.lock(); });
+        stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        locked_at_ns = clock_gettime_ns();
+    }
+
+    bool try_lock() /// NOLINT
+    {
+        if (!mutex.try_lock())
+            return false;
+        locked_at_ns = 0;
+        if (LockProfiler::isEnabled())
+        {
+            stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+            locked_at_ns = clock_gettime_ns();
+        }
+        return true;
+    }
+
+    void unlock()
+    {
+        UInt64 hold_ns = locked_at_ns ? clock_gettime_ns() - locked_at_ns : 0;
+        mutex.unlock();
+        if (hold_ns)
+        {
+            stats.hold_ns.fetch_add(hold_ns, std::memory_order_relaxed);
+            updateMax(stats.max_hold_ns, hold_ns);
+            LockProfiler::onHold(hold_ns);
+        }
+    }
+
+    const LockStats & getStats() const { return stats; }
+
+protected:
+    template <typename Lock>
+    void waitFor(Lock && do_lock)
+    {
+        UInt64 start_ns = clock_gettime_ns();
+        do_lock();
+        UInt64 wait_ns = clock_gettime_ns() - start_ns;
+        stats.contentions.fetch_add(1, std::memory_order_relaxed);
+        stats.wait_ns.fetch_add(wait_ns, std::memory_order_relaxed);
+        updateMax(stats.max_wait_ns, wait_ns);
+        LockProfiler::onWait(wait_ns);
+    }
+
+    static void updateMax(std::atomic<UInt64> & max, UInt64 value)
+    {
+        UInt64 current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    Mutex mutex;
+    const char * name;
+    LockStats stats;
+    /// Written by the holder only, 0 if the hold is not timed
+    UInt64 locked_at_ns = 0;
+};
+
+using ProfiledMutex = ProfiledMutexBase<std::mutex>;
+
+/// Shared acquisitions are counted with their waits, their hold time is not
+class ProfiledSharedMutex : public ProfiledMutexBase<std::shared_mutex>
+{
+public:
+    using ProfiledMutexBase::ProfiledMutexBase;
+
+    void lock_shared() /// NOLINT
+    {
+        if (!LockProfiler::isEnabled())
+        {
+            mutex.lock_shared();
+            return;
+        }
+
+        if (!mutex.try_lock_shared())
+            waitFor([this] { mutex.lock_shared(); });
+        stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    bool try_lock_shared() /// NOLINT
+    {
+        if (!mutex.try_lock_shared())
+            return false;
+        if (LockProfiler::isEnabled())
+            stats.acquisitions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock_shared() { mutex.unlock_shared(); } /// NOLINT
+};
+
+}
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+
+#include <Common/Stopwatch.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Stages of the request pipeline in order, a stage ends when the request is handed to the next one. A request skips
+/// stages which are not on its path, for example only requests of followers are forwarded and reads are not appended.
+enum class RequestStage : UInt8
+{
+    IO, /// From the read of the request until it is parsed and pushed to dispatcher
+    DISPATCH_QUEUE, /// Waiting in the queue of dispatcher
+    FORWARD, /// Waiting in forwarder until written to the leader
+    ACCUMULATE, /// Waiting in accumulator until its batch is appended
+    APPEND, /// Appended to Raft log of the leader
+    COMMIT, /// Replicated until committed by the state machine
+    APPLY, /// Waiting in processor until applied to the store
+    RESPONSE_QUEUE, /// Waiting in the queue of responses until handed to the connection
+    SEND, /// Waiting in the connection until written to the socket
+    END,
+};
+
+inline const char * toString(RequestStage stage)
+{
+    switch (stage)
+    {
+        case RequestStage::IO:
+            return "io";
+        case RequestStage::DISPATCH_QUEUE:
+            return "dispatch_queue";
+        case RequestStage::FORWARD:
+            return "forward";
+        case RequestStage::ACCUMULATE:
+            return "accumulate";
+        case RequestStage::APPEND:
+            return "append";
+        case RequestStage::COMMIT:
+            return "commit";
+        case RequestStage::APPLY:
+            return "apply";
+        case RequestStage::RESPONSE_QUEUE:
+            return "response_queue";
+        case RequestStage::SEND:
+            return "send";
+        case RequestStage::END:
+            break;
+    }
+    return "unknown";
+}
+
+/** Context of a sampled request in a trace, compatible with W3C trace context. A trace is started for a sampled request
+  * by the node receiving it and continued by the leader if it is forwarded, spans of stages have ids derived from the
+  * span of the request, so that the follower knows the id of its forward span before sending it.
+  */
+struct TraceContext
+{
+    UInt64 trace_id_high = 0;
+    UInt64 trace_id_low = 0;
+    /// Span of the request in this node and its parent, a forward span of follower for requests of leader
+    UInt64 span_id = 0;
+    UInt64 parent_span_id = 0;
+
+    bool sampled() const { return trace_id_high != 0 || trace_id_low != 0; }
+
+    UInt64 stageSpanId(RequestStage stage) const
+    {
+        /// SplitMix64 of the span id and stage, distinct for stages and never 0 in practice
+        UInt64 x = span_id + (static_cast<UInt64>(stage) + 1) * 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return x ^ (x >> 31);
+    }
+};
+
+/** Times in microseconds of monotonic clock a request started and passed stages of the pipeline, 0 if it did not.
+  * Stages are recorded by different threads and may be read while recording, for example a forwarded request may be
+  * committed before forwarder records its send, so times are atomic.
+  */
+class RequestTimeline
+{
+public:
+    static constexpr size_t STAGES = static_cast<size_t>(RequestStage::END);
+
+    static UInt64 now() { return clock_gettime_ns() / 1000; }
+
+    RequestTimeline() = default;
+    RequestTimeline(const RequestTimeline & other) { *this = other; }
+
+    RequestTimeline & operator=(const RequestTimeline & other)
+    {
+        for (size_t i = 0; i < times.size(); ++i)
+            times[i].store(other.times[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        trace = other.trace;
+        return *this;
+    }
+
+    void start(UInt64 time) { times[0].store(time, std::memory_order_relaxed); }
+    bool started() const { return times[0].load(std::memory_order_relaxed) != 0; }
+
+    void end(RequestStage stage, UInt64 time = now()) { times[index(stage)].store(time, std::memory_order_relaxed); }
+
+    /// Takes times and trace not recorded by this timeline from other, a committed request takes them of its local copy
+    void merge(const RequestTimeline & other)
+    {
+        for (size_t i = 0; i < times.size(); ++i)
+            if (times[i].load(std::memory_order_relaxed) == 0)
+                times[i].store(other.times[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        if (!trace.sampled())
+            trace = other.trace;
+    }
+
+    /// Duration of stages passed since the end of the previous passed one or the start, 0 of stages skipped
+    std::array<UInt64, STAGES> durations() const
+    {
+        std::array<UInt64, STAGES> res{};
+        UInt64 previous = times[0].load(std::memory_order_relaxed);
+        for (size_t stage = 0; stage < STAGES; ++stage)
+        {
+            UInt64 time = times[stage + 1].load(std::memory_order_relaxed);
+            if (time == 0)
+                continue;
+            /// Recorded late by another thread
+            if (time < previous)
+                time = previous;
+            res[stage] = time - previous;
+            previous = time;
+        }
+        return res;
+    }
+
+    /// Whether the request passed stage
+    bool passed(RequestStage stage) const { return times[index(stage)].load(std::memory_order_relaxed) != 0; }
+
+    UInt64 startTime() const { return times[0].load(std::memory_order_relaxed); }
+    /// End of stage, 0 if not passed
+    UInt64 endTime(RequestStage stage) const { return times[index(stage)].load(std::memory_order_relaxed); }
+
+    /// Set when the request is sampled for tracing before it is handed to other threads, so it is not atomic
+    TraceContext trace;
+
+private:
+    /// times[0] is the start, times[i + 1] is the end of stage i
+    static size_t index(RequestStage stage) { return static_cast<size_t>(stage) + 1; }
+
+    std::array<std::atomic<UInt64>, STAGES + 1> times{};
+};
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <thread>
+#include <vector>
+
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Threads are numbered in order of their first update of a sharded value, so that up to shards threads get a shard each
+inline size_t shardOfCurrentThread(size_t shards)
+{
+    static std::atomic<size_t> next_thread{0};
+    static thread_local size_t thread = next_thread.fetch_add(1, std::memory_order_relaxed);
+    return thread % shards;
+}
+
+/// Number of cores rounded up to a power of two, at most 64
+inline size_t defaultShardsNum()
+{
+    static const size_t shards = std::min(std::bit_ceil(std::max(std::thread::hardware_concurrency(), 1U)), 64U);
+    return shards;
+}
+
+/** Values updated by many threads and read rarely, like statistics. A thread updates its own shard, which takes a cache
+  * line, so that threads do not bounce the line of a shared atomic, and reading merges the shards. Shard should be
+  * aligned to 64 bytes.
+  */
+template <typename Shard>
+class Sharded
+{
+public:
+    explicit Sharded(size_t shards_num = defaultShardsNum()) : shards(std::max(shards_num, size_t(1))) { }
+
+    Shard & local() { return shards.size() == 1 ? shards[0] : shards[shardOfCurrentThread(shards.size())]; }
+
+    auto begin() const { return shards.begin(); }
+    auto end() const { return shards.end(); }
+    auto begin() { return shards.begin(); }
+    auto end() { return shards.end(); }
+
+private:
+    std::vector<Shard> shards;
+};
+
+/// Raise max to value, relaxed
+inline void atomicMax(std::atomic<UInt64> & max, UInt64 value)
+{
+    UInt64 current = max.load(std::memory_order_relaxed);
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+/// Lower min to value, relaxed
+inline void atomicMin(std::atomic<UInt64> & min, UInt64 value)
+{
+    UInt64 current = min.load(std::memory_order_relaxed);
+    while (value < current && !min.compare_exchange_weak(current, value, std::memory_order_relaxed))
+    {
+    }
+}
+
+/// Sum of additions of many threads, reading concurrently with adding may miss the values being added
+class ShardedCounter
+{
+public:
+    explicit ShardedCounter(size_t shards_num = defaultShardsNum()) : shards(shards_num) { }
+
+    void add(UInt64 value = 1) { shards.local().value.fetch_add(value, std::memory_order_relaxed); }
+
+    UInt64 get() const
+    {
+        UInt64 res = 0;
+        for (const auto & shard : shards)
+            res += shard.value.load(std::memory_order_relaxed);
+        return res;
+    }
+
+    void reset()
+    {
+        for (auto & shard : shards)
+            shard.value.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Shard
+    {
+        std::atomic<UInt64> value{0};
+    };
+
+    Sharded<Shard> shards;
+};
+
+}
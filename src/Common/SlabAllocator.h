@@ -0,0 +1,197 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#include <Common/HugePages.h>
+#include <common/defines.h>
+
+
+namespace RK
+{
+
+/** Pool of fixed size memory chunks carved out of big slabs.
+  *
+  * It is designed for objects which are allocated in tens of millions and live long, like nodes of the data tree.
+  * Chunks are packed densely into slabs without per allocation header, freed chunks are kept in a thread local
+  * free list and exchanged with the global pool in batches, so the mutex is rarely touched.
+  *
+  * Slabs are never returned to system, freed chunks are reused by later allocations, for example
+  * when a snapshot is reloaded after the data tree has been reset. Slabs are multiples of the huge page size and
+  * are taken from HugePages, so they are backed by huge pages if its mode asks to.
+  */
+template <size_t Size, size_t Alignment>
+class FixedSizeSlabPool
+{
+private:
+    struct FreeChunk
+    {
+        FreeChunk * next;
+    };
+
+    static constexpr size_t CHUNK_SIZE = ((std::max(Size, sizeof(FreeChunk)) + Alignment - 1) / Alignment) * Alignment;
+    static constexpr size_t SLAB_SIZE
+        = (std::max(HugePages::HUGE_PAGE_SIZE, CHUNK_SIZE * 64) + HugePages::HUGE_PAGE_SIZE - 1) / HugePages::HUGE_PAGE_SIZE
+        * HugePages::HUGE_PAGE_SIZE;
+    static constexpr size_t BATCH_SIZE = 512;
+
+    struct Batch
+    {
+        FreeChunk * head = nullptr;
+        size_t size = 0;
+
+        void push(void * ptr)
+        {
+            auto * chunk = static_cast<FreeChunk *>(ptr);
+            chunk->next = head;
+            head = chunk;
+            ++size;
+        }
+
+        void * pop()
+        {
+            FreeChunk * chunk = head;
+            head = chunk->next;
+            --size;
+            return chunk;
+        }
+    };
+
+    struct ThreadCache
+    {
+        Batch batch;
+
+        ~ThreadCache()
+        {
+            if (batch.size)
+                instance().returnBatch(batch);
+        }
+    };
+
+    static ThreadCache & threadCache()
+    {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+
+    /// Fill batch from global free lists or a new slab
+    void fetchBatch(Batch & batch)
+    {
+        std::lock_guard lock(mutex);
+        if (!free_batches.empty())
+        {
+            batch = free_batches.back();
+            free_batches.pop_back();
+            return;
+        }
+
+        if (slab_pos == slab_end)
+        {
+            char * slab = static_cast<char *>(HugePages::allocate(SLAB_SIZE, std::max(Alignment, alignof(FreeChunk))));
+            slab_pos = slab;
+            slab_end = slab + SLAB_SIZE / CHUNK_SIZE * CHUNK_SIZE;
+            allocated_bytes += SLAB_SIZE;
+        }
+
+        for (size_t i = 0; i < BATCH_SIZE && slab_pos != slab_end; ++i, slab_pos += CHUNK_SIZE)
+            batch.push(slab_pos);
+    }
+
+    void returnBatch(Batch & batch)
+    {
+        std::lock_guard lock(mutex);
+        free_batches.push_back(batch);
+        batch = {};
+    }
+
+    std::mutex mutex;
+    std::vector<Batch> free_batches;
+    char * slab_pos = nullptr;
+    char * slab_end = nullptr;
+    size_t allocated_bytes = 0;
+
+public:
+    static FixedSizeSlabPool & instance()
+    {
+        /// Never destroyed, because chunks may be freed by static objects or thread local caches at exit.
+        static auto * pool = new FixedSizeSlabPool;
+        return *pool;
+    }
+
+    void * alloc()
+    {
+        auto & cache = threadCache();
+        if (unlikely(cache.batch.size == 0))
+            fetchBatch(cache.batch);
+        return cache.batch.pop();
+    }
+
+    void free(void * ptr)
+    {
+        auto & cache = threadCache();
+        cache.batch.push(ptr);
+
+        /// Keep at most two batches in thread cache
+        if (unlikely(cache.batch.size >= BATCH_SIZE * 2))
+        {
+            Batch to_return;
+            for (size_t i = 0; i < BATCH_SIZE; ++i)
+                to_return.push(cache.batch.pop());
+            returnBatch(to_return);
+        }
+    }
+
+    /// Bytes of all slabs
+    size_t getAllocatedBytes()
+    {
+        std::lock_guard lock(mutex);
+        return allocated_bytes;
+    }
+};
+
+/// STL allocator over FixedSizeSlabPool, single object allocations of every rebound type go to the pool
+/// of its own size, so it can be used with std::allocate_shared to put object and control block into one chunk.
+template <typename T>
+struct SlabAllocator
+{
+    using value_type = T;
+
+    SlabAllocator() = default;
+
+    template <typename U>
+    SlabAllocator(const SlabAllocator<U> &) noexcept /// NOLINT
+    {
+    }
+
+    T * allocate(size_t n)
+    {
+        if (likely(n == 1))
+            return static_cast<T *>(FixedSizeSlabPool<sizeof(T), alignof(T)>::instance().alloc());
+        return std::allocator<T>().allocate(n);
+    }
+
+    void deallocate(T * ptr, size_t n)
+    {
+        if (likely(n == 1))
+            FixedSizeSlabPool<sizeof(T), alignof(T)>::instance().free(ptr);
+        else
+            std::allocator<T>().deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const SlabAllocator<U> &) const noexcept
+    {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const SlabAllocator<U> &) const noexcept
+    {
+        return false;
+    }
+};
+
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include <common/types.h>
+
+namespace RK
+{
+
+/** Approximate top-K of a stream by the Space-Saving algorithm of Metwally et al. At most capacity keys are counted, a key
+  * not counted takes the place of the one with the smallest count and inherits its count as error. So counts are never
+  * underestimated, and a key counted more than total / capacity times is always among the counted ones.
+  *
+  * Counters are kept in a min heap to replace the smallest in O(log capacity). Not thread safe.
+  */
+template <typename Key, typename Hash = std::hash<Key>>
+class SpaceSaving
+{
+public:
+    struct Counter
+    {
+        Key key;
+        /// Overestimates the real count by at most error
+        UInt64 count;
+        UInt64 error;
+    };
+
+    explicit SpaceSaving(size_t capacity_) : capacity(std::max(capacity_, size_t(1)))
+    {
+        counters.reserve(capacity);
+        index.reserve(capacity);
+    }
+
+    void insert(const Key & key, UInt64 weight = 1)
+    {
+        if (auto it = index.find(key); it != index.end())
+        {
+            counters[it->second].count += weight;
+            siftDown(it->second);
+            return;
+        }
+
+        if (counters.size() < capacity)
+        {
+            counters.push_back(Counter{key, weight, 0});
+            index.emplace(key, counters.size() - 1);
+            siftUp(counters.size() - 1);
+            return;
+        }
+
+        /// Replace the smallest one, which is the root
+        auto & smallest = counters.front();
+        index.erase(smallest.key);
+        smallest.key = key;
+        smallest.error = smallest.count;
+        smallest.count += weight;
+        index.emplace(key, 0);
+        siftDown(0);
+    }
+
+    /// At most limit counters by count descending
+    std::vector<Counter> top(size_t limit) const
+    {
+        std::vector<Counter> res(counters);
+        std::sort(res.begin(), res.end(), [](const Counter & lhs, const Counter & rhs) { return lhs.count > rhs.count; });
+        if (res.size() > limit)
+            res.resize(limit);
+        return res;
+    }
+
+    size_t size() const { return counters.size(); }
+
+    void clear()
+    {
+        counters.clear();
+        index.clear();
+    }
+
+private:
+    void swapCounters(size_t lhs, size_t rhs)
+    {
+        std::swap(counters[lhs], counters[rhs]);
+        index[counters[lhs].key] = lhs;
+        index[counters[rhs].key] = rhs;
+    }
+
+    void siftUp(size_t pos)
+    {
+        while (pos > 0)
+        {
+            size_t parent = (pos - 1) / 2;
+            if (counters[parent].count <= counters[pos].count)
+                break;
+            swapCounters(pos, parent);
+            pos = parent;
+        }
+    }
+
+    void siftDown(size_t pos)
+    {
+        while (true)
+        {
+            size_t smallest = pos;
+            for (size_t child = 2 * pos + 1; child <= 2 * pos + 2 && child < counters.size(); ++child)
+                if (counters[child].count < counters[smallest].count)
+                    smallest = child;
+            if (smallest == pos)
+                break;
+            swapCounters(pos, smallest);
+            pos = smallest;
+        }
+    }
+
+    size_t capacity;
+    std::vector<Counter> counters;
+    /// Position of key in counters
+    std::unordered_map<Key, size_t, Hash> index;
+};
+
+}
@@ -3,6 +3,7 @@
 #include <Poco/Util/Application.h>
 #include <Poco/Util/LayeredConfiguration.h>
 
+#include <Common/CpuProfiler.h>
 #include <Common/CurrentMetrics.h>
 #include <Common/Exception.h>
 #include <Common/ThreadPool.h>
@@ -266,6 +267,8 @@ void ThreadPoolImpl<Thread>::worker(typename std::list<Thread>::iterator thread_
                 /// job should be reset before decrementing scheduled_jobs to
                 /// ensure that the Job destroyed before wait() returns.
                 job = {};
+                /// The next job may be of another thread class
+                CpuProfiler::unregisterCurrentThread();
             }
             catch (...)
             {
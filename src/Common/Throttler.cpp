@@ -0,0 +1,39 @@
+#include <Common/Throttler.h>
+
+#include <algorithm>
+#include <Common/Stopwatch.h>
+#include <common/sleep.h>
+
+
+namespace RK
+{
+
+static constexpr UInt64 NS_PER_SECOND = 1000000000;
+
+Throttler::Throttler(UInt64 max_speed_, UInt64 max_burst_)
+    : max_speed(std::max<UInt64>(max_speed_, 1))
+    , max_burst_ns(max_burst_ ? static_cast<UInt64>(static_cast<double>(max_burst_) * NS_PER_SECOND / max_speed) : NS_PER_SECOND / 10)
+{
+}
+
+void Throttler::add(UInt64 amount)
+{
+    const UInt64 cost_ns = static_cast<UInt64>(static_cast<double>(amount) * NS_PER_SECOND / max_speed);
+    const UInt64 now = clock_gettime_ns();
+
+    UInt64 full_at = full_at_ns.load(std::memory_order_relaxed);
+    UInt64 new_full_at;
+    do
+        new_full_at = std::max(full_at, now) + cost_ns;
+    while (!full_at_ns.compare_exchange_weak(full_at, new_full_at, std::memory_order_relaxed));
+
+    /// Units beyond the burst are waited for
+    if (new_full_at > now + max_burst_ns)
+    {
+        UInt64 sleep_ns = new_full_at - now - max_burst_ns;
+        slept_ns.fetch_add(sleep_ns, std::memory_order_relaxed);
+        sleepForNanoseconds(sleep_ns);
+    }
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Limits the speed of an operation to max_speed units per second, e.g. bytes written to disk, by sleeping the caller.
+  *
+  * It is a token bucket holding at most max_burst units, kept as the time when the bucket will be full again
+  * (the generic cell rate algorithm), so add() is a compare-and-swap of one atomic and the throttler can be shared by
+  * threads without lock. It is also safe in a forked child process, where a mutex locked by another thread would never
+  * be unlocked.
+  */
+class Throttler
+{
+public:
+    /// max_burst of 0 means units of 100ms
+    explicit Throttler(UInt64 max_speed_, UInt64 max_burst_ = 0);
+
+    /// Account amount units, sleep until they fit the speed.
+    void add(UInt64 amount);
+
+    UInt64 getMaxSpeed() const { return max_speed; }
+
+    /// Total time slept in add()
+    UInt64 getSleptNs() const { return slept_ns.load(std::memory_order_relaxed); }
+
+private:
+    const UInt64 max_speed;
+    /// Time to earn max_burst units
+    const UInt64 max_burst_ns;
+
+    /// The time when the consumed units are earned back
+    std::atomic<UInt64> full_at_ns{0};
+    std::atomic<UInt64> slept_ns{0};
+};
+
+using ThrottlerPtr = std::shared_ptr<Throttler>;
+
+}
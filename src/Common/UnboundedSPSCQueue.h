@@ -0,0 +1,155 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+
+namespace RK
+{
+
+/** Unbounded single producer single consumer queue on a list of blocks. The producer fills the tail block and links
+  * a new one when it is full, the consumer drains the head block and frees it. Push and pop take no lock, and
+  * touch the shared cache lines of a block only to publish and to check the count of values written.
+  *
+  * Producers may change as long as pushes of them happen one after another, the same for consumers.
+  * The last drained block is kept for the producer, so a queue flowing steadily does not allocate.
+  * Counts of values pushed and popped are kept apart for size, which any thread may read.
+  */
+template <typename T, size_t BLOCK_SIZE = 64>
+class UnboundedSPSCQueue
+{
+private:
+    struct Block
+    {
+        std::array<T, BLOCK_SIZE> values;
+        /// Values pushed into the block, written by producer
+        std::atomic<size_t> written{0};
+        std::atomic<Block *> next{nullptr};
+        /// Values popped from the block, consumer only
+        size_t read = 0;
+    };
+
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    /// Consumer only
+    alignas(CACHE_LINE_SIZE) Block * head;
+    /// Written by consumer
+    std::atomic<size_t> popped{0};
+    /// Producer only
+    alignas(CACHE_LINE_SIZE) Block * tail;
+    /// Written by producer
+    std::atomic<size_t> pushed{0};
+    /// Drained block given back by consumer
+    alignas(CACHE_LINE_SIZE) std::atomic<Block *> spare{nullptr};
+
+    Block * newBlock()
+    {
+        Block * block = spare.exchange(nullptr, std::memory_order_acquire);
+        if (!block)
+            return new Block;
+        block->written.store(0, std::memory_order_relaxed);
+        block->next.store(nullptr, std::memory_order_relaxed);
+        block->read = 0;
+        return block;
+    }
+
+    void freeBlock(Block * block)
+    {
+        block = spare.exchange(block, std::memory_order_release);
+        delete block;
+    }
+
+    /// Block of the next value to pop, nullptr if the queue is empty. Consumer only.
+    Block * readableBlock()
+    {
+        while (true)
+        {
+            if (head->read < head->written.load(std::memory_order_acquire))
+                return head;
+            if (head->read < BLOCK_SIZE)
+                return nullptr;
+
+            /// Drained, the producer has linked the next one or will
+            Block * next = head->next.load(std::memory_order_acquire);
+            if (!next)
+                return nullptr;
+            freeBlock(head);
+            head = next;
+        }
+    }
+
+public:
+    UnboundedSPSCQueue() : head(new Block), tail(head) { }
+
+    UnboundedSPSCQueue(const UnboundedSPSCQueue &) = delete;
+    UnboundedSPSCQueue & operator=(const UnboundedSPSCQueue &) = delete;
+
+    ~UnboundedSPSCQueue()
+    {
+        while (head)
+        {
+            Block * next = head->next.load(std::memory_order_relaxed);
+            delete head;
+            head = next;
+        }
+        delete spare.load(std::memory_order_relaxed);
+    }
+
+    template <typename U>
+    void push(U && x)
+    {
+        size_t written = tail->written.load(std::memory_order_relaxed);
+        if (written == BLOCK_SIZE)
+        {
+            Block * block = newBlock();
+            block->values[0] = std::forward<U>(x);
+            block->written.store(1, std::memory_order_release);
+            tail->next.store(block, std::memory_order_release);
+            tail = block;
+        }
+        else
+        {
+            tail->values[written] = std::forward<U>(x);
+            tail->written.store(written + 1, std::memory_order_release);
+        }
+        pushed.store(pushed.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /// Consumer only
+    bool tryPop(T & x)
+    {
+        Block * block = readableBlock();
+        if (!block)
+            return false;
+
+        T & value = block->values[block->read++];
+        x = std::move(value);
+        value = T{};
+        popped.store(popped.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Next value to pop, it is examined in place and stays in the queue, nullptr if the queue is empty.
+    /// Consumer only, valid until the next pop.
+    T * front()
+    {
+        Block * block = readableBlock();
+        return block ? &block->values[block->read] : nullptr;
+    }
+
+    /// Consumer only, a value pushed concurrently may be not seen
+    bool empty() { return readableBlock() == nullptr; }
+
+    /// Values pushed and not popped yet, any thread. The consumer may pop at least as many.
+    size_t size() const
+    {
+        size_t popped_count = popped.load(std::memory_order_acquire);
+        return pushed.load(std::memory_order_acquire) - popped_count;
+    }
+
+    /// Approximate bytes of the blocks holding values, with the head and spare blocks
+    size_t getBufferSizeInBytes() const { return (size() / BLOCK_SIZE + 2) * sizeof(Block); }
+};
+
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#include <common/types.h>
+
+namespace RK
+{
+
+/** Indices [0, count) split into contiguous ranges, one per worker, for work stealing. A worker takes batches from the
+  * front of its own range, and when it is drained steals the back half of the largest range left and carries on with
+  * it, so a worker given slow items does not hold back the others, which static partitioning by index % workers does.
+  *
+  * A range is begin and end packed into one atomic word, taking a batch or stealing is one CAS on the cache line of the
+  * range, there is no lock or shared queue. Count should be less than 2^32.
+  */
+class WorkStealingRanges
+{
+public:
+    WorkStealingRanges(size_t count, size_t workers_, size_t batch_ = 1)
+        : workers(std::max(workers_, size_t(1))), batch(std::max(batch_, size_t(1))), ranges(std::make_unique<Range[]>(workers))
+    {
+        for (size_t i = 0; i < workers; i++)
+            ranges[i].value.store(pack(count * i / workers, count * (i + 1) / workers), std::memory_order_relaxed);
+    }
+
+    size_t workersNum() const { return workers; }
+
+    /// Next batch [begin, end) of worker, false if all indices are taken
+    bool next(size_t worker, size_t & begin, size_t & end)
+    {
+        while (true)
+        {
+            if (takeFront(ranges[worker], begin, end))
+                return true;
+            if (!steal(worker))
+                return false;
+        }
+    }
+
+private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    struct alignas(CACHE_LINE_SIZE) Range
+    {
+        std::atomic<UInt64> value{0};
+    };
+
+    static UInt64 pack(UInt64 begin, UInt64 end) { return (begin << 32) | end; }
+    static UInt64 beginOf(UInt64 value) { return value >> 32; }
+    static UInt64 endOf(UInt64 value) { return value & 0xFFFFFFFF; }
+
+    bool takeFront(Range & range, size_t & begin, size_t & end) const
+    {
+        UInt64 value = range.value.load(std::memory_order_acquire);
+        while (beginOf(value) < endOf(value))
+        {
+            UInt64 new_begin = std::min(beginOf(value) + batch, endOf(value));
+            if (range.value.compare_exchange_weak(value, pack(new_begin, endOf(value)), std::memory_order_acq_rel))
+            {
+                begin = beginOf(value);
+                end = new_begin;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// Move the back half of the largest range of others to the drained range of worker
+    bool steal(size_t worker)
+    {
+        while (true)
+        {
+            size_t victim = workers;
+            UInt64 victim_value = 0;
+            UInt64 victim_left = 0;
+            for (size_t i = 0; i < workers; i++)
+            {
+                if (i == worker)
+                    continue;
+                UInt64 value = ranges[i].value.load(std::memory_order_acquire);
+                UInt64 left = beginOf(value) < endOf(value) ? endOf(value) - beginOf(value) : 0;
+                if (left > victim_left)
+                {
+                    victim = i;
+                    victim_value = value;
+                    victim_left = left;
+                }
+            }
+            if (victim == workers)
+                return false;
+
+            UInt64 middle = endOf(victim_value) - (victim_left + 1) / 2;
+            if (ranges[victim].value.compare_exchange_strong(
+                    victim_value, pack(beginOf(victim_value), middle), std::memory_order_acq_rel))
+            {
+                /// Only its owner writes a drained range, others take nothing from it
+                ranges[worker].value.store(pack(middle, endOf(victim_value)), std::memory_order_release);
+                return true;
+            }
+        }
+    }
+
+    const size_t workers;
+    const size_t batch;
+    std::unique_ptr<Range[]> ranges;
+};
+
+/** Run job(index) for every index in [0, count) by thread_num jobs of thread_pool with work stealing, and wait for them.
+  * An exception of a job is rethrown by the wait of thread_pool, like it is for jobs scheduled directly. Small jobs
+  * may be taken by batch_size at a time to touch the ranges less.
+  */
+template <typename Pool>
+void parallelFor(Pool & thread_pool, size_t thread_num, size_t count, const std::function<void(size_t)> & job, size_t batch_size = 1)
+{
+    WorkStealingRanges ranges(count, std::min(thread_num, count), batch_size);
+    for (size_t worker = 0; worker < ranges.workersNum(); worker++)
+    {
+        thread_pool.scheduleOrThrowOnError(
+            [&ranges, &job, worker]
+            {
+                size_t begin;
+                size_t end;
+                while (ranges.next(worker, begin, end))
+                    for (size_t i = begin; i < end; i++)
+                        job(i);
+            });
+    }
+    thread_pool.wait();
+}
+
+/** Like parallelFor, but the calling thread is one of the thread_num workers and the pool is not waited for, so it may be
+  * called by several threads at a time or from jobs of the same pool. Jobs which can not be scheduled or start late
+  * find their ranges stolen and do nothing, the caller steals what is left and waits only for batches taken by others.
+  * The first exception of a job is rethrown after all indices are done.
+  */
+template <typename Pool>
+void parallelForWithCaller(
+    Pool & thread_pool, size_t thread_num, size_t count, const std::function<void(size_t)> & job, size_t batch_size = 1)
+{
+    struct State
+    {
+        State(size_t count_, size_t workers, size_t batch, const std::function<void(size_t)> & job_)
+            : ranges(count_, workers, batch), count(count_), job(job_)
+        {
+        }
+
+        void work(size_t worker)
+        {
+            size_t begin;
+            size_t end;
+            while (ranges.next(worker, begin, end))
+            {
+                for (size_t i = begin; i < end; i++)
+                {
+                    try
+                    {
+                        job(i);
+                    }
+                    catch (...)
+                    {
+                        std::lock_guard lock(mutex);
+                        if (!exception)
+                            exception = std::current_exception();
+                    }
+                }
+
+                if (done.fetch_add(end - begin, std::memory_order_acq_rel) + (end - begin) == count)
+                {
+                    std::lock_guard lock(mutex);
+                    all_done.notify_all();
+                }
+            }
+        }
+
+        WorkStealingRanges ranges;
+        const size_t count;
+        /// Not called by jobs starting after all indices are taken, which may be after the caller returned
+        const std::function<void(size_t)> & job;
+        std::atomic<size_t> done{0};
+        std::mutex mutex;
+        std::condition_variable all_done;
+        std::exception_ptr exception;
+    };
+
+    if (count == 0)
+        return;
+
+    auto state = std::make_shared<State>(count, std::min(thread_num, count), batch_size, job);
+    for (size_t worker = 1; worker < state->ranges.workersNum(); worker++)
+        if (!thread_pool.trySchedule([state, worker] { state->work(worker); }))
+            break;
+
+    state->work(0);
+
+    std::unique_lock lock(state->mutex);
+    state->all_done.wait(lock, [&] { return state->done.load(std::memory_order_acquire) == count; });
+    if (state->exception)
+        std::rethrow_exception(state->exception);
+}
+
+}
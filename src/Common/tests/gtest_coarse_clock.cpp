@@ -0,0 +1,39 @@
+#include <Common/CoarseClock.h>
+#include <Common/Stopwatch.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace RK;
+
+TEST(CoarseClock, Updated)
+{
+    auto & clock = CoarseClock::instance();
+
+    /// Precise before start
+    UInt64 precise = clock_gettime_ns(CLOCK_REALTIME) / 1000000;
+    ASSERT_GE(CoarseClock::nowMilliseconds(), precise);
+
+    clock.initialize(1);
+    UInt64 start = CoarseClock::nowMilliseconds();
+    UInt64 monotonic_start = CoarseClock::monotonicMilliseconds();
+    ASSERT_GE(start, precise);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_GT(CoarseClock::nowMilliseconds(), start);
+    ASSERT_GT(CoarseClock::monotonicMilliseconds(), monotonic_start);
+
+    /// Lags behind at most a little more than the resolution
+    UInt64 now = clock_gettime_ns(CLOCK_REALTIME) / 1000000;
+    ASSERT_LE(CoarseClock::nowMilliseconds(), now);
+    ASSERT_LT(now - CoarseClock::nowMilliseconds(), UInt64(1000));
+
+    clock.shutdown();
+    precise = clock_gettime_ns(CLOCK_REALTIME) / 1000000;
+    ASSERT_GE(CoarseClock::nowMilliseconds(), precise);
+
+    /// 0 resolution keeps reads precise
+    clock.initialize(0);
+    precise = clock_gettime_ns(CLOCK_REALTIME) / 1000000;
+    ASSERT_GE(CoarseClock::nowMilliseconds(), precise);
+}
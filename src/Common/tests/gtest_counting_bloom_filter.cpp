@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+
+#include <functional>
+#include <string>
+#include <Common/CountingBloomFilter.h>
+
+using namespace RK;
+
+TEST(Common, CountingBloomFilterNoFalseNegative)
+{
+    CountingBloomFilter filter(1000);
+    std::hash<std::string> hash;
+
+    for (int i = 0; i < 1000; ++i)
+        filter.add(hash("/node" + std::to_string(i)));
+    for (int i = 0; i < 1000; ++i)
+        ASSERT_TRUE(filter.mayContain(hash("/node" + std::to_string(i))));
+
+    /// Removing some hashes does not affect the others
+    for (int i = 0; i < 1000; i += 2)
+        filter.remove(hash("/node" + std::to_string(i)));
+    for (int i = 1; i < 1000; i += 2)
+        ASSERT_TRUE(filter.mayContain(hash("/node" + std::to_string(i))));
+    ASSERT_EQ(filter.size(), 500);
+}
+
+TEST(Common, CountingBloomFilterFalsePositiveRate)
+{
+    CountingBloomFilter filter(10000);
+    std::hash<std::string> hash;
+
+    for (int i = 0; i < 10000; ++i)
+        filter.add(hash("/lock/member" + std::to_string(i)));
+
+    size_t false_positives = 0;
+    for (int i = 0; i < 100000; ++i)
+        false_positives += filter.mayContain(hash("/lock/missing" + std::to_string(i)));
+    ASSERT_LT(false_positives, 5000);
+
+    filter.reset(10000);
+    ASSERT_FALSE(filter.mayContain(hash("/lock/member0")));
+}
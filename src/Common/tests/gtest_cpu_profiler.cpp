@@ -0,0 +1,85 @@
+#include <Common/CpuProfiler.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <time.h>
+
+using namespace RK;
+
+namespace
+{
+
+UInt64 threadCpuTimeNs()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<UInt64>(ts.tv_sec) * 1000000000 + static_cast<UInt64>(ts.tv_nsec);
+}
+
+/// Spin for cpu_ms of the cpu time of the current thread
+void burnCpu(UInt64 cpu_ms)
+{
+    volatile UInt64 value = 0;
+    UInt64 start = threadCpuTimeNs();
+    while (threadCpuTimeNs() - start < cpu_ms * 1000000)
+        for (size_t i = 0; i < 1000; ++i)
+            value = value + i;
+}
+
+}
+
+#if defined(OS_LINUX)
+
+TEST(CpuProfiler, SampleRegisteredThread)
+{
+    auto & profiler = CpuProfiler::instance();
+    profiler.initialize(true, 1000, CpuProfiler::DEFAULT_MAX_STACKS);
+
+    profiler.registerCurrentThread("test_class");
+    burnCpu(200);
+    CpuProfiler::unregisterCurrentThread();
+
+    ASSERT_GT(profiler.getSampleCount(), 0);
+    String folded = profiler.getFoldedStacks();
+    ASSERT_EQ(folded.rfind("test_class;", 0), 0) << folded;
+    ASSERT_EQ(folded.back(), '\n');
+
+    /// Not sampled after unregistering
+    profiler.reset();
+    burnCpu(50);
+    ASSERT_EQ(profiler.getSampleCount(), 0);
+    ASSERT_TRUE(profiler.getFoldedStacks().empty());
+
+    profiler.shutdown();
+}
+
+TEST(CpuProfiler, MaxStacks)
+{
+    auto & profiler = CpuProfiler::instance();
+    profiler.initialize(true, 1000, 0);
+
+    profiler.registerCurrentThread("test_class");
+    burnCpu(100);
+    CpuProfiler::unregisterCurrentThread();
+
+    String folded = profiler.getFoldedStacks();
+    ASSERT_EQ(folded.rfind("test_class;[other] ", 0), 0) << folded;
+    ASSERT_EQ(std::count(folded.begin(), folded.end(), '\n'), 1);
+
+    profiler.shutdown();
+}
+
+#endif
+
+TEST(CpuProfiler, Disabled)
+{
+    auto & profiler = CpuProfiler::instance();
+    profiler.initialize(false, 1000, CpuProfiler::DEFAULT_MAX_STACKS);
+
+    profiler.registerCurrentThread("test_class");
+    burnCpu(50);
+    CpuProfiler::unregisterCurrentThread();
+
+    ASSERT_FALSE(profiler.isEnabled());
+    ASSERT_EQ(profiler.getSampleCount(), 0);
+}
@@ -0,0 +1,109 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <Common/FlatHashMap.h>
+#include <Common/HashFunctions.h>
+
+using namespace RK;
+
+TEST(Common, FlatHashMapBasic)
+{
+    FlatHashMap<std::string, int> map;
+    ASSERT_TRUE(map.empty());
+    ASSERT_TRUE(map.find("a") == map.end());
+
+    ASSERT_TRUE(map.insert_or_assign("a", 1).second);
+    ASSERT_FALSE(map.insert_or_assign("a", 2).second);
+    ASSERT_EQ(map.find("a")->second, 2);
+    ASSERT_EQ(map.size(), 1);
+
+    ASSERT_EQ(map.erase("a"), 1);
+    ASSERT_EQ(map.erase("a"), 0);
+    ASSERT_TRUE(map.empty());
+    ASSERT_TRUE(map.begin() == map.end());
+}
+
+TEST(Common, FlatHashMapHashedStringView)
+{
+    FlatHashMap<std::string, int> map;
+    std::string path = "/a/b/c";
+    std::string_view parent = std::string_view(path).substr(0, 4);
+    size_t hash = std::hash<std::string_view>()(parent);
+
+    /// The key is constructed only when it is inserted
+    ASSERT_TRUE(map.findHashed(parent, hash) == map.end());
+    ASSERT_TRUE(map.tryEmplaceHashed(parent, hash, 1).second);
+    ASSERT_FALSE(map.insertOrAssignHashed(parent, hash, 2).second);
+    ASSERT_EQ(map.find("/a/b")->second, 2);
+    ASSERT_EQ(map.findHashed(parent, hash)->second, 2);
+
+    ASSERT_EQ(map.eraseHashed(parent, hash), 1);
+    ASSERT_TRUE(map.empty());
+}
+
+TEST(Common, FlatHashMapCompareWithStd)
+{
+    FlatHashMap<std::string, int> map;
+    std::unordered_map<std::string, int> expected;
+
+    std::mt19937 rng(42);
+    for (int i = 0; i < 200000; ++i)
+    {
+        auto key = "/clickhouse/tables/" + std::to_string(rng() % 10000);
+        switch (rng() % 3)
+        {
+            case 0:
+                ASSERT_EQ(map.insert_or_assign(key, i).second, expected.insert_or_assign(key, i).second);
+                break;
+            case 1:
+                ASSERT_EQ(map.erase(key), expected.erase(key));
+                break;
+            default: {
+                auto it = map.find(key);
+                auto expected_it = expected.find(key);
+                ASSERT_EQ(it == map.end(), expected_it == expected.end());
+                if (expected_it != expected.end())
+                    ASSERT_EQ(it->second, expected_it->second);
+            }
+        }
+    }
+
+    ASSERT_EQ(map.size(), expected.size());
+
+    size_t visited = 0;
+    for (const auto & [key, value] : map)
+    {
+        ASSERT_EQ(expected.at(key), value);
+        ++visited;
+    }
+    ASSERT_EQ(visited, expected.size());
+
+    auto copied = map;
+    ASSERT_EQ(copied.size(), map.size());
+    for (const auto & [key, value] : expected)
+        ASSERT_EQ(copied.find(key)->second, value);
+}
+
+TEST(Common, FlatHashMapProbeGroups)
+{
+    FlatHashMap<std::string, int, StringHash> map;
+    ASSERT_EQ(map.averageProbeGroups(), 0);
+    for (int i = 0; i < 100000; ++i)
+        map.insert_or_assign("/bench/d" + std::to_string(i / 100) + "/n" + std::to_string(i), i);
+
+    /// Most keys are in their own group at load factor up to 7/8
+    ASSERT_GE(map.averageProbeGroups(), 1);
+    ASSERT_LT(map.averageProbeGroups(), 1.5);
+}
+
+TEST(Common, HashPair)
+{
+    /// XOR of hashes is the same for swapped and 0 for equal ids
+    ASSERT_NE(hashPair(1, 2), hashPair(2, 1));
+    ASSERT_NE(hashPair(3, 3), hashPair(4, 4));
+    ASSERT_NE(hashPair(3, 3), size_t(0));
+    ASSERT_EQ(StringHash()(std::string_view("/a/b")), StringHash()(std::string("/a/b")));
+}
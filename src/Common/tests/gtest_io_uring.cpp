@@ -0,0 +1,95 @@
+#include <gtest/gtest.h>
+
+#if defined(OS_LINUX)
+
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <Common/IOUring.h>
+#include <Common/Exception.h>
+
+using namespace RK;
+
+namespace
+{
+
+std::unique_ptr<IOUring> tryCreateRing()
+{
+    try
+    {
+        return std::make_unique<IOUring>(8);
+    }
+    catch (const Exception &)
+    {
+        return nullptr;
+    }
+}
+
+}
+
+TEST(Common, IOUringLinkedWriteAndFdatasync)
+{
+    auto ring = tryCreateRing();
+    if (!ring)
+        GTEST_SKIP() << "io_uring is not available";
+
+    char path[] = "/tmp/gtest_io_uring_XXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+
+    std::string first = "hello ";
+    std::string second = "io_uring";
+    iovec vec[2] = {{first.data(), first.size()}, {second.data(), second.size()}};
+
+    /// Write at an offset, then fdatasync after the write succeeds
+    ring->prepareWritev(fd, vec, 2, 4, 1, true, false);
+    ring->prepareFdatasync(fd, 2, false);
+    ring->submit();
+
+    std::vector<std::pair<UInt64, int>> completions;
+    while (completions.size() < 2)
+    {
+        ring->wait();
+        UInt64 user_data;
+        int result;
+        while (ring->popCompletion(user_data, result))
+            completions.emplace_back(user_data, result);
+    }
+
+    ASSERT_EQ(completions[0], std::make_pair(UInt64(1), static_cast<int>(first.size() + second.size())));
+    ASSERT_EQ(completions[1], std::make_pair(UInt64(2), 0));
+
+    char buf[64]{};
+    ASSERT_EQ(pread(fd, buf, sizeof(buf), 0), 18);
+    ASSERT_EQ(std::string(buf + 4, 14), "hello io_uring");
+
+    close(fd);
+    unlink(path);
+}
+
+TEST(Common, IOUringQueueFull)
+{
+    auto ring = tryCreateRing();
+    if (!ring)
+        GTEST_SKIP() << "io_uring is not available";
+
+    /// The last one finds the queue full and submits the others first
+    for (unsigned i = 0; i <= ring->getEntries(); ++i)
+        ring->prepareNop(i);
+    ring->submit();
+
+    unsigned completed = 0;
+    UInt64 user_data;
+    int result;
+    while (completed < ring->getEntries() + 1)
+    {
+        ring->wait();
+        while (ring->popCompletion(user_data, result))
+            ++completed;
+    }
+    ASSERT_FALSE(ring->popCompletion(user_data, result));
+}
+
+#endif
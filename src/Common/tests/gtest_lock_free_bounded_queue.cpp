@@ -0,0 +1,154 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+#include <Common/LockFreeBoundedQueue.h>
+#include <common/scope_guard.h>
+
+using namespace RK;
+
+TEST(LockFreeBoundedQueue, PushPop)
+{
+    LockFreeBoundedQueue<std::shared_ptr<int>> queue(3);
+    ASSERT_EQ(queue.capacity(), 4);
+    ASSERT_TRUE(queue.empty());
+
+    for (int i = 0; i < 4; ++i)
+        ASSERT_TRUE(queue.tryPush(std::make_shared<int>(i)));
+
+    /// Full
+    ASSERT_FALSE(queue.tryPush(std::make_shared<int>(4)));
+    ASSERT_FALSE(queue.tryPush(std::make_shared<int>(4), 10));
+    ASSERT_EQ(queue.size(), 4);
+
+    std::shared_ptr<int> x;
+    ASSERT_TRUE(queue.peek(x));
+    ASSERT_EQ(*x, 0);
+
+    /// Front is not copied
+    x.reset();
+    ASSERT_EQ(*queue.front()->get(), 0);
+    ASSERT_EQ(queue.front()->use_count(), 1);
+
+    for (int i = 0; i < 4; ++i)
+    {
+        ASSERT_TRUE(queue.tryPop(x));
+        ASSERT_EQ(*x, i);
+    }
+
+    /// Empty
+    ASSERT_FALSE(queue.tryPop(x));
+    ASSERT_FALSE(queue.tryPop(x, 10));
+    ASSERT_FALSE(queue.peek(x));
+    ASSERT_FALSE(queue.front());
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(LockFreeBoundedQueue, PopBatch)
+{
+    LockFreeBoundedQueue<int> queue(16);
+    for (int i = 0; i < 10; ++i)
+        queue.push(i);
+
+    std::vector<int> res;
+    ASSERT_EQ(queue.tryPopBatch(res, 4), 4);
+    ASSERT_EQ(queue.tryPopBatch(res, 100), 6);
+    ASSERT_EQ(queue.tryPopBatch(res, 100), 0);
+
+    ASSERT_EQ(res.size(), 10);
+    for (int i = 0; i < 10; ++i)
+        ASSERT_EQ(res[i], i);
+}
+
+TEST(LockFreeBoundedQueue, MultiProducer)
+{
+    static constexpr size_t producers = 4;
+    static constexpr size_t per_producer = 100000;
+
+    /// Small capacity, so that both producers and consumer park
+    LockFreeBoundedQueue<size_t> queue(64);
+
+    std::vector<std::thread> threads;
+    for (size_t p = 0; p < producers; ++p)
+        threads.emplace_back([&queue, p]
+        {
+            for (size_t i = 0; i < per_producer; ++i)
+                queue.push(p * per_producer + i);
+        });
+
+    std::vector<size_t> last(producers, 0);
+    size_t sum = 0;
+    for (size_t i = 0; i < producers * per_producer; ++i)
+    {
+        size_t x;
+        ASSERT_TRUE(queue.tryPop(x, 10000));
+
+        /// Order is kept for each producer
+        size_t p = x / per_producer;
+        ASSERT_GE(x % per_producer + 1, last[p]);
+        last[p] = x % per_producer + 1;
+        sum += x;
+    }
+
+    for (auto & thread : threads)
+        thread.join();
+
+    size_t total = producers * per_producer;
+    ASSERT_EQ(sum, total * (total - 1) / 2);
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(LockFreeBoundedQueue, BusyPoll)
+{
+    BusyPoll::setBudget(2000);
+    SCOPE_EXIT({ BusyPoll::setBudget(0); });
+
+    LockFreeBoundedQueue<int> queue(4);
+    std::thread producer(
+        [&]
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(500));
+            queue.push(1);
+        });
+
+    int x = 0;
+    ASSERT_TRUE(queue.tryPop(x, 1000));
+    ASSERT_EQ(x, 1);
+    producer.join();
+
+    /// Spinning does not go beyond timeout
+    auto start = std::chrono::steady_clock::now();
+    ASSERT_FALSE(queue.tryPop(x, 1));
+    ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(100));
+}
+
+TEST(LockFreeBoundedQueue, Limit)
+{
+    LockFreeBoundedQueue<int> queue(8);
+    ASSERT_EQ(queue.getLimit(), 8);
+
+    /// Capped by capacity
+    ASSERT_EQ(queue.setLimit(100), 8);
+    ASSERT_EQ(queue.setLimit(2), 2);
+    ASSERT_TRUE(queue.tryPush(1));
+    ASSERT_TRUE(queue.tryPush(2));
+    ASSERT_FALSE(queue.tryPush(3));
+
+    /// Objects above a lowered limit are kept
+    queue.setLimit(1);
+    ASSERT_EQ(queue.size(), 2);
+    int x;
+    ASSERT_TRUE(queue.tryPop(x));
+    ASSERT_FALSE(queue.tryPush(3));
+    ASSERT_TRUE(queue.tryPop(x));
+    ASSERT_TRUE(queue.tryPush(3));
+
+    /// Raising the limit wakes up a blocked producer
+    std::thread producer([&] { queue.push(4); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ASSERT_EQ(queue.size(), 1);
+    queue.setLimit(8);
+    producer.join();
+    ASSERT_EQ(queue.size(), 2);
+}
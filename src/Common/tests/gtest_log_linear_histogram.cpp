@@ -0,0 +1,73 @@
+#include <Common/LogLinearHistogram.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace RK;
+
+TEST(LogLinearHistogram, Buckets)
+{
+    for (size_t bucket = 0; bucket + 1 < LogLinearHistogram::BUCKETS; ++bucket)
+    {
+        ASSERT_EQ(LogLinearHistogram::lowerBound(bucket) + LogLinearHistogram::width(bucket), LogLinearHistogram::lowerBound(bucket + 1));
+        ASSERT_EQ(LogLinearHistogram::bucketOf(LogLinearHistogram::lowerBound(bucket)), bucket);
+    }
+
+    for (UInt64 value = 0; value < LogLinearHistogram::SUB_BUCKETS; ++value)
+        ASSERT_EQ(LogLinearHistogram::bucketOf(value), value);
+
+    ASSERT_EQ(LogLinearHistogram::bucketOf(~UInt64(0)), LogLinearHistogram::BUCKETS - 1);
+
+    /// Relative error of the lower bound is less than 1 / SUB_BUCKETS
+    for (UInt64 value : {33ULL, 100ULL, 1000ULL, 123456789ULL, 1ULL << 40, (1ULL << 40) - 1})
+    {
+        UInt64 lower_bound = LogLinearHistogram::lowerBound(LogLinearHistogram::bucketOf(value));
+        ASSERT_LE(lower_bound, value);
+        ASSERT_LT((value - lower_bound) * LogLinearHistogram::SUB_BUCKETS, value);
+    }
+}
+
+TEST(LogLinearHistogram, Quantiles)
+{
+    auto histogram = std::make_unique<LogLinearHistogram>();
+    ASSERT_EQ(histogram->getSnapshot().quantile(0.5), 0);
+
+    for (UInt64 value = 1; value <= 100; ++value)
+        histogram->add(value);
+
+    auto snapshot = histogram->getSnapshot();
+    ASSERT_EQ(snapshot.count, 100);
+    ASSERT_EQ(snapshot.sum, 5050);
+    ASSERT_EQ(snapshot.quantile(0), 1);
+    ASSERT_EQ(snapshot.quantile(1), 100.5);
+    ASSERT_NEAR(snapshot.quantile(0.5), 50, 50.0 / LogLinearHistogram::SUB_BUCKETS);
+    ASSERT_NEAR(snapshot.quantile(0.99), 99, 99.0 / LogLinearHistogram::SUB_BUCKETS);
+    ASSERT_EQ(snapshot.countLessThan(64), 63);
+
+    histogram->reset();
+    snapshot = histogram->getSnapshot();
+    ASSERT_EQ(snapshot.count, 0);
+    ASSERT_EQ(snapshot.sum, 0);
+}
+
+TEST(LogLinearHistogram, Threads)
+{
+    /// Fewer shards than threads
+    auto histogram = std::make_unique<LogLinearHistogram>(3);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 32; ++i)
+        threads.emplace_back([&] {
+            for (UInt64 value = 1; value <= 10000; ++value)
+                histogram->add(value);
+        });
+    for (auto & thread : threads)
+        thread.join();
+
+    auto snapshot = histogram->getSnapshot();
+    ASSERT_EQ(snapshot.count, 32 * 10000);
+    ASSERT_EQ(snapshot.sum, 32 * 5000 * 10001);
+    ASSERT_EQ(snapshot.countLessThan(32), 32 * 31);
+}
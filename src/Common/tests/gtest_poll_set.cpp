@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+
+#include <Poco/Net/ServerSocket.h>
+#include <Poco/Net/StreamSocket.h>
+#include <Network/PollSet.h>
+
+using namespace RK;
+
+namespace
+{
+
+int pollMode(PollSet & poll_set, const Poco::Net::Socket & socket)
+{
+    PollSet::Events events;
+    poll_set.poll(Poco::Timespan(0, 100000), events);
+    int mode = 0;
+    for (const auto & event : events)
+        if (event.fd == socket.impl()->sockfd())
+            mode |= event.mode;
+    return mode;
+}
+
+void testLevelTriggered(PollSet::Backend backend)
+{
+    Poco::Net::ServerSocket listener(Poco::Net::SocketAddress("127.0.0.1", 0));
+    Poco::Net::StreamSocket client(listener.address());
+    Poco::Net::StreamSocket server = listener.acceptConnection();
+
+    PollSet poll_set(backend);
+    poll_set.add(server, PollSet::POLL_READ);
+    ASSERT_TRUE(poll_set.has(server));
+    ASSERT_EQ(poll_set.count(), 1);
+    ASSERT_EQ(pollMode(poll_set, server), 0);
+
+    client.sendBytes("x", 1);
+    ASSERT_EQ(pollMode(poll_set, server), PollSet::POLL_READ);
+    /// Not read yet, it is reported again
+    ASSERT_EQ(pollMode(poll_set, server), PollSet::POLL_READ);
+
+    poll_set.update(server, PollSet::POLL_READ | PollSet::POLL_WRITE);
+    ASSERT_EQ(pollMode(poll_set, server), PollSet::POLL_READ | PollSet::POLL_WRITE);
+
+    char buf;
+    ASSERT_EQ(server.receiveBytes(&buf, 1), 1);
+    ASSERT_EQ(pollMode(poll_set, server), PollSet::POLL_WRITE);
+
+    /// Paused sockets are not reported
+    poll_set.update(server, 0);
+    client.sendBytes("x", 1);
+    ASSERT_EQ(pollMode(poll_set, server), 0);
+    poll_set.update(server, PollSet::POLL_READ);
+    ASSERT_EQ(pollMode(poll_set, server), PollSet::POLL_READ);
+
+    poll_set.remove(server);
+    ASSERT_FALSE(poll_set.has(server));
+    ASSERT_TRUE(poll_set.empty());
+    ASSERT_EQ(pollMode(poll_set, server), 0);
+
+    poll_set.wakeUp();
+    PollSet::Events events;
+    poll_set.poll(Poco::Timespan(10, 0), events);
+    ASSERT_TRUE(events.empty());
+}
+
+}
+
+TEST(Common, PollSetEpoll)
+{
+    testLevelTriggered(PollSet::Backend::EPOLL);
+}
+
+/// Falls back to epoll if io_uring is not available
+TEST(Common, PollSetIOUring)
+{
+    testLevelTriggered(PollSet::Backend::IO_URING);
+}
@@ -0,0 +1,89 @@
+#include <Common/ProfiledMutex.h>
+#include <gtest/gtest.h>
+
+#include <thread>
+
+using namespace RK;
+
+namespace
+{
+
+const LockProfiler::Item * findItem(const std::vector<LockProfiler::Item> & report, const String & name)
+{
+    for (const auto & item : report)
+        if (item.name == name)
+            return &item;
+    return nullptr;
+}
+
+}
+
+TEST(ProfiledMutex, Contention)
+{
+    LockProfiler::setEnabled(true);
+    ProfiledMutex mutex("test_contended_mutex");
+
+    {
+        std::lock_guard lock(mutex);
+    }
+    ASSERT_EQ(mutex.getStats().acquisitions, 1);
+    ASSERT_EQ(mutex.getStats().contentions, 0);
+
+    std::unique_lock lock(mutex);
+    std::thread waiter([&mutex] { std::lock_guard waiter_lock(mutex); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    lock.unlock();
+    waiter.join();
+
+    ASSERT_EQ(mutex.getStats().acquisitions, 3);
+    ASSERT_EQ(mutex.getStats().contentions, 1);
+    ASSERT_GE(mutex.getStats().wait_ns, 10000000);
+    ASSERT_GE(mutex.getStats().max_hold_ns, 10000000);
+
+    auto report = LockProfiler::instance().getReport();
+    const auto * item = findItem(report, "test_contended_mutex");
+    ASSERT_NE(item, nullptr);
+    ASSERT_EQ(item->instances, 1);
+    ASSERT_EQ(item->contentions, 1);
+}
+
+TEST(ProfiledMutex, SharedAndRetired)
+{
+    LockProfiler::setEnabled(true);
+    {
+        ProfiledSharedMutex first("test_shared_mutex");
+        ProfiledSharedMutex second("test_shared_mutex");
+        {
+            std::shared_lock lock1(first);
+            std::shared_lock lock2(first);
+            ASSERT_FALSE(first.try_lock());
+        }
+        std::unique_lock lock(second);
+
+        auto report = LockProfiler::instance().getReport();
+        const auto * item = findItem(report, "test_shared_mutex");
+        ASSERT_NE(item, nullptr);
+        ASSERT_EQ(item->instances, 2);
+        ASSERT_EQ(item->acquisitions, 3);
+        ASSERT_EQ(item->contentions, 0);
+    }
+
+    /// Counters of destroyed mutexes are kept
+    auto report = LockProfiler::instance().getReport();
+    const auto * item = findItem(report, "test_shared_mutex");
+    ASSERT_NE(item, nullptr);
+    ASSERT_EQ(item->instances, 0);
+    ASSERT_EQ(item->acquisitions, 3);
+
+    LockProfiler::instance().reset();
+    ASSERT_EQ(findItem(LockProfiler::instance().getReport(), "test_shared_mutex"), nullptr);
+
+    /// Not counted when disabled
+    LockProfiler::setEnabled(false);
+    ProfiledMutex mutex("test_disabled_mutex");
+    {
+        std::lock_guard lock(mutex);
+    }
+    ASSERT_EQ(mutex.getStats().acquisitions, 0);
+    LockProfiler::setEnabled(true);
+}
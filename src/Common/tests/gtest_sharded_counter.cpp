@@ -0,0 +1,58 @@
+#include <Common/ShardedCounter.h>
+#include <gtest/gtest.h>
+
+#include <limits>
+#include <thread>
+#include <vector>
+
+using namespace RK;
+
+TEST(ShardedCounter, AddFromThreads)
+{
+    ShardedCounter counter(4);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < 8; ++i)
+        threads.emplace_back([&counter]
+        {
+            for (size_t j = 0; j < 10000; ++j)
+                counter.add();
+            counter.add(5);
+        });
+    for (auto & thread : threads)
+        thread.join();
+
+    ASSERT_EQ(counter.get(), 8 * 10005);
+
+    counter.reset();
+    ASSERT_EQ(counter.get(), 0);
+}
+
+TEST(ShardedCounter, MinMax)
+{
+    struct alignas(64) Shard
+    {
+        std::atomic<UInt64> min{std::numeric_limits<UInt64>::max()};
+        std::atomic<UInt64> max{0};
+    };
+    Sharded<Shard> shards(2);
+
+    std::vector<std::thread> threads;
+    for (UInt64 i = 1; i <= 4; ++i)
+        threads.emplace_back([&shards, i]
+        {
+            atomicMin(shards.local().min, i * 10);
+            atomicMax(shards.local().max, i * 10);
+        });
+    for (auto & thread : threads)
+        thread.join();
+
+    UInt64 min = std::numeric_limits<UInt64>::max();
+    UInt64 max = 0;
+    for (const auto & shard : shards)
+    {
+        min = std::min(min, shard.min.load());
+        max = std::max(max, shard.max.load());
+    }
+    ASSERT_EQ(min, 10);
+    ASSERT_EQ(max, 40);
+}
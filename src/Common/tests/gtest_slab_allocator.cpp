@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <Common/Exception.h>
+#include <Common/SlabAllocator.h>
+#include <common/types.h>
+
+using namespace RK;
+
+namespace
+{
+struct TestNode
+{
+    int64_t value;
+    String data;
+};
+}
+
+TEST(SlabAllocator, ReuseChunks)
+{
+    using Pool = FixedSizeSlabPool<sizeof(TestNode), alignof(TestNode)>;
+    SlabAllocator<TestNode> allocator;
+
+    std::vector<TestNode *> nodes;
+    for (int i = 0; i < 10000; ++i)
+    {
+        nodes.push_back(allocator.allocate(1));
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(nodes.back()) % alignof(TestNode), 0);
+        new (nodes.back()) TestNode{i, std::to_string(i)};
+    }
+
+    for (int i = 0; i < 10000; ++i)
+    {
+        ASSERT_EQ(nodes[i]->value, i);
+        ASSERT_EQ(nodes[i]->data, std::to_string(i));
+    }
+
+    size_t allocated = Pool::instance().getAllocatedBytes();
+    for (auto * node : nodes)
+    {
+        node->~TestNode();
+        allocator.deallocate(node, 1);
+    }
+    nodes.clear();
+
+    /// Freed chunks are reused
+    for (int i = 0; i < 10000; ++i)
+        nodes.push_back(allocator.allocate(1));
+    ASSERT_EQ(Pool::instance().getAllocatedBytes(), allocated);
+
+    for (auto * node : nodes)
+        allocator.deallocate(node, 1);
+}
+
+TEST(SlabAllocator, FreeInAnotherThread)
+{
+    std::vector<std::shared_ptr<TestNode>> nodes;
+    std::thread producer([&]
+    {
+        for (int i = 0; i < 5000; ++i)
+            nodes.push_back(std::allocate_shared<TestNode>(SlabAllocator<TestNode>(), TestNode{i, {}}));
+    });
+    producer.join();
+
+    std::thread consumer([&] { nodes.clear(); });
+    consumer.join();
+    ASSERT_TRUE(nodes.empty());
+}
+
+TEST(SlabAllocator, HugePages)
+{
+    ASSERT_EQ(HugePages::parseMode("transparent"), HugePagesMode::TRANSPARENT);
+    ASSERT_THROW(HugePages::parseMode("always"), Exception);
+
+    UInt64 hits = HugePages::hits();
+    UInt64 misses = HugePages::misses();
+
+    /// Not counted without huge pages
+    HugePages::setMode(HugePagesMode::NONE);
+    void * ptr = HugePages::allocate(HugePages::HUGE_PAGE_SIZE, 64);
+    ASSERT_EQ(HugePages::hits() + HugePages::misses(), hits + misses);
+    ::operator delete(ptr, std::align_val_t(64));
+
+    /// Hit or miss depends on THP of the host, the block is usable either way
+    HugePages::setMode(HugePagesMode::TRANSPARENT);
+    auto * block = static_cast<char *>(HugePages::allocate(HugePages::HUGE_PAGE_SIZE * 2, 64));
+    HugePages::setMode(HugePagesMode::NONE);
+    ASSERT_EQ(HugePages::hits() + HugePages::misses(), hits + misses + 1);
+    ASSERT_EQ(reinterpret_cast<uintptr_t>(block) % 64, 0);
+    if (HugePages::hits() > hits)
+    {
+        ASSERT_EQ(reinterpret_cast<uintptr_t>(block) % HugePages::HUGE_PAGE_SIZE, 0);
+    }
+    block[0] = 1;
+    block[HugePages::HUGE_PAGE_SIZE * 2 - 1] = 1;
+}
@@ -0,0 +1,77 @@
+#include <Common/SpaceSaving.h>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <random>
+
+using namespace RK;
+
+TEST(SpaceSaving, Exact)
+{
+    SpaceSaving<String> sketch(4);
+    for (int i = 0; i < 3; ++i)
+        sketch.insert("/a");
+    sketch.insert("/b", 5);
+    sketch.insert("/c");
+
+    auto top = sketch.top(2);
+    ASSERT_EQ(top.size(), 2);
+    ASSERT_EQ(top[0].key, "/b");
+    ASSERT_EQ(top[0].count, 5);
+    ASSERT_EQ(top[0].error, 0);
+    ASSERT_EQ(top[1].key, "/a");
+    ASSERT_EQ(top[1].count, 3);
+
+    sketch.clear();
+    ASSERT_EQ(sketch.size(), 0);
+    ASSERT_TRUE(sketch.top(10).empty());
+}
+
+TEST(SpaceSaving, Replace)
+{
+    SpaceSaving<int64_t> sketch(2);
+    sketch.insert(1, 10);
+    sketch.insert(2, 3);
+    sketch.insert(3);
+
+    /// 3 takes the place of 2
+    auto top = sketch.top(10);
+    ASSERT_EQ(top.size(), 2);
+    ASSERT_EQ(top[0].key, 1);
+    ASSERT_EQ(top[1].key, 3);
+    ASSERT_EQ(top[1].count, 4);
+    ASSERT_EQ(top[1].error, 3);
+}
+
+TEST(SpaceSaving, HeavyHitters)
+{
+    SpaceSaving<int64_t> sketch(32);
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int64_t> noise(100, 100000);
+
+    UInt64 total = 0;
+    std::array<UInt64, 3> heavy_counts{};
+    for (int i = 0; i < 100000; ++i)
+    {
+        /// 3 keys take 30% of the stream
+        if (i % 10 < 3)
+        {
+            sketch.insert(i % 10);
+            ++heavy_counts[static_cast<size_t>(i % 10)];
+        }
+        else
+            sketch.insert(noise(rng));
+        ++total;
+    }
+
+    auto top = sketch.top(3);
+    ASSERT_EQ(top.size(), 3);
+    for (const auto & counter : top)
+    {
+        ASSERT_LT(counter.key, 3);
+        UInt64 real = heavy_counts[static_cast<size_t>(counter.key)];
+        ASSERT_GE(counter.count, real);
+        ASSERT_LE(counter.count - counter.error, real);
+        ASSERT_LE(counter.error, total / 32);
+    }
+}
@@ -0,0 +1,39 @@
+#include <gtest/gtest.h>
+
+#include <thread>
+#include <vector>
+#include <Common/Stopwatch.h>
+#include <Common/Throttler.h>
+
+using namespace RK;
+
+TEST(Throttler, Burst)
+{
+    Throttler throttler(1000000);
+    Stopwatch watch;
+    /// Within the burst of 100ms
+    for (int i = 0; i < 10; ++i)
+        throttler.add(1000);
+    ASSERT_EQ(throttler.getSleptNs(), 0);
+    ASSERT_LT(watch.elapsedMilliseconds(), 100);
+}
+
+TEST(Throttler, Speed)
+{
+    Throttler throttler(1000000, 1000);
+    Stopwatch watch;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+        threads.emplace_back(
+            [&throttler]
+            {
+                for (int j = 0; j < 50; ++j)
+                    throttler.add(1000);
+            });
+    for (auto & thread : threads)
+        thread.join();
+
+    /// 200K units at 1M per second
+    ASSERT_GE(watch.elapsedMilliseconds(), 190);
+    ASSERT_GT(throttler.getSleptNs(), 0);
+}
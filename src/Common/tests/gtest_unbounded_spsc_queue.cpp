@@ -0,0 +1,86 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <thread>
+#include <Common/UnboundedSPSCQueue.h>
+
+using namespace RK;
+
+TEST(UnboundedSPSCQueue, PushPop)
+{
+    UnboundedSPSCQueue<std::shared_ptr<int>, 4> queue;
+    ASSERT_TRUE(queue.empty());
+
+    /// Across blocks
+    for (int i = 0; i < 10; ++i)
+        queue.push(std::make_shared<int>(i));
+    ASSERT_FALSE(queue.empty());
+
+    std::shared_ptr<int> x;
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_TRUE(queue.tryPop(x));
+        ASSERT_EQ(*x, i);
+    }
+    ASSERT_FALSE(queue.tryPop(x));
+    ASSERT_TRUE(queue.empty());
+
+    /// Popped values are released
+    auto value = std::make_shared<int>(10);
+    queue.push(value);
+    ASSERT_TRUE(queue.tryPop(x));
+    x.reset();
+    ASSERT_EQ(value.use_count(), 1);
+}
+
+TEST(UnboundedSPSCQueue, FrontAndSize)
+{
+    UnboundedSPSCQueue<int, 4> queue;
+    ASSERT_EQ(queue.front(), nullptr);
+    ASSERT_EQ(queue.size(), size_t(0));
+
+    for (int i = 0; i < 10; ++i)
+        queue.push(i);
+    ASSERT_EQ(queue.size(), size_t(10));
+    ASSERT_GE(queue.getBufferSizeInBytes(), 3 * 4 * sizeof(int));
+
+    /// Front stays in the queue until popped
+    int x;
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_NE(queue.front(), nullptr);
+        ASSERT_EQ(*queue.front(), i);
+        ASSERT_EQ(queue.size(), size_t(10 - i));
+        ASSERT_TRUE(queue.tryPop(x));
+        ASSERT_EQ(x, i);
+    }
+    ASSERT_EQ(queue.front(), nullptr);
+    ASSERT_EQ(queue.size(), size_t(0));
+}
+
+TEST(UnboundedSPSCQueue, Concurrent)
+{
+    UnboundedSPSCQueue<std::unique_ptr<size_t>, 16> queue;
+    constexpr size_t count = 1000000;
+
+    std::thread producer(
+        [&]
+        {
+            for (size_t i = 0; i < count; ++i)
+                queue.push(std::make_unique<size_t>(i));
+        });
+
+    size_t expected = 0;
+    std::unique_ptr<size_t> x;
+    while (expected < count)
+    {
+        if (queue.tryPop(x))
+        {
+            ASSERT_EQ(*x, expected);
+            ++expected;
+        }
+    }
+    producer.join();
+    ASSERT_TRUE(queue.empty());
+    ASSERT_EQ(queue.size(), size_t(0));
+}
@@ -0,0 +1,110 @@
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <Common/ThreadPool.h>
+#include <Common/WorkStealing.h>
+
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(WorkStealing, EveryIndexOnce)
+{
+    for (size_t count : std::vector<size_t>{0, 1, 7, 1000})
+    {
+        for (size_t batch : std::vector<size_t>{1, 3, 64})
+        {
+            std::vector<std::atomic<int>> taken(count);
+            FreeThreadPool pool(8);
+            parallelFor(pool, 8, count, [&](size_t i) { taken[i]++; }, batch);
+            for (size_t i = 0; i < count; i++)
+                ASSERT_EQ(taken[i], 1) << "count " << count << " batch " << batch << " index " << i;
+        }
+    }
+}
+
+TEST(WorkStealing, StealFromSlowWorker)
+{
+    /// The first worker owns the slow items, others steal them
+    static constexpr size_t COUNT = 64;
+    WorkStealingRanges ranges(COUNT, 4);
+    std::vector<std::atomic<int>> taken(COUNT);
+    std::atomic<size_t> stolen{0};
+
+    std::vector<std::thread> threads;
+    for (size_t worker = 0; worker < 4; worker++)
+    {
+        threads.emplace_back(
+            [&, worker]
+            {
+                size_t begin;
+                size_t end;
+                while (ranges.next(worker, begin, end))
+                {
+                    for (size_t i = begin; i < end; i++)
+                    {
+                        taken[i]++;
+                        if (i < COUNT / 4)
+                        {
+                            if (worker != 0)
+                                stolen++;
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                    }
+                }
+            });
+    }
+    for (auto & thread : threads)
+        thread.join();
+
+    for (size_t i = 0; i < COUNT; i++)
+        ASSERT_EQ(taken[i], 1);
+    ASSERT_GT(stolen, 0);
+}
+
+TEST(WorkStealing, RethrowException)
+{
+    FreeThreadPool pool(4);
+    std::atomic<size_t> done{0};
+    ASSERT_THROW(
+        parallelFor(pool, 4, 100, [&](size_t i) {
+            if (i == 50)
+                throw std::runtime_error("job failed");
+            done++;
+        }),
+        std::runtime_error);
+    ASSERT_LT(done, 100);
+}
+
+TEST(WorkStealing, WithCaller)
+{
+    /// Callers at a time on a pool smaller than their workers, jobs which are not scheduled are done by callers
+    FreeThreadPool pool(2, 2, 2);
+    static constexpr size_t COUNT = 1000;
+    std::vector<std::vector<std::atomic<int>>> taken(4);
+    std::vector<std::thread> callers;
+    for (size_t caller = 0; caller < taken.size(); caller++)
+    {
+        taken[caller] = std::vector<std::atomic<int>>(COUNT);
+        callers.emplace_back([&, caller] { parallelForWithCaller(pool, 8, COUNT, [&](size_t i) { taken[caller][i]++; }, 16); });
+    }
+    for (auto & caller : callers)
+        caller.join();
+    pool.wait();
+
+    for (const auto & caller_taken : taken)
+        for (size_t i = 0; i < COUNT; i++)
+            ASSERT_EQ(caller_taken[i], 1);
+
+    /// All indices are done before the exception is rethrown
+    std::atomic<size_t> done{0};
+    ASSERT_THROW(
+        parallelForWithCaller(pool, 4, 100, [&](size_t i) {
+            done++;
+            if (i == 50)
+                throw std::runtime_error("job failed");
+        }),
+        std::runtime_error);
+    ASSERT_EQ(done, 100);
+    pool.wait();
+}
@@ -75,17 +75,25 @@ bool NotificationCenter::accept(const Notification & notification) const
 
 void NotificationCenter::postNotification(const Notification & notification)
 {
-    Observers copied;
+    /// Mostly a notification has only one observer, it needs no vector to hold.
+    AbstractObserverPtr first;
+    Observers others;
     {
         Mutex::ScopedLock lock(mutex);
         for (auto & observer : observers)
         {
-            if (observer->accepts(notification))
-                copied.push_back(observer);
+            if (!observer->accepts(notification))
+                continue;
+            if (!first)
+                first = observer;
+            else
+                others.push_back(observer);
         }
     }
 
-    for (auto & observer : copied)
+    if (first)
+        first->notify(notification);
+    for (auto & observer : others)
         observer->notify(notification);
 }
 
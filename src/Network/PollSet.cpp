@@ -3,14 +3,24 @@
 * SPDX-License-Identifier:	BSL-1.0
 *
 */
+#include <atomic>
+#include <limits>
+#include <map>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 #if defined(POCO_HAVE_FD_EPOLL)
 #    include <sys/epoll.h>
 #    include <sys/eventfd.h>
 #else
-#    include <poll.h>
 #    include <Poco/Pipe.h>
 #endif
+#include <poll.h>
+#if defined(OS_LINUX)
+#    include <linux/io_uring.h>
+#    include <Common/IOUring.h>
+#endif
 
 #include <Poco/Logger.h>
 #include <Poco/Mutex.h>
@@ -34,6 +44,8 @@ namespace ErrorCodes
     extern const int EPOLL_WAIT;
     extern const int POLL_EVENT;
     extern const int LOGICAL_ERROR;
+    extern const int IO_URING_INIT_FAILED;
+    extern const int BAD_ARGUMENTS;
 }
 
 namespace
@@ -43,39 +55,75 @@ namespace
     {
         return sock.isStream() ? sock.peerAddress().toString() : sock.address().toString();
     }
+
+    std::atomic<PollSet::Backend> default_backend{PollSet::Backend::EPOLL};
 }
 
+/// Interface of the implementations, see PollSet for the methods.
+class PollSetImpl
+{
+public:
+    virtual ~PollSetImpl() = default;
+
+    virtual void add(const Socket & socket, int mode) = 0;
+    virtual void remove(const Socket & socket) = 0;
+
+    virtual bool has(const Socket & socket) const = 0;
+    virtual bool empty() const = 0;
+
+    virtual void update(const Socket & socket, int mode) = 0;
+    virtual void clear() = 0;
+
+    virtual void poll(const Poco::Timespan & timeout, PollSet::Events & result) = 0;
+
+    virtual void wakeUp() = 0;
+    virtual int count() const = 0;
+};
+
 #if defined(POCO_HAVE_FD_EPOLL)
 
 /// PollSet implementation with epoll
-class PollSetImpl
+///
+/// Event data is fd and the generation of it, generation changes when fd is removed, so an event of
+/// a removed socket whose fd is reused by a new one is dropped. Events are checked by indexing generations
+/// by fd, not by looking up sockets.
+class EpollPollSetImpl : public PollSetImpl
 {
 public:
-    PollSetImpl();
-    ~PollSetImpl();
+    EpollPollSetImpl();
+    ~EpollPollSetImpl() override;
 
-    void add(const Socket & socket, int mode);
-    void remove(const Socket & socket);
+    void add(const Socket & socket, int mode) override;
+    void remove(const Socket & socket) override;
 
-    bool has(const Socket & socket) const;
-    bool empty() const;
+    bool has(const Socket & socket) const override;
+    bool empty() const override;
 
-    void update(const Socket & socket, int mode);
-    void clear();
+    void update(const Socket & socket, int mode) override;
+    void clear() override;
 
-    PollSet::SocketModeMap poll(const Poco::Timespan & timeout);
+    void poll(const Poco::Timespan & timeout, PollSet::Events & result) override;
 
-    void wakeUp();
-    int count() const;
+    void wakeUp() override;
+    int count() const override;
 
 private:
-    int addImpl(int fd, int mode, void * data);
+    int addImpl(int fd, int mode, uint64_t data);
+    void updateImpl(const Socket & socket, int mode);
+
+    static uint32_t toEpollEvents(int mode);
+
+    /// Event data of fd, mutex must be held.
+    uint64_t eventData(poco_socket_t fd);
 
     mutable Poco::FastMutex mutex;
 
-    /// Monitored epoll events
+    /// Monitored sockets
     std::map<SocketImpl *, Socket> socket_map;
 
+    /// Generation of fd, it changes when fd is removed.
+    std::vector<uint32_t> generations;
+
     /// epoll fd
     int epoll_fd;
 
@@ -85,15 +133,18 @@ private:
     /// Only used to wake up poll set by writing 8 bytes.
     int waking_up_fd;
 
+    /// Event data of waking up fd, never a socket's for the generation part is invalid.
+    static constexpr uint64_t WAKING_UP_DATA = std::numeric_limits<uint64_t>::max();
+
     Poco::Logger * log;
 };
 
 
-PollSetImpl::PollSetImpl()
+EpollPollSetImpl::EpollPollSetImpl()
     : epoll_fd(epoll_create(1)), events(1024), waking_up_fd(eventfd(0, EFD_NONBLOCK)), log(&Poco::Logger::get("PollSet"))
 {
     /// Monitor waking up fd, use this as waking up event marker.
-    int err = addImpl(waking_up_fd, PollSet::POLL_READ, this);
+    int err = addImpl(waking_up_fd, PollSet::POLL_READ, WAKING_UP_DATA);
     if ((err) || (epoll_fd < 0))
     {
         throwFromErrno("Error when initializing poll set", ErrorCodes::EPOLL_ERROR, errno);
@@ -101,22 +152,42 @@ PollSetImpl::PollSetImpl()
 }
 
 
-PollSetImpl::~PollSetImpl()
+EpollPollSetImpl::~EpollPollSetImpl()
 {
     if (epoll_fd >= 0)
         ::close(epoll_fd);
 }
 
-void PollSetImpl::add(const Socket & socket, int mode)
+uint32_t EpollPollSetImpl::toEpollEvents(int mode)
+{
+    uint32_t epoll_events = 0;
+    if (mode & PollSet::POLL_WRITE)
+        epoll_events |= EPOLLOUT;
+    if (mode & PollSet::POLL_ERROR)
+        epoll_events |= EPOLLERR;
+    if (mode & PollSet::POLL_READ)
+        epoll_events |= EPOLLIN;
+    return epoll_events;
+}
+
+uint64_t EpollPollSetImpl::eventData(poco_socket_t fd)
+{
+    auto index = static_cast<size_t>(fd);
+    if (index >= generations.size())
+        generations.resize(std::max(index + 1, generations.size() * 2), 0);
+    return (static_cast<uint64_t>(generations[index]) << 32) | static_cast<uint32_t>(fd);
+}
+
+void EpollPollSetImpl::add(const Socket & socket, int mode)
 {
     Poco::FastMutex::ScopedLock lock(mutex);
     SocketImpl * socket_impl = socket.impl();
-    int err = addImpl(socket_impl->sockfd(), mode, socket_impl);
+    int err = addImpl(socket_impl->sockfd(), mode, eventData(socket_impl->sockfd()));
 
     if (err)
     {
         if (errno == EEXIST)
-            update(socket, mode);
+            updateImpl(socket, mode);
         else
             throwFromErrno("Error when updating epoll event to " + getAddressName(socket), ErrorCodes::EPOLL_CTL, errno);
     }
@@ -125,74 +196,72 @@ void PollSetImpl::add(const Socket & socket, int mode)
         socket_map[socket_impl] = socket;
 }
 
-int PollSetImpl::addImpl(int fd, int mode, void * data)
+int EpollPollSetImpl::addImpl(int fd, int mode, uint64_t data)
 {
     struct epoll_event ev;
-    ev.events = 0;
-    if (mode & PollSet::POLL_WRITE)
-        ev.events |= EPOLLOUT;
-    if (mode & PollSet::POLL_ERROR)
-        ev.events |= EPOLLERR;
-    if (mode & PollSet::POLL_READ)
-        ev.events |= EPOLLIN;
-    ev.data.ptr = data;
+    ev.events = toEpollEvents(mode);
+    ev.data.u64 = data;
     return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
 }
 
-void PollSetImpl::remove(const Socket & socket)
+void EpollPollSetImpl::remove(const Socket & socket)
 {
     Poco::FastMutex::ScopedLock lock(mutex);
 
     poco_socket_t fd = socket.impl()->sockfd();
     struct epoll_event ev;
     ev.events = 0;
-    ev.data.ptr = nullptr;
+    ev.data.u64 = 0;
     int err = epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, &ev);
     if (err)
         throwFromErrno("Error when updating epoll event to " + getAddressName(socket), ErrorCodes::EPOLL_CTL, errno);
 
+    /// Events of the socket already returned by epoll_wait are invalid now
+    if (static_cast<size_t>(fd) < generations.size())
+        ++generations[static_cast<size_t>(fd)];
+
     socket_map.erase(socket.impl());
 }
 
-bool PollSetImpl::has(const Socket & socket) const
+bool EpollPollSetImpl::has(const Socket & socket) const
 {
     Poco::FastMutex::ScopedLock lock(mutex);
     SocketImpl * socket_impl = socket.impl();
     return socket_impl && (socket_map.find(socket_impl) != socket_map.end());
 }
 
-bool PollSetImpl::empty() const
+bool EpollPollSetImpl::empty() const
 {
     Poco::FastMutex::ScopedLock lock(mutex);
     return socket_map.empty();
 }
 
-void PollSetImpl::update(const Socket & socket, int mode)
+void EpollPollSetImpl::update(const Socket & socket, int mode)
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    updateImpl(socket, mode);
+}
+
+void EpollPollSetImpl::updateImpl(const Socket & socket, int mode)
 {
     poco_socket_t fd = socket.impl()->sockfd();
     struct epoll_event ev;
-    ev.events = 0;
-
-    if (mode & PollSet::POLL_READ)
-        ev.events |= EPOLLIN;
-    if (mode & PollSet::POLL_WRITE)
-        ev.events |= EPOLLOUT;
-    if (mode & PollSet::POLL_ERROR)
-        ev.events |= EPOLLERR;
-
-    ev.data.ptr = socket.impl();
+    ev.events = toEpollEvents(mode);
+    ev.data.u64 = eventData(fd);
     int err = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
 
     if (err)
         throwFromErrno("Error when updating epoll event to " + getAddressName(socket), ErrorCodes::EPOLL_CTL, errno);
 }
 
-void PollSetImpl::clear()
+void EpollPollSetImpl::clear()
 {
     Poco::FastMutex::ScopedLock lock(mutex);
 
     ::close(epoll_fd);
     socket_map.clear();
+    for (auto & generation : generations)
+        ++generation;
     epoll_fd = epoll_create(1);
     if (epoll_fd < 0)
     {
@@ -200,20 +269,20 @@ void PollSetImpl::clear()
     }
 }
 
-PollSet::SocketModeMap PollSetImpl::poll(const Poco::Timespan & timeout)
+void EpollPollSetImpl::poll(const Poco::Timespan & timeout, PollSet::Events & result)
 {
-    PollSet::SocketModeMap result;
+    result.clear();
     Poco::Timespan remaining_time(timeout);
 
     int rc;
     do
     {
         Poco::Timestamp start;
-        rc = epoll_wait(epoll_fd, &events[0], events.size(), remaining_time.totalMilliseconds());
+        rc = epoll_wait(epoll_fd, &events[0], static_cast<int>(events.size()), static_cast<int>(remaining_time.totalMilliseconds()));
 
         if (rc == 0)
         {
-            return result;
+            return;
         }
 
         if (rc < 0 && errno == POCO_EINTR)
@@ -234,66 +303,317 @@ PollSet::SocketModeMap PollSetImpl::poll(const Poco::Timespan & timeout)
 
     for (int i = 0; i < rc; i++)
     {
+        uint64_t data = events[i].data.u64;
+
         /// Read data from 'wakeUp' method
-        if (events[i].data.ptr == this)
+        if (data == WAKING_UP_DATA)
         {
             uint64_t val;
             auto n = ::read(waking_up_fd, &val, sizeof(val));
             if (n < 0)
                 throwFromErrno("Error when reading data from 'wakeUp' method", ErrorCodes::EPOLL_CREATE, errno);
+            continue;
         }
-        /// Handle IO events
-        else if (events[i].data.ptr)
-        {
-            std::map<SocketImpl *, Socket>::iterator it = socket_map.find(static_cast<SocketImpl *>(events[i].data.ptr));
-            if (it != socket_map.end())
-            {
-                if (events[i].events & EPOLLIN)
-                    result[it->second] |= PollSet::POLL_READ;
-                if (events[i].events & EPOLLOUT)
-                    result[it->second] |= PollSet::POLL_WRITE;
-                if (events[i].events & EPOLLERR)
-                    result[it->second] |= PollSet::POLL_ERROR;
-            }
-        }
-        else
-        {
-            throw Exception(ErrorCodes::LOGICAL_ERROR, "Should never reach here.");
-        }
-    }
 
-    return result;
+        /// Handle IO events of sockets not removed
+        auto fd = static_cast<poco_socket_t>(static_cast<uint32_t>(data));
+        auto generation = static_cast<uint32_t>(data >> 32);
+        if (static_cast<size_t>(fd) >= generations.size() || generations[static_cast<size_t>(fd)] != generation)
+            continue;
+
+        int mode = 0;
+        if (events[i].events & EPOLLIN)
+            mode |= PollSet::POLL_READ;
+        if (events[i].events & EPOLLOUT)
+            mode |= PollSet::POLL_WRITE;
+        if (events[i].events & EPOLLERR)
+            mode |= PollSet::POLL_ERROR;
+        if (mode)
+            result.push_back({fd, mode});
+    }
 }
 
-void PollSetImpl::wakeUp()
+void EpollPollSetImpl::wakeUp()
 {
     uint64_t val = 0;
-    int n = ::write(waking_up_fd, &val, sizeof(val));
+    auto n = ::write(waking_up_fd, &val, sizeof(val));
     if (n < 0)
         throwFromErrno("Error when trying to wakeup poll set", ErrorCodes::EPOLL_CREATE, errno);
 }
 
-int PollSetImpl::count() const
+int EpollPollSetImpl::count() const
 {
     Poco::FastMutex::ScopedLock lock(mutex);
     return static_cast<int>(socket_map.size());
 }
 
-#else
+#endif
+
+#if defined(OS_LINUX)
+
+/// PollSet implementation with io_uring
+///
+/// Sockets are polled by one shot polls of the ring, a socket is polled again after its event is returned, so it is
+/// level triggered like epoll and a handler need not read until EAGAIN. Polls, changes of modes and removals made by
+/// the thread polling, which are the ones of handlers, are queued and handed to the kernel with the next wait by one
+/// syscall, while epoll takes an epoll_ctl for every change, for example a connection enables and disables writable
+/// events for every response it flushes later. Changes made by other threads are submitted right away.
+///
+/// User data of a poll is fd and the number of times the fd is polled, a completion of a poll which is removed or
+/// replaced, or of a removed socket whose fd is reused by a new one, is dropped.
+class IOUringPollSetImpl : public PollSetImpl
+{
+public:
+    IOUringPollSetImpl();
+
+    void add(const Socket & socket, int mode) override;
+    void remove(const Socket & socket) override;
+
+    bool has(const Socket & socket) const override;
+    bool empty() const override;
+
+    void update(const Socket & socket, int mode) override;
+    void clear() override;
+
+    void poll(const Poco::Timespan & timeout, PollSet::Events & result) override;
+
+    void wakeUp() override;
+    int count() const override;
+
+private:
+    struct Entry
+    {
+        /// Mode registered
+        int mode = 0;
+        /// Mode of the poll in flight, 0 if none
+        int polled_mode = 0;
+        /// Times the fd is polled
+        uint32_t polls = 0;
+    };
+
+    static uint32_t toPollMask(int mode);
+    static uint64_t userData(poco_socket_t fd, uint32_t polls) { return (static_cast<uint64_t>(polls) << 32) | static_cast<uint32_t>(fd); }
+
+    /// Mutex must be held by the following ones.
+    Entry & entryOf(poco_socket_t fd);
+    void setMode(poco_socket_t fd, int mode);
+    void pollSocket(poco_socket_t fd, Entry & entry);
+    void cancelPoll(poco_socket_t fd, Entry & entry);
+    /// Submit changes right away if they are not made by the thread polling
+    void submitIfNotPolling();
+
+    static constexpr unsigned RING_ENTRIES = 4096;
+
+    /// Never user data of a poll, whose low half is a valid fd
+    static constexpr uint64_t WAKING_UP_DATA = std::numeric_limits<uint64_t>::max();
+    static constexpr uint64_t REMOVE_DATA = std::numeric_limits<uint64_t>::max() - 1;
+
+    mutable Poco::FastMutex mutex;
+
+    /// Monitored sockets
+    std::map<SocketImpl *, Socket> socket_map;
+
+    /// Indexed by fd
+    std::vector<Entry> entries;
+
+    IOUring ring;
+
+    std::thread::id polling_thread;
+};
+
+IOUringPollSetImpl::IOUringPollSetImpl() : ring(RING_ENTRIES)
+{
+    /// Waiting with timeout needs EXT_ARG, completions of many sockets may overflow the completion queue without NODROP
+    if (!(ring.getFeatures() & IORING_FEAT_EXT_ARG) || !(ring.getFeatures() & IORING_FEAT_NODROP))
+        throw Exception(ErrorCodes::IO_URING_INIT_FAILED, "io_uring of the kernel does not wait with timeout, it needs Linux 5.11");
+}
+
+uint32_t IOUringPollSetImpl::toPollMask(int mode)
+{
+    uint32_t mask = 0;
+    if (mode & PollSet::POLL_READ)
+        mask |= POLLIN;
+    if (mode & PollSet::POLL_WRITE)
+        mask |= POLLOUT;
+    if (mode & PollSet::POLL_ERROR)
+        mask |= POLLERR;
+    return mask;
+}
+
+IOUringPollSetImpl::Entry & IOUringPollSetImpl::entryOf(poco_socket_t fd)
+{
+    auto index = static_cast<size_t>(fd);
+    if (index >= entries.size())
+        entries.resize(std::max(index + 1, entries.size() * 2));
+    return entries[index];
+}
+
+void IOUringPollSetImpl::pollSocket(poco_socket_t fd, Entry & entry)
+{
+    entry.polled_mode = entry.mode;
+    ++entry.polls;
+    ring.preparePoll(fd, toPollMask(entry.mode), userData(fd, entry.polls));
+}
+
+void IOUringPollSetImpl::cancelPoll(poco_socket_t fd, Entry & entry)
+{
+    if (!entry.polled_mode)
+        return;
+    ring.preparePollRemove(userData(fd, entry.polls), REMOVE_DATA);
+    entry.polled_mode = 0;
+    /// A completion of the poll before it is removed is dropped
+    ++entry.polls;
+}
+
+void IOUringPollSetImpl::setMode(poco_socket_t fd, int mode)
+{
+    Entry & entry = entryOf(fd);
+    entry.mode = mode;
+
+    /// A poll of more events than the mode is kept, its events not in the mode are dropped when it completes
+    if (entry.polled_mode && (!mode || (mode & ~entry.polled_mode)))
+        cancelPoll(fd, entry);
+    if (mode && !entry.polled_mode)
+        pollSocket(fd, entry);
+}
+
+void IOUringPollSetImpl::submitIfNotPolling()
+{
+    if (std::this_thread::get_id() != polling_thread)
+        ring.submit();
+}
+
+void IOUringPollSetImpl::add(const Socket & socket, int mode)
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    SocketImpl * socket_impl = socket.impl();
+    setMode(socket_impl->sockfd(), mode);
+    submitIfNotPolling();
+
+    if (socket_map.find(socket_impl) == socket_map.end())
+        socket_map[socket_impl] = socket;
+}
+
+void IOUringPollSetImpl::remove(const Socket & socket)
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    setMode(socket.impl()->sockfd(), 0);
+    /// The ring keeps the file of a polled socket open until the poll is removed, so it is removed right away
+    ring.submit();
+    socket_map.erase(socket.impl());
+}
+
+bool IOUringPollSetImpl::has(const Socket & socket) const
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    SocketImpl * socket_impl = socket.impl();
+    return socket_impl && (socket_map.find(socket_impl) != socket_map.end());
+}
+
+bool IOUringPollSetImpl::empty() const
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    return socket_map.empty();
+}
+
+void IOUringPollSetImpl::update(const Socket & socket, int mode)
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    setMode(socket.impl()->sockfd(), mode);
+    submitIfNotPolling();
+}
+
+void IOUringPollSetImpl::clear()
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    for (const auto & [socket_impl, _] : socket_map)
+        setMode(socket_impl->sockfd(), 0);
+    ring.submit();
+    socket_map.clear();
+}
+
+void IOUringPollSetImpl::poll(const Poco::Timespan & timeout, PollSet::Events & result)
+{
+    result.clear();
+    {
+        Poco::FastMutex::ScopedLock lock(mutex);
+        polling_thread = std::this_thread::get_id();
+    }
+
+    /// Submits the polls queued since the last wait
+    ring.submitAndWait(static_cast<UInt64>(std::max<Poco::Timespan::TimeDiff>(timeout.totalMilliseconds(), 0)));
+
+    Poco::FastMutex::ScopedLock lock(mutex);
+
+    UInt64 data;
+    int res;
+    while (ring.popCompletion(data, res))
+    {
+        if (data == WAKING_UP_DATA || data == REMOVE_DATA)
+            continue;
+
+        auto fd = static_cast<poco_socket_t>(static_cast<uint32_t>(data));
+        auto polls = static_cast<uint32_t>(data >> 32);
+        if (static_cast<size_t>(fd) >= entries.size() || entries[static_cast<size_t>(fd)].polls != polls)
+            continue;
+
+        Entry & entry = entries[static_cast<size_t>(fd)];
+        entry.polled_mode = 0;
+
+        int mode = 0;
+        if (res < 0)
+            mode |= PollSet::POLL_ERROR;
+        else
+        {
+            if (res & POLLIN)
+                mode |= PollSet::POLL_READ;
+            if (res & POLLOUT)
+                mode |= PollSet::POLL_WRITE;
+            if (res & POLLERR)
+                mode |= PollSet::POLL_ERROR;
+            /// Peer closed, the handler reads 0 bytes like epoll reports it as readable
+            if ((res & POLLHUP) && (entry.mode & PollSet::POLL_READ))
+                mode |= PollSet::POLL_READ;
+        }
+        mode &= entry.mode | PollSet::POLL_ERROR;
+
+        /// Polled again with the next wait, after the handler has taken the event
+        if (entry.mode)
+            pollSocket(fd, entry);
+        if (mode)
+            result.push_back({fd, mode});
+    }
+}
+
+void IOUringPollSetImpl::wakeUp()
+{
+    ring.prepareNop(WAKING_UP_DATA);
+    ring.submit();
+}
+
+int IOUringPollSetImpl::count() const
+{
+    Poco::FastMutex::ScopedLock lock(mutex);
+    return static_cast<int>(socket_map.size());
+}
+
+#endif
+
+#if !defined(POCO_HAVE_FD_EPOLL)
 
 /// BSD implementation using poll
-class PollSetImpl
+class PosixPollSetImpl : public PollSetImpl
 {
 public:
-    PollSetImpl()
+    PosixPollSetImpl()
     {
         pollfd fd{_pipe.readHandle(), POLLIN, 0};
         poll_fds.push_back(fd);
     }
 
-    ~PollSetImpl() { _pipe.close(); }
+    ~PosixPollSetImpl() override { _pipe.close(); }
 
-    void add(const Socket & socket, int mode)
+    void add(const Socket & socket, int mode) override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
         poco_socket_t fd = socket.impl()->sockfd();
@@ -302,7 +622,7 @@ public:
         socket_map[fd] = socket;
     }
 
-    void remove(const Socket & socket)
+    void remove(const Socket & socket) override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
         poco_socket_t fd = socket.impl()->sockfd();
@@ -311,20 +631,20 @@ public:
         socket_map.erase(fd);
     }
 
-    bool has(const Socket & socket) const
+    bool has(const Socket & socket) const override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
         SocketImpl * sockImpl = socket.impl();
         return sockImpl && (socket_map.find(sockImpl->sockfd()) != socket_map.end());
     }
 
-    bool empty() const
+    bool empty() const override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
         return socket_map.empty();
     }
 
-    void update(const Socket & socket, int mode)
+    void update(const Socket & socket, int mode) override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
         poco_socket_t fd = socket.impl()->sockfd();
@@ -339,7 +659,7 @@ public:
         }
     }
 
-    void clear()
+    void clear() override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
 
@@ -349,9 +669,9 @@ public:
         poll_fds.reserve(1);
     }
 
-    PollSet::SocketModeMap poll(const Poco::Timespan & timeout)
+    void poll(const Poco::Timespan & timeout, PollSet::Events & result) override
     {
-        PollSet::SocketModeMap result;
+        result.clear();
         {
             Poco::FastMutex::ScopedLock lock(mutex);
 
@@ -383,7 +703,7 @@ public:
         }
 
         if (poll_fds.empty())
-            return result;
+            return;
 
         Poco::Timespan remainingTime(timeout);
         int rc;
@@ -417,31 +737,31 @@ public:
             {
                 for (auto it = poll_fds.begin() + 1; it != poll_fds.end(); ++it)
                 {
-                    std::map<poco_socket_t, Socket>::const_iterator its = socket_map.find(it->fd);
-                    if (its != socket_map.end())
+                    if (socket_map.find(it->fd) != socket_map.end())
                     {
+                        int mode = 0;
                         if (it->revents & POLLIN)
-                            result[its->second] |= PollSet::POLL_READ;
+                            mode |= PollSet::POLL_READ;
                         if (it->revents & POLLOUT)
-                            result[its->second] |= PollSet::POLL_WRITE;
+                            mode |= PollSet::POLL_WRITE;
                         if (it->revents & POLLERR || (it->revents & POLLHUP))
-                            result[its->second] |= PollSet::POLL_ERROR;
+                            mode |= PollSet::POLL_ERROR;
+                        if (mode)
+                            result.push_back({it->fd, mode});
                     }
                     it->revents = 0;
                 }
             }
         }
-
-        return result;
     }
 
-    void wakeUp()
+    void wakeUp() override
     {
         char c = 1;
         _pipe.writeBytes(&c, 1);
     }
 
-    int count() const
+    int count() const override
     {
         Poco::FastMutex::ScopedLock lock(mutex);
         return static_cast<int>(socket_map.size());
@@ -468,8 +788,60 @@ private:
 #endif
 
 
-PollSet::PollSet() : impl(new PollSetImpl)
+PollSet::PollSet() : PollSet(getDefaultBackend())
+{
+}
+
+
+PollSet::PollSet(Backend backend) : impl(nullptr)
+{
+#if defined(OS_LINUX)
+    if (backend == Backend::IO_URING)
+    {
+        try
+        {
+            impl = new IOUringPollSetImpl;
+            return;
+        }
+        catch (...)
+        {
+            static std::once_flag warned;
+            std::call_once(
+                warned,
+                [] { tryLogCurrentException(&Poco::Logger::get("PollSet"), "Cannot poll sockets by io_uring, epoll is used instead"); });
+        }
+    }
+#else
+    UNUSED(backend);
+#endif
+
+#if defined(POCO_HAVE_FD_EPOLL)
+    impl = new EpollPollSetImpl;
+#else
+    impl = new PosixPollSetImpl;
+#endif
+}
+
+
+void PollSet::setDefaultBackend(Backend backend)
+{
+    default_backend.store(backend, std::memory_order_relaxed);
+}
+
+
+PollSet::Backend PollSet::getDefaultBackend()
+{
+    return default_backend.load(std::memory_order_relaxed);
+}
+
+
+PollSet::Backend PollSet::parseBackend(const String & backend)
 {
+    if (backend == "epoll")
+        return Backend::EPOLL;
+    if (backend == "io_uring")
+        return Backend::IO_URING;
+    throw Exception(ErrorCodes::BAD_ARGUMENTS, "Unknown network reactor {}, valid values are epoll and io_uring", backend);
 }
 
 
@@ -515,9 +887,9 @@ void PollSet::clear()
 }
 
 
-PollSet::SocketModeMap PollSet::poll(const Poco::Timespan & timeout)
+void PollSet::poll(const Poco::Timespan & timeout, Events & events)
 {
-    return impl->poll(timeout);
+    impl->poll(timeout, events);
 }
 
 
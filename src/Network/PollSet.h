@@ -4,9 +4,10 @@
 */
 #pragma once
 
-#include <map>
+#include <vector>
 
 #include <Poco/Net/Socket.h>
+#include <common/types.h>
 
 
 namespace RK
@@ -17,11 +18,18 @@ class PollSetImpl;
 
 /// A set of sockets that can be efficiently polled as a whole.
 ///
-/// PollSet is implemented using epoll (Linux) or poll (BSD) APIs.
+/// PollSet is implemented using epoll or io_uring (Linux) or poll (BSD) APIs.
 /// A fallback implementation using select() is also provided.
 class PollSet
 {
 public:
+    enum class Backend
+    {
+        EPOLL,
+        /// Needs Linux 5.11, falls back to epoll if the kernel does not have it
+        IO_URING,
+    };
+
     enum Mode
     {
         POLL_READ = 0x01,
@@ -29,11 +37,26 @@ public:
         POLL_ERROR = 0x04
     };
 
-    using SocketModeMap = std::map<Poco::Net::Socket, int>;
+    /// A socket whose state changed, mode is the changes.
+    struct Event
+    {
+        poco_socket_t fd;
+        int mode;
+    };
+    using Events = std::vector<Event>;
 
+    /// Of the default backend
     PollSet();
+    explicit PollSet(Backend backend);
     ~PollSet();
 
+    /// Backend of poll sets created later, it is set before reactors are created.
+    static void setDefaultBackend(Backend backend);
+    static Backend getDefaultBackend();
+
+    /// Parse "epoll" or "io_uring", throws on others
+    static Backend parseBackend(const String & backend);
+
     /// Adds the given socket to the set, for polling with the given mode.
     void add(const Socket & socket, int mode);
 
@@ -54,9 +77,9 @@ public:
 
     /// Waits until the state of at least one of the PollSet's sockets
     /// changes accordingly to its mode, or the timeout expires.
-    /// Returns a PollMap containing the sockets that have had
-    /// their state changed.
-    SocketModeMap poll(const Poco::Timespan & timeout);
+    /// Fills events with the sockets that have had their state changed,
+    /// events is cleared first and reused by caller to avoid allocation.
+    void poll(const Poco::Timespan & timeout, Events & events);
 
     /// Returns the number of sockets monitored.
     int count() const;
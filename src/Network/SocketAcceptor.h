@@ -63,7 +63,8 @@ public:
         MainReactorPtr & main_reactor_,
         const Poco::Timespan & timeout_,
         size_t worker_count_ = getNumberOfPhysicalCPUCores(),
-        SocketConfigurator socket_configurator_ = nullptr)
+        SocketConfigurator socket_configurator_ = nullptr,
+        int first_cpu_ = -1)
         : name(name_)
         , socket(socket_)
         , main_reactor(main_reactor_)
@@ -71,6 +72,7 @@ public:
         , keeper_context(keeper_context_)
         , timeout(timeout_)
         , socket_configurator(socket_configurator_)
+        , first_cpu(first_cpu_)
         , log(&Poco::Logger::get("SocketAcceptor"))
     {
         initialize();
@@ -126,7 +128,10 @@ protected:
         /// Initialize worker getWorkerReactors
         poco_assert(worker_count > 0);
         for (size_t i = 0; i < worker_count; ++i)
-            worker_reactors.push_back(std::make_shared<WorkerReactor>(timeout, name + "#" + std::to_string(i)));
+        {
+            int cpu = first_cpu < 0 ? -1 : static_cast<int>((static_cast<size_t>(first_cpu) + i) % Poco::Environment::processorCount());
+            worker_reactors.push_back(std::make_shared<WorkerReactor>(timeout, name + "#" + std::to_string(i), cpu));
+        }
 
         /// Register accept event handler to main reactor
         main_reactor->addEventHandler(socket, AcceptorObserver(*this, &SocketAcceptor::onAccept));
@@ -177,6 +182,9 @@ private:
     /// Used to configure accepted sockets
     SocketConfigurator socket_configurator;
 
+    /// If not negative, worker reactors are bound to cpus from it one by one.
+    int first_cpu;
+
     Poco::Logger * log;
 };
 
@@ -3,10 +3,17 @@
 * SPDX-License-Identifier:	BSL-1.0
 *
 */
+#if defined(OS_LINUX)
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
 #include <Poco/ErrorHandler.h>
 #include <Poco/Exception.h>
 #include <Poco/Thread.h>
 
+#include <Common/BusyPoll.h>
+#include <Common/CpuProfiler.h>
 #include <Common/Exception.h>
 #include <Network/SocketNotification.h>
 #include <Network/SocketNotifier.h>
@@ -55,26 +62,28 @@ void SocketReactor::run()
             else
             {
                 bool readable = false;
-                PollSet::SocketModeMap sm = poll_set.poll(timeout);
+                /// Spin polling without blocking for the budget, then block
+                if (!BusyPoll::spin([this] { poll_set.poll(Poco::Timespan(0), events); return !events.empty(); }))
+                    poll_set.poll(timeout, events);
 
-                if (!sm.empty())
+                if (!events.empty())
                 {
                     onBusy();
-                    for (auto & socket_and_events : sm)
+                    for (const auto & event : events)
                     {
-                        if (socket_and_events.second & PollSet::POLL_READ)
+                        if (event.mode & PollSet::POLL_READ)
                         {
-                            dispatch(socket_and_events.first, *rnf);
+                            dispatch(event.fd, *rnf);
                             readable = true;
                         }
-                        if (socket_and_events.second & PollSet::POLL_WRITE)
+                        if (event.mode & PollSet::POLL_WRITE)
                         {
-                            dispatch(socket_and_events.first, *wnf);
+                            dispatch(event.fd, *wnf);
                         }
-                        if (socket_and_events.second & PollSet::POLL_ERROR)
+                        if (event.mode & PollSet::POLL_ERROR)
                         {
-                            dynamic_cast<ErrorNotification *>(enf.get())->setErrorNo(errno);
-                            dispatch(socket_and_events.first, *enf);
+                            static_cast<ErrorNotification *>(enf.get())->setErrorNo(errno);
+                            dispatch(event.fd, *enf);
                         }
                     }
                 }
@@ -94,17 +103,8 @@ void SocketReactor::run()
 
 bool SocketReactor::hasSocketHandlers()
 {
-    ScopedLock lock(mutex);
-    if (!notifiers.empty())
-    {
-        for (auto & p : notifiers)
-        {
-            if (p.second->accepts(*rnf) || p.second->accepts(*wnf) || p.second->accepts(*enf))
-                return true;
-        }
-    }
-
-    return false;
+    /// Sockets are in poll set only if they have read, write or error handlers.
+    return !poll_set.empty();
 }
 
 
@@ -195,14 +195,17 @@ SocketNotifierPtr SocketReactor::getNotifier(const Socket & socket, bool makeNew
     if (impl == nullptr)
         return nullptr;
 
-    poco_socket_t sock_fd = impl->sockfd();
+    auto index = static_cast<size_t>(impl->sockfd());
     ScopedLock lock(mutex);
 
-    SocketNotifierMap::iterator it = notifiers.find(sock_fd);
-    if (it != notifiers.end())
-        return it->second;
+    if (index < notifiers.size() && notifiers[index])
+        return notifiers[index];
     else if (makeNew)
-        return (notifiers[sock_fd] = std::make_shared<SocketNotifier>(socket));
+    {
+        if (index >= notifiers.size())
+            notifiers.resize(std::max(index + 1, notifiers.size() * 2));
+        return (notifiers[index] = std::make_shared<SocketNotifier>(socket));
+    }
 
     return nullptr;
 }
@@ -217,13 +220,13 @@ void SocketReactor::removeEventHandler(const Socket & socket, const AbstractObse
     SocketNotifierPtr notifier;
     {
         ScopedLock lock(mutex);
-        SocketNotifierMap::iterator it = notifiers.find(impl->sockfd());
-        if (it != notifiers.end())
-            notifier = it->second;
+        auto index = static_cast<size_t>(impl->sockfd());
+        if (index < notifiers.size())
+            notifier = notifiers[index];
 
         if (notifier && notifier->onlyHas(observer))
         {
-            notifiers.erase(impl->sockfd());
+            notifiers[index].reset();
             poll_set.remove(socket);
         }
     }
@@ -282,6 +285,20 @@ void SocketReactor::dispatch(const Socket & socket, const Notification & notific
     dispatch(notifier, notification);
 }
 
+void SocketReactor::dispatch(poco_socket_t fd, const Notification & notification)
+{
+    SocketNotifierPtr notifier;
+    {
+        ScopedLock lock(mutex);
+        auto index = static_cast<size_t>(fd);
+        if (index < notifiers.size())
+            notifier = notifiers[index];
+    }
+    if (!notifier)
+        return;
+    dispatch(notifier, notification);
+}
+
 
 void SocketReactor::dispatch(const Notification & notification)
 {
@@ -290,7 +307,8 @@ void SocketReactor::dispatch(const Notification & notification)
         ScopedLock lock(mutex);
         copied.reserve(notifiers.size());
         for (auto & notifier : notifiers)
-            copied.push_back(notifier.second);
+            if (notifier)
+                copied.push_back(notifier);
     }
     for (auto & notifier : copied)
     {
@@ -314,7 +332,8 @@ void SocketReactor::dispatch(SocketNotifierPtr & notifier, const Notification &
 }
 
 
-AsyncSocketReactor::AsyncSocketReactor(const Poco::Timespan & timeout, const std::string & name_) : SocketReactor(timeout), name(name_)
+AsyncSocketReactor::AsyncSocketReactor(const Poco::Timespan & timeout, const std::string & name_, int cpu_)
+    : SocketReactor(timeout), name(name_), cpu(cpu_)
 {
     startup();
 }
@@ -331,9 +350,29 @@ void AsyncSocketReactor::run()
         setThreadName(name.c_str());
         Poco::Thread::current()->setName(name);
     }
+    if (cpu >= 0)
+        bindToCpu();
+    CpuProfiler::instance().registerCurrentThread("io");
     SocketReactor::run();
 }
 
+void AsyncSocketReactor::bindToCpu()
+{
+    auto * log = &Poco::Logger::get("AsyncSocketReactor");
+#if defined(OS_LINUX)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+    if (err)
+        LOG_WARNING(log, "Failed to bind reactor {} to cpu {}, error {}", name, cpu, err);
+    else
+        LOG_INFO(log, "Reactor {} is bound to cpu {}", name, cpu);
+#else
+    LOG_WARNING(log, "Binding reactor {} to cpu is supported only on Linux", name);
+#endif
+}
+
 AsyncSocketReactor::~AsyncSocketReactor()
 {
     try
@@ -6,6 +6,7 @@
 
 #include <atomic>
 #include <map>
+#include <vector>
 
 #include <Poco/Net/Net.h>
 #include <Poco/Net/Socket.h>
@@ -114,12 +115,14 @@ protected:
 
     /// Dispatches the given notification to observers which are registered for the given socket.
     void dispatch(const Socket & socket, const Notification & notification);
+    void dispatch(poco_socket_t fd, const Notification & notification);
 
     /// Dispatches the given notification to all observers.
     void dispatch(const Notification & notification);
 
 private:
-    using SocketNotifierMap = std::map<poco_socket_t, SocketNotifierPtr>;
+    /// Notifiers indexed by socket fd, so an event finds its notifier without lookup.
+    using SocketNotifiers = std::vector<SocketNotifierPtr>;
 
     using MutexType = Poco::FastMutex;
     using ScopedLock = MutexType::ScopedLock;
@@ -141,9 +144,12 @@ private:
     Poco::Timespan timeout;
     std::atomic<bool> stopped;
 
-    SocketNotifierMap notifiers;
+    SocketNotifiers notifiers;
     PollSet poll_set;
 
+    /// Events of the last poll, reused by every poll
+    PollSet::Events events;
+
     /// Notifications which will dispatched to observers
     NotificationPtr rnf;
     NotificationPtr wnf;
@@ -163,7 +169,8 @@ private:
 class AsyncSocketReactor : public SocketReactor
 {
 public:
-    explicit AsyncSocketReactor(const Poco::Timespan & timeout, const std::string & name);
+    /// cpu -- if not negative, the reactor thread is bound to the cpu.
+    explicit AsyncSocketReactor(const Poco::Timespan & timeout, const std::string & name, int cpu = -1);
     ~AsyncSocketReactor() override;
 
     void run() override;
@@ -174,8 +181,12 @@ protected:
 private:
     void startup();
 
+    /// Bind current thread to cpu, failure is just logged.
+    void bindToCpu();
+
     Poco::Thread thread;
     const std::string name;
+    const int cpu;
 };
 
 
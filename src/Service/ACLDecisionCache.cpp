@@ -0,0 +1,69 @@
+#include <Service/ACLDecisionCache.h>
+
+
+namespace RK
+{
+
+ACLDecisionCache::ACLDecisionCache(size_t max_session_entries_) : max_session_entries(max_session_entries_)
+{
+}
+
+std::optional<bool> ACLDecisionCache::get(int64_t session_id, uint64_t acl_id, int32_t permission) const
+{
+    const auto & shard = getShard(session_id);
+    std::lock_guard lock(shard.mutex);
+
+    auto session_it = shard.sessions.find(session_id);
+    if (session_it == shard.sessions.end())
+        return {};
+
+    auto it = session_it->second.find(keyOf(acl_id, permission));
+    if (it == session_it->second.end())
+        return {};
+    return it->second;
+}
+
+void ACLDecisionCache::put(int64_t session_id, uint64_t acl_id, int32_t permission, bool allowed)
+{
+    if (max_session_entries == 0)
+        return;
+
+    auto & shard = getShard(session_id);
+    std::lock_guard lock(shard.mutex);
+
+    auto & decisions = shard.sessions[session_id];
+    /// A session touching many ACLs starts over, instead of tracking usage of decisions
+    if (decisions.size() >= max_session_entries)
+        decisions.clear();
+    decisions[keyOf(acl_id, permission)] = allowed;
+}
+
+void ACLDecisionCache::invalidate(int64_t session_id)
+{
+    auto & shard = getShard(session_id);
+    std::lock_guard lock(shard.mutex);
+    shard.sessions.erase(session_id);
+}
+
+void ACLDecisionCache::reset()
+{
+    for (auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.sessions.clear();
+    }
+}
+
+size_t ACLDecisionCache::size() const
+{
+    size_t result = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        for (const auto & [_, decisions] : shard.sessions)
+            result += decisions.size();
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/**
+ * Decisions of ACL checks by session, ACL id and permission, so that checking a session against the ACL of a znode
+ * again is one lookup instead of resolving the ACL id and matching ACL entries against auth of the session.
+ *
+ * An ACL id stands for the same ACLs as long as the ACL map is not reset, setting ACL of a znode changes its ACL id,
+ * so decisions of a session are valid until auth of the session changes. The caller drops them then, and when the
+ * session is closed or the store is reset.
+ *
+ * Thread-safe, sessions are sharded.
+ */
+class ACLDecisionCache
+{
+public:
+    /// Decisions of a session are dropped when it has more than max_session_entries_, 0 means no cache
+    explicit ACLDecisionCache(size_t max_session_entries_ = 1024);
+
+    /// Whether session is allowed, empty if not cached
+    std::optional<bool> get(int64_t session_id, uint64_t acl_id, int32_t permission) const;
+
+    void put(int64_t session_id, uint64_t acl_id, int32_t permission, bool allowed);
+
+    /// Drop decisions of session
+    void invalidate(int64_t session_id);
+
+    void reset();
+
+    size_t size() const;
+
+private:
+    static constexpr size_t SHARD_NUM = 16;
+
+    /// ACL id and permission, permissions take 5 bits
+    using Decisions = std::unordered_map<uint64_t, bool>;
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<int64_t, Decisions> sessions;
+    };
+
+    static uint64_t keyOf(uint64_t acl_id, int32_t permission) { return (acl_id << 5) | static_cast<uint64_t>(permission & 0x1F); }
+
+    Shard & getShard(int64_t session_id) { return shards[static_cast<uint64_t>(session_id) % SHARD_NUM]; }
+    const Shard & getShard(int64_t session_id) const { return shards[static_cast<uint64_t>(session_id) % SHARD_NUM]; }
+
+    const size_t max_session_entries;
+    std::array<Shard, SHARD_NUM> shards;
+};
+
+}
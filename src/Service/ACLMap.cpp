@@ -1,5 +1,6 @@
 #include <Service/ACLMap.h>
 #include <Common/SipHash.h>
+#include <Service/MemoryUsage.h>
 
 namespace RK
 {
@@ -25,10 +26,10 @@ namespace ErrorCodes
     extern const int LOGICAL_ERROR;
 }
 
-size_t ACLMap::ACLsHash::operator()(const Coordination::ACLs & acls) const
+size_t ACLMap::ACLsHash::operator()(const Coordination::ACLs * acls) const
 {
     SipHash hash;
-    for (const auto & acl : acls)
+    for (const auto & acl : *acls)
     {
         hash.update(acl.permissions);
         hash.update(acl.scheme);
@@ -37,20 +38,20 @@ size_t ACLMap::ACLsHash::operator()(const Coordination::ACLs & acls) const
     return hash.get64();
 }
 
-bool ACLMap::ACLsComparator::operator()(const Coordination::ACLs & left, const Coordination::ACLs & right) const
+bool ACLMap::ACLsComparator::operator()(const Coordination::ACLs * left, const Coordination::ACLs * right) const
 {
-    if (left.size() != right.size())
+    if (left->size() != right->size())
         return false;
 
-    for (size_t i = 0; i < left.size(); ++i)
+    for (size_t i = 0; i < left->size(); ++i)
     {
-        if (left[i].permissions != right[i].permissions)
+        if ((*left)[i].permissions != (*right)[i].permissions)
             return false;
 
-        if (left[i].scheme != right[i].scheme)
+        if ((*left)[i].scheme != (*right)[i].scheme)
             return false;
 
-        if (left[i].id != right[i].id)
+        if ((*left)[i].id != (*right)[i].id)
             return false;
     }
     return true;
@@ -63,38 +64,60 @@ uint64_t ACLMap::convertACLs(const Coordination::ACLs & acls)
     if (acls.empty() || acls == Coordination::ACLs{Coordination::ACL{Coordination::ACL::All, "world", "anyone"}})
         return 0;
 
-    if (acl_to_num.count(acls))
-        return acl_to_num[acls];
+    auto it = acl_to_num.find(&acls);
+    if (it != acl_to_num.end())
+        return it->second;
 
     /// Start from one
     auto index = max_acl_id++;
 
-    acl_to_num[acls] = index;
-    num_to_acl[index] = acls;
+    auto interned = std::make_shared<const Coordination::ACLs>(acls);
+    acl_to_num[interned.get()] = index;
+    num_to_acl[index] = std::move(interned);
 
     return index;
 }
 
-Coordination::ACLs ACLMap::convertNumber(uint64_t acls_id) const
+ACLsPtr ACLMap::convertNumber(uint64_t acls_id) const
 {
     if (acls_id == 0) /// default acl is 'world,'anyone : cdrwa
     {
-        return Coordination::ACLs{Coordination::ACL{Coordination::ACL::All, "world", "anyone"}};
+        static const ACLsPtr default_acls
+            = std::make_shared<const Coordination::ACLs>(Coordination::ACLs{Coordination::ACL{Coordination::ACL::All, "world", "anyone"}});
+        return default_acls;
     }
 
     std::lock_guard lock(acl_mutex);
 
-    if (!num_to_acl.count(acls_id))
+    auto it = num_to_acl.find(acls_id);
+    if (it == num_to_acl.end())
         throw Exception(ErrorCodes::LOGICAL_ERROR, "Unknown ACL id {}. It's a bug", acls_id);
 
-    return num_to_acl.at(acls_id);
+    return it->second;
+}
+
+ACLMap::NumToACLMap ACLMap::getMapping() const
+{
+    std::lock_guard lock(acl_mutex);
+    NumToACLMap mapping;
+    for (const auto & [acls_id, acls] : num_to_acl)
+        mapping.emplace(acls_id, *acls);
+    return mapping;
 }
 
 void ACLMap::addMapping(uint64_t acls_id, const Coordination::ACLs & acls)
 {
     std::lock_guard lock(acl_mutex);
-    num_to_acl[acls_id] = acls;
-    acl_to_num[acls] = acls_id;
+
+    /// The same ACLs under another id, or other ACLs under the id, are replaced
+    auto old = num_to_acl.find(acls_id);
+    if (old != num_to_acl.end())
+        acl_to_num.erase(old->second.get());
+
+    auto interned = std::make_shared<const Coordination::ACLs>(acls);
+    acl_to_num.erase(interned.get());
+    acl_to_num.emplace(interned.get(), acls_id);
+    num_to_acl[acls_id] = std::move(interned);
     max_acl_id = std::max(acls_id + 1, max_acl_id); /// max_acl_id pointer next slot
 }
 
@@ -116,26 +139,30 @@ void ACLMap::removeUsage(uint64_t acl_id)
 
     if (usage_counter[acl_id] == 0)
     {
-        auto acls = num_to_acl[acl_id];
-        num_to_acl.erase(acl_id);
-        acl_to_num.erase(acls);
+        auto it = num_to_acl.find(acl_id);
+        if (it != num_to_acl.end())
+        {
+            /// Erase the key before the ACLs it points to may be released
+            acl_to_num.erase(it->second.get());
+            num_to_acl.erase(acl_id);
+        }
         usage_counter.erase(acl_id);
     }
 }
 bool ACLMap::operator==(const ACLMap & rhs) const
 {
-    if (acl_to_num.size() != rhs.acl_to_num.size())
+    if (acl_to_num.size() != rhs.acl_to_num.size() || num_to_acl.size() != rhs.num_to_acl.size())
         return false;
 
-    for (const auto & it : acl_to_num)
+    /// Handles of the two maps are different, compare the ACLs they point to
+    for (const auto & [acls_id, acls] : num_to_acl)
     {
-        if (!rhs.acl_to_num.contains(it.first))
-            return false;
-        if (it.second != rhs.acl_to_num.at(it.first))
+        auto it = rhs.num_to_acl.find(acls_id);
+        if (it == rhs.num_to_acl.end() || *acls != *it->second)
             return false;
     }
 
-    return mapEquals(num_to_acl, rhs.num_to_acl) && mapEquals(usage_counter, rhs.usage_counter) && max_acl_id == rhs.max_acl_id;
+    return mapEquals(usage_counter, rhs.usage_counter) && max_acl_id == rhs.max_acl_id;
 }
 
 bool ACLMap::operator!=(const ACLMap & rhs) const
@@ -143,6 +170,21 @@ bool ACLMap::operator!=(const ACLMap & rhs) const
     return !(rhs == *this);
 }
 
+uint64_t ACLMap::getApproximateMemoryUsage() const
+{
+    std::lock_guard lock(acl_mutex);
+    uint64_t acls_bytes = 0;
+    for (const auto & [_, acls] : num_to_acl)
+    {
+        /// The shared block of the handle and the vector in it
+        acls_bytes += sizeof(Coordination::ACLs) + 2 * sizeof(void *) + acls->capacity() * sizeof(Coordination::ACL);
+        for (const auto & acl : *acls)
+            acls_bytes += stringMemoryUsage(acl.scheme) + stringMemoryUsage(acl.id);
+    }
+    /// ACLs are kept once, keys of acl_to_num point to them
+    return hashTableMemoryUsage(acl_to_num) + num_to_acl.getApproximateMemoryUsage() + hashTableMemoryUsage(usage_counter) + acls_bytes;
+}
+
 void ACLMap::reset()
 {
     std::lock_guard lock(acl_mutex);
@@ -1,5 +1,7 @@
 #pragma once
+#include <memory>
 #include <unordered_map>
+#include <Service/CopyOnWriteMap.h>
 #include <ZooKeeper/IKeeper.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 
@@ -7,29 +9,35 @@
 namespace RK
 {
 
+/// Shared handle of ACLs interned in ACLMap, they are never changed
+using ACLsPtr = std::shared_ptr<const Coordination::ACLs>;
+
 /// Simple mapping of different ACLs to sequentially growing numbers
 /// Allows to store single number instead of vector of ACLs on disk and in memory.
+/// Every distinct ACLs is kept once, shared by both directions of the mapping, readers and pinned snapshot versions.
 class ACLMap
 {
 private:
+    /// Keys of acl_to_num point to the ACLs kept by num_to_acl, lookups point to the ACLs looked for.
     struct ACLsHash
     {
-        size_t operator()(const Coordination::ACLs & acls) const;
+        size_t operator()(const Coordination::ACLs * acls) const;
     };
 
     struct ACLsComparator
     {
-        bool operator()(const Coordination::ACLs & left, const Coordination::ACLs & right) const;
+        bool operator()(const Coordination::ACLs * left, const Coordination::ACLs * right) const;
     };
 
-    using ACLToNumMap = std::unordered_map<Coordination::ACLs, uint64_t, ACLsHash, ACLsComparator>;
+    using ACLToNumMap = std::unordered_map<const Coordination::ACLs *, uint64_t, ACLsHash, ACLsComparator>;
 
     using NumToACLMap = std::unordered_map<uint64_t, Coordination::ACLs>;
+    using NumToACLs = CopyOnWriteMap<uint64_t, ACLsPtr>;
 
     using UsageCounter = std::unordered_map<uint64_t, uint64_t>;
 
     ACLToNumMap acl_to_num;
-    NumToACLMap num_to_acl;
+    NumToACLs num_to_acl;
     UsageCounter usage_counter;
     mutable std::recursive_mutex acl_mutex;
     uint64_t max_acl_id{1};
@@ -40,13 +48,17 @@ public:
     uint64_t convertACLs(const Coordination::ACLs & acls);
 
     /// Convert number to ACL vector. If number is unknown for map
-    /// than throws LOGICAL ERROR
-    Coordination::ACLs convertNumber(uint64_t acls_id) const;
-    /// Mapping from numbers to ACLs vectors. Used during serialization.
-    NumToACLMap getMapping() const
+    /// than throws LOGICAL ERROR. The handle keeps ACLs alive even if they are removed later.
+    ACLsPtr convertNumber(uint64_t acls_id) const;
+
+    /// Copy of mapping from numbers to ACLs vectors. Used in tests.
+    NumToACLMap getMapping() const;
+
+    /// Version of the mapping for snapshot, later changes of ACLs do not change it
+    NumToACLs::VersionPtr pinMapping() const
     {
         std::lock_guard lock(acl_mutex);
-        return num_to_acl;
+        return num_to_acl.pin();
     }
 
     UsageCounter getUsageCounter() const
@@ -62,6 +74,9 @@ public:
     void addUsage(uint64_t acl_id, uint64_t count = 1);
     void removeUsage(uint64_t acl_id);
 
+    /// Approximate bytes of the mappings and usage counters
+    uint64_t getApproximateMemoryUsage() const;
+
     bool operator==(const ACLMap & rhs) const;
     bool operator!=(const ACLMap & rhs) const;
 
@@ -0,0 +1,48 @@
+#include <algorithm>
+#include <Service/AdaptiveBatchPolicy.h>
+
+namespace RK
+{
+
+AdaptiveBatchPolicy::AdaptiveBatchPolicy(UInt64 max_batch_size_, UInt64 target_latency_ms_)
+    : max_batch_size(std::max(max_batch_size_, UInt64(1))), target_latency_us(target_latency_ms_ * 1000), batch_size(max_batch_size.load())
+{
+}
+
+void AdaptiveBatchPolicy::onBatchCompleted(UInt64 size, UInt64 latency_us, bool full)
+{
+    if (!has_feedback)
+    {
+        avg_latency_us = static_cast<double>(latency_us);
+        avg_batch_size = static_cast<double>(size);
+        has_feedback = true;
+    }
+    else
+    {
+        avg_latency_us += SMOOTHING * (static_cast<double>(latency_us) - avg_latency_us);
+        avg_batch_size += SMOOTHING * (static_cast<double>(size) - avg_batch_size);
+    }
+
+    if (avg_latency_us > static_cast<double>(target_latency_us))
+    {
+        batch_size = std::max(UInt64(1), batch_size * 3 / 4);
+        linger_ms /= 2;
+    }
+    else if (full)
+    {
+        UInt64 max_size = max_batch_size.load(std::memory_order_relaxed);
+        batch_size = std::min(max_size, batch_size + std::max(UInt64(1), max_size / 16));
+    }
+    else if (avg_batch_size >= 2)
+    {
+        /// Linger at most half of the headroom, the rest is left for replication itself
+        auto max_linger_ms = static_cast<UInt64>((static_cast<double>(target_latency_us) - avg_latency_us) / 2000);
+        linger_ms = std::min(linger_ms + 1, max_linger_ms);
+    }
+    else
+    {
+        linger_ms = 0;
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/**
+ * Tunes batch size and linger time of RequestAccumulator against a target replication latency.
+ *
+ * The feedback is the size (the sample of log_replication_batch_size) and the replication latency
+ * of every completed batch, both are smoothed by exponential moving average.
+ *
+ *  1. Latency is above target: shrink batch size and linger time multiplicatively.
+ *  2. Batch was full: requests are queuing up, grow batch size additively.
+ *  3. Batch was flushed because queue drained: if batches contain several requests on average
+ *     there are concurrent clients, linger for a part of the latency headroom to let the batch
+ *     grow. Batches of a single request, for example when cluster is idle, never linger.
+ */
+class AdaptiveBatchPolicy
+{
+public:
+    AdaptiveBatchPolicy(UInt64 max_batch_size_, UInt64 target_latency_ms_);
+
+    UInt64 getBatchSize() const { return std::min(batch_size, max_batch_size.load(std::memory_order_relaxed)); }
+
+    /// Invoked from another thread when config is reloaded, a larger batch size is reached by growing again
+    void setMaxBatchSize(UInt64 max_batch_size_) { max_batch_size = std::max(max_batch_size_, UInt64(1)); }
+
+    /// How long to wait for more requests when queue is drained but the batch is not full
+    UInt64 getLingerMs() const { return linger_ms; }
+
+    /// Feed back a completed batch, full means it was flushed because it reached getBatchSize().
+    void onBatchCompleted(UInt64 size, UInt64 latency_us, bool full);
+
+private:
+    static constexpr double SMOOTHING = 0.2;
+
+    std::atomic<UInt64> max_batch_size;
+    const UInt64 target_latency_us;
+
+    UInt64 batch_size;
+    UInt64 linger_ms{0};
+
+    double avg_latency_us{0};
+    double avg_batch_size{1};
+    bool has_feedback{false};
+};
+
+}
@@ -0,0 +1,26 @@
+#include <Service/AdmissionController.h>
+
+namespace RK
+{
+
+AdmissionController::AdmissionController(UInt64 max_pending_requests_, UInt64 max_commit_lag_)
+    : max_pending_requests(max_pending_requests_), max_commit_lag(max_commit_lag_)
+{
+}
+
+bool AdmissionController::update(UInt64 pending_requests, UInt64 commit_lag)
+{
+    auto reached = [](UInt64 value, UInt64 limit) { return limit && value >= limit; };
+    auto below_half = [](UInt64 value, UInt64 limit) { return !limit || value <= limit / 2; };
+
+    bool res = saturated.load(std::memory_order_relaxed);
+    if (!res)
+        res = reached(pending_requests, max_pending_requests) || reached(commit_lag, max_commit_lag);
+    else
+        res = !(below_half(pending_requests, max_pending_requests) && below_half(commit_lag, max_commit_lag));
+
+    saturated.store(res, std::memory_order_relaxed);
+    return res;
+}
+
+}
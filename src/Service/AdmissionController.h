@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/**
+ * Tells connections whether the node is saturated, so that they stop reading requests from
+ * sockets for a while instead of queuing up more requests with unbounded latency.
+ *
+ * The node is saturated when the requests pending in the pipeline or the commit lag (Raft logs
+ * committed but not applied to state machine yet) reaches its limit. It leaves saturation when
+ * both of them drop under half of the limit, so that connections do not flap around the limit.
+ * A limit of 0 disables the check.
+ */
+class AdmissionController
+{
+public:
+    AdmissionController(UInt64 max_pending_requests_, UInt64 max_commit_lag_);
+
+    bool enabled() const { return max_pending_requests || max_commit_lag; }
+
+    /// Feed current pipeline depth and commit lag, return whether the node is saturated.
+    bool update(UInt64 pending_requests, UInt64 commit_lag);
+
+    bool isSaturated() const { return saturated.load(std::memory_order_relaxed); }
+
+private:
+    const UInt64 max_pending_requests;
+    const UInt64 max_commit_lag;
+
+    /// Updated by all reactor threads, the race is benign.
+    std::atomic<bool> saturated{false};
+};
+
+}
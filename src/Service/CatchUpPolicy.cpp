@@ -0,0 +1,62 @@
+#include <Service/CatchUpPolicy.h>
+
+#include <algorithm>
+
+namespace RK
+{
+
+CatchUpPolicy::CatchUpPolicy(UInt64 link_bandwidth_, UInt64 log_replay_rate_, UInt64 max_extra_log_bytes_)
+    : link_bandwidth(std::max(link_bandwidth_, UInt64(1)))
+    , log_replay_rate(std::max(log_replay_rate_, UInt64(1)))
+    , max_extra_log_bytes(max_extra_log_bytes_)
+{
+}
+
+UInt64 CatchUpPolicy::transferMs(double bytes) const
+{
+    return static_cast<UInt64>(bytes * 1000 / static_cast<double>(link_bandwidth));
+}
+
+UInt64 CatchUpPolicy::replayMs(UInt64 entries) const
+{
+    return entries * 1000 / log_replay_rate;
+}
+
+UInt64 CatchUpPolicy::logCostMs(UInt64 next_index, UInt64 last_log_index, double bytes_per_entry) const
+{
+    UInt64 entries = last_log_index >= next_index ? last_log_index - next_index + 1 : 0;
+    return transferMs(static_cast<double>(entries) * bytes_per_entry) + replayMs(entries);
+}
+
+UInt64 CatchUpPolicy::snapshotCostMs(UInt64 snapshot_bytes, UInt64 snapshot_index, UInt64 last_log_index, double bytes_per_entry) const
+{
+    UInt64 entries = last_log_index > snapshot_index ? last_log_index - snapshot_index : 0;
+    return transferMs(static_cast<double>(snapshot_bytes) + static_cast<double>(entries) * bytes_per_entry) + replayMs(entries);
+}
+
+UInt64 CatchUpPolicy::getCompactIndex(const LogState & state, const std::vector<UInt64> & follower_next_indexes) const
+{
+    if (!enabled() || !state.snapshot_bytes)
+        return state.compact_index;
+
+    UInt64 compact_index = state.compact_index;
+    for (UInt64 next_index : follower_next_indexes)
+    {
+        /// Needs nothing compacted, or needs a snapshot anyway because its logs are gone
+        if (next_index > compact_index || next_index < state.first_log_index)
+            continue;
+
+        /// Entries in [next_index, state.compact_index] kept for it
+        double extra_bytes = static_cast<double>(state.compact_index - next_index + 1) * state.bytes_per_entry;
+        if (extra_bytes > static_cast<double>(max_extra_log_bytes))
+            continue;
+
+        UInt64 log_cost = logCostMs(next_index, state.last_log_index, state.bytes_per_entry);
+        UInt64 snapshot_cost = snapshotCostMs(state.snapshot_bytes, state.snapshot_index, state.last_log_index, state.bytes_per_entry);
+        if (log_cost < snapshot_cost)
+            compact_index = next_index - 1;
+    }
+    return compact_index;
+}
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <vector>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/**
+ * Decides how far logs are compacted when there are lagging followers, so that a follower catches up by the cheaper
+ * of the two ways NuRaft has: streaming logs from its next index, or installing the latest snapshot and streaming
+ * logs after it. NuRaft sends a snapshot whenever the logs a follower needs are compacted, so a follower slightly
+ * beyond reserved_log_items would pull a whole snapshot.
+ *
+ * Costs are estimated as the time to send the bytes over a link of link_bandwidth bytes per second plus the time
+ * to replay the entries at log_replay_rate entries per second:
+ *
+ *  1. Log: entries from the next index of the follower to the last log.
+ *  2. Snapshot: the bytes of the snapshot, then entries from the snapshot to the last log.
+ *
+ * If logs are cheaper, compaction keeps the ones the follower needs, at most max_extra_log_bytes more than it would
+ * keep otherwise. Retention is extended only as long as it is decided again by every compaction, a follower which
+ * stays behind until the extension exceeds the bound gets a snapshot. max_extra_log_bytes of 0 disables it.
+ */
+class CatchUpPolicy
+{
+public:
+    CatchUpPolicy(UInt64 link_bandwidth_, UInt64 log_replay_rate_, UInt64 max_extra_log_bytes_);
+
+    bool enabled() const { return max_extra_log_bytes > 0; }
+
+    /// Estimated milliseconds to catch up by logs in [next_index, last_log_index]
+    UInt64 logCostMs(UInt64 next_index, UInt64 last_log_index, double bytes_per_entry) const;
+
+    /// Estimated milliseconds to catch up by the snapshot of snapshot_bytes at snapshot_index and the logs after it
+    UInt64 snapshotCostMs(UInt64 snapshot_bytes, UInt64 snapshot_index, UInt64 last_log_index, double bytes_per_entry) const;
+
+    struct LogState
+    {
+        /// Index NuRaft compacts logs up to, inclusive
+        UInt64 compact_index;
+        UInt64 first_log_index;
+        UInt64 last_log_index;
+        /// Average bytes of an entry
+        double bytes_per_entry;
+        UInt64 snapshot_index;
+        UInt64 snapshot_bytes;
+    };
+
+    /// Index to compact logs up to instead of state.compact_index, not larger than it, by the next indexes of followers.
+    UInt64 getCompactIndex(const LogState & state, const std::vector<UInt64> & follower_next_indexes) const;
+
+private:
+    UInt64 transferMs(double bytes) const;
+    UInt64 replayMs(UInt64 entries) const;
+
+    const UInt64 link_bandwidth;
+    const UInt64 log_replay_rate;
+    const UInt64 max_extra_log_bytes;
+};
+
+}
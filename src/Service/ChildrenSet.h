@@ -0,0 +1,251 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+#include <Common/HashFunctions.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Children names of a znode.
+  *
+  * Most znodes have no or a few children, so they are kept in a sorted vector which
+  * costs nothing when empty and is cheap to iterate and serialize. When the number of
+  * children exceeds HASH_INDEX_THRESHOLD, it switches to a hash set to keep insertion and
+  * removal O(1) for directories like queues with hundreds of thousands of children, and
+  * switches back when it shrinks far enough.
+  *
+  * Iteration is sorted only in the vector representation, page() gives sorted names in both. Names
+  * are looked up and erased by std::string_view, so the base name of a path need not be copied out of it.
+  */
+class ChildrenSet
+{
+public:
+    using SmallSet = std::vector<String>;
+    using LargeSet = std::unordered_set<String, StringHash, std::equal_to<>>;
+
+    static constexpr size_t HASH_INDEX_THRESHOLD = 128;
+
+    class const_iterator /// NOLINT
+    {
+        friend class ChildrenSet;
+
+        SmallSet::const_iterator small_it;
+        LargeSet::const_iterator large_it;
+        bool is_large = false;
+
+        explicit const_iterator(SmallSet::const_iterator it) : small_it(it) { }
+        explicit const_iterator(LargeSet::const_iterator it) : large_it(it), is_large(true) { }
+
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = String;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const String *;
+        using reference = const String &;
+
+        const_iterator() = default;
+
+        reference operator*() const { return is_large ? *large_it : *small_it; }
+        pointer operator->() const { return &**this; }
+
+        const_iterator & operator++()
+        {
+            if (is_large)
+                ++large_it;
+            else
+                ++small_it;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            auto res = *this;
+            ++*this;
+            return res;
+        }
+
+        bool operator==(const const_iterator & rhs) const { return is_large ? large_it == rhs.large_it : small_it == rhs.small_it; }
+        bool operator!=(const const_iterator & rhs) const { return !(*this == rhs); }
+    };
+
+    using iterator = const_iterator;
+    using value_type = String;
+
+    ChildrenSet() = default;
+
+    ChildrenSet(std::initializer_list<String> names)
+    {
+        for (const auto & name : names)
+            insert(name);
+    }
+
+    ChildrenSet(const ChildrenSet & rhs) : small(rhs.small), large(rhs.large ? std::make_unique<LargeSet>(*rhs.large) : nullptr) { }
+    ChildrenSet(ChildrenSet && rhs) noexcept = default;
+
+    ChildrenSet & operator=(const ChildrenSet & rhs)
+    {
+        if (this != &rhs)
+        {
+            small = rhs.small;
+            large = rhs.large ? std::make_unique<LargeSet>(*rhs.large) : nullptr;
+        }
+        return *this;
+    }
+
+    ChildrenSet & operator=(ChildrenSet && rhs) noexcept = default;
+
+    const_iterator begin() const { return large ? const_iterator(large->cbegin()) : const_iterator(small.cbegin()); }
+    const_iterator end() const { return large ? const_iterator(large->cend()) : const_iterator(small.cend()); }
+
+    size_t size() const { return large ? large->size() : small.size(); }
+    bool empty() const { return size() == 0; }
+
+    bool contains(std::string_view name) const
+    {
+        if (large)
+            return large->find(name) != large->end();
+        return std::binary_search(small.begin(), small.end(), name);
+    }
+
+    template <typename T>
+    bool insert(T && name)
+    {
+        if (large)
+            return large->emplace(std::forward<T>(name)).second;
+
+        auto it = std::lower_bound(small.begin(), small.end(), name);
+        if (it != small.end() && *it == name)
+            return false;
+
+        if (small.size() >= HASH_INDEX_THRESHOLD)
+        {
+            toLarge();
+            return large->emplace(std::forward<T>(name)).second;
+        }
+
+        small.emplace(it, std::forward<T>(name));
+        return true;
+    }
+
+    template <typename T>
+    bool emplace(T && name)
+    {
+        return insert(std::forward<T>(name));
+    }
+
+    size_t erase(std::string_view name)
+    {
+        if (large)
+        {
+            auto it = large->find(name);
+            if (it == large->end())
+                return 0;
+            large->erase(it);
+            if (large->size() < HASH_INDEX_THRESHOLD / 4)
+                toSmall();
+            return 1;
+        }
+
+        auto it = std::lower_bound(small.begin(), small.end(), name);
+        if (it == small.end() || *it != name)
+            return 0;
+        small.erase(it);
+        return 1;
+    }
+
+    /// At most limit names greater than start_after in sorted order, returns whether there are more of them.
+    /// The vector is sorted already, the hash set is scanned keeping the smallest limit names in a heap,
+    /// so a page of a wide znode costs O(size * log(limit)) time and O(limit) memory.
+    bool page(std::string_view start_after, size_t limit, std::vector<std::string_view> & names) const
+    {
+        names.clear();
+        if (!large)
+        {
+            auto it = start_after.empty() ? small.begin() : std::upper_bound(small.begin(), small.end(), start_after);
+            size_t left = static_cast<size_t>(small.end() - it);
+            names.assign(it, it + static_cast<std::ptrdiff_t>(std::min(left, limit)));
+            return left > limit;
+        }
+
+        size_t left = 0;
+        for (const auto & name : *large)
+        {
+            if (!start_after.empty() && name <= start_after)
+                continue;
+            ++left;
+            if (names.size() < limit)
+            {
+                names.push_back(name);
+                std::push_heap(names.begin(), names.end());
+            }
+            else if (limit && name < names.front())
+            {
+                std::pop_heap(names.begin(), names.end());
+                names.back() = name;
+                std::push_heap(names.begin(), names.end());
+            }
+        }
+        std::sort_heap(names.begin(), names.end());
+        return left > limit;
+    }
+
+    void reserve(size_t n)
+    {
+        if (large)
+            large->reserve(n);
+        else if (n > HASH_INDEX_THRESHOLD)
+            toLarge(n);
+        else
+            small.reserve(n);
+    }
+
+    void clear()
+    {
+        small = {};
+        large.reset();
+    }
+
+    bool operator==(const ChildrenSet & rhs) const
+    {
+        if (size() != rhs.size())
+            return false;
+        if (!large && !rhs.large)
+            return small == rhs.small;
+        for (const auto & name : *this)
+            if (!rhs.contains(name))
+                return false;
+        return true;
+    }
+
+    bool operator!=(const ChildrenSet & rhs) const { return !(*this == rhs); }
+
+private:
+    void toLarge(size_t reserve_size = 0)
+    {
+        large = std::make_unique<LargeSet>();
+        large->reserve(std::max(reserve_size, small.size() * 2));
+        for (auto & name : small)
+            large->emplace(std::move(name));
+        small = {};
+    }
+
+    void toSmall()
+    {
+        SmallSet res(std::make_move_iterator(large->begin()), std::make_move_iterator(large->end()));
+        std::sort(res.begin(), res.end());
+        small = std::move(res);
+        large.reset();
+    }
+
+    SmallSet small;
+    std::unique_ptr<LargeSet> large;
+};
+
+}
@@ -0,0 +1,63 @@
+#include <Service/ConnectionBufferPool.h>
+
+
+namespace RK
+{
+
+ConnectionBufferPool::ConnectionBufferPool(size_t max_buffers_, size_t max_buffer_capacity_)
+    : max_buffers(max_buffers_), max_buffer_capacity(max_buffer_capacity_)
+{
+    buffers.reserve(max_buffers);
+}
+
+ConnectionBufferPool & ConnectionBufferPool::instance()
+{
+    static ConnectionBufferPool pool;
+    return pool;
+}
+
+String ConnectionBufferPool::take()
+{
+    std::lock_guard lock(mutex);
+    if (buffers.empty())
+        return {};
+    String buffer = std::move(buffers.back());
+    buffers.pop_back();
+    pooled_bytes.fetch_sub(buffer.capacity(), std::memory_order_relaxed);
+    return buffer;
+}
+
+void ConnectionBufferPool::give(String && buffer)
+{
+    /// Nothing allocated by a connection not used yet
+    if (buffer.empty())
+        return;
+
+    size_t capacity = buffer.capacity();
+    if (capacity > max_buffer_capacity)
+    {
+        String().swap(buffer);
+        return;
+    }
+
+    String released;
+    {
+        std::lock_guard lock(mutex);
+        if (buffers.size() < max_buffers)
+        {
+            buffers.push_back(std::move(buffer));
+            pooled_bytes.fetch_add(capacity, std::memory_order_relaxed);
+            return;
+        }
+    }
+    /// Freed out of lock
+    released.swap(buffer);
+}
+
+size_t ConnectionBufferPool::size() const
+{
+    std::lock_guard lock(mutex);
+    return buffers.size();
+}
+
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Read and serialization buffers shared by client connections. A connection takes buffers when it has bytes to read
+  * or responses to send and gives them back when it drains, so an idle connection holds none of them, and the memory
+  * of buffers is bounded by the connections actually moving data rather than all connections.
+  *
+  * Buffers are given back with their size kept, a reader resizing it again does not fill it with zeros.
+  */
+class ConnectionBufferPool
+{
+public:
+    static constexpr size_t DEFAULT_MAX_BUFFERS = 256;
+    static constexpr size_t DEFAULT_MAX_BUFFER_CAPACITY = 65536;
+
+    explicit ConnectionBufferPool(size_t max_buffers_ = DEFAULT_MAX_BUFFERS, size_t max_buffer_capacity_ = DEFAULT_MAX_BUFFER_CAPACITY);
+
+    static ConnectionBufferPool & instance();
+
+    /// A pooled buffer, or an empty one if there is none
+    String take();
+
+    /// Keep buffer for other connections, it is freed if it is larger than max_buffer_capacity or the pool is full
+    void give(String && buffer);
+
+    /// Memory held by the pooled buffers
+    size_t bytes() const { return pooled_bytes.load(std::memory_order_relaxed); }
+
+    size_t size() const;
+
+private:
+    const size_t max_buffers;
+    const size_t max_buffer_capacity;
+
+    mutable std::mutex mutex;
+    std::vector<String> buffers;
+    std::atomic<size_t> pooled_bytes{0};
+};
+
+}
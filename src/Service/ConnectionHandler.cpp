@@ -1,10 +1,21 @@
 #include "ConnectionHandler.h"
 
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
 #include <Poco/Net/NetException.h>
 
+#include <Common/CoarseClock.h>
 #include <Common/Stopwatch.h>
 
+#include <Service/ConnectionBufferPool.h>
 #include <Service/FourLetterCommand.h>
+#include <Service/OpCostMetrics.h>
+#include <Service/RequestStageMetrics.h>
+#include <Service/RequestCapture.h>
+#include <Service/RequestTracer.h>
+#include <Service/SlowRequestLog.h>
 #include <Service/formatHex.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 #include <ZooKeeper/ZooKeeperIO.h>
@@ -17,9 +28,10 @@ namespace ErrorCodes
     extern const int UNEXPECTED_PACKET_FROM_CLIENT;
     extern const int TIMEOUT_EXCEEDED;
     extern const int LOGICAL_ERROR;
+    extern const int NETWORK_ERROR;
 }
 
-std::mutex ConnectionHandler::conns_mutex;
+ProfiledMutex ConnectionHandler::conns_mutex{"conns_mutex"};
 std::unordered_set<ConnectionHandler *> ConnectionHandler::connections;
 
 
@@ -35,12 +47,25 @@ void ConnectionHandler::unregisterConnection(ConnectionHandler * conn)
     connections.erase(conn);
 }
 
-void ConnectionHandler::dumpConnections(WriteBufferFromOwnString & buf, bool brief)
+void ConnectionHandler::dumpConnections(const DumpOutput & output, bool brief)
 {
-    std::lock_guard lock(conns_mutex);
-    for (auto * conn : connections)
+    std::vector<ConnectionHandler *> conns;
+    {
+        std::lock_guard lock(conns_mutex);
+        conns.assign(connections.begin(), connections.end());
+    }
+
+    for (size_t begin = 0; begin < conns.size(); begin += DUMP_CHUNK_SIZE)
     {
-        conn->dumpStats(buf, brief);
+        WriteBufferFromOwnString buf;
+        {
+            /// A connection is alive as long as it is registered
+            std::lock_guard lock(conns_mutex);
+            for (size_t i = begin; i < std::min(begin + DUMP_CHUNK_SIZE, conns.size()); ++i)
+                if (connections.contains(conns[i]))
+                    conns[i]->dumpStats(buf, brief);
+        }
+        output(std::move(buf.str()));
     }
 }
 
@@ -53,10 +78,23 @@ void ConnectionHandler::resetConnsStats()
     }
 }
 
+void ConnectionHandler::getMemoryUsage(KeeperMemoryUsage & usage)
+{
+    std::lock_guard lock(conns_mutex);
+    for (const auto * conn : connections)
+    {
+        usage.connection_buffers += conn->buffer_bytes.load(std::memory_order_relaxed);
+        usage.pipeline_queues += conn->unanswered_bytes.load(std::memory_order_relaxed);
+    }
+    usage.connection_buffers += ConnectionBufferPool::instance().bytes();
+}
+
 ConnectionHandler::ConnectionHandler(Context & global_context_, StreamSocket & socket_, SocketReactor & reactor_)
     : log(&Logger::get("ConnectionHandler"))
     , sock(socket_)
-    , peer(socket_.peerAddress().toString())
+    , peer(
+          socket_.address().family() == Poco::Net::SocketAddress::UNIX_LOCAL ? "unix#" + std::to_string(socket_.impl()->sockfd())
+                                                                               : socket_.peerAddress().toString())
     , reactor(reactor_)
     , global_context(global_context_)
     , keeper_dispatcher(global_context.getDispatcher())
@@ -72,12 +110,18 @@ ConnectionHandler::ConnectionHandler(Context & global_context_, StreamSocket & s
           0,
           Context::getConfigRef().getUInt("keeper.raft_settings.max_session_timeout_ms", Coordination::DEFAULT_MAX_SESSION_TIMEOUT_MS)
               * 1000)
-    , responses(std::make_unique<ThreadSafeResponseQueue>())
+    , max_in_flight_bytes(Context::getConfigRef().getUInt64("keeper.max_connection_in_flight_bytes", DEFAULT_MAX_IN_FLIGHT_BYTES))
+    , max_in_flight_requests(Context::getConfigRef().getUInt64("keeper.max_session_in_flight_requests", 0))
+    , max_request_bytes_per_second(Context::getConfigRef().getUInt64("keeper.max_session_request_bytes_per_second", 0))
+    , request_bytes_tokens(static_cast<double>(max_request_bytes_per_second))
     , last_op(std::make_unique<LastOp>(EMPTY_LAST_OP))
 {
     LOG_INFO(log, "New connection from {}", peer);
     registerConnection(this);
 
+    if (socket_.address().family() != Poco::Net::SocketAddress::UNIX_LOCAL && TLSContext::instance().clientPortEnabled())
+        tls_handshake = std::make_unique<TLSHandshake>(TLSContext::instance().serverContext(), sock.impl()->sockfd(), true);
+
     auto read_handler = Observer<ConnectionHandler, ReadableNotification>(*this, &ConnectionHandler::onSocketReadable);
     auto error_handler = Observer<ConnectionHandler, ErrorNotification>(*this, &ConnectionHandler::onSocketError);
     auto shutdown_handler = Observer<ConnectionHandler, ShutdownNotification>(*this, &ConnectionHandler::onReactorShutdown);
@@ -99,10 +143,17 @@ ConnectionHandler::~ConnectionHandler()
 
         unregisterConnection(this);
 
+        if (four_letter_word_task)
+        {
+            std::lock_guard lock(four_letter_word_task->mutex);
+            four_letter_word_task->handler = nullptr;
+        }
+
         reactor.removeEventHandler(sock, Observer<ConnectionHandler, ReadableNotification>(*this, &ConnectionHandler::onSocketReadable));
         reactor.removeEventHandler(sock, Observer<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
         reactor.removeEventHandler(sock, Observer<ConnectionHandler, ErrorNotification>(*this, &ConnectionHandler::onSocketError));
         reactor.removeEventHandler(sock, Observer<ConnectionHandler, ShutdownNotification>(*this, &ConnectionHandler::onReactorShutdown));
+        reactor.removeEventHandler(sock, Observer<ConnectionHandler, TimeoutNotification>(*this, &ConnectionHandler::onReactorTimeout));
     }
     catch (...)
     {
@@ -115,124 +166,82 @@ void ConnectionHandler::onSocketReadable(const Notification &)
     {
         LOG_TRACE(log, "Peer {}#{} is readable", peer, toHexString(session_id.load()));
 
-        if (!sock.available())
+        if (tls_handshake && proceedTLSHandshake() != TLSHandshake::DONE)
+            return;
+
+        if (handshake_done && !skip_saturation_check && keeper_dispatcher->isSaturated())
         {
-            destroyMe();
+            pauseReading("node is saturated");
             return;
         }
+        skip_saturation_check = false;
 
-        while (sock.available())
+        if (isOverMemoryLimit())
         {
-            /// 1. Request header
-            if (!next_req_header_read_done)
-            {
-                if (!req_header_buf.isFull())
-                {
-                    sock.receiveBytes(req_header_buf);
-                    if (!req_header_buf.isFull())
-                        continue;
-                }
-
-                /// header read completed
-                int32_t header{};
-                ReadBufferFromMemory read_buf(req_header_buf.begin(), req_header_buf.used());
-                Coordination::read(header, read_buf);
-
-                /// All four letter word command code is larger than 2^24 or lower than 0.
-                /// Hand shake package length must be lower than 2^24 and larger than 0.
-                /// So collision never happens.
-                if (!isHandShake(header) && !handshake_done)
-                {
-                    int32_t four_letter_cmd = header;
-                    tryExecuteFourLetterWordCmd(four_letter_cmd);
+            pauseReading("in flight bytes exceed limit");
+            return;
+        }
 
-                    /// Handler no need delete self
-                    /// As to four letter command just wait client close connection.
-                    req_header_buf.drain(req_header_buf.used());
-                    return;
-                }
+        if (isOverInFlightRequestsLimit())
+        {
+            Metrics::getMetrics().throttled_in_flight_requests->add(1);
+            pauseReading("in flight requests exceed limit");
+            return;
+        }
 
-                body_len = header;
-                LOG_TRACE(log, "Peer {}#{} read request length : {}", peer, toHexString(session_id.load()), body_len);
+        if (isOverRequestRateLimit())
+        {
+            Metrics::getMetrics().throttled_request_bytes->add(1);
+            pauseReading("request bytes per second exceed limit");
+            return;
+        }
 
-                /// clear len_buf
-                req_header_buf.drain(req_header_buf.used());
-                next_req_header_read_done = true;
-            }
+        /// Requests pipelined by client are read by large reads, parsed and pushed to dispatcher at once.
+        /// Socket is read until a read does not fill the buffer, no syscall is spent on checking available bytes.
+        std::vector<Coordination::ZooKeeperRequestPtr> requests;
+        bool peer_closed = false;
+        bool more = true;
+        UInt64 receive_time_us = RequestTimeline::now();
+        while (more && !isOverLimit())
+        {
+            more = readToBuffer(peer_closed);
+            if (!parseRequests(requests, receive_time_us))
+                return;
+        }
 
-            /// 2. Read body
+        if (!requests.empty())
+        {
+            UInt64 parsed_time_us = RequestTimeline::now();
+            for (const auto & request : requests)
+                request->timeline.end(RequestStage::IO, parsed_time_us);
 
-            if (previous_req_body_read_done)
+            try
             {
-                /// create a buffer
-                req_body_buf = std::make_shared<FIFOBuffer>(body_len);
-                previous_req_body_read_done = false;
+                if (!keeper_dispatcher->pushRequests(requests, session_id, read_only_client))
+                    throw Exception(ErrorCodes::TIMEOUT_EXCEEDED, "Session {} already disconnected", toHexString(session_id.load()));
             }
+            catch (const Exception & e)
+            {
+                tryLogCurrentException(log, fmt::format("Error processing session {} request.", toHexString(session_id.load())));
 
-            sock.receiveBytes(*req_body_buf);
-
-            if (!req_body_buf->isFull())
-                continue;
-
-            /// Request reading done, set flags
-            next_req_header_read_done = false;
-            previous_req_body_read_done = true;
-
-            packageReceived();
-
-            LOG_TRACE(
-                log,
-                "Peer {}#{} read request done, body length : {}, req_body_buf used {}",
-                peer,
-                toHexString(session_id.load()),
-                body_len,
-                req_body_buf->used());
-            poco_assert_msg(int32_t(req_body_buf->used()) == body_len, "Request body length is not consistent.");
+                /// They will not be answered
+                for (const auto & request : requests)
+                    requestAnswered(request->xid);
 
-            /// 3. handshake
-            if (unlikely(!handshake_done)) /// TODO in handshaking
-            {
-                try
+                if (e.code() == ErrorCodes::TIMEOUT_EXCEEDED)
                 {
-                    int32_t handshake_req_len = body_len;
-                    receiveHandshake(handshake_req_len);
-                }
-                catch (...)
-                {
-                    /// Typical for an incorrect username, password
-                    /// and bad protocol version, bad las zxid, rw connection to a read only server
-                    /// Close the connection directly.
-                    tryLogCurrentException(log, "Failed to connect me");
                     destroyMe();
                     return;
                 }
             }
-            /// 4. handle request
-            else
-            {
-                session_stopwatch.start();
-
-                try
-                {
-                    auto [opnum, xid] = receiveRequest(body_len);
-                    if (opnum == Coordination::OpNum::Close)
-                        LOG_DEBUG(log, "Received close request #{}#{}#Close", toHexString(session_id.load()), xid);
-
-                    /// Each request restarts session stopwatch
-                    session_stopwatch.restart();
-                }
-                catch (const Exception & e)
-                {
-                    tryLogCurrentException(log, fmt::format("Error processing session {} request.", toHexString(session_id.load())));
+        }
 
-                    if (e.code() == ErrorCodes::TIMEOUT_EXCEEDED)
-                    {
-                        destroyMe();
-                        return;
-                    }
-                }
-            }
+        if (peer_closed)
+        {
+            destroyMe();
+            return;
         }
+        updateMemoryStats();
     }
     catch (Poco::Net::NetException &)
     {
@@ -249,57 +258,214 @@ void ConnectionHandler::onSocketReadable(const Notification &)
 }
 
 
-void ConnectionHandler::onSocketWritable(const Notification &)
+bool ConnectionHandler::readToBuffer(bool & peer_closed)
 {
-    LOG_TRACE(log, "Peer {}#{} is writable", peer, toHexString(session_id.load()));
+    /// Move bytes not parsed to the front
+    if (in_buf_begin > 0)
+    {
+        memmove(in_buf.data(), in_buf.data() + in_buf_begin, in_buf_end - in_buf_begin);
+        in_buf_end -= in_buf_begin;
+        in_buf_begin = 0;
+    }
 
-    auto remove_event_handler_if_needed = [this]
+    /// Buffer was given back when the connection drained
+    if (in_buf.empty())
+        in_buf = ConnectionBufferPool::instance().take();
+
+    size_t size = std::max(in_buf.size(), READ_BUFFER_SIZE);
+
+    /// A request larger than buffer
+    if (in_buf_end >= sizeof(int32_t))
+    {
+        int32_t length{};
+        ReadBufferFromMemory header(in_buf.data(), sizeof(int32_t));
+        Coordination::read(length, header);
+        if (length > 0)
+            size = std::max(size, sizeof(int32_t) + static_cast<size_t>(length));
+    }
+
+    if (in_buf.size() < size)
+        in_buf.resize(size);
+
+    int requested = static_cast<int>(in_buf.size() - in_buf_end);
+    int received = sock.receiveBytes(in_buf.data() + in_buf_end, requested);
+
+    /// Non-blocking socket returns negative if there is nothing to read, 0 means peer closed.
+    if (received == 0)
+        peer_closed = true;
+    if (received <= 0)
+        return false;
+
+    in_buf_end += static_cast<size_t>(received);
+    return received == requested;
+}
+
+bool ConnectionHandler::parseRequests(std::vector<Coordination::ZooKeeperRequestPtr> & requests, UInt64 receive_time_us)
+{
+    while (in_buf_end - in_buf_begin >= sizeof(int32_t))
     {
-        /// Double check to avoid dead lock
-        if (responses->empty() && send_buf.isEmpty() && !out_buffer)
+        int32_t header{};
+        ReadBufferFromMemory read_buf(in_buf.data() + in_buf_begin, sizeof(int32_t));
+        Coordination::read(header, read_buf);
+
+        /// All four letter word command code is larger than 2^24 or lower than 0.
+        /// Hand shake package length must be lower than 2^24 and larger than 0.
+        /// So collision never happens.
+        if (!isHandShake(header) && !handshake_done)
         {
-            std::lock_guard lock(send_response_mutex);
-            {
-                /// If all sent, unregister writable event.
-                if (responses->empty() && send_buf.isEmpty() && !out_buffer)
-                {
-                    LOG_TRACE(log, "Remove socket writable event handler for peer {}", peer);
-                    socket_writable_event_registered = false;
-                    reactor.removeEventHandler(
-                        sock, Observer<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
-                }
-            }
+            int32_t four_letter_cmd = header;
+            tryExecuteFourLetterWordCmd(four_letter_cmd);
+
+            /// Handler no need delete self
+            /// As to four letter command just wait client close connection.
+            in_buf_begin = in_buf_end = 0;
+            return false;
         }
-    };
 
-    auto copy_buffer_to_send = [this]
-    {
-        auto used = send_buf.used();
-        if (used + out_buffer->available() <= SENT_BUFFER_SIZE)
+        if (header < 0)
+            throw Exception(ErrorCodes::UNEXPECTED_PACKET_FROM_CLIENT, "Unexpected request length {}", header);
+
+        size_t body_len = static_cast<size_t>(header);
+        if (in_buf_end - in_buf_begin - sizeof(int32_t) < body_len)
+            break;
+
+        const char * body = in_buf.data() + in_buf_begin + sizeof(int32_t);
+        in_buf_begin += sizeof(int32_t) + body_len;
+
+        packageReceived();
+        LOG_TRACE(log, "Peer {}#{} read request done, body length : {}", peer, toHexString(session_id.load()), body_len);
+
+        /// handshake
+        if (unlikely(!handshake_done)) /// TODO in handshaking
         {
-            send_buf.write(out_buffer->position(), out_buffer->available());
-            out_buffer.reset();
+            try
+            {
+                receiveHandshake(body, header);
+            }
+            catch (...)
+            {
+                /// Typical for an incorrect username, password
+                /// and bad protocol version, bad las zxid, rw connection to a read only server
+                /// Close the connection directly.
+                tryLogCurrentException(log, "Failed to connect me");
+                destroyMe();
+                return false;
+            }
         }
+        /// parse request
         else
         {
-            send_buf.write(out_buffer->position(), SENT_BUFFER_SIZE - used);
-            out_buffer->seek(SENT_BUFFER_SIZE - used, SEEK_CUR);
+            session_stopwatch.start();
+
+            consumeRequestBytes(body_len);
+
+            try
+            {
+                auto request = parseRequest(body, header);
+                if (request->getOpNum() == OpNum::Heartbeat && answerHeartbeat(request))
+                {
+                    RequestCapture::instance().capture(session_id.load(), receive_time_us, body, body_len);
+                    session_stopwatch.restart();
+                    continue;
+                }
+                request->timeline.start(receive_time_us);
+                RequestTracer::instance().trySample(request->timeline);
+                RequestCapture::instance().capture(session_id.load(), receive_time_us, body, body_len);
+                if (request->xid >= 0 && in_flight_requests.emplace(request->xid, InFlightRequest{body_len, request}).second)
+                    in_flight_request_bytes += body_len;
+                requests.push_back(std::move(request));
+
+                /// Each request restarts session stopwatch
+                session_stopwatch.restart();
+            }
+            catch (const Exception &)
+            {
+                tryLogCurrentException(log, fmt::format("Error processing session {} request.", toHexString(session_id.load())));
+            }
         }
+    }
+
+    /// Give the buffer back for other connections, the pool frees it if a large request grew it
+    if (in_buf_begin == in_buf_end)
+    {
+        in_buf_begin = in_buf_end = 0;
+        ConnectionBufferPool::instance().give(std::move(in_buf));
+        in_buf = String();
+    }
+    return true;
+}
+
+void ConnectionHandler::pauseReading(const String & reason)
+{
+    LOG_DEBUG(log, "Pause reading from peer {}#{}, {}", peer, toHexString(session_id.load()), reason);
+    reading_paused = true;
+    pause_watch.restart();
+    reactor.removeEventHandler(sock, Observer<ConnectionHandler, ReadableNotification>(*this, &ConnectionHandler::onSocketReadable));
+    reactor.addEventHandler(sock, Observer<ConnectionHandler, TimeoutNotification>(*this, &ConnectionHandler::onReactorTimeout));
+}
+
+void ConnectionHandler::resumeReadingIfNeeded()
+{
+    if (!reading_paused)
+        return;
+
+    /// Unlike saturation, they are not overridden by pausing too long. The client just needs to read responses, and the
+    /// bucket of request bytes is refilled in a second.
+    if (isOverLimit())
+        return;
+
+    bool paused_too_long = pause_watch.elapsedMilliseconds() >= static_cast<UInt64>(session_timeout.totalMilliseconds() / 3);
+    if (!paused_too_long && keeper_dispatcher->isSaturated())
+        return;
+
+    LOG_DEBUG(log, "Resume reading from peer {}#{}, paused {}ms", peer, toHexString(session_id.load()), pause_watch.elapsedMilliseconds());
+    reading_paused = false;
+    skip_saturation_check = paused_too_long;
+    reactor.removeEventHandler(sock, Observer<ConnectionHandler, TimeoutNotification>(*this, &ConnectionHandler::onReactorTimeout));
+    reactor.addEventHandler(sock, Observer<ConnectionHandler, ReadableNotification>(*this, &ConnectionHandler::onSocketReadable));
+}
+
+void ConnectionHandler::onReactorTimeout(const Notification &)
+{
+    resumeReadingIfNeeded();
+}
+
+void ConnectionHandler::onSocketWritable(const Notification &)
+{
+    LOG_TRACE(log, "Peer {}#{} is writable", peer, toHexString(session_id.load()));
+
+    auto remove_event_handler_if_needed = [this]
+    {
+        /// If all sent, unregister writable event.
+        if (!responses.empty() || !send_chunks.empty() || four_letter_word_output_ready)
+            return;
+
+        LOG_TRACE(log, "Remove socket writable event handler for peer {}", peer);
+        reactor.removeEventHandler(sock, Observer<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
+        socket_writable_event_registered = false;
+
+        /// Pairs with the fence in registerWritableEvent, either the response pushed meanwhile is seen here, or the flag
+        /// cleared is seen by the producer which registers again.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!responses.empty() || four_letter_word_output_ready)
+            registerWritableEvent(false);
     };
 
     try
     {
-        /// If the buffer was not completely sent last time, continue sending.
-        if (out_buffer)
-            copy_buffer_to_send();
-
-        while (!responses->empty() && send_buf.available())
+        if (tls_handshake)
         {
-            Coordination::ZooKeeperResponsePtr response;
+            if (proceedTLSHandshake() != TLSHandshake::WANT_WRITE)
+                remove_event_handler_if_needed();
+            return;
+        }
 
-            if (!responses->tryPop(response))
-                throw Exception(ErrorCodes::LOGICAL_ERROR, "We must have ready response, but queue is empty. It's a bug.");
+        if (four_letter_word_task)
+            takeFourLetterWordOutput();
 
+        Coordination::ZooKeeperResponsePtr response;
+        while (send_chunks_bytes < MAX_SEND_BYTES && responses.tryPop(response))
+        {
             if (response->xid != Coordination::WATCH_XID && response->getOpNum() == Coordination::OpNum::Close)
             {
                 LOG_DEBUG(log, "Received close event for session_id {}, internal_id {}", toHexString(session_id.load()), toHexString(internal_id.load()));
@@ -307,33 +473,77 @@ void ConnectionHandler::onSocketWritable(const Notification &)
                 return;
             }
 
+            auto answered = requestAnswered(response->xid);
+            size_t response_bytes = 0;
+
             if (response->getOpNum() == OpNum::NewSession || response->getOpNum() == OpNum::UpdateSession)
             {
                 if (!sendHandshake(response))
                 {
                     LOG_ERROR(log, "Failed to establish session, close connection.");
                     sock.setBlocking(true);
-                    sock.sendBytes(send_buf);
-                    sock.sendBytes(out_buffer->position(), out_buffer->available());
+                    while (!send_chunks.empty())
+                        sendChunks();
 
                     destroyMe();
                     return;
                 }
-                copy_buffer_to_send();
+            }
+            else if (const auto * watch_response = dynamic_cast<const ZooKeeperWatchResponse *>(response.get()))
+            {
+                /// Serialized once for all watchers, sent from the shared bytes
+                SendChunk chunk;
+                chunk.shared = &watch_response->getSerialized();
+                chunk.holder = response;
+                pushSendChunk(std::move(chunk));
             }
             else
             {
-                WriteBufferFromOwnString buf;
+                OpCostMetrics::Scope cost_scope(response->getOpNum(), OpCostMetrics::ThreadKind::IO);
+                WriteBufferFromOwnString buf(takeFreeBuffer());
                 response->writeNoCopy(buf);
-                out_buffer = std::make_shared<ReadBufferFromOwnString>(std::move(buf.str()));
-                copy_buffer_to_send();
+                SendChunk chunk;
+                chunk.owned = std::move(buf.str());
+                response_bytes = chunk.owned.size();
+                pushSendChunk(std::move(chunk));
             }
+
+            if (response->timeline.started())
+                sending_responses.push_back({response, std::move(answered.request), answered.bytes, response_bytes});
             packageSent();
         }
 
-        size_t sent = sock.sendBytes(send_buf);
+        size_t sent = sendChunks();
         Metrics::getMetrics().response_socket_send_size->add(sent);
 
+        if (!sending_responses.empty())
+        {
+            UInt64 sent_time_us = RequestTimeline::now();
+            for (const auto & sending : sending_responses)
+            {
+                const auto & response = sending.response;
+                response->timeline.end(RequestStage::SEND, sent_time_us);
+                RequestStageMetrics::instance().record(response->getOpNum(), response->timeline);
+                if (response->timeline.trace.sampled())
+                    RequestTracer::instance().finishRequest(session_id, *response);
+                if (SlowRequestLog::instance().isSlow(response->timeline))
+                    logSlowRequest(sending);
+            }
+            sending_responses.clear();
+        }
+
+        /// Implements a graceful shutdown protocol.
+        /// Closes the sending channel and sends a FIN (finish) signal to the client.
+        /// After the client receives all pending data and the FIN from the server, it sends a FIN packet back to the server.
+        /// Once the server acknowledges this with an ACK (acknowledgment), the connection is fully closed.
+        if (four_letter_word_sending && send_chunks.empty())
+        {
+            four_letter_word_sending = false;
+            sock.shutdownSend();
+        }
+
+        updateMemoryStats();
+        resumeReadingIfNeeded();
         remove_event_handler_if_needed();
     }
     catch (...)
@@ -343,6 +553,178 @@ void ConnectionHandler::onSocketWritable(const Notification &)
     }
 }
 
+TLSHandshake::Status ConnectionHandler::proceedTLSHandshake()
+{
+    auto status = tls_handshake->proceed();
+    if (status == TLSHandshake::WANT_WRITE)
+    {
+        registerWritableEvent(false);
+    }
+    else if (status == TLSHandshake::DONE)
+    {
+        LOG_DEBUG(log, "TLS handshake with {} done", peer);
+        tls_handshake.reset();
+    }
+    return status;
+}
+
+ConnectionHandler::InFlightRequest ConnectionHandler::requestAnswered(int32_t xid)
+{
+    if (xid < 0)
+        return {};
+    auto it = in_flight_requests.find(xid);
+    if (it == in_flight_requests.end())
+        return {};
+    InFlightRequest res = std::move(it->second);
+    in_flight_request_bytes -= res.bytes;
+    in_flight_requests.erase(it);
+    return res;
+}
+
+void ConnectionHandler::logSlowRequest(const SendingResponse & sending)
+{
+    const auto & response = sending.response;
+    SlowRequestLog::Record record;
+    record.session_id = session_id;
+    record.xid = response->xid;
+    record.opnum = response->getOpNum();
+    if (sending.request)
+        record.path = sending.request->getPath();
+    record.request_bytes = sending.request_bytes;
+    record.response_bytes = sending.response_bytes;
+    record.error = response->error;
+    record.total_us = response->timeline.endTime(RequestStage::SEND) - response->timeline.startTime();
+    record.stage_us = response->timeline.durations();
+    SlowRequestLog::instance().add(std::move(record));
+}
+
+size_t ConnectionHandler::inFlightBytes() const
+{
+    return in_flight_request_bytes + send_chunks_bytes;
+}
+
+bool ConnectionHandler::isOverMemoryLimit() const
+{
+    return max_in_flight_bytes != 0 && inFlightBytes() >= max_in_flight_bytes;
+}
+
+bool ConnectionHandler::isOverInFlightRequestsLimit() const
+{
+    return max_in_flight_requests != 0 && in_flight_requests.size() >= max_in_flight_requests;
+}
+
+bool ConnectionHandler::isOverRequestRateLimit()
+{
+    if (max_request_bytes_per_second == 0)
+        return false;
+
+    auto rate = static_cast<double>(max_request_bytes_per_second);
+    request_bytes_tokens = std::min(rate, request_bytes_tokens + request_bytes_watch.elapsedSeconds() * rate);
+    request_bytes_watch.restart();
+    return request_bytes_tokens <= 0;
+}
+
+void ConnectionHandler::consumeRequestBytes(size_t bytes)
+{
+    if (max_request_bytes_per_second == 0)
+        return;
+
+    auto rate = static_cast<double>(max_request_bytes_per_second);
+    request_bytes_tokens = std::max(-rate, request_bytes_tokens - static_cast<double>(sizeof(int32_t) + bytes));
+}
+
+void ConnectionHandler::updateMemoryStats()
+{
+    size_t bytes = in_buf.capacity() + send_chunks_bytes;
+    for (const auto & buffer : free_buffers)
+        bytes += buffer.capacity();
+    buffer_bytes.store(bytes, std::memory_order_relaxed);
+    in_flight_bytes.store(inFlightBytes(), std::memory_order_relaxed);
+    unanswered_bytes.store(in_flight_request_bytes, std::memory_order_relaxed);
+}
+
+void ConnectionHandler::pushSendChunk(SendChunk && chunk)
+{
+    send_chunks_bytes += chunk.bytes().size();
+    send_chunks.push_back(std::move(chunk));
+}
+
+String ConnectionHandler::takeFreeBuffer()
+{
+    if (free_buffers.empty())
+        return ConnectionBufferPool::instance().take();
+    String buffer = std::move(free_buffers.back());
+    free_buffers.pop_back();
+    return buffer;
+}
+
+size_t ConnectionHandler::sendChunks()
+{
+    if (send_chunks.empty())
+        return 0;
+
+    std::array<iovec, MAX_SEND_IOVECS> iovecs;
+    size_t iovec_count = 0;
+    for (auto it = send_chunks.begin(); it != send_chunks.end() && iovec_count < MAX_SEND_IOVECS; ++it, ++iovec_count)
+    {
+        const String & bytes = it->bytes();
+        size_t offset = iovec_count == 0 ? send_offset : 0;
+        iovecs[iovec_count].iov_base = const_cast<char *>(bytes.data() + offset);
+        iovecs[iovec_count].iov_len = bytes.size() - offset;
+    }
+
+    msghdr message{};
+    message.msg_iov = iovecs.data();
+    message.msg_iovlen = iovec_count;
+
+    ssize_t res;
+    do
+        res = ::sendmsg(sock.impl()->sockfd(), &message, MSG_NOSIGNAL);
+    while (res < 0 && errno == EINTR);
+
+    if (res < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        throwFromErrno("Cannot send responses to " + peer, ErrorCodes::NETWORK_ERROR);
+    }
+
+    size_t sent = static_cast<size_t>(res);
+    send_chunks_bytes -= sent;
+
+    size_t remaining = sent;
+    while (!send_chunks.empty())
+    {
+        auto & chunk = send_chunks.front();
+        size_t left = chunk.bytes().size() - send_offset;
+        if (remaining < left)
+        {
+            send_offset += remaining;
+            break;
+        }
+
+        remaining -= left;
+        send_offset = 0;
+        if (!chunk.shared && free_buffers.size() < MAX_FREE_BUFFERS && chunk.owned.capacity() <= MAX_FREE_BUFFER_CAPACITY)
+            free_buffers.push_back(std::move(chunk.owned));
+        send_chunks.pop_front();
+    }
+
+    /// Drained, give the buffers back for other connections
+    if (send_chunks.empty())
+        releaseFreeBuffers();
+
+    return sent;
+}
+
+void ConnectionHandler::releaseFreeBuffers()
+{
+    auto & pool = ConnectionBufferPool::instance();
+    for (auto & buffer : free_buffers)
+        pool.give(std::move(buffer));
+    std::vector<String>().swap(free_buffers);
+}
+
 void ConnectionHandler::onReactorShutdown(const Notification &)
 {
     LOG_INFO(log, "Reactor of peer {} shutdown!", peer);
@@ -363,6 +745,10 @@ void ConnectionHandler::dumpStats(WriteBufferFromOwnString & buf, bool brief)
     writeIntText(conn_stats.getPacketsReceived(), buf);
     writeText(",sent=", buf);
     writeIntText(conn_stats.getPacketsSent(), buf);
+    writeText(",buf=", buf);
+    writeIntText(buffer_bytes.load(std::memory_order_relaxed), buf);
+    writeText(",inflight=", buf);
+    writeIntText(in_flight_bytes.load(std::memory_order_relaxed), buf);
     if (!brief)
     {
         if (session_id != 0)
@@ -408,10 +794,9 @@ void ConnectionHandler::resetStats()
     last_op.set(std::make_unique<LastOp>(EMPTY_LAST_OP));
 }
 
-Coordination::OpNum ConnectionHandler::receiveHandshake(int32_t handshake_req_len)
+Coordination::OpNum ConnectionHandler::receiveHandshake(const char * body, int32_t handshake_req_len)
 {
     int32_t protocol_version;
-    int64_t last_zxid_seen;
     int32_t timeout_ms;
     int64_t previous_session_id = 0;
     std::array<char, Coordination::PASSWORD_LENGTH> passwd{};
@@ -419,7 +804,7 @@ Coordination::OpNum ConnectionHandler::receiveHandshake(int32_t handshake_req_le
     if (!isHandShake(handshake_req_len))
         throw Exception("Unexpected handshake length received: " + toString(handshake_req_len), ErrorCodes::UNEXPECTED_PACKET_FROM_CLIENT);
 
-    ReadBufferFromMemory in(req_body_buf->begin(), req_body_buf->used());
+    ReadBufferFromMemory in(body, static_cast<size_t>(handshake_req_len));
     Coordination::read(protocol_version, in);
 
     if (protocol_version != Coordination::ZOOKEEPER_PROTOCOL_VERSION)
@@ -435,8 +820,13 @@ Coordination::OpNum ConnectionHandler::receiveHandshake(int32_t handshake_req_le
         timeout_ms = session_timeout.totalMilliseconds();
     }
 
+    if (keeper_dispatcher->isWitness())
+        throw Exception(
+            "Refusing session request as I am a witness, client must try another server", ErrorCodes::UNEXPECTED_PACKET_FROM_CLIENT);
+
+    /// Unless reads of the session wait for the zxid seen by the client, which is read your writes without sync
     int64_t last_zxid = keeper_dispatcher->getStateMachine().getLastProcessedZxid();
-    if (last_zxid_seen > last_zxid)
+    if (last_zxid_seen > last_zxid && !keeper_dispatcher->acceptsSeenZxidAhead())
     {
         String msg = "Refusing session request  as it has seen zxid " + toHexString(last_zxid_seen) + " our last zxid is "
             + toHexString(last_zxid) + " client must try another server";
@@ -451,6 +841,15 @@ Coordination::OpNum ConnectionHandler::receiveHandshake(int32_t handshake_req_le
 
     if (handshake_req_len == Coordination::CLIENT_HANDSHAKE_LENGTH_WITH_READONLY)
         Coordination::read(readonly, in);
+    read_only_client = readonly;
+
+    /// The session can not be created by Raft without leader, and ZooKeeper clients do not expect a read only
+    /// server to know their previous session, so a new session is created in both cases.
+    if (readonly && keeper_dispatcher->acceptsReadOnlySession())
+    {
+        createReadOnlySession();
+        return OpNum::NewSession;
+    }
 
     auto opnum = previous_session_id == 0 ? OpNum::NewSession : OpNum::UpdateSession;
     Coordination::ZooKeeperRequestPtr request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
@@ -508,7 +907,8 @@ bool ConnectionHandler::sendHandshake(const Coordination::ZooKeeperResponsePtr &
         throw Exception(ErrorCodes::LOGICAL_ERROR, "Bad session response {}", response->toString());
     }
 
-    Coordination::write(Coordination::SERVER_HANDSHAKE_LENGTH, buf);
+    Coordination::write(
+        read_only_session ? Coordination::SERVER_HANDSHAKE_LENGTH_WITH_READONLY : Coordination::SERVER_HANDSHAKE_LENGTH, buf);
     if (success)
         Coordination::write(Coordination::ZOOKEEPER_PROTOCOL_VERSION, buf);
     else
@@ -522,8 +922,12 @@ bool ConnectionHandler::sendHandshake(const Coordination::ZooKeeperResponsePtr &
     Coordination::write(sid, buf);
     std::array<char, Coordination::PASSWORD_LENGTH> passwd{};
     Coordination::write(passwd, buf);
+    if (read_only_session)
+        Coordination::write(true, buf);
 
-    out_buffer = std::make_shared<ReadBufferFromOwnString>(std::move(buf.str()));
+    SendChunk chunk;
+    chunk.owned = std::move(buf.str());
+    pushSendChunk(std::move(chunk));
 
     return success;
 }
@@ -545,37 +949,91 @@ void ConnectionHandler::tryExecuteFourLetterWordCmd(int32_t command)
     {
         LOG_WARNING(log, "Not enabled four letter command {}", IFourLetterCommand::toName(command));
     }
+    else if (four_letter_word_task)
+    {
+        LOG_WARNING(log, "Four letter command {} is ignored for the previous one is not finished", IFourLetterCommand::toName(command));
+        return;
+    }
     else
     {
         auto command_ptr = FourLetterCommandFactory::instance().get(command);
         LOG_DEBUG(log, "Receive four letter command {}", command_ptr->name());
 
-        try
+        auto task = std::make_shared<FourLetterWordTask>();
+        task->handler = this;
+
+        auto run_command = [task, command_ptr, log = log]
         {
-            String res = command_ptr->run();
-            WriteBufferFromFiFoBuffer buf(res.size());
-            buf.write(res.data(), res.size());
+            auto push_output = [&task](String && output, bool finished)
+            {
+                std::lock_guard lock(task->mutex);
+                if (task->handler)
+                    task->handler->pushFourLetterWordOutput(std::move(output), finished);
+            };
 
-            /// Set socket to blocking mode to simplify sending.
-            sock.setBlocking(true);
-            sock.sendBytes(*buf.getBuffer());
-        }
-        catch (...)
+            try
+            {
+                command_ptr->stream(
+                    [&push_output](String && chunk)
+                    {
+                        if (!chunk.empty())
+                            push_output(std::move(chunk), false);
+                    });
+            }
+            catch (...)
+            {
+                tryLogCurrentException(log, "Error when executing four letter command " + command_ptr->name());
+            }
+            push_output({}, true);
+        };
+
+        if (FourLetterCommandFactory::instance().executor().trySchedule(run_command))
         {
-            tryLogCurrentException(log, "Error when executing four letter command " + command_ptr->name());
+            four_letter_word_task = task;
+            return;
         }
+        LOG_WARNING(log, "Too many four letter commands running, {} is rejected", command_ptr->name());
     }
 
-    /// Implements a graceful shutdown protocol.
-    /// Closes the sending channel and sends a FIN (finish) signal to the client.
-    /// After the client receives all pending data and the FIN from the server, it sends a FIN packet back to the server.
-    /// Once the server acknowledges this with an ACK (acknowledgment), the connection is fully closed.
     sock.shutdownSend();
 }
 
-std::pair<Coordination::OpNum, Coordination::XID> ConnectionHandler::receiveRequest(int32_t)
+void ConnectionHandler::pushFourLetterWordOutput(String && output, bool finished)
+{
+    {
+        std::lock_guard lock(four_letter_word_output_mutex);
+        if (four_letter_word_output.empty())
+            four_letter_word_output = std::move(output);
+        else
+            four_letter_word_output += output;
+        four_letter_word_output_finished = finished;
+        four_letter_word_output_ready = true;
+    }
+    registerWritableEvent(true);
+}
+
+void ConnectionHandler::takeFourLetterWordOutput()
+{
+    std::lock_guard lock(four_letter_word_output_mutex);
+    if (!four_letter_word_output_ready)
+        return;
+
+    /// Output is sent by non-blocking sends of writable events as socket accepts it
+    if (!four_letter_word_output.empty())
+    {
+        SendChunk chunk;
+        chunk.owned = std::move(four_letter_word_output);
+        four_letter_word_output.clear();
+        pushSendChunk(std::move(chunk));
+    }
+    four_letter_word_output_ready = false;
+    if (four_letter_word_output_finished)
+        four_letter_word_sending = true;
+}
+
+Coordination::ZooKeeperRequestPtr ConnectionHandler::parseRequest(const char * data, int32_t length)
 {
-    ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
+    ReadBufferFromMemory body(data, static_cast<size_t>(length));
     int32_t xid;
     Coordination::read(xid, body);
 
@@ -583,14 +1041,17 @@ std::pair<Coordination::OpNum, Coordination::XID> ConnectionHandler::receiveRequ
     Coordination::read(opnum, body);
 
     LOG_DEBUG(log, "Receive request #{}#{}#{}", toHexString(session_id.load()), xid, Coordination::toString(opnum));
+    OpCostMetrics::Scope cost_scope(opnum, OpCostMetrics::ThreadKind::IO);
 
     Coordination::ZooKeeperRequestPtr request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
     request->xid = xid;
     request->readImpl(body);
+    /// Hash path in IO thread rather than in request processor thread
+    request->getPathHash();
 
-    if (!keeper_dispatcher->pushRequest(request, session_id))
-        throw Exception(ErrorCodes::TIMEOUT_EXCEEDED, "Session {} already disconnected", toHexString(session_id.load()));
-    return std::make_pair(opnum, xid);
+    if (opnum == Coordination::OpNum::Close)
+        LOG_DEBUG(log, "Received close request #{}#{}#Close", toHexString(session_id.load()), xid);
+    return request;
 }
 
 void ConnectionHandler::sendSessionResponseToClient(const Coordination::ZooKeeperResponsePtr & response)
@@ -626,6 +1087,8 @@ void ConnectionHandler::sendSessionResponseToClient(const Coordination::ZooKeepe
         handshake_done = true;
 
         keeper_dispatcher->unRegisterSessionResponseCallbackWithoutLock(id);
+        /// Before the client gets the response and sends reads
+        keeper_dispatcher->waitForSeenZxid(sid, last_zxid_seen);
         auto response_callback = [this](const Coordination::ZooKeeperResponsePtr & response_) { pushUserResponseToSendingQueue(response_); };
 
         bool is_reconnected = response->getOpNum() == Coordination::OpNum::UpdateSession;
@@ -633,40 +1096,76 @@ void ConnectionHandler::sendSessionResponseToClient(const Coordination::ZooKeepe
     }
 
     // Send response to client
-    {
-        std::lock_guard lock(send_response_mutex);
-        responses->push(response);
+    responses.push(response);
+    registerWritableEvent(true);
+}
 
-        /// We should register write events.
-        if (!socket_writable_event_registered)
-        {
-            socket_writable_event_registered = true;
-            reactor.addEventHandler(sock, Observer<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
-            /// We must wake up getWorkerReactor to interrupt it's sleeping.
-            reactor.wakeUp();
-        }
-    }
+void ConnectionHandler::createReadOnlySession()
+{
+    auto response_callback = [this](const Coordination::ZooKeeperResponsePtr & response) { pushUserResponseToSendingQueue(response); };
+    int64_t sid = keeper_dispatcher->registerReadOnlySession(response_callback);
+    LOG_INFO(log, "Created read only session {} as there is no leader", toHexString(sid));
+    keeper_dispatcher->waitForSeenZxid(sid, last_zxid_seen);
+
+    read_only_session = true;
+    session_id = sid;
+    handshake_done = true;
+
+    auto response = std::make_shared<ZooKeeperNewSessionResponse>();
+    response->xid = Coordination::NEW_SESSION_XID;
+    response->zxid = keeper_dispatcher->getStateMachine().getLastProcessedZxid();
+    response->internal_id = sid;
+    response->session_id = sid;
+    response->server_id = keeper_dispatcher->myId();
+    response->success = true;
+
+    responses.push(response);
+    registerWritableEvent(false);
+}
+
+bool ConnectionHandler::answerHeartbeat(const Coordination::ZooKeeperRequestPtr & request)
+{
+    /// Read only sessions are not in the store
+    if (!read_only_session && !keeper_dispatcher->refreshLocalSession(session_id))
+        return false;
+
+    auto response = request->makeResponse();
+    response->xid = request->xid;
+    response->zxid = keeper_dispatcher->getStateMachine().getLastProcessedZxid();
+
+    /// Serialized here, responses queue has the response thread of the session as its only producer
+    WriteBufferFromOwnString buf(takeFreeBuffer());
+    response->writeNoCopy(buf);
+    SendChunk chunk;
+    chunk.owned = std::move(buf.str());
+    pushSendChunk(std::move(chunk));
+    packageSent();
+
+    registerWritableEvent(false);
+    return true;
 }
 
 void ConnectionHandler::pushUserResponseToSendingQueue(const Coordination::ZooKeeperResponsePtr & response)
 {
     LOG_DEBUG(log, "Push a response of session {} to IO sending queue. {}", toHexString(session_id.load()), response->toString());
     updateStats(response);
+    if (response->timeline.started())
+        response->timeline.end(RequestStage::RESPONSE_QUEUE);
 
-    /// Lock to avoid data condition which will lead response leak
-    {
-        std::lock_guard lock(send_response_mutex);
-        responses->push(response);
+    responses.push(response);
+    registerWritableEvent(true);
+}
 
-        /// We should register write events.
-        if (!socket_writable_event_registered)
-        {
-            socket_writable_event_registered = true;
-            reactor.addEventHandler(sock, Observer<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
-            /// We must wake up getWorkerReactor to interrupt it's sleeping.
-            reactor.wakeUp();
-        }
-    }
+void ConnectionHandler::registerWritableEvent(bool wake_up)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (socket_writable_event_registered.exchange(true))
+        return;
+
+    reactor.addEventHandler(sock, Observer<ConnectionHandler, WritableNotification>(*this, &ConnectionHandler::onSocketWritable));
+    /// We must wake up getWorkerReactor to interrupt it's sleeping.
+    if (wake_up)
+        reactor.wakeUp();
 }
 
 void ConnectionHandler::packageSent()
@@ -687,7 +1186,7 @@ void ConnectionHandler::updateStats(const Coordination::ZooKeeperResponsePtr & r
     if (response->xid != Coordination::WATCH_XID && response->getOpNum() != Coordination::OpNum::Heartbeat
         && response->getOpNum() != Coordination::OpNum::SetWatches && response->getOpNum() != Coordination::OpNum::Close)
     {
-        Int64 elapsed = Poco::Timestamp().epochMicroseconds() / 1000 - response->request_created_time_ms;
+        Int64 elapsed = CoarseClock::nowMilliseconds() - response->request_created_time_ms;
         {
             conn_stats.updateLatency(elapsed);
             if (unlikely(elapsed > 10000))
@@ -705,7 +1204,7 @@ void ConnectionHandler::updateStats(const Coordination::ZooKeeperResponsePtr & r
             .name = Coordination::toString(response->getOpNum()),
             .last_cxid = response->xid,
             .last_zxid = response->zxid,
-            .last_response_time = Poco::Timestamp().epochMicroseconds() / 1000,
+            .last_response_time = static_cast<int64_t>(CoarseClock::nowMilliseconds()),
         }));
     }
 }
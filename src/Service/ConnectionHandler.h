@@ -1,6 +1,10 @@
 #pragma once
 
+#include <array>
+#include <deque>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include <Poco/Delegate.h>
 #include <Poco/FIFOBuffer.h>
@@ -9,12 +13,17 @@
 #include <Poco/Util/ServerApplication.h>
 
 #include <Common/IO/WriteBufferFromString.h>
+#include <Common/ProfiledMutex.h>
+#include <Common/UnboundedSPSCQueue.h>
 #include <Network/SocketAcceptor.h>
 #include <Network/SocketNotification.h>
 #include <Network/SocketReactor.h>
 
 #include <Service/ConnCommon.h>
 #include <Service/ConnectionStats.h>
+#include <Service/KeeperCommon.h>
+#include <Service/MemoryUsage.h>
+#include <Service/TLSContext.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 
 
@@ -41,13 +50,17 @@ public:
     static void registerConnection(ConnectionHandler * conn);
     static void unregisterConnection(ConnectionHandler * conn);
 
-    /// dump all connections statistics, used for 4lw command
-    static void dumpConnections(WriteBufferFromOwnString & buf, bool brief);
+    /// dump all connections statistics, used for 4lw command. Connections are taken at once and dumped by chunks,
+    /// the ones closed meanwhile are skipped.
+    static void dumpConnections(const DumpOutput & output, bool brief);
     /// reset statistics
     static void resetConnsStats();
 
+    /// Add buffers of connections to connection_buffers of usage and their requests not answered to pipeline_queues
+    static void getMemoryUsage(KeeperMemoryUsage & usage);
+
 private:
-    static std::mutex conns_mutex;
+    static ProfiledMutex conns_mutex;
     static std::unordered_set<ConnectionHandler *> connections;
 
 public:
@@ -60,6 +73,8 @@ public:
 
     void onReactorShutdown(const Notification &);
     void onSocketError(const Notification &);
+    /// Registered only when reading is paused
+    void onReactorTimeout(const Notification &);
 
     /// current connection statistics
     ConnectionStats getConnectionStats() const;
@@ -69,18 +84,38 @@ public:
     void resetStats();
 
 private:
-    Coordination::OpNum receiveHandshake(int32_t handshake_length);
+    Coordination::OpNum receiveHandshake(const char * body, int32_t handshake_length);
     bool sendHandshake(const Coordination::ZooKeeperResponsePtr & response);
     static bool isHandShake(Int32 & handshake_length);
 
+    /// Command is run by the executor of FourLetterCommandFactory, its output is sent by the writable handler and
+    /// then sending is shut down. The connection may be destroyed before the command finishes.
     void tryExecuteFourLetterWordCmd(int32_t four_letter_cmd);
+    /// Called by the executor thread for every chunk of output, finished is true for the last call
+    void pushFourLetterWordOutput(String && output, bool finished);
+    /// Move output of command pushed so far to send_chunks
+    void takeFourLetterWordOutput();
 
     /// After handshake, we receive requests.
-    std::pair<Coordination::OpNum, Coordination::XID> receiveRequest(int32_t length);
+    Coordination::ZooKeeperRequestPtr parseRequest(const char * body, int32_t length);
+
+    /// Read from socket to in_buf, return true if the read fills in_buf so there may be more bytes.
+    bool readToBuffer(bool & peer_closed);
+    /// Parse all the complete requests in in_buf, handshake is handled directly and others are put to requests,
+    /// their timelines start at receive_time_us. Return false if no more bytes should be handled, the connection may be destroyed.
+    bool parseRequests(std::vector<Coordination::ZooKeeperRequestPtr> & requests, UInt64 receive_time_us);
+    /// Answer heartbeat of the session in IO thread, so that it does not wait behind other requests in the pipeline.
+    /// Returns false if it should go through the pipeline.
+    bool answerHeartbeat(const Coordination::ZooKeeperRequestPtr & request);
     /// Push a response of a user request to IO sending queue
     void pushUserResponseToSendingQueue(const Coordination::ZooKeeperResponsePtr & response);
     /// Push a response of new session or update session request to IO sending queue
     void sendSessionResponseToClient(const Coordination::ZooKeeperResponsePtr & response);
+    /// Create a session known only by this node for a client connected in read only mode while there is no leader
+    void createReadOnlySession();
+    /// Register writable event if it is not registered, invoked after something to send is pushed. Wake up reactor if
+    /// invoked by another thread.
+    void registerWritableEvent(bool wake_up);
 
     /// do some statistics
     void packageSent();
@@ -92,41 +127,140 @@ private:
     /// destroy connection
     void destroyMe();
 
-    // Todo Add configuration sent_buffer_size
-    static constexpr size_t SENT_BUFFER_SIZE = 16384;
-    FIFOBuffer send_buf = FIFOBuffer(SENT_BUFFER_SIZE);
-
-    /// Storing the result of the response serialization temporarily,
-    /// We cannot directly serialize it onto send_buf，
-    /// because `send_buf` maybe too small to hold a large size response.
-    std::shared_ptr<ReadBufferFromOwnString> out_buffer;
+    /// Continue TLS handshake, writable event is registered if it wants to write. tls_handshake is reset if it is done.
+    TLSHandshake::Status proceedTLSHandshake();
+
+    /// Stop reading requests from socket when the node is saturated, see AdmissionController, or the connection reaches
+    /// a limit of isOverLimit.
+    void pauseReading(const String & reason);
+    /// Resume when node is not saturated or paused for too long, and the connection is under its limits.
+    /// Invoked when socket is writable or reactor times out.
+    void resumeReadingIfNeeded();
+
+    struct InFlightRequest
+    {
+        size_t bytes = 0;
+        /// Kept for the slow request log, its path is not in response
+        Coordination::ZooKeeperRequestPtr request;
+    };
+
+    /// Remove the request of a response from in flight ones, return it if it is tracked
+    InFlightRequest requestAnswered(int32_t xid);
+    /// Bytes of requests not answered and of responses not sent. A request partly read is not counted, otherwise a
+    /// request larger than the limit could never be completed.
+    size_t inFlightBytes() const;
+    bool isOverMemoryLimit() const;
+    bool isOverInFlightRequestsLimit() const;
+    /// Refill the bucket of request bytes and return whether it is empty
+    bool isOverRequestRateLimit();
+    bool isOverLimit() { return isOverMemoryLimit() || isOverInFlightRequestsLimit() || isOverRequestRateLimit(); }
+    void consumeRequestBytes(size_t bytes);
+    /// Publish buffer_bytes and in_flight_bytes for cons, which reads them from other threads
+    void updateMemoryStats();
+
+    /// A serialized response waiting to be sent. Bytes of a watch response are shared by all
+    /// the triggered connections, so the chunk holds the response rather than a copy.
+    struct SendChunk
+    {
+        String owned;
+        Coordination::ZooKeeperResponsePtr holder;
+        const String * shared = nullptr;
+
+        const String & bytes() const { return shared ? *shared : owned; }
+    };
+
+    /// Stop taking responses from queue when bytes waiting to be sent reach it.
+    static constexpr size_t MAX_SEND_BYTES = 65536;
+    /// Max chunks sent by one sendmsg
+    static constexpr size_t MAX_SEND_IOVECS = 64;
+    /// Serialization buffers kept for reuse while there are chunks to send, larger ones are freed.
+    static constexpr size_t MAX_FREE_BUFFERS = 16;
+    static constexpr size_t MAX_FREE_BUFFER_CAPACITY = 65536;
+
+    void pushSendChunk(SendChunk && chunk);
+    /// Buffer to serialize a response into, reused from the sent ones or taken from ConnectionBufferPool.
+    String takeFreeBuffer();
+    /// Send chunks with one scatter-gather syscall without copying them, return bytes sent.
+    /// Sent chunks are removed and their buffers are kept for reuse, until all are sent and the buffers are given back.
+    size_t sendChunks();
+    void releaseFreeBuffers();
+
+    /// Responses serialized and not sent yet, send_offset is bytes of the first one already sent.
+    std::deque<SendChunk> send_chunks;
+    size_t send_offset = 0;
+    size_t send_chunks_bytes = 0;
+
+    std::vector<String> free_buffers;
+
+    struct SendingResponse
+    {
+        Coordination::ZooKeeperResponsePtr response;
+        Coordination::ZooKeeperRequestPtr request;
+        size_t request_bytes = 0;
+        size_t response_bytes = 0;
+    };
+
+    /// Responses serialized by the current write, their stages are recorded when they are handed to socket
+    std::vector<SendingResponse> sending_responses;
+
+    void logSlowRequest(const SendingResponse & sending);
 
     Logger * log;
 
     StreamSocket sock;
-    String peer; /// remote peer address
+    String peer; /// remote peer address, unix socket clients have no address and are named by fd
     SocketReactor & reactor;
 
-    FIFOBuffer req_header_buf = FIFOBuffer(4);
-
-    /// request body length
-    int32_t body_len{};
-    std::shared_ptr<FIFOBuffer> req_body_buf;
-
-    bool next_req_header_read_done = false;
-    bool previous_req_body_read_done = true;
+    /// Bytes read from socket and not parsed yet are [in_buf_begin, in_buf_end) of in_buf, it is read
+    /// by READ_BUFFER_SIZE at least and grows to hold a larger request. It is taken from ConnectionBufferPool
+    /// when there are bytes to read and given back once all of them are parsed, so an idle connection holds no buffer.
+    static constexpr size_t READ_BUFFER_SIZE = 65536;
+    String in_buf;
+    size_t in_buf_begin = 0;
+    size_t in_buf_end = 0;
 
     /// Whether session established.
     std::atomic<bool> handshake_done = false;
 
+    /// TLS handshake in progress, requests are read after it is done and socket is passed to kTLS.
+    std::unique_ptr<TLSHandshake> tls_handshake;
+
     Context & global_context;
     std::shared_ptr<KeeperDispatcher> keeper_dispatcher;
 
     Poco::Timespan operation_timeout;
     Poco::Timespan session_timeout;
+    /// Client connected in read only mode, its reads are not bounded by max_read_lag_entries and max_read_lag_ms
+    bool read_only_client{false};
+    /// Zxid seen by the client as of handshake, reads of the session wait for it if it is not applied
+    int64_t last_zxid_seen{0};
+    /// Session created by createReadOnlySession, only reads are served
+    bool read_only_session{false};
     Poco::Timespan min_session_timeout;
     Poco::Timespan max_session_timeout;
 
+    /// Reading is paused when inFlightBytes() reaches it, 0 means no limit
+    static constexpr UInt64 DEFAULT_MAX_IN_FLIGHT_BYTES = 64 * 1024 * 1024;
+    UInt64 max_in_flight_bytes;
+    /// Reading is paused when in_flight_requests reach it, 0 means no limit
+    UInt64 max_in_flight_requests;
+
+    /// Token bucket of request bytes, refilled by max_request_bytes_per_second and holding a second of them at most,
+    /// 0 means no limit. A request larger than the tokens left takes them in debt, a second of them at most, so that
+    /// reading is not paused for long and heartbeats are still read in time.
+    UInt64 max_request_bytes_per_second;
+    double request_bytes_tokens;
+    Stopwatch request_bytes_watch;
+
+    /// Requests with client xids not answered yet. Pings and requests with special xids are not tracked.
+    std::unordered_map<int32_t, InFlightRequest> in_flight_requests;
+    size_t in_flight_request_bytes = 0;
+
+    /// Memory held by read and send buffers, inFlightBytes() and bytes of requests not answered, as of the last IO event
+    std::atomic<size_t> buffer_bytes{0};
+    std::atomic<size_t> in_flight_bytes{0};
+    std::atomic<size_t> unanswered_bytes{0};
+
     /// Default session_id is 0, so if a connection failed,
     /// server will return 0 and when client tries connect
     /// with previous_session_id = 0.
@@ -136,7 +270,8 @@ private:
     std::atomic<int64_t> internal_id{0};
 
     Stopwatch session_stopwatch;
-    ThreadSafeResponseQueuePtr responses;
+    /// Pushed by the response thread of the session, popped by IO thread
+    UnboundedSPSCQueue<Coordination::ZooKeeperResponsePtr> responses;
 
     /// connection established timestamp
     Poco::Timestamp established;
@@ -144,8 +279,32 @@ private:
 
     ConnectionStats conn_stats;
 
-    mutable std::mutex send_response_mutex;
-    bool socket_writable_event_registered = false;
+    /// Only the one who sets it registers writable event, so a burst of responses registers and wakes up reactor once.
+    /// IO thread clears it when everything is sent, see registerWritableEvent.
+    std::atomic<bool> socket_writable_event_registered{false};
+    std::mutex four_letter_word_output_mutex;
+
+    /// Shared by the connection and its running four letter word command, handler is reset when the connection is destroyed.
+    struct FourLetterWordTask
+    {
+        std::mutex mutex;
+        ConnectionHandler * handler;
+    };
+    std::shared_ptr<FourLetterWordTask> four_letter_word_task;
+
+    /// Output of command waiting to be taken by IO thread, protected by four_letter_word_output_mutex. Streaming
+    /// commands push it by chunks, they are sent while the rest is produced.
+    String four_letter_word_output;
+    bool four_letter_word_output_finished = false;
+    std::atomic<bool> four_letter_word_output_ready{false};
+    /// All the output is in send_chunks, sending is shut down once they are sent
+    bool four_letter_word_sending = false;
+
+    /// Whether readable event handler is removed because the node is saturated
+    bool reading_paused = false;
+    Stopwatch pause_watch;
+    /// Read after paused for too long even if node is still saturated, so that heartbeats are read in time.
+    bool skip_saturation_check = false;
 };
 
 }
@@ -1,67 +1,76 @@
 #include <Service/ConnectionStats.h>
+#include <Common/Stopwatch.h>
 
 namespace RK
 {
 
 uint64_t ConnectionStats::getMinLatency() const
 {
-    UInt64 current_min = min_latency.load();
+    UInt64 current_min
+        = merge(&Shard::min_latency, std::numeric_limits<uint64_t>::max(), [](UInt64 lhs, UInt64 rhs) { return std::min(lhs, rhs); });
     return current_min == std::numeric_limits<uint64_t>::max() ? static_cast<uint64_t>(0): current_min;
 }
 
 uint64_t ConnectionStats::getMaxLatency() const
 {
-    return max_latency;
+    return merge(&Shard::max_latency, 0, [](UInt64 lhs, UInt64 rhs) { return std::max(lhs, rhs); });
 }
 
 uint64_t ConnectionStats::getAvgLatency() const
 {
-    uint64_t current_count = count.load();
+    uint64_t current_count = sum(&Shard::count);
     if (current_count != 0)
-        return total_latency / current_count;
+        return sum(&Shard::total_latency) / current_count;
     return 0;
 }
 
 uint64_t ConnectionStats::getLastLatency() const
 {
+    UInt64 last_update_ns = 0;
+    UInt64 last_latency = 0;
+    for (const auto & shard : shards)
+    {
+        UInt64 update_ns = shard.last_update_ns.load(std::memory_order_relaxed);
+        if (update_ns >= last_update_ns)
+        {
+            last_update_ns = update_ns;
+            last_latency = shard.last_latency.load(std::memory_order_relaxed);
+        }
+    }
     return last_latency;
 }
 
 uint64_t ConnectionStats::getPacketsReceived() const
 {
-    return packets_received;
+    return sum(&Shard::packets_received);
 }
 
 uint64_t ConnectionStats::getPacketsSent() const
 {
-    return packets_sent;
+    return sum(&Shard::packets_sent);
 }
 
 void ConnectionStats::incrementPacketsReceived()
 {
-    packets_received++;
+    shards.local().packets_received.fetch_add(1, std::memory_order_relaxed);
 }
 
 void ConnectionStats::incrementPacketsSent()
 {
-    packets_sent++;
+    shards.local().packets_sent.fetch_add(1, std::memory_order_relaxed);
 }
 
 void ConnectionStats::updateLatency(uint64_t latency_ms)
 {
-    last_latency = latency_ms;
-    total_latency += latency_ms;
-    count++;
-
-    if (latency_ms < min_latency)
-    {
-        min_latency = latency_ms;
-    }
-
-    if (latency_ms > max_latency)
-    {
-        max_latency = latency_ms;
-    }
+    auto & shard = shards.local();
+    shard.last_latency.store(latency_ms, std::memory_order_relaxed);
+    /// Coarse clock is enough to tell the latest shard and it is much cheaper
+    shard.last_update_ns.store(clock_gettime_ns(CLOCK_MONOTONIC_COARSE), std::memory_order_relaxed);
+    shard.total_latency.fetch_add(latency_ms, std::memory_order_relaxed);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+
+    atomicMin(shard.min_latency, latency_ms);
+    atomicMax(shard.max_latency, latency_ms);
 }
 
 void ConnectionStats::reset()
@@ -72,17 +81,24 @@ void ConnectionStats::reset()
 
 void ConnectionStats::resetLatency()
 {
-    total_latency = 0;
-    count = 0;
-    max_latency = 0;
-    last_latency = 0;
-    min_latency = std::numeric_limits<uint64_t>::max();
+    for (auto & shard : shards)
+    {
+        shard.total_latency = 0;
+        shard.count = 0;
+        shard.max_latency = 0;
+        shard.last_latency = 0;
+        shard.last_update_ns = 0;
+        shard.min_latency = std::numeric_limits<uint64_t>::max();
+    }
 }
 
 void ConnectionStats::resetRequestCounters()
 {
-    packets_received = 0;
-    packets_sent = 0;
+    for (auto & shard : shards)
+    {
+        shard.packets_received = 0;
+        shard.packets_sent = 0;
+    }
 }
 
 }
@@ -3,16 +3,19 @@
 #include <cstdint>
 #include <limits>
 #include <memory>
+#include <Common/ShardedCounter.h>
 #include <common/types.h>
 
 namespace RK
 {
 
-/// Request statistics for connection or dispatcher
+/** Request statistics for connection or dispatcher. Statistics of dispatcher are updated by all connections, so that
+  * counters are sharded by thread, see Sharded, a connection has one shard.
+  */
 class ConnectionStats
 {
 public:
-    ConnectionStats() = default;
+    explicit ConnectionStats(size_t shards_num = 1) : shards(shards_num) { }
 
     uint64_t getMinLatency() const;
     uint64_t getMaxLatency() const;
@@ -33,22 +36,42 @@ private:
     void resetLatency();
     void resetRequestCounters();
 
-    /// all responses with watch response included
-    std::atomic<uint64_t> packets_sent{0};
-    /// All user requests
-    std::atomic<uint64_t> packets_received{0};
+    struct alignas(64) Shard
+    {
+        /// all responses with watch response included
+        std::atomic<uint64_t> packets_sent{0};
+        /// All user requests
+        std::atomic<uint64_t> packets_received{0};
 
-    /// For consistent with zookeeper measured by millisecond,
-    /// otherwise maybe microsecond is better
-    std::atomic<UInt64> total_latency{0};
+        /// For consistent with zookeeper measured by millisecond,
+        /// otherwise maybe microsecond is better
+        std::atomic<UInt64> total_latency{0};
 
-    std::atomic<UInt64> max_latency{0};
-    std::atomic<UInt64> min_latency{std::numeric_limits<uint64_t>::max()};
+        std::atomic<UInt64> max_latency{0};
+        std::atomic<UInt64> min_latency{std::numeric_limits<uint64_t>::max()};
 
-    /// last operation latency
-    std::atomic<UInt64> last_latency{0};
-    /// request count
-    std::atomic<UInt64> count{0};
+        /// last operation latency of the shard, the last of all shards is the latest updated
+        std::atomic<UInt64> last_latency{0};
+        std::atomic<UInt64> last_update_ns{0};
+        /// request count
+        std::atomic<UInt64> count{0};
+    };
+
+    template <typename Merge>
+    UInt64 merge(std::atomic<UInt64> Shard::*member, UInt64 init, Merge && merge_func) const
+    {
+        UInt64 res = init;
+        for (const auto & shard : shards)
+            res = merge_func(res, (shard.*member).load(std::memory_order_relaxed));
+        return res;
+    }
+
+    UInt64 sum(std::atomic<UInt64> Shard::*member) const
+    {
+        return merge(member, 0, [](UInt64 lhs, UInt64 rhs) { return lhs + rhs; });
+    }
+
+    Sharded<Shard> shards;
 };
 
 }
@@ -0,0 +1,217 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <Service/MemoryUsage.h>
+
+namespace RK
+{
+
+/// Read only access to the buckets of a CopyOnWriteMap, a pinned version of it is a view which no writes change.
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class CopyOnWriteMapView
+{
+public:
+    using Map = std::unordered_map<Key, Value, Hash>;
+    using value_type = typename Map::value_type;
+    using BucketPtr = std::shared_ptr<Map>;
+    using Buckets = std::vector<BucketPtr>;
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const Buckets * buckets_, size_t bucket_) : buckets(buckets_), bucket(bucket_)
+        {
+            if (bucket < buckets->size())
+            {
+                it = (*buckets)[bucket]->begin();
+                skipEmptyBuckets();
+            }
+        }
+
+        const_iterator(const Buckets * buckets_, size_t bucket_, typename Map::const_iterator it_)
+            : buckets(buckets_), bucket(bucket_), it(it_)
+        {
+        }
+
+        const value_type & operator*() const { return *it; }
+        const value_type * operator->() const { return &*it; }
+
+        const_iterator & operator++()
+        {
+            ++it;
+            skipEmptyBuckets();
+            return *this;
+        }
+
+        bool operator==(const const_iterator & rhs) const
+        {
+            return bucket == rhs.bucket && (bucket == buckets->size() || it == rhs.it);
+        }
+        bool operator!=(const const_iterator & rhs) const { return !(*this == rhs); }
+
+    private:
+        void skipEmptyBuckets()
+        {
+            while (it == (*buckets)[bucket]->end())
+            {
+                if (++bucket == buckets->size())
+                    return;
+                it = (*buckets)[bucket]->begin();
+            }
+        }
+
+        const Buckets * buckets;
+        size_t bucket;
+        typename Map::const_iterator it;
+    };
+
+    const_iterator begin() const { return const_iterator(&buckets, 0); }
+    const_iterator end() const { return const_iterator(&buckets, buckets.size()); }
+
+    const_iterator find(const Key & key) const
+    {
+        size_t bucket = bucketOf(key);
+        auto it = buckets[bucket]->find(key);
+        return it == buckets[bucket]->end() ? end() : const_iterator(&buckets, bucket, it);
+    }
+
+    bool contains(const Key & key) const { return buckets[bucketOf(key)]->contains(key); }
+    size_t count(const Key & key) const { return contains(key) ? 1 : 0; }
+
+    size_t size() const { return elements; }
+    bool empty() const { return elements == 0; }
+
+    /// Copy of all the elements
+    Map toMap() const
+    {
+        Map res;
+        res.reserve(elements);
+        for (const auto & bucket : buckets)
+            res.insert(bucket->begin(), bucket->end());
+        return res;
+    }
+
+    /// Approximate bytes of the buckets, only of the ones no other version shares if only_unshared, memory owned by
+    /// elements is not included.
+    size_t getApproximateMemoryUsage(bool only_unshared = false) const
+    {
+        size_t bytes = only_unshared ? 0 : buckets.capacity() * sizeof(BucketPtr);
+        for (const auto & bucket : buckets)
+            if (!only_unshared || bucket.use_count() == 1)
+                bytes += hashTableMemoryUsage(*bucket);
+        return bytes;
+    }
+
+    bool operator==(const CopyOnWriteMapView & rhs) const
+    {
+        if (size() != rhs.size())
+            return false;
+        for (const auto & [key, value] : *this)
+        {
+            auto it = rhs.find(key);
+            if (it == rhs.end() || it->second != value)
+                return false;
+        }
+        return true;
+    }
+
+protected:
+    size_t bucketOf(const Key & key) const { return Hash{}(key) % buckets.size(); }
+
+    Buckets buckets;
+    size_t elements = 0;
+};
+
+/** Hash map split into buckets which are shared with the versions pinned from it and copied by the first write after
+  * a pin, like the buckets of KeeperNodeMap. So a snapshot task takes a consistent version of sessions or ACLs in
+  * O(buckets) under the lock of the owner instead of copying all of them, and writes afterwards copy only the buckets
+  * they touch, one at most per bucket and pin.
+  *
+  * The map is not thread safe, writes and pin are guarded by the lock of the owner. A pinned version is immutable and
+  * can be read from another thread without lock.
+  */
+template <typename Key, typename Value, typename Hash = std::hash<Key>>
+class CopyOnWriteMap : public CopyOnWriteMapView<Key, Value, Hash>
+{
+public:
+    using View = CopyOnWriteMapView<Key, Value, Hash>;
+    using VersionPtr = std::shared_ptr<const View>;
+    using typename View::Map;
+
+    static constexpr size_t DEFAULT_BUCKETS = 64;
+
+    explicit CopyOnWriteMap(size_t buckets_count = DEFAULT_BUCKETS)
+    {
+        buckets.resize(std::max(buckets_count, size_t(1)));
+        for (auto & bucket : buckets)
+            bucket = std::make_shared<Map>();
+    }
+
+    /// Version of the current elements, later writes do not change it
+    VersionPtr pin() const { return std::make_shared<const View>(*this); }
+
+    Value & operator[](const Key & key)
+    {
+        auto & bucket = bucketForUpdate(key);
+        size_t old_size = bucket.size();
+        auto & value = bucket[key];
+        elements += bucket.size() - old_size;
+        return value;
+    }
+
+    /// Mutable value of key, nullptr if there is none
+    Value * findForUpdate(const Key & key)
+    {
+        if (!this->contains(key))
+            return nullptr;
+        return &bucketForUpdate(key).find(key)->second;
+    }
+
+    /// Whether inserted, an existing value is kept
+    template <typename... Args>
+    bool emplace(const Key & key, Args &&... args)
+    {
+        if (this->contains(key))
+            return false;
+        bucketForUpdate(key).emplace(key, std::forward<Args>(args)...);
+        ++elements;
+        return true;
+    }
+
+    size_t erase(const Key & key)
+    {
+        if (!this->contains(key))
+            return 0;
+        bucketForUpdate(key).erase(key);
+        --elements;
+        return 1;
+    }
+
+    /// Pinned versions keep their buckets
+    void clear()
+    {
+        for (auto & bucket : buckets)
+            bucket = std::make_shared<Map>();
+        elements = 0;
+    }
+
+private:
+    using View::buckets;
+    using View::elements;
+
+    /// Bucket of key, copied if a pinned version shares it. Versions are pinned under the lock held by writes, so no
+    /// new one may share it after the check.
+    Map & bucketForUpdate(const Key & key)
+    {
+        auto & bucket = buckets[this->bucketOf(key)];
+        if (bucket.use_count() > 1)
+            bucket = std::make_shared<Map>(*bucket);
+        return *bucket;
+    }
+};
+
+}
@@ -6,6 +6,9 @@ namespace RK
 {
 UInt32 getCRC32(const char * data, size_t length);
 
+/// Continue crc of preceding data with more data, equal to getCRC32 of all data at once if the preceding is not empty.
+UInt32 extendCRC32(UInt32 crc, const char * data, size_t length);
+
 bool verifyCRC32(const char * data, size_t len, uint32_t value);
 
 }
@@ -0,0 +1,50 @@
+#include <Service/EpochManager.h>
+
+#include <algorithm>
+
+#include <Common/Exception.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int LOGICAL_ERROR;
+}
+
+EpochManager::EpochManager(size_t slots_count) : slots(std::max(slots_count, size_t(1)))
+{
+}
+
+void EpochManager::enter(size_t slot_id)
+{
+    if (slot_id >= slots.size())
+        throw Exception(ErrorCodes::LOGICAL_ERROR, "Epoch slot {} out of {} slots", slot_id, slots.size());
+
+    /// Sequentially consistent with advance: if the epoch is the same after the slot is set, a writer advancing it
+    /// later sees the reader, otherwise enter the advanced one.
+    auto & slot_epoch = slots[slot_id].epoch;
+    UInt64 epoch = global_epoch.load(std::memory_order_seq_cst);
+    while (true)
+    {
+        slot_epoch.store(epoch, std::memory_order_seq_cst);
+        UInt64 current = global_epoch.load(std::memory_order_seq_cst);
+        if (current == epoch)
+            break;
+        epoch = current;
+    }
+}
+
+UInt64 EpochManager::advance()
+{
+    UInt64 safe_epoch = global_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+    for (const auto & slot : slots)
+    {
+        UInt64 epoch = slot.epoch.load(std::memory_order_seq_cst);
+        if (epoch != 0)
+            safe_epoch = std::min(safe_epoch, epoch);
+    }
+    return safe_epoch;
+}
+
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+#include <common/types.h>
+
+namespace RK
+{
+
+/** Epoch based reclamation for readers of data tree which run in parallel with each other and with the writer.
+  *
+  * A reader enters the current epoch in its slot before it looks up nodes and leaves it when it is done, so it
+  * reads nodes by raw pointer without touching their reference counters. The writer retires nodes which it erases
+  * or replaces with the epoch of the moment, and frees them once every reader in a slot has entered a later epoch
+  * or left, for no reader which enters after the retirement can find them.
+  *
+  * A slot is used by one reader at a time, readers are the runners of the request processor.
+  */
+class EpochManager : private boost::noncopyable
+{
+public:
+    explicit EpochManager(size_t slots_count);
+
+    /// Epoch which nodes retired now are tagged with
+    UInt64 currentEpoch() const { return global_epoch.load(std::memory_order_seq_cst); }
+
+    /// Advance the epoch and return the one before which retired nodes are no longer read by anyone, called by the
+    /// writer when it reclaims.
+    UInt64 advance();
+
+    size_t getSlotsCount() const { return slots.size(); }
+
+private:
+    friend class EpochGuard;
+
+    struct alignas(64) Slot
+    {
+        /// Epoch the reader entered, 0 if there is no reader
+        std::atomic<UInt64> epoch{0};
+    };
+
+    void enter(size_t slot_id);
+    void leave(size_t slot_id) { slots[slot_id].epoch.store(0, std::memory_order_release); }
+
+    std::atomic<UInt64> global_epoch{1};
+    std::vector<Slot> slots;
+};
+
+/// Reader in a slot of EpochManager for its lifetime, nothing if the manager is nullptr.
+class EpochGuard : private boost::noncopyable
+{
+public:
+    EpochGuard(EpochManager * manager_, size_t slot_id_) : manager(manager_), slot_id(slot_id_)
+    {
+        if (manager)
+            manager->enter(slot_id);
+    }
+
+    ~EpochGuard()
+    {
+        if (manager)
+            manager->leave(slot_id);
+    }
+
+private:
+    EpochManager * manager;
+    size_t slot_id;
+};
+
+/// Objects retired by a writer and freed by reclaim after readers have advanced, not thread safe.
+template <typename Ptr>
+class RetireList
+{
+public:
+    void retire(Ptr && ptr, UInt64 epoch) { retired.push_back({epoch, std::move(ptr)}); }
+
+    /// Free objects retired before safe_epoch, they are in the order of their epochs
+    size_t reclaim(UInt64 safe_epoch)
+    {
+        size_t count = 0;
+        while (count < retired.size() && retired[count].first < safe_epoch)
+            ++count;
+        retired.erase(retired.begin(), retired.begin() + count);
+        return count;
+    }
+
+    size_t size() const { return retired.size(); }
+    void clear() { retired.clear(); }
+
+private:
+    std::vector<std::pair<UInt64, Ptr>> retired;
+};
+
+}
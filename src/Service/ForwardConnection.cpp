@@ -2,6 +2,9 @@
 #include <Common/IO/WriteHelpers.h>
 
 #include <Service/ForwardConnection.h>
+#include <Service/LatencyInjection.h>
+#include <Service/RequestTracer.h>
+#include <Service/TLSContext.h>
 #include <ZooKeeper/ZooKeeperIO.h>
 
 namespace RK
@@ -35,6 +38,10 @@ void ForwardConnection::connect()
             socket.setSendTimeout(socket_timeout);
             socket.setNoDelay(true);
 
+            /// Socket is blocking, handshake is bounded by the timeouts
+            if (TLSContext::instance().forwardingEnabled())
+                TLSHandshake(TLSContext::instance().clientContext(), socket.impl()->sockfd(), false).run();
+
             in.emplace(socket);
             out.emplace(socket);
 
@@ -78,6 +85,11 @@ void ForwardConnection::send(ForwardRequestPtr request)
 
     try
     {
+        auto & injection = LatencyInjection::instance();
+        injection.delay(InjectionPoint::FORWARD_SEND);
+        if (injection.shouldFail(InjectionPoint::FORWARD_SEND))
+            throw Exception(ErrorCodes::RAFT_FORWARD_ERROR, "Injected failure of forwarding to {}", endpoint);
+
         request->write(*out);
     }
     catch (...)
@@ -104,6 +116,11 @@ void ForwardConnection::receive(ForwardResponsePtr & response)
     ///     2. Receiving network packets failed, which cannot determine whether the opposite end is accepted.
     try
     {
+        auto & injection = LatencyInjection::instance();
+        injection.delay(InjectionPoint::FORWARD_RECEIVE);
+        if (injection.shouldFail(InjectionPoint::FORWARD_RECEIVE))
+            throw Exception(ErrorCodes::RAFT_FORWARD_ERROR, "Injected failure of receiving from {}", endpoint);
+
         int8_t type;
         Coordination::read(type, *in);
 
@@ -122,6 +139,18 @@ void ForwardConnection::receive(ForwardResponsePtr & response)
             case ForwardType::User:
                 response = std::make_shared<ForwardUserRequestResponse>();
                 break;
+            case ForwardType::ReadIndex:
+                response = std::make_shared<ForwardReadIndexResponse>();
+                break;
+            case ForwardType::LoadReport:
+                response = std::make_shared<ForwardLoadReportResponse>();
+                break;
+            case ForwardType::FetchLogs:
+                response = std::make_shared<ForwardFetchLogsResponse>();
+                break;
+            case ForwardType::FetchSnapshot:
+                response = std::make_shared<ForwardFetchSnapshotResponse>();
+                break;
             default:
                 throw Exception("Unexpected forward package type " + toString(response_type), ErrorCodes::UNEXPECTED_FORWARD_PACKET);
         }
@@ -146,6 +175,14 @@ void ForwardConnection::sendHandshake()
     ForwardHandshakeRequest handshake;
     handshake.server_id = my_server_id;
     handshake.client_id = client_id;
+    if (want_compression)
+        handshake.features |= FORWARD_FEATURE_COMPRESSION;
+    if (RequestTracer::instance().isEnabled())
+        handshake.features |= FORWARD_FEATURE_TRACE_CONTEXT;
+    /// Reports are sent only if leader balancing is enabled, asking costs nothing
+    handshake.features |= FORWARD_FEATURE_LOAD_REPORT;
+    /// Leaders of older versions drop the connection on an unknown packet
+    handshake.features |= FORWARD_FEATURE_USER_BATCH;
     handshake.write(*out);
 }
 
@@ -154,11 +191,20 @@ bool ForwardConnection::receiveHandshake()
 {
     int8_t type;
     Coordination::read(type, *in);
-    assert(type == static_cast<int8_t>(ForwardType::Handshake));
 
     ForwardHandshakeResponse handshake;
+    handshake.with_features = type == static_cast<int8_t>(ForwardType::HandshakeV2);
     handshake.readImpl(*in);
 
+    compression = (handshake.features & FORWARD_FEATURE_COMPRESSION) != 0;
+    if (compression)
+        LOG_INFO(log, "Compression of forwarded batches is enabled for {}", endpoint);
+    trace_context = (handshake.features & FORWARD_FEATURE_TRACE_CONTEXT) != 0;
+    if (trace_context)
+        LOG_INFO(log, "Trace context of forwarded requests is enabled for {}", endpoint);
+    load_report = (handshake.features & FORWARD_FEATURE_LOAD_REPORT) != 0;
+    user_batch = (handshake.features & FORWARD_FEATURE_USER_BATCH) != 0;
+
     return handshake.accepted;
 }
 
@@ -18,9 +18,11 @@ namespace RK
 class ForwardConnection
 {
 public:
-    ForwardConnection(int32_t server_id_, int32_t client_id_, String endpoint_, Poco::Timespan socket_timeout_)
+    ForwardConnection(
+        int32_t server_id_, int32_t client_id_, String endpoint_, Poco::Timespan socket_timeout_, bool want_compression_ = false)
         : my_server_id(server_id_)
         , client_id(client_id_)
+        , want_compression(want_compression_)
         , endpoint(endpoint_)
         , socket_timeout(socket_timeout_)
         , log(&Poco::Logger::get("ForwardConnection"))
@@ -42,6 +44,15 @@ public:
 
     bool isConnected() const { return connected; }
 
+    /// Whether the leader accepted compression of user batches when connecting
+    bool compressionEnabled() const { return compression; }
+    /// Whether the leader accepted trace context of sampled requests when connecting
+    bool traceContextEnabled() const { return trace_context; }
+    /// Whether the leader accepts load reports for leader balancing
+    bool loadReportEnabled() const { return load_report; }
+    /// Whether the leader accepts user batches, otherwise requests are sent one by one
+    bool userBatchEnabled() const { return user_batch; }
+
     ~ForwardConnection()
     {
         try
@@ -63,6 +74,14 @@ private:
     int32_t my_server_id;
     int32_t client_id;
 
+    /// Ask the leader for compression when connecting
+    bool want_compression;
+    std::atomic<bool> compression{false};
+    /// Asked for if tracing is enabled
+    std::atomic<bool> trace_context{false};
+    std::atomic<bool> load_report{false};
+    std::atomic<bool> user_batch{false};
+
     std::atomic<bool> connected{false};
 
     /// Remote endpoint
@@ -5,6 +5,7 @@
 #include <Service/ForwardConnection.h>
 #include <Service/ForwardConnectionHandler.h>
 #include <Service/FourLetterCommand.h>
+#include <Service/RequestTracer.h>
 #include <ZooKeeper/ZooKeeperIO.h>
 
 namespace RK
@@ -25,6 +26,9 @@ ForwardConnectionHandler::ForwardConnectionHandler(Context & global_context_, St
 {
     LOG_INFO(log, "New forward connection from {}", sock.peerAddress().toString());
 
+    if (TLSContext::instance().forwardingEnabled())
+        tls_handshake = std::make_unique<TLSHandshake>(TLSContext::instance().serverContext(), sock.impl()->sockfd(), true);
+
     auto read_handler = Observer<ForwardConnectionHandler, ReadableNotification>(*this, &ForwardConnectionHandler::onSocketReadable);
     auto error_handler = Observer<ForwardConnectionHandler, ErrorNotification>(*this, &ForwardConnectionHandler::onSocketError);
     auto shutdown_handler
@@ -60,6 +64,14 @@ void ForwardConnectionHandler::onSocketReadable(const Notification &)
     try
     {
         LOG_TRACE(log, "Forward handler socket readable");
+
+        /// Packages following the handshake make socket readable again
+        if (tls_handshake)
+        {
+            proceedTLSHandshake();
+            return;
+        }
+
         if (!sock.available())
         {
             LOG_INFO(log, "Client close connection!");
@@ -67,7 +79,8 @@ void ForwardConnectionHandler::onSocketReadable(const Notification &)
             return;
         }
 
-        while (sock.available())
+        /// Bytes are known to be available for the first round, check is needed only for the next ones.
+        do
         {
             LOG_TRACE(log, "Forward handler socket available");
 
@@ -96,10 +109,16 @@ void ForwardConnectionHandler::onSocketReadable(const Notification &)
                 switch (static_cast<ForwardType>(forward_type))
                 {
                     case ForwardType::Handshake:
+                    case ForwardType::HandshakeV2:
                     case ForwardType::SyncSessions:
                     case ForwardType::NewSession:
                     case ForwardType::UpdateSession:
                     case ForwardType::User:
+                    case ForwardType::ReadIndex:
+                    case ForwardType::UserBatch:
+                    case ForwardType::LoadReport:
+                    case ForwardType::FetchLogs:
+                    case ForwardType::FetchSnapshot:
                         current_package.is_done = false;
                         break;
                     case ForwardType::Destroy:
@@ -159,12 +178,40 @@ void ForwardConnectionHandler::onSocketReadable(const Notification &)
                         if (!req_body_buf->isFull())
                             continue;
 
+                        if (unlikely(current_package.type == ForwardType::HandshakeV2))
+                        {
+                            processHandshake(/* with_features */ true);
+                            req_body_buf.reset();
+                            current_package.is_done = true;
+                            continue;
+                        }
+
                         request = ForwardRequestFactory::instance().get(current_package.type);
 
                         if (likely(isUserOrSessionRequest(current_package.type)))
                         {
                             processUserOrSessionRequest(request);
                         }
+                        else if (current_package.type == ForwardType::UserBatch)
+                        {
+                            processUserBatchRequest(request);
+                        }
+                        else if (current_package.type == ForwardType::ReadIndex)
+                        {
+                            processReadIndexRequest(request);
+                        }
+                        else if (current_package.type == ForwardType::LoadReport)
+                        {
+                            processLoadReportRequest(request);
+                        }
+                        else if (current_package.type == ForwardType::FetchLogs)
+                        {
+                            processFetchLogsRequest(request);
+                        }
+                        else if (current_package.type == ForwardType::FetchSnapshot)
+                        {
+                            processFetchSnapshotRequest(request);
+                        }
                         else
                         {
                             processSyncSessionsRequest(request);
@@ -175,7 +222,8 @@ void ForwardConnectionHandler::onSocketReadable(const Notification &)
                     }
                     catch (Exception & e)
                     {
-                        if (request)
+                        /// A batch failed to parse has no response, the follower will time out its requests.
+                        if (request && current_package.type != ForwardType::UserBatch)
                         {
                             auto response = request->makeResponse();
                             response->setAppendEntryResult(false, nuraft::cmd_result_code::FAILED);
@@ -195,7 +243,7 @@ void ForwardConnectionHandler::onSocketReadable(const Notification &)
                     }
                 }
             }
-        }
+        } while (sock.available());
     }
     catch (Poco::Net::NetException &)
     {
@@ -239,13 +287,110 @@ void ForwardConnectionHandler::processUserOrSessionRequest(ForwardRequestPtr req
     keeper_dispatcher->pushForwardRequest(server_id, client_id, request);
 }
 
-void ForwardConnectionHandler::processHandshake()
+void ForwardConnectionHandler::processUserBatchRequest(ForwardRequestPtr request)
+{
+    auto & batch = static_cast<ForwardUserBatchRequest &>(*request);
+    batch.compression = compression;
+    batch.trace_context = trace_context;
+
+    ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
+    request->readImpl(body);
+    LOG_TRACE(log, "Receive batch of {} requests", batch.requests.size());
+
+    UInt64 parsed_time_us = RequestTimeline::now();
+    for (const auto & user_request : batch.requests)
+    {
+        auto & timeline = user_request->request.request->timeline;
+        if (timeline.started())
+            timeline.end(RequestStage::IO, parsed_time_us);
+
+        try
+        {
+            keeper_dispatcher->pushForwardRequest(server_id, client_id, user_request);
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Error when forwarding request " + user_request->toString());
+            auto response = user_request->makeResponse();
+            response->setAppendEntryResult(false, nuraft::cmd_result_code::FAILED);
+            keeper_dispatcher->invokeForwardResponseCallBack({server_id, client_id}, response);
+        }
+    }
+}
+
+void ForwardConnectionHandler::processReadIndexRequest(ForwardRequestPtr request)
+{
+    ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
+    request->readImpl(body);
+
+    auto response = request->makeResponse();
+    if (auto read_index = keeper_dispatcher->getReadIndex())
+        static_cast<ForwardReadIndexResponse &>(*response).read_index = *read_index;
+    else
+        response->setAppendEntryResult(false, nuraft::cmd_result_code::NOT_LEADER);
+
+    keeper_dispatcher->invokeForwardResponseCallBack({server_id, client_id}, response);
+}
+
+void ForwardConnectionHandler::processLoadReportRequest(ForwardRequestPtr request)
+{
+    ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
+    request->readImpl(body);
+    LOG_TRACE(log, "Receive load report {} of server {}", request->toString(), server_id);
+
+    keeper_dispatcher->onLoadReport(server_id, static_cast<ForwardLoadReportRequest &>(*request).load);
+
+    auto response = request->makeResponse();
+    keeper_dispatcher->invokeForwardResponseCallBack({server_id, client_id}, response);
+}
+
+void ForwardConnectionHandler::processFetchLogsRequest(ForwardRequestPtr request)
+{
+    ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
+    request->readImpl(body);
+    LOG_TRACE(log, "Receive fetch logs {} of server {}", request->toString(), server_id);
+
+    const auto & fetch = static_cast<const ForwardFetchLogsRequest &>(*request);
+    auto response = request->makeResponse();
+    keeper_dispatcher->fetchCommittedLogs(fetch.start_index, fetch.max_bytes, static_cast<ForwardFetchLogsResponse &>(*response));
+
+    keeper_dispatcher->invokeForwardResponseCallBack({server_id, client_id}, response);
+}
+
+void ForwardConnectionHandler::processFetchSnapshotRequest(ForwardRequestPtr request)
+{
+    ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
+    request->readImpl(body);
+    LOG_DEBUG(log, "Receive fetch snapshot {} of server {}", request->toString(), server_id);
+
+    const auto & fetch = static_cast<const ForwardFetchSnapshotRequest &>(*request);
+    auto response = request->makeResponse();
+    keeper_dispatcher->fetchSnapshotObject(fetch.snapshot, fetch.obj_id, static_cast<ForwardFetchSnapshotResponse &>(*response));
+
+    keeper_dispatcher->invokeForwardResponseCallBack({server_id, client_id}, response);
+}
+
+void ForwardConnectionHandler::processHandshake(bool with_features)
 {
     ReadBufferFromMemory body(req_body_buf->begin(), req_body_buf->used());
 
     read(server_id, body);
     read(client_id, body);
 
+    /// Accept all features asked for which are known
+    uint8_t features = 0;
+    if (with_features)
+    {
+        read(features, body);
+        auto known = static_cast<uint8_t>(FORWARD_FEATURE_COMPRESSION | FORWARD_FEATURE_LOAD_REPORT | FORWARD_FEATURE_USER_BATCH);
+        /// Spans of forwarded requests are not exported if tracing is disabled
+        if (RequestTracer::instance().isEnabled())
+            known |= FORWARD_FEATURE_TRACE_CONTEXT;
+        features = static_cast<uint8_t>(features & known);
+        compression = (features & FORWARD_FEATURE_COMPRESSION) != 0;
+        trace_context = (features & FORWARD_FEATURE_TRACE_CONTEXT) != 0;
+    }
+
     /// register session response callback
     auto response_callback = [this](ForwardResponsePtr response) { sendResponse(response); };
     keeper_dispatcher->registerForwarderResponseCallBack({server_id, client_id}, response_callback);
@@ -255,6 +400,8 @@ void ForwardConnectionHandler::processHandshake()
     std::shared_ptr<ForwardHandshakeResponse> response = std::make_shared<ForwardHandshakeResponse>();
     response->accepted = true;
     response->error_code = nuraft::OK;
+    response->with_features = with_features;
+    response->features = features;
 
     keeper_dispatcher->invokeForwardResponseCallBack({server_id, client_id}, response);
 }
@@ -301,6 +448,13 @@ void ForwardConnectionHandler::onSocketWritable(const Notification &)
 
     try
     {
+        if (tls_handshake)
+        {
+            if (proceedTLSHandshake() != TLSHandshake::WANT_WRITE)
+                remove_event_handler_if_needed();
+            return;
+        }
+
         /// If the buffer was not completely sent last time, continue sending.
         if (out_buffer)
             copy_buffer_to_send();
@@ -338,6 +492,27 @@ void ForwardConnectionHandler::onSocketWritable(const Notification &)
     }
 }
 
+TLSHandshake::Status ForwardConnectionHandler::proceedTLSHandshake()
+{
+    auto status = tls_handshake->proceed();
+    if (status == TLSHandshake::WANT_WRITE)
+    {
+        std::lock_guard lock(send_response_mutex);
+        if (!socket_writable_event_registered)
+        {
+            socket_writable_event_registered = true;
+            reactor.addEventHandler(
+                sock, Observer<ForwardConnectionHandler, WritableNotification>(*this, &ForwardConnectionHandler::onSocketWritable));
+        }
+    }
+    else if (status == TLSHandshake::DONE)
+    {
+        LOG_DEBUG(log, "TLS handshake with {} done", sock.peerAddress().toString());
+        tls_handshake.reset();
+    }
+    return status;
+}
+
 void ForwardConnectionHandler::onReactorShutdown(const Notification &)
 {
     LOG_INFO(log, "Reactor shutdown!");
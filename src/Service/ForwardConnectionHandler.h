@@ -10,6 +10,7 @@
 
 #include <Service/ConnCommon.h>
 #include <Service/ForwardConnection.h>
+#include <Service/TLSContext.h>
 
 
 namespace RK
@@ -40,6 +41,9 @@ private:
     /// destroy connection
     void destroyMe();
 
+    /// Continue TLS handshake, writable event is registered if it wants to write. tls_handshake is reset if it is done.
+    TLSHandshake::Status proceedTLSHandshake();
+
     static constexpr size_t SENT_BUFFER_SIZE = 16384;
     FIFOBuffer send_buf = FIFOBuffer(SENT_BUFFER_SIZE);
 
@@ -58,6 +62,9 @@ private:
 
     FIFOBuffer req_body_len_buf = FIFOBuffer(4);
 
+    /// TLS handshake in progress, packages are read after it is done and socket is passed to kTLS.
+    std::unique_ptr<TLSHandshake> tls_handshake;
+
     /// Represent one read from socket.
     struct CurrentPackage
     {
@@ -80,10 +87,25 @@ private:
     /// client id in client endpoint
     int32_t client_id{-1};
 
+    /// Negotiated by HandshakeV2, user batches may be compressed
+    bool compression = false;
+    /// Whether requests of user batches carry trace context
+    bool trace_context = false;
+
     bool isUserOrSessionRequest(ForwardType type);
-    void processHandshake();
+    /// Handshake has fixed size body, HandshakeV2 has length prefixed body with features
+    void processHandshake(bool with_features = false);
     void processUserOrSessionRequest(ForwardRequestPtr request);
+    /// Push every request of the batch, a request failed to push is answered alone
+    void processUserBatchRequest(ForwardRequestPtr request);
     void processSyncSessionsRequest(ForwardRequestPtr request);
+    /// Answer read index of a linearizable read directly, it does not go through Raft log
+    void processReadIndexRequest(ForwardRequestPtr request);
+    /// Load of the follower for leader balancing
+    void processLoadReportRequest(ForwardRequestPtr request);
+    /// Committed logs and snapshot objects for a cascaded observer, see LogRelay. They are read on this thread.
+    void processFetchLogsRequest(ForwardRequestPtr request);
+    void processFetchSnapshotRequest(ForwardRequestPtr request);
 };
 
 }
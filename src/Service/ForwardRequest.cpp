@@ -1,7 +1,15 @@
+#include <algorithm>
+#include <sstream>
+#include <Poco/DeflatingStream.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/MemoryStream.h>
 #include <Service/ForwardRequest.h>
 #include <ZooKeeper/ZooKeeperIO.h>
 #include <Service/RequestForwarder.h>
+#include <Service/RequestTracer.h>
 #include <Common/Exception.h>
+#include <Common/IO/ReadBufferFromString.h>
+#include <Common/IO/ReadHelpers.h>
 
 namespace RK
 {
@@ -27,6 +35,16 @@ void ForwardHandshakeRequest::readImpl(ReadBuffer & buf)
 
 void ForwardHandshakeRequest::writeImpl(WriteBuffer & buf) const
 {
+    if (features)
+    {
+        /// Body of HandshakeV2 is length prefixed, so that it can be extended.
+        WriteBufferFromOwnString out_buf;
+        Coordination::write(server_id, out_buf);
+        Coordination::write(client_id, out_buf);
+        Coordination::write(features, out_buf);
+        Coordination::write(out_buf.str(), buf);
+        return;
+    }
     Coordination::write(server_id, buf);
     Coordination::write(client_id, buf);
 }
@@ -115,6 +133,11 @@ RequestForSession ForwardNewSessionRequest::requestForSession() const
     return request_info;
 }
 
+ForwardKey ForwardNewSessionRequest::key() const
+{
+    return {forwardType(), dynamic_cast<ZooKeeperNewSessionRequest *>(request.get())->internal_id, 0};
+}
+
 void ForwardUpdateSessionRequest::readImpl(ReadBuffer & buf)
 {
     int32_t xid;
@@ -154,7 +177,15 @@ RequestForSession ForwardUpdateSessionRequest::requestForSession() const
     return request_for_session;
 }
 
-void ForwardUserRequest::readImpl(ReadBuffer & buf)
+ForwardKey ForwardUpdateSessionRequest::key() const
+{
+    return {forwardType(), dynamic_cast<ZooKeeperUpdateSessionRequest *>(request.get())->session_id, 0};
+}
+
+namespace
+{
+
+void readRequestForSession(RequestForSession & request, ReadBuffer & buf, bool trace_context)
 {
     Coordination::read(request.session_id, buf);
 
@@ -167,6 +198,128 @@ void ForwardUserRequest::readImpl(ReadBuffer & buf)
     request.request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
     request.request->xid = xid;
     request.request->readImpl(buf);
+    request.request->getPathHash();
+
+    if (!trace_context)
+        return;
+
+    bool sampled;
+    Coordination::read(sampled, buf);
+    if (!sampled)
+        return;
+
+    /// Span id sent is of the forward span of follower, the parent of the spans of leader
+    TraceContext parent;
+    Coordination::read(parent.trace_id_high, buf);
+    Coordination::read(parent.trace_id_low, buf);
+    Coordination::read(parent.span_id, buf);
+    RequestTracer::startRemote(request.request->timeline, parent);
+    request.request->timeline.start(RequestTimeline::now());
+}
+
+void writeRequestForSession(const RequestForSession & request, WriteBuffer & buf, bool trace_context)
+{
+    Coordination::write(request.session_id, buf);
+    Coordination::write(request.request->xid, buf);
+    Coordination::write(request.request->getOpNum(), buf);
+    request.request->writeImpl(buf);
+
+    if (!trace_context)
+        return;
+
+    const auto & trace = request.request->timeline.trace;
+    Coordination::write(trace.sampled(), buf);
+    if (!trace.sampled())
+        return;
+
+    Coordination::write(trace.trace_id_high, buf);
+    Coordination::write(trace.trace_id_low, buf);
+    Coordination::write(trace.stageSpanId(RequestStage::FORWARD), buf);
+}
+
+/// Codec of a user batch body when compression is negotiated, it is the first byte of the body.
+enum class ForwardCompression : uint8_t
+{
+    NONE = 0,
+    ZLIB = 1,
+};
+
+/// Data is kept uncompressed if it is small or compression does not make it smaller.
+String compressBatch(const String & data)
+{
+    if (data.size() >= ForwardUserBatchRequest::MIN_COMPRESS_SIZE)
+    {
+        std::ostringstream compressed;
+        compressed.put(static_cast<char>(ForwardCompression::ZLIB));
+        UInt32 data_size = static_cast<UInt32>(data.size());
+        compressed.write(reinterpret_cast<const char *>(&data_size), sizeof(data_size));
+        {
+            /// Fastest level, batches are compressed on the write path
+            Poco::DeflatingOutputStream deflating(compressed, Poco::DeflatingStreamBuf::STREAM_ZLIB, 1);
+            deflating.write(data.data(), static_cast<std::streamsize>(data.size()));
+            deflating.close();
+        }
+
+        String compressed_data = compressed.str();
+        if (compressed_data.size() < data.size() + 1)
+            return compressed_data;
+    }
+
+    String raw;
+    raw.reserve(data.size() + 1);
+    raw.push_back(static_cast<char>(ForwardCompression::NONE));
+    raw.append(data);
+    return raw;
+}
+
+String decompressBatch(const String & data)
+{
+    if (data.empty())
+        throw Exception(ErrorCodes::UNEXPECTED_FORWARD_PACKET, "Forward batch is empty");
+
+    auto compression = static_cast<ForwardCompression>(data[0]);
+    if (compression == ForwardCompression::NONE)
+        return data.substr(1);
+
+    if (compression != ForwardCompression::ZLIB)
+        throw Exception(ErrorCodes::UNEXPECTED_FORWARD_PACKET, "Unknown compression {} of forward batch", static_cast<int>(compression));
+
+    UInt32 data_size;
+    if (data.size() < 1 + sizeof(data_size))
+        throw Exception(ErrorCodes::UNEXPECTED_FORWARD_PACKET, "Compressed forward batch of {} bytes is too short", data.size());
+    memcpy(&data_size, data.data() + 1, sizeof(data_size));
+
+    String res(data_size, '\0');
+    Poco::MemoryInputStream compressed(data.data() + 1 + sizeof(data_size), data.size() - 1 - sizeof(data_size));
+    Poco::InflatingInputStream inflating(compressed, Poco::InflatingStreamBuf::STREAM_ZLIB);
+    inflating.read(res.data(), data_size);
+    if (static_cast<size_t>(inflating.gcount()) != data_size)
+        throw Exception(
+            ErrorCodes::UNEXPECTED_FORWARD_PACKET,
+            "Cannot decompress forward batch, expect {} bytes, got {}",
+            data_size,
+            inflating.gcount());
+    return res;
+}
+
+void readUserRequests(std::vector<std::shared_ptr<ForwardUserRequest>> & requests, ReadBuffer & buf, bool trace_context)
+{
+    int32_t size;
+    Coordination::read(size, buf);
+
+    requests.resize(static_cast<size_t>(size));
+    for (auto & request : requests)
+    {
+        request = std::make_shared<ForwardUserRequest>();
+        readRequestForSession(request->request, buf, trace_context);
+    }
+}
+
+}
+
+void ForwardUserRequest::readImpl(ReadBuffer & buf)
+{
+    readRequestForSession(request, buf, false);
 
 //    bool is_internal;
 //    Coordination::read(is_internal, buf);
@@ -176,10 +329,7 @@ void ForwardUserRequest::readImpl(ReadBuffer & buf)
 void ForwardUserRequest::writeImpl(WriteBuffer & buf) const
 {
     WriteBufferFromOwnString out_buf;
-    Coordination::write(request.session_id, out_buf);
-    Coordination::write(request.request->xid, out_buf);
-    Coordination::write(request.request->getOpNum(), out_buf);
-    request.request->writeImpl(out_buf);
+    writeRequestForSession(request, out_buf, false);
     Coordination::write(out_buf.str(), buf);
 //    Coordination::write(request.is_internal, buf);
 }
@@ -199,6 +349,168 @@ RequestForSession ForwardUserRequest::requestForSession() const
     return request;
 }
 
+void ForwardUserBatchRequest::readImpl(ReadBuffer & buf)
+{
+    if (!compression)
+    {
+        readUserRequests(requests, buf, trace_context);
+        return;
+    }
+
+    String data;
+    readStringUntilEOF(data, buf);
+    String decompressed = decompressBatch(data);
+    ReadBufferFromString in(decompressed);
+    readUserRequests(requests, in, trace_context);
+}
+
+void ForwardUserBatchRequest::writeImpl(WriteBuffer & buf) const
+{
+    WriteBufferFromOwnString out_buf;
+    Coordination::write(static_cast<int32_t>(requests.size()), out_buf);
+    for (const auto & request : requests)
+        writeRequestForSession(request->request, out_buf, trace_context);
+    Coordination::write(compression ? compressBatch(out_buf.str()) : out_buf.str(), buf);
+}
+
+bool ForwardUserBatchRequest::hasSampledRequest() const
+{
+    return std::any_of(
+        requests.begin(), requests.end(), [](const auto & request) { return request->request.request->timeline.trace.sampled(); });
+}
+
+ForwardResponsePtr ForwardUserBatchRequest::makeResponse() const
+{
+    throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Not implemented.");
+}
+
+RequestForSession ForwardUserBatchRequest::requestForSession() const
+{
+    throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Not implemented.");
+}
+
+void ForwardReadIndexRequest::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(session_id, buf);
+    Coordination::read(xid, buf);
+    Coordination::read(opnum, buf);
+}
+
+void ForwardReadIndexRequest::writeImpl(WriteBuffer & buf) const
+{
+    WriteBufferFromOwnString out_buf;
+    Coordination::write(session_id, out_buf);
+    Coordination::write(xid, out_buf);
+    Coordination::write(opnum, out_buf);
+    Coordination::write(out_buf.str(), buf);
+}
+
+ForwardResponsePtr ForwardReadIndexRequest::makeResponse() const
+{
+    auto res = std::make_shared<ForwardReadIndexResponse>();
+    res->session_id = session_id;
+    res->xid = xid;
+    res->opnum = opnum;
+    return res;
+}
+
+RequestForSession ForwardReadIndexRequest::requestForSession() const
+{
+    throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Not implemented.");
+}
+
+void ForwardLoadReportRequest::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(load.fsync_us, buf);
+    Coordination::read(load.cpu_permille, buf);
+    Coordination::read(load.connections, buf);
+}
+
+void ForwardLoadReportRequest::writeImpl(WriteBuffer & buf) const
+{
+    WriteBufferFromOwnString out_buf;
+    Coordination::write(load.fsync_us, out_buf);
+    Coordination::write(load.cpu_permille, out_buf);
+    Coordination::write(load.connections, out_buf);
+    Coordination::write(out_buf.str(), buf);
+}
+
+ForwardResponsePtr ForwardLoadReportRequest::makeResponse() const
+{
+    return std::make_shared<ForwardLoadReportResponse>();
+}
+
+RequestForSession ForwardLoadReportRequest::requestForSession() const
+{
+    throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Not implemented.");
+}
+
+void ForwardFetchLogsRequest::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(start_index, buf);
+    Coordination::read(max_bytes, buf);
+}
+
+void ForwardFetchLogsRequest::writeImpl(WriteBuffer & buf) const
+{
+    WriteBufferFromOwnString out_buf;
+    Coordination::write(start_index, out_buf);
+    Coordination::write(max_bytes, out_buf);
+    Coordination::write(out_buf.str(), buf);
+}
+
+ForwardResponsePtr ForwardFetchLogsRequest::makeResponse() const
+{
+    return std::make_shared<ForwardFetchLogsResponse>();
+}
+
+RequestForSession ForwardFetchLogsRequest::requestForSession() const
+{
+    throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Not implemented.");
+}
+
+void ForwardFetchSnapshotRequest::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(obj_id, buf);
+    String meta;
+    Coordination::read(meta, buf);
+    if (meta.empty())
+    {
+        snapshot = nullptr;
+        return;
+    }
+    auto meta_buf = nuraft::buffer::alloc(meta.size());
+    meta_buf->put_raw(reinterpret_cast<const nuraft::byte *>(meta.data()), meta.size());
+    meta_buf->pos(0);
+    snapshot = nuraft::snapshot::deserialize(*meta_buf);
+}
+
+void ForwardFetchSnapshotRequest::writeImpl(WriteBuffer & buf) const
+{
+    WriteBufferFromOwnString out_buf;
+    Coordination::write(obj_id, out_buf);
+    String meta;
+    if (snapshot)
+    {
+        auto meta_buf = snapshot->serialize();
+        meta.assign(reinterpret_cast<const char *>(meta_buf->data_begin()), meta_buf->size());
+    }
+    Coordination::write(meta, out_buf);
+    Coordination::write(out_buf.str(), buf);
+}
+
+ForwardResponsePtr ForwardFetchSnapshotRequest::makeResponse() const
+{
+    auto res = std::make_shared<ForwardFetchSnapshotResponse>();
+    res->snapshot = snapshot;
+    return res;
+}
+
+RequestForSession ForwardFetchSnapshotRequest::requestForSession() const
+{
+    throw Exception(ErrorCodes::NOT_IMPLEMENTED, "Not implemented.");
+}
+
 ForwardRequestPtr ForwardRequestFactory::get(ForwardType type) const
 {
     auto it = type_to_request.find(type);
@@ -238,6 +550,11 @@ ForwardRequestFactory::ForwardRequestFactory()
     registerForwardRequest<ForwardType::SyncSessions, ForwardSyncSessionsRequest>(*this);
     registerForwardRequest<ForwardType::NewSession, ForwardNewSessionRequest>(*this);
     registerForwardRequest<ForwardType::UpdateSession, ForwardUpdateSessionRequest>(*this);
+    registerForwardRequest<ForwardType::ReadIndex, ForwardReadIndexRequest>(*this);
+    registerForwardRequest<ForwardType::UserBatch, ForwardUserBatchRequest>(*this);
+    registerForwardRequest<ForwardType::LoadReport, ForwardLoadReportRequest>(*this);
+    registerForwardRequest<ForwardType::FetchLogs, ForwardFetchLogsRequest>(*this);
+    registerForwardRequest<ForwardType::FetchSnapshot, ForwardFetchSnapshotRequest>(*this);
 }
 
 ForwardRequestPtr ForwardRequestFactory::convertFromRequest(const RequestForSession & request_for_session)
@@ -3,6 +3,7 @@
 #include <chrono>
 #include <unordered_map>
 #include <Service/KeeperStore.h>
+#include <Service/LeaderBalancer.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 #include <Service/ForwardResponse.h>
 
@@ -28,6 +29,9 @@ struct ForwardRequest
     virtual ForwardResponsePtr makeResponse() const = 0;
     virtual RequestForSession requestForSession() const = 0;
 
+    /// Key to match the response
+    virtual ForwardKey key() const = 0;
+
     virtual String toString() const = 0;
     virtual ~ForwardRequest()= default;
 };
@@ -39,14 +43,17 @@ struct ForwardHandshakeRequest : public ForwardRequest
 {
     int32_t server_id; /// server_id is my id
     int32_t client_id;
+    /// Features asked for, see ForwardFeature. Sent by HandshakeV2 if any, so that older leaders accept it without.
+    uint8_t features = 0;
 
-    inline ForwardType forwardType() const override { return ForwardType::Handshake; }
+    inline ForwardType forwardType() const override { return features ? ForwardType::HandshakeV2 : ForwardType::Handshake; }
 
     void readImpl(ReadBuffer &) override;
     void writeImpl(WriteBuffer &) const override;
 
     ForwardResponsePtr makeResponse() const override;
     RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), server_id, client_id}; }
 
     String toString() const override
     {
@@ -73,6 +80,7 @@ struct ForwardSyncSessionsRequest : public ForwardRequest
 
     ForwardResponsePtr makeResponse() const override;
     RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
 
     String toString() const override
     {
@@ -93,6 +101,7 @@ struct ForwardNewSessionRequest : public ForwardRequest
 
     ForwardResponsePtr makeResponse() const override;
     RequestForSession requestForSession() const override;
+    ForwardKey key() const override;
 
     String toString() const override
     {
@@ -113,6 +122,7 @@ struct ForwardUpdateSessionRequest : public ForwardRequest
 
     ForwardResponsePtr makeResponse() const override;
     RequestForSession requestForSession() const override;
+    ForwardKey key() const override;
 
     String toString() const override
     {
@@ -133,6 +143,7 @@ struct ForwardUserRequest : public ForwardRequest
 
     ForwardResponsePtr makeResponse() const override;
     RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), request.session_id, request.request->xid}; }
 
     String toString() const override
     {
@@ -141,6 +152,142 @@ struct ForwardUserRequest : public ForwardRequest
 };
 
 
+/// Several user requests sent in one packet to save per packet overhead. The packet has no response of its own,
+/// the leader answers every request in it by a ForwardUserRequestResponse, so they are tracked one by one.
+struct ForwardUserBatchRequest : public ForwardRequest
+{
+    /// Batches smaller than it are not worth compressing
+    static constexpr size_t MIN_COMPRESS_SIZE = 1024;
+
+    std::vector<std::shared_ptr<ForwardUserRequest>> requests;
+    /// Whether compression is negotiated by the connection, then the body starts with its codec
+    bool compression = false;
+    /// Whether trace context is negotiated by the connection, then every request is followed by its trace context
+    bool trace_context = false;
+
+    /// Whether a request is sampled for tracing, it is sent by a batch to carry its trace context
+    bool hasSampledRequest() const;
+
+    inline ForwardType forwardType() const override { return ForwardType::UserBatch; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    ForwardResponsePtr makeResponse() const override;
+    RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return fmt::format("#{}#{}", RK::toString(forwardType()), requests.size());
+    }
+};
+
+
+/// Carries the id of a linearizable read, the request itself is kept in the follower.
+struct ForwardReadIndexRequest : public ForwardRequest
+{
+    int64_t session_id;
+    Coordination::XID xid;
+    Coordination::OpNum opnum;
+
+    ForwardReadIndexRequest() = default;
+
+    explicit ForwardReadIndexRequest(const RequestForSession & request_for_session)
+        : session_id(request_for_session.session_id)
+        , xid(request_for_session.request->xid)
+        , opnum(request_for_session.request->getOpNum())
+    {
+    }
+
+    inline ForwardType forwardType() const override { return ForwardType::ReadIndex; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    ForwardResponsePtr makeResponse() const override;
+    RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), session_id, xid}; }
+
+    String toString() const override
+    {
+        return fmt::format("#{}#{}#{}", RK::toString(forwardType()), session_id, xid);
+    }
+};
+
+
+/// Load of the follower for leader balancing, sent only if the leader accepted FORWARD_FEATURE_LOAD_REPORT.
+struct ForwardLoadReportRequest : public ForwardRequest
+{
+    NodeLoad load;
+
+    ForwardLoadReportRequest() = default;
+
+    explicit ForwardLoadReportRequest(const NodeLoad & load_) : load(load_) { }
+
+    inline ForwardType forwardType() const override { return ForwardType::LoadReport; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    ForwardResponsePtr makeResponse() const override;
+    RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return fmt::format(
+            "#{}#{}#{}#{}", RK::toString(forwardType()), load.fsync_us, load.cpu_permille, load.connections);
+    }
+};
+
+
+/// Committed logs from start_index asked for by a cascaded observer, see LogRelay.
+struct ForwardFetchLogsRequest : public ForwardRequest
+{
+    UInt64 start_index{0};
+    /// Bytes of logs answered, at least one entry
+    UInt64 max_bytes{0};
+
+    inline ForwardType forwardType() const override { return ForwardType::FetchLogs; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    ForwardResponsePtr makeResponse() const override;
+    RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return fmt::format("#{}#{}#{}", RK::toString(forwardType()), start_index, max_bytes);
+    }
+};
+
+
+/// Object obj_id of snapshot asked for by a cascaded observer, the first one has no snapshot and gets the latest
+/// snapshot of the upstream, later ones the snapshot of it.
+struct ForwardFetchSnapshotRequest : public ForwardRequest
+{
+    nuraft::ptr<nuraft::snapshot> snapshot;
+    UInt64 obj_id{0};
+
+    inline ForwardType forwardType() const override { return ForwardType::FetchSnapshot; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    ForwardResponsePtr makeResponse() const override;
+    RequestForSession requestForSession() const override;
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return fmt::format("#{}#{}#{}", RK::toString(forwardType()), snapshot ? snapshot->get_last_log_idx() : 0, obj_id);
+    }
+};
+
+
 class ForwardRequestFactory final : private boost::noncopyable
 {
 public:
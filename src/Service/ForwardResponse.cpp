@@ -29,6 +29,18 @@ String toString(ForwardType type)
             return "User";
         case ForwardType::Destroy:
             return "Destroy";
+        case ForwardType::ReadIndex:
+            return "ReadIndex";
+        case ForwardType::UserBatch:
+            return "UserBatch";
+        case ForwardType::HandshakeV2:
+            return "HandshakeV2";
+        case ForwardType::LoadReport:
+            return "LoadReport";
+        case ForwardType::FetchLogs:
+            return "FetchLogs";
+        case ForwardType::FetchSnapshot:
+            return "FetchSnapshot";
         default:
             break;
     }
@@ -46,9 +58,15 @@ void ForwardSyncSessionsResponse::writeImpl(WriteBuffer &) const
 {
 }
 
-bool ForwardSyncSessionsResponse::match(const ForwardRequestPtr & forward_request) const
+void ForwardSyncSessionsResponse::onError(RequestForwarder & forwarder) const
 {
-    return forward_request->forwardType() == forwardType();
+    /// Leader may miss the changed sessions, send all of them next time
+    forwarder.resetSessionSync();
+}
+
+ForwardKey ForwardSyncSessionsResponse::key() const
+{
+    return {forwardType(), 0, 0};
 }
 
 void ForwardNewSessionResponse::readImpl(ReadBuffer & buf)
@@ -73,19 +91,9 @@ void ForwardNewSessionResponse::onError(RequestForwarder & forwarder) const
         Coordination::OpNum::NewSession);
 }
 
-bool ForwardNewSessionResponse::match(const ForwardRequestPtr & forward_request) const
+ForwardKey ForwardNewSessionResponse::key() const
 {
-    auto * session_request = dynamic_cast<ForwardNewSessionRequest *>(forward_request.get());
-    if (session_request)
-    {
-        auto * zk_session_request = dynamic_cast<ZooKeeperNewSessionRequest *>(session_request->request.get());
-        if (zk_session_request)
-        {
-            return zk_session_request->internal_id == internal_id;
-        }
-    }
-
-    return false;
+    return {forwardType(), internal_id, 0};
 }
 
 void ForwardUpdateSessionResponse::readImpl(ReadBuffer & buf)
@@ -110,19 +118,9 @@ void ForwardUpdateSessionResponse::onError(RequestForwarder & forwarder) const
         Coordination::OpNum::UpdateSession);
 }
 
-bool ForwardUpdateSessionResponse::match(const ForwardRequestPtr & forward_request) const
+ForwardKey ForwardUpdateSessionResponse::key() const
 {
-    auto * session_request = dynamic_cast<ForwardUpdateSessionRequest *>(forward_request.get());
-    if (session_request)
-    {
-        auto * zk_session_request = dynamic_cast<ZooKeeperUpdateSessionRequest *>(session_request->request.get());
-        if (zk_session_request)
-        {
-            return zk_session_request->session_id == session_id;
-        }
-    }
-
-    return false;
+    return {forwardType(), session_id, 0};
 }
 
 void ForwardUserRequestResponse::readImpl(ReadBuffer & buf)
@@ -147,16 +145,128 @@ void ForwardUserRequestResponse::onError(RequestForwarder & forwarder) const
     forwarder.request_processor->onError(accepted, static_cast<nuraft::cmd_result_code>(error_code), session_id, xid, opnum);
 }
 
-bool ForwardUserRequestResponse::match(const ForwardRequestPtr & forward_request) const
+ForwardKey ForwardUserRequestResponse::key() const
+{
+    return {forwardType(), session_id, xid};
+}
+
+void ForwardReadIndexResponse::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(accepted, buf);
+    Coordination::read(error_code, buf);
+
+    Coordination::read(session_id, buf);
+    Coordination::read(xid, buf);
+    Coordination::read(opnum, buf);
+    Coordination::read(read_index, buf);
+}
+
+void ForwardReadIndexResponse::writeImpl(WriteBuffer & buf) const
+{
+    Coordination::write(session_id, buf);
+    Coordination::write(xid, buf);
+    Coordination::write(opnum, buf);
+    Coordination::write(read_index, buf);
+}
+
+void ForwardReadIndexResponse::onError(RequestForwarder & forwarder) const
+{
+    forwarder.request_processor->onError(accepted, static_cast<nuraft::cmd_result_code>(error_code), session_id, xid, opnum);
+}
+
+void ForwardReadIndexResponse::onSuccess(RequestForwarder & forwarder) const
+{
+    forwarder.request_processor->onReadIndex(session_id, xid, read_index);
+}
+
+ForwardKey ForwardReadIndexResponse::key() const
 {
-    auto * forward_request_ptr = dynamic_cast<ForwardUserRequest *>(forward_request.get());
-    if (forward_request_ptr)
+    return {forwardType(), session_id, xid};
+}
+
+void ForwardLoadReportResponse::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(accepted, buf);
+    Coordination::read(error_code, buf);
+}
+
+void ForwardLoadReportResponse::writeImpl(WriteBuffer &) const
+{
+}
+
+namespace
+{
+    void writeNuRaftBuffer(const nuraft::ptr<nuraft::buffer> & data, WriteBuffer & buf)
+    {
+        int32_t size = data ? static_cast<int32_t>(data->size()) : -1;
+        Coordination::write(size, buf);
+        if (data)
+            buf.write(reinterpret_cast<const char *>(data->data_begin()), data->size());
+    }
+
+    nuraft::ptr<nuraft::buffer> readNuRaftBuffer(ReadBuffer & buf)
+    {
+        int32_t size;
+        Coordination::read(size, buf);
+        if (size < 0)
+            return nullptr;
+        auto data = nuraft::buffer::alloc(size);
+        buf.readStrict(reinterpret_cast<char *>(data->data_begin()), size);
+        return data;
+    }
+}
+
+void ForwardFetchLogsResponse::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(accepted, buf);
+    Coordination::read(error_code, buf);
+
+    Coordination::read(leader_id, buf);
+    Coordination::read(commit_index, buf);
+    Coordination::read(first_index, buf);
+
+    int32_t count;
+    Coordination::read(count, buf);
+    if (count < 0)
+        throw Exception(ErrorCodes::UNEXPECTED_FORWARD_PACKET, "Unexpected count {} of fetched logs", count);
+    entries.clear();
+    entries.reserve(count);
+    for (int32_t i = 0; i < count; ++i)
     {
-        return forward_request_ptr->request.session_id == session_id && forward_request_ptr->request.request->xid == xid;
+        auto data = readNuRaftBuffer(buf);
+        if (!data)
+            throw Exception(ErrorCodes::UNEXPECTED_FORWARD_PACKET, "Unexpected empty log entry of fetched logs");
+        entries.push_back(nuraft::log_entry::deserialize(*data));
     }
+}
+
+void ForwardFetchLogsResponse::writeImpl(WriteBuffer & buf) const
+{
+    Coordination::write(leader_id, buf);
+    Coordination::write(commit_index, buf);
+    Coordination::write(first_index, buf);
 
-    return false;
+    Coordination::write(static_cast<int32_t>(entries.size()), buf);
+    for (const auto & entry : entries)
+        writeNuRaftBuffer(entry->serialize(), buf);
 }
 
+void ForwardFetchSnapshotResponse::readImpl(ReadBuffer & buf)
+{
+    Coordination::read(accepted, buf);
+    Coordination::read(error_code, buf);
+
+    auto meta = readNuRaftBuffer(buf);
+    snapshot = meta ? nuraft::snapshot::deserialize(*meta) : nullptr;
+    data = readNuRaftBuffer(buf);
+    Coordination::read(is_last, buf);
+}
+
+void ForwardFetchSnapshotResponse::writeImpl(WriteBuffer & buf) const
+{
+    writeNuRaftBuffer(snapshot ? snapshot->serialize() : nullptr, buf);
+    writeNuRaftBuffer(data, buf);
+    Coordination::write(is_last, buf);
+}
 
 }
@@ -3,6 +3,7 @@
 #include <ZooKeeper/ZooKeeperIO.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 #include <libnuraft/async.hxx>
+#include <libnuraft/nuraft.hxx>
 
 namespace RK
 {
@@ -20,10 +21,44 @@ enum class ForwardType : int8_t
     UpdateSession = 4,     /// Update session request when client reconnecting
     User = 5,              /// All write requests after the connection is established
     Destroy = 6,           /// Only used in server side to indicate that the connection is stale and server should close it
+    ReadIndex = 7,         /// Ask leader for read index of a linearizable read
+    UserBatch = 8,         /// Write requests sent in one packet, every one of them is answered by a User response
+    HandshakeV2 = 9,       /// Forwarder handshake negotiating features of the connection, see ForwardFeature
+    LoadReport = 10,       /// Follower will send its load to leader periodically if leader balancing is enabled, see LeaderBalancer
+    FetchLogs = 11,        /// Cascaded observer fetches committed logs from its upstream, see LogRelay
+    FetchSnapshot = 12,    /// Cascaded observer fetches an object of the snapshot of its upstream, see LogRelay
+};
+
+/// Features of a forward connection, a bit mask. The follower asks for them by HandshakeV2 and the leader
+/// answers with the ones it accepts.
+enum ForwardFeature : uint8_t
+{
+    FORWARD_FEATURE_COMPRESSION = 1, /// Large user batches may be compressed
+    FORWARD_FEATURE_TRACE_CONTEXT = 2, /// Requests of user batches carry trace context, see RequestTracer
+    FORWARD_FEATURE_LOAD_REPORT = 4, /// Leader accepts LoadReport
+    FORWARD_FEATURE_USER_BATCH = 8, /// Leader accepts UserBatch, requests are forwarded one by one otherwise
 };
 
 String toString(ForwardType type);
 
+/// Identifies a forward request among the outstanding ones of a connection, a response has the key of its request.
+struct ForwardKey
+{
+    ForwardType type;
+    int64_t id;
+    int64_t xid;
+
+    bool operator==(const ForwardKey & other) const = default;
+};
+
+struct ForwardKeyHash
+{
+    size_t operator()(const ForwardKey & key) const
+    {
+        return hashPair(hashPair(static_cast<UInt64>(key.id), static_cast<UInt64>(key.xid)), static_cast<UInt64>(key.type));
+    }
+};
+
 
 struct ForwardResponse
 {
@@ -44,7 +79,10 @@ struct ForwardResponse
     virtual void writeImpl(WriteBuffer &) const = 0;
 
     virtual void onError(RequestForwarder & request_forwarder) const = 0;
-    virtual bool match(const ForwardRequestPtr & forward_request) const = 0;
+    /// Invoked when the response is accepted
+    virtual void onSuccess(RequestForwarder &) const { }
+    /// Key of the request of the response
+    virtual ForwardKey key() const = 0;
 
     void setAppendEntryResult(bool raft_accept, nuraft::cmd_result_code code)
     {
@@ -61,17 +99,27 @@ using ForwardResponsePtr = std::shared_ptr<ForwardResponse>;
 
 struct ForwardHandshakeResponse : public ForwardResponse
 {
-    ForwardType forwardType() const override { return ForwardType::Handshake; }
+    /// Answer of HandshakeV2, which has accepted features
+    bool with_features = false;
+    uint8_t features = 0;
+
+    ForwardType forwardType() const override { return with_features ? ForwardType::HandshakeV2 : ForwardType::Handshake; }
 
     void readImpl(ReadBuffer & buf) override
     {
         Coordination::read(accepted, buf);
         Coordination::read(error_code, buf);
+        if (with_features)
+            Coordination::read(features, buf);
     }
 
-    void writeImpl(WriteBuffer &) const override {}
+    void writeImpl(WriteBuffer & buf) const override
+    {
+        if (with_features)
+            Coordination::write(features, buf);
+    }
     void onError(RequestForwarder &) const override {}
-    bool match(const ForwardRequestPtr &) const override { return false; }
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
 
     String toString() const override
     {
@@ -87,8 +135,8 @@ struct ForwardSyncSessionsResponse : public ForwardResponse
     void readImpl(ReadBuffer &) override;
     void writeImpl(WriteBuffer &) const override;
 
-    void onError(RequestForwarder &) const override {}
-    bool match(const ForwardRequestPtr & forward_request) const override;
+    void onError(RequestForwarder & forwarder) const override;
+    ForwardKey key() const override;
 
     String toString() const override
     {
@@ -108,7 +156,7 @@ struct ForwardNewSessionResponse : public ForwardResponse
     void writeImpl(WriteBuffer &) const override;
 
     void onError(RequestForwarder & request_forwarder) const override;
-    bool match(const ForwardRequestPtr & forward_request) const override;
+    ForwardKey key() const override;
 
     String toString() const override
     {
@@ -127,7 +175,7 @@ struct ForwardUpdateSessionResponse : public ForwardResponse
     void writeImpl(WriteBuffer &) const override;
 
     void onError(RequestForwarder & forwarder) const override;
-    bool match(const ForwardRequestPtr & forward_request) const override;
+    ForwardKey key() const override;
 
     String toString() const override
     {
@@ -148,7 +196,7 @@ struct ForwardUserRequestResponse : public ForwardResponse
     void writeImpl(WriteBuffer &) const override;
 
     void onError(RequestForwarder & forwarder) const override;
-    bool match(const ForwardRequestPtr & forward_request) const override;
+    ForwardKey key() const override;
 
     String toString() const override
     {
@@ -158,6 +206,97 @@ struct ForwardUserRequestResponse : public ForwardResponse
     }
 };
 
+struct ForwardReadIndexResponse : public ForwardResponse
+{
+    int64_t session_id;
+    int64_t xid;
+    Coordination::OpNum opnum;
+    UInt64 read_index{0};
+
+    ForwardType forwardType() const override { return ForwardType::ReadIndex; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    void onError(RequestForwarder & forwarder) const override;
+    void onSuccess(RequestForwarder & forwarder) const override;
+    ForwardKey key() const override;
+
+    String toString() const override
+    {
+        return "ForwardType: " + RK::toString(forwardType()) + ", accepted " + std::to_string(accepted) + " error_code "
+            + std::to_string(error_code) + " session " + std::to_string(session_id) + " xid " + std::to_string(xid) + " read_index "
+            + std::to_string(read_index);
+    }
+};
+
+struct ForwardLoadReportResponse : public ForwardResponse
+{
+    ForwardType forwardType() const override { return ForwardType::LoadReport; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    void onError(RequestForwarder &) const override { }
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return "ForwardType: " + RK::toString(forwardType()) + ", accepted " + std::to_string(accepted) + " error_code "
+            + std::to_string(error_code);
+    }
+};
+
+/// Committed logs from the start index asked for, none if the upstream has compacted them or not committed it yet.
+struct ForwardFetchLogsResponse : public ForwardResponse
+{
+    /// Leader known by the upstream, -1 if none
+    int32_t leader_id{-1};
+    /// Last log index the upstream has committed
+    UInt64 commit_index{0};
+    /// First log index the upstream keeps, a start index before it has to be caught up by the snapshot
+    UInt64 first_index{0};
+    std::vector<nuraft::ptr<nuraft::log_entry>> entries;
+
+    ForwardType forwardType() const override { return ForwardType::FetchLogs; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    void onError(RequestForwarder &) const override { }
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return "ForwardType: " + RK::toString(forwardType()) + ", accepted " + std::to_string(accepted) + " error_code "
+            + std::to_string(error_code) + " leader " + std::to_string(leader_id) + " commit_index " + std::to_string(commit_index)
+            + " entries " + std::to_string(entries.size());
+    }
+};
+
+/// Object of a snapshot, as read_logical_snp_obj of the upstream reads. Not accepted if the snapshot is removed.
+struct ForwardFetchSnapshotResponse : public ForwardResponse
+{
+    nuraft::ptr<nuraft::snapshot> snapshot;
+    nuraft::ptr<nuraft::buffer> data;
+    bool is_last{false};
+
+    ForwardType forwardType() const override { return ForwardType::FetchSnapshot; }
+
+    void readImpl(ReadBuffer &) override;
+    void writeImpl(WriteBuffer &) const override;
+
+    void onError(RequestForwarder &) const override { }
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
+
+    String toString() const override
+    {
+        return "ForwardType: " + RK::toString(forwardType()) + ", accepted " + std::to_string(accepted) + " error_code "
+            + std::to_string(error_code) + " snapshot " + std::to_string(snapshot ? snapshot->get_last_log_idx() : 0) + " is_last "
+            + std::to_string(is_last);
+    }
+};
+
 struct ForwardDestroyResponse : public ForwardResponse
 {
     ForwardType forwardType() const override { return ForwardType::Destroy; }
@@ -170,7 +309,7 @@ struct ForwardDestroyResponse : public ForwardResponse
 
     void writeImpl(WriteBuffer &) const override {}
     void onError(RequestForwarder &) const override {}
-    bool match(const ForwardRequestPtr &) const override { return false; }
+    ForwardKey key() const override { return {forwardType(), 0, 0}; }
 
     String toString() const override
     {
@@ -12,7 +12,17 @@
 #include <Common/config_version.h>
 #include <Common/getCurrentProcessFDCount.h>
 #include <Common/getMaxFileDescriptorCount.h>
+#include <Common/CpuProfiler.h>
+#include <Common/HugePages.h>
+#include <Common/MemoryStatisticsOS.h>
+#include <Common/ProfiledMutex.h>
+#include <Service/HotSpotTracker.h>
 #include <Service/Metrics.h>
+#include <Service/NodeData.h>
+#include <Service/OpCostMetrics.h>
+#include <Service/RequestStageMetrics.h>
+#include <Service/RequestCapture.h>
+#include <Service/SlowRequestLog.h>
 
 #include <unistd.h>
 
@@ -48,6 +58,13 @@ int32_t IFourLetterCommand::toCode(const String & name)
 
 IFourLetterCommand::~IFourLetterCommand() = default;
 
+String IFourLetterCommand::collectStream()
+{
+    String result;
+    stream([&result](String && chunk) { result += chunk; });
+    return result;
+}
+
 FourLetterCommandFactory & FourLetterCommandFactory::instance()
 {
     static FourLetterCommandFactory factory;
@@ -136,6 +153,9 @@ void FourLetterCommandFactory::registerCommands(KeeperDispatcher & keeper_dispat
         FourLetterCommandPtr create_snapshot_command = std::make_shared<CreateSnapshotCommand>(keeper_dispatcher);
         factory.registerCommand(create_snapshot_command);
 
+        FourLetterCommandPtr snapshot_stat_command = std::make_shared<SnapshotStatCommand>(keeper_dispatcher);
+        factory.registerCommand(snapshot_stat_command);
+
         FourLetterCommandPtr log_info_command = std::make_shared<LogInfoCommand>(keeper_dispatcher);
         factory.registerCommand(log_info_command);
 
@@ -145,7 +165,28 @@ void FourLetterCommandFactory::registerCommands(KeeperDispatcher & keeper_dispat
         FourLetterCommandPtr uptime_command = std::make_shared<UpTimeCommand>(keeper_dispatcher);
         factory.registerCommand(uptime_command);
 
+        FourLetterCommandPtr hot_spots_command = std::make_shared<HotSpotsCommand>(keeper_dispatcher);
+        factory.registerCommand(hot_spots_command);
+
+        FourLetterCommandPtr slow_requests_command = std::make_shared<SlowRequestsCommand>(keeper_dispatcher);
+        factory.registerCommand(slow_requests_command);
+
+        FourLetterCommandPtr lock_contention_command = std::make_shared<LockContentionCommand>(keeper_dispatcher);
+        factory.registerCommand(lock_contention_command);
+
+        FourLetterCommandPtr cpu_profile_command = std::make_shared<CpuProfileCommand>(keeper_dispatcher);
+        factory.registerCommand(cpu_profile_command);
+
+        FourLetterCommandPtr start_capture_command = std::make_shared<StartCaptureCommand>(keeper_dispatcher);
+        factory.registerCommand(start_capture_command);
+
+        FourLetterCommandPtr stop_capture_command = std::make_shared<StopCaptureCommand>(keeper_dispatcher);
+        factory.registerCommand(stop_capture_command);
+
         factory.initializeWhiteList(keeper_dispatcher);
+
+        size_t threads = static_cast<size_t>(keeper_dispatcher.getKeeperConfigurationAndSettings()->four_letter_word_threads);
+        factory.command_executor = std::make_unique<ThreadPool>(threads, threads, MAX_QUEUED_COMMANDS);
         factory.setInitialize(true);
     }
 }
@@ -250,6 +291,11 @@ String MonitorCommand::run()
 
     print(ret, "num_alive_connections", keeper_info.alive_connections_count);
     print(ret, "outstanding_requests", keeper_info.outstanding_requests_count);
+    print(ret, "expired_sessions", keeper_info.expired_sessions_count);
+    print(ret, "closing_sessions", keeper_info.closing_sessions_count);
+    print(ret, "memory_limit_state", keeper_info.memory_limit_state);
+    print(ret, "memory_rejected_requests", keeper_info.memory_rejected_requests);
+    print(ret, "read_only_sessions", keeper_info.read_only_sessions_count);
 
     print(ret, "server_state", keeper_info.getRole());
     print(ret, "is_leader", keeper_info.is_leader);
@@ -259,6 +305,27 @@ String MonitorCommand::run()
     print(ret, "ephemerals_count", state_machine.getTotalEphemeralNodesCount());
     print(ret, "approximate_data_size", state_machine.getApproximateDataSize());
     print(ret, "in_snapshot", state_machine.getSnapshoting());
+    if (state_machine.getStore().isDigestEnabled())
+    {
+        print(ret, "nodes_digest", state_machine.getStore().getNodesDigest());
+        print(ret, "digest_mismatches", state_machine.getStore().getDigestMismatches());
+    }
+
+    auto memory_usage = keeper_dispatcher.getMemoryUsage();
+    for (const auto & [component, bytes] : memory_usage.items())
+        print(ret, fmt::format("memory_{}_bytes", component), bytes);
+    print(ret, "memory_total_bytes", memory_usage.total());
+#if defined(OS_LINUX)
+    /// Which the components do not add up to is of NuRaft, caches of the allocator and fragmentation
+    static MemoryStatisticsOS memory_statistics;
+    print(ret, "memory_resident_bytes", memory_statistics.get().resident);
+#endif
+    print(ret, "data_tree_huge_pages_hits", HugePages::hits());
+    print(ret, "data_tree_huge_pages_misses", HugePages::misses());
+    print(ret, "large_values_mapped_bytes", LargeValueStore::instance().getMappedBytes());
+    print(ret, "large_values_segments", LargeValueStore::instance().getSegmentsCount());
+    print(ret, "interned_values_count", NodeDataInterner::instance().getValuesCount());
+    print(ret, "interned_values_bytes", NodeDataInterner::instance().getValuesBytes());
 
 #if defined(__linux__) || defined(__APPLE__)
     print(ret, "open_file_descriptor_count", getCurrentProcessFDCount());
@@ -271,6 +338,9 @@ String MonitorCommand::run()
         print(ret, "synced_followers", keeper_info.synced_follower_count);
     }
 
+    for (const auto & [key, value] : OpCostMetrics::instance().getAverages())
+        print(ret, key, value);
+
     for (auto && [_, values] : Metrics::getMetrics().dumpMetricsValues())
     {
         for (auto && line : values)
@@ -287,6 +357,12 @@ String StatResetCommand::run()
 {
     keeper_dispatcher.resetConnectionStats();
     Metrics::getMetrics().reset();
+    RequestStageMetrics::instance().reset();
+    OpCostMetrics::instance().reset();
+    HotSpotTracker::instance().reset();
+    SlowRequestLog::instance().reset();
+    LockProfiler::instance().reset();
+    CpuProfiler::instance().reset();
     return "Server stats reset.\n";
 }
 
@@ -302,11 +378,9 @@ String ConfCommand::run()
     return buf.str();
 }
 
-String ConsCommand::run()
+void ConsCommand::stream(const DumpOutput & output)
 {
-    StringBuffer buf;
-    ConnectionHandler::dumpConnections(buf, false);
-    return buf.str();
+    ConnectionHandler::dumpConnections(output, false);
 }
 
 String RestConnStatsCommand::run()
@@ -359,7 +433,7 @@ String StatCommand::run()
     write("RaftKeeper version", VERSION_FULL);
 
     buf << "Clients:\n";
-    ConnectionHandler::dumpConnections(buf, true);
+    ConnectionHandler::dumpConnections([&buf](String && chunk) { buf << chunk; }, true);
     buf << '\n';
 
     StringBuffer latency;
@@ -387,20 +461,14 @@ String BriefWatchCommand::run()
     return buf.str();
 }
 
-String WatchCommand::run()
+void WatchCommand::stream(const DumpOutput & output)
 {
-    StringBuffer buf;
-    const auto & state_machine = keeper_dispatcher.getStateMachine();
-    state_machine.dumpWatches(buf);
-    return buf.str();
+    keeper_dispatcher.getStateMachine().dumpWatches(output);
 }
 
-String WatchByPathCommand::run()
+void WatchByPathCommand::stream(const DumpOutput & output)
 {
-    StringBuffer buf;
-    const auto & state_machine = keeper_dispatcher.getStateMachine();
-    state_machine.dumpWatchesByPath(buf);
-    return buf.str();
+    keeper_dispatcher.getStateMachine().dumpWatchesByPath(output);
 }
 
 String DataSizeCommand::run()
@@ -411,12 +479,9 @@ String DataSizeCommand::run()
     return buf.str();
 }
 
-String DumpCommand::run()
+void DumpCommand::stream(const DumpOutput & output)
 {
-    StringBuffer buf;
-    const auto & state_machine = keeper_dispatcher.getStateMachine();
-    state_machine.dumpSessionsAndEphemerals(buf);
-    return buf.str();
+    keeper_dispatcher.getStateMachine().dumpSessionsAndEphemerals(output);
 }
 
 String EnviCommand::run()
@@ -452,7 +517,7 @@ String EnviCommand::run()
 
 String IsReadOnlyCommand::run()
 {
-    if (keeper_dispatcher.isObserver())
+    if (keeper_dispatcher.isObserver() || keeper_dispatcher.acceptsReadOnlySession())
         return "ro";
     else
         return "rw";
@@ -464,6 +529,25 @@ String CreateSnapshotCommand::run()
     return log_index > 0 ? std::to_string(log_index) : "Failed to schedule snapshot creation task.";
 }
 
+String SnapshotStatCommand::run()
+{
+    auto & metrics = Metrics::getMetrics();
+    StringBuffer ret;
+    writeText(metrics.snapshot_progress.dump(), ret);
+
+    for (auto && [name, values] : metrics.dumpMetricsValues())
+    {
+        if (!name.starts_with("snap_"))
+            continue;
+        for (auto && line : values)
+        {
+            writeText(line, ret);
+            writeText("\n", ret);
+        }
+    }
+    return ret.str();
+}
+
 String LogInfoCommand::run()
 {
     KeeperLogInfo log_info = keeper_dispatcher.getKeeperLogInfo();
@@ -497,4 +581,107 @@ String UpTimeCommand::run()
     return std::to_string(keeper_dispatcher.uptimeFromStartup() / 1000 / 1000);
 }
 
+String HotSpotsCommand::run()
+{
+    auto & tracker = HotSpotTracker::instance();
+    if (!tracker.isEnabled())
+        return "Hot spot tracking is disabled.\n";
+
+    auto report = tracker.getReport(LIMIT);
+    StringBuffer ret;
+    writeText(fmt::format("window_seconds\t{:.1f}\n", report.window_seconds), ret);
+
+    auto append = [&ret](const char * type, const std::vector<HotSpotTracker::Item> & items)
+    {
+        for (const auto & item : items)
+            writeText(fmt::format("{}\t{}\t{:.1f}\n", type, item.key, item.rate), ret);
+    };
+    append("read", report.reads);
+    append("write", report.writes);
+    append("session", report.sessions);
+    return ret.str();
+}
+
+String SlowRequestsCommand::run()
+{
+    auto & slow_log = SlowRequestLog::instance();
+    if (!slow_log.isEnabled())
+        return "Slow request log is disabled.\n";
+
+    StringBuffer ret;
+    for (const auto & record : slow_log.getRecords())
+        writeText(SlowRequestLog::format(record) + "\n", ret);
+    return ret.str();
+}
+
+String LockContentionCommand::run()
+{
+    if (!LockProfiler::isEnabled())
+        return "Lock profiling is disabled.\n";
+
+    auto report = LockProfiler::instance().getReport();
+    if (report.size() > LIMIT)
+        report.resize(LIMIT);
+
+    StringBuffer ret;
+    writeText("name\tinstances\tacquisitions\tcontentions\twait_us\tmax_wait_us\thold_us\tmax_hold_us\n", ret);
+    for (const auto & item : report)
+        writeText(
+            fmt::format(
+                "{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}\n",
+                item.name,
+                item.instances,
+                item.acquisitions,
+                item.contentions,
+                item.wait_us,
+                item.max_wait_us,
+                item.hold_us,
+                item.max_hold_us),
+            ret);
+    return ret.str();
+}
+
+String CpuProfileCommand::run()
+{
+    if (!CpuProfiler::instance().isEnabled())
+        return "Cpu profiler is disabled.\n";
+    return CpuProfiler::instance().getFoldedStacks();
+}
+
+namespace
+{
+
+String captureStatus()
+{
+    auto status = RequestCapture::instance().getStatus();
+    return fmt::format(
+        "capturing\t{}\nfile\t{}\nrecords\t{}\nbytes\t{}\ndropped\t{}\n",
+        static_cast<int>(status.capturing),
+        status.file,
+        status.records,
+        status.bytes,
+        status.dropped);
+}
+
+}
+
+String StartCaptureCommand::run()
+{
+    try
+    {
+        RequestCapture::instance().start();
+    }
+    catch (...)
+    {
+        return "Failed to start capture: " + getCurrentExceptionMessage(false) + "\n";
+    }
+    return captureStatus();
+}
+
+String StopCaptureCommand::run()
+{
+    RequestCapture::instance().stop();
+    return captureStatus();
+}
+
 }
@@ -25,6 +25,9 @@ public:
 
     virtual String name() = 0;
     virtual String run() = 0;
+    /// Run and pass output by chunks as it is produced, so that sending a large output starts before all of it is
+    /// collected. By default the output of run is passed at once.
+    virtual void stream(const DumpOutput & output) { output(run()); }
 
     virtual ~IFourLetterCommand();
     int32_t code();
@@ -33,6 +36,9 @@ public:
     static inline int32_t toCode(const String & name);
 
 protected:
+    /// Output of stream as a whole, run of streaming commands
+    String collectStream();
+
     KeeperDispatcher & keeper_dispatcher;
 };
 
@@ -61,10 +67,17 @@ public:
     static FourLetterCommandFactory & instance();
     static void registerCommands(KeeperDispatcher & keeper_dispatcher);
 
+    /// Commands are run by it rather than IO threads, output of some of them is large.
+    ThreadPool & executor() { return *command_executor; }
+
 private:
+    /// Commands waiting for a thread, more are rejected
+    static constexpr size_t MAX_QUEUED_COMMANDS = 128;
+
     std::atomic<bool> initialized = false;
     Commands commands;
     WhiteList white_list;
+    std::unique_ptr<ThreadPool> command_executor;
 };
 
 /**Tests if server is running in a non-error state. The server will respond with imok if it is running.
@@ -99,6 +112,8 @@ struct RuokCommand : public IFourLetterCommand
  * zk_watch_count  0
  * zk_ephemerals_count 0
  * zk_approximate_data_size    27
+ * zk_memory_data_tree_bytes   1376   - also watches, sessions, acl_map, log_entry_queue, pipeline_queues,
+ *                                      connection_buffers, snapshot and total
  * zk_open_file_descriptor_count 23    - only available on Unix platforms
  * zk_max_file_descriptor_count 1024   - only available on Unix platforms
  * zk_followers 2                      - only exposed by the Leader
@@ -165,7 +180,8 @@ struct ConsCommand : public IFourLetterCommand
     }
 
     String name() override { return "cons"; }
-    String run() override;
+    String run() override { return collectStream(); }
+    void stream(const DumpOutput & output) override;
     ~ConsCommand() override = default;
 };
 
@@ -232,7 +248,8 @@ struct WatchCommand : public IFourLetterCommand
     }
 
     String name() override { return "wchc"; }
-    String run() override;
+    String run() override { return collectStream(); }
+    void stream(const DumpOutput & output) override;
     ~WatchCommand() override = default;
 };
 
@@ -247,7 +264,8 @@ struct WatchByPathCommand : public IFourLetterCommand
     }
 
     String name() override { return "wchp"; }
-    String run() override;
+    String run() override { return collectStream(); }
+    void stream(const DumpOutput & output) override;
     ~WatchByPathCommand() override = default;
 };
 
@@ -260,7 +278,8 @@ struct DumpCommand : public IFourLetterCommand
     }
 
     String name() override { return "dump"; }
-    String run() override;
+    String run() override { return collectStream(); }
+    void stream(const DumpOutput & output) override;
     ~DumpCommand() override = default;
 };
 
@@ -317,6 +336,28 @@ struct CreateSnapshotCommand : public IFourLetterCommand
     ~CreateSnapshotCommand() override = default;
 };
 
+/** Progress of the snapshot being created or loaded and snapshot metrics:
+ *     phase    load_parse
+ *     phase_elapsed_ms 1520
+ *     objects  12
+ *     objects_total    40
+ *     ...
+ *     last_load_verify_ms  830
+ *     zk_avg_snap_load_parse_time_ms   0.0
+ *     ...
+ */
+struct SnapshotStatCommand : public IFourLetterCommand
+{
+    explicit SnapshotStatCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "snps"; }
+    String run() override;
+    ~SnapshotStatCommand() override = default;
+};
+
 /** Raft log information:
  *     first_log_idx 1
  *     first_log_term   1
@@ -365,4 +406,108 @@ struct UpTimeCommand : public IFourLetterCommand
     ~UpTimeCommand() override = default;
 };
 
+/** Hottest paths by read and write rate and sessions sending the most requests, rates are per second:
+ *     window_seconds   60.0
+ *     read     /clickhouse/tables/t1/log   1520.3
+ *     write    /clickhouse/tables/t1/log   210.7
+ *     session  0x100000a2f3   980.0
+ */
+struct HotSpotsCommand : public IFourLetterCommand
+{
+    explicit HotSpotsCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "hots"; }
+    String run() override;
+    ~HotSpotsCommand() override = default;
+
+    static constexpr size_t LIMIT = 20;
+};
+
+/** Requests recorded by the slow request log, oldest first. Columns are time, session, xid, opnum, path, request and
+ *  response bytes, error, latency in microseconds and microseconds of stages passed:
+ *     2026-10-14 10:21:03.128  0x100000a2f3  12  Create  /a  43  21  Ok  1204311  io=8,dispatch_queue=3,...
+ */
+struct SlowRequestsCommand : public IFourLetterCommand
+{
+    explicit SlowRequestsCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "slow"; }
+    String run() override;
+    ~SlowRequestsCommand() override = default;
+};
+
+/** Profiled mutexes by wait time, most contended first. Mutexes of the same name, like shards, are summed, times are in
+ *  microseconds:
+ *     name  instances  acquisitions  contentions  wait_us  max_wait_us  hold_us  max_hold_us
+ *     watch_mutex  1  10452311  23011  812330  1502  4011233  880
+ */
+struct LockContentionCommand : public IFourLetterCommand
+{
+    explicit LockContentionCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "lock"; }
+    String run() override;
+    ~LockContentionCommand() override = default;
+
+    static constexpr size_t LIMIT = 20;
+};
+
+/** Folded stacks sampled by the cpu profiler since start or the last srst, one line per stack starting with the thread
+ *  class and ending with the number of samples, most sampled first. Pipe it to flamegraph.pl for a flame graph:
+ *     processor;start_thread;RK::RequestProcessor::run();RK::KeeperStore::processRequest(...) 1203
+ */
+struct CpuProfileCommand : public IFourLetterCommand
+{
+    explicit CpuProfileCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "prof"; }
+    String run() override;
+    ~CpuProfileCommand() override = default;
+};
+
+/** Start capturing requests of clients to a new file of keeper.capture.dir, see RequestCapture. Shows the status of
+ *  capture, like cpof:
+ *     capturing    1
+ *     file    /var/lib/raftkeeper/capture/capture_1791966063128.bin
+ *     records    1520
+ *     bytes    98211
+ *     dropped    0
+ */
+struct StartCaptureCommand : public IFourLetterCommand
+{
+    explicit StartCaptureCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "cpon"; }
+    String run() override;
+    ~StartCaptureCommand() override = default;
+};
+
+/// Stop capturing requests and show the status of capture
+struct StopCaptureCommand : public IFourLetterCommand
+{
+    explicit StopCaptureCommand(KeeperDispatcher & keeper_dispatcher_)
+        : IFourLetterCommand(keeper_dispatcher_)
+    {
+    }
+
+    String name() override { return "cpof"; }
+    String run() override;
+    ~StopCaptureCommand() override = default;
+};
+
 }
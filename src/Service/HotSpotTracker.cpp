@@ -0,0 +1,130 @@
+#include <Service/HotSpotTracker.h>
+
+#include <Common/CoarseClock.h>
+#include <Service/formatHex.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+namespace
+{
+
+UInt64 nowMilliseconds()
+{
+    return CoarseClock::monotonicMilliseconds();
+}
+
+}
+
+HotSpotTracker & HotSpotTracker::instance()
+{
+    static HotSpotTracker tracker;
+    return tracker;
+}
+
+void HotSpotTracker::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    initialize(
+        config.getBool("keeper.hot_spots.enabled", true),
+        config.getUInt64("keeper.hot_spots.capacity", DEFAULT_CAPACITY),
+        config.getUInt64("keeper.hot_spots.sample_rate", DEFAULT_SAMPLE_RATE),
+        config.getUInt64("keeper.hot_spots.window_ms", DEFAULT_WINDOW_MS));
+
+    if (isEnabled())
+        LOG_INFO(
+            &Poco::Logger::get("HotSpotTracker"),
+            "Tracking hot spots of one of {} requests by windows of {}ms",
+            sample_rate.load(),
+            window_ms);
+}
+
+void HotSpotTracker::initialize(bool enabled_, size_t capacity_, UInt64 sample_rate_, UInt64 window_ms_)
+{
+    std::lock_guard lock(mutex);
+    sample_rate.store(std::max(sample_rate_, UInt64(1)), std::memory_order_relaxed);
+    window_ms = std::max(window_ms_, UInt64(1));
+    window_start_ms = nowMilliseconds();
+    current = std::make_unique<Window>(capacity_);
+    previous = std::make_unique<Window>(capacity_);
+    has_previous = false;
+    enabled.store(enabled_, std::memory_order_relaxed);
+}
+
+void HotSpotTracker::record(const RequestForSession & request_for_session)
+{
+    if (!enabled.load(std::memory_order_relaxed))
+        return;
+
+    static thread_local UInt64 requests = 0;
+    if (++requests % sample_rate.load(std::memory_order_relaxed) != 0)
+        return;
+
+    const auto & request = request_for_session.request;
+    std::lock_guard lock(mutex);
+    rotate(nowMilliseconds());
+
+    if (request->isReadRequest())
+        current->reads.insert(request->getPath());
+    else
+        current->writes.insert(request->getPath());
+    current->sessions.insert(request_for_session.session_id);
+}
+
+void HotSpotTracker::rotate(UInt64 now_ms)
+{
+    if (now_ms - window_start_ms < window_ms)
+        return;
+
+    /// No request in a whole window, nothing is hot
+    has_previous = now_ms - window_start_ms < 2 * window_ms;
+    std::swap(current, previous);
+    current->clear();
+    if (!has_previous)
+        previous->clear();
+    window_start_ms = now_ms;
+}
+
+HotSpotTracker::Report HotSpotTracker::getReport(size_t limit)
+{
+    Report report;
+    std::lock_guard lock(mutex);
+    if (!current)
+        return report;
+
+    UInt64 now_ms = nowMilliseconds();
+    rotate(now_ms);
+
+    const Window & window = has_previous ? *previous : *current;
+    UInt64 window_duration_ms = has_previous ? window_ms : std::max(now_ms - window_start_ms, UInt64(1));
+    report.window_seconds = static_cast<double>(window_duration_ms) / 1000;
+
+    double scale = static_cast<double>(sample_rate.load(std::memory_order_relaxed)) / report.window_seconds;
+    auto to_items = [&](const auto & sketch, auto && key_to_string)
+    {
+        std::vector<Item> items;
+        for (const auto & counter : sketch.top(limit))
+            items.push_back(Item{
+                key_to_string(counter.key), static_cast<double>(counter.count) * scale, static_cast<double>(counter.error) * scale});
+        return items;
+    };
+
+    auto path = [](const String & key) { return key; };
+    report.reads = to_items(window.reads, path);
+    report.writes = to_items(window.writes, path);
+    report.sessions = to_items(window.sessions, [](int64_t session_id) { return toHexString(session_id); });
+    return report;
+}
+
+void HotSpotTracker::reset()
+{
+    std::lock_guard lock(mutex);
+    if (!current)
+        return;
+    current->clear();
+    previous->clear();
+    has_previous = false;
+    window_start_ms = nowMilliseconds();
+}
+
+}
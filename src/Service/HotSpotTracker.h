@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <Common/SpaceSaving.h>
+#include <Service/KeeperCommon.h>
+
+namespace RK
+{
+
+/** Tracks the hottest paths by read and write rate and the sessions sending the most requests, so that the source of a
+  * load spike can be found. One of sample_rate requests of a thread is counted by Space-Saving sketches of capacity keys,
+  * overhead is a counter increment for the others. Rates are of the last complete window of window_ms, or of the
+  * current window until there is one.
+  *
+  * Configured by keeper.hot_spots.{enabled, capacity, sample_rate, window_ms}, enabled by default.
+  */
+class HotSpotTracker
+{
+public:
+    static HotSpotTracker & instance();
+
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+    void initialize(bool enabled_, size_t capacity_, UInt64 sample_rate_, UInt64 window_ms_);
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    /// Invoked for data requests by KeeperStore
+    void record(const RequestForSession & request_for_session);
+
+    struct Item
+    {
+        String key;
+        /// Requests per second, it overestimates by at most error_rate
+        double rate;
+        double error_rate;
+    };
+
+    struct Report
+    {
+        std::vector<Item> reads;
+        std::vector<Item> writes;
+        std::vector<Item> sessions;
+        double window_seconds = 0;
+    };
+
+    /// At most limit items of each
+    Report getReport(size_t limit);
+
+    void reset();
+
+    static constexpr size_t DEFAULT_CAPACITY = 64;
+    static constexpr UInt64 DEFAULT_SAMPLE_RATE = 16;
+    static constexpr UInt64 DEFAULT_WINDOW_MS = 60000;
+
+private:
+    struct Window
+    {
+        explicit Window(size_t capacity) : reads(capacity), writes(capacity), sessions(capacity) { }
+
+        void clear()
+        {
+            reads.clear();
+            writes.clear();
+            sessions.clear();
+        }
+
+        SpaceSaving<String> reads;
+        SpaceSaving<String> writes;
+        SpaceSaving<int64_t> sessions;
+    };
+
+    HotSpotTracker() = default;
+
+    /// Moves current window to previous if it is over, under mutex
+    void rotate(UInt64 now_ms);
+
+    std::atomic<bool> enabled{false};
+    std::atomic<UInt64> sample_rate{DEFAULT_SAMPLE_RATE};
+
+    std::mutex mutex;
+    UInt64 window_ms = DEFAULT_WINDOW_MS;
+    UInt64 window_start_ms = 0;
+    std::unique_ptr<Window> current;
+    std::unique_ptr<Window> previous;
+    bool has_previous = false;
+};
+
+}
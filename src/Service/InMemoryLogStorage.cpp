@@ -0,0 +1,90 @@
+#include <Service/InMemoryLogStorage.h>
+
+#include <algorithm>
+#include <mutex>
+
+#include <Service/NuRaftLogSegment.h>
+
+namespace RK
+{
+
+UInt64 InMemoryLogStorage::appendEntry(ptr<log_entry> entry, bool /* deferred */)
+{
+    std::lock_guard lock(mutex);
+    log_bytes.fetch_add(entryBytes(entry), std::memory_order_relaxed);
+    entries.push_back(std::move(entry));
+    UInt64 index = last_log_index.load(std::memory_order_relaxed) + 1;
+    last_log_index.store(index, std::memory_order_release);
+    return index;
+}
+
+UInt64 InMemoryLogStorage::writeAt(UInt64 index, ptr<log_entry> entry)
+{
+    {
+        std::lock_guard lock(mutex);
+        UInt64 first = first_log_index.load(std::memory_order_relaxed);
+        UInt64 last = last_log_index.load(std::memory_order_relaxed);
+        if (index < first || index > last + 1)
+            return -1;
+
+        for (UInt64 i = last; i >= index; --i)
+        {
+            log_bytes.fetch_sub(entryBytes(entries.back()), std::memory_order_relaxed);
+            entries.pop_back();
+        }
+        last_log_index.store(index - 1, std::memory_order_release);
+    }
+    return appendEntry(std::move(entry), false);
+}
+
+ptr<log_entry> InMemoryLogStorage::getEntry(UInt64 index)
+{
+    std::shared_lock lock(mutex);
+    UInt64 first = first_log_index.load(std::memory_order_relaxed);
+    if (index < first || index > last_log_index.load(std::memory_order_relaxed))
+        return nullptr;
+    return entries[index - first];
+}
+
+void InMemoryLogStorage::getEntriesExt(
+    UInt64 start_index, UInt64 end_index, int64 batch_size_hint_in_bytes, ptr<std::vector<ptr<log_entry>>> & res)
+{
+    std::shared_lock lock(mutex);
+    UInt64 first = first_log_index.load(std::memory_order_relaxed);
+    if (start_index < first)
+        return;
+    end_index = std::min(end_index, last_log_index.load(std::memory_order_relaxed));
+
+    int64 read_bytes = 0;
+    for (UInt64 index = start_index; index <= end_index; ++index)
+    {
+        const auto & entry = entries[index - first];
+        int64 entry_size = NuRaftLogSegment::getBatchSize(entry);
+        if (batch_size_hint_in_bytes > 0 && read_bytes + entry_size > batch_size_hint_in_bytes && !res->empty())
+            return;
+        res->push_back(entry);
+        read_bytes += entry_size;
+    }
+}
+
+int InMemoryLogStorage::removeSegment(UInt64 first_index_kept)
+{
+    std::lock_guard lock(mutex);
+    UInt64 first = first_log_index.load(std::memory_order_relaxed);
+    if (first >= first_index_kept)
+        return 0;
+
+    for (; first < first_index_kept && !entries.empty(); ++first)
+    {
+        log_bytes.fetch_sub(entryBytes(entries.front()), std::memory_order_relaxed);
+        entries.pop_front();
+    }
+
+    /// After the last entry, for example a snapshot from leader is installed
+    first_log_index.store(first_index_kept, std::memory_order_release);
+    if (entries.empty())
+        last_log_index.store(first_index_kept - 1, std::memory_order_release);
+    return 0;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <shared_mutex>
+
+#include <Service/LogStorage.h>
+
+namespace RK
+{
+
+/** Log storage keeping entries only in memory, so that appending and flushing cost no I/O. Logs are lost when the
+  * process exits, it is for benchmarks of the layers above storage and for tests, not for production.
+  */
+class InMemoryLogStorage : public ILogStorage
+{
+public:
+    UInt64 firstLogIndex() const override { return first_log_index.load(std::memory_order_acquire); }
+    UInt64 lastLogIndex() const override { return last_log_index.load(std::memory_order_acquire); }
+
+    UInt64 appendEntry(ptr<log_entry> entry, bool deferred) override;
+
+    /// Entries are durable as soon as they are appended
+    UInt64 flush() override { return lastLogIndex(); }
+
+    UInt64 writeAt(UInt64 index, ptr<log_entry> entry) override;
+    ptr<log_entry> getEntry(UInt64 index) override;
+
+    void getEntriesExt(
+        UInt64 start_index, UInt64 end_index, int64 batch_size_hint_in_bytes, ptr<std::vector<ptr<log_entry>>> & entries) override;
+
+    /// Entries are kept as appended, which is the current format
+    LogVersion getVersion(UInt64 /* index */) override { return CURRENT_LOG_VERSION; }
+
+    int removeSegment(UInt64 first_index_kept) override;
+
+    UInt64 getLogBytes() const override { return log_bytes.load(std::memory_order_relaxed); }
+
+private:
+    static UInt64 entryBytes(const ptr<log_entry> & entry) { return entry->get_buf().size(); }
+
+    mutable std::shared_mutex mutex;
+    /// Entries in [first_log_index, last_log_index], guarded by mutex
+    std::deque<ptr<log_entry>> entries;
+
+    /// Written with mutex
+    std::atomic<UInt64> first_log_index{1};
+    std::atomic<UInt64> last_log_index{0};
+    std::atomic<UInt64> log_bytes{0};
+};
+
+}
@@ -17,6 +17,7 @@ struct Keeper4LWInfo
 {
     bool is_leader;
     bool is_observer;
+    bool is_witness = false;
     bool is_follower;
     bool is_standalone;
 
@@ -25,6 +26,17 @@ struct Keeper4LWInfo
     uint64_t alive_connections_count;
     uint64_t outstanding_requests_count;
 
+    /// Sessions found dead by leader and the ones of them whose close requests are not applied yet
+    uint64_t expired_sessions_count = 0;
+    uint64_t closing_sessions_count = 0;
+
+    /// MemoryLimitState, 0 is normal, 1 soft limit reached and 2 hard limit reached, and writes rejected for memory
+    uint64_t memory_limit_state = 0;
+    uint64_t memory_rejected_requests = 0;
+
+    /// Sessions accepted in read only mode while there is no leader
+    uint64_t read_only_sessions_count = 0;
+
     uint64_t follower_count;
     uint64_t synced_follower_count;
 
@@ -39,6 +51,8 @@ struct Keeper4LWInfo
             return "leader";
         if (is_observer)
             return "observer";
+        if (is_witness)
+            return "witness";
         if (is_follower)
             return "follower";
 
@@ -20,6 +20,13 @@ RequestId ErrorRequest::getRequestId() const
     return {session_id, xid};
 }
 
+Coordination::Error ErrorRequest::getResponseError() const
+{
+    if (response_error != Coordination::Error::ZOK)
+        return response_error;
+    return error_code == nuraft::cmd_result_code::TIMEOUT ? Coordination::Error::ZOPERATIONTIMEOUT : Coordination::Error::ZCONNECTIONLOSS;
+}
+
 String RequestId::toString() const
 {
     return fmt::format("#{}#{}", toHexString(session_id), xid);
@@ -32,14 +39,7 @@ bool RequestId::operator==(const RequestId & other) const
 
 std::size_t RequestId::RequestIdHash::operator()(const RequestId & request_id) const
 {
-    std::size_t seed = 0;
-    std::hash<int64_t> hash64;
-    std::hash<int32_t> hash32;
-
-    seed ^= hash64(request_id.session_id);
-    seed ^= hash32(request_id.xid);
-
-    return seed;
+    return hashPair(static_cast<UInt64>(request_id.session_id), static_cast<UInt64>(request_id.xid));
 }
 
 String RequestForSession::toString() const
@@ -69,7 +69,7 @@ RequestId RequestForSession::getRequestId() const
 bool isSessionRequest(Coordination::OpNum opnum)
 {
     return opnum == Coordination::OpNum::NewSession || opnum == Coordination::OpNum::OldNewSession
-        || opnum == Coordination::OpNum::UpdateSession;
+        || opnum == Coordination::OpNum::UpdateSession || opnum == Coordination::OpNum::NewSessions;
 }
 
 bool isSessionRequest(const Coordination::ZooKeeperRequestPtr & request)
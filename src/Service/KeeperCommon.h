@@ -1,5 +1,8 @@
 #pragma once
 
+#include <functional>
+
+#include <Common/HashFunctions.h>
 #include <Common/ThreadPool.h>
 #include <libnuraft/nuraft.hxx>
 
@@ -12,6 +15,11 @@ namespace RK
 using RunnerId = size_t;
 using ThreadPoolPtr = std::shared_ptr<ThreadPool>;
 
+/// Receives the output of a dump chunk by chunk. Structures are dumped by DUMP_CHUNK_SIZE entries and their locks are
+/// released between chunks and while output is written, so a large dump does not block others for all the time.
+using DumpOutput = std::function<void(String &&)>;
+static constexpr size_t DUMP_CHUNK_SIZE = 1000;
+
 #ifdef COMPATIBLE_MODE_ZOOKEEPER
     const String ZOOKEEPER_SYSTEM_PATH = "/zookeeper";
     const String ZOOKEEPER_CONFIG_NODE = ZOOKEEPER_SYSTEM_PATH + "/config";
@@ -29,9 +37,22 @@ using ThreadPoolPtr = std::shared_ptr<ThreadPool>;
     inline constexpr auto CURRENT_KEEPER_API_VERSION = KeeperApiVersion::WITH_MULTI_READ;
 #endif
 
+/// Path with its pre-computed hash which is same with StringHash, so it can be used
+/// to look up maps keyed by path without hashing it again. Note that it does not own the path,
+/// which may be a part of another one, like the parent of a path, so looking it up allocates nothing.
+struct HashedPath
+{
+    std::string_view path;
+    size_t hash;
+
+    explicit HashedPath(std::string_view path_) : path(path_), hash(StringHash()(path_)) { }
+    HashedPath(std::string_view path_, size_t hash_) : path(path_), hash(hash_) { }
+};
+
 struct RequestId;
 
-/// Attached session id to request
+/// Attached session id to request. It is moved through the queues of the pipeline, so that the request is not
+/// copied and its reference counter is not touched by every hop.
 struct RequestForSession
 {
     int64_t session_id;
@@ -44,13 +65,19 @@ struct RequestForSession
     int32_t server_id{-1};
     int32_t client_id{-1};
 
-    //    /// RaftKeeper can generate request, for example: sessionCleanerTask
-    //    bool is_internal{false};
+    /// Raft log index, only set for committed requests
+    UInt64 log_idx{0};
+
+    /// Session of a client connected in read only mode, which accepts reads of any staleness
+    bool allow_stale_read{false};
+
+    /// Session created by a node without leader in read only mode, it is known only by the node and not by Raft
+    bool read_only_session{false};
 
     explicit RequestForSession() = default;
 
     RequestForSession(Coordination::ZooKeeperRequestPtr request_, int64_t session_id_, int64_t create_time_)
-        : session_id(session_id_), request(request_), create_time(create_time_)
+        : session_id(session_id_), request(std::move(request_)), create_time(create_time_)
     {
     }
 
@@ -61,13 +88,32 @@ struct RequestForSession
     String toSimpleString() const;
 };
 
+/// A cell of the queues is at most one cache line
+static_assert(sizeof(RequestForSession) <= 64);
+
 using RequestsForSessions = std::vector<RequestForSession>;
 
+/// Sessions a triggered watch event is sent to
+using Watchers = std::vector<int64_t>;
+using WatchersPtr = std::shared_ptr<const Watchers>;
+
 /// Attached session id to response
 struct ResponseForSession
 {
-    int64_t session_id;
+    int64_t session_id{};
     Coordination::ZooKeeperResponsePtr response;
+
+    /// If set, the response is a watch event for all these sessions, session_id is one of them and is used
+    /// for sharding. The event is fanned out to the connections by the response thread, so that the thread
+    /// committing requests does not pay for the number of watchers.
+    WatchersPtr watchers;
+
+    ResponseForSession() = default;
+
+    ResponseForSession(int64_t session_id_, Coordination::ZooKeeperResponsePtr response_, WatchersPtr watchers_ = nullptr)
+        : session_id(session_id_), response(std::move(response_)), watchers(std::move(watchers_))
+    {
+    }
 };
 
 using ResponsesForSessions = std::vector<ResponseForSession>;
@@ -95,9 +141,13 @@ struct ErrorRequest
     int64_t session_id; /// For new session request, this is internal_id, for there is no session_id right now.
     Coordination::XID xid;
     Coordination::OpNum opnum;
+    /// Error of the response if the request is rejected by the node itself rather than NuRaft
+    Coordination::Error response_error = Coordination::Error::ZOK;
 
     String toString() const;
     RequestId getRequestId() const;
+    /// Error sent to client
+    Coordination::Error getResponseError() const;
 };
 
 using ErrorRequests = std::list<ErrorRequest>;
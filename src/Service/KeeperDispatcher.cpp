@@ -1,12 +1,24 @@
 #include <Poco/NumberFormatter.h>
 
+#include <Common/BusyPoll.h>
+#include <Common/CoarseClock.h>
+#include <Common/CpuProfiler.h>
 #include <Common/checkStackSize.h>
 #include <Common/setThreadName.h>
+#include <common/scope_guard.h>
 
 #include <Service/KeeperDispatcher.h>
+#include <Service/ConnectionHandler.h>
 #include <Service/WriteBufferFromFiFoBuffer.h>
 #include <Service/formatHex.h>
+#include <Service/HotSpotTracker.h>
+#include <Service/LatencyInjection.h>
+#include <Service/OpCostMetrics.h>
+#include <Service/RequestCapture.h>
+#include <Service/RequestTracer.h>
+#include <Service/SlowRequestLog.h>
 #include <Service/Metrics.h>
+#include <Service/ThreadPlacement.h>
 
 namespace RK
 {
@@ -32,6 +44,7 @@ KeeperDispatcher::KeeperDispatcher()
 void KeeperDispatcher::requestThread(RunnerId runner_id)
 {
     setThreadName(("ReqDspchr#" + std::to_string(runner_id)).c_str());
+    ThreadPlacement::instance().apply(ThreadClass::REQUEST_DISPATCHER);
 
     /// Requests from previous iteration. We store them to be able
     /// to send errors to the client.
@@ -48,8 +61,17 @@ void KeeperDispatcher::requestThread(RunnerId runner_id)
             if (shutdown_called)
                 break;
 
+            request_for_session.request->timeline.end(RequestStage::DISPATCH_QUEUE);
+
             try
             {
+                if (unlikely(request_for_session.read_only_session)
+                    && !request_processor->isReadRequest(request_for_session.request))
+                {
+                    processReadOnlySessionRequest(request_for_session);
+                    continue;
+                }
+
                 if (unlikely(isSessionRequest(request_for_session.request)
                              || request_for_session.request->getOpNum() == Coordination::OpNum::Auth))
                 {
@@ -61,23 +83,45 @@ void KeeperDispatcher::requestThread(RunnerId runner_id)
                     request_processor->push(request_for_session);
                 }
                 /// we should skip close requests from clear session task
-                else if (!request_for_session.isForwardRequest() && request_for_session.request->getOpNum() != Coordination::OpNum::Close)
+                else if (
+                    !request_for_session.isForwardRequest() && request_for_session.request->getOpNum() != Coordination::OpNum::Close
+                    && request_for_session.request->getOpNum() != Coordination::OpNum::CloseSessions)
                 {
                     LOG_WARNING(log, "Not local session {}", toHexString(request_for_session.session_id));
                 }
 
-                if (!request_for_session.request->isReadRequest() && server->isLeaderAlive())
+                if (request_processor->isReadRequest(request_for_session.request))
+                {
+                    /// Heartbeat does not read data
+                    if (configuration_and_settings->raft_settings->linearizable_read
+                        && request_for_session.request->getOpNum() != Coordination::OpNum::Heartbeat
+                        && !request_for_session.read_only_session && isLocalSession(request_for_session.session_id))
+                        requestReadIndex(request_for_session);
+                }
+                else if (memory_limiter->shouldReject(*request_for_session.request) && isLocalSession(request_for_session.session_id))
+                {
+                    LOG_DEBUG(log, "Reject {} for memory reaches hard limit", request_for_session.toSimpleString());
+                    memory_rejected_requests++;
+                    request_processor->onError(
+                        false,
+                        nuraft::cmd_result_code::FAILED,
+                        request_for_session.session_id,
+                        request_for_session.request->xid,
+                        request_for_session.request->getOpNum(),
+                        Coordination::Error::ZTHROTTLEDOP);
+                }
+                else if (server->isLeaderAlive())
                 {
                     LOG_TRACE(log, "Leader is {}", server->getLeader());
 
                     if (server->isLeader())
-                        request_accumulator.push(request_for_session);
+                        request_accumulator.push(std::move(request_for_session));
                     else
-                        request_forwarder.push(request_for_session);
+                        request_forwarder.push(std::move(request_for_session));
                 }
-                else if (!request_for_session.request->isReadRequest() && !server->isLeaderAlive())
+                else
                 {
-                    request_accumulator.push(request_for_session);
+                    request_accumulator.push(std::move(request_for_session));
                 }
             }
             catch (...)
@@ -88,31 +132,140 @@ void KeeperDispatcher::requestThread(RunnerId runner_id)
     }
 }
 
-void KeeperDispatcher::responseThread()
+void KeeperDispatcher::processReadOnlySessionRequest(const RequestForSession & request_for_session)
+{
+    const auto & request = request_for_session.request;
+    auto session_id = request_for_session.session_id;
+
+    if (request->getOpNum() == Coordination::OpNum::Auth)
+    {
+        /// Auth of a read only session is not written to log, it is lost when the session is closed
+        server->getKeeperStateMachine()->getStore().processRequest(responses_queue, request_for_session);
+    }
+    else if (request->getOpNum() == Coordination::OpNum::Close)
+    {
+        LOG_DEBUG(log, "Close read only session {}", toHexString(session_id));
+        auto response = std::make_shared<Coordination::ZooKeeperCloseResponse>();
+        response->xid = request->xid;
+        response->zxid = getStateMachine().getLastProcessedZxid();
+        responses_queue.push(ResponseForSession{session_id, response});
+    }
+    else
+    {
+        LOG_DEBUG(log, "Reject {} of read only session", request_for_session.toSimpleString());
+        request_processor->push(request_for_session);
+        request_processor->onError(
+            false,
+            nuraft::cmd_result_code::FAILED,
+            session_id,
+            request->xid,
+            request->getOpNum(),
+            Coordination::Error::ZNOTREADONLY);
+    }
+}
+
+void KeeperDispatcher::requestReadIndex(const RequestForSession & request_for_session)
+{
+    if (server->isLeader())
+    {
+        if (auto read_index = server->getReadIndex())
+            request_processor->onReadIndex(request_for_session.session_id, request_for_session.request->xid, *read_index);
+        else
+            request_processor->onError(
+                false,
+                nuraft::cmd_result_code::NOT_LEADER,
+                request_for_session.session_id,
+                request_for_session.request->xid,
+                request_for_session.request->getOpNum());
+    }
+    else if (server->isLeaderAlive())
+    {
+        request_forwarder.push(request_for_session);
+    }
+    else
+    {
+        request_processor->onError(
+            false,
+            nuraft::cmd_result_code::FAILED,
+            request_for_session.session_id,
+            request_for_session.request->xid,
+            request_for_session.request->getOpNum());
+    }
+}
+
+bool KeeperDispatcher::isSaturated()
+{
+    if (!admission_controller || !admission_controller->enabled())
+        return false;
+
+    UInt64 pending_requests = requests_queue->size() + request_processor->commitQueueSize();
+    return admission_controller->update(pending_requests, server->getCommitLag());
+}
+
+void KeeperDispatcher::responseThread(size_t shard)
 {
-    setThreadName("RspDispatcher");
+    setThreadName(("RspDspchr#" + std::to_string(shard)).c_str());
+    ThreadPlacement::instance().apply(ThreadClass::RESPONSE_DISPATCHER);
+
+    /// Flush many responses with one wakeup
+    static constexpr size_t MAX_BATCH_SIZE = 1024;
 
-    ResponseForSession response_for_session;
+    ResponsesForSessions responses;
+    responses.reserve(MAX_BATCH_SIZE);
     UInt64 max_wait = configuration_and_settings->raft_settings->operation_timeout_ms;
 
     while (!shutdown_called)
     {
-        if (responses_queue.tryPop(response_for_session, std::min(max_wait, static_cast<UInt64>(1000))))
+        if (responses_queue.tryPopBatch(shard, responses, MAX_BATCH_SIZE, std::min(max_wait, static_cast<UInt64>(1000))))
         {
             if (shutdown_called)
                 break;
 
-            try
+            invokeResponseCallBacks(responses);
+            /// ZooKeeperResponsePtr should reset here to avoid destruction in responses_queue.tryPopBatch()
+            /// See details in https://github.com/JDRaftKeeper/RaftKeeper/issues/290
+            responses.clear();
+        }
+    }
+}
+
+void KeeperDispatcher::invokeResponseCallBacks(const ResponsesForSessions & responses)
+{
+    std::shared_lock read_lock(response_callbacks_mutex);
+    for (const auto & [session_id, response, watchers] : responses)
+    {
+        try
+        {
+            /// Watch event triggered for many sessions
+            if (watchers)
             {
-                invokeResponseCallBack(response_for_session.session_id, response_for_session.response);
-                /// ZooKeeperResponsePtr should reset here to avoid destruction in responses_queue.tryPop()
-                /// See details in https://github.com/JDRaftKeeper/RaftKeeper/issues/290
-                response_for_session.response.reset();
+                for (auto watcher : *watchers)
+                {
+                    auto session_writer = user_response_callbacks.find(watcher);
+                    if (session_writer != user_response_callbacks.end())
+                        session_writer->second(response);
+                }
+                continue;
             }
-            catch (...)
+
+            /// Session and close responses modify callbacks
+            if (unlikely(
+                    isSessionRequest(response->getOpNum())
+                    || (response->xid != Coordination::WATCH_XID && response->getOpNum() == Coordination::OpNum::Close)))
             {
-                tryLogCurrentException(__PRETTY_FUNCTION__);
+                read_lock.unlock();
+                SCOPE_EXIT({ read_lock.lock(); });
+                invokeResponseCallBack(session_id, response);
+                continue;
             }
+
+            auto session_writer = user_response_callbacks.find(session_id);
+            if (session_writer != user_response_callbacks.end())
+                session_writer->second(response);
+        }
+        catch (...)
+        {
+            tryLogCurrentException(__PRETTY_FUNCTION__);
         }
     }
 }
@@ -123,7 +276,7 @@ void KeeperDispatcher::invokeResponseCallBack(int64_t session_id, const Coordina
     if (unlikely(isSessionRequest(response->getOpNum())))
     {
         /// We should use write-lock here for the callback will modify session_response_callbacks
-        std::unique_lock<std::shared_mutex> write_lock(response_callbacks_mutex);
+        std::unique_lock write_lock(response_callbacks_mutex);
         auto session_writer = session_response_callbacks.find(session_id); /// TODO session id == internal id?
         if (session_writer == session_response_callbacks.end())
             return;
@@ -132,7 +285,7 @@ void KeeperDispatcher::invokeResponseCallBack(int64_t session_id, const Coordina
     /// user request
     else
     {
-        std::shared_lock<std::shared_mutex> read_lock(response_callbacks_mutex);
+        std::shared_lock read_lock(response_callbacks_mutex);
         auto session_writer = user_response_callbacks.find(session_id);
         if (session_writer == user_response_callbacks.end())
             return;
@@ -166,8 +319,7 @@ bool KeeperDispatcher::pushSessionRequest(const Coordination::ZooKeeperRequestPt
     request_info.request = request;
     request_info.session_id = internal_id;
 
-    using namespace std::chrono;
-    request_info.create_time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    request_info.create_time = getCurrentTimeMilliseconds();
 
     LOG_TRACE(
         log,
@@ -183,19 +335,21 @@ bool KeeperDispatcher::pushSessionRequest(const Coordination::ZooKeeperRequestPt
 
 bool KeeperDispatcher::pushRequest(const Coordination::ZooKeeperRequestPtr & request, int64_t session_id)
 {
+    bool read_only_session;
     {
-        std::shared_lock<std::shared_mutex> read_lock(response_callbacks_mutex);
+        std::shared_lock read_lock(response_callbacks_mutex);
         /// session is expired by server
         if (user_response_callbacks.count(session_id) == 0)
             return false;
+        read_only_session = read_only_sessions.contains(session_id);
     }
 
     RequestForSession request_info;
     request_info.request = request;
     request_info.session_id = session_id;
+    request_info.read_only_session = read_only_session;
 
-    using namespace std::chrono;
-    request_info.create_time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    request_info.create_time = getCurrentTimeMilliseconds();
 
     LOG_TRACE(log, "Push user request #{}#{}#{}", toHexString(session_id), request->xid, Coordination::toString(request->getOpNum()));
     /// Put close requests without timeouts
@@ -211,13 +365,52 @@ bool KeeperDispatcher::pushRequest(const Coordination::ZooKeeperRequestPtr & req
     return true;
 }
 
+bool KeeperDispatcher::pushRequests(
+    const std::vector<Coordination::ZooKeeperRequestPtr> & requests, int64_t session_id, bool allow_stale_read)
+{
+    if (requests.empty())
+        return true;
+
+    bool read_only_session;
+    {
+        std::shared_lock read_lock(response_callbacks_mutex);
+        /// session is expired by server
+        if (user_response_callbacks.count(session_id) == 0)
+            return false;
+        read_only_session = read_only_sessions.contains(session_id);
+    }
+
+    int64_t now = getCurrentTimeMilliseconds();
+
+    std::vector<RequestForSession> requests_info(requests.size());
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        requests_info[i].request = requests[i];
+        requests_info[i].session_id = session_id;
+        requests_info[i].create_time = now;
+        requests_info[i].allow_stale_read = allow_stale_read;
+        requests_info[i].read_only_session = read_only_session;
+        LOG_TRACE(
+            log, "Push user request #{}#{}#{}", toHexString(session_id), requests[i]->xid, Coordination::toString(requests[i]->getOpNum()));
+    }
+
+    Stopwatch watch;
+    size_t pushed = requests_queue->tryPushBatch(requests_info, configuration_and_settings->raft_settings->operation_timeout_ms);
+    if (pushed < requests.size())
+        throw Exception(
+            ErrorCodes::TIMEOUT_EXCEEDED,
+            "Cannot push request to queue within operation timeout, {} of {} requests pushed",
+            pushed,
+            requests.size());
+    Metrics::getMetrics().push_request_queue_time_ms->add(watch.elapsedMilliseconds());
+    return true;
+}
 
 bool KeeperDispatcher::pushForwardRequest(size_t server_id, size_t client_id, ForwardRequestPtr request)
 {
     RequestForSession && request_info = request->requestForSession();
 
-    using namespace std::chrono;
-    request_info.create_time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+    request_info.create_time = getCurrentTimeMilliseconds();
 
     request_info.server_id = server_id;
     request_info.client_id = client_id;
@@ -246,14 +439,51 @@ void KeeperDispatcher::initialize(const Poco::Util::AbstractConfiguration & conf
 {
     LOG_INFO(log, "Initializing dispatcher");
     configuration_and_settings = Settings::loadFromConfig(config, true);
+    ThreadPlacement::instance().initialize(config);
+    LatencyInjection::instance().initialize(config);
+    CoarseClock::instance().initialize(
+        config.getBool("keeper.coarse_clock.enabled", true)
+            ? config.getUInt64("keeper.coarse_clock.resolution_ms", CoarseClock::DEFAULT_RESOLUTION_MS)
+            : 0);
+    CpuProfiler::instance().initialize(
+        config.getBool("keeper.cpu_profiler.enabled", true),
+        config.getUInt64("keeper.cpu_profiler.frequency", CpuProfiler::DEFAULT_FREQUENCY),
+        config.getUInt64("keeper.cpu_profiler.max_stacks", CpuProfiler::DEFAULT_MAX_STACKS));
+    HotSpotTracker::instance().initialize(config);
+    OpCostMetrics::instance().initialize(config);
+    RequestTracer::instance().initialize(config, configuration_and_settings->my_id);
+    SlowRequestLog::instance().initialize(config);
+    RequestCapture::instance().initialize(config);
+    LockProfiler::setEnabled(config.getBool("keeper.lock_profiling.enabled", true));
+    BusyPoll::setBudget(configuration_and_settings->busy_poll_us);
 
     size_t parallel = configuration_and_settings->parallel;
+    bool least_loaded_placement = configuration_and_settings->runner_placement == "least_loaded";
     UInt64 operation_timeout_ms = configuration_and_settings->raft_settings->operation_timeout_ms;
 
+    /// Every response thread consumes a shard
+    responses_queue.resize(configuration_and_settings->response_threads);
+
     server = std::make_shared<KeeperServer>(configuration_and_settings, config, responses_queue, request_processor);
     new_session_internal_id_counter = server->myId();
     /// Raft server needs to be able to handle commit when startup.
-    request_processor->initialize(parallel, server, shared_from_this(), operation_timeout_ms);
+    request_processor->initialize(
+        parallel,
+        server,
+        shared_from_this(),
+        operation_timeout_ms,
+        configuration_and_settings->raft_settings->parallel_read,
+        configuration_and_settings->raft_settings->parallel_apply,
+        configuration_and_settings->raft_settings->linearizable_read,
+        configuration_and_settings->raft_settings->observer_max_staleness_ms,
+        configuration_and_settings->raft_settings->max_read_lag_entries,
+        configuration_and_settings->raft_settings->max_read_lag_ms,
+        configuration_and_settings->raft_settings->redirect_stale_reads,
+        configuration_and_settings->raft_settings->seen_zxid_wait_ms,
+        configuration_and_settings->requests_queue_capacity,
+        configuration_and_settings->committed_queue_capacity,
+        least_loaded_placement,
+        configuration_and_settings->fair_queue_quantum);
 
     try
     {
@@ -271,22 +501,57 @@ void KeeperDispatcher::initialize(const Poco::Util::AbstractConfiguration & conf
     }
 
     UInt64 session_sync_period_ms = configuration_and_settings->raft_settings->dead_session_check_period_ms * 2;
-    request_forwarder.initialize(parallel, server, shared_from_this(), session_sync_period_ms, operation_timeout_ms);
-    request_accumulator.initialize(shared_from_this(), server, operation_timeout_ms, configuration_and_settings->raft_settings->max_batch_size);
-    requests_queue = std::make_shared<RequestsQueue>(parallel, 20000);
+    request_forwarder.initialize(
+        parallel,
+        server,
+        shared_from_this(),
+        session_sync_period_ms,
+        operation_timeout_ms,
+        configuration_and_settings->raft_settings->forward_compression,
+        configuration_and_settings->requests_queue_capacity,
+        least_loaded_placement);
+    request_accumulator.initialize(
+        shared_from_this(),
+        server,
+        operation_timeout_ms,
+        configuration_and_settings->raft_settings->max_batch_size,
+        configuration_and_settings->raft_settings->adaptive_batching,
+        configuration_and_settings->raft_settings->target_replication_latency_ms,
+        configuration_and_settings->raft_settings->max_inflight_batches);
+    requests_queue = std::make_shared<RequestsQueue>(
+        parallel,
+        configuration_and_settings->requests_queue_capacity,
+        configuration_and_settings->control_requests_weight,
+        least_loaded_placement);
+    pipeline_settings = configuration_and_settings;
+    admission_controller = std::make_unique<AdmissionController>(
+        configuration_and_settings->raft_settings->max_pending_requests, configuration_and_settings->raft_settings->max_commit_lag);
+    memory_limiter = std::make_unique<MemoryLimiter>(
+        configuration_and_settings->raft_settings->memory_soft_limit, configuration_and_settings->raft_settings->memory_hard_limit);
 
     request_thread = std::make_shared<ThreadPool>(parallel);
-    responses_thread = std::make_shared<ThreadPool>(1);
+    responses_thread = std::make_shared<ThreadPool>(configuration_and_settings->response_threads);
 
     for (size_t i = 0; i < parallel; i++)
     {
         request_thread->trySchedule([this, i] { requestThread(i); });
     }
-    responses_thread->trySchedule([this] { responseThread(); });
+    for (size_t shard = 0; shard < responses_queue.getShardNum(); shard++)
+    {
+        responses_thread->trySchedule([this, shard] { responseThread(shard); });
+    }
 
     session_cleaner_thread = ThreadFromGlobalPool([this] { deadSessionCleanThread(); });
     update_configuration_thread = ThreadFromGlobalPool([this] { updateConfigurationThread(); });
 
+    if (configuration_and_settings->raft_settings->auto_leader_balance)
+    {
+        UInt64 interval_ms = configuration_and_settings->raft_settings->leader_balance_interval_ms;
+        leader_balancer = std::make_unique<LeaderBalancer>(
+            configuration_and_settings->raft_settings->leader_balance_margin_percent, interval_ms * 2);
+        leader_balance_thread = ThreadFromGlobalPool([this] { leaderBalanceThread(); });
+    }
+
     updateConfiguration(config);
     LOG_INFO(log, "Dispatcher initialized");
 }
@@ -312,6 +577,9 @@ void KeeperDispatcher::shutdown()
             if (session_cleaner_thread.joinable())
                 session_cleaner_thread.join();
 
+            if (leader_balance_thread.joinable())
+                leader_balance_thread.join();
+
             LOG_INFO(log, "Shutting down request_thread");
             if (request_thread)
                 request_thread->wait();
@@ -338,9 +606,15 @@ void KeeperDispatcher::shutdown()
             response->error = Coordination::Error::ZSESSIONEXPIRED;
             invokeResponseCallBack(request_for_session.session_id, response);
         }
-        std::unique_lock<std::shared_mutex> write_lock(response_callbacks_mutex);
+        std::unique_lock write_lock(response_callbacks_mutex);
         user_response_callbacks.clear();
         session_response_callbacks.clear();
+
+        /// Spans of answered requests are exported
+        RequestTracer::instance().shutdown();
+        RequestCapture::instance().shutdown();
+        CpuProfiler::instance().shutdown();
+        CoarseClock::instance().shutdown();
     }
     catch (...)
     {
@@ -353,14 +627,14 @@ void KeeperDispatcher::shutdown()
 void KeeperDispatcher::registerSessionResponseCallback(int64_t id, ZooKeeperResponseCallback callback)
 {
     LOG_DEBUG(log, "Register session response callback {}", toHexString(id));
-    std::unique_lock<std::shared_mutex> write_lock(response_callbacks_mutex);
+    std::unique_lock write_lock(response_callbacks_mutex);
     if (!session_response_callbacks.try_emplace(id, callback).second)
         throw Exception(RK::ErrorCodes::LOGICAL_ERROR, "Session response callback with id {} has already registered", toHexString(id));
 }
 
 void KeeperDispatcher::unRegisterSessionResponseCallback(int64_t id)
 {
-    std::unique_lock<std::shared_mutex> write_lock(response_callbacks_mutex);
+    std::unique_lock write_lock(response_callbacks_mutex);
     unRegisterSessionResponseCallbackWithoutLock(id);
 }
 
@@ -374,7 +648,7 @@ void KeeperDispatcher::unRegisterSessionResponseCallbackWithoutLock(int64_t id)
 
 [[maybe_unused]] void KeeperDispatcher::registerUserResponseCallBack(int64_t session_id, ZooKeeperResponseCallback callback, bool is_reconnected)
 {
-    std::unique_lock<std::shared_mutex> write_lock(response_callbacks_mutex);
+    std::unique_lock write_lock(response_callbacks_mutex);
     registerUserResponseCallBackWithoutLock(session_id, callback, is_reconnected);
 }
 
@@ -385,11 +659,12 @@ void KeeperDispatcher::registerUserResponseCallBackWithoutLock(int64_t session_i
 
     if (!user_response_callbacks.try_emplace(session_id, callback).second && !is_reconnected)
         throw Exception(RK::ErrorCodes::LOGICAL_ERROR, "Session with id {} already registered in dispatcher", toHexString(session_id));
+    server->getKeeperStateMachine()->getStore().addLocalSession(session_id);
 }
 
 void KeeperDispatcher::unregisterUserResponseCallBack(int64_t session_id)
 {
-    std::unique_lock<std::shared_mutex> write_lock(response_callbacks_mutex);
+    std::unique_lock write_lock(response_callbacks_mutex);
     unregisterUserResponseCallBackWithoutLock(session_id);
 }
 
@@ -398,7 +673,70 @@ void KeeperDispatcher::unregisterUserResponseCallBackWithoutLock(int64_t session
     LOG_DEBUG(log, "Unregister user response callback {}", toHexString(session_id));
     auto it = user_response_callbacks.find(session_id);
     if (it != user_response_callbacks.end())
+    {
         user_response_callbacks.erase(it);
+        server->getKeeperStateMachine()->getStore().removeLocalSession(session_id);
+        if (read_only_sessions.erase(session_id))
+        {
+            server->getKeeperStateMachine()->getStore().closeReadOnlySession(session_id);
+            /// Close of it does not go through Raft log
+            request_processor->eraseSeenZxid(session_id);
+        }
+    }
+}
+
+bool KeeperDispatcher::acceptsReadOnlySession() const
+{
+    return configuration_and_settings->raft_settings->read_only_mode && !hasLeader() && !isWitness();
+}
+
+bool KeeperDispatcher::acceptsSeenZxidAhead() const
+{
+    return configuration_and_settings->raft_settings->seen_zxid_wait_ms != 0;
+}
+
+void KeeperDispatcher::waitForSeenZxid(int64_t session_id, int64_t zxid)
+{
+    if (zxid > server->getKeeperStateMachine()->getLastProcessedZxid())
+        request_processor->waitForSeenZxid(session_id, zxid);
+}
+
+int64_t KeeperDispatcher::registerReadOnlySession(ZooKeeperResponseCallback callback)
+{
+    /// Out of the range of session ids generated by Raft, and differ between nodes
+    static constexpr int64_t READ_ONLY_SESSION_FLAG = int64_t(1) << 62;
+
+    const auto & store = server->getKeeperStateMachine()->getStore();
+    int64_t session_id;
+    do
+        session_id = READ_ONLY_SESSION_FLAG | (static_cast<int64_t>(myId() & 0xff) << 48) | ++read_only_session_counter;
+    while (store.containsSession(session_id));
+
+    std::unique_lock write_lock(response_callbacks_mutex);
+    registerUserResponseCallBackWithoutLock(session_id, callback);
+    read_only_sessions.insert(session_id);
+    LOG_INFO(log, "Created read only session {}", toHexString(session_id));
+    return session_id;
+}
+
+void KeeperDispatcher::closeReadOnlySessions()
+{
+    std::vector<int64_t> session_ids;
+    {
+        std::shared_lock read_lock(response_callbacks_mutex);
+        session_ids.assign(read_only_sessions.begin(), read_only_sessions.end());
+    }
+    if (session_ids.empty())
+        return;
+
+    LOG_INFO(log, "Leader is available, close {} read only sessions", session_ids.size());
+    for (auto session_id : session_ids)
+    {
+        auto response = std::make_shared<Coordination::ZooKeeperCloseResponse>();
+        response->xid = Coordination::CLOSE_XID;
+        response->zxid = getStateMachine().getLastProcessedZxid();
+        responses_queue.push(ResponseForSession{session_id, response});
+    }
 }
 
 void KeeperDispatcher::registerForwarderResponseCallBack(ForwardClientId client_id, ForwardResponseCallback callback)
@@ -436,6 +774,11 @@ void KeeperDispatcher::deadSessionCleanThread()
     setThreadName("DeadSessnClean");
 
     LOG_INFO(log, "Start dead session clean thread");
+
+    /// Session -> when its close request is pushed. Sessions are dead until the request is applied,
+    /// they are closed again only if the request is not applied in operation timeout.
+    std::unordered_map<int64_t, UInt64> closing_sessions;
+
     while (true)
     {
         if (shutdown_called)
@@ -443,41 +786,50 @@ void KeeperDispatcher::deadSessionCleanThread()
 
         try
         {
-            if (isLeader())
-            {
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(configuration_and_settings->raft_settings->dead_session_check_period_ms));
+            std::this_thread::sleep_for(std::chrono::milliseconds(configuration_and_settings->raft_settings->dead_session_check_period_ms));
 
-                auto dead_sessions = server->getDeadSessions();
-                if (!dead_sessions.empty())
-                    LOG_INFO(log, "Found dead sessions {}", dead_sessions.size());
+            /// Observers never expire sessions, learner role changes only by reconfiguration
+            server->getKeeperStateMachine()->getStore().setTrackOnlyLocalSessions(server->isObserver());
 
-                for (int64_t dead_session : dead_sessions)
-                {
-                    LOG_INFO(log, "Found dead session {}, will try to close it", toHexString(dead_session));
-                    Coordination::ZooKeeperRequestPtr request
-                        = Coordination::ZooKeeperRequestFactory::instance().get(Coordination::OpNum::Close);
-                    request->xid = Coordination::CLOSE_XID;
-                    RequestForSession request_info;
-                    request_info.request = request;
-                    request_info.session_id = dead_session;
-                    // request_info.is_internal = true;
-                    using namespace std::chrono;
-                    request_info.create_time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-                    {
-                        std::lock_guard lock(push_request_mutex);
-                        if (!requests_queue->push(std::move(request_info)))
-                            throw Exception("Cannot push request to queue", ErrorCodes::SYSTEM_ERROR);
-                    }
-                    // unregisterUserResponseCallBack(dead_session);
-                    LOG_DEBUG(log, "Dead session close request pushed");
-                }
+            checkMemoryLimit();
+
+            if (hasLeader())
+                closeReadOnlySessions();
+
+            if (!isLeader())
+            {
+                closing_sessions.clear();
+                expired_sessions_count = 0;
+                closing_sessions_count = 0;
+                continue;
             }
-            else
+
+            auto dead_sessions = server->getDeadSessions();
+            expired_sessions_count = dead_sessions.size();
+
+            UInt64 now = getCurrentTimeMilliseconds();
+            UInt64 operation_timeout_ms = configuration_and_settings->raft_settings->operation_timeout_ms;
+
+            std::unordered_map<int64_t, UInt64> still_closing;
+            std::vector<int64_t> to_close;
+            for (int64_t dead_session : dead_sessions)
             {
-                std::this_thread::sleep_for(
-                    std::chrono::milliseconds(configuration_and_settings->raft_settings->dead_session_check_period_ms));
+                auto it = closing_sessions.find(dead_session);
+                if (it != closing_sessions.end() && now < it->second + operation_timeout_ms)
+                    still_closing.emplace(*it);
+                else
+                    to_close.push_back(dead_session);
             }
+            closing_sessions.swap(still_closing);
+
+            if (!to_close.empty())
+                LOG_INFO(log, "Found dead sessions {}, will try to close {} of them", dead_sessions.size(), to_close.size());
+
+            closeDeadSessions(to_close, closing_sessions);
+            closing_sessions_count = closing_sessions.size();
+
+            removeExpiredNodes();
+            checkDigest();
         }
         catch (...)
         {
@@ -488,6 +840,198 @@ void KeeperDispatcher::deadSessionCleanThread()
     LOG_INFO(log, "End dead session clean thread!");
 }
 
+void KeeperDispatcher::leaderBalanceThread()
+{
+    setThreadName("LeaderBalance");
+
+    LOG_INFO(log, "Start leader balance thread");
+
+    const UInt64 interval_ms = configuration_and_settings->raft_settings->leader_balance_interval_ms;
+    NodeLoadMeter meter;
+
+    while (!shutdown_called)
+    {
+        /// Sleep in slices, so that shutdown does not wait for a whole interval
+        for (UInt64 slept_ms = 0; slept_ms < interval_ms && !shutdown_called; slept_ms += 100)
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::min<UInt64>(100, interval_ms - slept_ms)));
+        if (shutdown_called)
+            break;
+
+        try
+        {
+            UInt64 connections;
+            {
+                std::shared_lock read_lock(response_callbacks_mutex);
+                connections = user_response_callbacks.size();
+            }
+            NodeLoad load = meter.sample(connections);
+
+            if (!isLeader())
+            {
+                leader_balancer->reset();
+                request_forwarder.reportLoad(load);
+                continue;
+            }
+
+            auto successor = leader_balancer->pickSuccessor(load, server->getLeaderCandidates(), getCurrentTimeMilliseconds());
+            if (successor)
+            {
+                LOG_INFO(
+                    log,
+                    "Server {} is less loaded than me (fsync {}us, cpu {}permille, {} connections), yield leadership to it",
+                    *successor,
+                    load.fsync_us,
+                    load.cpu_permille,
+                    load.connections);
+                server->yieldLeadership(*successor);
+            }
+        }
+        catch (...)
+        {
+            tryLogCurrentException(__PRETTY_FUNCTION__);
+        }
+    }
+
+    LOG_INFO(log, "End leader balance thread!");
+}
+
+void KeeperDispatcher::onLoadReport(int32_t server_id, const NodeLoad & load)
+{
+    if (leader_balancer && isLeader())
+        leader_balancer->report(server_id, load, getCurrentTimeMilliseconds());
+}
+
+void KeeperDispatcher::closeDeadSessions(const std::vector<int64_t> & dead_sessions, std::unordered_map<int64_t, UInt64> & closing_sessions)
+{
+    const auto & raft_settings = configuration_and_settings->raft_settings;
+    const UInt64 max_sessions_per_second = raft_settings->max_close_sessions_per_second;
+
+    /// Older versions can not read CloseSessions, every session is closed by its own Close request until it is enabled.
+    if (!raft_settings->batch_close_sessions)
+    {
+        for (int64_t dead_session : dead_sessions)
+        {
+            if (shutdown_called || !isLeader())
+                return;
+
+            Coordination::ZooKeeperRequestPtr request = Coordination::ZooKeeperRequestFactory::instance().get(Coordination::OpNum::Close);
+            request->xid = Coordination::CLOSE_XID;
+
+            RequestForSession request_info;
+            request_info.request = request;
+            request_info.session_id = dead_session;
+            request_info.create_time = getCurrentTimeMilliseconds();
+            UInt64 push_time = request_info.create_time;
+            {
+                std::lock_guard lock(push_request_mutex);
+                if (!requests_queue->push(std::move(request_info)))
+                    throw Exception("Cannot push request to queue", ErrorCodes::SYSTEM_ERROR);
+            }
+            LOG_DEBUG(log, "Close request of dead session {} pushed", toHexString(dead_session));
+
+            closing_sessions[dead_session] = push_time;
+            closing_sessions_count = closing_sessions.size();
+
+            if (max_sessions_per_second)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1000 / max_sessions_per_second));
+        }
+        return;
+    }
+
+    const size_t batch_size = raft_settings->close_sessions_batch_size;
+
+    /// Dead sessions are closed in batches, a mass disconnection does not flood raft log with one entry per session.
+    for (size_t begin = 0; begin < dead_sessions.size(); begin += batch_size)
+    {
+        if (shutdown_called || !isLeader())
+            return;
+
+        size_t end = std::min(dead_sessions.size(), begin + batch_size);
+
+        auto request = std::make_shared<Coordination::ZooKeeperCloseSessionsRequest>();
+        request->xid = Coordination::CLOSE_XID;
+        request->session_ids.assign(dead_sessions.begin() + begin, dead_sessions.begin() + end);
+
+        RequestForSession request_info;
+        request_info.request = request;
+        /// Not a real session, the request is applied as a remote one on every node.
+        request_info.session_id = 0;
+        request_info.create_time = getCurrentTimeMilliseconds();
+
+        /// Bypass requests queue, close requests do not wait in line with requests of live clients.
+        UInt64 push_time = request_info.create_time;
+        request_accumulator.push(std::move(request_info));
+        Metrics::getMetrics().close_sessions_batch_size->add(end - begin);
+        LOG_DEBUG(log, "Close request of {} dead sessions pushed", end - begin);
+
+        for (size_t i = begin; i < end; ++i)
+            closing_sessions[dead_sessions[i]] = push_time;
+        closing_sessions_count = closing_sessions.size();
+
+        if (max_sessions_per_second)
+            std::this_thread::sleep_for(std::chrono::milliseconds((end - begin) * 1000 / max_sessions_per_second));
+    }
+}
+
+void KeeperDispatcher::removeExpiredNodes()
+{
+    const auto & raft_settings = configuration_and_settings->raft_settings;
+    auto & expiry_index = server->getKeeperStateMachine()->getStore().getNodeExpiryIndex();
+
+    while (!shutdown_called && isLeader())
+    {
+        auto paths = expiry_index.collect(
+            getCurrentTimeMilliseconds(), raft_settings->remove_expired_nodes_batch_size, raft_settings->operation_timeout_ms);
+        if (paths.empty())
+            return;
+
+        auto request = std::make_shared<Coordination::ZooKeeperRemoveExpiredRequest>();
+        request->xid = Coordination::CLOSE_XID;
+        request->paths = std::move(paths);
+
+        RequestForSession request_info;
+        request_info.request = request;
+        /// Like close requests of dead sessions, applied as a remote one on every node.
+        request_info.session_id = 0;
+        request_info.create_time = getCurrentTimeMilliseconds();
+
+        LOG_DEBUG(log, "Remove request of {} expired nodes pushed", request->paths.size());
+        request_accumulator.push(std::move(request_info));
+    }
+}
+
+void KeeperDispatcher::checkDigest()
+{
+    UInt64 interval_ms = configuration_and_settings->raft_settings->digest_check_interval_ms;
+    auto & store = server->getKeeperStateMachine()->getStore();
+    if (!interval_ms || !store.isDigestEnabled())
+        return;
+
+    auto now = static_cast<int64_t>(getCurrentTimeMilliseconds());
+    if (now < last_digest_checkpoint + static_cast<int64_t>(interval_ms))
+        return;
+
+    auto request = std::make_shared<Coordination::ZooKeeperCheckDigestRequest>();
+    request->xid = Coordination::CLOSE_XID;
+    request->checkpoint = now;
+    /// The previous checkpoint is checked if this node has applied it, it may not after becoming leader
+    if (auto digest = store.getDigestCheckpoint(last_digest_checkpoint))
+    {
+        request->checked_checkpoint = last_digest_checkpoint;
+        request->checked_digest = *digest;
+    }
+
+    RequestForSession request_info;
+    request_info.request = request;
+    /// Like close requests of dead sessions, applied as a remote one on every node.
+    request_info.session_id = 0;
+    request_info.create_time = now;
+
+    LOG_DEBUG(log, "Check digest request of checkpoint {} pushed", now);
+    request_accumulator.push(std::move(request_info));
+    last_digest_checkpoint = now;
+}
+
 
 void KeeperDispatcher::updateConfigurationThread()
 {
@@ -544,14 +1088,19 @@ void KeeperDispatcher::updateConfigurationThread()
 
 bool KeeperDispatcher::isLocalSession(int64_t session_id)
 {
-    std::shared_lock<std::shared_mutex> read_lock(response_callbacks_mutex);
+    std::shared_lock read_lock(response_callbacks_mutex);
     auto it = user_response_callbacks.find(session_id);
     return it != user_response_callbacks.end();
 }
 
+bool KeeperDispatcher::refreshLocalSession(int64_t session_id)
+{
+    return server->getKeeperStateMachine()->getStore().updateSessionExpirationTime(session_id);
+}
+
 void KeeperDispatcher::filterLocalSessions(std::unordered_map<int64_t, int64_t> & session_to_expiration_time)
 {
-    std::shared_lock<std::shared_mutex> read_lock(response_callbacks_mutex);
+    std::shared_lock read_lock(response_callbacks_mutex);
     for (auto it = session_to_expiration_time.begin(); it != session_to_expiration_time.end();)
     {
         if (!user_response_callbacks.contains(it->first))
@@ -584,6 +1133,61 @@ void KeeperDispatcher::updateConfiguration(const Poco::Util::AbstractConfigurati
         if (!push_result)
             throw Exception(ErrorCodes::SYSTEM_ERROR, "Cannot push configuration update to queue");
     }
+
+    updatePipelineSettings(config);
+}
+
+void KeeperDispatcher::updatePipelineSettings(const Poco::Util::AbstractConfiguration & config)
+{
+    SettingsPtr new_settings;
+    try
+    {
+        new_settings = Settings::loadFromConfig(config, true);
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, "Can not load settings of request pipeline from reloaded config, keep the current ones");
+        return;
+    }
+
+    const auto & current = *pipeline_settings;
+    if (new_settings->requests_queue_capacity != current.requests_queue_capacity
+        || new_settings->committed_queue_capacity != current.committed_queue_capacity)
+    {
+        size_t requests_queue_capacity = new_settings->requests_queue_capacity;
+        requests_queue->setCapacity(requests_queue_capacity);
+        request_forwarder.setQueueCapacity(requests_queue_capacity);
+        auto [applied_requests_queue_capacity, applied_committed_queue_capacity]
+            = request_processor->setQueueCapacities(requests_queue_capacity, new_settings->committed_queue_capacity);
+        LOG_INFO(
+            log,
+            "Capacity of requests queues changed to {}, of committed queue to {}",
+            applied_requests_queue_capacity,
+            applied_committed_queue_capacity);
+        if (applied_requests_queue_capacity < requests_queue_capacity
+            || applied_committed_queue_capacity < new_settings->committed_queue_capacity)
+            LOG_WARNING(log, "Queues can not grow above the capacity at startup, restart to apply larger ones");
+    }
+
+    const auto & raft_settings = *new_settings->raft_settings;
+    if (raft_settings.max_batch_size != current.raft_settings->max_batch_size
+        || raft_settings.max_inflight_batches != current.raft_settings->max_inflight_batches)
+    {
+        request_accumulator.setMaxBatchSize(raft_settings.max_batch_size);
+        request_accumulator.setMaxInflightBatches(raft_settings.max_inflight_batches);
+        LOG_INFO(
+            log,
+            "Max batch size changed to {}, max inflight batches to {}",
+            raft_settings.max_batch_size,
+            raft_settings.max_inflight_batches);
+    }
+
+    if (new_settings->parallel != configuration_and_settings->parallel
+        || new_settings->response_threads != configuration_and_settings->response_threads
+        || new_settings->four_letter_word_threads != configuration_and_settings->four_letter_word_threads)
+        LOG_WARNING(log, "parallel, response_threads and four_letter_word_threads are changed in config, they are applied after restart");
+
+    pipeline_settings = new_settings;
 }
 
 
@@ -623,6 +1227,45 @@ uint64_t KeeperDispatcher::getSnapDirSize() const
     return getDirSize(configuration_and_settings->snapshot_dir);
 }
 
+KeeperMemoryUsage KeeperDispatcher::getMemoryUsage() const
+{
+    KeeperMemoryUsage usage;
+    getStateMachine().getMemoryUsage(usage);
+    usage.log_entry_queue = server->getLogCacheMemoryUsage();
+
+    /// Ring buffers are allocated up front and hold queued requests, responses are queued in deques
+    usage.pipeline_queues = request_accumulator.getQueueBufferSizeInBytes() + responses_queue.size() * sizeof(ResponseForSession);
+    if (requests_queue)
+        usage.pipeline_queues += requests_queue->getBufferSizeInBytes();
+    if (request_processor)
+        usage.pipeline_queues += request_processor->getCommitQueueBufferSizeInBytes();
+    ConnectionHandler::getMemoryUsage(usage);
+    return usage;
+}
+
+void KeeperDispatcher::checkMemoryLimit()
+{
+    if (!memory_limiter->enabled())
+        return;
+
+    MemoryLimitState prev_state = memory_limiter->getState();
+    UInt64 memory_usage = getMemoryUsage().total();
+    MemoryLimitState state = memory_limiter->update(memory_usage);
+    if (state == prev_state)
+        return;
+
+    LOG_WARNING(
+        log, "Memory usage is {} bytes, memory limit state changes from {} to {}", memory_usage, toString(prev_state), toString(state));
+    if (state < prev_state)
+        return;
+
+    /// Free what can be freed without losing data: caches are filled again when memory drops, a snapshot lets logs be compacted
+    server->getKeeperStateMachine()->getStore().shrinkCaches();
+    server->shrinkLogCache();
+    if (prev_state == MemoryLimitState::NORMAL)
+        createSnapshot();
+}
+
 Keeper4LWInfo KeeperDispatcher::getKeeper4LWInfo()
 {
     Keeper4LWInfo result;
@@ -630,14 +1273,20 @@ Keeper4LWInfo KeeperDispatcher::getKeeper4LWInfo()
     result.is_standalone = !result.is_follower && server->getFollowerCount() == 0;
     result.is_leader = isLeader();
     result.is_observer = server->isObserver();
+    result.is_witness = server->isWitness();
     result.has_leader = hasLeader();
     {
         std::lock_guard lock(push_request_mutex);
         result.outstanding_requests_count = requests_queue->size();
     }
+    result.expired_sessions_count = expired_sessions_count;
+    result.closing_sessions_count = closing_sessions_count;
+    result.memory_limit_state = static_cast<uint64_t>(memory_limiter->getState());
+    result.memory_rejected_requests = memory_rejected_requests;
     {
-        std::shared_lock<std::shared_mutex> read_lock(response_callbacks_mutex);
+        std::shared_lock read_lock(response_callbacks_mutex);
         result.alive_connections_count = user_response_callbacks.size();
+        result.read_only_sessions_count = read_only_sessions.size();
     }
     if (result.is_leader)
     {
@@ -5,18 +5,24 @@
 #endif
 
 #include <functional>
+#include <unordered_set>
 
 #include <Poco/FIFOBuffer.h>
 #include <Poco/Util/AbstractConfiguration.h>
 
 #include <Common/ConcurrentBoundedQueue.h>
 #include <Common/Exception.h>
+#include <Common/HashFunctions.h>
+#include <Common/ProfiledMutex.h>
 #include <Common/ThreadPool.h>
 #include <common/logger_useful.h>
 
+#include <Service/AdmissionController.h>
+#include <Service/MemoryLimiter.h>
 #include <Service/ConnectionStats.h>
 #include <Service/Keeper4LWInfo.h>
 #include <Service/KeeperServer.h>
+#include <Service/LeaderBalancer.h>
 #include <Service/NuRaftStateMachine.h>
 #include <Service/RequestAccumulator.h>
 #include <Service/RequestForwarder.h>
@@ -32,30 +38,33 @@ using ForwardResponseCallback = std::function<void(ForwardResponsePtr response)>
 class KeeperDispatcher : public std::enable_shared_from_this<KeeperDispatcher>
 {
 private:
-    std::mutex push_request_mutex;
+    ProfiledMutex push_request_mutex{"push_request_mutex"};
     ptr<RequestsQueue> requests_queue;
-    ThreadSafeQueue<ResponseForSession> responses_queue;
+    ResponsesQueue responses_queue;
     std::atomic<bool> shutdown_called{false};
 
     /// Response callback which will send response to IO handler. Key is session_id
     /// which are local session which are directly connected to the node.
     using UserResponseCallbacks = std::unordered_map<int64_t, ZooKeeperResponseCallback>;
     UserResponseCallbacks user_response_callbacks;
-    std::shared_mutex response_callbacks_mutex;
+    ProfiledSharedMutex response_callbacks_mutex{"response_callbacks_mutex"};
 
     /// Just like user_response_callbacks, but only concerns new session or update session requests.
     /// For new session request the key is internal_id, for update session request the key is session id.
     using SessionResponseCallbacks = std::unordered_map<int64_t, ZooKeeperResponseCallback>;
     SessionResponseCallbacks session_response_callbacks;
 
+    /// Sessions created in read only mode, they are local to this node and not known by Raft.
+    /// Guarded by response_callbacks_mutex, the same with their callbacks.
+    std::unordered_set<int64_t> read_only_sessions;
+    std::atomic<int64_t> read_only_session_counter{0};
+
     struct PairHash
     {
         template <class T1, class T2>
         std::size_t operator()(const std::pair<T1, T2> & p) const
         {
-            auto h1 = std::hash<T1>{}(p.first);
-            auto h2 = std::hash<T2>{}(p.second);
-            return h1 ^ h2;
+            return hashPair(static_cast<UInt64>(p.first), static_cast<UInt64>(p.second));
         }
     };
 
@@ -78,11 +87,17 @@ private:
     /// Apply or wait for configuration changes
     ThreadFromGlobalPool update_configuration_thread;
 
+    /// Measure and report load, or move leadership if I am leader. Only if auto_leader_balance is enabled.
+    ThreadFromGlobalPool leader_balance_thread;
+    std::unique_ptr<LeaderBalancer> leader_balancer;
+
     std::shared_ptr<KeeperServer> server;
 
-    ConnectionStats keeper_stats;
+    ConnectionStats keeper_stats{defaultShardsNum()};
 
     SettingsPtr configuration_and_settings;
+    /// Settings of the request pipeline applied by the last config reload, see updatePipelineSettings
+    SettingsPtr pipeline_settings;
 
     Poco::Logger * log;
 
@@ -94,17 +109,48 @@ private:
     RequestAccumulator request_accumulator;
     RequestForwarder request_forwarder;
 
+    std::unique_ptr<AdmissionController> admission_controller;
+    std::unique_ptr<MemoryLimiter> memory_limiter;
+    std::atomic<UInt64> memory_rejected_requests{0};
+
     Poco::Timestamp uptime;
 
     /// Used as new session request internal id counter
     std::atomic<int64_t> new_session_internal_id_counter;
 
     void requestThread(RunnerId runner_id);
-    void responseThread();
+    /// Get read index of a linearizable read from leader or myself if I am leader
+    void requestReadIndex(const RequestForSession & request_for_session);
+    void responseThread(size_t shard);
 
     /// Clean dead sessions
     void deadSessionCleanThread();
+    void leaderBalanceThread();
+    /// Push close requests of dead sessions to Raft in batches if batch_close_sessions, one by one otherwise,
+    /// at most max_close_sessions_per_second.
+    /// Sessions pushed are added to closing_sessions with the time.
+    void closeDeadSessions(const std::vector<int64_t> & dead_sessions, std::unordered_map<int64_t, UInt64> & closing_sessions);
+    /// Push remove requests of TTL nodes and empty containers the expiry index finds expired, in batches.
+    void removeExpiredNodes();
+    /// Push a request by which all nodes record the digest of data tree and compare the previous one with leader,
+    /// every digest_check_interval_ms.
+    void checkDigest();
+    /// Update state of memory limiter, snapshot is created and caches are dropped when a limit is reached.
+    void checkMemoryLimit();
+    /// Close read only sessions once there is a leader, so that their clients reconnect with read-write sessions.
+    void closeReadOnlySessions();
+    /// Process a request of a read only session which is not a read: auth is kept by this node, close is answered
+    /// at once, and others fail with ZNOTREADONLY.
+    void processReadOnlySessionRequest(const RequestForSession & request_for_session);
+
+    /// Sessions found dead by the last check of leader and the ones of them being closed
+    std::atomic<UInt64> expired_sessions_count{0};
+    std::atomic<UInt64> closing_sessions_count{0};
+    /// Checkpoint of the last CheckDigest request pushed, only accessed by deadSessionCleanThread
+    int64_t last_digest_checkpoint = 0;
     void invokeResponseCallBack(int64_t session_id, const Coordination::ZooKeeperResponsePtr & response);
+    /// Invoke callbacks for a batch of responses under one lock of response_callbacks_mutex
+    void invokeResponseCallBacks(const ResponsesForSessions & responses);
 
 public:
     KeeperDispatcher();
@@ -117,6 +163,8 @@ public:
 
     /// Push user requests
     bool pushRequest(const Coordination::ZooKeeperRequestPtr & request, int64_t session_id);
+    /// Push requests of a session read at once from its connection, in order. Return false if session is expired.
+    bool pushRequests(const std::vector<Coordination::ZooKeeperRequestPtr> & requests, int64_t session_id, bool allow_stale_read = false);
 
     /// Push new session or update session request
     bool pushSessionRequest(const Coordination::ZooKeeperRequestPtr & request, int64_t internal_id);
@@ -141,16 +189,36 @@ public:
 
     bool isLocalSession(int64_t session_id);
 
+    /// Refresh expiration time of a local session for its heartbeat, which is answered by its connection rather than
+    /// the request pipeline. A follower syncs it to leader by the next session sync. Returns false if the session is
+    /// expired, the heartbeat goes through the pipeline then.
+    bool refreshLocalSession(int64_t session_id);
+
+    /// Whether new sessions of clients connected in read only mode are created locally, it is true if read_only_mode
+    /// is enabled and there is no leader.
+    bool acceptsReadOnlySession() const;
+    /// Create a read only session served by this node with the response callback, return its id.
+    int64_t registerReadOnlySession(ZooKeeperResponseCallback callback);
+
+    /// Whether a client which has seen a zxid not applied by this node is accepted, it is if seen_zxid_wait_ms is set.
+    bool acceptsSeenZxidAhead() const;
+    /// Hold reads of the session until this node applies the zxid its client has seen, if it is not applied yet.
+    void waitForSeenZxid(int64_t session_id, int64_t zxid);
+
     void filterLocalSessions(std::unordered_map<int64_t, int64_t> & session_to_expiration_time);
 
     /// from follower
     void handleRemoteSession(int64_t session_id, int64_t expiration_time) { server->handleRemoteSession(session_id, expiration_time); }
+    void onLoadReport(int32_t server_id, const NodeLoad & load);
 
     /// Thread apply or wait configuration changes from leader
     void updateConfigurationThread();
     /// Registered in ConfigReloader callback. Add new configuration changes to
     /// update_configuration_queue. Keeper Dispatcher apply them asynchronously.
     void updateConfiguration(const Poco::Util::AbstractConfiguration & config);
+    /// Apply capacities of queues and batching of reloaded config to the request pipeline. Others which size threads
+    /// and queues per runner, like parallel, need a restart.
+    void updatePipelineSettings(const Poco::Util::AbstractConfiguration & config);
 
     /// Invoked when a request completes.
     void updateKeeperStatLatency(uint64_t process_time_ms);
@@ -161,7 +229,22 @@ public:
     /// Are we leader
     bool isLeader() const { return server->isLeader(); }
     bool hasLeader() const { return server->isLeaderAlive(); }
+    std::optional<UInt64> getReadIndex() const { return server->getReadIndex(); }
+
+    /// For cascaded observers replicating from me, see LogRelay
+    void fetchCommittedLogs(UInt64 start_index, UInt64 max_bytes, ForwardFetchLogsResponse & response) const
+    {
+        server->fetchCommittedLogs(start_index, max_bytes, response);
+    }
+    void fetchSnapshotObject(ptr<nuraft::snapshot> snapshot, UInt64 obj_id, ForwardFetchSnapshotResponse & response) const
+    {
+        server->fetchSnapshotObject(std::move(snapshot), obj_id, response);
+    }
+
+    /// Whether the node is too busy to accept more requests, connections stop reading from sockets if it is.
+    bool isSaturated();
     bool isObserver() const { return server->isObserver(); }
+    bool isWitness() const { return server->isWitness(); }
 
     /// get log size in bytes
     uint64_t getLogDirSize() const;
@@ -206,6 +289,9 @@ public:
 
     KeeperLogInfo getKeeperLogInfo() { return server->getKeeperLogInfo(); }
 
+    /// Approximate memory held by the components of this node
+    KeeperMemoryUsage getMemoryUsage() const;
+
     /// Request to be leader
     bool requestLeader() { return server->requestLeader(); }
 
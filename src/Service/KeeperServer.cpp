@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <chrono>
+#include <limits>
 #include <string>
 
 #include <Poco/NumberFormatter.h>
@@ -8,9 +10,11 @@
 
 #include <Service/KeeperServer.h>
 #include <Service/LoggerWrapper.h>
+#include <Service/Metrics.h>
 #include <Service/NuRaftStateMachine.h>
 #include <Service/NuRaftStateManager.h>
 #include <Service/ReadBufferFromNuRaftBuffer.h>
+#include <Service/ThreadPlacement.h>
 #include <ZooKeeper/ZooKeeperIO.h>
 
 namespace RK
@@ -31,6 +35,10 @@ KeeperServer::KeeperServer(
     , settings(settings_)
     , config(config_)
     , log(&(Poco::Logger::get("KeeperServer")))
+    , catch_up_policy(
+          settings_->raft_settings->catch_up_link_bandwidth,
+          settings_->raft_settings->catch_up_log_replay_rate,
+          settings_->raft_settings->max_catch_up_log_bytes)
 {
     state_manager = cs_new<NuRaftStateManager>(my_id, config, settings_);
 
@@ -46,7 +54,34 @@ KeeperServer::KeeperServer(
         state_manager->load_log_store(),
         checkAndGetSuperdigest(settings->super_digest),
         MAX_OBJECT_NODE_SIZE,
-        request_processor_);
+        request_processor_,
+        state_manager->isWitness());
+
+    /// Snapshots are staggered by the position of this node in cluster members
+    std::vector<int32_t> server_ids;
+    for (const auto & server : state_manager->getClusterConfig()->get_servers())
+        server_ids.push_back(server->get_id());
+    std::sort(server_ids.begin(), server_ids.end());
+    auto member_index = std::find(server_ids.begin(), server_ids.end(), my_id) - server_ids.begin();
+    state_machine->setSnapshotMember(member_index, server_ids.size());
+
+    if (int32_t upstream_id = state_manager->getUpstreamId(); upstream_id != -1)
+    {
+        auto caught_up = [this]
+        {
+            std::unique_lock lock(initialized_mutex);
+            initialized_flag = true;
+            initialized_cv.notify_all();
+        };
+        log_relay = std::make_unique<LogRelay>(
+            my_id,
+            upstream_id,
+            state_manager->getForwardingEndpoint(upstream_id),
+            state_machine,
+            state_manager,
+            settings->raft_settings,
+            caught_up);
+    }
 
 #ifdef COMPATIBLE_MODE_ZOOKEEPER
     auto cluster_config = state_manager->getClusterConfig();
@@ -71,9 +106,18 @@ namespace
         params.election_timeout_upper_bound_ = raft_settings->election_timeout_upper_bound_ms;
         params.reserved_log_items_ = raft_settings->reserved_log_items;
         params.snapshot_distance_ = raft_settings->snapshot_distance;
-        params.return_method_ = nuraft::raft_params::blocking;
+        /// Batches are also limited by bytes, see max_append_bytes and replication_window_bytes
+        params.max_append_size_
+            = static_cast<int32_t>(std::min<UInt64>(raft_settings->max_append_entries, std::numeric_limits<int32_t>::max()));
+        /// Accumulator waits for results itself when several batches are in flight
+        params.return_method_
+            = raft_settings->max_inflight_batches > 1 ? nuraft::raft_params::async_handler : nuraft::raft_params::blocking;
         params.parallel_log_appending_ = raft_settings->log_fsync_mode == FsyncMode::FSYNC_PARALLEL;
         params.auto_forwarding_ = false;
+        /// Leader steps down before followers can elect a new one, so its committed index can serve as read index
+        if (raft_settings->linearizable_read)
+            params.leadership_expiry_
+                = ReadIndexPolicy::getLeaseMs(raft_settings->election_timeout_lower_bound_ms, raft_settings->heart_beat_interval_ms);
     }
 }
 
@@ -86,6 +130,7 @@ void KeeperServer::startup()
 
     nuraft::asio_service::options asio_opts{};
     asio_opts.thread_pool_size_ = raft_settings->nuraft_thread_size;
+    asio_opts.worker_start_ = [](uint32_t) { ThreadPlacement::instance().apply(ThreadClass::NURAFT); };
     nuraft::raft_server::init_options init_options;
 
     init_options.skip_initial_election_timeout_ = state_manager->shouldStartAsFollower();
@@ -108,15 +153,69 @@ void KeeperServer::startup()
     /// used raft_instance notify_log_append_completion
     if (raft_settings->log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
         dynamic_cast<NuRaftFileLogStore &>(*state_manager->load_log_store()).setRaftServer(raft_instance);
+
+    dynamic_cast<NuRaftFileLogStore &>(*state_manager->load_log_store()).setMaxAppendBytes(raft_settings->max_append_bytes);
+
+    if (catch_up_policy.enabled())
+        dynamic_cast<NuRaftFileLogStore &>(*state_manager->load_log_store())
+            .setCompactIndexCallback([this](UInt64 compact_index) { return getCompactIndex(compact_index); });
+
+    /// After NuRaft server is initialized, so that it does not touch logs relayed
+    if (log_relay)
+        log_relay->startup();
+}
+
+UInt64 KeeperServer::getCompactIndex(UInt64 compact_index)
+{
+    if (!raft_instance || !raft_instance->is_leader())
+        return compact_index;
+
+    auto log_store = state_manager->load_log_store();
+    auto & file_log_store = dynamic_cast<NuRaftFileLogStore &>(*log_store);
+    UInt64 first_log_index = log_store->start_index();
+    UInt64 last_log_index = log_store->next_slot() - 1;
+    if (last_log_index < first_log_index)
+        return compact_index;
+
+    auto [snapshot_index, snapshot_bytes] = state_machine->getLastSnapshotIndexAndBytes();
+    CatchUpPolicy::LogState state{
+        .compact_index = compact_index,
+        .first_log_index = first_log_index,
+        .last_log_index = last_log_index,
+        .bytes_per_entry = static_cast<double>(file_log_store.logStorage()->getLogBytes())
+            / static_cast<double>(last_log_index - first_log_index + 1),
+        .snapshot_index = snapshot_index,
+        .snapshot_bytes = snapshot_bytes};
+
+    std::vector<UInt64> follower_next_indexes;
+    for (const auto & follower : raft_instance->get_peer_info_all())
+        follower_next_indexes.push_back(follower.last_log_idx_ + 1);
+
+    UInt64 index = catch_up_policy.getCompactIndex(state, follower_next_indexes);
+    if (index < compact_index)
+        LOG_INFO(
+            log,
+            "Logs from {} are cheaper than the snapshot of {} bytes for lagging followers, keep them",
+            index + 1,
+            snapshot_bytes);
+    return index;
 }
 
 int32 KeeperServer::getLeader()
 {
+    if (log_relay)
+        return log_relay->getLeader();
     return raft_instance->get_leader();
 }
 
 void KeeperServer::shutdown()
 {
+    if (log_relay)
+    {
+        LOG_INFO(log, "Shutting down log relay.");
+        log_relay->shutdown();
+    }
+
     LOG_INFO(log, "Shutting down NuRaft core.");
     if (!launcher.shutdown(settings->raft_settings->shutdown_timeout / 1000))
         LOG_WARNING(log, "Failed to shutdown NuRaft core in {}ms", settings->raft_settings->shutdown_timeout);
@@ -125,7 +224,13 @@ void KeeperServer::shutdown()
     if (state_manager->load_log_store() && !state_manager->load_log_store()->flush())
         LOG_WARNING(log, "Log store flush error while server shutdown.");
 
-    dynamic_cast<NuRaftFileLogStore &>(*state_manager->load_log_store()).shutdown();
+    /// Before the log store is shut down, which has the term of the last committed log
+    if (settings->raft_settings->snapshot_on_shutdown && state_manager->load_log_store())
+        state_machine->createShutdownSnapshot(state_manager->load_log_store()->term_at(state_machine->last_commit_index()));
+
+    auto & file_log_store = dynamic_cast<NuRaftFileLogStore &>(*state_manager->load_log_store());
+    file_log_store.setCompactIndexCallback({});
+    file_log_store.shutdown();
     state_machine->shutdown();
 
     LOG_INFO(log, "Shut down NuRaft core done!");
@@ -135,13 +240,56 @@ ptr<nuraft::cmd_result<ptr<buffer>>> KeeperServer::pushRequestBatch(const std::v
 {
     LOG_DEBUG(log, "Push batch requests of size {}", request_batch.size());
     std::vector<ptr<buffer>> entries;
+    /// Requests of entries, committed by state machine as they are
+    std::vector<RequestForSession> requests;
+
+    /// New session requests are merged into one entry at the position of the first one. They are
+    /// independent of other requests, for the sessions are not known by clients until it is applied.
+    std::shared_ptr<Coordination::ZooKeeperNewSessionsRequest> new_sessions;
+    const RequestForSession * first_new_session = nullptr;
+    size_t new_sessions_pos = 0;
+
     for (const auto & request_session : request_batch)
     {
         LOG_TRACE(log, "Push request {}", request_session.toSimpleString());
+        if (settings->raft_settings->batch_new_sessions && request_session.request->getOpNum() == Coordination::OpNum::NewSession)
+        {
+            if (!first_new_session)
+            {
+                first_new_session = &request_session;
+                new_sessions_pos = entries.size();
+                entries.emplace_back();
+                requests.emplace_back();
+
+                new_sessions = std::make_shared<Coordination::ZooKeeperNewSessionsRequest>();
+                new_sessions->xid = Coordination::NEW_SESSION_XID;
+            }
+            new_sessions->requests.push_back(std::static_pointer_cast<Coordination::ZooKeeperNewSessionRequest>(request_session.request));
+            continue;
+        }
         entries.push_back(getZooKeeperLogEntry(request_session.session_id, request_session.create_time, request_session.request));
+        requests.emplace_back(request_session.request, request_session.session_id, request_session.create_time);
     }
+
+    if (first_new_session && new_sessions->requests.size() == 1)
+    {
+        entries[new_sessions_pos]
+            = getZooKeeperLogEntry(first_new_session->session_id, first_new_session->create_time, first_new_session->request);
+        requests[new_sessions_pos]
+            = RequestForSession(first_new_session->request, first_new_session->session_id, first_new_session->create_time);
+    }
+    else if (first_new_session)
+    {
+        LOG_DEBUG(log, "Merge {} new session requests into one log entry", new_sessions->requests.size());
+        /// Not a real session, the responses are sent to internal ids of the requests.
+        entries[new_sessions_pos] = getZooKeeperLogEntry(0, first_new_session->create_time, new_sessions);
+        requests[new_sessions_pos] = RequestForSession(new_sessions, 0, first_new_session->create_time);
+    }
+
+    state_machine->beginLocalAppend(entries, std::move(requests));
     /// append_entries write request
     ptr<nuraft::cmd_result<ptr<buffer>>> result = raft_instance->append_entries(entries);
+    state_machine->endLocalAppend(entries);
     return result;
 }
 
@@ -170,12 +318,75 @@ bool KeeperServer::isLeader() const
 }
 
 
+bool KeeperServer::isWitness() const
+{
+    return state_machine->isWitness();
+}
+
 bool KeeperServer::isObserver() const
 {
     auto cluster_config = state_manager->getClusterConfig();
     return cluster_config->get_server(my_id)->is_learner();
 }
 
+UInt64 KeeperServer::getLeaderContactAgeMs() const
+{
+    if (log_relay)
+        return log_relay->getContactAgeMs();
+    if (isLeader())
+        return 0;
+    UInt64 now = getCurrentTimeMilliseconds();
+    UInt64 last_contact = last_leader_contact_ms.load(std::memory_order_relaxed);
+    return now > last_contact ? now - last_contact : 0;
+}
+
+UInt64 KeeperServer::getLeaderCommittedLogIdx() const
+{
+    if (log_relay)
+        return log_relay->getUpstreamCommittedIdx();
+    return raft_instance->get_leader_committed_log_idx();
+}
+
+void KeeperServer::fetchCommittedLogs(UInt64 start_index, UInt64 max_bytes, ForwardFetchLogsResponse & response)
+{
+    auto log_store = state_manager->load_log_store();
+    /// Logs applied are committed, so they are never rolled back
+    UInt64 commit_index = state_machine->last_commit_index();
+
+    response.leader_id = getLeader();
+    response.commit_index = commit_index;
+    response.first_index = log_store->start_index();
+    if (start_index < response.first_index || start_index > commit_index || isWitness())
+        return;
+
+    auto entries = log_store->log_entries_ext(start_index, commit_index + 1, static_cast<int64>(max_bytes));
+    if (entries)
+        response.entries = std::move(*entries);
+}
+
+void KeeperServer::fetchSnapshotObject(ptr<nuraft::snapshot> snapshot, UInt64 obj_id, ForwardFetchSnapshotResponse & response)
+{
+    if (!snapshot)
+        snapshot = state_machine->last_snapshot();
+    if (!snapshot || isWitness())
+    {
+        response.setAppendEntryResult(false, nuraft::cmd_result_code::FAILED);
+        return;
+    }
+
+    void * user_snp_ctx = nullptr;
+    bool is_last = false;
+    state_machine->read_logical_snp_obj(*snapshot, user_snp_ctx, obj_id, response.data, is_last);
+    /// Removed by a newer one
+    if (!response.data)
+    {
+        response.setAppendEntryResult(false, nuraft::cmd_result_code::FAILED);
+        return;
+    }
+    response.snapshot = snapshot;
+    response.is_last = is_last;
+}
+
 bool KeeperServer::isFollower() const
 {
     return !isLeader() && !isObserver();
@@ -183,10 +394,28 @@ bool KeeperServer::isFollower() const
 
 bool KeeperServer::isLeaderAlive() const
 {
+    if (log_relay)
+        return log_relay->isLeaderAlive();
     /// nuraft leader_ and role_ not sync
     return raft_instance->is_leader_alive() && raft_instance->get_leader() != -1;
 }
 
+std::optional<UInt64> KeeperServer::getReadIndex() const
+{
+    if (!isLeader() || !isLeaderAlive())
+        return {};
+    UInt64 term = raft_instance->get_term();
+    return read_index_policy.getReadIndex(
+        term, raft_instance->get_committed_log_idx(), [this](UInt64 index) { return state_manager->load_log_store()->term_at(index); });
+}
+
+UInt64 KeeperServer::getCommitLag() const
+{
+    UInt64 committed = log_relay ? log_relay->getUpstreamCommittedIdx() : raft_instance->get_committed_log_idx();
+    UInt64 applied = state_machine->last_commit_index();
+    return committed > applied ? committed - applied : 0;
+}
+
 uint64_t KeeperServer::getFollowerCount() const
 {
     return raft_instance->get_peer_info_all().size();
@@ -210,7 +439,11 @@ uint64_t KeeperServer::getSyncedFollowerCount() const
 
 nuraft::cb_func::ReturnCode KeeperServer::callbackFunc(nuraft::cb_func::Type type, nuraft::cb_func::Param * /* param */)
 {
-    if (type == nuraft::cb_func::Type::BecomeFresh || type == nuraft::cb_func::Type::BecomeLeader)
+    if (type == nuraft::cb_func::GotAppendEntryReqFromLeader)
+    {
+        last_leader_contact_ms.store(getCurrentTimeMilliseconds(), std::memory_order_relaxed);
+    }
+    else if (type == nuraft::cb_func::Type::BecomeFresh || type == nuraft::cb_func::Type::BecomeLeader)
     {
         std::unique_lock lock(initialized_mutex);
         initialized_flag = true;
@@ -401,7 +634,8 @@ bool KeeperServer::waitConfigurationUpdate(const ConfigUpdateAction & task)
 
 uint64_t KeeperServer::createSnapshot()
 {
-    uint64_t log_idx = raft_instance->create_snapshot();
+    /// Logs are not committed by NuRaft
+    uint64_t log_idx = log_relay ? log_relay->createSnapshot() : raft_instance->create_snapshot();
     if (log_idx != 0)
         LOG_INFO(log, "Snapshot creation scheduled with last committed log index {}.", log_idx);
     else
@@ -429,14 +663,54 @@ KeeperLogInfo KeeperServer::getKeeperLogInfo()
         log_info.last_snapshot_idx = raft_instance->get_last_snapshot_idx();
     }
 
+    if (log_relay)
+    {
+        log_info.last_log_idx = state_manager->load_log_store()->next_slot() - 1;
+        log_info.last_committed_log_idx = state_machine->last_commit_index();
+        log_info.leader_committed_log_idx = log_relay->getUpstreamCommittedIdx();
+        log_info.target_committed_log_idx = log_relay->getUpstreamCommittedIdx();
+        if (auto last_snapshot = state_machine->last_snapshot())
+            log_info.last_snapshot_idx = last_snapshot->get_last_log_idx();
+    }
+
     return log_info;
 }
 
+UInt64 KeeperServer::getLogCacheMemoryUsage() const
+{
+    auto * log_store = dynamic_cast<NuRaftFileLogStore *>(state_manager->load_log_store().get());
+    return log_store ? log_store->getLogCacheBytes() : 0;
+}
+
+void KeeperServer::shrinkLogCache()
+{
+    if (auto * log_store = dynamic_cast<NuRaftFileLogStore *>(state_manager->load_log_store().get()))
+        log_store->shrinkLogCache();
+}
+
 bool KeeperServer::requestLeader()
 {
     return isLeader() || raft_instance->request_leadership();
 }
 
+std::vector<int32_t> KeeperServer::getLeaderCandidates() const
+{
+    std::vector<int32_t> candidates;
+    for (const auto & server : state_manager->getClusterConfig()->get_servers())
+    {
+        if (server->get_id() != my_id && !server->is_learner() && server->get_priority() > 0)
+            candidates.push_back(server->get_id());
+    }
+    return candidates;
+}
+
+void KeeperServer::yieldLeadership(int32_t successor)
+{
+    LOG_INFO(log, "Yield leadership to server {}", successor);
+    /// Not immediate, NuRaft hands leadership over gracefully
+    raft_instance->yield_leadership(false, successor);
+}
+
 void KeeperServer::registerForWardListener(UpdateForwardListener forward_listener)
 {
     std::unique_lock lock(forward_listener_mutex);
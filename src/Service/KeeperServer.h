@@ -1,15 +1,19 @@
 #pragma once
 
+#include <optional>
 #include <unordered_map>
 
 #include <libnuraft/nuraft.hxx>
 
+#include <Service/CatchUpPolicy.h>
 #include <Service/Keeper4LWInfo.h>
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperStore.h>
+#include <Service/LogRelay.h>
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftStateMachine.h>
 #include <Service/NuRaftStateManager.h>
+#include <Service/ReadIndexPolicy.h>
 #include <Service/Settings.h>
 
 namespace RK
@@ -72,9 +76,31 @@ public:
 
     bool isFollower() const;
 
+    /// Committed log index if the node is leader within its lease and an entry of its term is committed, which is used
+    /// as read index of linearizable reads, see ReadIndexPolicy.
+    std::optional<UInt64> getReadIndex() const;
+
+    /// How many Raft logs are committed but not applied to state machine yet.
+    UInt64 getCommitLag() const;
+
     /// observer node who does not participate in leader selection and data replication quorum
     bool isObserver() const;
 
+    /// Whether I only vote and persist logs, see NuRaftStateMachine::witness
+    bool isWitness() const;
+
+    /// Milliseconds since the last append entries request from leader, 0 for leader.
+    UInt64 getLeaderContactAgeMs() const;
+
+    /// Committed log index of leader as of the last append entries request from it, of the upstream for a cascaded
+    /// observer.
+    UInt64 getLeaderCommittedLogIdx() const;
+
+    /// Committed logs from start_index for a cascaded observer replicating from me, see LogRelay
+    void fetchCommittedLogs(UInt64 start_index, UInt64 max_bytes, ForwardFetchLogsResponse & response);
+    /// Object obj_id of snapshot, the latest one if it is nullptr, for a cascaded observer replicating from me
+    void fetchSnapshotObject(ptr<nuraft::snapshot> snapshot, UInt64 obj_id, ForwardFetchSnapshotResponse & response);
+
     /// @return follower count if node is not leader return 0
     uint64_t getFollowerCount() const;
 
@@ -99,9 +125,18 @@ public:
     /// Return NuRaft log related information.
     KeeperLogInfo getKeeperLogInfo();
 
+    /// Bytes of log entries cached in memory by log store
+    UInt64 getLogCacheMemoryUsage() const;
+    void shrinkLogCache();
+
     /// Send request to become leader. Return true if scheduled task, or false.
     bool requestLeader();
 
+    /// Voting members of non zero priority other than me, which may become leader
+    std::vector<int32_t> getLeaderCandidates() const;
+    /// Invoked by leader to hand leadership over to successor
+    void yieldLeadership(int32_t successor);
+
     void registerForWardListener(UpdateForwardListener forward_listener);
 
     int32_t myId() const { return my_id; }
@@ -113,6 +148,10 @@ private:
     /// BecomeLeader for leader events, which means itself joins cluster.
     nuraft::cb_func::ReturnCode callbackFunc(nuraft::cb_func::Type type, nuraft::cb_func::Param * param);
 
+    /// Index to compact logs up to instead of compact_index, lower if keeping logs for lagging followers is cheaper
+    /// than sending them snapshots, see CatchUpPolicy. Only the leader keeps logs for them.
+    UInt64 getCompactIndex(UInt64 compact_index);
+
     /// my id configured in config.xml
     int32_t my_id;
 
@@ -146,6 +185,17 @@ private:
 
     std::mutex forward_listener_mutex;
     UpdateForwardListener update_forward_listener;
+
+    /// When got the last append entries request from leader, including heartbeats
+    std::atomic<UInt64> last_leader_contact_ms{0};
+
+    const CatchUpPolicy catch_up_policy;
+
+    /// Caches the term of which an entry is committed, so it is updated by getReadIndex
+    mutable ReadIndexPolicy read_index_policy;
+
+    /// If I am a cascaded observer, which replicates logs from an upstream instead of NuRaft
+    std::unique_ptr<LogRelay> log_relay;
 };
 
 }
@@ -1,9 +1,18 @@
+#include <array>
 #include <functional>
 #include <iomanip>
-#include <Service/memcopy.h>
+#include <limits>
+#include <numeric>
+#include <Service/HotSpotTracker.h>
 #include <Service/KeeperStore.h>
 #include <Service/KeeperUtils.h>
+#include <Service/Metrics.h>
+#include <Service/OpCostMetrics.h>
 #include <ZooKeeper/IKeeper.h>
+#include <ZooKeeper/ZooKeeperIO.h>
+#include <Common/SlabAllocator.h>
+#include <Common/WorkStealing.h>
+#include <common/scope_guard.h>
 
 namespace RK
 {
@@ -11,22 +20,22 @@ namespace ErrorCodes
 {
     extern const int LOGICAL_ERROR;
     extern const int BAD_ARGUMENTS;
+    extern const int INVALID_CONFIG_PARAMETER;
 }
 
+template <typename Queue>
 static inline void set_response(
-    ThreadSafeQueue<ResponseForSession> & responses_queue,
+    Queue & responses_queue,
     const ResponsesForSessions & responses,
     bool ignore_response)
 {
     if (!ignore_response)
-    {
-        for (auto && response : responses)
-            responses_queue.push(std::move(response));
-    }
+        responses_queue.pushBatch(responses);
 }
 
+template <typename Queue>
 static inline void set_response(
-    ThreadSafeQueue<ResponseForSession> & responses_queue,
+    Queue & responses_queue,
     const ResponseForSession & response,
     bool ignore_response)
 {
@@ -113,21 +122,50 @@ static bool fixupACL(
  */
 static bool shouldIncreaseZxid(const Coordination::ZooKeeperRequestPtr & zk_request)
 {
-    return !(dynamic_cast<Coordination::ZooKeeperGetRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperSetWatchesRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperExistsRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperAuthRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperHeartbeatRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperListRequest *>(zk_request.get())
-        || dynamic_cast<Coordination::ZooKeeperSimpleListRequest *>(zk_request.get()));
+    switch (zk_request->getOpNum())
+    {
+        case Coordination::OpNum::Get:
+        case Coordination::OpNum::SetWatches:
+        case Coordination::OpNum::SetWatches2:
+        case Coordination::OpNum::AddWatch:
+        case Coordination::OpNum::Exists:
+        case Coordination::OpNum::Auth:
+        case Coordination::OpNum::Heartbeat:
+        case Coordination::OpNum::List:
+        case Coordination::OpNum::SimpleList:
+        case Coordination::OpNum::FilteredList:
+        case Coordination::OpNum::ListWithData:
+        case Coordination::OpNum::PagedList:
+        case Coordination::OpNum::StatBatch:
+            return false;
+        default:
+            return true;
+    }
+}
+
+using KeeperNodePool = FixedSizeSlabPool<sizeof(KeeperNode), alignof(KeeperNode)>;
+
+KeeperNodePtr KeeperNode::create()
+{
+    return KeeperNodePtr(new KeeperNode);
+}
+
+void * KeeperNode::operator new([[maybe_unused]] size_t size)
+{
+    assert(size == sizeof(KeeperNode));
+    return KeeperNodePool::instance().alloc();
+}
+
+void KeeperNode::operator delete(void * ptr) noexcept
+{
+    KeeperNodePool::instance().free(ptr);
 }
 
 KeeperNodePtr KeeperNode::clone() const
 {
-    auto node = std::make_shared<KeeperNode>();
-    auto data_size = data.size();
-    node->data.resize(data_size);
-    memcopy(node->data.data(), data.data(), data_size);
+    auto node = KeeperNode::create();
+    /// Large data is shared, not copied
+    node->data = data;
     node->acl_id = acl_id;
     node->is_ephemeral = is_ephemeral;
     node->is_sequential = is_sequential;
@@ -138,10 +176,8 @@ KeeperNodePtr KeeperNode::clone() const
 
 KeeperNodePtr KeeperNode::cloneWithoutChildren() const
 {
-    auto node = std::make_shared<KeeperNode>();
-    auto data_size = data.size();
-    node->data.resize(data_size);
-    memcopy(node->data.data(), data.data(), data_size);
+    auto node = KeeperNode::create();
+    node->data = data;
     node->acl_id = acl_id;
     node->is_ephemeral = is_ephemeral;
     node->is_sequential = is_sequential;
@@ -149,134 +185,259 @@ KeeperNodePtr KeeperNode::cloneWithoutChildren() const
     return node;
 }
 
+KeeperNodePtr KeeperNode::cloneForUpdate()
+{
+    auto node = cloneWithoutChildren();
+    node->children = std::move(children);
+    return node;
+}
+
 /// All stat for client should be generated by this function.
 /// This method will remove numChildren from persisted stat.
 Coordination::Stat KeeperNode::statForResponse() const
 {
-    Coordination::Stat stat_view;
-    stat_view = stat;
+    Coordination::Stat stat_view = persistedStat();
     stat_view.numChildren = children.size();
     stat_view.cversion = stat.cversion * 2 - stat.numChildren;
     return stat_view;
 }
 
-KeeperStore::KeeperStore(int64_t dead_session_check_period_ms, const String & super_digest_)
-    : session_manager(dead_session_check_period_ms), super_digest(super_digest_)
+Coordination::Stat KeeperNode::persistedStat() const
+{
+    Coordination::Stat res;
+    res.czxid = stat.czxid;
+    res.mzxid = stat.mzxid;
+    res.ctime = stat.ctime;
+    res.mtime = stat.mtime;
+    res.version = stat.version;
+    res.cversion = stat.cversion;
+    res.aversion = stat.aversion;
+    res.ephemeralOwner = stat.ephemeralOwner;
+    res.dataLength = static_cast<int32_t>(data.size());
+    res.numChildren = stat.numChildren;
+    res.pzxid = stat.pzxid;
+    return res;
+}
+
+void KeeperNode::setPersistedStat(const Coordination::Stat & persisted_stat)
+{
+    stat.czxid = persisted_stat.czxid;
+    stat.mzxid = persisted_stat.mzxid;
+    stat.ctime = persisted_stat.ctime;
+    stat.mtime = persisted_stat.mtime;
+    stat.version = persisted_stat.version;
+    stat.cversion = persisted_stat.cversion;
+    stat.aversion = persisted_stat.aversion;
+    stat.ephemeralOwner = persisted_stat.ephemeralOwner;
+    stat.numChildren = persisted_stat.numChildren;
+    stat.pzxid = persisted_stat.pzxid;
+}
+
+KeeperStore::KeeperStore(
+    int64_t dead_session_check_period_ms,
+    const String & super_digest_,
+    UInt32 data_tree_bucket_num,
+    UInt64 response_cache_max_entries,
+    bool negative_lookup_filter,
+    bool track_dirty_nodes)
+    : data_tree(data_tree_bucket_num, negative_lookup_filter, track_dirty_nodes)
+    , session_manager(dead_session_check_period_ms)
+    , response_cache(response_cache_max_entries)
+    , super_digest(super_digest_)
 {
     log = &(Poco::Logger::get("KeeperStore"));
-    data_tree.emplace("/", std::make_shared<KeeperNode>());
+    if (data_tree_bucket_num == 0)
+        throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Data tree bucket num should be greater than 0");
+
+    data_tree.emplace("/", KeeperNode::create());
 }
 
-using Undo = std::function<void()>;
+/// What is needed to revert a sub request of a multi transaction. The paths are taken
+/// from the sub request and its response, so a record holds no strings.
+struct UndoRecord
+{
+    enum class Type : UInt8
+    {
+        None,
+        Create,
+        Remove,
+        Set,
+    };
+
+    Type type = Type::None;
+
+    /// Index of the sub request in the multi request
+    size_t index = 0;
+
+    /// Create, Remove: parent pzxid before the request
+    int64_t pzxid = 0;
 
+    /// Create: owner session of the ephemeral node
+    int64_t session_id = 0;
+
+    /// Create: acl of the created node
+    uint64_t acl_id = 0;
+
+    /// Set: data and stat of the node before the request, children are not changed by set and are not copied
+    NodeData prev_data;
+    KeeperNodeStat prev_stat;
+
+    /// Remove: node before the request, a removed node has no children
+    KeeperNodePtr prev_node;
+};
+
+/// Request handlers are stateless, there is a single instance for every op num,
+/// so dispatching a request needs neither allocation nor RTTI.
 struct StoreRequest
 {
-    Coordination::ZooKeeperRequestPtr zk_request;
+    /// If undo is not null and the request modified the store, fill it in so that the modification can be reverted.
+    virtual Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t zxid,
+        int64_t session_id,
+        int64_t time,
+        UndoRecord * undo) const = 0;
+
+    virtual bool checkAuth(KeeperStore & /*storage*/, const Coordination::ZooKeeperRequestPtr & /*zk_request*/, int64_t /*session_id*/) const
+    {
+        return true;
+    }
 
-    explicit StoreRequest(const Coordination::ZooKeeperRequestPtr & zk_request_) : zk_request(zk_request_) { }
+    /// Revert the modification recorded by process.
+    virtual void revert(
+        KeeperStore & /*store*/,
+        const Coordination::ZooKeeperRequestPtr & /*zk_request*/,
+        const Coordination::ZooKeeperResponsePtr & /*response*/,
+        const UndoRecord & /*record*/) const
+    {
+    }
 
-    virtual std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t zxid, int64_t session_id, int64_t time) const = 0;
+    virtual ~StoreRequest() = default;
 
-    virtual bool checkAuth(KeeperStore & /*storage*/, int64_t /*session_id*/) const { return true; }
+protected:
+    /// Get node of request path, the path hash has been computed when parsing the request.
+    static KeeperNodePtr getRequestNode(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, const String & request_path)
+    {
+        return store.getNode(HashedPath(request_path, zk_request->getPathHash()));
+    }
 
-    virtual ~StoreRequest() = default;
+    /// Node for read requests which do not keep it, reads of parallel runners are in their epochs.
+    static const KeeperNode *
+    getReadNode(const KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, const String & request_path)
+    {
+        return store.getNodeForRead(HashedPath(request_path, zk_request->getPathHash()));
+    }
 };
 
-using StoreRequestPtr = std::shared_ptr<StoreRequest>;
-
 struct StoreRequestHeartbeat final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & /* store */, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & /* store */,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
-        return {zk_request->makeResponse(), {}};
+        return zk_request->makeResponse();
     }
 };
 
 struct StoreRequestSetWatches final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & /* storage */, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & /* storage */,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
-        return {zk_request->makeResponse(), {}};
+        return zk_request->makeResponse();
     }
 
 };
 
-struct StoreRequestSync final : public StoreRequest
+struct StoreRequestAddWatch final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & /* storage */,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
+    {
+        return zk_request->makeResponse();
+    }
+};
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & /* storage */, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
+struct StoreRequestSync final : public StoreRequest
+{
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & /* storage */,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         auto response = zk_request->makeResponse();
-        dynamic_cast<Coordination::ZooKeeperSyncResponse *>(response.get())->path
-            = dynamic_cast<Coordination::ZooKeeperSyncRequest *>(zk_request.get())->path;
-        return {response, {}};
+        static_cast<Coordination::ZooKeeperSyncResponse &>(*response).path
+            = static_cast<Coordination::ZooKeeperSyncRequest &>(*zk_request).path;
+        return response;
     }
 };
 
 struct StoreRequestCreate final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        auto parent_path = getParentPath(zk_request->getPath());
-
-        auto parent = store.getNode(parent_path);
+        auto parent = store.getNode(HashedPath(parentPathOf(zk_request->getPath())));
         if (parent == nullptr)
             return true;
 
-        const auto & node_acls = store.getACLMap().convertNumber(parent->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Create, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Create, node_acls, empty_auth_ids);
-        }
+        return store.hasPermission(session_id, parent->acl_id, Coordination::ACL::Create);
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t zxid, int64_t session_id, int64_t time) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t zxid,
+        int64_t session_id,
+        int64_t time,
+        UndoRecord * undo) const override
     {
         Poco::Logger * log = &(Poco::Logger::get("StoreRequestCreate"));
 
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
-        Undo undo;
-        Coordination::ZooKeeperCreateResponse & response = dynamic_cast<Coordination::ZooKeeperCreateResponse &>(*response_ptr);
-        Coordination::ZooKeeperCreateRequest & request = dynamic_cast<Coordination::ZooKeeperCreateRequest &>(*zk_request);
+        Coordination::ZooKeeperCreateResponse & response = static_cast<Coordination::ZooKeeperCreateResponse &>(*response_ptr);
+        Coordination::ZooKeeperCreateRequest & request = static_cast<Coordination::ZooKeeperCreateRequest &>(*zk_request);
 
-        auto parent = store.getNode(getParentPath(request.path));
+        auto parent = store.getNode(HashedPath(parentPathOf(request.path)));
         if (parent == nullptr)
         {
-            LOG_TRACE(log, "Create no parent {}, path {}", getParentPath(request.path), request.path);
+            LOG_TRACE(log, "Create no parent {}, path {}", parentPathOf(request.path), request.path);
             response.error = Coordination::Error::ZNONODE;
-            return {response_ptr, undo};
+            return response_ptr;
         }
         else if (parent->is_ephemeral)
         {
             response.error = Coordination::Error::ZNOCHILDRENFOREPHEMERALS;
-            return {response_ptr, undo};
+            return response_ptr;
+        }
+        /// Ttl is sent by CreateTTL only, the same as ZooKeeper
+        else if (
+            request.is_ttl != (request.getOpNum() == Coordination::OpNum::CreateTTL)
+            || (request.is_ttl && (request.ttl <= 0 || request.ttl > MAX_TTL_MS)))
+        {
+            response.error = Coordination::Error::ZBADARGUMENTS;
+            return response_ptr;
         }
 
         String path_created = request.path;
+        size_t path_created_hash = zk_request->getPathHash();
         if (request.is_sequential)
         {
             auto seq_num = parent->stat.cversion;
@@ -286,19 +447,20 @@ struct StoreRequestCreate final : public StoreRequest
             seq_num_str << std::setw(10) << std::setfill('0') << seq_num;
 
             path_created += seq_num_str.str();
+            path_created_hash = StringHash()(path_created);
         }
-        if (store.exists(path_created))
+        if (store.exists(HashedPath(path_created, path_created_hash)))
         {
             response.error = Coordination::Error::ZNODEEXISTS;
-            return {response_ptr, undo};
+            return response_ptr;
         }
-        String child_path = getBaseName(path_created);
+        std::string_view child_path = baseNameOf(path_created);
         if (child_path.empty())
         {
             response.error = Coordination::Error::ZBADARGUMENTS;
-            return {response_ptr, undo};
+            return response_ptr;
         }
-        std::shared_ptr<KeeperNode> created_node = std::make_shared<KeeperNode>();
+        KeeperNodePtr created_node = KeeperNode::create();
 
         Coordination::ACLs node_acls;
         uint64_t acl_id{};
@@ -311,7 +473,7 @@ struct StoreRequestCreate final : public StoreRequest
             if (!fixupACL(request.acls, session_auth_ids, node_acls))
             {
                 response.error = Coordination::Error::ZINVALIDACL;
-                return {response_ptr, {}};
+                return response_ptr;
             }
 
             acl_id = store.acl_map.convertACLs(node_acls);
@@ -326,11 +488,14 @@ struct StoreRequestCreate final : public StoreRequest
         created_node->stat.ctime = time;
         created_node->stat.mtime = created_node->stat.ctime;
         created_node->stat.numChildren = 0;
-        created_node->stat.dataLength = request.data.length();
         created_node->data = request.data;
         created_node->is_ephemeral = request.is_ephemeral;
         if (request.is_ephemeral)
             created_node->stat.ephemeralOwner = session_id;
+        else if (request.is_container)
+            created_node->stat.ephemeralOwner = CONTAINER_OWNER;
+        else if (request.is_ttl)
+            created_node->stat.ephemeralOwner = TTL_OWNER_MASK | request.ttl;
         created_node->is_sequential = request.is_sequential;
 
         int64_t pzxid;
@@ -338,6 +503,7 @@ struct StoreRequestCreate final : public StoreRequest
         {
             response.path_created = path_created;
 
+            parent = store.getNodeForUpdate(HashedPath(parentPathOf(request.path)));
             parent->children.insert(child_path);
 
             ++parent->stat.cversion;
@@ -347,79 +513,80 @@ struct StoreRequestCreate final : public StoreRequest
             parent->stat.pzxid = zxid;
         }
 
-        store.addNode(path_created, std::move(created_node));
+        store.unindexExpiringNode(parentPathOf(request.path), *parent);
+        store.indexExpiringNode(path_created, *created_node);
+        if (response.with_stat)
+            response.stat = created_node->statForResponse();
+        store.addNode(HashedPath(path_created, path_created_hash), std::move(created_node));
 
         if (request.is_ephemeral)
             store.addEphemeralNode(session_id, path_created);
 
-        undo = [&store,
-                session_id,
-                path_created,
-                pzxid,
-                is_ephemeral = request.is_ephemeral,
-                parent_path = getParentPath(request.path),
-                child_path,
-                acl_id] {
-            {
-                store.removeNode(path_created);
-                store.getACLMap().removeUsage(acl_id);
-            }
-            if (is_ephemeral)
-                store.removeEphemeralNode(session_id, path_created);
-
-            auto undo_parent = store.getNode(parent_path);
-            {
-                --undo_parent->stat.cversion;
-                --undo_parent->stat.numChildren;
-                undo_parent->stat.pzxid = pzxid;
-                undo_parent->children.erase(child_path);
-            }
-        };
+        if (undo)
+        {
+            undo->type = UndoRecord::Type::Create;
+            undo->pzxid = pzxid;
+            undo->session_id = session_id;
+            undo->acl_id = acl_id;
+        }
 
         response.error = Coordination::Error::ZOK;
-        return {response_ptr, undo};
+        return response_ptr;
+    }
+
+    void revert(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        const Coordination::ZooKeeperResponsePtr & response,
+        const UndoRecord & record) const override
+    {
+        const auto & request = static_cast<const Coordination::ZooKeeperCreateRequest &>(*zk_request);
+        const auto & path_created = static_cast<const Coordination::ZooKeeperCreateResponse &>(*response).path_created;
+
+        {
+            store.removeNode(path_created);
+            store.getACLMap().removeUsage(record.acl_id);
+        }
+        if (request.is_ephemeral)
+            store.removeEphemeralNode(record.session_id, path_created);
+        else if (request.is_container || request.is_ttl)
+            store.getNodeExpiryIndex().remove(path_created);
+
+        auto undo_parent = store.getNodeForUpdate(HashedPath(parentPathOf(request.path)));
+        {
+            --undo_parent->stat.cversion;
+            --undo_parent->stat.numChildren;
+            undo_parent->stat.pzxid = record.pzxid;
+            undo_parent->children.erase(baseNameOf(path_created));
+        }
+        store.indexExpiringNode(parentPathOf(request.path), *undo_parent);
     }
 };
 
 struct StoreRequestGet final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        Poco::Logger * log = &(Poco::Logger::get("StoreRequestGet"));
-        auto node = store.getNode(zk_request->getPath());
+        const auto * node = getReadNode(store, zk_request, zk_request->getPath());
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        LOG_TRACE(log, "path {}, acl_id {}, node_acls {}", zk_request->getPath(), node->acl_id, toString(node_acls));
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        return store.hasPermission(session_id, node->acl_id, Coordination::ACL::Read);
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
-        Coordination::ZooKeeperGetResponse & response = dynamic_cast<Coordination::ZooKeeperGetResponse &>(*response_ptr);
-        Coordination::ZooKeeperGetRequest & request = dynamic_cast<Coordination::ZooKeeperGetRequest &>(*zk_request);
+        Coordination::ZooKeeperGetResponse & response = static_cast<Coordination::ZooKeeperGetResponse &>(*response_ptr);
+        Coordination::ZooKeeperGetRequest & request = static_cast<Coordination::ZooKeeperGetRequest &>(*zk_request);
 
-        auto node = store.getNode(request.path);
+        const auto * node = getReadNode(store, zk_request, request.path);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
@@ -428,55 +595,41 @@ struct StoreRequestGet final : public StoreRequest
         {
             {
                 response.stat = node->statForResponse();
-                response.data = node->data;
+                response.data = node->data.view();
             }
             response.error = Coordination::Error::ZOK;
         }
 
-        return {response_ptr, {}};
+        return response_ptr;
     }
 };
 
 struct StoreRequestRemove final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        auto parent = store.getNode(getParentPath(zk_request->getPath()));
+        auto parent = store.getNode(HashedPath(parentPathOf(zk_request->getPath())));
         if (parent == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(parent->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Delete, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Delete, node_acls, empty_auth_ids);
-        }
+        return store.hasPermission(session_id, parent->acl_id, Coordination::ACL::Delete);
     }
 
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t zxid, int64_t /* session_id */, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t zxid,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * undo) const override
     {
         Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
-        Coordination::ZooKeeperRemoveResponse & response = dynamic_cast<Coordination::ZooKeeperRemoveResponse &>(*response_ptr);
-        Coordination::ZooKeeperRemoveRequest & request = dynamic_cast<Coordination::ZooKeeperRemoveRequest &>(*zk_request);
-        Undo undo;
+        Coordination::ZooKeeperRemoveResponse & response = static_cast<Coordination::ZooKeeperRemoveResponse &>(*response_ptr);
+        Coordination::ZooKeeperRemoveRequest & request = static_cast<Coordination::ZooKeeperRemoveRequest &>(*zk_request);
 
         Poco::Logger * log = &(Poco::Logger::get("StoreRequestRemove"));
-        auto node = store.getNode(request.path);
+        auto node = getRequestNode(store, zk_request, request.path);
         if (node == nullptr)
         {
             response.error = Coordination::Error::ZNONODE;
@@ -495,59 +648,199 @@ struct StoreRequestRemove final : public StoreRequest
             response.error = Coordination::Error::ZOK;
 
             int64_t pzxid;
-            auto prev_node = node->clone();
-            auto child_basename = getBaseName(request.path);
+            auto child_basename = baseNameOf(request.path);
 
-            auto parent = store.getNode(getParentPath(request.path));
+            auto parent = store.getNodeForUpdate(HashedPath(parentPathOf(request.path)));
             {
                 --parent->stat.numChildren;
                 pzxid = parent->stat.pzxid;
                 parent->stat.pzxid = zxid;
                 parent->children.erase(child_basename);
             }
+            store.indexExpiringNode(parentPathOf(request.path), *parent);
 
-            store.acl_map.removeUsage(prev_node->acl_id);
-            store.removeNode(request.path);
+            store.acl_map.removeUsage(node->acl_id);
+            store.removeNode(HashedPath(request.path, zk_request->getPathHash()));
 
-            int64_t ephemeral_owner{};
+            if (node->is_ephemeral)
+                store.removeEphemeralNode(node->stat.ephemeralOwner, request.path);
+            else
+                store.unindexExpiringNode(request.path, *node);
 
-            if (prev_node->is_ephemeral)
+            if (undo)
             {
-                ephemeral_owner = prev_node->stat.ephemeralOwner;
-                store.removeEphemeralNode(ephemeral_owner, request.path);
+                undo->type = UndoRecord::Type::Remove;
+                undo->pzxid = pzxid;
+                undo->prev_node = node->cloneWithoutChildren();
             }
+        }
 
-            undo = [prev_node, &store, ephemeral_owner, path = request.path, pzxid, child_basename] {
-                if (prev_node->is_ephemeral)
-                    store.addEphemeralNode(ephemeral_owner, path);
-                store.acl_map.addUsage(prev_node->acl_id);
+        return response_ptr;
+    }
 
-                store.addNode(path, prev_node);
-                auto undo_parent = store.getNode(getParentPath(path));
-                {
-                    ++(undo_parent->stat.numChildren);
-                    undo_parent->stat.pzxid = pzxid;
-                    undo_parent->children.insert(child_basename);
-                }
-            };
+    void revert(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        const Coordination::ZooKeeperResponsePtr & /*response*/,
+        const UndoRecord & record) const override
+    {
+        const auto & path = static_cast<const Coordination::ZooKeeperRemoveRequest &>(*zk_request).path;
+        const auto & prev_node = record.prev_node;
+
+        if (prev_node->is_ephemeral)
+            store.addEphemeralNode(prev_node->stat.ephemeralOwner, path);
+        store.acl_map.addUsage(prev_node->acl_id);
+
+        store.indexExpiringNode(path, *prev_node);
+        store.addNode(path, prev_node);
+        auto undo_parent = store.getNodeForUpdate(HashedPath(parentPathOf(path)));
+        {
+            ++(undo_parent->stat.numChildren);
+            undo_parent->stat.pzxid = record.pzxid;
+            undo_parent->children.insert(getBaseName(path));
+        }
+        store.unindexExpiringNode(parentPathOf(path), *undo_parent);
+    }
+};
+
+struct StoreRequestRemoveRecursive final : public StoreRequest
+{
+    /// Upper bound of nodes removed by a request, requests may ask for smaller limits
+    static constexpr size_t MAX_REMOVE_NODES = 1000000;
+
+    using SubtreeNodes = std::vector<std::pair<String, KeeperNodePtr>>;
+
+    static size_t removeNodesLimit(const Coordination::ZooKeeperRemoveRecursiveRequest & request)
+    {
+        return std::min(static_cast<size_t>(request.remove_nodes_limit), MAX_REMOVE_NODES);
+    }
+
+    /// Nodes of the subtree of path with parents before children, false if there are more than limit of them
+    static bool collectSubtree(KeeperStore & store, const String & path, size_t limit, SubtreeNodes & nodes)
+    {
+        auto root = store.getNode(path);
+        if (root == nullptr)
+            return true;
+        nodes.emplace_back(path, root);
+
+        for (size_t i = 0; i < nodes.size(); ++i)
+        {
+            if (nodes[i].second->children.empty())
+                continue;
+            if (nodes.size() + nodes[i].second->children.size() > limit)
+                return false;
+
+            String prefix = nodes[i].first + "/";
+            for (const auto & child : nodes[i].second->children)
+            {
+                String child_path = prefix + child;
+                auto child_node = store.getNode(child_path);
+                if (child_node == nullptr)
+                    throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Child {} of {} is not in data tree", child, nodes[i].first);
+                nodes.emplace_back(std::move(child_path), child_node);
+            }
+        }
+        return nodes.size() <= limit;
+    }
+
+    /// Delete permission is needed on the parent of every removed node, as if they were removed one by one
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
+    {
+        const auto & request = static_cast<const Coordination::ZooKeeperRemoveRecursiveRequest &>(*zk_request);
+        if (request.path == "/")
+            return true;
+
+        auto parent = store.getNode(HashedPath(parentPathOf(request.path)));
+        if (parent != nullptr && !store.hasPermission(session_id, parent->acl_id, Coordination::ACL::Delete))
+            return false;
+
+        SubtreeNodes nodes;
+        /// Nothing is removed then
+        if (!collectSubtree(store, request.path, removeNodesLimit(request), nodes))
+            return true;
+
+        for (const auto & [path, node] : nodes)
+            if (!node->children.empty() && !store.hasPermission(session_id, node->acl_id, Coordination::ACL::Delete))
+                return false;
+        return true;
+    }
+
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t zxid,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
+    {
+        Coordination::ZooKeeperResponsePtr response_ptr = zk_request->makeResponse();
+        auto & response = static_cast<Coordination::ZooKeeperRemoveRecursiveResponse &>(*response_ptr);
+        const auto & request = static_cast<const Coordination::ZooKeeperRemoveRecursiveRequest &>(*zk_request);
+
+        if (request.path == "/")
+        {
+            response.error = Coordination::Error::ZBADARGUMENTS;
+            return response_ptr;
+        }
+
+        SubtreeNodes nodes;
+        if (!collectSubtree(store, request.path, removeNodesLimit(request), nodes))
+        {
+            response.error = Coordination::Error::ZNOTEMPTY;
+            return response_ptr;
+        }
+        if (nodes.empty())
+        {
+            response.error = Coordination::Error::ZNONODE;
+            return response_ptr;
+        }
+
+        response.error = Coordination::Error::ZOK;
+
+        /// Only the parent of the subtree stays
+        auto parent = store.getNodeForUpdate(HashedPath(parentPathOf(request.path)));
+        {
+            --parent->stat.numChildren;
+            parent->stat.pzxid = zxid;
+            parent->children.erase(baseNameOf(request.path));
+        }
+        store.indexExpiringNode(parentPathOf(request.path), *parent);
+
+        response.removed_paths.reserve(nodes.size());
+        for (auto it = nodes.rbegin(); it != nodes.rend(); ++it)
+        {
+            auto & [path, node] = *it;
+            store.acl_map.removeUsage(node->acl_id);
+            store.removeNode(path);
+            if (node->is_ephemeral)
+                store.removeEphemeralNode(node->stat.ephemeralOwner, path);
+            else
+                store.unindexExpiringNode(path, *node);
+            response.removed_paths.push_back(std::move(path));
         }
 
-        return {response_ptr, undo};
+        return response_ptr;
     }
 };
 
 struct StoreRequestExists final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /* zxid */, int64_t /* session_id */, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         Coordination::ZooKeeperResponsePtr response = zk_request->makeResponse();
-        auto & response_typed = dynamic_cast<Coordination::ZooKeeperExistsResponse &>(*response);
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperExistsRequest &>(*zk_request);
+        auto & response_typed = static_cast<Coordination::ZooKeeperExistsResponse &>(*response);
+        auto & request_typed = static_cast<Coordination::ZooKeeperExistsRequest &>(*zk_request);
 
-        auto node = store.getNode(request_typed.path);
+        /// Polling missing paths is common, for example lock and leader election recipes.
+        const KeeperNode * node = nullptr;
+        if (store.mayExist(HashedPath(request_typed.path, zk_request->getPathHash())))
+            node = getReadNode(store, zk_request, request_typed.path);
         if (node != nullptr)
         {
             response_typed.stat = node->statForResponse();
@@ -558,134 +851,262 @@ struct StoreRequestExists final : public StoreRequest
             response_typed.error = Coordination::Error::ZNONODE;
         }
 
-        return {response, {}};
+        return response;
     }
 };
 
-struct StoreRequestSet final : public StoreRequest
+struct StoreRequestStatBatch final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    /// Upper bound of paths of a request, so that one request does not hold up the others for long
+    static constexpr size_t MAX_STAT_BATCH_PATHS = 10000;
+
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /* zxid */,
+        int64_t /* session_id */,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
-        auto node = store.getNode(zk_request->getPath());
-        if (node == nullptr)
-            return true;
-
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
+        Coordination::ZooKeeperResponsePtr response = zk_request->makeResponse();
+        auto & response_typed = static_cast<Coordination::ZooKeeperStatBatchResponse &>(*response);
+        const auto & paths = static_cast<const Coordination::ZooKeeperStatBatchRequest &>(*zk_request).paths;
 
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
+        if (paths.size() > MAX_STAT_BATCH_PATHS)
         {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Write, node_acls, session_auths);
+            response_typed.error = Coordination::Error::ZBADARGUMENTS;
+            return response;
         }
-        else
+
+        response_typed.stats.resize(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i)
         {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Write, node_acls, empty_auth_ids);
+            auto & path_stat = response_typed.stats[i];
+            /// Only the stat is copied, not the data
+            HashedPath path(paths[i]);
+            const KeeperNode * node = nullptr;
+            if (store.mayExist(path))
+                node = store.getNodeForRead(path);
+            if (node != nullptr)
+                path_stat.stat = node->statForResponse();
+            else
+                path_stat.error = Coordination::Error::ZNONODE;
         }
+
+        response_typed.error = Coordination::Error::ZOK;
+        return response;
+    }
+};
+
+struct StoreRequestSet final : public StoreRequest
+{
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
+    {
+        auto node = getRequestNode(store, zk_request, zk_request->getPath());
+        if (node == nullptr)
+            return true;
+
+        return store.hasPermission(session_id, node->acl_id, Coordination::ACL::Write);
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t zxid, int64_t /* session_id */, int64_t time) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t zxid,
+        int64_t /* session_id */,
+        int64_t time,
+        UndoRecord * undo) const override
     {
         Coordination::ZooKeeperResponsePtr response = zk_request->makeResponse();
-        auto & response_typed = dynamic_cast<Coordination::ZooKeeperSetResponse &>(*response);
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperSetRequest &>(*zk_request);
-        Undo undo;
+        auto & response_typed = static_cast<Coordination::ZooKeeperSetResponse &>(*response);
+        auto & request_typed = static_cast<Coordination::ZooKeeperSetRequest &>(*zk_request);
 
-        auto node = store.getNode(request_typed.path);
+        auto node = getRequestNode(store, zk_request, request_typed.path);
         if (node == nullptr)
         {
             response_typed.error = Coordination::Error::ZNONODE;
         }
         else if (request_typed.version == -1 || request_typed.version == node->stat.version)
         {
-            auto prev_node = node->clone();
+            if (undo)
+            {
+                undo->type = UndoRecord::Type::Set;
+                undo->prev_data = node->data;
+                undo->prev_stat = node->stat;
+            }
+
+            HashedPath hashed_path(request_typed.path, zk_request->getPathHash());
+            node = store.getNodeForUpdate(hashed_path);
+            store.updateDigest(request_typed.path, *node);
             {
                 ++node->stat.version;
                 node->stat.mzxid = zxid;
                 node->stat.mtime = time;
-                node->stat.dataLength = request_typed.data.length();
+                store.onNodeDataChanged(hashed_path, node->data.size(), request_typed.data.size());
                 node->data = request_typed.data;
             }
+            store.updateDigest(request_typed.path, *node);
+            /// Deadline of a TTL node moves
+            store.indexExpiringNode(request_typed.path, *node);
 
-            auto parent = store.getNode(getParentPath(request_typed.path));
+            auto parent = store.getNode(HashedPath(parentPathOf(request_typed.path)));
             response_typed.stat = node->statForResponse();
             response_typed.error = Coordination::Error::ZOK;
-
-            undo = [prev_node, &store, path = request_typed.path] { store.addNode(path, prev_node); };
         }
         else
         {
             response_typed.error = Coordination::Error::ZBADVERSION;
         }
 
-        return {response, undo};
+        return response;
+    }
+
+    void revert(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        const Coordination::ZooKeeperResponsePtr & /*response*/,
+        const UndoRecord & record) const override
+    {
+        const auto & path = static_cast<const Coordination::ZooKeeperSetRequest &>(*zk_request).path;
+        HashedPath hashed_path(path, zk_request->getPathHash());
+        auto node = store.getNodeForUpdate(hashed_path);
+        store.updateDigest(path, *node);
+        {
+            /// Later sub requests are reverted before, so the stat is the one right after the set
+            node->stat = record.prev_stat;
+            store.onNodeDataChanged(hashed_path, node->data.size(), record.prev_data.size());
+            node->data = record.prev_data;
+        }
+        store.updateDigest(path, *node);
+        store.indexExpiringNode(path, *node);
     }
 };
 
 struct StoreRequestList final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        auto node = store.getNode(zk_request->getPath());
+        const auto * node = getReadNode(store, zk_request, zk_request->getPath());
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
+        return store.hasPermission(session_id, node->acl_id, Coordination::ACL::Read);
+    }
 
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
+    /// Upper bounds of a page of ListWithData and PagedList, requests may ask for smaller pages
+    static constexpr size_t MAX_PAGE_CHILDREN = 10000;
+    static constexpr size_t MAX_PAGE_BYTES = 1 << 20;
+
+    static void listWithData(
+        KeeperStore & store,
+        const Coordination::ZooKeeperListWithDataRequest & request,
+        const KeeperNode & node,
+        int64_t session_id,
+        Coordination::ZooKeeperListWithDataResponse & response)
+    {
+        auto limit = [](int32_t asked, size_t max) { return asked > 0 ? std::min(static_cast<size_t>(asked), max) : max; };
+        size_t max_children = limit(request.max_children, MAX_PAGE_CHILDREN);
+        size_t max_bytes = limit(request.max_bytes, MAX_PAGE_BYTES);
+
+        std::vector<std::string_view> names;
+        response.has_more = node.children.page(request.start_after, max_children, names);
+        response.stat = node.statForResponse();
+
+        String child_path = request.path == "/" ? request.path : request.path + "/";
+        const size_t prefix_size = child_path.size();
+        size_t bytes = 0;
+        response.children.reserve(names.size());
+        for (auto name : names)
+        {
+            /// A page has at least one child, so that paging always moves on
+            if (bytes >= max_bytes)
+            {
+                response.has_more = true;
+                break;
+            }
+
+            child_path.resize(prefix_size);
+            child_path.append(name);
+            const auto * child_node = store.getNodeForRead(child_path);
+            if (child_node == nullptr)
+                throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Child {} of {} is not in data tree", name, request.path);
+
+            auto & child = response.children.emplace_back();
+            child.name = name;
+            /// As a get of the child would be checked
+            if (!store.hasPermission(session_id, child_node->acl_id, Coordination::ACL::Read))
+                child.error = Coordination::Error::ZNOAUTH;
+            else
+            {
+                if (request.with_data)
+                    child.data = child_node->data.view();
+                if (request.with_stat)
+                    child.stat = child_node->statForResponse();
+            }
+            bytes += child.name.size() + child.data.size();
         }
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /*zxid*/, int64_t /*session_id*/, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /*zxid*/,
+        int64_t session_id,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         auto response = zk_request->makeResponse();
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperListRequest &>(*zk_request);
+        auto & request_typed = static_cast<Coordination::ZooKeeperListRequest &>(*zk_request);
 
-        auto node = store.getNode(request_typed.path);
+        const auto * node = getReadNode(store, zk_request, request_typed.path);
         if (node == nullptr)
         {
             response->error = Coordination::Error::ZNONODE;
-            return {response, {}};
+            return response;
         }
 
         auto path_prefix = request_typed.path;
         if (path_prefix.empty())
             throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Logical error: path cannot be empty");
 
+        if (zk_request->getOpNum() == Coordination::OpNum::ListWithData)
+        {
+            listWithData(
+                store,
+                static_cast<const Coordination::ZooKeeperListWithDataRequest &>(request_typed),
+                *node,
+                session_id,
+                static_cast<Coordination::ZooKeeperListWithDataResponse &>(*response));
+            response->error = Coordination::Error::ZOK;
+            return response;
+        }
+
+        if (zk_request->getOpNum() == Coordination::OpNum::PagedList)
+        {
+            const auto & paged_request = static_cast<const Coordination::ZooKeeperPagedListRequest &>(request_typed);
+            auto & paged_response = static_cast<Coordination::ZooKeeperPagedListResponse &>(*response);
+            size_t limit = MAX_PAGE_CHILDREN;
+            if (paged_request.limit > 0)
+                limit = std::min(static_cast<size_t>(paged_request.limit), MAX_PAGE_CHILDREN);
+
+            std::vector<std::string_view> names;
+            paged_response.has_more = node->children.page(paged_request.start_after, limit, names);
+            paged_response.stat = node->statForResponse();
+            paged_response.names.reserve(names.size());
+            for (auto name : names)
+                paged_response.names.push_back(name);
+            response->error = Coordination::Error::ZOK;
+            return response;
+        }
+
         if (response->getOpNum() == Coordination::OpNum::List || response->getOpNum() == Coordination::OpNum::FilteredList)
         {
             using enum Coordination::ZooKeeperFilteredListRequest::ListRequestType;
             auto list_request_type = ALL;
-            if (auto * filtered_list_request = dynamic_cast<Coordination::ZooKeeperFilteredListRequest *>(&request_typed))
-            {
-                list_request_type = filtered_list_request->list_request_type;
-            }
+            if (zk_request->getOpNum() == Coordination::OpNum::FilteredList)
+                list_request_type = static_cast<Coordination::ZooKeeperFilteredListRequest &>(request_typed).list_request_type;
 
-            auto & response_typed = dynamic_cast<Coordination::ZooKeeperListResponse &>(*response);
+            auto & response_typed = static_cast<Coordination::ZooKeeperListResponse &>(*response);
 
             response_typed.stat = node->statForResponse();
 
@@ -693,12 +1114,12 @@ struct StoreRequestList final : public StoreRequest
             {
                 response_typed.names.reserve(node->children.size());
                 response_typed.names.push_back(node->children.begin(), node->children.end());
-                return {response, {}};
+                return response;
             }
 
             auto add_child = [&](const auto & child)
             {
-                auto child_node = store.getNode(request_typed.path + "/" + child);
+                const auto * child_node = store.getNodeForRead(request_typed.path + "/" + child);
                 if (node == nullptr)
                 {
                     LOG_ERROR(
@@ -709,7 +1130,7 @@ struct StoreRequestList final : public StoreRequest
                     std::terminate();
                 }
 
-                const auto is_ephemeral = child_node->stat.ephemeralOwner != 0;
+                const auto is_ephemeral = isEphemeralOwner(child_node->stat.ephemeralOwner);
                 return (is_ephemeral && list_request_type == EPHEMERAL_ONLY) || (!is_ephemeral && list_request_type == PERSISTENT_ONLY);
             };
 
@@ -721,54 +1142,41 @@ struct StoreRequestList final : public StoreRequest
         }
         else
         {
-            auto & response_typed = dynamic_cast<Coordination::ZooKeeperSimpleListResponse &>(*response);
+            auto & response_typed = static_cast<Coordination::ZooKeeperSimpleListResponse &>(*response);
             response_typed.names.reserve(node->children.size());
             response_typed.names.push_back(node->children.begin(), node->children.end());
         }
 
         response->error = Coordination::Error::ZOK;
 
-        return {response, {}};
+        return response;
     }
 };
 
 struct StoreRequestCheck final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        auto node = store.getNode(zk_request->getPath());
+        auto node = getRequestNode(store, zk_request, zk_request->getPath());
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        return store.hasPermission(session_id, node->acl_id, Coordination::ACL::Read);
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /*zxid*/, int64_t /*session_id*/, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /*zxid*/,
+        int64_t /*session_id*/,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         auto response = zk_request->makeResponse();
-        auto & response_typed = dynamic_cast<Coordination::ZooKeeperCheckResponse &>(*response);
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperCheckRequest &>(*zk_request);
+        auto & response_typed = static_cast<Coordination::ZooKeeperCheckResponse &>(*response);
+        auto & request_typed = static_cast<Coordination::ZooKeeperCheckRequest &>(*zk_request);
 
-        auto node = store.getNode(request_typed.path);
+        auto node = getRequestNode(store, zk_request, request_typed.path);
         if (node == nullptr)
         {
             response_typed.error = Coordination::Error::ZNONODE;
@@ -781,46 +1189,34 @@ struct StoreRequestCheck final : public StoreRequest
         {
             response_typed.error = Coordination::Error::ZOK;
         }
-        return {response, {}};
+        return response;
     }
 };
 
 struct StoreRequestSetACL final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        auto node = store.getNode(zk_request->getPath());
+        auto node = getRequestNode(store, zk_request, zk_request->getPath());
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            return checkACL(Coordination::ACL::Admin, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Admin, node_acls, empty_auth_ids);
-        }
+        return store.hasPermission(session_id, node->acl_id, Coordination::ACL::Admin);
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /*zxid*/, int64_t session_id, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /*zxid*/,
+        int64_t session_id,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         auto response = zk_request->makeResponse();
-        auto & response_typed = dynamic_cast<Coordination::ZooKeeperSetACLResponse &>(*response);
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperSetACLRequest &>(*zk_request);
+        auto & response_typed = static_cast<Coordination::ZooKeeperSetACLResponse &>(*response);
+        auto & request_typed = static_cast<Coordination::ZooKeeperSetACLRequest &>(*zk_request);
 
-        auto node = store.getNode(request_typed.path);
+        auto node = getRequestNode(store, zk_request, request_typed.path);
         if (node == nullptr)
         {
             response_typed.error = Coordination::Error::ZNONODE;
@@ -839,62 +1235,53 @@ struct StoreRequestSetACL final : public StoreRequest
                 if (!fixupACL(request_typed.acls, session_auth_ids, node_acls))
                 {
                     response_typed.error = Coordination::Error::ZINVALIDACL;
-                    return {response, {}};
+                    return response;
                 }
             }
 
             uint64_t acl_id = store.acl_map.convertACLs(node_acls);
             store.acl_map.addUsage(acl_id);
 
+            node = store.getNodeForUpdate(HashedPath(request_typed.path, zk_request->getPathHash()));
+            store.updateDigest(request_typed.path, *node);
             node->acl_id = acl_id;
             ++node->stat.aversion;
+            store.updateDigest(request_typed.path, *node);
 
             response_typed.stat = node->stat;
             response_typed.error = Coordination::Error::ZOK;
         }
 
         /// It cannot be used inside multi-transaction?
-        return {response, {}};
+        return response;
     }
 };
 
 struct StoreRequestGetACL final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
-        auto node = store.getNode(zk_request->getPath());
+        const auto * node = getReadNode(store, zk_request, zk_request->getPath());
         if (node == nullptr)
             return true;
 
-        const auto & node_acls = store.acl_map.convertNumber(node->acl_id);
-        if (node_acls.empty())
-            return true;
-
-        std::shared_lock r_lock(store.auth_mutex);
-        auto it = store.session_and_auth.find(session_id);
-        if (it != store.session_and_auth.end())
-        {
-            const auto & session_auths = it->second;
-            /// LOL, GetACL require more permissions, then SetACL...
-            return checkACL(Coordination::ACL::Admin | Coordination::ACL::Read, node_acls, session_auths);
-        }
-        else
-        {
-            std::vector<Coordination::AuthID> empty_auth_ids;
-            return checkACL(Coordination::ACL::Admin | Coordination::ACL::Read, node_acls, empty_auth_ids);
-        }
+        /// LOL, GetACL require more permissions, then SetACL...
+        return store.hasPermission(session_id, node->acl_id, Coordination::ACL::Admin | Coordination::ACL::Read);
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /*zxid*/, int64_t /*session_id*/, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /*zxid*/,
+        int64_t /*session_id*/,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         auto response = zk_request->makeResponse();
-        auto & response_typed = dynamic_cast<Coordination::ZooKeeperGetACLResponse &>(*response);
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperGetACLRequest &>(*zk_request);
+        auto & response_typed = static_cast<Coordination::ZooKeeperGetACLResponse &>(*response);
+        auto & request_typed = static_cast<Coordination::ZooKeeperGetACLRequest &>(*zk_request);
 
-        auto node = store.getNode(request_typed.path);
+        const auto * node = getReadNode(store, zk_request, request_typed.path);
         if (node == nullptr)
         {
             response_typed.error = Coordination::Error::ZNONODE;
@@ -902,23 +1289,26 @@ struct StoreRequestGetACL final : public StoreRequest
         else
         {
             response_typed.stat = node->stat;
-            response_typed.acl = store.acl_map.convertNumber(node->acl_id);
+            response_typed.acl = *store.acl_map.convertNumber(node->acl_id);
         }
 
-        return {response, {}};
+        return response;
     }
 };
 
 struct StoreRequestAuth final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t /*zxid*/, int64_t session_id, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t /*zxid*/,
+        int64_t session_id,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         auto response = zk_request->makeResponse();
-        auto & request_typed = dynamic_cast<Coordination::ZooKeeperAuthRequest &>(*zk_request);
-        auto & response_typed = dynamic_cast<Coordination::ZooKeeperAuthResponse &>(*response);
+        auto & request_typed = static_cast<Coordination::ZooKeeperAuthRequest &>(*zk_request);
+        auto & response_typed = static_cast<Coordination::ZooKeeperAuthResponse &>(*response);
 
         auto & sessions_and_auth = store.session_and_auth;
 
@@ -935,6 +1325,7 @@ struct StoreRequestAuth final : public StoreRequest
 
                 std::lock_guard w_lock(store.auth_mutex);
                 sessions_and_auth[session_id].emplace_back(auth);
+                store.acl_decision_cache.invalidate(session_id);
             }
             else
             {
@@ -943,32 +1334,37 @@ struct StoreRequestAuth final : public StoreRequest
                 std::lock_guard w_lock(store.auth_mutex);
                 auto & session_ids = sessions_and_auth[session_id];
                 if (std::find(session_ids.begin(), session_ids.end(), auth) == session_ids.end())
+                {
                     sessions_and_auth[session_id].emplace_back(auth);
+                    store.acl_decision_cache.invalidate(session_id);
+                }
             }
         }
 
-        return {response, {}};
+        return response;
     }
 };
 
+static const StoreRequest & getStoreRequest(Coordination::OpNum op_num);
+
 struct StoreRequestMultiTxn final : public StoreRequest
 {
     using OperationType = Coordination::ZooKeeperMultiRequest::OperationType;
-    OperationType operation_type = OperationType::Unspecified;
 
-    bool checkAuth(KeeperStore & store, int64_t session_id) const override
+    /// Sub requests of a parallel MultiRead taken by a thread at a time
+    static constexpr size_t MULTI_READ_BATCH_SIZE = 8;
+
+    /// Sub requests are held as Coordination::RequestPtr, which is a virtual base of ZooKeeperRequest,
+    /// so a cross cast is needed to reach them.
+    static Coordination::ZooKeeperRequestPtr getSubRequest(const Coordination::RequestPtr & sub_request)
     {
-        for (const auto & concrete_request : concrete_requests)
-            if (!concrete_request->checkAuth(store, session_id))
-                return false;
-        return true;
+        return std::dynamic_pointer_cast<Coordination::ZooKeeperRequest>(sub_request);
     }
 
-    std::vector<StoreRequestPtr> concrete_requests;
-    explicit StoreRequestMultiTxn(const Coordination::ZooKeeperRequestPtr & zk_request_) : StoreRequest(zk_request_)
+    /// Validate sub requests and return whether it is a read or write transaction.
+    static OperationType getOperationType(const Coordination::ZooKeeperMultiRequest & request)
     {
-        Coordination::ZooKeeperMultiRequest & request = dynamic_cast<Coordination::ZooKeeperMultiRequest &>(*zk_request);
-        concrete_requests.reserve(request.requests.size());
+        OperationType operation_type = OperationType::Unspecified;
 
         const auto check_operation_type = [&](OperationType type)
         {
@@ -979,66 +1375,120 @@ struct StoreRequestMultiTxn final : public StoreRequest
 
         for (const auto & sub_request : request.requests)
         {
-            auto sub_zk_request = std::dynamic_pointer_cast<Coordination::ZooKeeperRequest>(sub_request);
-            if (sub_zk_request->getOpNum() == Coordination::OpNum::Create)
-            {
-                check_operation_type(OperationType::Write);
-                concrete_requests.push_back(std::make_shared<StoreRequestCreate>(sub_zk_request));
-            }
-            else if (sub_zk_request->getOpNum() == Coordination::OpNum::Remove)
-            {
-                check_operation_type(OperationType::Write);
-                concrete_requests.push_back(std::make_shared<StoreRequestRemove>(sub_zk_request));
-            }
-            else if (sub_zk_request->getOpNum() == Coordination::OpNum::Set)
+            auto op_num = getSubRequest(sub_request)->getOpNum();
+            switch (op_num)
             {
-                check_operation_type(OperationType::Write);
-                concrete_requests.push_back(std::make_shared<StoreRequestSet>(sub_zk_request));
+                case Coordination::OpNum::Create:
+                case Coordination::OpNum::Create2:
+                case Coordination::OpNum::CreateContainer:
+                case Coordination::OpNum::CreateTTL:
+                case Coordination::OpNum::Remove:
+                case Coordination::OpNum::Set:
+                case Coordination::OpNum::Check:
+                    check_operation_type(OperationType::Write);
+                    break;
+                case Coordination::OpNum::Get:
+                case Coordination::OpNum::Exists:
+                case Coordination::OpNum::List:
+                case Coordination::OpNum::SimpleList:
+                case Coordination::OpNum::FilteredList:
+                    check_operation_type(OperationType::Read);
+                    break;
+                default:
+                    throw RK::Exception(ErrorCodes::BAD_ARGUMENTS, "Illegal command as part of multi ZooKeeper request {}", op_num);
             }
-            else if (sub_zk_request->getOpNum() == Coordination::OpNum::Check)
-            {
-                check_operation_type(OperationType::Write);
-                concrete_requests.push_back(std::make_shared<StoreRequestCheck>(sub_zk_request));
-            }
-            else if (sub_zk_request->getOpNum() == Coordination::OpNum::Get)
-            {
-                check_operation_type(OperationType::Read);
-                concrete_requests.push_back(std::make_shared<StoreRequestGet>(sub_zk_request));
-            }
-            else if (sub_zk_request->getOpNum() == Coordination::OpNum::Exists)
-            {
-                check_operation_type(OperationType::Read);
-                concrete_requests.push_back(std::make_shared<StoreRequestExists>(sub_zk_request));
-            }
-            else if (sub_zk_request->getOpNum() == Coordination::OpNum::List || sub_zk_request->getOpNum() == Coordination::OpNum::SimpleList
-                     || sub_zk_request->getOpNum() == Coordination::OpNum::FilteredList)
-            {
-                check_operation_type(OperationType::Read);
-                concrete_requests.push_back(std::make_shared<StoreRequestList>(sub_zk_request));
-            }
-            else
-                throw RK::Exception(
-                    ErrorCodes::BAD_ARGUMENTS, "Illegal command as part of multi ZooKeeper request {}", sub_zk_request->getOpNum());
         }
+
+        return operation_type;
     }
 
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & store, int64_t zxid, int64_t session_id, int64_t time) const override
+    bool checkAuth(KeeperStore & store, const Coordination::ZooKeeperRequestPtr & zk_request, int64_t session_id) const override
     {
+        const auto & request = static_cast<const Coordination::ZooKeeperMultiRequest &>(*zk_request);
+        getOperationType(request);
+
+        for (const auto & sub_request : request.requests)
+        {
+            auto sub_zk_request = getSubRequest(sub_request);
+            if (!getStoreRequest(sub_zk_request->getOpNum()).checkAuth(store, sub_zk_request, session_id))
+                return false;
+        }
+        return true;
+    }
+
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & store,
+        const Coordination::ZooKeeperRequestPtr & zk_request,
+        int64_t zxid,
+        int64_t session_id,
+        int64_t time,
+        UndoRecord * /* undo */) const override
+    {
+        const auto & request = static_cast<const Coordination::ZooKeeperMultiRequest &>(*zk_request);
+        const auto operation_type = getOperationType(request);
+
         Coordination::ZooKeeperResponsePtr response = zk_request->makeResponse();
-        Coordination::ZooKeeperMultiResponse & response_typed = dynamic_cast<Coordination::ZooKeeperMultiResponse &>(*response);
-        std::vector<Undo> undo_actions;
+        Coordination::ZooKeeperMultiResponse & response_typed = static_cast<Coordination::ZooKeeperMultiResponse &>(*response);
+
+        /// Multi requests are processed one at a time on a thread, so the journal is reused to keep its capacity.
+        static thread_local std::vector<UndoRecord> undo_journal;
+        undo_journal.clear();
+        SCOPE_EXIT({ undo_journal.clear(); });
+
+        const auto revert_all = [&]()
+        {
+            for (auto it = undo_journal.rbegin(); it != undo_journal.rend(); ++it)
+            {
+                auto sub_zk_request = getSubRequest(request.requests[it->index]);
+                getStoreRequest(sub_zk_request->getOpNum()).revert(store, sub_zk_request, response_typed.responses[it->index], *it);
+            }
+        };
+
+        /// Reads in a MultiRead see the same data tree, they are independent and need no undo
+        if (operation_type == OperationType::Read && store.multi_read_thread_pool
+            && request.requests.size() >= store.multi_read_parallel_min_requests)
+        {
+            parallelForWithCaller(
+                *store.multi_read_thread_pool,
+                store.multi_read_threads + 1,
+                request.requests.size(),
+                [&](size_t i)
+                {
+                    auto sub_zk_request = getSubRequest(request.requests[i]);
+                    const auto & sub_store_request = getStoreRequest(sub_zk_request->getOpNum());
+                    auto cur_response = sub_store_request.process(store, sub_zk_request, zxid, session_id, time, nullptr);
+#ifdef COMPATIBLE_MODE_ZOOKEEPER
+                    if (cur_response->error != Coordination::Error::ZOK)
+                    {
+                        auto response_error = cur_response->error;
+                        cur_response = std::make_shared<Coordination::ZooKeeperErrorResponse>();
+                        cur_response->error = response_error;
+                    }
+#endif
+                    response_typed.responses[i] = cur_response;
+                },
+                MULTI_READ_BATCH_SIZE);
+
+            response_typed.error = Coordination::Error::ZOK;
+            return response;
+        }
 
         try
         {
-            size_t i = 0;
-            for (const auto & concrete_request : concrete_requests)
+            for (size_t i = 0; i < request.requests.size(); ++i)
             {
-                auto [cur_response, undo_action] = concrete_request->process(store, zxid, session_id, time);
+                auto sub_zk_request = getSubRequest(request.requests[i]);
+
+                UndoRecord record;
+                record.index = i;
+                auto cur_response = getStoreRequest(sub_zk_request->getOpNum()).process(store, sub_zk_request, zxid, session_id, time, &record);
 
                 response_typed.responses[i] = cur_response;
                 if (cur_response->error != Coordination::Error::ZOK && operation_type == OperationType::Write)
                 {
+                    /// Revert before replacing the responses, some records refer to them.
+                    revert_all();
+
                     for (size_t j = 0; j <= i; ++j)
                     {
                         auto response_error = response_typed.responses[j]->error;
@@ -1052,11 +1502,7 @@ struct StoreRequestMultiTxn final : public StoreRequest
                         response_typed.responses[j]->error = Coordination::Error::ZRUNTIMEINCONSISTENCY;
                     }
 
-                    for (auto it = undo_actions.rbegin(); it != undo_actions.rend(); ++it)
-                        if (*it)
-                            (*it)();
-
-                    return {response, {}};
+                    return response;
                 }
                 else
                 {
@@ -1068,19 +1514,17 @@ struct StoreRequestMultiTxn final : public StoreRequest
                         response_typed.responses[i]->error = response_error;
                     }
 #endif
-                    undo_actions.emplace_back(std::move(undo_action));
+                    if (record.type != UndoRecord::Type::None)
+                        undo_journal.push_back(std::move(record));
                 }
-                ++i;
             }
 
             response_typed.error = Coordination::Error::ZOK;
-            return {response, {}};
+            return response;
         }
         catch (...)
         {
-            for (auto it = undo_actions.rbegin(); it != undo_actions.rend(); ++it)
-                if (*it)
-                    (*it)();
+            revert_all();
             throw;
         }
     }
@@ -1088,10 +1532,13 @@ struct StoreRequestMultiTxn final : public StoreRequest
 
 struct StoreRequestClose final : public StoreRequest
 {
-    using StoreRequest::StoreRequest;
-
-    std::pair<Coordination::ZooKeeperResponsePtr, Undo>
-    process(KeeperStore & /* store */, int64_t, int64_t, int64_t /* time */) const override
+    Coordination::ZooKeeperResponsePtr process(
+        KeeperStore & /* store */,
+        const Coordination::ZooKeeperRequestPtr & /* zk_request */,
+        int64_t,
+        int64_t,
+        int64_t /* time */,
+        UndoRecord * /* undo */) const override
     {
         throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Called process on close request");
     }
@@ -1104,21 +1551,23 @@ void KeeperStore::finalize()
 
     finalized = true;
 
-    for (const auto & [session_id, ephemerals_paths] : ephemerals)
-        for (const String & ephemeral_path : ephemerals_paths)
-        {
-            auto parent = data_tree.at(getParentPath(ephemeral_path));
+    for (auto & shard : ephemerals_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        for (const auto & [session_id, ephemerals_paths] : shard.ephemerals)
+            for (const String & ephemeral_path : ephemerals_paths)
             {
-                --parent->stat.numChildren;
-                parent->children.erase(getBaseName(ephemeral_path));
+                auto parent = data_tree.getForUpdate(HashedPath(parentPathOf(ephemeral_path)));
+                {
+                    --parent->stat.numChildren;
+                    parent->children.erase(baseNameOf(ephemeral_path));
+                }
+                data_tree.erase(ephemeral_path);
             }
-            data_tree.erase(ephemeral_path);
-        }
-
-    {
-        std::lock_guard lock(ephemerals_mutex);
-        ephemerals.clear();
+        shard.ephemerals.clear();
     }
+    total_ephemeral_nodes = 0;
+    sessions_with_ephemeral_nodes = 0;
 
     session_manager.reset();
     watch_manager.reset();
@@ -1126,64 +1575,92 @@ void KeeperStore::finalize()
     {
         std::lock_guard auth_lock(auth_mutex);
         session_and_auth.clear();
+        acl_decision_cache.reset();
     }
 }
 
+/// Op nums are small integers, so handlers are kept in a flat table indexed by op num.
 class StoreRequestFactory final : private boost::noncopyable
 {
 public:
-    using Creator = std::function<StoreRequestPtr(const Coordination::ZooKeeperRequestPtr &)>;
-    using OpNumToRequest = std::unordered_map<Coordination::OpNum, Creator>;
-
     static StoreRequestFactory & instance()
     {
         static StoreRequestFactory factory;
         return factory;
     }
 
-    StoreRequestPtr get(const Coordination::ZooKeeperRequestPtr & zk_request) const
+    const StoreRequest & get(Coordination::OpNum op_num) const
     {
-        auto it = op_num_to_request.find(zk_request->getOpNum());
-        if (it == op_num_to_request.end())
-            throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Unknown operation type {}", toString(zk_request->getOpNum()));
+        const auto * request = op_num_to_request[toIndex(op_num)];
+        if (unlikely(!request))
+            throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Unknown operation type {}", toString(op_num));
 
-        return it->second(zk_request);
+        return *request;
     }
 
-    void registerRequest(Coordination::OpNum op_num, Creator creator)
+    void registerRequest(Coordination::OpNum op_num, const StoreRequest & request)
     {
-        if (!op_num_to_request.try_emplace(op_num, creator).second)
+        auto & registered = op_num_to_request[toIndex(op_num)];
+        if (registered)
             throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Request with op num {} already registered", op_num);
+        registered = &request;
     }
 
 private:
-    OpNumToRequest op_num_to_request;
+    /// One below the smallest op num, so that slot 0 is never registered.
+    static constexpr int32_t MIN_OP_NUM = static_cast<int32_t>(Coordination::OpNum::Close) - 1;
+    static constexpr int32_t MAX_OP_NUM = static_cast<int32_t>(Coordination::OpNum::CloseSessions);
+
+    /// Out of range op nums are mapped to the empty slot 0.
+    static size_t toIndex(Coordination::OpNum op_num)
+    {
+        const auto value = static_cast<int32_t>(op_num);
+        if (unlikely(value <= MIN_OP_NUM || value > MAX_OP_NUM))
+            return 0;
+        return value - MIN_OP_NUM;
+    }
+
+    std::array<const StoreRequest *, MAX_OP_NUM - MIN_OP_NUM + 1> op_num_to_request{};
     StoreRequestFactory();
 };
 
 template <Coordination::OpNum num, typename RequestT>
 void registerNuKeeperRequestWrapper(StoreRequestFactory & factory)
 {
-    factory.registerRequest(
-        num, [](const Coordination::ZooKeeperRequestPtr & zk_request) { return std::make_shared<RequestT>(zk_request); });
+    static const RequestT request;
+    factory.registerRequest(num, request);
 }
 
+static const StoreRequest & getStoreRequest(Coordination::OpNum op_num)
+{
+    return StoreRequestFactory::instance().get(op_num);
+}
 
 StoreRequestFactory::StoreRequestFactory()
 {
     registerNuKeeperRequestWrapper<Coordination::OpNum::Heartbeat, StoreRequestHeartbeat>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SetWatches, StoreRequestSetWatches>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::SetWatches2, StoreRequestSetWatches>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::AddWatch, StoreRequestAddWatch>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Sync, StoreRequestSync>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Auth, StoreRequestAuth>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Close, StoreRequestClose>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::CloseSessions, StoreRequestClose>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Create, StoreRequestCreate>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::Create2, StoreRequestCreate>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::CreateContainer, StoreRequestCreate>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::CreateTTL, StoreRequestCreate>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Remove, StoreRequestRemove>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::RemoveRecursive, StoreRequestRemoveRecursive>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Exists, StoreRequestExists>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Get, StoreRequestGet>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Set, StoreRequestSet>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::List, StoreRequestList>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::SimpleList, StoreRequestList>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::FilteredList, StoreRequestList>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::ListWithData, StoreRequestList>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::PagedList, StoreRequestList>(*this);
+    registerNuKeeperRequestWrapper<Coordination::OpNum::StatBatch, StoreRequestStatBatch>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Check, StoreRequestCheck>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::Multi, StoreRequestMultiTxn>(*this);
     registerNuKeeperRequestWrapper<Coordination::OpNum::MultiRead, StoreRequestMultiTxn>(*this);
@@ -1193,11 +1670,12 @@ StoreRequestFactory::StoreRequestFactory()
 
 
 void KeeperStore::processRequest(
-    ThreadSafeQueue<ResponseForSession> & responses_queue,
+    KeeperResponsesQueue & responses_queue,
     const RequestForSession & request_for_session,
     std::optional<int64_t> new_last_zxid,
     bool check_acl,
-    bool ignore_response)
+    bool ignore_response,
+    GetResponseCache * get_response_cache)
 {
     LOG_TRACE(log, "Process request {}", request_for_session.toSimpleString());
 
@@ -1214,34 +1692,41 @@ void KeeperStore::processRequest(
 
     if (zk_request->getOpNum() == Coordination::OpNum::Close)
     {
-        LOG_INFO(log, "Clean ephemeral nodes and watches for {}", toHexString(session_id));
-        cleanEphemeralNodes(session_id, responses_queue, ignore_response);
-        watch_manager.cleanDeadWatches(session_id);
-
-        LOG_INFO(log, "Clean auth for {}", toHexString(session_id));
-        /// clean auth for session
-        {
-            std::lock_guard lock(auth_mutex);
-            session_and_auth.erase(session_id);
-        }
-
-        LOG_INFO(log, "Expire session {}", toHexString(session_id));
-        session_manager.expireSession(session_id);
-
-        auto response = std::make_shared<Coordination::ZooKeeperCloseResponse>();
-        response->xid = zk_request->xid;
-        response->zxid = new_last_zxid ? zxid.load() : fetchAndGetZxid();
-
-        set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
+        LOG_INFO(log, "Close session {}", toHexString(session_id));
+        auto response_zxid = new_last_zxid ? zxid.load() : fetchAndGetZxid();
+        closeSessions({session_id}, zk_request->xid, response_zxid, responses_queue, ignore_response);
+        return;
+    }
+    else if (zk_request->getOpNum() == Coordination::OpNum::CloseSessions)
+    {
+        /// All the sessions are closed by one log entry, so they share a zxid.
+        const auto & session_ids = static_cast<const Coordination::ZooKeeperCloseSessionsRequest &>(*zk_request).session_ids;
+        LOG_INFO(log, "Close {} dead sessions", session_ids.size());
+        auto response_zxid = new_last_zxid ? zxid.load() : fetchAndGetZxid();
+        closeSessions(session_ids, Coordination::CLOSE_XID, response_zxid, responses_queue, ignore_response);
+        return;
+    }
+    else if (zk_request->getOpNum() == Coordination::OpNum::RemoveExpired)
+    {
+        /// All the nodes are removed by one log entry, expiry is decided by the time of the entry, so it is the same on every node.
+        const auto & paths = static_cast<const Coordination::ZooKeeperRemoveExpiredRequest &>(*zk_request).paths;
+        auto request_zxid = new_last_zxid ? zxid.load() : fetchAndGetZxid();
+        removeExpiredNodes(paths, request_for_session.create_time, request_zxid, responses_queue, ignore_response);
+        return;
+    }
+    else if (zk_request->getOpNum() == Coordination::OpNum::CheckDigest)
+    {
+        if (!new_last_zxid)
+            fetchAndGetZxid();
+        checkDigest(static_cast<const Coordination::ZooKeeperCheckDigestRequest &>(*zk_request));
         return;
     }
     else if (isNewSessionRequest(zk_request->getOpNum()))
     {
-        auto * new_session_req = dynamic_cast<Coordination::ZooKeeperNewSessionRequest *>(zk_request.get());
-        assert(new_session_req != nullptr);
+        auto * new_session_req = static_cast<Coordination::ZooKeeperNewSessionRequest *>(zk_request.get());
 
         auto response = new_session_req->makeResponse();
-        auto * new_session_resp = dynamic_cast<Coordination::ZooKeeperNewSessionResponse *>(response.get());
+        auto * new_session_resp = static_cast<Coordination::ZooKeeperNewSessionResponse *>(response.get());
 
         new_session_resp->zxid = fetchAndGetZxid();
         new_session_resp->session_id = session_manager.getSessionID(new_session_req->session_timeout_ms);
@@ -1250,13 +1735,39 @@ void KeeperStore::processRequest(
         set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
         return;
     }
+    else if (zk_request->getOpNum() == Coordination::OpNum::NewSessions)
+    {
+        /// All the sessions are created by one log entry, so they share a zxid.
+        const auto & new_session_reqs = static_cast<const Coordination::ZooKeeperNewSessionsRequest &>(*zk_request).requests;
+        auto response_zxid = fetchAndGetZxid();
+
+        std::vector<int64_t> session_timeouts_ms;
+        session_timeouts_ms.reserve(new_session_reqs.size());
+        for (const auto & new_session_req : new_session_reqs)
+            session_timeouts_ms.push_back(new_session_req->session_timeout_ms);
+        auto first_session_id = session_manager.getSessionIDs(session_timeouts_ms);
+
+        ResponsesForSessions responses;
+        responses.reserve(new_session_reqs.size());
+        for (size_t i = 0; i < new_session_reqs.size(); ++i)
+        {
+            auto response = new_session_reqs[i]->makeResponse();
+            auto & new_session_resp = static_cast<Coordination::ZooKeeperNewSessionResponse &>(*response);
+            new_session_resp.zxid = response_zxid;
+            new_session_resp.session_id = first_session_id + static_cast<int64_t>(i);
+            new_session_resp.success = true;
+            responses.emplace_back(new_session_reqs[i]->internal_id, std::move(response));
+        }
+
+        set_response(responses_queue, responses, ignore_response);
+        return;
+    }
     else if (zk_request->getOpNum() == Coordination::OpNum::UpdateSession)
     {
-        auto * update_session_req = dynamic_cast<Coordination::ZooKeeperUpdateSessionRequest *>(zk_request.get());
-        assert(update_session_req != nullptr);
+        auto * update_session_req = static_cast<Coordination::ZooKeeperUpdateSessionRequest *>(zk_request.get());
 
         auto response = update_session_req->makeResponse();
-        auto * update_session_resp = dynamic_cast<Coordination::ZooKeeperUpdateSessionResponse *>(response.get());
+        auto * update_session_resp = static_cast<Coordination::ZooKeeperUpdateSessionResponse *>(response.get());
 
         /// Update session should increase zxid /// TODO
         update_session_resp->zxid = fetchAndGetZxid();
@@ -1274,7 +1785,7 @@ void KeeperStore::processRequest(
         return;
     }
 
-    if (!session_manager.contains(session_id) && !new_last_zxid)
+    if (!session_manager.contains(session_id) && !new_last_zxid && !request_for_session.read_only_session)
     {
         LOG_WARNING(
             log,
@@ -1289,21 +1800,21 @@ void KeeperStore::processRequest(
 
     if (zk_request->getOpNum() == Coordination::OpNum::Heartbeat)
     {
-        StoreRequestPtr store_request = StoreRequestFactory::instance().get(zk_request);
-        auto [response, _] = store_request->process(*this, zxid, session_id, request_for_session.create_time);
+        const auto & store_request = getStoreRequest(zk_request->getOpNum());
+        auto response = store_request.process(*this, zk_request, zxid, session_id, request_for_session.create_time, nullptr);
         response->xid = zk_request->xid;
         response->zxid = zxid;
         LOG_TRACE(log, "heart beat for session {}", toHexString(session_id));
         set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
     }
-    else if (zk_request->getOpNum() == Coordination::OpNum::SetWatches)
+    else if (zk_request->getOpNum() == Coordination::OpNum::SetWatches || zk_request->getOpNum() == Coordination::OpNum::SetWatches2)
     {
-        StoreRequestPtr store_request = StoreRequestFactory::instance().get(zk_request);
-        auto [response, _] = store_request->process(*this, zxid, session_id, request_for_session.create_time);
+        const auto & store_request = getStoreRequest(zk_request->getOpNum());
+        auto response = store_request.process(*this, zk_request, zxid, session_id, request_for_session.create_time, nullptr);
         response->xid = zk_request->xid;
         response->zxid = zxid;
 
-        auto * request = dynamic_cast<Coordination::ZooKeeperSetWatchesRequest *>(zk_request.get());
+        auto * request = static_cast<Coordination::ZooKeeperSetWatchesRequest *>(zk_request.get());
 
         /// path -> mzixd pzxid
         std::unordered_map<String, std::pair<int64_t, int64_t>> watch_nodes_info;
@@ -1319,114 +1830,458 @@ void KeeperStore::processRequest(
         /// no response for SetWatches request
         set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
     }
-    else
+    else if (zk_request->getOpNum() == Coordination::OpNum::AddWatch)
     {
-        StoreRequestPtr store_request = StoreRequestFactory::instance().get(zk_request);
-        Coordination::ZooKeeperResponsePtr response;
+        const auto & store_request = getStoreRequest(zk_request->getOpNum());
+        auto response = store_request.process(*this, zk_request, zxid, session_id, request_for_session.create_time, nullptr);
+        response->xid = zk_request->xid;
+        response->zxid = zxid;
 
-        if (check_acl && !store_request->checkAuth(*this, session_id))
+        const auto * request = static_cast<const Coordination::ZooKeeperAddWatchRequest *>(zk_request.get());
+        if (response->error == Coordination::Error::ZOK && !watch_manager.addPersistentWatch(request->path, session_id, request->mode))
         {
-            response = zk_request->makeResponse();
-            /// Original ZooKeeper always throws no auth, even when user provided some credentials
-            response->error = Coordination::Error::ZNOAUTH;
-        }
-        else
-        {
-            response = store_request->process(*this, zxid, session_id, request_for_session.create_time).first;
+            response->error = Coordination::Error::ZTHROTTLEDOP;
+            Metrics::getMetrics().throttled_watches->add(1);
         }
+        set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
+    }
+    else
+    {
+        /// Requests replayed from log are not load
+        if (!ignore_response)
+            HotSpotTracker::instance().record(request_for_session);
+
+        int64_t request_zxid = zxid.load();
+        processDataRequest(responses_queue, request_for_session, request_zxid, check_acl, ignore_response, get_response_cache);
+        if (!new_last_zxid && shouldIncreaseZxid(zk_request))
+            zxid.store(request_zxid + 1);
+    }
+}
 
-        response->request_created_time_ms = request_for_session.create_time;
-        response->xid = zk_request->xid;
-        response->zxid = new_last_zxid ? zxid.load() : (shouldIncreaseZxid(zk_request) ? fetchAndGetZxid() : zxid.load());
+template <typename Queue>
+void KeeperStore::processDataRequest(
+    Queue & responses_queue,
+    const RequestForSession & request_for_session,
+    int64_t request_zxid,
+    bool check_acl,
+    bool ignore_response,
+    GetResponseCache * get_response_cache)
+{
+    const auto & zk_request = request_for_session.request;
+    const auto session_id = request_for_session.session_id;
 
-        if (response->error != Coordination::Error::ZOK)
-            LOG_DEBUG(
-                log,
-                "Error when processing request {} with error no {}",
-                request_for_session.toSimpleString(),
-                Coordination::errorMessage(response->error));
+    const auto & store_request = getStoreRequest(zk_request->getOpNum());
+    Coordination::ZooKeeperResponsePtr response;
 
-        if (zk_request->isReadRequest())
-        {
-            /// register watch
-            if (zk_request->has_watch && (response->error == Coordination::Error::ZOK
-                || (response->error == Coordination::Error::ZNONODE && zk_request->getOpNum() == Coordination::OpNum::Exists)))
+    if (check_acl && !store_request.checkAuth(*this, zk_request, session_id))
+    {
+        response = zk_request->makeResponse();
+        /// Original ZooKeeper always throws no auth, even when user provided some credentials
+        response->error = Coordination::Error::ZNOAUTH;
+    }
+    else if (get_response_cache && zk_request->getOpNum() == Coordination::OpNum::Get)
+    {
+        response = processCoalescedGet(*get_response_cache, request_for_session, request_zxid);
+    }
+    else if (response_cache.enabled() && zk_request->isReadRequest())
+    {
+        response = processReadRequest(request_for_session, request_zxid);
+    }
+    else
+    {
+        response = store_request.process(*this, zk_request, request_zxid, session_id, request_for_session.create_time, nullptr);
+    }
+
+    response->request_created_time_ms = request_for_session.create_time;
+    response->xid = zk_request->xid;
+    response->zxid = request_zxid;
+    if (zk_request->timeline.started())
+    {
+        response->timeline = zk_request->timeline;
+        response->timeline.end(RequestStage::APPLY);
+    }
+
+    if (response->error != Coordination::Error::ZOK)
+        LOG_DEBUG(
+            log,
+            "Error when processing request {} with error no {}",
+            request_for_session.toSimpleString(),
+            Coordination::errorMessage(response->error));
+
+    if (zk_request->isReadRequest())
+    {
+        /// register watch
+        if (zk_request->has_watch && (response->error == Coordination::Error::ZOK
+            || (response->error == Coordination::Error::ZNONODE && zk_request->getOpNum() == Coordination::OpNum::Exists)))
+        {
+            LOG_TRACE(log, "Register watch for {}, path {}", request_for_session.toSimpleString(), zk_request->getPath());
+            /// The read fails rather than the client waiting for an event that never comes
+            HashedPath watch_path(zk_request->getPath(), zk_request->getPathHash());
+            if (!watch_manager.registerWatches(watch_path, session_id, zk_request->getOpNum()))
             {
-                LOG_TRACE(log, "Register watch for {}, path {}", request_for_session.toSimpleString(), zk_request->getPath());
-                watch_manager.registerWatches(zk_request->getPath(), session_id, zk_request->getOpNum());
+                response->error = Coordination::Error::ZTHROTTLEDOP;
+                Metrics::getMetrics().throttled_watches->add(1);
             }
-            /// push response to queue
-            set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
         }
-        else
+        /// push response to queue
+        set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
+    }
+    else
+    {
+        /// Trigger watches
+        if (response->error == Coordination::Error::ZOK)
         {
-            /// Trigger watches
-            if (response->error == Coordination::Error::ZOK)
+            /// Trigger watches for all requests
+            if (zk_request->getOpNum() == Coordination::OpNum::Multi)
             {
-                /// Trigger watches for all requests
-                if (zk_request->getOpNum() == Coordination::OpNum::Multi)
+                auto multi_response = std::static_pointer_cast<Coordination::ZooKeeperMultiWriteResponse>(response);
+                /// An multi request allows you to execute multiple operations within a single transaction.
+                /// If any one of these operations fails, the before transaction will be rolled back, and rest operations will set to an error code
+                /// So we only check last response code to determine if we need to trigger watches
+                if (!multi_response->responses.empty() && multi_response->responses.back()->error == Coordination::Error::ZOK)
                 {
-                    auto multi_response = std::dynamic_pointer_cast<Coordination::ZooKeeperMultiWriteResponse>(response);
-                    /// An multi request allows you to execute multiple operations within a single transaction.
-                    /// If any one of these operations fails, the before transaction will be rolled back, and rest operations will set to an error code
-                    /// So we only check last response code to determine if we need to trigger watches
-                    if (!multi_response->responses.empty() && multi_response->responses.back()->error == Coordination::Error::ZOK)
+                    auto * multi_request = static_cast<Coordination::ZooKeeperMultiRequest *>(zk_request.get());
+                    for (auto & concrete_request : multi_request->requests)
                     {
-                        auto * multi_request = dynamic_cast<Coordination::ZooKeeperMultiRequest *>(zk_request.get());
-                        for (auto & concrete_request : multi_request->requests)
+                        const auto * sub_zk_request = dynamic_cast<Coordination::ZooKeeperRequest *>(concrete_request.get());
+                        if (response_cache.enabled())
+                            response_cache.invalidate(sub_zk_request->getPath());
+                        auto watch_responses = watch_manager.processWatches(
+                            HashedPath(sub_zk_request->getPath(), sub_zk_request->getPathHash()), sub_zk_request->getOpNum());
+                        if (!watch_responses.empty())
                         {
-                            const auto * sub_zk_request = dynamic_cast<Coordination::ZooKeeperRequest *>(concrete_request.get());
-                            auto watch_responses = watch_manager.processWatches(sub_zk_request->getPath(), sub_zk_request->getOpNum());
-                            if (!watch_responses.empty())
-                            {
-                                LOG_TRACE(log, "{} triggered {} watches", request_for_session.toSimpleString(), watch_responses.size());
-                                set_response(responses_queue, watch_responses, ignore_response);
-                            }
+                            LOG_TRACE(log, "{} triggered {} watch events", request_for_session.toSimpleString(), watch_responses.size());
+                            set_response(responses_queue, watch_responses, ignore_response);
                         }
                     }
                 }
-                else
+            }
+            else if (zk_request->getOpNum() == Coordination::OpNum::RemoveRecursive)
+            {
+                /// Watches are triggered after all the nodes are removed, so that a parent is notified once.
+                const auto & removed_paths = static_cast<const Coordination::ZooKeeperRemoveRecursiveResponse &>(*response).removed_paths;
+                if (response_cache.enabled())
+                    for (const auto & removed_path : removed_paths)
+                        response_cache.invalidate(removed_path);
+                auto watch_responses = watch_manager.processRemovedPaths(removed_paths);
+                if (!watch_responses.empty())
                 {
-                    auto watch_responses = watch_manager.processWatches(zk_request->getPath(), zk_request->getOpNum());
-                    if (!watch_responses.empty())
-                    {
-                        LOG_TRACE(log, "{} triggered {} watches", request_for_session.toSimpleString(), watch_responses.size());
-                        set_response(responses_queue, watch_responses, ignore_response);
-                    }
+                    LOG_TRACE(log, "{} triggered {} watch events", request_for_session.toSimpleString(), watch_responses.size());
+                    set_response(responses_queue, watch_responses, ignore_response);
+                }
+            }
+            else
+            {
+                if (response_cache.enabled())
+                    response_cache.invalidate(zk_request->getPath());
+                auto watch_responses
+                    = watch_manager.processWatches(HashedPath(zk_request->getPath(), zk_request->getPathHash()), zk_request->getOpNum());
+                if (!watch_responses.empty())
+                {
+                    LOG_TRACE(log, "{} triggered {} watch events", request_for_session.toSimpleString(), watch_responses.size());
+                    set_response(responses_queue, watch_responses, ignore_response);
                 }
             }
+        }
 
-            /// push response to queue
-            set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
+        /// push response to queue
+        set_response(responses_queue, ResponseForSession{session_id, response}, ignore_response);
+    }
+}
+
+bool KeeperStore::getTouchedBuckets(const Coordination::ZooKeeperRequest & zk_request, std::vector<UInt32> & buckets)
+{
+    switch (zk_request.getOpNum())
+    {
+        case Coordination::OpNum::Create:
+        case Coordination::OpNum::Create2:
+        case Coordination::OpNum::CreateContainer:
+        case Coordination::OpNum::CreateTTL:
+        {
+            const auto & create_request = static_cast<const Coordination::ZooKeeperCreateRequest &>(zk_request);
+            /// Name of sequential node is not known before it is created
+            if (create_request.is_sequential)
+                return false;
+            buckets.push_back(data_tree.getBucketIndex(HashedPath(create_request.path, zk_request.getPathHash())));
+            buckets.push_back(data_tree.getBucketIndex(HashedPath(parentPathOf(create_request.path))));
+            /// May allocate a new ACL id, the default one is not stored in ACL map
+            const auto & acls = create_request.acls;
+            if (!acls.empty() && acls != Coordination::ACLs{Coordination::ACL{Coordination::ACL::All, "world", "anyone"}})
+                buckets.push_back(getDataTreeBucketNum());
+            return true;
         }
+        case Coordination::OpNum::Remove:
+        {
+            HashedPath path(zk_request.getPath(), zk_request.getPathHash());
+            buckets.push_back(data_tree.getBucketIndex(path));
+            buckets.push_back(data_tree.getBucketIndex(HashedPath(parentPathOf(zk_request.getPath()))));
+            /// May remove the last usage of an ACL id, which a create in another partition may take or allocate at the
+            /// same time. A node created or given ACL earlier in the run is connected to ACL map by its bucket.
+            auto node = getNode(path);
+            if (node && node->acl_id != 0)
+                buckets.push_back(getDataTreeBucketNum());
+            return true;
+        }
+        case Coordination::OpNum::Set:
+        case Coordination::OpNum::Check:
+            buckets.push_back(data_tree.getBucketIndex(HashedPath(zk_request.getPath(), zk_request.getPathHash())));
+            return true;
+        case Coordination::OpNum::SetACL:
+            buckets.push_back(data_tree.getBucketIndex(HashedPath(zk_request.getPath(), zk_request.getPathHash())));
+            buckets.push_back(getDataTreeBucketNum());
+            return true;
+        case Coordination::OpNum::Multi:
+        {
+            const auto & multi_request = static_cast<const Coordination::ZooKeeperMultiRequest &>(zk_request);
+            for (const auto & sub_request : multi_request.requests)
+            {
+                const auto * sub_zk_request = dynamic_cast<const Coordination::ZooKeeperRequest *>(sub_request.get());
+                if (!sub_zk_request || !getTouchedBuckets(*sub_zk_request, buckets))
+                    return false;
+            }
+            return !buckets.empty();
+        }
+        default:
+            /// Session requests, close and others touch state outside of data tree
+            return false;
+    }
+}
+
+Coordination::ZooKeeperResponsePtr KeeperStore::processCoalescedGet(
+    GetResponseCache & get_response_cache, const RequestForSession & request_for_session, int64_t request_zxid)
+{
+    const auto & zk_request = request_for_session.request;
+    const auto & path = static_cast<const Coordination::ZooKeeperGetRequest &>(*zk_request).path;
+
+    auto [it, inserted] = get_response_cache.try_emplace(path);
+    auto & coalesced = it->second;
+    if (inserted)
+    {
+        /// The first request of the path is processed as usual, its response is pushed to the response queue
+        /// and may be serialized concurrently, so it is only read from now on.
+        coalesced.request = zk_request;
+        coalesced.response = processReadRequest(request_for_session, request_zxid);
+        /// Served from response cache
+        coalesced.serialized_body = static_cast<const Coordination::ZooKeeperGetResponse &>(*coalesced.response).serialized_body;
+        return coalesced.response;
+    }
+
+    const auto & cached = static_cast<const Coordination::ZooKeeperGetResponse &>(*coalesced.response);
+    auto response = std::make_shared<Coordination::ZooKeeperGetResponse>();
+    response->error = cached.error;
+    if (cached.error != Coordination::Error::ZOK)
+        return response;
+
+    /// Serialize once the path turns out to be requested more than once
+    if (!coalesced.serialized_body)
+    {
+        WriteBufferFromOwnString buf;
+        Coordination::write(cached.data, buf);
+        Coordination::write(cached.stat, buf);
+        coalesced.serialized_body = std::make_shared<const String>(std::move(buf.str()));
+    }
+
+    response->stat = cached.stat;
+    response->serialized_body = coalesced.serialized_body;
+    return response;
+}
+
+namespace
+{
+
+void setSerializedBody(Coordination::ZooKeeperResponse & response, const ResponseCache::Body & body, const Coordination::Stat & stat)
+{
+    using enum Coordination::OpNum;
+    switch (response.getOpNum())
+    {
+        case Get:
+            static_cast<Coordination::ZooKeeperGetResponse &>(response).serialized_body = body;
+            static_cast<Coordination::ZooKeeperGetResponse &>(response).stat = stat;
+            break;
+        case List:
+            static_cast<Coordination::ZooKeeperListResponse &>(response).serialized_body = body;
+            static_cast<Coordination::ZooKeeperListResponse &>(response).stat = stat;
+            break;
+        case SimpleList:
+            static_cast<Coordination::ZooKeeperSimpleListResponse &>(response).serialized_body = body;
+            break;
+        default:
+            throw Exception(ErrorCodes::LOGICAL_ERROR, "Response of {} is not cacheable", Coordination::toString(response.getOpNum()));
     }
 }
 
-void KeeperStore::buildChildrenSet(bool from_zk_snapshot)
+}
+
+Coordination::ZooKeeperResponsePtr KeeperStore::processReadRequest(const RequestForSession & request_for_session, int64_t request_zxid)
 {
-    for (UInt32 bucket_id = 0; bucket_id < data_tree.getBucketNum(); bucket_id++)
+    const auto & zk_request = request_for_session.request;
+    const auto & store_request = getStoreRequest(zk_request->getOpNum());
+    auto process = [&]
     {
-        for (const auto & it : data_tree.getMap(bucket_id).getMap())
+        return store_request.process(
+            *this, zk_request, request_zxid, request_for_session.session_id, request_for_session.create_time, nullptr);
+    };
+
+    if (!response_cache.enabled() || !ResponseCache::isCacheable(zk_request->getOpNum()))
+        return process();
+
+    const auto & path = zk_request->getOpNum() == Coordination::OpNum::Get
+        ? static_cast<const Coordination::ZooKeeperGetRequest &>(*zk_request).path
+        : static_cast<const Coordination::ZooKeeperListRequest &>(*zk_request).path;
+
+    auto node = getNode(HashedPath(path, zk_request->getPathHash()));
+    if (!node)
+        return process();
+
+    /// Data tree is not changed while processing read requests
+    auto stat = node->statForResponse();
+    bool should_put;
+    if (auto body = response_cache.get(zk_request->getOpNum(), path, stat, should_put))
+    {
+        auto response = zk_request->makeResponse();
+        setSerializedBody(*response, body, stat);
+        return response;
+    }
+
+    auto response = process();
+    if (should_put && response->error == Coordination::Error::ZOK)
+    {
+        WriteBufferFromOwnString buf;
+        response->writeImpl(buf);
+        ResponseCache::Body body = std::make_shared<const String>(std::move(buf.str()));
+        setSerializedBody(*response, body, stat);
+        response_cache.put(zk_request->getOpNum(), path, stat, std::move(body));
+    }
+    return response;
+}
+
+void KeeperStore::processRequests(
+    KeeperResponsesQueue & responses_queue, const std::vector<RequestForSession> & requests, ThreadPool & thread_pool)
+{
+    /// The last one is for ACL map
+    const UInt32 bucket_num = getDataTreeBucketNum() + 1;
+
+    std::vector<UInt32> bucket_roots(bucket_num);
+    auto find_root = [&bucket_roots](UInt32 bucket)
+    {
+        while (bucket_roots[bucket] != bucket)
+            bucket = bucket_roots[bucket] = bucket_roots[bucket_roots[bucket]];
+        return bucket;
+    };
+
+    std::vector<UInt32> touched_buckets;
+    std::vector<UInt32> request_buckets;
+    std::vector<int64_t> request_zxids;
+
+    size_t begin = 0;
+    while (begin < requests.size())
+    {
+        /// Collect the longest run of requests which touch only known buckets, requests touching connected
+        /// buckets are put into the same partition.
+        std::iota(bucket_roots.begin(), bucket_roots.end(), 0);
+        request_buckets.clear();
+
+        size_t end = begin;
+        for (; end < requests.size(); ++end)
+        {
+            touched_buckets.clear();
+            if (!getTouchedBuckets(*requests[end].request, touched_buckets))
+                break;
+
+            UInt32 root = find_root(touched_buckets.front());
+            for (auto bucket : touched_buckets)
+                bucket_roots[find_root(bucket)] = root;
+            request_buckets.push_back(touched_buckets.front());
+        }
+
+        if (end == begin)
+        {
+            OpCostMetrics::Scope cost_scope(requests[begin].request->getOpNum(), OpCostMetrics::ThreadKind::PROCESSOR);
+            processRequest(responses_queue, requests[begin]);
+            ++begin;
+            continue;
+        }
+
+        /// Assign zxids in order, sessions are not expired by requests in the run.
+        request_zxids.assign(end - begin, -1);
+        int64_t next_zxid = zxid.load();
+        for (size_t i = begin; i < end; ++i)
         {
-            if (it.first == "/")
+            const auto & request_for_session = requests[i];
+            if (!session_manager.contains(request_for_session.session_id))
+            {
+                LOG_WARNING(
+                    log,
+                    "Session {} is expired, ignore {} operation to path '{}'",
+                    toHexString(request_for_session.session_id),
+                    Coordination::toString(request_for_session.request->getOpNum()),
+                    request_for_session.request->getPath());
                 continue;
+            }
+            request_zxids[i - begin] = next_zxid;
+            if (shouldIncreaseZxid(request_for_session.request))
+                ++next_zxid;
+        }
 
-            auto parent_path = getParentPath(it.first);
-            auto child_path = getBaseName(it.first);
-            auto parent = data_tree.get(parent_path);
+        std::unordered_map<UInt32, std::vector<size_t>> partitions;
+        for (size_t i = 0; i < request_buckets.size(); ++i)
+            if (request_zxids[i] >= 0)
+                partitions[find_root(request_buckets[i])].push_back(i);
+
+        /// Responses and watch events are buffered by request, and are pushed in order of zxids after applying.
+        std::vector<ThreadSafeQueue<ResponseForSession>> request_responses(end - begin);
+        auto apply_partition = [&](const std::vector<size_t> & partition)
+        {
+            for (auto i : partition)
+            {
+                const auto & request_for_session = requests[begin + i];
+                /// Not opened by applyCommittedBatch, which applies the whole batch at once
+                OpCostMetrics::Scope cost_scope(request_for_session.request->getOpNum(), OpCostMetrics::ThreadKind::PROCESSOR);
+                session_manager.updateSessionExpirationTime(request_for_session.session_id);
+                /// As processRequest does, the tracker is shared by partitions under its mutex
+                HotSpotTracker::instance().record(request_for_session);
+                processDataRequest(request_responses[i], request_for_session, request_zxids[i], true, false);
+            }
+        };
 
-            if (parent == nullptr)
-                throw RK::Exception(ErrorCodes::LOGICAL_ERROR, "Error when building children set, can not find parent for node {}", it.first);
+        LOG_TRACE(log, "Apply {} requests in {} partitions", end - begin, partitions.size());
 
-            parent->children.insert(child_path);
-            if (from_zk_snapshot)
-                parent->stat.numChildren++;
+        /// Apply the last partition in the current thread
+        auto last_partition = partitions.begin();
+        for (auto it = std::next(partitions.begin()); it != partitions.end(); ++it)
+            thread_pool.scheduleOrThrowOnError([&apply_partition, &partition = it->second] { apply_partition(partition); });
+
+        try
+        {
+            if (last_partition != partitions.end())
+                apply_partition(last_partition->second);
+        }
+        catch (...)
+        {
+            thread_pool.wait();
+            throw;
         }
+        thread_pool.wait();
+
+        zxid.store(next_zxid);
+
+        ResponsesForSessions responses;
+        for (auto & request_response : request_responses)
+            request_response.tryPopBatch(responses, std::numeric_limits<size_t>::max());
+        responses_queue.pushBatch(responses);
+
+        begin = end;
     }
 }
 
 void KeeperStore::fillDataTreeBucket(const std::vector<BucketNodes> & all_objects_nodes, UInt32 bucket_id)
 {
+    /// Avoid rehashing the bucket again and again while loading.
+    size_t bucket_size = data_tree.getMap(bucket_id).size();
+    for (auto && object_nodes : all_objects_nodes)
+        bucket_size += object_nodes[bucket_id].size();
+    data_tree.getMap(bucket_id).reserve(bucket_size);
+
     for (auto && object_nodes : all_objects_nodes)
     {
         for (auto && [path, node] : object_nodes[bucket_id])
@@ -1437,7 +2292,7 @@ void KeeperStore::fillDataTreeBucket(const std::vector<BucketNodes> & all_object
     }
 }
 
-void KeeperStore::buildBucketChildren(const std::vector<BucketEdges> & all_objects_edges, UInt32 bucket_id)
+void KeeperStore::buildBucketChildren(const std::vector<BucketEdges> & all_objects_edges, UInt32 bucket_id, bool count_children)
 {
     for (const auto & object_edges : all_objects_edges)
     {
@@ -1448,24 +2303,99 @@ void KeeperStore::buildBucketChildren(const std::vector<BucketEdges> & all_objec
             if (unlikely(parent == nullptr))
                 throw RK::Exception(RK::ErrorCodes::LOGICAL_ERROR, "Can not find parent for node {}", path);
 
-            parent->children.emplace(std::move(path));
+            if (parent->children.emplace(std::move(path)) && count_children)
+                parent->stat.numChildren++;
         }
     }
 }
 
-void KeeperStore::cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<ResponseForSession> & responses_queue, bool ignore_response)
+void KeeperStore::applySnapshotDelta(std::vector<std::pair<String, KeeperNodePtr>> & nodes, const Strings & deleted_paths)
 {
-    LOG_DEBUG(log, "Clean ephemeral nodes for session {}", toHexString(session_id));
+    for (const auto & path : deleted_paths)
+    {
+        auto node = data_tree.get(path);
+        if (!node)
+            continue;
+
+        acl_map.removeUsage(node->acl_id);
+        if (isEphemeralOwner(node->stat.ephemeralOwner))
+            removeEphemeralNode(node->stat.ephemeralOwner, path);
+        else
+            unindexExpiringNode(path, *node);
+        data_tree.erase(path);
+
+        /// The parent may be deleted too
+        if (auto parent = data_tree.get(HashedPath(parentPathOf(path))))
+            parent->children.erase(baseNameOf(path));
+    }
 
-    std::lock_guard lock(ephemerals_mutex);
-    auto it = ephemerals.find(session_id);
+    Strings created_paths;
+    for (auto & [path, node] : nodes)
+    {
+        /// Add usage before removing the old one, or the ACL may be removed if the node is the only user
+        acl_map.addUsage(node->acl_id);
+        if (auto old_node = data_tree.get(path))
+        {
+            node->children = std::move(old_node->children);
+            acl_map.removeUsage(old_node->acl_id);
+            if (isEphemeralOwner(old_node->stat.ephemeralOwner))
+                removeEphemeralNode(old_node->stat.ephemeralOwner, path);
+        }
+        else if (path != "/")
+        {
+            created_paths.push_back(path);
+        }
+
+        if (isEphemeralOwner(node->stat.ephemeralOwner))
+            addEphemeralNode(node->stat.ephemeralOwner, path);
+        else
+            indexExpiringNode(path, *node);
+        data_tree.emplace(path, std::move(node));
+    }
+
+    /// Parents may be created in the same delta, so link children after all nodes are in place.
+    for (const auto & path : created_paths)
+    {
+        auto parent = data_tree.get(HashedPath(parentPathOf(path)));
+        if (unlikely(parent == nullptr))
+            throw RK::Exception(RK::ErrorCodes::LOGICAL_ERROR, "Can not find parent for node {}", path);
+        parent->children.emplace(getBaseName(path));
+    }
+}
 
-    if (it != ephemerals.end())
+void KeeperStore::cleanEphemeralNodes(
+    const std::vector<int64_t> & session_ids, KeeperResponsesQueue & responses_queue, bool ignore_response)
+{
+    std::vector<String> removed_paths;
+    for (auto session_id : session_ids)
     {
-        for (const auto & ephemeral_path : it->second)
+        /// Paths of the session are taken out of the index, nodes are removed without holding the shard.
+        std::unordered_set<String> ephemeral_paths;
+        {
+            auto & shard = getEphemeralsShard(session_id);
+            std::lock_guard lock(shard.mutex);
+            auto it = shard.ephemerals.find(session_id);
+            if (it != shard.ephemerals.end())
+            {
+                ephemeral_paths.swap(it->second);
+                shard.ephemerals.erase(it);
+                total_ephemeral_nodes -= ephemeral_paths.size();
+                --sessions_with_ephemeral_nodes;
+            }
+        }
+
+        if (ephemeral_paths.empty())
+        {
+            LOG_DEBUG(log, "Session {} has no ephemeral nodes", toHexString(session_id));
+            continue;
+        }
+
+        LOG_DEBUG(log, "Clean {} ephemeral nodes for session {}", ephemeral_paths.size(), toHexString(session_id));
+        while (!ephemeral_paths.empty())
         {
+            auto ephemeral_path = std::move(ephemeral_paths.extract(ephemeral_paths.begin()).value());
             LOG_TRACE(log, "Disconnect session {}, deleting its ephemeral node {}", toHexString(session_id), ephemeral_path);
-            auto parent = data_tree.at(getParentPath(ephemeral_path));
+            auto parent = data_tree.getForUpdate(HashedPath(parentPathOf(ephemeral_path)));
             if (!parent)
             {
                 LOG_ERROR(
@@ -1477,141 +2407,317 @@ void KeeperStore::cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<Respon
             else
             {
                 --parent->stat.numChildren;
-                parent->children.erase(getBaseName(ephemeral_path));
+                parent->children.erase(baseNameOf(ephemeral_path));
+                indexExpiringNode(parentPathOf(ephemeral_path), *parent);
             }
-            data_tree.erase(ephemeral_path);
-
-            auto responses = watch_manager.processWatches(ephemeral_path, Coordination::Event::DELETED);
-            set_response(responses_queue, responses, ignore_response);
+            removeNode(ephemeral_path);
+            removed_paths.push_back(std::move(ephemeral_path));
         }
-        ephemerals.erase(it);
-    }
-    else
-    {
-        LOG_DEBUG(log, "Session {} has no ephemeral nodes", toHexString(session_id));
     }
+
+    /// Watches are triggered after all the nodes are removed, so that a parent is notified once.
+    if (!removed_paths.empty())
+        set_response(responses_queue, watch_manager.processRemovedPaths(removed_paths), ignore_response);
+}
+
+void KeeperStore::enableParallelMultiRead(size_t threads, size_t min_requests)
+{
+    multi_read_thread_pool = std::make_unique<ThreadPool>(threads);
+    multi_read_threads = threads;
+    multi_read_parallel_min_requests = min_requests;
+}
+
+bool KeeperStore::hasPermission(int64_t session_id, uint64_t acl_id, int32_t permission)
+{
+    /// No ACL or world:anyone with all permissions
+    if (acl_id == 0)
+        return true;
+
+    if (auto allowed = acl_decision_cache.get(session_id, acl_id, permission))
+        return *allowed;
+
+    /// Shared handle of the interned ACLs, nothing is copied
+    auto node_acls = acl_map.convertNumber(acl_id);
+
+    /// Put under auth_mutex, auth of the session changes under it exclusively and drops the decisions made before
+    std::shared_lock r_lock(auth_mutex);
+    auto it = session_and_auth.find(session_id);
+    bool allowed = it != session_and_auth.end() ? checkACL(permission, *node_acls, it->second) : checkACL(permission, *node_acls, {});
+    acl_decision_cache.put(session_id, acl_id, permission, allowed);
+    return allowed;
 }
 
-void KeeperStore::dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) const
+void KeeperStore::closeSessions(
+    const std::vector<int64_t> & session_ids,
+    Coordination::XID xid,
+    int64_t response_zxid,
+    KeeperResponsesQueue & responses_queue,
+    bool ignore_response)
 {
-    auto write_str_set = [&buf](const std::unordered_set<String> & ephemeral_paths)
+    cleanEphemeralNodes(session_ids, responses_queue, ignore_response);
+    watch_manager.cleanDeadWatches(session_ids);
+
+    /// clean auth for sessions
     {
-        for (const String & path : ephemeral_paths)
+        std::lock_guard lock(auth_mutex);
+        for (auto session_id : session_ids)
         {
-            buf << "\t" << path << "\n";
+            session_and_auth.erase(session_id);
+            acl_decision_cache.invalidate(session_id);
         }
-    };
+    }
 
-    session_manager.dumpSessionIDs(buf);
+    session_manager.expireSessions(session_ids);
 
-    buf << "Sessions with Ephemerals (" << getSessionWithEphemeralNodesCount() << "):\n";
-    std::lock_guard lock(ephemerals_mutex);
-    for (const auto & [session_id, ephemeral_paths] : ephemerals)
+    ResponsesForSessions responses;
+    responses.reserve(session_ids.size());
+    for (auto session_id : session_ids)
     {
-        buf << toHexString(session_id) << "\n";
-        write_str_set(ephemeral_paths);
+        auto response = std::make_shared<Coordination::ZooKeeperCloseResponse>();
+        response->xid = xid;
+        response->zxid = response_zxid;
+        responses.emplace_back(session_id, std::move(response));
     }
+    set_response(responses_queue, responses, ignore_response);
 }
 
-uint64_t KeeperStore::getTotalEphemeralNodesCount() const
+void KeeperStore::closeReadOnlySession(int64_t session_id)
 {
-    std::lock_guard lock(ephemerals_mutex);
-    uint64_t ret = 0;
-    for (const auto & [session_id, nodes] : ephemerals)
-        ret += nodes.size();
+    watch_manager.cleanDeadWatches(session_id);
 
-    return ret;
+    std::lock_guard lock(auth_mutex);
+    session_and_auth.erase(session_id);
+    acl_decision_cache.invalidate(session_id);
 }
 
+void KeeperStore::removeExpiredNodes(
+    const Strings & paths, int64_t time, int64_t request_zxid, KeeperResponsesQueue & responses_queue, bool ignore_response)
+{
+    std::vector<String> removed_paths;
+    for (const auto & path : paths)
+    {
+        auto node = data_tree.get(path);
+        if (!node)
+            continue;
+
+        const auto owner = node->stat.ephemeralOwner;
+        if (!node->children.empty())
+        {
+            /// Indexed again when its last child is removed
+            unindexExpiringNode(path, *node);
+            continue;
+        }
+        /// Changed after it was collected, indexed by the new deadline
+        if (isTTLOwner(owner) && node->stat.mtime + ttlOfOwner(owner) > time)
+            continue;
+        if (!isTTLOwner(owner) && !(isContainerOwner(owner) && node->stat.cversion > 0))
+            continue;
+
+        LOG_TRACE(log, "Remove expired {} node {}", isTTLOwner(owner) ? "TTL" : "container", path);
+        auto parent = data_tree.getForUpdate(HashedPath(parentPathOf(path)));
+        if (!parent)
+        {
+            LOG_ERROR(log, "Logical error, parent of expired node {} not exist", path);
+            continue;
+        }
+        --parent->stat.numChildren;
+        parent->stat.pzxid = request_zxid;
+        parent->children.erase(baseNameOf(path));
+        /// An empty container parent is removed by the next check
+        indexExpiringNode(parentPathOf(path), *parent);
+
+        acl_map.removeUsage(node->acl_id);
+        node_expiry_index.remove(path);
+        removeNode(path);
+        if (response_cache.enabled())
+            response_cache.invalidate(path);
+        removed_paths.push_back(path);
+    }
 
-void KeeperStore::reset()
+    LOG_DEBUG(log, "Removed {} of {} expired nodes", removed_paths.size(), paths.size());
+
+    /// Watches are triggered after all the nodes are removed, so that a parent is notified once.
+    if (!removed_paths.empty())
+        set_response(responses_queue, watch_manager.processRemovedPaths(removed_paths), ignore_response);
+}
+
+void KeeperStore::enableDigest()
 {
-    data_tree.clear();
-    zxid = 0;
+    digest_enabled = true;
+    recomputeDigest();
+}
 
-    acl_map.reset();
-    session_manager.reset();
-    watch_manager.reset();
+void KeeperStore::recomputeDigest()
+{
+    if (!digest_enabled)
+        return;
+
+    UInt64 digest = 0;
+    for (UInt32 bucket_id = 0; bucket_id < data_tree.getBucketNum(); ++bucket_id)
+        for (const auto & [path, node] : data_tree.getMapForRead(bucket_id).getMap())
+            digest ^= nodeDigest(path, *node);
+    nodes_digest.store(digest, std::memory_order_relaxed);
+}
+
+std::optional<UInt64> KeeperStore::getDigestCheckpoint(int64_t checkpoint) const
+{
+    std::lock_guard lock(digest_checkpoints_mutex);
+    auto it = digest_checkpoints.find(checkpoint);
+    if (it == digest_checkpoints.end())
+        return {};
+    return it->second;
+}
 
+void KeeperStore::checkDigest(const Coordination::ZooKeeperCheckDigestRequest & request)
+{
+    if (!digest_enabled)
+        return;
+
+    UInt64 digest = getNodesDigest();
+    std::lock_guard lock(digest_checkpoints_mutex);
+    digest_checkpoints[request.checkpoint] = digest;
+    while (digest_checkpoints.size() > MAX_DIGEST_CHECKPOINTS)
+        digest_checkpoints.erase(digest_checkpoints.begin());
+
+    if (request.checked_checkpoint == 0)
+        return;
+
+    /// Not known if the checkpoint is before the snapshot loaded
+    auto it = digest_checkpoints.find(request.checked_checkpoint);
+    if (it == digest_checkpoints.end())
+        return;
+
+    if (it->second != request.checked_digest)
     {
-        std::lock_guard lock(auth_mutex);
-        session_and_auth.clear();
+        digest_mismatches.fetch_add(1, std::memory_order_relaxed);
+        LOG_ERROR(
+            log,
+            "Digest of data tree {} differs with the one of leader {} at checkpoint {}, data tree diverged",
+            it->second,
+            request.checked_digest,
+            request.checked_checkpoint);
     }
-
+    else
     {
-        std::lock_guard lock(ephemerals_mutex);
-        ephemerals.clear();
+        LOG_DEBUG(log, "Digest of data tree at checkpoint {} is the same with leader", request.checked_checkpoint);
     }
 }
 
-std::shared_ptr<KeeperStore::BucketNodes> KeeperStore::dumpDataTree()
+void KeeperStore::dumpSessionsAndEphemerals(const DumpOutput & output) const
 {
-    auto result = std::make_shared<KeeperStore::BucketNodes>();
-    ThreadPool object_thread_pool(DATA_TREE_BUCKET_NUM);
+    session_manager.dumpSessionIDs(output);
 
-    for (UInt32 thread_idx = 0; thread_idx < DATA_TREE_BUCKET_NUM; thread_idx++)
+    output("Sessions with Ephemerals (" + std::to_string(getSessionWithEphemeralNodesCount()) + "):\n");
+    for (const auto & shard : ephemerals_shards)
     {
-        object_thread_pool.trySchedule(
-            [thread_idx, this, &result]
+        /// Sessions are taken at once, and looked up again by chunks, the ones gone meanwhile are skipped.
+        std::vector<int64_t> session_ids;
+        {
+            std::lock_guard lock(shard.mutex);
+            session_ids.reserve(shard.ephemerals.size());
+            for (const auto & [session_id, _] : shard.ephemerals)
+                session_ids.push_back(session_id);
+        }
+
+        for (size_t begin = 0; begin < session_ids.size(); begin += DUMP_CHUNK_SIZE)
+        {
+            WriteBufferFromOwnString buf;
             {
-                for (UInt32 bucket_idx = 0; bucket_idx < DATA_TREE_BUCKET_NUM; bucket_idx++)
+                std::lock_guard lock(shard.mutex);
+                for (size_t i = begin; i < std::min(begin + DUMP_CHUNK_SIZE, session_ids.size()); ++i)
                 {
-                    if (bucket_idx % DATA_TREE_BUCKET_NUM != thread_idx)
+                    auto it = shard.ephemerals.find(session_ids[i]);
+                    if (it == shard.ephemerals.end())
                         continue;
+                    buf << toHexString(it->first) << "\n";
+                    for (const String & path : it->second)
+                        buf << "\t" << path << "\n";
+                }
+            }
+            output(std::move(buf.str()));
+        }
+    }
+}
 
-                    LOG_INFO(log, "Dump data tree for bucket {}", bucket_idx);
-
-                    auto && bucket = this->data_tree.getMap(bucket_idx).getMap();
-                    auto & bucket_in_result = (*result)[bucket_idx];
-                    bucket_in_result.reserve(bucket.size());
-
-                    size_t key_size = 0;
-                    for (auto it = bucket.begin(); it != bucket.end(); ++it)
-                    {
-                        auto data_size = it->first.size();
-                        key_size += data_size;
 
-                        String path_copied;
-                        path_copied.resize(data_size);
-                        memcopy(path_copied.data(), it->first.data(), data_size);
+void KeeperStore::reset()
+{
+    data_tree.clear();
+    zxid = 0;
+    nodes_digest = 0;
+    {
+        std::lock_guard lock(digest_checkpoints_mutex);
+        digest_checkpoints.clear();
+    }
 
-                        bucket_in_result.emplace_back(std::move(path_copied), it->second->cloneWithoutChildren());
+    acl_map.reset();
+    session_manager.reset();
+    watch_manager.reset();
 
-                        /// Prefetch the next element, may slightly improve performance in this case.
-                        auto next_it = std::next(it);
-                        if (likely(next_it != bucket.end()))
-                        {
-                            __builtin_prefetch(next_it->first.data(), 0, 3);
-                            __builtin_prefetch(next_it->second.get(), 0, 3);
-                        }
-                    }
-                    LOG_INFO(log, "Dump data tree for bucket {} done, key_size {}, result size {}", bucket_idx, key_size, bucket_in_result.size());
-                }
-            });
+    {
+        std::lock_guard lock(auth_mutex);
+        session_and_auth.clear();
+        acl_decision_cache.reset();
     }
 
-    object_thread_pool.wait();
-    return result;
+    for (auto & shard : ephemerals_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.ephemerals.clear();
+    }
+    total_ephemeral_nodes = 0;
+    sessions_with_ephemeral_nodes = 0;
+    node_expiry_index.clear();
 }
 
 uint64_t KeeperStore::getApproximateDataSize() const
 {
     UInt64 node_count = data_tree.size();
     UInt64 size_bytes = data_tree.getBucketNum() * sizeof(DataTree::InnerMap) /* Inner map size */
-        + node_count * 8 / 0.75 /*hash map array size*/
+        + data_tree.getBufferSizeInBytes() /*hash map array size*/
         + node_count * sizeof(KeeperNode) /*node size*/
-        + node_count * 100; /*path and child of node size*/
+        + data_tree.getDataSize(); /*path, child name and data of node size*/
     return size_bytes;
 }
 
+void KeeperStore::getMemoryUsage(KeeperMemoryUsage & usage) const
+{
+    usage.data_tree = getApproximateDataSize();
+    usage.watches = watch_manager.getApproximateMemoryUsage();
+    usage.acl_map = acl_map.getApproximateMemoryUsage();
+
+    usage.sessions = session_manager.getApproximateMemoryUsage();
+    {
+        std::shared_lock lock(auth_mutex);
+        usage.sessions += session_and_auth.getApproximateMemoryUsage();
+        for (const auto & [_, auth_ids] : session_and_auth)
+        {
+            usage.sessions += auth_ids.capacity() * sizeof(Coordination::AuthID);
+            for (const auto & auth_id : auth_ids)
+                usage.sessions += stringMemoryUsage(auth_id.scheme) + stringMemoryUsage(auth_id.id);
+        }
+    }
+    for (const auto & shard : ephemerals_shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        usage.sessions += hashTableMemoryUsage(shard.ephemerals);
+        for (const auto & [_, paths] : shard.ephemerals)
+        {
+            usage.sessions += hashTableMemoryUsage(paths);
+            for (const auto & path : paths)
+                usage.sessions += stringMemoryUsage(path);
+        }
+    }
+}
+
 void KeeperStore::initializeSystemNodes()
 {
     auto add_node = [&](const String & path)
     {
         if (!data_tree.count(path))
         {
-            data_tree.emplace(path, std::make_shared<KeeperNode>());
-            getNode(getParentPath(path))->children.insert(getBaseName(path));
+            addNode(path, KeeperNode::create());
+            getNodeForUpdate(HashedPath(parentPathOf(path)))->children.insert(getBaseName(path));
         }
     };
 
@@ -1623,7 +2729,12 @@ void KeeperStore::initializeSystemNodes()
     add_node(CLICKHOUSE_KEEPER_SYSTEM_PATH);
     add_node(CLICKHOUSE_KEEPER_API_VERSION_PATH);
 
-    data_tree.get(CLICKHOUSE_KEEPER_API_VERSION_PATH)->data = toString(static_cast<uint8_t>(CURRENT_KEEPER_API_VERSION));
+    auto api_version_node = data_tree.getForUpdate(CLICKHOUSE_KEEPER_API_VERSION_PATH);
+    String api_version = toString(static_cast<uint8_t>(CURRENT_KEEPER_API_VERSION));
+    onNodeDataChanged(HashedPath(CLICKHOUSE_KEEPER_API_VERSION_PATH), api_version_node->data.size(), api_version.size());
+    updateDigest(CLICKHOUSE_KEEPER_API_VERSION_PATH, *api_version_node);
+    api_version_node->data = std::move(api_version);
+    updateDigest(CLICKHOUSE_KEEPER_API_VERSION_PATH, *api_version_node);
 #endif
 }
 
@@ -1,50 +1,112 @@
 #pragma once
 
+#include <array>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <string_view>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
+#include <Service/ACLDecisionCache.h>
 #include <Service/ACLMap.h>
+#include <Service/ChildrenSet.h>
+#include <Service/CopyOnWriteMap.h>
+#include <Service/EpochManager.h>
+#include <Service/ResponseCache.h>
 #include <Service/SessionManager.h>
 #include <Service/WatchManager.h>
+#include <Service/ResponsesQueue.h>
 #include <Service/ThreadSafeQueue.h>
 #include <Service/KeeperCommon.h>
+#include <Service/MemoryUsage.h>
+#include <Service/NodeData.h>
+#include <Service/NodeExpiryIndex.h>
 #include <Service/formatHex.h>
 #include <ZooKeeper/IKeeper.h>
 #include <Poco/Logger.h>
 #include <Common/ConcurrentBoundedQueue.h>
+#include <Common/CountingBloomFilter.h>
+#include <Common/FlatHashMap.h>
+#include <Common/HashFunctions.h>
 #include <Common/IO/Operators.h>
 #include <Common/IO/WriteBufferFromString.h>
+#include <Common/ProfiledMutex.h>
 #include <Common/ThreadPool.h>
 #include <common/logger_useful.h>
+#include <boost/smart_ptr/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include <shared_mutex>
 
 namespace RK
 {
 
+struct KeeperNode;
+using KeeperNodePtr = boost::intrusive_ptr<KeeperNode>;
+
+/// Stat of a node kept in data tree. Unlike Coordination::Stat there is no dataLength, which is size of data,
+/// and the fields are ordered without padding. numChildren is kept, it is persisted in snapshot and children
+/// of a node pinned for snapshot may be moved to its copy.
+struct KeeperNodeStat
+{
+    int64_t czxid = 0;
+    int64_t mzxid = 0;
+    int64_t ctime = 0;
+    int64_t mtime = 0;
+    int64_t ephemeralOwner = 0;
+    int64_t pzxid = 0;
+    int32_t version = 0;
+    int32_t cversion = 0;
+    int32_t aversion = 0;
+    int32_t numChildren = 0;
+
+    bool operator==(const KeeperNodeStat & rhs) const = default;
+};
+
 /**
  * Represent an entry in data tree.
+ *
+ * Reference counter is embedded into the node rather than living in a separate
+ * control block, node is allocated as a single chunk of the slab pool.
+ * Flags come first to fill the tail padding of the reference counter.
  */
-struct KeeperNode
+struct KeeperNode : public boost::intrusive_ref_counter<KeeperNode>
 {
-    using ChildrenSet = std::unordered_set<String>;
-
-    String data;
-    uint64_t acl_id = 0;
+    using ChildrenSet = RK::ChildrenSet;
 
     bool is_ephemeral = false;
     bool is_sequential = false;
 
-    Coordination::Stat stat{};
+    /// Large data is kept out of the heap, see NodeData
+    NodeData data;
+    uint64_t acl_id = 0;
+
+    KeeperNodeStat stat;
     ChildrenSet children;
 
-    std::shared_ptr<KeeperNode> clone() const;
-    std::shared_ptr<KeeperNode> cloneWithoutChildren() const;
+    /// Version of data tree in which the node was put into the tree, see KeeperNodeMap::pin.
+    UInt64 tree_version = 0;
+
+    static KeeperNodePtr create();
+
+    static void * operator new(size_t size);
+    static void operator delete(void * ptr) noexcept;
+
+    KeeperNodePtr clone() const;
+    KeeperNodePtr cloneWithoutChildren() const;
+
+    /// Copy which replaces the node in data tree when the node is shared with a pinned version.
+    /// Children are moved instead of copied, for snapshot does not serialize them.
+    KeeperNodePtr cloneForUpdate();
 
     /// All stat for client should be generated by this function.
     /// This method will remove numChildren from persisted stat.
     Coordination::Stat statForResponse() const;
 
+    /// Stat in snapshot, dataLength is derived from data.
+    Coordination::Stat persistedStat() const;
+    void setPersistedStat(const Coordination::Stat & persisted_stat);
+
     bool operator==(const KeeperNode & rhs) const
     {
         return data == rhs.data && acl_id == rhs.acl_id && is_ephemeral == rhs.is_ephemeral && is_sequential == rhs.is_sequential
@@ -53,23 +115,30 @@ struct KeeperNode
     bool operator!=(const KeeperNode & rhs) const { return !(rhs == *this); }
 };
 
-using KeeperNodePtr = std::shared_ptr<KeeperNode>;
-
 struct KeeperNodeWithPath
 {
     String path;
     KeeperNodePtr node;
 };
 
-/// KeeperNodeMap is a two-level unordered_map which is designed to reduce latency for unordered_map scaling.
+/// KeeperNodeMap is a two-level hash map which is designed to reduce latency for hash map scaling.
+/// Every bucket is an open addressing FlatHashMap, so lookups do not chase a heap node per entry.
 /// It is not a thread-safe map. But it is accessed only in the request processor thread.
-template <typename Value, unsigned NumBuckets>
+/// Value should be reference counted intrusively, see KeeperNode.
+///
+/// Data tree can be pinned as an immutable version for snapshot in O(bucket num). After that buckets and values
+/// are copied on write: the first update of a bucket or a value which was put into the tree before pinning
+/// replaces it with a copy, so the pinned version can be read from another thread without lock.
+///
+/// Optionally every bucket has a counting Bloom filter of its keys, so that lookups of missing keys can be
+/// answered by mayContain without touching the bucket. Filters belong to the live tree only.
+template <typename Value>
 class KeeperNodeMap
 {
 public:
     using Key = String;
-    using ValuePtr = std::shared_ptr<Value>;
-    using NestedMap = std::unordered_map<String, ValuePtr>;
+    using ValuePtr = boost::intrusive_ptr<Value>;
+    using NestedMap = FlatHashMap<String, ValuePtr, StringHash>;
     using Action = std::function<void(const String &, const ValuePtr &)>;
 
     class InnerMap
@@ -81,17 +150,47 @@ public:
             return (i != map.end()) ? i->second : nullptr;
         }
 
+        ValuePtr get(const HashedPath & key)
+        {
+            auto i = map.findHashed(key.path, key.hash);
+            return (i != map.end()) ? i->second : nullptr;
+        }
+
+        /// Without touching the reference counter, see KeeperNodeMap::getForRead
+        const Value * getForRead(const String & key) const
+        {
+            auto i = map.find(key);
+            return (i != map.end()) ? i->second.get() : nullptr;
+        }
+
+        const Value * getForRead(const HashedPath & key) const
+        {
+            auto i = map.findHashed(key.path, key.hash);
+            return (i != map.end()) ? i->second.get() : nullptr;
+        }
+
         template <typename T>
         bool emplace(const String & key, T && value)
         {
             return map.insert_or_assign(key, value).second;
         }
 
+        template <typename T>
+        bool emplace(const HashedPath & key, T && value)
+        {
+            return map.insertOrAssignHashed(key.path, key.hash, value).second;
+        }
+
         bool erase(const String & key)
         {
             return map.erase(key);
         }
 
+        bool erase(const HashedPath & key)
+        {
+            return map.eraseHashed(key.path, key.hash);
+        }
+
         size_t size() const
         {
             return map.size();
@@ -102,6 +201,16 @@ public:
             map.clear();
         }
 
+        void reserve(size_t n)
+        {
+            map.reserve(n);
+        }
+
+        size_t getBufferSizeInBytes() const
+        {
+            return map.getBufferSizeInBytes();
+        }
+
         void forEach(const Action & fn)
         {
             for (const auto & [key, value] : map)
@@ -111,109 +220,455 @@ public:
         /// This method will destroy InnerMap thread safety property.
         /// Deprecated, please use forEach instead.
         NestedMap & getMap() { return map; }
+        const NestedMap & getMap() const { return map; }
+
+        /// Version of data tree in which the bucket was created or copied.
+        UInt64 tree_version = 0;
 
     private:
         NestedMap map;
     };
 
+    using InnerMapPtr = std::shared_ptr<InnerMap>;
+
+    /// Immutable data tree of the moment of pinning, it is safe to read it from any thread.
+    class Version
+    {
+    public:
+        Version(std::vector<std::shared_ptr<const InnerMap>> buckets_, std::atomic<UInt32> & pinned_versions_)
+            : buckets(std::move(buckets_)), pinned_versions(pinned_versions_)
+        {
+        }
+
+        ~Version()
+        {
+            /// Release buckets before unpinning, after that writer can update them in place.
+            buckets.clear();
+            pinned_versions.fetch_sub(1, std::memory_order_release);
+        }
+
+        const std::vector<std::shared_ptr<const InnerMap>> & getBuckets() const { return buckets; }
+
+    private:
+        std::vector<std::shared_ptr<const InnerMap>> buckets;
+        std::atomic<UInt32> & pinned_versions;
+    };
+
+    using VersionPtr = std::shared_ptr<Version>;
+
+    /// Keys changed since the last takeDirtyKeys, per bucket.
+    using DirtyKeys = std::vector<std::unordered_set<String>>;
+    using DirtyKeysPtr = std::shared_ptr<DirtyKeys>;
+
 private:
-    inline InnerMap & mapFor(const String & key) { return buckets[hash(key) % NumBuckets]; }
+    inline UInt32 indexFor(const String & key) const { return hash(key) % num_buckets; }
+    inline UInt32 indexFor(const HashedPath & key) const { return key.hash % num_buckets; }
 
-    std::array<InnerMap, NumBuckets> buckets;
-    std::hash<String> hash;
-    std::atomic<size_t> node_count{0};
+    inline InnerMap & mapFor(const String & key) { return *buckets[indexFor(key)]; }
+    inline InnerMap & mapFor(const HashedPath & key) { return *buckets[indexFor(key)]; }
 
-public:
-    ValuePtr get(const String & key) { return mapFor(key).get(key); }
-    ValuePtr at(const String & key) { return mapFor(key).get(key); }
+    /// Whether an object put into the tree in object_version may be referenced by a pinned version.
+    inline bool isShared(UInt64 object_version) const
+    {
+        return object_version < current_version.load(std::memory_order_relaxed) && pinned_versions.load(std::memory_order_acquire) != 0;
+    }
 
-    template <typename T>
-    bool emplace(const String & key, T && value)
+    /// Bucket for inserting, erasing or replacing values, copy it if it is shared.
+    InnerMap & mapForUpdate(UInt32 bucket_id)
     {
-        if (mapFor(key).emplace(key, std::forward<T>(value)))
+        auto & bucket = buckets[bucket_id];
+        if (unlikely(isShared(bucket->tree_version)))
         {
-            node_count++;
-            return true;
+            bucket = std::make_shared<InnerMap>(*bucket);
+            bucket->tree_version = current_version.load(std::memory_order_relaxed);
         }
-        return false;
+        return *bucket;
     }
 
-    template <typename T>
-    bool emplace(const String & key, T && value, UInt32 bucket_id)
+    static const String & keyOf(const String & key) { return key; }
+    static std::string_view keyOf(const HashedPath & key) { return key.path; }
+
+    /// Bytes of a key and its value accounted in bucket_data_sizes: the path, the name of the node as
+    /// a child of its parent and the data.
+    static size_t entrySize(std::string_view key, const Value & value)
+    {
+        size_t pos = key.rfind('/');
+        size_t name_size = pos == String::npos ? key.size() : key.size() - pos - 1;
+        return key.size() + name_size + value.data.size();
+    }
+
+    template <typename K>
+    void markDirty(UInt32 bucket_id, const K & key)
     {
-        if (buckets[bucket_id].emplace(key, std::forward<T>(value)))
+        if (!dirty_keys.empty() && dirty_keys_valid.load(std::memory_order_relaxed))
+            dirty_keys[bucket_id].emplace(keyOf(key));
+    }
+
+    template <typename K, typename T>
+    bool emplaceImpl(const K & key, T && value, UInt32 bucket_id)
+    {
+        markDirty(bucket_id, key);
+
+        /// The value must not be shared with any pinned version, it is owned by the live tree from now on.
+        value->tree_version = current_version.load(std::memory_order_relaxed);
+
+        auto & bucket = mapForUpdate(bucket_id);
+        auto & bucket_data_size = bucket_data_sizes[bucket_id];
+        auto old_value = bucket.get(key);
+        if (old_value)
+            bucket_data_size.fetch_sub(entrySize(keyOf(key), *old_value), std::memory_order_relaxed);
+        bucket_data_size.fetch_add(entrySize(keyOf(key), *value), std::memory_order_relaxed);
+
+        if (bucket.emplace(key, std::forward<T>(value)))
         {
             node_count++;
+            if (!filters.empty())
+                addToFilter(bucket_id, hashOf(key));
             return true;
         }
+        retire(bucket_id, std::move(old_value));
         return false;
     }
 
-    bool erase(String const & key)
+    /// Keep a value erased or replaced in the live tree until readers of the epoch have left
+    void retire(UInt32 bucket_id, ValuePtr && value)
+    {
+        if (epoch_manager && value)
+            retired[bucket_id].retire(std::move(value), epoch_manager->currentEpoch());
+    }
+
+    template <typename K>
+    bool eraseImpl(const K & key)
     {
-        if (mapFor(key).erase(key))
+        UInt32 bucket_id = indexFor(key);
+        auto & bucket = mapForUpdate(bucket_id);
+        auto old_value = bucket.get(key);
+        if (!old_value)
+            return false;
+
+        markDirty(bucket_id, key);
+        bucket_data_sizes[bucket_id].fetch_sub(entrySize(keyOf(key), *old_value), std::memory_order_relaxed);
+        bucket.erase(key);
+        node_count--;
+        if (!filters.empty())
+            filters[bucket_id].remove(hashOf(key));
+        retire(bucket_id, std::move(old_value));
+        return true;
+    }
+
+    size_t hashOf(const String & key) const { return hash(key); }
+    static size_t hashOf(const HashedPath & key) { return key.hash; }
+
+    void addToFilter(UInt32 bucket_id, size_t key_hash)
+    {
+        auto & filter = filters[bucket_id];
+        if (filter.size() < filter.getCapacity())
         {
-            node_count--;
-            return true;
+            filter.add(key_hash);
+            return;
         }
-        return false;
+
+        /// Rebuild with doubled capacity, the key is already in the bucket
+        filter.reset(filter.getCapacity() * 2);
+        for (const auto & [bucket_key, _] : buckets[bucket_id]->getMap())
+            filter.add(hash(bucket_key));
+    }
+
+    template <typename K>
+    ValuePtr getForUpdateImpl(const K & key)
+    {
+        UInt32 bucket_id = indexFor(key);
+        auto & bucket = mapForUpdate(bucket_id);
+        auto value = bucket.get(key);
+        if (value)
+            markDirty(bucket_id, key);
+        if (value && unlikely(isShared(value->tree_version)))
+        {
+            auto old_value = std::move(value);
+            value = old_value->cloneForUpdate();
+            value->tree_version = current_version.load(std::memory_order_relaxed);
+            bucket.emplace(key, value);
+            retire(bucket_id, std::move(old_value));
+        }
+        return value;
+    }
+
+    UInt32 num_buckets;
+    std::vector<InnerMapPtr> buckets;
+    StringHash hash;
+    std::atomic<size_t> node_count{0};
+    /// Maintained by every insertion, erasing and data update, so monitoring need not walk the tree.
+    std::vector<std::atomic<size_t>> bucket_data_sizes;
+
+    /// Increased by every pinning
+    std::atomic<UInt64> current_version{0};
+    std::atomic<UInt32> pinned_versions{0};
+
+    /// Bloom filters of keys of buckets, empty if they are disabled
+    std::vector<CountingBloomFilter> filters;
+
+    /// Keys inserted, erased or got for update, empty if dirty tracking is disabled. Buckets are
+    /// touched by one writer each, so they need no lock. Keys are recorded only if dirty_keys_valid,
+    /// which is false before the first takeDirtyKeys and after clear.
+    DirtyKeys dirty_keys;
+    std::atomic<bool> dirty_keys_valid{false};
+
+    /// Values retired per bucket, nullptr manager if readers do not run in parallel with the writer. Buckets are
+    /// touched by one writer each as dirty_keys.
+    EpochManager * epoch_manager = nullptr;
+    std::vector<RetireList<ValuePtr>> retired;
+
+public:
+    explicit KeeperNodeMap(UInt32 num_buckets_, bool negative_lookup_filter = false, bool track_dirty_keys = false)
+        : num_buckets(num_buckets_), bucket_data_sizes(num_buckets_)
+    {
+        buckets.reserve(num_buckets);
+        for (UInt32 i = 0; i < num_buckets; ++i)
+            buckets.emplace_back(std::make_shared<InnerMap>());
+        if (negative_lookup_filter)
+            filters.resize(num_buckets);
+        if (track_dirty_keys)
+            dirty_keys.resize(num_buckets);
+    }
+
+    /// False if the key is not in the tree for sure, true if it may be or filters are disabled.
+    bool mayContain(const HashedPath & key) const { return filters.empty() || filters[indexFor(key)].mayContain(key.hash); }
+
+    ValuePtr get(const String & key) { return mapFor(key).get(key); }
+    ValuePtr at(const String & key) { return mapFor(key).get(key); }
+
+    /// Pre-hashed key is hashed once for both choosing bucket and looking up in the bucket.
+    ValuePtr get(const HashedPath & key) { return mapFor(key).get(key); }
+
+    /// Value which is valid until the writer erases or replaces it, or with an epoch manager until the reader leaves
+    /// the epoch it is in. Reference counter is not touched, so readers in parallel do not contend on hot nodes.
+    const Value * getForRead(const String & key) const { return buckets[indexFor(key)]->getForRead(key); }
+    const Value * getForRead(const HashedPath & key) const { return buckets[indexFor(key)]->getForRead(key); }
+
+    /// Values erased or replaced from now on are retired to the manager, nullptr frees them at once
+    void setEpochManager(EpochManager * manager)
+    {
+        reclaim();
+        epoch_manager = manager;
+        retired = std::vector<RetireList<ValuePtr>>(manager ? num_buckets : 0);
+    }
+
+    /// Free retired values which no reader may read, return how many. Invoked by the writer when no write is in
+    /// progress.
+    size_t reclaim()
+    {
+        if (!epoch_manager)
+            return 0;
+        UInt64 safe_epoch = epoch_manager->advance();
+        size_t res = 0;
+        for (auto & list : retired)
+            res += list.reclaim(safe_epoch);
+        return res;
+    }
+
+    size_t getRetiredCount() const
+    {
+        size_t res = 0;
+        for (const auto & list : retired)
+            res += list.size();
+        return res;
+    }
+
+    /// Return the value which can be modified in place, every modification of values must use them.
+    ValuePtr getForUpdate(const String & key) { return getForUpdateImpl(key); }
+    ValuePtr getForUpdate(const HashedPath & key) { return getForUpdateImpl(key); }
+
+    template <typename T>
+    bool emplace(const HashedPath & key, T && value)
+    {
+        return emplaceImpl(key, std::forward<T>(value), indexFor(key));
+    }
+
+    bool erase(const HashedPath & key) { return eraseImpl(key); }
+
+    size_t count(const HashedPath & key) { return get(key) != nullptr ? 1 : 0; }
+
+    template <typename T>
+    bool emplace(const String & key, T && value)
+    {
+        return emplaceImpl(key, std::forward<T>(value), indexFor(key));
+    }
+
+    template <typename T>
+    bool emplace(const String & key, T && value, UInt32 bucket_id)
+    {
+        return emplaceImpl(key, std::forward<T>(value), bucket_id);
+    }
+
+    bool erase(String const & key) { return eraseImpl(key); }
+
+    /// Should be invoked when data of a value in the tree is updated in place.
+    void onDataSizeChanged(const HashedPath & key, size_t old_size, size_t new_size)
+    {
+        auto & bucket_data_size = bucket_data_sizes[indexFor(key)];
+        bucket_data_size.fetch_add(new_size, std::memory_order_relaxed);
+        bucket_data_size.fetch_sub(old_size, std::memory_order_relaxed);
     }
 
     size_t count(const String & key) { return get(key) != nullptr ? 1 : 0; }
 
-    UInt32 getBucketIndex(const String & key) { return hash(key) % NumBuckets; }
-    UInt32 getBucketNum() const { return NumBuckets; }
+    UInt32 getBucketIndex(const String & key) { return indexFor(key); }
+    UInt32 getBucketIndex(const HashedPath & key) const { return indexFor(key); }
+    UInt32 getBucketNum() const { return num_buckets; }
 
-    InnerMap & getMap(const UInt32 & bucket_id) { return buckets[bucket_id]; }
+    /// Bucket is copied if it is shared with a pinned version.
+    InnerMap & getMap(const UInt32 & bucket_id) { return mapForUpdate(bucket_id); }
+    /// Bucket for reading in the writer thread, it is never copied.
+    const InnerMap & getMapForRead(const UInt32 & bucket_id) const { return *buckets[bucket_id]; }
+
+    /// Pin the current data tree as an immutable version, it is unpinned when the returned version is released.
+    /// It should be invoked when there is no write in progress.
+    VersionPtr pin()
+    {
+        pinned_versions.fetch_add(1, std::memory_order_acquire);
+        current_version.fetch_add(1, std::memory_order_relaxed);
+        return std::make_shared<Version>(std::vector<std::shared_ptr<const InnerMap>>(buckets.begin(), buckets.end()), pinned_versions);
+    }
+
+    /// Take keys changed since the last call, nullptr if they are not known, which is the case when tracking is
+    /// disabled, at the first call and after clear. It should be invoked together with pin, then the keys are
+    /// what changed between the two versions.
+    DirtyKeysPtr takeDirtyKeys()
+    {
+        if (dirty_keys.empty())
+            return nullptr;
+
+        DirtyKeysPtr res;
+        if (dirty_keys_valid.load(std::memory_order_relaxed))
+            res = std::make_shared<DirtyKeys>(std::move(dirty_keys));
+        dirty_keys = DirtyKeys(num_buckets);
+        dirty_keys_valid.store(true, std::memory_order_relaxed);
+        return res;
+    }
 
     void clear()
     {
         for (auto & bucket : buckets)
-            bucket.clear();
+        {
+            if (isShared(bucket->tree_version))
+            {
+                bucket = std::make_shared<InnerMap>();
+                bucket->tree_version = current_version.load(std::memory_order_relaxed);
+            }
+            else
+                bucket->clear();
+        }
+        for (auto & bucket_data_size : bucket_data_sizes)
+            bucket_data_size.store(0);
+        for (auto & filter : filters)
+            filter.reset(CountingBloomFilter::MIN_CAPACITY);
+        for (auto & keys : dirty_keys)
+            keys.clear();
+        dirty_keys_valid.store(false, std::memory_order_relaxed);
         node_count.store(0);
+        /// There is no reader while the tree is reset
+        for (auto & list : retired)
+            list.clear();
     }
 
     size_t size() const
     {
         return node_count.load();
     }
+
+    /// Bytes of paths, children names and data in the bucket
+    size_t getBucketDataSize(UInt32 bucket_id) const { return bucket_data_sizes[bucket_id].load(std::memory_order_relaxed); }
+
+    size_t getDataSize() const
+    {
+        size_t res = 0;
+        for (const auto & bucket_data_size : bucket_data_sizes)
+            res += bucket_data_size.load(std::memory_order_relaxed);
+        return res;
+    }
+
+    /// Memory used by hash tables and filters of all buckets, not including nodes.
+    size_t getBufferSizeInBytes() const
+    {
+        size_t res = 0;
+        for (const auto & bucket : buckets)
+            res += bucket->getBufferSizeInBytes();
+        for (const auto & filter : filters)
+            res += filter.getBufferSizeInBytes();
+        return res;
+    }
 };
 
 /// KeeperStore hold data tree, sessions, watches and auths. It is under state machine.
 class KeeperStore
 {
 public:
-    /// bucket num for KeeperNodeMap
-    static constexpr int DATA_TREE_BUCKET_NUM = 16;
-    using DataTree = KeeperNodeMap<KeeperNode, DATA_TREE_BUCKET_NUM>;
+    /// Default bucket num for KeeperNodeMap, the actual one is RaftSettings::data_tree_bucket_num.
+    static constexpr UInt32 DEFAULT_DATA_TREE_BUCKET_NUM = 16;
+    using DataTree = KeeperNodeMap<KeeperNode>;
+    using DataTreeVersionPtr = DataTree::VersionPtr;
 
-    using KeeperResponsesQueue = ThreadSafeQueue<ResponseForSession>;
+    using KeeperResponsesQueue = ResponsesQueue;
 
     using SessionAndAuth = std::unordered_map<int64_t, Coordination::AuthIDs>;
+    using SessionAndAuthMap = CopyOnWriteMap<int64_t, Coordination::AuthIDs>;
     using Ephemerals = std::unordered_map<int64_t, std::unordered_set<String>>;
 
     /// Hold Edges in different Buckets based on the parent node's bucket number.
     /// It should be used when load snapshot to built node's childrenSet in parallel without lock.
+    /// Both have getDataTreeBucketNum() elements.
     using Edge = std::pair<String, String>;
     using Edges = std::vector<Edge>;
-    using BucketEdges = std::array<Edges, DATA_TREE_BUCKET_NUM>;
-    using BucketNodes = std::array<std::vector<std::pair<String, std::shared_ptr<KeeperNode>>>, DATA_TREE_BUCKET_NUM>;
-
-    explicit KeeperStore(int64_t dead_session_check_period_ms, const String & super_digest_ = "");
+    using BucketEdges = std::vector<Edges>;
+    using BucketNodes = std::vector<std::vector<std::pair<String, KeeperNodePtr>>>;
+
+    explicit KeeperStore(
+        int64_t dead_session_check_period_ms,
+        const String & super_digest_ = "",
+        UInt32 data_tree_bucket_num = DEFAULT_DATA_TREE_BUCKET_NUM,
+        UInt64 response_cache_max_entries = 0,
+        bool negative_lookup_filter = false,
+        bool track_dirty_nodes = false);
+
+    /// Get requests already processed in a round of read requests, keyed by path. Data tree is not changed
+    /// during the round, so identical get requests share one lookup and one serialized response body.
+    struct CoalescedGet
+    {
+        /// Holds the path the key refers to
+        Coordination::ZooKeeperRequestPtr request;
+        Coordination::ZooKeeperResponsePtr response;
+        std::shared_ptr<const String> serialized_body;
+    };
+    using GetResponseCache = std::unordered_map<std::string_view, CoalescedGet>;
 
     /// process request
     void processRequest(
-        ThreadSafeQueue<ResponseForSession> & responses_queue,
+        KeeperResponsesQueue & responses_queue,
         const RequestForSession & request_for_session,
         std::optional<int64_t> new_last_zxid = {}, /// empty when we are converting zookeeper log to raftkeeper data.
         bool check_acl = true,
-        bool ignore_response = false);
+        bool ignore_response = false,
+        GetResponseCache * get_response_cache = nullptr);
 
-    /// Build children set after loading data from snapshot
-    void buildChildrenSet(bool from_zk_snapshot = false);
+    /// Apply committed write requests in order. Requests touching disjoint buckets of data tree are applied
+    /// in parallel on thread_pool, the others one by one. Zxids, responses and watch events are the same as
+    /// applying all of them with processRequest.
+    void processRequests(
+        KeeperResponsesQueue & responses_queue, const std::vector<RequestForSession> & requests, ThreadPool & thread_pool);
+
+    /// Spread sub requests of MultiRead requests with at least min_requests sub requests on a pool of threads
+    void enableParallelMultiRead(size_t threads, size_t min_requests);
+
+    /// Reads and AddWatch requests setting a watch more than the limit fail with ZTHROTTLEDOP, 0 means no limit
+    void setMaxWatchesPerSession(UInt64 max_watches) { watch_manager.setMaxWatchesPerSession(max_watches); }
+
+    /// Apply nodes changed and deleted since the snapshot loaded, they are from an incremental snapshot.
+    /// Children set and the ephemerals are maintained, nodes are moved out.
+    void applySnapshotDelta(std::vector<std::pair<String, KeeperNodePtr>> & nodes, const Strings & deleted_paths);
 
     // Build children set for the nodes in specified bucket after load data from snapshot.
-    void buildBucketChildren(const std::vector<BucketEdges> & all_objects_edges, UInt32 bucket_id);
+    /// count_children is for ZooKeeper snapshots, whose nodes have no numChildren.
+    void buildBucketChildren(const std::vector<BucketEdges> & all_objects_edges, UInt32 bucket_id, bool count_children = false);
     void fillDataTreeBucket(const std::vector<BucketNodes> & all_objects_nodes, UInt32 bucket_id);
 
     /// Clean ephemeral nodes, invoked when shutdown
@@ -222,8 +677,26 @@ public:
     /// Clear whole store and set to initial state.
     void reset();
 
-    /// Used when creating snapshot
-    std::shared_ptr<BucketNodes> dumpDataTree();
+    /// Used when creating snapshot asynchronously, writes are not blocked by the pinned version.
+    DataTreeVersionPtr pinDataTree() { return data_tree.pin(); }
+
+    /// Paths of nodes changed since the last call, see KeeperNodeMap::takeDirtyKeys. Invoke it after pinDataTree.
+    DataTree::DirtyKeysPtr takeDirtyNodes() { return data_tree.takeDirtyKeys(); }
+
+    /// Maintain the digest of data tree by every write from now on.
+    void enableDigest();
+    bool isDigestEnabled() const { return digest_enabled; }
+
+    /// Compute the digest of data tree from all nodes, invoked after data tree is loaded from a snapshot.
+    void recomputeDigest();
+
+    UInt64 getNodesDigest() const { return nodes_digest.load(std::memory_order_relaxed); }
+
+    /// Digest recorded by the CheckDigest request of checkpoint, empty if it is not known.
+    std::optional<UInt64> getDigestCheckpoint(int64_t checkpoint) const;
+
+    /// CheckDigest requests whose digest differs with the one of the leader
+    UInt64 getDigestMismatches() const { return digest_mismatches.load(std::memory_order_relaxed); }
 
     int64_t getZxid() const
     {
@@ -238,13 +711,21 @@ public:
     SessionAndAuth getSessionAndAuth() const
     {
         std::lock_guard lock(auth_mutex);
-        return session_and_auth;
+        return session_and_auth.toMap();
+    }
+
+    /// Version of auth of sessions for snapshot, later changes of auth do not change it
+    SessionAndAuthMap::VersionPtr pinSessionAndAuth() const
+    {
+        std::lock_guard lock(auth_mutex);
+        return session_and_auth.pin();
     }
 
     void addSessionAuth(int64_t session_id, const Coordination::AuthIDs & auth)
     {
         std::lock_guard lock(auth_mutex);
         session_and_auth[session_id] = std::move(auth);
+        acl_decision_cache.invalidate(session_id);
     }
 
     std::vector<int64_t> getDeadSessions() const
@@ -262,12 +743,19 @@ public:
         session_manager.handleRemoteSession(session_id, expiration_time);
     }
 
+    void addLocalSession(int64_t session_id) { session_manager.addLocalSession(session_id); }
+    void removeLocalSession(int64_t session_id) { session_manager.removeLocalSession(session_id); }
+    void setTrackOnlyLocalSessions(bool only_local) { session_manager.setTrackOnlyLocalSessions(only_local); }
+
+    /// Drop watches and auth of a read only session, it has no ephemeral nodes and is not known by Raft
+    void closeReadOnlySession(int64_t session_id);
+
     inline bool containsSession(int64_t session_id) const
     {
         return session_manager.contains(session_id);
     }
 
-    size_t getDataTreeBucketNum() const
+    UInt32 getDataTreeBucketNum() const
     {
         return data_tree.getBucketNum();
     }
@@ -277,6 +765,39 @@ public:
         return data_tree.get(path);
     }
 
+    /// Get node for a read request without holding a reference, see KeeperNodeMap::getForRead.
+    inline const KeeperNode * getNodeForRead(const String & path) const
+    {
+        return data_tree.getForRead(path);
+    }
+
+    inline const KeeperNode * getNodeForRead(const HashedPath & path) const
+    {
+        return data_tree.getForRead(path);
+    }
+
+    /// Nodes erased or replaced are retired and freed once readers in the readers_count slots have left the epochs
+    /// which may see them. Invoked when there is no request in progress.
+    void enableEpochReclamation(size_t readers_count)
+    {
+        auto manager = std::make_unique<EpochManager>(readers_count);
+        data_tree.setEpochManager(manager.get());
+        epoch_manager = std::move(manager);
+    }
+
+    /// nullptr if epoch reclamation is disabled
+    EpochManager * getEpochManager() const { return epoch_manager.get(); }
+
+    /// Free retired nodes which no reader may read, invoked by the writer after a batch of writes
+    size_t reclaimRetiredNodes() { return data_tree.reclaim(); }
+    size_t getRetiredNodesCount() const { return data_tree.getRetiredCount(); }
+
+    /// Get node which is going to be modified in place.
+    inline KeeperNodePtr getNodeForUpdate(const String & path)
+    {
+        return data_tree.getForUpdate(path);
+    }
+
     inline bool exists(const String & path)
     {
         return data_tree.count(path);
@@ -284,26 +805,144 @@ public:
 
     inline void addNode(const String & path, KeeperNodePtr node)
     {
+        if (digest_enabled)
+        {
+            if (const auto * old_node = data_tree.getForRead(path))
+                updateDigest(path, *old_node);
+            updateDigest(path, *node);
+        }
         data_tree.emplace(path, node);
     }
 
     inline void removeNode(const String & path)
     {
+        if (digest_enabled)
+        {
+            if (const auto * node = data_tree.getForRead(path))
+                updateDigest(path, *node);
+        }
+        data_tree.erase(path);
+    }
+
+    /// Same as above but with pre-hashed path.
+    inline KeeperNodePtr getNode(const HashedPath & path)
+    {
+        return data_tree.get(path);
+    }
+
+    inline KeeperNodePtr getNodeForUpdate(const HashedPath & path)
+    {
+        return data_tree.getForUpdate(path);
+    }
+
+    inline bool exists(const HashedPath & path)
+    {
+        return data_tree.mayContain(path) && data_tree.count(path);
+    }
+
+    /// False if the node does not exist for sure, answered without looking up data tree if negative lookup filter is enabled.
+    inline bool mayExist(const HashedPath & path) const
+    {
+        return data_tree.mayContain(path);
+    }
+
+    inline void addNode(const HashedPath & path, KeeperNodePtr node)
+    {
+        if (digest_enabled)
+        {
+            if (const auto * old_node = data_tree.getForRead(path))
+                updateDigest(path.path, *old_node);
+            updateDigest(path.path, *node);
+        }
+        data_tree.emplace(path, node);
+    }
+
+    inline void removeNode(const HashedPath & path)
+    {
+        if (digest_enabled)
+        {
+            if (const auto * node = data_tree.getForRead(path))
+                updateDigest(path.path, *node);
+        }
         data_tree.erase(path);
     }
 
+    /// Digest of a node, it covers what the request changing the node itself changes, but not the stat which changes by
+    /// its children, so the digest of a parent is not updated by creating and removing children.
+    static UInt64 nodeDigest(std::string_view path, const KeeperNode & node)
+    {
+        UInt64 res = hashPair(StringHash{}(path), StringHash{}(node.data.view()));
+        for (auto value : {node.stat.czxid, node.stat.mzxid, node.stat.ctime, node.stat.mtime, node.stat.ephemeralOwner})
+            res = hashPair(res, static_cast<UInt64>(value));
+        res = hashPair(res, static_cast<UInt64>(node.stat.version));
+        res = hashPair(res, static_cast<UInt64>(node.stat.aversion));
+        return hashPair(res, node.acl_id);
+    }
+
+    /// Toggle a node in the digest of data tree, it is XOR of the digests of nodes, so it does not depend on the order of
+    /// changes and requests applied in parallel may update it. Invoked before and after a node is modified in place.
+    inline void updateDigest(std::string_view path, const KeeperNode & node)
+    {
+        if (digest_enabled)
+            nodes_digest.fetch_xor(nodeDigest(path, node), std::memory_order_relaxed);
+    }
+
+    /// Should be invoked when data of a node is updated in place.
+    inline void onNodeDataChanged(const HashedPath & path, size_t old_size, size_t new_size)
+    {
+        data_tree.onDataSizeChanged(path, old_size, new_size);
+    }
+
     inline void addEphemeralNode(int64_t session_id, const String & path)
     {
-        std::lock_guard lock(ephemerals_mutex);
-        ephemerals[session_id].insert(path);
+        auto & shard = getEphemeralsShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        auto [it, new_session] = shard.ephemerals.try_emplace(session_id);
+        if (new_session)
+            ++sessions_with_ephemeral_nodes;
+        if (it->second.insert(path).second)
+            ++total_ephemeral_nodes;
     }
 
     inline void removeEphemeralNode(int64_t session_id, const String & path)
     {
-        std::lock_guard lock(ephemerals_mutex);
-        ephemerals[session_id].erase(path);
+        auto & shard = getEphemeralsShard(session_id);
+        std::lock_guard lock(shard.mutex);
+        auto it = shard.ephemerals.find(session_id);
+        if (it == shard.ephemerals.end())
+            return;
+
+        total_ephemeral_nodes -= it->second.erase(path);
+        if (it->second.empty())
+        {
+            shard.ephemerals.erase(it);
+            --sessions_with_ephemeral_nodes;
+        }
+    }
+
+    /// Keep node_expiry_index when a TTL or container node is created, changed, loaded or loses a child
+    inline void indexExpiringNode(std::string_view path, const KeeperNode & node)
+    {
+        const auto owner = node.stat.ephemeralOwner;
+        if (!node.children.empty())
+            return;
+        if (isTTLOwner(owner))
+            node_expiry_index.addTTLNode(String(path), node.stat.mtime + ttlOfOwner(owner));
+        /// A container is not removed before it has a child
+        else if (isContainerOwner(owner) && node.stat.cversion > 0)
+            node_expiry_index.addEmptyContainer(String(path));
     }
 
+    /// Keep node_expiry_index when a TTL or container node is removed or gets a child
+    inline void unindexExpiringNode(std::string_view path, const KeeperNode & node)
+    {
+        const auto owner = node.stat.ephemeralOwner;
+        if (isTTLOwner(owner) || isContainerOwner(owner))
+            node_expiry_index.remove(String(path));
+    }
+
+    NodeExpiryIndex & getNodeExpiryIndex() { return node_expiry_index; }
+
     const String & getSuperDigest() const
     {
         return super_digest;
@@ -315,20 +954,34 @@ public:
     uint64_t getNodesCount() const { return data_tree.size(); }
     uint64_t getApproximateDataSize() const;
 
-    uint64_t getSessionWithEphemeralNodesCount() const
+    /// Fill data_tree, watches, sessions and acl_map of usage. Ephemeral nodes and auth of sessions are walked.
+    void getMemoryUsage(KeeperMemoryUsage & usage) const;
+
+    /// Drop cached responses and ACL decisions, called when memory reaches its soft limit
+    void shrinkCaches()
     {
-        std::lock_guard lock(ephemerals_mutex);
-        return ephemerals.size();
+        response_cache.clear();
+        acl_decision_cache.reset();
     }
 
-    uint64_t getTotalEphemeralNodesCount() const;
-    void dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) const;
+    uint64_t getSessionWithEphemeralNodesCount() const { return sessions_with_ephemeral_nodes.load(); }
+
+    uint64_t getTotalEphemeralNodesCount() const { return total_ephemeral_nodes.load(); }
+
+    /// Bytes of paths, children names and data of a bucket of data tree
+    uint64_t getBucketDataSize(UInt32 bucket_id) const { return data_tree.getBucketDataSize(bucket_id); }
+    void dumpSessionsAndEphemerals(const DumpOutput & output) const;
 
     SessionManager::SessionAndTimeout getSessionAndTimeOut() const
     {
         return session_manager.getSessionAndTimeOut();
     }
 
+    SessionManager::SessionAndTimeoutMap::VersionPtr pinSessionAndTimeout() const
+    {
+        return session_manager.pinSessionAndTimeout();
+    }
+
     uint64_t getSessionID(uint64_t session_timeout_ms)
     {
         return session_manager.getSessionID(session_timeout_ms);
@@ -339,6 +992,12 @@ public:
         return session_manager.updateSessionTimeout(session_id, session_timeout_ms);
     }
 
+    /// Refresh expiration time of session as a request of it does, returns false if it is expired
+    bool updateSessionExpirationTime(int64_t session_id)
+    {
+        return session_manager.updateSessionExpirationTime(session_id);
+    }
+
     void addSessionID(int64_t session_id, int64_t session_timeout_ms)
     {
         session_manager.addSessionID(session_id, session_timeout_ms);
@@ -379,10 +1038,16 @@ public:
         acl_map.addMapping(acls_id, acls);
     }
 
-    const Ephemerals & getEphemerals() const
+    /// Copy of ephemeral paths of all sessions
+    Ephemerals getEphemerals() const
     {
-        std::lock_guard lock(ephemerals_mutex);
-        return ephemerals;
+        Ephemerals result;
+        for (const auto & shard : ephemerals_shards)
+        {
+            std::lock_guard lock(shard.mutex);
+            result.insert(shard.ephemerals.begin(), shard.ephemerals.end());
+        }
+        return result;
     }
 
     /// watch related functions
@@ -402,42 +1067,123 @@ public:
         return watch_manager.getSessionsWithWatchesCount();
     }
 
-    void dumpWatches(WriteBufferFromOwnString & buf) const
+    void dumpWatches(const DumpOutput & output) const
     {
-        watch_manager.dumpWatches(buf);
+        watch_manager.dumpWatches(output);
     }
 
-    void dumpWatchesByPath(WriteBufferFromOwnString & buf) const
+    void dumpWatchesByPath(const DumpOutput & output) const
     {
-        watch_manager.dumpWatchesByPath(buf);
+        watch_manager.dumpWatchesByPath(output);
     }
 
     void initializeSystemNodes();
 
-    mutable std::shared_mutex auth_mutex;
-    SessionAndAuth session_and_auth;
+    mutable ProfiledSharedMutex auth_mutex{"auth_mutex"};
+    SessionAndAuthMap session_and_auth;
 
     /// ACLMap for more compact ACLs storage inside nodes.
     ACLMap acl_map;
 
+    /// Decisions of hasPermission, changed together with session_and_auth under auth_mutex
+    ACLDecisionCache acl_decision_cache;
+
+    /// TTL and container nodes which may expire, collected by leader
+    NodeExpiryIndex node_expiry_index;
+
+    /// Not empty if enableParallelMultiRead is called
+    std::unique_ptr<ThreadPool> multi_read_thread_pool;
+    size_t multi_read_threads = 0;
+    size_t multi_read_parallel_min_requests = 0;
+
+    /// Whether auth of session grants permission by ACL of acl_id, one lookup when it was checked before
+    bool hasPermission(int64_t session_id, uint64_t acl_id, int32_t permission);
+
 private:
     int64_t fetchAndGetZxid() { return zxid++; }
-    void cleanEphemeralNodes(int64_t session_id, ThreadSafeQueue<ResponseForSession> & responses_queue, bool ignore_response);
+    void cleanEphemeralNodes(const std::vector<int64_t> & session_ids, KeeperResponsesQueue & responses_queue, bool ignore_response);
+
+    /// Remove the nodes which are expired at time, the others are kept, see NodeExpiryIndex.
+    void removeExpiredNodes(
+        const Strings & paths, int64_t time, int64_t request_zxid, KeeperResponsesQueue & responses_queue, bool ignore_response);
+
+    /// Remove ephemeral nodes, watches and auth of sessions and expire them, every session gets a close response.
+    void closeSessions(
+        const std::vector<int64_t> & session_ids,
+        Coordination::XID xid,
+        int64_t response_zxid,
+        KeeperResponsesQueue & responses_queue,
+        bool ignore_response);
+
+    /// Process a request which touches only data tree, request_zxid is the zxid it sees and responds.
+    template <typename Queue>
+    void processDataRequest(
+        Queue & responses_queue,
+        const RequestForSession & request_for_session,
+        int64_t request_zxid,
+        bool check_acl,
+        bool ignore_response,
+        GetResponseCache * get_response_cache = nullptr);
+
+    /// Process a get request, reusing the result of an identical get request of the round if there is one.
+    Coordination::ZooKeeperResponsePtr processCoalescedGet(
+        GetResponseCache & get_response_cache, const RequestForSession & request_for_session, int64_t request_zxid);
+
+    /// Process a read request, get and list responses of popular znodes are served from response_cache.
+    Coordination::ZooKeeperResponsePtr processReadRequest(const RequestForSession & request_for_session, int64_t request_zxid);
+
+    /// Push buckets of data tree which the request may touch, getDataTreeBucketNum() stands for ACL map.
+    /// Returns false if the request touches other state or they are not known in advance.
+    bool getTouchedBuckets(const Coordination::ZooKeeperRequest & zk_request, std::vector<UInt32> & buckets);
+
+    /// Record the digest of the checkpoint of request and compare the checked one with the digest of the leader.
+    void checkDigest(const Coordination::ZooKeeperCheckDigestRequest & request);
 
     /// data tree
+    /// Declared before data tree, which retires nodes to it
+    std::unique_ptr<EpochManager> epoch_manager;
     DataTree data_tree;
 
     SessionManager session_manager;
     WatchManager watch_manager;
 
-    /// all ephemeral nodes goes here
-    Ephemerals ephemerals;
-    mutable std::mutex ephemerals_mutex;
+    /// serialized responses of popular znodes, disabled by default
+    ResponseCache response_cache;
+
+    /// All ephemeral nodes goes here. They are sharded by session, so that ephemeral nodes of
+    /// sessions in different shards are created and removed without contention.
+    static constexpr size_t EPHEMERALS_SHARDS = 16;
+    struct EphemeralsShard
+    {
+        Ephemerals ephemerals;
+        mutable ProfiledMutex mutex{"ephemerals_mutex"};
+    };
+    std::array<EphemeralsShard, EPHEMERALS_SHARDS> ephemerals_shards;
+
+    EphemeralsShard & getEphemeralsShard(int64_t session_id)
+    {
+        return ephemerals_shards[static_cast<UInt64>(session_id) % EPHEMERALS_SHARDS];
+    }
+
+    /// Count of paths in ephemerals
+    std::atomic<uint64_t> total_ephemeral_nodes{0};
+    /// Count of sessions in ephemerals, a session is removed when its last ephemeral node is removed
+    std::atomic<uint64_t> sessions_with_ephemeral_nodes{0};
 
     /// Global transaction id, only write request will consume zxid.
     /// It should be same across all nodes.
     std::atomic<int64_t> zxid{0};
 
+    /// XOR of nodeDigest of all nodes, maintained if digest_enabled
+    bool digest_enabled = false;
+    std::atomic<UInt64> nodes_digest{0};
+
+    /// Digests recorded by the last CheckDigest requests, by checkpoint
+    static constexpr size_t MAX_DIGEST_CHECKPOINTS = 16;
+    std::map<int64_t, UInt64> digest_checkpoints;
+    mutable std::mutex digest_checkpoints_mutex;
+    std::atomic<UInt64> digest_mismatches{0};
+
     /// finalized flag
     bool finalized{false};
 
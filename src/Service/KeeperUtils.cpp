@@ -36,7 +36,7 @@ String checkAndGetSuperdigest(const String & user_and_digest)
 
 nuraft::ptr<nuraft::buffer> getZooKeeperLogEntry(int64_t session_id, int64_t time, const Coordination::ZooKeeperRequestPtr & request)
 {
-    RK::WriteBufferFromNuraftBuffer buf;
+    RK::WriteBufferFromNuraftBuffer buf(sizeof(session_id) + request->bytesSize() + sizeof(time));
     RK::writeIntBinary(session_id, buf);
     request->write(buf);
     Coordination::write(time, buf);
@@ -50,21 +50,6 @@ ptr<log_entry> makeClone(const ptr<log_entry> & entry)
     return clone;
 }
 
-String getBaseName(const String & path)
-{
-    size_t basename_start = path.rfind('/');
-    return String{&path[basename_start + 1], path.length() - basename_start - 1};
-}
-
-
-String getParentPath(const String & path)
-{
-    auto rslash_pos = path.rfind('/');
-    if (rslash_pos > 0)
-        return path.substr(0, rslash_pos);
-    return "/";
-}
-
 String base64Encode(const String & decoded)
 {
     std::ostringstream ostr; // STYLE_CHECK_ALLOW_STD_STRING_STREAM
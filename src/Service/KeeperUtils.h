@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstring>
 #include <fstream>
+#include <string_view>
 #include <time.h>
 #include <Service/Crc32.h>
 #include <ZooKeeper/IKeeper.h>
@@ -16,10 +18,39 @@ namespace RK
 nuraft::ptr<nuraft::buffer> getZooKeeperLogEntry(int64_t session_id, int64_t time, const Coordination::ZooKeeperRequestPtr & request);
 nuraft::ptr<nuraft::log_entry> makeClone(const nuraft::ptr<nuraft::log_entry> & entry);
 
+/// Position of the last '/' of path, memrchr of libc scans it backwards by vector instructions rather than by bytes.
+inline size_t lastSlashOf(std::string_view path)
+{
+    const void * slash = path.empty() ? nullptr : memrchr(path.data(), '/', path.size());
+    return slash ? static_cast<size_t>(static_cast<const char *>(slash) - path.data()) : std::string_view::npos;
+}
+
+/// Parent of a path as a part of it, for example: got '/a/b' from '/a/b/c', and '/' from '/a'
+inline std::string_view parentPathOf(std::string_view path)
+{
+    size_t slash = lastSlashOf(path);
+    if (slash > 0)
+        return path.substr(0, slash);
+    return "/";
+}
+
+/// Base name of a path as a part of it, for example: got 'c' from '/a/b/c', empty for '/' and '/a/'
+inline std::string_view baseNameOf(std::string_view path)
+{
+    return path.substr(lastSlashOf(path) + 1);
+}
+
 /// Parent of a path, for example: got '/a/b' from '/a/b/c'
-String getParentPath(const String & path);
+inline String getParentPath(const String & path)
+{
+    return String(parentPathOf(path));
+}
+
 /// Base name of a path, for example: got 'c' from '/a/b/c'
-String getBaseName(const String & path);
+inline String getBaseName(const String & path)
+{
+    return String(baseNameOf(path));
+}
 
 String base64Encode(const String & decoded);
 String getSHA1(const String & userdata);
@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include <Poco/File.h>
 
 #include <Common/IO/ReadBufferFromFileDescriptor.h>
@@ -23,7 +25,8 @@ inline UInt64 getCurrentTimeMicroseconds()
     return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
 }
 
-LastCommittedIndexManager::LastCommittedIndexManager(const String & log_dir) : log(&Poco::Logger::get("LastCommittedIndexManager"))
+LastCommittedIndexManager::LastCommittedIndexManager(const String & log_dir, bool with_log_fsync_)
+    : with_log_fsync(with_log_fsync_), log(&Poco::Logger::get("LastCommittedIndexManager"))
 {
     if (!Poco::File(log_dir).exists())
         Poco::File(log_dir).createDirectories();
@@ -35,7 +38,10 @@ LastCommittedIndexManager::LastCommittedIndexManager(const String & log_dir) : l
         throwFromErrno("Failed to open committed log index file", ErrorCodes::CANNOT_OPEN_FILE);
 
     previous_persist_time = getCurrentTimeMicroseconds();
-    persist_thread = ThreadFromGlobalPool([this] { persistThread(); });
+    if (with_log_fsync)
+        LOG_INFO(log, "Persist last committed index after log fsync");
+    else
+        persist_thread = ThreadFromGlobalPool([this] { persistThread(); });
 }
 
 LastCommittedIndexManager::~LastCommittedIndexManager()
@@ -101,14 +107,33 @@ void LastCommittedIndexManager::persistThread()
         if (previous_persist_index == current_index)
             continue;
 
-        WriteBufferFromFileDescriptor out(persist_file_fd);
-        out.seek(0, SEEK_SET);
+        std::lock_guard lock(mutex);
+        write(current_index);
+    }
+}
 
-        writeIntBinary(current_index, out);
-        out.next();
+void LastCommittedIndexManager::persist(UInt64 durable_index_)
+{
+    std::lock_guard lock(mutex);
+    if (is_shut_down)
+        return;
+
+    /// A follower may learn commits of entries it has not flushed yet
+    durable_index = std::max(durable_index, durable_index_);
+    uint64_t current_index = std::min(last_committed_index.load(), durable_index);
+    if (previous_persist_index != current_index)
+        write(current_index);
+}
 
-        previous_persist_index = current_index;
-    }
+void LastCommittedIndexManager::write(UInt64 index)
+{
+    WriteBufferFromFileDescriptor out(persist_file_fd);
+    out.seek(0, SEEK_SET);
+
+    writeIntBinary(index, out);
+    out.next();
+
+    previous_persist_index = index;
 }
 
 void LastCommittedIndexManager::shutDown()
@@ -116,8 +141,17 @@ void LastCommittedIndexManager::shutDown()
     LOG_INFO(log, "Shutting down last committed index persist thread");
     if (!is_shut_down)
     {
+        std::unique_lock lock(mutex);
         is_shut_down = true;
-        persist_thread.join();
+
+        /// Commits after the last log fsync are persisted here
+        uint64_t current_index = std::min(last_committed_index.load(), durable_index);
+        if (with_log_fsync && previous_persist_index != current_index)
+            write(current_index);
+        lock.unlock();
+
+        if (persist_thread.joinable())
+            persist_thread.join();
 
         ::close(persist_file_fd);
     }
@@ -16,11 +16,13 @@ namespace RK
  * Note:
  *  1. LastCommittedIndexManager will not persist every index, it will batch persistThread.
  *  2. LastCommittedIndexManager work asynchronously, it will not block log committing.
+ *  3. If with_log_fsync, there is no thread, the index is persisted by persist after each
+ *     Raft log fsync, so the disk gets no writes between log flushes.
  */
 class LastCommittedIndexManager
 {
 public:
-    explicit LastCommittedIndexManager(const String & log_dir);
+    explicit LastCommittedIndexManager(const String & log_dir, bool with_log_fsync_ = false);
     ~LastCommittedIndexManager();
 
     /// Push last_committed_index into queue
@@ -31,10 +33,16 @@ public:
 
     void persistThread();
 
+    /// Persist last committed index, at most durable_index, invoked after log fsync if with_log_fsync.
+    void persist(UInt64 durable_index);
+
     /// Shutdown background thread
     void shutDown();
 
 private:
+    /// Write index to the file, caller should hold mutex
+    void write(UInt64 index);
+
     UInt64 static constexpr PERSIST_INTERVAL_US = 100 * 1000;
     std::string_view static constexpr FILE_NAME = "last_committed_index.bin";
 
@@ -48,6 +56,10 @@ private:
     uint64_t previous_persist_index = 0;
     uint64_t previous_persist_time;
 
+    bool with_log_fsync;
+    /// Last log index flushed, the index persisted by persist does not exceed it
+    uint64_t durable_index = 0;
+
     std::mutex mutex;
     std::condition_variable cv;
 
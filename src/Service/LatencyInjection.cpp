@@ -0,0 +1,160 @@
+#include <Service/LatencyInjection.h>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+
+#include <Common/Exception.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int INVALID_CONFIG_PARAMETER;
+}
+
+LatencyInjection & LatencyInjection::instance()
+{
+    static LatencyInjection injection;
+    return injection;
+}
+
+void LatencyInjection::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    auto * log = &Poco::Logger::get("LatencyInjection");
+    UInt64 seed = config.getUInt64("keeper.latency_injection.seed", 0);
+    Poco::Util::AbstractConfiguration::Keys keys;
+    config.keys("keeper.latency_injection", keys);
+
+    for (size_t i = 0; i < states.size(); ++i)
+    {
+        auto point = static_cast<InjectionPoint>(i);
+        String prefix = "keeper.latency_injection." + toString(point);
+        if (std::find(keys.begin(), keys.end(), toString(point)) == keys.end())
+        {
+            disable(point);
+            continue;
+        }
+
+        PointSettings settings;
+        String distribution = config.getString(prefix + ".distribution", "constant");
+        if (distribution == "constant")
+            settings.distribution = Distribution::CONSTANT;
+        else if (distribution == "uniform")
+            settings.distribution = Distribution::UNIFORM;
+        else if (distribution == "exponential")
+            settings.distribution = Distribution::EXPONENTIAL;
+        else if (distribution == "pareto")
+            settings.distribution = Distribution::PARETO;
+        else
+            throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Unknown latency distribution '{}' of {}", distribution, prefix);
+
+        settings.latency_us = config.getUInt64(prefix + ".latency_us", 0);
+        settings.max_latency_us = config.getUInt64(prefix + ".max_latency_us", 0);
+        settings.shape = config.getDouble(prefix + ".shape", 2);
+        settings.probability = config.getDouble(prefix + ".probability", 1);
+        settings.error_probability = config.getDouble(prefix + ".error_probability", 0);
+
+        if (settings.distribution == Distribution::UNIFORM && settings.max_latency_us < settings.latency_us)
+            throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "max_latency_us of {} should not be less than latency_us", prefix);
+        if (settings.shape <= 0)
+            throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "shape of {} should be greater than 0", prefix);
+
+        configure(point, settings, seed + i);
+        LOG_WARNING(
+            log,
+            "Inject {} latency of {}us into {} with probability {}, error probability {}",
+            distribution,
+            settings.latency_us,
+            toString(point),
+            settings.probability,
+            settings.error_probability);
+    }
+}
+
+void LatencyInjection::configure(InjectionPoint point, const PointSettings & settings, UInt64 seed)
+{
+    auto & point_state = state(point);
+    std::lock_guard lock(point_state.mutex);
+    point_state.settings = settings;
+    point_state.rng.seed(seed);
+    point_state.enabled.store(true, std::memory_order_relaxed);
+}
+
+void LatencyInjection::disable(InjectionPoint point)
+{
+    state(point).enabled.store(false, std::memory_order_relaxed);
+}
+
+UInt64 LatencyInjection::drawLatencyUs(InjectionPoint point)
+{
+    auto & point_state = state(point);
+    std::lock_guard lock(point_state.mutex);
+    const auto & settings = point_state.settings;
+    auto & rng = point_state.rng;
+
+    if (settings.probability < 1 && std::uniform_real_distribution<double>(0, 1)(rng) >= settings.probability)
+        return 0;
+
+    double latency = 0;
+    switch (settings.distribution)
+    {
+        case Distribution::CONSTANT:
+            return settings.latency_us;
+        case Distribution::UNIFORM:
+            return std::uniform_int_distribution<UInt64>(settings.latency_us, settings.max_latency_us)(rng);
+        case Distribution::EXPONENTIAL:
+            if (settings.latency_us)
+                latency = std::exponential_distribution<double>(1.0 / settings.latency_us)(rng);
+            break;
+        case Distribution::PARETO:
+            /// Inverse transform of 1 - (scale / x) ^ shape
+            latency = settings.latency_us / std::pow(1 - std::uniform_real_distribution<double>(0, 1)(rng), 1 / settings.shape);
+            break;
+    }
+
+    if (settings.max_latency_us)
+        latency = std::min(latency, static_cast<double>(settings.max_latency_us));
+    return static_cast<UInt64>(latency);
+}
+
+void LatencyInjection::delayImpl(InjectionPoint point)
+{
+    if (UInt64 latency_us = drawLatencyUs(point))
+        std::this_thread::sleep_for(std::chrono::microseconds(latency_us));
+}
+
+bool LatencyInjection::shouldFailImpl(InjectionPoint point)
+{
+    auto & point_state = state(point);
+    std::lock_guard lock(point_state.mutex);
+    double error_probability = point_state.settings.error_probability;
+    return error_probability > 0 && std::uniform_real_distribution<double>(0, 1)(point_state.rng) < error_probability;
+}
+
+String LatencyInjection::toString(InjectionPoint point)
+{
+    switch (point)
+    {
+        case InjectionPoint::LOG_WRITE:
+            return "log_write";
+        case InjectionPoint::LOG_FSYNC:
+            return "log_fsync";
+        case InjectionPoint::SNAPSHOT_WRITE:
+            return "snapshot_write";
+        case InjectionPoint::SNAPSHOT_READ:
+            return "snapshot_read";
+        case InjectionPoint::FORWARD_SEND:
+            return "forward_send";
+        case InjectionPoint::FORWARD_RECEIVE:
+            return "forward_receive";
+        case InjectionPoint::COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+}
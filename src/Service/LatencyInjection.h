@@ -0,0 +1,120 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <mutex>
+
+#include <pcg_random.hpp>
+#include <Poco/Util/AbstractConfiguration.h>
+#include <common/defines.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Places where latency can be injected
+enum class InjectionPoint : uint8_t
+{
+    /// Write of Raft log entries to a segment
+    LOG_WRITE,
+    /// fdatasync of a segment, or waiting for the one of io_uring
+    LOG_FSYNC,
+    /// Finishing a snapshot object
+    SNAPSHOT_WRITE,
+    /// Opening a snapshot object for loading
+    SNAPSHOT_READ,
+    /// Sending a request to leader by ForwardConnection
+    FORWARD_SEND,
+    /// Receiving a response from leader by ForwardConnection
+    FORWARD_RECEIVE,
+    COUNT
+};
+
+/** Test only injection of latency and errors into storage and forwarding, so that slow fsyncs, slow disks and slow or
+  * lossy links are reproduced on normal hardware. A point is configured by keeper.latency_injection.<point name>, for
+  * example:
+  *
+  *     <log_fsync>
+  *         <distribution>pareto</distribution>
+  *         <latency_us>500</latency_us>
+  *         <max_latency_us>200000</max_latency_us>
+  *         <probability>0.1</probability>
+  *     </log_fsync>
+  *
+  * distribution is constant, uniform in [latency_us, max_latency_us], exponential with mean latency_us, or pareto with
+  * scale latency_us and shape, which is 2 by default. Latency of the last two is capped by max_latency_us if it is not
+  * 0. Only probability of the operations are delayed, and error_probability of them fail, which is supported by
+  * forwarding points, the connection is broken then. Latencies of a point are drawn from a generator seeded by
+  * keeper.latency_injection.seed, so a run is reproduced by the same seed and order of operations.
+  *
+  * Points not configured cost a relaxed load.
+  */
+class LatencyInjection
+{
+public:
+    enum class Distribution : uint8_t
+    {
+        CONSTANT,
+        UNIFORM,
+        EXPONENTIAL,
+        PARETO,
+    };
+
+    struct PointSettings
+    {
+        Distribution distribution = Distribution::CONSTANT;
+        UInt64 latency_us = 0;
+        UInt64 max_latency_us = 0;
+        double shape = 2;
+        double probability = 1;
+        double error_probability = 0;
+    };
+
+    static LatencyInjection & instance();
+
+    /// Throws if a point is malformed
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+
+    /// Inject into point from now on, seed is of its generator
+    void configure(InjectionPoint point, const PointSettings & settings, UInt64 seed = 0);
+    void disable(InjectionPoint point);
+
+    bool enabled(InjectionPoint point) const { return state(point).enabled.load(std::memory_order_relaxed); }
+
+    /// Sleep for a latency drawn for the point if it is delayed
+    void delay(InjectionPoint point)
+    {
+        if (unlikely(enabled(point)))
+            delayImpl(point);
+    }
+
+    /// Whether the operation at point should fail
+    bool shouldFail(InjectionPoint point)
+    {
+        return unlikely(enabled(point)) && shouldFailImpl(point);
+    }
+
+    /// Latency drawn for the point, 0 if the operation is not delayed
+    UInt64 drawLatencyUs(InjectionPoint point);
+
+    static String toString(InjectionPoint point);
+
+private:
+    struct State
+    {
+        std::atomic<bool> enabled{false};
+        std::mutex mutex;
+        PointSettings settings;
+        pcg64 rng;
+    };
+
+    State & state(InjectionPoint point) { return states[static_cast<size_t>(point)]; }
+    const State & state(InjectionPoint point) const { return states[static_cast<size_t>(point)]; }
+
+    void delayImpl(InjectionPoint point);
+    bool shouldFailImpl(InjectionPoint point);
+
+    std::array<State, static_cast<size_t>(InjectionPoint::COUNT)> states;
+};
+
+}
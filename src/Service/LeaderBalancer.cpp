@@ -0,0 +1,112 @@
+#include <Service/LeaderBalancer.h>
+
+#include <algorithm>
+#include <sys/resource.h>
+
+#include <Common/Stopwatch.h>
+#include <Service/Metrics.h>
+
+namespace RK
+{
+
+NodeLoad NodeLoadMeter::sample(UInt64 connections)
+{
+    NodeLoad load;
+    load.connections = connections;
+
+    auto fsync = dynamic_cast<const BasicSummary &>(*Metrics::getMetrics().log_fsync_time_us).getValues();
+    if (fsync.count > last_fsync_count)
+        load.fsync_us = (fsync.sum - last_fsync_sum) / (fsync.count - last_fsync_count);
+    last_fsync_count = fsync.count;
+    last_fsync_sum = fsync.sum;
+
+    ::rusage usage{};
+    ::getrusage(RUSAGE_SELF, &usage);
+    UInt64 cpu_us = static_cast<UInt64>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000
+        + static_cast<UInt64>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+    UInt64 wall_us = clock_gettime_ns() / 1000;
+    if (last_wall_us && wall_us > last_wall_us)
+        load.cpu_permille = (cpu_us - last_cpu_us) * 1000 / (wall_us - last_wall_us);
+    last_cpu_us = cpu_us;
+    last_wall_us = wall_us;
+
+    return load;
+}
+
+LeaderBalancer::LeaderBalancer(UInt64 margin_percent_, UInt64 max_report_age_ms_, size_t rounds_)
+    : margin(static_cast<double>(margin_percent_) / 100), max_report_age_ms(max_report_age_ms_), rounds(std::max(rounds_, size_t(1)))
+{
+}
+
+void LeaderBalancer::report(int32_t server_id, const NodeLoad & load, UInt64 now_ms)
+{
+    std::lock_guard lock(mutex);
+    reports[server_id] = {load, now_ms};
+}
+
+std::optional<int32_t> LeaderBalancer::pickSuccessor(const NodeLoad & my_load, const std::vector<int32_t> & candidates, UInt64 now_ms)
+{
+    std::lock_guard lock(mutex);
+
+    std::vector<std::pair<int32_t, NodeLoad>> loads;
+    NodeLoad max_load = my_load;
+    for (int32_t candidate : candidates)
+    {
+        auto it = reports.find(candidate);
+        if (it == reports.end() || it->second.time_ms + max_report_age_ms < now_ms)
+            continue;
+        const auto & load = it->second.load;
+        loads.emplace_back(candidate, load);
+        max_load.fsync_us = std::max(max_load.fsync_us, load.fsync_us);
+        max_load.cpu_permille = std::max(max_load.cpu_permille, load.cpu_permille);
+        max_load.connections = std::max(max_load.connections, load.connections);
+    }
+
+    auto score = [&](const NodeLoad & load)
+    {
+        auto part = [](UInt64 value, UInt64 max) { return max ? static_cast<double>(value) / static_cast<double>(max) : 0; };
+        return part(load.fsync_us, max_load.fsync_us) + part(load.cpu_permille, max_load.cpu_permille)
+            + part(load.connections, max_load.connections);
+    };
+
+    int32_t best = -1;
+    double best_score = score(my_load) - margin;
+    for (const auto & [candidate, load] : loads)
+    {
+        double candidate_score = score(load);
+        if (candidate_score <= best_score)
+        {
+            best = candidate;
+            best_score = candidate_score;
+        }
+    }
+
+    if (best == -1 || best != best_candidate)
+    {
+        best_candidate = best;
+        best_rounds = best == -1 ? 0 : 1;
+    }
+    else
+    {
+        ++best_rounds;
+    }
+
+    if (best_rounds < rounds)
+        return {};
+
+    /// Start over, the new leader balances by its own reports
+    reports.clear();
+    best_candidate = -1;
+    best_rounds = 0;
+    return best;
+}
+
+void LeaderBalancer::reset()
+{
+    std::lock_guard lock(mutex);
+    reports.clear();
+    best_candidate = -1;
+    best_rounds = 0;
+}
+
+}
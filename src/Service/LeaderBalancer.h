@@ -0,0 +1,82 @@
+#pragma once
+
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/// Load of a node over the last balance interval, the lower the better the node is for a leader.
+struct NodeLoad
+{
+    /// Average time of a log fsync
+    UInt64 fsync_us = 0;
+    /// CPU time of the process per wall time, 1000 is one core busy
+    UInt64 cpu_permille = 0;
+    /// Client connections
+    UInt64 connections = 0;
+};
+
+/// Measures the load of this node since the previous sample.
+class NodeLoadMeter
+{
+public:
+    NodeLoad sample(UInt64 connections);
+
+private:
+    UInt64 last_fsync_count = 0;
+    UInt64 last_fsync_sum = 0;
+    UInt64 last_cpu_us = 0;
+    UInt64 last_wall_us = 0;
+};
+
+/**
+ * Automatic leader placement by load. Every node measures its load once per balance interval, followers report theirs
+ * to the leader by forward connections, and the leader yields leadership to the least loaded voting member if its score
+ * is lower than the one of the leader by margin for several intervals in a row, so that a short spike does not move
+ * leadership back and forth.
+ *
+ * Score of a node is the sum of its fsync time, CPU usage and connections, each divided by the largest one among the
+ * leader and the candidates, so it is in [0, 3] and the metrics weigh the same whatever their units.
+ */
+class LeaderBalancer
+{
+public:
+    static constexpr size_t DEFAULT_ROUNDS = 3;
+
+    LeaderBalancer(UInt64 margin_percent_, UInt64 max_report_age_ms_, size_t rounds_ = DEFAULT_ROUNDS);
+
+    /// Load reported by a follower
+    void report(int32_t server_id, const NodeLoad & load, UInt64 now_ms);
+
+    /// Invoked by the leader once per interval, return the node to yield leadership to if any. Candidates are the
+    /// voting members other than the leader, ones without a recent report are not considered.
+    std::optional<int32_t> pickSuccessor(const NodeLoad & my_load, const std::vector<int32_t> & candidates, UInt64 now_ms);
+
+    /// Forget reports and rounds, invoked when the node is not leader
+    void reset();
+
+private:
+    struct Report
+    {
+        NodeLoad load;
+        UInt64 time_ms;
+    };
+
+    const double margin;
+    const UInt64 max_report_age_ms;
+    const size_t rounds;
+
+    std::mutex mutex;
+    std::unordered_map<int32_t, Report> reports;
+
+    /// Candidate better than the leader by margin in the last best_rounds calls
+    int32_t best_candidate = -1;
+    size_t best_rounds = 0;
+};
+
+}
@@ -1,30 +1,91 @@
+#include <cstring>
+#include <sstream>
+#include <Poco/DeflatingStream.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/MemoryStream.h>
 #include <Service/LogEntry.h>
 #include <libnuraft/nuraft.hxx>
+#include <Common/Exception.h>
 
 namespace RK
 {
+
+namespace ErrorCodes
+{
+    extern const int CORRUPTED_LOG;
+}
+
 using nuraft::byte;
 using nuraft::cs_new;
 
 
-ptr<buffer> LogEntryBody::serialize(ptr<log_entry> & entry)
+void LogEntryBody::serialize(ptr<log_entry> & entry, bool compress, UInt8 & type, ptr<buffer> & data)
 {
-    ptr<buffer> entry_buf;
-    ptr<buffer> data = entry->get_buf_ptr();
-    data->pos(0);
+    data = entry->get_buf_ptr();
+    type = static_cast<UInt8>(entry->get_val_type());
 
-    entry_buf = buffer::alloc(sizeof(char) + data->size());
-    entry_buf->put((static_cast<byte>(entry->get_val_type())));
+    if (compress && data->size() >= MIN_COMPRESS_SIZE)
+    {
+        std::ostringstream compressed;
+        {
+            /// Fastest level, entries are compressed on the write path
+            Poco::DeflatingOutputStream deflating(compressed, Poco::DeflatingStreamBuf::STREAM_ZLIB, 1);
+            deflating.write(reinterpret_cast<const char *>(data->data_begin()), data->size());
+            deflating.close();
+        }
+        String compressed_data = compressed.str();
 
-    entry_buf->put(*data);
-    entry_buf->pos(0);
+        if (sizeof(UInt32) + compressed_data.size() < data->size())
+        {
+            auto compressed_buf = buffer::alloc(sizeof(UInt32) + compressed_data.size());
+            byte * pos = compressed_buf->data_begin();
+            UInt32 data_size = data->size();
+            memcpy(pos, &data_size, sizeof(data_size));
+            memcpy(pos + sizeof(data_size), compressed_data.data(), compressed_data.size());
+            compressed_buf->pos(0);
+            type |= COMPRESSED_FLAG;
+            data = compressed_buf;
+        }
+    }
+}
 
+ptr<buffer> LogEntryBody::serialize(ptr<log_entry> & entry, bool compress)
+{
+    UInt8 type;
+    ptr<buffer> data;
+    serialize(entry, compress, type, data);
+
+    ptr<buffer> entry_buf = buffer::alloc(sizeof(char) + data->size());
+    byte * pos = entry_buf->data_begin();
+    pos[0] = type;
+    memcpy(pos + sizeof(char), data->data_begin(), data->size());
+    entry_buf->pos(0);
     return entry_buf;
 }
 
 ptr<log_entry> LogEntryBody::parse(const char * entry_str, size_t buf_size)
 {
-    nuraft::log_val_type tp = static_cast<nuraft::log_val_type>(entry_str[0]);
+    auto type = static_cast<UInt8>(entry_str[0]);
+    nuraft::log_val_type tp = static_cast<nuraft::log_val_type>(type & ~COMPRESSED_FLAG);
+
+    if (type & COMPRESSED_FLAG)
+    {
+        UInt32 data_size;
+        if (buf_size < sizeof(char) + sizeof(data_size))
+            throw Exception(ErrorCodes::CORRUPTED_LOG, "Compressed log entry body of {} bytes is too short", buf_size);
+        memcpy(&data_size, entry_str + sizeof(char), sizeof(data_size));
+
+        auto data = buffer::alloc(data_size);
+        Poco::MemoryInputStream compressed(entry_str + sizeof(char) + sizeof(data_size), buf_size - sizeof(char) - sizeof(data_size));
+        Poco::InflatingInputStream inflating(compressed, Poco::InflatingStreamBuf::STREAM_ZLIB);
+        inflating.read(reinterpret_cast<char *>(data->data_begin()), data_size);
+        if (static_cast<size_t>(inflating.gcount()) != data_size)
+            throw Exception(
+                ErrorCodes::CORRUPTED_LOG, "Cannot decompress log entry body, expect {} bytes, got {}", data_size, inflating.gcount());
+        data->pos(0);
+        return cs_new<log_entry>(0, data, tp); /// term is set latter
+    }
+
     auto data = buffer::alloc(buf_size - 1);
     data->put_raw(reinterpret_cast<const byte *>(entry_str + 1), buf_size - 1);
     data->pos(0);
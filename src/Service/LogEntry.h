@@ -34,10 +34,24 @@ struct LogEntryHeader
     static constexpr size_t HEADER_SIZE = 24;
 };
 
+/** Body of log entry in segment file
+  *     type: log_val_type 1 byte, COMPRESSED_FLAG is set if data is compressed
+  *     data: entry buffer, or if compressed, its size 4 bytes followed by the zlib stream of it
+  */
 class LogEntryBody
 {
 public:
-    static ptr<buffer> serialize(ptr<log_entry> & entry);
+    static constexpr UInt8 COMPRESSED_FLAG = 0x80;
+    /// Smaller entries are not worth compressing
+    static constexpr size_t MIN_COMPRESS_SIZE = 256;
+
+    /// Serialize without copying the entry buffer: type is the first byte of body and data is the rest,
+    /// it is the entry buffer itself unless it is compressed. They are written with a scatter-gather write.
+    /// If compress, data of at least MIN_COMPRESS_SIZE bytes is compressed when it gets smaller.
+    static void serialize(ptr<log_entry> & entry, bool compress, UInt8 & type, ptr<buffer> & data);
+
+    /// Serialize into one buffer, see above.
+    static ptr<buffer> serialize(ptr<log_entry> & entry, bool compress = false);
     static ptr<log_entry> parse(const char * entry_str, size_t buf_size);
 };
 
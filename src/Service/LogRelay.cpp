@@ -0,0 +1,267 @@
+#include <Service/LogRelay.h>
+
+#include <Common/setThreadName.h>
+#include <Service/Metrics.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int RAFT_ERROR;
+    extern const int RAFT_FORWARD_ERROR;
+    extern const int UNEXPECTED_FORWARD_PACKET;
+}
+
+LogRelay::LogRelay(
+    int32_t my_id_,
+    int32_t upstream_id_,
+    const String & upstream_endpoint_,
+    ptr<NuRaftStateMachine> state_machine_,
+    ptr<NuRaftStateManager> state_manager_,
+    RaftSettingsPtr raft_settings_,
+    CaughtUpCallback caught_up_callback_)
+    : upstream_id(upstream_id_)
+    , state_machine(state_machine_)
+    , state_manager(state_manager_)
+    , raft_settings(raft_settings_)
+    , caught_up_callback(caught_up_callback_)
+    , connection(my_id_, CLIENT_ID, upstream_endpoint_, Poco::Timespan(raft_settings_->operation_timeout_ms * 1000))
+    , log(&Poco::Logger::get("LogRelay"))
+{
+}
+
+LogRelay::~LogRelay()
+{
+    shutdown();
+}
+
+void LogRelay::startup()
+{
+    next_index = state_machine->last_commit_index() + 1;
+    LOG_INFO(log, "Replicate logs from {} of upstream {}", next_index, upstream_id);
+    thread = ThreadFromGlobalPool([this] { run(); });
+}
+
+void LogRelay::shutdown()
+{
+    {
+        std::lock_guard lock(mutex);
+        if (shutdown_called)
+            return;
+        shutdown_called = true;
+    }
+    cv.notify_all();
+
+    if (thread.joinable())
+        thread.join();
+    connection.disconnect();
+}
+
+bool LogRelay::isLeaderAlive() const
+{
+    return getLeader() != -1 && getContactAgeMs() < raft_settings->election_timeout_upper_bound_ms;
+}
+
+UInt64 LogRelay::getContactAgeMs() const
+{
+    UInt64 now = getCurrentTimeMilliseconds();
+    UInt64 last_contact = last_contact_ms.load(std::memory_order_relaxed);
+    return now > last_contact ? now - last_contact : 0;
+}
+
+UInt64 LogRelay::createSnapshot()
+{
+    if (in_snapshot)
+        return 0;
+    snapshot_requested = true;
+    cv.notify_all();
+    return state_machine->last_commit_index();
+}
+
+void LogRelay::run()
+{
+    setThreadName("LogRelay");
+
+    while (!shutdown_called)
+    {
+        bool more = false;
+        try
+        {
+            more = fetchLogs();
+            createSnapshotIfNeeded(snapshot_requested.exchange(false));
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Failed to replicate logs from upstream " + std::to_string(upstream_id));
+        }
+
+        if (more)
+            continue;
+
+        std::unique_lock lock(mutex);
+        cv.wait_for(
+            lock,
+            std::chrono::milliseconds(raft_settings->relay_fetch_interval_ms),
+            [this] { return shutdown_called.load() || snapshot_requested.load(); });
+    }
+}
+
+template <typename ResponseT>
+std::shared_ptr<ResponseT> LogRelay::call(const ForwardRequestPtr & request)
+{
+    connection.send(request);
+
+    ForwardResponsePtr response;
+    connection.receive(response);
+
+    auto typed_response = std::dynamic_pointer_cast<ResponseT>(response);
+    if (!typed_response)
+        throw Exception(ErrorCodes::UNEXPECTED_FORWARD_PACKET, "Unexpected response {} to {}", response->toString(), request->toString());
+    if (!typed_response->accepted)
+        throw Exception(ErrorCodes::RAFT_FORWARD_ERROR, "Upstream {} refused {}", upstream_id, request->toString());
+
+    last_contact_ms.store(getCurrentTimeMilliseconds(), std::memory_order_relaxed);
+    return typed_response;
+}
+
+bool LogRelay::fetchLogs()
+{
+    auto request = std::make_shared<ForwardFetchLogsRequest>();
+    request->start_index = next_index;
+    request->max_bytes = raft_settings->max_append_bytes ? raft_settings->max_append_bytes : DEFAULT_FETCH_BYTES;
+
+    auto response = call<ForwardFetchLogsResponse>(request);
+    leader_id.store(response->leader_id, std::memory_order_relaxed);
+    upstream_committed_idx.store(response->commit_index, std::memory_order_relaxed);
+
+    if (next_index < response->first_index && next_index <= response->commit_index)
+    {
+        installSnapshot();
+        return true;
+    }
+
+    if (!response->entries.empty())
+        applyLogs(response->entries);
+
+    if (!caught_up && next_index > response->commit_index)
+    {
+        LOG_INFO(log, "Logs are caught up with upstream {} at {}", upstream_id, response->commit_index);
+        caught_up = true;
+        caught_up_callback();
+    }
+    return next_index <= response->commit_index;
+}
+
+void LogRelay::applyLogs(const std::vector<ptr<log_entry>> & entries)
+{
+    auto log_store = state_manager->load_log_store();
+
+    UInt64 start_index = next_index;
+    /// A gap if logs kept are behind the state machine, logs go on from the start index
+    if (log_store->next_slot() < start_index)
+        log_store->compact(start_index - 1);
+
+    UInt64 index = start_index;
+    for (auto entry : entries)
+    {
+        if (index == log_store->next_slot())
+            log_store->append(entry);
+        /// Logs of the time it was a learner of the Raft cluster may be uncommitted ones
+        else if (log_store->term_at(index) != entry->get_term())
+            log_store->write_at(index, entry);
+        ++index;
+    }
+
+    log_store->end_of_append_batch(start_index, entries.size());
+    if (!log_store->flush())
+        throw Exception(ErrorCodes::RAFT_ERROR, "Failed to flush logs from {} to {}", start_index, index - 1);
+
+    index = start_index;
+    for (const auto & entry : entries)
+    {
+        /// Configuration of the Raft cluster is not mine
+        if (entry->get_val_type() == nuraft::log_val_type::app_log && index > state_machine->last_commit_index())
+            state_machine->commit(index, entry->get_buf());
+        ++index;
+    }
+
+    next_index = index;
+    LOG_TRACE(log, "Committed logs from {} to {} of upstream {}", start_index, index - 1, upstream_id);
+}
+
+void LogRelay::installSnapshot()
+{
+    ptr<nuraft::snapshot> snapshot;
+    ulong obj_id = 0;
+
+    while (!shutdown_called)
+    {
+        auto request = std::make_shared<ForwardFetchSnapshotRequest>();
+        request->snapshot = snapshot;
+        request->obj_id = obj_id;
+
+        auto response = call<ForwardFetchSnapshotResponse>(request);
+        if (!snapshot)
+        {
+            if (!response->snapshot || !response->data)
+                throw Exception(ErrorCodes::RAFT_FORWARD_ERROR, "Upstream {} has no snapshot", upstream_id);
+            snapshot = response->snapshot;
+            LOG_INFO(
+                log,
+                "Install snapshot {} of upstream {}, logs from {} are compacted",
+                snapshot->get_last_log_idx(),
+                upstream_id,
+                next_index);
+        }
+
+        /// So that the objects are saved in the order of NuRaft receiving them from the leader
+        state_machine->save_logical_snp_obj(*snapshot, obj_id, *response->data, request->obj_id == 0, response->is_last);
+        if (response->is_last)
+            break;
+    }
+
+    if (shutdown_called)
+        return;
+
+    if (!state_machine->apply_snapshot(*snapshot))
+        throw Exception(ErrorCodes::RAFT_ERROR, "Failed to apply snapshot {} of upstream {}", snapshot->get_last_log_idx(), upstream_id);
+
+    /// Logs go on after the snapshot
+    state_manager->load_log_store()->compact(snapshot->get_last_log_idx());
+    next_index = snapshot->get_last_log_idx() + 1;
+    LOG_INFO(log, "Installed snapshot {} of upstream {}", snapshot->get_last_log_idx(), upstream_id);
+}
+
+void LogRelay::createSnapshotIfNeeded(bool force)
+{
+    if (in_snapshot)
+        return;
+
+    UInt64 last_committed_idx = state_machine->last_commit_index();
+    auto last_snapshot = state_machine->last_snapshot();
+    UInt64 last_snapshot_idx = last_snapshot ? last_snapshot->get_last_log_idx() : 0;
+    if (last_committed_idx <= last_snapshot_idx)
+        return;
+    if (!force && (last_committed_idx - last_snapshot_idx < raft_settings->snapshot_distance || !state_machine->chk_create_snapshot()))
+        return;
+
+    auto log_store = state_manager->load_log_store();
+    auto snapshot = nuraft::cs_new<nuraft::snapshot>(
+        last_committed_idx, log_store->term_at(last_committed_idx), state_manager->getClusterConfig());
+
+    in_snapshot = true;
+    nuraft::async_result<bool>::handler_type when_done = [this, snapshot, log_store](bool & ret, ptr<std::exception> &)
+    {
+        /// Logs are compacted the same way as NuRaft does after creating a snapshot
+        UInt64 last_log_idx = snapshot->get_last_log_idx();
+        if (ret && last_log_idx > raft_settings->reserved_log_items)
+            log_store->compact(last_log_idx - raft_settings->reserved_log_items);
+        in_snapshot = false;
+    };
+
+    LOG_INFO(log, "Create snapshot {} of logs replicated from upstream {}", last_committed_idx, upstream_id);
+    state_machine->create_snapshot(*snapshot, when_done);
+}
+
+}
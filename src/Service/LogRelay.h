@@ -0,0 +1,122 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#include <Common/ThreadPool.h>
+#include <common/logger_useful.h>
+
+#include <Service/ForwardConnection.h>
+#include <Service/NuRaftStateMachine.h>
+#include <Service/NuRaftStateManager.h>
+#include <Service/Settings.h>
+
+namespace RK
+{
+
+/** Replicates committed logs of a cascaded observer, one configured with replicate_from, from its upstream instead of
+  * the leader. The upstream is a follower or another cascaded observer, so that observers in a tree cost the leader
+  * little. The observer is not a member of the Raft cluster of others, its NuRaft server idles as a learner no one
+  * sends logs to.
+  *
+  * Logs are fetched from the forwarding port of the upstream which serves only the ones it has committed, so they are
+  * never rolled back. They are appended to the log store and committed to the state machine in order by the thread of
+  * the relay, which also creates snapshots in place of NuRaft. When the upstream has compacted the logs asked for,
+  * its snapshot is installed the same way NuRaft installs a snapshot from the leader.
+  *
+  * Writes are still forwarded to the leader, which is the one the upstream knows, and the last response of the
+  * upstream is the last contact of the leader for staleness of reads.
+  */
+class LogRelay
+{
+public:
+    /// Invoked once when logs are caught up with the upstream for the first time
+    using CaughtUpCallback = std::function<void()>;
+
+    LogRelay(
+        int32_t my_id_,
+        int32_t upstream_id_,
+        const String & upstream_endpoint_,
+        ptr<NuRaftStateMachine> state_machine_,
+        ptr<NuRaftStateManager> state_manager_,
+        RaftSettingsPtr raft_settings_,
+        CaughtUpCallback caught_up_callback_);
+
+    ~LogRelay();
+
+    void startup();
+    void shutdown();
+
+    int32_t getUpstreamId() const { return upstream_id; }
+
+    /// Leader known by the upstream as of the last response of it, -1 if none
+    int32_t getLeader() const { return leader_id.load(std::memory_order_relaxed); }
+
+    /// Whether the upstream answered within election timeout and knows a leader
+    bool isLeaderAlive() const;
+
+    /// Milliseconds since the last response of the upstream
+    UInt64 getContactAgeMs() const;
+
+    /// Committed log index of the upstream as of the last response of it
+    UInt64 getUpstreamCommittedIdx() const { return upstream_committed_idx.load(std::memory_order_relaxed); }
+
+    /// Schedule creating a snapshot of logs committed, return the last log index of it, 0 if one is being created.
+    UInt64 createSnapshot();
+
+private:
+    void run();
+
+    /// Fetch logs from next_index and apply them, return whether there may be more to fetch
+    bool fetchLogs();
+
+    /// Fetch the latest snapshot of the upstream and apply it, logs go on after it.
+    void installSnapshot();
+
+    /// Append entries from next_index to log store and commit them
+    void applyLogs(const std::vector<ptr<log_entry>> & entries);
+
+    /// Snapshots are created every snapshot_distance logs like NuRaft does, or anyway if force.
+    void createSnapshotIfNeeded(bool force);
+
+    /// Client id of the forward connection, runners of RequestForwarder take the ones from 0
+    static constexpr int32_t CLIENT_ID = -1;
+    /// Bytes of logs fetched at once if max_append_bytes is 0
+    static constexpr UInt64 DEFAULT_FETCH_BYTES = 1024 * 1024;
+
+    /// Send request to upstream and receive response of it, throw if it is not accepted.
+    template <typename ResponseT>
+    std::shared_ptr<ResponseT> call(const ForwardRequestPtr & request);
+
+    int32_t upstream_id;
+
+    ptr<NuRaftStateMachine> state_machine;
+    ptr<NuRaftStateManager> state_manager;
+    RaftSettingsPtr raft_settings;
+
+    CaughtUpCallback caught_up_callback;
+    bool caught_up = false;
+
+    /// Used only by the thread
+    ForwardConnection connection;
+    /// Next log index to fetch
+    UInt64 next_index = 0;
+
+    std::atomic<int32_t> leader_id{-1};
+    std::atomic<UInt64> upstream_committed_idx{0};
+    std::atomic<UInt64> last_contact_ms{0};
+
+    /// Manual snapshot is created by the thread too, for logs are committed by it
+    std::atomic<bool> snapshot_requested{false};
+    std::atomic<bool> in_snapshot{false};
+
+    ThreadFromGlobalPool thread;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::atomic<bool> shutdown_called{false};
+
+    Poco::Logger * log;
+};
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <vector>
+
+#include <libnuraft/nuraft.hxx>
+#include <common/types.h>
+
+namespace RK
+{
+using nuraft::int64;
+using nuraft::log_entry;
+using nuraft::ptr;
+
+enum class LogVersion : uint8_t
+{
+    V0 = 0,
+    V1 = 1, /// with ctime mtime
+    V2 = 2, /// entry body may be compressed, see LogEntryBody
+};
+
+/// Attach version to log entry
+struct VersionLogEntry
+{
+    LogVersion version;
+    ptr<log_entry> entry;
+};
+
+static constexpr auto CURRENT_LOG_VERSION = LogVersion::V2;
+
+/** Backend keeping Raft log entries of NuRaftFileLogStore, which adds the log cache, fsync modes and compaction
+  * policy on top of it. The store keeps a contiguous range [firstLogIndex, lastLogIndex] of entries.
+  *
+  * Appends come from one thread of NuRaft at a time, reads may come from any thread.
+  * LogSegmentStore keeps them in segment files, InMemoryLogStorage only in memory for benchmarks and tests.
+  */
+class ILogStorage
+{
+public:
+    virtual ~ILogStorage() = default;
+
+    virtual UInt64 firstLogIndex() const = 0;
+    virtual UInt64 lastLogIndex() const = 0;
+
+    /// Append entry and return its index. A deferred entry may be persisted only by the next writePending or flush.
+    virtual UInt64 appendEntry(ptr<log_entry> entry, bool deferred) = 0;
+
+    /// Write deferred entries, return 0 if success.
+    virtual int writePending() { return 0; }
+
+    /// Persist entries appended, return the last index persisted, 0 if failed.
+    virtual UInt64 flush() = 0;
+
+    /// Whether writes are persisted asynchronously by submitPending and waited for by waitDurable
+    virtual bool hasIOUring() const { return false; }
+
+    /// Submit persisting deferred entries without waiting, return 0 if success, -1 if it is not supported.
+    virtual int submitPending() { return -1; }
+
+    /// Wait for submitted writes and return the last index persisted, it is woken up by wakeUp.
+    virtual UInt64 waitDurable() { return 0; }
+    virtual void wakeUp() { }
+
+    /// Drop entries from index and append entry at it, returns index if success.
+    virtual UInt64 writeAt(UInt64 index, ptr<log_entry> entry) = 0;
+
+    /// Entry at index, nullptr if there is none
+    virtual ptr<log_entry> getEntry(UInt64 index) = 0;
+
+    /// Collect entries in [start_index, end_index] until their size reaches batch_size_hint_in_bytes, at least one.
+    virtual void
+    getEntriesExt(UInt64 start_index, UInt64 end_index, int64 batch_size_hint_in_bytes, ptr<std::vector<ptr<log_entry>>> & entries)
+        = 0;
+
+    /// Format version of the entry at index
+    virtual LogVersion getVersion(UInt64 index) = 0;
+
+    /// Drop entries before first_index_kept, some of them may be kept. If it is after the last entry, the store
+    /// is empty and goes on from first_index_kept. Return 0 if success.
+    virtual int removeSegment(UInt64 first_index_kept) = 0;
+
+    /// Move entries up to last_index, which are rarely read, to cheaper storage if there is one.
+    virtual void offloadSegments(UInt64 /* last_index */) { }
+
+    /// Bytes taken by entries
+    virtual UInt64 getLogBytes() const = 0;
+};
+
+}
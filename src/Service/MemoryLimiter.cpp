@@ -0,0 +1,66 @@
+#include <Service/MemoryLimiter.h>
+
+namespace RK
+{
+
+const char * toString(MemoryLimitState state)
+{
+    switch (state)
+    {
+        case MemoryLimitState::NORMAL:
+            return "normal";
+        case MemoryLimitState::SOFT:
+            return "soft";
+        case MemoryLimitState::HARD:
+            return "hard";
+    }
+    __builtin_unreachable();
+}
+
+MemoryLimiter::MemoryLimiter(UInt64 soft_limit_, UInt64 hard_limit_) : soft_limit(soft_limit_), hard_limit(hard_limit_)
+{
+}
+
+MemoryLimitState MemoryLimiter::update(UInt64 memory_usage)
+{
+    auto reached = [&](UInt64 limit) { return limit && memory_usage >= limit; };
+    auto stays = [&](UInt64 limit) { return limit && memory_usage > limit / 10 * 9; };
+
+    MemoryLimitState current = state.load(std::memory_order_relaxed);
+    MemoryLimitState res = MemoryLimitState::NORMAL;
+    if (reached(hard_limit) || (current == MemoryLimitState::HARD && stays(hard_limit)))
+        res = MemoryLimitState::HARD;
+    else if (reached(soft_limit) || (current != MemoryLimitState::NORMAL && stays(soft_limit)))
+        res = MemoryLimitState::SOFT;
+
+    state.store(res, std::memory_order_relaxed);
+    return res;
+}
+
+bool MemoryLimiter::isGrowingRequest(const Coordination::ZooKeeperRequest & request)
+{
+    switch (request.getOpNum())
+    {
+        case Coordination::OpNum::Create:
+        case Coordination::OpNum::Create2:
+        case Coordination::OpNum::CreateContainer:
+        case Coordination::OpNum::CreateTTL:
+        case Coordination::OpNum::Set:
+            return true;
+        case Coordination::OpNum::Multi:
+        {
+            const auto & multi_request = static_cast<const Coordination::ZooKeeperMultiRequest &>(request);
+            for (const auto & sub_request : multi_request.requests)
+            {
+                const auto * sub_zk_request = dynamic_cast<const Coordination::ZooKeeperRequest *>(sub_request.get());
+                if (sub_zk_request && isGrowingRequest(*sub_zk_request))
+                    return true;
+            }
+            return false;
+        }
+        default:
+            return false;
+    }
+}
+
+}
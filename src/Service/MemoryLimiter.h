@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <ZooKeeper/ZooKeeperCommon.h>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+enum class MemoryLimitState : UInt8
+{
+    NORMAL,
+    /// Above the soft limit, snapshot is created and caches are dropped to free memory
+    SOFT,
+    /// Above the hard limit, requests which add nodes or data are rejected, reads and deletes still work
+    HARD,
+};
+
+const char * toString(MemoryLimitState state);
+
+/**
+ * Soft and hard budgets of the memory of a node, checked against the sum of the components in KeeperMemoryUsage.
+ *
+ * A node enters a state when the memory reaches its limit, and leaves it when the memory drops under 90% of the
+ * limit, so that it does not flap around the limit. A limit of 0 disables it.
+ */
+class MemoryLimiter
+{
+public:
+    MemoryLimiter(UInt64 soft_limit_, UInt64 hard_limit_);
+
+    bool enabled() const { return soft_limit || hard_limit; }
+
+    /// Feed current memory usage, return the state.
+    MemoryLimitState update(UInt64 memory_usage);
+
+    MemoryLimitState getState() const { return state.load(std::memory_order_relaxed); }
+
+    /// Whether request is rejected in the current state
+    bool shouldReject(const Coordination::ZooKeeperRequest & request) const
+    {
+        return getState() == MemoryLimitState::HARD && isGrowingRequest(request);
+    }
+
+    /// Whether request creates nodes or sets data, including a multi request with such an operation
+    static bool isGrowingRequest(const Coordination::ZooKeeperRequest & request);
+
+private:
+    const UInt64 soft_limit;
+    const UInt64 hard_limit;
+
+    /// Updated by the dead session clean thread, read by request threads
+    std::atomic<MemoryLimitState> state{MemoryLimitState::NORMAL};
+};
+
+}
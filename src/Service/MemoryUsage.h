@@ -0,0 +1,73 @@
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Approximate bytes of the nodes and buckets of a std::unordered_map or set, memory owned by elements is not included.
+template <typename HashTable>
+size_t hashTableMemoryUsage(const HashTable & table)
+{
+    /// A node holds the element, the pointer to the next one and the cached hash
+    return table.bucket_count() * sizeof(void *) + table.size() * (sizeof(typename HashTable::value_type) + 2 * sizeof(void *));
+}
+
+/// Heap bytes of a string, short ones are stored in the object
+inline size_t stringMemoryUsage(const String & str)
+{
+    const auto * object = reinterpret_cast<const char *>(&str);
+    if (str.data() >= object && str.data() < object + sizeof(str))
+        return 0;
+    return str.capacity() + 1;
+}
+
+/** Approximate memory held by the components of a node, see mntr keys zk_memory_<component>_bytes. Structures estimate
+  * it from their sizes and the sizes of their elements, so allocator overhead is not included and the sum is less than
+  * the resident memory, which also has NuRaft and caches of the allocator.
+  */
+struct KeeperMemoryUsage
+{
+    /// Nodes with their paths, data and children
+    UInt64 data_tree = 0;
+    UInt64 watches = 0;
+    /// Timeouts, expiry queue, auth and ephemeral nodes index of sessions
+    UInt64 sessions = 0;
+    UInt64 acl_map = 0;
+    /// Cached log entries of log store
+    UInt64 log_entry_queue = 0;
+    /// Queues between connections and processor with the requests and responses in flight
+    UInt64 pipeline_queues = 0;
+    /// Read buffers and responses not sent yet of client connections
+    UInt64 connection_buffers = 0;
+    /// Buckets of sessions and ACLs copied on write for a snapshot task in progress and its dirty paths, nodes copied on
+    /// write for it are not included
+    UInt64 snapshot = 0;
+
+    /// Component name and bytes
+    std::vector<std::pair<const char *, UInt64>> items() const
+    {
+        return {
+            {"data_tree", data_tree},
+            {"watches", watches},
+            {"sessions", sessions},
+            {"acl_map", acl_map},
+            {"log_entry_queue", log_entry_queue},
+            {"pipeline_queues", pipeline_queues},
+            {"connection_buffers", connection_buffers},
+            {"snapshot", snapshot}};
+    }
+
+    UInt64 total() const
+    {
+        UInt64 res = 0;
+        for (const auto & [_, bytes] : items())
+            res += bytes;
+        return res;
+    }
+};
+
+}
@@ -1,5 +1,7 @@
 #include <Service/Metrics.h>
 #include <algorithm>
+#include <bit>
+#include <Common/IO/WriteHelpers.h>
 
 namespace RK
 {
@@ -9,111 +11,208 @@ namespace ErrorCodes
     extern const int BAD_ARGUMENTS;
 }
 
-void ReservoirSampler::update(RK::UInt64 value)
+Strings AdvanceSummary::values() const
 {
-    UInt64 c = count.fetch_add(1);
+    auto snapshot = histogram.getSnapshot();
 
-    if (c < DEFAULT_SIZE)
-    {
-        values[c].store(value);
-        return;
-    }
-
-    static thread_local std::mt19937 gen{std::random_device{}()};
-    std::uniform_int_distribution<> dis(0, c);
-
-    UInt64 i = dis(gen);
-    if (i < DEFAULT_SIZE)
-        values[i].store(value);
+    Strings results;
+    results.emplace_back(fmt::format("zk_p50_{}\t{:.1f}", name, snapshot.quantile(0.5)));
+    results.emplace_back(fmt::format("zk_p90_{}\t{:.1f}", name, snapshot.quantile(0.9)));
+    results.emplace_back(fmt::format("zk_p99_{}\t{:.1f}", name, snapshot.quantile(0.99)));
+    results.emplace_back(fmt::format("zk_p999_{}\t{:.1f}", name, snapshot.quantile(0.999)));
+    results.emplace_back(fmt::format("zk_cnt_{}\t{}", name, snapshot.count));
+    results.emplace_back(fmt::format("zk_sum_{}\t{}", name, snapshot.sum));
+    return results;
 }
 
-std::vector<UInt64> ReservoirSampler::getSnapshot() const
+void AdvanceSummary::writePrometheus(WriteBuffer & out, const String & prefix) const
 {
-    size_t s = std::min(DEFAULT_SIZE, count.load());
-
-    std::vector<UInt64> copy(s);
+    auto snapshot = histogram.getSnapshot();
 
-    for (size_t i = 0; i < s; i++)
-        copy[i] = values[i].load();
-
-    return copy;
+    String metric = prefix + name;
+    writeString(fmt::format("# TYPE {} histogram\n", metric), out);
+    writePrometheusHistogram(out, metric, "", snapshot);
 }
 
-double AdvanceSummary::getValue(const std::vector<UInt64>& numbers, double quantile)
+void writePrometheusHistogram(
+    WriteBuffer & out, const String & metric, const String & labels, const LogLinearHistogram::Snapshot & snapshot)
 {
-    if (quantile < 0.0 || quantile > 1.0)
+    String bucket_labels = labels.empty() ? "" : labels + ",";
+    String series_labels = labels.empty() ? "" : "{" + labels + "}";
+
+    /// Buckets starting at powers of two are boundaries, values are integers so that le is the boundary minus 1.
+    /// Boundaries after the one covering all values are omitted.
+    UInt64 cumulative = 0;
+    for (size_t bucket = 1; bucket < LogLinearHistogram::BUCKETS; ++bucket)
     {
-        LOG_ERROR(&Poco::Logger::get("AdvanceSummary"), "Quantile {} is not in [0..1]", quantile);
-        return 0.0;
+        cumulative += snapshot.counts[bucket - 1];
+        UInt64 lower_bound = LogLinearHistogram::lowerBound(bucket);
+        if (!std::has_single_bit(lower_bound))
+            continue;
+        writeString(fmt::format("{}_bucket{{{}le=\"{}\"}} {}\n", metric, bucket_labels, lower_bound - 1, cumulative), out);
+        if (cumulative == snapshot.count)
+            break;
     }
-
-    if (numbers.empty())
-        return 0.0;
-
-    auto index = quantile * (numbers.size() + 1);
-    size_t pos = static_cast<size_t>(index);
-
-    if (pos < 1)
-        return numbers[0];
-
-
-    if (pos >= numbers.size())
-        return numbers.back();
-
-    auto lower = numbers[pos - 1];
-    auto upper = numbers[pos];
-    return lower + (index - std::floor(index)) * (upper - lower);
+    writeString(fmt::format("{}_bucket{{{}le=\"+Inf\"}} {}\n", metric, bucket_labels, snapshot.count), out);
+    writeString(fmt::format("{}_sum{} {}\n", metric, series_labels, snapshot.sum), out);
+    writeString(fmt::format("{}_count{} {}\n", metric, series_labels, snapshot.count), out);
 }
 
-Strings AdvanceSummary::values() const
+Strings SimpleSummary::values() const
 {
-    auto numbers = reservoir_sampler.getSnapshot();
-    std::sort(numbers.begin(), numbers.end());
-
     Strings results;
-    results.emplace_back(fmt::format("zk_p50_{}\t{:.1f}", name, getValue(numbers, 0.5)));
-    results.emplace_back(fmt::format("zk_p90_{}\t{:.1f}", name, getValue(numbers, 0.9)));
-    results.emplace_back(fmt::format("zk_p99_{}\t{:.1f}", name, getValue(numbers, 0.99)));
-    results.emplace_back(fmt::format("zk_p999_{}\t{:.1f}", name, getValue(numbers, 0.999)));
-    results.emplace_back(fmt::format("zk_cnt_{}\t{}", name, count.load()));
-    results.emplace_back(fmt::format("zk_sum_{}\t{}", name, sum.load()));
+    results.emplace_back(fmt::format("zk_{}\t{}", name, sum.get()));
     return results;
 }
 
-Strings SimpleSummary::values() const
+void SimpleSummary::writePrometheus(WriteBuffer & out, const String & prefix) const
 {
-    Strings results;
-    results.emplace_back(fmt::format("zk_{}\t{}", name, sum.load()));
-    return results;
+    String metric = prefix + name;
+    writeString(fmt::format("# TYPE {} counter\n{} {}\n", metric, metric, sum.get()), out);
 }
 
 void BasicSummary::add(RK::UInt64 value)
 {
-    UInt64 current;
+    auto & shard = shards.local();
+    atomicMax(shard.max, value);
+    atomicMin(shard.min, value);
+    shard.count.fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(value, std::memory_order_relaxed);
+}
 
-    while (value > (current = max.load()) && !max.compare_exchange_strong(current, value))
+void BasicSummary::reset()
+{
+    for (auto & shard : shards)
     {
+        shard.count.store(0, std::memory_order_relaxed);
+        shard.sum.store(0, std::memory_order_relaxed);
+        shard.min.store(std::numeric_limits<UInt64>::max(), std::memory_order_relaxed);
+        shard.max.store(0, std::memory_order_relaxed);
     }
+}
 
-    while (value < (current = min.load()) && !min.compare_exchange_strong(current, value))
+BasicSummary::Values BasicSummary::getValues() const
+{
+    Values res;
+    UInt64 min = std::numeric_limits<UInt64>::max();
+    for (const auto & shard : shards)
     {
+        res.count += shard.count.load(std::memory_order_relaxed);
+        res.sum += shard.sum.load(std::memory_order_relaxed);
+        min = std::min(min, shard.min.load(std::memory_order_relaxed));
+        res.max = std::max(res.max, shard.max.load(std::memory_order_relaxed));
     }
-
-    count ++;
-    sum += value;
+    res.min = min == std::numeric_limits<UInt64>::max() ? 0 : min;
+    return res;
 }
 
 Strings BasicSummary::values() const
 {
+    auto current = getValues();
+
     Strings results;
-    results.emplace_back(fmt::format("zk_avg_{}\t{:.1f}", name, getAvg()));
-    results.emplace_back(fmt::format("zk_min_{}\t{}", name, getMin()));
-    results.emplace_back(fmt::format("zk_max_{}\t{}", name, max.load()));
-    results.emplace_back(fmt::format("zk_cnt_{}\t{}", name, count.load()));
-    results.emplace_back(fmt::format("zk_sum_{}\t{}", name, sum.load()));
+    results.emplace_back(fmt::format("zk_avg_{}\t{:.1f}", name, current.getAvg()));
+    results.emplace_back(fmt::format("zk_min_{}\t{}", name, current.min));
+    results.emplace_back(fmt::format("zk_max_{}\t{}", name, current.max));
+    results.emplace_back(fmt::format("zk_cnt_{}\t{}", name, current.count));
+    results.emplace_back(fmt::format("zk_sum_{}\t{}", name, current.sum));
     return results;
 }
 
+void BasicSummary::writePrometheus(WriteBuffer & out, const String & prefix) const
+{
+    auto current = getValues();
+
+    String metric = prefix + name;
+    writeString(fmt::format("# TYPE {} summary\n{}_sum {}\n{}_count {}\n", metric, metric, current.sum, metric, current.count), out);
+    writeString(fmt::format("# TYPE {}_min gauge\n{}_min {}\n", metric, metric, current.min), out);
+    writeString(fmt::format("# TYPE {}_max gauge\n{}_max {}\n", metric, metric, current.max), out);
+}
+
+const char * SnapshotProgress::toString(Phase phase)
+{
+    switch (phase)
+    {
+        case IDLE:
+            return "idle";
+        case CREATE_DUMP:
+            return "create_dump";
+        case CREATE_SERIALIZE:
+            return "create_serialize";
+        case LOAD_VERIFY:
+            return "load_verify";
+        case LOAD_PARSE:
+            return "load_parse";
+        case LOAD_BUILD:
+            return "load_build";
+        case PHASE_COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+void SnapshotProgress::begin(Phase phase_, UInt64 objects_total_)
+{
+    finish();
+    phase_start_ms = getCurrentTimeMilliseconds();
+    objects_total = objects_total_;
+    objects = 0;
+    bytes = 0;
+    nodes = 0;
+    phase = phase_;
+}
+
+void SnapshotProgress::finish()
+{
+    Phase last = phase.exchange(IDLE);
+    if (last == IDLE)
+        return;
+
+    UInt64 now = getCurrentTimeMilliseconds();
+    UInt64 elapsed = now > phase_start_ms ? now - phase_start_ms : 0;
+    last_elapsed_ms[last] = elapsed;
+
+    auto & metrics = Metrics::getMetrics();
+    Metrics::SummaryPtr summaries[PHASE_COUNT]
+        = {nullptr,
+           metrics.snap_dump_time_ms,
+           metrics.snap_serialize_time_ms,
+           metrics.snap_load_verify_time_ms,
+           metrics.snap_load_parse_time_ms,
+           metrics.snap_load_build_time_ms};
+    summaries[last]->add(elapsed);
+}
+
+void SnapshotProgress::addObject(UInt64 object_bytes, UInt64 object_nodes)
+{
+    objects++;
+    bytes += object_bytes;
+    nodes += object_nodes;
+}
+
+String SnapshotProgress::dump() const
+{
+    Phase current = phase;
+    UInt64 now = getCurrentTimeMilliseconds();
+    UInt64 elapsed = current != IDLE && now > phase_start_ms ? now - phase_start_ms : 0;
+
+    String res;
+    auto append = [&res](const String & key, const String & value) { res += key + "\t" + value + "\n"; };
+    append("phase", toString(current));
+    append("phase_elapsed_ms", std::to_string(elapsed));
+    append("objects", std::to_string(objects.load()));
+    append("objects_total", std::to_string(objects_total.load()));
+    append("bytes", std::to_string(bytes.load()));
+    append("nodes", std::to_string(nodes.load()));
+    /// Throughput of current phase
+    append("bytes_per_second", std::to_string(elapsed ? bytes * 1000 / elapsed : 0));
+    append("nodes_per_second", std::to_string(elapsed ? nodes * 1000 / elapsed : 0));
+
+    for (UInt8 i = CREATE_DUMP; i < PHASE_COUNT; ++i)
+        append(String("last_") + toString(Phase(i)) + "_ms", std::to_string(last_elapsed_ms[i].load()));
+    return res;
+}
+
 using SummaryPtr = std::shared_ptr<Summary>;
 
 Metrics::Metrics()
@@ -122,6 +221,7 @@ Metrics::Metrics()
     log_replication_batch_size = getSummary("log_replication_batch_size", SummaryLevel::BASIC);
     response_socket_send_size = getSummary("response_socket_send_size", SummaryLevel::BASIC);
     forward_response_socket_send_size = getSummary("forward_response_socket_send_size", SummaryLevel::BASIC);
+    forward_batch_size = getSummary("forward_batch_size", SummaryLevel::BASIC);
     apply_write_request_time_ms = getSummary("apply_write_request_time_ms", SummaryLevel::ADVANCED);
     apply_read_request_time_ms = getSummary("apply_read_request_time_ms", SummaryLevel::ADVANCED);
     read_latency = getSummary("readlatency", SummaryLevel::ADVANCED);
@@ -130,6 +230,30 @@ Metrics::Metrics()
     snap_time_ms = getSummary("snap_time_ms", SummaryLevel::SIMPLE);
     snap_blocking_time_ms = getSummary("snap_blocking_time_ms", SummaryLevel::SIMPLE);
     snap_count = getSummary("snap_count", SummaryLevel::SIMPLE);
+    snap_dump_time_ms = getSummary("snap_dump_time_ms", SummaryLevel::BASIC);
+    snap_serialize_time_ms = getSummary("snap_serialize_time_ms", SummaryLevel::BASIC);
+    snap_load_verify_time_ms = getSummary("snap_load_verify_time_ms", SummaryLevel::BASIC);
+    snap_load_parse_time_ms = getSummary("snap_load_parse_time_ms", SummaryLevel::BASIC);
+    snap_load_build_time_ms = getSummary("snap_load_build_time_ms", SummaryLevel::BASIC);
+    snap_object_bytes = getSummary("snap_object_bytes", SummaryLevel::BASIC);
+    snap_object_nodes = getSummary("snap_object_nodes", SummaryLevel::BASIC);
+    snap_load_object_bytes = getSummary("snap_load_object_bytes", SummaryLevel::BASIC);
+    snap_load_object_nodes = getSummary("snap_load_object_nodes", SummaryLevel::BASIC);
+    snap_load_fill_bucket_time_ms = getSummary("snap_load_fill_bucket_time_ms", SummaryLevel::BASIC);
+    snap_load_build_children_time_ms = getSummary("snap_load_build_children_time_ms", SummaryLevel::BASIC);
+
+    log_cache_hit = getSummary("log_cache_hit", SummaryLevel::SIMPLE);
+    log_cache_miss = getSummary("log_cache_miss", SummaryLevel::SIMPLE);
+
+    log_fsync_group_entries = getSummary("log_fsync_group_entries", SummaryLevel::BASIC);
+    log_fsync_group_bytes = getSummary("log_fsync_group_bytes", SummaryLevel::BASIC);
+    log_fsync_time_us = getSummary("log_fsync_time_us", SummaryLevel::BASIC);
+
+    close_sessions_batch_size = getSummary("close_sessions_batch_size", SummaryLevel::BASIC);
+
+    throttled_watches = getSummary("throttled_watches", SummaryLevel::SIMPLE);
+    throttled_in_flight_requests = getSummary("throttled_in_flight_requests", SummaryLevel::SIMPLE);
+    throttled_request_bytes = getSummary("throttled_request_bytes", SummaryLevel::SIMPLE);
 }
 
 SummaryPtr Metrics::getSummary(const RK::String & name, RK::SummaryLevel level)
@@ -163,4 +287,10 @@ std::map<String, Strings> Metrics::dumpMetricsValues() const
     return metrics_values;
 }
 
+void Metrics::writePrometheus(WriteBuffer & out, const String & prefix) const
+{
+    for (const auto & [_, summary] : summaries)
+        summary->writePrometheus(out, prefix);
+}
+
 }
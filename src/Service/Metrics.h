@@ -3,51 +3,26 @@
 #include <common/types.h>
 #include <array>
 #include <atomic>
-#include <random>
 #include <Poco/Logger.h>
 #include <common/logger_useful.h>
 #include <unordered_map>
 #include <map>
+#include <Common/CoarseClock.h>
 #include <Common/Exception.h>
+#include <Common/LogLinearHistogram.h>
+#include <Common/ShardedCounter.h>
 
 
 namespace RK
 {
 
-inline UInt64 getCurrentTimeMilliseconds()
-{
-    return duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
-};
+class WriteBuffer;
 
-
-/**
- * Uses the reservoir sampling algorithm to sample statistical values
- * The ReservoirSampler is thread-safe
- */
-class ReservoirSampler
+/// Of the coarse clock, timestamps and deadlines of requests need not be precise
+inline UInt64 getCurrentTimeMilliseconds()
 {
-public:
-    static constexpr UInt64 DEFAULT_SIZE = 4096;
-
-    size_t size() const
-    {
-        UInt64 c = count.load();
-        return c > DEFAULT_SIZE ? c : DEFAULT_SIZE;
-    }
-
-    void update(UInt64 value);
-
-    void reset()
-    {
-        count.store(0);
-    }
-
-    std::vector<UInt64> getSnapshot() const;
-
-private:
-    std::atomic<UInt64> count{0};
-    std::array<std::atomic<UInt64>, DEFAULT_SIZE> values;
-};
+    return CoarseClock::nowMilliseconds();
+}
 
 
 class Summary
@@ -57,6 +32,8 @@ public:
     virtual void reset() = 0;
     virtual ~Summary() = default;
     virtual Strings values() const = 0;
+    /// Write in Prometheus text format, metric name is prefix followed by name of the summary
+    virtual void writePrometheus(WriteBuffer & out, const String & prefix) const = 0;
 };
 
 enum SummaryLevel
@@ -88,15 +65,17 @@ public:
     }
 
     Strings values() const override;
+    /// A counter
+    void writePrometheus(WriteBuffer & out, const String & prefix) const override;
 
-    void add(RK::UInt64 value) override { sum += value; }
-    UInt64 getSum() const { return sum.load(); }
+    void add(RK::UInt64 value) override { sum.add(value); }
+    UInt64 getSum() const { return sum.get(); }
 
-    void reset() override { sum.store(0); }
+    void reset() override { sum.reset(); }
 
 private:
     String name;
-    std::atomic<UInt64> sum{0};
+    ShardedCounter sum;
 };
 
 class BasicSummary : public Summary
@@ -106,40 +85,45 @@ public:
     {
     }
 
-    void reset() override
-    {
-        count.store(0);
-        sum.store(0);
-        min.store(std::numeric_limits<UInt64>::max());
-        max.store(0);
-    }
+    void reset() override;
 
     void add(UInt64 value) override;
 
-    double getAvg() const
+    struct Values
     {
-        UInt64 current_count = count.load();
-        UInt64 current_sum = sum.load();
+        UInt64 count = 0;
+        UInt64 sum = 0;
+        UInt64 min = 0;
+        UInt64 max = 0;
 
-        return current_count > 0 ? current_sum / current_count : 0;
-    }
+        double getAvg() const { return count > 0 ? static_cast<double>(sum / count) : 0; }
+    };
 
-    UInt64 getMin() const
-    {
-        UInt64 current_min = min.load();
-        return current_min == std::numeric_limits<UInt64>::max() ? 0 : current_min;
-    }
+    /// Merged shards, min is 0 if empty
+    Values getValues() const;
 
     Strings values() const override;
+    /// A summary without quantiles, and gauges of min and max
+    void writePrometheus(WriteBuffer & out, const String & prefix) const override;
 
 private:
+    struct alignas(64) Shard
+    {
+        std::atomic<UInt64> count{0};
+        std::atomic<UInt64> sum{0};
+        std::atomic<UInt64> min{std::numeric_limits<UInt64>::max()};
+        std::atomic<UInt64> max{0};
+    };
+
     String name;
-    std::atomic<UInt64> count{0};
-    std::atomic<UInt64> sum{0};
-    std::atomic<UInt64> min{std::numeric_limits<UInt64>::max()};
-    std::atomic<UInt64> max{0};
+    Sharded<Shard> shards;
 };
 
+/// Write series of Prometheus histogram metric with buckets of powers of two, labels like 'op="Get"' are added to every
+/// series. Boundaries above all the values are omitted.
+void writePrometheusHistogram(
+    WriteBuffer & out, const String & metric, const String & labels, const LogLinearHistogram::Snapshot & snapshot);
+
 class AdvanceSummary : public Summary
 {
 public:
@@ -147,32 +131,63 @@ public:
     {
     }
 
-    void reset() override
-    {
-        count.store(0);
-        sum.store(0);
-        reservoir_sampler.reset();
-    }
+    void reset() override { histogram.reset(); }
 
-    void add(UInt64 value) override
-    {
-        count ++;
-        sum += value;
-        reservoir_sampler.update(value);
-    }
-
-    static double getValue(const std::vector<UInt64>& numbers, double quantile);
+    void add(UInt64 value) override { histogram.add(value); }
 
     Strings values() const override;
+    /// A histogram with buckets of powers of two, they can be added up across nodes
+    void writePrometheus(WriteBuffer & out, const String & prefix) const override;
 
 private:
     String name;
-    ReservoirSampler reservoir_sampler;
-    std::atomic<UInt64> count{0};
-    std::atomic<UInt64> sum{0};
+    LogLinearHistogram histogram;
+};
+
+/** Progress of the snapshot being created or loaded, shown by four letter command "snps". Phases are sequential,
+  * beginning a phase finishes the previous one, whose duration is added to its summary in Metrics. Counters are
+  * updated once per object by threads of the snapshot without lock, so they may be a bit inconsistent.
+  */
+class SnapshotProgress
+{
+public:
+    enum Phase : UInt8
+    {
+        IDLE = 0,
+        CREATE_DUMP, /// Pinning data tree and copying sessions and ACLs
+        CREATE_SERIALIZE, /// Writing objects, in a forked process or not
+        LOAD_VERIFY, /// Checking objects before loading
+        LOAD_PARSE,
+        LOAD_BUILD, /// Filling buckets and building children
+        PHASE_COUNT,
+    };
+
+    static const char * toString(Phase phase);
+
+    void begin(Phase phase_, UInt64 objects_total_ = 0);
+    void finish();
+
+    /// An object is done in current phase
+    void addObject(UInt64 object_bytes, UInt64 object_nodes);
+
+    /// key-value lines of current phase, throughput and the duration of the last run of every phase
+    String dump() const;
+
+    /// Duration of the last finished run of phase_
+    UInt64 getLastElapsedMs(Phase phase_) const { return last_elapsed_ms[phase_]; }
+
+private:
+    std::atomic<Phase> phase{IDLE};
+    std::atomic<UInt64> phase_start_ms{0};
+    std::atomic<UInt64> objects_total{0};
+    std::atomic<UInt64> objects{0};
+    std::atomic<UInt64> bytes{0};
+    std::atomic<UInt64> nodes{0};
+    std::array<std::atomic<UInt64>, PHASE_COUNT> last_elapsed_ms{};
 };
 
-/** Implements Summary Metrics for RK.
+/** Implements Summary Metrics for RK. Summaries are added to by threads of all connections and of the pipeline, so
+  * that they are sharded by thread and merged when read.
   * There is possible race-condition, but we don't need the stats to be extremely accurate.
   */
 class Metrics
@@ -187,6 +202,7 @@ public:
     }
 
     std::map<String, Strings> dumpMetricsValues() const;
+    void writePrometheus(WriteBuffer & out, const String & prefix) const;
 
     void reset()
     {
@@ -198,6 +214,8 @@ public:
     SummaryPtr log_replication_batch_size;
     SummaryPtr response_socket_send_size;
     SummaryPtr forward_response_socket_send_size;
+    /// User requests forwarded by a packet
+    SummaryPtr forward_batch_size;
     SummaryPtr apply_write_request_time_ms;
     SummaryPtr apply_read_request_time_ms;
     SummaryPtr read_latency;
@@ -205,6 +223,36 @@ public:
     SummaryPtr snap_time_ms;
     SummaryPtr snap_blocking_time_ms;
     SummaryPtr snap_count;
+    /// Duration of snapshot phases, see SnapshotProgress
+    SummaryPtr snap_dump_time_ms;
+    SummaryPtr snap_serialize_time_ms;
+    SummaryPtr snap_load_verify_time_ms;
+    SummaryPtr snap_load_parse_time_ms;
+    SummaryPtr snap_load_build_time_ms;
+    /// Per data object created, not counted when created in a forked process
+    SummaryPtr snap_object_bytes;
+    SummaryPtr snap_object_nodes;
+    /// Per object loaded
+    SummaryPtr snap_load_object_bytes;
+    SummaryPtr snap_load_object_nodes;
+    /// Per bucket of data tree when loading
+    SummaryPtr snap_load_fill_bucket_time_ms;
+    SummaryPtr snap_load_build_children_time_ms;
+    SummaryPtr log_cache_hit;
+    SummaryPtr log_cache_miss;
+    SummaryPtr log_fsync_group_entries;
+    SummaryPtr log_fsync_group_bytes;
+    /// Time of a log flush which persisted entries, load of the disk for LeaderBalancer
+    SummaryPtr log_fsync_time_us;
+    /// Sessions of a close request of dead sessions
+    SummaryPtr close_sessions_batch_size;
+    /// Watches rejected by max_watches_per_session
+    SummaryPtr throttled_watches;
+    /// Times reading from a connection is paused by max_session_in_flight_requests or max_session_request_bytes_per_second
+    SummaryPtr throttled_in_flight_requests;
+    SummaryPtr throttled_request_bytes;
+
+    SnapshotProgress snapshot_progress;
 
 private:
     Metrics();
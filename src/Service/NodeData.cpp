@@ -0,0 +1,244 @@
+#include <Service/NodeData.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <ZooKeeper/ZooKeeperIO.h>
+#include <Common/Exception.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+struct LargeValueSegment : private boost::noncopyable
+{
+    LargeValueSegment(int fd_, char * begin_, size_t capacity_) : fd(fd_), begin(begin_), capacity(capacity_) { }
+
+    ~LargeValueSegment()
+    {
+        ::munmap(begin, capacity);
+        ::close(fd);
+        auto & store = LargeValueStore::instance();
+        store.mapped_bytes.fetch_sub(capacity, std::memory_order_relaxed);
+        store.segments_count.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    const int fd;
+    char * const begin;
+    const size_t capacity;
+    /// Bytes written, guarded by the mutex of the store
+    size_t used = 0;
+};
+
+LargeValueStore & LargeValueStore::instance()
+{
+    /// Never destroyed, because values may be released by static objects at exit.
+    static auto * store = new LargeValueStore;
+    return *store;
+}
+
+void LargeValueStore::configure(const String & dir_, UInt64 threshold_, UInt64 segment_size_)
+{
+    std::lock_guard lock(mutex);
+    dir = dir_;
+    segment_size = std::max(segment_size_, UInt64(1));
+    threshold.store(threshold_, std::memory_order_relaxed);
+    current.reset();
+}
+
+std::shared_ptr<LargeValueSegment> LargeValueStore::createSegment(size_t size)
+{
+    auto * log = &Poco::Logger::get("LargeValueStore");
+
+    String path = dir + "/large_values_XXXXXX";
+    int fd = ::mkstemp(path.data());
+    if (fd < 0)
+    {
+        LOG_WARNING(log, "Can not create segment in {}, {}", dir, strerror(errno));
+        return nullptr;
+    }
+    /// The file lives as long as it is open and mapped
+    ::unlink(path.c_str());
+
+    size_t page_size = static_cast<size_t>(::getpagesize());
+    size_t capacity = (std::max(size, static_cast<size_t>(segment_size)) + page_size - 1) / page_size * page_size;
+
+    /// Blocks are allocated up front, writing a hole of a full disk by the mapping would be a SIGBUS
+#if defined(OS_LINUX)
+    int err = ::posix_fallocate(fd, 0, capacity);
+#else
+    int err = ::ftruncate(fd, capacity) == 0 ? 0 : errno;
+#endif
+    if (err != 0)
+    {
+        LOG_WARNING(log, "Can not allocate segment of {} bytes in {}, {}", capacity, dir, strerror(err));
+        ::close(fd);
+        return nullptr;
+    }
+
+    void * begin = ::mmap(nullptr, capacity, PROT_READ, MAP_SHARED, fd, 0);
+    if (begin == MAP_FAILED)
+    {
+        LOG_WARNING(log, "Can not map segment of {} bytes, {}", capacity, strerror(errno));
+        ::close(fd);
+        return nullptr;
+    }
+
+    mapped_bytes.fetch_add(capacity, std::memory_order_relaxed);
+    segments_count.fetch_add(1, std::memory_order_relaxed);
+    return std::make_shared<LargeValueSegment>(fd, static_cast<char *>(begin), capacity);
+}
+
+std::shared_ptr<const LargeValue> LargeValueStore::put(std::string_view value)
+{
+    std::lock_guard lock(mutex);
+
+    auto segment = current.lock();
+    if (!segment || segment->capacity - segment->used < value.size())
+    {
+        segment = createSegment(value.size());
+        if (!segment)
+            return nullptr;
+        current = segment;
+    }
+
+    /// Written by the file rather than the mapping, so that an error is returned instead of a signal
+    size_t offset = segment->used;
+    for (size_t written = 0; written < value.size();)
+    {
+        ssize_t res = ::pwrite(segment->fd, value.data() + written, value.size() - written, offset + written);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+        {
+            LOG_WARNING(&Poco::Logger::get("LargeValueStore"), "Can not write value of {} bytes, {}", value.size(), strerror(errno));
+            return nullptr;
+        }
+        written += static_cast<size_t>(res);
+    }
+    segment->used += value.size();
+
+    auto large = std::make_shared<LargeValue>();
+    large->segment = segment;
+    large->data = segment->begin + offset;
+    large->size = value.size();
+    large->mapped = true;
+    return large;
+}
+
+struct InternedValue : public SharedValue
+{
+    explicit InternedValue(std::string_view value_) : value(value_)
+    {
+        data = value.data();
+        size = value.size();
+    }
+
+    ~InternedValue() override { NodeDataInterner::instance().release(*this); }
+
+    const String value;
+};
+
+NodeDataInterner & NodeDataInterner::instance()
+{
+    /// Never destroyed, because values may be released by static objects at exit.
+    static auto * interner = new NodeDataInterner;
+    return *interner;
+}
+
+std::shared_ptr<const SharedValue> NodeDataInterner::intern(std::string_view value)
+{
+    if (!shouldIntern(value.size()))
+        return nullptr;
+
+    auto & shard = shardOf(value);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.values.find(value);
+    if (it != shard.values.end())
+    {
+        if (auto interned = it->second.lock())
+            return interned;
+        /// Released, but its destructor has not removed it yet, it will find the new value and keep it.
+        values_count.fetch_sub(1, std::memory_order_relaxed);
+        values_bytes.fetch_sub(it->first.size(), std::memory_order_relaxed);
+        shard.values.erase(it);
+    }
+
+    auto interned = std::make_shared<const InternedValue>(value);
+    shard.values.emplace(interned->value, interned);
+    values_count.fetch_add(1, std::memory_order_relaxed);
+    values_bytes.fetch_add(value.size(), std::memory_order_relaxed);
+    return interned;
+}
+
+void NodeDataInterner::release(const InternedValue & value)
+{
+    auto & shard = shardOf(value.value);
+    std::lock_guard lock(shard.mutex);
+
+    /// It may be replaced by an equal value interned after the release
+    auto it = shard.values.find(value.value);
+    if (it == shard.values.end() || !it->second.expired())
+        return;
+    values_count.fetch_sub(1, std::memory_order_relaxed);
+    values_bytes.fetch_sub(value.size, std::memory_order_relaxed);
+    shard.values.erase(it);
+}
+
+NodeData & NodeData::operator=(std::string_view value)
+{
+    UInt64 threshold = LargeValueStore::instance().getThreshold();
+    if (threshold && value.size() >= threshold)
+    {
+        if (auto stored = LargeValueStore::instance().put(value))
+        {
+            shared = std::move(stored);
+            String().swap(inline_data);
+            return *this;
+        }
+    }
+    else if (auto interned = NodeDataInterner::instance().intern(value))
+    {
+        shared = std::move(interned);
+        String().swap(inline_data);
+        return *this;
+    }
+    inline_data.assign(value.data(), value.size());
+    shared.reset();
+    return *this;
+}
+
+NodeData & NodeData::operator=(String && value)
+{
+    UInt64 threshold = LargeValueStore::instance().getThreshold();
+    if ((threshold && value.size() >= threshold) || NodeDataInterner::instance().shouldIntern(value.size()))
+        return *this = std::string_view(value);
+    inline_data = std::move(value);
+    shared.reset();
+    return *this;
+}
+
+}
+
+namespace Coordination
+{
+
+void write(const RK::NodeData & data, RK::WriteBuffer & out)
+{
+    write(static_cast<int32_t>(data.size()), out);
+    out.write(data.data(), data.size());
+}
+
+void read(RK::NodeData & data, RK::ReadBuffer & in)
+{
+    String value;
+    read(value, in);
+    data = std::move(value);
+}
+
+}
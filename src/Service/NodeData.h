@@ -0,0 +1,180 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <unordered_map>
+
+#include <Common/IO/ReadBuffer.h>
+#include <Common/IO/WriteBuffer.h>
+#include <boost/noncopyable.hpp>
+#include <common/types.h>
+
+namespace RK
+{
+
+struct LargeValueSegment;
+struct InternedValue;
+
+/// Immutable data of nodes referenced by handle, kept in LargeValueStore or NodeDataInterner.
+struct SharedValue
+{
+    virtual ~SharedValue() = default;
+
+    const char * data = nullptr;
+    size_t size = 0;
+    /// Whether kept in a segment of LargeValueStore
+    bool mapped = false;
+};
+
+/// Value of LargeValueStore, the segment is unmapped when no value of it is referenced.
+struct LargeValue : public SharedValue
+{
+    std::shared_ptr<const LargeValueSegment> segment;
+};
+
+/** Append-only store of large node data out of the heap. Values are written to segment files which are memory mapped,
+  * so their pages are read lazily and the kernel may evict them under memory pressure without swap, while the heap
+  * only holds small data and metadata of nodes.
+  *
+  * Segment files are unlinked as soon as they are created, they back memory and persist nothing: data is persisted by
+  * log and snapshots as before, and the store is filled again when a snapshot is loaded. A segment is released when
+  * all of its values are, space of a value replaced while others of its segment are alive is not reused.
+  */
+class LargeValueStore : private boost::noncopyable
+{
+public:
+    static constexpr UInt64 DEFAULT_SEGMENT_SIZE = 64 * 1024 * 1024;
+
+    static LargeValueStore & instance();
+
+    /// Data of at least threshold bytes is put in segments of segment_size bytes in dir, 0 disables the store.
+    /// Values already stored stay valid.
+    void configure(const String & dir_, UInt64 threshold_, UInt64 segment_size_ = DEFAULT_SEGMENT_SIZE);
+
+    UInt64 getThreshold() const { return threshold.load(std::memory_order_relaxed); }
+
+    /// Copy of value in the store, nullptr if it can not be stored, for example the disk is full, then the caller
+    /// keeps the value in the heap.
+    std::shared_ptr<const LargeValue> put(std::string_view value);
+
+    /// Bytes of segments mapped, with the space of released values in them
+    UInt64 getMappedBytes() const { return mapped_bytes.load(std::memory_order_relaxed); }
+    UInt64 getSegmentsCount() const { return segments_count.load(std::memory_order_relaxed); }
+
+private:
+    friend struct LargeValueSegment;
+
+    LargeValueStore() = default;
+
+    /// Segment of at least size bytes, nullptr if it can not be created
+    std::shared_ptr<LargeValueSegment> createSegment(size_t size);
+
+    std::mutex mutex;
+    String dir;
+    std::atomic<UInt64> threshold{0};
+    UInt64 segment_size = DEFAULT_SEGMENT_SIZE;
+    /// Segment values are appended to, it is released as others when none of its values is referenced
+    std::weak_ptr<LargeValueSegment> current;
+
+    std::atomic<UInt64> mapped_bytes{0};
+    std::atomic<UInt64> segments_count{0};
+};
+
+/** Interns node data, so that nodes with the same data, e.g. the same config or a common marker value of many
+  * znodes, share a single copy of it. Values are refcounted and looked up by content, a value is removed when the
+  * last node with it changes or is removed.
+  *
+  * Data shorter than MIN_INTERNED_SIZE is not interned, it fits in the string itself without any heap allocation.
+  */
+class NodeDataInterner : private boost::noncopyable
+{
+public:
+    static constexpr size_t MIN_INTERNED_SIZE = sizeof(String);
+
+    static NodeDataInterner & instance();
+
+    /// Data of at most max_size bytes is interned, 0 disables it. Values already interned stay valid.
+    void configure(UInt64 max_size_) { max_size.store(max_size_, std::memory_order_relaxed); }
+
+    bool shouldIntern(size_t size) const
+    {
+        return size >= MIN_INTERNED_SIZE && size <= max_size.load(std::memory_order_relaxed);
+    }
+
+    /// Value equal to value, shared with other nodes if there is one, nullptr if it should not be interned
+    std::shared_ptr<const SharedValue> intern(std::string_view value);
+
+    /// Count and total bytes of the distinct values
+    UInt64 getValuesCount() const { return values_count.load(std::memory_order_relaxed); }
+    UInt64 getValuesBytes() const { return values_bytes.load(std::memory_order_relaxed); }
+
+private:
+    friend struct InternedValue;
+
+    static constexpr size_t SHARDS_COUNT = 16;
+
+    struct Shard
+    {
+        std::mutex mutex;
+        /// Keys point into the values, an entry is removed by the destructor of its value
+        std::unordered_map<std::string_view, std::weak_ptr<const InternedValue>> values;
+    };
+
+    NodeDataInterner() = default;
+
+    Shard & shardOf(std::string_view value) { return shards[std::hash<std::string_view>{}(value) % SHARDS_COUNT]; }
+
+    /// Called when the last reference of value is released
+    void release(const InternedValue & value);
+
+    std::atomic<UInt64> max_size{0};
+    std::array<Shard, SHARDS_COUNT> shards;
+
+    std::atomic<UInt64> values_count{0};
+    std::atomic<UInt64> values_bytes{0};
+};
+
+/** Data of a node. Data smaller than the threshold of LargeValueStore is kept in a string, larger one in the store and
+  * referenced by handle, so copies of a node for snapshot or for undo of a multi request do not copy it. Data which
+  * NodeDataInterner interns is referenced by handle as well.
+  */
+class NodeData
+{
+public:
+    NodeData() = default;
+
+    NodeData & operator=(std::string_view value);
+    NodeData & operator=(const char * value) { return *this = std::string_view(value); }
+    NodeData & operator=(String && value);
+
+    const char * data() const { return shared ? shared->data : inline_data.data(); }
+    size_t size() const { return shared ? shared->size : inline_data.size(); }
+    bool empty() const { return size() == 0; }
+    std::string_view view() const { return {data(), size()}; }
+
+    /// Whether the data is kept in LargeValueStore
+    bool isLarge() const { return shared && shared->mapped; }
+    /// Whether the data is interned by NodeDataInterner
+    bool isInterned() const { return shared && !shared->mapped; }
+
+    bool operator==(const NodeData & rhs) const { return view() == rhs.view(); }
+    bool operator==(std::string_view rhs) const { return view() == rhs; }
+
+private:
+    String inline_data;
+    std::shared_ptr<const SharedValue> shared;
+};
+
+}
+
+namespace Coordination
+{
+
+/// Same with the string of the data
+void write(const RK::NodeData & data, RK::WriteBuffer & out);
+void read(RK::NodeData & data, RK::ReadBuffer & in);
+
+}
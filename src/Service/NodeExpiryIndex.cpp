@@ -0,0 +1,119 @@
+#include <Service/NodeExpiryIndex.h>
+
+#include <algorithm>
+
+namespace RK
+{
+
+NodeExpiryIndex::NodeExpiryIndex(int64_t interval_ms_) : interval_ms(std::max(interval_ms_, int64_t(1))), slots(WHEEL_SLOTS)
+{
+}
+
+void NodeExpiryIndex::addEntryLocked(const String & path, int64_t deadline_ms)
+{
+    int64_t interval = std::max(intervalOf(deadline_ms), checked_interval + 1);
+    slotOf(interval).push_back({path, deadline_ms});
+}
+
+void NodeExpiryIndex::addTTLNode(const String & path, int64_t deadline_ms)
+{
+    std::lock_guard lock(mutex);
+    auto [it, inserted] = ttl_deadlines.try_emplace(path, deadline_ms);
+    if (!inserted)
+    {
+        if (it->second == deadline_ms)
+            return;
+        it->second = deadline_ms;
+    }
+    addEntryLocked(path, deadline_ms);
+}
+
+void NodeExpiryIndex::addEmptyContainer(const String & path)
+{
+    std::lock_guard lock(mutex);
+    empty_containers.try_emplace(path, 0);
+}
+
+void NodeExpiryIndex::remove(const String & path)
+{
+    std::lock_guard lock(mutex);
+    ttl_deadlines.erase(path);
+    empty_containers.erase(path);
+}
+
+Strings NodeExpiryIndex::collect(int64_t now_ms, size_t max_count, int64_t retry_ms)
+{
+    std::lock_guard lock(mutex);
+    Strings result;
+
+    /// Check again after the intervals being checked
+    int64_t retry_deadline_ms = std::max(now_ms + retry_ms, (intervalOf(now_ms) + 1) * interval_ms);
+
+    for (auto it = empty_containers.begin(); it != empty_containers.end() && result.size() < max_count; ++it)
+    {
+        if (it->second > now_ms)
+            continue;
+        result.push_back(it->first);
+        it->second = retry_deadline_ms;
+    }
+
+    /// A turn of the wheel checks all the slots
+    int64_t now_interval = intervalOf(now_ms);
+    int64_t first_interval = std::max(checked_interval + 1, now_interval - static_cast<int64_t>(WHEEL_SLOTS) + 1);
+    std::vector<Entry> retried;
+    for (int64_t interval = first_interval; interval <= now_interval && result.size() < max_count; ++interval)
+    {
+        std::vector<Entry> entries;
+        entries.swap(slotOf(interval));
+        auto & slot = slotOf(interval);
+        for (auto & entry : entries)
+        {
+            auto deadline_it = ttl_deadlines.find(entry.path);
+            if (deadline_it == ttl_deadlines.end() || deadline_it->second != entry.deadline_ms)
+                continue;
+
+            if (entry.deadline_ms > now_ms || result.size() >= max_count)
+            {
+                slot.push_back(std::move(entry));
+                continue;
+            }
+
+            result.push_back(entry.path);
+            deadline_it->second = retry_deadline_ms;
+            retried.push_back({std::move(entry.path), retry_deadline_ms});
+        }
+
+        /// Entries left because of max_count are collected next time
+        if (result.size() < max_count)
+            checked_interval = interval;
+    }
+
+    for (auto & entry : retried)
+        addEntryLocked(entry.path, entry.deadline_ms);
+
+    return result;
+}
+
+size_t NodeExpiryIndex::ttlNodesCount() const
+{
+    std::lock_guard lock(mutex);
+    return ttl_deadlines.size();
+}
+
+size_t NodeExpiryIndex::emptyContainersCount() const
+{
+    std::lock_guard lock(mutex);
+    return empty_containers.size();
+}
+
+void NodeExpiryIndex::clear()
+{
+    std::lock_guard lock(mutex);
+    ttl_deadlines.clear();
+    for (auto & slot : slots)
+        slot.clear();
+    checked_interval = -1;
+    empty_containers.clear();
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <limits>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <common/types.h>
+
+namespace RK
+{
+
+/// As in ZooKeeper, container and TTL nodes are told by special ephemeral owners, so that snapshot needs no more fields.
+/// The owner of a TTL node is TTL_OWNER_MASK | ttl, session ids are counters which never reach them.
+static constexpr int64_t CONTAINER_OWNER = std::numeric_limits<int64_t>::min();
+static constexpr int64_t TTL_OWNER_MASK = static_cast<int64_t>(0xFF00000000000000ULL);
+static constexpr int64_t MAX_TTL_MS = 0x000000FFFFFFFFFF;
+
+inline bool isContainerOwner(int64_t owner) { return owner == CONTAINER_OWNER; }
+inline bool isTTLOwner(int64_t owner) { return (owner & TTL_OWNER_MASK) == TTL_OWNER_MASK; }
+inline int64_t ttlOfOwner(int64_t owner) { return owner & MAX_TTL_MS; }
+/// Owned by a session, so removed when the session is closed
+inline bool isEphemeralOwner(int64_t owner) { return owner != 0 && !isContainerOwner(owner) && !isTTLOwner(owner); }
+
+/** Nodes which may expire: TTL nodes by their deadlines in a timing wheel, and containers which had children and have
+  * none now in a set. It is kept on every node as requests are applied, so a new leader knows them, and only the leader
+  * collects them to propose their removal. A collected node may be not expired any more, for example a child was
+  * created in the meantime, it is checked again when the removal is applied.
+  *
+  * Deadlines are not removed from the wheel, a path keeps its last deadline in a map and entries with other deadlines
+  * are dropped when their slot is checked. So a collection costs the nodes expired and stale entries, not all of them.
+  */
+class NodeExpiryIndex
+{
+public:
+    explicit NodeExpiryIndex(int64_t interval_ms_ = 1000);
+
+    NodeExpiryIndex(const NodeExpiryIndex &) = delete;
+    NodeExpiryIndex & operator=(const NodeExpiryIndex &) = delete;
+
+    /// TTL node without children expires at deadline_ms, a later call for the path moves it
+    void addTTLNode(const String & path, int64_t deadline_ms);
+
+    /// Container which had children and has none now
+    void addEmptyContainer(const String & path);
+
+    /// Node removed, got a child or is not expiring any more
+    void remove(const String & path);
+
+    /// At most max_count nodes which may be expired at now_ms. They stay in the index and are collected again after
+    /// retry_ms, in case the removal proposed for them is lost, until they are removed.
+    Strings collect(int64_t now_ms, size_t max_count, int64_t retry_ms);
+
+    size_t ttlNodesCount() const;
+    size_t emptyContainersCount() const;
+
+    void clear();
+
+private:
+    static constexpr size_t WHEEL_SLOTS = 4096;
+
+    struct Entry
+    {
+        String path;
+        int64_t deadline_ms;
+    };
+
+    int64_t intervalOf(int64_t time_ms) const { return time_ms / interval_ms; }
+    std::vector<Entry> & slotOf(int64_t interval) { return slots[static_cast<size_t>(interval) % WHEEL_SLOTS]; }
+
+    /// Put an entry into the slot of its deadline, or of the next check if the interval of the deadline is checked
+    void addEntryLocked(const String & path, int64_t deadline_ms);
+
+    mutable std::mutex mutex;
+
+    const int64_t interval_ms;
+
+    /// Path of TTL node -> its deadline
+    std::unordered_map<String, int64_t> ttl_deadlines;
+
+    /// A slot holds entries whose deadline intervals modulo WHEEL_SLOTS is the slot index
+    std::vector<std::vector<Entry>> slots;
+
+    /// Intervals up to it are checked, -1 if none is
+    int64_t checked_interval = -1;
+
+    /// Path of empty container -> the earliest time to collect it
+    std::unordered_map<String, int64_t> empty_containers;
+};
+
+}
@@ -1,58 +1,141 @@
 #include <memory>
+#include <thread>
 #include <unistd.h>
 #include <Service/LogEntry.h>
+#include <Service/Metrics.h>
 #include <Service/NuRaftFileLogStore.h>
+#include <Service/ThreadPlacement.h>
+#include <Common/Stopwatch.h>
 #include <Common/setThreadName.h>
 
 namespace RK
 {
 using namespace nuraft;
 
-ptr<log_entry> LogEntryQueue::getEntry(const UInt64 & index)
+LogEntryQueue::LogEntryQueue(UInt64 max_entries_, UInt64 max_bytes_)
+    : max_entries(max_entries_), max_bytes(max_bytes_), log(&(Poco::Logger::get("LogEntryQueue")))
 {
-    std::shared_lock read_lock(queue_mutex);
+    if (max_entries == 0)
+        return;
 
-    /// match index
-    if (index > max_index || max_index - index >= MAX_VECTOR_SIZE)
-        return nullptr;
+    /// One more for the log put before evicting the oldest one
+    UInt64 capacity = 1;
+    while (capacity < max_entries + 1)
+        capacity <<= 1;
+    slots = std::make_unique<Slot[]>(capacity);
+    mask = capacity - 1;
+}
 
-    /// match cycle
-    if (index >> BIT_SIZE == batch_index || index >> BIT_SIZE == batch_index - 1)
-        return entry_vec[index & (MAX_VECTOR_SIZE - 1)];
+ptr<log_entry> LogEntryQueue::getEntry(UInt64 index)
+{
+    if (!slots || index == 0)
+        return nullptr;
 
-    return nullptr;
+    Slot & slot = slotOf(index);
+    /// Sequentially consistent with setSlot, so either the writer sees the reader or the reader sees the slot emptied.
+    slot.readers.fetch_add(1, std::memory_order_seq_cst);
+    ptr<log_entry> entry;
+    if (slot.index.load(std::memory_order_seq_cst) == index)
+        entry = slot.entry;
+    slot.readers.fetch_sub(1, std::memory_order_release);
+    return entry;
 }
 
-void LogEntryQueue::putEntry(UInt64 & index, ptr<log_entry> & entry)
+void LogEntryQueue::setSlot(UInt64 index, const ptr<log_entry> & entry)
 {
-    LOG_TRACE(log, "put entry {}, index {}, batch {}", index, index & (MAX_VECTOR_SIZE - 1), batch_index);
-    std::lock_guard write_lock(queue_mutex);
-    entry_vec[index & (MAX_VECTOR_SIZE - 1)] = entry;
-    batch_index = std::max(batch_index, index >> BIT_SIZE);
-    max_index = std::max(max_index, index);
+    Slot & slot = slotOf(index);
+    slot.index.store(0, std::memory_order_seq_cst);
+    while (slot.readers.load(std::memory_order_seq_cst) != 0)
+        std::this_thread::yield();
+
+    slot.entry = entry;
+    if (entry)
+        slot.index.store(index, std::memory_order_release);
 }
 
-[[maybe_unused]] void LogEntryQueue::putEntryOrClear(UInt64 & index, ptr<log_entry> & entry)
+void LogEntryQueue::putEntry(UInt64 index, const ptr<log_entry> & entry)
 {
-    std::lock_guard write_lock(queue_mutex);
-    if (index >> BIT_SIZE == batch_index || index >> BIT_SIZE == batch_index - 1)
-    {
-        entry_vec[index & (MAX_VECTOR_SIZE - 1)] = entry;
-        max_index = index;
+    if (max_entries == 0)
         return;
+
+    std::lock_guard write_lock(write_mutex);
+    UInt64 first = first_index.load(std::memory_order_relaxed);
+    UInt64 size = count.load(std::memory_order_relaxed);
+    LOG_TRACE(log, "put entry {}, first index {}, size {}", index, first, size);
+
+    /// Drop overwritten logs and the ones after them, or all if it is not contiguous
+    if (size && index >= first && index < first + size)
+    {
+        while (first + count.load(std::memory_order_relaxed) > index)
+            popBack();
     }
-    /// next cycle
-    clear();
+    else if (size && index != first + size)
+        clearUnlocked();
+
+    if (count.load(std::memory_order_relaxed) == 0)
+        first_index.store(index, std::memory_order_relaxed);
+    setSlot(index, entry);
+    total_bytes.fetch_add(entryBytes(entry), std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+
+    /// Keep the last one even if it is larger than max_bytes
+    while (count.load(std::memory_order_relaxed) > 1
+           && (count.load(std::memory_order_relaxed) > max_entries || total_bytes.load(std::memory_order_relaxed) > max_bytes))
+        popFront();
+}
+
+void LogEntryQueue::popFront()
+{
+    UInt64 first = first_index.load(std::memory_order_relaxed);
+    total_bytes.fetch_sub(entryBytes(slotOf(first).entry), std::memory_order_relaxed);
+    setSlot(first, nullptr);
+    first_index.store(first + 1, std::memory_order_relaxed);
+    count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LogEntryQueue::popBack()
+{
+    UInt64 last = first_index.load(std::memory_order_relaxed) + count.load(std::memory_order_relaxed) - 1;
+    total_bytes.fetch_sub(entryBytes(slotOf(last).entry), std::memory_order_relaxed);
+    setSlot(last, nullptr);
+    count.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void LogEntryQueue::removeUntil(UInt64 index)
+{
+    std::lock_guard write_lock(write_mutex);
+    while (count.load(std::memory_order_relaxed) && first_index.load(std::memory_order_relaxed) <= index)
+        popFront();
 }
 
 void LogEntryQueue::clear()
 {
     LOG_INFO(log, "clear log queue.");
-    std::lock_guard write_lock(queue_mutex);
-    batch_index = 0;
-    max_index = 0;
-    for (auto & i : entry_vec)
-        i = nullptr;
+    std::lock_guard write_lock(write_mutex);
+    clearUnlocked();
+}
+
+void LogEntryQueue::clearUnlocked()
+{
+    while (count.load(std::memory_order_relaxed))
+        popBack();
+    first_index.store(0, std::memory_order_relaxed);
+}
+
+size_t LogEntryQueue::size() const
+{
+    return count.load(std::memory_order_relaxed);
+}
+
+size_t LogEntryQueue::bytes() const
+{
+    return total_bytes.load(std::memory_order_relaxed);
+}
+
+UInt64 LogEntryQueue::firstIndex() const
+{
+    /// The pair may be torn by a concurrent write, which is fine for choosing between cache and disk
+    return count.load(std::memory_order_relaxed) ? first_index.load(std::memory_order_relaxed) : 0;
 }
 
 NuRaftFileLogStore::NuRaftFileLogStore(
@@ -61,23 +144,55 @@ NuRaftFileLogStore::NuRaftFileLogStore(
     FsyncMode log_fsync_mode_,
     UInt64 log_fsync_interval_,
     UInt32 max_log_size_,
-    UInt32 max_segment_count_)
-    : log_fsync_mode(log_fsync_mode_), log_fsync_interval(log_fsync_interval_)
+    UInt32 max_segment_count_,
+    bool log_io_uring_,
+    bool log_preallocate_,
+    bool log_direct_io_,
+    UInt64 log_cache_max_entries_,
+    UInt64 log_cache_max_bytes_,
+    bool log_compression_,
+    const String & log_cold_dir_,
+    UInt64 reserved_log_items_,
+    UInt64 log_fsync_bytes_,
+    UInt64 log_fsync_interval_us_,
+    ptr<ILogStorage> log_storage_)
+    : log_queue(log_cache_max_entries_, log_cache_max_bytes_)
+    , log_fsync_mode(log_fsync_mode_)
+    , log_fsync_interval(log_fsync_interval_)
+    , reserved_log_items(reserved_log_items_)
+    , log_fsync_bytes(log_fsync_bytes_)
+    , log_fsync_interval_us(log_fsync_interval_us_)
 {
     log = &(Poco::Logger::get("FileLogStore"));
 
+    int ret = 0;
+    if (log_storage_)
+    {
+        log_storage = std::move(log_storage_);
+    }
+    else
+    {
+        auto segment_store = LogSegmentStore::getInstance(log_dir, force_new);
+        ret = segment_store->init(
+            max_log_size_, max_segment_count_, log_io_uring_, log_preallocate_, log_direct_io_, log_compression_, log_cold_dir_);
+        log_storage = segment_store;
+    }
+
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
     {
         parallel_fsync_event = std::make_shared<Poco::Event>();
+        async_fsync = log_storage->hasIOUring();
 
         fsync_thread = ThreadFromGlobalPool([this] { fsyncThread(); });
     }
+    else if (log_fsync_mode == FsyncMode::FSYNC_GROUP && log_fsync_interval_us)
+    {
+        fsync_thread = ThreadFromGlobalPool([this] { groupFsyncThread(); });
+    }
 
-    segment_store = LogSegmentStore::getInstance(log_dir, force_new);
-
-    if (segment_store->init(max_log_size_, max_segment_count_) >= 0)
+    if (ret >= 0)
     {
-        LOG_INFO(log, "Init file log store, last log index {}, log dir {}", segment_store->lastLogIndex(), log_dir);
+        LOG_INFO(log, "Init file log store, last log index {}, log dir {}", log_storage->lastLogIndex(), log_dir);
     }
     else
     {
@@ -85,13 +200,13 @@ NuRaftFileLogStore::NuRaftFileLogStore(
         return;
     }
 
-    if (segment_store->lastLogIndex() < 1)
+    if (log_storage->lastLogIndex() < 1)
         /// no log entry exists, return a dummy constant entry with value set to null and term set to  zero
         last_log_entry = cs_new<log_entry>(0, nuraft::buffer::alloc(0));
     else
-        last_log_entry = segment_store->getEntry(segment_store->lastLogIndex());
+        last_log_entry = log_storage->getEntry(log_storage->lastLogIndex());
 
-    disk_last_durable_index = segment_store->lastLogIndex();
+    disk_last_durable_index = log_storage->lastLogIndex();
 }
 
 void NuRaftFileLogStore::shutdown()
@@ -104,8 +219,20 @@ void NuRaftFileLogStore::shutdown()
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
     {
         parallel_fsync_event->set();
+        if (async_fsync)
+            log_storage->wakeUp();
+        if (fsync_thread.joinable())
+            fsync_thread.join();
+    }
+    else if (log_fsync_mode == FsyncMode::FSYNC_GROUP)
+    {
+        {
+            std::lock_guard lock(group_mutex);
+            group_cv.notify_all();
+        }
         if (fsync_thread.joinable())
             fsync_thread.join();
+        flushGroup();
     }
 }
 
@@ -117,31 +244,106 @@ NuRaftFileLogStore::~NuRaftFileLogStore()
 void NuRaftFileLogStore::fsyncThread()
 {
     setThreadName("LogFsync");
+    ThreadPlacement::instance().apply(ThreadClass::LOG_FSYNC);
 
     while (!shutdown_called)
     {
-        parallel_fsync_event->wait();
+        UInt64 last_flush_index;
+        if (async_fsync)
+        {
+            last_flush_index = log_storage->waitDurable();
+            if (last_flush_index == disk_last_durable_index)
+                continue;
+        }
+        else
+        {
+            parallel_fsync_event->wait();
+            last_flush_index = log_storage->flush();
+        }
 
-        UInt64 last_flush_index = segment_store->flush();
         if (last_flush_index)
         {
             disk_last_durable_index = last_flush_index;
             if (raft_instance) /// For test
                 raft_instance->notify_log_append_completion(true);
+            onFlushed(last_flush_index);
         }
     }
 
     LOG_INFO(log, "shutdown background raft log fsync thread.");
 }
 
+void NuRaftFileLogStore::groupFsyncThread()
+{
+    setThreadName("LogGroupFsync");
+    ThreadPlacement::instance().apply(ThreadClass::LOG_FSYNC);
+
+    std::unique_lock lock(group_mutex);
+    while (!shutdown_called)
+    {
+        if (!group_start_us)
+        {
+            group_cv.wait(lock);
+            continue;
+        }
+
+        UInt64 deadline = group_start_us + log_fsync_interval_us;
+        UInt64 now = clock_gettime_ns() / 1000;
+        if (now < deadline)
+        {
+            group_cv.wait_for(lock, std::chrono::microseconds(deadline - now));
+            continue;
+        }
+
+        lock.unlock();
+        flushGroup();
+        lock.lock();
+    }
+
+    LOG_INFO(log, "shutdown background raft log group fsync thread.");
+}
+
+void NuRaftFileLogStore::flushGroup()
+{
+    UInt64 count;
+    UInt64 bytes;
+    {
+        std::lock_guard lock(group_mutex);
+        if (!group_start_us)
+            return;
+        count = to_flush_count;
+        bytes = to_flush_bytes;
+        to_flush_count = 0;
+        to_flush_bytes = 0;
+        group_start_us = 0;
+    }
+
+    flush();
+    Metrics::getMetrics().log_fsync_group_entries->add(count);
+    Metrics::getMetrics().log_fsync_group_bytes->add(bytes);
+}
+
+void NuRaftFileLogStore::requestParallelFsync()
+{
+    /// Submit the write and fdatasync here, fsync thread waits for them
+    if (async_fsync)
+    {
+        if (log_storage->submitPending() != 0)
+            LOG_WARNING(log, "Fail to submit log write and fdatasync, retry with the next batch");
+        return;
+    }
+
+    parallel_fsync_event->set();
+}
+
 ulong NuRaftFileLogStore::next_slot() const
 {
-    return segment_store->lastLogIndex() + 1;
+    return log_storage->lastLogIndex() + 1;
 }
 
 ulong NuRaftFileLogStore::start_index() const
 {
-    return segment_store->firstLogIndex();
+    return log_storage->firstLogIndex();
 }
 
 ptr<log_entry> NuRaftFileLogStore::last_entry() const
@@ -155,27 +357,32 @@ ptr<log_entry> NuRaftFileLogStore::last_entry() const
 ulong NuRaftFileLogStore::append(ptr<log_entry> & entry)
 {
     ptr<log_entry> clone = makeClone(entry);
-    UInt64 log_index = segment_store->appendEntry(entry);
+    /// Entries of a batch are written together in end_of_append_batch, others right now.
+    UInt64 log_index = log_storage->appendEntry(entry, /* deferred */ entry->get_val_type() == log_val_type::app_log);
     log_queue.putEntry(log_index, clone);
 
     last_log_entry = clone;
+    appended_bytes += entry->get_buf().size();
 
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL && entry->get_val_type() != log_val_type::app_log)
-        parallel_fsync_event->set();
+        requestParallelFsync();
 
     return log_index;
 }
 
 void NuRaftFileLogStore::write_at(ulong index, ptr<log_entry> & entry)
 {
-    if (segment_store->writeAt(index, entry) == index)
+    if (log_storage->writeAt(index, entry) == index)
+        log_queue.putEntry(index, makeClone(entry));
+    else
         log_queue.clear();
 
     last_log_entry = entry;
+    appended_bytes += entry->get_buf().size();
 
     /// notify parallel fsync thread
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL && entry->get_val_type() != log_val_type::app_log)
-        parallel_fsync_event->set();
+        requestParallelFsync();
 
     LOG_DEBUG(log, "write entry at {}", index);
 }
@@ -186,10 +393,16 @@ void NuRaftFileLogStore::end_of_append_batch(ulong start, ulong cnt)
 
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
     {
-        parallel_fsync_event->set();
+        /// Group commit, one write for all entries of the batch. With io_uring it is submitted with fdatasync.
+        if (!async_fsync && log_storage->writePending() != 0)
+            LOG_WARNING(log, "Fail to write log entries from {}, count {}, retry when flushing", start, cnt);
+        requestParallelFsync();
     }
     else if (log_fsync_mode == FsyncMode::FSYNC_BATCH)
     {
+        if (log_storage->writePending() != 0)
+            LOG_WARNING(log, "Fail to write log entries from {}, count {}, retry when flushing", start, cnt);
+
         to_flush_count += cnt;
         if (to_flush_count >= log_fsync_interval)
         {
@@ -197,6 +410,29 @@ void NuRaftFileLogStore::end_of_append_batch(ulong start, ulong cnt)
             flush();
         }
     }
+    else if (log_fsync_mode == FsyncMode::FSYNC_GROUP)
+    {
+        if (log_storage->writePending() != 0)
+            LOG_WARNING(log, "Fail to write log entries from {}, count {}, retry when flushing", start, cnt);
+
+        /// Flush now if the group reaches count or bytes limit, time limit is checked by fsync thread
+        bool group_full;
+        {
+            std::lock_guard lock(group_mutex);
+            if (!group_start_us)
+            {
+                group_start_us = clock_gettime_ns() / 1000;
+                group_cv.notify_all();
+            }
+            to_flush_count += cnt;
+            to_flush_bytes += appended_bytes;
+            group_full = to_flush_count >= log_fsync_interval || (log_fsync_bytes && to_flush_bytes >= log_fsync_bytes);
+        }
+        appended_bytes = 0;
+
+        if (group_full)
+            flushGroup();
+    }
     else if (log_fsync_mode == FsyncMode::FSYNC)
     {
         flush();
@@ -217,19 +453,41 @@ ptr<std::vector<ptr<log_entry>>> NuRaftFileLogStore::log_entries(ulong start, ul
 ptr<std::vector<ptr<log_entry>>> NuRaftFileLogStore::log_entries_ext(ulong start, ulong end, int64 batch_size_hint_in_bytes)
 {
     ptr<std::vector<ptr<log_entry>>> ret = cs_new<std::vector<ptr<log_entry>>>();
+    if (start >= end)
+        return ret;
+
+    auto max_bytes = static_cast<int64>(max_append_bytes.load(std::memory_order_relaxed));
+    if (max_bytes > 0 && (batch_size_hint_in_bytes <= 0 || batch_size_hint_in_bytes > max_bytes))
+        batch_size_hint_in_bytes = max_bytes;
+
+    /// Logs older than the queue, which a lagging follower asks for, are read from segments in large sequential reads
+    UInt64 cached_start = log_queue.firstIndex();
+    UInt64 disk_end = (cached_start == 0 || cached_start > end) ? end : std::max<UInt64>(start, cached_start);
+    if (start < disk_end)
+    {
+        log_storage->getEntriesExt(start, disk_end - 1, batch_size_hint_in_bytes, ret);
+        Metrics::getMetrics().log_cache_miss->add(ret->size());
+    }
+
     int64 get_size = 0;
-    int64 entry_size;
-    for (auto i = start; i < end; i++)
+    for (const auto & entry : *ret)
+        get_size += NuRaftLogSegment::getBatchSize(entry);
+
+    if (ret->size() == disk_end - start)
     {
-        auto entry_ptr = entry_at(i);
-        entry_size = entry_ptr->get_buf().size() + sizeof(ulong) + sizeof(char);
-        if (batch_size_hint_in_bytes > 0 && get_size + entry_size > batch_size_hint_in_bytes)
+        for (auto i = disk_end; i < end; i++)
         {
-            break;
+            auto entry_ptr = entry_at(i);
+            if (!entry_ptr)
+                break;
+            int64 entry_size = NuRaftLogSegment::getBatchSize(entry_ptr);
+            if (batch_size_hint_in_bytes > 0 && get_size + entry_size > batch_size_hint_in_bytes && !ret->empty())
+                break;
+            ret->push_back(entry_ptr);
+            get_size += entry_size;
         }
-        ret->push_back(entry_ptr);
-        get_size += entry_size;
     }
+
     LOG_DEBUG(log, "log entries ext, start {} end {}, real size {}, max size {}", start, end, get_size, batch_size_hint_in_bytes);
     return ret;
 }
@@ -237,20 +495,10 @@ ptr<std::vector<ptr<log_entry>>> NuRaftFileLogStore::log_entries_ext(ulong start
 ptr<std::vector<VersionLogEntry>> NuRaftFileLogStore::log_entries_version_ext(ulong start, ulong end, int64 batch_size_hint_in_bytes)
 {
     ptr<std::vector<VersionLogEntry>> ret = cs_new<std::vector<VersionLogEntry>>();
-    int64 get_size = 0;
-    int64 entry_size;
-    for (auto i = start; i < end; i++)
-    {
-        auto entry_ptr = entry_at(i);
-        entry_size = entry_ptr->get_buf().size() + sizeof(ulong) + sizeof(char);
-        if (batch_size_hint_in_bytes > 0 && get_size + entry_size > batch_size_hint_in_bytes)
-        {
-            break;
-        }
-        ret->push_back({segment_store->getVersion(i), entry_ptr});
-        get_size += entry_size;
-    }
-    LOG_DEBUG(log, "log entries ext, start {} end {}, real size {}, max size {}", start, end, get_size, batch_size_hint_in_bytes);
+    auto entries = log_entries_ext(start, end, batch_size_hint_in_bytes);
+    ret->reserve(entries->size());
+    for (size_t i = 0; i < entries->size(); i++)
+        ret->push_back({log_storage->getVersion(start + i), (*entries)[i]});
     return ret;
 }
 
@@ -260,21 +508,21 @@ ptr<log_entry> NuRaftFileLogStore::entry_at(ulong index)
     if (res)
     {
         LOG_TRACE(log, "Get log {} from queue", index);
+        Metrics::getMetrics().log_cache_hit->add(1);
     }
     else
     {
         LOG_TRACE(log, "Get log {} from disk", index);
-        res = segment_store->getEntry(index);
+        Metrics::getMetrics().log_cache_miss->add(1);
+        res = log_storage->getEntry(index);
     }
     return res ? makeClone(res) : nullptr;
 }
 
 ulong NuRaftFileLogStore::term_at(ulong index)
 {
-    if (entry_at(index))
-        return entry_at(index)->get_term();
-    else
-        return 0;
+    auto entry = entry_at(index);
+    return entry ? entry->get_term() : 0;
 }
 
 ptr<buffer> NuRaftFileLogStore::pack(ulong index, int32 cnt)
@@ -319,13 +567,13 @@ void NuRaftFileLogStore::apply_pack(ulong index, buffer & pack)
         ptr<buffer> buf_local = buffer::alloc(buf_size);
         pack.get(buf_local);
 
-        if (cur_idx - segment_store->lastLogIndex() != 1)
-            LOG_WARNING(log, "cur_idx {}, segment_store last_log_index {}, difference is not 1", cur_idx, segment_store->lastLogIndex());
+        if (cur_idx - log_storage->lastLogIndex() != 1)
+            LOG_WARNING(log, "cur_idx {}, log_storage last_log_index {}, difference is not 1", cur_idx, log_storage->lastLogIndex());
         else
-            LOG_DEBUG(log, "cur_idx {}, segment_store last_log_index {}", cur_idx, segment_store->lastLogIndex());
+            LOG_DEBUG(log, "cur_idx {}, log_storage last_log_index {}", cur_idx, log_storage->lastLogIndex());
 
         ptr<log_entry> le = log_entry::deserialize(*buf_local);
-        segment_store->writeAt(cur_idx, le);
+        log_storage->writeAt(cur_idx, le);
     }
 
     if (log_fsync_mode == FsyncMode::FSYNC_PARALLEL)
@@ -336,15 +584,54 @@ void NuRaftFileLogStore::apply_pack(ulong index, buffer & pack)
 
 bool NuRaftFileLogStore::compact(ulong last_log_index)
 {
-    segment_store->removeSegment(last_log_index + 1);
-    log_queue.clear();
+    UInt64 compact_index = last_log_index;
+    {
+        std::lock_guard lock(compact_index_callback_mutex);
+        if (compact_index_callback)
+            compact_index = std::min<UInt64>(compact_index_callback(last_log_index), last_log_index);
+    }
+    if (compact_index < last_log_index)
+        LOG_INFO(log, "Keep logs from {} for lagging followers instead of compacting up to {}", compact_index + 1, last_log_index);
+
+    log_storage->removeSegment(compact_index + 1);
+    /// NuRaft compacts up to the index of the new snapshot minus reserved_log_items, the segments after it
+    /// are kept for lagging followers, which are rarely read
+    log_storage->offloadSegments(last_log_index + reserved_log_items);
+    /// Keep the latest logs for lagging followers
+    log_queue.removeUntil(last_log_index);
     LOG_DEBUG(log, "compact last_log_index {}", last_log_index);
     return true;
 }
 
 bool NuRaftFileLogStore::flush()
 {
-    return segment_store->flush() > 0;
+    Stopwatch watch;
+    UInt64 last_flush_index = log_storage->flush();
+    if (last_flush_index)
+    {
+        Metrics::getMetrics().log_fsync_time_us->add(watch.elapsedMicroseconds());
+        onFlushed(last_flush_index);
+    }
+    return last_flush_index > 0;
+}
+
+void NuRaftFileLogStore::setFlushCallback(FlushCallback callback)
+{
+    std::lock_guard lock(flush_callback_mutex);
+    flush_callback = std::move(callback);
+}
+
+void NuRaftFileLogStore::setCompactIndexCallback(CompactIndexCallback callback)
+{
+    std::lock_guard lock(compact_index_callback_mutex);
+    compact_index_callback = std::move(callback);
+}
+
+void NuRaftFileLogStore::onFlushed(UInt64 durable_index)
+{
+    std::lock_guard lock(flush_callback_mutex);
+    if (flush_callback)
+        flush_callback(durable_index);
 }
 
 ulong NuRaftFileLogStore::last_durable_index()
@@ -1,7 +1,10 @@
 #pragma once
 
 #include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <Service/NuRaftLogSegment.h>
 #include <Service/Settings.h>
@@ -15,38 +18,73 @@ using nuraft::int32;
 using nuraft::int64;
 using nuraft::ulong;
 
-/// Act as a ring cache who will cache latest append logs.
-/// TODO make it as a common tool.
+/// Cache of the latest appended logs, so that followers a little behind are served from memory.
+/// It keeps a contiguous range of indexes, bounded by both count and bytes of logs, the oldest are evicted first.
+///
+/// Logs are kept in a ring of slots, log index goes to slot index & mask. Replication threads of every follower read
+/// while the append path writes, so reading takes no lock: a reader counts itself in the slot, takes the entry if the
+/// slot holds the index and leaves. Writer marks the slot empty, waits for the readers in it, which only copy a pointer,
+/// and then replaces the entry. Writes are serialized by a mutex.
 class LogEntryQueue
 {
 public:
-    LogEntryQueue() : batch_index(0), max_index(0), log(&(Poco::Logger::get("LogEntryQueue"))) { }
+    static constexpr UInt64 DEFAULT_MAX_ENTRIES = 65536;
+    static constexpr UInt64 DEFAULT_MAX_BYTES = 256 * 1024 * 1024;
+
+    /// max_entries_ 0 means disabled
+    explicit LogEntryQueue(UInt64 max_entries_ = DEFAULT_MAX_ENTRIES, UInt64 max_bytes_ = DEFAULT_MAX_BYTES);
 
     /// get log from cache, return null if not exists.
-    ptr<log_entry> getEntry(const UInt64 & index);
+    ptr<log_entry> getEntry(UInt64 index);
 
-    /// put log into the queue
-    void putEntry(UInt64 & index, ptr<log_entry> & entry);
+    /// Put log into the queue, logs from its index are replaced. If it does not follow the last one, the queue is cleared first.
+    void putEntry(UInt64 index, const ptr<log_entry> & entry);
 
-    [[maybe_unused]] void putEntryOrClear(UInt64 & index, ptr<log_entry> & entry);
+    /// Remove logs whose index is less than or equal to index.
+    void removeUntil(UInt64 index);
 
     /// clean all log
     void clear();
 
+    size_t size() const;
+    size_t bytes() const;
+
+    /// Index of the first cached log, 0 if the queue is empty.
+    UInt64 firstIndex() const;
+
 private:
-    static constexpr UInt8 BIT_SIZE = 16;
-    static constexpr UInt32 MAX_VECTOR_SIZE = 65536; /// 2^16
+    struct Slot
+    {
+        /// Index of entry, 0 if the slot is empty, log index starts with 1
+        std::atomic<UInt64> index{0};
+        /// Readers checking index or copying entry
+        std::atomic<UInt32> readers{0};
+        ptr<log_entry> entry;
+    };
+
+    static size_t entryBytes(const ptr<log_entry> & entry) { return sizeof(log_entry) + entry->get_buf().size(); }
+
+    Slot & slotOf(UInt64 index) const { return slots[index & mask]; }
+
+    /// Write entry of index into its slot, nullptr to empty it. Invoked with write_mutex.
+    void setSlot(UInt64 index, const ptr<log_entry> & entry);
+
+    void popFront();
+    void popBack();
+    void clearUnlocked();
 
-    /// every max_index log, increase batch_index
-    UInt64 batch_index;
+    const UInt64 max_entries;
+    const UInt64 max_bytes;
 
-    /// queue capacity
-    UInt64 max_index;
+    std::unique_ptr<Slot[]> slots;
+    UInt64 mask{0};
 
-    /// logs
-    ptr<log_entry> entry_vec[MAX_VECTOR_SIZE];
+    /// Index of the first log and count of logs, written with write_mutex
+    std::atomic<UInt64> first_index{0};
+    std::atomic<UInt64> count{0};
+    std::atomic<size_t> total_bytes{0};
 
-    std::shared_mutex queue_mutex;
+    std::mutex write_mutex;
     Poco::Logger * log;
 };
 
@@ -58,7 +96,18 @@ class NuRaftFileLogStore : public nuraft::log_store
          FsyncMode log_fsync_mode_ = FsyncMode::FSYNC_PARALLEL,
          UInt64 log_fsync_interval_ = 1000,
          UInt32 max_log_size_ = LogSegmentStore::MAX_SEGMENT_FILE_SIZE,
-         UInt32 max_segment_count_ = LogSegmentStore::MAX_SEGMENT_COUNT);
+         UInt32 max_segment_count_ = LogSegmentStore::MAX_SEGMENT_COUNT,
+         bool log_io_uring_ = false,
+         bool log_preallocate_ = false,
+         bool log_direct_io_ = false,
+         UInt64 log_cache_max_entries_ = LogEntryQueue::DEFAULT_MAX_ENTRIES,
+         UInt64 log_cache_max_bytes_ = LogEntryQueue::DEFAULT_MAX_BYTES,
+         bool log_compression_ = false,
+         const String & log_cold_dir_ = "",
+         UInt64 reserved_log_items_ = 0,
+         UInt64 log_fsync_bytes_ = 4194304,
+         UInt64 log_fsync_interval_us_ = 10000,
+         ptr<ILogStorage> log_storage_ = nullptr);
 
     ~NuRaftFileLogStore() override;
 
@@ -119,6 +168,10 @@ class NuRaftFileLogStore : public nuraft::log_store
      */
     ptr<std::vector<ptr<log_entry>>> log_entries_ext(ulong start, ulong end, int64 batch_size_hint_in_bytes = 0) override;
 
+    /// Bytes of entries log_entries_ext returns when the follower gives no hint or a larger one, at least one entry
+    /// is returned. 0 means no limit.
+    void setMaxAppendBytes(UInt64 max_bytes) { max_append_bytes.store(max_bytes, std::memory_order_relaxed); }
+
     /// Same with log_entries_ext, but return log entry with version info.
     ptr<std::vector<VersionLogEntry>> log_entries_version_ext(ulong start, ulong end, int64 batch_size_hint_in_bytes = 0);
 
@@ -189,16 +242,44 @@ class NuRaftFileLogStore : public nuraft::log_store
 
     void setRaftServer(nuraft::ptr<nuraft::raft_server> raft_instance_) { raft_instance = raft_instance_; }
 
-    ptr<LogSegmentStore> segmentStore() const { return segment_store; }
+    ptr<ILogStorage> logStorage() const { return log_storage; }
+    /// nullptr if log is not kept in segment files
+    ptr<LogSegmentStore> segmentStore() const { return std::dynamic_pointer_cast<LogSegmentStore>(log_storage); }
+
+    /// Bytes of log entries cached in memory
+    size_t getLogCacheBytes() const { return log_queue.bytes(); }
+
+    /// Drop log entries cached in memory, they are read from log segments then
+    void shrinkLogCache() { log_queue.clear(); }
+
+    /// Invoked with the last durable log index after each log flush, by the thread flushing.
+    using FlushCallback = std::function<void(UInt64)>;
+    void setFlushCallback(FlushCallback callback);
+
+    /// Invoked by compact with the index NuRaft compacts up to, return the index to compact up to instead, which is
+    /// not larger than it. Logs are kept longer for lagging followers by it, see CatchUpPolicy.
+    using CompactIndexCallback = std::function<UInt64(UInt64)>;
+    void setCompactIndexCallback(CompactIndexCallback callback);
 
 private:
+    void onFlushed(UInt64 durable_index);
+
     /// Thread used to flush log, only used in FSYNC_PARALLEL mode
     void fsyncThread();
 
+    /// Ask for persisting appended entries, only used in FSYNC_PARALLEL mode
+    void requestParallelFsync();
+
+    /// Thread flushing the group when its first entry waits for log_fsync_interval_us, only used in FSYNC_GROUP mode
+    void groupFsyncThread();
+
+    /// Flush entries of the group and record its size, only used in FSYNC_GROUP mode
+    void flushGroup();
+
     Poco::Logger * log;
 
-    /// Used to operate log in the store
-    ptr<LogSegmentStore> segment_store;
+    /// Used to operate log in the store, segment files of log_dir unless another storage is given
+    ptr<ILogStorage> log_storage;
 
     /// Memory log cache
     LogEntryQueue log_queue;
@@ -210,12 +291,33 @@ private:
     FsyncMode log_fsync_mode;
     UInt64 log_fsync_interval;
 
-    /// How many log to flush, only used in FSYNC_BATCH mode
+    /// Log entries NuRaft keeps before the latest snapshot, see compact
+    UInt64 reserved_log_items;
+
+    /// How many log to flush, only used in FSYNC_BATCH and FSYNC_GROUP mode
     UInt64 to_flush_count{0};
 
-    /// Thread used to flush log, only used in FSYNC_PARALLEL mode
+    /// Limits of a group besides log_fsync_interval, only used in FSYNC_GROUP mode
+    UInt64 log_fsync_bytes;
+    UInt64 log_fsync_interval_us;
+
+    /// Bytes appended since the last end_of_append_batch, only used in FSYNC_GROUP mode
+    UInt64 appended_bytes{0};
+
+    /// The group of entries written but not flushed, only used in FSYNC_GROUP mode.
+    /// group_start_us is when its first entry was written, 0 if it is empty.
+    std::mutex group_mutex;
+    std::condition_variable group_cv;
+    UInt64 to_flush_bytes{0};
+    UInt64 group_start_us{0};
+
+    /// Thread used to flush log, only used in FSYNC_PARALLEL and FSYNC_GROUP mode
     ThreadFromGlobalPool fsync_thread;
 
+    /// In FSYNC_PARALLEL mode with io_uring, writes and fdatasync are submitted without waiting,
+    /// and fsync thread only waits for their completions.
+    bool async_fsync{false};
+
     /// last flushed log index, only used in FSYNC_PARALLEL mode
     std::atomic<ulong> disk_last_durable_index;
 
@@ -227,6 +329,14 @@ private:
     nuraft::ptr<nuraft::raft_server> raft_instance;
 
     std::atomic<bool> shutdown_called{false};
+
+    std::mutex flush_callback_mutex;
+    FlushCallback flush_callback;
+
+    std::mutex compact_index_callback_mutex;
+    CompactIndexCallback compact_index_callback;
+
+    std::atomic<UInt64> max_append_bytes{0};
 };
 
 }
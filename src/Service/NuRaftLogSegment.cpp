@@ -1,16 +1,22 @@
+#include <algorithm>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
 #include <sys/uio.h>
+#include <thread>
 #include <unistd.h>
 
 #include <Poco/File.h>
 
+#include <Common/Exception.h>
 #include <Common/ThreadPool.h>
+#include <Common/WorkStealing.h>
+#include <Common/setThreadName.h>
 
 #include <Service/Crc32.h>
 #include <Service/KeeperUtils.h>
+#include <Service/LatencyInjection.h>
 #include <Service/LogEntry.h>
 #include <Service/NuRaftLogSegment.h>
 
@@ -41,6 +47,19 @@ int ftruncateUninterrupted(int fd, off_t length)
     return rc;
 }
 
+/// Write magic and version of segment file, return whether success
+static bool writeMagicAndVersion(int fd, LogVersion version)
+{
+    union
+    {
+        uint64_t magic_num;
+        uint8_t magic_array[8] = {0, 'R', 'a', 'f', 't', 'L', 'o', 'g'};
+    };
+
+    auto version_uint8 = static_cast<uint8_t>(version);
+    return write(fd, &magic_num, 8) == 8 && write(fd, &version_uint8, 1) == 1;
+}
+
 bool compareSegment(ptr<NuRaftLogSegment> & seg1, ptr<NuRaftLogSegment> & seg2)
 {
     return seg1->firstIndex() < seg2->firstIndex();
@@ -120,9 +139,27 @@ int NuRaftLogSegment::closeFile()
         ::close(seg_fd);
         seg_fd = -1;
     }
+#if defined(OS_LINUX)
+    if (direct_fd >= 0)
+    {
+        ::close(direct_fd);
+        direct_fd = -1;
+    }
+#endif
     return 0;
 }
 
+int NuRaftLogSegment::truncateFile(UInt64 size)
+{
+    int ret = ftruncateUninterrupted(seg_fd, size);
+#if defined(OS_LINUX)
+    /// Allocate the dropped space again, so later appends do not allocate blocks
+    if (ret == 0 && preallocate_size > size && fallocate(seg_fd, 0, size, preallocate_size - size) != 0)
+        LOG_WARNING(log, "Fail to preallocate segment {} to size {}, error:{}", getFileName(), preallocate_size, strerror(errno));
+#endif
+    return ret;
+}
+
 int NuRaftLogSegment::create()
 {
     if (!is_open)
@@ -149,6 +186,74 @@ int NuRaftLogSegment::create()
     return 0;
 }
 
+int NuRaftLogSegment::createFromSpare(const String & spare_path)
+{
+    if (!is_open)
+    {
+        LOG_WARNING(log, "Create on a closed segment at first_index={} in {}", first_index, log_dir);
+        return -1;
+    }
+    std::lock_guard write_lock(log_mutex);
+    file_name = getOpenFileName();
+    String full_path = getOpenPath();
+    if (Poco::File(full_path).exists())
+    {
+        LOG_ERROR(log, "File {} is exists.", full_path);
+        return -1;
+    }
+    errno = 0;
+    if (::rename(spare_path.c_str(), full_path.c_str()) != 0)
+    {
+        LOG_WARNING(log, "Fail to rename spare segment {} to {}, error:{}", spare_path, full_path, strerror(errno));
+        return -1;
+    }
+    seg_fd = ::open(full_path.c_str(), O_RDWR);
+    if (seg_fd < 0)
+    {
+        LOG_WARNING(log, "Open segment {} failed, error:{}", full_path, strerror(errno));
+        return -1;
+    }
+
+    /// The spare has file header already
+    file_size = sizeof(uint64_t) + sizeof(uint8_t);
+    ::lseek(seg_fd, file_size, SEEK_SET);
+    LOG_INFO(log, "Created new segment {} from spare, seg_fd {}, first index {}", full_path, seg_fd, first_index);
+    return 0;
+}
+
+int NuRaftLogSegment::createSpare(const String & spare_path, UInt64 size)
+{
+    auto * log = &(Poco::Logger::get("LogSegment"));
+#if defined(OS_LINUX)
+    String tmp_path = spare_path + ".tmp";
+    errno = 0;
+    int fd = ::open(tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        LOG_WARNING(log, "Create spare segment {} failed, error:{}", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    /// Blocks are allocated and persisted here, fdatasync of appends need not update the file size
+    bool ok = writeMagicAndVersion(fd, CURRENT_LOG_VERSION) && fallocate(fd, 0, 0, size) == 0 && fdatasync(fd) == 0;
+    int saved_errno = errno;
+    ::close(fd);
+
+    if (!ok || ::rename(tmp_path.c_str(), spare_path.c_str()) != 0)
+    {
+        LOG_WARNING(log, "Preallocate spare segment {} of {} bytes failed, error:{}", spare_path, size, strerror(ok ? errno : saved_errno));
+        ::unlink(tmp_path.c_str());
+        return -1;
+    }
+
+    LOG_INFO(log, "Created spare segment {} of {} bytes", spare_path, size);
+    return 0;
+#else
+    LOG_WARNING(log, "Preallocating segment {} of {} bytes is only supported on Linux", spare_path, size);
+    return -1;
+#endif
+}
+
 void NuRaftLogSegment::writeFileHeader()
 {
     if (!is_open)
@@ -157,20 +262,10 @@ void NuRaftLogSegment::writeFileHeader()
     if (seg_fd < 0)
         throw Exception(ErrorCodes::LOGICAL_ERROR, "File not open yet");
 
-    union
-    {
-        uint64_t magic_num;
-        uint8_t magic_array[8] = {0, 'R', 'a', 'f', 't', 'L', 'o', 'g'};
-    };
-
     std::lock_guard write_lock(log_mutex);
-    auto version_uint8 = static_cast<uint8_t>(version);
-
-    if (write(seg_fd, &magic_num, 8) != 8)
-        throw Exception(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Cannot write magic to file descriptor");
 
-    if (write(seg_fd, &version_uint8, 1) != 1)
-        throw Exception(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Cannot write version to file descriptor");
+    if (!writeMagicAndVersion(seg_fd, version))
+        throw Exception(ErrorCodes::CANNOT_WRITE_TO_FILE_DESCRIPTOR, "Cannot write magic and version to file descriptor");
 
     file_size.fetch_add(sizeof(uint64_t) + sizeof(uint8_t), std::memory_order_release);
 }
@@ -198,10 +293,33 @@ int NuRaftLogSegment::load()
     file_size = st_buf.st_size;
 
     size_t entry_off = loadVersion();
+
+    /// A closed segment is not changed after its index is written
+    if (!is_open && loadIndex(entry_off) == 0)
+    {
+        LOG_INFO(log, "Load closed segment {} from its index, first index {}, last index {}", getFileName(), first_index, last_index);
+        return 0;
+    }
+
     UInt64 actual_last_index = first_index - 1;
 
+    /// A preallocated file is longer than its entries, the end is found by checking entries,
+    /// the last one may be written partially before crash. The file may be preallocated by
+    /// an earlier run, then its tail is zeros.
+    bool scan_tail = is_open && preallocate_size;
+    if (is_open && !scan_tail && file_size >= entry_off + LogEntryHeader::HEADER_SIZE)
+    {
+        char tail[LogEntryHeader::HEADER_SIZE];
+        scan_tail = pread(seg_fd, tail, sizeof(tail), file_size - sizeof(tail)) == static_cast<ssize_t>(sizeof(tail))
+            && std::all_of(tail, tail + sizeof(tail), [](char c) { return c == 0; });
+    }
+
     for (; entry_off < file_size;)
     {
+        /// Less than a header is left by an unfinished write or by padding of direct writes
+        if (is_open && entry_off + LogEntryHeader::HEADER_SIZE > file_size)
+            break;
+
         LogEntryHeader header;
         const int rc = loadLogEntryHeader(seg_fd, entry_off, &header);
         if (rc != 0)
@@ -210,17 +328,31 @@ int NuRaftLogSegment::load()
             break;
         }
 
+        /// Zeros after the last entry, an entry has at least its type
+        if (header.data_length == 0)
+            break;
+
         /// rc == 0
         const UInt64 skip_len = sizeof(LogEntryHeader) + header.data_length;
 
         if (entry_off + skip_len > file_size)
         {
+            if (scan_tail)
+                break;
             /// The last log was not completely written and it should be
             /// truncated
             ret = -1;
             break;
         }
 
+        if (scan_tail)
+        {
+            String data(header.data_length, '\0');
+            ssize_t read_len = pread(seg_fd, data.data(), header.data_length, entry_off + LogEntryHeader::HEADER_SIZE);
+            if (read_len != static_cast<ssize_t>(header.data_length) || !verifyCRC32(data.data(), header.data_length, header.data_crc))
+                break;
+        }
+
         offset_term.push_back(std::make_pair(entry_off, header.term));
         ++actual_last_index;
         entry_off += skip_len;
@@ -284,17 +416,136 @@ int NuRaftLogSegment::load()
             first_index,
             file_size,
             entry_off);
-        ret = ftruncateUninterrupted(seg_fd, entry_off);
+        ret = truncateFile(entry_off);
     }
 
     file_size = entry_off;
 
     if (is_open)
         ::lseek(seg_fd, entry_off, SEEK_SET);
+    else if (ret == 0)
+        writeIndex();
 
     return ret;
 }
 
+String NuRaftLogSegment::getIndexPath()
+{
+    return log_dir + "/" + INDEX_FILE_PREFIX + getFileName();
+}
+
+int NuRaftLogSegment::writeIndex()
+{
+    String index_path = getIndexPath();
+    String tmp_path = index_path + ".tmp";
+
+    /// Numbers are written as they are in memory, like entry headers
+    String buf;
+    buf.reserve(INDEX_HEADER_SIZE + offset_term.size() * 2 * sizeof(UInt64) + sizeof(UInt32));
+    auto put = [&buf](auto value) { buf.append(reinterpret_cast<const char *>(&value), sizeof(value)); };
+
+    buf.append(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    put(first_index);
+    put(last_index.load(std::memory_order_relaxed));
+    put(file_size.load(std::memory_order_relaxed));
+    for (const auto & [offset, term] : offset_term)
+    {
+        put(offset);
+        put(term);
+    }
+    put(getCRC32(buf.data(), buf.size()));
+
+    errno = 0;
+    int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool ok = fd >= 0;
+    for (size_t written = 0; ok && written < buf.size();)
+    {
+        ssize_t ret = ::write(fd, buf.data() + written, buf.size() - written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        ok = ret > 0;
+        written += ok ? ret : 0;
+    }
+    int saved_errno = errno;
+    if (fd >= 0)
+        ::close(fd);
+
+    /// Index is not synced, a broken one after crash does not pass the checks of loadIndex
+    if (!ok || ::rename(tmp_path.c_str(), index_path.c_str()) != 0)
+    {
+        LOG_WARNING(log, "Fail to write index {}, error:{}", index_path, strerror(ok ? errno : saved_errno));
+        ::unlink(tmp_path.c_str());
+        return -1;
+    }
+
+    LOG_INFO(log, "Write index {} of {} entries", index_path, offset_term.size());
+    return 0;
+}
+
+int NuRaftLogSegment::loadIndex(UInt64 first_entry_offset)
+{
+    String index_path = getIndexPath();
+
+    int fd = ::open(index_path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        LOG_INFO(log, "No index of segment {}, scan it", getFileName());
+        return -1;
+    }
+
+    UInt64 entry_count = last_index.load(std::memory_order_relaxed) + 1 - first_index;
+    String buf(INDEX_HEADER_SIZE + entry_count * 2 * sizeof(UInt64) + sizeof(UInt32), '\0');
+
+    struct stat st_buf;
+    bool ok = fstat(fd, &st_buf) == 0 && static_cast<size_t>(st_buf.st_size) == buf.size()
+        && pread(fd, buf.data(), buf.size(), 0) == static_cast<ssize_t>(buf.size());
+    ::close(fd);
+
+    const char * pos = buf.data();
+    auto get = [&pos]()
+    {
+        UInt64 value;
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    };
+
+    UInt32 crc = 0;
+    if (ok)
+    {
+        memcpy(&crc, buf.data() + buf.size() - sizeof(crc), sizeof(crc));
+        ok = memcmp(pos, INDEX_MAGIC, sizeof(INDEX_MAGIC)) == 0 && verifyCRC32(buf.data(), buf.size() - sizeof(crc), crc);
+        pos += sizeof(INDEX_MAGIC);
+    }
+    ok = ok && get() == first_index && get() == last_index.load(std::memory_order_relaxed)
+        && get() == file_size.load(std::memory_order_relaxed);
+
+    std::vector<std::pair<UInt64, UInt64>> loaded;
+    if (ok)
+    {
+        loaded.reserve(entry_count);
+        for (UInt64 i = 0; ok && i < entry_count; ++i)
+        {
+            UInt64 offset = get();
+            UInt64 term = get();
+            /// Offsets step by at least a header
+            UInt64 min_offset = loaded.empty() ? first_entry_offset : loaded.back().first + LogEntryHeader::HEADER_SIZE;
+            ok = loaded.empty() ? offset == min_offset : offset >= min_offset;
+            loaded.emplace_back(offset, term);
+        }
+        ok = ok && loaded.back().first + LogEntryHeader::HEADER_SIZE <= file_size;
+    }
+
+    if (!ok)
+    {
+        LOG_WARNING(log, "Index {} does not match segment, scan the segment", index_path);
+        return -1;
+    }
+
+    offset_term = std::move(loaded);
+    return 0;
+}
+
 size_t NuRaftLogSegment::loadVersion()
 {
     if (seg_fd < 0)
@@ -341,6 +592,18 @@ int NuRaftLogSegment::close(bool is_full)
     if (!is_open)
         return 0;
 
+    if (writePendingUnlocked() != 0)
+        LOG_ERROR(log, "Fail to write {} pending log entries when closing segment {}", pending_entries.size(), getFileName());
+
+    /// Drop preallocated space after the entries of a full segment and padding of direct writes,
+    /// an open segment keeps its preallocated space.
+    bool trim = is_full && preallocate_size;
+#if defined(OS_LINUX)
+    trim |= direct_fd >= 0 && (is_full || !preallocate_size);
+#endif
+    if (trim && seg_fd >= 0 && ftruncateUninterrupted(seg_fd, file_size) != 0)
+        LOG_WARNING(log, "Fail to trim segment {} to size {}, error:{}", getFileName(), file_size, strerror(errno));
+
     int ret = closeFile();
 
     if (ret)
@@ -362,16 +625,35 @@ int NuRaftLogSegment::close(bool is_full)
         is_open = false;
         Poco::File(old_path).renameTo(new_path);
         file_name = getFinishFileName();
+        writeIndex();
         return 0;
     }
     return 0;
 }
 
-UInt64 NuRaftLogSegment::flush() const
+UInt64 NuRaftLogSegment::flush()
 {
     if (seg_fd >= 0)
     {
+        LatencyInjection::instance().delay(InjectionPoint::LOG_FSYNC);
         std::lock_guard write_lock(log_mutex);
+#if defined(OS_LINUX)
+        /// One submission for the write and fdatasync
+        if (io_uring)
+        {
+            if (submitPendingUnlocked(true) != 0 || reapCompletionsUnlocked(in_flight_writes.back().sequence, true) != 0)
+                return 0;
+            return last_index;
+        }
+#endif
+        if (writePendingUnlocked() != 0)
+            return 0;
+
+#if defined(OS_LINUX)
+        /// Direct writes are durable when they return
+        if (direct_fd >= 0)
+            return last_index;
+#endif
 
         int ret;
 #if defined(OS_DARWIN)
@@ -387,10 +669,28 @@ UInt64 NuRaftLogSegment::flush() const
     return 0;
 }
 
+void NuRaftLogSegment::closeForRemove()
+{
+    pending_entries.clear();
+    pending_written = 0;
+    mapped_file.reset();
+    mapping_disabled = true;
+#if defined(OS_LINUX)
+    /// The kernel may still use buffers of the writes
+    if (io_uring && !in_flight_writes.empty())
+        reapCompletionsUnlocked(in_flight_writes.back().sequence, false);
+    in_flight_writes.clear();
+#endif
+    closeFile();
+    if (!is_open)
+        ::unlink(getIndexPath().c_str());
+    removed = true;
+}
+
 int NuRaftLogSegment::remove()
 {
     std::lock_guard write_lock(log_mutex);
-    closeFile();
+    closeForRemove();
     String full_path = getPath();
     Poco::File file_obj(full_path);
     if (file_obj.exists())
@@ -401,29 +701,132 @@ int NuRaftLogSegment::remove()
     return 0;
 }
 
-UInt64 NuRaftLogSegment::appendEntry(ptr<log_entry> entry, std::atomic<UInt64> & last_log_index)
+String NuRaftLogSegment::removeLater()
 {
-    LogEntryHeader header;
-    ptr<buffer> entry_buf;
-
-    char * entry_str;
-    size_t buf_size = 0;
+    std::lock_guard write_lock(log_mutex);
+    closeForRemove();
+    String full_path = getPath();
+    String removed_path = log_dir + "/" + REMOVED_FILE_PREFIX + getFileName();
+    if (::rename(full_path.c_str(), removed_path.c_str()) != 0)
+    {
+        if (errno != ENOENT)
+            LOG_WARNING(log, "Rename removed log segment {} failed, error:{}, remove it now", full_path, strerror(errno));
+        ::unlink(full_path.c_str());
+        return {};
+    }
+    LOG_INFO(log, "Remove log segment {} later", full_path);
+    return removed_path;
+}
 
-    struct iovec vec[2];
+namespace
+{
+    /// Copy the file to a temporary file and rename it to dst after fsync, return 0 if success
+    int copyFile(const String & src, const String & dst, const std::atomic<bool> & cancelled, Poco::Logger * log)
     {
-        if (!entry || !is_open)
-            return -1;
+        static constexpr size_t COPY_BUFFER_SIZE = 1024 * 1024;
 
-        entry_buf = LogEntryBody::serialize(entry);
-        buf_size = entry_buf->size();
-        entry_str = reinterpret_cast<char *>(entry_buf->data_begin());
+        String tmp_path = dst + ".tmp";
+        int src_fd = ::open(src.c_str(), O_RDONLY);
+        int dst_fd = src_fd < 0 ? -1 : ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = dst_fd >= 0;
 
-        if (entry_str == nullptr || buf_size == 0)
+        std::vector<char> buf(ok ? COPY_BUFFER_SIZE : 0);
+        while (ok && !cancelled)
         {
-            LOG_ERROR(log, "Can't get entry string buffer, size is {}.", buf_size);
-            return -1;
+            ssize_t read_size = ::read(src_fd, buf.data(), buf.size());
+            if (read_size < 0 && errno == EINTR)
+                continue;
+            if (read_size <= 0)
+            {
+                ok = read_size == 0;
+                break;
+            }
+
+            for (ssize_t written = 0; ok && written < read_size;)
+            {
+                ssize_t ret = ::write(dst_fd, buf.data() + written, read_size - written);
+                if (ret < 0 && errno == EINTR)
+                    continue;
+                ok = ret > 0;
+                written += ret;
+            }
         }
 
+        ok = ok && !cancelled && ::fsync(dst_fd) == 0;
+        if (!ok && !cancelled)
+            LOG_WARNING(log, "Copy log segment {} to {} failed, error:{}", src, dst, strerror(errno));
+
+        if (src_fd >= 0)
+            ::close(src_fd);
+        if (dst_fd >= 0)
+            ::close(dst_fd);
+
+        ok = ok && ::rename(tmp_path.c_str(), dst.c_str()) == 0;
+        if (!ok)
+            ::unlink(tmp_path.c_str());
+        return ok ? 0 : -1;
+    }
+}
+
+String NuRaftLogSegment::moveTo(const String & dir, const std::atomic<bool> & cancelled)
+{
+    String src_path;
+    String dst_path = dir + "/" + getFileName();
+    {
+        std::shared_lock read_lock(log_mutex);
+        if (is_open || removed || log_dir == dir)
+            return {};
+        src_path = getPath();
+    }
+
+    /// A closed segment is not changed, it is copied without lock, so reading is not blocked
+    if (copyFile(src_path, dst_path, cancelled, log) != 0)
+        return {};
+
+    /// Readers always find an fd of the segment, it is replaced at once
+    int new_fd = ::open(dst_path.c_str(), O_RDWR);
+    std::lock_guard write_lock(log_mutex);
+    if (new_fd < 0 || removed || is_open)
+    {
+        if (new_fd >= 0)
+            ::close(new_fd);
+        ::unlink(dst_path.c_str());
+        return {};
+    }
+
+    String old_dir = log_dir;
+    String old_index_path = getIndexPath();
+    mapped_file.reset();
+    closeFile();
+    seg_fd = new_fd;
+    log_dir = dir;
+    writeIndex();
+    ::unlink(old_index_path.c_str());
+
+    /// The old file is not loaded again after it is renamed, so a crash before that leaves two copies,
+    /// the one in dir is dropped when loading.
+    String removed_path = old_dir + "/" + REMOVED_FILE_PREFIX + getFileName();
+    if (::rename(src_path.c_str(), removed_path.c_str()) != 0)
+    {
+        LOG_WARNING(log, "Rename moved log segment {} failed, error:{}, remove it now", src_path, strerror(errno));
+        ::unlink(src_path.c_str());
+        return {};
+    }
+    LOG_INFO(log, "Move log segment {} to {}", src_path, dir);
+    return removed_path;
+}
+
+UInt64 NuRaftLogSegment::appendEntry(ptr<log_entry> entry, std::atomic<UInt64> & last_log_index, bool deferred, bool compress)
+{
+    PendingEntry pending;
+    LogEntryHeader & header = pending.header;
+
+    {
+        if (!entry || !is_open)
+            return -1;
+
+        LogEntryBody::serialize(entry, compress && version >= LogVersion::V2, pending.type, pending.data);
+
         if (seg_fd < 0)
         {
             LOG_ERROR(log, "seg fs is null.");
@@ -431,33 +834,25 @@ UInt64 NuRaftLogSegment::appendEntry(ptr<log_entry> entry, std::atomic<UInt64> &
         }
 
         header.term = entry->get_term();
-        header.data_length = buf_size;
-        header.data_crc = RK::getCRC32(entry_str, header.data_length);
-
-        vec[0].iov_base = &header;
-        vec[0].iov_len = LogEntryHeader::HEADER_SIZE;
-        vec[1].iov_base = reinterpret_cast<void *>(entry_str);
-        vec[1].iov_len = header.data_length;
+        header.data_length = sizeof(pending.type) + pending.data->size();
+        header.data_crc = RK::getCRC32(reinterpret_cast<const char *>(&pending.type), sizeof(pending.type));
+        header.data_crc = RK::extendCRC32(header.data_crc, reinterpret_cast<const char *>(pending.data->data_begin()), pending.dataSize());
     }
 
-    errno = 0;
-
     {
         std::lock_guard write_lock(log_mutex);
         header.index = last_index.load(std::memory_order_acquire) + 1;
-        ssize_t ret = writev(seg_fd, vec, 2);
-
-        if (ret < 0 || ret != static_cast<ssize_t>(vec[0].iov_len + vec[1].iov_len))
-        {
-            LOG_WARNING(log, "Write {}, real size {}, error:{}", ret, vec[0].iov_len + vec[1].iov_len, strerror(errno));
-            return -1;
-        }
+        pending_entries.push_back(pending);
 
         offset_term.push_back(std::make_pair(file_size.load(std::memory_order_relaxed), entry->get_term()));
         file_size.fetch_add(LogEntryHeader::HEADER_SIZE + header.data_length, std::memory_order_release);
 
         last_index.fetch_add(1, std::memory_order_release);
         last_log_index.store(last_index, std::memory_order_release);
+
+        /// A failed write is retried by the next one, the entry is accounted already.
+        if (!deferred || pending_entries.size() >= MAX_PENDING_ENTRIES)
+            writePendingUnlocked();
     }
 
     LOG_TRACE(
@@ -579,15 +974,505 @@ int NuRaftLogSegment::loadLogEntry(int fd, off_t offset, LogEntryHeader * head,
     return 0;
 }
 
+int NuRaftLogSegment::writePending()
+{
+    std::lock_guard write_lock(log_mutex);
+    return writePendingUnlocked();
+}
+
+int NuRaftLogSegment::writePendingUnlocked()
+{
+    if (!pending_entries.empty())
+        LatencyInjection::instance().delay(InjectionPoint::LOG_WRITE);
+
+#if defined(OS_LINUX)
+    if (direct_fd >= 0)
+        return writePendingDirectUnlocked();
+
+    if (io_uring)
+    {
+        if (submitPendingUnlocked(false) != 0)
+            return -1;
+        return in_flight_writes.empty() ? 0 : reapCompletionsUnlocked(in_flight_writes.back().sequence, true);
+    }
+#endif
+
+    if (pending_entries.empty())
+        return 0;
+
+    if (seg_fd < 0)
+    {
+        LOG_ERROR(log, "seg fs is null.");
+        return -1;
+    }
+
+    std::vector<struct iovec> vec;
+    vec.reserve(pending_entries.size() * 2);
+    size_t skip = pending_written;
+    auto add_buffer = [&vec, &skip](void * data, size_t size)
+    {
+        /// Skip bytes written by the last partial write
+        size_t skipped = std::min(skip, size);
+        skip -= skipped;
+        if (skipped < size)
+            vec.push_back({static_cast<char *>(data) + skipped, size - skipped});
+    };
+
+    size_t total_size = 0;
+    for (auto & pending : pending_entries)
+    {
+        add_buffer(&pending.header, PendingEntry::PREFIX_SIZE);
+        add_buffer(pending.data->data_begin(), pending.dataSize());
+        total_size += LogEntryHeader::HEADER_SIZE + pending.header.data_length;
+    }
+
+    size_t vec_index = 0;
+    while (vec_index < vec.size())
+    {
+        errno = 0;
+        ssize_t ret = writev(seg_fd, vec.data() + vec_index, static_cast<int>(vec.size() - vec_index));
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            LOG_WARNING(
+                log,
+                "Write {} pending log entries failed, written {} of {}, error:{}",
+                pending_entries.size(),
+                pending_written,
+                total_size,
+                strerror(errno));
+            return -1;
+        }
+
+        pending_written += ret;
+        for (size_t written = ret; written > 0;)
+        {
+            auto & buf = vec[vec_index];
+            size_t advance = std::min(written, buf.iov_len);
+            buf.iov_base = static_cast<char *>(buf.iov_base) + advance;
+            buf.iov_len -= advance;
+            written -= advance;
+            if (buf.iov_len == 0)
+                ++vec_index;
+        }
+    }
+
+    LOG_TRACE(log, "Write {} pending log entries, size {}", pending_entries.size(), total_size);
+    pending_entries.clear();
+    pending_written = 0;
+    return 0;
+}
+
+#if defined(OS_LINUX)
+namespace
+{
+    /// Write all the buffers at the offset with plain syscalls, return 0 if success
+    int pwritevFully(int fd, std::vector<struct iovec> vec, off_t offset)
+    {
+        size_t vec_index = 0;
+        while (vec_index < vec.size())
+        {
+            ssize_t ret = pwritev(fd, vec.data() + vec_index, static_cast<int>(vec.size() - vec_index), offset);
+            if (ret < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return -1;
+            }
+
+            offset += ret;
+            for (size_t written = ret; written > 0;)
+            {
+                auto & buf = vec[vec_index];
+                size_t advance = std::min(written, buf.iov_len);
+                buf.iov_base = static_cast<char *>(buf.iov_base) + advance;
+                buf.iov_len -= advance;
+                written -= advance;
+                if (buf.iov_len == 0)
+                    ++vec_index;
+            }
+        }
+        return 0;
+    }
+}
+
+void NuRaftLogSegment::setIOUring(LogIOUring * io_uring_)
+{
+    std::lock_guard write_lock(log_mutex);
+    if (io_uring == io_uring_)
+        return;
+
+    if (writePendingUnlocked() != 0)
+        LOG_WARNING(log, "Fail to write {} pending log entries before using io_uring", pending_entries.size());
+
+    io_uring = io_uring_;
+    written_index = last_index.load(std::memory_order_relaxed);
+}
+
+int NuRaftLogSegment::enableDirectIO()
+{
+    std::lock_guard write_lock(log_mutex);
+    if (direct_fd >= 0)
+        return 0;
+
+    if (!is_open || io_uring || seg_fd < 0)
+        return -1;
+
+    /// Entries written through page cache should be durable before, direct writes are regarded durable without fsync
+    errno = 0;
+    if (writePendingUnlocked() != 0 || ::fdatasync(seg_fd) != 0)
+    {
+        LOG_WARNING(log, "Fail to sync segment {} before writing it directly, error:{}", getFileName(), strerror(errno));
+        return -1;
+    }
+
+    String full_path = getOpenPath();
+    direct_fd = ::open(full_path.c_str(), O_RDWR | O_DIRECT | O_DSYNC);
+    if (direct_fd < 0)
+    {
+        LOG_WARNING(log, "Fail to open {} with O_DIRECT, write it through page cache, error:{}", full_path, strerror(errno));
+        return -1;
+    }
+
+    direct_buffer = Memory<>(DIRECT_IO_BLOCK_SIZE, DIRECT_IO_BLOCK_SIZE);
+    if (loadDirectTail() != 0)
+    {
+        ::close(direct_fd);
+        direct_fd = -1;
+        return -1;
+    }
+
+    LOG_INFO(log, "Write segment {} with O_DIRECT, last partial block at {} of size {}", full_path, direct_block_offset, direct_tail_size);
+    return 0;
+}
+
+int NuRaftLogSegment::loadDirectTail()
+{
+    UInt64 end = file_size.load(std::memory_order_relaxed);
+    direct_block_offset = end / DIRECT_IO_BLOCK_SIZE * DIRECT_IO_BLOCK_SIZE;
+    direct_tail_size = end - direct_block_offset;
+
+    errno = 0;
+    if (direct_tail_size
+        && pread(seg_fd, direct_buffer.data(), direct_tail_size, direct_block_offset) != static_cast<ssize_t>(direct_tail_size))
+    {
+        LOG_WARNING(log, "Fail to read last block of segment {} at {}, error:{}", getFileName(), direct_block_offset, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+int NuRaftLogSegment::writePendingDirectUnlocked()
+{
+    if (pending_entries.empty())
+        return 0;
+
+    size_t total_size = 0;
+    for (auto & pending : pending_entries)
+        total_size += LogEntryHeader::HEADER_SIZE + pending.header.data_length;
+
+    /// Entries follow the last partial block, the end is padded with zeros to a whole block
+    size_t end = direct_tail_size + total_size;
+    size_t write_size = (end + DIRECT_IO_BLOCK_SIZE - 1) / DIRECT_IO_BLOCK_SIZE * DIRECT_IO_BLOCK_SIZE;
+    if (direct_buffer.size() < write_size)
+        direct_buffer.resize(write_size);
+
+    char * pos = direct_buffer.data() + direct_tail_size;
+    for (auto & pending : pending_entries)
+    {
+        memcpy(pos, &pending.header, PendingEntry::PREFIX_SIZE);
+        pos += PendingEntry::PREFIX_SIZE;
+        memcpy(pos, pending.data->data_begin(), pending.dataSize());
+        pos += pending.dataSize();
+    }
+    memset(pos, 0, write_size - end);
+
+    for (size_t written = 0; written < write_size;)
+    {
+        errno = 0;
+        ssize_t ret = pwrite(direct_fd, direct_buffer.data() + written, write_size - written, direct_block_offset + written);
+        if (ret < 0 && errno == EINTR)
+            continue;
+
+        /// The next write starts from the last partial block again, so nothing is kept of a failed one
+        if (ret <= 0 || ret % DIRECT_IO_BLOCK_SIZE != 0)
+        {
+            LOG_WARNING(
+                log,
+                "Direct write of {} pending log entries failed, written {} of {}, error:{}",
+                pending_entries.size(),
+                written,
+                write_size,
+                strerror(errno));
+            return -1;
+        }
+        written += ret;
+    }
+
+    /// Keep the new last partial block for the next write
+    size_t full_size = end / DIRECT_IO_BLOCK_SIZE * DIRECT_IO_BLOCK_SIZE;
+    direct_tail_size = end - full_size;
+    memmove(direct_buffer.data(), direct_buffer.data() + full_size, direct_tail_size);
+    direct_block_offset += full_size;
+
+    LOG_TRACE(log, "Write {} pending log entries directly, size {}, blocks size {}", pending_entries.size(), total_size, write_size);
+    pending_entries.clear();
+    pending_written = 0;
+    return 0;
+}
+
+int NuRaftLogSegment::submitPending()
+{
+    std::lock_guard write_lock(log_mutex);
+    if (!io_uring)
+        return -1;
+    if (!pending_entries.empty())
+        LatencyInjection::instance().delay(InjectionPoint::LOG_WRITE);
+    return submitPendingUnlocked(true);
+}
+
+int NuRaftLogSegment::reapCompletions()
+{
+    std::lock_guard write_lock(log_mutex);
+    if (!io_uring)
+        return 0;
+    return reapCompletionsUnlocked(0, false);
+}
+
+int NuRaftLogSegment::submitPendingUnlocked(bool sync)
+{
+    if (pending_entries.empty() && !sync)
+        return 0;
+
+    if (seg_fd < 0)
+    {
+        LOG_ERROR(log, "seg fs is null.");
+        return -1;
+    }
+
+    /// Keep completions not taken bounded, the completion queue of the ring must not overflow
+    if (in_flight_writes.size() >= MAX_IN_FLIGHT_WRITES && reapCompletionsUnlocked(in_flight_writes.front().sequence, true) != 0)
+        return -1;
+
+    auto & write = in_flight_writes.emplace_back();
+    write.sequence = next_write_sequence++;
+    write.entries.swap(pending_entries);
+    write.last_index = last_index.load(std::memory_order_relaxed);
+    write.sync = sync;
+    /// Writes are at explicit offsets, a partial write by writev is done again as a whole
+    pending_written = 0;
+
+    if (write.entries.empty())
+    {
+        write.written = true;
+    }
+    else
+    {
+        write.offset = offset_term[write.entries.front().header.index - first_index].first;
+        write.vec.reserve(write.entries.size() * 2);
+        for (auto & pending : write.entries)
+        {
+            write.vec.push_back({&pending.header, PendingEntry::PREFIX_SIZE});
+            write.vec.push_back({pending.data->data_begin(), pending.dataSize()});
+            write.size += LogEntryHeader::HEADER_SIZE + pending.header.data_length;
+        }
+    }
+
+    try
+    {
+        UInt64 user_data = write.sequence << 1;
+        if (!write.written)
+        {
+            auto vec_size = static_cast<unsigned>(write.vec.size());
+            io_uring->ring.prepareWritev(seg_fd, write.vec.data(), vec_size, write.offset, user_data, /* link */ sync, /* drain */ false);
+        }
+        /// Drain, so the fdatasync also covers writes submitted before
+        if (sync)
+            io_uring->ring.prepareFdatasync(seg_fd, user_data | 1, true);
+        io_uring->ring.submit();
+    }
+    catch (...)
+    {
+        /// Requests already queued are submitted by the next call, but do not wait for them, redo the write by plain syscalls
+        tryLogCurrentException(log, "Fail to submit log write to io_uring");
+        if (!write.written && !write.write_result)
+            write.write_result = -ECANCELED;
+        if (sync && !write.sync_result)
+            write.sync_result = -ECANCELED;
+    }
+
+    LOG_TRACE(log, "Submit {} log entries, size {}, sync {}", write.entries.size(), write.size, sync);
+    return 0;
+}
+
+int NuRaftLogSegment::reapCompletionsUnlocked(UInt64 wait_sequence, bool wake_up_reaper)
+{
+    int ret = 0;
+    bool durable_advanced = false;
+    bool woken_up = false;
+
+    while (true)
+    {
+        UInt64 user_data;
+        int result;
+        while (io_uring->ring.popCompletion(user_data, result))
+        {
+            /// Sequence 0 is for waking up, writes of closed segments are retired already
+            UInt64 sequence = user_data >> 1;
+            woken_up |= sequence == 0;
+            if (in_flight_writes.empty() || sequence < in_flight_writes.front().sequence)
+                continue;
+            UInt64 pos = sequence - in_flight_writes.front().sequence;
+            if (pos >= in_flight_writes.size())
+                continue;
+
+            auto & write = in_flight_writes[pos];
+            (user_data & 1 ? write.sync_result : write.write_result) = result;
+        }
+
+        /// Retire in order, so a synced write means entries before it are durable too
+        while (!in_flight_writes.empty() && finishInFlightWrite(in_flight_writes.front()))
+        {
+            auto & write = in_flight_writes.front();
+            written_index = std::max(written_index, write.last_index);
+            if (write.sync)
+            {
+                io_uring->durable_index.store(write.last_index, std::memory_order_release);
+                durable_advanced = true;
+            }
+            in_flight_writes.pop_front();
+        }
+
+        if (in_flight_writes.empty() || in_flight_writes.front().sequence > wait_sequence)
+            break;
+
+        /// Writing it again failed, it is tried again by the next call
+        const auto & front = in_flight_writes.front();
+        if ((front.write_result && !front.written) || (front.sync_result && !front.synced))
+        {
+            ret = -1;
+            break;
+        }
+
+        try
+        {
+            io_uring->ring.wait();
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to wait for log write of io_uring");
+            ret = -1;
+            break;
+        }
+    }
+
+    /// The thread waiting for durable index misses completions taken here, wake it up, also pass on
+    /// the wake up taken from it. At most one is posted, so they do not pile up.
+    if (wake_up_reaper && (durable_advanced || woken_up) && io_uring->has_waiter.load(std::memory_order_acquire))
+    {
+        try
+        {
+            io_uring->ring.prepareNop(0);
+            io_uring->ring.submit();
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to wake up io_uring waiter");
+        }
+    }
+
+    return ret;
+}
+
+bool NuRaftLogSegment::finishInFlightWrite(InFlightWrite & write)
+{
+    if (!write.written)
+    {
+        if (!write.write_result)
+            return false;
+
+        if (*write.write_result == static_cast<int>(write.size))
+        {
+            write.written = true;
+        }
+        else
+        {
+            LOG_WARNING(
+                log,
+                "Write {} log entries by io_uring failed, offset {}, size {}, result {}, write again",
+                write.entries.size(),
+                write.offset,
+                write.size,
+                *write.write_result);
+            write.written = pwritevFully(seg_fd, write.vec, write.offset) == 0;
+            if (!write.written)
+            {
+                LOG_ERROR(log, "Write {} log entries failed, error:{}", write.entries.size(), strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    if (write.sync && !write.synced)
+    {
+        if (!write.sync_result)
+            return false;
+
+        if (*write.sync_result == 0)
+        {
+            write.synced = true;
+        }
+        else
+        {
+            /// A failed write cancels its linked fdatasync
+            if (*write.sync_result != -ECANCELED)
+                LOG_WARNING(log, "Fdatasync by io_uring failed, result {}, sync again", *write.sync_result);
+            write.synced = ::fdatasync(seg_fd) == 0;
+            if (!write.synced)
+            {
+                LOG_ERROR(log, "log fsync error error no {}", errno);
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+#endif
+
+int NuRaftLogSegment::prepareRead(UInt64 last_read_index)
+{
+    std::lock_guard write_lock(log_mutex);
+    if (openFile() != 0)
+        return -1;
+    bool unwritten = !pending_entries.empty() && last_read_index >= pending_entries.front().header.index;
+#if defined(OS_LINUX)
+    unwritten |= io_uring && last_read_index > written_index;
+#endif
+    if (unwritten && writePendingUnlocked() != 0)
+        return -1;
+
+    if (!is_open && !mapped_file && !mapping_disabled && mapFile() != 0)
+        mapping_disabled = true;
+    return 0;
+}
+
 ptr<log_entry> NuRaftLogSegment::getEntry(UInt64 index)
 {
     {
-        std::lock_guard write_lock(log_mutex);
-        if (openFile() != 0)
-            return nullptr;
+        std::shared_lock read_lock(log_mutex);
+        if (mapped_file)
+            return getMappedEntry(index);
     }
 
+    if (prepareRead(index) != 0)
+        return nullptr;
+
     std::shared_lock read_lock(log_mutex);
+    if (mapped_file)
+        return getMappedEntry(index);
+
     LogMeta meta;
 
     if (getMeta(index, &meta) != 0)
@@ -616,6 +1501,140 @@ ptr<log_entry> NuRaftLogSegment::getEntry(UInt64 index)
 }
 
 
+int NuRaftLogSegment::mapFile()
+{
+    try
+    {
+        mapped_file = std::make_unique<MMapReadBufferFromFileDescriptor>(seg_fd, 0, file_size.load(std::memory_order_relaxed));
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, "Fail to map segment " + getFileName() + ", read it by pread");
+        return -1;
+    }
+    return 0;
+}
+
+ptr<log_entry> NuRaftLogSegment::getMappedEntry(UInt64 index) const
+{
+    LogMeta meta;
+    if (getMeta(index, &meta) != 0)
+        return nullptr;
+
+    if (meta.length < LogEntryHeader::HEADER_SIZE || meta.offset + meta.length > mapped_file->buffer().size())
+    {
+        LOG_ERROR(log, "Entry at offset {} length {} is out of mapped segment {}", meta.offset, meta.length, file_name);
+        return nullptr;
+    }
+
+    return parseEntry(mapped_file->buffer().begin() + meta.offset, meta);
+}
+
+ptr<log_entry> NuRaftLogSegment::parseEntry(const char * pos, const LogMeta & meta) const
+{
+    /// Header is written as it is in memory, see writePendingUnlocked
+    LogEntryHeader header;
+    memcpy(&header, pos, LogEntryHeader::HEADER_SIZE);
+    const char * data = pos + LogEntryHeader::HEADER_SIZE;
+
+    if (header.data_length != meta.length - LogEntryHeader::HEADER_SIZE || !verifyCRC32(data, header.data_length, header.data_crc))
+    {
+        LOG_ERROR(
+            log,
+            "Found corrupted data at offset {}, term {}, index {}, length {}, crc {}, file {}",
+            meta.offset,
+            header.term,
+            header.index,
+            header.data_length,
+            header.data_crc,
+            file_name);
+        return nullptr;
+    }
+
+    auto entry = LogEntryBody::parse(data, header.data_length);
+    entry->set_term(header.term);
+    return entry;
+}
+
+int NuRaftLogSegment::getEntries(
+    UInt64 start_index, UInt64 end_index, int64 max_bytes, int64 & read_bytes, std::vector<ptr<log_entry>> & entries)
+{
+    end_index = std::min(end_index, lastIndex());
+    if (start_index > end_index)
+        return 0;
+
+    /// Return whether the entry is taken
+    auto take = [&](const ptr<log_entry> & entry)
+    {
+        int64 size = getBatchSize(entry);
+        if (max_bytes > 0 && read_bytes + size > max_bytes && !entries.empty())
+            return false;
+        entries.push_back(entry);
+        read_bytes += size;
+        return true;
+    };
+
+    if (prepareRead(end_index) != 0)
+        return -1;
+
+    std::shared_lock read_lock(log_mutex);
+    if (mapped_file)
+    {
+        for (UInt64 index = start_index; index <= end_index; ++index)
+        {
+            auto entry = getMappedEntry(index);
+            if (!entry)
+                return -1;
+            if (!take(entry))
+                break;
+        }
+        return 0;
+    }
+
+    auto end_offset = [this](UInt64 index)
+    { return index < last_index.load(std::memory_order_relaxed) ? offset_term[index + 1 - first_index].first : file_size.load(); };
+
+    std::vector<char> chunk;
+    for (UInt64 index = start_index; index <= end_index;)
+    {
+        /// Read ahead following entries unless the chunk exceeds READAHEAD_SIZE or what is left of max_bytes
+        UInt64 chunk_offset = offset_term[index - first_index].first;
+        UInt64 chunk_last = index;
+        while (chunk_last < end_index && end_offset(chunk_last + 1) - chunk_offset <= READAHEAD_SIZE
+               && (max_bytes <= 0 || read_bytes + static_cast<int64>(end_offset(chunk_last) - chunk_offset) < max_bytes))
+            ++chunk_last;
+
+        chunk.resize(end_offset(chunk_last) - chunk_offset);
+        errno = 0;
+        ssize_t ret = pread(seg_fd, chunk.data(), chunk.size(), chunk_offset);
+        if (ret != static_cast<ssize_t>(chunk.size()))
+        {
+            LOG_ERROR(
+                log,
+                "Read entries failed, file {}, offset {}, size {}, ret:{}, error:{}.",
+                file_name,
+                chunk_offset,
+                chunk.size(),
+                ret,
+                strerror(errno));
+            return -1;
+        }
+
+        for (; index <= chunk_last; ++index)
+        {
+            LogMeta meta;
+            if (getMeta(index, &meta) != 0 || meta.length < LogEntryHeader::HEADER_SIZE)
+                return -1;
+            auto entry = parseEntry(chunk.data() + (meta.offset - chunk_offset), meta);
+            if (!entry)
+                return -1;
+            if (!take(entry))
+                return 0;
+        }
+    }
+    return 0;
+}
+
 UInt64 NuRaftLogSegment::getTerm(UInt64 index) const
 {
     LogMeta meta;
@@ -639,6 +1658,14 @@ int NuRaftLogSegment::truncate(const UInt64 last_index_kept)
             return 0;
         }
 
+        /// Offsets of pending entries are on the file, write them before truncating
+        if (writePendingUnlocked() != 0)
+            return -1;
+
+        /// Reading a mapping beyond the end of file crashes
+        mapped_file.reset();
+        mapping_disabled = true;
+
         first_truncate_in_offset = last_index_kept + 1 - first_index;
         truncate_size = offset_term[first_truncate_in_offset].first;
 
@@ -657,6 +1684,9 @@ int NuRaftLogSegment::truncate(const UInt64 last_index_kept)
     /// because the node may crash before truncate.
     if (!is_open)
     {
+        /// Remove the index first, a segment closed again may have the same name
+        ::unlink(getIndexPath().c_str());
+
         String old_path = getFinishPath();
         String new_path = getOpenPath();
 
@@ -677,7 +1707,7 @@ int NuRaftLogSegment::truncate(const UInt64 last_index_kept)
     openFile();
 
     errno = 0;
-    int ret = ftruncate(seg_fd, truncate_size);
+    int ret = truncateFile(truncate_size);
 
     if (ret != 0)
     {
@@ -701,11 +1731,45 @@ int NuRaftLogSegment::truncate(const UInt64 last_index_kept)
         offset_term.resize(first_truncate_in_offset);
         last_index.store(last_index_kept, std::memory_order_release);
         file_size = truncate_size;
+#if defined(OS_LINUX)
+        written_index = std::min(written_index, last_index_kept);
+        if (direct_fd >= 0 && loadDirectTail() != 0)
+        {
+            LOG_WARNING(log, "Write segment {} through page cache after truncating", getFileName());
+            ::close(direct_fd);
+            direct_fd = -1;
+        }
+#endif
     }
 
     return ret;
 }
 
+LogSegmentStore::~LogSegmentStore()
+{
+    if (spare_thread.joinable())
+        spare_thread.join();
+
+    offload_cancelled = true;
+    if (offload_thread.joinable())
+        offload_thread.join();
+
+    /// Files still queued are deleted before the reclaimer exits
+    {
+        std::lock_guard lock(reclaim_mutex);
+        reclaimer_stopped = true;
+    }
+    reclaim_cv.notify_all();
+    if (reclaim_thread.joinable())
+        reclaim_thread.join();
+
+#if defined(OS_LINUX)
+    /// Wait for writes in flight, the kernel uses their buffers
+    if (io_uring)
+        close();
+#endif
+}
+
 ptr<LogSegmentStore> LogSegmentStore::getInstance(const String & log_dir_, bool force_new)
 {
     static ptr<LogSegmentStore> segment_store;
@@ -714,7 +1778,14 @@ ptr<LogSegmentStore> LogSegmentStore::getInstance(const String & log_dir_, bool
     return segment_store;
 }
 
-int LogSegmentStore::init(UInt32 max_segment_file_size_, UInt32 max_segment_count_)
+int LogSegmentStore::init(
+    UInt32 max_segment_file_size_,
+    UInt32 max_segment_count_,
+    bool use_io_uring,
+    bool preallocate_,
+    bool direct_io_,
+    bool compress_,
+    const String & cold_dir_)
 {
     LOG_INFO(
         log,
@@ -724,9 +1795,64 @@ int LogSegmentStore::init(UInt32 max_segment_file_size_, UInt32 max_segment_coun
 
     max_segment_file_size = max_segment_file_size_;
     max_segment_count = max_segment_count_;
+    compress = compress_;
 
     Poco::File(log_dir).createDirectories();
 
+    if (spare_thread.joinable())
+        spare_thread.join();
+    if (offload_thread.joinable())
+        offload_thread.join();
+
+    cold_dir = cold_dir_;
+    if (!cold_dir.empty())
+    {
+        Poco::File(cold_dir).createDirectories();
+        LOG_INFO(log, "Move closed segments covered by snapshot to {}", cold_dir);
+    }
+
+    startReclaimer();
+
+#if defined(OS_LINUX)
+    preallocate = preallocate_;
+    direct_io = direct_io_;
+    if (direct_io && use_io_uring)
+    {
+        LOG_WARNING(log, "Direct log writes are synchronous, io_uring is not used with them");
+        use_io_uring = false;
+    }
+#else
+    if (preallocate_)
+        LOG_WARNING(log, "Preallocating log segments is only supported on Linux");
+    if (direct_io_)
+        LOG_WARNING(log, "Direct log writes are only supported on Linux");
+#endif
+
+    /// A spare made by an interrupted preparation is incomplete
+    String spare_path = getSparePath();
+    ::unlink((spare_path + ".tmp").c_str());
+    if (!preallocate)
+        ::unlink(spare_path.c_str());
+    spare_ready = preallocate && Poco::File(spare_path).exists();
+
+#if defined(OS_LINUX)
+    if (use_io_uring && !io_uring)
+    {
+        try
+        {
+            io_uring = std::make_unique<LogIOUring>(IO_URING_ENTRIES);
+            LOG_INFO(log, "Write log segments by io_uring");
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "io_uring is not available, write log segments by plain syscalls");
+        }
+    }
+#else
+    if (use_io_uring)
+        LOG_WARNING(log, "io_uring is only available on Linux, write log segments by plain syscalls");
+#endif
+
     int ret = 0;
 
     first_log_index.store(1);
@@ -756,6 +1882,20 @@ int LogSegmentStore::init(UInt32 max_segment_file_size_, UInt32 max_segment_coun
         }
     } while (false);
 
+    if (ret == 0 && preallocate)
+        prepareSpare();
+
+#if defined(OS_LINUX)
+    /// The open segment may be loaded rather than created by openSegment
+    if (ret == 0 && io_uring)
+    {
+        io_uring->durable_index.store(last_log_index.load());
+        open_segment->setIOUring(io_uring.get());
+    }
+    if (ret == 0 && direct_io)
+        open_segment->enableDirectIO();
+#endif
+
     return ret;
 }
 
@@ -800,24 +1940,207 @@ int LogSegmentStore::openSegment()
     ptr<NuRaftLogSegment> seg = cs_new<NuRaftLogSegment>(log_dir, next_idx);
 
     open_segment = seg;
-    if (open_segment->create() != 0)
+    if (preallocate && spare_ready.exchange(false))
     {
-        LOG_ERROR(log, "Create open segment directory {} index {} failed.", log_dir, next_idx);
-        open_segment = nullptr;
-        return -1;
+        open_segment->setPreallocateSize(max_segment_file_size);
+        if (open_segment->createFromSpare(getSparePath()) != 0)
+        {
+            LOG_ERROR(log, "Create open segment directory {} index {} from spare failed.", log_dir, next_idx);
+            open_segment = nullptr;
+            return -1;
+        }
     }
+    else
+    {
+        if (open_segment->create() != 0)
+        {
+            LOG_ERROR(log, "Create open segment directory {} index {} failed.", log_dir, next_idx);
+            open_segment = nullptr;
+            return -1;
+        }
 
-    try
+        try
+        {
+            open_segment->writeFileHeader();
+        }
+        catch (...)
+        {
+            open_segment = nullptr;
+            return -1;
+        }
+    }
+
+    if (preallocate)
+        prepareSpare();
+
+#if defined(OS_LINUX)
+    if (io_uring)
+        open_segment->setIOUring(io_uring.get());
+    if (direct_io)
+        open_segment->enableDirectIO();
+#endif
+
+    return 0;
+}
+
+void LogSegmentStore::prepareSpare()
+{
+    if (spare_ready || preparing_spare.exchange(true))
+        return;
+
+    /// The last preparation is finished
+    if (spare_thread.joinable())
+        spare_thread.join();
+
+    spare_thread = ThreadFromGlobalPool(
+        [this]
+        {
+            setThreadName("LogSpare");
+            spare_ready = NuRaftLogSegment::createSpare(getSparePath(), max_segment_file_size) == 0;
+            preparing_spare = false;
+        });
+}
+
+void LogSegmentStore::startReclaimer()
+{
+    if (reclaim_thread.joinable())
+        return;
+
+    reclaim_thread = ThreadFromGlobalPool(
+        [this]
+        {
+            setThreadName("LogReclaim");
+            std::unique_lock lock(reclaim_mutex);
+            while (true)
+            {
+                reclaim_cv.wait(lock, [this] { return !reclaim_queue.empty() || reclaimer_stopped; });
+                if (reclaim_queue.empty())
+                    return;
+
+                String path = reclaim_queue.front();
+                lock.unlock();
+                deleteGradually(path);
+                lock.lock();
+
+                reclaim_queue.pop_front();
+                reclaim_cv.notify_all();
+            }
+        });
+}
+
+void LogSegmentStore::reclaim(std::vector<ptr<NuRaftLogSegment>> & removed)
+{
+    for (auto & seg : removed)
     {
-        open_segment->writeFileHeader();
+        String path = seg->removeLater();
+        if (!path.empty())
+            reclaimFile(path);
+        LOG_INFO(log, "Remove segment, directory {}, file {}", log_dir, seg->getFileName());
+        seg = nullptr;
     }
-    catch (...)
+}
+
+void LogSegmentStore::reclaimFile(const String & path)
+{
     {
-        open_segment = nullptr;
-        return -1;
+        std::lock_guard lock(reclaim_mutex);
+        if (reclaim_thread.joinable())
+        {
+            reclaim_queue.push_back(path);
+            reclaim_cv.notify_all();
+            return;
+        }
     }
+    deleteGradually(path);
+}
 
-    return 0;
+void LogSegmentStore::deleteGradually(const String & path) const
+{
+    int fd = ::open(path.c_str(), O_WRONLY);
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (fstat(fd, &st) == 0)
+        {
+            for (off_t size = st.st_size; size > 0;)
+            {
+                size = size > RECLAIM_TRUNCATE_STEP ? size - RECLAIM_TRUNCATE_STEP : 0;
+                if (ftruncateUninterrupted(fd, size) != 0)
+                {
+                    LOG_WARNING(log, "Truncate removed segment {} failed, error:{}", path, strerror(errno));
+                    break;
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    if (::unlink(path.c_str()) != 0 && errno != ENOENT)
+        LOG_WARNING(log, "Unlink removed segment {} failed, error:{}", path, strerror(errno));
+    else
+        LOG_INFO(log, "Delete removed segment {}", path);
+}
+
+void LogSegmentStore::offloadSegments(UInt64 last_index)
+{
+    if (cold_dir.empty())
+        return;
+
+    UInt64 prev_index = offload_index.load();
+    while (prev_index < last_index && !offload_index.compare_exchange_weak(prev_index, last_index))
+        ;
+
+    if (offloading.exchange(true))
+        return;
+
+    /// The last offloading is finished
+    if (offload_thread.joinable())
+        offload_thread.join();
+
+    offload_thread = ThreadFromGlobalPool(
+        [this]
+        {
+            setThreadName("LogOffload");
+            /// The index may be raised while moving
+            for (UInt64 moved_index = 0; !offload_cancelled && moved_index != offload_index;)
+            {
+                moved_index = offload_index;
+                moveColdSegments(moved_index);
+            }
+            offloading = false;
+        });
+}
+
+void LogSegmentStore::moveColdSegments(UInt64 last_index)
+{
+    Segments to_move;
+    {
+        std::shared_lock read_lock(seg_mutex);
+        for (const auto & segment : segments)
+            if (segment->lastIndex() <= last_index && segment->getDir() != cold_dir)
+                to_move.push_back(segment);
+    }
+
+    for (auto & segment : to_move)
+    {
+        if (offload_cancelled)
+            break;
+        String old_path = segment->moveTo(cold_dir, offload_cancelled);
+        if (!old_path.empty())
+            reclaimFile(old_path);
+    }
+}
+
+void LogSegmentStore::waitOffloaded()
+{
+    if (offload_thread.joinable())
+        offload_thread.join();
+}
+
+void LogSegmentStore::waitReclaimed()
+{
+    std::unique_lock lock(reclaim_mutex);
+    reclaim_cv.wait(lock, [this] { return reclaim_queue.empty(); });
 }
 
 int LogSegmentStore::getSegment(UInt64 index, ptr<NuRaftLogSegment> & seg)
@@ -868,7 +2191,16 @@ LogVersion LogSegmentStore::getVersion(UInt64 index)
     return seg->getVersion();
 }
 
-UInt64 LogSegmentStore::appendEntry(ptr<log_entry> entry)
+UInt64 LogSegmentStore::getLogBytes() const
+{
+    std::shared_lock read_lock(seg_mutex);
+    UInt64 bytes = open_segment ? open_segment->getFileSize() : 0;
+    for (const auto & segment : segments)
+        bytes += segment->getFileSize();
+    return bytes;
+}
+
+UInt64 LogSegmentStore::appendEntry(ptr<log_entry> entry, bool deferred)
 {
     if (openSegment() != 0)
     {
@@ -876,7 +2208,75 @@ UInt64 LogSegmentStore::appendEntry(ptr<log_entry> entry)
         return -1;
     }
     std::shared_lock read_lock(seg_mutex);
-    return open_segment->appendEntry(entry, last_log_index);
+    return open_segment->appendEntry(entry, last_log_index, deferred, compress);
+}
+
+int LogSegmentStore::writePending()
+{
+    std::shared_lock read_lock(seg_mutex);
+    return open_segment ? open_segment->writePending() : 0;
+}
+
+bool LogSegmentStore::hasIOUring() const
+{
+#if defined(OS_LINUX)
+    return io_uring != nullptr;
+#else
+    return false;
+#endif
+}
+
+int LogSegmentStore::submitPending()
+{
+#if defined(OS_LINUX)
+    std::shared_lock read_lock(seg_mutex);
+    if (io_uring && open_segment)
+        return open_segment->submitPending();
+#endif
+    return -1;
+}
+
+UInt64 LogSegmentStore::waitDurable()
+{
+#if defined(OS_LINUX)
+    if (io_uring)
+    {
+        io_uring->has_waiter.store(true, std::memory_order_release);
+        try
+        {
+            io_uring->ring.wait();
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to wait for log writes of io_uring");
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
+        LatencyInjection::instance().delay(InjectionPoint::LOG_FSYNC);
+
+        std::shared_lock read_lock(seg_mutex);
+        if (open_segment && open_segment->reapCompletions() != 0)
+            LOG_WARNING(log, "Fail to complete log writes of io_uring, retry later");
+        return io_uring->durable_index.load(std::memory_order_acquire);
+    }
+#endif
+    return 0;
+}
+
+void LogSegmentStore::wakeUp()
+{
+#if defined(OS_LINUX)
+    if (!io_uring)
+        return;
+    try
+    {
+        io_uring->ring.prepareNop(0);
+        io_uring->ring.submit();
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, "Fail to wake up io_uring waiter");
+    }
+#endif
 }
 
 UInt64 LogSegmentStore::writeAt(UInt64 index, ptr<log_entry> entry)
@@ -916,7 +2316,7 @@ void LogSegmentStore::getEntries(UInt64 start_index, UInt64 end_index, ptr<std::
 }
 
 
-[[maybe_unused]] void LogSegmentStore::getEntriesExt(
+void LogSegmentStore::getEntriesExt(
     UInt64 start_index, UInt64 end_index, int64 batch_size_hint_in_bytes, ptr<std::vector<ptr<log_entry>>> & entries)
 {
     if (entries == nullptr)
@@ -925,19 +2325,32 @@ void LogSegmentStore::getEntries(UInt64 start_index, UInt64 end_index, ptr<std::
         return;
     }
 
-    int64 get_size = 0;
-    int64 entry_size = 0;
+    std::shared_lock read_lock(seg_mutex);
+    end_index = std::min(end_index, last_log_index.load(std::memory_order_acquire));
+    int64 read_bytes = 0;
 
-    for (UInt64 index = start_index; index <= end_index; index++)
+    for (UInt64 index = start_index; index <= end_index;)
     {
-        auto entry_pt = getEntry(index);
-        entry_size = entry_pt->get_buf().size() + sizeof(ulong) + sizeof(char);
+        ptr<NuRaftLogSegment> seg;
+        if (getSegment(index, seg) != 0)
+        {
+            LOG_WARNING(log, "Can't find log segment by index {}.", index);
+            return;
+        }
 
-        if (get_size + entry_size > batch_size_hint_in_bytes)
-            break;
+        UInt64 last_index = std::min(end_index, seg->lastIndex());
+        size_t size_before = entries->size();
+        if (seg->getEntries(index, last_index, batch_size_hint_in_bytes, read_bytes, *entries) != 0)
+        {
+            LOG_WARNING(log, "Get entries failed, index range [{}, {}], segment {}.", index, last_index, seg->getFileName());
+            return;
+        }
 
-        entries->push_back(entry_pt);
-        get_size += entry_size;
+        UInt64 read_count = entries->size() - size_before;
+        /// Batch is full
+        if (index + read_count <= last_index)
+            return;
+        index += read_count;
     }
 }
 
@@ -963,9 +2376,9 @@ int LogSegmentStore::removeSegment(UInt64 first_index_kept)
         return 0;
     }
 
+    std::vector<ptr<NuRaftLogSegment>> to_be_removed;
     {
         std::lock_guard write_lock(seg_mutex);
-        std::vector<ptr<NuRaftLogSegment>> to_be_removed;
 
         {
             first_log_index.store(first_index_kept, std::memory_order_release);
@@ -1009,17 +2422,12 @@ int LogSegmentStore::removeSegment(UInt64 first_index_kept)
             }
         }
 
-        for (auto & seg : to_be_removed)
-        {
-            seg->remove();
-            LOG_INFO(log, "Remove segment, directory {}, file {}", log_dir, seg->getFileName());
-        }
-
         /// reset last_log_index
         if (last_log_index == 0 || (last_log_index - 1) < first_log_index)
             last_log_index.store(first_log_index - 1, std::memory_order_release);
     }
 
+    reclaim(to_be_removed);
     return 0;
 }
 
@@ -1032,10 +2440,10 @@ int LogSegmentStore::removeSegment()
         return 0;
     }
 
-    std::lock_guard write_lock(seg_mutex);
     std::vector<ptr<NuRaftLogSegment>> remove_vec;
 
     {
+        std::lock_guard write_lock(seg_mutex);
         std::sort(segments.begin(), segments.end(), compareSegment);
         for (UInt32 i = 0; i < remove_count; i++)
         {
@@ -1046,12 +2454,7 @@ int LogSegmentStore::removeSegment()
         }
     }
 
-    for (auto & i : remove_vec)
-    {
-        i->remove();
-        LOG_INFO(log, "Remove segment, directory {}, file {}", log_dir, i->getFileName());
-        i = nullptr;
-    }
+    reclaim(remove_vec);
     return 0;
 }
 
@@ -1108,12 +2511,7 @@ int LogSegmentStore::truncateLog(UInt64 last_index_kept)
     }
 
     ///remove files
-    for (auto & i : remove_vec)
-    {
-        i->remove();
-        LOG_INFO(log, "Remove segment, directory {}, file {}", log_dir, i->getFileName());
-        i = nullptr;
-    }
+    reclaim(remove_vec);
 
     if (last_segment)
     {
@@ -1137,6 +2535,14 @@ int LogSegmentStore::truncateLog(UInt64 last_index_kept)
 
             if (!segments.empty())
                 segments.erase(segments.end() - 1);
+
+#if defined(OS_LINUX)
+            /// The reopened segment is written like a new one
+            if (io_uring)
+                open_segment->setIOUring(io_uring.get());
+            if (direct_io)
+                open_segment->enableDirectIO();
+#endif
         }
         if (ret == 0)
             last_log_index.store(last_index_kept, std::memory_order_release);
@@ -1188,6 +2594,65 @@ int LogSegmentStore::reset(UInt64 next_log_index)
     return 0;
 }
 
+void LogSegmentStore::listColdSegments()
+{
+    std::vector<String> files;
+    Poco::File(cold_dir).list(files);
+
+    std::vector<String> index_files;
+    for (const auto & file_name : files)
+    {
+        String path = cold_dir + "/" + file_name;
+        if (file_name.starts_with(NuRaftLogSegment::REMOVED_FILE_PREFIX))
+        {
+            reclaimFile(path);
+            continue;
+        }
+
+        /// Copy or index interrupted by restart
+        if (file_name.ends_with(".tmp"))
+        {
+            ::unlink(path.c_str());
+            continue;
+        }
+
+        if (file_name.starts_with(NuRaftLogSegment::INDEX_FILE_PREFIX))
+        {
+            index_files.push_back(file_name);
+            continue;
+        }
+
+        UInt64 first_index = 0;
+        UInt64 last_index = 0;
+        char create_time[128];
+        if (sscanf(file_name.c_str(), NuRaftLogSegment::LOG_FINISH_FILE_NAME, &first_index, &last_index, create_time) != 3)
+            continue;
+
+        /// Restarted before the original was renamed, it is still used
+        auto same_segment = [&file_name](const ptr<NuRaftLogSegment> & segment) { return segment->getFileName() == file_name; };
+        if (std::any_of(segments.begin(), segments.end(), same_segment))
+        {
+            LOG_INFO(log, "Remove copy {} of segment in log directory", path);
+            ::unlink((cold_dir + "/" + NuRaftLogSegment::INDEX_FILE_PREFIX + file_name).c_str());
+            reclaimFile(path);
+            continue;
+        }
+
+        LOG_INFO(log, "Restore cold segment, directory {}, first index {}, last index {}", cold_dir, first_index, last_index);
+        segments.push_back(cs_new<NuRaftLogSegment>(cold_dir, first_index, last_index, file_name));
+    }
+
+    for (const auto & index_file : index_files)
+    {
+        String segment_file = index_file.substr(strlen(NuRaftLogSegment::INDEX_FILE_PREFIX));
+        if (std::find(files.begin(), files.end(), segment_file) == files.end())
+        {
+            LOG_INFO(log, "Remove cold index {} without segment", index_file);
+            ::unlink((cold_dir + "/" + index_file).c_str());
+        }
+    }
+}
+
 int LogSegmentStore::listSegments()
 {
     Poco::File file_dir(log_dir);
@@ -1200,8 +2665,22 @@ int LogSegmentStore::listSegments()
     std::vector<String> files;
     file_dir.list(files);
 
+    std::vector<String> index_files;
     for (const auto& file_name : files)
     {
+        /// Removed before restart and not deleted yet
+        if (file_name.starts_with(NuRaftLogSegment::REMOVED_FILE_PREFIX))
+        {
+            reclaimFile(log_dir + "/" + file_name);
+            continue;
+        }
+
+        if (file_name.starts_with(NuRaftLogSegment::INDEX_FILE_PREFIX))
+        {
+            index_files.push_back(file_name);
+            continue;
+        }
+
         if (file_name.find("log_") == String::npos)
             continue;
 
@@ -1230,6 +2709,8 @@ int LogSegmentStore::listSegments()
             if (!open_segment)
             {
                 open_segment = cs_new<NuRaftLogSegment>(log_dir, first_index, file_name, String(create_time));
+                if (preallocate)
+                    open_segment->setPreallocateSize(max_segment_file_size);
                 LOG_INFO(log, "Create open segment, directory {}, first index {}, file name {}", log_dir, first_index, file_name);
                 continue;
             }
@@ -1241,8 +2722,22 @@ int LogSegmentStore::listSegments()
         }
     }
 
+    if (!cold_dir.empty())
+        listColdSegments();
+
     std::sort(segments.begin(), segments.end(), compareSegment);
 
+    /// Indexes of segments removed before crash, and temporary files of unfinished writes
+    for (const auto & index_file : index_files)
+    {
+        String segment_file = index_file.substr(strlen(NuRaftLogSegment::INDEX_FILE_PREFIX));
+        if (std::find(files.begin(), files.end(), segment_file) == files.end())
+        {
+            LOG_INFO(log, "Remove index {} without segment", index_file);
+            Poco::File(log_dir + "/" + index_file).remove();
+        }
+    }
+
     /// 0 close/open segment
     /// 1 open segment
     /// N close segment + 1 open segment
@@ -1315,37 +2810,30 @@ int LogSegmentStore::listSegments()
 
 int LogSegmentStore::loadSegments()
 {
-    /// closed segments
+    /// closed segments, segments differ in size so threads steal from each other rather than load every LOAD_THREAD_NUM-th one
     ThreadPool load_thread_pool(LOAD_THREAD_NUM);
+    Poco::Logger * thread_log = &(Poco::Logger::get("LoadLogThread"));
 
-    for (UInt32 thread_idx = 0; thread_idx < LOAD_THREAD_NUM; thread_idx++)
-    {
-        load_thread_pool.trySchedule([this, thread_idx] {
-            Poco::Logger * thread_log = &(Poco::Logger::get("LoadLogThread"));
-            int ret = 0;
-            for (size_t seg_idx = 0; seg_idx < this->getClosedSegments().size(); seg_idx++)
+    parallelFor(
+        load_thread_pool,
+        LOAD_THREAD_NUM,
+        getClosedSegments().size(),
+        [this, thread_log](size_t seg_idx)
+        {
+            ptr<NuRaftLogSegment> segment = this->getClosedSegments()[seg_idx];
+            LOG_INFO(thread_log, "Load closed segment, first_index {}, last_index {}", segment->firstIndex(), segment->lastIndex());
+            int ret = segment->load();
+            if (ret != 0)
             {
-                if (seg_idx % LOAD_THREAD_NUM == thread_idx)
-                {
-                    ptr<NuRaftLogSegment> segment = this->getClosedSegments()[seg_idx];
-                    LOG_INFO(thread_log, "Load closed segment, first_index {}, last_index {}", segment->firstIndex(), segment->lastIndex());
-                    ret = segment->load();
-                    if (ret != 0)
-                    {
-                        LOG_WARNING(log, "Load closed segment {} failed {}", segment->firstIndex(), ret);
-                        continue;
-                    }
-                    if (segment->lastIndex() > this->lastLogIndex())
-                    {
-                        LOG_INFO(log, "Close segment last index {}", segment->lastIndex());
-                        this->setLastLogIndex(segment->lastIndex());
-                    }
-                }
+                LOG_WARNING(log, "Load closed segment {} failed {}", segment->firstIndex(), ret);
+                return;
+            }
+            if (segment->lastIndex() > this->lastLogIndex())
+            {
+                LOG_INFO(log, "Close segment last index {}", segment->lastIndex());
+                this->setLastLogIndex(segment->lastIndex());
             }
         });
-    }
-
-    load_thread_pool.wait();
 
     /// open segment
     if (open_segment)
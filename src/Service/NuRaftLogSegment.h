@@ -1,40 +1,49 @@
 #pragma once
 
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <optional>
 #include <shared_mutex>
 #include <vector>
 
 #include <Poco/DateTime.h>
 #include <Poco/DateTimeFormatter.h>
 
+#include <Common/IO/BufferWithOwnMemory.h>
+#include <Common/IO/MMapReadBufferFromFileDescriptor.h>
+#include <Common/IOUring.h>
+#include <Common/ProfiledMutex.h>
+#include <Common/ThreadPool.h>
 #include <common/logger_useful.h>
 #include <libnuraft/basic_types.hxx>
 #include <libnuraft/nuraft.hxx>
 
 #include <Service/KeeperUtils.h>
 #include <Service/LogEntry.h>
+#include <Service/LogStorage.h>
 
 
 namespace RK
 {
 using nuraft::int64;
 
-enum class LogVersion : uint8_t
+#if defined(OS_LINUX)
+/// io_uring shared by segments of a LogSegmentStore
+struct LogIOUring
 {
-    V0 = 0,
-    V1 = 1, /// with ctime mtime
-};
+    explicit LogIOUring(unsigned entries) : ring(entries) { }
 
-/// Attach version to log entry
-struct VersionLogEntry
-{
-    LogVersion version;
-    ptr<log_entry> entry;
+    IOUring ring;
+    /// Last index written and synced
+    std::atomic<UInt64> durable_index{0};
+    /// Whether a thread waits for durable_index by LogSegmentStore::waitDurable, others wake it up when they advance it.
+    std::atomic<bool> has_waiter{false};
 };
-
-static constexpr auto CURRENT_LOG_VERSION = LogVersion::V1;
+#endif
 
 class NuRaftLogSegment
 {
@@ -80,6 +89,16 @@ public:
     /// return 0 if success
     int create();
 
+    /// Create open segment by renaming a spare made by createSpare, return 0 if success.
+    int createFromSpare(const String & spare_path);
+
+    /// Create a spare segment file with file header and size bytes preallocated, return 0 if success.
+    /// It is written to a temporary file and renamed, so the spare is complete if it exists.
+    static int createSpare(const String & spare_path, UInt64 size);
+
+    /// The file of open segment is preallocated to size, its end is found by checking entries when it is loaded.
+    void setPreallocateSize(UInt64 size) { preallocate_size = size; }
+
     /// load an segment
     /// return 0 if success
     int load();
@@ -94,6 +113,17 @@ public:
     /// return 0 if success
     int remove();
 
+    /// Close the segment and rename its file with REMOVED_FILE_PREFIX, so it can be deleted later without blocking anybody.
+    /// Return the new path, or empty string if the segment has no file.
+    String removeLater();
+
+    /// Copy the file of the closed segment into dir and read the segment from there, stop early if cancelled.
+    /// The old file is renamed like removeLater, return its new path, or empty string if the segment is not moved.
+    String moveTo(const String & dir, const std::atomic<bool> & cancelled);
+
+    /// Directory of the segment file
+    const String & getDir() const { return log_dir; }
+
     /**
      * write segment file header
      *      magic : \0RaftLog 8 bytes
@@ -108,16 +138,48 @@ public:
     LogVersion getVersion() const { return version; }
 
     /// flush log, return last flushed log index if success or 0 if failed
-    inline UInt64 flush() const;
+    inline UInt64 flush();
+
+    /// serialize entry, and append to open segment, return new start index.
+    /// If deferred, the entry is kept in memory and written together with the following ones by writePending,
+    /// it is also written when it is read, flushed or the segment is closed or truncated.
+    /// If compress and the segment is V2 or later, the entry body is compressed, see LogEntryBody::serialize.
+    UInt64 appendEntry(ptr<log_entry> entry, std::atomic<UInt64> & last_log_index, bool deferred = false, bool compress = false);
+
+    /// Write deferred entries with one writev, return 0 if success. Entries are kept and written again
+    /// by the next call if it fails.
+    int writePending();
+
+#if defined(OS_LINUX)
+    /// Write and fdatasync by io_uring from now on.
+    void setIOUring(LogIOUring * io_uring_);
+
+    /// Write through a descriptor opened with O_DIRECT and O_DSYNC from now on, so writes bypass page cache and are
+    /// durable when they return. Return 0 if success, otherwise the segment keeps writing through page cache.
+    int enableDirectIO();
 
-    /// serialize entry, and append to open segment, return new start index
-    UInt64 appendEntry(ptr<log_entry> entry, std::atomic<UInt64> & last_log_index);
+    /// Submit the write of deferred entries and a linked fdatasync to io_uring without waiting for them,
+    /// return 0 if success. They are completed by reapCompletions or any call waiting for writes.
+    int submitPending();
+
+    /// Take completions of submitted writes without waiting, return 0 if success.
+    int reapCompletions();
+#endif
 
     [[maybe_unused]] int writeAt(UInt64 index, const ptr<log_entry> entry);
 
     /// get entry by index, return null if not exist.
+    /// A closed segment is mapped into memory by the first read, entries are parsed from the mapping without syscalls.
     ptr<log_entry> getEntry(UInt64 index);
 
+    /// Append entries in [start_index, end_index] to entries while read_bytes, which is increased by getBatchSize of each,
+    /// stays within max_bytes. The first entry is always taken if entries is empty, max_bytes <= 0 means no limit.
+    /// Consecutive entries are read by one pread of up to READAHEAD_SIZE bytes. Return 0 if success.
+    int getEntries(UInt64 start_index, UInt64 end_index, int64 max_bytes, int64 & read_bytes, std::vector<ptr<log_entry>> & entries);
+
+    /// Size of entry accounted in batch_size_hint_in_bytes of log_entries_ext
+    static int64 getBatchSize(const ptr<log_entry> & entry) { return entry->get_buf().size() + sizeof(ulong) + sizeof(char); }
+
     /// get entry's term by index
     UInt64 getTerm(UInt64 index) const;
 
@@ -148,6 +210,12 @@ public:
     static constexpr char LOG_OPEN_FILE_NAME[] = "log_%lu_open_%s";
 #endif
 
+    /// Prefix of the index file of a closed segment, it is followed by the segment file name
+    static constexpr char INDEX_FILE_PREFIX[] = "index_";
+
+    /// Prefix of the file of a segment removed by removeLater, it is followed by the segment file name
+    static constexpr char REMOVED_FILE_PREFIX[] = "removed_";
+
 private:
     /// log entry metadata in segment, when initializing
     /// load all log entry metadata in memory, see offset_term.
@@ -175,12 +243,18 @@ private:
     /// current segment file path
     String getPath();
 
+    /// Drop pending entries, writes in flight and the mapping, then close the file. Invoked with log_mutex held.
+    void closeForRemove();
+
     /// open file by fd, return 0 if success.
     int openFile();
 
     /// close file, return 0 if success.
     int closeFile();
 
+    /// Truncate file to size and preallocate it again if the segment is preallocated, return 0 if success.
+    int truncateFile(UInt64 size);
+
     /// get log entry meta, return 0 if success.
     int getMeta(UInt64 index, LogMeta * meta) const;
 
@@ -190,6 +264,57 @@ private:
     /// load log entry
     int loadLogEntry(int fd, off_t offset, LogEntryHeader * head, ptr<log_entry> & entry) const;
 
+    /** Index file of a closed segment keeps offset_term, so the segment is loaded without scanning its entries.
+      *     magic: RKLogIdx 8 bytes
+      *     first index, last index, segment file size: 8 bytes each
+      *     offset and term of each entry: 16 bytes each
+      *     crc32 of all above: 4 bytes
+      */
+    String getIndexPath();
+
+    /// Write the index file of the closed segment, return 0 if success. It is written to a temporary file and renamed.
+    int writeIndex();
+
+    /// Load offset_term from the index file, return 0 if it exists and matches the segment file,
+    /// whose first entry is at first_entry_offset.
+    int loadIndex(UInt64 first_entry_offset);
+
+    /// Make entries up to last_read_index readable from the file and map the file if it is closed, return 0 if success.
+    int prepareRead(UInt64 last_read_index);
+
+    /// Map the closed segment file, return 0 if success. Caller should hold log_mutex.
+    int mapFile();
+
+    /// Get entry from mapped_file, caller should hold log_mutex.
+    ptr<log_entry> getMappedEntry(UInt64 index) const;
+
+    /// Parse entry of the meta whose header and body are at pos, return null if it is corrupted.
+    ptr<log_entry> parseEntry(const char * pos, const LogMeta & meta) const;
+
+    /// writePending without lock, caller should hold log_mutex
+    int writePendingUnlocked();
+
+#if defined(OS_LINUX)
+    struct InFlightWrite;
+
+    /// Submit deferred entries as an in flight write, with sync also fdatasync after it. Caller should hold log_mutex.
+    int submitPendingUnlocked(bool sync);
+
+    /// Take completions and retire finished writes in order, then wait until writes up to
+    /// wait_sequence are retired. Caller should hold log_mutex.
+    int reapCompletionsUnlocked(UInt64 wait_sequence, bool wake_up_reaper);
+
+    /// Check results of the write, redo it or its fdatasync with plain syscalls if it failed,
+    /// return whether it is finished.
+    bool finishInFlightWrite(InFlightWrite & write);
+
+    /// Write deferred entries by direct_fd in whole blocks, caller should hold log_mutex
+    int writePendingDirectUnlocked();
+
+    /// Read the last partial block of the file into direct_buffer, caller should hold log_mutex
+    int loadDirectTail();
+#endif
+
     /// segment file directory
     String log_dir;
 
@@ -225,18 +350,117 @@ private:
 
     /// file format version, default V1
     LogVersion version;
+
+    /// Entries appended but not written yet, they are accounted in last_index, file_size and offset_term.
+    /// Entry waiting to be written, the buffer of the log entry is not copied, see LogEntryBody::serialize.
+    struct PendingEntry
+    {
+        LogEntryHeader header;
+        /// First byte of body, it follows the header in memory, so they are written as one buffer of PREFIX_SIZE
+        UInt8 type;
+        /// The rest of body
+        ptr<buffer> data;
+
+        static constexpr size_t PREFIX_SIZE = LogEntryHeader::HEADER_SIZE + sizeof(UInt8);
+        size_t dataSize() const { return header.data_length - sizeof(UInt8); }
+    };
+    static_assert(offsetof(PendingEntry, type) == LogEntryHeader::HEADER_SIZE);
+
+    /// One writev takes at most IOV_MAX, which is 1024 on Linux, buffers of header and body.
+    static constexpr size_t MAX_PENDING_ENTRIES = 512;
+
+    std::vector<PendingEntry> pending_entries;
+    /// Bytes of pending_entries already written by a partial write
+    size_t pending_written = 0;
+
+    /// Size the file is preallocated to, 0 if it is not
+    UInt64 preallocate_size = 0;
+
+    /// Bound of bytes read by one pread of getEntries
+    static constexpr size_t READAHEAD_SIZE = 4 * 1024 * 1024;
+
+    static constexpr char INDEX_MAGIC[8] = {'R', 'K', 'L', 'o', 'g', 'I', 'd', 'x'};
+    static constexpr size_t INDEX_HEADER_SIZE = sizeof(INDEX_MAGIC) + 3 * sizeof(UInt64);
+
+    /// Mapping of closed segment, it is dropped before the file is truncated or removed
+    std::unique_ptr<MMapReadBufferFromFileDescriptor> mapped_file;
+    /// The segment is not mapped again after it is truncated, it becomes open
+    bool mapping_disabled = false;
+    /// Set by remove and removeLater
+    bool removed = false;
+
+#if defined(OS_LINUX)
+    /// Entries submitted to io_uring, buffers are kept until the kernel finishes with them.
+    struct InFlightWrite
+    {
+        UInt64 sequence;
+        std::vector<PendingEntry> entries;
+        std::vector<struct iovec> vec;
+        UInt64 offset = 0;
+        size_t size = 0;
+        /// Last index of the segment when it is submitted, durable after it is synced
+        UInt64 last_index = 0;
+        bool sync = false;
+        std::optional<int> write_result;
+        std::optional<int> sync_result;
+        bool written = false;
+        bool synced = false;
+    };
+
+    /// Bound of writes in flight, each takes up to two completion entries of the ring.
+    static constexpr size_t MAX_IN_FLIGHT_WRITES = 32;
+
+    /// Not null if the segment writes by io_uring
+    LogIOUring * io_uring = nullptr;
+
+    std::deque<InFlightWrite> in_flight_writes;
+    UInt64 next_write_sequence = 1;
+    /// Entries up to it are written to the file
+    UInt64 written_index = 0;
+
+    /// Alignment of offsets, sizes and buffers of direct writes
+    static constexpr size_t DIRECT_IO_BLOCK_SIZE = 4096;
+
+    /// Opened with O_DIRECT and O_DSYNC if the segment writes directly, -1 otherwise. Reads always use seg_fd.
+    int direct_fd = -1;
+    /// Buffer of direct writes, it starts with the last partial block of the file, which is written again with the next entries
+    Memory<> direct_buffer;
+    /// Offset of the last partial block in the file
+    UInt64 direct_block_offset = 0;
+    /// Size of the last partial block
+    size_t direct_tail_size = 0;
+#endif
 };
 
 /**
  * LogSegmentStore manages log segments and it use segmented append-only file, all data
- * in disk, all index in memory. Append one log entry, only cause one disk write, every
- * disk write will call fsync().
+ * in disk, all index in memory. Entries of an append batch can be deferred and written
+ * with one disk write, see NuRaftLogSegment::appendEntry, fsync is issued by flush().
+ *
+ * With io_uring, the write of a batch and its fdatasync can be submitted by submitPending
+ * and waited for by waitDurable on another thread, so nobody blocks in fdatasync.
+ *
+ * With direct I/O, the open segment is written in whole blocks with O_DIRECT and O_DSYNC, bypassing
+ * page cache, so flush needs no fsync. Recent entries are read from the cache of NuRaftFileLogStore.
+ *
+ * With preallocation, the open segment is preallocated to the max segment size and a spare
+ * one is prepared in background, so rotating neither creates nor allocates a file.
+ *
+ * Files of removed segments are renamed and deleted by a background reclaimer, which truncates
+ * them step by step first, so compaction holds seg_mutex only to update the in-memory index.
+ *
+ * With a cold directory, closed segments covered by the latest snapshot are moved there in background,
+ * see offloadSegments. It may be on cheaper storage, they are still read from there.
  *
  * SegmentLog file layout:
  *      log_1_1000_create_time: closed segment
  *      log_open_1001_create_time: open segment
+ *      log_spare: spare segment, renamed to the next open segment
+ *      index_log_1_1000_create_time: index of closed segment, see NuRaftLogSegment::writeIndex
+ *      removed_log_1_1000_create_time: removed segment waiting for the reclaimer
+ *      cold_dir/log_1_1000_create_time, cold_dir/index_log_1_1000_create_time: moved closed segment
  */
-class LogSegmentStore
+class LogSegmentStore : public ILogStorage
 {
 public:
     using Segments = std::vector<ptr<NuRaftLogSegment>>;
@@ -244,6 +468,11 @@ public:
     static constexpr UInt32 MAX_SEGMENT_FILE_SIZE = 1000 * 1024 * 1024; //1G, 0.3K/Log, 3M logs
     static constexpr UInt32 MAX_SEGMENT_COUNT = 50; //50G
     static constexpr int LOAD_THREAD_NUM = 8;
+    /// Submission queue size of io_uring, completion queue is twice of it
+    static constexpr unsigned IO_URING_ENTRIES = 128;
+    static constexpr char LOG_SPARE_FILE_NAME[] = "log_spare";
+    /// Removed segment files are shrunk by the step before unlinking, so freeing a big file does not stall the disk
+    static constexpr off_t RECLAIM_TRUNCATE_STEP = 64 * 1024 * 1024;
 
     explicit LogSegmentStore(const String & log_dir_)
         : log_dir(log_dir_), first_log_index(1), last_log_index(0), log(&(Poco::Logger::get("LogSegmentStore")))
@@ -251,44 +480,82 @@ public:
         LOG_INFO(log, "Create LogSegmentStore {}.", log_dir_);
     }
 
-    virtual ~LogSegmentStore() = default;
+    ~LogSegmentStore() override;
     static ptr<LogSegmentStore> getInstance(const String & log_dir, bool force_new = false);
 
-    /// Init log store, will create dir if not exist, return 0 if success
-    int init(UInt32 max_segment_file_size_ = MAX_SEGMENT_FILE_SIZE, UInt32 max_segment_count_ = MAX_SEGMENT_COUNT);
+    /// Init log store, will create dir if not exist, return 0 if success.
+    /// If use_io_uring and the kernel supports it, segments are written by io_uring.
+    /// If preallocate_, segment files are preallocated to max_segment_file_size_, Linux only.
+    /// If direct_io_, the open segment is written with O_DIRECT and O_DSYNC, it takes precedence over io_uring, Linux only.
+    /// If compress_, bodies of appended entries are compressed.
+    /// If cold_dir_ is not empty, closed segments are moved there by offloadSegments.
+    int init(
+        UInt32 max_segment_file_size_ = MAX_SEGMENT_FILE_SIZE,
+        UInt32 max_segment_count_ = MAX_SEGMENT_COUNT,
+        bool use_io_uring = false,
+        bool preallocate_ = false,
+        bool direct_io_ = false,
+        bool compress_ = false,
+        const String & cold_dir_ = "");
 
     int close();
 
     /// flush log, return last flushed log index if success
-    UInt64 flush();
+    UInt64 flush() override;
 
     /// first log index in whole log store
-    UInt64 firstLogIndex() { return first_log_index.load(std::memory_order_acquire); }
+    UInt64 firstLogIndex() const override { return first_log_index.load(std::memory_order_acquire); }
 
     /// last log index in whole log store
-    UInt64 lastLogIndex() { return last_log_index.load(std::memory_order_acquire); }
+    UInt64 lastLogIndex() const override { return last_log_index.load(std::memory_order_acquire); }
 
     void setLastLogIndex(UInt64 index) { last_log_index.store(index, std::memory_order_release); }
 
-    /// append entry to log store
-    UInt64 appendEntry(ptr<log_entry> entry);
+    /// append entry to log store, see NuRaftLogSegment::appendEntry for deferred.
+    UInt64 appendEntry(ptr<log_entry> entry, bool deferred = false) override;
+
+    /// Write deferred entries of open segment, return 0 if success.
+    int writePending() override;
+
+    /// Whether segments are written by io_uring
+    bool hasIOUring() const override;
+
+    /// Submit the write and fdatasync of deferred entries of open segment without waiting, return 0 if success.
+    /// Return -1 if there is no io_uring.
+    int submitPending() override;
+
+    /// Wait for submitted writes and return the last index synced, it is woken up by wakeUp.
+    /// Only one thread should wait. Return 0 if there is no io_uring.
+    UInt64 waitDurable() override;
+
+    /// Wake up waitDurable
+    void wakeUp() override;
 
     /// First truncate log whose index large or equal entry.index,
     /// then append it.
-    UInt64 writeAt(UInt64 index, ptr<log_entry> entry);
-    ptr<log_entry> getEntry(UInt64 index);
+    UInt64 writeAt(UInt64 index, ptr<log_entry> entry) override;
+    ptr<log_entry> getEntry(UInt64 index) override;
 
     /// collection entries in [start_index, end_index]
     void getEntries(UInt64 start_index, UInt64 end_index, ptr<std::vector<ptr<log_entry>>> & entries);
 
-    [[maybe_unused]] void
-    getEntriesExt(UInt64 start_idx, UInt64 end_idx, int64 batch_size_hint_in_bytes, ptr<std::vector<ptr<log_entry>>> & entries);
+    /// Collect entries in [start_index, end_index] until their size reaches batch_size_hint_in_bytes, see NuRaftLogSegment::getEntries.
+    /// Entries of a segment are read sequentially in large chunks, so a lagging follower is caught up by few big reads.
+    void getEntriesExt(
+        UInt64 start_index, UInt64 end_index, int64 batch_size_hint_in_bytes, ptr<std::vector<ptr<log_entry>>> & entries) override;
     [[maybe_unused]] UInt64 getTerm(UInt64 index);
 
     /// Remove segments from storage's head, logs in [1, first_index_kept) will be discarded,
     /// usually invoked when compaction.
     int removeSegment();
-    int removeSegment(UInt64 first_index_kept);
+    int removeSegment(UInt64 first_index_kept) override;
+
+    /// Move closed segments whose entries are all in [1, last_index] to the cold directory in background,
+    /// nothing is done if there is no cold directory. Usually invoked when compaction with the index of the latest snapshot.
+    void offloadSegments(UInt64 last_index) override;
+
+    /// Wait until the running offloading finishes, it should not be invoked concurrently with offloadSegments.
+    void waitOffloaded();
 
     /// Delete uncommitted logs from storage's tail, (last_index_kept, infinity) will be discarded
     int truncateLog(UInt64 last_index_kept);
@@ -299,16 +566,39 @@ public:
     Segments & getClosedSegments() { return segments; }
 
     /// get file format version
-    LogVersion getVersion(UInt64 index);
+    LogVersion getVersion(UInt64 index) override;
+
+    /// Bytes of segment files, the closed ones and the written part of the open one
+    UInt64 getLogBytes() const override;
+
+    /// Wait until the reclaimer deletes files of all removed segments
+    void waitReclaimed();
 
 private:
     /// open a new segment, invoked when init
     int openSegment();
     /// list segments, invoked when init
     int listSegments();
+    /// list segments moved to cold_dir, invoked by listSegments
+    void listColdSegments();
     /// load listed segments, invoked when init
     int loadSegments();
 
+    /// Create the spare segment in background if there is none
+    void prepareSpare();
+    String getSparePath() const { return log_dir + "/" + LOG_SPARE_FILE_NAME; }
+
+    /// Rename files of removed segments and queue them to the reclaimer, invoked without seg_mutex
+    void reclaim(std::vector<ptr<NuRaftLogSegment>> & removed);
+    /// Queue a file to the reclaimer, or delete it right away if the reclaimer is not started
+    void reclaimFile(const String & path);
+    void startReclaimer();
+    /// Shrink the file by RECLAIM_TRUNCATE_STEP until it is empty, then unlink it
+    void deleteGradually(const String & path) const;
+
+    /// Move closed segments up to offload_index to cold_dir, invoked by the offloading thread
+    void moveColdSegments(UInt64 last_index);
+
     /// find segment by log index
     int getSegment(UInt64 log_index, ptr<NuRaftLogSegment> & ptr);
 
@@ -334,7 +624,35 @@ private:
     ptr<NuRaftLogSegment> open_segment;
 
     /// global mutex
-    mutable std::shared_mutex seg_mutex;
+    mutable ProfiledSharedMutex seg_mutex{"seg_mutex"};
+
+#if defined(OS_LINUX)
+    std::unique_ptr<LogIOUring> io_uring;
+#endif
+
+    bool preallocate = false;
+    bool direct_io = false;
+    bool compress = false;
+    /// Whether the spare segment exists, it is taken by openSegment
+    std::atomic<bool> spare_ready{false};
+    std::atomic<bool> preparing_spare{false};
+    ThreadFromGlobalPool spare_thread;
+
+    /// Paths of files to be deleted by the reclaimer, the first one is being deleted
+    std::deque<String> reclaim_queue;
+    bool reclaimer_stopped = false;
+    std::mutex reclaim_mutex;
+    std::condition_variable reclaim_cv;
+    ThreadFromGlobalPool reclaim_thread;
+
+    /// Directory of moved closed segments, empty if they are not moved
+    String cold_dir;
+    /// Closed segments up to it should be moved
+    std::atomic<UInt64> offload_index{0};
+    std::atomic<bool> offloading{false};
+    /// Set when the store is destroyed, a segment being copied is left where it is
+    std::atomic<bool> offload_cancelled{false};
+    ThreadFromGlobalPool offload_thread;
 };
 
 }
@@ -2,8 +2,13 @@
 #include <fmt/format.h>
 #include <fcntl.h>
 #include <filesystem>
+#include <limits>
+#include <set>
 #include <stdio.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 
 #include <common/find_symbols.h>
 
@@ -13,9 +18,13 @@
 #include <Poco/NumberFormatter.h>
 
 #include <Common/Exception.h>
+#include <Common/IO/MMapReadBufferFromFile.h>
 #include <Common/Stopwatch.h>
+#include <Common/WorkStealing.h>
+#include <common/scope_guard.h>
 
 #include <Service/KeeperUtils.h>
+#include <Service/LatencyInjection.h>
 #include <Service/NuRaftLogSnapshot.h>
 #include <Service/ReadBufferFromNuRaftBuffer.h>
 #include <Service/WriteBufferFromNuraftBuffer.h>
@@ -36,6 +45,8 @@ namespace ErrorCodes
     extern const int UNKNOWN_FORMAT_VERSION;
     extern const int SNAPSHOT_OBJECT_NOT_EXISTS;
     extern const int SNAPSHOT_NOT_EXISTS;
+    extern const int CANNOT_PIPE;
+    extern const int CANNOT_FORK;
 }
 
 using nuraft::cs_new;
@@ -62,27 +73,133 @@ size_t KeeperSnapshotStore::serializeDataTreeV2(KeeperStore & storage)
     uint32_t checksum = 0;
 
     serializeNodeV2(out, batch, storage, "/", processed, checksum);
-    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, write_throttler.get());
     checksum = new_checksum;
 
-    writeTailAndClose(out, checksum);
+    closeObject(out, checksum, (processed - 1) % max_object_node_size + 1);
     LOG_INFO(log, "Creating snapshot processed data size {}, current zxid {}", processed, storage.getZxid());
 
     return getObjectIdx(out->getFileName());
 }
 
 size_t KeeperSnapshotStore::serializeDataTreeAsync(SnapTask & snap_task)
+{
+    const auto & buckets = snap_task.data_tree->getBuckets();
+
+    /// Every bucket is saved to objects of its own, so that buckets are saved in parallel. Object ids of a bucket
+    /// follow the ones of the previous bucket, a bucket may have one more object than if nodes were saved in turn.
+    std::vector<UInt64> first_object_ids(buckets.size());
+    /// for there are 4 objects before data objects
+    UInt64 next_object_id = 4;
+    for (size_t i = 0; i < buckets.size(); i++)
+    {
+        first_object_ids[i] = next_object_id;
+        next_object_id += (buckets[i]->size() + max_object_node_size - 1) / max_object_node_size;
+    }
+
+    Stopwatch watch;
+    const size_t create_thread_num = single_threaded ? 1 : std::min(buckets.size(), getThreadNum());
+    if (create_thread_num <= 1)
+    {
+        for (size_t i = 0; i < buckets.size(); i++)
+            serializeBucketAsync(*buckets[i], first_object_ids[i]);
+    }
+    else
+    {
+        ThreadPool thread_pool(create_thread_num);
+        parallelFor(
+            thread_pool,
+            create_thread_num,
+            buckets.size(),
+            [this, &buckets, &first_object_ids](size_t i) { serializeBucketAsync(*buckets[i], first_object_ids[i]); });
+    }
+
+    LOG_INFO(
+        log,
+        "Creating snapshot processed data size {}, objects {}, threads {}, costs {}ms, current zxid {}",
+        snap_task.nodes_count,
+        next_object_id - 4,
+        create_thread_num,
+        watch.elapsedMilliseconds(),
+        snap_task.next_zxid);
+
+    return next_object_id - 1;
+}
+
+size_t KeeperSnapshotStore::serializeDataTreeDelta(SnapTask & snap_task)
 {
     std::shared_ptr<WriteBufferFromFile> out;
-    ptr<SnapshotBatchBody> batch;
+    ptr<SnapshotBatchBody> batch = cs_new<SnapshotBatchBody>();
+    uint64_t processed = 0;
+    uint32_t checksum = 0;
 
-    auto checksum = serializeNodeAsync(out, batch, *snap_task.buckets_nodes);
-    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
-    checksum = new_checksum;
+    auto flush_batch = [&]
+    {
+        if (batch->size() == 0)
+            return;
+        auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, write_throttler.get());
+        checksum = new_checksum;
+    };
+
+    /// Items are put into objects and batches as serializeBucketAsync does, a batch holds items of one type.
+    auto append = [&](SnapshotBatchType type, String item)
+    {
+        if (processed % max_object_node_size == 0)
+        {
+            if (out)
+            {
+                flush_batch();
+                closeObject(out, checksum, max_object_node_size);
+                checksum = 0;
+            }
+            String new_obj_path;
+            /// for there are 4 objects before data objects
+            getObjectPath(processed / max_object_node_size + 4, new_obj_path);
+            LOG_INFO(log, "Creating new incremental snapshot object {}, path {}", processed / max_object_node_size + 4, new_obj_path);
+            out = openFileAndWriteHeader(new_obj_path, version);
+        }
+        else if (processed % save_batch_size == 0 || batch->type != type)
+        {
+            flush_batch();
+        }
 
-    writeTailAndClose(out, checksum);
-    LOG_INFO(log, "Creating snapshot processed data size {}, current zxid {}", snap_task.nodes_count, snap_task.next_zxid);
+        batch->type = type;
+        batch->add(item);
+        processed++;
+    };
+
+    const auto & buckets = snap_task.data_tree->getBuckets();
+    Strings deleted_paths;
+    for (UInt32 bucket_id = 0; bucket_id < buckets.size(); ++bucket_id)
+    {
+        const auto & bucket = buckets[bucket_id]->getMap();
+        for (const auto & path : (*snap_task.dirty_nodes)[bucket_id])
+        {
+            auto it = bucket.find(path);
+            if (it != bucket.end())
+                append(SnapshotBatchType::SNAPSHOT_TYPE_DATA, serializeKeeperNode(path, it->second, version));
+            else
+                deleted_paths.push_back(path);
+        }
+    }
+
+    size_t changed_count = processed;
+    for (auto & path : deleted_paths)
+        append(SnapshotBatchType::SNAPSHOT_TYPE_DELETED_PATHS, std::move(path));
+
+    LOG_INFO(
+        log,
+        "Creating incremental snapshot with {} changed nodes and {} deleted nodes, current zxid {}",
+        changed_count,
+        deleted_paths.size(),
+        snap_task.next_zxid);
 
+    /// Nothing changed
+    if (!out)
+        return 3;
+
+    flush_batch();
+    closeObject(out, checksum, (processed - 1) % max_object_node_size + 1);
     return getObjectIdx(out->getFileName());
 }
 
@@ -100,7 +217,7 @@ void KeeperSnapshotStore::serializeNodeV2(
     if (!node)
         return;
 
-    std::shared_ptr<KeeperNode> node_copy = node->clone();
+    KeeperNodePtr node_copy = node->clone();
 
     if (processed % max_object_node_size == 0)
     {
@@ -110,11 +227,11 @@ void KeeperSnapshotStore::serializeNodeV2(
         if (obj_id != 0)
         {
             /// flush last batch data
-            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, write_throttler.get());
             checksum = new_checksum;
 
             /// close current object file
-            writeTailAndClose(out, checksum);
+            closeObject(out, checksum, max_object_node_size);
             /// reset checksum
             checksum = 0;
         }
@@ -133,7 +250,7 @@ void KeeperSnapshotStore::serializeNodeV2(
         if (processed != 0)
         {
             /// flush data in batch to file
-            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+            auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, write_throttler.get());
             checksum = new_checksum;
         }
         else
@@ -155,68 +272,85 @@ void KeeperSnapshotStore::serializeNodeV2(
         serializeNodeV2(out, batch, store, path_with_slash + child, processed, checksum);
 }
 
-uint32_t KeeperSnapshotStore::serializeNodeAsync(
-    ptr<WriteBufferFromFile> & out,
-    ptr<SnapshotBatchBody> & batch,
-    BucketNodes & bucket_nodes)
+void KeeperSnapshotStore::serializeBucketAsync(const KeeperStore::DataTree::InnerMap & bucket, UInt64 first_object_id)
 {
+    ptr<WriteBufferFromFile> out;
+    ptr<SnapshotBatchBody> batch = cs_new<SnapshotBatchBody>();
     uint64_t processed = 0;
     uint32_t checksum = 0;
-    for (auto && bucket : bucket_nodes)
+
+    /// Since V5 nodes of a batch are collected and stored by column when the batch is flushed
+    bool columnar = version >= SnapshotVersion::V5;
+    ColumnarNodes columnar_nodes;
+
+    auto flush_batch = [&]
     {
-        for (auto && [path, node] : bucket)
+        if (columnar)
         {
-            if (processed % max_object_node_size == 0)
-            {
-                /// time to create new snapshot object
-                uint64_t obj_id = processed / max_object_node_size;
-
-                if (obj_id != 0)
-                {
-                    /// flush last batch data
-                    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
-                    checksum = new_checksum;
-
-                    /// close current object file
-                    writeTailAndClose(out, checksum);
-                    /// reset checksum
-                    checksum = 0;
-                }
-                String new_obj_path;
-                /// for there are 4 objects before data objects
-                getObjectPath(obj_id + 4, new_obj_path);
+            batch = serializeColumnarBatch(columnar_nodes);
+            columnar_nodes.clear();
+        }
+        auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, write_throttler.get());
+        checksum = new_checksum;
+    };
 
-                LOG_INFO(log, "Creating new snapshot object {}, path {}", obj_id + 4, new_obj_path);
-                out = openFileAndWriteHeader(new_obj_path, version);
-            }
+    for (const auto & [path, node] : bucket.getMap())
+    {
+        if (processed % max_object_node_size == 0)
+        {
+            /// time to create new snapshot object
+            uint64_t obj_id = first_object_id + processed / max_object_node_size;
 
-            /// flush and rebuild batch
-            if (processed % save_batch_size == 0)
+            if (out)
             {
-                /// skip flush the first batch
-                if (processed != 0)
-                {
-                    /// flush data in batch to file
-                    auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
-                    checksum = new_checksum;
-                }
-                else
-                {
-                    if (!batch)
-                        batch = cs_new<SnapshotBatchBody>();
-                }
+                /// flush last batch data
+                flush_batch();
+
+                /// close current object file
+                closeObject(out, checksum, max_object_node_size);
+                /// reset checksum
+                checksum = 0;
             }
+            String new_obj_path;
+            getObjectPath(obj_id, new_obj_path);
 
-            LOG_TRACE(log, "Append node path {}", path);
-            appendNodeToBatchV2(batch, path, node, version);
-            processed++;
+            LOG_INFO(log, "Creating new snapshot object {}, path {}", obj_id, new_obj_path);
+            out = openFileAndWriteHeader(new_obj_path, version);
+        }
+        /// flush and rebuild batch, skip flush the first batch of an object
+        else if (processed % save_batch_size == 0)
+        {
+            /// flush data in batch to file
+            flush_batch();
         }
+
+        LOG_TRACE(log, "Append node path {}", path);
+        if (columnar)
+            columnar_nodes.emplace_back(path, node.get());
+        else
+            appendNodeToBatchV2(batch, path, node, version);
+        processed++;
+    }
+
+    if (out)
+    {
+        flush_batch();
+        closeObject(out, checksum, (processed - 1) % max_object_node_size + 1);
     }
-    return checksum;
+}
+
+void KeeperSnapshotStore::closeObject(ptr<WriteBufferFromFile> & out, UInt32 checksum, UInt64 object_nodes)
+{
+    writeTailAndClose(out, checksum);
+
+    auto & metrics = Metrics::getMetrics();
+    metrics.snap_object_bytes->add(out->count());
+    metrics.snap_object_nodes->add(object_nodes);
+    metrics.snapshot_progress.addObject(out->count(), object_nodes);
 }
 
 void KeeperSnapshotStore::appendNodeToBatchV2(
-    ptr<SnapshotBatchBody> batch, const String & path, std::shared_ptr<KeeperNode> node, SnapshotVersion version)
+    ptr<SnapshotBatchBody> batch, const String & path, KeeperNodePtr node, SnapshotVersion version)
 {
     WriteBufferFromNuraftBuffer buf;
 
@@ -232,7 +366,7 @@ void KeeperSnapshotStore::appendNodeToBatchV2(
         Coordination::write(node->acl_id, buf);
     Coordination::write(node->is_ephemeral, buf);
     Coordination::write(node->is_sequential, buf);
-    Coordination::write(node->stat, buf);
+    Coordination::write(node->persistedStat(), buf);
 
     ptr<buffer> data = buf.getBuffer();
     data->pos(0);
@@ -244,9 +378,9 @@ size_t KeeperSnapshotStore::createObjects(KeeperStore & store, int64_t next_zxid
     return createObjectsV2(store, next_zxid, next_session_id);
 }
 
-size_t KeeperSnapshotStore::createObjectsAsync(SnapTask & snap_task)
+size_t KeeperSnapshotStore::createObjectsAsync(SnapTask & snap_task, std::optional<uint128_t> base_key_)
 {
-    return createObjectsAsyncImpl(snap_task);
+    return createObjectsAsyncImpl(snap_task, base_key_);
 }
 
 
@@ -282,21 +416,23 @@ size_t KeeperSnapshotStore::createObjectsV2(KeeperStore & store, int64_t next_zx
     int_map["ZXID"] = next_zxid;
     /// Next session id
     int_map["SESSIONID"] = next_session_id;
+    /// Bucket count of the data tree which created the snapshot
+    int_map["BUCKET_NUM"] = store.getDataTreeBucketNum();
 
     String map_path;
     getObjectPath(1, map_path);
-    serializeMapV2(int_map, save_batch_size, version, map_path);
+    serializeMapV2(int_map, save_batch_size, version, map_path, write_throttler.get());
 
     /// 2. Save sessions
     String session_path;
     /// object index should start from 1
     getObjectPath(2, session_path);
 
-    auto session_and_timeout = store.getSessionAndTimeOut();
-    auto session_and_auth = store.getSessionAndAuth();
+    auto session_and_timeout = store.pinSessionAndTimeout();
+    auto session_and_auth = store.pinSessionAndAuth();
     auto serialized_next_session_id = store.getSessionIDCounter();
 
-    serializeSessionsV2(session_and_timeout, session_and_auth, save_batch_size, version, session_path);
+    serializeSessionsV2(*session_and_timeout, *session_and_auth, save_batch_size, version, session_path, write_throttler.get());
     LOG_INFO(
         log,
         "Creating snapshot nex_session_id {}, serialized_next_session_id {}",
@@ -307,27 +443,23 @@ size_t KeeperSnapshotStore::createObjectsV2(KeeperStore & store, int64_t next_zx
     String acl_path;
     /// object index should start from 1
     getObjectPath(3, acl_path);
-    serializeAclsV2(store.getACLMap().getMapping(), acl_path, save_batch_size, version);
+    serializeAclsV2(*store.getACLMap().pinMapping(), acl_path, save_batch_size, version, write_throttler.get());
 
     /// 4. Save data tree
     size_t last_id = serializeDataTreeV2(store);
+    base_key_loaded = true;
 
     total_obj_count = last_id;
     LOG_INFO(log, "Creating snapshot real data_object_count {}, total_obj_count {}", total_obj_count - 3, total_obj_count);
 
     /// add all path to objects_path
-    for (size_t i = 1; i < total_obj_count + 1; i++)
-    {
-        String path;
-        getObjectPath(i, path);
-        addObjectPath(i, path);
-    }
+    addObjectPaths(total_obj_count);
 
     return total_obj_count;
 }
 
 
-size_t KeeperSnapshotStore::createObjectsAsyncImpl(SnapTask & snap_task)
+size_t KeeperSnapshotStore::createObjectsAsyncImpl(SnapTask & snap_task, std::optional<uint128_t> base_key_)
 {
     if (snap_meta->size() == 0)
     {
@@ -355,17 +487,27 @@ size_t KeeperSnapshotStore::createObjectsAsyncImpl(SnapTask & snap_task)
     int_map["ZXID"] = snap_task.next_zxid;
     /// Next session id
     int_map["SESSIONID"] = snap_task.next_session_id;
+    /// Bucket count of the data tree which created the snapshot
+    int_map["BUCKET_NUM"] = static_cast<int64_t>(snap_task.data_tree->getBuckets().size());
+    if (base_key_)
+    {
+        /// The snapshot which the incremental one is based on
+        auto [base_term, base_index] = getTermLogFromSnapshotStoreMapKey(*base_key_);
+        int_map["BASE_TERM"] = static_cast<int64_t>(base_term);
+        int_map["BASE_INDEX"] = static_cast<int64_t>(base_index);
+    }
 
     String map_path;
     getObjectPath(1, map_path);
-    serializeMapV2(int_map, save_batch_size, version, map_path);
+    serializeMapV2(int_map, save_batch_size, version, map_path, write_throttler.get());
 
     /// 2. Save sessions
     String session_path;
     /// object index should start from 1
     getObjectPath(2, session_path);
 
-    serializeSessionsV2(snap_task.session_and_timeout, snap_task.session_and_auth, save_batch_size, version, session_path);
+    serializeSessionsV2(
+        *snap_task.session_and_timeout, *snap_task.session_and_auth, save_batch_size, version, session_path, write_throttler.get());
 
     int64_t serialized_next_session_id = snap_task.next_session_id;
     LOG_INFO(
@@ -378,21 +520,18 @@ size_t KeeperSnapshotStore::createObjectsAsyncImpl(SnapTask & snap_task)
     String acl_path;
     /// object index should start from 1
     getObjectPath(3, acl_path);
-    serializeAclsV2(snap_task.acl_map, acl_path, save_batch_size, version);
+    serializeAclsV2(*snap_task.acl_map, acl_path, save_batch_size, version, write_throttler.get());
 
     /// 4. Save data tree
-    size_t last_id = serializeDataTreeAsync(snap_task);
+    size_t last_id = base_key_ ? serializeDataTreeDelta(snap_task) : serializeDataTreeAsync(snap_task);
+    base_key = base_key_;
+    base_key_loaded = true;
 
     total_obj_count = last_id;
     LOG_INFO(log, "Creating snapshot real data_object_count {}, total_obj_count {}", total_obj_count - 3, total_obj_count);
 
     /// add all path to objects_path
-    for (size_t i = 1; i < total_obj_count + 1; i++)
-    {
-        String path;
-        getObjectPath(i, path);
-        addObjectPath(i, path);
-    }
+    addObjectPaths(total_obj_count);
 
     return total_obj_count;
 }
@@ -410,52 +549,70 @@ void KeeperSnapshotStore::init(String create_time = "")
     }
 }
 
-void KeeperSnapshotStore::parseBatchHeader(ptr<std::fstream> fs, SnapshotBatchHeader & head)
+void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
 {
-    head.reset();
-    errno = 0;
-    if (readUInt32(fs, head.data_length) != 0)
-    {
-        if (!fs->eof())
-            throwFromErrno("Can't read header data_length from snapshot file", ErrorCodes::CORRUPTED_SNAPSHOT);
-    }
-
-    if (readUInt32(fs, head.data_crc) != 0)
+    auto count_nodes = [&bucket_nodes]
     {
-        if (!fs->eof())
-            throwFromErrno("Can't read header data_crc from snapshot file", ErrorCodes::CORRUPTED_SNAPSHOT);
-    }
+        size_t count = 0;
+        for (const auto & nodes : bucket_nodes)
+            count += nodes.size();
+        return count;
+    };
+
+    size_t nodes_before = count_nodes();
+    size_t object_bytes = readObject(
+        obj_path,
+        [&](std::string_view body, SnapshotVersion version_from_obj)
+        { parseBatchBodyV2(store, body, buckets_edges, bucket_nodes, version_from_obj); });
+
+    auto & metrics = Metrics::getMetrics();
+    size_t object_nodes = count_nodes() - nodes_before;
+    metrics.snap_load_object_bytes->add(object_bytes);
+    metrics.snap_load_object_nodes->add(object_nodes);
+    metrics.snapshot_progress.addObject(object_bytes, object_nodes);
 }
 
-void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
+size_t
+KeeperSnapshotStore::readObject(const String & obj_path, const std::function<void(std::string_view, SnapshotVersion)> & process_batch)
 {
-    ptr<std::fstream> snap_fs = cs_new<std::fstream>();
-    snap_fs->open(obj_path, std::ios::in | std::ios::binary);
+    LatencyInjection::instance().delay(InjectionPoint::SNAPSHOT_READ);
 
-    if (snap_fs->fail())
-        throwFromErrno("Open snapshot object " + obj_path + " for read failed", ErrorCodes::CORRUPTED_SNAPSHOT);
-
-    snap_fs->seekg(0, snap_fs->end);
-    size_t file_size = snap_fs->tellg();
-    snap_fs->seekg(0, snap_fs->beg);
+    /// Batches are parsed straight from the mapped file, the ones not compressed are not copied at all
+    MMapReadBufferFromFile in(obj_path, 0);
+    char * begin = in.buffer().begin();
+    size_t file_size = in.buffer().size();
+    if (file_size && madvise(begin, file_size, MADV_SEQUENTIAL) != 0)
+        LOG_WARNING(log, "Cannot madvise snapshot object {}, errno {}", obj_path, errno);
 
     LOG_INFO(log, "Open snapshot object {} for read, file size {}", obj_path, file_size);
 
-    size_t read_size = 0;
+    const char * pos = begin;
+    const char * end = begin + file_size;
+    auto read_pod = [&](auto & x)
+    {
+        if (static_cast<size_t>(end - pos) < sizeof(x))
+            return false;
+        memcpy(&x, pos, sizeof(x));
+        pos += sizeof(x);
+        return true;
+    };
+
     SnapshotBatchHeader header;
     UInt32 checksum = 0;
     SnapshotVersion version_from_obj = SnapshotVersion::None;
+    /// Buffer of decompressed batches, reused across batches
+    String decompressed;
 
-    while (!snap_fs->eof())
+    while (true)
     {
-        size_t cur_read_size = read_size;
+        const char * batch_begin = pos;
         UInt64 magic;
 
-        // If raft snapshot version is v0, we get eof when read magic.
+        // If raft snapshot version is v0, there is no tail, we get eof when read magic.
         // Just log it, and break;
-        if (readUInt64(snap_fs, magic) != 0)
+        if (!read_pod(magic))
         {
-            if (snap_fs->eof() && version_from_obj == SnapshotVersion::V0)
+            if (version_from_obj == SnapshotVersion::V0)
             {
                 LOG_DEBUG(log, "obj_path {}, read file tail, version {}", obj_path, uint8_t(version_from_obj));
                 break;
@@ -464,22 +621,19 @@ void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, Buck
                 ErrorCodes::CORRUPTED_SNAPSHOT, "snapshot {} load magic error, version {}", obj_path, toString(version_from_obj));
         }
 
-        read_size += 8;
         if (isSnapshotFileHeader(magic))
         {
-            char * buf = reinterpret_cast<char *>(&version_from_obj);
-            snap_fs->read(buf, sizeof(uint8_t));
-            read_size += 1;
+            if (!read_pod(version_from_obj))
+                throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read version of snapshot object {}", obj_path);
             LOG_DEBUG(log, "Got snapshot file header with version {}", toString(version_from_obj));
-            if (version_from_obj > CURRENT_SNAPSHOT_VERSION)
+            if (version_from_obj > MAX_SNAPSHOT_VERSION)
                 throw Exception(ErrorCodes::UNKNOWN_FORMAT_VERSION, "Unsupported snapshot version {}", version_from_obj);
         }
         else if (isSnapshotFileTail(magic))
         {
             UInt32 file_checksum;
-            char * buf = reinterpret_cast<char *>(&file_checksum);
-            snap_fs->read(buf, sizeof(UInt32));
-            read_size += 4;
+            if (!read_pod(file_checksum))
+                throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read checksum of snapshot object {}", obj_path);
             LOG_DEBUG(log, "obj_path {}, file_checksum {}, checksum {}.", obj_path, file_checksum, checksum);
             if (file_checksum != checksum)
                 throw Exception(ErrorCodes::CHECKSUM_DOESNT_MATCH, "snapshot {} checksum doesn't match", obj_path);
@@ -494,56 +648,110 @@ void KeeperSnapshotStore::parseObject(KeeperStore & store, String obj_path, Buck
             }
 
             LOG_DEBUG(log, "obj_path {}, didn't read the header and tail of the file", obj_path);
-            snap_fs->seekg(cur_read_size);
-            read_size = cur_read_size;
+            pos = batch_begin;
         }
 
-        parseBatchHeader(snap_fs, header);
+        header.reset();
+        if (!read_pod(header.data_length) || !read_pod(header.data_crc))
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read batch header from snapshot object {}", obj_path);
 
         checksum = updateCheckSum(checksum, header.data_crc);
-        String body_string(header.data_length, '0');
-        char * body_buf = body_string.data();
-        read_size += (SnapshotBatchHeader::HEADER_SIZE + header.data_length);
+        if (static_cast<size_t>(end - pos) < header.data_length)
+            throw Exception(
+                ErrorCodes::CORRUPTED_SNAPSHOT,
+                "Can't read snapshot object file {}, batch size {}, only {} could be read",
+                obj_path,
+                header.data_length,
+                end - pos);
 
-        if (!snap_fs->read(body_buf, header.data_length))
-        {
-            throwFromErrno(
-                "Can't read snapshot object file " + obj_path + ", batch size " + std::to_string(header.data_length) + ", only "
-                    + std::to_string(snap_fs->gcount()) + " could be read",
-                ErrorCodes::CORRUPTED_SNAPSHOT);
-        }
+        std::string_view body(pos, header.data_length);
+        pos += header.data_length;
+
+        if (!verifyCRC32(body.data(), body.size(), header.data_crc))
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read snapshot object file {}, batch crc not match.", obj_path);
+
+        /// Only verifying
+        if (!process_batch)
+            continue;
+
+        /// Objects are parsed by a thread each, so are they decompressed
+        if (version_from_obj >= SnapshotVersion::V3)
+            body = SnapshotBatchBody::decompress(body, decompressed);
 
-        if (!verifyCRC32(body_buf, header.data_length, header.data_crc))
+        process_batch(body, version_from_obj);
+    }
+    return file_size;
+}
+
+IntMap KeeperSnapshotStore::loadIntMap()
+{
+    IntMap int_map;
+    readObject(
+        objects_path.at(1),
+        [&](std::string_view body, SnapshotVersion)
         {
-            throwFromErrno("Can't read snapshot object file " + obj_path + ", batch crc not match.", ErrorCodes::CORRUPTED_SNAPSHOT);
-        }
+            auto batch = SnapshotBatchView::parse(body);
+            if (batch.type == SnapshotBatchType::SNAPSHOT_TYPE_UINTMAP)
+                int_map.merge(parseBatchIntMapV2(batch));
+        });
+    return int_map;
+}
 
-        parseBatchBodyV2(store, body_string, buckets_edges, bucket_nodes, version_from_obj);
+UInt64 KeeperSnapshotStore::getObjectsBytes() const
+{
+    UInt64 bytes = 0;
+    for (const auto & [_, path] : objects_path)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        if (!ec)
+            bytes += size;
     }
+    return bytes;
 }
 
-void KeeperSnapshotStore::parseBatchBodyV2(KeeperStore & store, const String & body_string, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version_)
+std::optional<uint128_t> KeeperSnapshotStore::getBaseKey()
 {
-    ptr<SnapshotBatchBody> batch;
-    batch = SnapshotBatchBody::parse(body_string);
-    switch (batch->type)
+    /// Not received yet
+    if (!existObject(1))
+        return {};
+
+    if (!base_key_loaded)
+    {
+        IntMap int_map = loadIntMap();
+        if (int_map.contains("BASE_TERM") && int_map.contains("BASE_INDEX"))
+            base_key = getSnapshotStoreMapKeyImpl(static_cast<UInt64>(int_map["BASE_TERM"]), static_cast<UInt64>(int_map["BASE_INDEX"]));
+        base_key_loaded = true;
+    }
+    return base_key;
+}
+
+void KeeperSnapshotStore::parseBatchBodyV2(
+    KeeperStore & store, std::string_view body, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version_)
+{
+    auto batch = SnapshotBatchView::parse(body);
+    switch (batch.type)
     {
         case SnapshotBatchType::SNAPSHOT_TYPE_DATA:
-            LOG_DEBUG(log, "Parsing batch data from snapshot, data count {}", batch->size());
-            parseBatchDataV2(store, *batch, buckets_edges, bucket_nodes, version_);
+            LOG_DEBUG(log, "Parsing batch data from snapshot, data count {}", batch.size());
+            parseBatchDataV2(store, batch, buckets_edges, bucket_nodes, version_);
+            break;
+        case SnapshotBatchType::SNAPSHOT_TYPE_DATA_COLUMNS:
+            LOG_DEBUG(log, "Parsing columnar batch data from snapshot");
+            parseBatchDataColumnsV2(store, batch, buckets_edges, bucket_nodes);
             break;
         case SnapshotBatchType::SNAPSHOT_TYPE_SESSION: {
-            LOG_DEBUG(log, "Parsing batch session from snapshot, session count {}", batch->size());
-            parseBatchSessionV2(store, *batch, version_);
+            LOG_DEBUG(log, "Parsing batch session from snapshot, session count {}", batch.size());
+            parseBatchSessionV2(store, batch, version_);
         }
         break;
         case SnapshotBatchType::SNAPSHOT_TYPE_ACLMAP:
-            LOG_DEBUG(log, "Parsing batch acl from snapshot, acl count {}", batch->size());
-            parseBatchAclMapV2(store, *batch, version_);
+            LOG_DEBUG(log, "Parsing batch acl from snapshot, acl count {}", batch.size());
+            parseBatchAclMapV2(store, batch, version_);
             break;
         case SnapshotBatchType::SNAPSHOT_TYPE_UINTMAP:
-            LOG_DEBUG(log, "Parsing batch int_map from snapshot, element count {}", batch->size());
-            parseBatchIntMapV2(store, *batch, version_);
+            LOG_DEBUG(log, "Parsing batch int_map from snapshot, element count {}", batch.size());
+            parseBatchIntMapV2(store, batch, version_);
             LOG_DEBUG(log, "Parsed zxid {}, session_id_counter {}", store.getZxid(), store.getSessionIDCounter());
             break;
         case SnapshotBatchType::SNAPSHOT_TYPE_CONFIG:
@@ -554,76 +762,192 @@ void KeeperSnapshotStore::parseBatchBodyV2(KeeperStore & store, const String & b
     }
 }
 
-void KeeperSnapshotStore::loadLatestSnapshot(KeeperStore & store)
+bool KeeperSnapshotStore::verifyObjects()
 {
-    auto objects_cnt = objects_path.size();
-    ThreadPool thread_pool(SNAPSHOT_THREAD_NUM);
-
-    all_objects_edges = std::vector<BucketEdges>(objects_cnt);
-    all_objects_nodes = std::vector<BucketNodes>(objects_cnt);
-
-    LOG_INFO(log, "Parsing snapshot objects from disk");
     Stopwatch watch;
+    std::atomic<bool> intact = true;
+    Metrics::getMetrics().snapshot_progress.begin(SnapshotProgress::LOAD_VERIFY, objects_path.size());
+    ThreadPool thread_pool(std::max<size_t>(std::min<size_t>(objects_path.size(), getThreadNum()), 1));
 
-    for (UInt32 thread_id = 0; thread_id < SNAPSHOT_THREAD_NUM; thread_id++)
+    for (const auto & [obj_id, obj_path] : objects_path)
     {
-        thread_pool.trySchedule(
-            [this, thread_id, &store]
+        thread_pool.scheduleOrThrowOnError(
+            [this, &intact, path = obj_path]
             {
-                Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.parseObjectThread#" + std::to_string(thread_id)));
-                UInt32 obj_idx = 0;
-                for (auto it = this->objects_path.begin(); it != this->objects_path.end(); it++)
+                if (!intact)
+                    return;
+                try
                 {
-                    if (obj_idx % SNAPSHOT_THREAD_NUM == thread_id)
-                    {
-                        LOG_INFO(thread_log, "Parsing snapshot object {}", it->second);
-                        parseObject(store, it->second, all_objects_edges[obj_idx], all_objects_nodes[obj_idx]);
-                    }
-                    obj_idx++;
+                    Metrics::getMetrics().snapshot_progress.addObject(readObject(path, {}), 0);
+                }
+                catch (...)
+                {
+                    tryLogCurrentException(log, "Snapshot object " + path + " is corrupted");
+                    intact = false;
                 }
             });
     }
 
     thread_pool.wait();
+    Metrics::getMetrics().snapshot_progress.finish();
+    LOG_INFO(
+        log,
+        "Verifying {} objects of snapshot {} costs {}ms, intact {}",
+        objects_path.size(),
+        last_log_index,
+        watch.elapsedMilliseconds(),
+        intact.load());
+    return intact;
+}
+
+void KeeperSnapshotStore::loadLatestSnapshot(KeeperStore & store, bool data_only)
+{
+    auto objects_cnt = objects_path.size();
+    const size_t parse_thread_num = getThreadNum();
+    ThreadPool thread_pool(parse_thread_num);
+
+    /// Nodes are routed to buckets of current store when parsing, so a snapshot
+    /// created with another bucket count is resharded naturally.
+    all_objects_edges = std::vector<BucketEdges>(objects_cnt, BucketEdges(store.getDataTreeBucketNum()));
+    all_objects_nodes = std::vector<BucketNodes>(objects_cnt, BucketNodes(store.getDataTreeBucketNum()));
+
+    LOG_INFO(log, "Parsing snapshot objects from disk");
+    Stopwatch watch;
+    auto & metrics = Metrics::getMetrics();
+    metrics.snapshot_progress.begin(SnapshotProgress::LOAD_PARSE, objects_cnt);
+
+    /// Objects differ in size, threads steal from each other rather than parse every parse_thread_num-th one
+    std::vector<std::map<ulong, String>::const_iterator> objects;
+    objects.reserve(objects_cnt);
+    for (auto it = objects_path.cbegin(); it != objects_path.cend(); ++it)
+        objects.push_back(it);
+
+    Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.parseObjectThread"));
+    parallelFor(
+        thread_pool,
+        parse_thread_num,
+        objects_cnt,
+        [this, &objects, data_only, &store, thread_log](size_t obj_idx)
+        {
+            /// for there are 4 objects before data objects
+            if (data_only && objects[obj_idx]->first < 4)
+                return;
+            LOG_INFO(thread_log, "Parsing snapshot object {}", objects[obj_idx]->second);
+            parseObject(store, objects[obj_idx]->second, all_objects_edges[obj_idx], all_objects_nodes[obj_idx]);
+        });
     LOG_INFO(log, "Parsing snapshot objects costs {}ms", watch.elapsedMilliseconds());
 
     LOG_INFO(log, "Building data tree from snapshot objects");
     watch.restart();
+    /// Objects of progress are buckets when building
+    metrics.snapshot_progress.begin(SnapshotProgress::LOAD_BUILD, store.getDataTreeBucketNum());
+
+    /// Build data tree relationship in parallel, buckets are independent so use as many threads as we can.
+    const UInt32 cores = thread_num ? static_cast<UInt32>(thread_num) : getNumberOfPhysicalCPUCores();
+    const UInt32 build_thread_num = std::min(store.getDataTreeBucketNum(), std::max(cores, 1U));
+    ThreadPool build_thread_pool(build_thread_num);
+
+    Poco::Logger * build_log = &(Poco::Logger::get("KeeperSnapshotStore.buildDataTreeThread"));
+    parallelFor(
+        build_thread_pool,
+        build_thread_num,
+        store.getDataTreeBucketNum(),
+        [this, &store, &metrics, build_log](size_t index)
+        {
+            UInt32 bucket_id = static_cast<UInt32>(index);
+            LOG_INFO(build_log, "Filling bucket {} in data tree", bucket_id);
+            Stopwatch bucket_watch;
+            store.fillDataTreeBucket(all_objects_nodes, bucket_id);
+            metrics.snap_load_fill_bucket_time_ms->add(bucket_watch.elapsedMilliseconds());
+
+            LOG_INFO(build_log, "Building children set for data tree bucket {}", bucket_id);
+            bucket_watch.restart();
+            store.buildBucketChildren(all_objects_edges, bucket_id);
+            metrics.snap_load_build_children_time_ms->add(bucket_watch.elapsedMilliseconds());
+            metrics.snapshot_progress.addObject(0, 0);
+        });
+    metrics.snapshot_progress.finish();
+    LOG_INFO(log, "Building data tree costs {}ms", watch.elapsedMilliseconds());
+
+    all_objects_edges.clear();
+    all_objects_nodes.clear();
 
-    /// Build data tree relationship in parallel
-    for (UInt32 thread_id = 0; thread_id < SNAPSHOT_THREAD_NUM; thread_id++)
+    LOG_INFO(
+        log,
+        "Loading snapshot done: nodes {}, ephemeral nodes {}, sessions {}, session_id_counter {}, zxid {}",
+        store.getNodesCount(),
+        store.getTotalEphemeralNodesCount(),
+        store.getSessionCount(),
+        store.getSessionIDCounter(),
+        store.getZxid());
+}
+
+void KeeperSnapshotStore::loadSnapshotDelta(KeeperStore & store, bool with_sessions_and_acls)
+{
+    Stopwatch watch;
+    std::vector<std::pair<String, KeeperNodePtr>> nodes;
+    Strings deleted_paths;
+    auto & progress = Metrics::getMetrics().snapshot_progress;
+    progress.begin(SnapshotProgress::LOAD_PARSE, objects_path.size());
+
+    for (const auto & [obj_id, obj_path] : objects_path)
     {
-        thread_pool.trySchedule(
-            [this, thread_id, &store]
+        if (obj_id < 4)
+            continue;
+
+        LOG_INFO(log, "Parsing incremental snapshot object {}", obj_path);
+        size_t nodes_before = nodes.size() + deleted_paths.size();
+        size_t object_bytes = readObject(
+            obj_path,
+            [&](std::string_view body, SnapshotVersion version_from_obj)
             {
-                Poco::Logger * thread_log = &(Poco::Logger::get("KeeperSnapshotStore.buildDataTreeThread#" + std::to_string(thread_id)));
-                for (UInt32 bucket_id = 0; bucket_id < store.getDataTreeBucketNum(); bucket_id++)
+                auto batch = SnapshotBatchView::parse(body);
+                if (batch.type == SnapshotBatchType::SNAPSHOT_TYPE_DATA)
                 {
-                    if (bucket_id % SNAPSHOT_THREAD_NUM == thread_id)
+                    for (size_t i = 0; i < batch.size(); i++)
                     {
-                        LOG_INFO(thread_log, "Filling bucket {} in data tree", bucket_id);
-                        store.fillDataTreeBucket(all_objects_nodes, bucket_id);
-                        LOG_INFO(thread_log, "Building children set for data tree bucket {}", bucket_id);
-                        store.buildBucketChildren(all_objects_edges, bucket_id);
+                        auto node_with_path = parseKeeperNode(batch[i], version_from_obj);
+                        nodes.emplace_back(std::move(node_with_path->path), std::move(node_with_path->node));
                     }
                 }
+                else if (batch.type == SnapshotBatchType::SNAPSHOT_TYPE_DATA_COLUMNS)
+                {
+                    auto columnar_nodes = parseColumnarBatch(batch);
+                    for (auto & path_and_node : columnar_nodes)
+                        nodes.emplace_back(std::move(path_and_node));
+                }
+                else if (batch.type == SnapshotBatchType::SNAPSHOT_TYPE_DELETED_PATHS)
+                {
+                    for (size_t i = 0; i < batch.size(); i++)
+                        deleted_paths.emplace_back(batch[i]);
+                }
             });
+        progress.addObject(object_bytes, nodes.size() + deleted_paths.size() - nodes_before);
     }
 
-    thread_pool.wait();
-    LOG_INFO(log, "Building data tree costs {}ms", watch.elapsedMilliseconds());
+    /// Applying is the build phase of an incremental snapshot
+    progress.begin(SnapshotProgress::LOAD_BUILD);
+    store.applySnapshotDelta(nodes, deleted_paths);
 
-    all_objects_edges.clear();
-    all_objects_nodes.clear();
+    /// After data, for ACLs no longer used by the base nodes are removed when applying
+    if (with_sessions_and_acls)
+    {
+        BucketEdges unused_edges(store.getDataTreeBucketNum());
+        BucketNodes unused_nodes(store.getDataTreeBucketNum());
+        for (const auto & [obj_id, obj_path] : objects_path)
+            if (obj_id < 4)
+                parseObject(store, obj_path, unused_edges, unused_nodes);
+    }
+    progress.finish();
 
     LOG_INFO(
         log,
-        "Loading snapshot done: nodes {}, ephemeral nodes {}, sessions {}, session_id_counter {}, zxid {}",
+        "Loading incremental snapshot {} done: changed nodes {}, deleted nodes {}, nodes {}, costs {}ms",
+        last_log_index,
+        nodes.size(),
+        deleted_paths.size(),
         store.getNodesCount(),
-        store.getTotalEphemeralNodesCount(),
-        store.getSessionCount(),
-        store.getSessionIDCounter(),
-        store.getZxid());
+        watch.elapsedMilliseconds());
 }
 
 bool KeeperSnapshotStore::existObject(ulong obj_id)
@@ -631,58 +955,168 @@ bool KeeperSnapshotStore::existObject(ulong obj_id)
     return (objects_path.find(obj_id) != objects_path.end());
 }
 
-void KeeperSnapshotStore::loadObject(ulong obj_id, ptr<buffer> & buffer)
+namespace
 {
-    if (!existObject(obj_id))
-        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} does not exist", obj_id);
 
-    String obj_path = objects_path.at(obj_id);
+/// Read size bytes from offset of the object file straight into pos. Objects are read to be sent to followers, so
+/// the pages read are dropped from page cache, otherwise sending a snapshot keeps a copy of it in memory besides
+/// the buffers on the wire.
+void readObjectRange(int snap_fd, const String & obj_path, char * pos, UInt64 offset, UInt64 size)
+{
+    for (UInt64 done = 0; done < size;)
+    {
+        ssize_t ret = ::pread(snap_fd, pos + done, size - done, offset + done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            throwFromErrno("Cannot read snapshot object " + obj_path, ErrorCodes::CORRUPTED_SNAPSHOT);
+        if (ret == 0)
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot object {} is truncated when reading it", obj_path);
+        done += ret;
+    }
+#if defined(OS_LINUX)
+    ::posix_fadvise(snap_fd, offset, size, POSIX_FADV_DONTNEED);
+#endif
+}
 
-    int snap_fd = openFileForRead(obj_path);
+/// Open the object file to read it sequentially and return its size
+int openObjectForRead(const String & obj_path, UInt64 & file_size)
+{
+    int snap_fd = ::open(obj_path.c_str(), O_RDONLY);
     if (snap_fd < 0)
+        throwFromErrno("Opening snapshot object " + obj_path + " failed", ErrorCodes::CORRUPTED_SNAPSHOT);
+
+    struct stat file_stat;
+    if (::fstat(snap_fd, &file_stat) != 0)
     {
-        return;
+        ::close(snap_fd);
+        throwFromErrno("Cannot stat snapshot object " + obj_path, ErrorCodes::CORRUPTED_SNAPSHOT);
     }
+    file_size = file_stat.st_size;
+#if defined(OS_LINUX)
+    ::posix_fadvise(snap_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return snap_fd;
+}
 
-    ::lseek(snap_fd, 0, SEEK_SET);
-    size_t file_size = ::lseek(snap_fd, 0, SEEK_END);
-    ::lseek(snap_fd, 0, SEEK_SET);
+/// Read a chunk of at most size bytes from offset of the object file, with SnapshotChunkHeader
+ptr<buffer> readObjectChunk(const String & obj_path, UInt64 offset, UInt64 size)
+{
+    UInt64 file_size;
+    int snap_fd = openObjectForRead(obj_path, file_size);
+    SCOPE_EXIT({ ::close(snap_fd); });
 
+    if (offset > file_size)
+        throw Exception(
+            ErrorCodes::CORRUPTED_SNAPSHOT, "Chunk offset {} is beyond snapshot object {} of {} bytes", offset, obj_path, file_size);
+
+    UInt64 read_size = std::min(size, file_size - offset);
+    ptr<buffer> chunk = buffer::alloc(SnapshotChunkHeader::HEADER_SIZE + read_size);
+    nuraft::buffer_serializer bs(chunk);
+    bs.put_u64(offset);
+    bs.put_u8(offset + read_size == file_size);
+
+    readObjectRange(snap_fd, obj_path, reinterpret_cast<char *>(chunk->data_begin()) + SnapshotChunkHeader::HEADER_SIZE, offset, read_size);
+
+    chunk->pos(0);
+    return chunk;
+}
+
+}
+
+void KeeperSnapshotStore::loadObject(ulong obj_id, ptr<buffer> & buffer)
+{
+    if (!existObject(obj_id))
+        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} does not exist", obj_id);
+
+    String obj_path = objects_path.at(obj_id);
+
+    UInt64 file_size;
+    int snap_fd = openObjectForRead(obj_path, file_size);
+    SCOPE_EXIT({ ::close(snap_fd); });
+
+    /// Read straight into the buffer NuRaft sends
     buffer = buffer::alloc(file_size);
-    size_t offset = 0;
-    char read_buf[IO_BUFFER_SIZE];
-    while (offset < file_size)
+    readObjectRange(snap_fd, obj_path, reinterpret_cast<char *>(buffer->data_begin()), 0, file_size);
+    buffer->pos(0);
+
+    LOG_INFO(log, "Load object obj_id {}, file_size {}.", obj_id, file_size);
+}
+
+bool KeeperSnapshotStore::loadObjectChunk(ulong obj_id, UInt64 offset, UInt64 size, ptr<buffer> & buffer)
+{
+    if (!existObject(obj_id))
+        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} does not exist", obj_id);
+
+    buffer = nullptr;
+    if (read_ahead && read_ahead->obj_id == obj_id && read_ahead->offset == offset && read_ahead->size == size)
     {
-        int buf_size = IO_BUFFER_SIZE;
-        if (offset + IO_BUFFER_SIZE >= file_size)
+        try
         {
-            buf_size = file_size - offset;
+            buffer = read_ahead->data.get();
         }
-        errno = 0;
-        ssize_t ret = pread(snap_fd, read_buf, buf_size, offset);
-        if (ret < 0)
+        catch (...)
         {
-            LOG_ERROR(
-                log,
-                "Read object failed, path {}, offset {}, length {}, ret {}, erron {}, error:{}",
-                obj_path,
-                offset,
-                buf_size,
-                ret,
-                errno,
-                strerror(errno));
-            break;
+            tryLogCurrentException(log, "Fail to read snapshot object chunk ahead, read it again");
         }
-        buffer->put_raw(reinterpret_cast<nuraft::byte *>(read_buf), buf_size);
-        offset += buf_size;
     }
+    /// Wait for the outdated one, if any
+    read_ahead.reset();
 
-    if (snap_fd > 0)
+    if (!buffer)
+        buffer = readObjectChunk(objects_path.at(obj_id), offset, size);
+
+    bool last = buffer->data_begin()[sizeof(UInt64)];
+
+    /// Read the next chunk while this one is on the wire
+    ulong next_obj_id = last ? obj_id + 1 : obj_id;
+    UInt64 next_offset = last ? 0 : offset + size;
+    if (existObject(next_obj_id))
     {
-        ::close(snap_fd);
+        String next_path = objects_path.at(next_obj_id);
+        read_ahead = ChunkReadAhead{
+            next_obj_id,
+            next_offset,
+            size,
+            std::async(std::launch::async, [next_path, next_offset, size] { return readObjectChunk(next_path, next_offset, size); })};
     }
 
-    LOG_INFO(log, "Load object obj_id {}, file_size {}.", obj_id, file_size);
+    LOG_DEBUG(log, "Load object obj_id {} chunk at {}, size {}, last {}", obj_id, offset, buffer->size(), last);
+    return last;
+}
+
+void KeeperSnapshotStore::saveObjectChunk(ulong obj_id, const SnapshotChunkHeader & header, const char * data, size_t size)
+{
+    Poco::File(snap_dir).createDirectories();
+
+    String obj_path;
+    getObjectPath(obj_id, obj_path);
+
+    int snap_fd = openFileForWrite(obj_path);
+    SCOPE_EXIT({ ::close(snap_fd); });
+
+    for (size_t done = 0; done < size;)
+    {
+        ssize_t ret = ::pwrite(snap_fd, data + done, size - done, header.offset + done);
+        if (ret < 0 && errno == EINTR)
+            continue;
+        if (ret < 0)
+            throwFromErrno("Cannot write snapshot object " + obj_path, ErrorCodes::CORRUPTED_SNAPSHOT);
+        done += ret;
+    }
+
+    if (write_throttler)
+        write_throttler->add(size);
+
+    if (header.last)
+    {
+        /// The file may be left by an interrupted transfer
+        if (::ftruncate(snap_fd, header.offset + size) != 0)
+            throwFromErrno("Cannot truncate snapshot object " + obj_path, ErrorCodes::CORRUPTED_SNAPSHOT);
+        objects_path[obj_id] = obj_path;
+        base_key_loaded = false;
+        LOG_INFO(log, "Save object path {}, file size {}, obj_id {}.", obj_path, header.offset + size, obj_id);
+    }
 }
 
 void KeeperSnapshotStore::saveObject(ulong obj_id, buffer & buffer)
@@ -723,6 +1157,9 @@ void KeeperSnapshotStore::saveObject(ulong obj_id, buffer & buffer)
             break;
         }
         offset += buf_size;
+
+        if (write_throttler)
+            write_throttler->add(buf_size);
     }
 
     if (snap_fd > 0)
@@ -731,6 +1168,7 @@ void KeeperSnapshotStore::saveObject(ulong obj_id, buffer & buffer)
     }
 
     objects_path[obj_id] = obj_path;
+    base_key_loaded = false;
     LOG_INFO(log, "Save object path {}, file size {}, obj_id {}.", obj_path, buffer.size(), obj_id);
 }
 
@@ -739,16 +1177,89 @@ void KeeperSnapshotStore::addObjectPath(ulong obj_id, String & path)
     objects_path[obj_id] = path;
 }
 
-size_t KeeperSnapshotManager::createSnapshotAsync(SnapTask & snap_task, SnapshotVersion version)
+void KeeperSnapshotStore::addObjectPaths(size_t object_count)
+{
+    for (size_t i = 1; i < object_count + 1; i++)
+    {
+        String path;
+        getObjectPath(i, path);
+        addObjectPath(i, path);
+    }
+}
+
+KeeperSnapshotManager::SnapshotChain KeeperSnapshotManager::getSnapshotChain(uint128_t key)
+{
+    SnapshotChain chain;
+    while (true)
+    {
+        auto it = snapshots.find(key);
+        if (it == snapshots.end())
+        {
+            auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(key);
+            throw Exception(ErrorCodes::SNAPSHOT_NOT_EXISTS, "Snapshot with term {} log index {} does not exist", log_term, log_index);
+        }
+        chain.push_back(it->second);
+
+        auto base_key = it->second->getBaseKey();
+        if (!base_key)
+            break;
+        if (*base_key >= key)
+            throw Exception(
+                ErrorCodes::CORRUPTED_SNAPSHOT,
+                "Incremental snapshot {} is based on a later one",
+                it->second->getSnapshotMeta()->get_last_log_idx());
+        key = *base_key;
+    }
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+bool KeeperSnapshotManager::canCreateIncremental(const SnapTask & snap_task, const std::optional<uint128_t> & base_key)
+{
+    if (!incremental_snapshot_count || !snap_task.dirty_nodes || !base_key || !snapshots.contains(*base_key))
+        return false;
+
+    size_t dirty_count = 0;
+    for (const auto & paths : *snap_task.dirty_nodes)
+        dirty_count += paths.size();
+
+    /// Not worth it if most of nodes are changed
+    if (dirty_count * 2 > static_cast<size_t>(snap_task.nodes_count))
+        return false;
+
+    try
+    {
+        /// The base and its deltas
+        return getSnapshotChain(*base_key).size() <= incremental_snapshot_count;
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, "Fail to get the chain of the previous snapshot, create a full snapshot");
+        return false;
+    }
+}
+
+ptr<KeeperSnapshotStore>
+KeeperSnapshotManager::prepareSnapshotStore(SnapTask & snap_task, SnapshotVersion version, std::optional<uint128_t> & base_key)
 {
     auto && meta = snap_task.s;
     meta->set_size(snap_task.nodes_count);
+
+    /// Dirty nodes are changes since the previous snapshot only if it was created
+    base_key = std::exchange(dirty_base, std::nullopt);
+    if (!canCreateIncremental(snap_task, base_key))
+        base_key.reset();
+    if (base_key)
+        version = SnapshotVersion::V4;
+
     ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, *meta, object_node_size, SAVE_BATCH_SIZE, version);
+    snap_store->setWriteThrottler(write_throttler);
     snap_store->init();
     LOG_INFO(
         log,
-        "Creating snapshot with last_log_term {}, last_log_idx {}, size {}, nodes {}, ephemeral nodes {}, sessions {}, session_id_counter {}, "
-        "zxid {}",
+        "Creating {} snapshot with last_log_term {}, last_log_idx {}, size {}, nodes {}, ephemeral nodes {}, sessions {}, "
+        "session_id_counter {}, zxid {}",
+        base_key ? "incremental" : "full",
         meta->get_last_log_term(),
         meta->get_last_log_idx(),
         meta->size(),
@@ -757,17 +1268,138 @@ size_t KeeperSnapshotManager::createSnapshotAsync(SnapTask & snap_task, Snapshot
         snap_task.session_count,
         snap_task.next_session_id,
         snap_task.next_zxid);
-    size_t obj_size = snap_store->createObjectsAsync(snap_task);
-    snapshots[getSnapshotStoreMapKey(*meta)] = snap_store;
+    return snap_store;
+}
+
+size_t KeeperSnapshotManager::createSnapshotAsync(SnapTask & snap_task, SnapshotVersion version)
+{
+    std::optional<uint128_t> base_key;
+    ptr<KeeperSnapshotStore> snap_store = prepareSnapshotStore(snap_task, version, base_key);
+    size_t obj_size = snap_store->createObjectsAsync(snap_task, base_key);
+    snapshots[getSnapshotStoreMapKey(*snap_task.s)] = snap_store;
+    dirty_base = getSnapshotStoreMapKey(*snap_task.s);
     return obj_size;
 }
 
+KeeperSnapshotManager::ForkedSnapshot KeeperSnapshotManager::forkSnapshot(SnapTask & snap_task, SnapshotVersion version)
+{
+    std::optional<uint128_t> base_key;
+    ForkedSnapshot forked;
+    forked.store = prepareSnapshotStore(snap_task, version, base_key);
+
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0)
+        throwFromErrno("Cannot create pipe for forked snapshot", ErrorCodes::CANNOT_PIPE);
+
+    forked.pid = fork();
+    if (forked.pid < 0)
+    {
+        int saved_errno = errno;
+        close(fds[0]);
+        close(fds[1]);
+        errno = saved_errno;
+        throwFromErrno("Cannot fork to create snapshot", ErrorCodes::CANNOT_FORK);
+    }
+
+    if (forked.pid == 0)
+    {
+        /// Only this thread exists in the child, so it may touch nothing which other threads lock, including loggers.
+        /// The data tree is read without lock, sessions and ACLs are copied by snap_task before fork.
+        close(fds[0]);
+        int exit_code = 1;
+        try
+        {
+            forked.store->prepareForkedChild();
+            UInt64 object_count = forked.store->createObjectsAsync(snap_task, base_key);
+            if (write(fds[1], &object_count, sizeof(object_count)) == sizeof(object_count))
+                exit_code = 0;
+        }
+        catch (...)
+        {
+        }
+        _exit(exit_code);
+    }
+
+    close(fds[1]);
+    forked.result_fd = fds[0];
+
+    /// The child has its own copy, writes need not copy buckets any more
+    snap_task.data_tree.reset();
+    snap_task.dirty_nodes.reset();
+
+    LOG_INFO(log, "Forked process {} to create snapshot {}", forked.pid, snap_task.s->get_last_log_idx());
+    return forked;
+}
+
+size_t KeeperSnapshotManager::waitForkedSnapshot(ForkedSnapshot & forked)
+{
+    UInt64 object_count = 0;
+    size_t read_size = 0;
+    while (read_size < sizeof(object_count))
+    {
+        ssize_t res = read(forked.result_fd, reinterpret_cast<char *>(&object_count) + read_size, sizeof(object_count) - read_size);
+        if (res < 0 && errno == EINTR)
+            continue;
+        if (res <= 0)
+            break;
+        read_size += res;
+    }
+    close(forked.result_fd);
+    forked.result_fd = -1;
+
+    int status = 0;
+    while (waitpid(forked.pid, &status, 0) < 0)
+    {
+        if (errno != EINTR)
+        {
+            LOG_ERROR(log, "Cannot wait for process {} creating snapshot, errno {}", forked.pid, errno);
+            return 0;
+        }
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || read_size != sizeof(object_count))
+    {
+        LOG_ERROR(
+            log,
+            "Process {} creating snapshot failed, exit code {}, signal {}",
+            forked.pid,
+            WIFEXITED(status) ? WEXITSTATUS(status) : 0,
+            WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+        forked.pid = -1;
+        return 0;
+    }
+    forked.pid = -1;
+    return object_count;
+}
+
+bool KeeperSnapshotManager::finishForkedSnapshot(const ForkedSnapshot & forked, size_t object_count)
+{
+    auto meta = forked.store->getSnapshotMeta();
+    auto key = getSnapshotStoreMapKey(*meta);
+    if (!object_count)
+    {
+        removeSnapshotFiles(key);
+        return false;
+    }
+
+    forked.store->addObjectPaths(object_count);
+    snapshots[key] = forked.store;
+    dirty_base = key;
+    LOG_INFO(log, "Created snapshot {} with {} objects in forked process", meta->get_last_log_idx(), object_count);
+    return true;
+}
+
 size_t KeeperSnapshotManager::createSnapshot(
     snapshot & meta, KeeperStore & store, int64_t next_zxid, int64_t next_session_id, SnapshotVersion version)
 {
+    /// Always full, restart tracking dirty nodes from it
+    dirty_base.reset();
+    store.takeDirtyNodes();
+
     size_t store_size = store.getNodesCount();
     meta.set_size(store_size);
     ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size, SAVE_BATCH_SIZE, version);
+    snap_store->setWriteThrottler(write_throttler);
     snap_store->init();
     LOG_INFO(
         log,
@@ -783,17 +1415,109 @@ size_t KeeperSnapshotManager::createSnapshot(
         next_zxid);
     size_t obj_size = snap_store->createObjects(store, next_zxid, next_session_id);
     snapshots[getSnapshotStoreMapKey(meta)] = snap_store;
+    dirty_base = getSnapshotStoreMapKey(meta);
     return obj_size;
 }
 
 bool KeeperSnapshotManager::receiveSnapshotMeta(snapshot & meta)
 {
+    auto key = getSnapshotStoreMapKey(meta);
+    /// Objects of the local one, if any, are not the same as the received ones
+    removeSnapshotFiles(key);
+
     ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, meta, object_node_size);
+    snap_store->setWriteThrottler(write_throttler);
     snap_store->init();
-    snapshots[getSnapshotStoreMapKey(meta)] = snap_store;
+    snapshots[key] = snap_store;
+
+    /// Leaders of older versions send no chain
+    receiving_key = key;
+    receiving_chain = {{snap_store, std::numeric_limits<UInt64>::max()}};
     return true;
 }
 
+std::vector<SnapshotChainMember> KeeperSnapshotManager::getSnapshotChainMembers(const snapshot & meta)
+{
+    std::vector<SnapshotChainMember> members;
+    for (const auto & member : getSnapshotChain(getSnapshotStoreMapKey(meta)))
+    {
+        auto member_meta = member->getSnapshotMeta();
+        members.push_back({member_meta->get_last_log_term(), member_meta->get_last_log_idx(), member->getObjectCount()});
+    }
+    return members;
+}
+
+UInt64 KeeperSnapshotManager::getSnapshotBytes(const snapshot & meta)
+{
+    UInt64 bytes = 0;
+    for (const auto & member : getSnapshotChain(getSnapshotStoreMapKey(meta)))
+        bytes += member->getObjectsBytes();
+    return bytes;
+}
+
+void KeeperSnapshotManager::receiveSnapshotChain(snapshot & meta, const std::vector<SnapshotChainMember> & members)
+{
+    receiving_key = getSnapshotStoreMapKey(meta);
+    receiving_chain.clear();
+    for (const auto & member : members)
+    {
+        auto key = getSnapshotStoreMapKeyImpl(member.log_last_term, member.log_last_index);
+        if (key != receiving_key)
+        {
+            LOG_INFO(
+                log,
+                "Receive snapshot term {} log index {} which snapshot {} is based on",
+                member.log_last_term,
+                member.log_last_index,
+                meta.get_last_log_idx());
+            removeSnapshotFiles(key);
+            ptr<nuraft::cluster_config> config = cs_new<nuraft::cluster_config>(member.log_last_index, member.log_last_index - 1);
+            nuraft::snapshot member_meta(member.log_last_index, member.log_last_term, config);
+            ptr<KeeperSnapshotStore> snap_store = cs_new<KeeperSnapshotStore>(snap_dir, member_meta, object_node_size);
+            snap_store->init();
+            snapshots[key] = snap_store;
+        }
+        receiving_chain.emplace_back(snapshots.at(key), member.object_count);
+    }
+}
+
+std::pair<ptr<KeeperSnapshotStore>, ulong> KeeperSnapshotManager::findChainObject(const snapshot & meta, ulong obj_id)
+{
+    for (const auto & store : getSnapshotChain(getSnapshotStoreMapKey(meta)))
+    {
+        if (obj_id <= store->getObjectCount())
+            return {store, obj_id};
+        obj_id -= store->getObjectCount();
+    }
+    return {nullptr, 0};
+}
+
+ptr<KeeperSnapshotStore> KeeperSnapshotManager::getReceivingStore(snapshot & meta, ulong & obj_id)
+{
+    auto key = getSnapshotStoreMapKey(meta);
+    if (key == receiving_key)
+    {
+        for (const auto & [store, object_count] : receiving_chain)
+        {
+            if (obj_id <= object_count)
+                return store;
+            obj_id -= object_count;
+        }
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Received object is beyond the chain of snapshot {}", meta.get_last_log_idx());
+    }
+
+    auto it = snapshots.find(key);
+    if (it != snapshots.end())
+        return it->second;
+
+    meta.set_size(0);
+    ptr<KeeperSnapshotStore> store = cs_new<KeeperSnapshotStore>(snap_dir, meta);
+    store->setWriteThrottler(write_throttler);
+    store->init();
+    snapshots[key] = store;
+    return store;
+}
+
 bool KeeperSnapshotManager::existSnapshot(const snapshot & meta)
 {
     return snapshots.find(getSnapshotStoreMapKey(meta)) != snapshots.end();
@@ -807,8 +1531,8 @@ bool KeeperSnapshotManager::existSnapshotObject(const snapshot & meta, ulong obj
         LOG_INFO(log, "Not exists snapshot last_log_idx {}", meta.get_last_log_idx());
         return false;
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    bool exist = store->existObject(obj_id);
+    auto [store, local_id] = findChainObject(meta, obj_id);
+    bool exist = store && store->existObject(local_id);
     LOG_INFO(log, "Find object {} by last_log_idx {} and object id {}", exist, meta.get_last_log_idx(), obj_id);
     return exist;
 }
@@ -824,40 +1548,67 @@ bool KeeperSnapshotManager::loadSnapshotObject(const snapshot & meta, ulong obj_
             obj_id,
             meta.get_last_log_idx());
 
-
-    ptr<KeeperSnapshotStore> store = it->second;
-    store->loadObject(obj_id, buffer);
+    auto [store, local_id] = findChainObject(meta, obj_id);
+    if (!store)
+        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} does not exist", obj_id);
+    store->loadObject(local_id, buffer);
     return true;
 }
 
 bool KeeperSnapshotManager::saveSnapshotObject(snapshot & meta, ulong obj_id, buffer & buffer)
 {
-    auto it = snapshots.find(getSnapshotStoreMapKey(meta));
-    ptr<KeeperSnapshotStore> store;
-    if (it == snapshots.end())
-    {
-        meta.set_size(0);
-        store = cs_new<KeeperSnapshotStore>(snap_dir, meta);
-        store->init();
-        snapshots[getSnapshotStoreMapKey(meta)] = store;
-    }
-    else
-    {
-        store = it->second;
-    }
+    ptr<KeeperSnapshotStore> store = getReceivingStore(meta, obj_id);
     store->saveObject(obj_id, buffer);
     return true;
 }
 
-bool KeeperSnapshotManager::parseSnapshot(const snapshot & meta, KeeperStore & storage)
+bool KeeperSnapshotManager::loadSnapshotObjectChunk(const snapshot & meta, ulong obj_id, UInt64 offset, UInt64 size, ptr<buffer> & buffer)
 {
     auto it = snapshots.find(getSnapshotStoreMapKey(meta));
     if (it == snapshots.end())
+        throw Exception(
+            ErrorCodes::SNAPSHOT_NOT_EXISTS,
+            "Error when loading snapshot object {}, for snapshot {} does not exist",
+            obj_id,
+            meta.get_last_log_idx());
+
+    auto [store, local_id] = findChainObject(meta, obj_id);
+    if (!store)
+        throw Exception(ErrorCodes::SNAPSHOT_OBJECT_NOT_EXISTS, "Snapshot object {} does not exist", obj_id);
+    return store->loadObjectChunk(local_id, offset, size, buffer);
+}
+
+bool KeeperSnapshotManager::saveSnapshotObjectChunk(snapshot & meta, ulong obj_id, buffer & buffer)
+{
+    if (buffer.size() < SnapshotChunkHeader::HEADER_SIZE)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot object chunk of {} bytes is too short", buffer.size());
+
+    ptr<KeeperSnapshotStore> store = getReceivingStore(meta, obj_id);
+
+    buffer.pos(0);
+    nuraft::buffer_serializer bs(buffer);
+    SnapshotChunkHeader header;
+    header.offset = bs.get_u64();
+    header.last = bs.get_u8();
+
+    const char * data = reinterpret_cast<const char *>(buffer.data_begin()) + SnapshotChunkHeader::HEADER_SIZE;
+    store->saveObjectChunk(obj_id, header, data, buffer.size() - SnapshotChunkHeader::HEADER_SIZE);
+    return header.last;
+}
+
+bool KeeperSnapshotManager::parseSnapshot(const snapshot & meta, KeeperStore & storage)
+{
+    auto chain = getSnapshotChain(getSnapshotStoreMapKey(meta));
+    if (chain.size() == 1)
     {
-        throw Exception(ErrorCodes::SNAPSHOT_NOT_EXISTS, "Error when parsing snapshot {}, for it does not exist", meta.get_last_log_idx());
+        chain.front()->loadLatestSnapshot(storage);
+        return true;
     }
-    ptr<KeeperSnapshotStore> store = it->second;
-    store->loadLatestSnapshot(storage);
+
+    LOG_INFO(log, "Snapshot {} is incremental, loading it with {} snapshots it is based on", meta.get_last_log_idx(), chain.size() - 1);
+    chain.front()->loadLatestSnapshot(storage, true);
+    for (size_t i = 1; i < chain.size(); ++i)
+        chain[i]->loadSnapshotDelta(storage, i + 1 == chain.size());
     return true;
 }
 
@@ -904,6 +1655,32 @@ size_t KeeperSnapshotManager::loadSnapshotMetas()
     return snapshots.size();
 }
 
+ptr<snapshot> KeeperSnapshotManager::lastIntactSnapshot()
+{
+    while (!snapshots.empty())
+    {
+        auto key = snapshots.rbegin()->first;
+        bool intact = false;
+        try
+        {
+            auto chain = getSnapshotChain(key);
+            intact = std::all_of(chain.begin(), chain.end(), [](const auto & store) { return store->verifyObjects(); });
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to get the chain of a snapshot");
+        }
+
+        if (intact)
+            return snapshots.rbegin()->second->getSnapshotMeta();
+
+        auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(key);
+        LOG_ERROR(log, "Snapshot with term {} log index {} is corrupted, skip it and its files are kept", log_term, log_index);
+        snapshots.erase(key);
+    }
+    return nullptr;
+}
+
 ptr<snapshot> KeeperSnapshotManager::lastSnapshot()
 {
     LOG_INFO(log, "Get last snapshot, snapshot size {}", snapshots.size());
@@ -913,62 +1690,70 @@ ptr<snapshot> KeeperSnapshotManager::lastSnapshot()
     return entry->second->getSnapshotMeta();
 }
 
-size_t KeeperSnapshotManager::removeSnapshots()
+void KeeperSnapshotManager::removeSnapshotFiles(uint128_t key)
 {
-    Int64 remove_count = static_cast<Int64>(snapshots.size()) - static_cast<Int64>(keep_max_snapshot_count);
+    auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(key);
 
-    LOG_INFO(log, "There are {} snapshots, we will try to move {remove_count} of them", snapshots.size(), remove_count);
-
-    while (remove_count > 0)
+    Poco::File dir_obj(snap_dir);
+    if (dir_obj.exists())
     {
-        auto it = snapshots.begin();
-        uint128_t remove_term_log_index = it->first;
-        auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(remove_term_log_index);
-        LOG_INFO(log, "Remove snapshot with term {} log index {}", log_term, log_index);
-
-        Poco::File dir_obj(snap_dir);
-        if (dir_obj.exists())
+        std::vector<String> files;
+        dir_obj.list(files);
+        for (const auto & file : files)
         {
-            std::vector<String> files;
-            dir_obj.list(files);
-            for (const auto & file : files)
+            if (file.find("snapshot_") == file.npos)
             {
-                if (file.find("snapshot_") == file.npos)
-                {
-                    LOG_INFO(log, "Skip no snapshot file {}", file);
-                    continue;
-                }
-                SnapObject s_obj;
-                if (!s_obj.parseInfoFromObjectName(file))
-                {
-                    LOG_ERROR(log, "Can't parse object info from file name {}", file);
-                    continue;
-                }
-                auto key = getSnapshotStoreMapKey(s_obj);
-                if (remove_term_log_index == key)
-                {
-                    LOG_INFO(
-                        log,
-                        "remove_count {}, snapshot size {}, remove term with term {} log index {}, file {}",
-                        remove_count,
-                        snapshots.size(),
-                        log_term,
-                        log_index,
-                        file);
-                    Poco::File(snap_dir + "/" + file).remove();
-                    if (snapshots.find(key) != snapshots.end())
-                    {
-                        snapshots.erase(it);
-                    }
-                }
+                LOG_INFO(log, "Skip no snapshot file {}", file);
+                continue;
+            }
+            SnapObject s_obj;
+            if (!s_obj.parseInfoFromObjectName(file))
+            {
+                LOG_ERROR(log, "Can't parse object info from file name {}", file);
+                continue;
+            }
+            if (getSnapshotStoreMapKey(s_obj) == key)
+            {
+                LOG_INFO(log, "Remove snapshot file with term {} log index {}, file {}", log_term, log_index, file);
+                Poco::File(snap_dir + "/" + file).remove();
             }
         }
-        remove_count--;
     }
+    snapshots.erase(key);
+}
 
-    if (snapshots.size() > keep_max_snapshot_count)
-        LOG_ERROR(log, "Snapshots size() is still large than keep_max_snapshot_count {}, it's a bug",
-                  snapshots.size(), keep_max_snapshot_count);
+size_t KeeperSnapshotManager::removeSnapshots()
+{
+    /// Keep the latest snapshots and the ones they are based on
+    std::set<uint128_t> keep_keys;
+    size_t kept = 0;
+    for (auto it = snapshots.rbegin(); it != snapshots.rend() && kept < keep_max_snapshot_count; ++it, ++kept)
+    {
+        keep_keys.insert(it->first);
+        try
+        {
+            for (const auto & member : getSnapshotChain(it->first))
+                keep_keys.insert(getSnapshotStoreMapKey(*member->getSnapshotMeta()));
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to get the chain of a snapshot");
+        }
+    }
+
+    std::vector<uint128_t> remove_keys;
+    for (const auto & [key, _] : snapshots)
+        if (!keep_keys.contains(key))
+            remove_keys.push_back(key);
+
+    LOG_INFO(log, "There are {} snapshots, we will try to remove {} of them", snapshots.size(), remove_keys.size());
+
+    for (auto key : remove_keys)
+    {
+        auto [log_term, log_index] = getTermLogFromSnapshotStoreMapKey(key);
+        LOG_INFO(log, "Remove snapshot with term {} log index {}", log_term, log_index);
+        removeSnapshotFiles(key);
+    }
 
     return snapshots.size();
 }
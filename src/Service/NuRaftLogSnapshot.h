@@ -4,6 +4,10 @@
 #include <Service/Metrics.h>
 #include <Common/Stopwatch.h>
 #include <charconv>
+#include <functional>
+#include <future>
+#include <optional>
+#include <sys/types.h>
 
 
 namespace RK
@@ -20,34 +24,100 @@ struct SnapTask
     int64_t nodes_count;
     int64_t ephemeral_nodes_count;
     int64_t session_count;
-    SessionAndTimeout session_and_timeout;
-    std::unordered_map<uint64_t, Coordination::ACLs> acl_map;
-    KeeperStore::SessionAndAuth session_and_auth;
-    std::shared_ptr<KeeperStore::BucketNodes> buckets_nodes;
+    /// Versions pinned from the store, writes after the task copy the buckets they change
+    SessionManager::SessionAndTimeoutMap::VersionPtr session_and_timeout;
+    CopyOnWriteMap<uint64_t, ACLsPtr>::VersionPtr acl_map;
+    KeeperStore::SessionAndAuthMap::VersionPtr session_and_auth;
+    KeeperStore::DataTreeVersionPtr data_tree;
+    /// Paths changed since the previous snapshot task, nullptr if they are not known
+    KeeperStore::DataTree::DirtyKeysPtr dirty_nodes;
     nuraft::async_result<bool>::handler_type when_done;
 
     SnapTask(const ptr<snapshot> & s_, KeeperStore & store, nuraft::async_result<bool>::handler_type & when_done_)
         : s(s_), next_zxid(store.getZxid()), next_session_id(store.getSessionIDCounter()), when_done(when_done_)
     {
         auto * log = &Poco::Logger::get("SnapTask");
-        session_and_timeout = store.getSessionAndTimeOut();
-        session_count = session_and_timeout.size();
-        session_and_auth = store.getSessionAndAuth();
-
-        acl_map = store.getACLMap().getMapping();
         Stopwatch watch;
-        buckets_nodes = store.dumpDataTree();
-        LOG_INFO(log, "Dumping data tree costs {}ms", watch.elapsedMilliseconds());
+        session_and_timeout = store.pinSessionAndTimeout();
+        session_count = session_and_timeout->size();
+        session_and_auth = store.pinSessionAndAuth();
+        acl_map = store.getACLMap().pinMapping();
+        /// Later writes copy what they touch, so the pinned version is consistent until the task is released.
+        data_tree = store.pinDataTree();
+        dirty_nodes = store.takeDirtyNodes();
+        LOG_INFO(log, "Pinning sessions, ACLs and data tree costs {}ms", watch.elapsedMilliseconds());
         Metrics::getMetrics().snap_blocking_time_ms->add(watch.elapsedMilliseconds());
 
-        for (auto && bucket : *buckets_nodes)
+        for (const auto & bucket : data_tree->getBuckets())
         {
-            LOG_DEBUG(log, "Get bucket size {}", bucket.size());
+            LOG_DEBUG(log, "Get bucket size {}", bucket->size());
         }
 
         nodes_count = store.getNodesCount();
         ephemeral_nodes_count = store.getTotalEphemeralNodesCount();
     }
+
+    /// Approximate bytes of the buckets of sessions and ACLs which the store has copied since the task pinned them,
+    /// and of the dirty paths taken by the task
+    UInt64 getApproximateMemoryUsage() const
+    {
+        UInt64 bytes = session_and_timeout->getApproximateMemoryUsage(true) + acl_map->getApproximateMemoryUsage(true)
+            + session_and_auth->getApproximateMemoryUsage(true);
+        if (dirty_nodes)
+            for (const auto & bucket : *dirty_nodes)
+            {
+                bytes += hashTableMemoryUsage(bucket);
+                for (const auto & path : bucket)
+                    bytes += stringMemoryUsage(path);
+            }
+        return bytes;
+    }
+};
+
+/** Snapshot objects may be sent to followers in chunks, so that neither side holds a whole object in memory.
+  *
+  * The leader tells it by the first dummy object, and the follower then asks for objects by chunked ids,
+  * which contain object id and chunk index. Every chunk is SnapshotChunkHeader followed by chunk data.
+  * Followers of older versions ignore the dummy object and ask for whole objects as before.
+  */
+static constexpr Int32 SNAPSHOT_TRANSFER_WHOLE = 0;
+static constexpr Int32 SNAPSHOT_TRANSFER_CHUNKED = 1;
+static constexpr UInt64 DEFAULT_SNAPSHOT_CHUNK_SIZE = 16 * 1024 * 1024;
+static constexpr ulong CHUNKED_OBJECT_ID_FLAG = 1ULL << 63;
+
+inline ulong getChunkedObjectId(ulong object_id, UInt64 chunk_index)
+{
+    return CHUNKED_OBJECT_ID_FLAG | object_id << 32 | chunk_index;
+}
+
+inline bool isChunkedObjectId(ulong id)
+{
+    return id & CHUNKED_OBJECT_ID_FLAG;
+}
+
+/// Return object id and chunk index
+inline std::pair<ulong, UInt64> parseChunkedObjectId(ulong id)
+{
+    return {(id & ~CHUNKED_OBJECT_ID_FLAG) >> 32, id & 0xFFFFFFFF};
+}
+
+/// The dummy object also lists the snapshots the sent one is based on, the base first, see KeeperSnapshotManager.
+/// Objects of them are numbered one after another, so that the follower can tell which snapshot an object is of.
+struct SnapshotChainMember
+{
+    UInt64 log_last_term;
+    UInt64 log_last_index;
+    UInt64 object_count;
+    static const size_t SIZE = 24;
+};
+
+struct SnapshotChunkHeader
+{
+    /// Offset of the chunk in the object file
+    UInt64 offset;
+    /// Whether it is the last chunk of the object
+    bool last;
+    static const size_t HEADER_SIZE = 9;
 };
 
 struct SnapObject
@@ -126,6 +196,9 @@ struct SnapObject
  *
  * Snapshot object format:
  *      SnapshotHeader + (SnapshotBatch)[...] + SnapshotTail
+ *
+ * An incremental snapshot (SnapshotVersion::V4) has the same objects, but data objects hold only nodes changed
+ * since its base snapshot and batches of deleted paths. Its int map has BASE_TERM and BASE_INDEX of the base.
  */
 class KeeperSnapshotStore
 {
@@ -140,7 +213,7 @@ public:
         , snap_dir(snap_dir_)
         , max_object_node_size(max_object_node_size_)
         , save_batch_size(save_batch_size_)
-        , log(&(Poco::Logger::get("KeeperSnapshotStore")))
+        , log(getSnapshotLogger())
     {
         last_log_index = meta.get_last_log_idx();
         last_log_term = meta.get_last_log_term();
@@ -160,26 +233,68 @@ public:
     /// Create snapshot object, return the size of objects
     size_t createObjects(KeeperStore & store, int64_t next_zxid = 0, int64_t next_session_id = 0);
 
-    /// Create async snapshot object by snap_task, return the size of objects
-    size_t createObjectsAsync(SnapTask & snap_task);
+    /// Create async snapshot object by snap_task, return the size of objects.
+    /// If base_key is set, only nodes in snap_task.dirty_nodes are saved, as changes since the base snapshot.
+    size_t createObjectsAsync(SnapTask & snap_task, std::optional<uint128_t> base_key = {});
 
     /// initialize a snapshot store
     void init(String create_time);
 
-    /// Load the latest snapshot object.
-    void loadLatestSnapshot(KeeperStore & store);
+    /// Verify batch CRCs and checksums of all objects in parallel without parsing them, return whether all are intact.
+    bool verifyObjects();
+
+    /// Load the latest snapshot object. If data_only, sessions, ACLs and the int map are skipped,
+    /// it is used for the base of incremental snapshots.
+    void loadLatestSnapshot(KeeperStore & store, bool data_only = false);
+
+    /// Apply an incremental snapshot to the store which has its base loaded. Sessions, ACLs and the int map
+    /// are loaded only for the last one of a chain, for they are saved in full.
+    void loadSnapshotDelta(KeeperStore & store, bool with_sessions_and_acls);
+
+    /// Map key of the base snapshot, empty if it is a full snapshot.
+    std::optional<uint128_t> getBaseKey();
+
+    /// Object ids are from 1 to it
+    UInt64 getObjectCount() const { return objects_path.empty() ? 0 : objects_path.rbegin()->first; }
+
+    /// Bytes of object files, the missing ones are not counted
+    UInt64 getObjectsBytes() const;
 
     /// load on object of the latest snapshot
     void loadObject(ulong obj_id, ptr<buffer> & buffer);
 
+    /// Load a chunk of an object with SnapshotChunkHeader, return whether it is the last chunk of the object.
+    /// The next chunk is read ahead, so that it is ready when the previous one is sent.
+    bool loadObjectChunk(ulong obj_id, UInt64 offset, UInt64 size, ptr<buffer> & buffer);
+
     /// whether an object id exist
     bool existObject(ulong obj_id);
 
     /// save an object
     void saveObject(ulong obj_id, buffer & buffer);
 
+    /// Save a chunk of an object, the object exists after its last chunk is saved.
+    void saveObjectChunk(ulong obj_id, const SnapshotChunkHeader & header, const char * data, size_t size);
+
     void addObjectPath(ulong obj_id, String & path);
 
+    /// Add paths of objects from 1 to object_count, which are created by this store or a forked child process.
+    void addObjectPaths(size_t object_count);
+
+    /// Limit the speed of writing objects, both created and received ones
+    void setWriteThrottler(ThrottlerPtr throttler) { write_throttler = std::move(throttler); }
+
+    /// Threads of creating, verifying, parsing and building, 0 for SNAPSHOT_THREAD_NUM and for physical cores when building
+    void setThreadNum(size_t thread_num_) { thread_num = thread_num_; }
+
+    /// Invoked in a forked child process, where only the calling thread exists. Logging may wait forever for a mutex
+    /// held by another thread of the parent, and threads of the global thread pool are gone.
+    void prepareForkedChild()
+    {
+        log->setLevel(0);
+        single_threaded = true;
+    }
+
     /// get snapshot metadata
     ptr<snapshot> getSnapshotMeta() { return snap_meta; }
 
@@ -196,7 +311,7 @@ private:
     size_t createObjectsV2(KeeperStore & store, int64_t next_zxid = 0, int64_t next_session_id = 0);
 
     /// For create snapshot async
-    size_t createObjectsAsyncImpl(SnapTask & snap_task);
+    size_t createObjectsAsyncImpl(SnapTask & snap_task, std::optional<uint128_t> base_key);
 
     /// get path of an object
     void getObjectPath(ulong object_id, String & path);
@@ -204,12 +319,15 @@ private:
     /// Parse an snapshot object. We should take the version from snapshot in general.
     void parseObject(KeeperStore & store, String obj_path, BucketEdges &, BucketNodes &);
 
-    /// Parse batch header in an object
-    /// TODO use internal buffer
-    void parseBatchHeader(ptr<std::fstream> fs, SnapshotBatchHeader & head);
+    /// Read batches of an object from the mapped file and verify checksums, process_batch gets uncompressed batch body,
+    /// which is valid only during the call. Return the size of the object file.
+    size_t readObject(const String & obj_path, const std::function<void(std::string_view, SnapshotVersion)> & process_batch);
+
+    /// Read the int map object
+    IntMap loadIntMap();
 
     /// Parse a batch
-    void parseBatchBodyV2(KeeperStore & store, const String &, BucketEdges &, BucketNodes &, SnapshotVersion version_);
+    void parseBatchBodyV2(KeeperStore & store, std::string_view body, BucketEdges &, BucketNodes &, SnapshotVersion version_);
 
     /// For snapshot version v2
     size_t serializeDataTreeV2(KeeperStore & storage);
@@ -217,6 +335,9 @@ private:
     /// For async snapshot
     size_t serializeDataTreeAsync(SnapTask & snap_task);
 
+    /// For incremental snapshot, save dirty nodes of the pinned data tree and paths of those deleted
+    size_t serializeDataTreeDelta(SnapTask & snap_task);
+
     /// For snapshot version v2
     void serializeNodeV2(
         ptr<WriteBufferFromFile> & out,
@@ -226,15 +347,15 @@ private:
         uint64_t & processed,
         uint32_t & checksum);
 
-    /// For async snapshot
-    uint32_t serializeNodeAsync(
-        ptr<WriteBufferFromFile> & out,
-        ptr<SnapshotBatchBody> & batch,
-        BucketNodes & nodes);
+    /// For async snapshot, save nodes of a bucket to objects from first_object_id
+    void serializeBucketAsync(const KeeperStore::DataTree::InnerMap & bucket, UInt64 first_object_id);
+
+    /// Write tail of a data object holding object_nodes nodes and close it, the object is counted in Metrics
+    void closeObject(ptr<WriteBufferFromFile> & out, UInt32 checksum, UInt64 object_nodes);
 
     /// Append node to batch version v2
     inline static void
-    appendNodeToBatchV2(ptr<SnapshotBatchBody> batch, const String & path, std::shared_ptr<KeeperNode> node, SnapshotVersion version);
+    appendNodeToBatchV2(ptr<SnapshotBatchBody> batch, const String & path, KeeperNodePtr node, SnapshotVersion version);
 
     /// Snapshot directory, note than the directory may contain more than one snapshot.
     String snap_dir;
@@ -258,6 +379,19 @@ private:
 
     std::map<ulong, String> objects_path;
 
+    /// Cache of getBaseKey
+    bool base_key_loaded = false;
+    std::optional<uint128_t> base_key;
+
+    /// Whether save buckets of the data tree in turn, see prepareForkedChild
+    bool single_threaded = false;
+
+    /// See setThreadNum
+    size_t thread_num = 0;
+    size_t getThreadNum() const { return thread_num ? thread_num : SNAPSHOT_THREAD_NUM; }
+
+    ThrottlerPtr write_throttler;
+
     std::vector<BucketEdges> all_objects_edges;
     std::vector<BucketNodes> all_objects_nodes;
 
@@ -267,6 +401,16 @@ private:
     /// Used to create snapshot asynchronously,
     /// but now creating snapshot is synchronous
     std::shared_ptr<ThreadPool> snapshot_thread;
+
+    /// The chunk being read ahead by loadObjectChunk
+    struct ChunkReadAhead
+    {
+        ulong obj_id;
+        UInt64 offset;
+        UInt64 size;
+        std::future<ptr<buffer>> data;
+    };
+    std::optional<ChunkReadAhead> read_ahead;
 };
 
 // In Raft, each log entry can be uniquely identified by the combination of its Log Index and Term.
@@ -299,20 +443,52 @@ using KeeperSnapshotStoreMap = std::map<uint128_t, ptr<KeeperSnapshotStore>>;
 class KeeperSnapshotManager
 {
 public:
-    KeeperSnapshotManager(const String & snap_dir_, UInt32 keep_max_snapshot_count_, UInt32 object_node_size_)
+    KeeperSnapshotManager(
+        const String & snap_dir_,
+        UInt32 keep_max_snapshot_count_,
+        UInt32 object_node_size_,
+        UInt32 incremental_snapshot_count_ = 0,
+        ThrottlerPtr write_throttler_ = nullptr)
         : snap_dir(snap_dir_)
         , keep_max_snapshot_count(keep_max_snapshot_count_)
         , object_node_size(object_node_size_)
+        , incremental_snapshot_count(incremental_snapshot_count_)
+        , write_throttler(std::move(write_throttler_))
         , log(&(Poco::Logger::get("KeeperSnapshotManager")))
     {
     }
 
     ~KeeperSnapshotManager() = default;
 
+    /// Snapshot and the ones it is based on, the base first. Throws if any of them does not exist.
+    using SnapshotChain = std::vector<ptr<KeeperSnapshotStore>>;
+    SnapshotChain getSnapshotChain(uint128_t key);
+
+    /// Create an incremental snapshot if snap_task has dirty nodes since the previous snapshot and the chain is
+    /// not too long, otherwise a full one.
     size_t createSnapshotAsync(
         SnapTask & snap_task,
         SnapshotVersion version = CURRENT_SNAPSHOT_VERSION);
 
+    /// Snapshot being created by a forked child process
+    struct ForkedSnapshot
+    {
+        pid_t pid = -1;
+        /// Read end of the pipe which the child writes the size of objects to
+        int result_fd = -1;
+        ptr<KeeperSnapshotStore> store;
+    };
+
+    /// Create the snapshot of snap_task like createSnapshotAsync, but in a forked child process. The child sees the memory
+    /// as it is when forked, so the pinned data tree of snap_task is released in the parent at once.
+    ForkedSnapshot forkSnapshot(SnapTask & snap_task, SnapshotVersion version = CURRENT_SNAPSHOT_VERSION);
+
+    /// Wait for the child to exit, return the size of objects it created, 0 if it failed. It needs no lock.
+    size_t waitForkedSnapshot(ForkedSnapshot & forked);
+
+    /// Add the snapshot created by the child, or remove files it left if object_count is 0. Return whether it is added.
+    bool finishForkedSnapshot(const ForkedSnapshot & forked, size_t object_count);
+
     size_t createSnapshot(
         snapshot & meta,
         KeeperStore & store,
@@ -323,6 +499,15 @@ public:
     /// save snapshot meta, invoked when we receive an snapshot from leader.
     bool receiveSnapshotMeta(snapshot & meta);
 
+    /// Snapshots the snapshot is based on and itself, they are sent to followers together.
+    std::vector<SnapshotChainMember> getSnapshotChainMembers(const snapshot & meta);
+
+    /// Bytes of objects of the snapshot and the ones it is based on, which are sent to a follower installing it
+    UInt64 getSnapshotBytes(const snapshot & meta);
+
+    /// Invoked after receiveSnapshotMeta if the leader sends a chain, objects received later are saved to members.
+    void receiveSnapshotChain(snapshot & meta, const std::vector<SnapshotChainMember> & members);
+
     /// save snapshot object, invoked when we receive an snapshot from leader.
     bool saveSnapshotObject(snapshot & meta, ulong obj_id, buffer & buffer);
 
@@ -335,19 +520,43 @@ public:
     /// load snapshot object, invoked when leader should send snapshot to others.
     bool loadSnapshotObject(const snapshot & meta, ulong obj_id, ptr<buffer> & buffer);
 
+    /// Chunked versions of loadSnapshotObject and saveSnapshotObject, see SNAPSHOT_TRANSFER_CHUNKED.
+    /// Return whether the chunk is the last one of the object.
+    bool loadSnapshotObjectChunk(const snapshot & meta, ulong obj_id, UInt64 offset, UInt64 size, ptr<buffer> & buffer);
+    bool saveSnapshotObjectChunk(snapshot & meta, ulong obj_id, buffer & buffer);
+
     /// parse snapshot object, invoked when follower apply received snapshot to state machine.
     bool parseSnapshot(const snapshot & meta, KeeperStore & storage);
 
     /// latest snapshot meta
     ptr<snapshot> lastSnapshot();
 
+    /// Latest snapshot whose objects and the ones of its chain are intact, invoked before loading it when starting up.
+    /// Newer corrupted snapshots are forgotten so that the previous one is used instead, but their files are kept.
+    ptr<snapshot> lastIntactSnapshot();
+
     /// when initializing, load snapshots meta
     size_t loadSnapshotMetas();
 
-    /// remove outdated snapshots, after invoked at mast keep_max_snapshot_count remains.
+    /// Remove outdated snapshots, after invoked at most keep_max_snapshot_count remains,
+    /// not including the ones they are based on.
     size_t removeSnapshots();
 
 private:
+    /// Snapshot store and local object id of an object of a snapshot chain, nullptr if there is no such object.
+    std::pair<ptr<KeeperSnapshotStore>, ulong> findChainObject(const snapshot & meta, ulong obj_id);
+
+    /// Snapshot store of the snapshot being received which the object belongs to, obj_id is changed to the local id.
+    ptr<KeeperSnapshotStore> getReceivingStore(snapshot & meta, ulong & obj_id);
+
+    bool canCreateIncremental(const SnapTask & snap_task, const std::optional<uint128_t> & base_key);
+
+    /// Create store for the snapshot of snap_task, base_key is set if it is an incremental one.
+    ptr<KeeperSnapshotStore> prepareSnapshotStore(SnapTask & snap_task, SnapshotVersion version, std::optional<uint128_t> & base_key);
+
+    /// Remove files of a snapshot and forget it
+    void removeSnapshotFiles(uint128_t key);
+
     /// snapshot directory
     String snap_dir;
 
@@ -356,10 +565,25 @@ private:
 
     /// item limit of an object
     UInt32 object_node_size;
+
+    /// max incremental snapshots after a full one
+    UInt32 incremental_snapshot_count;
+
+    /// Limit of writing objects of created and received snapshots, shared by their stores
+    ThrottlerPtr write_throttler;
+
     Poco::Logger * log;
 
     KeeperSnapshotStoreMap snapshots;
     String last_create_time_str;
+
+    /// The last snapshot which dirty nodes of the next snapshot task are changes since. It is reset
+    /// when creating a snapshot begins, so it is empty if the previous one failed.
+    std::optional<uint128_t> dirty_base;
+
+    /// Snapshot being received and its chain with object counts
+    uint128_t receiving_key = 0;
+    std::vector<std::pair<ptr<KeeperSnapshotStore>, UInt64>> receiving_chain;
 };
 
 }
@@ -1,17 +1,27 @@
 #include <atomic>
+#include <csignal>
+#include <fcntl.h>
 #include <mutex>
+#include <optional>
 #include <string>
 
 #include <Poco/File.h>
 
+#include <Common/ConcurrentBoundedQueue.h>
+#include <Common/Exception.h>
+#include <Common/IO/ReadBufferFromFile.h>
+#include <Common/IO/ReadHelpers.h>
+#include <Common/IO/WriteBufferFromFile.h>
 #include <Common/Stopwatch.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
 #include <Common/setThreadName.h>
+#include <common/scope_guard.h>
 
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftStateMachine.h>
 #include <Service/ReadBufferFromNuRaftBuffer.h>
 #include <Service/RequestProcessor.h>
-#include <Service/ThreadSafeQueue.h>
+#include <Service/ThreadPlacement.h>
 #include <Service/WriteBufferFromNuraftBuffer.h>
 #include <ZooKeeper/ZooKeeperIO.h>
 
@@ -42,6 +52,26 @@ struct ReplayLogBatch
     ptr<std::vector<ptr<RequestForSession>>> request_vec;
 };
 
+/// Batches of logs loaded and deserialized by a thread ahead of applying them, at most 10 of them wait for applying.
+/// Loading is stopped when it is destroyed.
+struct LogReplayLoader
+{
+    explicit LogReplayLoader(ulong from_) : from(from_) { }
+
+    ~LogReplayLoader()
+    {
+        queue.clearAndFinish();
+        if (thread.joinable())
+            thread.join();
+    }
+
+    /// First log index loaded
+    const ulong from;
+    ConcurrentBoundedQueue<ReplayLogBatch> queue{10};
+    std::exception_ptr exception;
+    ThreadFromGlobalPool thread;
+};
+
 NuRaftStateMachine::NuRaftStateMachine(
     KeeperResponsesQueue & responses_queue_,
     const RaftSettingsPtr & raft_settings_,
@@ -54,36 +84,105 @@ NuRaftStateMachine::NuRaftStateMachine(
     ptr<log_store> log_store_,
     String super_digest,
     UInt32 object_node_size,
-    std::shared_ptr<RequestProcessor> request_processor_)
+    std::shared_ptr<RequestProcessor> request_processor_,
+    bool witness_)
     : raft_settings(raft_settings_)
-    , store(raft_settings->dead_session_check_period_ms, super_digest)
+    , store(
+          raft_settings->dead_session_check_period_ms,
+          super_digest,
+          raft_settings->data_tree_bucket_num,
+          raft_settings->response_cache_max_entries,
+          raft_settings->negative_lookup_filter,
+          raft_settings->incremental_snapshot_count > 0)
     , responses_queue(responses_queue_)
     , request_processor(request_processor_)
     , last_committed_idx(0)
     , snapshot_creating_interval(static_cast<uint64_t>(internal) * 1000000)
+    , snapshot_scheduler(
+          raft_settings->snapshot_distance,
+          raft_settings->snapshot_max_deferred_distance,
+          raft_settings->snapshot_defer_commit_rate,
+          raft_settings->snapshot_defer_commit_lag,
+          raft_settings->snapshot_stagger_interval_ms)
     , last_snapshot_time(Poco::Timestamp().epochMicroseconds())
     , new_session_id_callback_mutex(new_session_id_callback_mutex_)
     , new_session_id_callback(new_session_id_callback_)
+    , witness(witness_)
 {
     log = &(Poco::Logger::get("KeeperStateMachine"));
 
     LOG_INFO(log, "Begin to initialize state machine");
 
-    snapshot_dir = snap_dir;
-    snap_mgr = cs_new<KeeperSnapshotManager>(snapshot_dir, keep_max_snapshot_count, object_node_size);
+    if (raft_settings->multi_read_threads)
+        store.enableParallelMultiRead(raft_settings->multi_read_threads, raft_settings->multi_read_parallel_min_requests);
+    if (raft_settings->digest_check_interval_ms)
+        store.enableDigest();
+    store.setMaxWatchesPerSession(raft_settings->max_watches_per_session);
 
-    /// Load snapshot meta from disk
-    auto snapshots_count = snap_mgr->loadSnapshotMetas();
-    LOG_INFO(log, "Found {} snapshots from disk, load the latest one", snapshots_count);
-    auto last_snapshot = snap_mgr->lastSnapshot();
-    if (last_snapshot != nullptr)
-        applySnapshotImpl(*last_snapshot);
+    snapshot_dir = snap_dir;
+    /// Before loading snapshot, so that large data loaded is kept out of the heap and equal data is shared
+    LargeValueStore::instance().configure(snapshot_dir, raft_settings->large_value_threshold);
+    NodeDataInterner::instance().configure(raft_settings->intern_data_max_size);
+
+    ThrottlerPtr snapshot_write_throttler;
+    if (raft_settings->snapshot_write_max_bytes_per_second)
+        snapshot_write_throttler = std::make_shared<Throttler>(raft_settings->snapshot_write_max_bytes_per_second);
+    if (raft_settings->snapshot_transfer_max_bytes_per_second)
+        snapshot_transfer_throttler = std::make_shared<Throttler>(raft_settings->snapshot_transfer_max_bytes_per_second);
+
+    snap_mgr = cs_new<KeeperSnapshotManager>(
+        snapshot_dir, keep_max_snapshot_count, object_node_size, raft_settings->incremental_snapshot_count, snapshot_write_throttler);
+    if (raft_settings->snapshot_columnar_format)
+        snapshot_version = SnapshotVersion::V5;
+    else
+        snapshot_version = raft_settings->snapshot_compression ? SnapshotVersion::V3 : SnapshotVersion::V2;
 
-    committed_log_manager = cs_new<LastCommittedIndexManager>(log_dir);
+    auto * file_log_store = dynamic_cast<NuRaftFileLogStore *>(log_store_.get());
+    bool index_with_log_fsync = raft_settings->last_committed_index_with_log_fsync && file_log_store;
+    committed_log_manager = cs_new<LastCommittedIndexManager>(log_dir, index_with_log_fsync);
+    if (index_with_log_fsync)
+        file_log_store->setFlushCallback([manager = committed_log_manager](UInt64 durable_index) { manager->persist(durable_index); });
     /// Last committed idx of the previous startup, we should apply log to here.
     uint64_t previous_last_commit_id = committed_log_manager->get();
 
-    if (!previous_last_commit_id)
+    /// Logs after the snapshot, loaded while it is being parsed
+    std::unique_ptr<LogReplayLoader> log_loader;
+
+    if (witness)
+    {
+        LOG_INFO(log, "I am a witness, logs will not be applied");
+        loadWitnessSnapshot();
+    }
+    else
+    {
+        /// Load snapshot meta from disk
+        auto snapshots_count = snap_mgr->loadSnapshotMetas();
+        LOG_INFO(log, "Found {} snapshots from disk, load the latest one", snapshots_count);
+        auto last_snapshot = snap_mgr->lastIntactSnapshot();
+
+        uint64_t snapshot_idx = last_snapshot ? last_snapshot->get_last_log_idx() : 0;
+        if (previous_last_commit_id > snapshot_idx)
+        {
+            try
+            {
+                log_loader = startLoadingLogs(log_store_, snapshot_idx + 1, previous_last_commit_id);
+            }
+            catch (...)
+            {
+                /// Logs do not match the snapshot, it is reported when replaying them
+            }
+        }
+
+        if (last_snapshot != nullptr)
+            applySnapshotImpl(*last_snapshot);
+    }
+
+    if (witness)
+    {
+        /// Nothing to replay, logs after it are committed again which does nothing
+        last_committed_idx = std::max<uint64_t>(last_committed_idx, previous_last_commit_id);
+    }
+    else if (!previous_last_commit_id)
     {
         LOG_INFO(log, "No previous last commit idx found, skip replaying logs.");
     }
@@ -98,8 +197,13 @@ NuRaftStateMachine::NuRaftStateMachine(
     else
     {
         LOG_INFO(log, "Replaying logs from {} to {}", last_committed_idx + 1, previous_last_commit_id);
-        replayLogs(log_store_, last_committed_idx + 1, previous_last_commit_id);
+        /// Loaded from the snapshot index, which is not the last committed one if applying the snapshot failed
+        if (log_loader && log_loader->from == last_committed_idx + 1)
+            replayLogs(*log_loader);
+        else
+            replayLogs(log_store_, last_committed_idx + 1, previous_last_commit_id);
     }
+    log_loader.reset();
 
     /// If the node is empty and join cluster, the log index is less than the last index of the snapshot, so compact is required.
     if (log_store_ && log_store_->next_slot() <= last_committed_idx)
@@ -151,6 +255,7 @@ ptr<RequestForSession> NuRaftStateMachine::createRequestSession(ptr<log_entry> &
     request_for_session->request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
     request_for_session->request->xid = xid;
     request_for_session->request->readImpl(buffer);
+    request_for_session->request->getPathHash();
 
     if (buffer.eof())
         request_for_session->create_time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
@@ -163,6 +268,7 @@ ptr<RequestForSession> NuRaftStateMachine::createRequestSession(ptr<log_entry> &
 void NuRaftStateMachine::snapThread()
 {
     setThreadName("snapThread");
+    ThreadPlacement::instance().apply(ThreadClass::SNAPSHOT);
     while (!shutdown_called)
     {
         if (snap_task_ready)
@@ -176,11 +282,17 @@ void NuRaftStateMachine::snapThread()
                 current_task->s->get_last_log_term(),
                 current_task->s->get_last_log_idx());
 
-            create_snapshot_async(*current_task);
             ptr<std::exception> except(nullptr);
             bool ret = true;
+            if (raft_settings->fork_snapshot)
+                ret = wait_forked_snapshot();
+            else
+                create_snapshot_async(*current_task);
+            Metrics::getMetrics().snapshot_progress.finish();
 
             current_task->when_done(ret, except);
+            current_task.reset();
+            snap_task_memory.store(0, std::memory_order_relaxed);
 
             Metrics::getMetrics().snap_count->add(1);
             Metrics::getMetrics().snap_time_ms->add(Poco::Timestamp().epochMicroseconds() / 1000 - snap_start_time);
@@ -216,6 +328,7 @@ RequestForSession NuRaftStateMachine::parseRequest(nuraft::buffer & data)
     request_for_session.request = Coordination::ZooKeeperRequestFactory::instance().get(opnum);
     request_for_session.request->xid = xid;
     request_for_session.request->readImpl(buffer);
+    request_for_session.request->getPathHash();
 
     if (!buffer.eof())
         Coordination::read(request_for_session.create_time, buffer);
@@ -237,7 +350,8 @@ RequestForSession NuRaftStateMachine::parseRequest(nuraft::buffer & data)
 
 ptr<buffer> NuRaftStateMachine::serializeRequest(RequestForSession & session_request)
 {
-    WriteBufferFromNuraftBuffer out;
+    WriteBufferFromNuraftBuffer out(
+        sizeof(session_request.session_id) + session_request.request->bytesSize() + sizeof(session_request.create_time));
     /// TODO unify digital encoding mode, see parseRequest
     writeIntBinary(session_request.session_id, out);
     session_request.request->write(out);
@@ -245,21 +359,107 @@ ptr<buffer> NuRaftStateMachine::serializeRequest(RequestForSession & session_req
     return out.getBuffer();
 }
 
+void NuRaftStateMachine::beginLocalAppend(const std::vector<ptr<buffer>> & entries, std::vector<RequestForSession> && requests)
+{
+    assert(entries.size() == requests.size());
+    std::lock_guard lock(local_requests_mutex);
+    for (size_t i = 0; i < entries.size(); ++i)
+        appending_requests.emplace(entries[i].get(), LocalRequest{std::move(requests[i]), entries[i]->size()});
+}
+
+void NuRaftStateMachine::endLocalAppend(const std::vector<ptr<buffer>> & entries)
+{
+    std::lock_guard lock(local_requests_mutex);
+    for (const auto & entry : entries)
+        appending_requests.erase(entry.get());
+}
+
+RequestForSession NuRaftStateMachine::takeRequest(ulong log_idx, nuraft::buffer & data)
+{
+    {
+        std::lock_guard lock(local_requests_mutex);
+        if (!local_requests.empty())
+        {
+            auto it = local_requests.find(log_idx);
+            std::optional<LocalRequest> local_request;
+            if (it != local_requests.end() && it->second.size == data.size())
+                local_request = std::move(it->second);
+            /// Logs are committed in order, the earlier ones are stale
+            local_requests.erase(local_requests.begin(), local_requests.upper_bound(log_idx));
+            if (local_request)
+                return std::move(local_request->request);
+        }
+    }
+    return parseRequest(data);
+}
+
 ptr<buffer> NuRaftStateMachine::pre_commit(const ulong log_idx, buffer & data)
 {
     LOG_TRACE(log, "pre commit, log index {}, data size {}", log_idx, data.size());
+    std::lock_guard lock(local_requests_mutex);
+    uncommitted_logs.emplace_back(log_idx, data.size());
+    uncommitted_log_bytes += data.size();
+    if (auto it = appending_requests.find(&data); it != appending_requests.end())
+    {
+        local_requests[log_idx] = std::move(it->second);
+        appending_requests.erase(it);
+    }
     return nullptr;
 }
 
-/// Do nothing, as doesn't do anything on pre-commit.
+/// Pre-commit only keeps the parsed request of a local log, which is obsolete now.
 void NuRaftStateMachine::rollback(const ulong log_idx, buffer & data)
 {
-    LOG_TRACE(log, "pre commit, log index {}, data size {}", log_idx, data.size());
+    LOG_TRACE(log, "rollback, log index {}, data size {}", log_idx, data.size());
+    std::lock_guard lock(local_requests_mutex);
+    local_requests.erase(log_idx);
+    /// Rolled back from the last log
+    while (!uncommitted_logs.empty() && uncommitted_logs.back().first >= log_idx)
+    {
+        uncommitted_log_bytes -= uncommitted_logs.back().second;
+        uncommitted_logs.pop_back();
+    }
+}
+
+void NuRaftStateMachine::releaseUncommittedLogs(ulong log_idx)
+{
+    std::lock_guard lock(local_requests_mutex);
+    while (!uncommitted_logs.empty() && uncommitted_logs.front().first <= log_idx)
+    {
+        uncommitted_log_bytes -= uncommitted_logs.front().second;
+        uncommitted_logs.pop_front();
+    }
+}
+
+nuraft::int64 NuRaftStateMachine::get_next_batch_size_hint_in_bytes()
+{
+    auto max_bytes = static_cast<Int64>(raft_settings->max_append_bytes);
+    auto window = static_cast<Int64>(raft_settings->replication_window_bytes);
+    if (window == 0)
+        return max_bytes;
+
+    Int64 window_left;
+    {
+        std::lock_guard lock(local_requests_mutex);
+        window_left = window - static_cast<Int64>(uncommitted_log_bytes);
+    }
+    if (window_left <= 0)
+        return -1;
+    return max_bytes == 0 ? window_left : std::min(max_bytes, window_left);
 }
 
 nuraft::ptr<nuraft::buffer> NuRaftStateMachine::commit(const ulong log_idx, nuraft::buffer & data, bool ignore_response)
 {
     LOG_TRACE(log, "Begin commit log index {}", log_idx);
+    releaseUncommittedLogs(log_idx);
+
+    /// Witness is never leader, no one waits for the result
+    if (witness)
+    {
+        last_committed_idx = log_idx;
+        committed_log_manager->push(last_committed_idx);
+        return nullptr;
+    }
 
     if (isNewSessionRequest(data)) /// TODO remove in future
     {
@@ -322,13 +522,14 @@ nuraft::ptr<nuraft::buffer> NuRaftStateMachine::commit(const ulong log_idx, nura
     }
     else
     {
-        auto request_for_session = parseRequest(data);
+        auto request_for_session = takeRequest(log_idx, data);
+        request_for_session.log_idx = log_idx;
         ResponsesForSessions responses_for_sessions;
 
         LOG_TRACE(log, "Commit log index {}, request {}", log_idx, request_for_session.toSimpleString());
 
         if (request_processor)
-            request_processor->commit(request_for_session);
+            request_processor->commit(std::move(request_for_session));
         else
             store.processRequest(responses_queue, request_for_session, {}, true, ignore_response);
 
@@ -389,19 +590,19 @@ uint64_t NuRaftStateMachine::getSessionWithEphemeralNodesCount() const
     return store.getSessionWithEphemeralNodesCount();
 }
 
-void NuRaftStateMachine::dumpWatches(WriteBufferFromOwnString & buf) const
+void NuRaftStateMachine::dumpWatches(const DumpOutput & output) const
 {
-    store.dumpWatches(buf);
+    store.dumpWatches(output);
 }
 
-void NuRaftStateMachine::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
+void NuRaftStateMachine::dumpWatchesByPath(const DumpOutput & output) const
 {
-    store.dumpWatchesByPath(buf);
+    store.dumpWatchesByPath(output);
 }
 
-void NuRaftStateMachine::dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) const
+void NuRaftStateMachine::dumpSessionsAndEphemerals(const DumpOutput & output) const
 {
-    store.dumpSessionsAndEphemerals(buf);
+    store.dumpSessionsAndEphemerals(output);
 }
 
 uint64_t NuRaftStateMachine::getApproximateDataSize() const
@@ -409,11 +610,58 @@ uint64_t NuRaftStateMachine::getApproximateDataSize() const
     return store.getApproximateDataSize();
 }
 
+void NuRaftStateMachine::getMemoryUsage(KeeperMemoryUsage & usage) const
+{
+    store.getMemoryUsage(usage);
+    usage.snapshot = snap_task_memory.load(std::memory_order_relaxed);
+}
+
 bool NuRaftStateMachine::containsSession(int64_t session_id) const
 {
     return store.containsSession(session_id);
 }
 
+void NuRaftStateMachine::createShutdownSnapshot(ulong last_committed_term)
+{
+    if (witness)
+        return;
+
+    ulong log_idx = last_committed_idx;
+    auto last = snap_mgr->lastSnapshot();
+    if (log_idx == 0 || (last && last->get_last_log_idx() >= log_idx))
+    {
+        LOG_INFO(log, "Nothing is committed since the last snapshot {}, skip creating snapshot on shutdown", log_idx);
+        return;
+    }
+
+    /// Logs committed but not applied are not in store
+    if (request_processor && request_processor->commitQueueSize() != 0)
+    {
+        LOG_WARNING(
+            log, "{} committed logs are not applied, skip creating snapshot on shutdown", request_processor->commitQueueSize());
+        return;
+    }
+
+    if (last_committed_term == 0)
+    {
+        LOG_WARNING(log, "Term of the last committed log {} is unknown, skip creating snapshot on shutdown", log_idx);
+        return;
+    }
+
+    LOG_INFO(log, "Creating snapshot on shutdown, last_log_term {}, last_log_idx {}", last_committed_term, log_idx);
+    try
+    {
+        Stopwatch watch;
+        snapshot s(log_idx, last_committed_term, cs_new<cluster_config>(log_idx, log_idx - 1));
+        create_snapshot(s, store.getZxid(), store.getSessionIDCounter());
+        LOG_INFO(log, "Created snapshot on shutdown, time cost {} ms", watch.elapsedMilliseconds());
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, "Fail to create snapshot on shutdown");
+    }
+}
+
 void NuRaftStateMachine::shutdown()
 {
     if (shutdown_called)
@@ -425,17 +673,41 @@ void NuRaftStateMachine::shutdown()
     store.finalize();
     committed_log_manager->shutDown();
     snap_thread.join();
+
+    /// The snapshot being created in a forked process is not waited for by the snapshot thread
+    if (snap_task_ready && raft_settings->fork_snapshot)
+    {
+        kill(forked_snapshot.pid, SIGKILL);
+        wait_forked_snapshot();
+    }
     LOG_INFO(log, "State machine shut down done!");
 }
 
 bool NuRaftStateMachine::chk_create_snapshot()
 {
+    /// Costs nothing
+    if (witness)
+        return true;
+
     Poco::Timestamp now;
-    return !in_snapshot && now > last_snapshot_time + snapshot_creating_interval;
+    if (in_snapshot || now <= last_snapshot_time + snapshot_creating_interval)
+        return false;
+
+    UInt64 commit_lag = request_processor ? request_processor->commitQueueSize() : 0;
+    return snapshot_scheduler.shouldCreate(now.epochMicroseconds() / 1000, last_committed_idx, commit_lag);
 }
 
 void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handler_type & when_done)
 {
+    if (witness)
+    {
+        saveWitnessSnapshot(s);
+        ptr<std::exception> except(nullptr);
+        bool ret = true;
+        when_done(ret, except);
+        return;
+    }
+
     size_t wait_times = 0;
     while (request_processor && request_processor->commitQueueSize() != 0)
     {
@@ -449,12 +721,48 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
 
     in_snapshot = true;
     snap_start_time = Poco::Timestamp().epochMicroseconds() / 1000;
+    snapshot_scheduler.setLastSnapshotIndex(s.get_last_log_idx());
 
     LOG_INFO(log, "Creating snapshot last_log_term {}, last_log_idx {}", s.get_last_log_term(), s.get_last_log_idx());
+    auto & progress = Metrics::getMetrics().snapshot_progress;
 
-    if (!raft_settings->async_snapshot)
+    if (raft_settings->fork_snapshot)
+    {
+        ptr<buffer> snp_buf = s.serialize();
+        auto snap_copy = snapshot::deserialize(*snp_buf);
+        progress.begin(SnapshotProgress::CREATE_DUMP);
+        auto task = std::make_shared<SnapTask>(snap_copy, store, when_done);
+        try
+        {
+            Stopwatch watch;
+            {
+                std::lock_guard<std::mutex> lock(snapshot_mutex);
+                forked_snapshot = snap_mgr->forkSnapshot(*task, snapshot_version);
+            }
+            /// Objects are written by the forked process, only the duration is known
+            progress.begin(SnapshotProgress::CREATE_SERIALIZE);
+            Metrics::getMetrics().snap_blocking_time_ms->add(watch.elapsedMilliseconds());
+            LOG_INFO(log, "Forking process to create snapshot costs {}ms", watch.elapsedMilliseconds());
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Fail to fork process to create snapshot");
+            progress.finish();
+            in_snapshot = false;
+            ptr<std::exception> except(nullptr);
+            bool ret = false;
+            when_done(ret, except);
+            return;
+        }
+        snap_task = task;
+        snap_task_memory.store(task->getApproximateMemoryUsage(), std::memory_order_relaxed);
+        snap_task_ready = true;
+    }
+    else if (!raft_settings->async_snapshot)
     {
+        progress.begin(SnapshotProgress::CREATE_SERIALIZE);
         create_snapshot(s, store.getZxid(), store.getSessionIDCounter());
+        progress.finish();
         ptr<std::exception> except(nullptr);
         bool ret = true;
         when_done(ret, except);
@@ -472,7 +780,11 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
         /// Need make a copy of s
         ptr<buffer> snp_buf = s.serialize();
         auto snap_copy = snapshot::deserialize(*snp_buf);
+        progress.begin(SnapshotProgress::CREATE_DUMP);
         snap_task = std::make_shared<SnapTask>(snap_copy, store, when_done);
+        snap_task_memory.store(snap_task->getApproximateMemoryUsage(), std::memory_order_relaxed);
+        /// Including waiting for the snapshot thread
+        progress.begin(SnapshotProgress::CREATE_SERIALIZE);
         snap_task_ready = true;
 
         LOG_INFO(log, "Scheduling asynchronous creating snapshot task, time cost {} ms", Poco::Timestamp().epochMicroseconds() / 1000 - snap_start_time);
@@ -482,17 +794,30 @@ void NuRaftStateMachine::create_snapshot(snapshot & s, async_result<bool>::handl
 void NuRaftStateMachine::create_snapshot(snapshot & s, int64_t next_zxid, int64_t next_session_id)
 {
     std::lock_guard<std::mutex> lock(snapshot_mutex);
-    snap_mgr->createSnapshot(s, store, next_zxid, next_session_id);
+    snap_mgr->createSnapshot(s, store, next_zxid, next_session_id, snapshot_version);
     snap_mgr->removeSnapshots();
 }
 
 void NuRaftStateMachine::create_snapshot_async(SnapTask & s)
 {
     std::lock_guard<std::mutex> lock(snapshot_mutex);
-    snap_mgr->createSnapshotAsync(s);
+    snap_mgr->createSnapshotAsync(s, snapshot_version);
     snap_mgr->removeSnapshots();
 }
 
+bool NuRaftStateMachine::wait_forked_snapshot()
+{
+    /// Not under the lock, for it takes as long as creating the snapshot
+    size_t object_count = snap_mgr->waitForkedSnapshot(forked_snapshot);
+
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    bool created = snap_mgr->finishForkedSnapshot(forked_snapshot, object_count);
+    forked_snapshot = {};
+    if (created)
+        snap_mgr->removeSnapshots();
+    return created;
+}
+
 void NuRaftStateMachine::save_snapshot_data(snapshot &, const ulong, buffer &)
 {
     throw Exception(ErrorCodes::NOT_IMPLEMENTED, "method is deprecated");
@@ -504,6 +829,25 @@ int NuRaftStateMachine::read_snapshot_data(snapshot &, const ulong, buffer &)
 }
 
 int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj)
+{
+    /// Witness is never leader
+    if (witness)
+    {
+        LOG_WARNING(log, "Witness has no data of snapshot {}, object id {}", s.get_last_log_idx(), obj_id);
+        data_out = nullptr;
+        is_last_obj = true;
+        return 0;
+    }
+
+    int res = readSnapshotObject(s, user_snp_ctx, obj_id, data_out, is_last_obj);
+
+    /// Wait out of snapshot_mutex, which creating snapshots takes
+    if (snapshot_transfer_throttler && data_out)
+        snapshot_transfer_throttler->add(data_out->size());
+    return res;
+}
+
+int NuRaftStateMachine::readSnapshotObject(snapshot & s, void *& user_snp_ctx, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj)
 {
     std::lock_guard<std::mutex> lock(snapshot_mutex);
     if (!snap_mgr->existSnapshot(s))
@@ -516,15 +860,43 @@ int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx,
 
     if (obj_id == 0)
     {
-        // Object ID == 0: first object
-        data_out = buffer::alloc(sizeof(UInt32));
+        // Object ID == 0: first object, it tells whether objects are sent in chunks and the snapshot chain
+        auto members = snap_mgr->getSnapshotChainMembers(s);
+        data_out = buffer::alloc(sizeof(UInt32) * 2 + members.size() * SnapshotChainMember::SIZE);
         buffer_serializer bs(data_out);
-        bs.put_i32(0);
+        bs.put_i32(raft_settings->snapshot_transfer_chunk_size ? SNAPSHOT_TRANSFER_CHUNKED : SNAPSHOT_TRANSFER_WHOLE);
+        bs.put_u32(static_cast<UInt32>(members.size()));
+        for (const auto & member : members)
+        {
+            bs.put_u64(member.log_last_term);
+            bs.put_u64(member.log_last_index);
+            bs.put_u64(member.object_count);
+        }
         is_last_obj = false;
         LOG_INFO(log, "Read snapshot object, last_log_idx {}, object id {}, is_last {}", s.get_last_log_idx(), obj_id, false);
         return 0;
     }
 
+    if (isChunkedObjectId(obj_id))
+    {
+        auto [object_id, chunk_index] = parseChunkedObjectId(obj_id);
+        /// The follower may ask for chunks after the setting is changed to 0
+        UInt64 chunk_size = raft_settings->snapshot_transfer_chunk_size ? raft_settings->snapshot_transfer_chunk_size
+                                                                         : DEFAULT_SNAPSHOT_CHUNK_SIZE;
+        bool last_chunk = snap_mgr->loadSnapshotObjectChunk(s, object_id, chunk_index * chunk_size, chunk_size, data_out);
+        is_last_obj = last_chunk && !snap_mgr->existSnapshotObject(s, object_id + 1);
+
+        LOG_DEBUG(
+            log,
+            "Read snapshot object, last_log_idx {}, object id {}, chunk {}, is_last {}",
+            s.get_last_log_idx(),
+            object_id,
+            chunk_index,
+            is_last_obj);
+        user_snp_ctx = nullptr;
+        return 0;
+    }
+
     // Object ID > 0: second object, put actual value.
     snap_mgr->loadSnapshotObject(s, obj_id, data_out);
     is_last_obj = !(snap_mgr->existSnapshotObject(s, obj_id + 1));
@@ -537,10 +909,74 @@ int NuRaftStateMachine::read_logical_snp_obj(snapshot & s, void *& user_snp_ctx,
 
 void NuRaftStateMachine::save_logical_snp_obj(snapshot & s, ulong & obj_id, buffer & data, bool is_first_obj, bool is_last_obj)
 {
+    if (witness)
+    {
+        /// Objects are dropped, but asked for in the order of a replica so that the leader goes on sending
+        data.pos(0);
+        buffer_serializer bs(data);
+        if (obj_id == 0)
+        {
+            bool chunked = data.size() >= sizeof(Int32) && bs.get_i32() == SNAPSHOT_TRANSFER_CHUNKED;
+            obj_id = chunked ? getChunkedObjectId(1, 0) : 1;
+        }
+        else if (isChunkedObjectId(obj_id))
+        {
+            /// Chunk header is offset followed by whether it is the last chunk of the object
+            bool last_chunk = false;
+            if (data.size() > sizeof(UInt64))
+            {
+                bs.pos(sizeof(UInt64));
+                last_chunk = bs.get_u8() != 0;
+            }
+            obj_id = last_chunk ? getChunkedObjectId(parseChunkedObjectId(obj_id).first + 1, 0) : obj_id + 1;
+        }
+        else
+        {
+            obj_id++;
+        }
+        LOG_DEBUG(log, "Witness drops snapshot {} object, is_last_obj {}", s.get_last_log_idx(), is_last_obj);
+        return;
+    }
+
     if (obj_id == 0)
     {
         // Object ID == 0: it contains dummy value, create snapshot context.
         snap_mgr->receiveSnapshotMeta(s);
+
+        /// Leaders of older versions send 0, or no chain
+        data.pos(0);
+        buffer_serializer bs(data);
+        Int32 transfer_mode = data.size() >= sizeof(Int32) ? bs.get_i32() : SNAPSHOT_TRANSFER_WHOLE;
+        if (data.size() >= sizeof(Int32) * 2)
+        {
+            std::vector<SnapshotChainMember> members(bs.get_u32());
+            for (auto & member : members)
+            {
+                member.log_last_term = bs.get_u64();
+                member.log_last_index = bs.get_u64();
+                member.object_count = bs.get_u64();
+            }
+            if (members.size() > 1)
+                LOG_INFO(log, "Save logical snapshot, it is incremental and sent with {} snapshots it is based on", members.size() - 1);
+            std::lock_guard<std::mutex> lock(snapshot_mutex);
+            snap_mgr->receiveSnapshotChain(s, members);
+        }
+
+        if (transfer_mode == SNAPSHOT_TRANSFER_CHUNKED)
+        {
+            LOG_INFO(log, "Save logical snapshot, objects are sent in chunks");
+            obj_id = getChunkedObjectId(1, 0);
+            return;
+        }
+    }
+    else if (isChunkedObjectId(obj_id))
+    {
+        std::lock_guard<std::mutex> lock(snapshot_mutex);
+        auto [object_id, chunk_index] = parseChunkedObjectId(obj_id);
+        bool last_chunk = snap_mgr->saveSnapshotObjectChunk(s, object_id, data);
+        LOG_DEBUG(log, "Save logical snapshot, object id {}, chunk {}, is_last_obj {}", object_id, chunk_index, is_last_obj);
+        obj_id = last_chunk ? getChunkedObjectId(object_id + 1, 0) : obj_id + 1;
+        return;
     }
     else
     {
@@ -559,10 +995,25 @@ bool NuRaftStateMachine::existSnapshotObject(snapshot & s, ulong obj_id)
 
 bool NuRaftStateMachine::apply_snapshot(snapshot & s)
 {
+    if (witness)
+    {
+        saveWitnessSnapshot(s);
+        last_committed_idx = s.get_last_log_idx();
+        LOG_INFO(log, "Witness applied snapshot, now the last log index is {}", last_committed_idx);
+        return true;
+    }
+
     /// The invoker is from NuRaft, we should reset the state machine
     LOG_INFO(log, "Reset state machine.");
     reset();
 
+    {
+        std::lock_guard lock(local_requests_mutex);
+        local_requests.erase(local_requests.begin(), local_requests.upper_bound(s.get_last_log_idx()));
+    }
+    /// Logs of the snapshot are never committed
+    releaseUncommittedLogs(s.get_last_log_idx());
+
     return applySnapshotImpl(s);
 }
 
@@ -573,18 +1024,21 @@ bool NuRaftStateMachine::applySnapshotImpl(snapshot & s)
     bool succeed = snap_mgr->parseSnapshot(s, store);
     if (succeed)
     {
+        /// Nodes of snapshot are put into data tree without maintaining the digest
+        store.recomputeDigest();
         last_committed_idx = s.get_last_log_idx();
+        snapshot_scheduler.setLastSnapshotIndex(s.get_last_log_idx());
         LOG_INFO(log, "Applied snapshot, now the last log index is {}", last_committed_idx);
     }
     return succeed;
 }
 
-void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, uint64_t to)
+std::unique_ptr<LogReplayLoader> NuRaftStateMachine::startLoadingLogs(ptr<log_store> log_store_, uint64_t from, uint64_t to)
 {
     if (!log_store_)
     {
         LOG_WARNING(log, "There is no log_store, skip to replay logs.");
-        return;
+        return nullptr;
     }
 
     ulong first_index_in_store = log_store_->start_index();
@@ -593,7 +1047,7 @@ void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, ui
     if (last_index_in_store == 0)
     {
         LOG_WARNING(log, "Log store is empty, skip to replay logs.");
-        return;
+        return nullptr;
     }
 
     if (from > last_index_in_store)
@@ -613,87 +1067,96 @@ void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, ui
         last_index_in_store = to;
     }
 
-    /// [ batch_start_index, batch_end_index )
-    std::atomic<ulong> batch_start_index = from;
-    std::atomic<ulong> batch_end_index = 0;
+    auto loader = std::make_unique<LogReplayLoader>(from);
 
-    ThreadSafeQueue<ReplayLogBatch> log_queue;
+    /// Entries of a batch are deserialized in parallel, applying is in order
+    const size_t deserialize_thread_num = std::max(getNumberOfPhysicalCPUCores(), 1U);
 
     /// Loading and applying asynchronously
-    auto load_thread = ThreadFromGlobalPool(
-        [this, last_index_in_store, &log_queue, &batch_start_index, &batch_end_index, &log_store_]
+    loader->thread = ThreadFromGlobalPool(
+        [this, from, last_index_in_store, deserialize_thread_num, &replay_loader = *loader, log_store_]
         {
             Poco::Logger * thread_log = &(Poco::Logger::get("LoadLogThread"));
-            while (batch_start_index < last_index_in_store)
+            SCOPE_EXIT({ replay_loader.queue.finish(); });
+
+            auto deserialize_entry = [this, thread_log](VersionLogEntry & entry) -> ptr<RequestForSession>
             {
-                while (log_queue.size() > 10)
+                if (entry.entry->get_val_type() != nuraft::log_val_type::app_log)
                 {
-                    LOG_DEBUG(thread_log, "Sleep 100ms to wait for applying log");
-                    usleep(100000);
+                    LOG_DEBUG(thread_log, "Found non app log(type {}), ignore it", entry.entry->get_val_type());
+                    return nullptr;
                 }
+                /// Session requests are applied from the log entries
+                if (isNewSessionRequest(entry.entry->get_buf()) || isUpdateSessionRequest(entry.entry->get_buf()))
+                    return nullptr;
+                /// user requests
+                return createRequestSession(entry.entry);
+            };
+
+            try
+            {
+                ThreadPool deserialize_pool(deserialize_thread_num);
 
-                /// 0.3 * 10000 = 3M
-                batch_end_index = batch_start_index + 10000;
-                if (batch_end_index > last_index_in_store + 1)
-                    batch_end_index = last_index_in_store + 1;
+                /// [ batch_start_index, batch_end_index )
+                ulong batch_start_index = from;
+                while (batch_start_index <= last_index_in_store)
+                {
+                    /// 0.3 * 10000 = 3M
+                    ulong batch_end_index = std::min(batch_start_index + 10000, last_index_in_store + 1);
 
-                LOG_INFO(thread_log, "Begin to load batch [{} , {})", batch_start_index, batch_end_index);
+                    LOG_INFO(thread_log, "Begin to load batch [{} , {})", batch_start_index, batch_end_index);
 
-                ReplayLogBatch batch;
-                batch.log_vec
-                    = dynamic_cast<NuRaftFileLogStore *>(log_store_.get())->log_entries_version_ext(batch_start_index, batch_end_index, 0);
+                    ReplayLogBatch batch;
+                    batch.log_vec = dynamic_cast<NuRaftFileLogStore *>(log_store_.get())
+                                        ->log_entries_version_ext(batch_start_index, batch_end_index, 0);
 
-                batch.batch_start_index = batch_start_index;
-                batch.batch_end_index = batch_end_index;
-                batch.request_vec = cs_new<std::vector<ptr<RequestForSession>>>();
+                    batch.batch_start_index = batch_start_index;
+                    batch.batch_end_index = batch_end_index;
 
-                for (auto entry : *(batch.log_vec))
-                {
-                    if (entry.entry->get_val_type() != nuraft::log_val_type::app_log)
-                    {
-                        LOG_DEBUG(thread_log, "Found non app log(type {}), ignore it", entry.entry->get_val_type());
-                        batch.request_vec->push_back(nullptr);
-                    }
-                    else if (isNewSessionRequest(entry.entry->get_buf()))
-                    {
-                        batch.request_vec->push_back(nullptr);
-                    }
-                    else if (isUpdateSessionRequest(entry.entry->get_buf()))
-                    {
-                        batch.request_vec->push_back(nullptr);
-                    }
-                    else
+                    auto & log_vec = *batch.log_vec;
+                    batch.request_vec = cs_new<std::vector<ptr<RequestForSession>>>(log_vec.size());
+                    auto & request_vec = *batch.request_vec;
+
+                    size_t range_size = (log_vec.size() + deserialize_thread_num - 1) / deserialize_thread_num;
+                    for (size_t range_begin = 0; range_begin < log_vec.size(); range_begin += range_size)
                     {
-                        /// user requests
-                        ptr<RequestForSession> ptr_request = createRequestSession(entry.entry);
-                        batch.request_vec->push_back(ptr_request);
+                        size_t range_end = std::min(range_begin + range_size, log_vec.size());
+                        deserialize_pool.scheduleOrThrowOnError(
+                            [&log_vec, &request_vec, &deserialize_entry, range_begin, range_end]
+                            {
+                                for (size_t i = range_begin; i < range_end; ++i)
+                                    request_vec[i] = deserialize_entry(log_vec[i]);
+                            });
                     }
-                }
+                    deserialize_pool.wait();
 
-                LOG_INFO(thread_log, "Finish to load batch [{}, {})", batch_start_index, batch_end_index);
-                log_queue.push(batch);
-                batch_start_index.store(batch_end_index);
+                    LOG_INFO(thread_log, "Finish to load batch [{}, {})", batch_start_index, batch_end_index);
+                    if (!replay_loader.queue.push(std::move(batch)))
+                        return;
+                    batch_start_index = batch_end_index;
+                }
+            }
+            catch (...)
+            {
+                replay_loader.exception = std::current_exception();
             }
         });
 
-    /// Apply loaded logs
-    while (!log_queue.empty() || batch_start_index < last_index_in_store)
-    {
-        while (log_queue.empty() && batch_start_index != last_index_in_store)
-        {
-            LOG_DEBUG(log, "Sleep 100ms to wait for log loading");
-            usleep(100000);
-        }
-
-        ReplayLogBatch batch;
-        log_queue.peek(batch);
+    return loader;
+}
 
-        if (batch.log_vec == nullptr)
-        {
-            LOG_DEBUG(log, "log vector is null");
-            break;
-        }
+void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, uint64_t to)
+{
+    if (auto loader = startLoadingLogs(log_store_, from, to))
+        replayLogs(*loader);
+}
 
+void NuRaftStateMachine::replayLogs(LogReplayLoader & loader)
+{
+    /// Apply loaded logs, loading is stopped by the destructor of loader if applying fails
+    ReplayLogBatch batch;
+    while (log_queue.pop(batch))
+    {
         for (size_t i = 0; i < batch.log_vec->size(); ++i)
         {
             ulong log_index = batch.batch_start_index + i;
@@ -738,13 +1201,14 @@ void NuRaftStateMachine::replayLogs(ptr<log_store> log_store_, uint64_t from, ui
             }
         }
 
-        log_queue.pop();
         last_committed_idx = batch.batch_end_index - 1;
 
         LOG_INFO(log, "Replayed log batch [{}, {})", batch.batch_start_index, batch.batch_end_index);
     }
 
-    load_thread.join();
+    loader.thread.join();
+    if (loader.exception)
+        std::rethrow_exception(loader.exception);
 
     LOG_INFO(
         log,
@@ -771,9 +1235,66 @@ ptr<snapshot> NuRaftStateMachine::last_snapshot()
     /// Just return the latest snapshot.
     std::lock_guard<std::mutex> lock(snapshot_mutex);
     LOG_INFO(log, "last_snapshot invoke");
+    if (witness)
+        return witness_snapshot;
     return snap_mgr->lastSnapshot();
 }
 
+std::pair<UInt64, UInt64> NuRaftStateMachine::getLastSnapshotIndexAndBytes()
+{
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    auto last = witness ? nullptr : snap_mgr->lastSnapshot();
+    if (!last)
+        return {0, 0};
+    try
+    {
+        return {last->get_last_log_idx(), snap_mgr->getSnapshotBytes(*last)};
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, "Can not get bytes of the latest snapshot");
+        return {last->get_last_log_idx(), 0};
+    }
+}
+
+void NuRaftStateMachine::loadWitnessSnapshot()
+{
+    if (!Poco::File(witnessSnapshotFile()).exists())
+        return;
+
+    ReadBufferFromFile in(witnessSnapshotFile());
+    String data;
+    readStringUntilEOF(data, in);
+
+    auto buf = buffer::alloc(data.size());
+    buf->put_raw(reinterpret_cast<const byte *>(data.data()), data.size());
+    buf->pos(0);
+
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    witness_snapshot = snapshot::deserialize(*buf);
+    last_committed_idx = witness_snapshot->get_last_log_idx();
+    LOG_INFO(log, "Loaded witness snapshot, last log index {}", last_committed_idx);
+}
+
+void NuRaftStateMachine::saveWitnessSnapshot(snapshot & s)
+{
+    ptr<buffer> buf = s.serialize();
+    String tmp_file = witnessSnapshotFile() + ".tmp";
+
+    std::lock_guard<std::mutex> lock(snapshot_mutex);
+    Poco::File(snapshot_dir).createDirectories();
+    {
+        WriteBufferFromFile out(tmp_file, DEFAULT_BUFFER_SIZE, O_WRONLY | O_TRUNC | O_CREAT);
+        out.write(reinterpret_cast<const char *>(buf->data_begin()), buf->size());
+        out.next();
+        out.sync();
+    }
+    Poco::File(tmp_file).renameTo(witnessSnapshotFile());
+
+    witness_snapshot = snapshot::deserialize(*buf);
+    LOG_INFO(log, "Created witness snapshot, last_log_term {}, last_log_idx {}", s.get_last_log_term(), s.get_last_log_idx());
+}
+
 bool NuRaftStateMachine::exists(const String & path)
 {
     return (store.getNode(path) != nullptr);
@@ -2,6 +2,8 @@
 
 #include <atomic>
 #include <cassert>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <string.h>
 #include <time.h>
@@ -13,8 +15,9 @@
 #include <Service/KeeperStore.h>
 #include <Service/LastCommittedIndexManager.h>
 #include <Service/NuRaftLogSnapshot.h>
+#include <Service/ResponsesQueue.h>
 #include <Service/Settings.h>
-#include <Service/ThreadSafeQueue.h>
+#include <Service/SnapshotScheduler.h>
 
 
 namespace RK
@@ -23,9 +26,10 @@ using nuraft::async_result;
 using nuraft::buffer;
 using nuraft::cs_new;
 
-using KeeperResponsesQueue = ThreadSafeQueue<ResponseForSession>;
+using KeeperResponsesQueue = ResponsesQueue;
 
 class RequestProcessor;
+struct LogReplayLoader;
 
 class NuRaftStateMachine : public nuraft::state_machine
 {
@@ -42,16 +46,26 @@ public:
         ptr<nuraft::log_store> log_store_ = nullptr,
         String super_digest = "",
         UInt32 object_node_size = MAX_OBJECT_NODE_SIZE,
-        std::shared_ptr<RequestProcessor> request_processor_ = nullptr);
+        std::shared_ptr<RequestProcessor> request_processor_ = nullptr,
+        bool witness_ = false);
 
     ~NuRaftStateMachine() override = default;
 
-    /// do nothing
+    /// Keep the parsed request of a local log and count bytes of the log not committed
     ptr<buffer> pre_commit(const ulong log_idx, buffer & data) override; // NOLINT(readability-avoid-const-params-in-decls)
 
-    /// do nothing
+    /// Forget what pre_commit keeps of the log
     void rollback(const ulong log_idx, buffer & data) override; // NOLINT(readability-avoid-const-params-in-decls)
 
+    /**
+     * Bytes of log entries this node asks the leader to send by the next append_entries, it is sent back to the
+     * leader by every append_entries response and the leader passes it to log_entries_ext. It is max_append_bytes,
+     * or less when bytes of logs appended but not committed are close to replication_window_bytes. When they
+     * reach it, it is negative and the leader sends only heartbeats to this node until it commits them.
+     * 0 means no limit.
+     */
+    nuraft::int64 get_next_batch_size_hint_in_bytes() override;
+
     /**
      * Commit the given Raft log.
      *
@@ -99,6 +113,9 @@ public:
     /// async create snapshot
     void create_snapshot_async(SnapTask &);
 
+    /// Wait for the snapshot being created in a forked process, return whether it is created.
+    bool wait_forked_snapshot();
+
     /**
      * (Deprecated)
      * Read the given snapshot chunk.
@@ -196,6 +213,12 @@ public:
      */
     void replayLogs(ptr<nuraft::log_store> log_store_, uint64_t from, uint64_t to);
 
+    /// Start loading and deserializing logs in [from, to] in background, nullptr if there is nothing to load.
+    /// Logs are loaded while the snapshot is being parsed, so that they are replayed as soon as it is.
+    std::unique_ptr<LogReplayLoader> startLoadingLogs(ptr<nuraft::log_store> log_store_, uint64_t from, uint64_t to);
+    /// Apply the logs loaded by loader
+    void replayLogs(LogReplayLoader & loader);
+
     /**
      * Free user-defined instance that is allocated by
      * `read_logical_snp_obj`.
@@ -216,6 +239,9 @@ public:
      */
     ptr<snapshot> last_snapshot() override;
 
+    /// Log index and bytes of the latest snapshot which are sent to a follower installing it, 0 bytes if there is none
+    std::pair<UInt64, UInt64> getLastSnapshotIndexAndBytes();
+
     ulong last_commit_index() override { return last_committed_idx; }
 
     /// get persisted last committed index
@@ -231,6 +257,7 @@ public:
     KeeperNode & getNode(const String & path);
 
     KeeperStore & getStore() { return store; }
+    const KeeperStore & getStore() const { return store; }
 
     /// process read request
     [[maybe_unused]] void processReadRequest(const RequestForSession & request_for_session);
@@ -253,10 +280,10 @@ public:
     /// how many sessions register watch
     uint64_t getSessionsWithWatchesCount() const;
 
-    /// dump watches
-    void dumpWatches(WriteBufferFromOwnString & buf) const;
-    void dumpWatchesByPath(WriteBufferFromOwnString & buf) const;
-    void dumpSessionsAndEphemerals(WriteBufferFromOwnString & buf) const;
+    /// dump watches, output is passed in chunks, see DumpOutput
+    void dumpWatches(const DumpOutput & output) const;
+    void dumpWatchesByPath(const DumpOutput & output) const;
+    void dumpSessionsAndEphemerals(const DumpOutput & output) const;
 
     uint64_t getSessionWithEphemeralNodesCount() const;
     uint64_t getTotalEphemeralNodesCount() const;
@@ -265,6 +292,9 @@ public:
     /// TODO need a more accurate value
     uint64_t getApproximateDataSize() const;
 
+    /// Fill data_tree, watches, sessions, acl_map and snapshot of usage
+    void getMemoryUsage(KeeperMemoryUsage & usage) const;
+
     /// Whether contains a session, note that leader contains all sessions in cluster.
     /// and follower only contains local session.
     bool containsSession(int64_t session_id) const;
@@ -275,6 +305,16 @@ public:
         return in_snapshot;
     }
 
+    /// Witness votes and persists logs, but applies nothing, see witness
+    bool isWitness() const { return witness; }
+
+    /// Position of this node in cluster members sorted by server id, snapshots are staggered by it.
+    void setSnapshotMember(size_t member_index, size_t member_count) { snapshot_scheduler.setMember(member_index, member_count); }
+
+    /// Create a full snapshot of the last committed log, whose term is last_committed_term, when shutting down
+    /// gracefully. Then the next startup replays no log. Invoked after consensus and request processor are stopped.
+    void createShutdownSnapshot(ulong last_committed_term);
+
     void shutdown();
 
     /// deserialize a RequestForSession
@@ -282,6 +322,12 @@ public:
     /// serialize a RequestForSession
     static ptr<buffer> serializeRequest(RequestForSession & request);
 
+    /// Requests of log entries being appended by this node as leader, so that they are committed without deserializing.
+    /// Entries are matched with requests by buffer in pre_commit, which NuRaft invokes in append_entries on leader.
+    void beginLocalAppend(const std::vector<ptr<buffer>> & entries, std::vector<RequestForSession> && requests);
+    /// Forget requests of entries not appended, invoked after append_entries returned.
+    void endLocalAppend(const std::vector<ptr<buffer>> & entries);
+
 private:
     /// Clear the whole state machine.
     /// Used when apply_snapshot.
@@ -289,16 +335,27 @@ private:
 
     ptr<RequestForSession> createRequestSession(ptr<log_entry> & entry);
 
+    /// Parsed request of locally appended log log_idx, or parse data if there is none
+    RequestForSession takeRequest(ulong log_idx, nuraft::buffer & data);
+
     /// Asynchronously snapshot creating thread.
     /// Now it is not used.
     void snapThread();
 
+    /// read_logical_snp_obj without limiting the speed
+    int readSnapshotObject(snapshot & s, void *& user_snp_ctx, ulong obj_id, ptr<buffer> & data_out, bool & is_last_obj);
+
     /// Only contains session_id
     static bool isNewSessionRequest(nuraft::buffer & data);
 
     /// Contains session_id and timeout
     static bool isUpdateSessionRequest(nuraft::buffer & data);
 
+    /// Snapshot of a witness is its meta only, kept in file witness_snapshot of snapshot dir
+    String witnessSnapshotFile() const { return snapshot_dir + "/witness_snapshot"; }
+    void loadWitnessSnapshot();
+    void saveWitnessSnapshot(snapshot & s);
+
     Poco::Logger * log;
     /// raft related settings
     RaftSettingsPtr raft_settings;
@@ -322,9 +379,18 @@ private:
 
     ptr<KeeperSnapshotManager> snap_mgr;
 
+    /// Limit of sending snapshot objects to followers, nullptr means unlimited
+    ThrottlerPtr snapshot_transfer_throttler;
+
+    /// Version of created snapshots, V3 is compressed, V5 is compressed and columnar
+    SnapshotVersion snapshot_version;
+
     /// The minimal interval to create snapshot
     uint64_t snapshot_creating_interval;
 
+    /// Defers due snapshots by load and staggers them across cluster members
+    SnapshotScheduler snapshot_scheduler;
+
     std::atomic<int64_t> last_snapshot_time;
 
     /// When get a not exist node, return blank.
@@ -338,10 +404,39 @@ private:
     ThreadFromGlobalPool snap_thread;
 
     std::shared_ptr<SnapTask> snap_task;
+    /// Memory of the snapshot task in progress, for 4lw commands which cannot read snap_task
+    std::atomic<UInt64> snap_task_memory{0};
+    /// The process creating snapshot of snap_task if fork_snapshot is enabled
+    KeeperSnapshotManager::ForkedSnapshot forked_snapshot;
     std::atomic<bool> shutdown_called{false};
 
     std::mutex & new_session_id_callback_mutex;
     std::unordered_map<int64_t, ptr<std::condition_variable>> & new_session_id_callback;
+
+    /// A witness only tracks indices. It commits logs without applying them to store, and its snapshots have no data,
+    /// they just let NuRaft compact logs. Snapshots sent by leader are dropped.
+    const bool witness;
+    ptr<snapshot> witness_snapshot;
+
+    struct LocalRequest
+    {
+        RequestForSession request;
+        /// Size of the log entry, against matching a wrong entry
+        size_t size;
+    };
+
+    std::mutex local_requests_mutex;
+    /// Requests by log entry buffers in append_entries, see beginLocalAppend
+    std::unordered_map<const buffer *, LocalRequest> appending_requests;
+    /// Requests by log index from pre-commit to commit, dropped on rollback. Followers and log replay have none.
+    std::map<ulong, LocalRequest> local_requests;
+
+    /// Index and bytes of logs from pre-commit to commit, for get_next_batch_size_hint_in_bytes. Logs replayed are
+    /// not pre-committed, so they are not counted.
+    std::deque<std::pair<ulong, size_t>> uncommitted_logs;
+    size_t uncommitted_log_bytes = 0;
+    /// Forget uncommitted_logs up to log_idx
+    void releaseUncommittedLogs(ulong log_idx);
 };
 
 }
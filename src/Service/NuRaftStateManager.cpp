@@ -1,4 +1,5 @@
 #include <filesystem>
+#include <Service/InMemoryLogStorage.h>
 #include <Service/NuRaftStateManager.h>
 #include <libnuraft/nuraft.hxx>
 #include <Poco/File.h>
@@ -12,12 +13,41 @@ namespace RK
 {
 using namespace nuraft;
 
+namespace ErrorCodes
+{
+    extern const int INVALID_CONFIG_PARAMETER;
+}
+
 NuRaftStateManager::NuRaftStateManager(int32_t id_, const Poco::Util::AbstractConfiguration & config_, SettingsPtr settings_)
     : settings(settings_), my_id(id_), my_host(settings_->host), my_internal_port(settings_->internal_port), log_dir(settings_->log_dir)
 {
     log = &(Poco::Logger::get("NuRaftStateManager"));
-    curr_log_store
-        = cs_new<NuRaftFileLogStore>(log_dir, false, settings->raft_settings->log_fsync_mode, settings->raft_settings->log_fsync_interval);
+
+    ptr<ILogStorage> log_storage;
+    if (settings->raft_settings->log_storage == "memory")
+    {
+        LOG_WARNING(log, "Raft log is kept only in memory, it is lost when the process exits");
+        log_storage = cs_new<InMemoryLogStorage>();
+    }
+
+    curr_log_store = cs_new<NuRaftFileLogStore>(
+        log_dir,
+        false,
+        settings->raft_settings->log_fsync_mode,
+        settings->raft_settings->log_fsync_interval,
+        LogSegmentStore::MAX_SEGMENT_FILE_SIZE,
+        LogSegmentStore::MAX_SEGMENT_COUNT,
+        settings->raft_settings->log_io_uring,
+        settings->raft_settings->log_preallocate,
+        settings->raft_settings->log_direct_io,
+        settings->raft_settings->log_cache_max_entries,
+        settings->raft_settings->log_cache_max_bytes,
+        settings->raft_settings->log_compression,
+        settings->log_cold_dir,
+        settings->raft_settings->reserved_log_items,
+        settings->raft_settings->log_fsync_bytes,
+        settings->raft_settings->log_fsync_interval_us,
+        log_storage);
 
     srv_state_file = fs::path(log_dir) / "srv_state";
     cluster_config_file = fs::path(log_dir) / "cluster_config";
@@ -131,6 +161,30 @@ ptr<cluster_config> NuRaftStateManager::parseClusterConfig(
             String endpoint = host + ":" + internal_port;
             bool learner = config.getBool(config_name + "." + key + ".learner", false);
             int priority = config.getInt(config_name + "." + key + ".priority", 1);
+            /// Witness votes but has no data to lead with
+            if (config.getBool(config_name + "." + key + ".witness", false))
+            {
+                if (learner)
+                    throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Server {} can not be both learner and witness", id);
+                if (priority != 0)
+                    LOG_INFO(log, "Server {} is witness, its priority {} is ignored", id, priority);
+                priority = 0;
+                witness_servers.emplace(id);
+            }
+            forwarding_endpoints[id] = host + ":" + config.getString(config_name + "." + key + ".forwarding_port", "8102");
+            /// Cascaded observer gets logs from its upstream rather than the leader, so it is a member of only my cluster
+            /// config if it is me, in which my NuRaft server idles as a learner.
+            if (config.has(config_name + "." + key + ".replicate_from"))
+            {
+                int upstream_id = config.getInt(config_name + "." + key + ".replicate_from");
+                if (!learner)
+                    throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Server {} replicating from {} must be learner", id, upstream_id);
+                if (upstream_id == id)
+                    throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Server {} can not replicate from itself", id);
+                upstream_servers[id] = upstream_id;
+                if (id != my_id)
+                    continue;
+            }
             ret_cluster_config->get_servers().push_back(cs_new<srv_config>(id, 0, endpoint, "", learner, priority));
             bool start_as_follower = config.getBool(config_name + "." + key + ".start_as_follower", false);
             if (start_as_follower)
@@ -138,6 +192,24 @@ ptr<cluster_config> NuRaftStateManager::parseClusterConfig(
         }
     }
 
+    for (auto [id, upstream_id] : upstream_servers)
+    {
+        if (!forwarding_endpoints.contains(upstream_id))
+            throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Server {} replicates from {} which is not configured", id, upstream_id);
+        /// Witness has no data to serve
+        if (witness_servers.count(upstream_id))
+            throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Server {} can not replicate from witness {}", id, upstream_id);
+
+        /// The root of a tree of cascaded observers is a member of the cluster
+        int root = upstream_id;
+        for (size_t depth = 0; upstream_servers.contains(root); ++depth)
+        {
+            if (depth == upstream_servers.size())
+                throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Servers replicating from {} are in a cycle", id);
+            root = upstream_servers[root];
+        }
+    }
+
     /// If user does not configure cluster, put myself to NuRaft.
     if (ret_cluster_config->get_servers().empty())
     {
@@ -156,6 +228,18 @@ ptr<cluster_config> NuRaftStateManager::parseClusterConfig(
     return ret_cluster_config;
 }
 
+int32_t NuRaftStateManager::getUpstreamId() const
+{
+    auto it = upstream_servers.find(my_id);
+    return it == upstream_servers.end() ? -1 : it->second;
+}
+
+String NuRaftStateManager::getForwardingEndpoint(int32_t id) const
+{
+    auto it = forwarding_endpoints.find(id);
+    return it == forwarding_endpoints.end() ? "" : it->second;
+}
+
 ConfigUpdateActions NuRaftStateManager::getConfigurationDiff(const Poco::Util::AbstractConfiguration & config)
 {
     auto new_cluster_config = parseClusterConfig(config, "keeper.cluster");
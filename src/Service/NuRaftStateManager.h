@@ -65,6 +65,14 @@ public:
 
     bool shouldStartAsFollower() const { return start_as_follower_servers.count(my_id); }
 
+    /// Whether I am configured as witness, see NuRaftStateMachine::witness
+    bool isWitness() const { return witness_servers.count(my_id); }
+
+    /// Server I replicate logs from instead of the leader, -1 if I am not a cascaded observer, see LogRelay
+    int32_t getUpstreamId() const;
+    /// <host>:<forwarding_port> of a configured server, empty if there is no such server
+    String getForwardingEndpoint(int32_t id) const;
+
     //ptr<srv_config> get_srv_config() const { return curr_srv_config; }
 
     ptr<cluster_config> getClusterConfig() const;
@@ -86,6 +94,10 @@ private:
     int32_t my_internal_port;
 
     std::unordered_set<int> start_as_follower_servers;
+    std::unordered_set<int> witness_servers;
+    /// Cascaded observers and the servers they replicate from, they are not in the Raft cluster of others
+    std::unordered_map<int, int> upstream_servers;
+    std::unordered_map<int, String> forwarding_endpoints;
 
     String log_dir;
     ptr<log_store> curr_log_store;
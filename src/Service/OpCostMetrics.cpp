@@ -0,0 +1,184 @@
+#include <Service/OpCostMetrics.h>
+
+#include <ctime>
+
+#if USE_JEMALLOC
+#    include <jemalloc/jemalloc.h>
+#endif
+
+#include <Common/IO/WriteHelpers.h>
+#include <Poco/String.h>
+#include <fmt/format.h>
+
+namespace RK
+{
+
+OpCostMetrics::~OpCostMetrics()
+{
+    for (auto & op_counters : counters)
+        for (auto & thread_counters : op_counters)
+            delete thread_counters.load();
+}
+
+void OpCostMetrics::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    setEnabled(config.getBool("keeper.op_cost_accounting.enabled", false));
+}
+
+const char * OpCostMetrics::toString(ThreadKind thread_kind)
+{
+    switch (thread_kind)
+    {
+        case ThreadKind::PROCESSOR:
+            return "processor";
+        case ThreadKind::IO:
+            return "io";
+    }
+    return "unknown";
+}
+
+UInt64 OpCostMetrics::threadCpuNs()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<UInt64>(ts.tv_sec) * 1000000000 + static_cast<UInt64>(ts.tv_nsec);
+}
+
+UInt64 OpCostMetrics::threadAllocatedBytes()
+{
+#if USE_JEMALLOC
+    /// Counter of the thread kept by jemalloc, looked up once per thread
+    static thread_local UInt64 * allocated = []
+    {
+        UInt64 * ptr = nullptr;
+        size_t size = sizeof(ptr);
+        if (mallctl("thread.allocatedp", &ptr, &size, nullptr, 0) != 0)
+            return static_cast<UInt64 *>(nullptr);
+        return ptr;
+    }();
+    return allocated ? *allocated : 0;
+#else
+    return 0;
+#endif
+}
+
+void OpCostMetrics::record(Coordination::OpNum op_num, ThreadKind thread_kind, UInt64 cpu_ns, UInt64 allocated_bytes)
+{
+    auto index = RequestStageMetrics::indexOf(op_num);
+    if (!index)
+        return;
+
+    auto & slot = counters[*index][static_cast<size_t>(thread_kind)];
+    Counters * current = slot.load(std::memory_order_acquire);
+    if (!current)
+    {
+        auto * created = new Counters;
+        if (slot.compare_exchange_strong(current, created, std::memory_order_acq_rel))
+            current = created;
+        else
+            delete created;
+    }
+
+    current->count.add();
+    current->cpu_ns.add(cpu_ns);
+    current->allocated_bytes.add(allocated_bytes);
+}
+
+OpCostMetrics::Cost OpCostMetrics::getCost(Coordination::OpNum op_num, ThreadKind thread_kind) const
+{
+    auto index = RequestStageMetrics::indexOf(op_num);
+    if (!index)
+        return {};
+
+    const auto * current = counters[*index][static_cast<size_t>(thread_kind)].load(std::memory_order_acquire);
+    if (!current)
+        return {};
+    return {current->count.get(), current->cpu_ns.get(), current->allocated_bytes.get()};
+}
+
+void OpCostMetrics::writePrometheus(WriteBuffer & out, const String & prefix) const
+{
+    static constexpr std::array<std::pair<const char *, ShardedCounter Counters::*>, 3> METRICS{{
+        {"op_requests_total", &Counters::count},
+        {"op_cpu_ns_total", &Counters::cpu_ns},
+        {"op_allocated_bytes_total", &Counters::allocated_bytes},
+    }};
+
+    for (const auto & [name, member] : METRICS)
+    {
+        String metric = prefix + name;
+        writeString(fmt::format("# TYPE {} counter\n", metric), out);
+        for (size_t op = 0; op < RequestStageMetrics::OP_NUMS.size(); ++op)
+        {
+            for (size_t thread_kind = 0; thread_kind < THREAD_KINDS; ++thread_kind)
+            {
+                const auto * current = counters[op][thread_kind].load(std::memory_order_acquire);
+                if (!current)
+                    continue;
+                writeString(
+                    fmt::format(
+                        "{}{{op=\"{}\",thread=\"{}\"}} {}\n",
+                        metric,
+                        Coordination::toString(RequestStageMetrics::OP_NUMS[op]),
+                        toString(static_cast<ThreadKind>(thread_kind)),
+                        (current->*member).get()),
+                    out);
+            }
+        }
+    }
+}
+
+std::vector<std::pair<String, UInt64>> OpCostMetrics::getAverages() const
+{
+    std::vector<std::pair<String, UInt64>> averages;
+    for (size_t op = 0; op < RequestStageMetrics::OP_NUMS.size(); ++op)
+    {
+        for (size_t thread_kind = 0; thread_kind < THREAD_KINDS; ++thread_kind)
+        {
+            auto cost = getCost(RequestStageMetrics::OP_NUMS[op], static_cast<ThreadKind>(thread_kind));
+            if (!cost.count)
+                continue;
+            String op_name = Poco::toLower(Coordination::toString(RequestStageMetrics::OP_NUMS[op]));
+            String key = fmt::format("{}_{}", toString(static_cast<ThreadKind>(thread_kind)), op_name);
+            averages.emplace_back(key + "_cpu_ns_avg", cost.cpu_ns / cost.count);
+            averages.emplace_back(key + "_allocated_bytes_avg", cost.allocated_bytes / cost.count);
+        }
+    }
+    return averages;
+}
+
+void OpCostMetrics::reset()
+{
+    for (auto & op_counters : counters)
+    {
+        for (auto & thread_counters : op_counters)
+        {
+            if (auto * current = thread_counters.load(std::memory_order_acquire))
+            {
+                current->count.reset();
+                current->cpu_ns.reset();
+                current->allocated_bytes.reset();
+            }
+        }
+    }
+}
+
+OpCostMetrics::Scope::Scope(Coordination::OpNum op_num_, ThreadKind thread_kind_)
+    : op_num(op_num_), thread_kind(thread_kind_), enabled(OpCostMetrics::instance().isEnabled())
+{
+    if (!enabled)
+        return;
+    start_cpu_ns = threadCpuNs();
+    start_allocated_bytes = threadAllocatedBytes();
+}
+
+OpCostMetrics::Scope::~Scope()
+{
+    if (!enabled)
+        return;
+    UInt64 cpu_ns = threadCpuNs() - start_cpu_ns;
+    UInt64 allocated_bytes = threadAllocatedBytes() - start_allocated_bytes;
+    OpCostMetrics::instance().record(op_num, thread_kind, cpu_ns, allocated_bytes);
+}
+
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <Common/IO/WriteBuffer.h>
+#include <Common/ShardedCounter.h>
+#include <Service/RequestStageMetrics.h>
+
+namespace RK
+{
+
+/** CPU time and bytes allocated by requests of every operation, in processor threads which apply them to the store and
+  * in IO threads which parse requests and serialize responses, so that the request classes to optimize or limit are
+  * known, for example list costs 4us cpu and 1.2KB allocation on average.
+  *
+  * Cpu time is of the thread cpu clock, allocations are of the counter of the thread of jemalloc, without jemalloc
+  * they are 0. Reading the thread cpu clock is a syscall, so it is configured by keeper.op_cost_accounting.enabled and
+  * disabled by default. Counters of an operation are created when its first request is recorded.
+  */
+class OpCostMetrics
+{
+public:
+    enum class ThreadKind : UInt8
+    {
+        PROCESSOR,
+        IO,
+    };
+    static constexpr size_t THREAD_KINDS = 2;
+
+    static OpCostMetrics & instance()
+    {
+        static OpCostMetrics metrics;
+        return metrics;
+    }
+
+    ~OpCostMetrics();
+
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool value) { enabled.store(value, std::memory_order_relaxed); }
+
+    void record(Coordination::OpNum op_num, ThreadKind thread_kind, UInt64 cpu_ns, UInt64 allocated_bytes);
+
+    struct Cost
+    {
+        UInt64 count = 0;
+        UInt64 cpu_ns = 0;
+        UInt64 allocated_bytes = 0;
+    };
+
+    /// Totals of operation in threads of the kind, all 0 if none is recorded
+    Cost getCost(Coordination::OpNum op_num, ThreadKind thread_kind) const;
+
+    /// As counters with labels of op and thread
+    void writePrometheus(WriteBuffer & out, const String & prefix) const;
+
+    /// Averages per request like "processor_list_cpu_ns_avg 4000", of operations recorded
+    std::vector<std::pair<String, UInt64>> getAverages() const;
+
+    void reset();
+
+    /// Cost of the current thread from construction to destruction is recorded to op_num if accounting is enabled
+    class Scope
+    {
+    public:
+        Scope(Coordination::OpNum op_num_, ThreadKind thread_kind_);
+        ~Scope();
+
+        Scope(const Scope &) = delete;
+        Scope & operator=(const Scope &) = delete;
+
+    private:
+        Coordination::OpNum op_num;
+        ThreadKind thread_kind;
+        bool enabled;
+        UInt64 start_cpu_ns = 0;
+        UInt64 start_allocated_bytes = 0;
+    };
+
+    /// Cpu time of the current thread
+    static UInt64 threadCpuNs();
+    /// Bytes allocated by the current thread since it started, 0 without jemalloc
+    static UInt64 threadAllocatedBytes();
+
+private:
+    OpCostMetrics() = default;
+
+    struct Counters
+    {
+        ShardedCounter count;
+        ShardedCounter cpu_ns;
+        ShardedCounter allocated_bytes;
+    };
+
+    static const char * toString(ThreadKind thread_kind);
+
+    std::atomic<bool> enabled{false};
+    std::array<std::array<std::atomic<Counters *>, THREAD_KINDS>, RequestStageMetrics::OP_NUMS.size()> counters{};
+};
+
+}
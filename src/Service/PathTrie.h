@@ -0,0 +1,229 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/** Prefix compressed index of znode paths, every trie node is a path component.
+  *
+  * Unlike the data tree which stores the full path of every znode as the key and the name of every child again
+  * in its parent, a path component is stored only once here, so shared prefixes like
+  * "/clickhouse/tables/<uuid>/<shard>/replicas" cost nothing per znode. Children of a path are kept sorted
+  * in the trie node, so it supplies both node lookup and sorted children enumeration.
+  *
+  * Lookup is O(depth * log(children)) instead of O(1). It indexes persistent watches of WatchManager, where
+  * prefix enumeration is needed; it is not a backend of the data tree, which stays on KeeperNodeMap because
+  * snapshot loading, parallel apply and pinning for snapshot work per hash bucket.
+  * Not thread-safe.
+  */
+template <typename Value>
+class PathTrie
+{
+private:
+    struct TrieNode
+    {
+        String name;
+        std::optional<Value> value;
+        /// Sorted by name
+        std::vector<std::unique_ptr<TrieNode>> children;
+
+        explicit TrieNode(std::string_view name_) : name(name_) { }
+
+        typename std::vector<std::unique_ptr<TrieNode>>::iterator lowerBound(std::string_view child_name)
+        {
+            return std::lower_bound(
+                children.begin(), children.end(), child_name, [](const auto & child, std::string_view n) { return child->name < n; });
+        }
+
+        TrieNode * findChild(std::string_view child_name)
+        {
+            auto it = lowerBound(child_name);
+            return it != children.end() && (*it)->name == child_name ? it->get() : nullptr;
+        }
+
+        TrieNode * getOrCreateChild(std::string_view child_name)
+        {
+            auto it = lowerBound(child_name);
+            if (it != children.end() && (*it)->name == child_name)
+                return it->get();
+            return children.insert(it, std::make_unique<TrieNode>(child_name))->get();
+        }
+    };
+
+    /// Call fn for every component of path, "/" has no component.
+    template <typename Fn>
+    static bool forEachComponent(std::string_view path, Fn && fn)
+    {
+        size_t pos = 0;
+        while (pos < path.size())
+        {
+            if (path[pos] == '/')
+            {
+                ++pos;
+                continue;
+            }
+            size_t next = path.find('/', pos);
+            if (next == std::string_view::npos)
+                next = path.size();
+            if (!fn(path.substr(pos, next - pos)))
+                return false;
+            pos = next;
+        }
+        return true;
+    }
+
+    TrieNode * findNode(std::string_view path) const
+    {
+        TrieNode * node = root.get();
+        bool found = forEachComponent(path, [&](std::string_view component)
+        {
+            node = node->findChild(component);
+            return node != nullptr;
+        });
+        return found ? node : nullptr;
+    }
+
+    template <typename Fn>
+    static void forEachImpl(const TrieNode & node, String & path, Fn && fn)
+    {
+        if (node.value)
+            fn(path.empty() ? String("/") : path, *node.value);
+
+        for (const auto & child : node.children)
+        {
+            size_t old_size = path.size();
+            path += '/';
+            path += child->name;
+            forEachImpl(*child, path, fn);
+            path.resize(old_size);
+        }
+    }
+
+    static size_t memoryUsageImpl(const TrieNode & node)
+    {
+        size_t res = sizeof(TrieNode) + (node.name.capacity() > 15 ? node.name.capacity() : 0)
+            + node.children.capacity() * sizeof(std::unique_ptr<TrieNode>);
+        for (const auto & child : node.children)
+            res += memoryUsageImpl(*child);
+        return res;
+    }
+
+    std::unique_ptr<TrieNode> root = std::make_unique<TrieNode>("");
+    size_t num_values = 0;
+
+public:
+    Value * get(std::string_view path)
+    {
+        TrieNode * node = findNode(path);
+        return node && node->value ? &*node->value : nullptr;
+    }
+
+    const Value * get(std::string_view path) const { return const_cast<PathTrie *>(this)->get(path); }
+
+    bool contains(std::string_view path) const { return get(path) != nullptr; }
+
+    /// Insert or assign, intermediate components are created without value.
+    /// Return true if the path did not exist.
+    template <typename T>
+    bool emplace(std::string_view path, T && value)
+    {
+        TrieNode * node = root.get();
+        forEachComponent(path, [&](std::string_view component)
+        {
+            node = node->getOrCreateChild(component);
+            return true;
+        });
+
+        bool inserted = !node->value;
+        node->value = std::forward<T>(value);
+        num_values += inserted;
+        return inserted;
+    }
+
+    /// Remove the value of path, trie nodes that have neither value nor children are removed too.
+    bool erase(std::string_view path)
+    {
+        std::vector<TrieNode *> trace{root.get()};
+        bool found = forEachComponent(path, [&](std::string_view component)
+        {
+            TrieNode * child = trace.back()->findChild(component);
+            if (child)
+                trace.push_back(child);
+            return child != nullptr;
+        });
+
+        if (!found || !trace.back()->value)
+            return false;
+
+        trace.back()->value.reset();
+        --num_values;
+
+        for (size_t i = trace.size() - 1; i > 0; --i)
+        {
+            TrieNode * node = trace[i];
+            if (node->value || !node->children.empty())
+                break;
+            auto & siblings = trace[i - 1]->children;
+            siblings.erase(trace[i - 1]->lowerBound(node->name));
+        }
+        return true;
+    }
+
+    /// Invoke fn(child_name) for every child of path in sorted order, children without value are skipped.
+    template <typename Fn>
+    void forEachChild(std::string_view path, Fn && fn) const
+    {
+        const TrieNode * node = findNode(path);
+        if (!node)
+            return;
+        for (const auto & child : node->children)
+            if (child->value)
+                fn(std::string_view(child->name));
+    }
+
+    /// Invoke fn(value, is_path) for values of "/", ancestors of path and path itself from top to bottom,
+    /// is_path is true only for path itself. It costs O(depth) no matter how many values are in the trie.
+    template <typename Fn>
+    void forEachPrefix(std::string_view path, Fn && fn) const
+    {
+        TrieNode * node = root.get();
+        bool found = forEachComponent(path, [&](std::string_view component)
+        {
+            if (node->value)
+                fn(*node->value, false);
+            node = node->findChild(component);
+            return node != nullptr;
+        });
+        if (found && node->value)
+            fn(*node->value, true);
+    }
+
+    /// Invoke fn(path, value) for every path in pre-order.
+    template <typename Fn>
+    void forEach(Fn && fn) const
+    {
+        String path;
+        forEachImpl(*root, path, fn);
+    }
+
+    size_t size() const { return num_values; }
+
+    void clear()
+    {
+        root = std::make_unique<TrieNode>("");
+        num_values = 0;
+    }
+
+    /// Approximate memory used by the trie itself, not including memory owned by values.
+    size_t getApproximateMemoryUsage() const { return memoryUsageImpl(*root); }
+};
+
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+#include <Service/ForwardRequest.h>
+
+namespace RK
+{
+
+/// Forward requests sent by a connection and waiting for responses, in send order.
+///
+/// Many requests are outstanding on a connection, a response finds its request by key through a hash index
+/// rather than scanning them. The earliest request is at front, timed out requests are removed from front.
+class PendingForwardRequests
+{
+public:
+    using Func = std::function<bool(const ForwardRequestPtr &)>;
+
+    void push(ForwardRequestPtr request)
+    {
+        std::lock_guard lock(mutex);
+        auto key = request->key();
+        auto it = requests.emplace(requests.end(), Entry{next_seq++, std::move(request)});
+        index.emplace(key, it);
+    }
+
+    /// Remove and return the earliest request of key, nullptr if not found.
+    ForwardRequestPtr remove(const ForwardKey & key)
+    {
+        std::lock_guard lock(mutex);
+        auto [begin, end] = index.equal_range(key);
+        if (begin == end)
+            return nullptr;
+
+        auto earliest = begin;
+        for (auto it = std::next(begin); it != end; ++it)
+            if (it->second->seq < earliest->second->seq)
+                earliest = it;
+
+        ForwardRequestPtr request = std::move(earliest->second->request);
+        requests.erase(earliest->second);
+        index.erase(earliest);
+        return request;
+    }
+
+    bool peek(ForwardRequestPtr & request) const
+    {
+        std::lock_guard lock(mutex);
+        if (requests.empty())
+            return false;
+        request = requests.front().request;
+        return true;
+    }
+
+    /// Remove requests from front while func returns true, then peek the new front.
+    bool removeFrontIf(Func func, ForwardRequestPtr & new_front)
+    {
+        std::lock_guard lock(mutex);
+        while (!requests.empty() && func(requests.front().request))
+            eraseFront();
+
+        if (requests.empty())
+            return false;
+        new_front = requests.front().request;
+        return true;
+    }
+
+    /// Invoke func on requests in send order until it returns false.
+    void forEach(Func func) const
+    {
+        std::lock_guard lock(mutex);
+        for (const auto & entry : requests)
+            if (!func(entry.request))
+                break;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard lock(mutex);
+        return requests.size();
+    }
+
+private:
+    struct Entry
+    {
+        UInt64 seq;
+        ForwardRequestPtr request;
+    };
+
+    using Requests = std::list<Entry>;
+
+    void eraseFront()
+    {
+        auto [begin, end] = index.equal_range(requests.front().request->key());
+        for (auto it = begin; it != end; ++it)
+        {
+            if (it->second == requests.begin())
+            {
+                index.erase(it);
+                break;
+            }
+        }
+        requests.pop_front();
+    }
+
+    mutable std::mutex mutex;
+    Requests requests;
+    UInt64 next_seq = 0;
+    std::unordered_multimap<ForwardKey, Requests::iterator, ForwardKeyHash> index;
+};
+
+}
@@ -0,0 +1,250 @@
+#pragma once
+
+#include <limits>
+#include <optional>
+#include <vector>
+#include <Service/KeeperCommon.h>
+#include <Common/FlatHashMap.h>
+
+
+namespace RK
+{
+
+/** Pending requests of a request processor runner grouped by session, requests of a session are kept in FIFO.
+  *
+  * Sessions are in an open addressing FlatHashMap, requests are nodes of a pool which are linked into the
+  * FIFO of their session. Freed nodes are reused, so pushing and popping requests do not allocate once
+  * the pool has grown to the working set. Sessions without pending requests are removed.
+  *
+  * Not thread-safe, a runner is processed by one thread at a time.
+  */
+class PendingRequests
+{
+public:
+    bool empty() const { return request_count == 0; }
+    size_t size() const { return request_count; }
+    size_t sessionCount() const { return sessions.size(); }
+
+    void push(RequestForSession && request)
+    {
+        int64_t session_id = request.session_id;
+        NodeIndex index = allocate(std::move(request));
+
+        auto & queue = sessions[session_id];
+        if (queue.tail == NIL)
+            queue.head = index;
+        else
+            nodes[queue.tail].next = index;
+        queue.tail = index;
+        ++request_count;
+    }
+
+    bool contains(int64_t session_id) const { return sessions.contains(session_id); }
+
+    /// The first pending request of the session, nullptr if there is none.
+    const RequestForSession * front(int64_t session_id) const
+    {
+        auto it = sessions.find(session_id);
+        return it == sessions.end() ? nullptr : &nodes[it->second.head].request;
+    }
+
+    void popFront(int64_t session_id)
+    {
+        auto it = sessions.find(session_id);
+        if (it != sessions.end())
+            popFront(it);
+    }
+
+    /// Remove all pending requests of the session.
+    void erase(int64_t session_id)
+    {
+        auto it = sessions.find(session_id);
+        if (it == sessions.end())
+            return;
+
+        for (NodeIndex index = it->second.head; index != NIL;)
+        {
+            NodeIndex next = nodes[index].next;
+            deallocate(index);
+            --request_count;
+            index = next;
+        }
+        sessions.erase(it);
+    }
+
+    /// Remove and return the first pending request of the session which matches the predicate.
+    template <typename Predicate>
+    std::optional<RequestForSession> extract(int64_t session_id, Predicate && predicate)
+    {
+        auto it = sessions.find(session_id);
+        if (it == sessions.end())
+            return {};
+
+        auto & queue = it->second;
+        for (NodeIndex prev = NIL, index = queue.head; index != NIL; prev = index, index = nodes[index].next)
+        {
+            if (!predicate(nodes[index].request))
+                continue;
+
+            std::optional<RequestForSession> res(std::move(nodes[index].request));
+            NodeIndex next = nodes[index].next;
+            if (prev == NIL)
+                queue.head = next;
+            else
+                nodes[prev].next = next;
+            if (queue.tail == index)
+                queue.tail = prev;
+
+            deallocate(index);
+            --request_count;
+            if (queue.head == NIL)
+                sessions.erase(it);
+            return res;
+        }
+        return {};
+    }
+
+    /// For every session pop front requests while function returns true for them.
+    template <typename Function>
+    void popFrontWhile(Function && function)
+    {
+        for (auto it = sessions.begin(); it != sessions.end();)
+        {
+            /// The iterator is still valid after erasing, it is advanced before.
+            auto current = it++;
+            while (function(static_cast<const RequestForSession &>(nodes[current->second.head].request)))
+            {
+                if (!popFront(current))
+                    break;
+            }
+        }
+    }
+
+    /// Like popFrontWhile but sessions take turns and pop at most quantum requests a turn, so that a burst of one session
+    /// does not hold back the others. 0 quantum pops all of a session in one turn like popFrontWhile.
+    template <typename Function>
+    void popFrontFair(size_t quantum, Function && function)
+    {
+        if (quantum == 0)
+        {
+            popFrontWhile(function);
+            return;
+        }
+
+        /// Sessions which used up their quantum
+        auto & turns = fair_turns;
+        turns.clear();
+        for (auto it = sessions.begin(); it != sessions.end();)
+        {
+            auto current = it++;
+            if (popFrontQuantum(current, quantum, function))
+                turns.push_back(current->first);
+        }
+
+        while (!turns.empty())
+        {
+            size_t kept = 0;
+            for (auto session_id : turns)
+            {
+                auto it = sessions.find(session_id);
+                if (it != sessions.end() && popFrontQuantum(it, quantum, function))
+                    turns[kept++] = session_id;
+            }
+            turns.resize(kept);
+        }
+    }
+
+    /// Whether the front request of any session matches the predicate.
+    template <typename Predicate>
+    bool anyFront(Predicate && predicate) const
+    {
+        for (const auto & [_, queue] : sessions)
+            if (predicate(nodes[queue.head].request))
+                return true;
+        return false;
+    }
+
+private:
+    using NodeIndex = UInt32;
+    static constexpr NodeIndex NIL = std::numeric_limits<NodeIndex>::max();
+
+    struct Node
+    {
+        RequestForSession request;
+        /// Next request of the same session or next free node
+        NodeIndex next = NIL;
+    };
+
+    struct SessionQueue
+    {
+        NodeIndex head = NIL;
+        NodeIndex tail = NIL;
+    };
+
+    using Sessions = FlatHashMap<int64_t, SessionQueue>;
+
+    NodeIndex allocate(RequestForSession && request)
+    {
+        NodeIndex index;
+        if (free_head != NIL)
+        {
+            index = free_head;
+            free_head = nodes[index].next;
+        }
+        else
+        {
+            index = static_cast<NodeIndex>(nodes.size());
+            nodes.emplace_back();
+        }
+
+        nodes[index].request = std::move(request);
+        nodes[index].next = NIL;
+        return index;
+    }
+
+    void deallocate(NodeIndex index)
+    {
+        /// Release the request now rather than when the node is reused
+        nodes[index].request = RequestForSession();
+        nodes[index].next = free_head;
+        free_head = index;
+    }
+
+    /// Returns false if the session has no more requests and is erased.
+    bool popFront(Sessions::iterator it)
+    {
+        auto & queue = it->second;
+        NodeIndex index = queue.head;
+        queue.head = nodes[index].next;
+        deallocate(index);
+        --request_count;
+
+        if (queue.head == NIL)
+        {
+            sessions.erase(it);
+            return false;
+        }
+        return true;
+    }
+
+    /// Returns true if quantum requests are popped and there are more of the session.
+    template <typename Function>
+    bool popFrontQuantum(Sessions::iterator it, size_t quantum, Function && function)
+    {
+        for (size_t popped = 0; popped < quantum; ++popped)
+        {
+            if (!function(static_cast<const RequestForSession &>(nodes[it->second.head].request)) || !popFront(it))
+                return false;
+        }
+        return true;
+    }
+
+    Sessions sessions;
+    /// Reused by popFrontFair, so that it does not allocate
+    std::vector<int64_t> fair_turns;
+    std::vector<Node> nodes;
+    NodeIndex free_head = NIL;
+    size_t request_count = 0;
+};
+
+}
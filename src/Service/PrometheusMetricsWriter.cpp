@@ -0,0 +1,227 @@
+#include <Service/PrometheusMetricsWriter.h>
+
+#include <Poco/Net/HTTPServerRequest.h>
+#include <Poco/Net/HTTPServerResponse.h>
+
+#include <Common/CurrentMetrics.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <Common/IO/WriteHelpers.h>
+#include <Common/ProfileEvents.h>
+#include <Common/config_version.h>
+#include <Common/getCurrentProcessFDCount.h>
+#include <Common/getMaxFileDescriptorCount.h>
+#include <Service/HotSpotTracker.h>
+#include <Service/KeeperDispatcher.h>
+#include <Service/Metrics.h>
+#include <Service/OpCostMetrics.h>
+#include <Service/RequestStageMetrics.h>
+
+namespace RK
+{
+
+namespace
+{
+
+/// Escape HELP text, see Prometheus text exposition format
+String escapeHelp(const char * text)
+{
+    String res;
+    for (const char * pos = text; *pos; ++pos)
+    {
+        if (*pos == '\\')
+            res += "\\\\";
+        else if (*pos == '\n')
+            res += "\\n";
+        else
+            res += *pos;
+    }
+    return res;
+}
+
+/// Escape label value, see Prometheus text exposition format
+String escapeLabelValue(const String & value)
+{
+    String res;
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+            res += '\\';
+        if (c == '\n')
+            res += "\\n";
+        else
+            res += c;
+    }
+    return res;
+}
+
+void writeMetric(WriteBuffer & out, const String & name, const char * type, const char * help, Int64 value)
+{
+    if (help)
+        writeString(fmt::format("# HELP {} {}\n", name, escapeHelp(help)), out);
+    writeString(fmt::format("# TYPE {} {}\n{} {}\n", name, type, name, value), out);
+}
+
+void writeGauge(WriteBuffer & out, const String & key, Int64 value)
+{
+    writeMetric(out, PrometheusMetricsWriter::PREFIX + key, "gauge", nullptr, value);
+}
+
+void writeCounter(WriteBuffer & out, const String & key, Int64 value)
+{
+    writeMetric(out, PrometheusMetricsWriter::PREFIX + key, "counter", nullptr, value);
+}
+
+class PrometheusRequestHandler : public Poco::Net::HTTPRequestHandler
+{
+public:
+    explicit PrometheusRequestHandler(KeeperDispatcher & keeper_dispatcher_) : writer(keeper_dispatcher_) { }
+
+    void handleRequest(Poco::Net::HTTPServerRequest &, Poco::Net::HTTPServerResponse & response) override
+    {
+        try
+        {
+            WriteBufferFromOwnString buf;
+            writer.write(buf);
+            const auto & text = buf.str();
+
+            response.setContentType("text/plain; version=0.0.4; charset=UTF-8");
+            response.sendBuffer(text.data(), text.size());
+        }
+        catch (...)
+        {
+            tryLogCurrentException("PrometheusRequestHandler");
+            if (!response.sent())
+            {
+                response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_INTERNAL_SERVER_ERROR);
+                response.send();
+            }
+        }
+    }
+
+private:
+    PrometheusMetricsWriter writer;
+};
+
+class NotFoundRequestHandler : public Poco::Net::HTTPRequestHandler
+{
+public:
+    void handleRequest(Poco::Net::HTTPServerRequest &, Poco::Net::HTTPServerResponse & response) override
+    {
+        response.setStatusAndReason(Poco::Net::HTTPResponse::HTTP_NOT_FOUND);
+        response.send();
+    }
+};
+
+}
+
+void PrometheusMetricsWriter::write(WriteBuffer & out) const
+{
+    writeStatus(out);
+
+    Metrics::getMetrics().writePrometheus(out, PREFIX);
+    RequestStageMetrics::instance().writePrometheus(out, PREFIX);
+    OpCostMetrics::instance().writePrometheus(out, PREFIX);
+    writeHotSpots(out);
+
+    for (ProfileEvents::Event event = 0; event < ProfileEvents::end(); ++event)
+    {
+        auto value = ProfileEvents::global_counters[event].load(std::memory_order_relaxed);
+        writeMetric(
+            out,
+            PROFILE_EVENTS_PREFIX + String(ProfileEvents::getName(event)),
+            "counter",
+            ProfileEvents::getDocumentation(event),
+            static_cast<Int64>(value));
+    }
+
+    for (CurrentMetrics::Metric metric = 0; metric < CurrentMetrics::end(); ++metric)
+    {
+        auto value = CurrentMetrics::values[metric].load(std::memory_order_relaxed);
+        writeMetric(
+            out,
+            CURRENT_METRICS_PREFIX + String(CurrentMetrics::getName(metric)),
+            "gauge",
+            CurrentMetrics::getDocumentation(metric),
+            value);
+    }
+}
+
+void PrometheusMetricsWriter::writeStatus(WriteBuffer & out) const
+{
+    const auto & stats = keeper_dispatcher.getKeeperConnectionStats();
+    Keeper4LWInfo keeper_info = keeper_dispatcher.getKeeper4LWInfo();
+
+    /// Role is a label of info, so that it is shown with version in dashboards
+    String role = keeper_info.has_leader ? keeper_info.getRole() : "none";
+    writeString(fmt::format("# TYPE {0}info gauge\n{0}info{{version=\"{1}\",role=\"{2}\"}} 1\n", PREFIX, VERSION_FULL, role), out);
+
+    writeGauge(out, "has_leader", keeper_info.has_leader);
+    writeGauge(out, "is_leader", keeper_info.is_leader);
+
+    writeGauge(out, "avg_latency", static_cast<Int64>(stats.getAvgLatency()));
+    writeGauge(out, "max_latency", static_cast<Int64>(stats.getMaxLatency()));
+    writeGauge(out, "min_latency", static_cast<Int64>(stats.getMinLatency()));
+    writeCounter(out, "packets_received", static_cast<Int64>(stats.getPacketsReceived()));
+    writeCounter(out, "packets_sent", static_cast<Int64>(stats.getPacketsSent()));
+
+    writeGauge(out, "num_alive_connections", static_cast<Int64>(keeper_info.alive_connections_count));
+    writeGauge(out, "outstanding_requests", static_cast<Int64>(keeper_info.outstanding_requests_count));
+    writeGauge(out, "expired_sessions", static_cast<Int64>(keeper_info.expired_sessions_count));
+    writeGauge(out, "closing_sessions", static_cast<Int64>(keeper_info.closing_sessions_count));
+    writeGauge(out, "memory_limit_state", static_cast<Int64>(keeper_info.memory_limit_state));
+    writeCounter(out, "memory_rejected_requests", static_cast<Int64>(keeper_info.memory_rejected_requests));
+    writeGauge(out, "read_only_sessions", static_cast<Int64>(keeper_info.read_only_sessions_count));
+
+    const auto & state_machine = keeper_dispatcher.getStateMachine();
+    writeGauge(out, "znode_count", static_cast<Int64>(state_machine.getNodesCount()));
+    writeGauge(out, "watch_count", static_cast<Int64>(state_machine.getTotalWatchesCount()));
+    writeGauge(out, "ephemerals_count", static_cast<Int64>(state_machine.getTotalEphemeralNodesCount()));
+    writeGauge(out, "approximate_data_size", static_cast<Int64>(state_machine.getApproximateDataSize()));
+    writeGauge(out, "in_snapshot", state_machine.getSnapshoting());
+
+    auto memory_usage = keeper_dispatcher.getMemoryUsage();
+    for (const auto & [component, bytes] : memory_usage.items())
+        writeGauge(out, fmt::format("memory_{}_bytes", component), static_cast<Int64>(bytes));
+    writeGauge(out, "memory_total_bytes", static_cast<Int64>(memory_usage.total()));
+
+#if defined(__linux__) || defined(__APPLE__)
+    writeGauge(out, "open_file_descriptor_count", static_cast<Int64>(getCurrentProcessFDCount()));
+    writeGauge(out, "max_file_descriptor_count", static_cast<Int64>(getMaxFileDescriptorCount()));
+#endif
+
+    if (keeper_info.is_leader)
+    {
+        writeGauge(out, "followers", static_cast<Int64>(keeper_info.follower_count));
+        writeGauge(out, "synced_followers", static_cast<Int64>(keeper_info.synced_follower_count));
+    }
+}
+
+void PrometheusMetricsWriter::writeHotSpots(WriteBuffer & out) const
+{
+    auto & tracker = HotSpotTracker::instance();
+    if (!tracker.isEnabled())
+        return;
+
+    auto report = tracker.getReport(HOT_SPOTS_LIMIT);
+
+    String path_metric = String(PREFIX) + "hot_path_requests_per_second";
+    writeString(fmt::format("# TYPE {} gauge\n", path_metric), out);
+    for (const auto & [type, items] : {std::pair{"read", &report.reads}, std::pair{"write", &report.writes}})
+        for (const auto & item : *items)
+            writeString(
+                fmt::format("{}{{type=\"{}\",path=\"{}\"}} {:.1f}\n", path_metric, type, escapeLabelValue(item.key), item.rate), out);
+
+    String session_metric = String(PREFIX) + "hot_session_requests_per_second";
+    writeString(fmt::format("# TYPE {} gauge\n", session_metric), out);
+    for (const auto & item : report.sessions)
+        writeString(fmt::format("{}{{session=\"{}\"}} {:.1f}\n", session_metric, item.key, item.rate), out);
+}
+
+Poco::Net::HTTPRequestHandler * PrometheusRequestHandlerFactory::createRequestHandler(const Poco::Net::HTTPServerRequest & request)
+{
+    if (request.getURI() == endpoint && request.getMethod() == Poco::Net::HTTPRequest::HTTP_GET)
+        return new PrometheusRequestHandler(keeper_dispatcher);
+    return new NotFoundRequestHandler;
+}
+
+}
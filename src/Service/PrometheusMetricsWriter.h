@@ -0,0 +1,55 @@
+#pragma once
+
+#include <Poco/Net/HTTPRequestHandler.h>
+#include <Poco/Net/HTTPRequestHandlerFactory.h>
+
+#include <Common/IO/WriteBuffer.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+class KeeperDispatcher;
+
+/// Writes metrics in Prometheus text format: status of the node like mntr, ProfileEvents as counters, CurrentMetrics
+/// as gauges, summaries of Metrics, durations of request stages and hot spots. Summaries with percentiles are written as
+/// Prometheus histograms.
+class PrometheusMetricsWriter
+{
+public:
+    explicit PrometheusMetricsWriter(KeeperDispatcher & keeper_dispatcher_) : keeper_dispatcher(keeper_dispatcher_) { }
+
+    void write(WriteBuffer & out) const;
+
+    /// Of status and summaries
+    static constexpr auto PREFIX = "raftkeeper_";
+    static constexpr auto PROFILE_EVENTS_PREFIX = "raftkeeper_profile_events_";
+    static constexpr auto CURRENT_METRICS_PREFIX = "raftkeeper_current_metrics_";
+
+    /// Hottest paths and sessions exported, the labels of paths are many
+    static constexpr size_t HOT_SPOTS_LIMIT = 10;
+
+private:
+    void writeStatus(WriteBuffer & out) const;
+    void writeHotSpots(WriteBuffer & out) const;
+
+    KeeperDispatcher & keeper_dispatcher;
+};
+
+/// Serves metrics on keeper.prometheus.endpoint of keeper.prometheus.port, other paths get 404.
+class PrometheusRequestHandlerFactory : public Poco::Net::HTTPRequestHandlerFactory
+{
+public:
+    PrometheusRequestHandlerFactory(KeeperDispatcher & keeper_dispatcher_, const String & endpoint_)
+        : keeper_dispatcher(keeper_dispatcher_), endpoint(endpoint_)
+    {
+    }
+
+    Poco::Net::HTTPRequestHandler * createRequestHandler(const Poco::Net::HTTPServerRequest & request) override;
+
+private:
+    KeeperDispatcher & keeper_dispatcher;
+    String endpoint;
+};
+
+}
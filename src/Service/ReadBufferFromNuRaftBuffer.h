@@ -6,6 +6,7 @@
 namespace RK
 {
 
+/// A view of the buffer, which is neither copied nor owned, so it must outlive the read buffer.
 class ReadBufferFromNuRaftBuffer : public ReadBufferFromMemory
 {
 public:
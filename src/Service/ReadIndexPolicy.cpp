@@ -0,0 +1,38 @@
+#include <Service/ReadIndexPolicy.h>
+
+#include <limits>
+#include <Common/Exception.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int ILLEGAL_SETTING_VALUE;
+}
+
+Int32 ReadIndexPolicy::getLeaseMs(UInt64 election_timeout_lower_bound_ms, UInt64 heart_beat_interval_ms)
+{
+    UInt64 margin = heart_beat_interval_ms + election_timeout_lower_bound_ms * CLOCK_DRIFT_PERCENT / 100;
+    if (election_timeout_lower_bound_ms <= margin + heart_beat_interval_ms)
+        throw Exception(
+            ErrorCodes::ILLEGAL_SETTING_VALUE,
+            "election_timeout_lower_bound_ms {} leaves no lease for linearizable_read, it should be greater than {}",
+            election_timeout_lower_bound_ms,
+            margin + heart_beat_interval_ms);
+    return static_cast<Int32>(std::min<UInt64>(election_timeout_lower_bound_ms - margin, std::numeric_limits<Int32>::max()));
+}
+
+std::optional<UInt64>
+ReadIndexPolicy::getReadIndex(UInt64 term, UInt64 committed_index, const std::function<UInt64(UInt64)> & term_at)
+{
+    if (committed_term.load(std::memory_order_relaxed) != term)
+    {
+        if (committed_index == 0 || term_at(committed_index) != term)
+            return {};
+        committed_term.store(term, std::memory_order_relaxed);
+    }
+    return committed_index;
+}
+
+}
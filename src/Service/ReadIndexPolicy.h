@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/**
+ * Decides when the leader may answer linearizable reads with its committed log index, NuRaft has no read index
+ * round trip so the leader relies on a lease.
+ *
+ *  1. A new leader knows that entries of earlier terms it has are committed only after an entry of its own term is
+ *     committed, its committed index may be behind the one of the previous leader until then. The read index is
+ *     withheld until the entry at the committed index has the current term, which NuRaft commits soon after
+ *     election as it appends a configuration entry.
+ *  2. The leader steps down if a quorum has not answered within the lease. It notices that only at a heartbeat and
+ *     clocks of nodes drift, so the lease is shorter than election_timeout_lower_bound_ms by a heartbeat interval
+ *     and by CLOCK_DRIFT_PERCENT of the election timeout. Followers can not elect a new leader before it stepped down.
+ */
+class ReadIndexPolicy
+{
+public:
+    static constexpr UInt64 CLOCK_DRIFT_PERCENT = 10;
+
+    /// Milliseconds of leadership_expiry, throws ILLEGAL_SETTING_VALUE if the election timeout leaves no lease longer
+    /// than a heartbeat interval.
+    static Int32 getLeaseMs(UInt64 election_timeout_lower_bound_ms, UInt64 heart_beat_interval_ms);
+
+    /// committed_index as read index if an entry of term is committed, term_at gives the term of a log entry, 0 if it
+    /// does not exist. It is looked up until a read index of the term is given.
+    std::optional<UInt64> getReadIndex(UInt64 term, UInt64 committed_index, const std::function<UInt64(UInt64)> & term_at);
+
+private:
+    /// Term of which an entry is known committed
+    std::atomic<UInt64> committed_term{0};
+};
+
+}
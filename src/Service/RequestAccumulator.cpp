@@ -3,61 +3,197 @@
 #include <Service/KeeperDispatcher.h>
 #include <Service/RequestAccumulator.h>
 #include <Service/Metrics.h>
+#include <Service/RequestTracer.h>
+#include <Service/ThreadPlacement.h>
+
+#include <thread>
 
 namespace RK
 {
 
-void RequestAccumulator::push(const RequestForSession & request_for_session)
+void RequestAccumulator::push(RequestForSession request_for_session)
 {
-    requests_queue->push(request_for_session);
+    requests_queue->push(std::move(request_for_session));
 }
 
 
 void RequestAccumulator::run()
 {
     setThreadName("ReqAccumulator");
-
-    NuRaftResult result;
+    ThreadPlacement::instance().apply(ThreadClass::ACCUMULATOR);
 
     RequestsForSessions to_append_batch;
     UInt64 max_wait = std::min(static_cast<uint64_t>(1000), operation_timeout_ms);
 
+    /// When the first request of current batch is popped
+    Stopwatch batch_watch;
+
     while (!shutdown_called)
     {
         RequestForSession request_for_session;
 
+        /// Results of in-flight batches are polled, so don't block long while there are some
+        handleCompletedBatches(false);
+
         bool pop_success;
         if (to_append_batch.empty())
         {
-            pop_success = requests_queue->tryPop(request_for_session, max_wait);
+            pop_success = requests_queue->tryPop(request_for_session, inflight_batches.empty() ? max_wait : 1);
+            batch_watch.restart();
         }
         else
         {
-            if (!requests_queue->tryPop(request_for_session))
+            pop_success = requests_queue->tryPop(request_for_session);
+
+            /// Queue is drained, wait a little to let the batch grow
+            if (!pop_success && batch_policy)
+            {
+                UInt64 elapsed_ms = batch_watch.elapsedMilliseconds();
+                if (batch_policy->getLingerMs() > elapsed_ms)
+                    pop_success = requests_queue->tryPop(request_for_session, batch_policy->getLingerMs() - elapsed_ms);
+            }
+
+            if (!pop_success)
             {
-                Metrics::getMetrics().log_replication_batch_size->add(to_append_batch.size());
-                result = server->pushRequestBatch(to_append_batch);
-                waitResultAndHandleError(result, to_append_batch);
-                result.reset();
-                to_append_batch.clear();
+                appendBatch(to_append_batch, false);
                 continue;
             }
-            pop_success = true;
         }
 
         if (pop_success)
         {
-            to_append_batch.emplace_back(request_for_session);
+            if (joinSyncRound(request_for_session))
+                continue;
 
-            if (to_append_batch.size() >= max_batch_size)
-            {
-                Metrics::getMetrics().log_replication_batch_size->add(to_append_batch.size());
-                result = server->pushRequestBatch(to_append_batch);
-                waitResultAndHandleError(result, to_append_batch);
-                result.reset();
-                to_append_batch.clear();
-            }
+            to_append_batch.push_back(std::move(request_for_session));
+
+            if (to_append_batch.size() >= getMaxBatchSize())
+                appendBatch(to_append_batch, true);
+        }
+    }
+
+    /// Results which are not ready will be cancelled when Raft shuts down
+    handleCompletedBatches(false);
+    if (!inflight_batches.empty())
+        LOG_WARNING(log, "Shutting down with {} batches in flight", inflight_batches.size());
+
+    auto cancel = [this](const RequestsForSessions & sync_waiters)
+    {
+        for (const auto & request_session : sync_waiters)
+            request_processor->onError(
+                false,
+                nuraft::cmd_result_code::CANCELLED,
+                request_session.session_id,
+                request_session.request->xid,
+                request_session.request->getOpNum());
+    };
+    for (const auto & inflight_batch : inflight_batches)
+        cancel(inflight_batch.sync_waiters);
+    cancel(batch_sync_waiters);
+}
+
+bool RequestAccumulator::joinSyncRound(RequestForSession & request_for_session)
+{
+    if (request_for_session.isForwardRequest() || request_for_session.request->getOpNum() != Coordination::OpNum::Sync)
+        return false;
+
+    RequestsForSessions * waiters = nullptr;
+    if (batch_has_sync)
+        waiters = &batch_sync_waiters;
+    else
+        for (auto it = inflight_batches.rbegin(); it != inflight_batches.rend() && !waiters; ++it)
+            if (it->has_sync)
+                waiters = &it->sync_waiters;
+
+    if (!waiters)
+    {
+        batch_has_sync = true;
+        return false;
+    }
+
+    /// Before any later request of the session is appended, so that the processor does not wait for its log
+    request_processor->onSyncJoined(request_for_session.session_id, request_for_session.request->xid);
+    LOG_TRACE(log, "{} joined the sync round in flight", request_for_session.toSimpleString());
+    waiters->push_back(std::move(request_for_session));
+    return true;
+}
+
+void RequestAccumulator::finishSyncRound(const InflightBatch & batch, bool committed)
+{
+    if (batch.sync_waiters.empty())
+        return;
+
+    /// Not less than log of the barrier, which is committed
+    std::optional<UInt64> read_index;
+    if (committed)
+        read_index = server->getReadIndex();
+
+    LOG_DEBUG(log, "Finish sync round of {} joined requests, read index {}", batch.sync_waiters.size(), read_index.value_or(0));
+    for (const auto & request_session : batch.sync_waiters)
+    {
+        if (read_index)
+            request_processor->onReadIndex(request_session.session_id, request_session.request->xid, *read_index);
+        else
+            request_processor->onError(
+                batch.result->get_accepted(),
+                committed ? nuraft::cmd_result_code::NOT_LEADER : batch.result->get_result_code(),
+                request_session.session_id,
+                request_session.request->xid,
+                request_session.request->getOpNum());
+    }
+}
+
+void RequestAccumulator::appendBatch(RequestsForSessions & batch, bool full)
+{
+    /// Raft commit does not wait for the processor, so hold new logs back while it is behind, up to operation timeout.
+    if (request_processor->isCommitQueueFull())
+    {
+        using namespace std::chrono_literals;
+        Stopwatch watch;
+        while (!shutdown_called && request_processor->isCommitQueueFull() && watch.elapsedMilliseconds() < operation_timeout_ms)
+        {
+            handleCompletedBatches(false);
+            std::this_thread::sleep_for(1ms);
         }
+        LOG_DEBUG(log, "Waited {}ms for committed queue of size {}", watch.elapsedMilliseconds(), request_processor->commitQueueSize());
+    }
+
+    Metrics::getMetrics().log_replication_batch_size->add(batch.size());
+
+    UInt64 accumulated_time_us = RequestTimeline::now();
+    for (const auto & request_for_session : batch)
+        request_for_session.request->timeline.end(RequestStage::ACCUMULATE, accumulated_time_us);
+
+    auto & inflight_batch = inflight_batches.emplace_back();
+    inflight_batch.result = server->pushRequestBatch(batch);
+
+    UInt64 appended_time_us = RequestTimeline::now();
+    for (const auto & request_for_session : batch)
+        request_for_session.request->timeline.end(RequestStage::APPEND, appended_time_us);
+    inflight_batch.requests.swap(batch);
+    inflight_batch.full = full;
+    inflight_batch.has_sync = batch_has_sync;
+    inflight_batch.sync_waiters.swap(batch_sync_waiters);
+    batch_has_sync = false;
+
+    handleCompletedBatches(inflight_batches.size() >= max_inflight_batches);
+}
+
+void RequestAccumulator::handleCompletedBatches(bool wait)
+{
+    while (!inflight_batches.empty())
+    {
+        auto & inflight_batch = inflight_batches.front();
+        if (!wait && !inflight_batch.result->has_result())
+            break;
+
+        bool committed = waitResultAndHandleError(inflight_batch.result, inflight_batch.requests);
+        finishSyncRound(inflight_batch, committed);
+        if (batch_policy)
+            batch_policy->onBatchCompleted(inflight_batch.requests.size(), inflight_batch.watch.elapsedMicroseconds(), inflight_batch.full);
+
+        inflight_batches.pop_front();
+        wait = false;
     }
 }
 
@@ -79,6 +215,8 @@ bool RequestAccumulator::waitResultAndHandleError(NuRaftResult prev_result, cons
             response->setAppendEntryResult(result_accepted, prev_result->get_result_code());
 
             keeper_dispatcher->invokeForwardResponseCallBack({request_session.server_id, request_session.client_id}, response);
+            if (request_session.request->timeline.trace.sampled())
+                RequestTracer::instance().finishForwarded(request_session);
         }
         else if (!result_accepted || prev_result->get_result_code() != nuraft::cmd_result_code::OK)
         {
@@ -118,14 +256,30 @@ void RequestAccumulator::initialize(
     std::shared_ptr<KeeperDispatcher> keeper_dispatcher_,
     std::shared_ptr<KeeperServer> server_,
     UInt64 operation_timeout_ms_,
-    UInt64 max_batch_size_)
+    UInt64 max_batch_size_,
+    bool adaptive_batching_,
+    UInt64 target_replication_latency_ms_,
+    UInt64 max_inflight_batches_)
 {
     keeper_dispatcher = keeper_dispatcher_;
     operation_timeout_ms = operation_timeout_ms_;
-    max_batch_size = max_batch_size_;
+    max_batch_size = std::max(max_batch_size_, UInt64(1));
+    max_inflight_batches = std::max(max_inflight_batches_, UInt64(1));
+    if (adaptive_batching_)
+    {
+        LOG_INFO(log, "Adaptive batching is enabled, target replication latency is {}ms", target_replication_latency_ms_);
+        batch_policy = std::make_unique<AdaptiveBatchPolicy>(max_batch_size.load(), target_replication_latency_ms_);
+    }
     server = server_;
-    requests_queue = std::make_shared<ConcurrentBoundedQueue<RequestForSession>>(20000);
+    requests_queue = std::make_shared<LockFreeBoundedQueue<RequestForSession>>(20000);
     request_thread = ThreadFromGlobalPool([this] { run(); });
 }
 
+void RequestAccumulator::setMaxBatchSize(UInt64 max_batch_size_)
+{
+    max_batch_size = std::max(max_batch_size_, UInt64(1));
+    if (batch_policy)
+        batch_policy->setMaxBatchSize(max_batch_size);
+}
+
 }
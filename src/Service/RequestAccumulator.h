@@ -1,9 +1,12 @@
 #pragma once
 
+#include <Service/AdaptiveBatchPolicy.h>
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperServer.h>
 #include <Service/RequestProcessor.h>
 #include <Service/RequestsQueue.h>
+#include <Common/Stopwatch.h>
+#include <deque>
 
 namespace RK
 {
@@ -12,6 +15,20 @@ namespace RK
  * Request in a batch must be all write request.
  *
  * The batch is transferred to Raft and goes through log replication flow.
+ *
+ * By default a batch is submitted once it reaches max_batch_size or the queue is drained.
+ * With adaptive batching, batch size and linger time are tuned by AdaptiveBatchPolicy.
+ *
+ * Up to max_inflight_batches batches can be replicating at the same time, their results are
+ * handled in submission order, which is also the order of the Raft log.
+ *
+ * Raft commit does not wait for RequestProcessor, so a batch is held back while committed requests
+ * waiting to be applied reach committed_queue_capacity.
+ *
+ * Sync requests are coalesced: a local sync is the barrier of a round, and syncs arriving while the
+ * barrier is in the current batch or in flight join its round rather than taking a log each. When the
+ * barrier is committed every one of them gets the committed log index as read index, as a linearizable
+ * read does, for all writes committed before they arrived are in the log up to it.
  */
 class RequestAccumulator
 {
@@ -24,7 +41,7 @@ public:
     {
     }
 
-    void push(const RequestForSession & request_for_session);
+    void push(RequestForSession request_for_session);
 
     bool waitResultAndHandleError(NuRaftResult prev_result, const RequestsForSessions & prev_batch);
 
@@ -36,12 +53,48 @@ public:
         std::shared_ptr<KeeperDispatcher> keeper_dispatcher_,
         std::shared_ptr<KeeperServer> server_,
         UInt64 operation_timeout_ms_,
-        UInt64 max_batch_size_);
+        UInt64 max_batch_size_,
+        bool adaptive_batching_ = false,
+        UInt64 target_replication_latency_ms_ = 10,
+        UInt64 max_inflight_batches_ = 1);
+
+    size_t getQueueBufferSizeInBytes() const { return requests_queue ? requests_queue->getBufferSizeInBytes() : 0; }
+
+    /// Change batching at runtime, batches submitted later follow the new values
+    void setMaxBatchSize(UInt64 max_batch_size_);
+    void setMaxInflightBatches(UInt64 max_inflight_batches_) { max_inflight_batches = std::max(max_inflight_batches_, UInt64(1)); }
 
 private:
+    /// A batch submitted to Raft whose result is not handled yet
+    struct InflightBatch
+    {
+        NuRaftResult result;
+        RequestsForSessions requests;
+        Stopwatch watch;
+        bool full{false};
+        /// Whether a sync of the batch is the barrier of a round, and syncs joined the round
+        bool has_sync{false};
+        RequestsForSessions sync_waiters;
+    };
+
+    /// Submit batch to Raft and clear it. Waits for the oldest in-flight batch if there are too many.
+    void appendBatch(RequestsForSessions & batch, bool full);
+
+    /// Handle results of in-flight batches in submission order until one is not ready.
+    /// If wait is true, wait for the oldest one.
+    void handleCompletedBatches(bool wait);
+
+    /// Join the request to the current sync round if it is a local sync and there is one, returns whether joined.
+    /// Otherwise a local sync starts a round.
+    bool joinSyncRound(RequestForSession & request_for_session);
+    /// Answer syncs joined the round of the batch, by read index if the barrier is committed
+    void finishSyncRound(const InflightBatch & batch, bool committed);
+
+    UInt64 getMaxBatchSize() const { return batch_policy ? batch_policy->getBatchSize() : max_batch_size.load(std::memory_order_relaxed); }
+
     Poco::Logger * log;
 
-    ptr<ConcurrentBoundedQueue<RequestForSession>> requests_queue;
+    ptr<LockFreeBoundedQueue<RequestForSession>> requests_queue;
     ThreadFromGlobalPool request_thread;
 
     std::atomic<bool> shutdown_called{false};
@@ -51,7 +104,17 @@ private:
     std::shared_ptr<RequestProcessor> request_processor;
 
     UInt64 operation_timeout_ms;
-    UInt64 max_batch_size;
+    std::atomic<UInt64> max_batch_size{1};
+
+    /// Not null if adaptive batching is enabled
+    std::unique_ptr<AdaptiveBatchPolicy> batch_policy;
+
+    std::deque<InflightBatch> inflight_batches;
+
+    /// Sync round of the batch being accumulated, moved to its InflightBatch when it is appended
+    bool batch_has_sync{false};
+    RequestsForSessions batch_sync_waiters;
+    std::atomic<UInt64> max_inflight_batches{1};
 };
 
 }
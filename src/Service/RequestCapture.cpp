@@ -0,0 +1,257 @@
+#include <Service/RequestCapture.h>
+
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+
+#include <Poco/File.h>
+#include <Common/Exception.h>
+#include <Common/IO/ReadHelpers.h>
+#include <Common/IO/VarInt.h>
+#include <Common/IO/WriteHelpers.h>
+#include <Common/RequestTimeline.h>
+#include <Common/SipHash.h>
+#include <Common/setThreadName.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int INVALID_CONFIG_PARAMETER;
+    extern const int CORRUPTED_DATA;
+}
+
+namespace
+{
+
+UInt64 unixTimeMicroseconds()
+{
+    using namespace std::chrono;
+    return static_cast<UInt64>(duration_cast<microseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+void appendVarUInt(UInt64 x, String & out)
+{
+    char buf[10];
+    char * end = writeVarUInt(x, buf);
+    out.append(buf, static_cast<size_t>(end - buf));
+}
+
+}
+
+RequestCapture::Reader::Reader(const String & file) : in(file)
+{
+    char magic[MAGIC_SIZE];
+    in.readStrict(magic, MAGIC_SIZE);
+    if (memcmp(magic, MAGIC, MAGIC_SIZE) != 0)
+        throw Exception(ErrorCodes::CORRUPTED_DATA, "File {} is not a request capture", file);
+    readIntBinary(start_time_us, in);
+}
+
+bool RequestCapture::Reader::next(Record & record)
+{
+    if (in.eof())
+        return false;
+
+    UInt64 session_id;
+    UInt64 size;
+    readVarUInt(record.time_us, in);
+    readVarUInt(session_id, in);
+    readVarUInt(size, in);
+    record.session_id = static_cast<int64_t>(session_id);
+    record.body.resize(size);
+    in.readStrict(record.body.data(), size);
+    return true;
+}
+
+RequestCapture & RequestCapture::instance()
+{
+    static RequestCapture request_capture;
+    return request_capture;
+}
+
+void RequestCapture::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    bool enabled = config.getBool("keeper.capture.enabled", false);
+    String dir_ = config.getString("keeper.capture.dir", "");
+    if (enabled && dir_.empty())
+        throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.capture.dir must be set if capture is enabled");
+
+    double sample_probability = config.getDouble("keeper.capture.sample_probability", DEFAULT_SAMPLE_PROBABILITY);
+    if (sample_probability < 0 || sample_probability > 1)
+        throw Exception(
+            ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.capture.sample_probability must be in [0, 1], got {}", sample_probability);
+
+    initialize(
+        dir_,
+        sample_probability,
+        config.getUInt64("keeper.capture.flush_interval_ms", DEFAULT_FLUSH_INTERVAL_MS),
+        config.getUInt64("keeper.capture.max_pending_bytes", DEFAULT_MAX_PENDING_BYTES),
+        config.getUInt64("keeper.capture.max_file_bytes", DEFAULT_MAX_FILE_BYTES));
+
+    if (enabled)
+        start();
+}
+
+void RequestCapture::initialize(
+    const String & dir_, double sample_probability, UInt64 flush_interval_ms_, size_t max_pending_bytes_, UInt64 max_file_bytes_)
+{
+    stop();
+
+    std::lock_guard lock(mutex);
+    dir = dir_;
+    flush_interval_ms = std::max(flush_interval_ms_, UInt64(1));
+    max_pending_bytes = max_pending_bytes_;
+    max_file_bytes = max_file_bytes_;
+
+    /// 2^64 does not fit, probability 1 samples all but one of 2^64 sessions
+    UInt64 threshold = sample_probability >= 1 ? std::numeric_limits<UInt64>::max()
+                                               : static_cast<UInt64>(sample_probability * 18446744073709551616.0);
+    sample_threshold.store(threshold, std::memory_order_relaxed);
+}
+
+String RequestCapture::start()
+{
+    std::lock_guard start_stop_lock(start_stop_mutex);
+    if (capturing)
+    {
+        std::lock_guard lock(mutex);
+        return file;
+    }
+
+    /// Write thread stopped by a full file
+    if (write_thread.joinable())
+        write_thread.join();
+
+    std::lock_guard lock(mutex);
+    if (dir.empty())
+        throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.capture.dir is not set");
+
+    Poco::File(dir).createDirectories();
+    UInt64 start_time_us = unixTimeMicroseconds();
+    file = dir + "/capture_" + std::to_string(start_time_us / 1000) + ".bin";
+    out = std::make_unique<WriteBufferFromFile>(file, DEFAULT_BUFFER_SIZE, O_WRONLY | O_TRUNC | O_CREAT);
+    out->write(MAGIC, MAGIC_SIZE);
+    writeIntBinary(start_time_us, *out);
+    out->next();
+
+    pending.clear();
+    records = 0;
+    dropped = 0;
+    file_bytes = MAGIC_SIZE + sizeof(start_time_us);
+    start_monotonic_us = RequestTimeline::now();
+    stop_called = false;
+    write_thread = ThreadFromGlobalPool([this] { writeThread(); });
+    capturing = true;
+
+    LOG_INFO(&Poco::Logger::get("RequestCapture"), "Capturing requests to {}", file);
+    return file;
+}
+
+void RequestCapture::stop()
+{
+    std::lock_guard start_stop_lock(start_stop_mutex);
+    capturing = false;
+    {
+        std::lock_guard lock(mutex);
+        stop_called = true;
+    }
+    cv.notify_all();
+
+    if (write_thread.joinable())
+        write_thread.join();
+    out.reset();
+}
+
+bool RequestCapture::isSampled(int64_t session_id) const
+{
+    return sipHash64(session_id) < sample_threshold.load(std::memory_order_relaxed);
+}
+
+void RequestCapture::capture(int64_t session_id, UInt64 receive_time_us, const char * body, size_t size)
+{
+    if (!capturing.load(std::memory_order_relaxed) || !isSampled(session_id))
+        return;
+
+    /// Requests read before start are of time 0
+    UInt64 start = start_monotonic_us.load(std::memory_order_relaxed);
+    UInt64 time_us = receive_time_us > start ? receive_time_us - start : 0;
+
+    std::lock_guard lock(mutex);
+    if (pending.size() + size > max_pending_bytes)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    appendRecord(time_us, session_id, body, size, pending);
+    records.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RequestCapture::appendRecord(UInt64 time_us, int64_t session_id, const char * body, size_t size, String & out)
+{
+    appendVarUInt(time_us, out);
+    appendVarUInt(static_cast<UInt64>(session_id), out);
+    appendVarUInt(size, out);
+    out.append(body, size);
+}
+
+RequestCapture::Status RequestCapture::getStatus() const
+{
+    std::lock_guard lock(mutex);
+    Status status;
+    status.capturing = capturing;
+    status.file = file;
+    status.records = records;
+    status.bytes = file_bytes + pending.size();
+    status.dropped = dropped;
+    return status;
+}
+
+void RequestCapture::writeThread()
+{
+    setThreadName("RequestCapture");
+
+    bool stopped = false;
+    while (!stopped)
+    {
+        {
+            std::unique_lock lock(mutex);
+            stopped = cv.wait_for(lock, std::chrono::milliseconds(flush_interval_ms), [this] { return stop_called; });
+        }
+        if (flush())
+        {
+            capturing = false;
+            LOG_WARNING(&Poco::Logger::get("RequestCapture"), "Stopped capturing requests, file has {} bytes", file_bytes.load());
+            flush();
+            break;
+        }
+    }
+}
+
+bool RequestCapture::flush()
+{
+    String data;
+    {
+        std::lock_guard lock(mutex);
+        data.swap(pending);
+    }
+
+    if (!data.empty())
+    {
+        try
+        {
+            out->write(data.data(), data.size());
+            out->next();
+            file_bytes += data.size();
+        }
+        catch (...)
+        {
+            tryLogCurrentException("RequestCapture", fmt::format("Failed to write {} bytes of captured requests", data.size()));
+        }
+    }
+    return file_bytes >= max_file_bytes;
+}
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <Common/IO/ReadBufferFromFile.h>
+#include <Common/IO/WriteBufferFromFile.h>
+#include <Common/ThreadPool.h>
+
+namespace RK
+{
+
+/** Capture of the requests of clients to a file, which raftkeeper replay sends to a test cluster with the same timing,
+  * so that changes can be measured against a production workload. Requests are captured as parsed by connections, after
+  * handshake, so a session of the capture is a session of the replay. Sessions rather than requests are sampled, one of
+  * sample_probability sessions by the hash of their id, so that a captured session has all its requests.
+  *
+  * A capture is a file capture_<unix time in milliseconds>.bin of dir, which is
+  *     magic RKCAPTR1, unix time in microseconds the capture started at (UInt64 little endian),
+  * and a record for every request
+  *     microseconds since the start (VarUInt), session id (VarUInt), size of body (VarUInt),
+  *     body, which is xid, opnum and the request as sent by client without the length.
+  *
+  * Connections append records to memory, at most max_pending_bytes of them between flushes and others are dropped, and a
+  * background thread writes them every flush_interval_ms. Capturing stops when the file has max_file_bytes.
+  *
+  * Configured by keeper.capture.{enabled, dir, sample_probability, flush_interval_ms, max_pending_bytes, max_file_bytes},
+  * enabled starts capturing at startup. 4lw commands cpon and cpof start and stop capturing on demand.
+  */
+class RequestCapture
+{
+public:
+    struct Record
+    {
+        /// Microseconds since the start of the capture
+        UInt64 time_us = 0;
+        int64_t session_id = 0;
+        String body;
+    };
+
+    struct Status
+    {
+        bool capturing = false;
+        String file;
+        UInt64 records = 0;
+        UInt64 bytes = 0;
+        UInt64 dropped = 0;
+    };
+
+    /// Sequential reader of a capture file
+    class Reader
+    {
+    public:
+        explicit Reader(const String & file);
+
+        /// Unix time in microseconds the capture started at
+        UInt64 startTimeUs() const { return start_time_us; }
+
+        /// False at the end of the file
+        bool next(Record & record);
+
+    private:
+        ReadBufferFromFile in;
+        UInt64 start_time_us = 0;
+    };
+
+    static RequestCapture & instance();
+
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+    void initialize(const String & dir_, double sample_probability, UInt64 flush_interval_ms_, size_t max_pending_bytes_,
+        UInt64 max_file_bytes_);
+
+    /// Start capturing to a new file, return its path. Does nothing if capturing.
+    String start();
+    void stop();
+
+    bool isCapturing() const { return capturing.load(std::memory_order_relaxed); }
+
+    /// Whether requests of session are captured when capturing
+    bool isSampled(int64_t session_id) const;
+
+    /// Invoked by connection for a request parsed, receive_time_us is of RequestTimeline::now()
+    void capture(int64_t session_id, UInt64 receive_time_us, const char * body, size_t size);
+
+    Status getStatus() const;
+
+    void shutdown() { stop(); }
+
+    /// Encoded record appended to out
+    static void appendRecord(UInt64 time_us, int64_t session_id, const char * body, size_t size, String & out);
+
+    static constexpr char MAGIC[] = "RKCAPTR1";
+    static constexpr size_t MAGIC_SIZE = sizeof(MAGIC) - 1;
+    static constexpr double DEFAULT_SAMPLE_PROBABILITY = 1;
+    static constexpr UInt64 DEFAULT_FLUSH_INTERVAL_MS = 100;
+    static constexpr size_t DEFAULT_MAX_PENDING_BYTES = 64 * 1024 * 1024;
+    static constexpr UInt64 DEFAULT_MAX_FILE_BYTES = 10ULL * 1024 * 1024 * 1024;
+
+private:
+    RequestCapture() = default;
+
+    void writeThread();
+    /// Write pending records, return whether the file is full
+    bool flush();
+
+    std::atomic<bool> capturing{false};
+    /// A session is sampled if the hash of its id is less than it
+    std::atomic<UInt64> sample_threshold{std::numeric_limits<UInt64>::max()};
+    std::atomic<UInt64> records{0};
+    std::atomic<UInt64> dropped{0};
+    /// RequestTimeline::now() of the start
+    std::atomic<UInt64> start_monotonic_us{0};
+
+    mutable std::mutex mutex;
+    std::condition_variable cv;
+    String pending;
+    String dir;
+    String file;
+    size_t max_pending_bytes = DEFAULT_MAX_PENDING_BYTES;
+    UInt64 max_file_bytes = DEFAULT_MAX_FILE_BYTES;
+    UInt64 flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+    bool stop_called = false;
+    std::atomic<UInt64> file_bytes{0};
+
+    /// Start and stop are serialized by it, they join write thread without holding mutex
+    std::mutex start_stop_mutex;
+
+    /// Only used by write thread
+    std::unique_ptr<WriteBufferFromFile> out;
+    ThreadFromGlobalPool write_thread;
+};
+
+}
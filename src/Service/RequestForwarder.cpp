@@ -1,5 +1,7 @@
 #include <Service/KeeperDispatcher.h>
+#include <Service/Metrics.h>
 #include <Service/RequestForwarder.h>
+#include <Service/ThreadPlacement.h>
 #include <Service/Context.h>
 #include <Common/setThreadName.h>
 
@@ -14,16 +16,18 @@ namespace ErrorCodes
     extern const int RAFT_FWD_NO_CONN;
 }
 
-void RequestForwarder::push(const RequestForSession & request_for_session)
+void RequestForwarder::push(RequestForSession request_for_session)
 {
-    requests_queue->push(request_for_session);
+    requests_queue->push(std::move(request_for_session));
 }
 
 void RequestForwarder::runSend(RunnerId runner_id)
 {
     setThreadName(("ReqFwdSend#" + toString(runner_id)).c_str());
+    ThreadPlacement::instance().apply(ThreadClass::FORWARDER);
 
     LOG_DEBUG(log, "Starting forward request sending thread.");
+    std::vector<RequestForSession> requests;
     while (!shutdown_called)
     {
         UInt64 max_wait = session_sync_period_ms;
@@ -37,43 +41,11 @@ void RequestForwarder::runSend(RunnerId runner_id)
 
         if (requests_queue->tryPop(runner_id, request_for_session, max_wait))
         {
-            try
-            {
-                if (server->isLeader())
-                {
-                    LOG_WARNING(log, "A leader switch may have occurred suddenly");
-                    throw Exception("Can't forward request", ErrorCodes::RAFT_IS_LEADER);
-                }
-
-                if (!server->isLeaderAlive())
-                    throw Exception("Raft no leader", ErrorCodes::RAFT_NO_LEADER);
-
-                int32_t leader = server->getLeader();
-                ptr<ForwardConnection> connection;
-                {
-                    std::lock_guard<std::mutex> lock(connections_mutex);
-                    connection = connections[leader][runner_id];
-                }
-
-                if (!connection)
-                    throw Exception("Not found connection for runner " + std::to_string(runner_id), ErrorCodes::RAFT_FWD_NO_CONN);
-
-                ForwardRequestPtr forward_request = ForwardRequestFactory::instance().convertFromRequest(request_for_session);
-                forward_request->send_time = clock::now();
-                connection->send(forward_request);
-
-                forward_request_queue[runner_id]->push(std::move(forward_request));
-            }
-            catch (...)
-            {
-                tryLogCurrentException(log, "Error when forwarding request with runner " + std::to_string(runner_id));
-                request_processor->onError(
-                    false,
-                    nuraft::cmd_result_code::FAILED,
-                    request_for_session.session_id,
-                    request_for_session.request->xid,
-                    request_for_session.request->getOpNum());
-            }
+            /// Take the requests already waiting too, so that they are sent in one packet.
+            requests.clear();
+            requests.push_back(std::move(request_for_session));
+            requests_queue->tryPopBatch(runner_id, requests, MAX_FORWARD_BATCH_SIZE - 1);
+            sendRequests(runner_id, requests);
         }
 
         if (session_sync_idx % parallel == runner_id && session_sync_time_watch.elapsedMilliseconds() >= session_sync_period_ms)
@@ -95,6 +67,7 @@ void RequestForwarder::runSend(RunnerId runner_id)
                         /// TODO if keeper nodes time has large gap something will be wrong.
                         auto session_to_expiration_time = server->getKeeperStateMachine()->getStore().sessionToExpirationTime();
                         keeper_dispatcher->filterLocalSessions(session_to_expiration_time);
+                        filterSyncedSessions(leader, session_to_expiration_time);
 
                         if (!session_to_expiration_time.empty())
                             LOG_DEBUG(log, "Has {} local sessions to send", session_to_expiration_time.size());
@@ -106,6 +79,8 @@ void RequestForwarder::runSend(RunnerId runner_id)
                             connection->send(forward_request);
                             forward_request_queue[runner_id]->push(std::move(forward_request));
                         }
+
+                        sendLoadReport(runner_id, *connection);
                     }
                     else
                     {
@@ -125,9 +100,126 @@ void RequestForwarder::runSend(RunnerId runner_id)
     }
 }
 
+ptr<ForwardConnection> RequestForwarder::getLeaderConnection(RunnerId runner_id)
+{
+    if (server->isLeader())
+    {
+        LOG_WARNING(log, "A leader switch may have occurred suddenly");
+        throw Exception("Can't forward request", ErrorCodes::RAFT_IS_LEADER);
+    }
+
+    if (!server->isLeaderAlive())
+        throw Exception("Raft no leader", ErrorCodes::RAFT_NO_LEADER);
+
+    int32_t leader = server->getLeader();
+    ptr<ForwardConnection> connection;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        connection = connections[leader][runner_id];
+    }
+
+    if (!connection)
+        throw Exception("Not found connection for runner " + std::to_string(runner_id), ErrorCodes::RAFT_FWD_NO_CONN);
+    return connection;
+}
+
+void RequestForwarder::sendRequests(RunnerId runner_id, const std::vector<RequestForSession> & requests)
+{
+    auto batch = std::make_shared<ForwardUserBatchRequest>();
+
+    auto on_error = [this](const RequestForSession & request_for_session)
+    {
+        request_processor->onError(
+            false,
+            nuraft::cmd_result_code::FAILED,
+            request_for_session.session_id,
+            request_for_session.request->xid,
+            request_for_session.request->getOpNum());
+    };
+
+    auto send_batch = [&]
+    {
+        if (batch->requests.empty())
+            return;
+
+        try
+        {
+            auto connection = getLeaderConnection(runner_id);
+            auto now = clock::now();
+            batch->compression = connection->compressionEnabled();
+            batch->trace_context = connection->traceContextEnabled();
+
+            /// A single request is not worth the batch header, unless it carries trace context. A leader which does
+            /// not accept user batches, of an older version during rolling upgrade, gets requests one by one.
+            if (!connection->userBatchEnabled())
+            {
+                for (const auto & request : batch->requests)
+                    connection->send(request);
+            }
+            else if (batch->requests.size() == 1 && !(batch->trace_context && batch->hasSampledRequest()))
+                connection->send(batch->requests.front());
+            else
+                connection->send(batch);
+
+            Metrics::getMetrics().forward_batch_size->add(batch->requests.size());
+            UInt64 forwarded_time_us = RequestTimeline::now();
+            for (auto & request : batch->requests)
+            {
+                request->request.request->timeline.end(RequestStage::FORWARD, forwarded_time_us);
+                request->send_time = now;
+                forward_request_queue[runner_id]->push(std::move(request));
+            }
+        }
+        catch (...)
+        {
+            tryLogCurrentException(
+                log, fmt::format("Error when forwarding {} requests with runner {}", batch->requests.size(), runner_id));
+            for (const auto & request : batch->requests)
+                on_error(request->request);
+        }
+        batch->requests.clear();
+    };
+
+    for (const auto & request_for_session : requests)
+    {
+        try
+        {
+            ForwardRequestPtr forward_request;
+            /// Read requests are pushed only for linearizable read, leader just returns the read index.
+            if (request_processor->isReadRequest(request_for_session.request))
+                forward_request = std::make_shared<ForwardReadIndexRequest>(request_for_session);
+            else
+                forward_request = ForwardRequestFactory::instance().convertFromRequest(request_for_session);
+
+            if (forward_request->forwardType() == ForwardType::User)
+            {
+                batch->requests.push_back(std::static_pointer_cast<ForwardUserRequest>(forward_request));
+                continue;
+            }
+
+            /// Keep the order of requests in the connection
+            send_batch();
+
+            auto connection = getLeaderConnection(runner_id);
+            forward_request->send_time = clock::now();
+            connection->send(forward_request);
+
+            forward_request_queue[runner_id]->push(std::move(forward_request));
+        }
+        catch (...)
+        {
+            tryLogCurrentException(log, "Error when forwarding request with runner " + std::to_string(runner_id));
+            on_error(request_for_session);
+        }
+    }
+
+    send_batch();
+}
+
 void RequestForwarder::runReceive(RunnerId runner_id)
 {
     setThreadName(("ReqFwdRecv#" + toString(runner_id)).c_str());
+    ThreadPlacement::instance().apply(ThreadClass::FORWARDER);
 
     LOG_DEBUG(log, "Starting forward response receiving thread.");
     while (!shutdown_called)
@@ -248,13 +340,7 @@ bool RequestForwarder::processTimeoutRequest(RunnerId runner_id, ForwardRequestP
 
 bool RequestForwarder::removeFromQueue(RunnerId runner_id, ForwardResponsePtr forward_response_ptr)
 {
-    return forward_request_queue[runner_id]->findAndRemove([forward_response_ptr](const ForwardRequestPtr & request) -> bool
-    {
-        if (request->forwardType() != forward_response_ptr->forwardType())
-            return false;
-
-        return forward_response_ptr->match(request);
-    });
+    return forward_request_queue[runner_id]->remove(forward_response_ptr->key()) != nullptr;
 }
 
 
@@ -262,15 +348,84 @@ void RequestForwarder::processResponse(RunnerId runner_id, ForwardResponsePtr fo
 {
     bool found = removeFromQueue(runner_id, forward_response_ptr);
 
-    if (!found || forward_response_ptr->accepted)
+    if (!found)
         return;
 
+    if (forward_response_ptr->accepted)
+    {
+        forward_response_ptr->onSuccess(*this);
+        return;
+    }
+
     /// common request
     LOG_ERROR(log, "Receive failed forward response {}", forward_response_ptr->toString());
 
     forward_response_ptr->onError(*this); /// for NewSession UpdateSession Op, maybe peer not accepted or raft not accepted
 }
 
+void RequestForwarder::filterSyncedSessions(int32_t leader, std::unordered_map<int64_t, int64_t> & session_to_expiration_time)
+{
+    std::lock_guard lock(session_sync_mutex);
+
+    if (leader != synced_leader || full_session_sync_watch.elapsedMilliseconds() >= FULL_SESSION_SYNC_PERIOD_MS)
+    {
+        LOG_DEBUG(log, "Sync all {} local sessions to leader {}", session_to_expiration_time.size(), leader);
+        synced_sessions = session_to_expiration_time;
+        synced_leader = leader;
+        full_session_sync_watch.restart();
+        return;
+    }
+
+    std::unordered_map<int64_t, int64_t> changed_sessions;
+    for (const auto & [session_id, expiration_time] : session_to_expiration_time)
+    {
+        auto [it, inserted] = synced_sessions.try_emplace(session_id, expiration_time);
+        if (inserted || it->second != expiration_time)
+        {
+            it->second = expiration_time;
+            changed_sessions.emplace(session_id, expiration_time);
+        }
+    }
+
+    /// Closed sessions
+    if (synced_sessions.size() > session_to_expiration_time.size())
+        std::erase_if(synced_sessions, [&](const auto & session) { return !session_to_expiration_time.contains(session.first); });
+
+    LOG_TRACE(log, "{} of {} local sessions changed since last sync", changed_sessions.size(), session_to_expiration_time.size());
+    session_to_expiration_time.swap(changed_sessions);
+}
+
+void RequestForwarder::reportLoad(const NodeLoad & load)
+{
+    std::lock_guard lock(load_report_mutex);
+    load_report = load;
+}
+
+void RequestForwarder::sendLoadReport(RunnerId runner_id, ForwardConnection & connection)
+{
+    std::optional<NodeLoad> load;
+    {
+        std::lock_guard lock(load_report_mutex);
+        load.swap(load_report);
+    }
+
+    /// Older leaders do not know the packet
+    if (!load || !connection.loadReportEnabled())
+        return;
+
+    ForwardRequestPtr forward_request = std::make_shared<ForwardLoadReportRequest>(*load);
+    forward_request->send_time = clock::now();
+    connection.send(forward_request);
+    forward_request_queue[runner_id]->push(std::move(forward_request));
+}
+
+void RequestForwarder::resetSessionSync()
+{
+    std::lock_guard lock(session_sync_mutex);
+    synced_sessions.clear();
+    synced_leader = -1;
+}
+
 void RequestForwarder::shutdown()
 {
     LOG_INFO(log, "Shutting down request forwarder!");
@@ -356,7 +511,7 @@ void RequestForwarder::initConnections()
         {
             LOG_INFO(log, "Creating forward connection #{}#{} to {}", server_id, runner_id, endpoint);
             std::shared_ptr<ForwardConnection> connection = std::make_shared<ForwardConnection>(
-                my_id, runner_id, endpoint, operation_timeout);
+                my_id, runner_id, endpoint, operation_timeout, forward_compression);
             connection_pool.push_back(connection);
         }
         connections.emplace(server_id, connection_pool);
@@ -383,19 +538,24 @@ void RequestForwarder::initialize(
     std::shared_ptr<KeeperServer> server_,
     std::shared_ptr<KeeperDispatcher> keeper_dispatcher_,
     UInt64 session_sync_period_ms_,
-    UInt64 operation_timeout_ms_)
+    UInt64 operation_timeout_ms_,
+    bool forward_compression_,
+    size_t requests_queue_capacity_,
+    bool least_loaded_placement_)
 {
     parallel = parallel_;
+    forward_compression = forward_compression_;
     session_sync_period_ms = session_sync_period_ms_;
     server = server_;
     keeper_dispatcher = keeper_dispatcher_;
-    requests_queue = std::make_shared<RequestsQueue>(parallel, 20000);
+    requests_queue = std::make_shared<RequestsQueue>(
+        parallel, requests_queue_capacity_, RequestsQueue::DEFAULT_CONTROL_REQUESTS_WEIGHT, least_loaded_placement_);
 
     operation_timeout = operation_timeout_ms_ * 1000;
 
     for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
     {
-        forward_request_queue.push_back(std::make_unique<ForwardRequestQueue>());
+        forward_request_queue.push_back(std::make_unique<PendingForwardRequests>());
     }
 
     initConnections();
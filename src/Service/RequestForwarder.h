@@ -1,6 +1,7 @@
 #pragma once
 
 #include <chrono>
+#include <optional>
 
 #include <Common/Stopwatch.h>
 
@@ -9,6 +10,7 @@
 #include <Service/ForwardResponse.h>
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperServer.h>
+#include <Service/PendingForwardRequests.h>
 #include <Service/RequestProcessor.h>
 #include <Service/RequestsQueue.h>
 
@@ -26,7 +28,7 @@ public:
     {
     }
 
-    void push(const RequestForSession & request_for_session);
+    void push(RequestForSession request_for_session);
 
     void runSend(RunnerId runner_id);
     void runReceive(RunnerId runner_id);
@@ -36,10 +38,23 @@ public:
         std::shared_ptr<KeeperServer> server_,
         std::shared_ptr<KeeperDispatcher> keeper_dispatcher_,
         UInt64 session_sync_period_ms_,
-        UInt64 operation_timeout_ms_);
+        UInt64 operation_timeout_ms_,
+        bool forward_compression_,
+        size_t requests_queue_capacity_ = 20000,
+        bool least_loaded_placement_ = false);
+
+    /// Change capacity of the queue of requests to forward at runtime, returns the capacity applied
+    size_t setQueueCapacity(size_t capacity) { return requests_queue->setCapacity(capacity); }
 
     void shutdown();
 
+    /// Forget what was synced, so that the next session sync sends all local sessions.
+    /// Invoked when a session sync request failed.
+    void resetSessionSync();
+
+    /// Load of this node sent to the leader with the next session sync, see LeaderBalancer
+    void reportLoad(const NodeLoad & load);
+
     std::shared_ptr<RequestProcessor> request_processor;
     std::shared_ptr<KeeperDispatcher> keeper_dispatcher;
 
@@ -54,6 +69,20 @@ private:
 
     bool processTimeoutRequest(RunnerId runner_id, ForwardRequestPtr newFront);
 
+    /// Connection of the runner to the current leader, throws if there is no leader or I become leader.
+    ptr<ForwardConnection> getLeaderConnection(RunnerId runner_id);
+
+    /// Forward requests popped together. Successive user requests are sent in one packet,
+    /// other ones are sent alone in their places to keep the order.
+    void sendRequests(RunnerId runner_id, const std::vector<RequestForSession> & requests);
+
+    /// Keep only sessions whose expiration time changed since the last sync to the leader,
+    /// unless it is time for full reconciliation or the leader changed.
+    void filterSyncedSessions(int32_t leader, std::unordered_map<int64_t, int64_t> & session_to_expiration_time);
+
+    /// Send the load reported since the last time if any
+    void sendLoadReport(RunnerId runner_id, ForwardConnection & connection);
+
     size_t parallel;
     ptr<RequestsQueue> requests_queue;
 
@@ -72,12 +101,29 @@ private:
     std::atomic<UInt64> session_sync_idx{0};
     Stopwatch session_sync_time_watch;
 
-    using ForwardRequestQueue = ThreadSafeQueue<ForwardRequestPtr, std::list<ForwardRequestPtr>>;
-    using ForwardRequestQueuePtr = std::unique_ptr<ForwardRequestQueue>;
-    std::vector<ForwardRequestQueuePtr> forward_request_queue;
+    /// All local sessions are sent to the leader at this low rate, otherwise only changed ones.
+    static constexpr UInt64 FULL_SESSION_SYNC_PERIOD_MS = 60000;
+
+    /// Max requests forwarded by one packet
+    static constexpr size_t MAX_FORWARD_BATCH_SIZE = 256;
+
+    /// Session -> expiration time last sent to synced_leader, runners take turns to sync sessions
+    std::unordered_map<int64_t, int64_t> synced_sessions;
+    int32_t synced_leader = -1;
+    Stopwatch full_session_sync_watch;
+    std::mutex session_sync_mutex;
+
+    std::optional<NodeLoad> load_report;
+    std::mutex load_report_mutex;
+
+    /// Requests waiting for responses of every runner
+    std::vector<std::unique_ptr<PendingForwardRequests>> forward_request_queue;
 
     Poco::Timespan operation_timeout;
 
+    /// Ask the leader for compression of large user batches
+    bool forward_compression = false;
+
     using ConnectionPool = std::vector<ptr<ForwardConnection>>;
     std::unordered_map<UInt32, ConnectionPool> connections;
     std::mutex connections_mutex;
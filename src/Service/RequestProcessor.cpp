@@ -1,18 +1,23 @@
+#include <Common/BusyPoll.h>
 #include <Common/setThreadName.h>
 
+#include <limits>
+
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperDispatcher.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 #include <Service/Metrics.h>
+#include <Service/OpCostMetrics.h>
+#include <Service/ThreadPlacement.h>
 
 namespace RK
 {
 
-void RequestProcessor::push(const RequestForSession & request_for_session)
+void RequestProcessor::push(RequestForSession request_for_session)
 {
     if (!shutdown_called)
     {
-        requests_queue->push(request_for_session);
+        requests_queue->push(std::move(request_for_session));
         {
             std::unique_lock lk(mutex);
             cv.notify_all();
@@ -28,6 +33,7 @@ void RequestProcessor::systemExist()
 void RequestProcessor::run()
 {
     setThreadName("ReqProcessor");
+    ThreadPlacement::instance().apply(ThreadClass::PROCESSOR);
     Stopwatch watch;
 
     while (!shutdown_called)
@@ -42,18 +48,21 @@ void RequestProcessor::run()
                 /// to pending queue and then the first loop handle the write request, then If we do not check the
                 /// pending queue in our wait condition, it will result in meaningless waiting.
                 bool pending_requests_empty = true;
-                for (const auto & [_, runner_pending_requests] : pending_requests)
+                for (const auto & runner_pending_requests : pending_requests)
                 {
-                    for (const auto & [session_, session_pending_requests] : runner_pending_requests)
-                        if (!session_pending_requests.empty())
-                        {
-                            pending_requests_empty = false;
-                            break;
-                        }
+                    if (!runner_pending_requests.empty())
+                    {
+                        pending_requests_empty = false;
+                        break;
+                    }
                 }
                 return error_request_ids.empty() && requests_queue->empty() && committed_queue.empty() && pending_requests_empty;
             };
 
+            /// Spin on the queues before waiting on cv, other conditions are guarded by the mutex.
+            if (BusyPoll::enabled() && [&] { std::lock_guard lk(mutex); return need_wait(); }())
+                BusyPoll::spin([&] { return !requests_queue->empty() || !committed_queue.empty() || shutdown_called; });
+
             {
                 using namespace std::chrono_literals;
                 std::unique_lock lk(mutex);
@@ -69,6 +78,8 @@ void RequestProcessor::run()
             if (shutdown_called)
                 return;
 
+            /// Read before the size of committed_queue, so that requests up to it are all in the queue
+            UInt64 committed_log_idx = server->getKeeperStateMachine()->last_commit_index();
             size_t committed_request_size = committed_queue.size();
             size_t error_request_size;
             {
@@ -77,17 +88,29 @@ void RequestProcessor::run()
             }
 
             /// 1. process read request
+            updateReadLag();
             watch.restart();
-            for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
+            if (parallel_read)
+            {
+                processReadRequestsInParallel();
+            }
+            else
             {
-                moveRequestToPendingQueue(runner_id);
-                processReadRequests(runner_id);
+                for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
+                {
+                    moveRequestToPendingQueue(runner_id);
+                    processReadRequests(runner_id);
+                }
             }
             Metrics::getMetrics().apply_read_request_time_ms->add(watch.elapsedMilliseconds());
 
-            /// 2. process committed request, single thread
+            /// 2. process committed request
             watch.restart();
             processCommittedRequest(committed_request_size);
+            if (committed_queue.empty())
+                applied_log_idx = std::max(applied_log_idx, committed_log_idx);
+            if (parallel_read)
+                server->getKeeperStateMachine()->getStore().reclaimRetiredNodes();
             Metrics::getMetrics().apply_write_request_time_ms->add(watch.elapsedMilliseconds());
 
             /// 3. process error requests
@@ -102,25 +125,31 @@ void RequestProcessor::run()
 
 void RequestProcessor::moveRequestToPendingQueue(RunnerId runner_id)
 {
-    auto & thread_requests = pending_requests.find(runner_id)->second;
+    auto & thread_requests = pending_requests[runner_id];
     size_t request_size = requests_queue->size(runner_id);
 
     if (request_size)
         LOG_TRACE(log, "Prepare to move {} requests to pending queue of runner {}", request_size, runner_id);
 
-    for (size_t i = 0; i < request_size; ++i)
+    /// Reused across invocations, so that it does not allocate
+    auto & requests = popped_requests[runner_id];
+    requests_queue->tryPopBatch(runner_id, requests, request_size);
+
+    for (auto & request : requests)
     {
-        RequestForSession request;
-        if (requests_queue->tryPop(runner_id, request))
+        auto op_num = request.request->getOpNum();
+        /// Heartbeat only refreshes the session, it does not wait behind other requests of the session.
+        if (op_num == Coordination::OpNum::Heartbeat)
         {
-            auto op_num = request.request->getOpNum();
-            if (op_num != Coordination::OpNum::Auth)
-            {
-                LOG_TRACE(log, "Move {} to pending queue", request.toSimpleString());
-                thread_requests[request.session_id].push_back(request);
-            }
+            applyRequest(request);
+        }
+        else if (op_num != Coordination::OpNum::Auth)
+        {
+            LOG_TRACE(log, "Move {} to pending queue", request.toSimpleString());
+            thread_requests.push(std::move(request));
         }
     }
+    requests.clear();
 }
 
 bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & committed_request, bool & found_in_pending_queue)
@@ -129,9 +158,7 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
     bool found_error = false;
 
     auto runner_id = getRunnerId(committed_request.session_id);
-    auto & my_pending_requests = pending_requests.find(runner_id)->second;
-
-    auto & pending_requests_for_session = my_pending_requests[committed_request.session_id];
+    const auto * first_pending_request = pending_requests[runner_id].front(committed_request.session_id);
 
     auto process_not_in_pending_queue = [this, &found_in_pending_queue, &committed_request]()
     {
@@ -144,24 +171,23 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
             committed_request.toSimpleString());
     };
 
-    if (pending_requests_for_session.empty())
+    if (!first_pending_request)
     {
         process_not_in_pending_queue();
         return true;
     }
 
-    auto & first_pending_request = pending_requests_for_session.front();
     LOG_DEBUG(
         log,
         "First pending request of session {} is {}",
         toHexString(committed_request.session_id),
-        first_pending_request.toSimpleString());
+        first_pending_request->toSimpleString());
 
-    if (first_pending_request.request->xid == committed_request.request->xid)
+    if (first_pending_request->request->xid == committed_request.request->xid)
     {
         found_in_pending_queue = true;
         std::unique_lock lk(mutex);
-        if (error_request_ids.contains(first_pending_request.getRequestId()))
+        if (error_request_ids.contains(first_pending_request->getRequestId()))
         {
             LOG_WARNING(log, "Request {} is in errors, but is successfully committed", committed_request.toSimpleString());
         }
@@ -172,7 +198,7 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
         found_in_pending_queue = false;
         /// Session of the previous committed(write) request is not same with the current,
         /// which means a write_request(session_1) -> request(session_2) sequence.
-        if (first_pending_request.request->isReadRequest())
+        if (isLocalRequest(*first_pending_request))
         {
             LOG_DEBUG(log, "Found read request, We should terminate the processing of committed(write) requests.");
             has_read_request = true;
@@ -181,7 +207,7 @@ bool RequestProcessor::shouldProcessCommittedRequest(const RequestForSession & c
         {
             {
                 std::unique_lock lk(mutex);
-                found_error = error_request_ids.contains(first_pending_request.getRequestId());
+                found_error = error_request_ids.contains(first_pending_request->getRequestId());
             }
 
             if (found_error)
@@ -199,22 +225,39 @@ void RequestProcessor::processCommittedRequest(size_t count)
     RequestForSession committed_request;
     for (size_t i = 0; i < count; ++i)
     {
-        if (!committed_queue.peek(committed_request))
+        /// Examined in place, it is moved out of the queue only when it is applied
+        const auto * front = committed_queue.front();
+        if (!front)
             continue;
 
-        LOG_DEBUG(log, "Process committed(write) request {}", committed_request.toSimpleString());
+        LOG_DEBUG(log, "Process committed(write) request {}", front->toSimpleString());
 
-        auto runner_id = getRunnerId(committed_request.session_id);
-        auto & my_pending_requests = pending_requests.find(runner_id)->second;
+        /// Logs before it are applied
+        if (front->log_idx)
+            applied_log_idx = std::max(applied_log_idx, front->log_idx - 1);
+
+        auto runner_id = getRunnerId(front->session_id);
+        auto & my_pending_requests = pending_requests[runner_id];
 
         /// New session and update session requests are not put into pending queue
-        if (unlikely(isSessionRequest(committed_request.request)))
+        bool session_request = isSessionRequest(front->request);
+        bool local_session = !session_request && keeper_dispatcher->isLocalSession(front->session_id);
+        bool auth_request = front->request->getOpNum() == Coordination::OpNum::Auth;
+
+        bool found_in_pending_queue = false;
+        if (local_session && !auth_request && !shouldProcessCommittedRequest(*front, found_in_pending_queue))
+            break;
+
+        committed_queue.tryPop(committed_request);
+        auto committed_session_id = committed_request.session_id;
+        bool close_request = committed_request.request->getOpNum() == Coordination::OpNum::Close;
+
+        if (unlikely(session_request))
         {
-            applyRequest(committed_request);
-            committed_queue.pop();
+            applyCommittedRequest(std::move(committed_request));
         }
         /// Remote requests
-        else if (!keeper_dispatcher->isLocalSession(committed_request.session_id))
+        else if (!local_session)
         {
             if (my_pending_requests.contains(committed_request.session_id))
             {
@@ -224,42 +267,45 @@ void RequestProcessor::processCommittedRequest(size_t count)
                     "Just delete from pending queue.",
                     toHexString(committed_request.session_id));
                 my_pending_requests.erase(committed_request.session_id);
+                std::lock_guard lock(mutex);
+                eraseReadIndexes(committed_request.session_id);
             }
 
-            applyRequest(committed_request);
-            committed_queue.pop();
+            applyCommittedRequest(std::move(committed_request));
         }
         /// Local requests
+        else if (unlikely(auth_request))
+        {
+            LOG_DEBUG(log, "Apply auth request {}", toHexString(committed_request.session_id));
+            applyCommittedRequest(std::move(committed_request));
+        }
         else
         {
-            if (unlikely(committed_request.request->getOpNum() == Coordination::OpNum::Auth))
-            {
-                LOG_DEBUG(log, "Apply auth request {}", toHexString(committed_request.session_id));
-                applyRequest(committed_request);
-                committed_queue.pop();
-            }
-            else
-            {
-                bool found_in_pending_queue;
-                if (!shouldProcessCommittedRequest(committed_request, found_in_pending_queue))
-                    break;
-
-                /// apply request
-                applyRequest(committed_request);
-                committed_queue.pop();
-                auto current_time = getCurrentTimeMilliseconds();
-                Metrics::getMetrics().update_latency->add(current_time - committed_request.create_time);
-
-                /// remove request from pending queue
-                auto & pending_requests_for_session = my_pending_requests[committed_request.session_id];
-                if (found_in_pending_queue)
-                    pending_requests_for_session.erase(pending_requests_for_session.begin());
-
-                if (pending_requests_for_session.empty())
-                    my_pending_requests.erase(committed_request.session_id);
-            }
+            /// Stages before commit are recorded in the local copy
+            if (found_in_pending_queue)
+                committed_request.request->timeline.merge(my_pending_requests.front(committed_request.session_id)->request->timeline);
+
+            auto session_id = committed_request.session_id;
+            auto create_time = committed_request.create_time;
+
+            /// apply request
+            applyCommittedRequest(std::move(committed_request));
+            auto current_time = getCurrentTimeMilliseconds();
+            Metrics::getMetrics().update_latency->add(current_time - create_time);
+
+            /// remove request from pending queue
+            if (found_in_pending_queue)
+                my_pending_requests.popFront(session_id);
         }
+
+        /// Close request is the last one of a session, it keeps its runner while there are requests pending
+        if (close_request && !my_pending_requests.contains(committed_session_id))
+            requests_queue->releaseSession(committed_session_id);
+        if (close_request)
+            eraseSeenZxid(committed_session_id);
     }
+
+    applyCommittedBatch();
 }
 
 void RequestProcessor::processErrorRequest(size_t count)
@@ -277,7 +323,7 @@ void RequestProcessor::processErrorRequest(size_t count)
         auto & error_request = error_requests.front();
         auto [session_id, xid] = error_request.getRequestId();
 
-        auto & my_pending_requests = pending_requests.find(getRunnerId(session_id))->second;
+        auto & my_pending_requests = pending_requests[getRunnerId(session_id)];
 
         if (unlikely(isSessionRequest(error_request.opnum)))
         {
@@ -299,8 +345,7 @@ void RequestProcessor::processErrorRequest(size_t count)
                 response = std::move(update_session_response);
             }
 
-            response->error = error_request.error_code == nuraft::cmd_result_code::TIMEOUT ? Coordination::Error::ZOPERATIONTIMEOUT
-                                                                                           : Coordination::Error::ZCONNECTIONLOSS;
+            response->error = error_request.getResponseError();
             /// TODO use real request creating time.
             response->request_created_time_ms = getCurrentTimeMilliseconds();
 
@@ -320,6 +365,7 @@ void RequestProcessor::processErrorRequest(size_t count)
                     "Just delete from pending queue.",
                     toHexString(session_id));
                 my_pending_requests.erase(session_id);
+                eraseReadIndexes(session_id);
             }
 
             LOG_WARNING(log, "Error request {} is not local", error_request.toString());
@@ -342,11 +388,11 @@ void RequestProcessor::processErrorRequest(size_t count)
                 response->zxid = 0;
                 response->request_created_time_ms = request->create_time;
 
-                response->error = error_request.error_code == nuraft::cmd_result_code::TIMEOUT ? Coordination::Error::ZOPERATIONTIMEOUT
-                                                                                               : Coordination::Error::ZCONNECTIONLOSS;
+                response->error = error_request.getResponseError();
 
                 responses_queue.push(ResponseForSession{session_id, response});
 
+                read_indexes.erase(error_request.getRequestId());
                 error_request_ids.erase(error_request.getRequestId());
                 error_requests.erase(error_requests.begin());
             }
@@ -386,77 +432,257 @@ std::optional<RequestForSession> RequestProcessor::findErrorRequest(const ErrorR
         return request;
     }
 
-    std::optional<RequestForSession> request;
+    return pending_requests[getRunnerId(session_id)].extract(
+        session_id,
+        [&](const RequestForSession & request)
+        {
+            LOG_TRACE(log, "Try match {}", request.toSimpleString());
+            bool matched = request.request->xid == xid
+                || (request.request->getOpNum() == Coordination::OpNum::Close && error_request.opnum == Coordination::OpNum::Close);
+            if (matched)
+                LOG_WARNING(log, "Matched error request {} in pending queue", request.toSimpleString());
+            return matched;
+        });
+}
 
-    auto & my_pending_requests = pending_requests.find(getRunnerId(session_id))->second;
-    auto session_requests = my_pending_requests.find(session_id);
+void RequestProcessor::processReadRequests(RunnerId runner_id)
+{
+    /// There is no write while processing, identical get requests of the round share one lookup.
+    KeeperStore::GetResponseCache get_response_cache;
 
-    if (session_requests != my_pending_requests.end())
-    {
-        auto & requests = session_requests->second;
-        for (auto request_it = requests.begin(); request_it != requests.end();)
-        {
-            LOG_TRACE(log, "Try match {}", request_it->toSimpleString());
+    /// Nodes are read without reference, the runner is a reader of the epoch for them
+    EpochGuard epoch_guard(server->getKeeperStateMachine()->getStore().getEpochManager(), runner_id);
 
-            if (request_it->request->xid == xid
-                || (request_it->request->getOpNum() == Coordination::OpNum::Close && error_request.opnum == Coordination::OpNum::Close))
+    bool too_stale = !linearizable_read && isTooStaleToRead();
+
+    /// process every session, until encountered write request. Sessions take turns by fair_queue_quantum requests.
+    pending_requests[runner_id].popFrontFair(
+        fair_queue_quantum,
+        [this, &get_response_cache, too_stale](const RequestForSession & session_request)
+        {
+            if (!isLocalRequest(session_request))
+                return false;
+            bool joined_sync = !isReadRequest(session_request.request);
+            /// Read only sessions exist only while there is no leader
+            if (too_stale && !session_request.read_only_session)
             {
-                LOG_WARNING(log, "Matched error request {} in pending queue", request_it->toSimpleString());
-                request = *request_it;
-                requests.erase(request_it);
-                break;
+                failStaleRead(session_request);
+                return true;
             }
-            else
+            if (read_lag_exceeded && !session_request.allow_stale_read)
             {
-                ++request_it;
+                /// Wait at the head of session for the node to catch up
+                UInt64 deadline = static_cast<UInt64>(session_request.create_time) + operation_timeout_ms;
+                if (!redirect_stale_reads && getCurrentTimeMilliseconds() < deadline)
+                    return false;
+                failStaleRead(session_request);
+                return true;
             }
-        }
+            /// Hold at the head of session until the zxid seen by the client is applied, without Raft traffic
+            bool seen_zxid_expired = false;
+            if (isWaitingForSeenZxid(session_request, seen_zxid_expired))
+            {
+                if (!seen_zxid_expired)
+                    return false;
+                failStaleRead(session_request);
+                return true;
+            }
+            if ((linearizable_read || joined_sync) && !session_request.read_only_session && !isReadIndexApplied(session_request))
+                return false;
+
+            applyRequest(session_request, &get_response_cache);
+            auto current_time = getCurrentTimeMilliseconds();
+            Metrics::getMetrics().read_latency->add(current_time - session_request.create_time);
+            return true;
+        });
+}
+
+bool RequestProcessor::hasPendingReadRequest(RunnerId runner_id) const
+{
+    return pending_requests[runner_id].anyFront([this](const RequestForSession & request) { return isLocalRequest(request); });
+}
+
+bool RequestProcessor::isLocalRequest(const RequestForSession & request) const
+{
+    if (isReadRequest(request.request))
+        return true;
+    if (request.request->getOpNum() != Coordination::OpNum::Sync)
+        return false;
+
+    std::lock_guard lock(mutex);
+    return read_indexes.contains(request.getRequestId());
+}
+
+bool RequestProcessor::isReadIndexApplied(const RequestForSession & request)
+{
+    std::lock_guard lock(mutex);
+    auto it = read_indexes.find(request.getRequestId());
+    if (it == read_indexes.end() || it->second > applied_log_idx)
+        return false;
+
+    read_indexes.erase(it);
+    return true;
+}
+
+bool RequestProcessor::isWaitingForSeenZxid(const RequestForSession & request, bool & expired)
+{
+    if (!has_seen_zxids.load(std::memory_order_relaxed))
+        return false;
+
+    std::lock_guard lock(mutex);
+    auto it = seen_zxids.find(request.session_id);
+    if (it == seen_zxids.end())
+        return false;
+
+    auto [seen_zxid, deadline] = it->second;
+    if (server->getKeeperStateMachine()->getLastProcessedZxid() >= seen_zxid)
+    {
+        seen_zxids.erase(it);
+        has_seen_zxids = !seen_zxids.empty();
+        return false;
     }
 
-    return request;
+    /// Kept until the session is closed, so that no read of it goes back in time
+    expired = getCurrentTimeMilliseconds() >= deadline;
+    if (expired)
+        LOG_DEBUG(log, "Session {} waited too long for zxid {}, fail read requests", toHexString(request.session_id), seen_zxid);
+    return true;
 }
 
-void RequestProcessor::processReadRequests(RunnerId runner_id)
+void RequestProcessor::waitForSeenZxid(int64_t session_id, int64_t zxid)
+{
+    LOG_DEBUG(log, "Reads of session {} wait for zxid {}", toHexString(session_id), zxid);
+    std::lock_guard lock(mutex);
+    seen_zxids[session_id] = {zxid, getCurrentTimeMilliseconds() + seen_zxid_wait_ms};
+    has_seen_zxids = true;
+}
+
+void RequestProcessor::eraseSeenZxid(int64_t session_id)
 {
-    auto & thread_requests = pending_requests.find(runner_id)->second;
+    if (!has_seen_zxids.load(std::memory_order_relaxed))
+        return;
+
+    std::lock_guard lock(mutex);
+    seen_zxids.erase(session_id);
+    has_seen_zxids = !seen_zxids.empty();
+}
+
+void RequestProcessor::eraseReadIndexes(int64_t session_id)
+{
+    std::erase_if(read_indexes, [session_id](const auto & read_index) { return read_index.first.session_id == session_id; });
+}
 
-    /// process every session, until encountered write request
-    for (auto it = thread_requests.begin(); it != thread_requests.end();)
+bool RequestProcessor::isTooStaleToRead() const
+{
+    if (!observer_max_staleness_ms || !server->isObserver())
+        return false;
+
+    UInt64 age_ms = server->getLeaderContactAgeMs();
+    if (age_ms <= observer_max_staleness_ms)
+        return false;
+
+    LOG_DEBUG(log, "Not heard from leader for {}ms, fail read requests", age_ms);
+    return true;
+}
+
+void RequestProcessor::updateReadLag()
+{
+    if ((!max_read_lag_entries && !max_read_lag_ms) || linearizable_read)
+        return;
+
+    if (server->isLeader())
     {
-        auto & session_requests = it->second;
-        for (auto session_request = session_requests.begin(); session_request != session_requests.end();)
-        {
-            /// read request
-            if (session_request->request->isReadRequest())
-            {
-                applyRequest(*session_request);
-                auto current_time = getCurrentTimeMilliseconds();
-                Metrics::getMetrics().read_latency->add(current_time - session_request->create_time);
-                session_request = session_requests.erase(session_request);
-            }
-            else
-            {
-                break;
-            }
-        }
+        read_lag_exceeded = false;
+        return;
+    }
 
-        if (session_requests.empty())
-            it = thread_requests.erase(it);
-        else
-            ++it;
+    UInt64 now = getCurrentTimeMilliseconds();
+    UInt64 leader_committed_idx = server->getLeaderCommittedLogIdx();
+    UInt64 lag_entries = leader_committed_idx > applied_log_idx ? leader_committed_idx - applied_log_idx : 0;
+
+    /// Catching up the target, the next target is what leader has committed by now
+    if (applied_log_idx >= lag_target_idx)
+    {
+        lag_target_idx = leader_committed_idx;
+        lag_target_time_ms = now;
+    }
+    UInt64 lag_ms = applied_log_idx >= lag_target_idx ? 0 : now - lag_target_time_ms;
+    /// Committed log index of leader is not known beyond the last contact
+    lag_ms = std::max(lag_ms, server->getLeaderContactAgeMs());
+
+    bool exceeded = (max_read_lag_entries && lag_entries > max_read_lag_entries) || (max_read_lag_ms && lag_ms > max_read_lag_ms);
+    if (exceeded != read_lag_exceeded)
+        LOG_INFO(
+            log,
+            "Applied log {} lags {} entries and {}ms behind leader, {} bounded reads",
+            applied_log_idx,
+            lag_entries,
+            lag_ms,
+            exceeded ? (redirect_stale_reads ? "redirect" : "hold") : "serve");
+    read_lag_exceeded = exceeded;
+}
+
+void RequestProcessor::failStaleRead(const RequestForSession & request)
+{
+    ZooKeeperResponsePtr response = request.request->makeResponse();
+    response->xid = request.request->xid;
+    response->zxid = 0;
+    response->request_created_time_ms = request.create_time;
+    response->error = Coordination::Error::ZCONNECTIONLOSS;
+    responses_queue.push(ResponseForSession{request.session_id, response});
+}
+
+void RequestProcessor::processReadRequestsInParallel()
+{
+    for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
+        moveRequestToPendingQueue(runner_id);
+
+    /// Runners touch only their own pending requests, and read requests do not modify data tree.
+    size_t scheduled = 0;
+    RunnerId last_runner = 0;
+    for (RunnerId runner_id = 0; runner_id < parallel; runner_id++)
+    {
+        if (!hasPendingReadRequest(runner_id))
+            continue;
+
+        /// Process the last one in the current thread
+        if (scheduled++)
+            thread_pool->scheduleOrThrowOnError([this, runner = last_runner] { processReadRequests(runner); });
+        last_runner = runner_id;
     }
+
+    if (scheduled)
+        processReadRequests(last_runner);
+    thread_pool->wait();
 }
 
-void RequestProcessor::applyRequest(const RequestForSession & request) const
+void RequestProcessor::applyRequest(const RequestForSession & request, KeeperStore::GetResponseCache * get_response_cache) const
 {
     LOG_TRACE(log, "Apply request {}", request.toSimpleString());
+    OpCostMetrics::Scope cost_scope(request.request->getOpNum(), OpCostMetrics::ThreadKind::PROCESSOR);
+
+    /// Committed sync requests, for example written before linearizable_read is enabled, go to store as before.
+    /// Sync requests not committed are the ones joined a sync round.
+    bool is_read_request
+        = !request.log_idx && (isReadRequest(request.request) || request.request->getOpNum() == Coordination::OpNum::Sync);
     try
     {
-        if (request.request->isReadRequest())
+        if (is_read_request)
         {
-            if (server->isLeaderAlive())
+            if (server->isLeaderAlive() && request.request->getOpNum() == Coordination::OpNum::Sync)
             {
-                server->getKeeperStateMachine()->getStore().processRequest(responses_queue, request);
+                /// Read index is applied, nothing to do in store
+                auto response = request.request->makeResponse();
+                static_cast<Coordination::ZooKeeperSyncResponse &>(*response).path
+                    = static_cast<Coordination::ZooKeeperSyncRequest &>(*request.request).path;
+                response->request_created_time_ms = request.create_time;
+                response->xid = request.request->xid;
+                response->zxid = server->getKeeperStateMachine()->getStore().getZxid();
+                responses_queue.push(ResponseForSession{request.session_id, response});
+            }
+            else if (server->isLeaderAlive())
+            {
+                server->getKeeperStateMachine()->getStore().processRequest(responses_queue, request, {}, true, false, get_response_cache);
             }
             else
             {
@@ -480,7 +706,7 @@ void RequestProcessor::applyRequest(const RequestForSession & request) const
     catch (...)
     {
         tryLogCurrentException(log, fmt::format("Fail to apply request {}.", request.request->toString()));
-        if (!request.request->isReadRequest())
+        if (!is_read_request)
         {
             LOG_FATAL(log, "Fail to apply committed(write) request which will lead state machine inconsistency, system will exist.");
             systemExist();
@@ -488,6 +714,35 @@ void RequestProcessor::applyRequest(const RequestForSession & request) const
     }
 }
 
+void RequestProcessor::applyCommittedRequest(RequestForSession request)
+{
+    if (parallel_apply)
+        committed_batch.push_back(std::move(request));
+    else
+        applyRequest(request);
+}
+
+void RequestProcessor::applyCommittedBatch()
+{
+    if (committed_batch.empty())
+        return;
+
+    LOG_TRACE(log, "Apply {} committed(write) requests", committed_batch.size());
+    try
+    {
+        if (!server->isLeaderAlive())
+            LOG_WARNING(log, "Write request is committed, when try to apply it to store the leader is not alive.");
+        server->getKeeperStateMachine()->getStore().processRequests(responses_queue, committed_batch, *thread_pool);
+    }
+    catch (...)
+    {
+        tryLogCurrentException(log, fmt::format("Fail to apply {} committed(write) requests.", committed_batch.size()));
+        LOG_FATAL(log, "Fail to apply committed(write) request which will lead state machine inconsistency, system will exist.");
+        systemExist();
+    }
+    committed_batch.clear();
+}
+
 void RequestProcessor::shutdown()
 {
     if (shutdown_called)
@@ -521,22 +776,28 @@ void RequestProcessor::commit(RequestForSession request)
 {
     if (!shutdown_called)
     {
-        committed_queue.push(request);
+        request.request->timeline.end(RequestStage::COMMIT);
+        LOG_DEBUG(log, "Commit {}, committed queue size is {}", request.toSimpleString(), committed_queue.size());
+        committed_queue.push(std::move(request));
         {
             std::unique_lock lk(mutex);
             cv.notify_all();
         }
-        LOG_DEBUG(log, "Commit {}, now committed queue size is {}", request.toSimpleString(), committed_queue.size());
     }
 }
 
 void RequestProcessor::onError(
-    bool accepted, nuraft::cmd_result_code error_code, int64_t session_id, Coordination::XID xid, Coordination::OpNum opnum)
+    bool accepted,
+    nuraft::cmd_result_code error_code,
+    int64_t session_id,
+    Coordination::XID xid,
+    Coordination::OpNum opnum,
+    Coordination::Error response_error)
 {
     if (!shutdown_called)
     {
         RequestId id{session_id, xid};
-        ErrorRequest error_request{accepted, error_code, session_id, xid, opnum};
+        ErrorRequest error_request{accepted, error_code, session_id, xid, opnum, response_error};
 
         LOG_WARNING(log, "Found error request {}", error_request.toString());
         {
@@ -548,20 +809,78 @@ void RequestProcessor::onError(
     }
 }
 
+void RequestProcessor::onReadIndex(int64_t session_id, Coordination::XID xid, UInt64 read_index)
+{
+    if (!shutdown_called)
+    {
+        LOG_TRACE(log, "Got read index {} for request #{}#{}", read_index, toHexString(session_id), xid);
+        {
+            std::unique_lock lock(mutex);
+            read_indexes[RequestId{session_id, xid}] = read_index;
+        }
+        cv.notify_all();
+    }
+}
+
+void RequestProcessor::onSyncJoined(int64_t session_id, Coordination::XID xid)
+{
+    if (!shutdown_called)
+    {
+        LOG_TRACE(log, "Sync request #{}#{} joined a sync round", toHexString(session_id), xid);
+        std::unique_lock lock(mutex);
+        read_indexes.emplace(RequestId{session_id, xid}, std::numeric_limits<UInt64>::max());
+    }
+}
+
 void RequestProcessor::initialize(
     size_t parallel_,
     std::shared_ptr<KeeperServer> server_,
     std::shared_ptr<KeeperDispatcher> keeper_dispatcher_,
-    UInt64 operation_timeout_ms_)
+    UInt64 operation_timeout_ms_,
+    bool parallel_read_,
+    bool parallel_apply_,
+    bool linearizable_read_,
+    UInt64 observer_max_staleness_ms_,
+    UInt64 max_read_lag_entries_,
+    UInt64 max_read_lag_ms_,
+    bool redirect_stale_reads_,
+    UInt64 seen_zxid_wait_ms_,
+    size_t requests_queue_capacity_,
+    size_t committed_queue_capacity_,
+    bool least_loaded_placement_,
+    size_t fair_queue_quantum_)
 {
     operation_timeout_ms = operation_timeout_ms_;
     parallel = parallel_;
     server = server_;
     keeper_dispatcher = keeper_dispatcher_;
-    requests_queue = std::make_shared<RequestsQueue>(parallel, 20000);
-    for (size_t runner_id = 0; runner_id < parallel; runner_id++)
-        pending_requests.emplace(runner_id, std::unordered_map<int64_t, std::vector<RequestForSession>>());
+    /// Runners are looked up by committed requests after their requests are popped, sessions are released by them
+    requests_queue = std::make_shared<RequestsQueue>(
+        parallel, requests_queue_capacity_, RequestsQueue::DEFAULT_CONTROL_REQUESTS_WEIGHT, least_loaded_placement_, false);
+    committed_queue_capacity = std::max(committed_queue_capacity_, size_t(1));
+    pending_requests.resize(parallel);
+    popped_requests.resize(parallel);
+    parallel_read = parallel_read_ && parallel > 1;
+    parallel_apply = parallel_apply_ && parallel > 1;
+    linearizable_read = linearizable_read_;
+    observer_max_staleness_ms = observer_max_staleness_ms_;
+    max_read_lag_entries = max_read_lag_entries_;
+    max_read_lag_ms = max_read_lag_ms_;
+    redirect_stale_reads = redirect_stale_reads_;
+    seen_zxid_wait_ms = seen_zxid_wait_ms_;
+    fair_queue_quantum = fair_queue_quantum_;
+    if (parallel_read || parallel_apply)
+        thread_pool = std::make_unique<ThreadPool>(parallel - 1);
+    /// Runners of parallel reads are the readers of epochs
+    if (parallel_read)
+        server->getKeeperStateMachine()->getStore().enableEpochReclamation(parallel);
     main_thread = ThreadFromGlobalPool([this] { run(); });
 }
 
+std::pair<size_t, size_t> RequestProcessor::setQueueCapacities(size_t requests_queue_capacity_, size_t committed_queue_capacity_)
+{
+    committed_queue_capacity = std::max(committed_queue_capacity_, size_t(1));
+    return {requests_queue->setCapacity(requests_queue_capacity_), committed_queue_capacity.load()};
+}
+
 }
@@ -2,8 +2,11 @@
 
 #include <Service/KeeperCommon.h>
 #include <Service/KeeperServer.h>
+#include <Service/PendingRequests.h>
 #include <Service/RequestsQueue.h>
 #include <ZooKeeper/ZooKeeperConstants.h>
+#include <Common/ThreadPool.h>
+#include <Common/UnboundedSPSCQueue.h>
 
 namespace RK
 {
@@ -15,27 +18,74 @@ class KeeperDispatcher;
 class RequestProcessor
 {
 public:
+    static constexpr size_t DEFAULT_REQUESTS_QUEUE_CAPACITY = 20000;
+    static constexpr size_t DEFAULT_COMMITTED_QUEUE_CAPACITY = 1024;
+
     explicit RequestProcessor(KeeperResponsesQueue & responses_queue_)
         : responses_queue(responses_queue_), log(&Poco::Logger::get("RequestProcessor"))
     {
     }
 
-    void push(const RequestForSession & request_for_session);
+    void push(RequestForSession request_for_session);
 
     void shutdown();
 
     void commit(RequestForSession request);
 
-    /// Invoked when fail to forward request to leader or append entry.
-    void onError(bool accepted, nuraft::cmd_result_code error_code, int64_t session_id, Coordination::XID xid, Coordination::OpNum opnum);
+    /// Invoked when fail to forward request to leader or append entry, or the node rejects the request with response_error.
+    void onError(
+        bool accepted,
+        nuraft::cmd_result_code error_code,
+        int64_t session_id,
+        Coordination::XID xid,
+        Coordination::OpNum opnum,
+        Coordination::Error response_error = Coordination::Error::ZOK);
+
+    /// Invoked when got read index of a linearizable read or a joined sync, it is processed after read index is applied.
+    void onReadIndex(int64_t session_id, Coordination::XID xid, UInt64 read_index);
+
+    /// Invoked when a sync request joins the sync round of another one rather than going through Raft log,
+    /// it is answered as a linearizable read after onReadIndex of it.
+    void onSyncJoined(int64_t session_id, Coordination::XID xid);
+
+    /// Invoked when a session is created for a client which has seen zxid not applied yet, its reads wait for the zxid
+    /// to be applied for seen_zxid_wait_ms and fail after that.
+    void waitForSeenZxid(int64_t session_id, int64_t zxid);
+    /// Drop the zxid the session waits for, invoked when it is closed.
+    void eraseSeenZxid(int64_t session_id);
+
+    /// Whether the request is processed locally without Raft log. Sync request is if linearizable_read is enabled.
+    bool isReadRequest(const Coordination::ZooKeeperRequestPtr & request) const
+    {
+        return request->isReadRequest() || (linearizable_read && request->getOpNum() == Coordination::OpNum::Sync);
+    }
 
     void initialize(
         size_t parallel_,
         std::shared_ptr<KeeperServer> server_,
         std::shared_ptr<KeeperDispatcher> keeper_dispatcher_,
-        UInt64 operation_timeout_ms_);
-
-    size_t commitQueueSize() { return committed_queue.size(); }
+        UInt64 operation_timeout_ms_,
+        bool parallel_read_ = false,
+        bool parallel_apply_ = false,
+        bool linearizable_read_ = false,
+        UInt64 observer_max_staleness_ms_ = 0,
+        UInt64 max_read_lag_entries_ = 0,
+        UInt64 max_read_lag_ms_ = 0,
+        bool redirect_stale_reads_ = false,
+        UInt64 seen_zxid_wait_ms_ = 0,
+        size_t requests_queue_capacity_ = DEFAULT_REQUESTS_QUEUE_CAPACITY,
+        size_t committed_queue_capacity_ = DEFAULT_COMMITTED_QUEUE_CAPACITY,
+        bool least_loaded_placement_ = false,
+        size_t fair_queue_quantum_ = 0);
+
+    /// Change capacities of the queues at runtime, the one of requests_queue up to the one initialized with.
+    /// Returns the capacities applied.
+    std::pair<size_t, size_t> setQueueCapacities(size_t requests_queue_capacity_, size_t committed_queue_capacity_);
+
+    size_t commitQueueSize() const { return committed_queue.size(); }
+    size_t getCommitQueueBufferSizeInBytes() const { return committed_queue.getBufferSizeInBytes(); }
+    /// Whether committed requests not applied reach committed_queue_capacity, leader holds new batches back then
+    bool isCommitQueueFull() const { return commitQueueSize() >= committed_queue_capacity.load(std::memory_order_relaxed); }
 
 private:
     void run();
@@ -45,12 +95,35 @@ private:
     void moveRequestToPendingQueue(RunnerId runner_id);
 
     void processReadRequests(RunnerId runner_id);
+    /// Process read requests of all runners on thread_pool, there is no write during it,
+    /// so all of them see the same data tree.
+    void processReadRequestsInParallel();
+    bool hasPendingReadRequest(RunnerId runner_id) const;
+    /// Whether the pending request is processed locally, which a sync request joined a sync round also is.
+    bool isLocalRequest(const RequestForSession & request) const;
+    /// Whether read index of the linearizable read is applied, read index is dropped if it is.
+    bool isReadIndexApplied(const RequestForSession & request);
+    /// Whether reads of the session wait for the zxid its client has seen, expired is set if they waited too long.
+    bool isWaitingForSeenZxid(const RequestForSession & request, bool & expired);
+    /// Drop read indexes of the session, caller should hold mutex.
+    void eraseReadIndexes(int64_t session_id);
+    /// Whether the node is an observer not hearing from leader for observer_max_staleness_ms
+    bool isTooStaleToRead() const;
+    /// Answer a read with connection loss rather than stale data, so that the client goes to another node
+    void failStaleRead(const RequestForSession & request);
+    /// Update read_lag_exceeded by applied log against the committed log of leader, invoked before processing reads
+    void updateReadLag();
     void processErrorRequest(size_t count);
     void processCommittedRequest(size_t count);
 
-    /// Apply request to state machine
-    void applyRequest(const RequestForSession & request) const;
-    size_t getRunnerId(int64_t session_id) const { return session_id % parallel; }
+    /// Apply request to state machine, get requests are coalesced in get_response_cache if it is given.
+    void applyRequest(const RequestForSession & request, KeeperStore::GetResponseCache * get_response_cache = nullptr) const;
+    /// Apply committed(write) request, it is deferred to applyCommittedBatch if parallel_apply is enabled.
+    void applyCommittedRequest(RequestForSession request);
+    /// Apply deferred committed(write) requests in parallel
+    void applyCommittedBatch();
+    /// Runner of the session is its child queue in requests_queue, where its pending requests are
+    size_t getRunnerId(int64_t session_id) const { return requests_queue->getAssignedQueueId(session_id); }
 
     /// Find error request in pending request queue
     std::optional<RequestForSession> findErrorRequest(const ErrorRequest & error_request);
@@ -73,12 +146,16 @@ private:
     /// Local requests
     ptr<RequestsQueue> requests_queue;
 
-    /// <runner_id, <session_id, requests>>
-    /// Requests from `requests_queue` grouped by session
-    std::unordered_map<size_t, std::unordered_map<int64_t, RequestForSessions>> pending_requests;
+    /// Requests from `requests_queue` grouped by session, indexed by runner id
+    std::vector<PendingRequests> pending_requests;
+    /// Buffers for moving requests from `requests_queue` to pending_requests, indexed by runner id
+    std::vector<RequestForSessions> popped_requests;
 
-    /// Raft committed write requests which can be local or from other nodes.
-    ConcurrentBoundedQueue<RequestForSession> committed_queue{1000};
+    /// Raft committed write requests which can be local or from other nodes. The commit thread of NuRaft is the
+    /// producer and main thread the consumer, commit never waits for the queue, so a slow processor does not stall
+    /// Raft. The queue is bounded by the leader instead, which does not append while it is full.
+    UnboundedSPSCQueue<RequestForSession> committed_queue;
+    std::atomic<size_t> committed_queue_capacity{DEFAULT_COMMITTED_QUEUE_CAPACITY};
 
     size_t parallel;
 
@@ -95,6 +172,40 @@ private:
     Poco::Logger * log;
 
     UInt64 operation_timeout_ms = 10000;
+
+    bool parallel_read{false};
+    bool parallel_apply{false};
+    bool linearizable_read{false};
+    /// Linearizable reads are never stale and are not bounded by them
+    UInt64 observer_max_staleness_ms{0};
+    UInt64 max_read_lag_entries{0};
+    UInt64 max_read_lag_ms{0};
+    bool redirect_stale_reads{false};
+    UInt64 seen_zxid_wait_ms{0};
+    /// Read requests of a session processed before other sessions of the runner take a turn, 0 means no limit
+    size_t fair_queue_quantum{0};
+
+    /// Whether reads wait or fail for max_read_lag_entries or max_read_lag_ms, only used by main thread.
+    bool read_lag_exceeded{false};
+    /// Committed log index of leader seen at lag_target_time_ms but not applied yet, lag in time is since then.
+    UInt64 lag_target_idx{0};
+    UInt64 lag_target_time_ms{0};
+
+    /// Read index of linearizable reads and joined sync requests, the one of a sync is the max value until its round is
+    /// committed. Guarded by mutex.
+    std::unordered_map<RequestId, UInt64, RequestId::RequestIdHash> read_indexes;
+    /// Zxid seen by clients of sessions and the deadline of waiting for it, guarded by mutex. The flag tells readers
+    /// whether there is any without locking.
+    std::unordered_map<int64_t, std::pair<int64_t, UInt64>> seen_zxids;
+    std::atomic<bool> has_seen_zxids{false};
+    /// Raft logs up to it are applied to state machine, updated only when no read request is being processed.
+    UInt64 applied_log_idx{0};
+
+    /// Not empty if parallel_read or parallel_apply is enabled
+    std::unique_ptr<ThreadPool> thread_pool;
+
+    /// Committed(write) requests deferred in processCommittedRequest
+    RequestForSessions committed_batch;
 };
 
 }
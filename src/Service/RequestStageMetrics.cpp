@@ -0,0 +1,86 @@
+#include <Service/RequestStageMetrics.h>
+
+#include <Common/IO/WriteHelpers.h>
+#include <Service/Metrics.h>
+#include <fmt/format.h>
+
+namespace RK
+{
+
+RequestStageMetrics::~RequestStageMetrics()
+{
+    for (auto & op_histograms : histograms)
+        for (auto & histogram : op_histograms)
+            delete histogram.load();
+}
+
+std::optional<size_t> RequestStageMetrics::indexOf(Coordination::OpNum op_num)
+{
+    for (size_t i = 0; i < OP_NUMS.size(); ++i)
+        if (OP_NUMS[i] == op_num)
+            return i;
+    return {};
+}
+
+void RequestStageMetrics::record(Coordination::OpNum op_num, const RequestTimeline & timeline)
+{
+    auto index = indexOf(op_num);
+    if (!index || !timeline.started())
+        return;
+
+    auto durations = timeline.durations();
+    for (size_t stage = 0; stage < RequestTimeline::STAGES; ++stage)
+    {
+        if (!timeline.passed(static_cast<RequestStage>(stage)))
+            continue;
+
+        auto & histogram = histograms[*index][stage];
+        LogLinearHistogram * current = histogram.load(std::memory_order_acquire);
+        if (!current)
+        {
+            auto * created = new LogLinearHistogram(SHARDS);
+            if (histogram.compare_exchange_strong(current, created, std::memory_order_acq_rel))
+                current = created;
+            else
+                delete created;
+        }
+        current->add(durations[stage]);
+    }
+}
+
+const LogLinearHistogram * RequestStageMetrics::getHistogram(RequestStage stage, Coordination::OpNum op_num) const
+{
+    auto index = indexOf(op_num);
+    if (!index)
+        return nullptr;
+    return histograms[*index][static_cast<size_t>(stage)].load(std::memory_order_acquire);
+}
+
+void RequestStageMetrics::writePrometheus(WriteBuffer & out, const String & prefix) const
+{
+    String metric = prefix + "request_stage_time_us";
+    writeString(fmt::format("# TYPE {} histogram\n", metric), out);
+
+    for (size_t op = 0; op < OP_NUMS.size(); ++op)
+    {
+        for (size_t stage = 0; stage < RequestTimeline::STAGES; ++stage)
+        {
+            const auto * histogram = histograms[op][stage].load(std::memory_order_acquire);
+            if (!histogram)
+                continue;
+            String labels = fmt::format(
+                "stage=\"{}\",op=\"{}\"", toString(static_cast<RequestStage>(stage)), Coordination::toString(OP_NUMS[op]));
+            writePrometheusHistogram(out, metric, labels, histogram->getSnapshot());
+        }
+    }
+}
+
+void RequestStageMetrics::reset()
+{
+    for (auto & op_histograms : histograms)
+        for (auto & histogram : op_histograms)
+            if (auto * current = histogram.load(std::memory_order_acquire))
+                current->reset();
+}
+
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <optional>
+
+#include <Common/IO/WriteBuffer.h>
+#include <Common/LogLinearHistogram.h>
+#include <Common/RequestTimeline.h>
+#include <ZooKeeper/ZooKeeperConstants.h>
+
+namespace RK
+{
+
+/** Histograms of durations in microseconds of request stages by stage and operation, they tell whether latency comes
+  * from disk, replication or apply. Requests are recorded when their responses are sent to clients. A histogram is
+  * created when the first request of its operation passes the stage, with few shards, for there are many of them.
+  */
+class RequestStageMetrics
+{
+public:
+    static RequestStageMetrics & instance()
+    {
+        static RequestStageMetrics metrics;
+        return metrics;
+    }
+
+    ~RequestStageMetrics();
+
+    void record(Coordination::OpNum op_num, const RequestTimeline & timeline);
+
+    /// Histogram of stage and operation, nullptr if none is recorded
+    const LogLinearHistogram * getHistogram(RequestStage stage, Coordination::OpNum op_num) const;
+
+    /// As one histogram metric with labels of stage and op
+    void writePrometheus(WriteBuffer & out, const String & prefix) const;
+
+    void reset();
+
+    static constexpr size_t SHARDS = 4;
+
+    /// Operations of clients, others are not recorded, also the ones of OpCostMetrics
+    static constexpr std::array OP_NUMS{
+        Coordination::OpNum::Close,
+        Coordination::OpNum::Create,
+        Coordination::OpNum::Create2,
+        Coordination::OpNum::CreateContainer,
+        Coordination::OpNum::CreateTTL,
+        Coordination::OpNum::Remove,
+        Coordination::OpNum::Exists,
+        Coordination::OpNum::Get,
+        Coordination::OpNum::Set,
+        Coordination::OpNum::GetACL,
+        Coordination::OpNum::SetACL,
+        Coordination::OpNum::SimpleList,
+        Coordination::OpNum::Sync,
+        Coordination::OpNum::Heartbeat,
+        Coordination::OpNum::List,
+        Coordination::OpNum::Check,
+        Coordination::OpNum::Multi,
+        Coordination::OpNum::MultiRead,
+        Coordination::OpNum::Auth,
+        Coordination::OpNum::SetWatches,
+        Coordination::OpNum::SetWatches2,
+        Coordination::OpNum::AddWatch,
+        Coordination::OpNum::FilteredList,
+        Coordination::OpNum::ListWithData,
+        Coordination::OpNum::PagedList,
+        Coordination::OpNum::StatBatch,
+        Coordination::OpNum::RemoveRecursive,
+    };
+
+    /// Index of op_num in OP_NUMS
+    static std::optional<size_t> indexOf(Coordination::OpNum op_num);
+
+private:
+    RequestStageMetrics() = default;
+
+    std::array<std::array<std::atomic<LogLinearHistogram *>, RequestTimeline::STAGES>, OP_NUMS.size()> histograms{};
+};
+
+}
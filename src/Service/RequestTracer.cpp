@@ -0,0 +1,330 @@
+#include <Service/RequestTracer.h>
+
+#include <chrono>
+#include <fcntl.h>
+#include <limits>
+
+#include <Common/Exception.h>
+#include <Common/hex.h>
+#include <Common/setThreadName.h>
+#include <Common/thread_local_rng.h>
+#include <Service/formatHex.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int INVALID_CONFIG_PARAMETER;
+}
+
+namespace
+{
+
+/// Ids of traces and spans are never 0, which means none
+UInt64 randomId()
+{
+    UInt64 id = thread_local_rng();
+    return id ? id : 1;
+}
+
+UInt64 unixTimeMicroseconds()
+{
+    using namespace std::chrono;
+    return static_cast<UInt64>(duration_cast<microseconds>(system_clock::now().time_since_epoch()).count());
+}
+
+void writeJSONString(const String & value, String & out)
+{
+    out += '"';
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+            out += fmt::format("\\u{:04x}", static_cast<int>(c));
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+void writeJSONAttributes(const std::vector<std::pair<String, String>> & attributes, String & out)
+{
+    out += "[";
+    for (size_t i = 0; i < attributes.size(); ++i)
+    {
+        if (i)
+            out += ',';
+        out += "{\"key\":";
+        writeJSONString(attributes[i].first, out);
+        out += ",\"value\":{\"stringValue\":";
+        writeJSONString(attributes[i].second, out);
+        out += "}}";
+    }
+    out += "]";
+}
+
+}
+
+RequestTracer & RequestTracer::instance()
+{
+    static RequestTracer tracer;
+    return tracer;
+}
+
+void RequestTracer::initialize(const Poco::Util::AbstractConfiguration & config, int32_t my_id)
+{
+    bool enabled_ = config.getBool("keeper.tracing.enabled", false);
+    String file = config.getString("keeper.tracing.file", "");
+    if (enabled_ && file.empty())
+        throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.tracing.file must be set if tracing is enabled");
+
+    double sample_probability = config.getDouble("keeper.tracing.sample_probability", DEFAULT_SAMPLE_PROBABILITY);
+    if (sample_probability < 0 || sample_probability > 1)
+        throw Exception(
+            ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.tracing.sample_probability must be in [0, 1], got {}", sample_probability);
+
+    initialize(
+        enabled_,
+        sample_probability,
+        file,
+        config.getUInt64("keeper.tracing.flush_interval_ms", DEFAULT_FLUSH_INTERVAL_MS),
+        config.getUInt64("keeper.tracing.max_pending_spans", DEFAULT_MAX_PENDING_SPANS),
+        std::to_string(my_id));
+
+    if (isEnabled())
+        LOG_INFO(&Poco::Logger::get("RequestTracer"), "Tracing {} of requests to {}", sample_probability, file);
+}
+
+void RequestTracer::initialize(
+    bool enabled_, double sample_probability, const String & file, UInt64 flush_interval_ms_, size_t max_pending_spans_,
+    const String & instance_id_)
+{
+    shutdown();
+
+    std::lock_guard lock(mutex);
+    pending_spans.clear();
+    dropped_spans.store(0, std::memory_order_relaxed);
+    max_pending_spans = max_pending_spans_;
+    flush_interval_ms = std::max(flush_interval_ms_, UInt64(1));
+    instance_id = instance_id_;
+    shutdown_called = false;
+
+    /// 2^64 does not fit, probability 1 samples all but one of 2^64 requests
+    UInt64 threshold = sample_probability >= 1 ? std::numeric_limits<UInt64>::max()
+                                               : static_cast<UInt64>(sample_probability * 18446744073709551616.0);
+    sample_threshold.store(threshold, std::memory_order_relaxed);
+
+    if (enabled_ && !file.empty())
+    {
+        out = std::make_unique<WriteBufferFromFile>(file, DEFAULT_BUFFER_SIZE, O_WRONLY | O_APPEND | O_CREAT);
+        export_thread = ThreadFromGlobalPool([this] { exportThread(); });
+    }
+    enabled.store(enabled_, std::memory_order_relaxed);
+}
+
+void RequestTracer::trySample(RequestTimeline & timeline)
+{
+    if (!enabled.load(std::memory_order_relaxed) || thread_local_rng() >= sample_threshold.load(std::memory_order_relaxed))
+        return;
+
+    timeline.trace.trace_id_high = randomId();
+    timeline.trace.trace_id_low = randomId();
+    timeline.trace.span_id = randomId();
+    timeline.trace.parent_span_id = 0;
+}
+
+void RequestTracer::startRemote(RequestTimeline & timeline, const TraceContext & parent)
+{
+    timeline.trace.trace_id_high = parent.trace_id_high;
+    timeline.trace.trace_id_low = parent.trace_id_low;
+    timeline.trace.span_id = randomId();
+    timeline.trace.parent_span_id = parent.span_id;
+}
+
+void RequestTracer::finishRequest(int64_t session_id, const Coordination::ZooKeeperResponse & response)
+{
+    const auto & timeline = response.timeline;
+    if (!timeline.trace.sampled() || !enabled.load(std::memory_order_relaxed))
+        return;
+
+    UInt64 end_us = timeline.passed(RequestStage::SEND) ? timeline.endTime(RequestStage::SEND) : RequestTimeline::now();
+    addSpans(makeSpans(
+        timeline,
+        Coordination::toString(response.getOpNum()),
+        end_us,
+        {{"rpc.system", "zookeeper"},
+         {"zookeeper.session_id", toHexString(session_id)},
+         {"zookeeper.xid", std::to_string(response.xid)},
+         {"zookeeper.error", Coordination::errorMessage(response.error)}}));
+}
+
+void RequestTracer::finishForwarded(const RequestForSession & request_for_session)
+{
+    const auto & request = request_for_session.request;
+    if (!request->timeline.trace.sampled() || !enabled.load(std::memory_order_relaxed))
+        return;
+
+    addSpans(makeSpans(
+        request->timeline,
+        "forwarded " + Coordination::toString(request->getOpNum()),
+        RequestTimeline::now(),
+        {{"rpc.system", "zookeeper"},
+         {"zookeeper.session_id", toHexString(request_for_session.session_id)},
+         {"zookeeper.xid", std::to_string(request->xid)},
+         {"zookeeper.path", request->getPath()},
+         {"raftkeeper.forwarded_from", std::to_string(request_for_session.server_id)}}));
+}
+
+std::vector<RequestTracer::Span> RequestTracer::makeSpans(
+    const RequestTimeline & timeline, String name, UInt64 end_us, std::vector<std::pair<String, String>> attributes)
+{
+    const auto & trace = timeline.trace;
+    /// Monotonic times of timeline to unix time, spans of a node are exact relative to each other
+    UInt64 offset = unixTimeMicroseconds() - RequestTimeline::now();
+
+    std::vector<Span> spans;
+    Span & root = spans.emplace_back();
+    root.trace_id_high = trace.trace_id_high;
+    root.trace_id_low = trace.trace_id_low;
+    root.span_id = trace.span_id;
+    root.parent_span_id = trace.parent_span_id;
+    root.name = std::move(name);
+    root.kind = SpanKind::SERVER;
+    root.start_us = timeline.startTime() + offset;
+    root.end_us = std::max(end_us, timeline.startTime()) + offset;
+    root.attributes = std::move(attributes);
+
+    UInt64 previous = timeline.startTime();
+    for (size_t i = 0; i < RequestTimeline::STAGES; ++i)
+    {
+        auto stage = static_cast<RequestStage>(i);
+        UInt64 time = timeline.endTime(stage);
+        if (time == 0)
+            continue;
+        /// Recorded late by another thread
+        time = std::max(time, previous);
+
+        Span span;
+        span.trace_id_high = trace.trace_id_high;
+        span.trace_id_low = trace.trace_id_low;
+        span.span_id = trace.stageSpanId(stage);
+        span.parent_span_id = trace.span_id;
+        span.name = toString(stage);
+        span.kind = stage == RequestStage::FORWARD ? SpanKind::CLIENT : SpanKind::INTERNAL;
+        span.start_us = previous + offset;
+        span.end_us = time + offset;
+        spans.push_back(std::move(span));
+        previous = time;
+    }
+    return spans;
+}
+
+String RequestTracer::formatSpans(const std::vector<Span> & spans, const String & instance_id)
+{
+    String res = "{\"resourceSpans\":[{\"resource\":{\"attributes\":";
+    writeJSONAttributes({{"service.name", SERVICE_NAME}, {"service.instance.id", instance_id}}, res);
+    res += fmt::format("}},\"scopeSpans\":[{{\"scope\":{{\"name\":\"{}\"}},\"spans\":[", SERVICE_NAME);
+
+    for (size_t i = 0; i < spans.size(); ++i)
+    {
+        const auto & span = spans[i];
+        if (i)
+            res += ',';
+        res += fmt::format(
+            "{{\"traceId\":\"{}{}\",\"spanId\":\"{}\",",
+            getHexUIntLowercase(span.trace_id_high),
+            getHexUIntLowercase(span.trace_id_low),
+            getHexUIntLowercase(span.span_id));
+        if (span.parent_span_id)
+            res += fmt::format("\"parentSpanId\":\"{}\",", getHexUIntLowercase(span.parent_span_id));
+        res += "\"name\":";
+        writeJSONString(span.name, res);
+        /// 64 bit integers are strings in OTLP/JSON
+        res += fmt::format(
+            ",\"kind\":{},\"startTimeUnixNano\":\"{}\",\"endTimeUnixNano\":\"{}\",\"attributes\":",
+            static_cast<int>(span.kind),
+            span.start_us * 1000,
+            span.end_us * 1000);
+        writeJSONAttributes(span.attributes, res);
+        res += '}';
+    }
+
+    res += "]}]}]}";
+    return res;
+}
+
+void RequestTracer::addSpans(std::vector<Span> && spans)
+{
+    std::lock_guard lock(mutex);
+    if (pending_spans.size() + spans.size() > max_pending_spans)
+    {
+        dropped_spans.fetch_add(spans.size(), std::memory_order_relaxed);
+        return;
+    }
+    for (auto & span : spans)
+        pending_spans.push_back(std::move(span));
+}
+
+std::vector<RequestTracer::Span> RequestTracer::takePendingSpans()
+{
+    std::lock_guard lock(mutex);
+    std::vector<Span> res;
+    res.swap(pending_spans);
+    return res;
+}
+
+void RequestTracer::exportThread()
+{
+    setThreadName("RequestTracer");
+
+    bool stop = false;
+    while (!stop)
+    {
+        {
+            std::unique_lock lock(mutex);
+            stop = cv.wait_for(lock, std::chrono::milliseconds(flush_interval_ms), [this] { return shutdown_called; });
+        }
+        flush();
+    }
+}
+
+void RequestTracer::flush()
+{
+    auto spans = takePendingSpans();
+    if (spans.empty())
+        return;
+
+    try
+    {
+        String line = formatSpans(spans, instance_id);
+        line += '\n';
+        out->write(line.data(), line.size());
+        out->next();
+    }
+    catch (...)
+    {
+        tryLogCurrentException("RequestTracer", fmt::format("Failed to export {} spans", spans.size()));
+    }
+}
+
+void RequestTracer::shutdown()
+{
+    enabled.store(false, std::memory_order_relaxed);
+    {
+        std::lock_guard lock(mutex);
+        shutdown_called = true;
+    }
+    cv.notify_all();
+
+    if (export_thread.joinable())
+        export_thread.join();
+    out.reset();
+}
+
+}
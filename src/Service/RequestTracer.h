@@ -0,0 +1,115 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <Common/IO/WriteBufferFromFile.h>
+#include <Common/RequestTimeline.h>
+#include <Common/ThreadPool.h>
+#include <Service/KeeperCommon.h>
+
+namespace RK
+{
+
+/** Traces sampled requests by spans compatible with OpenTelemetry, so that the latency of a single request can be
+  * followed across the follower and the leader. The node receiving a request from client samples one of
+  * sample_probability requests, its spans are the request and every stage of RequestTimeline it passed. The trace
+  * context of a forwarded request is sent to the leader if the forward connection negotiated it, the leader adds a
+  * span of the request with its stages as a child of the forward span of the follower.
+  *
+  * Spans are exported in OTLP/JSON, one ExportTraceServiceRequest per line, to keeper.tracing.file by a background
+  * thread every flush_interval_ms, which can be collected by the otlpjsonfile receiver of OpenTelemetry collector.
+  * At most max_pending_spans are kept between flushes, others are dropped.
+  *
+  * Configured by keeper.tracing.{enabled, sample_probability, file, flush_interval_ms, max_pending_spans},
+  * disabled by default.
+  */
+class RequestTracer
+{
+public:
+    enum class SpanKind : UInt8
+    {
+        INTERNAL = 1,
+        SERVER = 2,
+        CLIENT = 3,
+    };
+
+    struct Span
+    {
+        UInt64 trace_id_high = 0;
+        UInt64 trace_id_low = 0;
+        UInt64 span_id = 0;
+        UInt64 parent_span_id = 0;
+        String name;
+        SpanKind kind = SpanKind::INTERNAL;
+        /// Unix time in microseconds
+        UInt64 start_us = 0;
+        UInt64 end_us = 0;
+        std::vector<std::pair<String, String>> attributes;
+    };
+
+    static RequestTracer & instance();
+
+    void initialize(const Poco::Util::AbstractConfiguration & config, int32_t my_id);
+    /// Empty file keeps spans in memory until they are taken by takePendingSpans
+    void initialize(bool enabled_, double sample_probability, const String & file, UInt64 flush_interval_ms_, size_t max_pending_spans_,
+        const String & instance_id_);
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    /// Starts a trace of one of sample_probability requests, invoked when a request of client is parsed
+    void trySample(RequestTimeline & timeline);
+    /// Continues the trace of a forwarded request by leader, parent is the forward span of follower
+    static void startRemote(RequestTimeline & timeline, const TraceContext & parent);
+
+    /// Invoked when the response of a sampled request is sent to client
+    void finishRequest(int64_t session_id, const Coordination::ZooKeeperResponse & response);
+    /// Invoked by leader when a sampled forwarded request is appended and answered
+    void finishForwarded(const RequestForSession & request_for_session);
+
+    /// Spans of the request and its stages, the request spans from the start of timeline to end_us of monotonic clock
+    static std::vector<Span> makeSpans(
+        const RequestTimeline & timeline, String name, UInt64 end_us, std::vector<std::pair<String, String>> attributes);
+    /// ExportTraceServiceRequest of OTLP/JSON in one line
+    static String formatSpans(const std::vector<Span> & spans, const String & instance_id);
+
+    std::vector<Span> takePendingSpans();
+    size_t droppedSpans() const { return dropped_spans.load(std::memory_order_relaxed); }
+
+    void shutdown();
+
+    static constexpr auto SERVICE_NAME = "raftkeeper";
+    static constexpr double DEFAULT_SAMPLE_PROBABILITY = 0.001;
+    static constexpr UInt64 DEFAULT_FLUSH_INTERVAL_MS = 1000;
+    static constexpr size_t DEFAULT_MAX_PENDING_SPANS = 100000;
+
+private:
+    RequestTracer() = default;
+
+    void addSpans(std::vector<Span> && spans);
+    void exportThread();
+    void flush();
+
+    std::atomic<bool> enabled{false};
+    /// A request is sampled if a random UInt64 is less than it
+    std::atomic<UInt64> sample_threshold{0};
+    std::atomic<size_t> dropped_spans{0};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<Span> pending_spans;
+    size_t max_pending_spans = DEFAULT_MAX_PENDING_SPANS;
+    UInt64 flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+    String instance_id;
+    bool shutdown_called = false;
+
+    /// Only used by export thread
+    std::unique_ptr<WriteBufferFromFile> out;
+    ThreadFromGlobalPool export_thread;
+};
+
+}
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
 #include <Service/NuRaftStateMachine.h>
-#include <boost/lockfree/queue.hpp>
-#include <Common/ConcurrentBoundedQueue.h>
+#include <Common/BusyPoll.h>
+#include <Common/LockFreeBoundedQueue.h>
 
 namespace RK
 {
@@ -32,14 +38,85 @@ namespace RK
  * 3 RequestAccumulator: accumulate request and send to Raft in batch.
  * 4 Raft log replication
  * 5 RequestProcessor: process user requests.
+ *
+ * Requests of a session always go to the same child queue, so that they are executed in order. By default it is the
+ * session id modulo child queues, a few heavy sessions may land on the same one then. With least loaded placement a
+ * session is placed on the child queue with the least recent load when it is first seen and stays there until its
+ * close request, so new sessions keep away from the runners busy with heavy ones.
  */
 struct RequestsQueue
 {
-    using Queue = ConcurrentBoundedQueue<RequestForSession>;
+    using Queue = LockFreeBoundedQueue<RequestForSession>;
+
+    /// How many control requests are popped in a row before a bulk request when both are pending
+    static constexpr size_t DEFAULT_CONTROL_REQUESTS_WEIGHT = 16;
+
+    /// Every child queue has a control lane for heartbeats and session requests, which keep sessions
+    /// alive and should not wait behind bulk reads and writes. Requests of different lanes may be
+    /// reordered, which is fine for them. Heartbeat has its own xid and there is no other request of
+    /// a session before its new or update session request returns.
+    struct Lanes
+    {
+        ptr<Queue> control;
+        ptr<Queue> bulk;
+
+        /// Control requests popped in a row, only touched by the consumer
+        size_t control_streak{0};
+
+        /// Requests pushed recently, halved every LOAD_DECAY_PERIOD requests pushed to all child queues
+        std::atomic<UInt64> load{0};
+        /// Sessions placed on it by least loaded placement
+        std::atomic<size_t> sessions{0};
+
+        /// Consumers waiting on both lanes
+        std::atomic<size_t> waiters{0};
+        std::mutex mutex;
+        std::condition_variable condition;
+    };
 
-    std::vector<ptr<Queue>> queues;
+    std::vector<std::unique_ptr<Lanes>> queues;
 
-    explicit RequestsQueue(size_t child_queue_size, size_t capacity = 20000)
+    const size_t control_requests_weight;
+
+    /// Sessions placed by least loaded placement, striped to keep pushes of different sessions apart
+    struct Placement
+    {
+        static constexpr size_t STRIPES = 64;
+
+        struct Stripe
+        {
+            std::mutex mutex;
+            std::unordered_map<int64_t, size_t> queues;
+        };
+
+        std::array<Stripe, STRIPES> stripes;
+        std::atomic<UInt64> pushed{0};
+        /// Whether a session is released when its close request is popped, otherwise by releaseSession
+        bool release_on_close;
+
+        explicit Placement(bool release_on_close_) : release_on_close(release_on_close_) { }
+        Stripe & stripeOf(int64_t session_id) { return stripes[static_cast<UInt64>(session_id) % STRIPES]; }
+    };
+
+    static constexpr UInt64 LOAD_DECAY_PERIOD = 65536;
+
+    /// Null for modulo placement
+    std::unique_ptr<Placement> placement;
+
+    /// Consumers of tryPopAny waiting on all child queues, every push wakes them up besides the ones of its child queue
+    std::atomic<size_t> any_waiters{0};
+    std::mutex any_mutex;
+    std::condition_variable any_condition;
+    /// Child queue tryPopAny starts from, the one after the last it popped, so that no child queue is starved
+    std::atomic<size_t> any_next{0};
+
+    explicit RequestsQueue(
+        size_t child_queue_size,
+        size_t capacity = 20000,
+        size_t control_requests_weight_ = DEFAULT_CONTROL_REQUESTS_WEIGHT,
+        bool least_loaded_placement = false,
+        bool release_on_close = true)
+        : control_requests_weight(std::max(control_requests_weight_, 1ul))
     {
         assert(child_queue_size > 0);
         assert(capacity > 0);
@@ -47,59 +124,357 @@ struct RequestsQueue
         queues.resize(child_queue_size);
         for (size_t i = 0; i < child_queue_size; i++)
         {
-            queues[i] = std::make_shared<Queue>(std::max(1ul, capacity / child_queue_size));
+            queues[i] = std::make_unique<Lanes>();
+            queues[i]->control = std::make_shared<Queue>(std::max(1ul, capacity / child_queue_size));
+            queues[i]->bulk = std::make_shared<Queue>(std::max(1ul, capacity / child_queue_size));
+        }
+
+        if (least_loaded_placement)
+            placement = std::make_unique<Placement>(release_on_close);
+    }
+
+    static bool isControlRequest(const RequestForSession & request)
+    {
+        auto op_num = request.request->getOpNum();
+        return op_num == Coordination::OpNum::Heartbeat || op_num == Coordination::OpNum::NewSession
+            || op_num == Coordination::OpNum::UpdateSession;
+    }
+
+    /// Child queue of the session, the session is placed if it is not yet.
+    size_t getQueueId(int64_t session_id)
+    {
+        if (!placement)
+            return session_id % queues.size();
+
+        auto & stripe = placement->stripeOf(session_id);
+        std::lock_guard lock(stripe.mutex);
+        auto [it, inserted] = stripe.queues.try_emplace(session_id, 0);
+        if (inserted)
+        {
+            it->second = getLeastLoadedQueueId();
+            queues[it->second]->sessions.fetch_add(1, std::memory_order_relaxed);
+        }
+        return it->second;
+    }
+
+    /// Child queue the session is on without placing it, a session not placed is on the one of modulo placement.
+    size_t getAssignedQueueId(int64_t session_id) const
+    {
+        if (placement)
+        {
+            auto & stripe = placement->stripeOf(session_id);
+            std::lock_guard lock(stripe.mutex);
+            if (auto it = stripe.queues.find(session_id); it != stripe.queues.end())
+                return it->second;
+        }
+        return session_id % queues.size();
+    }
+
+    /// Forget where the session is placed, its next request places it again.
+    void releaseSession(int64_t session_id)
+    {
+        if (!placement)
+            return;
+
+        auto & stripe = placement->stripeOf(session_id);
+        std::lock_guard lock(stripe.mutex);
+        if (auto it = stripe.queues.find(session_id); it != stripe.queues.end())
+        {
+            queues[it->second]->sessions.fetch_sub(1, std::memory_order_relaxed);
+            stripe.queues.erase(it);
         }
     }
 
     template <typename Request>
     bool push(Request && request)
     {
-        return queues[request.session_id % queues.size()]->push(std::forward<Request>(request));
+        size_t queue_id = getQueueId(request.session_id);
+        auto & lanes = *queues[queue_id];
+        bool control = isControlRequest(request);
+        if (!(control ? lanes.control : lanes.bulk)->push(std::forward<Request>(request)))
+            return false;
+        addLoad(queue_id, 1);
+        notify(lanes);
+        return true;
     }
 
     template <typename Request>
     bool tryPush(Request && request, UInt64 wait_ms = 0)
     {
-        return queues[request.session_id % queues.size()]->tryPush(std::forward<Request>(request), wait_ms);
+        size_t queue_id = getQueueId(request.session_id);
+        auto & lanes = *queues[queue_id];
+        bool control = isControlRequest(request);
+        if (!(control ? lanes.control : lanes.bulk)->tryPush(std::forward<Request>(request), wait_ms))
+            return false;
+        addLoad(queue_id, 1);
+        notify(lanes);
+        return true;
+    }
+
+    /// Push requests of one session waking up the consumer once. Close requests are pushed without timeout.
+    /// Requests are pushed in order and pushing stops at the first failure, returns how many are pushed.
+    size_t tryPushBatch(std::vector<RequestForSession> & requests, UInt64 wait_ms = 0)
+    {
+        if (requests.empty())
+            return 0;
+
+        size_t queue_id = getQueueId(requests.front().session_id);
+        auto & lanes = *queues[queue_id];
+        size_t pushed = 0;
+        for (auto & request : requests)
+        {
+            assert(request.session_id == requests.front().session_id);
+            auto & queue = isControlRequest(request) ? lanes.control : lanes.bulk;
+            bool ok = request.request->getOpNum() == Coordination::OpNum::Close ? queue->push(std::move(request))
+                                                                                 : queue->tryPush(std::move(request), wait_ms);
+            if (!ok)
+                break;
+            ++pushed;
+        }
+
+        if (pushed)
+        {
+            addLoad(queue_id, pushed);
+            notify(lanes);
+        }
+        return pushed;
     }
 
     bool pop(size_t queue_id, RequestForSession & request)
     {
-        assert(queue_id != 0 && queue_id <= queues.size());
-        return queues[queue_id]->pop(request);
+        assert(queue_id < queues.size());
+        return wait(*queues[queue_id], {}, request);
     }
 
     bool tryPop(size_t queue_id, RequestForSession & request, UInt64 wait_ms = 0)
     {
         assert(queue_id < queues.size());
-        return queues[queue_id]->tryPop(request, wait_ms);
+        return wait(*queues[queue_id], wait_ms, request);
+    }
+
+    /// Pop at most max_size requests without waiting, control requests first, returns how many were popped.
+    size_t tryPopBatch(size_t queue_id, std::vector<RequestForSession> & requests, size_t max_size)
+    {
+        assert(queue_id < queues.size());
+        auto & lanes = *queues[queue_id];
+        size_t size_before = requests.size();
+        size_t popped = lanes.control->tryPopBatch(requests, max_size);
+        if (popped < max_size)
+            popped += lanes.bulk->tryPopBatch(requests, max_size - popped);
+        if (placement && placement->release_on_close)
+            for (size_t i = size_before; i < requests.size(); ++i)
+                releaseIfClosed(requests[i]);
+        return popped;
     }
 
+    /// Pop from any child queue, waits at most wait_ms for a push to any of them.
     bool tryPopAny(RequestForSession & request, UInt64 wait_ms = 0)
     {
-        for (const auto & queue : queues)
-        {
-            if (queue->tryPop(request, wait_ms))
-                return true;
-        }
-        return false;
+        return waitFor(any_waiters, any_mutex, any_condition, wait_ms, [&] { return tryPopAnyOnce(request); });
+    }
+
+    /// Pop at most max_size requests from child queues in turn, waits at most wait_ms for a push to any of them if all
+    /// are empty. Returns how many were popped.
+    size_t tryPopAnyBatch(std::vector<RequestForSession> & requests, size_t max_size, UInt64 wait_ms = 0)
+    {
+        size_t popped = 0;
+        waitFor(
+            any_waiters,
+            any_mutex,
+            any_condition,
+            wait_ms,
+            [&]
+            {
+                popped = tryPopAnyBatchOnce(requests, max_size);
+                return popped > 0;
+            });
+        return popped;
     }
 
     size_t size() const
     {
         size_t size{};
-        for (const auto & queue : queues)
-            size += queue->size();
+        for (const auto & lanes : queues)
+            size += lanes->control->size() + lanes->bulk->size();
         return size;
     }
 
     size_t size(size_t queue_id) const
     {
         assert(queue_id < queues.size());
-        return queues[queue_id]->size();
+        return queues[queue_id]->control->size() + queues[queue_id]->bulk->size();
     }
 
     bool empty() const { return size() == 0; }
+
+    /// Change the capacity of all child queues at runtime, the capacity they are created with is the most they can
+    /// hold. Returns the capacity applied.
+    size_t setCapacity(size_t capacity)
+    {
+        size_t applied{};
+        size_t child_capacity = std::max(1ul, capacity / queues.size());
+        for (const auto & lanes : queues)
+        {
+            applied += lanes->control->setLimit(child_capacity);
+            lanes->bulk->setLimit(child_capacity);
+        }
+        return applied;
+    }
+
+    size_t getBufferSizeInBytes() const
+    {
+        size_t bytes{};
+        for (const auto & lanes : queues)
+            bytes += lanes->control->getBufferSizeInBytes() + lanes->bulk->getBufferSizeInBytes();
+        return bytes;
+    }
+
+private:
+    size_t getLeastLoadedQueueId() const
+    {
+        size_t res = 0;
+        for (size_t i = 1; i < queues.size(); ++i)
+        {
+            UInt64 load = queues[i]->load.load(std::memory_order_relaxed);
+            UInt64 min_load = queues[res]->load.load(std::memory_order_relaxed);
+            if (load < min_load
+                || (load == min_load
+                    && queues[i]->sessions.load(std::memory_order_relaxed) < queues[res]->sessions.load(std::memory_order_relaxed)))
+                res = i;
+        }
+        return res;
+    }
+
+    /// Loads only matter for placement. They are halved racily, which is fine for they are approximate.
+    void addLoad(size_t queue_id, size_t count)
+    {
+        if (!placement)
+            return;
+
+        queues[queue_id]->load.fetch_add(count, std::memory_order_relaxed);
+        UInt64 pushed = placement->pushed.fetch_add(count, std::memory_order_relaxed);
+        if (pushed / LOAD_DECAY_PERIOD != (pushed + count) / LOAD_DECAY_PERIOD)
+            for (const auto & lanes : queues)
+                lanes->load.store(lanes->load.load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+
+    /// Close request is the last one of a session
+    void releaseIfClosed(const RequestForSession & request)
+    {
+        if (request.request->getOpNum() == Coordination::OpNum::Close)
+            releaseSession(request.session_id);
+    }
+
+    /// Pop without waiting, control lane is preferred but gives way to bulk lane after control_requests_weight requests.
+    bool tryPopOnce(Lanes & lanes, RequestForSession & request)
+    {
+        bool res;
+        if (lanes.control_streak < control_requests_weight && lanes.control->tryPop(request))
+        {
+            ++lanes.control_streak;
+            res = true;
+        }
+        else
+        {
+            lanes.control_streak = 0;
+            res = lanes.bulk->tryPop(request) || lanes.control->tryPop(request);
+        }
+
+        if (res && placement && placement->release_on_close)
+            releaseIfClosed(request);
+        return res;
+    }
+
+    bool tryPopAnyOnce(RequestForSession & request)
+    {
+        size_t start = any_next.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < queues.size(); ++i)
+        {
+            size_t queue_id = (start + i) % queues.size();
+            if (tryPopOnce(*queues[queue_id], request))
+            {
+                any_next.store(queue_id + 1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t tryPopAnyBatchOnce(std::vector<RequestForSession> & requests, size_t max_size)
+    {
+        size_t popped = 0;
+        size_t start = any_next.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < queues.size() && popped < max_size; ++i)
+        {
+            size_t queue_id = (start + i) % queues.size();
+            if (size_t count = tryPopBatch(queue_id, requests, max_size - popped))
+            {
+                popped += count;
+                any_next.store(queue_id + 1, std::memory_order_relaxed);
+            }
+        }
+        return popped;
+    }
+
+    /// Both sides do read-modify-write on waiters, so a waiter either sees the pushed request or is woken up.
+    static void notifyWaiters(std::atomic<size_t> & waiters, std::mutex & mutex, std::condition_variable & condition)
+    {
+        if (waiters.fetch_add(0, std::memory_order_acq_rel))
+        {
+            std::lock_guard lock(mutex);
+            condition.notify_all();
+        }
+    }
+
+    void notify(Lanes & lanes)
+    {
+        notifyWaiters(lanes.waiters, lanes.mutex, lanes.condition);
+        notifyWaiters(any_waiters, any_mutex, any_condition);
+    }
+
+    bool wait(Lanes & lanes, std::optional<UInt64> wait_ms, RequestForSession & request)
+    {
+        return waitFor(lanes.waiters, lanes.mutex, lanes.condition, wait_ms, [&] { return tryPopOnce(lanes, request); });
+    }
+
+    /// Wait until try_pop succeeds, at most wait_ms if it is given, 0 means not waiting.
+    template <typename TryPop>
+    static bool waitFor(
+        std::atomic<size_t> & waiters,
+        std::mutex & mutex,
+        std::condition_variable & condition,
+        std::optional<UInt64> wait_ms,
+        TryPop && try_pop)
+    {
+        if (try_pop())
+            return true;
+
+        if (wait_ms && *wait_ms == 0)
+            return false;
+
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(wait_ms.value_or(0));
+
+        if (BusyPoll::spin(try_pop, wait_ms))
+            return true;
+
+        std::unique_lock lock(mutex);
+        waiters.fetch_add(1, std::memory_order_acq_rel);
+
+        bool res = false;
+        while (!(res = try_pop()))
+        {
+            if (!wait_ms)
+                condition.wait(lock);
+            else if (condition.wait_until(lock, deadline) == std::cv_status::timeout)
+            {
+                res = try_pop();
+                break;
+            }
+        }
+
+        waiters.fetch_sub(1, std::memory_order_relaxed);
+        return res;
+    }
 };
 
 }
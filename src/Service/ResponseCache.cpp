@@ -0,0 +1,114 @@
+#include <algorithm>
+#include <Service/KeeperUtils.h>
+#include <Service/ResponseCache.h>
+
+namespace RK
+{
+
+ResponseCache::ResponseCache(size_t max_entries_)
+    : max_entries(max_entries_), max_shard_entries(std::max(max_entries_ / SHARD_NUM, size_t(1)))
+{
+}
+
+bool ResponseCache::isCacheable(Coordination::OpNum op_num)
+{
+    using enum Coordination::OpNum;
+    return op_num == Get || op_num == List || op_num == SimpleList;
+}
+
+size_t ResponseCache::slotIndex(Coordination::OpNum op_num)
+{
+    using enum Coordination::OpNum;
+    return op_num == Get ? 0 : (op_num == List ? 1 : 2);
+}
+
+bool ResponseCache::sameVersion(const Coordination::Stat & lhs, const Coordination::Stat & rhs)
+{
+    return lhs.mzxid == rhs.mzxid && lhs.pzxid == rhs.pzxid && lhs.version == rhs.version && lhs.cversion == rhs.cversion
+        && lhs.aversion == rhs.aversion;
+}
+
+ResponseCache::Shard & ResponseCache::getShard(const String & path)
+{
+    return shards[StringHash()(path) % SHARD_NUM];
+}
+
+ResponseCache::Body ResponseCache::get(Coordination::OpNum op_num, const String & path, const Coordination::Stat & stat, bool & should_put)
+{
+    should_put = false;
+    auto & shard = getShard(path);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.entries.find(path);
+    if (it == shard.entries.end())
+    {
+        /// Evict an arbitrary entry, popular znodes come back soon
+        if (shard.entries.size() >= max_shard_entries)
+            shard.entries.erase(shard.entries.begin());
+        it = shard.entries.try_emplace(path).first;
+    }
+
+    auto & slot = it->second[slotIndex(op_num)];
+    if (slot.seen && sameVersion(slot.stat, stat))
+    {
+        if (slot.body)
+            return slot.body;
+        should_put = true;
+        return nullptr;
+    }
+
+    slot.stat = stat;
+    slot.seen = true;
+    slot.body.reset();
+    return nullptr;
+}
+
+void ResponseCache::put(Coordination::OpNum op_num, const String & path, const Coordination::Stat & stat, Body body)
+{
+    auto & shard = getShard(path);
+    std::lock_guard lock(shard.mutex);
+
+    auto it = shard.entries.find(path);
+    if (it == shard.entries.end())
+        return;
+
+    auto & slot = it->second[slotIndex(op_num)];
+    if (slot.seen && sameVersion(slot.stat, stat))
+        slot.body = std::move(body);
+}
+
+void ResponseCache::invalidate(const String & path)
+{
+    auto erase = [this](const String & erased_path)
+    {
+        auto & shard = getShard(erased_path);
+        std::lock_guard lock(shard.mutex);
+        shard.entries.erase(erased_path);
+    };
+
+    erase(path);
+    if (path != "/")
+        erase(getParentPath(path));
+}
+
+void ResponseCache::clear()
+{
+    for (auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        shard.entries.clear();
+    }
+}
+
+size_t ResponseCache::size() const
+{
+    size_t res = 0;
+    for (const auto & shard : shards)
+    {
+        std::lock_guard lock(shard.mutex);
+        res += shard.entries.size();
+    }
+    return res;
+}
+
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <ZooKeeper/IKeeper.h>
+#include <ZooKeeper/ZooKeeperConstants.h>
+
+
+namespace RK
+{
+
+/**
+ * Serialized bodies of get and list responses of popular znodes, so that reading them again copies
+ * the body instead of serializing data or children.
+ *
+ * A body is valid as long as the stat of the znode is the same: changing data bumps mzxid and version,
+ * changing children bumps pzxid and cversion, changing ACL bumps aversion. The write path also drops
+ * entries of the znodes it touches. A body is only put when the znode is read twice with the same stat,
+ * so znodes read once do not pay for serialization.
+ *
+ * Thread-safe, entries are sharded by path.
+ */
+class ResponseCache
+{
+public:
+    using Body = std::shared_ptr<const String>;
+
+    explicit ResponseCache(size_t max_entries_);
+
+    bool enabled() const { return max_entries != 0; }
+
+    /// Whether response of the operation can be cached.
+    static bool isCacheable(Coordination::OpNum op_num);
+
+    /// Body of the response if the znode is unchanged since it was put. Otherwise returns nullptr and sets
+    /// should_put if the znode was read with the same stat before, then the caller serializes and puts it.
+    Body get(Coordination::OpNum op_num, const String & path, const Coordination::Stat & stat, bool & should_put);
+
+    void put(Coordination::OpNum op_num, const String & path, const Coordination::Stat & stat, Body body);
+
+    /// Drop entries of the path and its parent, called after the path is written.
+    void invalidate(const String & path);
+
+    /// Drop all entries, for example to free memory
+    void clear();
+
+    size_t size() const;
+
+private:
+    static constexpr size_t SHARD_NUM = 16;
+    /// Get, List and SimpleList
+    static constexpr size_t OP_NUM = 3;
+
+    struct Slot
+    {
+        /// Stat of the znode when it was read last time
+        Coordination::Stat stat{};
+        bool seen = false;
+        Body body;
+    };
+
+    using Entry = std::array<Slot, OP_NUM>;
+
+    struct Shard
+    {
+        mutable std::mutex mutex;
+        std::unordered_map<String, Entry> entries;
+    };
+
+    static size_t slotIndex(Coordination::OpNum op_num);
+    static bool sameVersion(const Coordination::Stat & lhs, const Coordination::Stat & rhs);
+    Shard & getShard(const String & path);
+
+    const size_t max_entries;
+    const size_t max_shard_entries;
+    std::array<Shard, SHARD_NUM> shards;
+};
+
+}
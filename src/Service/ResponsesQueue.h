@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cassert>
+#include <memory>
+#include <vector>
+#include <Service/KeeperCommon.h>
+#include <Service/ThreadSafeQueue.h>
+#include <common/defines.h>
+
+namespace RK
+{
+
+/**
+ * Responses queue which is sharded by session, responses of a session always go to the same shard,
+ * so they keep their order. Every shard is consumed by its own response thread of KeeperDispatcher.
+ */
+class ResponsesQueue
+{
+public:
+    using Queue = ThreadSafeQueue<ResponseForSession>;
+
+    ResponsesQueue() : ResponsesQueue(1) { }
+
+    explicit ResponsesQueue(size_t shard_num) { resize(shard_num); }
+
+    /// Change shard number, should be invoked before the queue is used.
+    void resize(size_t shard_num)
+    {
+        assert(shard_num > 0);
+        queues.resize(shard_num);
+        for (auto & queue : queues)
+            if (!queue)
+                queue = std::make_unique<Queue>();
+    }
+
+    size_t getShardNum() const { return queues.size(); }
+
+    size_t getShard(int64_t session_id) const { return static_cast<UInt64>(session_id) % queues.size(); }
+
+    void push(const ResponseForSession & response)
+    {
+        if (unlikely(response.watchers && queues.size() > 1))
+            pushBatch({response});
+        else
+            queues[getShard(response.session_id)]->push(response);
+    }
+
+    void push(ResponseForSession && response)
+    {
+        if (unlikely(response.watchers && queues.size() > 1))
+            pushBatch({std::move(response)});
+        else
+            queues[getShard(response.session_id)]->push(std::move(response));
+    }
+
+    /// Push responses with one lock of every shard, responses of a session keep their order.
+    /// A watch event is split into one event per shard holding the watchers of the shard.
+    void pushBatch(const ResponsesForSessions & responses)
+    {
+        if (queues.size() == 1)
+        {
+            queues[0]->pushBatch(responses);
+            return;
+        }
+
+        std::vector<ResponsesForSessions> shard_responses(queues.size());
+        std::vector<Watchers> shard_watchers(queues.size());
+        for (const auto & response : responses)
+        {
+            if (!response.watchers)
+            {
+                shard_responses[getShard(response.session_id)].push_back(response);
+                continue;
+            }
+
+            for (auto watcher : *response.watchers)
+                shard_watchers[getShard(watcher)].push_back(watcher);
+
+            for (size_t shard = 0; shard < queues.size(); ++shard)
+            {
+                if (shard_watchers[shard].empty())
+                    continue;
+                int64_t session_id = shard_watchers[shard].front();
+                auto watchers = std::make_shared<const Watchers>(std::move(shard_watchers[shard]));
+                shard_responses[shard].emplace_back(session_id, response.response, std::move(watchers));
+                shard_watchers[shard].clear();
+            }
+        }
+
+        for (size_t shard = 0; shard < queues.size(); ++shard)
+            queues[shard]->pushBatch(shard_responses[shard]);
+    }
+
+    bool tryPop(size_t shard, ResponseForSession & response, int64_t timeout_ms = 0)
+    {
+        assert(shard < queues.size());
+        return queues[shard]->tryPop(response, timeout_ms);
+    }
+
+    /// Try every shard in turn.
+    bool tryPop(ResponseForSession & response, int64_t timeout_ms = 0)
+    {
+        for (const auto & queue : queues)
+        {
+            if (queue->tryPop(response, timeout_ms))
+                return true;
+        }
+        return false;
+    }
+
+    /// Wait until the shard is not empty and pop at most max_size responses at once, returns how many were popped.
+    size_t tryPopBatch(size_t shard, std::vector<ResponseForSession> & responses, size_t max_size, int64_t timeout_ms = 0)
+    {
+        assert(shard < queues.size());
+        return queues[shard]->tryPopBatch(responses, max_size, timeout_ms);
+    }
+
+    size_t size() const
+    {
+        size_t size{};
+        for (const auto & queue : queues)
+            size += queue->size();
+        return size;
+    }
+
+    bool empty() const { return size() == 0; }
+
+private:
+    std::vector<std::unique_ptr<Queue>> queues;
+};
+
+}
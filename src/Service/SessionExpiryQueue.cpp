@@ -1,27 +1,74 @@
 #include <Service/SessionExpiryQueue.h>
-#include <common/logger_useful.h>
+#include <algorithm>
 
 namespace RK
 {
 
-bool SessionExpiryQueue::remove(int64_t session_id)
+SessionExpiryQueue::SessionExpiryQueue(int64_t expiration_interval_)
+    : slots(WHEEL_SLOTS, nullptr)
+    , checked_interval(getNowMilliseconds() / expiration_interval_ - 1)
+    , expiration_interval(expiration_interval_)
 {
-    auto session_it = session_to_expiration_time.find(session_id);
-    if (session_it != session_to_expiration_time.end())
-    {
-        auto set_it = expiry_to_sessions.find(session_it->second);
-        if (set_it != expiry_to_sessions.end())
-            set_it->second.erase(session_id);
+}
 
-        /// No more sessions in this bucket
-        if (set_it->second.empty())
-            expiry_to_sessions.erase(set_it);
+void SessionExpiryQueue::link(Entry *& head, Entry * entry)
+{
+    entry->prev = nullptr;
+    entry->next = head;
+    if (head)
+        head->prev = entry;
+    head = entry;
+}
+
+void SessionExpiryQueue::unlink(Entry *& head, Entry * entry)
+{
+    if (entry->prev)
+        entry->prev->next = entry->next;
+    else
+        head = entry->next;
+    if (entry->next)
+        entry->next->prev = entry->prev;
+    entry->prev = nullptr;
+    entry->next = nullptr;
+}
 
-        session_to_expiration_time.erase(session_it);
-        return true;
+SessionExpiryQueue::Entry *& SessionExpiryQueue::headOf(const Entry * entry) const
+{
+    return entry->expired ? expired_head : slotOf(intervalOf(entry->expiration_time));
+}
+
+void SessionExpiryQueue::linkByExpirationTime(Entry * entry)
+{
+    entry->expired = intervalOf(entry->expiration_time) <= checked_interval;
+    link(headOf(entry), entry);
+}
+
+void SessionExpiryQueue::moveExpired(Entry *& head, int64_t now) const
+{
+    Entry * entry = head;
+    while (entry)
+    {
+        Entry * next = entry->next;
+        if (entry->expiration_time <= now)
+        {
+            unlink(head, entry);
+            entry->expired = true;
+            link(expired_head, entry);
+        }
+        entry = next;
     }
+}
 
-    return false;
+bool SessionExpiryQueue::remove(int64_t session_id)
+{
+    auto session_it = sessions.find(session_id);
+    if (session_it == sessions.end())
+        return false;
+
+    Entry & entry = session_it->second;
+    unlink(headOf(&entry), &entry);
+    sessions.erase(session_it);
+    return true;
 }
 
 void SessionExpiryQueue::addNewSessionOrUpdate(int64_t session_id, int64_t timeout_ms)
@@ -35,74 +82,56 @@ void SessionExpiryQueue::addNewSessionOrUpdate(int64_t session_id, int64_t timeo
 
 void SessionExpiryQueue::setSessionExpirationTime(int64_t session_id, int64_t expiration_time)
 {
-    int64_t new_expiry_time = expiration_time;
+    auto [session_it, inserted] = sessions.try_emplace(session_id);
+    Entry & entry = session_it->second;
 
-    auto session_it = session_to_expiration_time.find(session_id);
-    /// We already registered this session
-    if (session_it != session_to_expiration_time.end())
+    if (!inserted)
     {
-        int64_t prev_expiry_time = session_it->second;
-        session_it->second = new_expiry_time;
-        /// Nothing changed, session stay in the some bucket
-        if (new_expiry_time == prev_expiry_time)
+        /// Nothing changed, session stay in the some slot
+        if (entry.expiration_time == expiration_time)
             return;
-
-        /// This bucket doesn't exist, let's create it
-        auto set_it = expiry_to_sessions.find(new_expiry_time);
-        if (set_it == expiry_to_sessions.end())
-            std::tie(set_it, std::ignore) = expiry_to_sessions.emplace(new_expiry_time, std::unordered_set<int64_t>());
-
-        /// Add session to the next bucket
-        set_it->second.insert(session_id);
-
-        auto prev_set_it = expiry_to_sessions.find(prev_expiry_time);
-        /// Remove session from previous bucket
-        if (prev_set_it != expiry_to_sessions.end())
-            prev_set_it->second.erase(session_id);
-
-        /// No more sessions in this bucket
-        if (prev_set_it->second.empty())
-            expiry_to_sessions.erase(prev_set_it);
+        unlink(headOf(&entry), &entry);
     }
-    else
-    {
-        /// Just add sessions to the new bucket
-        session_to_expiration_time[session_id] = new_expiry_time;
 
-        auto set_it = expiry_to_sessions.find(new_expiry_time);
-        if (set_it == expiry_to_sessions.end())
-            std::tie(set_it, std::ignore) = expiry_to_sessions.emplace(new_expiry_time, std::unordered_set<int64_t>());
-
-        set_it->second.insert(session_id);
-    }
+    entry.session_id = session_id;
+    entry.expiration_time = expiration_time;
+    linkByExpirationTime(&entry);
 }
 
 std::vector<int64_t> SessionExpiryQueue::getExpiredSessions() const
 {
     int64_t now = getNowMilliseconds();
-    std::vector<int64_t> result;
+    int64_t now_interval = intervalOf(now);
 
-    /// Check all buckets
-    for (const auto & [expire_time, expired_sessions] : expiry_to_sessions)
-    {
-        if (expire_time <= now)
-            result.insert(result.end(), expired_sessions.begin(), expired_sessions.end());
-        else
-            break;
-    }
+    /// Intervals before now are checked once, every slot at most once
+    int64_t first_interval = std::max(checked_interval + 1, now_interval - static_cast<int64_t>(WHEEL_SLOTS));
+    for (int64_t interval = first_interval; interval < now_interval; ++interval)
+        moveExpired(slotOf(interval), now);
+    checked_interval = std::max(checked_interval, now_interval - 1);
+
+    /// The interval of now is checked by every call, for sessions whose expiration time is not rounded
+    moveExpired(slotOf(now_interval), now);
 
+    std::vector<int64_t> result;
+    for (const Entry * entry = expired_head; entry; entry = entry->next)
+        result.push_back(entry->session_id);
     return result;
 }
 
-const std::unordered_map<int64_t, int64_t> & SessionExpiryQueue::sessionToExpirationTime() const
+std::unordered_map<int64_t, int64_t> SessionExpiryQueue::sessionToExpirationTime() const
 {
-    return session_to_expiration_time;
+    std::unordered_map<int64_t, int64_t> result;
+    result.reserve(sessions.size());
+    for (const auto & [session_id, entry] : sessions)
+        result.emplace(session_id, entry.expiration_time);
+    return result;
 }
 
 void SessionExpiryQueue::clear()
 {
-    session_to_expiration_time.clear();
-    expiry_to_sessions.clear();
+    sessions.clear();
+    std::fill(slots.begin(), slots.end(), nullptr);
+    expired_head = nullptr;
 }
 
 }
@@ -1,48 +1,81 @@
 #pragma once
 
-#include <chrono>
-#include <map>
 #include <unordered_map>
-#include <unordered_set>
+#include <vector>
+
+#include <Common/CoarseClock.h>
+#include <Service/MemoryUsage.h>
 
 namespace RK
 {
 
 /// Simple class for checking expired sessions. Main idea -- to round sessions
-/// timeouts and place all sessions into buckets rounded by their expired time.
-/// So we will have not too many different buckets and can check expired
-/// sessions quite fast.
-/// So buckets looks like this:
-/// [1630580418000] -> {1, 5, 6}
-/// [1630580418500] -> {2, 3}
+/// timeouts and place all sessions into slots of a timing wheel by their expired
+/// time, a slot stands for an expiration interval.
+/// So the wheel looks like this:
+/// [slot of 1630580418000] -> 1 <-> 5 <-> 6
+/// [slot of 1630580418500] -> 2 <-> 3
 /// ...
-/// When new session appear it's added to the existing bucket or create new bucket.
+/// Sessions of a slot are linked by pointers in their entries, so adding a session
+/// to a slot or moving it to another one on heartbeat is O(1) and allocates nothing.
+/// The wheel turns every WHEEL_SLOTS intervals, sessions expiring later than a turn
+/// share a slot with the ones of this turn and are checked by their expiration time.
 class SessionExpiryQueue
 {
 private:
-    /// Session -> timeout ms
-    std::unordered_map<int64_t, int64_t> session_to_expiration_time;
+    static constexpr size_t WHEEL_SLOTS = 4096;
+
+    struct Entry
+    {
+        int64_t session_id;
+        int64_t expiration_time;
+        /// In the expired list or in the slot of expiration_time
+        bool expired = false;
+        Entry * prev = nullptr;
+        Entry * next = nullptr;
+    };
+
+    /// Session -> entry, entries do not move for the map is node based
+    std::unordered_map<int64_t, Entry> sessions;
 
-    /// Expire time -> session expire near this time
-    std::map<int64_t, std::unordered_set<int64_t>> expiry_to_sessions;
+    /// Heads of lists of sessions, a slot holds sessions expiring in intervals whose index modulo WHEEL_SLOTS is
+    /// the slot index. They are changed by getExpiredSessions, which moves expired sessions to the expired list.
+    mutable std::vector<Entry *> slots;
+
+    /// Sessions expired and not removed yet
+    mutable Entry * expired_head = nullptr;
+
+    /// Intervals up to it are checked, sessions expiring in them are in the expired list.
+    mutable int64_t checked_interval;
 
     int64_t expiration_interval;
 
-    static int64_t getNowMilliseconds()
-    {
-        using namespace std::chrono;
-        return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
-    }
+    static int64_t getNowMilliseconds() { return static_cast<int64_t>(CoarseClock::nowMilliseconds()); }
 
-    /// Round time to the next expiration interval. The result used as a key for
-    /// expiry_to_sessions map.
+    /// Round time to the next expiration interval.
     int64_t roundToNextInterval(int64_t time) const { return (time / expiration_interval + 1) * expiration_interval; }
 
+    int64_t intervalOf(int64_t time) const { return time / expiration_interval; }
+    Entry *& slotOf(int64_t interval) const { return slots[static_cast<size_t>(interval) % WHEEL_SLOTS]; }
+
+    static void link(Entry *& head, Entry * entry);
+    static void unlink(Entry *& head, Entry * entry);
+
+    /// Link entry to its slot, or to the expired list if its interval is checked
+    void linkByExpirationTime(Entry * entry);
+    Entry *& headOf(const Entry * entry) const;
+
+    /// Move sessions of the slot which expire no later than now to the expired list
+    void moveExpired(Entry *& head, int64_t now) const;
+
 public:
     /// expiration_interval -- how often we will check new sessions and how small
-    /// buckets we will have. In ZooKeeper normal session timeout is around 30 seconds
+    /// slots we will have. In ZooKeeper normal session timeout is around 30 seconds
     /// and expiration_interval is about 500ms.
-    explicit SessionExpiryQueue(int64_t expiration_interval_) : expiration_interval(expiration_interval_) { }
+    explicit SessionExpiryQueue(int64_t expiration_interval_);
+
+    SessionExpiryQueue(const SessionExpiryQueue &) = delete;
+    SessionExpiryQueue & operator=(const SessionExpiryQueue &) = delete;
 
     /// Session was actually removed
     bool remove(int64_t session_id);
@@ -53,10 +86,12 @@ public:
     /// Get all expired sessions
     std::vector<int64_t> getExpiredSessions() const;
 
-    const std::unordered_map<int64_t, int64_t> & sessionToExpirationTime() const;
+    std::unordered_map<int64_t, int64_t> sessionToExpirationTime() const;
 
     void setSessionExpirationTime(int64_t session_id, int64_t expiration_time);
 
+    size_t getApproximateMemoryUsage() const { return hashTableMemoryUsage(sessions) + slots.capacity() * sizeof(Entry *); }
+
     void clear();
 };
 
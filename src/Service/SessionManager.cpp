@@ -7,29 +7,85 @@ int64_t SessionManager::getSessionID(int64_t session_timeout_ms)
 {
     std::lock_guard lock(session_mutex);
     auto new_id = session_id_counter++;
-    auto it = session_and_timeout.emplace(new_id, session_timeout_ms);
-    if (!it.second)
+    if (!session_and_timeout.emplace(new_id, session_timeout_ms))
     {
         LOG_DEBUG(log, "Session {} already exist, must applying a fuzzy log.", toHexString(new_id));
     }
     LOG_DEBUG(log, "New session {} created.", toHexString(new_id));
-    session_expiry_queue.addNewSessionOrUpdate(new_id, session_timeout_ms);
+    touchSession(new_id, session_timeout_ms);
     return new_id;
 }
 
+int64_t SessionManager::getSessionIDs(const std::vector<int64_t> & session_timeouts_ms)
+{
+    std::lock_guard lock(session_mutex);
+    auto first_id = session_id_counter;
+    session_id_counter += session_timeouts_ms.size();
+
+    for (size_t i = 0; i < session_timeouts_ms.size(); ++i)
+    {
+        auto new_id = first_id + static_cast<int64_t>(i);
+        if (!session_and_timeout.emplace(new_id, session_timeouts_ms[i]))
+            LOG_DEBUG(log, "Session {} already exist, must applying a fuzzy log.", toHexString(new_id));
+        touchSession(new_id, session_timeouts_ms[i]);
+    }
+
+    LOG_DEBUG(log, "New sessions [{}, {}) created.", toHexString(first_id), toHexString(session_id_counter));
+    return first_id;
+}
+
 bool SessionManager::updateSessionTimeout(int64_t session_id, int64_t /*session_timeout_ms*/)
 {
     std::lock_guard lock(session_mutex);
-    if (!session_and_timeout.contains(session_id))
+    auto it = session_and_timeout.find(session_id);
+    if (it == session_and_timeout.end())
     {
         LOG_WARNING(log, "Updating session timeout for {}, but it is already expired.", toHexString(session_id));
         return false;
     }
-    session_expiry_queue.addNewSessionOrUpdate(session_id, session_and_timeout[session_id]);
+    touchSession(session_id, it->second);
     LOG_INFO(log, "Updated session timeout for {}", toHexString(session_id));
     return true;
 }
 
+void SessionManager::addLocalSession(int64_t session_id)
+{
+    std::lock_guard lock(session_mutex);
+    local_sessions.insert(session_id);
+    auto it = session_and_timeout.find(session_id);
+    if (it != session_and_timeout.end())
+        touchSession(session_id, it->second);
+}
+
+void SessionManager::removeLocalSession(int64_t session_id)
+{
+    std::lock_guard lock(session_mutex);
+    local_sessions.erase(session_id);
+    if (track_only_local_sessions)
+        session_expiry_queue.remove(session_id);
+}
+
+void SessionManager::setTrackOnlyLocalSessions(bool only_local)
+{
+    std::lock_guard lock(session_mutex);
+    if (track_only_local_sessions == only_local)
+        return;
+    track_only_local_sessions = only_local;
+
+    if (only_local)
+    {
+        for (const auto & [session_id, _] : session_expiry_queue.sessionToExpirationTime())
+            if (!local_sessions.contains(session_id))
+                session_expiry_queue.remove(session_id);
+    }
+    else
+    {
+        for (const auto & [session_id, session_timeout_ms] : session_and_timeout)
+            session_expiry_queue.addNewSessionOrUpdate(session_id, session_timeout_ms);
+    }
+    LOG_INFO(log, "Track {} sessions in expiry queue", only_local ? "only local" : "all");
+}
+
 void SessionManager::reset()
 {
     std::lock_guard lock(session_mutex);
@@ -10,6 +10,8 @@
 #include <Common/IO/WriteBufferFromString.h>
 #include <common/logger_useful.h>
 
+#include <Service/CopyOnWriteMap.h>
+#include <Service/KeeperCommon.h>
 #include <Service/SessionExpiryQueue.h>
 #include <Service/formatHex.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
@@ -21,6 +23,7 @@ class SessionManager
 {
 public:
     using SessionAndTimeout = std::unordered_map<int64_t, int64_t>;
+    using SessionAndTimeoutMap = CopyOnWriteMap<int64_t, int64_t>;
     using SessionIDs = std::vector<int64_t>;
 
     explicit SessionManager(int64_t dead_session_check_period_ms)
@@ -32,14 +35,21 @@ public:
     /// Will increase session_id_counter and zxid.
     int64_t getSessionID(int64_t session_timeout_ms);
 
+    /// Allocate a range of session ids for sessions with the expiry timeouts, return the first one.
+    int64_t getSessionIDs(const std::vector<int64_t> & session_timeouts_ms);
+
     /// Update session timeout for session_id, invoked when client reconnect to keeper.
     bool updateSessionTimeout(int64_t session_id, int64_t session_timeout_ms);
 
-    void updateSessionExpirationTime(int64_t session_id)
+    /// Returns false if there is no such session
+    bool updateSessionExpirationTime(int64_t session_id)
     {
         std::lock_guard lock(session_mutex);
-        if (session_and_timeout.contains(session_id))
-            session_expiry_queue.addNewSessionOrUpdate(session_id, session_and_timeout[session_id]);
+        auto it = session_and_timeout.find(session_id);
+        if (it == session_and_timeout.end())
+            return false;
+        touchSession(session_id, it->second);
+        return true;
     }
 
     bool contains(int64_t session_id) const
@@ -48,11 +58,15 @@ public:
         return session_and_timeout.contains(session_id);
     }
 
-    void expireSession(int64_t session_id)
+    void expireSessions(const std::vector<int64_t> & session_ids)
     {
         std::lock_guard lock(session_mutex);
-        session_expiry_queue.remove(session_id);
-        session_and_timeout.erase(session_id);
+        for (auto session_id : session_ids)
+        {
+            session_expiry_queue.remove(session_id);
+            session_and_timeout.erase(session_id);
+            local_sessions.erase(session_id);
+        }
     }
 
     int64_t getSessionIDCounter() const
@@ -76,7 +90,14 @@ public:
     SessionAndTimeout getSessionAndTimeOut() const
     {
         std::lock_guard lock(session_mutex);
-        return session_and_timeout;
+        return session_and_timeout.toMap();
+    }
+
+    /// Version of sessions and timeouts for snapshot, later changes of sessions do not change it
+    SessionAndTimeoutMap::VersionPtr pinSessionAndTimeout() const
+    {
+        std::lock_guard lock(session_mutex);
+        return session_and_timeout.pin();
     }
 
     /// Add session id. Used when restoring KeeperStore from snapshot.
@@ -84,7 +105,7 @@ public:
     {
         std::lock_guard lock(session_mutex);
         session_and_timeout.emplace(session_id, session_timeout_ms);
-        session_expiry_queue.addNewSessionOrUpdate(session_id, session_timeout_ms);
+        touchSession(session_id, session_timeout_ms);
     }
 
     std::vector<int64_t> getDeadSessions() const
@@ -97,8 +118,7 @@ public:
     std::unordered_map<int64_t, int64_t> sessionToExpirationTime() const
     {
         std::lock_guard lock(session_mutex);
-        const auto & ret = session_expiry_queue.sessionToExpirationTime();
-        return ret;
+        return session_expiry_queue.sessionToExpirationTime();
     }
 
     void handleRemoteSession(int64_t session_id, int64_t expiration_time)
@@ -107,27 +127,65 @@ public:
         session_expiry_queue.setSessionExpirationTime(session_id, expiration_time);
     }
 
-    void dumpSessionIDs(WriteBuffer & buf, const String & delimiter = "\n") const
+    /// Approximate bytes of timeouts and expiry queue
+    size_t getApproximateMemoryUsage() const
     {
         std::lock_guard lock(session_mutex);
-        buf << "Sessions dump (" << session_and_timeout.size() << "):\n";
-        for (const auto & [session_id, _] : session_and_timeout)
+        return session_and_timeout.getApproximateMemoryUsage() + session_expiry_queue.getApproximateMemoryUsage();
+    }
+
+    /// Ids are taken under the lock and written by chunks out of it
+    void dumpSessionIDs(const DumpOutput & output) const
+    {
+        std::vector<int64_t> session_ids;
         {
-            buf << toHexString(session_id) << delimiter;
+            std::lock_guard lock(session_mutex);
+            session_ids.reserve(session_and_timeout.size());
+            for (const auto & [session_id, _] : session_and_timeout)
+                session_ids.push_back(session_id);
+        }
+
+        output("Sessions dump (" + std::to_string(session_ids.size()) + "):\n");
+        for (size_t begin = 0; begin < session_ids.size(); begin += DUMP_CHUNK_SIZE)
+        {
+            WriteBufferFromOwnString buf;
+            for (size_t i = begin; i < std::min(begin + DUMP_CHUNK_SIZE, session_ids.size()); ++i)
+                buf << toHexString(session_ids[i]) << "\n";
+            output(std::move(buf.str()));
         }
     }
 
+    /// Sessions of clients connected to this node, they are always tracked by expiry queue
+    void addLocalSession(int64_t session_id);
+    void removeLocalSession(int64_t session_id);
+
+    /// Whether expiry queue holds only local sessions. Only leader expires sessions, and other nodes sync expiration
+    /// time of their local sessions to it, so an observer, which never becomes leader, need not track remote ones
+    /// on every request applied. Tracking all sessions again starts their expiration time over.
+    void setTrackOnlyLocalSessions(bool only_local);
+
     void reset();
 
 private:
+    /// Update expiration time of session if it is tracked, session_mutex must be held
+    void touchSession(int64_t session_id, int64_t session_timeout_ms)
+    {
+        if (!track_only_local_sessions || local_sessions.contains(session_id))
+            session_expiry_queue.addNewSessionOrUpdate(session_id, session_timeout_ms);
+    }
+
     /// Hold session and initialized expiry timeout, only local sessions.
-    SessionAndTimeout session_and_timeout;
+    SessionAndTimeoutMap session_and_timeout;
 
     /// Hold session and expiry time
     /// For leader, holds all sessions in cluster.
-    /// For follower/leaner, holds only local sessions
+    /// For follower, holds all sessions too, it may become leader.
+    /// For observer, holds only local sessions, see setTrackOnlyLocalSessions.
     SessionExpiryQueue session_expiry_queue;
 
+    std::unordered_set<int64_t> local_sessions;
+    bool track_only_local_sessions = false;
+
     mutable std::mutex session_mutex;
 
     int64_t session_id_counter{1};
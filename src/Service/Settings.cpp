@@ -23,6 +23,8 @@ namespace FsyncModeNS
             return FsyncMode::FSYNC;
         else if (in == "fsync_batch")
             return FsyncMode::FSYNC_BATCH;
+        else if (in == "fsync_group")
+            return FsyncMode::FSYNC_GROUP;
         else
             throw Exception("Unknown config 'log_fsync_mode'.", ErrorCodes::UNKNOWN_SETTING);
     }
@@ -35,6 +37,8 @@ namespace FsyncModeNS
             return "fsync";
         else if (mode == FsyncMode::FSYNC_BATCH)
             return "fsync_batch";
+        else if (mode == FsyncMode::FSYNC_GROUP)
+            return "fsync_group";
         else
             throw Exception("Unknown config 'log_fsync_mode'.", ErrorCodes::UNKNOWN_SETTING);
     }
@@ -70,12 +74,36 @@ void RaftSettings::loadFromConfig(const String & config_elem, const Poco::Util::
             min_session_timeout_ms = Coordination::DEFAULT_MIN_SESSION_TIMEOUT_MS;
         }
         dead_session_check_period_ms = config.getUInt(get_key("dead_session_check_period_ms"), 500);
+        batch_close_sessions = config.getBool(get_key("batch_close_sessions"), false);
+        close_sessions_batch_size = config.getUInt64(get_key("close_sessions_batch_size"), 10000);
+        if (close_sessions_batch_size == 0)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "close_sessions_batch_size should be greater than 0");
+        max_close_sessions_per_second = config.getUInt64(get_key("max_close_sessions_per_second"), 0);
+        remove_expired_nodes_batch_size = config.getUInt64(get_key("remove_expired_nodes_batch_size"), 1000);
+        if (remove_expired_nodes_batch_size == 0)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "remove_expired_nodes_batch_size should be greater than 0");
+        digest_check_interval_ms = config.getUInt64(get_key("digest_check_interval_ms"), 0);
         heart_beat_interval_ms = config.getUInt(get_key("heart_beat_interval_ms"), 500);
         client_req_timeout_ms = config.getUInt(get_key("client_req_timeout_ms"), operation_timeout_ms);
         election_timeout_lower_bound_ms = config.getUInt(get_key("election_timeout_lower_bound_ms"), Coordination::ELECTION_TIMEOUT_LOWER_BOUND_MS);
         election_timeout_upper_bound_ms = config.getUInt(get_key("election_timeout_upper_bound_ms"), Coordination::ELECTION_TIMEOUT_UPPER_BOUND_MS);
         reserved_log_items = config.getUInt(get_key("reserved_log_items"), 1000000);
         snapshot_distance = config.getUInt(get_key("snapshot_distance"), 3000000);
+        max_append_entries = config.getUInt64(get_key("max_append_entries"), 100);
+        if (max_append_entries == 0)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "max_append_entries should be greater than 0");
+        max_append_bytes = config.getUInt64(get_key("max_append_bytes"), 0);
+        replication_window_bytes = config.getUInt64(get_key("replication_window_bytes"), 0);
+        relay_fetch_interval_ms = config.getUInt64(get_key("relay_fetch_interval_ms"), 10);
+        if (relay_fetch_interval_ms == 0)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "relay_fetch_interval_ms should be greater than 0");
+        max_catch_up_log_bytes = config.getUInt64(get_key("max_catch_up_log_bytes"), 0);
+        catch_up_link_bandwidth = config.getUInt64(get_key("catch_up_link_bandwidth"), 100 * 1024 * 1024);
+        catch_up_log_replay_rate = config.getUInt64(get_key("catch_up_log_replay_rate"), 100000);
+        snapshot_max_deferred_distance = config.getUInt64(get_key("snapshot_max_deferred_distance"), 0);
+        snapshot_defer_commit_rate = config.getUInt64(get_key("snapshot_defer_commit_rate"), 0);
+        snapshot_defer_commit_lag = config.getUInt64(get_key("snapshot_defer_commit_lag"), 0);
+        snapshot_stagger_interval_ms = config.getUInt64(get_key("snapshot_stagger_interval_ms"), 0);
         max_stored_snapshots = config.getUInt(get_key("max_stored_snapshots"), 5);
         startup_timeout = config.getUInt(get_key("startup_timeout"), 6000000);
         shutdown_timeout = config.getUInt(get_key("shutdown_timeout"), 5000);
@@ -89,7 +117,62 @@ void RaftSettings::loadFromConfig(const String & config_elem, const Poco::Util::
         max_batch_size = config.getUInt(get_key("max_batch_size"), 1000);
         log_fsync_mode = FsyncModeNS::parseFsyncMode(config.getString(get_key("log_fsync_mode"), "fsync_parallel"));
         log_fsync_interval = config.getUInt(get_key("log_fsync_interval"), 1000);
+        log_fsync_bytes = config.getUInt64(get_key("log_fsync_bytes"), 4194304);
+        log_fsync_interval_us = config.getUInt64(get_key("log_fsync_interval_us"), 10000);
         async_snapshot = config.getBool(get_key("async_snapshot"), true);
+        fork_snapshot = config.getBool(get_key("fork_snapshot"), false);
+        snapshot_compression = config.getBool(get_key("snapshot_compression"), false);
+        snapshot_columnar_format = config.getBool(get_key("snapshot_columnar_format"), false);
+        snapshot_on_shutdown = config.getBool(get_key("snapshot_on_shutdown"), false);
+        snapshot_transfer_chunk_size = config.getUInt64(get_key("snapshot_transfer_chunk_size"), 16777216);
+        snapshot_write_max_bytes_per_second = config.getUInt64(get_key("snapshot_write_max_bytes_per_second"), 0);
+        snapshot_transfer_max_bytes_per_second = config.getUInt64(get_key("snapshot_transfer_max_bytes_per_second"), 0);
+        incremental_snapshot_count = config.getUInt(get_key("incremental_snapshot_count"), 0);
+        data_tree_bucket_num = config.getUInt(get_key("data_tree_bucket_num"), 16);
+        if (data_tree_bucket_num == 0)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "data_tree_bucket_num should be greater than 0");
+        parallel_read = config.getBool(get_key("parallel_read"), false);
+        parallel_apply = config.getBool(get_key("parallel_apply"), false);
+        adaptive_batching = config.getBool(get_key("adaptive_batching"), false);
+        target_replication_latency_ms = config.getUInt(get_key("target_replication_latency_ms"), 10);
+        max_inflight_batches = config.getUInt(get_key("max_inflight_batches"), 1);
+        batch_new_sessions = config.getBool(get_key("batch_new_sessions"), false);
+        if (max_inflight_batches == 0)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "max_inflight_batches should be greater than 0");
+        linearizable_read = config.getBool(get_key("linearizable_read"), false);
+        observer_max_staleness_ms = config.getUInt64(get_key("observer_max_staleness_ms"), 0);
+        max_read_lag_entries = config.getUInt64(get_key("max_read_lag_entries"), 0);
+        max_read_lag_ms = config.getUInt64(get_key("max_read_lag_ms"), 0);
+        redirect_stale_reads = config.getBool(get_key("redirect_stale_reads"), false);
+        seen_zxid_wait_ms = config.getUInt64(get_key("seen_zxid_wait_ms"), 0);
+        read_only_mode = config.getBool(get_key("read_only_mode"), false);
+        auto_leader_balance = config.getBool(get_key("auto_leader_balance"), false);
+        leader_balance_interval_ms = config.getUInt64(get_key("leader_balance_interval_ms"), 60000);
+        leader_balance_margin_percent = config.getUInt64(get_key("leader_balance_margin_percent"), 20);
+        max_pending_requests = config.getUInt(get_key("max_pending_requests"), 0);
+        max_commit_lag = config.getUInt(get_key("max_commit_lag"), 0);
+        memory_soft_limit = config.getUInt64(get_key("memory_soft_limit"), 0);
+        memory_hard_limit = config.getUInt64(get_key("memory_hard_limit"), 0);
+        if (memory_soft_limit && memory_hard_limit && memory_soft_limit > memory_hard_limit)
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "memory_soft_limit should not be greater than memory_hard_limit");
+        max_watches_per_session = config.getUInt64(get_key("max_watches_per_session"), 0);
+        response_cache_max_entries = config.getUInt(get_key("response_cache_max_entries"), 0);
+        multi_read_threads = config.getUInt64(get_key("multi_read_threads"), 0);
+        multi_read_parallel_min_requests = config.getUInt64(get_key("multi_read_parallel_min_requests"), 64);
+        negative_lookup_filter = config.getBool(get_key("negative_lookup_filter"), false);
+        large_value_threshold = config.getUInt64(get_key("large_value_threshold"), 0);
+        intern_data_max_size = config.getUInt64(get_key("intern_data_max_size"), 0);
+        log_storage = config.getString(get_key("log_storage"), "file");
+        if (log_storage != "file" && log_storage != "memory")
+            throw Exception(ErrorCodes::ILLEGAL_SETTING_VALUE, "log_storage should be file or memory, got {}", log_storage);
+        log_io_uring = config.getBool(get_key("log_io_uring"), false);
+        log_preallocate = config.getBool(get_key("log_preallocate"), false);
+        log_direct_io = config.getBool(get_key("log_direct_io"), false);
+        log_cache_max_entries = config.getUInt(get_key("log_cache_max_entries"), 65536);
+        log_cache_max_bytes = config.getUInt64(get_key("log_cache_max_bytes"), 256 * 1024 * 1024);
+        log_compression = config.getBool(get_key("log_compression"), false);
+        forward_compression = config.getBool(get_key("forward_compression"), false);
+        last_committed_index_with_log_fsync = config.getBool(get_key("last_committed_index_with_log_fsync"), false);
     }
     catch (Exception & e)
     {
@@ -106,12 +189,28 @@ RaftSettingsPtr RaftSettings::getDefault()
     settings->min_session_timeout_ms = Coordination::DEFAULT_MIN_SESSION_TIMEOUT_MS;
     settings->operation_timeout_ms = Coordination::DEFAULT_OPERATION_TIMEOUT_MS;
     settings->dead_session_check_period_ms = 500;
+    settings->batch_close_sessions = false;
+    settings->close_sessions_batch_size = 10000;
+    settings->max_close_sessions_per_second = 0;
+    settings->remove_expired_nodes_batch_size = 1000;
+    settings->digest_check_interval_ms = 0;
     settings->heart_beat_interval_ms = 500;
     settings->client_req_timeout_ms = settings->operation_timeout_ms;
     settings->election_timeout_lower_bound_ms = Coordination::ELECTION_TIMEOUT_LOWER_BOUND_MS;
     settings->election_timeout_upper_bound_ms = Coordination::ELECTION_TIMEOUT_UPPER_BOUND_MS;
     settings->reserved_log_items = 10000000;
     settings->snapshot_distance = 3000000;
+    settings->max_append_entries = 100;
+    settings->max_append_bytes = 0;
+    settings->replication_window_bytes = 0;
+    settings->relay_fetch_interval_ms = 10;
+    settings->max_catch_up_log_bytes = 0;
+    settings->catch_up_link_bandwidth = 100 * 1024 * 1024;
+    settings->catch_up_log_replay_rate = 100000;
+    settings->snapshot_max_deferred_distance = 0;
+    settings->snapshot_defer_commit_rate = 0;
+    settings->snapshot_defer_commit_lag = 0;
+    settings->snapshot_stagger_interval_ms = 0;
     settings->max_stored_snapshots = 5;
     settings->shutdown_timeout = 5000;
     settings->startup_timeout = 6000000;
@@ -123,13 +222,61 @@ RaftSettingsPtr RaftSettings::getDefault()
     settings->configuration_change_tries_count = 30;
     settings->max_batch_size = 1000;
     settings->log_fsync_interval = 1000;
+    settings->log_fsync_bytes = 4194304;
+    settings->log_fsync_interval_us = 10000;
     settings->log_fsync_mode = FsyncMode::FSYNC_PARALLEL;
     settings->async_snapshot = true;
+    settings->fork_snapshot = false;
+    settings->snapshot_compression = false;
+    settings->snapshot_columnar_format = false;
+    settings->snapshot_on_shutdown = false;
+    settings->snapshot_transfer_chunk_size = 16777216;
+    settings->snapshot_write_max_bytes_per_second = 0;
+    settings->snapshot_transfer_max_bytes_per_second = 0;
+    settings->incremental_snapshot_count = 0;
+    settings->data_tree_bucket_num = 16;
+    settings->parallel_read = false;
+    settings->parallel_apply = false;
+    settings->adaptive_batching = false;
+    settings->target_replication_latency_ms = 10;
+    settings->max_inflight_batches = 1;
+    settings->batch_new_sessions = false;
+    settings->linearizable_read = false;
+    settings->observer_max_staleness_ms = 0;
+    settings->max_read_lag_entries = 0;
+    settings->max_read_lag_ms = 0;
+    settings->redirect_stale_reads = false;
+    settings->seen_zxid_wait_ms = 0;
+    settings->read_only_mode = false;
+    settings->auto_leader_balance = false;
+    settings->leader_balance_interval_ms = 60000;
+    settings->leader_balance_margin_percent = 20;
+    settings->max_pending_requests = 0;
+    settings->max_commit_lag = 0;
+    settings->memory_soft_limit = 0;
+    settings->memory_hard_limit = 0;
+    settings->max_watches_per_session = 0;
+    settings->response_cache_max_entries = 0;
+    settings->multi_read_threads = 0;
+    settings->multi_read_parallel_min_requests = 64;
+    settings->negative_lookup_filter = false;
+    settings->large_value_threshold = 0;
+    settings->intern_data_max_size = 0;
+    settings->log_storage = "file";
+    settings->log_io_uring = false;
+    settings->log_preallocate = false;
+    settings->log_direct_io = false;
+    settings->log_cache_max_entries = 65536;
+    settings->log_cache_max_bytes = 256 * 1024 * 1024;
+    settings->log_compression = false;
+    settings->forward_compression = false;
+    settings->last_committed_index_with_log_fsync = false;
 
     return settings;
 }
 
-const String Settings::DEFAULT_FOUR_LETTER_WORD_CMD = "conf,cons,crst,envi,ruok,srst,srvr,stat,wchs,dirs,mntr,isro,lgif,rqld,uptm,csnp";
+const String Settings::DEFAULT_FOUR_LETTER_WORD_CMD
+    = "conf,cons,crst,envi,ruok,srst,srvr,stat,wchs,dirs,mntr,isro,lgif,rqld,uptm,csnp,snps,hots,slow,lock,prof";
 
 Settings::Settings() : my_id(NOT_EXIST), port(NOT_EXIST), standalone_keeper(false), raft_settings(RaftSettings::getDefault())
 {
@@ -162,6 +309,28 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     writeText("parallel=", buf);
     write_int(parallel);
 
+    writeText("response_threads=", buf);
+    write_int(response_threads);
+
+    writeText("control_requests_weight=", buf);
+    write_int(control_requests_weight);
+
+    writeText("runner_placement=", buf);
+    writeText(runner_placement, buf);
+    buf.write('\n');
+
+    writeText("fair_queue_quantum=", buf);
+    write_int(fair_queue_quantum);
+
+    writeText("busy_poll_us=", buf);
+    write_int(busy_poll_us);
+
+    writeText("requests_queue_capacity=", buf);
+    write_int(requests_queue_capacity);
+
+    writeText("committed_queue_capacity=", buf);
+    write_int(committed_queue_capacity);
+
     writeText("snapshot_create_interval=", buf);
     write_int(snapshot_create_interval);
 
@@ -169,10 +338,17 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     writeText(four_letter_word_white_list, buf);
     buf.write('\n');
 
+    writeText("four_letter_word_threads=", buf);
+    write_int(four_letter_word_threads);
+
     writeText("log_dir=", buf);
     writeText(log_dir, buf);
     buf.write('\n');
 
+    writeText("log_cold_dir=", buf);
+    writeText(log_cold_dir, buf);
+    buf.write('\n');
+
     writeText("snapshot_dir=", buf);
     writeText(snapshot_dir, buf);
     buf.write('\n');
@@ -187,6 +363,16 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     write_int(raft_settings->operation_timeout_ms);
     writeText("dead_session_check_period_ms=", buf);
     write_int(raft_settings->dead_session_check_period_ms);
+    writeText("batch_close_sessions=", buf);
+    write_int(raft_settings->batch_close_sessions);
+    writeText("close_sessions_batch_size=", buf);
+    write_int(raft_settings->close_sessions_batch_size);
+    writeText("max_close_sessions_per_second=", buf);
+    write_int(raft_settings->max_close_sessions_per_second);
+    writeText("remove_expired_nodes_batch_size=", buf);
+    write_int(raft_settings->remove_expired_nodes_batch_size);
+    writeText("digest_check_interval_ms=", buf);
+    write_int(raft_settings->digest_check_interval_ms);
 
     writeText("heart_beat_interval_ms=", buf);
     write_int(raft_settings->heart_beat_interval_ms);
@@ -201,8 +387,46 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     write_int(raft_settings->reserved_log_items);
     writeText("snapshot_distance=", buf);
     write_int(raft_settings->snapshot_distance);
+    writeText("max_append_entries=", buf);
+    write_int(raft_settings->max_append_entries);
+    writeText("max_append_bytes=", buf);
+    write_int(raft_settings->max_append_bytes);
+    writeText("replication_window_bytes=", buf);
+    write_int(raft_settings->replication_window_bytes);
+    writeText("relay_fetch_interval_ms=", buf);
+    write_int(raft_settings->relay_fetch_interval_ms);
+    writeText("max_catch_up_log_bytes=", buf);
+    write_int(raft_settings->max_catch_up_log_bytes);
+    writeText("catch_up_link_bandwidth=", buf);
+    write_int(raft_settings->catch_up_link_bandwidth);
+    writeText("catch_up_log_replay_rate=", buf);
+    write_int(raft_settings->catch_up_log_replay_rate);
+    writeText("snapshot_max_deferred_distance=", buf);
+    write_int(raft_settings->snapshot_max_deferred_distance);
+    writeText("snapshot_defer_commit_rate=", buf);
+    write_int(raft_settings->snapshot_defer_commit_rate);
+    writeText("snapshot_defer_commit_lag=", buf);
+    write_int(raft_settings->snapshot_defer_commit_lag);
+    writeText("snapshot_stagger_interval_ms=", buf);
+    write_int(raft_settings->snapshot_stagger_interval_ms);
     writeText("async_snapshot=", buf);
     write_int(raft_settings->async_snapshot);
+    writeText("fork_snapshot=", buf);
+    write_int(raft_settings->fork_snapshot);
+    writeText("snapshot_compression=", buf);
+    write_int(raft_settings->snapshot_compression);
+    writeText("snapshot_columnar_format=", buf);
+    write_int(raft_settings->snapshot_columnar_format);
+    writeText("snapshot_on_shutdown=", buf);
+    write_int(raft_settings->snapshot_on_shutdown);
+    writeText("snapshot_transfer_chunk_size=", buf);
+    write_int(raft_settings->snapshot_transfer_chunk_size);
+    writeText("snapshot_write_max_bytes_per_second=", buf);
+    write_int(raft_settings->snapshot_write_max_bytes_per_second);
+    writeText("snapshot_transfer_max_bytes_per_second=", buf);
+    write_int(raft_settings->snapshot_transfer_max_bytes_per_second);
+    writeText("incremental_snapshot_count=", buf);
+    write_int(raft_settings->incremental_snapshot_count);
     writeText("max_stored_snapshots=", buf);
     write_int(raft_settings->max_stored_snapshots);
 
@@ -222,11 +446,90 @@ void Settings::dump(WriteBufferFromOwnString & buf) const
     buf.write('\n');
     writeText("log_fsync_interval=", buf);
     write_int(raft_settings->log_fsync_interval);
+    writeText("log_fsync_bytes=", buf);
+    write_int(raft_settings->log_fsync_bytes);
+    writeText("log_fsync_interval_us=", buf);
+    write_int(raft_settings->log_fsync_interval_us);
 
     writeText("nuraft_thread_size=", buf);
     write_int(raft_settings->nuraft_thread_size);
     writeText("fresh_log_gap=", buf);
     write_int(raft_settings->fresh_log_gap);
+    writeText("data_tree_bucket_num=", buf);
+    write_int(raft_settings->data_tree_bucket_num);
+    writeText("parallel_read=", buf);
+    write_int(raft_settings->parallel_read);
+    writeText("parallel_apply=", buf);
+    write_int(raft_settings->parallel_apply);
+    writeText("adaptive_batching=", buf);
+    write_int(raft_settings->adaptive_batching);
+    writeText("target_replication_latency_ms=", buf);
+    write_int(raft_settings->target_replication_latency_ms);
+    writeText("max_inflight_batches=", buf);
+    write_int(raft_settings->max_inflight_batches);
+    writeText("batch_new_sessions=", buf);
+    write_int(raft_settings->batch_new_sessions);
+    writeText("linearizable_read=", buf);
+    write_int(raft_settings->linearizable_read);
+    writeText("observer_max_staleness_ms=", buf);
+    write_int(raft_settings->observer_max_staleness_ms);
+    writeText("max_read_lag_entries=", buf);
+    write_int(raft_settings->max_read_lag_entries);
+    writeText("max_read_lag_ms=", buf);
+    write_int(raft_settings->max_read_lag_ms);
+    writeText("redirect_stale_reads=", buf);
+    write_int(raft_settings->redirect_stale_reads);
+    writeText("seen_zxid_wait_ms=", buf);
+    write_int(raft_settings->seen_zxid_wait_ms);
+    writeText("read_only_mode=", buf);
+    write_int(raft_settings->read_only_mode);
+    writeText("auto_leader_balance=", buf);
+    write_int(raft_settings->auto_leader_balance);
+    writeText("leader_balance_interval_ms=", buf);
+    write_int(raft_settings->leader_balance_interval_ms);
+    writeText("leader_balance_margin_percent=", buf);
+    write_int(raft_settings->leader_balance_margin_percent);
+    writeText("max_pending_requests=", buf);
+    write_int(raft_settings->max_pending_requests);
+    writeText("max_commit_lag=", buf);
+    write_int(raft_settings->max_commit_lag);
+    writeText("memory_soft_limit=", buf);
+    write_int(raft_settings->memory_soft_limit);
+    writeText("memory_hard_limit=", buf);
+    write_int(raft_settings->memory_hard_limit);
+    writeText("max_watches_per_session=", buf);
+    write_int(raft_settings->max_watches_per_session);
+    writeText("response_cache_max_entries=", buf);
+    write_int(raft_settings->response_cache_max_entries);
+    writeText("multi_read_threads=", buf);
+    write_int(raft_settings->multi_read_threads);
+    writeText("multi_read_parallel_min_requests=", buf);
+    write_int(raft_settings->multi_read_parallel_min_requests);
+    writeText("negative_lookup_filter=", buf);
+    write_int(raft_settings->negative_lookup_filter);
+    writeText("large_value_threshold=", buf);
+    write_int(raft_settings->large_value_threshold);
+    writeText("intern_data_max_size=", buf);
+    write_int(raft_settings->intern_data_max_size);
+    writeText("log_storage=", buf);
+    writeText(raft_settings->log_storage, buf);
+    buf.write('\n');
+    writeText("log_io_uring=", buf);
+    write_int(raft_settings->log_io_uring);
+    writeText("log_preallocate=", buf);
+    write_int(raft_settings->log_preallocate);
+    writeText("log_direct_io=", buf);
+    write_int(raft_settings->log_direct_io);
+    writeText("log_cache_max_entries=", buf);
+    write_int(raft_settings->log_cache_max_entries);
+    writeText("log_cache_max_bytes=", buf);
+    write_int(raft_settings->log_cache_max_bytes);
+    writeText("log_compression=", buf);
+    write_int(raft_settings->log_compression);
+    writeText("forward_compression=", buf);
+    write_int(raft_settings->forward_compression);
+    writeText("last_committed_index_with_log_fsync=", buf);
+    write_int(raft_settings->last_committed_index_with_log_fsync);
 }
 
 SettingsPtr Settings::loadFromConfig(const Poco::Util::AbstractConfiguration & config, bool standalone_keeper_)
@@ -244,6 +547,16 @@ SettingsPtr Settings::loadFromConfig(const Poco::Util::AbstractConfiguration & c
 
     ret->internal_port = config.getInt("keeper.internal_port", 8103);
     ret->parallel = config.getInt("keeper.parallel", getNumberOfPhysicalCPUCores());
+    ret->response_threads = std::max(config.getInt("keeper.response_threads", 1), 1);
+    ret->control_requests_weight = std::max(config.getInt("keeper.control_requests_weight", 16), 1);
+    ret->runner_placement = config.getString("keeper.runner_placement", "modulo");
+    if (ret->runner_placement != "modulo" && ret->runner_placement != "least_loaded")
+        throw Exception(
+            ErrorCodes::ILLEGAL_SETTING_VALUE, "runner_placement should be modulo or least_loaded, got {}", ret->runner_placement);
+    ret->fair_queue_quantum = config.getUInt64("keeper.fair_queue_quantum", 0);
+    ret->busy_poll_us = config.getUInt64("keeper.busy_poll_us", 0);
+    ret->requests_queue_capacity = std::max(config.getUInt64("keeper.requests_queue_capacity", 20000), UInt64(1));
+    ret->committed_queue_capacity = std::max(config.getUInt64("keeper.committed_queue_capacity", 1024), UInt64(1));
 
     ret->snapshot_create_interval = config.getUInt("keeper.snapshot_create_interval", 3600);
     ret->snapshot_create_interval = std::max(ret->snapshot_create_interval, 1U);
@@ -251,8 +564,10 @@ SettingsPtr Settings::loadFromConfig(const Poco::Util::AbstractConfiguration & c
     ret->super_digest = config.getString("keeper.superdigest", "");
 
     ret->four_letter_word_white_list = config.getString("keeper.four_letter_word_white_list", DEFAULT_FOUR_LETTER_WORD_CMD);
+    ret->four_letter_word_threads = std::max(config.getInt("keeper.four_letter_word_threads", 2), 1);
 
     ret->log_dir = getLogsPathFromConfig(config, standalone_keeper_);
+    ret->log_cold_dir = config.getString("keeper.log_cold_dir", "");
     ret->snapshot_dir = getSnapshotsPathFromConfig(config, standalone_keeper_);
 
     ret->raft_settings->loadFromConfig("keeper.raft_settings", config);
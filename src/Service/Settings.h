@@ -19,7 +19,10 @@ enum FsyncMode
     /// The leader and follower do log persisting synchronously. In this mode data is safety.
     FSYNC,
     /// The leader and follower do log persisting asynchronously and in batch. In this mode data is less safety.
-    FSYNC_BATCH
+    FSYNC_BATCH,
+    /// Like FSYNC_BATCH, but fsync when any of entry count, bytes and time since the first entry not fsynced
+    /// reaches its limit. In this mode data is less safety.
+    FSYNC_GROUP
 };
 
 namespace FsyncModeNS
@@ -46,12 +49,32 @@ struct Settings
     int32_t internal_port;
 
     String log_dir;
+    /// Directory closed log segments covered by the latest snapshot are moved to, it may be on cheaper storage.
+    /// Empty to keep all segments in log_dir.
+    String log_cold_dir;
     String snapshot_dir;
 
     uint32_t snapshot_create_interval;
     int32_t parallel;
+    /// Threads dispatching responses to connections, responses are sharded by session
+    int32_t response_threads;
+    /// How many control requests (heartbeats and session requests) are dispatched in a row when bulk requests are waiting
+    int32_t control_requests_weight;
+    /// How sessions are placed on runners of the request pipeline, modulo or least_loaded
+    String runner_placement = "modulo";
+    /// Read requests of a session processed in a row before other sessions of the runner take a turn, 0 means no limit
+    UInt64 fair_queue_quantum = 0;
+    /// Microseconds pipeline threads and IO reactors spin before blocking, 0 means no busy polling
+    UInt64 busy_poll_us = 0;
+    /// Capacity of the queues of requests from clients, to forward and to process, shared by the runners of a queue.
+    /// Lowered or raised at runtime by reloading config up to the value at startup, which is allocated up front.
+    UInt64 requests_queue_capacity = 20000;
+    /// Committed requests waiting to be applied above which leader holds new logs back, changed at runtime
+    UInt64 committed_queue_capacity = 1024;
 
     String four_letter_word_white_list;
+    /// Threads running four letter word commands, they are not run by IO threads for some of them are slow
+    int32_t four_letter_word_threads;
 
     String super_digest;
 
@@ -78,6 +101,16 @@ struct RaftSettings
     UInt64 operation_timeout_ms;
     /// How often leader will check sessions to consider them dead and remove
     UInt64 dead_session_check_period_ms;
+    /// Whether dead sessions are closed in batches by one log entry, older versions can not read it
+    bool batch_close_sessions;
+    /// Max dead sessions closed by one log entry
+    UInt64 close_sessions_batch_size;
+    /// Max speed of closing dead sessions, 0 means unlimited
+    UInt64 max_close_sessions_per_second;
+    /// Max expired TTL and container nodes removed by one log entry
+    UInt64 remove_expired_nodes_batch_size;
+    /// Interval of leader checking digest of data tree of all nodes, 0 disables the digest
+    UInt64 digest_check_interval_ms;
     /// Heartbeat interval between quorum nodes
     UInt64 heart_beat_interval_ms;
     /// Lower bound of election timer (avoid too often leader elections)
@@ -90,6 +123,30 @@ struct RaftSettings
     UInt64 reserved_log_items;
     /// How many log items we have to collect to write new snapshot00
     UInt64 snapshot_distance;
+    /// Max log entries of an append_entries request
+    UInt64 max_append_entries;
+    /// Max bytes of log entries of an append_entries request, at least one entry is sent, 0 means no limit
+    UInt64 max_append_bytes;
+    /// Max bytes of logs a follower has appended but not committed, the leader stops sending it logs until it
+    /// commits them, 0 means no limit
+    UInt64 replication_window_bytes;
+    /// Milliseconds a cascaded observer waits before fetching logs again when its upstream has no new ones
+    UInt64 relay_fetch_interval_ms;
+    /// Bytes of logs kept beyond reserved_log_items for a lagging follower if catching up by them is cheaper than by
+    /// a snapshot, 0 means never kept, see CatchUpPolicy
+    UInt64 max_catch_up_log_bytes;
+    /// Bytes per second of links between cluster members, used to estimate the costs of catching up
+    UInt64 catch_up_link_bandwidth;
+    /// Log entries per second a follower replays, used to estimate the costs of catching up
+    UInt64 catch_up_log_replay_rate;
+    /// How many log items beyond snapshot_distance a snapshot may be deferred by load or stagger, 0 means never deferred
+    UInt64 snapshot_max_deferred_distance;
+    /// Defer snapshots while more log items than this are committed per second, 0 means unlimited
+    UInt64 snapshot_defer_commit_rate;
+    /// Defer snapshots while more requests than this are waiting to be committed, 0 means unlimited
+    UInt64 snapshot_defer_commit_lag;
+    /// Cluster members create snapshots in turn in slots of this length, 0 means no stagger
+    UInt64 snapshot_stagger_interval_ms;
     /// How many snapshots we want to store
     UInt64 max_stored_snapshots;
     /// How many milliseconds we will wait until RAFT shutdown
@@ -110,10 +167,114 @@ struct RaftSettings
     UInt64 max_batch_size;
     /// Raft log fsync mode
     FsyncMode log_fsync_mode;
-    /// How many logs do once fsync when async_fsync is false
+    /// How many logs do once fsync in fsync_batch and fsync_group mode
     UInt64 log_fsync_interval;
+    /// How many bytes of logs do once fsync in fsync_group mode
+    UInt64 log_fsync_bytes;
+    /// How long the first log not fsynced waits in fsync_group mode
+    UInt64 log_fsync_interval_us;
     /// Whether async snapshot
     bool async_snapshot;
+    /// Whether create snapshot in a forked child process, it takes precedence over async_snapshot
+    bool fork_snapshot;
+    /// Whether compress snapshot objects, older versions can not read them
+    bool snapshot_compression;
+    /// Whether store data nodes of snapshots by column, older versions can not read them
+    bool snapshot_columnar_format;
+    /// Create a snapshot of the last committed log on graceful shutdown, so that the next startup replays no log
+    bool snapshot_on_shutdown;
+    /// Size of chunks snapshot objects are sent to followers in, 0 means sending whole objects
+    UInt64 snapshot_transfer_chunk_size;
+    /// Max speed of writing snapshot objects to disk, 0 means unlimited
+    UInt64 snapshot_write_max_bytes_per_second;
+    /// Max speed of sending snapshot objects to followers, 0 means unlimited
+    UInt64 snapshot_transfer_max_bytes_per_second;
+    /// How many incremental snapshots follow a full one, 0 means every snapshot is full
+    UInt32 incremental_snapshot_count;
+    /// Bucket count of the data tree, it is also the parallelism of loading and dumping the data tree.
+    /// Snapshots are resharded when loading, so it can be changed across restarts.
+    UInt64 data_tree_bucket_num;
+    /// Whether process read requests of different runners in parallel. Requests of a session always
+    /// go to the same runner, so session order is kept.
+    bool parallel_read;
+    /// Whether apply committed write requests touching disjoint buckets of data tree in parallel
+    bool parallel_apply;
+    /// Whether tune batch size and linger time of log replication against target_replication_latency_ms
+    bool adaptive_batching;
+    /// Target replication latency of a batch when adaptive_batching is enabled
+    UInt64 target_replication_latency_ms;
+    /// How many log replication batches can be in flight at the same time
+    UInt64 max_inflight_batches;
+    /// Whether new session requests of a log replication batch are written as one log entry, older versions can not read it
+    bool batch_new_sessions;
+    /// Whether serve read and sync requests after the node has applied the committed log index of the leader
+    bool linearizable_read;
+    /// Observers fail reads when they have not heard from leader for it, so that clients of a partitioned observer go
+    /// to other nodes rather than read data of arbitrary age, 0 means no bound
+    UInt64 observer_max_staleness_ms;
+    /// Followers and observers serve reads only when their applied log is within so many entries of the committed log
+    /// of leader, 0 means no bound. Clients connected in read only mode are not bounded.
+    UInt64 max_read_lag_entries;
+    /// Followers and observers serve reads only when their applied log is within so many milliseconds of the committed
+    /// log of leader, 0 means no bound
+    UInt64 max_read_lag_ms;
+    /// Whether a read beyond max_read_lag_entries or max_read_lag_ms fails with connection loss at once, so that the
+    /// client reconnects to another node, rather than waits for the node to catch up within operation timeout
+    bool redirect_stale_reads;
+    /// A client reconnecting with a zxid seen ahead of the applied one of this node is accepted, and the reads of its
+    /// session wait for the node to apply the zxid for so many milliseconds, then fail with connection loss. 0 means
+    /// the client is refused like ZooKeeper does.
+    UInt64 seen_zxid_wait_ms;
+    /// Whether a node without leader accepts sessions of clients connected in read only mode and serves their reads
+    /// from its last applied state, like read only mode of ZooKeeper
+    bool read_only_mode;
+    /// Whether leader yields leadership to a voting member of lower load, see LeaderBalancer
+    bool auto_leader_balance;
+    /// How often nodes measure and report their load for leader balancing
+    UInt64 leader_balance_interval_ms;
+    /// Leader yields only to a node whose load score is lower by so many percent of one metric
+    UInt64 leader_balance_margin_percent;
+    /// Connections stop reading requests when requests pending in the pipeline reach it, 0 means no limit
+    UInt64 max_pending_requests;
+    /// Connections stop reading requests when Raft logs committed but not applied reach it, 0 means no limit
+    UInt64 max_commit_lag;
+    /// Above it snapshot is created and caches are dropped, 0 means no limit
+    UInt64 memory_soft_limit;
+    /// Above it requests creating nodes or setting data are rejected, 0 means no limit
+    UInt64 memory_hard_limit;
+    /// Watches a session may have, requests setting a watch more fail, 0 means no limit
+    UInt64 max_watches_per_session;
+    /// Max entries of serialized get and list responses of popular znodes kept in store, 0 means disabled
+    UInt64 response_cache_max_entries;
+    /// Threads sub requests of big MultiRead requests are spread on together with the reader thread, 0 means disabled
+    UInt64 multi_read_threads;
+    /// MultiRead requests with fewer sub requests are processed on the reader thread only
+    UInt64 multi_read_parallel_min_requests;
+    /// Whether keep Bloom filters of paths in data tree, so that lookups of missing paths need not search it
+    bool negative_lookup_filter;
+    /// Node data of at least these bytes is kept in memory mapped files under snapshot dir instead of the heap,
+    /// 0 means disabled
+    UInt64 large_value_threshold;
+    /// Node data of at most these bytes is shared by nodes with the same data, 0 means disabled
+    UInt64 intern_data_max_size;
+    /// Storage of Raft log entries, "file" for segment files in log_dir or "memory" for benchmarks and tests
+    String log_storage;
+    /// Whether write and fdatasync Raft log by io_uring, falls back to plain syscalls if the kernel does not support it
+    bool log_io_uring;
+    /// Whether preallocate Raft log segments and keep a spare one, so that rotating does not create files on commit path
+    bool log_preallocate;
+    /// Whether write Raft log with O_DIRECT and O_DSYNC, so that fsync latency does not depend on page cache pressure
+    bool log_direct_io;
+    /// Max count of the latest log entries kept in memory for followers, 0 means disabled
+    UInt64 log_cache_max_entries;
+    /// Max bytes of the latest log entries kept in memory for followers
+    UInt64 log_cache_max_bytes;
+    /// Whether compress bodies of large Raft log entries on disk
+    bool log_compression;
+    /// Whether compress large batches of requests forwarded to the leader, older versions can not accept it
+    bool forward_compression;
+    /// Whether persist the last committed index after Raft log fsync, rather than by a thread of its own
+    bool last_committed_index_with_log_fsync;
 
     Poco::Logger * log = &Poco::Logger::get("RaftSettings");
 
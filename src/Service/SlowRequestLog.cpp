@@ -0,0 +1,127 @@
+#include <Service/SlowRequestLog.h>
+
+#include <fcntl.h>
+
+#include <Common/CoarseClock.h>
+#include <Common/Exception.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <Common/IO/WriteHelpers.h>
+#include <Service/formatHex.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+SlowRequestLog & SlowRequestLog::instance()
+{
+    static SlowRequestLog log;
+    return log;
+}
+
+void SlowRequestLog::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    initialize(
+        config.getBool("keeper.slow_request_log.enabled", true),
+        config.getUInt64("keeper.slow_request_log.threshold_ms", DEFAULT_THRESHOLD_MS),
+        config.getUInt64("keeper.slow_request_log.capacity", DEFAULT_CAPACITY),
+        config.getString("keeper.slow_request_log.file", ""));
+
+    if (isEnabled())
+        LOG_INFO(
+            &Poco::Logger::get("SlowRequestLog"),
+            "Logging requests slower than {}ms{}",
+            threshold_us.load() / 1000,
+            config.has("keeper.slow_request_log.file") ? " to " + config.getString("keeper.slow_request_log.file") : "");
+}
+
+void SlowRequestLog::initialize(bool enabled_, UInt64 threshold_ms, size_t capacity_, const String & file)
+{
+    std::lock_guard lock(mutex);
+    threshold_us.store(threshold_ms * 1000, std::memory_order_relaxed);
+    capacity = capacity_;
+    records.clear();
+    out.reset();
+    if (enabled_ && !file.empty())
+        out = std::make_unique<WriteBufferFromFile>(file, DEFAULT_BUFFER_SIZE, O_WRONLY | O_APPEND | O_CREAT);
+    enabled.store(enabled_, std::memory_order_relaxed);
+}
+
+bool SlowRequestLog::isSlow(const RequestTimeline & timeline) const
+{
+    if (!enabled.load(std::memory_order_relaxed) || !timeline.started() || !timeline.passed(RequestStage::SEND))
+        return false;
+    return timeline.endTime(RequestStage::SEND) - timeline.startTime() >= threshold_us.load(std::memory_order_relaxed);
+}
+
+void SlowRequestLog::add(Record && record)
+{
+    if (record.time_ms == 0)
+        record.time_ms = CoarseClock::nowMilliseconds();
+
+    std::lock_guard lock(mutex);
+    if (out)
+    {
+        try
+        {
+            String line = format(record);
+            line += '\n';
+            out->write(line.data(), line.size());
+            out->next();
+        }
+        catch (...)
+        {
+            tryLogCurrentException("SlowRequestLog", "Failed to write slow request");
+        }
+    }
+
+    if (capacity == 0)
+        return;
+    if (records.size() >= capacity)
+        records.pop_front();
+    records.push_back(std::move(record));
+}
+
+std::vector<SlowRequestLog::Record> SlowRequestLog::getRecords() const
+{
+    std::lock_guard lock(mutex);
+    return {records.begin(), records.end()};
+}
+
+String SlowRequestLog::format(const Record & record)
+{
+    WriteBufferFromOwnString buf;
+    writeDateTimeText(LocalDateTime(static_cast<time_t>(record.time_ms / 1000)), buf);
+    writeString(fmt::format(".{:03}", record.time_ms % 1000), buf);
+
+    writeString(
+        fmt::format(
+            "\t{}\t{}\t{}\t{}\t{}\t{}\t{}\t{}",
+            toHexString(record.session_id),
+            record.xid,
+            Coordination::toString(record.opnum),
+            record.path,
+            record.request_bytes,
+            record.response_bytes,
+            Coordination::errorMessage(record.error),
+            record.total_us),
+        buf);
+
+    /// Stages skipped by the request or shorter than 1us are omitted
+    char delimiter = '\t';
+    for (size_t stage = 0; stage < RequestTimeline::STAGES; ++stage)
+    {
+        if (record.stage_us[stage] == 0)
+            continue;
+        writeString(fmt::format("{}{}={}", delimiter, toString(static_cast<RequestStage>(stage)), record.stage_us[stage]), buf);
+        delimiter = ',';
+    }
+    return buf.str();
+}
+
+void SlowRequestLog::reset()
+{
+    std::lock_guard lock(mutex);
+    records.clear();
+}
+
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <Common/IO/WriteBufferFromFile.h>
+#include <Common/RequestTimeline.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+
+namespace RK
+{
+
+/** Log of requests whose latency from read to response sent is over threshold_ms, with durations of the stages they
+  * passed, so that slow requests can be explained without debug logs. The last capacity records are kept in memory and
+  * shown by 4lw command slow, they are also appended to file if it is set. Slow requests are rare, so records are
+  * written by the connection thread sending the response.
+  *
+  * Configured by keeper.slow_request_log.{enabled, threshold_ms, capacity, file}, enabled by default.
+  */
+class SlowRequestLog
+{
+public:
+    struct Record
+    {
+        /// Unix time in milliseconds the response was sent
+        UInt64 time_ms = 0;
+        int64_t session_id = 0;
+        Coordination::XID xid = 0;
+        Coordination::OpNum opnum = Coordination::OpNum::Error;
+        String path;
+        size_t request_bytes = 0;
+        size_t response_bytes = 0;
+        Coordination::Error error = Coordination::Error::ZOK;
+        UInt64 total_us = 0;
+        std::array<UInt64, RequestTimeline::STAGES> stage_us{};
+    };
+
+    static SlowRequestLog & instance();
+
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+    /// Empty file keeps records in memory only
+    void initialize(bool enabled_, UInt64 threshold_ms, size_t capacity_, const String & file);
+
+    bool isEnabled() const { return enabled.load(std::memory_order_relaxed); }
+
+    /// Whether the request of timeline which passed all its stages is slow
+    bool isSlow(const RequestTimeline & timeline) const;
+
+    /// Invoked for slow requests by connection
+    void add(Record && record);
+
+    /// Oldest first
+    std::vector<Record> getRecords() const;
+
+    /// Tab separated line without line feed
+    static String format(const Record & record);
+
+    void reset();
+
+    static constexpr UInt64 DEFAULT_THRESHOLD_MS = 1000;
+    static constexpr size_t DEFAULT_CAPACITY = 100;
+
+private:
+    SlowRequestLog() = default;
+
+    std::atomic<bool> enabled{false};
+    std::atomic<UInt64> threshold_us{DEFAULT_THRESHOLD_MS * 1000};
+
+    mutable std::mutex mutex;
+    size_t capacity = DEFAULT_CAPACITY;
+    std::deque<Record> records;
+    std::unique_ptr<WriteBufferFromFile> out;
+};
+
+}
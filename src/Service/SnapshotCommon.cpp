@@ -1,9 +1,18 @@
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <sstream>
+#include <unordered_map>
+#include <Poco/DeflatingStream.h>
 #include <Poco/File.h>
+#include <Poco/InflatingStream.h>
+#include <Poco/MemoryStream.h>
 
 #include <Common/Exception.h>
 #include <Common/IO/WriteHelpers.h>
 
 #include <Service/KeeperUtils.h>
+#include <Service/LatencyInjection.h>
 #include <Service/ReadBufferFromNuRaftBuffer.h>
 #include <Service/SnapshotCommon.h>
 #include <Service/WriteBufferFromNuraftBuffer.h>
@@ -34,6 +43,12 @@ String toString(SnapshotVersion version)
             return "v1";
         case SnapshotVersion::V2:
             return "v2";
+        case SnapshotVersion::V3:
+            return "v3";
+        case SnapshotVersion::V4:
+            return "v4";
+        case SnapshotVersion::V5:
+            return "v5";
         case SnapshotVersion::None:
             return "none";
     }
@@ -60,6 +75,12 @@ bool isSnapshotFileTail(UInt64 magic)
     return magic == magic_num;
 }
 
+Poco::Logger * getSnapshotLogger()
+{
+    static Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+    return log;
+}
+
 int openFileForWrite(const String & path)
 {
     int snap_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
@@ -88,6 +109,7 @@ void writeTailAndClose(ptr<WriteBufferFromFile> & out, UInt32 checksum)
 {
     out->write(MAGIC_SNAPSHOT_TAIL.data(), MAGIC_SNAPSHOT_TAIL.size());
     writeIntBinary(checksum, *out);
+    LatencyInjection::instance().delay(InjectionPoint::SNAPSHOT_WRITE);
     out->next();
     out->close();
 }
@@ -104,7 +126,7 @@ UInt32 updateCheckSum(UInt32 checksum, UInt32 data_crc)
     return RK::getCRC32(reinterpret_cast<const char *>(&data), 8);
 }
 
-String serializeKeeperNode(const String & path, const ptr<KeeperNode> & node, SnapshotVersion version)
+String serializeKeeperNode(const String & path, const KeeperNodePtr & node, SnapshotVersion version)
 {
     WriteBufferFromOwnString buf;
 
@@ -122,18 +144,18 @@ String serializeKeeperNode(const String & path, const ptr<KeeperNode> & node, Sn
 
     Coordination::write(node->is_ephemeral, buf);
     Coordination::write(node->is_sequential, buf);
-    Coordination::write(node->stat, buf);
+    Coordination::write(node->persistedStat(), buf);
 
     return std::move(buf.str());
 }
 
-ptr<KeeperNodeWithPath>parseKeeperNode(const String & buf, SnapshotVersion version)
+ptr<KeeperNodeWithPath> parseKeeperNode(std::string_view buf, SnapshotVersion version)
 {
     ReadBufferFromMemory in(buf.data(), buf.size());
 
     ptr<KeeperNodeWithPath> node_with_path = cs_new<KeeperNodeWithPath>();
     auto & node = node_with_path->node;
-    node = std::make_shared<KeeperNode>();
+    node = KeeperNode::create();
 
     Coordination::read(node_with_path->path, in);
     Coordination::read(node->data, in);
@@ -149,7 +171,9 @@ ptr<KeeperNodeWithPath>parseKeeperNode(const String & buf, SnapshotVersion versi
 
     Coordination::read(node->is_ephemeral, in);
     Coordination::read(node->is_sequential, in);
-    Coordination::read(node->stat, in);
+    Coordination::Stat stat;
+    Coordination::read(stat, in);
+    node->setPersistedStat(stat);
 
     node->children.reserve(node->stat.numChildren);
 
@@ -157,12 +181,15 @@ ptr<KeeperNodeWithPath>parseKeeperNode(const String & buf, SnapshotVersion versi
 }
 
 
-std::pair<size_t, UInt32> saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch)
+std::pair<size_t, UInt32>
+saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, SnapshotVersion version, Throttler * throttler)
 {
     if (!batch)
         batch = cs_new<SnapshotBatchBody>();
 
     String str_buf = SnapshotBatchBody::serialize(*batch);
+    if (version >= SnapshotVersion::V3)
+        str_buf = SnapshotBatchBody::compress(str_buf);
 
     SnapshotBatchHeader header;
     header.data_length = str_buf.size();
@@ -174,21 +201,29 @@ std::pair<size_t, UInt32> saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<Snapsh
     out->write(str_buf.c_str(), header.data_length);
     out->next();
 
+    if (throttler)
+        throttler->add(SnapshotBatchHeader::HEADER_SIZE + header.data_length);
+
     return {SnapshotBatchHeader::HEADER_SIZE + header.data_length, header.data_crc};
 }
 
-std::pair<size_t, UInt32>
-saveBatchAndUpdateCheckSumV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, UInt32 checksum)
+std::pair<size_t, UInt32> saveBatchAndUpdateCheckSumV2(
+    ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, UInt32 checksum, SnapshotVersion version, Throttler * throttler)
 {
-    auto [save_size, data_crc] = saveBatchV2(out, batch);
+    auto [save_size, data_crc] = saveBatchV2(out, batch, version, throttler);
     /// rebuild batch
     batch = cs_new<SnapshotBatchBody>();
     return {save_size, updateCheckSum(checksum, data_crc)};
 }
 
-void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch_size, SnapshotVersion version)
+void serializeAclsV2(
+    const CopyOnWriteMapView<uint64_t, ACLsPtr> & acl_map,
+    String path,
+    UInt32 save_batch_size,
+    SnapshotVersion version,
+    Throttler * throttler)
 {
-    Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+    Poco::Logger * log = getSnapshotLogger();
 
     LOG_INFO(log, "Begin create snapshot acl object, acl size {}, path {}", acl_map.size(), path);
 
@@ -207,7 +242,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, throttler);
                 checksum = new_checksum;
             }
             batch = cs_new<SnapshotBatchBody>();
@@ -217,7 +252,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
         /// append to batch
         WriteBufferFromNuraftBuffer buf;
         Coordination::write(acl_it.first, buf);
-        Coordination::write(acl_it.second, buf);
+        Coordination::write(*acl_it.second, buf);
 
         ptr<buffer> data = buf.getBuffer();
         data->pos(0);
@@ -227,7 +262,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
     }
 
     /// flush the last acl batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, throttler);
     checksum = new_checksum;
 
     writeTailAndClose(out, checksum);
@@ -236,7 +271,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
 
 [[maybe_unused]] size_t serializeEphemeralsV2(KeeperStore::Ephemerals & ephemerals, std::mutex & mutex, String path, UInt32 save_batch_size)
 {
-    Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+    Poco::Logger * log = getSnapshotLogger();
     LOG_INFO(log, "Begin create snapshot ephemeral object, node size {}, path {}", ephemerals.size(), path);
 
     ptr<SnapshotBatchBody> batch;
@@ -260,7 +295,7 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
             if (index != 0)
             {
                 /// write data in batch to file
-                saveBatchV2(out, batch);
+                saveBatchV2(out, batch, SnapshotVersion::V2);
             }
             batch = cs_new<SnapshotBatchBody>();
             batch->type = SnapshotBatchType::SNAPSHOT_TYPE_DATA_EPHEMERAL;
@@ -284,14 +319,20 @@ void serializeAclsV2(const NumToACLMap & acl_map, String path, UInt32 save_batch
     }
 
     /// flush the last batch
-    saveBatchV2(out, batch);
+    saveBatchV2(out, batch, SnapshotVersion::V2);
     out->close();
     return 1;
 }
 
-void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth & session_and_auth, UInt32 save_batch_size, const SnapshotVersion version, String & path)
+void serializeSessionsV2(
+    const CopyOnWriteMapView<int64_t, int64_t> & session_and_timeout,
+    const CopyOnWriteMapView<int64_t, Coordination::AuthIDs> & session_and_auth,
+    UInt32 save_batch_size,
+    const SnapshotVersion version,
+    String & path,
+    Throttler * throttler)
 {
-    Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+    Poco::Logger * log = getSnapshotLogger();
     auto out = openFileAndWriteHeader(path, version);
     LOG_INFO(log, "Begin create snapshot session object, session size {}, path {}", session_and_timeout.size(), path);
 
@@ -309,7 +350,7 @@ void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, throttler);
                 checksum = new_checksum;
             }
             batch = cs_new<SnapshotBatchBody>();
@@ -321,10 +362,9 @@ void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth
         Coordination::write(session_it.first, buf); //NewSession
         Coordination::write(session_it.second, buf); //Timeout_ms
 
-        Coordination::AuthIDs ids;
-        if (session_and_auth.count(session_it.first))
-            ids = session_and_auth.at(session_it.first);
-        Coordination::write(ids, buf);
+        static const Coordination::AuthIDs no_auth;
+        auto auth_it = session_and_auth.find(session_it.first);
+        Coordination::write(auth_it != session_and_auth.end() ? auth_it->second : no_auth, buf);
 
         ptr<buffer> data = buf.getBuffer();
         data->pos(0);
@@ -334,15 +374,15 @@ void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth
     }
 
     /// flush the last batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, throttler);
     checksum = new_checksum;
     writeTailAndClose(out, checksum);
 }
 
 template <typename T>
-void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path)
+void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path, Throttler * throttler)
 {
-    Poco::Logger * log = &(Poco::Logger::get("KeeperSnapshotStore"));
+    Poco::Logger * log = getSnapshotLogger();
     LOG_INFO(log, "Begin create snapshot map object, map size {}, path {}", snap_map.size(), path);
 
     auto out = openFileAndWriteHeader(path, version);
@@ -360,7 +400,7 @@ void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion versio
             if (index != 0)
             {
                 /// write data in batch to file
-                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+                auto [save_size, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, throttler);
                 checksum = new_checksum;
             }
 
@@ -386,13 +426,15 @@ void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion versio
     }
 
     /// flush the last batch
-    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum);
+    auto [_, new_checksum] = saveBatchAndUpdateCheckSumV2(out, batch, checksum, version, throttler);
     checksum = new_checksum;
     writeTailAndClose(out, checksum);
 }
 
-template void serializeMapV2<StringMap>(StringMap & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path);
-template void serializeMapV2<IntMap>(IntMap & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path);
+template void
+serializeMapV2<StringMap>(StringMap & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path, Throttler * throttler);
+template void
+serializeMapV2<IntMap>(IntMap & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path, Throttler * throttler);
 
 void SnapshotBatchBody::add(const String & element)
 {
@@ -444,14 +486,131 @@ ptr<SnapshotBatchBody> SnapshotBatchBody::parse(const String & data)
     return batch_body;
 }
 
-void parseBatchDataV2(KeeperStore & store, SnapshotBatchBody & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version)
+String SnapshotBatchBody::compress(const String & data)
+{
+    std::ostringstream compressed;
+    compressed.put(static_cast<char>(SnapshotBatchCompression::ZLIB));
+    UInt32 data_size = data.size();
+    compressed.write(reinterpret_cast<const char *>(&data_size), sizeof(data_size));
+    {
+        /// Fastest level, objects are compressed when creating snapshot
+        Poco::DeflatingOutputStream deflating(compressed, Poco::DeflatingStreamBuf::STREAM_ZLIB, 1);
+        deflating.write(data.data(), data.size());
+        deflating.close();
+    }
+
+    String compressed_data = compressed.str();
+    if (compressed_data.size() < data.size() + 1)
+        return compressed_data;
+
+    String raw;
+    raw.reserve(data.size() + 1);
+    raw.push_back(static_cast<char>(SnapshotBatchCompression::NONE));
+    raw.append(data);
+    return raw;
+}
+
+String SnapshotBatchBody::decompress(const String & data)
+{
+    String buf;
+    auto res = decompress(std::string_view(data), buf);
+    return res.data() == buf.data() ? buf : String(res);
+}
+
+std::string_view SnapshotBatchBody::decompress(std::string_view data, String & buf)
+{
+    if (data.empty())
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot batch is empty");
+
+    auto compression = static_cast<SnapshotBatchCompression>(data[0]);
+    if (compression == SnapshotBatchCompression::NONE)
+        return data.substr(1);
+
+    if (compression != SnapshotBatchCompression::ZLIB)
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Unknown compression {} of snapshot batch", static_cast<int>(compression));
+
+    UInt32 data_size;
+    if (data.size() < 1 + sizeof(data_size))
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Compressed snapshot batch of {} bytes is too short", data.size());
+    memcpy(&data_size, data.data() + 1, sizeof(data_size));
+
+    buf.resize(data_size);
+    Poco::MemoryInputStream compressed(data.data() + 1 + sizeof(data_size), data.size() - 1 - sizeof(data_size));
+    Poco::InflatingInputStream inflating(compressed, Poco::InflatingStreamBuf::STREAM_ZLIB);
+    inflating.read(buf.data(), data_size);
+    if (static_cast<size_t>(inflating.gcount()) != data_size)
+        throw Exception(
+            ErrorCodes::CORRUPTED_SNAPSHOT, "Cannot decompress snapshot batch, expect {} bytes, got {}", data_size, inflating.gcount());
+    return buf;
+}
+
+SnapshotBatchView SnapshotBatchView::parse(std::string_view data)
+{
+    SnapshotBatchView batch;
+    ReadBufferFromMemory in(data.data(), data.size());
+    int32_t type;
+    readIntBinary(type, in);
+    batch.type = static_cast<SnapshotBatchType>(type);
+    int32_t element_count;
+    readIntBinary(element_count, in);
+    batch.elements.reserve(element_count);
+    for (int i = 0; i < element_count; i++)
+    {
+        int32_t element_size;
+        readIntBinary(element_size, in);
+        if (element_size < 0 || static_cast<size_t>(in.buffer().end() - in.position()) < static_cast<size_t>(element_size))
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot batch element {} of {} bytes is beyond the batch", i, element_size);
+        batch.elements.emplace_back(in.position(), element_size);
+        in.ignore(element_size);
+    }
+    return batch;
+}
+
+namespace
+{
+/// Nodes parsed from a data batch are put into buckets, parent relationship is built after all objects are loaded.
+void addParsedNode(KeeperStore & store, String && path, KeeperNodePtr && node, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
+{
+    /// Some strange ACLID during deserialization from ZooKeeper
+    if (node->acl_id == std::numeric_limits<uint64_t>::max())
+        node->acl_id = 0;
+
+    store.acl_map.addUsage(node->acl_id);
+
+    /// Children are not linked yet, containers with children are dropped from the index by the first check
+    auto ephemeral_owner = node->stat.ephemeralOwner;
+    if (isEphemeralOwner(ephemeral_owner))
+        store.addEphemeralNode(ephemeral_owner, path);
+    else
+        store.indexExpiringNode(path, *node);
+
+    if (likely(path != "/"))
+    {
+        auto rslash_pos = path.rfind('/');
+
+        if (unlikely(rslash_pos == String::npos))
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't find parent path for path {}", path);
+
+        auto parent_path = rslash_pos == 0 ? "/" : path.substr(0, rslash_pos);
+
+        // Storage edges in different bucket, according to the bucket index of parent node.
+        // Which allow us to insert child paths for all nodes in parallel.
+        buckets_edges[store.getBucketIndex(parent_path)].emplace_back(std::move(parent_path), path.substr(rslash_pos + 1));
+    }
+
+    bucket_nodes[store.getBucketIndex(path)].emplace_back(std::move(path), std::move(node));
+}
+}
+
+void parseBatchDataV2(
+    KeeperStore & store, const SnapshotBatchView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version)
 {
     for (size_t i = 0; i < batch.size(); i++)
     {
-        const auto & data = batch[i];
+        std::string_view data = batch[i];
 
         String path;
-        ptr<KeeperNode> node;
+        KeeperNodePtr node;
 
         try
         {
@@ -468,39 +627,15 @@ void parseBatchDataV2(KeeperStore & store, SnapshotBatchBody & batch, BucketEdge
         if (version == SnapshotVersion::V0)
             node->acl_id = 0;
 
-        /// Some strange ACLID during deserialization from ZooKeeper
-        if (node->acl_id == std::numeric_limits<uint64_t>::max())
-            node->acl_id = 0;
-
-        store.acl_map.addUsage(node->acl_id);
-
-        auto ephemeral_owner = node->stat.ephemeralOwner;
-        if (ephemeral_owner != 0)
-            store.addEphemeralNode(ephemeral_owner, path);
-
-        if (likely(path != "/"))
-        {
-            auto rslash_pos = path.rfind('/');
-
-            if (unlikely(rslash_pos < 0))
-                throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't find parent path for path {}", path);
-
-            auto parent_path = rslash_pos == 0 ? "/" : path.substr(0, rslash_pos);
-
-            // Storage edges in different bucket, according to the bucket index of parent node.
-            // Which allow us to insert child paths for all nodes in parallel.
-            buckets_edges[store.getBucketIndex(parent_path)].emplace_back(std::move(parent_path), path.substr(rslash_pos + 1));
-        }
-
-        bucket_nodes[store.getBucketIndex(path)].emplace_back(std::move(path), std::move(node));
+        addParsedNode(store, std::move(path), std::move(node), buckets_edges, bucket_nodes);
     }
 }
 
-void parseBatchSessionV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version)
+void parseBatchSessionV2(KeeperStore & store, const SnapshotBatchView & batch, SnapshotVersion version)
 {
     for (size_t i = 0; i < batch.size(); i++)
     {
-        const String & data = batch[i];
+        std::string_view data = batch[i];
         ReadBufferFromMemory in(data.data(), data.size());
 
         int64_t session_id;
@@ -527,13 +662,13 @@ void parseBatchSessionV2(KeeperStore & store, SnapshotBatchBody & batch, Snapsho
     }
 }
 
-void parseBatchAclMapV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version)
+void parseBatchAclMapV2(KeeperStore & store, const SnapshotBatchView & batch, SnapshotVersion version)
 {
     if (version >= SnapshotVersion::V1)
     {
         for (size_t i = 0; i < batch.size(); i++)
         {
-            const String & data = batch[i];
+            std::string_view data = batch[i];
             ReadBufferFromMemory in(data.data(), data.size());
 
             uint64_t acl_id;
@@ -554,12 +689,12 @@ void parseBatchAclMapV2(KeeperStore & store, SnapshotBatchBody & batch, Snapshot
     }
 }
 
-void parseBatchIntMapV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion /*version*/)
+IntMap parseBatchIntMapV2(const SnapshotBatchView & batch)
 {
     IntMap int_map;
     for (size_t i = 0; i < batch.size(); i++)
     {
-        const String & data = batch[i];
+        std::string_view data = batch[i];
         ReadBufferFromMemory in(data.data(), data.size());
 
         String key;
@@ -576,6 +711,12 @@ void parseBatchIntMapV2(KeeperStore & store, SnapshotBatchBody & batch, Snapshot
         }
         int_map[key] = value;
     }
+    return int_map;
+}
+
+void parseBatchIntMapV2(KeeperStore & store, const SnapshotBatchView & batch, SnapshotVersion /*version*/)
+{
+    IntMap int_map = parseBatchIntMapV2(batch);
     if (int_map.find("ZXID") != int_map.end())
     {
         store.setZxid(int_map["ZXID"]);
@@ -584,6 +725,259 @@ void parseBatchIntMapV2(KeeperStore & store, SnapshotBatchBody & batch, Snapshot
     {
         store.setSessionIDCounter(int_map["SESSIONID"]);
     }
+    if (int_map.find("BUCKET_NUM") != int_map.end() && static_cast<UInt64>(int_map["BUCKET_NUM"]) != store.getDataTreeBucketNum())
+    {
+        LOG_INFO(
+            getSnapshotLogger(),
+            "Snapshot is created with data tree bucket num {}, resharding it into {} buckets",
+            int_map["BUCKET_NUM"],
+            store.getDataTreeBucketNum());
+    }
+}
+
+namespace
+{
+/// Columns of SNAPSHOT_TYPE_DATA_COLUMNS batch, in the order of batch elements.
+enum ColumnarBatchColumn : size_t
+{
+    COLUMN_PATH = 0, /// Node count, then shared prefix length, suffix length and suffix of every path
+    COLUMN_DATA_LENGTH,
+    COLUMN_DATA,
+    COLUMN_ACL_ID,
+    COLUMN_FLAGS, /// A byte of every node, bit 0 is ephemeral, bit 1 is sequential
+    COLUMN_CZXID, /// Delta to czxid of the previous node
+    COLUMN_MZXID, /// Delta to czxid
+    COLUMN_PZXID, /// Delta to czxid
+    COLUMN_CTIME, /// Delta to ctime of the previous node
+    COLUMN_MTIME, /// Delta to ctime
+    COLUMN_EPHEMERAL_OWNER,
+    COLUMN_VERSION,
+    COLUMN_CVERSION,
+    COLUMN_AVERSION,
+    COLUMN_NUM_CHILDREN,
+    /// 0 if data of the node is in data columns, or k if it is the k-th distinct data of the batch written before.
+    /// Batches written before it have no such column.
+    COLUMN_DATA_REF,
+    COLUMN_COUNT,
+};
+
+constexpr size_t COLUMN_COUNT_WITHOUT_DATA_REF = COLUMN_DATA_REF;
+
+/// Shorter data is written again rather than referenced, it takes less than the lookup.
+constexpr size_t MIN_DATA_REF_SIZE = 8;
+
+constexpr UInt8 COLUMN_FLAG_EPHEMERAL = 1;
+constexpr UInt8 COLUMN_FLAG_SEQUENTIAL = 2;
+
+/// Unlike writeVarUInt, all 64 bits are kept, since session ids in ephemeral owner may use the highest bit.
+void writeColumnUInt(UInt64 x, WriteBuffer & out)
+{
+    while (x > 0x7F)
+    {
+        writeChar(static_cast<char>((x & 0x7F) | 0x80), out);
+        x >>= 7;
+    }
+    writeChar(static_cast<char>(x), out);
+}
+
+void writeColumnInt(Int64 x, WriteBuffer & out)
+{
+    writeColumnUInt((static_cast<UInt64>(x) << 1) ^ static_cast<UInt64>(x >> 63), out);
+}
+
+/// Difference which wraps around instead of overflowing, restored by addDelta.
+Int64 delta(Int64 x, Int64 base)
+{
+    return static_cast<Int64>(static_cast<UInt64>(x) - static_cast<UInt64>(base));
+}
+
+Int64 addDelta(Int64 base, Int64 x)
+{
+    return static_cast<Int64>(static_cast<UInt64>(base) + static_cast<UInt64>(x));
+}
+
+struct ColumnReader
+{
+    const char * pos = nullptr;
+    const char * end = nullptr;
+
+    void check(size_t n) const
+    {
+        if (static_cast<size_t>(end - pos) < n)
+            throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Can't read {} bytes from column of snapshot data batch", n);
+    }
+
+    UInt64 readUInt()
+    {
+        UInt64 x = 0;
+        for (size_t shift = 0; shift < 64; shift += 7)
+        {
+            check(1);
+            UInt64 byte = static_cast<UInt8>(*pos++);
+            x |= (byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return x;
+        }
+        throw Exception(ErrorCodes::CORRUPTED_SNAPSHOT, "Too long varint in column of snapshot data batch");
+    }
+
+    Int64 readInt()
+    {
+        UInt64 x = readUInt();
+        return static_cast<Int64>((x >> 1) ^ (~(x & 1) + 1));
+    }
+
+    std::string_view readBytes(size_t n)
+    {
+        check(n);
+        std::string_view res(pos, n);
+        pos += n;
+        return res;
+    }
+};
+}
+
+ptr<SnapshotBatchBody> serializeColumnarBatch(ColumnarNodes & nodes)
+{
+    std::sort(nodes.begin(), nodes.end(), [](const auto & lhs, const auto & rhs) { return lhs.first < rhs.first; });
+
+    std::array<WriteBufferFromOwnString, COLUMN_COUNT> columns;
+    writeColumnUInt(nodes.size(), columns[COLUMN_PATH]);
+
+    std::string_view prev_path;
+    Int64 prev_czxid = 0;
+    Int64 prev_ctime = 0;
+    /// Distinct data written in the batch to its number, from 1
+    std::unordered_map<std::string_view, size_t> distinct_data;
+
+    for (const auto & [path, node] : nodes)
+    {
+        size_t shared = 0;
+        size_t max_shared = std::min(path.size(), prev_path.size());
+        while (shared < max_shared && path[shared] == prev_path[shared])
+            shared++;
+        writeColumnUInt(shared, columns[COLUMN_PATH]);
+        writeColumnUInt(path.size() - shared, columns[COLUMN_PATH]);
+        columns[COLUMN_PATH].write(path.data() + shared, path.size() - shared);
+        prev_path = path;
+
+        size_t data_ref = 0;
+        if (node->data.size() >= MIN_DATA_REF_SIZE)
+        {
+            auto [it, inserted] = distinct_data.try_emplace(node->data.view(), distinct_data.size() + 1);
+            if (!inserted)
+                data_ref = it->second;
+        }
+        writeColumnUInt(data_ref, columns[COLUMN_DATA_REF]);
+        if (!data_ref)
+        {
+            writeColumnUInt(node->data.size(), columns[COLUMN_DATA_LENGTH]);
+            columns[COLUMN_DATA].write(node->data.data(), node->data.size());
+        }
+        writeColumnUInt(node->acl_id, columns[COLUMN_ACL_ID]);
+        UInt8 flags = (node->is_ephemeral ? COLUMN_FLAG_EPHEMERAL : 0) | (node->is_sequential ? COLUMN_FLAG_SEQUENTIAL : 0);
+        writeChar(static_cast<char>(flags), columns[COLUMN_FLAGS]);
+
+        const auto & stat = node->stat;
+        writeColumnInt(delta(stat.czxid, prev_czxid), columns[COLUMN_CZXID]);
+        writeColumnInt(delta(stat.mzxid, stat.czxid), columns[COLUMN_MZXID]);
+        writeColumnInt(delta(stat.pzxid, stat.czxid), columns[COLUMN_PZXID]);
+        writeColumnInt(delta(stat.ctime, prev_ctime), columns[COLUMN_CTIME]);
+        writeColumnInt(delta(stat.mtime, stat.ctime), columns[COLUMN_MTIME]);
+        writeColumnInt(stat.ephemeralOwner, columns[COLUMN_EPHEMERAL_OWNER]);
+        writeColumnInt(stat.version, columns[COLUMN_VERSION]);
+        writeColumnInt(stat.cversion, columns[COLUMN_CVERSION]);
+        writeColumnInt(stat.aversion, columns[COLUMN_AVERSION]);
+        writeColumnInt(stat.numChildren, columns[COLUMN_NUM_CHILDREN]);
+        prev_czxid = stat.czxid;
+        prev_ctime = stat.ctime;
+    }
+
+    auto batch = cs_new<SnapshotBatchBody>();
+    batch->type = SnapshotBatchType::SNAPSHOT_TYPE_DATA_COLUMNS;
+    batch->elements.reserve(COLUMN_COUNT);
+    for (auto & column : columns)
+        batch->elements.emplace_back(std::move(column.str()));
+    return batch;
+}
+
+std::vector<std::pair<String, KeeperNodePtr>> parseColumnarBatch(const SnapshotBatchView & batch)
+{
+    if (batch.size() != COLUMN_COUNT && batch.size() != COLUMN_COUNT_WITHOUT_DATA_REF)
+        throw Exception(
+            ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot data batch has {} columns, expect {}", batch.size(), size_t(COLUMN_COUNT));
+    bool has_data_ref = batch.size() == COLUMN_COUNT;
+
+    std::array<ColumnReader, COLUMN_COUNT> columns;
+    for (size_t i = 0; i < batch.size(); i++)
+        columns[i] = {batch[i].data(), batch[i].data() + batch[i].size()};
+
+    UInt64 count = columns[COLUMN_PATH].readUInt();
+    /// Every node takes at least a byte of flags, do not trust count before it is checked
+    columns[COLUMN_FLAGS].check(count);
+
+    std::vector<std::pair<String, KeeperNodePtr>> nodes;
+    nodes.reserve(count);
+
+    String path;
+    Int64 prev_czxid = 0;
+    Int64 prev_ctime = 0;
+    std::vector<std::string_view> distinct_data;
+
+    for (UInt64 i = 0; i < count; i++)
+    {
+        size_t shared = columns[COLUMN_PATH].readUInt();
+        if (shared > path.size())
+            throw Exception(
+                ErrorCodes::CORRUPTED_SNAPSHOT, "Snapshot is corrupted, the {}th path shares {} bytes of path {}", i + 1, shared, path);
+        path.resize(shared);
+        path.append(columns[COLUMN_PATH].readBytes(columns[COLUMN_PATH].readUInt()));
+
+        auto node = KeeperNode::create();
+        size_t data_ref = has_data_ref ? columns[COLUMN_DATA_REF].readUInt() : 0;
+        if (data_ref > distinct_data.size())
+            throw Exception(
+                ErrorCodes::CORRUPTED_SNAPSHOT,
+                "Snapshot is corrupted, data of path {} refers to the {}th distinct data of {}",
+                path,
+                data_ref,
+                distinct_data.size());
+
+        std::string_view data
+            = data_ref ? distinct_data[data_ref - 1] : columns[COLUMN_DATA].readBytes(columns[COLUMN_DATA_LENGTH].readUInt());
+        if (!data_ref && data.size() >= MIN_DATA_REF_SIZE)
+            distinct_data.push_back(data);
+        node->data = data;
+        node->acl_id = columns[COLUMN_ACL_ID].readUInt();
+        UInt8 flags = static_cast<UInt8>(columns[COLUMN_FLAGS].readBytes(1)[0]);
+        node->is_ephemeral = flags & COLUMN_FLAG_EPHEMERAL;
+        node->is_sequential = flags & COLUMN_FLAG_SEQUENTIAL;
+
+        auto & stat = node->stat;
+        stat.czxid = addDelta(prev_czxid, columns[COLUMN_CZXID].readInt());
+        stat.mzxid = addDelta(stat.czxid, columns[COLUMN_MZXID].readInt());
+        stat.pzxid = addDelta(stat.czxid, columns[COLUMN_PZXID].readInt());
+        stat.ctime = addDelta(prev_ctime, columns[COLUMN_CTIME].readInt());
+        stat.mtime = addDelta(stat.ctime, columns[COLUMN_MTIME].readInt());
+        stat.ephemeralOwner = columns[COLUMN_EPHEMERAL_OWNER].readInt();
+        stat.version = static_cast<int32_t>(columns[COLUMN_VERSION].readInt());
+        stat.cversion = static_cast<int32_t>(columns[COLUMN_CVERSION].readInt());
+        stat.aversion = static_cast<int32_t>(columns[COLUMN_AVERSION].readInt());
+        stat.numChildren = static_cast<int32_t>(columns[COLUMN_NUM_CHILDREN].readInt());
+        prev_czxid = stat.czxid;
+        prev_ctime = stat.ctime;
+
+        node->children.reserve(stat.numChildren);
+        nodes.emplace_back(path, std::move(node));
+    }
+
+    return nodes;
+}
+
+void parseBatchDataColumnsV2(KeeperStore & store, const SnapshotBatchView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes)
+{
+    for (auto & [path, node] : parseColumnarBatch(batch))
+        addParsedNode(store, std::move(path), std::move(node), buckets_edges, bucket_nodes);
 }
 
 }
@@ -2,8 +2,10 @@
 
 #include <map>
 #include <string>
+#include <string_view>
 
 #include <Common/IO/WriteBufferFromFile.h>
+#include <Common/Throttler.h>
 #include <libnuraft/nuraft.hxx>
 
 #include <Service/KeeperStore.h>
@@ -44,18 +46,23 @@ enum SnapshotVersion : uint8_t
     V0 = 0,
     V1 = 1, /// Add ACL map
     V2 = 2, /// Replace protobuf
+    V3 = 3, /// Compress batch body
+    V4 = 4, /// Incremental snapshot, data objects hold nodes changed and deleted since the base snapshot
+    V5 = 5, /// Data nodes are stored by column
     None = 255,
 };
 
 String toString(SnapshotVersion version);
 
 
-static constexpr auto CURRENT_SNAPSHOT_VERSION = SnapshotVersion::V2;
+static constexpr auto CURRENT_SNAPSHOT_VERSION = SnapshotVersion::V3;
+/// The newest version can be read, V4 is only used by incremental snapshots.
+static constexpr auto MAX_SNAPSHOT_VERSION = SnapshotVersion::V5;
 
 /// Batch data header in an snapshot object file.
 struct SnapshotBatchHeader
 {
-    /// The length of the batch data (uncompressed)
+    /// The length of the batch data, since V3 it is the length of the compressed data
     UInt32 data_length;
     /// The CRC32C of the batch data.
     /// If compression is enabled, this is the checksum of the compressed data.
@@ -78,7 +85,18 @@ enum class SnapshotBatchType : int
     SNAPSHOT_TYPE_SESSION = 4,
     SNAPSHOT_TYPE_STRINGMAP = 5,
     SNAPSHOT_TYPE_UINTMAP = 6,
-    SNAPSHOT_TYPE_ACLMAP = 7
+    SNAPSHOT_TYPE_ACLMAP = 7,
+    /// Paths of nodes deleted since the base snapshot, only in incremental snapshots
+    SNAPSHOT_TYPE_DELETED_PATHS = 8,
+    /// Data nodes stored by column since V5, see serializeColumnarBatch
+    SNAPSHOT_TYPE_DATA_COLUMNS = 9
+};
+
+/// Codec of batch data since V3, it is the first byte of the data.
+enum class SnapshotBatchCompression : uint8_t
+{
+    NONE = 0,
+    ZLIB = 1,
 };
 
 struct SnapshotBatchBody
@@ -92,8 +110,32 @@ struct SnapshotBatchBody
 
     static String serialize(const SnapshotBatchBody & batch_body);
     static ptr<SnapshotBatchBody> parse(const String & data);
+
+    /// Compress serialized batch for V3, it is stored uncompressed if compression does not make it smaller.
+    static String compress(const String & data);
+    static String decompress(const String & data);
+
+    /// Same as above, but a batch stored uncompressed is not copied, the result points into data or buf.
+    static std::string_view decompress(std::string_view data, String & buf);
+};
+
+/// Parsed batch whose elements point into the serialized data, which must outlive it. Used when loading snapshots
+/// from mapped objects, so that elements are parsed without copying.
+struct SnapshotBatchView
+{
+    SnapshotBatchType type;
+    std::vector<std::string_view> elements;
+
+    size_t size() const { return elements.size(); }
+    std::string_view operator[](size_t n) const { return elements[n]; }
+
+    static SnapshotBatchView parse(std::string_view data);
 };
 
+/// Logger of creating and loading snapshots. It is got once, since getting a logger locks a global mutex, which may be
+/// held forever by a thread which does not exist in a forked child process, see KeeperSnapshotManager::forkSnapshot.
+Poco::Logger * getSnapshotLogger();
+
 int openFileForWrite(const String & path);
 int openFileForRead(String & path);
 
@@ -109,31 +151,62 @@ void writeTailAndClose(ptr<WriteBufferFromFile> & out, UInt32 checksum);
 UInt32 updateCheckSum(UInt32 checksum, UInt32 data_crc);
 
 /// Serialize and parse keeper node. Please note that children is ignored for we build parent relationship after load all data.
-String serializeKeeperNode(const String & path, const ptr<KeeperNode> & node, SnapshotVersion version);
-ptr<KeeperNodeWithPath> parseKeeperNode(const String & buf, SnapshotVersion version);
+String serializeKeeperNode(const String & path, const KeeperNodePtr & node, SnapshotVersion version);
+ptr<KeeperNodeWithPath> parseKeeperNode(std::string_view buf, SnapshotVersion version);
 
 
 /// ----- For snapshot version 2 -----
 
-/// save batch data in snapshot object
-std::pair<size_t, UInt32> saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch);
+/// save batch data in snapshot object, the writing speed is limited by throttler if it is set
 std::pair<size_t, UInt32>
-saveBatchAndUpdateCheckSumV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, UInt32 checksum);
-
-void serializeAclsV2(const NumToACLMap & acls, String path, UInt32 save_batch_size, SnapshotVersion version);
+saveBatchV2(ptr<WriteBufferFromFile> & out, ptr<SnapshotBatchBody> & batch, SnapshotVersion version, Throttler * throttler = nullptr);
+std::pair<size_t, UInt32> saveBatchAndUpdateCheckSumV2(
+    ptr<WriteBufferFromFile> & out,
+    ptr<SnapshotBatchBody> & batch,
+    UInt32 checksum,
+    SnapshotVersion version,
+    Throttler * throttler = nullptr);
+
+void serializeAclsV2(
+    const CopyOnWriteMapView<uint64_t, ACLsPtr> & acls,
+    String path,
+    UInt32 save_batch_size,
+    SnapshotVersion version,
+    Throttler * throttler = nullptr);
 [[maybe_unused]] size_t
 serializeEphemeralsV2(KeeperStore::Ephemerals & ephemerals, std::mutex & mutex, String path, UInt32 save_batch_size);
 
 /// Serialize sessions and return the next_session_id before serialize
-void serializeSessionsV2(SessionAndTimeout & session_and_timeout, SessionAndAuth & session_and_auth, UInt32 save_batch_size, const SnapshotVersion version, String & path);
+void serializeSessionsV2(
+    const CopyOnWriteMapView<int64_t, int64_t> & session_and_timeout,
+    const CopyOnWriteMapView<int64_t, Coordination::AuthIDs> & session_and_auth,
+    UInt32 save_batch_size,
+    const SnapshotVersion version,
+    String & path,
+    Throttler * throttler = nullptr);
 
 /// Save map<string, string> or map<string, uint64>
 template <typename T>
-void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path);
+void serializeMapV2(T & snap_map, UInt32 save_batch_size, SnapshotVersion version, String & path, Throttler * throttler = nullptr);
 
 /// parse snapshot batch
-void parseBatchDataV2(KeeperStore & store, SnapshotBatchBody & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version);
-void parseBatchSessionV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version);
-void parseBatchAclMapV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version);
-void parseBatchIntMapV2(KeeperStore & store, SnapshotBatchBody & batch, SnapshotVersion version);
+void parseBatchDataV2(
+    KeeperStore & store, const SnapshotBatchView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes, SnapshotVersion version);
+void parseBatchSessionV2(KeeperStore & store, const SnapshotBatchView & batch, SnapshotVersion version);
+void parseBatchAclMapV2(KeeperStore & store, const SnapshotBatchView & batch, SnapshotVersion version);
+void parseBatchIntMapV2(KeeperStore & store, const SnapshotBatchView & batch, SnapshotVersion version);
+IntMap parseBatchIntMapV2(const SnapshotBatchView & batch);
+
+
+/// ----- For snapshot version 5 -----
+
+using ColumnarNodes = std::vector<std::pair<std::string_view, const KeeperNode *>>;
+
+/// Serialize nodes into a SNAPSHOT_TYPE_DATA_COLUMNS batch whose elements are columns. Nodes are sorted by path, so that
+/// a path is stored as the length of the prefix shared with the previous path and the rest. Data of all nodes is a single
+/// blob, and every other field is a column of varints, zxids and times are stored as deltas which are mostly small.
+ptr<SnapshotBatchBody> serializeColumnarBatch(ColumnarNodes & nodes);
+std::vector<std::pair<String, KeeperNodePtr>> parseColumnarBatch(const SnapshotBatchView & batch);
+
+void parseBatchDataColumnsV2(KeeperStore & store, const SnapshotBatchView & batch, BucketEdges & buckets_edges, BucketNodes & bucket_nodes);
 }
@@ -0,0 +1,78 @@
+#include <Service/SnapshotScheduler.h>
+
+namespace RK
+{
+
+SnapshotScheduler::SnapshotScheduler(
+    UInt64 snapshot_distance_, UInt64 max_deferred_distance_, UInt64 max_commit_rate_, UInt64 max_commit_lag_, UInt64 stagger_interval_ms_)
+    : snapshot_distance(snapshot_distance_)
+    , max_deferred_distance(max_deferred_distance_)
+    , max_commit_rate(max_commit_rate_)
+    , max_commit_lag(max_commit_lag_)
+    , stagger_interval_ms(stagger_interval_ms_)
+{
+}
+
+void SnapshotScheduler::setMember(size_t member_index_, size_t member_count_)
+{
+    member_count.store(member_count_ ? member_count_ : 1, std::memory_order_relaxed);
+    member_index.store(member_index_, std::memory_order_relaxed);
+}
+
+void SnapshotScheduler::updateCommitRate(UInt64 now_ms, UInt64 committed_idx)
+{
+    if (!window_start_ms || committed_idx < window_start_idx)
+    {
+        window_start_ms = now_ms;
+        window_start_idx = committed_idx;
+        rate_measured = false;
+        return;
+    }
+
+    /// Checks are made on every commit while a snapshot is deferred, so a long window means a low rate
+    if (now_ms >= window_start_ms + RATE_WINDOW_MS)
+    {
+        commit_rate = (committed_idx - window_start_idx) * 1000 / (now_ms - window_start_ms);
+        rate_measured = true;
+        window_start_ms = now_ms;
+        window_start_idx = committed_idx;
+    }
+}
+
+bool SnapshotScheduler::shouldCreate(UInt64 now_ms, UInt64 committed_idx, UInt64 commit_lag)
+{
+    bool create = shouldCreateImpl(now_ms, committed_idx, commit_lag);
+    /// Checks stop until the next snapshot is due, whose rate is measured from then
+    if (create)
+        window_start_ms = 0;
+    return create;
+}
+
+bool SnapshotScheduler::shouldCreateImpl(UInt64 now_ms, UInt64 committed_idx, UInt64 commit_lag)
+{
+    UInt64 last_idx = last_snapshot_idx.load(std::memory_order_relaxed);
+    UInt64 distance = committed_idx > last_idx ? committed_idx - last_idx : 0;
+    if (distance >= snapshot_distance + max_deferred_distance)
+        return true;
+
+    if (max_commit_rate)
+    {
+        updateCommitRate(now_ms, committed_idx);
+        if (!rate_measured || commit_rate > max_commit_rate)
+            return false;
+    }
+
+    if (max_commit_lag && commit_lag > max_commit_lag)
+        return false;
+
+    if (stagger_interval_ms)
+    {
+        size_t count = member_count.load(std::memory_order_relaxed);
+        if ((now_ms / stagger_interval_ms) % count != member_index.load(std::memory_order_relaxed) % count)
+            return false;
+    }
+
+    return true;
+}
+
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <common/types.h>
+
+
+namespace RK
+{
+
+/**
+ * Decides whether a snapshot which is due by snapshot_distance and snapshot_create_interval is created now.
+ *
+ *  1. Load: the snapshot is deferred while the commit rate, measured in windows of a second from the time the snapshot
+ *     is due, or the commit lag, the requests waiting to be committed, is above its threshold.
+ *  2. Stagger: time is divided into slots of stagger_interval_ms and they are taken by cluster members in turn,
+ *     a member creates snapshots only in its own slots, so that members do not create snapshots at the same time.
+ *  3. Bound: when max_deferred_distance logs are committed beyond snapshot_distance, the snapshot is created anyway.
+ *
+ * A threshold of 0 disables its rule, and snapshots are never deferred if max_deferred_distance is 0. Check is invoked
+ * by the commit thread only, the last snapshot index may be set by any thread.
+ */
+class SnapshotScheduler
+{
+public:
+    SnapshotScheduler(
+        UInt64 snapshot_distance_,
+        UInt64 max_deferred_distance_,
+        UInt64 max_commit_rate_,
+        UInt64 max_commit_lag_,
+        UInt64 stagger_interval_ms_);
+
+    /// Position of this node in cluster members, sorted by server id
+    void setMember(size_t member_index_, size_t member_count_);
+
+    /// Log index of the latest snapshot, created or received
+    void setLastSnapshotIndex(UInt64 index) { last_snapshot_idx.store(index, std::memory_order_relaxed); }
+
+    /// Whether to create the due snapshot now
+    bool shouldCreate(UInt64 now_ms, UInt64 committed_idx, UInt64 commit_lag);
+
+    /// Commits per second of the last complete window
+    UInt64 getCommitRate() const { return commit_rate; }
+
+private:
+    static constexpr UInt64 RATE_WINDOW_MS = 1000;
+
+    bool shouldCreateImpl(UInt64 now_ms, UInt64 committed_idx, UInt64 commit_lag);
+    void updateCommitRate(UInt64 now_ms, UInt64 committed_idx);
+
+    const UInt64 snapshot_distance;
+    const UInt64 max_deferred_distance;
+    const UInt64 max_commit_rate;
+    const UInt64 max_commit_lag;
+    const UInt64 stagger_interval_ms;
+
+    std::atomic<size_t> member_index{0};
+    std::atomic<size_t> member_count{1};
+    std::atomic<UInt64> last_snapshot_idx{0};
+
+    UInt64 window_start_ms{0};
+    UInt64 window_start_idx{0};
+    UInt64 commit_rate{0};
+    bool rate_measured{false};
+};
+
+}
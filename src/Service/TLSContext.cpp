@@ -0,0 +1,269 @@
+#include <Service/TLSContext.h>
+
+#include <cstring>
+#include <vector>
+
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#include <openssl/digest.h>
+#include <openssl/err.h>
+#include <openssl/hkdf.h>
+#include <openssl/nid.h>
+#include <openssl/obj.h>
+
+#include <Common/Exception.h>
+#include <common/logger_useful.h>
+
+#ifndef TCP_ULP
+#    define TCP_ULP 31
+#endif
+
+#ifndef SOL_TLS
+#    define SOL_TLS 282
+#endif
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int INVALID_CONFIG_PARAMETER;
+    extern const int NETWORK_ERROR;
+}
+
+namespace
+{
+
+[[noreturn]] void throwSSLError(int code, const String & message)
+{
+    char error[256] = {0};
+    ERR_error_string_n(ERR_get_error(), error, sizeof(error));
+    ERR_clear_error();
+    throw Exception(code, "{}: {}", message, error);
+}
+
+bssl::UniquePtr<SSL_CTX>
+createContext(bool is_server, const String & certificate_file, const String & private_key_file, const String & ca_file, bool verify_peer)
+{
+    bssl::UniquePtr<SSL_CTX> context(SSL_CTX_new(TLS_method()));
+    if (!context)
+        throwSSLError(ErrorCodes::INVALID_CONFIG_PARAMETER, "Cannot create TLS context");
+
+    /// Ciphers of TLS 1.3 are all supported by kTLS, the ones of TLS 1.2 are limited to the AEAD ones.
+    if (!SSL_CTX_set_min_proto_version(context.get(), TLS1_2_VERSION)
+        || !SSL_CTX_set_strict_cipher_list(context.get(), "ECDHE+AESGCM:ECDHE+CHACHA20"))
+        throwSSLError(ErrorCodes::INVALID_CONFIG_PARAMETER, "Cannot set TLS ciphers");
+
+    SSL_CTX_set_options(context.get(), SSL_OP_NO_TICKET);
+    SSL_CTX_set_session_cache_mode(context.get(), SSL_SESS_CACHE_OFF);
+
+    if (SSL_CTX_use_certificate_chain_file(context.get(), certificate_file.c_str()) != 1)
+        throwSSLError(ErrorCodes::INVALID_CONFIG_PARAMETER, "Cannot load certificate " + certificate_file);
+    if (SSL_CTX_use_PrivateKey_file(context.get(), private_key_file.c_str(), SSL_FILETYPE_PEM) != 1)
+        throwSSLError(ErrorCodes::INVALID_CONFIG_PARAMETER, "Cannot load private key " + private_key_file);
+    if (!ca_file.empty() && SSL_CTX_load_verify_locations(context.get(), ca_file.c_str(), nullptr) != 1)
+        throwSSLError(ErrorCodes::INVALID_CONFIG_PARAMETER, "Cannot load CA " + ca_file);
+
+    if (verify_peer)
+        SSL_CTX_set_verify(context.get(), is_server ? SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT : SSL_VERIFY_PEER, nullptr);
+
+    return context;
+}
+
+/// HKDF-Expand-Label of TLS 1.3, see RFC 8446 7.1
+void expandLabel(const EVP_MD * digest, bssl::Span<const uint8_t> secret, const String & label, uint8_t * out, size_t out_len)
+{
+    String full_label = "tls13 " + label;
+    String info;
+    info.push_back(static_cast<char>(out_len >> 8));
+    info.push_back(static_cast<char>(out_len & 0xff));
+    info.push_back(static_cast<char>(full_label.size()));
+    info += full_label;
+    info.push_back(0);
+
+    if (!HKDF_expand(out, out_len, digest, secret.data(), secret.size(), reinterpret_cast<const uint8_t *>(info.data()), info.size()))
+        throwSSLError(ErrorCodes::NETWORK_ERROR, "Cannot derive TLS traffic keys");
+}
+
+/// Kernel takes the fixed part of nonce as salt and the rest as iv. TLS 1.3 and ChaCha20 xor the sequence number into
+/// the whole nonce, explicit nonce of AES-GCM of TLS 1.2 is the sequence number in BoringSSL.
+template <typename CryptoInfo>
+void setCryptoInfo(
+    int fd, int direction, uint16_t version, uint16_t cipher_type, const uint8_t * key, const uint8_t * iv, uint64_t sequence)
+{
+    CryptoInfo info;
+    memset(&info, 0, sizeof(info));
+    info.info.version = version;
+    info.info.cipher_type = cipher_type;
+
+    for (size_t i = 0; i < sizeof(info.rec_seq); ++i)
+        info.rec_seq[i] = static_cast<unsigned char>(sequence >> (8 * (sizeof(info.rec_seq) - 1 - i)));
+
+    memcpy(info.key, key, sizeof(info.key));
+    memcpy(info.salt, iv, sizeof(info.salt));
+    if (version == TLS_1_3_VERSION || sizeof(info.salt) == 0)
+        memcpy(info.iv, iv + sizeof(info.salt), sizeof(info.iv));
+    else
+        memcpy(info.iv, info.rec_seq, sizeof(info.iv));
+
+    if (setsockopt(fd, SOL_TLS, direction, &info, sizeof(info)) != 0)
+        throwFromErrno("Cannot set kTLS keys", ErrorCodes::NETWORK_ERROR);
+}
+
+/// Key of AES-GCM or ChaCha20-Poly1305 and the fixed part of nonce of a direction
+struct TrafficKeys
+{
+    std::vector<uint8_t> key;
+    std::vector<uint8_t> iv;
+    uint64_t sequence = 0;
+};
+
+void setTrafficKeys(int fd, int direction, uint16_t version, int cipher_nid, const TrafficKeys & keys)
+{
+    switch (cipher_nid)
+    {
+        case NID_aes_128_gcm:
+            setCryptoInfo<tls12_crypto_info_aes_gcm_128>(
+                fd, direction, version, TLS_CIPHER_AES_GCM_128, keys.key.data(), keys.iv.data(), keys.sequence);
+            break;
+        case NID_aes_256_gcm:
+            setCryptoInfo<tls12_crypto_info_aes_gcm_256>(
+                fd, direction, version, TLS_CIPHER_AES_GCM_256, keys.key.data(), keys.iv.data(), keys.sequence);
+            break;
+#if defined(TLS_CIPHER_CHACHA20_POLY1305)
+        case NID_chacha20_poly1305:
+            setCryptoInfo<tls12_crypto_info_chacha20_poly1305>(
+                fd, direction, version, TLS_CIPHER_CHACHA20_POLY1305, keys.key.data(), keys.iv.data(), keys.sequence);
+            break;
+#endif
+        default:
+            throw Exception(ErrorCodes::NETWORK_ERROR, "Cipher {} is not supported by kTLS", OBJ_nid2sn(cipher_nid));
+    }
+}
+
+}
+
+TLSContext & TLSContext::instance()
+{
+    static TLSContext context;
+    return context;
+}
+
+void TLSContext::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    client_port = config.getBool("keeper.tls.client_port", false);
+    forwarding = config.getBool("keeper.tls.forwarding_port", false);
+    if (!client_port && !forwarding)
+        return;
+
+    String certificate_file = config.getString("keeper.tls.certificate_file", "");
+    String private_key_file = config.getString("keeper.tls.private_key_file", "");
+    String ca_file = config.getString("keeper.tls.ca_file", "");
+    bool verify_peer = config.getBool("keeper.tls.verify_peer", false);
+
+    if (certificate_file.empty() || private_key_file.empty())
+        throw Exception(
+            ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.tls.certificate_file and keeper.tls.private_key_file are required by TLS");
+    if (verify_peer && ca_file.empty())
+        throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "keeper.tls.ca_file is required if keeper.tls.verify_peer is true");
+
+    server_context = createContext(true, certificate_file, private_key_file, ca_file, verify_peer);
+    /// Follower presents the same certificate to leader
+    if (forwarding)
+        client_context = createContext(false, certificate_file, private_key_file, ca_file, verify_peer);
+
+    LOG_INFO(&Poco::Logger::get("TLSContext"), "TLS enabled, client port {}, forwarding port {}", client_port, forwarding);
+}
+
+TLSHandshake::TLSHandshake(SSL_CTX * context, int fd_, bool is_server) : ssl(SSL_new(context)), fd(fd_)
+{
+    if (!ssl || !SSL_set_fd(ssl.get(), fd))
+        throwSSLError(ErrorCodes::NETWORK_ERROR, "Cannot create TLS connection");
+
+    if (is_server)
+        SSL_set_accept_state(ssl.get());
+    else
+        SSL_set_connect_state(ssl.get());
+}
+
+TLSHandshake::Status TLSHandshake::proceed()
+{
+    int res = SSL_do_handshake(ssl.get());
+    if (res != 1)
+    {
+        int error = SSL_get_error(ssl.get(), res);
+        if (error == SSL_ERROR_WANT_READ)
+            return WANT_READ;
+        if (error == SSL_ERROR_WANT_WRITE)
+            return WANT_WRITE;
+        throwSSLError(ErrorCodes::NETWORK_ERROR, "TLS handshake failed");
+    }
+
+    setUpKernelTLS();
+    return DONE;
+}
+
+void TLSHandshake::run()
+{
+    if (proceed() != DONE)
+        throw Exception(ErrorCodes::NETWORK_ERROR, "TLS handshake timed out");
+}
+
+void TLSHandshake::setUpKernelTLS()
+{
+    /// Records already read by BoringSSL can not be passed to kernel, BoringSSL does not read beyond the handshake
+    /// records, so it happens only if peer sends handshake messages after its Finished.
+    if (SSL_has_pending(ssl.get()))
+        throw Exception(ErrorCodes::NETWORK_ERROR, "Unexpected TLS records after handshake");
+
+    const SSL_CIPHER * cipher = SSL_get_current_cipher(ssl.get());
+    int cipher_nid = SSL_CIPHER_get_cipher_nid(cipher);
+    auto version = static_cast<uint16_t>(SSL_version(ssl.get()));
+
+    size_t key_len = cipher_nid == NID_aes_128_gcm ? 16 : 32;
+    size_t iv_len = version == TLS1_3_VERSION || cipher_nid == NID_chacha20_poly1305 ? 12 : 4;
+
+    TrafficKeys read_keys{std::vector<uint8_t>(key_len), std::vector<uint8_t>(iv_len), SSL_get_read_sequence(ssl.get())};
+    TrafficKeys write_keys{std::vector<uint8_t>(key_len), std::vector<uint8_t>(iv_len), SSL_get_write_sequence(ssl.get())};
+
+    if (version == TLS1_3_VERSION)
+    {
+        bssl::Span<const uint8_t> read_secret;
+        bssl::Span<const uint8_t> write_secret;
+        if (!bssl::SSL_get_traffic_secrets(ssl.get(), &read_secret, &write_secret))
+            throwSSLError(ErrorCodes::NETWORK_ERROR, "Cannot get TLS traffic secrets");
+
+        const EVP_MD * digest = EVP_get_digestbynid(SSL_CIPHER_get_prf_nid(cipher));
+        expandLabel(digest, read_secret, "key", read_keys.key.data(), key_len);
+        expandLabel(digest, read_secret, "iv", read_keys.iv.data(), iv_len);
+        expandLabel(digest, write_secret, "key", write_keys.key.data(), key_len);
+        expandLabel(digest, write_secret, "iv", write_keys.iv.data(), iv_len);
+    }
+    else
+    {
+        /// Key block of AEAD ciphers has no mac keys: client key, server key, client iv, server iv.
+        std::vector<uint8_t> key_block(SSL_get_key_block_len(ssl.get()));
+        if (key_block.size() != 2 * (key_len + iv_len) || !SSL_generate_key_block(ssl.get(), key_block.data(), key_block.size()))
+            throwSSLError(ErrorCodes::NETWORK_ERROR, "Cannot get TLS key block");
+
+        bool is_server = SSL_is_server(ssl.get()) != 0;
+        auto & client_keys = is_server ? read_keys : write_keys;
+        auto & server_keys = is_server ? write_keys : read_keys;
+
+        const uint8_t * pos = key_block.data();
+        memcpy(client_keys.key.data(), pos, key_len);
+        memcpy(server_keys.key.data(), pos + key_len, key_len);
+        memcpy(client_keys.iv.data(), pos + 2 * key_len, iv_len);
+        memcpy(server_keys.iv.data(), pos + 2 * key_len + iv_len, iv_len);
+    }
+
+    if (setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")) != 0)
+        throwFromErrno("Cannot enable kTLS, check that tls kernel module is loaded", ErrorCodes::NETWORK_ERROR);
+
+    setTrafficKeys(fd, TLS_TX, version, cipher_nid, write_keys);
+    setTrafficKeys(fd, TLS_RX, version, cipher_nid, read_keys);
+}
+
+}
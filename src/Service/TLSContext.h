@@ -0,0 +1,67 @@
+#pragma once
+
+#include <openssl/ssl.h>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// TLS of client port and forwarding port, configured by keeper.tls. BoringSSL does only the handshake, the negotiated
+/// keys are then passed to kernel (kTLS) which encrypts and decrypts records, so connections keep using plain socket
+/// syscalls and their scatter-gather sends. kTLS needs the tls kernel module, a connection fails if it is not loaded.
+///
+/// Only AEAD ciphers supported by kTLS are negotiated, and no session tickets are issued for that kernel can not handle
+/// handshake messages after the keys are passed to it.
+class TLSContext
+{
+public:
+    static TLSContext & instance();
+
+    /// Throws if certificate, private key or CA can not be loaded
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+
+    /// Unix domain socket is always plaintext
+    bool clientPortEnabled() const { return client_port; }
+    /// Must be the same on all nodes for it is not negotiated
+    bool forwardingEnabled() const { return forwarding; }
+
+    SSL_CTX * serverContext() const { return server_context.get(); }
+    SSL_CTX * clientContext() const { return client_context.get(); }
+
+private:
+    bssl::UniquePtr<SSL_CTX> server_context;
+    bssl::UniquePtr<SSL_CTX> client_context;
+
+    bool client_port = false;
+    bool forwarding = false;
+};
+
+/// TLS handshake of a connection, kTLS is set up on the socket when it is done.
+class TLSHandshake
+{
+public:
+    enum Status
+    {
+        DONE,
+        WANT_READ,
+        WANT_WRITE,
+    };
+
+    TLSHandshake(SSL_CTX * context, int fd_, bool is_server);
+
+    /// Continue handshake on a non-blocking socket, throws if it fails.
+    Status proceed();
+
+    /// Handshake on a blocking socket, socket timeout fails it.
+    void run();
+
+private:
+    void setUpKernelTLS();
+
+    bssl::UniquePtr<SSL> ssl;
+    int fd;
+};
+
+}
@@ -0,0 +1,152 @@
+#include <Service/ThreadPlacement.h>
+
+#if defined(OS_LINUX)
+#    include <pthread.h>
+#    include <sched.h>
+#endif
+
+#if USE_JEMALLOC
+#    include <jemalloc/jemalloc.h>
+#endif
+
+#include <Common/CpuProfiler.h>
+#include <Common/Exception.h>
+#include <common/logger_useful.h>
+
+namespace RK
+{
+
+namespace ErrorCodes
+{
+    extern const int INVALID_CONFIG_PARAMETER;
+}
+
+ThreadPlacement & ThreadPlacement::instance()
+{
+    static ThreadPlacement placement;
+    return placement;
+}
+
+void ThreadPlacement::initialize(const Poco::Util::AbstractConfiguration & config)
+{
+    auto * log = &Poco::Logger::get("ThreadPlacement");
+    for (size_t i = 0; i < cpu_sets.size(); ++i)
+    {
+        auto thread_class = static_cast<ThreadClass>(i);
+        String key = "keeper.thread_placement." + toString(thread_class);
+        if (!config.has(key))
+            continue;
+
+        cpu_sets[i] = parseCpuList(config.getString(key));
+        LOG_INFO(log, "Threads of {} are bound to cpus {}", toString(thread_class), config.getString(key));
+    }
+    processor_arena = config.getBool("keeper.thread_placement.processor_arena", false);
+}
+
+void ThreadPlacement::apply(ThreadClass thread_class) const
+{
+    auto * log = &Poco::Logger::get("ThreadPlacement");
+    const auto & cpus = cpu_sets[static_cast<size_t>(thread_class)];
+    CpuProfiler::instance().registerCurrentThread(toString(thread_class));
+
+    if (!cpus.empty())
+    {
+#if defined(OS_LINUX)
+        cpu_set_t cpu_set;
+        CPU_ZERO(&cpu_set);
+        for (int cpu : cpus)
+            CPU_SET(cpu, &cpu_set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+        if (err)
+            LOG_WARNING(log, "Failed to bind thread of {} to cpus, error {}", toString(thread_class), err);
+#else
+        LOG_WARNING(log, "Binding threads to cpus is supported only on Linux");
+#endif
+    }
+
+    if (thread_class == ThreadClass::PROCESSOR && processor_arena)
+    {
+#if USE_JEMALLOC
+        unsigned arena;
+        size_t size = sizeof(arena);
+        if (mallctl("arenas.create", &arena, &size, nullptr, 0) != 0
+            || mallctl("thread.arena", nullptr, nullptr, &arena, sizeof(arena)) != 0)
+            LOG_WARNING(log, "Failed to create jemalloc arena for processor thread");
+        else
+            LOG_INFO(log, "Processor thread allocates from jemalloc arena {}", arena);
+#else
+        LOG_WARNING(log, "Arena of processor thread is supported only with jemalloc");
+#endif
+    }
+}
+
+std::vector<int> ThreadPlacement::parseCpuList(const String & list)
+{
+    /// Size of cpu_set_t
+    static constexpr int MAX_CPUS = 1024;
+
+    auto throw_bad_list = [&list]
+    { throw Exception(ErrorCodes::INVALID_CONFIG_PARAMETER, "Bad cpu list '{}', expect a list like 0-3,8", list); };
+
+    auto parse_cpu = [&](const String & str) -> int
+    {
+        if (str.empty() || str.size() > 4 || str.find_first_not_of("0123456789") != String::npos)
+            throw_bad_list();
+        int cpu = std::stoi(str);
+        if (cpu >= MAX_CPUS)
+            throw_bad_list();
+        return cpu;
+    };
+
+    std::vector<int> cpus;
+    size_t begin = 0;
+    while (begin <= list.size())
+    {
+        size_t end = list.find(',', begin);
+        if (end == String::npos)
+            end = list.size();
+
+        String range = list.substr(begin, end - begin);
+        range.erase(0, range.find_first_not_of(' '));
+        range.erase(range.find_last_not_of(' ') + 1);
+
+        size_t dash = range.find('-');
+        int first = parse_cpu(range.substr(0, dash));
+        int last = dash == String::npos ? first : parse_cpu(range.substr(dash + 1));
+        if (first > last)
+            throw_bad_list();
+
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+        begin = end + 1;
+    }
+    return cpus;
+}
+
+String ThreadPlacement::toString(ThreadClass thread_class)
+{
+    switch (thread_class)
+    {
+        case ThreadClass::REQUEST_DISPATCHER:
+            return "request_dispatcher";
+        case ThreadClass::RESPONSE_DISPATCHER:
+            return "response_dispatcher";
+        case ThreadClass::PROCESSOR:
+            return "processor";
+        case ThreadClass::ACCUMULATOR:
+            return "accumulator";
+        case ThreadClass::FORWARDER:
+            return "forwarder";
+        case ThreadClass::NURAFT:
+            return "nuraft";
+        case ThreadClass::LOG_FSYNC:
+            return "log_fsync";
+        case ThreadClass::SNAPSHOT:
+            return "snapshot";
+        case ThreadClass::COUNT:
+            break;
+    }
+    return "unknown";
+}
+
+}
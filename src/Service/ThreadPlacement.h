@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include <Poco/Util/AbstractConfiguration.h>
+#include <common/types.h>
+
+namespace RK
+{
+
+/// Classes of threads which can be bound to cpu sets, IO reactors are bound by keeper.io_thread_cpu_affinity.
+enum class ThreadClass : uint8_t
+{
+    REQUEST_DISPATCHER,
+    RESPONSE_DISPATCHER,
+    PROCESSOR,
+    ACCUMULATOR,
+    FORWARDER,
+    NURAFT,
+    LOG_FSYNC,
+    SNAPSHOT,
+    COUNT
+};
+
+/// Binds threads of a class to the cpus configured by keeper.thread_placement.<class name>, for example
+/// <processor>0-3,8</processor>. Threads of classes not configured are not bound.
+///
+/// On multi-socket hosts, bind the processor and the threads working with it to cpus of one NUMA node. Linux places
+/// pages on the node of the thread touching them first, if processor_arena is true the processor thread allocates
+/// from a jemalloc arena of its own, so that the data tree it builds is on its node and not mixed with allocations of
+/// threads on other nodes.
+class ThreadPlacement
+{
+public:
+    static ThreadPlacement & instance();
+
+    /// Throws if a cpu list is malformed
+    void initialize(const Poco::Util::AbstractConfiguration & config);
+
+    /// Bind the current thread by its class, failures are logged and the thread runs unbound. The thread is also
+    /// sampled by CpuProfiler as its class.
+    void apply(ThreadClass thread_class) const;
+
+    /// Parse cpu list like "0-3,8,10-11"
+    static std::vector<int> parseCpuList(const String & list);
+
+    static String toString(ThreadClass thread_class);
+
+private:
+    std::array<std::vector<int>, static_cast<size_t>(ThreadClass::COUNT)> cpu_sets;
+    bool processor_arena = false;
+};
+
+}
@@ -2,6 +2,8 @@
 
 #include <deque>
 #include <mutex>
+#include <vector>
+#include <Common/BusyPoll.h>
 
 namespace RK
 {
@@ -14,6 +16,21 @@ private:
     mutable std::mutex queue_mutex;
     std::condition_variable cv;
     Queue queue;
+
+    /// Spin for the budget of BusyPoll before waiting on cv, the mutex is only tried so that producers are not blocked.
+    void busyWait(int64_t timeout_ms)
+    {
+        if (timeout_ms <= 0 || !BusyPoll::enabled())
+            return;
+        BusyPoll::spin(
+            [this]
+            {
+                std::unique_lock lock(queue_mutex, std::try_to_lock);
+                return lock.owns_lock() && !queue.empty();
+            },
+            static_cast<UInt64>(timeout_ms));
+    }
+
 public:
 
     using Func = std::function<bool(const T & e)>;
@@ -32,6 +49,16 @@ public:
         cv.notify_one();
     }
 
+    /// Push all elements under one lock and with one wakeup.
+    void pushBatch(const std::vector<T> & elements)
+    {
+        if (elements.empty())
+            return;
+        std::lock_guard lock(queue_mutex);
+        queue.insert(queue.end(), elements.begin(), elements.end());
+        cv.notify_one();
+    }
+
     void pop()
     {
         std::unique_lock lock(queue_mutex);
@@ -40,6 +67,7 @@ public:
 
     bool tryPop(T & response, int64_t timeout_ms = 0)
     {
+        busyWait(timeout_ms);
         std::unique_lock lock(queue_mutex);
         if (!cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return !queue.empty(); }))
             return false;
@@ -49,6 +77,24 @@ public:
         return true;
     }
 
+    /// Wait until the queue is not empty and pop at most max_size elements, returns how many were popped.
+    size_t tryPopBatch(std::vector<T> & responses, size_t max_size, int64_t timeout_ms = 0)
+    {
+        busyWait(timeout_ms);
+        std::unique_lock lock(queue_mutex);
+        if (!cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return !queue.empty(); }))
+            return 0;
+
+        size_t popped = 0;
+        while (popped < max_size && !queue.empty())
+        {
+            responses.push_back(std::move(queue.front()));
+            queue.pop_front();
+            ++popped;
+        }
+        return popped;
+    }
+
     bool peek(T & response)
     {
         std::unique_lock lock(queue_mutex);
@@ -1,40 +1,208 @@
 #include <Common/IO/Operators.h>
 #include <Common/IO/WriteBufferFromString.h>
+#include <Common/SlabAllocator.h>
 #include <common/logger_useful.h>
 
+#include <algorithm>
+#include <unordered_set>
+
 #include <Service/KeeperUtils.h>
 #include <Service/WatchManager.h>
 
 namespace RK
 {
 
-void WatchManager::registerWatches(const String & path, int64_t session_id, Coordination::OpNum opnum)
+namespace
 {
-    std::lock_guard lock(watch_mutex);
-    auto watches_type = opnum == Coordination::OpNum::List
-            || opnum == Coordination::OpNum::SimpleList
-            || opnum == Coordination::OpNum::FilteredList ? WatchType::List : WatchType::Data;
+bool addSession(std::vector<int64_t> & sessions, int64_t session_id)
+{
+    auto it = std::lower_bound(sessions.begin(), sessions.end(), session_id);
+    if (it != sessions.end() && *it == session_id)
+        return false;
+    sessions.insert(it, session_id);
+    return true;
+}
+
+bool removeSession(std::vector<int64_t> & sessions, int64_t session_id)
+{
+    auto it = std::lower_bound(sessions.begin(), sessions.end(), session_id);
+    if (it == sessions.end() || *it != session_id)
+        return false;
+    sessions.erase(it);
+    return true;
+}
+
+bool hasSession(const std::vector<int64_t> & sessions, int64_t session_id)
+{
+    return std::binary_search(sessions.begin(), sessions.end(), session_id);
+}
+
+WatchType getWatchType(Coordination::OpNum opnum)
+{
+    return opnum == Coordination::OpNum::List || opnum == Coordination::OpNum::SimpleList || opnum == Coordination::OpNum::FilteredList
+            || opnum == Coordination::OpNum::ListWithData || opnum == Coordination::OpNum::PagedList
+        ? WatchType::List
+        : WatchType::Data;
+}
+}
+
+WatchManager::PathId WatchManager::getOrCreatePathId(const HashedPath & hashed_path)
+{
+    auto it = path_ids.findHashed(hashed_path.path, hashed_path.hash);
+    if (it != path_ids.end())
+        return it->second;
+
+    PathId path_id;
+    if (!free_path_ids.empty())
+    {
+        path_id = free_path_ids.back();
+        free_path_ids.pop_back();
+    }
+    else
+    {
+        path_id = static_cast<PathId>(watched_paths.size());
+        watched_paths.emplace_back();
+    }
 
-    switch (watches_type)
+    auto & watched_path = watched_paths[path_id];
+    watched_path.path = hashed_path.path;
+    watched_paths_bytes += stringMemoryUsage(watched_path.path);
+    path_ids.tryEmplaceHashed(watched_path.path, hashed_path.hash, path_id);
+    return path_id;
+}
+
+void WatchManager::releasePathIfEmpty(PathId path_id)
+{
+    auto & watched_path = watched_paths[path_id];
+    if (!watched_path.empty())
+        return;
+
+    path_ids.erase(watched_path.path);
+    watched_paths_bytes -= stringMemoryUsage(watched_path.path);
+    /// Release memory of the path and session sets
+    watched_path = WatchedPath{};
+    free_path_ids.push_back(path_id);
+}
+
+bool WatchManager::addWatcher(PathId path_id, WatchType type, int64_t session_id)
+{
+    auto & watched_path = watched_paths[path_id];
+    auto & watchers = watched_path.watchers(type);
+    const auto & other_watchers = type == WatchType::Data ? watched_path.list_watchers : watched_path.data_watchers;
+    bool was_watching = !watched_path.empty() && hasSession(other_watchers, session_id);
+
+    bool was_empty = watchers.empty();
+    if (!addSession(watchers, session_id))
+        return false;
+
+    ++total_watches;
+    if (was_empty)
+        ++(type == WatchType::Data ? data_watched_paths : list_watched_paths);
+    return !was_watching;
+}
+
+bool WatchManager::removeWatcher(PathId path_id, WatchType type, int64_t session_id)
+{
+    auto & watched_path = watched_paths[path_id];
+    auto & watchers = watched_path.watchers(type);
+    if (!removeSession(watchers, session_id))
+        return false;
+
+    --total_watches;
+    if (watchers.empty())
+        --(type == WatchType::Data ? data_watched_paths : list_watched_paths);
+    return !hasSession(type == WatchType::Data ? watched_path.list_watchers : watched_path.data_watchers, session_id);
+}
+
+std::vector<WatchManager::PathId> WatchManager::livePathIds(int64_t session_id, const SessionWatches & session_watches) const
+{
+    std::vector<PathId> result;
+    result.reserve(session_watches.path_ids.size() - session_watches.stale);
+    for (auto path_id : session_watches.path_ids)
+    {
+        const auto & watched_path = watched_paths[path_id];
+        if (hasSession(watched_path.data_watchers, session_id) || hasSession(watched_path.list_watchers, session_id))
+            result.push_back(path_id);
+    }
+
+    /// A reused path id may be both stale and live
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+void WatchManager::markStale(int64_t session_id)
+{
+    auto it = sessions_and_watchers.find(session_id);
+    if (it == sessions_and_watchers.end())
+        return;
+
+    auto & session_watches = it->second;
+    ++session_watches.stale;
+    if (session_watches.stale == session_watches.path_ids.size())
+        sessions_and_watchers.erase(it);
+    else if (session_watches.stale * 2 > session_watches.path_ids.size())
     {
-        case WatchType::Data:
-            watches[path].emplace(session_id);
-            break;
-        case WatchType::List:
-            list_watches[path].emplace(session_id);
-            break;
+        session_watches.path_ids = livePathIds(session_id, session_watches);
+        session_watches.stale = 0;
     }
+}
+
+void WatchManager::registerWatchesLocked(const HashedPath & hashed_path, int64_t session_id, WatchType type)
+{
+    auto path_id = getOrCreatePathId(hashed_path);
+    if (addWatcher(path_id, type, session_id))
+        sessions_and_watchers[session_id].path_ids.push_back(path_id);
+
+    LOG_TRACE(
+        log,
+        "Register watch path={}, session_id={}, type={}",
+        hashed_path.path,
+        toHexString(session_id),
+        toString(static_cast<UInt8>(type)));
+}
 
-    sessions_and_watchers[session_id][path] |= static_cast<uint8_t>(watches_type);
+uint64_t WatchManager::sessionWatchesCountLocked(int64_t session_id) const
+{
+    uint64_t count = 0;
+    if (auto it = sessions_and_watchers.find(session_id); it != sessions_and_watchers.end())
+        count += it->second.path_ids.size() - it->second.stale;
+    if (auto it = sessions_and_persistent_watches.find(session_id); it != sessions_and_persistent_watches.end())
+        count += it->second.size();
+    return count;
+}
 
-    LOG_TRACE(log, "Register watch path={}, session_id={}, data={}", path, toHexString(session_id), toString(sessions_and_watchers[session_id][path]));
+bool WatchManager::isWatchingLocked(const HashedPath & hashed_path, int64_t session_id) const
+{
+    auto it = path_ids.findHashed(hashed_path.path, hashed_path.hash);
+    if (it == path_ids.end())
+        return false;
+    const auto & watched_path = watched_paths[it->second];
+    return hasSession(watched_path.data_watchers, session_id) || hasSession(watched_path.list_watchers, session_id);
+}
+
+bool WatchManager::registerWatches(const HashedPath & hashed_path, int64_t session_id, Coordination::OpNum opnum)
+{
+    std::lock_guard lock(watch_mutex);
+    /// Watching a path watched already by the other type does not count
+    if (max_watches_per_session && sessionWatchesCountLocked(session_id) >= max_watches_per_session
+        && !isWatchingLocked(hashed_path, session_id))
+    {
+        LOG_DEBUG(log, "Reject watch path={}, session_id={}, too many watches", hashed_path.path, toHexString(session_id));
+        return false;
+    }
+    registerWatchesLocked(hashed_path, session_id, getWatchType(opnum));
+    return true;
 }
 
-ResponsesForSessions WatchManager::processWatches(const String & path, Coordination::OpNum opnum)
+ResponsesForSessions WatchManager::processWatches(const HashedPath & path, Coordination::OpNum opnum)
 {
     switch (opnum)
     {
         case Coordination::OpNum::Create:
+        case Coordination::OpNum::Create2:
+        case Coordination::OpNum::CreateContainer:
+        case Coordination::OpNum::CreateTTL:
             return processWatches(path, Coordination::Event::CREATED);
         case Coordination::OpNum::Remove:
             return processWatches(path, Coordination::Event::DELETED);
@@ -45,81 +213,191 @@ ResponsesForSessions WatchManager::processWatches(const String & path, Coordinat
     }
 }
 
-ResponsesForSessions WatchManager::processWatches(const String & path, Coordination::Event event_type)
+ResponsesForSessions WatchManager::processWatches(const HashedPath & hashed_path, Coordination::Event event_type)
 {
     std::lock_guard lock(watch_mutex);
+    return processWatchesLocked(hashed_path, event_type);
+}
 
-    ResponsesForSessions result;
-    auto it = watches.find(path);
-    if (it != watches.end())
+WatchManager::SessionSet WatchManager::takeWatchersLocked(const HashedPath & hashed_path, WatchType type)
+{
+    SessionSet triggered;
+    auto it = path_ids.findHashed(hashed_path.path, hashed_path.hash);
+    if (it == path_ids.end())
+        return triggered;
+
+    auto path_id = it->second;
+    auto & watched_path = watched_paths[path_id];
+    auto & watchers = watched_path.watchers(type);
+    if (watchers.empty())
+        return triggered;
+
+    triggered.swap(watchers);
+    total_watches -= triggered.size();
+    --(type == WatchType::Data ? data_watched_paths : list_watched_paths);
+
+    const auto & other_watchers = type == WatchType::Data ? watched_path.list_watchers : watched_path.data_watchers;
+    for (auto watcher_session : triggered)
     {
-        std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_response = std::make_shared<Coordination::ZooKeeperWatchResponse>();
-        watch_response->path = path;
-        watch_response->xid = Coordination::WATCH_XID;
-        watch_response->zxid = -1;
-        watch_response->type = event_type;
-        watch_response->state = Coordination::State::CONNECTED;
-        for (auto watcher_session : it->second)
+        LOG_TRACE(
+            log,
+            "Unregister watch path={}, session_id={}, type={}",
+            hashed_path.path,
+            toHexString(watcher_session),
+            toString(static_cast<UInt8>(type)));
+        if (!hasSession(other_watchers, watcher_session))
+            markStale(watcher_session);
+    }
+
+    releasePathIfEmpty(path_id);
+    return triggered;
+}
+
+void WatchManager::collectPersistentWatchersLocked(std::string_view path, bool child_event, SessionSet & sessions) const
+{
+    if (persistent_watches.size() == 0)
+        return;
+
+    persistent_watches.forEachPrefix(
+        path,
+        [&](const PersistentWatchers & watchers, bool is_path)
         {
-            result.push_back(ResponseForSession{watcher_session, watch_response});
-            LOG_TRACE(log, "Unregister watch for path={}, session_id={}, data={}", path, toHexString(watcher_session), toString(sessions_and_watchers[watcher_session][path]));
-            if ((sessions_and_watchers[watcher_session][path] ^= static_cast<uint8_t>(WatchType::Data)) == 0)
-            {
-                sessions_and_watchers[watcher_session].erase(path);
-                LOG_TRACE(log, "Unregister sessions_and_watchers path={}, session_id={}", path, toHexString(watcher_session));
-            }
-        }
-        watches.erase(it);
+            if (is_path)
+                sessions.insert(sessions.end(), watchers.persistent.begin(), watchers.persistent.end());
+            /// Recursive watches never trigger child events
+            if (!child_event)
+                sessions.insert(sessions.end(), watchers.recursive.begin(), watchers.recursive.end());
+        });
+}
+
+void WatchManager::triggerWatchesLocked(
+    std::string_view path, Coordination::Event event_type, SessionSet & sessions, ResponsesForSessions & result)
+{
+    if (sessions.empty())
+        return;
+
+    /// A session is notified once even if it is both a standard and persistent watcher
+    std::sort(sessions.begin(), sessions.end());
+    sessions.erase(std::unique(sessions.begin(), sessions.end()), sessions.end());
+
+    /// Pooled like other responses, it is released by an IO thread once sent
+    auto watch_response = std::allocate_shared<Coordination::ZooKeeperWatchResponse>(
+        SlabAllocator<Coordination::ZooKeeperWatchResponse>());
+    watch_response->path = path;
+    watch_response->xid = Coordination::WATCH_XID;
+    watch_response->zxid = -1;
+    watch_response->type = event_type;
+    watch_response->state = Coordination::State::CONNECTED;
+
+    /// Fanned out to the sessions by the response thread
+    int64_t session_id = sessions.front();
+    result.emplace_back(session_id, std::move(watch_response), std::make_shared<const Watchers>(std::move(sessions)));
+    sessions.clear();
+}
 
+ResponsesForSessions WatchManager::processWatchesLocked(const HashedPath & hashed_path, Coordination::Event event_type)
+{
+    ResponsesForSessions result;
+    std::string_view path = hashed_path.path;
+
+    if (event_type == Coordination::Event::CHILD)
+    {
+        auto sessions = takeWatchersLocked(hashed_path, WatchType::List);
+        collectPersistentWatchersLocked(path, true, sessions);
+        triggerWatchesLocked(path, Coordination::Event::CHILD, sessions, result);
+        return result;
     }
 
-    auto parent_path = getParentPath(path);
+    /// CHANGED event never trigger list wathes
+    auto sessions = takeWatchersLocked(hashed_path, WatchType::Data);
+    collectPersistentWatchersLocked(path, false, sessions);
+    triggerWatchesLocked(path, event_type, sessions, result);
 
-    Strings paths_to_check_for_list_watches;
-    if (event_type == Coordination::Event::CREATED)
+    if (event_type == Coordination::Event::DELETED)
     {
-        paths_to_check_for_list_watches.push_back(parent_path); /// Trigger list watches for parent
+        /// Trigger list watches for this path
+        sessions = takeWatchersLocked(hashed_path, WatchType::List);
+        triggerWatchesLocked(path, Coordination::Event::DELETED, sessions, result);
     }
-    else if (event_type == Coordination::Event::DELETED)
+
+    if (event_type == Coordination::Event::CREATED || event_type == Coordination::Event::DELETED)
     {
-        paths_to_check_for_list_watches.push_back(path); /// Trigger both list watches for this path
-        paths_to_check_for_list_watches.push_back(parent_path); /// And for parent path
+        /// And for parent path
+        std::string_view parent_path = parentPathOf(path);
+        sessions = takeWatchersLocked(HashedPath(parent_path), WatchType::List);
+        collectPersistentWatchersLocked(parent_path, true, sessions);
+        triggerWatchesLocked(parent_path, Coordination::Event::CHILD, sessions, result);
     }
-    /// CHANGED event never trigger list wathes
 
-    for (const auto & path_to_check : paths_to_check_for_list_watches)
+    return result;
+}
+
+ResponsesForSessions WatchManager::processRemovedPaths(const std::vector<String> & paths)
+{
+    ResponsesForSessions result;
+    std::vector<String> parent_paths;
+    std::unordered_set<String> seen_parent_paths;
+
+    std::lock_guard lock(watch_mutex);
+    for (const auto & path : paths)
     {
-        it = list_watches.find(path_to_check);
-        if (it != list_watches.end())
-        {
-            std::shared_ptr<Coordination::ZooKeeperWatchResponse> watch_list_response
-                = std::make_shared<Coordination::ZooKeeperWatchResponse>();
-            watch_list_response->path = path_to_check;
-            watch_list_response->xid = Coordination::WATCH_XID;
-            watch_list_response->zxid = -1;
-            if (path_to_check == parent_path)
-                watch_list_response->type = Coordination::Event::CHILD;
-            else
-                watch_list_response->type = Coordination::Event::DELETED;
-
-            watch_list_response->state = Coordination::State::CONNECTED;
-            for (auto watcher_session : it->second)
-            {
-                result.push_back(ResponseForSession{watcher_session, watch_list_response});
-                LOG_TRACE(log, "Unregister watch forlistwatch path={}, session_id={}, data={}", path_to_check, toHexString(watcher_session), toString(sessions_and_watchers[watcher_session][path_to_check]));
-                if ((sessions_and_watchers[watcher_session][path_to_check] ^= static_cast<uint8_t>(WatchType::List)) == 0)
-                {
-                    sessions_and_watchers[watcher_session].erase(path_to_check);
-                    LOG_TRACE(log, "Unregister sessions_and_watchers path={}, session_id={}", path_to_check, toHexString(watcher_session));
-                }
-            }
+        HashedPath hashed_path(path);
+        auto sessions = takeWatchersLocked(hashed_path, WatchType::Data);
+        collectPersistentWatchersLocked(path, false, sessions);
+        triggerWatchesLocked(path, Coordination::Event::DELETED, sessions, result);
 
-            list_watches.erase(it);
-        }
+        sessions = takeWatchersLocked(hashed_path, WatchType::List);
+        triggerWatchesLocked(path, Coordination::Event::DELETED, sessions, result);
+
+        auto parent_path = getParentPath(path);
+        if (seen_parent_paths.insert(parent_path).second)
+            parent_paths.push_back(std::move(parent_path));
     }
+
+    for (const auto & parent_path : parent_paths)
+    {
+        auto sessions = takeWatchersLocked(HashedPath(parent_path), WatchType::List);
+        collectPersistentWatchersLocked(parent_path, true, sessions);
+        triggerWatchesLocked(parent_path, Coordination::Event::CHILD, sessions, result);
+    }
+
     return result;
 }
 
+bool WatchManager::addPersistentWatch(const String & path, int64_t session_id, Coordination::AddWatchMode mode)
+{
+    std::lock_guard lock(watch_mutex);
+    return addPersistentWatchLocked(path, session_id, mode, true);
+}
+
+bool WatchManager::addPersistentWatchLocked(const String & path, int64_t session_id, Coordination::AddWatchMode mode, bool limited)
+{
+    auto * watchers = persistent_watches.get(path);
+    if (limited && max_watches_per_session && sessionWatchesCountLocked(session_id) >= max_watches_per_session)
+    {
+        bool recursive = mode == Coordination::AddWatchMode::PersistentRecursive;
+        if (!watchers || !hasSession(recursive ? watchers->recursive : watchers->persistent, session_id))
+        {
+            LOG_DEBUG(log, "Reject persistent watch path={}, session_id={}, too many watches", path, toHexString(session_id));
+            return false;
+        }
+    }
+
+    if (!watchers)
+    {
+        persistent_watches.emplace(path, PersistentWatchers{});
+        watchers = persistent_watches.get(path);
+    }
+
+    auto & sessions = mode == Coordination::AddWatchMode::PersistentRecursive ? watchers->recursive : watchers->persistent;
+    if (!addSession(sessions, session_id))
+        return true;
+
+    ++persistent_watches_count;
+    sessions_and_persistent_watches[session_id].push_back(path);
+    LOG_TRACE(log, "Add persistent watch path={}, session_id={}, mode={}", path, toHexString(session_id), static_cast<int32_t>(mode));
+    return true;
+}
 
 ResponsesForSessions WatchManager::processRequestSetWatch(
     const RequestForSession & request_for_session, std::unordered_map<String, std::pair<int64_t, int64_t>> & watch_nodes_info)
@@ -129,72 +407,86 @@ ResponsesForSessions WatchManager::processRequestSetWatch(
     auto * request = dynamic_cast<Coordination::ZooKeeperSetWatchesRequest *>(request_for_session.request.get());
     auto session_id = request_for_session.session_id;
 
+    auto trigger = [&](const HashedPath & path, Coordination::Event event_type)
+    {
+        auto watch_responses = processWatchesLocked(path, event_type);
+        responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
+    };
+
     std::lock_guard lock(watch_mutex);
     for (String & path : request->data_watches)
     {
         LOG_TRACE(log, "Register data_watches for session {}, path {}, xid", toHexString(session_id), path, request->xid);
+        HashedPath hashed_path(path);
         /// register watches
-        watches[path].emplace(session_id);
-        sessions_and_watchers[session_id][path] |= static_cast<uint8_t>(WatchType::Data);
+        registerWatchesLocked(hashed_path, session_id, WatchType::Data);
 
         /// trigger watches
         if (!watch_nodes_info.contains(path))
         {
             LOG_TRACE(
                 log, "Trigger data_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::DELETED);
-            responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
+            trigger(hashed_path, Coordination::Event::DELETED);
         }
         else if (watch_nodes_info[path].first > request->relative_zxid)
         {
             LOG_TRACE(
                 log, "Trigger data_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::CHANGED);
-            responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
+            trigger(hashed_path, Coordination::Event::CHANGED);
         }
     }
 
     for (String & path : request->exist_watches)
     {
         LOG_TRACE(log, "Register exist_watches for session {}, path {}, xid", toHexString(session_id), path, request->xid);
+        HashedPath hashed_path(path);
         /// register watches
-        watches[path].emplace(session_id);
-        sessions_and_watchers[session_id][path] |= static_cast<uint8_t>(WatchType::Data);
+        registerWatchesLocked(hashed_path, session_id, WatchType::Data);
 
         /// trigger watches
         if (watch_nodes_info.contains(path))
         {
             LOG_TRACE(
                 log, "Trigger exist_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::CREATED);
-            responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
+            trigger(hashed_path, Coordination::Event::CREATED);
         }
     }
 
     for (String & path : request->list_watches)
     {
         LOG_TRACE(log, "Register list_watches for session {}, path {}, xid", toHexString(session_id), path, request->xid);
+        HashedPath hashed_path(path);
         /// register watches
-        list_watches[path].emplace(session_id);
-        sessions_and_watchers[session_id][path] |= static_cast<uint8_t>(WatchType::List);
+        registerWatchesLocked(hashed_path, session_id, WatchType::List);
 
         /// trigger watches
         if (!watch_nodes_info.contains(path))
         {
             LOG_TRACE(
                 log, "Trigger list_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::DELETED);
-            responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
+            trigger(hashed_path, Coordination::Event::DELETED);
         }
         else if (watch_nodes_info[path].second > request->relative_zxid)
         {
             LOG_TRACE(
                 log, "Trigger list_watches when processing SetWatch operation for session {}, path {}", toHexString(session_id), path);
-            auto watch_responses = processWatches(path, Coordination::Event::CHILD);
-            responses.insert(responses.end(), watch_responses.begin(), watch_responses.end());
+            trigger(hashed_path, Coordination::Event::CHILD);
         }
     }
 
+    /// Like ZooKeeper, persistent watches are set again without events of changes missed while disconnected
+    for (const String & path : request->persistent_watches)
+    {
+        LOG_TRACE(log, "Register persistent_watches for session {}, path {}", toHexString(session_id), path);
+        addPersistentWatchLocked(path, session_id, Coordination::AddWatchMode::Persistent, false);
+    }
+
+    for (const String & path : request->persistent_recursive_watches)
+    {
+        LOG_TRACE(log, "Register persistent_recursive_watches for session {}, path {}", toHexString(session_id), path);
+        addPersistentWatchLocked(path, session_id, Coordination::AddWatchMode::PersistentRecursive, false);
+    }
+
     return responses;
 }
 
@@ -203,86 +495,123 @@ void WatchManager::cleanDeadWatches(int64_t session_id)
     LOG_DEBUG(log, "Clean dead watches for session {}", toHexString(session_id));
 
     std::lock_guard watch_lock(watch_mutex);
+    cleanDeadWatchesLocked(session_id);
+}
+
+void WatchManager::cleanDeadWatches(const std::vector<int64_t> & session_ids)
+{
+    LOG_DEBUG(log, "Clean dead watches for {} sessions", session_ids.size());
+
+    std::lock_guard watch_lock(watch_mutex);
+    for (auto session_id : session_ids)
+        cleanDeadWatchesLocked(session_id);
+}
+
+void WatchManager::cleanDeadWatchesLocked(int64_t session_id)
+{
     auto watches_it = sessions_and_watchers.find(session_id);
 
     if (watches_it != sessions_and_watchers.end())
     {
-        for (const auto & [watch_path, _] : watches_it->second)
+        /// Stale and duplicated path ids are harmless, the session is not in their watchers.
+        for (auto path_id : watches_it->second.path_ids)
         {
-            auto watch = watches.find(watch_path);
-            if (watch != watches.end())
-            {
-                auto & watches_for_path = watch->second;
-                for (auto w_it = watches_for_path.begin(); w_it != watches_for_path.end();)
-                {
-                    if (*w_it == session_id)
-                        w_it = watches_for_path.erase(w_it);
-                    else
-                        ++w_it;
-                }
-                if (watches_for_path.empty())
-                    watches.erase(watch);
-            }
-
-            auto list_watch = list_watches.find(watch_path);
-            if (list_watch != list_watches.end())
-            {
-                auto & list_watches_for_path = list_watch->second;
-                for (auto w_it = list_watches_for_path.begin(); w_it != list_watches_for_path.end();)
-                {
-                    if (*w_it == session_id)
-                        w_it = list_watches_for_path.erase(w_it);
-                    else
-                        ++w_it;
-                }
-                if (list_watches_for_path.empty())
-                    list_watches.erase(list_watch);
-            }
+            bool removed = removeWatcher(path_id, WatchType::Data, session_id);
+            removed |= removeWatcher(path_id, WatchType::List, session_id);
+            if (removed)
+                releasePathIfEmpty(path_id);
         }
         sessions_and_watchers.erase(watches_it);
     }
+
+    auto persistent_it = sessions_and_persistent_watches.find(session_id);
+    if (persistent_it != sessions_and_persistent_watches.end())
+    {
+        for (const auto & path : persistent_it->second)
+        {
+            auto * watchers = persistent_watches.get(path);
+            if (!watchers)
+                continue;
+            persistent_watches_count -= removeSession(watchers->persistent, session_id);
+            persistent_watches_count -= removeSession(watchers->recursive, session_id);
+            if (watchers->persistent.empty() && watchers->recursive.empty())
+                persistent_watches.erase(path);
+        }
+        sessions_and_persistent_watches.erase(persistent_it);
+    }
 }
 
 uint64_t WatchManager::getTotalWatchesCount() const
 {
     std::lock_guard lock(watch_mutex);
-    uint64_t ret = 0;
-    for (const auto & [path, subscribed_sessions] : watches)
-        ret += subscribed_sessions.size();
-
-    for (const auto & [path, subscribed_sessions] : list_watches)
-        ret += subscribed_sessions.size();
-
-    return ret;
+    return total_watches + persistent_watches_count;
 }
 
 uint64_t WatchManager::getSessionsWithWatchesCount() const
 {
     std::lock_guard lock(watch_mutex);
-    std::unordered_set<int64_t> counter;
-    for (const auto & [path, subscribed_sessions] : watches)
-        counter.insert(subscribed_sessions.begin(), subscribed_sessions.end());
-
-    for (const auto & [path, subscribed_sessions] : list_watches)
-        counter.insert(subscribed_sessions.begin(), subscribed_sessions.end());
-
-    return counter.size();
+    uint64_t ret = sessions_and_watchers.size();
+    for (const auto & [session_id, _] : sessions_and_persistent_watches)
+        ret += !sessions_and_watchers.contains(session_id);
+    return ret;
 }
 
-void WatchManager::dumpWatches(WriteBufferFromOwnString & buf) const
+uint64_t WatchManager::getApproximateMemoryUsage() const
 {
     std::lock_guard lock(watch_mutex);
-    for (const auto & [session_id, watches_paths] : sessions_and_watchers)
+    uint64_t bytes = watched_paths.size() * sizeof(WatchedPath) + watched_paths_bytes + free_path_ids.capacity() * sizeof(PathId)
+        + path_ids.getBufferSizeInBytes() + hashTableMemoryUsage(sessions_and_watchers);
+    /// A watch is a session in a set of its path and a path id in the list of its session
+    bytes += total_watches * (sizeof(int64_t) + sizeof(PathId));
+    /// A persistent watch is a session in the trie and a path in the list of its session
+    bytes += persistent_watches.getApproximateMemoryUsage() + hashTableMemoryUsage(sessions_and_persistent_watches)
+        + persistent_watches_count * (sizeof(int64_t) + sizeof(String));
+    return bytes;
+}
+
+void WatchManager::dumpWatches(const DumpOutput & output) const
+{
+    /// Sessions are taken at once, and looked up again by chunks, the ones gone meanwhile are skipped.
+    std::vector<int64_t> session_ids;
+    {
+        std::lock_guard lock(watch_mutex);
+        session_ids.reserve(sessions_and_watchers.size() + sessions_and_persistent_watches.size());
+        for (const auto & [session_id, _] : sessions_and_watchers)
+            session_ids.push_back(session_id);
+        for (const auto & [session_id, _] : sessions_and_persistent_watches)
+            if (!sessions_and_watchers.contains(session_id))
+                session_ids.push_back(session_id);
+    }
+
+    for (size_t begin = 0; begin < session_ids.size(); begin += DUMP_CHUNK_SIZE)
     {
-        buf << toHexString(session_id) << "\n";
-        for (const auto & [path, _] : watches_paths)
-            buf << "\t" << path << "\n";
+        WriteBufferFromOwnString buf;
+        {
+            std::lock_guard lock(watch_mutex);
+            for (size_t i = begin; i < std::min(begin + DUMP_CHUNK_SIZE, session_ids.size()); ++i)
+            {
+                int64_t session_id = session_ids[i];
+                auto watches_it = sessions_and_watchers.find(session_id);
+                auto persistent_it = sessions_and_persistent_watches.find(session_id);
+                if (watches_it == sessions_and_watchers.end() && persistent_it == sessions_and_persistent_watches.end())
+                    continue;
+
+                buf << toHexString(session_id) << "\n";
+                if (watches_it != sessions_and_watchers.end())
+                    for (auto path_id : livePathIds(session_id, watches_it->second))
+                        buf << "\t" << watched_paths[path_id].path << "\n";
+                if (persistent_it != sessions_and_persistent_watches.end())
+                    for (const auto & path : persistent_it->second)
+                        buf << "\t" << path << "\n";
+            }
+        }
+        output(std::move(buf.str()));
     }
 }
 
-void WatchManager::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
+void WatchManager::dumpWatchesByPath(const DumpOutput & output) const
 {
-    auto write_int_vec = [&buf](const std::unordered_set<int64_t> & session_ids)
+    auto write_int_vec = [](WriteBufferFromOwnString & buf, const SessionSet & session_ids)
     {
         for (int64_t session_id : session_ids)
         {
@@ -290,26 +619,62 @@ void WatchManager::dumpWatchesByPath(WriteBufferFromOwnString & buf) const
         }
     };
 
-    std::lock_guard lock(watch_mutex);
-    for (const auto & [watch_path, sessions] : watches)
+    /// Elements of watched_paths never move and are dumped by index, a path released meanwhile has no watchers.
+    auto dump_watchers = [&](WatchType type)
     {
-        buf << watch_path << "\n";
-        write_int_vec(sessions);
-    }
+        for (size_t begin = 0;; begin += DUMP_CHUNK_SIZE)
+        {
+            WriteBufferFromOwnString buf;
+            {
+                std::lock_guard lock(watch_mutex);
+                if (begin >= watched_paths.size())
+                    return;
+                for (size_t i = begin; i < std::min(begin + DUMP_CHUNK_SIZE, watched_paths.size()); ++i)
+                {
+                    const auto & watched_path = watched_paths[i];
+                    const auto & watchers = type == WatchType::Data ? watched_path.data_watchers : watched_path.list_watchers;
+                    if (watchers.empty())
+                        continue;
+                    buf << watched_path.path << "\n";
+                    write_int_vec(buf, watchers);
+                }
+            }
+            output(std::move(buf.str()));
+        }
+    };
 
-    for (const auto & [watch_path, sessions] : list_watches)
+    dump_watchers(WatchType::Data);
+    dump_watchers(WatchType::List);
+
+    /// Persistent watches are few, they are dumped at once
+    WriteBufferFromOwnString buf;
     {
-        buf << watch_path << "\n";
-        write_int_vec(sessions);
+        std::lock_guard lock(watch_mutex);
+        persistent_watches.forEach(
+            [&](const String & watch_path, const PersistentWatchers & watchers)
+            {
+                buf << watch_path << "\n";
+                write_int_vec(buf, watchers.persistent);
+                write_int_vec(buf, watchers.recursive);
+            });
     }
+    output(std::move(buf.str()));
 }
 
 void WatchManager::reset()
 {
     std::lock_guard lock(watch_mutex);
-    watches.clear();
-    list_watches.clear();
+    watched_paths.clear();
+    free_path_ids.clear();
+    path_ids.clear();
     sessions_and_watchers.clear();
+    persistent_watches.clear();
+    sessions_and_persistent_watches.clear();
+    persistent_watches_count = 0;
+    data_watched_paths = 0;
+    list_watched_paths = 0;
+    total_watches = 0;
+    watched_paths_bytes = 0;
 }
 
 }
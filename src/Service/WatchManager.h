@@ -1,14 +1,19 @@
 #pragma once
 
+#include <deque>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 #include <Poco/Logger.h>
 
 #include <Service/KeeperCommon.h>
+#include <Service/MemoryUsage.h>
+#include <Service/PathTrie.h>
 #include <Service/SessionExpiryQueue.h>
 #include <Service/formatHex.h>
+#include <Common/FlatHashMap.h>
+#include <Common/ProfiledMutex.h>
 #include <ZooKeeper/ZooKeeperCommon.h>
 
 namespace RK
@@ -24,45 +29,150 @@ enum class WatchType : UInt8
 class WatchManager
 {
 public:
-    using Watches = std::unordered_map<String, std::unordered_set<int64_t>>;
-    using SessionAndWatcher = std::unordered_map<int64_t, std::unordered_map<String, UInt8>>;
-
     explicit WatchManager() : log(&Poco::Logger::get("WatchManager")) { }
 
-    void registerWatches(const String & path, int64_t session_id, Coordination::OpNum opnum);
+    /// Return false if the watch is rejected, for the session has max_watches_per_session watches.
+    bool registerWatches(const HashedPath & path, int64_t session_id, Coordination::OpNum opnum);
+    bool registerWatches(const String & path, int64_t session_id, Coordination::OpNum opnum)
+    {
+        return registerWatches(HashedPath(path), session_id, opnum);
+    }
+
+    /// Return a response for every triggered event, its watchers are the sessions to send it to.
+    ResponsesForSessions processWatches(const HashedPath & path, Coordination::OpNum opnum);
+    ResponsesForSessions processWatches(const String & path, Coordination::OpNum opnum) { return processWatches(HashedPath(path), opnum); }
 
-    ResponsesForSessions processWatches(const String & path, Coordination::OpNum opnum);
-    ResponsesForSessions processWatches(const String & path, Coordination::Event event_type);
+    ResponsesForSessions processWatches(const HashedPath & path, Coordination::Event event_type);
+    ResponsesForSessions processWatches(const String & path, Coordination::Event event_type)
+    {
+        return processWatches(HashedPath(path), event_type);
+    }
 
-    /// Process request SetWatch from client
+    /// Trigger DELETED events of removed paths, a parent of many removed paths gets a single CHILD event.
+    ResponsesForSessions processRemovedPaths(const std::vector<String> & paths);
+
+    /// Process request SetWatches or SetWatches2 from client
     ResponsesForSessions processRequestSetWatch(
         const RequestForSession & request_for_session, std::unordered_map<String, std::pair<int64_t, int64_t>> & watch_nodes_info);
 
+    /// Process request AddWatch from client, persistent watches are not removed when triggered.
+    /// Return false if the watch is rejected like by registerWatches.
+    bool addPersistentWatch(const String & path, int64_t session_id, Coordination::AddWatchMode mode);
+
+    /// Paths a session may watch and persistent watches it may have, a watch more is rejected, 0 means no limit.
+    /// Watches set again by SetWatches after reconnecting are not limited, they were accepted before.
+    void setMaxWatchesPerSession(UInt64 max_watches)
+    {
+        std::lock_guard lock(watch_mutex);
+        max_watches_per_session = max_watches;
+    }
+
+    /// Paths the session watches and persistent watches of it
+    uint64_t getSessionWatchesCount(int64_t session_id) const
+    {
+        std::lock_guard lock(watch_mutex);
+        return sessionWatchesCountLocked(session_id);
+    }
+
     void cleanDeadWatches(int64_t session_id);
+    void cleanDeadWatches(const std::vector<int64_t> & session_ids);
 
     uint64_t getWatchedPathsCount() const
     {
         std::lock_guard lock(watch_mutex);
-        return watches.size() + list_watches.size();
+        return data_watched_paths + list_watched_paths + persistent_watches.size();
     }
 
     uint64_t getTotalWatchesCount() const;
     uint64_t getSessionsWithWatchesCount() const;
 
-    void dumpWatches(WriteBufferFromOwnString & buf) const;
-    void dumpWatchesByPath(WriteBufferFromOwnString & buf) const;
+    /// Approximate bytes of watched paths and the watches of sessions
+    uint64_t getApproximateMemoryUsage() const;
+
+    void dumpWatches(const DumpOutput & output) const;
+    void dumpWatchesByPath(const DumpOutput & output) const;
 
     void reset();
 
 private:
-    /// Session id -> node path
-    SessionAndWatcher sessions_and_watchers;
-    /// Node path -> session id. Watches for 'get' and 'exist' requests
-    Watches watches;
-    /// Node path -> session id. Watches for 'list' request (watches on children).
-    Watches list_watches;
-
-    mutable std::mutex watch_mutex;
+    /// Sessions watching a path, sorted. Most paths are watched by a few sessions.
+    using SessionSet = std::vector<int64_t>;
+    using PathId = UInt32;
+
+    struct WatchedPath
+    {
+        String path;
+        /// Watches for 'get' and 'exist' requests
+        SessionSet data_watchers;
+        /// Watches for 'list' request (watches on children).
+        SessionSet list_watchers;
+
+        bool empty() const { return data_watchers.empty() && list_watchers.empty(); }
+        SessionSet & watchers(WatchType type) { return type == WatchType::Data ? data_watchers : list_watchers; }
+    };
+
+    /// Paths watched by a session. A path id is appended when the session starts watching the path and
+    /// is not removed when the watch is triggered, instead it is counted as stale and the list is
+    /// compacted when stale ids are more than a half. Path ids are reused, so the list may have duplicates.
+    struct SessionWatches
+    {
+        std::vector<PathId> path_ids;
+        size_t stale = 0;
+    };
+
+    struct PersistentWatchers
+    {
+        SessionSet persistent;
+        SessionSet recursive;
+    };
+
+    PathId getOrCreatePathId(const HashedPath & path);
+    void releasePathIfEmpty(PathId path_id);
+
+    /// Return whether the session starts watching the path
+    bool addWatcher(PathId path_id, WatchType type, int64_t session_id);
+    /// Return whether the session stops watching the path
+    bool removeWatcher(PathId path_id, WatchType type, int64_t session_id);
+
+    void markStale(int64_t session_id);
+    std::vector<PathId> livePathIds(int64_t session_id, const SessionWatches & session_watches) const;
+
+    void registerWatchesLocked(const HashedPath & path, int64_t session_id, WatchType type);
+    /// Not limited by max_watches_per_session if limited is false, like watches set by SetWatches2
+    bool addPersistentWatchLocked(const String & path, int64_t session_id, Coordination::AddWatchMode mode, bool limited);
+    uint64_t sessionWatchesCountLocked(int64_t session_id) const;
+    bool isWatchingLocked(const HashedPath & path, int64_t session_id) const;
+    /// Remove and return the watchers of path
+    SessionSet takeWatchersLocked(const HashedPath & path, WatchType type);
+    /// Append persistent watchers of path and recursive watchers of path and its ancestors, for child events only the former.
+    void collectPersistentWatchersLocked(std::string_view path, bool child_event, SessionSet & sessions) const;
+    void triggerWatchesLocked(std::string_view path, Coordination::Event event_type, SessionSet & sessions, ResponsesForSessions & result);
+    ResponsesForSessions processWatchesLocked(const HashedPath & path, Coordination::Event event_type);
+    void cleanDeadWatchesLocked(int64_t session_id);
+
+    /// Interned watched paths, elements never move, so the keys of path_ids can point to their paths.
+    std::deque<WatchedPath> watched_paths;
+    std::vector<PathId> free_path_ids;
+    /// Node path -> path id
+    FlatHashMap<std::string_view, PathId, StringHash> path_ids;
+
+    /// Session id -> watched paths
+    std::unordered_map<int64_t, SessionWatches> sessions_and_watchers;
+
+    /// Node path -> persistent watchers, a changed path is matched by walking its ancestors only.
+    PathTrie<PersistentWatchers> persistent_watches;
+    /// Session id -> paths of persistent watches
+    std::unordered_map<int64_t, std::vector<String>> sessions_and_persistent_watches;
+    uint64_t persistent_watches_count = 0;
+
+    uint64_t data_watched_paths = 0;
+    uint64_t list_watched_paths = 0;
+    uint64_t total_watches = 0;
+    UInt64 max_watches_per_session = 0;
+    /// Heap bytes of the paths of watched_paths
+    uint64_t watched_paths_bytes = 0;
+
+    mutable ProfiledMutex watch_mutex{"watch_mutex"};
 
     Poco::Logger * log;
 };
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <Service/WriteBufferFromNuraftBuffer.h>
 #include <common/logger_useful.h>
 
@@ -28,9 +29,9 @@ void WriteBufferFromNuraftBuffer::nextImpl()
     working_buffer = internal_buffer;
 }
 
-WriteBufferFromNuraftBuffer::WriteBufferFromNuraftBuffer() : WriteBuffer(nullptr, 0)
+WriteBufferFromNuraftBuffer::WriteBufferFromNuraftBuffer(size_t reserve) : WriteBuffer(nullptr, 0)
 {
-    buffer = nuraft::buffer::alloc(initial_size);
+    buffer = nuraft::buffer::alloc(std::max(reserve, size_t(1)));
     set(reinterpret_cast<Position>(buffer->data_begin()), buffer->size());
 }
 
@@ -41,9 +42,13 @@ void WriteBufferFromNuraftBuffer::finalize()
 
     is_finished = true;
     size_t real_size = pos - reinterpret_cast<Position>(buffer->data_begin());
-    nuraft::ptr<nuraft::buffer> new_buffer = nuraft::buffer::alloc(real_size);
-    memcpy(new_buffer->data_begin(), buffer->data_begin(), real_size);
-    buffer = new_buffer;
+    /// Exactly reserved
+    if (real_size != buffer->size())
+    {
+        nuraft::ptr<nuraft::buffer> new_buffer = nuraft::buffer::alloc(real_size);
+        memcpy(new_buffer->data_begin(), buffer->data_begin(), real_size);
+        buffer = new_buffer;
+    }
 
     /// Prevent further writes.
     set(nullptr, 0);
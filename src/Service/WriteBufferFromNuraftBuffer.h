@@ -7,7 +7,8 @@ namespace RK
 {
 
 /**
- * writer buffer for NuRaft Buffer.
+ * writer buffer for NuRaft Buffer. It grows by reallocating, so if the size to write is known, pass it to
+ * the constructor, then the buffer is allocated once and returned as it is.
  */
 class WriteBufferFromNuraftBuffer : public WriteBuffer
 {
@@ -21,7 +22,7 @@ private:
     void nextImpl() override;
 
 public:
-    WriteBufferFromNuraftBuffer();
+    explicit WriteBufferFromNuraftBuffer(size_t reserve = initial_size);
 
     void finalize() override final;
     nuraft::ptr<nuraft::buffer> getBuffer();
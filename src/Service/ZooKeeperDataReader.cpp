@@ -2,9 +2,16 @@
 #include <filesystem>
 #include <cstdlib>
 #include <Common/IO/ReadHelpers.h>
+#include <Service/KeeperUtils.h>
 #include <ZooKeeper/ZooKeeperIO.h>
+#include <Common/ConcurrentBoundedQueue.h>
 #include <Common/IO/ReadBufferFromFile.h>
+#include <Common/ThreadPool.h>
+#include <Common/WorkStealing.h>
+#include <Common/getNumberOfPhysicalCPUCores.h>
 #include <string>
+#include <thread>
+#include <common/scope_guard.h>
 
 
 namespace RK
@@ -14,6 +21,7 @@ namespace ErrorCodes
 {
     extern const int NOT_IMPLEMENTED;
     extern const int CORRUPTED_DATA;
+    extern const int LOGICAL_ERROR;
 }
 
 int64_t getZxidFromName(const String & filename)
@@ -95,6 +103,30 @@ void deserializeACLMap(KeeperStore & store, ReadBuffer & in)
     }
 }
 
+namespace
+{
+
+/// Nodes read from a ZooKeeper snapshot are converted in chunks, so that memory besides the store is bounded.
+constexpr size_t CONVERT_CHUNK_NODES = 100000;
+
+/// Nodes and edges of a chunk, both are held in buckets as loading snapshots of our own, edges in buckets of parents.
+struct ZooKeeperSnapshotChunk
+{
+    explicit ZooKeeperSnapshotChunk(UInt32 bucket_num) : nodes(bucket_num), edges(bucket_num) { }
+
+    KeeperStore::BucketNodes nodes;
+    KeeperStore::BucketEdges edges;
+    size_t size = 0;
+};
+
+/// Run job for every bucket of data tree on thread_pool, a thread takes buckets of its own and steals others when done.
+void forEachBucket(ThreadPool & thread_pool, UInt32 thread_num, UInt32 bucket_num, const std::function<void(UInt32)> & job)
+{
+    parallelFor(thread_pool, thread_num, bucket_num, [&job](size_t bucket_id) { job(static_cast<UInt32>(bucket_id)); });
+}
+
+}
+
 int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logger * log)
 {
     int64_t max_zxid = 0;
@@ -103,9 +135,59 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
     Coordination::read(path, in);
     size_t count = 0;
 
+    const UInt32 bucket_num = store.getDataTreeBucketNum();
+    const UInt32 thread_num = std::min(bucket_num, std::max(getNumberOfPhysicalCPUCores(), 1U));
+    ThreadPool bucket_pool(thread_num);
+
+    /// ZooKeeper saves a parent before its children, but the parent of a node may be missing when the chunk of the node
+    /// is converted if the snapshot is fuzzy. The edge is retried after all nodes are in the tree.
+    KeeperStore::BucketEdges deferred_edges(bucket_num);
+
+    auto convert_chunk = [&](const std::shared_ptr<ZooKeeperSnapshotChunk> & chunk)
+    {
+        auto & data_tree = store.getDataTree();
+        forEachBucket(
+            bucket_pool,
+            thread_num,
+            bucket_num,
+            [&](UInt32 bucket_id)
+            {
+                for (auto & [node_path, node] : chunk->nodes[bucket_id])
+                    data_tree.emplace(node_path, std::move(node), bucket_id);
+            });
+
+        /// After all nodes of the chunk are in the tree, for parents may be in any bucket
+        forEachBucket(
+            bucket_pool,
+            thread_num,
+            bucket_num,
+            [&](UInt32 bucket_id)
+            {
+                for (auto & edge : chunk->edges[bucket_id])
+                {
+                    auto parent = data_tree.get(edge.first);
+                    if (unlikely(parent == nullptr))
+                        deferred_edges[bucket_id].emplace_back(std::move(edge));
+                    else if (parent->children.emplace(std::move(edge.second)))
+                        parent->stat.numChildren++;
+                }
+            });
+    };
+
+    /// A chunk is converted while the next one is being read, at most two are in memory. It is declared after what
+    /// converting uses, so that it is joined first when an exception is thrown.
+    ThreadPool convert_pool(1);
+
+    auto submit_chunk = [&](std::shared_ptr<ZooKeeperSnapshotChunk> chunk)
+    {
+        convert_pool.wait();
+        convert_pool.scheduleOrThrowOnError([&convert_chunk, chunk] { convert_chunk(chunk); });
+    };
+
+    auto chunk = std::make_shared<ZooKeeperSnapshotChunk>(bucket_num);
     while (path != "/")
     {
-        std::shared_ptr<KeeperNode> node = std::make_shared<KeeperNode>();
+        KeeperNodePtr node = KeeperNode::create();
         Coordination::read(node->data, in);
 
         size_t acl_id;
@@ -131,14 +213,27 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
 
         if (!path.empty())
         {
-            node->stat.dataLength = node->data.length();
-            store.addNode(path, node);
-
-            if (node->stat.ephemeralOwner != 0)
+            /// Container and TTL nodes of ZooKeeper are told by their owners too
+            if (isEphemeralOwner(node->stat.ephemeralOwner))
             {
                 node->is_ephemeral = true;
                 store.addEphemeralNode(node->stat.ephemeralOwner, path);
             }
+            else
+            {
+                store.indexExpiringNode(path, *node);
+            }
+
+            auto parent_path = getParentPath(path);
+            auto & edges = chunk->edges[store.getBucketIndex(parent_path)];
+            edges.emplace_back(std::move(parent_path), getBaseName(path));
+            chunk->nodes[store.getBucketIndex(path)].emplace_back(std::move(path), std::move(node));
+
+            if (++chunk->size == CONVERT_CHUNK_NODES)
+            {
+                submit_chunk(std::move(chunk));
+                chunk = std::make_shared<ZooKeeperSnapshotChunk>(bucket_num);
+            }
         }
 
         Coordination::read(path, in);
@@ -148,9 +243,15 @@ int64_t deserializeStorageData(KeeperStore & store, ReadBuffer & in, Poco::Logge
             LOG_INFO(log, "Deserialized nodes from snapshot: {}", count);
     }
 
-    store.buildChildrenSet(true);
+    submit_chunk(std::move(chunk));
+    convert_pool.wait();
+
     LOG_INFO(log, "Totally deserialized {} nodes from snapshot", count);
 
+    std::vector<KeeperStore::BucketEdges> all_deferred_edges{std::move(deferred_edges)};
+    forEachBucket(
+        bucket_pool, thread_num, bucket_num, [&](UInt32 bucket_id) { store.buildBucketChildren(all_deferred_edges, bucket_id, true); });
+
     return max_zxid;
 }
 
@@ -487,9 +588,17 @@ bool hasErrorsInMultiRequest(Coordination::ZooKeeperRequestPtr request)
     return false;
 }
 
-}
+/// Transaction read from ZooKeeper log, request is nullptr for error transactions.
+struct ZooKeeperTxn
+{
+    Coordination::ZooKeeperRequestPtr request;
+    int64_t session_id;
+    int64_t zxid;
+    int64_t time;
+};
 
-bool deserializeTxn(KeeperStore & store, ReadBuffer & in, Poco::Logger * log)
+/// Return false if there is no more transaction
+bool deserializeTxn(ZooKeeperTxn & txn, ReadBuffer & in, Poco::Logger * log)
 {
     int64_t checksum;
     Coordination::read(checksum, in);
@@ -500,29 +609,33 @@ bool deserializeTxn(KeeperStore & store, ReadBuffer & in, Poco::Logger * log)
     int32_t txn_len;
     Coordination::read(txn_len, in);
     int64_t count_before = in.count();
-    int64_t session_id;
-    Coordination::read(session_id, in);
+    Coordination::read(txn.session_id, in);
     int32_t xid;
     Coordination::read(xid, in);
-    int64_t zxid;
-    Coordination::read(zxid, in);
-    int64_t time;
-    Coordination::read(time, in);
+    Coordination::read(txn.zxid, in);
+    Coordination::read(txn.time, in);
 
-    Coordination::ZooKeeperRequestPtr request = deserializeTxnImpl(in, false, txn_len, log);
+    txn.request = deserializeTxnImpl(in, false, txn_len, log);
 
     /// Skip all other bytes
     int64_t bytes_read = in.count() - count_before;
     if (bytes_read < txn_len)
         in.ignore(txn_len - bytes_read);
 
+    if (!isErrorRequest(txn.request))
+        txn.request->xid = xid;
+    return true;
+}
+
+void applyTxn(KeeperStore & store, const ZooKeeperTxn & txn)
+{
+    const auto & request = txn.request;
+
     /// We don't need to apply error requests
     if (isErrorRequest(request))
-        return true;
+        return;
 
-    request->xid = xid;
-
-    if (zxid > store.getZxid())
+    if (txn.zxid > store.getZxid())
     {
         /// Separate processing of session id requests
         if (request->getOpNum() == Coordination::OpNum::NewSession)
@@ -534,17 +647,17 @@ bool deserializeTxn(KeeperStore & store, ReadBuffer & in, Poco::Logger * log)
         {
             /// Skip failed multi-requests
             if (request->getOpNum() == Coordination::OpNum::Multi && hasErrorsInMultiRequest(request))
-                return true;
+                return;
 
             KeeperStore::KeeperResponsesQueue responses_queue;
-            store.processRequest(responses_queue, {request, session_id, time}, zxid, /* check_acl = */ false, /*ignore_response*/true);
+            store.processRequest(
+                responses_queue, {request, txn.session_id, txn.time}, txn.zxid, /* check_acl = */ false, /*ignore_response*/ true);
         }
     }
-
-    return true;
 }
 
-void deserializeLogAndApplyToStore(KeeperStore & store, const String & log_path, Poco::Logger * log)
+/// Read transactions of a log file and pass them to process_txn in order
+void deserializeLog(const String & log_path, const std::function<void(ZooKeeperTxn &&)> & process_txn, Poco::Logger * log)
 {
     ReadBufferFromFile reader(log_path);
 
@@ -554,8 +667,11 @@ void deserializeLogAndApplyToStore(KeeperStore & store, const String & log_path,
     LOG_INFO(log, "Header looks OK");
     size_t counter = 0;
 
-    while (!reader.eof() && deserializeTxn(store, reader, log))
+    ZooKeeperTxn txn;
+    while (!reader.eof() && deserializeTxn(txn, reader, log))
     {
+        process_txn(std::move(txn));
+
         counter++;
         if (counter % 1000 == 0)
             LOG_INFO(log, "Deserialized txns log: {}", counter);
@@ -569,7 +685,43 @@ void deserializeLogAndApplyToStore(KeeperStore & store, const String & log_path,
     LOG_INFO(log, "Finished {} deserialization, totally read {} records. ", log_path, counter);
 }
 
-void deserializeLogsAndApplyToStore(KeeperStore & store, const String & path, Poco::Logger * log)
+/// Read transactions of a log file being written from offset, return the offset after the last one completely written.
+/// The tail may be a transaction partially written, or zeros ZooKeeper preallocates the file with.
+off_t deserializeLogFrom(
+    const String & log_path, off_t offset, const std::function<void(ZooKeeperTxn &&)> & process_txn, Poco::Logger * log)
+{
+    ReadBufferFromFile reader(log_path);
+    try
+    {
+        if (offset == 0)
+        {
+            deserializeLogMagic(reader);
+            offset = reader.getPosition();
+        }
+        else
+            reader.seek(offset, SEEK_SET);
+
+        ZooKeeperTxn txn;
+        while (!reader.eof() && deserializeTxn(txn, reader, log))
+        {
+            int8_t forty_two;
+            Coordination::read(forty_two, reader);
+            if (forty_two != 0x42)
+                break;
+
+            process_txn(std::move(txn));
+            offset = reader.getPosition();
+        }
+    }
+    catch (const Exception & e)
+    {
+        LOG_TRACE(log, "Log {} is read up to offset {}, the rest is not completely written: {}", log_path, offset, e.message());
+    }
+    return offset;
+}
+
+/// Log files in path by the zxid of their first transaction
+std::map<int64_t, String> listLogs(const String & path)
 {
     namespace fs = std::filesystem;
     std::map<int64_t, String> existing_logs;
@@ -583,6 +735,23 @@ void deserializeLogsAndApplyToStore(KeeperStore & store, const String & path, Po
         int64_t zxid = getZxidFromName(log_path);
         existing_logs[zxid] = p.path();
     }
+    return existing_logs;
+}
+
+/// Transactions are passed from reading to applying in batches, at most TXN_QUEUE_BATCHES of them are in the queue.
+constexpr size_t TXN_BATCH_SIZE = 1000;
+constexpr size_t TXN_QUEUE_BATCHES = 64;
+
+}
+
+void deserializeLogAndApplyToStore(KeeperStore & store, const String & log_path, Poco::Logger * log)
+{
+    deserializeLog(log_path, [&store](ZooKeeperTxn && txn) { applyTxn(store, txn); }, log);
+}
+
+void deserializeLogsAndApplyToStore(KeeperStore & store, const String & path, Poco::Logger * log)
+{
+    auto existing_logs = listLogs(path);
 
     LOG_INFO(log, "Totally have {} logs", existing_logs.size());
 
@@ -601,10 +770,109 @@ void deserializeLogsAndApplyToStore(KeeperStore & store, const String & path, Po
         }
     }
 
-    for (auto it = stored_files.rbegin(); it != stored_files.rend(); ++it)
+    /// Logs are read on a thread in order and transactions are applied here at the same time, reading goes on to the
+    /// next file while the previous one is being applied.
+    using TxnBatch = std::vector<ZooKeeperTxn>;
+    ConcurrentBoundedQueue<TxnBatch> txn_queue(TXN_QUEUE_BATCHES);
+    ThreadPool read_pool(1);
+
+    /// Stop reading if applying fails, or reading is blocked by the full queue forever
+    SCOPE_EXIT({ txn_queue.clearAndFinish(); });
+
+    read_pool.scheduleOrThrowOnError(
+        [&txn_queue, &stored_files, log]
+        {
+            SCOPE_EXIT({ txn_queue.finish(); });
+            TxnBatch batch;
+            batch.reserve(TXN_BATCH_SIZE);
+
+            for (auto it = stored_files.rbegin(); it != stored_files.rend(); ++it)
+            {
+                deserializeLog(
+                    *it,
+                    [&](ZooKeeperTxn && txn)
+                    {
+                        batch.emplace_back(std::move(txn));
+                        if (batch.size() == TXN_BATCH_SIZE)
+                        {
+                            if (!txn_queue.push(std::move(batch)))
+                                throw Exception(ErrorCodes::LOGICAL_ERROR, "Transaction queue is finished when reading logs");
+                            batch = {};
+                            batch.reserve(TXN_BATCH_SIZE);
+                        }
+                    },
+                    log);
+            }
+
+            if (!batch.empty())
+                txn_queue.push(std::move(batch));
+        });
+
+    TxnBatch batch;
+    while (txn_queue.pop(batch))
+    {
+        for (const auto & txn : batch)
+            applyTxn(store, txn);
+    }
+
+    /// Rethrow the exception of reading if any
+    read_pool.wait();
+}
+
+void followLogsAndApplyToStore(
+    KeeperStore & store, const String & path, const std::function<bool()> & should_stop, UInt64 poll_interval_ms, Poco::Logger * log)
+{
+    auto apply = [&store](ZooKeeperTxn && txn) { applyTxn(store, txn); };
+
+    /// The last log starting before the zxid of store, the ones before it have only transactions applied
+    int64_t current_zxid = -1;
+    String current_path;
+    off_t offset = 0;
+
+    while (true)
     {
-        deserializeLogAndApplyToStore(store, *it, log);
+        bool stopping = should_stop();
+
+        if (current_path.empty())
+        {
+            auto logs = listLogs(path);
+            auto it = logs.upper_bound(store.getZxid());
+            if (it != logs.begin())
+                --it;
+            if (it != logs.end())
+            {
+                std::tie(current_zxid, current_path) = *it;
+                LOG_INFO(log, "Follow log {} from zxid {}", current_path, store.getZxid());
+            }
+        }
+
+        if (!current_path.empty())
+        {
+            offset = deserializeLogFrom(current_path, offset, apply, log);
+
+            auto logs = listLogs(path);
+            auto next = logs.upper_bound(current_zxid);
+            if (next != logs.end())
+            {
+                /// ZooKeeper flushes a log before it rolls to the next one, so the rest of it is completely written
+                offset = deserializeLogFrom(current_path, offset, apply, log);
+                LOG_INFO(log, "Finished following log {}, applied up to zxid {}", current_path, store.getZxid());
+
+                std::tie(current_zxid, current_path) = *next;
+                offset = 0;
+                LOG_INFO(log, "Follow log {}", current_path);
+                continue;
+            }
+        }
+
+        if (stopping)
+            break;
+
+        LOG_DEBUG(log, "Applied transactions up to zxid {}, nodes {}", store.getZxid(), store.getNodesCount());
+        std::this_thread::sleep_for(std::chrono::milliseconds(poll_interval_ms));
     }
+
+    LOG_INFO(log, "Stopped following logs at zxid {} of log {}", store.getZxid(), current_path);
 }
 
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <string>
 #include <Service/KeeperStore.h>
 #include <common/logger_useful.h>
@@ -17,4 +18,12 @@ void deserializeLogAndApplyToStore(KeeperStore & store, const String & log_path,
 /// deserialize log
 void deserializeLogsAndApplyToStore(KeeperStore & store, const String & path, Poco::Logger * log);
 
+/** Follow logs in path written by a running ZooKeeper and apply transactions after the zxid of store, polling for more
+  * every poll_interval_ms, so that the store keeps up with ZooKeeper while the data of it is migrated. Once should_stop
+  * returns true, which is the cutover after ZooKeeper is stopped, the transactions written by then are applied and it
+  * returns. The tail of the log being written is read again by the next poll if it is not completely written.
+  */
+void followLogsAndApplyToStore(
+    KeeperStore & store, const String & path, const std::function<bool()> & should_stop, UInt64 poll_interval_ms, Poco::Logger * log);
+
 }
@@ -0,0 +1,56 @@
+#include <Service/ACLDecisionCache.h>
+#include <ZooKeeper/IKeeper.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(ACLDecisionCache, GetAndPut)
+{
+    ACLDecisionCache cache;
+    ASSERT_FALSE(cache.get(1, 10, Coordination::ACL::Read));
+
+    cache.put(1, 10, Coordination::ACL::Read, true);
+    cache.put(1, 10, Coordination::ACL::Write, false);
+    cache.put(2, 10, Coordination::ACL::Read, false);
+
+    ASSERT_EQ(cache.get(1, 10, Coordination::ACL::Read), true);
+    ASSERT_EQ(cache.get(1, 10, Coordination::ACL::Write), false);
+    ASSERT_EQ(cache.get(2, 10, Coordination::ACL::Read), false);
+    ASSERT_FALSE(cache.get(1, 11, Coordination::ACL::Read));
+    ASSERT_FALSE(cache.get(1, 10, Coordination::ACL::Admin | Coordination::ACL::Read));
+    ASSERT_EQ(cache.size(), size_t(3));
+}
+
+TEST(ACLDecisionCache, Invalidate)
+{
+    ACLDecisionCache cache;
+    cache.put(1, 10, Coordination::ACL::Read, false);
+    cache.put(17, 10, Coordination::ACL::Read, false);
+    cache.put(2, 10, Coordination::ACL::Read, true);
+
+    /// Auth added to session 1, the one in the same shard is kept
+    cache.invalidate(1);
+    ASSERT_FALSE(cache.get(1, 10, Coordination::ACL::Read));
+    ASSERT_EQ(cache.get(17, 10, Coordination::ACL::Read), false);
+    ASSERT_EQ(cache.get(2, 10, Coordination::ACL::Read), true);
+
+    cache.reset();
+    ASSERT_EQ(cache.size(), size_t(0));
+}
+
+TEST(ACLDecisionCache, Limits)
+{
+    ACLDecisionCache cache(4);
+    for (uint64_t acl_id = 1; acl_id <= 4; ++acl_id)
+        cache.put(1, acl_id, Coordination::ACL::Read, true);
+    ASSERT_EQ(cache.size(), size_t(4));
+
+    /// Decisions of the session start over
+    cache.put(1, 5, Coordination::ACL::Read, true);
+    ASSERT_EQ(cache.size(), size_t(1));
+    ASSERT_EQ(cache.get(1, 5, Coordination::ACL::Read), true);
+
+    ACLDecisionCache disabled(0);
+    disabled.put(1, 1, Coordination::ACL::Read, true);
+    ASSERT_FALSE(disabled.get(1, 1, Coordination::ACL::Read));
+}
@@ -0,0 +1,49 @@
+#include <Service/ACLMap.h>
+#include <ZooKeeper/IKeeper.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(ACLMap, SharedHandles)
+{
+    ACLMap acl_map;
+    Coordination::ACLs acls{Coordination::ACL{Coordination::ACL::Read, "digest", "user1:password1"}};
+
+    auto acl_id = acl_map.convertACLs(acls);
+    ASSERT_EQ(acl_map.convertACLs(acls), acl_id);
+    acl_map.addUsage(acl_id, 2);
+
+    /// ACLs are kept once and shared by readers
+    auto handle = acl_map.convertNumber(acl_id);
+    ASSERT_EQ(handle.get(), acl_map.convertNumber(acl_id).get());
+    ASSERT_EQ(*handle, acls);
+    ASSERT_EQ(acl_map.convertNumber(0).get(), acl_map.convertNumber(0).get());
+
+    /// A pinned version and a handle keep ACLs removed later
+    auto pinned = acl_map.pinMapping();
+    acl_map.removeUsage(acl_id);
+    acl_map.removeUsage(acl_id);
+    ASSERT_TRUE(acl_map.getMapping().empty());
+    ASSERT_EQ(*handle, acls);
+    ASSERT_EQ(pinned->size(), size_t(1));
+    ASSERT_EQ(*pinned->find(acl_id)->second, acls);
+
+    /// The same ACLs get a new id
+    ASSERT_NE(acl_map.convertACLs(acls), acl_id);
+}
+
+TEST(ACLMap, AddMapping)
+{
+    ACLMap acl_map;
+    ACLMap other;
+    Coordination::ACLs acls{Coordination::ACL{Coordination::ACL::All, "digest", "user1:password1"}};
+
+    acl_map.addMapping(3, acls);
+    ASSERT_EQ(acl_map.convertACLs(acls), uint64_t(3));
+    ASSERT_EQ(acl_map.convertACLs(Coordination::ACLs{Coordination::ACL{Coordination::ACL::Read, "world", "anyone"}}), uint64_t(4));
+
+    other.addMapping(3, acls);
+    ASSERT_NE(acl_map, other);
+    other.convertACLs(Coordination::ACLs{Coordination::ACL{Coordination::ACL::Read, "world", "anyone"}});
+    ASSERT_EQ(acl_map, other);
+}
@@ -0,0 +1,61 @@
+#include <Service/AdaptiveBatchPolicy.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(AdaptiveBatchPolicy, shrinkWhenLatencyIsHigh)
+{
+    AdaptiveBatchPolicy policy(1000, 10);
+    ASSERT_EQ(policy.getBatchSize(), 1000);
+
+    for (int i = 0; i < 10; i++)
+        policy.onBatchCompleted(policy.getBatchSize(), 50000, true);
+
+    ASSERT_LT(policy.getBatchSize(), 100);
+    ASSERT_GE(policy.getBatchSize(), 1);
+    ASSERT_EQ(policy.getLingerMs(), 0);
+
+    /// Grows back when latency is under target and batches are full
+    for (int i = 0; i < 100; i++)
+        policy.onBatchCompleted(policy.getBatchSize(), 1000, true);
+    ASSERT_EQ(policy.getBatchSize(), 1000);
+}
+
+TEST(AdaptiveBatchPolicy, lingerUnderConcurrentLoad)
+{
+    AdaptiveBatchPolicy policy(1000, 10);
+
+    /// Queue is drained with several requests in a batch, linger within half of the headroom
+    for (int i = 0; i < 100; i++)
+        policy.onBatchCompleted(20, 2000, false);
+    ASSERT_EQ(policy.getLingerMs(), 4);
+
+    /// Latency goes above target, stop lingering
+    for (int i = 0; i < 20; i++)
+        policy.onBatchCompleted(20, 30000, false);
+    ASSERT_EQ(policy.getLingerMs(), 0);
+}
+
+TEST(AdaptiveBatchPolicy, noLingerWhenIdle)
+{
+    AdaptiveBatchPolicy policy(1000, 10);
+
+    for (int i = 0; i < 100; i++)
+        policy.onBatchCompleted(1, 1000, false);
+    ASSERT_EQ(policy.getLingerMs(), 0);
+    ASSERT_EQ(policy.getBatchSize(), 1000);
+}
+
+TEST(AdaptiveBatchPolicy, changeMaxBatchSize)
+{
+    AdaptiveBatchPolicy policy(1000, 10);
+
+    policy.setMaxBatchSize(100);
+    ASSERT_EQ(policy.getBatchSize(), 100);
+
+    /// Grows up to the new max only
+    policy.setMaxBatchSize(2000);
+    for (int i = 0; i < 100; i++)
+        policy.onBatchCompleted(policy.getBatchSize(), 1000, true);
+    ASSERT_EQ(policy.getBatchSize(), 2000);
+}
@@ -0,0 +1,34 @@
+#include <Service/AdmissionController.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(AdmissionController, saturateWithHysteresis)
+{
+    AdmissionController controller(1000, 100);
+    ASSERT_TRUE(controller.enabled());
+
+    ASSERT_FALSE(controller.update(999, 0));
+    ASSERT_TRUE(controller.update(1000, 0));
+
+    /// Stay saturated until both drop under half of the limit
+    ASSERT_TRUE(controller.update(600, 0));
+    ASSERT_TRUE(controller.update(500, 60));
+    ASSERT_FALSE(controller.update(500, 50));
+    ASSERT_FALSE(controller.isSaturated());
+
+    ASSERT_TRUE(controller.update(0, 100));
+    ASSERT_TRUE(controller.isSaturated());
+}
+
+TEST(AdmissionController, zeroLimitDisablesCheck)
+{
+    AdmissionController controller(0, 100);
+    ASSERT_FALSE(controller.update(1000000, 0));
+    ASSERT_TRUE(controller.update(1000000, 100));
+    ASSERT_FALSE(controller.update(1000000, 50));
+
+    AdmissionController disabled(0, 0);
+    ASSERT_FALSE(disabled.enabled());
+    ASSERT_FALSE(disabled.update(1000000, 1000000));
+}
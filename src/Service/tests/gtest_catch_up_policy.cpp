@@ -0,0 +1,60 @@
+#include <Service/CatchUpPolicy.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(CatchUpPolicy, costs)
+{
+    /// 1MB per second, 1000 entries per second
+    CatchUpPolicy policy(1000000, 1000, 1000000000);
+
+    ASSERT_EQ(policy.logCostMs(1001, 2000, 1000), 2000);
+    ASSERT_EQ(policy.logCostMs(2001, 2000, 1000), 0);
+    /// Snapshot of 10MB at 1500, then 500 entries
+    ASSERT_EQ(policy.snapshotCostMs(10000000, 1500, 2000, 1000), 11000);
+}
+
+TEST(CatchUpPolicy, extendRetention)
+{
+    CatchUpPolicy policy(1000000, 1000, 10000000);
+    CatchUpPolicy::LogState state{
+        .compact_index = 1000,
+        .first_log_index = 1,
+        .last_log_index = 2000,
+        .bytes_per_entry = 1000,
+        .snapshot_index = 1500,
+        .snapshot_bytes = 10000000};
+
+    /// Followers slightly behind keep their logs, the one behind most decides
+    ASSERT_EQ(policy.getCompactIndex(state, {2001, 990, 995}), 989);
+    /// Not behind the compaction
+    ASSERT_EQ(policy.getCompactIndex(state, {1001, 2001}), 1000);
+    /// Logs are gone already
+    state.first_log_index = 500;
+    ASSERT_EQ(policy.getCompactIndex(state, {400}), 1000);
+
+    /// Snapshot is cheaper than the logs
+    state.first_log_index = 1;
+    state.snapshot_bytes = 100000;
+    ASSERT_EQ(policy.getCompactIndex(state, {990}), 1000);
+}
+
+TEST(CatchUpPolicy, maxExtraLogBytes)
+{
+    CatchUpPolicy policy(1000000, 1000, 100000);
+    CatchUpPolicy::LogState state{
+        .compact_index = 1000,
+        .first_log_index = 1,
+        .last_log_index = 2000,
+        .bytes_per_entry = 1000,
+        .snapshot_index = 1500,
+        .snapshot_bytes = 1000000000};
+
+    ASSERT_EQ(policy.getCompactIndex(state, {901}), 900);
+    /// Extension is above the bound
+    ASSERT_EQ(policy.getCompactIndex(state, {800}), 1000);
+
+    CatchUpPolicy disabled(1000000, 1000, 0);
+    ASSERT_FALSE(disabled.enabled());
+    ASSERT_EQ(disabled.getCompactIndex(state, {901}), 1000);
+}
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+
+#include <set>
+#include <Service/ChildrenSet.h>
+
+using namespace RK;
+
+TEST(ChildrenSet, SortedWhenSmall)
+{
+    ChildrenSet children;
+    ASSERT_TRUE(children.empty());
+    ASSERT_TRUE(children.insert("c"));
+    ASSERT_TRUE(children.insert("a"));
+    ASSERT_TRUE(children.insert("b"));
+    ASSERT_FALSE(children.insert("a"));
+
+    ASSERT_EQ(Strings(children.begin(), children.end()), (Strings{"a", "b", "c"}));
+    ASSERT_EQ(children.erase("b"), 1);
+    ASSERT_EQ(children.erase("b"), 0);
+    ASSERT_EQ(children, (ChildrenSet{"c", "a"}));
+}
+
+TEST(ChildrenSet, SwitchRepresentation)
+{
+    ChildrenSet children;
+    std::set<String> expected;
+
+    for (size_t i = 0; i < ChildrenSet::HASH_INDEX_THRESHOLD * 4; ++i)
+    {
+        auto name = "replica_" + std::to_string(i);
+        ASSERT_TRUE(children.insert(name));
+        expected.insert(name);
+    }
+    ASSERT_EQ(children.size(), expected.size());
+    ASSERT_EQ(std::set<String>(children.begin(), children.end()), expected);
+
+    auto copied = children;
+    ASSERT_EQ(copied, children);
+
+    for (size_t i = 0; i < ChildrenSet::HASH_INDEX_THRESHOLD * 4 - 1; ++i)
+        ASSERT_EQ(children.erase("replica_" + std::to_string(i)), 1);
+
+    ASSERT_EQ(children.size(), 1);
+    ASSERT_TRUE(children.contains("replica_" + std::to_string(ChildrenSet::HASH_INDEX_THRESHOLD * 4 - 1)));
+    ASSERT_NE(copied, children);
+}
+
+TEST(ChildrenSet, LookUpByStringView)
+{
+    for (size_t count : {size_t(3), ChildrenSet::HASH_INDEX_THRESHOLD * 2})
+    {
+        ChildrenSet children;
+        for (size_t i = 0; i < count; ++i)
+            children.insert("node_" + std::to_string(i));
+
+        String path = "/parent/node_1";
+        std::string_view name = std::string_view(path).substr(path.rfind('/') + 1);
+        ASSERT_TRUE(children.contains(name));
+        ASSERT_FALSE(children.contains(std::string_view(path)));
+        ASSERT_EQ(children.erase(name), 1);
+        ASSERT_EQ(children.erase(name), 0);
+        ASSERT_FALSE(children.contains("node_1"));
+        ASSERT_EQ(children.size(), count - 1);
+    }
+}
+
+TEST(ChildrenSet, Page)
+{
+    for (size_t count : {size_t(0), size_t(20), ChildrenSet::HASH_INDEX_THRESHOLD * 4})
+    {
+        ChildrenSet children;
+        std::set<String> expected;
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto name = "queue-" + std::to_string(i * 7919 % 100000);
+            children.insert(name);
+            expected.insert(name);
+        }
+
+        /// Walk by pages, every page starts after the last name of the previous one
+        Strings walked;
+        std::vector<std::string_view> names;
+        String start_after;
+        bool more = true;
+        while (more)
+        {
+            more = children.page(start_after, 7, names);
+            ASSERT_LE(names.size(), size_t(7));
+            ASSERT_TRUE(std::is_sorted(names.begin(), names.end()));
+            ASSERT_TRUE(!more || names.size() == 7);
+            walked.insert(walked.end(), names.begin(), names.end());
+            if (!names.empty())
+                start_after = String(names.back());
+        }
+        ASSERT_EQ(walked, Strings(expected.begin(), expected.end()));
+
+        /// A cursor which is not a child
+        if (count)
+        {
+            ASSERT_FALSE(children.page("queue-99999", 7, names));
+            ASSERT_TRUE(children.page("", 0, names));
+            ASSERT_TRUE(names.empty());
+        }
+    }
+}
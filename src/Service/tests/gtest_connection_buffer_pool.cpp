@@ -0,0 +1,44 @@
+#include <Service/ConnectionBufferPool.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(ConnectionBufferPool, TakeAndGive)
+{
+    ConnectionBufferPool pool(2, 1024);
+    ASSERT_TRUE(pool.take().empty());
+
+    String buffer(1000, 'x');
+    const char * data = buffer.data();
+    size_t capacity = buffer.capacity();
+    pool.give(std::move(buffer));
+    ASSERT_EQ(pool.size(), 1);
+    ASSERT_EQ(pool.bytes(), capacity);
+
+    /// The same memory with its size kept
+    String taken = pool.take();
+    ASSERT_EQ(taken.data(), data);
+    ASSERT_EQ(taken.size(), 1000);
+    ASSERT_EQ(pool.size(), 0);
+    ASSERT_EQ(pool.bytes(), 0);
+}
+
+TEST(ConnectionBufferPool, Limits)
+{
+    ConnectionBufferPool pool(2, 1024);
+
+    /// Too large, and empty ones are not kept
+    pool.give(String(2000, 'x'));
+    pool.give(String());
+    ASSERT_EQ(pool.size(), 0);
+
+    pool.give(String(100, 'x'));
+    pool.give(String(100, 'x'));
+    pool.give(String(100, 'x'));
+    ASSERT_EQ(pool.size(), 2);
+
+    pool.take();
+    pool.take();
+    ASSERT_TRUE(pool.take().empty());
+    ASSERT_EQ(pool.bytes(), 0);
+}
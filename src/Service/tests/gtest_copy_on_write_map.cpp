@@ -0,0 +1,87 @@
+#include <Service/CopyOnWriteMap.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(CopyOnWriteMap, basic)
+{
+    CopyOnWriteMap<int64_t, int64_t> map(4);
+    ASSERT_TRUE(map.empty());
+
+    ASSERT_TRUE(map.emplace(1, 10));
+    ASSERT_FALSE(map.emplace(1, 11));
+    map[2] = 20;
+    map[2] = 21;
+    ASSERT_EQ(map.size(), size_t(2));
+    ASSERT_EQ(map.find(1)->second, 10);
+    ASSERT_EQ(map.find(2)->second, 21);
+    ASSERT_TRUE(map.find(3) == map.end());
+
+    ASSERT_EQ(map.erase(3), size_t(0));
+    ASSERT_EQ(map.erase(1), size_t(1));
+    ASSERT_FALSE(map.contains(1));
+    ASSERT_EQ(map.size(), size_t(1));
+
+    map.clear();
+    ASSERT_TRUE(map.empty());
+    ASSERT_TRUE(map.begin() == map.end());
+}
+
+TEST(CopyOnWriteMap, iteration)
+{
+    CopyOnWriteMap<int64_t, int64_t> map(16);
+    for (int64_t i = 0; i < 100; ++i)
+        map.emplace(i, i * 2);
+
+    size_t count = 0;
+    int64_t sum = 0;
+    for (const auto & [key, value] : map)
+    {
+        ASSERT_EQ(value, key * 2);
+        sum += key;
+        ++count;
+    }
+    ASSERT_EQ(count, size_t(100));
+    ASSERT_EQ(sum, 99 * 100 / 2);
+    ASSERT_EQ(map.toMap().size(), size_t(100));
+}
+
+TEST(CopyOnWriteMap, pin)
+{
+    CopyOnWriteMap<int64_t, int64_t> map(8);
+    for (int64_t i = 0; i < 100; ++i)
+        map.emplace(i, i);
+
+    auto version = map.pin();
+    /// Nothing copied yet
+    ASSERT_EQ(version->getApproximateMemoryUsage(true), size_t(0));
+
+    map[1] = 100;
+    map.erase(2);
+    map.emplace(200, 200);
+    ASSERT_EQ(map.find(1)->second, 100);
+    ASSERT_FALSE(map.contains(2));
+
+    /// The version is not changed by the writes
+    ASSERT_EQ(version->size(), size_t(100));
+    ASSERT_EQ(version->find(1)->second, 1);
+    ASSERT_TRUE(version->contains(2));
+    ASSERT_FALSE(version->contains(200));
+    size_t count = 0;
+    for (const auto & [key, value] : *version)
+    {
+        ASSERT_EQ(key, value);
+        ++count;
+    }
+    ASSERT_EQ(count, size_t(100));
+
+    /// Only the buckets written are copied
+    size_t copied_bytes = version->getApproximateMemoryUsage(true);
+    ASSERT_GT(copied_bytes, size_t(0));
+    ASSERT_LT(copied_bytes, version->getApproximateMemoryUsage());
+
+    /// Clear keeps the version
+    map.clear();
+    ASSERT_EQ(version->size(), size_t(100));
+    ASSERT_GT(version->getApproximateMemoryUsage(true), copied_bytes);
+}
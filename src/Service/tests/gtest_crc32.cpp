@@ -0,0 +1,62 @@
+#include <random>
+#include <vector>
+#include <Service/Crc32.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+/// Checksums of logs and snapshots on disk are computed byte by byte like this
+UInt32 referenceCRC32(const char * data, size_t length)
+{
+    if (length < 1)
+        return 0xffffffff;
+
+    UInt32 crc = 0;
+    for (size_t i = 0; i != length; ++i)
+    {
+        crc ^= static_cast<UInt8>(data[i]);
+        for (int j = 0; j < 8; ++j)
+            crc = (crc >> 1) ^ ((crc & 1) ? 0xedb88320 : 0);
+    }
+    return crc ^ 0xffffffff;
+}
+
+}
+
+TEST(CRC32, knownValues)
+{
+    ASSERT_EQ(getCRC32("", 0), 0xffffffff);
+    ASSERT_EQ(getCRC32("123456789", 9), 0xd202d277);
+    ASSERT_TRUE(verifyCRC32("123456789", 9, 0xd202d277));
+    ASSERT_FALSE(verifyCRC32("123456780", 9, 0xd202d277));
+}
+
+TEST(CRC32, sameAsReference)
+{
+    std::mt19937 rng(42);
+    std::vector<char> data(70000);
+    for (auto & c : data)
+        c = static_cast<char>(rng());
+
+    /// Unaligned starts and lengths around the sizes of folded blocks
+    for (size_t offset = 0; offset < 16; ++offset)
+        for (size_t length = 0; length < 600; ++length)
+            ASSERT_EQ(getCRC32(data.data() + offset, length), referenceCRC32(data.data() + offset, length))
+                << "offset " << offset << ", length " << length;
+
+    ASSERT_EQ(getCRC32(data.data(), data.size()), referenceCRC32(data.data(), data.size()));
+    ASSERT_EQ(getCRC32(data.data() + 3, data.size() - 3), referenceCRC32(data.data() + 3, data.size() - 3));
+}
+
+TEST(CRC32, extend)
+{
+    String data(1000, 'x');
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = static_cast<char>(i * 7);
+
+    for (size_t split : {1, 10, 64, 500, 999, 1000})
+        ASSERT_EQ(extendCRC32(getCRC32(data.data(), split), data.data() + split, data.size() - split), 0xe8be3d80) << split;
+}
@@ -0,0 +1,84 @@
+#include <Service/EpochManager.h>
+#include <Service/KeeperStore.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(EpochManager, advance)
+{
+    EpochManager manager(2);
+    UInt64 epoch = manager.currentEpoch();
+
+    /// No reader, everything retired before is safe
+    ASSERT_EQ(manager.advance(), epoch + 1);
+
+    {
+        EpochGuard reader(&manager, 0);
+        UInt64 entered = manager.currentEpoch();
+        /// Held back by the reader
+        ASSERT_EQ(manager.advance(), entered);
+        ASSERT_EQ(manager.advance(), entered);
+
+        /// A later reader does not move it back
+        EpochGuard later_reader(&manager, 1);
+        ASSERT_EQ(manager.advance(), entered);
+    }
+    UInt64 safe_epoch = manager.advance();
+    ASSERT_EQ(safe_epoch, manager.currentEpoch());
+
+    /// Nothing without a manager
+    EpochGuard no_reader(nullptr, 100);
+}
+
+TEST(EpochManager, retireList)
+{
+    RetireList<std::shared_ptr<int>> list;
+    auto value = std::make_shared<int>(1);
+    std::weak_ptr<int> weak = value;
+    list.retire(std::move(value), 5);
+    list.retire(std::make_shared<int>(2), 6);
+
+    ASSERT_EQ(list.reclaim(5), size_t(0));
+    ASSERT_FALSE(weak.expired());
+    ASSERT_EQ(list.reclaim(6), size_t(1));
+    ASSERT_TRUE(weak.expired());
+    ASSERT_EQ(list.size(), size_t(1));
+    list.clear();
+    ASSERT_EQ(list.size(), size_t(0));
+}
+
+TEST(EpochManager, dataTree)
+{
+    EpochManager manager(1);
+    KeeperStore::DataTree tree(4);
+    tree.setEpochManager(&manager);
+
+    auto node = KeeperNode::create();
+    node->data = "a";
+    tree.emplace("/a", node);
+    tree.emplace("/b", KeeperNode::create());
+    node.reset();
+
+    const KeeperNode * read_node = nullptr;
+    {
+        EpochGuard reader(&manager, 0);
+        read_node = tree.getForRead("/a");
+        ASSERT_NE(read_node, nullptr);
+
+        /// Erased and replaced nodes are retired, the reader may still read them
+        tree.erase("/a");
+        tree.emplace("/b", KeeperNode::create());
+        ASSERT_EQ(tree.getForRead("/a"), nullptr);
+        ASSERT_EQ(tree.getRetiredCount(), size_t(2));
+        ASSERT_EQ(tree.reclaim(), size_t(0));
+        ASSERT_EQ(read_node->data, "a");
+    }
+
+    ASSERT_EQ(tree.reclaim(), size_t(2));
+    ASSERT_EQ(tree.getRetiredCount(), size_t(0));
+
+    /// Freed at once without a manager
+    tree.setEpochManager(nullptr);
+    tree.erase("/b");
+    ASSERT_EQ(tree.getRetiredCount(), size_t(0));
+}
@@ -0,0 +1,289 @@
+#include <Common/IO/ReadBufferFromString.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <Service/ForwardRequest.h>
+#include <ZooKeeper/ZooKeeperIO.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+ForwardUserBatchRequest makeBatch(size_t size, const String & data)
+{
+    ForwardUserBatchRequest batch;
+    for (size_t i = 1; i <= size; ++i)
+    {
+        auto zk_request = std::make_shared<Coordination::ZooKeeperCreateRequest>();
+        zk_request->xid = static_cast<Coordination::XID>(i * 10);
+        zk_request->path = "/node" + std::to_string(i);
+        zk_request->data = data;
+        auto request = std::make_shared<ForwardUserRequest>();
+        request->request = RequestForSession(zk_request, static_cast<int64_t>(i), 0);
+        batch.requests.push_back(request);
+    }
+    return batch;
+}
+
+/// Write the batch and read it back like the leader, returns the packet size.
+size_t writeAndRead(const ForwardUserBatchRequest & batch, bool compression, ForwardRequestPtr & read_request, bool trace_context = false)
+{
+    WriteBufferFromOwnString out;
+    batch.write(out);
+
+    ReadBufferFromString in(out.str());
+    int8_t type;
+    Coordination::read(type, in);
+    EXPECT_EQ(static_cast<ForwardType>(type), ForwardType::UserBatch);
+    int32_t body_len;
+    Coordination::read(body_len, in);
+    EXPECT_EQ(static_cast<size_t>(body_len), out.str().size() - sizeof(type) - sizeof(body_len));
+
+    read_request = ForwardRequestFactory::instance().get(ForwardType::UserBatch);
+    static_cast<ForwardUserBatchRequest &>(*read_request).compression = compression;
+    static_cast<ForwardUserBatchRequest &>(*read_request).trace_context = trace_context;
+    read_request->readImpl(in);
+    EXPECT_TRUE(in.eof());
+    return out.str().size();
+}
+
+void checkBatch(const ForwardRequestPtr & request, size_t size, const String & data)
+{
+    const auto & read_batch = static_cast<const ForwardUserBatchRequest &>(*request);
+    ASSERT_EQ(read_batch.requests.size(), size);
+    for (size_t i = 0; i < size; ++i)
+    {
+        const auto & read_request = read_batch.requests[i]->request;
+        ASSERT_EQ(read_request.session_id, static_cast<int64_t>(i + 1));
+        ASSERT_EQ(read_request.request->xid, static_cast<Coordination::XID>((i + 1) * 10));
+        ASSERT_EQ(read_request.request->getOpNum(), Coordination::OpNum::Create);
+        const auto & create = dynamic_cast<const Coordination::ZooKeeperCreateRequest &>(*read_request.request);
+        ASSERT_EQ(create.path, "/node" + std::to_string(i + 1));
+        ASSERT_EQ(create.data, data);
+        ForwardKey key{ForwardType::User, static_cast<int64_t>(i + 1), static_cast<int64_t>((i + 1) * 10)};
+        ASSERT_EQ(read_batch.requests[i]->key(), key);
+    }
+}
+
+}
+
+TEST(ForwardRequest, UserBatchRoundTrip)
+{
+    auto batch = makeBatch(3, "data");
+    ForwardRequestPtr request;
+    writeAndRead(batch, false, request);
+    checkBatch(request, 3, "data");
+}
+
+TEST(ForwardRequest, CompressedUserBatchRoundTrip)
+{
+    String data(1000, 'a');
+    auto batch = makeBatch(10, data);
+    ForwardRequestPtr request;
+    size_t raw_size = writeAndRead(batch, false, request);
+
+    batch.compression = true;
+    size_t compressed_size = writeAndRead(batch, true, request);
+    checkBatch(request, 10, data);
+    ASSERT_LT(compressed_size * 10, raw_size);
+
+    /// Small batch is sent uncompressed with a codec byte only
+    auto small_batch = makeBatch(1, "data");
+    size_t small_raw_size = writeAndRead(small_batch, false, request);
+    small_batch.compression = true;
+    ASSERT_EQ(writeAndRead(small_batch, true, request), small_raw_size + 1);
+    checkBatch(request, 1, "data");
+}
+
+TEST(ForwardRequest, UserBatchWithTraceContext)
+{
+    auto batch = makeBatch(2, "data");
+    auto & trace = batch.requests[1]->request.request->timeline.trace;
+    trace.trace_id_high = 1;
+    trace.trace_id_low = 2;
+    trace.span_id = 3;
+    ASSERT_TRUE(batch.hasSampledRequest());
+
+    batch.trace_context = true;
+    batch.compression = true;
+    ForwardRequestPtr request;
+    writeAndRead(batch, true, request, true);
+    checkBatch(request, 2, "data");
+
+    const auto & read_batch = static_cast<const ForwardUserBatchRequest &>(*request);
+    ASSERT_FALSE(read_batch.requests[0]->request.request->timeline.trace.sampled());
+    ASSERT_FALSE(read_batch.requests[0]->request.request->timeline.started());
+
+    /// Leader continues the trace under the forward span of follower
+    const auto & read_timeline = read_batch.requests[1]->request.request->timeline;
+    ASSERT_TRUE(read_timeline.started());
+    ASSERT_EQ(read_timeline.trace.trace_id_high, 1);
+    ASSERT_EQ(read_timeline.trace.trace_id_low, 2);
+    ASSERT_EQ(read_timeline.trace.parent_span_id, trace.stageSpanId(RequestStage::FORWARD));
+    ASSERT_NE(read_timeline.trace.span_id, 3);
+}
+
+TEST(ForwardRequest, HandshakeWithFeatures)
+{
+    ForwardHandshakeRequest handshake;
+    handshake.server_id = 1;
+    handshake.client_id = 2;
+
+    WriteBufferFromOwnString plain;
+    handshake.write(plain);
+    ASSERT_EQ(plain.str().size(), sizeof(int8_t) + 2 * sizeof(int32_t));
+    ASSERT_EQ(static_cast<ForwardType>(plain.str()[0]), ForwardType::Handshake);
+
+    handshake.features = FORWARD_FEATURE_COMPRESSION;
+    WriteBufferFromOwnString with_features;
+    handshake.write(with_features);
+
+    ReadBufferFromString in(with_features.str());
+    int8_t type;
+    Coordination::read(type, in);
+    ASSERT_EQ(static_cast<ForwardType>(type), ForwardType::HandshakeV2);
+    int32_t body_len;
+    Coordination::read(body_len, in);
+    ASSERT_EQ(body_len, 9);
+    int32_t server_id;
+    int32_t client_id;
+    uint8_t features;
+    Coordination::read(server_id, in);
+    Coordination::read(client_id, in);
+    Coordination::read(features, in);
+    ASSERT_EQ(server_id, 1);
+    ASSERT_EQ(client_id, 2);
+    ASSERT_EQ(features, static_cast<uint8_t>(FORWARD_FEATURE_COMPRESSION));
+
+    ForwardHandshakeResponse response;
+    response.with_features = true;
+    response.features = FORWARD_FEATURE_COMPRESSION;
+    WriteBufferFromOwnString response_out;
+    response.write(response_out);
+
+    ReadBufferFromString response_in(response_out.str());
+    Coordination::read(type, response_in);
+    ASSERT_EQ(static_cast<ForwardType>(type), ForwardType::HandshakeV2);
+    ForwardHandshakeResponse read_response;
+    read_response.with_features = true;
+    read_response.readImpl(response_in);
+    ASSERT_TRUE(read_response.accepted);
+    ASSERT_EQ(read_response.features, static_cast<uint8_t>(FORWARD_FEATURE_COMPRESSION));
+}
+
+TEST(ForwardRequest, FetchLogsRoundTrip)
+{
+    ForwardFetchLogsRequest request;
+    request.start_index = 100;
+    request.max_bytes = 4096;
+
+    WriteBufferFromOwnString out;
+    request.write(out);
+    ReadBufferFromString in(out.str());
+    int8_t type;
+    Coordination::read(type, in);
+    ASSERT_EQ(static_cast<ForwardType>(type), ForwardType::FetchLogs);
+    int32_t body_len;
+    Coordination::read(body_len, in);
+    auto read_request = ForwardRequestFactory::instance().get(ForwardType::FetchLogs);
+    read_request->readImpl(in);
+    ASSERT_TRUE(in.eof());
+    ASSERT_EQ(static_cast<ForwardFetchLogsRequest &>(*read_request).start_index, 100);
+    ASSERT_EQ(static_cast<ForwardFetchLogsRequest &>(*read_request).max_bytes, 4096);
+
+    auto response = std::static_pointer_cast<ForwardFetchLogsResponse>(read_request->makeResponse());
+    response->leader_id = 2;
+    response->commit_index = 101;
+    response->first_index = 1;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        auto data = nuraft::buffer::alloc(sizeof(UInt64));
+        data->put(static_cast<ulong>(i));
+        data->pos(0);
+        response->entries.push_back(nuraft::cs_new<nuraft::log_entry>(3, data));
+    }
+    response->entries.push_back(nuraft::cs_new<nuraft::log_entry>(3, nuraft::buffer::alloc(8), nuraft::log_val_type::conf));
+
+    WriteBufferFromOwnString response_out;
+    response->write(response_out);
+    ReadBufferFromString response_in(response_out.str());
+    Coordination::read(type, response_in);
+    ASSERT_EQ(static_cast<ForwardType>(type), ForwardType::FetchLogs);
+    ForwardFetchLogsResponse read_response;
+    read_response.readImpl(response_in);
+    ASSERT_TRUE(response_in.eof());
+    ASSERT_TRUE(read_response.accepted);
+    ASSERT_EQ(read_response.leader_id, 2);
+    ASSERT_EQ(read_response.commit_index, 101);
+    ASSERT_EQ(read_response.first_index, 1);
+    ASSERT_EQ(read_response.entries.size(), 3);
+    for (size_t i = 0; i < 2; ++i)
+    {
+        ASSERT_EQ(read_response.entries[i]->get_term(), 3);
+        ASSERT_EQ(read_response.entries[i]->get_val_type(), nuraft::log_val_type::app_log);
+        read_response.entries[i]->get_buf().pos(0);
+        ASSERT_EQ(read_response.entries[i]->get_buf().get_ulong(), i);
+    }
+    ASSERT_EQ(read_response.entries[2]->get_val_type(), nuraft::log_val_type::conf);
+}
+
+TEST(ForwardRequest, FetchSnapshotRoundTrip)
+{
+    ForwardFetchSnapshotRequest first;
+    WriteBufferFromOwnString out;
+    first.write(out);
+    ReadBufferFromString in(out.str());
+    int8_t type;
+    Coordination::read(type, in);
+    ASSERT_EQ(static_cast<ForwardType>(type), ForwardType::FetchSnapshot);
+    int32_t body_len;
+    Coordination::read(body_len, in);
+    ForwardFetchSnapshotRequest read_first;
+    read_first.readImpl(in);
+    /// The first one asks for the latest snapshot
+    ASSERT_FALSE(read_first.snapshot);
+    ASSERT_EQ(read_first.obj_id, 0);
+
+    ForwardFetchSnapshotRequest next;
+    next.snapshot = nuraft::cs_new<nuraft::snapshot>(1000, 5, nuraft::cs_new<nuraft::cluster_config>());
+    next.obj_id = 3;
+    WriteBufferFromOwnString next_out;
+    next.write(next_out);
+    ReadBufferFromString next_in(next_out.str());
+    Coordination::read(type, next_in);
+    Coordination::read(body_len, next_in);
+    ForwardFetchSnapshotRequest read_next;
+    read_next.readImpl(next_in);
+    ASSERT_TRUE(next_in.eof());
+    ASSERT_EQ(read_next.snapshot->get_last_log_idx(), 1000);
+    ASSERT_EQ(read_next.snapshot->get_last_log_term(), 5);
+    ASSERT_EQ(read_next.obj_id, 3);
+
+    auto response = std::static_pointer_cast<ForwardFetchSnapshotResponse>(read_next.makeResponse());
+    response->data = nuraft::buffer::alloc(3);
+    response->data->put_raw(reinterpret_cast<const nuraft::byte *>("abc"), 3);
+    response->is_last = true;
+    WriteBufferFromOwnString response_out;
+    response->write(response_out);
+    ReadBufferFromString response_in(response_out.str());
+    Coordination::read(type, response_in);
+    ForwardFetchSnapshotResponse read_response;
+    read_response.readImpl(response_in);
+    ASSERT_TRUE(response_in.eof());
+    ASSERT_EQ(read_response.snapshot->get_last_log_idx(), 1000);
+    ASSERT_EQ(String(reinterpret_cast<const char *>(read_response.data->data_begin()), read_response.data->size()), "abc");
+    ASSERT_TRUE(read_response.is_last);
+
+    /// Not accepted without data when the snapshot is removed
+    ForwardFetchSnapshotResponse refused;
+    refused.setAppendEntryResult(false, nuraft::cmd_result_code::FAILED);
+    WriteBufferFromOwnString refused_out;
+    refused.write(refused_out);
+    ReadBufferFromString refused_in(refused_out.str());
+    Coordination::read(type, refused_in);
+    ForwardFetchSnapshotResponse read_refused;
+    read_refused.readImpl(refused_in);
+    ASSERT_FALSE(read_refused.accepted);
+    ASSERT_FALSE(read_refused.snapshot);
+    ASSERT_FALSE(read_refused.data);
+}
@@ -0,0 +1,59 @@
+#include <Service/HotSpotTracker.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+RequestForSession makeRequest(int64_t session_id, const String & path, bool read)
+{
+    Coordination::ZooKeeperRequestPtr request;
+    if (read)
+    {
+        auto get_request = std::make_shared<Coordination::ZooKeeperGetRequest>();
+        get_request->path = path;
+        request = get_request;
+    }
+    else
+    {
+        auto set_request = std::make_shared<Coordination::ZooKeeperSetRequest>();
+        set_request->path = path;
+        request = set_request;
+    }
+    return RequestForSession(request, session_id, 0);
+}
+
+}
+
+TEST(HotSpotTracker, Report)
+{
+    auto & tracker = HotSpotTracker::instance();
+    tracker.initialize(true, 8, 1, 3600000);
+
+    for (int i = 0; i < 100; ++i)
+        tracker.record(makeRequest(1, "/hot", true));
+    for (int i = 0; i < 10; ++i)
+        tracker.record(makeRequest(2, "/cold", true));
+    for (int i = 0; i < 50; ++i)
+        tracker.record(makeRequest(2, "/written", false));
+
+    auto report = tracker.getReport(1);
+    ASSERT_GT(report.window_seconds, 0);
+    ASSERT_EQ(report.reads.size(), 1);
+    ASSERT_EQ(report.reads[0].key, "/hot");
+    ASSERT_EQ(report.writes.size(), 1);
+    ASSERT_EQ(report.writes[0].key, "/written");
+    ASSERT_EQ(report.sessions.size(), 1);
+    ASSERT_EQ(report.sessions[0].key, "0x1");
+    /// Rates are of the current window until it is over, which is shorter than a second here
+    ASSERT_GE(report.reads[0].rate, 100);
+    ASSERT_EQ(report.reads[0].error_rate, 0);
+
+    tracker.reset();
+    ASSERT_TRUE(tracker.getReport(10).reads.empty());
+
+    tracker.initialize(false, 8, 1, 3600000);
+    tracker.record(makeRequest(1, "/hot", true));
+    ASSERT_TRUE(tracker.getReport(10).reads.empty());
+}
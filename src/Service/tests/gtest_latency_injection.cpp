@@ -0,0 +1,102 @@
+#include <algorithm>
+
+#include <Poco/AutoPtr.h>
+#include <Poco/Util/MapConfiguration.h>
+#include <Service/LatencyInjection.h>
+#include <Common/Exception.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+std::vector<UInt64> drawLatencies(InjectionPoint point, size_t count)
+{
+    std::vector<UInt64> latencies;
+    for (size_t i = 0; i < count; ++i)
+        latencies.push_back(LatencyInjection::instance().drawLatencyUs(point));
+    return latencies;
+}
+
+}
+
+TEST(LatencyInjection, Distributions)
+{
+    auto & injection = LatencyInjection::instance();
+    constexpr auto point = InjectionPoint::LOG_FSYNC;
+
+    LatencyInjection::PointSettings settings;
+    settings.latency_us = 100;
+    injection.configure(point, settings);
+    ASSERT_TRUE(injection.enabled(point));
+    for (auto latency : drawLatencies(point, 100))
+        ASSERT_EQ(latency, 100);
+
+    settings.distribution = LatencyInjection::Distribution::UNIFORM;
+    settings.max_latency_us = 200;
+    injection.configure(point, settings);
+    for (auto latency : drawLatencies(point, 1000))
+        ASSERT_TRUE(latency >= 100 && latency <= 200) << latency;
+
+    /// Pareto is never below its scale and is capped
+    settings.distribution = LatencyInjection::Distribution::PARETO;
+    settings.max_latency_us = 10000;
+    injection.configure(point, settings);
+    UInt64 max_latency = 0;
+    for (auto latency : drawLatencies(point, 10000))
+    {
+        ASSERT_TRUE(latency >= 100 && latency <= 10000) << latency;
+        max_latency = std::max(max_latency, latency);
+    }
+    ASSERT_GT(max_latency, 1000);
+
+    /// Same seed, same latencies
+    settings.distribution = LatencyInjection::Distribution::EXPONENTIAL;
+    settings.max_latency_us = 0;
+    settings.probability = 0.5;
+    injection.configure(point, settings, 42);
+    auto first = drawLatencies(point, 1000);
+    injection.configure(point, settings, 42);
+    ASSERT_EQ(drawLatencies(point, 1000), first);
+    size_t delayed = std::count_if(first.begin(), first.end(), [](UInt64 latency) { return latency > 0; });
+    ASSERT_TRUE(delayed > 400 && delayed < 600) << delayed;
+
+    injection.disable(point);
+    ASSERT_FALSE(injection.enabled(point));
+}
+
+TEST(LatencyInjection, Errors)
+{
+    auto & injection = LatencyInjection::instance();
+    constexpr auto point = InjectionPoint::FORWARD_SEND;
+    ASSERT_FALSE(injection.shouldFail(point));
+
+    LatencyInjection::PointSettings settings;
+    settings.error_probability = 1;
+    injection.configure(point, settings);
+    ASSERT_TRUE(injection.shouldFail(point));
+
+    injection.disable(point);
+    ASSERT_FALSE(injection.shouldFail(point));
+}
+
+TEST(LatencyInjection, Config)
+{
+    auto & injection = LatencyInjection::instance();
+
+    Poco::AutoPtr<Poco::Util::MapConfiguration> config(new Poco::Util::MapConfiguration);
+    config->setString("keeper.latency_injection.log_write.distribution", "uniform");
+    config->setUInt64("keeper.latency_injection.log_write.latency_us", 10);
+    config->setUInt64("keeper.latency_injection.log_write.max_latency_us", 20);
+    injection.initialize(*config);
+    ASSERT_TRUE(injection.enabled(InjectionPoint::LOG_WRITE));
+    ASSERT_FALSE(injection.enabled(InjectionPoint::LOG_FSYNC));
+    auto latency = injection.drawLatencyUs(InjectionPoint::LOG_WRITE);
+    ASSERT_TRUE(latency >= 10 && latency <= 20) << latency;
+
+    config->setString("keeper.latency_injection.log_write.distribution", "normal");
+    ASSERT_THROW(injection.initialize(*config), Exception);
+
+    injection.disable(InjectionPoint::LOG_WRITE);
+}
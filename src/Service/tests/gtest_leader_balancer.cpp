@@ -0,0 +1,90 @@
+#include <Service/LeaderBalancer.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+NodeLoad loadOf(UInt64 fsync_us, UInt64 cpu_permille, UInt64 connections)
+{
+    NodeLoad load;
+    load.fsync_us = fsync_us;
+    load.cpu_permille = cpu_permille;
+    load.connections = connections;
+    return load;
+}
+
+}
+
+TEST(LeaderBalancer, YieldAfterRounds)
+{
+    LeaderBalancer balancer(20, 1000, 3);
+    NodeLoad my_load = loadOf(1000, 800, 100);
+
+    balancer.report(2, loadOf(1000, 800, 100), 0);
+    balancer.report(3, loadOf(200, 300, 20), 0);
+
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+    auto successor = balancer.pickSuccessor(my_load, {2, 3}, 0);
+    ASSERT_TRUE(successor);
+    ASSERT_EQ(*successor, 3);
+
+    /// Reports are forgotten after yielding
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+}
+
+TEST(LeaderBalancer, WithinMargin)
+{
+    LeaderBalancer balancer(20, 1000, 1);
+
+    /// The same load, and a bit lower one
+    balancer.report(2, loadOf(1000, 800, 100), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(loadOf(1000, 800, 100), {2}, 0));
+    balancer.report(2, loadOf(950, 780, 98), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(loadOf(1000, 800, 100), {2}, 0));
+
+    /// Idle cluster
+    balancer.report(2, loadOf(0, 0, 0), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(loadOf(0, 0, 0), {2}, 0));
+
+    balancer.report(2, loadOf(500, 800, 100), 0);
+    ASSERT_EQ(balancer.pickSuccessor(loadOf(1000, 800, 100), {2}, 0), 2);
+}
+
+TEST(LeaderBalancer, IgnoreStaleAndNonCandidates)
+{
+    LeaderBalancer balancer(20, 1000, 1);
+    NodeLoad my_load = loadOf(1000, 800, 100);
+
+    balancer.report(2, loadOf(100, 100, 10), 0);
+    /// Too old
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2}, 2000));
+
+    /// Not a candidate, like an observer
+    balancer.report(2, loadOf(100, 100, 10), 2000);
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {3}, 2000));
+    ASSERT_EQ(balancer.pickSuccessor(my_load, {2, 3}, 2000), 2);
+}
+
+TEST(LeaderBalancer, SustainedBestCandidate)
+{
+    LeaderBalancer balancer(20, 1000, 2);
+    NodeLoad my_load = loadOf(1000, 800, 100);
+
+    balancer.report(2, loadOf(100, 100, 10), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+
+    /// Another candidate is the best now, rounds start over
+    balancer.report(3, loadOf(50, 50, 5), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+    ASSERT_EQ(balancer.pickSuccessor(my_load, {2, 3}, 0), 3);
+
+    /// Reset when I am not leader
+    balancer.report(3, loadOf(50, 50, 5), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+    balancer.reset();
+    balancer.report(3, loadOf(50, 50, 5), 0);
+    ASSERT_FALSE(balancer.pickSuccessor(my_load, {2, 3}, 0));
+}
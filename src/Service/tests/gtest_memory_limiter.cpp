@@ -0,0 +1,60 @@
+#include <Service/MemoryLimiter.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+using namespace Coordination;
+
+TEST(MemoryLimiter, statesWithHysteresis)
+{
+    MemoryLimiter limiter(1000, 2000);
+    ASSERT_TRUE(limiter.enabled());
+
+    ASSERT_EQ(limiter.update(999), MemoryLimitState::NORMAL);
+    ASSERT_EQ(limiter.update(1000), MemoryLimitState::SOFT);
+    ASSERT_EQ(limiter.update(2000), MemoryLimitState::HARD);
+
+    /// Stay in a state until memory drops under 90% of its limit
+    ASSERT_EQ(limiter.update(1900), MemoryLimitState::HARD);
+    ASSERT_EQ(limiter.update(1800), MemoryLimitState::SOFT);
+    ASSERT_EQ(limiter.update(901), MemoryLimitState::SOFT);
+    ASSERT_EQ(limiter.update(900), MemoryLimitState::NORMAL);
+    ASSERT_EQ(limiter.getState(), MemoryLimitState::NORMAL);
+}
+
+TEST(MemoryLimiter, zeroLimitDisablesIt)
+{
+    MemoryLimiter hard_only(0, 1000);
+    ASSERT_EQ(hard_only.update(999), MemoryLimitState::NORMAL);
+    ASSERT_EQ(hard_only.update(1000), MemoryLimitState::HARD);
+    ASSERT_EQ(hard_only.update(900), MemoryLimitState::NORMAL);
+
+    MemoryLimiter disabled(0, 0);
+    ASSERT_FALSE(disabled.enabled());
+    ASSERT_EQ(disabled.update(1000000), MemoryLimitState::NORMAL);
+}
+
+TEST(MemoryLimiter, rejectGrowingRequests)
+{
+    MemoryLimiter limiter(0, 1000);
+
+    auto create = std::make_shared<ZooKeeperCreateRequest>();
+    auto set = std::make_shared<ZooKeeperSetRequest>();
+    auto remove = std::make_shared<ZooKeeperRemoveRequest>();
+    auto get = std::make_shared<ZooKeeperGetRequest>();
+
+    auto multi_with_set = std::make_shared<ZooKeeperMultiRequest>();
+    multi_with_set->requests = {remove, set};
+    auto multi_remove = std::make_shared<ZooKeeperMultiRequest>();
+    multi_remove->requests = {remove};
+
+    /// Nothing is rejected under the limit
+    ASSERT_FALSE(limiter.shouldReject(*create));
+
+    limiter.update(1000);
+    ASSERT_TRUE(limiter.shouldReject(*create));
+    ASSERT_TRUE(limiter.shouldReject(*set));
+    ASSERT_TRUE(limiter.shouldReject(*multi_with_set));
+    ASSERT_FALSE(limiter.shouldReject(*remove));
+    ASSERT_FALSE(limiter.shouldReject(*get));
+    ASSERT_FALSE(limiter.shouldReject(*multi_remove));
+}
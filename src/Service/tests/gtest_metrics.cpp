@@ -0,0 +1,144 @@
+#include <Common/IO/WriteBufferFromString.h>
+#include <Service/Metrics.h>
+#include <Service/OpCostMetrics.h>
+#include <Service/RequestStageMetrics.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <memory>
+
+using namespace RK;
+
+TEST(Metrics, PrometheusFormat)
+{
+    SimpleSummary simple("bytes");
+    simple.add(3);
+    simple.add(4);
+
+    BasicSummary basic("batch_size");
+    basic.add(1);
+    basic.add(5);
+
+    auto advance = std::make_shared<AdvanceSummary>("latency");
+    for (UInt64 i = 1; i <= 100; ++i)
+        advance->add(i);
+
+    WriteBufferFromOwnString buf;
+    simple.writePrometheus(buf, "rk_");
+    basic.writePrometheus(buf, "rk_");
+    advance->writePrometheus(buf, "rk_");
+    const String & text = buf.str();
+
+    ASSERT_NE(text.find("# TYPE rk_bytes counter\nrk_bytes 7\n"), String::npos);
+
+    ASSERT_NE(text.find("# TYPE rk_batch_size summary\nrk_batch_size_sum 6\nrk_batch_size_count 2\n"), String::npos);
+    ASSERT_NE(text.find("rk_batch_size_min 1\n"), String::npos);
+    ASSERT_NE(text.find("rk_batch_size_max 5\n"), String::npos);
+
+    ASSERT_NE(text.find("# TYPE rk_latency histogram\n"), String::npos);
+    ASSERT_NE(text.find("rk_latency_bucket{le=\"0\"} 0\n"), String::npos);
+    ASSERT_NE(text.find("rk_latency_bucket{le=\"63\"} 63\n"), String::npos);
+    ASSERT_NE(text.find("rk_latency_bucket{le=\"127\"} 100\n"), String::npos);
+    ASSERT_EQ(text.find("rk_latency_bucket{le=\"255\"}"), String::npos);
+    ASSERT_NE(text.find("rk_latency_bucket{le=\"+Inf\"} 100\n"), String::npos);
+    ASSERT_NE(text.find("rk_latency_sum 5050\nrk_latency_count 100\n"), String::npos);
+}
+
+TEST(Metrics, RequestStages)
+{
+    RequestTimeline timeline;
+    timeline.start(100);
+    timeline.end(RequestStage::IO, 110);
+    timeline.end(RequestStage::DISPATCH_QUEUE, 130);
+    timeline.end(RequestStage::ACCUMULATE, 160);
+    timeline.end(RequestStage::APPEND, 1160);
+
+    /// Stages recorded by the committed copy are kept
+    RequestTimeline committed;
+    committed.end(RequestStage::COMMIT, 2160);
+    committed.merge(timeline);
+    committed.end(RequestStage::APPLY, 2170);
+    /// Recorded late
+    committed.end(RequestStage::FORWARD, 120);
+
+    ASSERT_TRUE(committed.started());
+    ASSERT_FALSE(committed.passed(RequestStage::SEND));
+
+    auto durations = committed.durations();
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::IO)], 10);
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::DISPATCH_QUEUE)], 20);
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::FORWARD)], 0);
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::ACCUMULATE)], 30);
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::APPEND)], 1000);
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::COMMIT)], 1000);
+    ASSERT_EQ(durations[static_cast<size_t>(RequestStage::APPLY)], 10);
+
+    auto & metrics = RequestStageMetrics::instance();
+    metrics.reset();
+    metrics.record(Coordination::OpNum::Create, committed);
+    /// Not started
+    metrics.record(Coordination::OpNum::Create, RequestTimeline());
+
+    const auto * append = metrics.getHistogram(RequestStage::APPEND, Coordination::OpNum::Create);
+    ASSERT_NE(append, nullptr);
+    ASSERT_EQ(append->getSnapshot().count, 1);
+    ASSERT_EQ(append->getSnapshot().sum, 1000);
+    ASSERT_EQ(metrics.getHistogram(RequestStage::SEND, Coordination::OpNum::Create), nullptr);
+    ASSERT_EQ(metrics.getHistogram(RequestStage::APPEND, Coordination::OpNum::Get), nullptr);
+
+    WriteBufferFromOwnString buf;
+    metrics.writePrometheus(buf, "rk_");
+    const String & text = buf.str();
+    ASSERT_NE(text.find("# TYPE rk_request_stage_time_us histogram\n"), String::npos);
+    ASSERT_NE(text.find("rk_request_stage_time_us_bucket{stage=\"append\",op=\"Create\",le=\"1023\"} 1\n"), String::npos);
+    ASSERT_NE(text.find("rk_request_stage_time_us_sum{stage=\"append\",op=\"Create\"} 1000\n"), String::npos);
+    ASSERT_NE(text.find("rk_request_stage_time_us_count{stage=\"io\",op=\"Create\"} 1\n"), String::npos);
+}
+
+TEST(Metrics, OpCostMetrics)
+{
+    auto & metrics = OpCostMetrics::instance();
+    metrics.reset();
+
+    metrics.record(Coordination::OpNum::List, OpCostMetrics::ThreadKind::PROCESSOR, 3000, 1000);
+    metrics.record(Coordination::OpNum::List, OpCostMetrics::ThreadKind::PROCESSOR, 5000, 1400);
+    metrics.record(Coordination::OpNum::List, OpCostMetrics::ThreadKind::IO, 700, 0);
+
+    auto cost = metrics.getCost(Coordination::OpNum::List, OpCostMetrics::ThreadKind::PROCESSOR);
+    ASSERT_EQ(cost.count, 2);
+    ASSERT_EQ(cost.cpu_ns, 8000);
+    ASSERT_EQ(cost.allocated_bytes, 2400);
+    ASSERT_EQ(metrics.getCost(Coordination::OpNum::Get, OpCostMetrics::ThreadKind::PROCESSOR).count, 0);
+
+    auto averages = metrics.getAverages();
+    ASSERT_NE(std::find(averages.begin(), averages.end(), std::pair<String, UInt64>{"processor_list_cpu_ns_avg", 4000}), averages.end());
+    ASSERT_NE(
+        std::find(averages.begin(), averages.end(), std::pair<String, UInt64>{"processor_list_allocated_bytes_avg", 1200}), averages.end());
+    ASSERT_NE(std::find(averages.begin(), averages.end(), std::pair<String, UInt64>{"io_list_cpu_ns_avg", 700}), averages.end());
+
+    WriteBufferFromOwnString buf;
+    metrics.writePrometheus(buf, "rk_");
+    const String & text = buf.str();
+    ASSERT_NE(text.find("# TYPE rk_op_cpu_ns_total counter\n"), String::npos);
+    ASSERT_NE(text.find("rk_op_requests_total{op=\"List\",thread=\"processor\"} 2\n"), String::npos);
+    ASSERT_NE(text.find("rk_op_allocated_bytes_total{op=\"List\",thread=\"processor\"} 2400\n"), String::npos);
+
+    /// Nothing is recorded while disabled
+    metrics.setEnabled(false);
+    {
+        OpCostMetrics::Scope scope(Coordination::OpNum::Get, OpCostMetrics::ThreadKind::IO);
+    }
+    ASSERT_EQ(metrics.getCost(Coordination::OpNum::Get, OpCostMetrics::ThreadKind::IO).count, 0);
+
+    metrics.setEnabled(true);
+    {
+        OpCostMetrics::Scope scope(Coordination::OpNum::Get, OpCostMetrics::ThreadKind::IO);
+        volatile UInt64 sum = 0;
+        for (UInt64 i = 0; i < 1000000; ++i)
+            sum = sum + i;
+    }
+    metrics.setEnabled(false);
+    cost = metrics.getCost(Coordination::OpNum::Get, OpCostMetrics::ThreadKind::IO);
+    ASSERT_EQ(cost.count, 1);
+    ASSERT_GT(cost.cpu_ns, 0);
+}
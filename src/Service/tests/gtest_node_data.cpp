@@ -0,0 +1,151 @@
+#include <filesystem>
+
+#include <Common/IO/ReadBufferFromString.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <Service/NodeData.h>
+#include <ZooKeeper/ZooKeeperIO.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+struct LargeValueStoreGuard
+{
+    LargeValueStoreGuard(UInt64 threshold, UInt64 segment_size)
+    {
+        std::filesystem::create_directories(dir);
+        LargeValueStore::instance().configure(dir, threshold, segment_size);
+    }
+
+    ~LargeValueStoreGuard()
+    {
+        LargeValueStore::instance().configure(dir, 0);
+        /// Segment files are unlinked when created
+        std::filesystem::remove_all(dir);
+    }
+
+    String dir = "./test_large_values";
+};
+
+}
+
+TEST(NodeData, inlineData)
+{
+    LargeValueStoreGuard guard(0, 4096);
+
+    NodeData data;
+    ASSERT_TRUE(data.empty());
+    data = String(10000, 'x');
+    ASSERT_FALSE(data.isLarge());
+    ASSERT_EQ(data.size(), size_t(10000));
+    ASSERT_EQ(data, String(10000, 'x'));
+}
+
+TEST(NodeData, largeData)
+{
+    LargeValueStoreGuard guard(100, 4096);
+    auto & store = LargeValueStore::instance();
+    UInt64 segments = store.getSegmentsCount();
+
+    {
+        NodeData small;
+        small = "small";
+        ASSERT_FALSE(small.isLarge());
+
+        NodeData large;
+        large = String(1000, 'a');
+        ASSERT_TRUE(large.isLarge());
+        ASSERT_EQ(large, String(1000, 'a'));
+        ASSERT_EQ(store.getSegmentsCount(), segments + 1);
+
+        /// Copy shares the data
+        NodeData copy = large;
+        ASSERT_EQ(copy.data(), large.data());
+
+        /// Larger than a segment
+        NodeData huge;
+        huge = String(10000, 'b');
+        ASSERT_TRUE(huge.isLarge());
+        ASSERT_EQ(huge, String(10000, 'b'));
+        ASSERT_EQ(store.getSegmentsCount(), segments + 2);
+
+        /// Replaced by small data
+        large = "a";
+        ASSERT_FALSE(large.isLarge());
+        ASSERT_EQ(copy, String(1000, 'a'));
+    }
+
+    /// All values released
+    ASSERT_EQ(store.getSegmentsCount(), segments);
+}
+
+TEST(NodeData, serialization)
+{
+    LargeValueStoreGuard guard(100, 4096);
+
+    NodeData large;
+    large = String(1000, 'a');
+
+    WriteBufferFromOwnString out;
+    Coordination::write(large, out);
+    /// Same with a string
+    String expected_data(1000, 'a');
+    WriteBufferFromOwnString expected;
+    Coordination::write(expected_data, expected);
+    ASSERT_EQ(out.str(), expected.str());
+
+    NodeData parsed;
+    ReadBufferFromString in(out.str());
+    Coordination::read(parsed, in);
+    ASSERT_TRUE(parsed.isLarge());
+    ASSERT_EQ(parsed, large);
+}
+
+TEST(NodeData, internedData)
+{
+    auto & interner = NodeDataInterner::instance();
+    interner.configure(1000);
+    UInt64 values = interner.getValuesCount();
+
+    {
+        String value(100, 'c');
+        NodeData first;
+        first = value;
+        ASSERT_TRUE(first.isInterned());
+
+        /// Equal data is shared
+        NodeData second;
+        second = String(value);
+        ASSERT_EQ(second.data(), first.data());
+        ASSERT_EQ(interner.getValuesCount(), values + 1);
+
+        /// Too short or too long
+        NodeData small;
+        small = "small";
+        ASSERT_FALSE(small.isInterned());
+        NodeData long_data;
+        long_data = String(2000, 'c');
+        ASSERT_FALSE(long_data.isInterned());
+
+        /// Released when the last node changes
+        first = "a";
+        ASSERT_EQ(second, value);
+        ASSERT_EQ(interner.getValuesCount(), values + 1);
+        second = String(100, 'd');
+        ASSERT_EQ(interner.getValuesCount(), values + 1);
+
+        /// Interned again after released
+        first = value;
+        ASSERT_TRUE(first.isInterned());
+        ASSERT_EQ(interner.getValuesCount(), values + 2);
+    }
+
+    ASSERT_EQ(interner.getValuesCount(), values);
+    interner.configure(0);
+
+    NodeData data;
+    data = String(100, 'c');
+    ASSERT_FALSE(data.isInterned());
+}
@@ -0,0 +1,107 @@
+#include <algorithm>
+
+#include <Service/NodeExpiryIndex.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+Strings sorted(Strings paths)
+{
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+}
+
+TEST(NodeExpiryIndex, Owners)
+{
+    ASSERT_TRUE(isContainerOwner(CONTAINER_OWNER));
+    ASSERT_FALSE(isTTLOwner(CONTAINER_OWNER));
+    ASSERT_FALSE(isEphemeralOwner(CONTAINER_OWNER));
+
+    int64_t ttl_owner = TTL_OWNER_MASK | 3600000;
+    ASSERT_TRUE(isTTLOwner(ttl_owner));
+    ASSERT_FALSE(isContainerOwner(ttl_owner));
+    ASSERT_FALSE(isEphemeralOwner(ttl_owner));
+    ASSERT_EQ(ttlOfOwner(ttl_owner), 3600000);
+    ASSERT_EQ(ttlOfOwner(TTL_OWNER_MASK | MAX_TTL_MS), MAX_TTL_MS);
+
+    ASSERT_TRUE(isEphemeralOwner(1));
+    ASSERT_FALSE(isEphemeralOwner(0));
+}
+
+TEST(NodeExpiryIndex, TTLNodes)
+{
+    NodeExpiryIndex index(100);
+    int64_t now = 1000000;
+
+    index.addTTLNode("/a", now + 150);
+    index.addTTLNode("/b", now + 1000);
+    index.addTTLNode("/c", now + 1000);
+    /// Deadline moved by a set of the node
+    index.addTTLNode("/c", now + 5000);
+    ASSERT_EQ(index.ttlNodesCount(), size_t(3));
+
+    ASSERT_TRUE(index.collect(now, 100, 10000).empty());
+    ASSERT_EQ(index.collect(now + 200, 100, 10000), Strings({"/a"}));
+    ASSERT_EQ(index.collect(now + 1000, 100, 10000), Strings({"/b"}));
+    ASSERT_TRUE(index.collect(now + 2000, 100, 10000).empty());
+
+    /// Removed, the entry left in the wheel is dropped
+    index.remove("/c");
+    ASSERT_TRUE(index.collect(now + 6000, 100, 10000).empty());
+
+    /// Collected again if not removed for the retry time
+    index.remove("/b");
+    ASSERT_EQ(index.collect(now + 10200, 100, 10000), Strings({"/a"}));
+    ASSERT_EQ(index.ttlNodesCount(), size_t(1));
+}
+
+TEST(NodeExpiryIndex, MaxCountAndLongGap)
+{
+    NodeExpiryIndex index(10);
+    int64_t now = 1000000;
+    Strings expected;
+    for (int i = 0; i < 10; ++i)
+    {
+        index.addTTLNode("/node_" + std::to_string(i), now + i * 100);
+        expected.push_back("/node_" + std::to_string(i));
+    }
+
+    /// Much more than a turn of the wheel later
+    int64_t later = now + 10000000;
+    auto first = index.collect(later, 4, 100000000);
+    auto second = index.collect(later, 4, 100000000);
+    auto third = index.collect(later, 4, 100000000);
+    ASSERT_EQ(first.size(), size_t(4));
+    ASSERT_EQ(second.size(), size_t(4));
+    ASSERT_EQ(third.size(), size_t(2));
+
+    Strings all = first;
+    all.insert(all.end(), second.begin(), second.end());
+    all.insert(all.end(), third.begin(), third.end());
+    ASSERT_EQ(sorted(all), sorted(expected));
+}
+
+TEST(NodeExpiryIndex, EmptyContainers)
+{
+    NodeExpiryIndex index;
+    int64_t now = 1000000;
+
+    index.addEmptyContainer("/a");
+    index.addEmptyContainer("/b");
+    ASSERT_EQ(index.emptyContainersCount(), size_t(2));
+
+    /// Got a child
+    index.remove("/b");
+    ASSERT_EQ(index.collect(now, 100, 5000), Strings({"/a"}));
+    ASSERT_TRUE(index.collect(now + 1000, 100, 5000).empty());
+    ASSERT_EQ(index.collect(now + 5000, 100, 5000), Strings({"/a"}));
+
+    index.clear();
+    ASSERT_EQ(index.emptyContainersCount(), size_t(0));
+    ASSERT_TRUE(index.collect(now + 20000, 100, 5000).empty());
+}
@@ -0,0 +1,73 @@
+#include <gtest/gtest.h>
+
+#include <map>
+#include <Service/PathTrie.h>
+
+using namespace RK;
+
+TEST(PathTrie, Basic)
+{
+    PathTrie<int> trie;
+    ASSERT_TRUE(trie.emplace("/", 0));
+    ASSERT_TRUE(trie.emplace("/clickhouse", 1));
+    ASSERT_TRUE(trie.emplace("/clickhouse/tables", 2));
+    ASSERT_TRUE(trie.emplace("/clickhouse/task_queue", 3));
+    ASSERT_FALSE(trie.emplace("/clickhouse/task_queue", 4));
+
+    ASSERT_EQ(trie.size(), 4);
+    ASSERT_EQ(*trie.get("/clickhouse/task_queue"), 4);
+    ASSERT_EQ(trie.get("/clickhouse/not_exists"), nullptr);
+    ASSERT_EQ(trie.get("/click"), nullptr);
+
+    std::vector<String> children;
+    trie.forEachChild("/clickhouse", [&](std::string_view name) { children.emplace_back(name); });
+    ASSERT_EQ(children, (std::vector<String>{"tables", "task_queue"}));
+
+    ASSERT_TRUE(trie.erase("/clickhouse/tables"));
+    ASSERT_FALSE(trie.erase("/clickhouse/tables"));
+    ASSERT_EQ(trie.size(), 3);
+}
+
+TEST(PathTrie, ForEach)
+{
+    PathTrie<int> trie;
+    std::map<String, int> expected;
+
+    trie.emplace("/", 0);
+    expected["/"] = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        String path = "/clickhouse/tables/" + std::to_string(i % 10) + "/replicas/r" + std::to_string(i);
+        trie.emplace(path, i);
+        expected[path] = i;
+    }
+
+    std::map<String, int> actual;
+    trie.forEach([&](const String & path, int value) { actual[path] = value; });
+    ASSERT_EQ(actual, expected);
+
+    for (const auto & [path, _] : expected)
+        ASSERT_TRUE(trie.erase(path));
+    ASSERT_EQ(trie.size(), 0);
+}
+
+TEST(PathTrie, ForEachPrefix)
+{
+    PathTrie<int> trie;
+    trie.emplace("/", 0);
+    trie.emplace("/a", 1);
+    trie.emplace("/a/b/c", 3);
+    trie.emplace("/a/b/c/d", 4);
+
+    std::vector<std::pair<int, bool>> visited;
+    trie.forEachPrefix("/a/b/c", [&](int value, bool is_path) { visited.emplace_back(value, is_path); });
+    ASSERT_EQ(visited, (std::vector<std::pair<int, bool>>{{0, false}, {1, false}, {3, true}}));
+
+    visited.clear();
+    trie.forEachPrefix("/a/x/y", [&](int value, bool is_path) { visited.emplace_back(value, is_path); });
+    ASSERT_EQ(visited, (std::vector<std::pair<int, bool>>{{0, false}, {1, false}}));
+
+    visited.clear();
+    trie.forEachPrefix("/", [&](int value, bool is_path) { visited.emplace_back(value, is_path); });
+    ASSERT_EQ(visited, (std::vector<std::pair<int, bool>>{{0, true}}));
+}
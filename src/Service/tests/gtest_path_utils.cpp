@@ -0,0 +1,38 @@
+#include <Service/ChildrenSet.h>
+#include <Service/KeeperCommon.h>
+#include <Service/KeeperUtils.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(PathUtils, ParentAndBaseName)
+{
+    ASSERT_EQ(parentPathOf("/a/b/c"), "/a/b");
+    ASSERT_EQ(parentPathOf("/a"), "/");
+    ASSERT_EQ(parentPathOf("/"), "/");
+    ASSERT_EQ(baseNameOf("/a/b/c"), "c");
+    ASSERT_EQ(baseNameOf("/a"), "a");
+    ASSERT_EQ(baseNameOf("/"), "");
+    ASSERT_EQ(baseNameOf("/a/"), "");
+
+    /// Parts of the path, nothing copied
+    String path = "/" + String(1000, 'x') + "/" + String(100, 'y');
+    std::string_view parent = parentPathOf(path);
+    std::string_view name = baseNameOf(path);
+    ASSERT_EQ(parent.data(), path.data());
+    ASSERT_EQ(parent.size(), 1001);
+    ASSERT_EQ(name.data(), path.data() + 1002);
+    ASSERT_EQ(name, String(100, 'y'));
+
+    ASSERT_EQ(getParentPath(path), String(parent));
+    ASSERT_EQ(getBaseName(path), String(name));
+}
+
+TEST(PathUtils, HashedParentPath)
+{
+    /// Same hash as the parent path copied into a string, so maps keyed by String find it
+    String path = "/a/b/c";
+    String parent = getParentPath(path);
+    ASSERT_EQ(HashedPath(parentPathOf(path)).hash, StringHash()(parent));
+    ASSERT_EQ(HashedPath(parentPathOf(path)).path, parent);
+}
@@ -0,0 +1,63 @@
+#include <Service/PendingForwardRequests.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+ForwardRequestPtr makeUserRequest(int64_t session_id, Coordination::XID xid)
+{
+    auto zk_request = std::make_shared<Coordination::ZooKeeperCreateRequest>();
+    zk_request->xid = xid;
+    auto request = std::make_shared<ForwardUserRequest>();
+    request->request = RequestForSession(zk_request, session_id, 0);
+    return request;
+}
+
+}
+
+TEST(PendingForwardRequests, MatchByKey)
+{
+    PendingForwardRequests pending;
+    for (int64_t session_id = 1; session_id <= 3; ++session_id)
+        for (Coordination::XID xid = 0; xid < 10; ++xid)
+            pending.push(makeUserRequest(session_id, xid));
+    ASSERT_EQ(pending.size(), 30);
+
+    /// Responses come in any order
+    auto request = pending.remove({ForwardType::User, 2, 5});
+    ASSERT_NE(request, nullptr);
+    ASSERT_EQ(request->toString(), makeUserRequest(2, 5)->toString());
+    ASSERT_EQ(pending.remove({ForwardType::User, 2, 5}), nullptr);
+    ASSERT_EQ(pending.remove({ForwardType::ReadIndex, 2, 6}), nullptr);
+    ASSERT_EQ(pending.size(), 29);
+
+    /// Timed out requests are removed from front in send order
+    size_t removed = 0;
+    ForwardRequestPtr front;
+    ASSERT_TRUE(pending.removeFrontIf([&](const ForwardRequestPtr &) { return ++removed <= 10; }, front));
+    ASSERT_EQ(front->toString(), makeUserRequest(2, 0)->toString());
+    ASSERT_EQ(pending.size(), 19);
+    ASSERT_EQ(pending.remove({ForwardType::User, 1, 3}), nullptr);
+    ASSERT_NE(pending.remove({ForwardType::User, 3, 3}), nullptr);
+}
+
+TEST(PendingForwardRequests, EarliestOfSameKey)
+{
+    PendingForwardRequests pending;
+
+    std::vector<ForwardRequestPtr> requests;
+    for (int64_t i = 0; i < 3; ++i)
+    {
+        std::unordered_map<int64_t, int64_t> sessions{{i, i}};
+        requests.push_back(std::make_shared<ForwardSyncSessionsRequest>(std::move(sessions)));
+        pending.push(requests.back());
+    }
+
+    for (const auto & request : requests)
+        ASSERT_EQ(pending.remove({ForwardType::SyncSessions, 0, 0}), request);
+
+    ForwardRequestPtr front;
+    ASSERT_FALSE(pending.peek(front));
+}
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <Service/PendingRequests.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+/// create_time is used as the sequence number of request
+RequestForSession makeRequest(int64_t session_id, int64_t seq)
+{
+    return RequestForSession(nullptr, session_id, seq);
+}
+
+}
+
+TEST(PendingRequests, FifoPerSession)
+{
+    PendingRequests pending;
+    ASSERT_TRUE(pending.empty());
+    ASSERT_EQ(pending.front(1), nullptr);
+
+    for (int64_t seq = 0; seq < 10; ++seq)
+        pending.push(makeRequest(seq % 2 + 1, seq));
+
+    ASSERT_EQ(pending.size(), 10);
+    ASSERT_EQ(pending.sessionCount(), 2);
+
+    for (int64_t seq = 0; seq < 10; seq += 2)
+    {
+        ASSERT_EQ(pending.front(1)->create_time, seq);
+        pending.popFront(1);
+    }
+    ASSERT_FALSE(pending.contains(1));
+    ASSERT_EQ(pending.sessionCount(), 1);
+
+    pending.erase(2);
+    ASSERT_TRUE(pending.empty());
+    ASSERT_EQ(pending.sessionCount(), 0);
+
+    /// Freed nodes are reused
+    for (int64_t seq = 0; seq < 10; ++seq)
+        pending.push(makeRequest(3, seq));
+    ASSERT_EQ(pending.front(3)->create_time, 0);
+}
+
+TEST(PendingRequests, Extract)
+{
+    PendingRequests pending;
+    for (int64_t seq = 0; seq < 5; ++seq)
+        pending.push(makeRequest(1, seq));
+
+    auto tail = pending.extract(1, [](const RequestForSession & request) { return request.create_time == 4; });
+    ASSERT_TRUE(tail);
+    ASSERT_EQ(tail->create_time, 4);
+
+    auto middle = pending.extract(1, [](const RequestForSession & request) { return request.create_time == 2; });
+    ASSERT_TRUE(middle);
+    ASSERT_FALSE(pending.extract(1, [](const RequestForSession & request) { return request.create_time == 2; }));
+    ASSERT_FALSE(pending.extract(2, [](const RequestForSession &) { return true; }));
+
+    /// Push after extracting the tail
+    pending.push(makeRequest(1, 5));
+
+    std::vector<int64_t> rest;
+    while (const auto * front = pending.front(1))
+    {
+        rest.push_back(front->create_time);
+        pending.popFront(1);
+    }
+    ASSERT_EQ(rest, (std::vector<int64_t>{0, 1, 3, 5}));
+    ASSERT_TRUE(pending.empty());
+}
+
+TEST(PendingRequests, PopFrontWhile)
+{
+    PendingRequests pending;
+    for (int64_t session_id = 1; session_id <= 100; ++session_id)
+        for (int64_t seq = 0; seq < 3; ++seq)
+            pending.push(makeRequest(session_id, seq));
+
+    /// Pop the first two requests of every session
+    size_t popped = 0;
+    pending.popFrontWhile(
+        [&](const RequestForSession & request)
+        {
+            if (request.create_time >= 2)
+                return false;
+            ++popped;
+            return true;
+        });
+
+    ASSERT_EQ(popped, 200);
+    ASSERT_EQ(pending.size(), 100);
+    ASSERT_TRUE(pending.anyFront([](const RequestForSession & request) { return request.create_time == 2; }));
+
+    /// Sessions become empty while iterating
+    pending.popFrontWhile([](const RequestForSession &) { return true; });
+    ASSERT_TRUE(pending.empty());
+    ASSERT_EQ(pending.sessionCount(), 0);
+}
+
+TEST(PendingRequests, PopFrontFair)
+{
+    PendingRequests pending;
+    /// A burst of session 1 and a request of session 2
+    for (int64_t seq = 0; seq < 10; ++seq)
+        pending.push(makeRequest(1, seq));
+    pending.push(makeRequest(2, 100));
+
+    std::vector<int64_t> order;
+    pending.popFrontFair(
+        3,
+        [&](const RequestForSession & request)
+        {
+            order.push_back(request.create_time);
+            return true;
+        });
+
+    ASSERT_TRUE(pending.empty());
+    ASSERT_EQ(order.size(), 11);
+    /// Session 2 does not wait for all of session 1, which is still in order
+    auto it = std::find(order.begin(), order.end(), 100);
+    ASSERT_LE(it - order.begin(), 3);
+    order.erase(it);
+    for (int64_t seq = 0; seq < 10; ++seq)
+        ASSERT_EQ(order[seq], seq);
+
+    /// Stops at a request not popped like popFrontWhile
+    for (int64_t seq = 0; seq < 10; ++seq)
+        pending.push(makeRequest(1, seq));
+    pending.popFrontFair(3, [](const RequestForSession & request) { return request.create_time < 5; });
+    ASSERT_EQ(pending.front(1)->create_time, 5);
+}
@@ -1,8 +1,10 @@
+#include <thread>
 #include <Poco/File.h>
 
 #include <gtest/gtest.h>
 #include <libnuraft/nuraft.hxx>
 
+#include <Service/InMemoryLogStorage.h>
 #include <Service/LogEntry.h>
 #include <Service/KeeperUtils.h>
 #include <Service/NuRaftFileLogStore.h>
@@ -435,3 +437,669 @@ int main(int argc, char ** argv)
     //delete thread_env;
     return ret;
 }
+
+TEST(RaftLog, deferredAppend)
+{
+    String log_dir(LOG_DIR + "/11");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 5; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data), true), i + 1);
+    ASSERT_EQ(log_store->lastLogIndex(), 5);
+
+    /// Reading a deferred entry writes them
+    auto entry = log_store->getEntry(3);
+    ASSERT_NE(entry, nullptr);
+    ASSERT_EQ(getZookeeperCreateRequest(entry)->data, data);
+
+    for (int i = 5; i < 10; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data), true), i + 1);
+    ASSERT_EQ(log_store->writePending(), 0);
+    ASSERT_EQ(log_store->close(), 0);
+
+    ASSERT_EQ(log_store->init(), 0);
+    ASSERT_EQ(log_store->lastLogIndex(), 10);
+    for (UInt64 i = 1; i <= 10; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, ioUringAppend)
+{
+    String log_dir(LOG_DIR + "/12");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    /// Falls back to plain writes if io_uring is not available
+    ASSERT_EQ(log_store->init(LogSegmentStore::MAX_SEGMENT_FILE_SIZE, LogSegmentStore::MAX_SEGMENT_COUNT, true), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 5; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data), true), i + 1);
+
+    if (log_store->hasIOUring())
+    {
+        /// Write and fdatasync are submitted together, waitDurable takes their completions
+        ASSERT_EQ(log_store->submitPending(), 0);
+        while (log_store->waitDurable() < 5)
+            ;
+    }
+    else
+    {
+        ASSERT_EQ(log_store->flush(), 5);
+    }
+
+    /// Reading an entry in flight waits for its write
+    for (int i = 5; i < 10; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data), true), i + 1);
+    if (log_store->hasIOUring())
+        ASSERT_EQ(log_store->submitPending(), 0);
+    ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(8))->data, data);
+
+    ASSERT_EQ(log_store->flush(), 10);
+    ASSERT_EQ(log_store->close(), 0);
+
+    ASSERT_EQ(log_store->init(), 0);
+    ASSERT_EQ(log_store->lastLogIndex(), 10);
+    for (UInt64 i = 1; i <= 10; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+#if defined(OS_LINUX)
+TEST(RaftLog, preallocatedSegments)
+{
+    String log_dir(LOG_DIR + "/13");
+    cleanDirectory(log_dir);
+    String spare_path = log_dir + "/" + LogSegmentStore::LOG_SPARE_FILE_NAME;
+
+    auto wait_spare = [&spare_path]
+    {
+        for (int i = 0; i < 1000 && !Poco::File(spare_path).exists(); i++)
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        return Poco::File(spare_path).exists();
+    };
+
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT, false, true), 0);
+    ASSERT_TRUE(wait_spare());
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+    {
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data)), i + 1);
+        /// So that rotations take the spare
+        if (log_store->lastLogIndex() % 20 == 0)
+            wait_spare();
+    }
+    ASSERT_EQ(log_store->flush(), 100);
+
+    /// Preallocated space of closed segments is dropped
+    ASSERT_FALSE(log_store->getClosedSegments().empty());
+    for (auto & segment : log_store->getClosedSegments())
+        ASSERT_EQ(Poco::File(log_dir + "/" + segment->getFileName()).getSize(), segment->getFileSize());
+    ASSERT_EQ(log_store->close(), 0);
+
+    /// The end of the open segment is found by checking entries
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT, false, true), 0);
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+    for (UInt64 i = 1; i <= 100; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+
+    ASSERT_EQ(log_store->truncateLog(95), 0);
+    ASSERT_EQ(log_store->appendEntry(createLogEntry(2, key, data)), 96);
+    ASSERT_EQ(log_store->flush(), 96);
+    ASSERT_EQ(log_store->close(), 0);
+
+    /// Without preallocation the spare is removed and the zeros after entries are truncated
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+    ASSERT_FALSE(Poco::File(spare_path).exists());
+    ASSERT_EQ(log_store->lastLogIndex(), 96);
+    ASSERT_EQ(log_store->getEntry(96)->get_term(), 2);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+#endif
+
+TEST(RaftLog, directIOAppend)
+{
+    String log_dir(LOG_DIR + "/14");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    /// Falls back to writes through page cache if the file system does not support O_DIRECT
+    ASSERT_EQ(log_store->init(8192, LogSegmentStore::MAX_SEGMENT_COUNT, false, false, true), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 200; i++)
+    {
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data), true), i + 1);
+        /// Batches of different sizes, some of them end in the middle of a block
+        if (i % 7 == 0)
+            ASSERT_EQ(log_store->flush(), i + 1);
+    }
+    ASSERT_EQ(log_store->flush(), 200);
+    ASSERT_FALSE(log_store->getClosedSegments().empty());
+    for (UInt64 i = 1; i <= 200; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+
+    /// The last partial block is loaded again after truncating
+    ASSERT_EQ(log_store->truncateLog(190), 0);
+    ASSERT_EQ(log_store->appendEntry(createLogEntry(2, key, data)), 191);
+    ASSERT_EQ(log_store->flush(), 191);
+    ASSERT_EQ(log_store->close(), 0);
+
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(8192, LogSegmentStore::MAX_SEGMENT_COUNT, false, false, true), 0);
+    ASSERT_EQ(log_store->lastLogIndex(), 191);
+    for (UInt64 i = 1; i <= 190; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+    ASSERT_EQ(log_store->getEntry(191)->get_term(), 2);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, mappedClosedSegments)
+{
+    String log_dir(LOG_DIR + "/15");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data)), i + 1);
+    ASSERT_EQ(log_store->flush(), 100);
+    ASSERT_GE(log_store->getClosedSegments().size(), 2);
+
+    /// Entries of closed segments are read from their mappings
+    for (UInt64 i = 1; i <= 100; i++)
+    {
+        auto entry = log_store->getEntry(i);
+        ASSERT_NE(entry, nullptr);
+        ASSERT_EQ(getZookeeperCreateRequest(entry)->data, data);
+    }
+
+    /// Truncating a mapped closed segment reopens it and reads it by pread
+    UInt64 last_index_kept = log_store->getClosedSegments()[0]->lastIndex() - 1;
+    ASSERT_EQ(log_store->truncateLog(last_index_kept), 0);
+    ASSERT_EQ(log_store->appendEntry(createLogEntry(2, key, data)), last_index_kept + 1);
+    ASSERT_EQ(log_store->flush(), last_index_kept + 1);
+    for (UInt64 i = 1; i <= last_index_kept; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+    ASSERT_EQ(log_store->getEntry(last_index_kept + 1)->get_term(), 2);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, logEntryQueue)
+{
+    String data(100, 'a');
+    auto entry_bytes = sizeof(log_entry) + createLogEntry(1, "/a", data)->get_buf().size();
+
+    /// Bounded by bytes
+    LogEntryQueue queue(100, entry_bytes * 10);
+    for (UInt64 i = 1; i <= 20; i++)
+        queue.putEntry(i, createLogEntry(1, "/a", data));
+    ASSERT_EQ(queue.size(), 10U);
+    ASSERT_EQ(queue.bytes(), entry_bytes * 10);
+    ASSERT_EQ(queue.getEntry(10), nullptr);
+    ASSERT_NE(queue.getEntry(11), nullptr);
+    ASSERT_NE(queue.getEntry(20), nullptr);
+    ASSERT_EQ(queue.getEntry(21), nullptr);
+
+    /// Overwriting drops the logs after
+    queue.putEntry(15, createLogEntry(2, "/a", data));
+    ASSERT_EQ(queue.size(), 5U);
+    ASSERT_EQ(queue.getEntry(15)->get_term(), 2);
+    ASSERT_EQ(queue.getEntry(16), nullptr);
+
+    queue.removeUntil(12);
+    ASSERT_EQ(queue.getEntry(12), nullptr);
+    ASSERT_NE(queue.getEntry(13), nullptr);
+
+    /// Not contiguous
+    queue.putEntry(100, createLogEntry(2, "/a", data));
+    ASSERT_EQ(queue.size(), 1U);
+    ASSERT_NE(queue.getEntry(100), nullptr);
+
+    /// Bounded by count
+    LogEntryQueue small_queue(3, entry_bytes * 10);
+    for (UInt64 i = 1; i <= 5; i++)
+        small_queue.putEntry(i, createLogEntry(1, "/a", data));
+    ASSERT_EQ(small_queue.size(), 3U);
+    ASSERT_EQ(small_queue.getEntry(2), nullptr);
+    ASSERT_NE(small_queue.getEntry(3), nullptr);
+
+    LogEntryQueue disabled_queue(0, entry_bytes * 10);
+    disabled_queue.putEntry(1, createLogEntry(1, "/a", data));
+    ASSERT_EQ(disabled_queue.getEntry(1), nullptr);
+}
+
+TEST(RaftLog, logEntryQueueConcurrentReads)
+{
+    /// Term of log i is i, overwritten logs have term i + 1000000
+    LogEntryQueue queue(64, 1UL << 30);
+    std::atomic<bool> stop{false};
+    std::atomic<UInt64> last_index{0};
+    std::atomic<bool> failed{false};
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < 4; ++i)
+    {
+        readers.emplace_back(
+            [&]
+            {
+                while (!stop)
+                {
+                    UInt64 last = last_index.load();
+                    for (UInt64 index = last > 64 ? last - 64 : 1; index <= last; ++index)
+                    {
+                        auto entry = queue.getEntry(index);
+                        if (entry && entry->get_term() != index && entry->get_term() != index + 1000000)
+                            failed = true;
+                    }
+                }
+            });
+    }
+
+    for (UInt64 index = 1; index <= 20000; ++index)
+    {
+        queue.putEntry(index, createLogEntry(index, "/a", "data"));
+        last_index = index;
+        if (index % 100 == 0)
+        {
+            queue.putEntry(index - 5, createLogEntry(index - 5 + 1000000, "/a", "data"));
+            for (UInt64 overwritten = index - 4; overwritten <= index; ++overwritten)
+                queue.putEntry(overwritten, createLogEntry(overwritten, "/a", "data"));
+        }
+    }
+
+    stop = true;
+    for (auto & reader : readers)
+        reader.join();
+    ASSERT_FALSE(failed);
+    ASSERT_EQ(queue.size(), 64U);
+    ASSERT_EQ(queue.firstIndex(), 20000 - 63);
+}
+
+TEST(RaftLog, getEntriesExt)
+{
+    String log_dir(LOG_DIR + "/16");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data)), i + 1);
+    /// Deferred entries of the open segment are written before they are read
+    for (int i = 100; i < 110; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(2, key, data), true), i + 1);
+    ASSERT_GE(log_store->getClosedSegments().size(), 2);
+
+    /// No limit, across closed segments and the open one
+    ptr<std::vector<ptr<log_entry>>> ret = cs_new<std::vector<ptr<log_entry>>>();
+    log_store->getEntriesExt(1, 110, 0, ret);
+    ASSERT_EQ(ret->size(), 110U);
+    for (UInt64 i = 0; i < 110; i++)
+    {
+        ASSERT_EQ((*ret)[i]->get_term(), i < 100 ? 1U : 2U);
+        ASSERT_EQ(getZookeeperCreateRequest((*ret)[i])->path, key);
+    }
+
+    /// Limited by bytes
+    int64 entry_size = NuRaftLogSegment::getBatchSize(log_store->getEntry(1));
+    ret->clear();
+    log_store->getEntriesExt(5, 110, entry_size * 50 + 1, ret);
+    ASSERT_EQ(ret->size(), 50U);
+    ASSERT_EQ(getZookeeperCreateRequest((*ret)[49])->path, key);
+
+    /// The first entry is taken even if it is larger
+    ret->clear();
+    log_store->getEntriesExt(5, 110, 1, ret);
+    ASSERT_EQ(ret->size(), 1U);
+
+    ret->clear();
+    log_store->getEntriesExt(105, 200, 0, ret);
+    ASSERT_EQ(ret->size(), 6U);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, segmentIndex)
+{
+    String log_dir(LOG_DIR + "/17");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data)), i + 1);
+    ASSERT_EQ(log_store->flush(), 100);
+    ASSERT_GE(log_store->getClosedSegments().size(), 3);
+
+    auto index_path = [&](size_t i)
+    { return log_dir + "/" + NuRaftLogSegment::INDEX_FILE_PREFIX + log_store->getClosedSegments()[i]->getFileName(); };
+    for (size_t i = 0; i < log_store->getClosedSegments().size(); i++)
+        ASSERT_TRUE(Poco::File(index_path(i)).exists());
+
+    /// Truncating a closed segment removes its index
+    String truncated_index = index_path(1);
+    UInt64 last_index_kept = log_store->getClosedSegments()[1]->lastIndex() - 1;
+    ASSERT_EQ(log_store->truncateLog(last_index_kept), 0);
+    ASSERT_FALSE(Poco::File(truncated_index).exists());
+    for (UInt64 i = last_index_kept + 1; i <= 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(2, key, data)), i);
+    ASSERT_EQ(log_store->flush(), 100);
+
+    /// Break an index and leave one without segment, the first is loaded by scanning and the other is removed
+    String broken_index = index_path(0);
+    String orphan_index = log_dir + "/" + NuRaftLogSegment::INDEX_FILE_PREFIX + "log_1000_2000_20230101000000";
+    ASSERT_EQ(log_store->close(), 0);
+    {
+        std::fstream out(broken_index, std::ios::in | std::ios::out | std::ios::binary);
+        out.seekp(40);
+        out.put('x');
+        std::ofstream orphan(orphan_index);
+    }
+
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+    for (UInt64 i = 1; i <= 100; i++)
+    {
+        auto entry = log_store->getEntry(i);
+        ASSERT_NE(entry, nullptr);
+        ASSERT_EQ(entry->get_term(), i <= last_index_kept ? 1U : 2U);
+        ASSERT_EQ(getZookeeperCreateRequest(entry)->path, key);
+    }
+    ASSERT_FALSE(Poco::File(orphan_index).exists());
+    for (size_t i = 0; i < log_store->getClosedSegments().size(); i++)
+        ASSERT_TRUE(Poco::File(index_path(i)).exists());
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, compressedEntries)
+{
+    /// Large compressible data is compressed, small data is not
+    String large_data(4096, 'a');
+    auto large_entry = createLogEntry(1, "/a", large_data);
+    auto body = LogEntryBody::serialize(large_entry, true);
+    ASSERT_TRUE(body->data_begin()[0] & LogEntryBody::COMPRESSED_FLAG);
+    ASSERT_LT(body->size(), large_entry->get_buf().size());
+    auto parsed = LogEntryBody::parse(reinterpret_cast<const char *>(body->data_begin()), body->size());
+    ASSERT_EQ(parsed->get_val_type(), large_entry->get_val_type());
+    ASSERT_EQ(getZookeeperCreateRequest(parsed)->data, large_data);
+
+    auto small_entry = createLogEntry(1, "/a", "b");
+    body = LogEntryBody::serialize(small_entry, true);
+    ASSERT_FALSE(body->data_begin()[0] & LogEntryBody::COMPRESSED_FLAG);
+    ASSERT_EQ(body->size(), small_entry->get_buf().size() + 1);
+
+    String log_dir(LOG_DIR + "/18");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(65536, LogSegmentStore::MAX_SEGMENT_COUNT, false, false, false, true), 0);
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, "/a", i % 2 ? large_data : "b")), i + 1);
+    ASSERT_EQ(log_store->flush(), 100);
+    /// 50 large entries take 200KB uncompressed
+    ASSERT_TRUE(log_store->getClosedSegments().empty());
+    ASSERT_EQ(log_store->close(), 0);
+
+    /// Readable without compression enabled
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(65536, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+    for (UInt64 i = 1; i <= 100; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->data, i % 2 ? "b" : large_data);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, reclaimRemovedSegments)
+{
+    String log_dir(LOG_DIR + "/19");
+    cleanDirectory(log_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data)), i + 1);
+    ASSERT_GE(log_store->getClosedSegments().size(), 3);
+
+    auto count_files = [&](const String & prefix)
+    {
+        std::vector<String> files;
+        Poco::File(log_dir).list(files);
+        auto has_prefix = [&](const String & file) { return file.starts_with(prefix); };
+        return static_cast<size_t>(std::count_if(files.begin(), files.end(), has_prefix));
+    };
+
+    /// Index is updated at once, files are deleted in background
+    String removed_file = log_store->getClosedSegments()[0]->getFileName();
+    UInt64 first_index_kept = log_store->getClosedSegments()[2]->firstIndex();
+    size_t closed_count = log_store->getClosedSegments().size();
+    ASSERT_EQ(log_store->removeSegment(first_index_kept), 0);
+    ASSERT_EQ(log_store->firstLogIndex(), first_index_kept);
+    ASSERT_EQ(log_store->getClosedSegments().size(), closed_count - 2);
+
+    log_store->waitReclaimed();
+    ASSERT_FALSE(Poco::File(log_dir + "/" + removed_file).exists());
+    ASSERT_EQ(count_files(NuRaftLogSegment::REMOVED_FILE_PREFIX), 0U);
+    ASSERT_EQ(count_files("log_"), closed_count - 2 + 1);
+
+    /// A removed file left by restart is deleted when loading
+    ASSERT_EQ(log_store->close(), 0);
+    String left_file = log_dir + "/" + NuRaftLogSegment::REMOVED_FILE_PREFIX + "log_1_2_20230101000000";
+    std::ofstream(left_file) << String(100000, 'x');
+
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT), 0);
+    log_store->waitReclaimed();
+    ASSERT_FALSE(Poco::File(left_file).exists());
+    ASSERT_EQ(log_store->firstLogIndex(), first_index_kept);
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+    for (UInt64 i = first_index_kept; i <= 100; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, coldSegments)
+{
+    String log_dir(LOG_DIR + "/20");
+    String cold_dir(LOG_DIR + "/20_cold");
+    cleanDirectory(log_dir);
+    cleanDirectory(cold_dir);
+    auto log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT, false, false, false, false, cold_dir), 0);
+
+    String key("/ck/table/table1");
+    String data("CREATE TABLE table1;");
+    for (int i = 0; i < 100; i++)
+        ASSERT_EQ(log_store->appendEntry(createLogEntry(1, key, data)), i + 1);
+    ASSERT_GE(log_store->getClosedSegments().size(), 3);
+
+    /// The first two segments are moved, they are still readable
+    UInt64 last_cold_index = log_store->getClosedSegments()[1]->lastIndex();
+    log_store->offloadSegments(last_cold_index);
+    log_store->waitOffloaded();
+    log_store->waitReclaimed();
+    for (size_t i = 0; i < log_store->getClosedSegments().size(); i++)
+    {
+        const auto & segment = log_store->getClosedSegments()[i];
+        String file_name = segment->getFileName();
+        ASSERT_EQ(segment->getDir(), i < 2 ? cold_dir : log_dir);
+        ASSERT_TRUE(Poco::File(segment->getDir() + "/" + file_name).exists());
+        ASSERT_TRUE(Poco::File(segment->getDir() + "/" + NuRaftLogSegment::INDEX_FILE_PREFIX + file_name).exists());
+        ASSERT_EQ(Poco::File(log_dir + "/" + file_name).exists(), i >= 2);
+    }
+    for (UInt64 i = 1; i <= 100; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+
+    /// Cold segments are loaded again
+    size_t closed_count = log_store->getClosedSegments().size();
+    ASSERT_EQ(log_store->close(), 0);
+    log_store = LogSegmentStore::getInstance(log_dir, true);
+    ASSERT_EQ(log_store->init(4096, LogSegmentStore::MAX_SEGMENT_COUNT, false, false, false, false, cold_dir), 0);
+    ASSERT_EQ(log_store->getClosedSegments().size(), closed_count);
+    ASSERT_EQ(log_store->firstLogIndex(), 1);
+    ASSERT_EQ(log_store->lastLogIndex(), 100);
+    for (UInt64 i = 1; i <= 100; i++)
+        ASSERT_EQ(getZookeeperCreateRequest(log_store->getEntry(i))->path, key);
+
+    /// Removing works the same in the cold directory
+    ASSERT_EQ(log_store->removeSegment(last_cold_index + 1), 0);
+    log_store->waitReclaimed();
+    std::vector<String> cold_files;
+    Poco::File(cold_dir).list(cold_files);
+    ASSERT_TRUE(cold_files.empty());
+    ASSERT_EQ(log_store->close(), 0);
+    cleanDirectory(log_dir);
+    cleanDirectory(cold_dir);
+}
+
+TEST(RaftLog, fsyncGroup)
+{
+    String log_dir(LOG_DIR + "/21");
+    cleanDirectory(log_dir);
+    /// A group is flushed after 3 entries, 1024 bytes or 200ms
+    ptr<NuRaftFileLogStore> file_store = cs_new<NuRaftFileLogStore>(
+        log_dir,
+        true,
+        FsyncMode::FSYNC_GROUP,
+        3,
+        LogSegmentStore::MAX_SEGMENT_FILE_SIZE,
+        LogSegmentStore::MAX_SEGMENT_COUNT,
+        false,
+        false,
+        false,
+        LogEntryQueue::DEFAULT_MAX_ENTRIES,
+        LogEntryQueue::DEFAULT_MAX_BYTES,
+        false,
+        "",
+        0,
+        1024,
+        200000);
+
+    std::atomic<UInt64> flushed_index{0};
+    file_store->setFlushCallback([&](UInt64 index) { flushed_index = index; });
+
+    auto append = [&](const String & data)
+    {
+        ptr<log_entry> entry = createLogEntry(1, "/ck/table/table1", data);
+        UInt64 index = file_store->append(entry);
+        file_store->end_of_append_batch(index, 1);
+    };
+
+    /// Count limit
+    append("CREATE TABLE table1;");
+    append("CREATE TABLE table1;");
+    ASSERT_EQ(flushed_index, 0);
+    append("CREATE TABLE table1;");
+    ASSERT_EQ(flushed_index, 3);
+
+    /// Bytes limit
+    append(String(2000, 'x'));
+    ASSERT_EQ(flushed_index, 4);
+
+    /// Time limit
+    append("CREATE TABLE table1;");
+    ASSERT_EQ(flushed_index, 4);
+    for (int i = 0; i < 100 && flushed_index != 5; i++)
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    ASSERT_EQ(flushed_index, 5);
+
+    file_store->shutdown();
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftLog, inMemoryStorage)
+{
+    String log_dir(LOG_DIR + "/22");
+    cleanDirectory(log_dir);
+    auto storage = cs_new<InMemoryLogStorage>();
+    /// Log cache is disabled, so that entries are read from the storage
+    ptr<NuRaftFileLogStore> file_store = cs_new<NuRaftFileLogStore>(
+        log_dir,
+        true,
+        FsyncMode::FSYNC,
+        1000,
+        LogSegmentStore::MAX_SEGMENT_FILE_SIZE,
+        LogSegmentStore::MAX_SEGMENT_COUNT,
+        false,
+        false,
+        false,
+        0,
+        LogEntryQueue::DEFAULT_MAX_BYTES,
+        false,
+        "",
+        0,
+        4194304,
+        10000,
+        storage);
+    ASSERT_EQ(file_store->segmentStore(), nullptr);
+
+    for (int i = 0; i < 10; i++)
+    {
+        ptr<log_entry> entry = createLogEntry(1, "/ck/table/table" + std::to_string(i), "CREATE TABLE table;");
+        ASSERT_EQ(file_store->append(entry), i + 1);
+    }
+    file_store->end_of_append_batch(1, 10);
+    ASSERT_TRUE(file_store->flush());
+    ASSERT_EQ(file_store->next_slot(), 11);
+    ASSERT_EQ(file_store->last_durable_index(), 10);
+    ASSERT_EQ(getZookeeperCreateRequest(file_store->entry_at(5))->path, "/ck/table/table4");
+
+    /// Batch is limited by size, at least one entry is returned
+    auto entries = file_store->log_entries_ext(1, 11, NuRaftLogSegment::getBatchSize(file_store->entry_at(1)) * 3);
+    ASSERT_EQ(entries->size(), 3);
+    ASSERT_EQ(file_store->log_entries_ext(1, 11, 1)->size(), 1);
+
+    /// Limited by max_append_bytes if the follower gives no hint or a larger one
+    file_store->setMaxAppendBytes(NuRaftLogSegment::getBatchSize(file_store->entry_at(1)) * 2);
+    ASSERT_EQ(file_store->log_entries_ext(1, 11)->size(), 2);
+    ASSERT_EQ(file_store->log_entries_ext(1, 11, NuRaftLogSegment::getBatchSize(file_store->entry_at(1)) * 3)->size(), 2);
+    ASSERT_EQ(file_store->log_entries_ext(1, 11, 1)->size(), 1);
+    file_store->setMaxAppendBytes(0);
+    ASSERT_EQ(file_store->log_entries_ext(1, 11)->size(), 10);
+
+    /// Overwrite the tail
+    ptr<log_entry> entry = createLogEntry(2, "/ck/table/table_new", "CREATE TABLE table;");
+    file_store->write_at(8, entry);
+    ASSERT_EQ(file_store->next_slot(), 9);
+    ASSERT_EQ(file_store->term_at(8), 2);
+    ASSERT_EQ(file_store->entry_at(9), nullptr);
+
+    file_store->compact(3);
+    ASSERT_EQ(file_store->start_index(), 4);
+    ASSERT_EQ(file_store->entry_at(3), nullptr);
+    ASSERT_EQ(getZookeeperCreateRequest(file_store->entry_at(4))->path, "/ck/table/table3");
+
+    /// Compacted beyond the last entry, as when a snapshot is installed
+    file_store->compact(20);
+    ASSERT_EQ(file_store->start_index(), 21);
+    ASSERT_EQ(file_store->next_slot(), 21);
+    ASSERT_EQ(storage->getLogBytes(), 0);
+
+    file_store->shutdown();
+    cleanDirectory(log_dir);
+}
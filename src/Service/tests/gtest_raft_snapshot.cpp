@@ -1,8 +1,13 @@
+#include <cstring>
+#include <fstream>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <Poco/File.h>
 #include <Service/ACLMap.h>
 #include <Service/KeeperStore.h>
 #include <Service/KeeperCommon.h>
+#include <Service/KeeperUtils.h>
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftLogSnapshot.h>
 #include <Service/Settings.h>
@@ -244,7 +249,7 @@ void assertStateMachineEquals(KeeperStore & storage, KeeperStore & ano_storage)
 
 
     /// assert data tree
-    for (uint32_t i = 0; i < KeeperStore::DATA_TREE_BUCKET_NUM; i++)
+    for (uint32_t i = 0; i < storage.getDataTreeBucketNum(); i++)
     {
         auto & map = storage.getDataTree().getMap(i);
         auto & ano_map = ano_storage.getDataTree().getMap(i);
@@ -288,11 +293,13 @@ void assertStateMachineEquals(KeeperStore & storage, KeeperStore & ano_storage)
         }
     };
 
-    filter_auth(storage.session_and_auth);
-    filter_auth(ano_storage.session_and_auth);
+    auto session_and_auth = storage.getSessionAndAuth();
+    auto ano_session_and_auth = ano_storage.getSessionAndAuth();
+    filter_auth(session_and_auth);
+    filter_auth(ano_session_and_auth);
 
     /// assert session_and_auth
-    ASSERT_EQ(storage.session_and_auth, ano_storage.session_and_auth);
+    ASSERT_EQ(session_and_auth, ano_session_and_auth);
 
     /// assert acl
     ASSERT_EQ(storage.acl_map, ano_storage.acl_map);
@@ -303,7 +310,7 @@ void assertStateMachineEquals(KeeperStore & storage, KeeperStore & ano_storage)
 TEST(RaftSnapshot, parseAndSerializeKeeperNode)
 {
     String path = "/parseAndSerializeKeeperNode";
-    ptr<KeeperNode> node = cs_new<KeeperNode>();
+    KeeperNodePtr node = KeeperNode::create();
     node->data = "some_data";
     node->acl_id = 0;
     node->is_ephemeral = true;
@@ -317,7 +324,6 @@ TEST(RaftSnapshot, parseAndSerializeKeeperNode)
     node->stat.cversion = 1;
     node->stat.aversion = 1;
     node->stat.ephemeralOwner = 1;
-    node->stat.dataLength = 9;
     node->stat.numChildren = 2;
     node->stat.pzxid = 1;
 
@@ -334,6 +340,7 @@ TEST(RaftSnapshot, parseAndSerializeKeeperNode)
     test(V0);
     test(V1);
     test(V2);
+    test(V3);
 }
 
 TEST(RaftSnapshot, createSnapshot_1)
@@ -378,6 +385,722 @@ TEST(RaftSnapshot, createSnapshot_2)
     cleanDirectory(snap_dir);
 }
 
+TEST(RaftSnapshot, pinDataTree)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    for (int i = 0; i < 100; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i));
+
+    auto find_pinned = [](const KeeperStore::DataTree::Version & version, const String & path) -> KeeperNodePtr
+    {
+        for (const auto & bucket : version.getBuckets())
+        {
+            auto it = bucket->getMap().find(path);
+            if (it != bucket->getMap().end())
+                return it->second;
+        }
+        return nullptr;
+    };
+
+    auto pinned = store.pinDataTree();
+    for (int i = 100; i < 200; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i));
+
+    size_t pinned_count = 0;
+    for (const auto & bucket : pinned->getBuckets())
+        pinned_count += bucket->size();
+    ASSERT_EQ(pinned_count, 101);
+    ASSERT_EQ(store.getNodesCount(), 201);
+
+    /// Root is updated by copy, the pinned one keeps the old stat
+    ASSERT_EQ(find_pinned(*pinned, "/")->stat.numChildren, 100);
+    ASSERT_EQ(store.getNode("/")->stat.numChildren, 200);
+    ASSERT_EQ(store.getNode("/")->children.size(), 200);
+    ASSERT_EQ(find_pinned(*pinned, "/150"), nullptr);
+
+    /// Nodes are updated in place when there is no pinned version
+    pinned.reset();
+    auto root = store.getNode("/");
+    setNode(store, "200", "table_200");
+    ASSERT_EQ(store.getNode("/").get(), root.get());
+    ASSERT_EQ(root->stat.numChildren, 201);
+}
+
+TEST(RaftSnapshot, incrementalDataSize)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    for (int i = 0; i < 100; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i), /* is_ephemeral */ i % 2, /* session_id */ 1 + i % 3);
+
+    auto walked_data_size = [&]
+    {
+        size_t res = 0;
+        for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
+            for (const auto & [path, node] : store.getDataTree().getMap(i).getMap())
+                res += path.size() + getBaseName(path).size() + node->data.size();
+        return res;
+    };
+
+    size_t data_size = 0;
+    for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
+        data_size += store.getBucketDataSize(i);
+
+    ASSERT_EQ(data_size, walked_data_size());
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 50);
+
+    store.reset();
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 0);
+    for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
+        ASSERT_EQ(store.getBucketDataSize(i), 0);
+}
+
+TEST(RaftSnapshot, multiTxnRollback)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    setNode(store, "a", "value_a");
+    setNode(store, "b", "value_b", /* is_ephemeral */ true, /* session_id */ 1);
+
+    auto nodes_count = store.getNodesCount();
+    auto data_size = store.getDataTree().getDataSize();
+    auto root_cversion = store.getNode("/")->stat.cversion;
+    auto root_mzxid = store.getNode("/")->stat.mzxid;
+
+    auto request = cs_new<ZooKeeperMultiRequest>();
+    {
+        /// Parent of the nodes created and removed below, its children are kept by undo
+        auto set_root = cs_new<ZooKeeperSetRequest>();
+        set_root->path = "/";
+        set_root->data = "value_root";
+        request->requests.push_back(set_root);
+
+        auto set = cs_new<ZooKeeperSetRequest>();
+        set->path = "/a";
+        set->data = "new_value_a";
+        request->requests.push_back(set);
+
+        auto create = cs_new<ZooKeeperCreateRequest>();
+        create->path = "/c";
+        create->data = "value_c";
+        request->requests.push_back(create);
+
+        auto remove = cs_new<ZooKeeperRemoveRequest>();
+        remove->path = "/b";
+        request->requests.push_back(remove);
+
+        /// Fails, so that all the above is reverted
+        auto create_exists = cs_new<ZooKeeperCreateRequest>();
+        create_exists->path = "/a";
+        request->requests.push_back(create_exists);
+    }
+    request->xid = 1;
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+    ResponseForSession response;
+    ASSERT_TRUE(responses_queue.tryPop(response));
+    const auto & multi_response = dynamic_cast<ZooKeeperMultiResponse &>(*response.response);
+    ASSERT_EQ(multi_response.responses.size(), 5);
+    ASSERT_EQ(multi_response.responses[0]->error, Error::ZOK);
+    ASSERT_EQ(multi_response.responses[4]->error, Error::ZNODEEXISTS);
+
+    ASSERT_EQ(store.getNodesCount(), nodes_count);
+    ASSERT_EQ(store.getDataTree().getDataSize(), data_size);
+    ASSERT_EQ(store.getNode("/a")->data, "value_a");
+    ASSERT_EQ(store.getNode("/a")->stat.version, 0);
+    ASSERT_EQ(store.getNode("/c"), nullptr);
+    ASSERT_NE(store.getNode("/b"), nullptr);
+    ASSERT_EQ(store.getNode("/")->stat.cversion, root_cversion);
+    ASSERT_EQ(store.getNode("/")->stat.mzxid, root_mzxid);
+    ASSERT_EQ(store.getNode("/")->stat.version, 0);
+    ASSERT_TRUE(store.getNode("/")->data.empty());
+    ASSERT_EQ(store.getNode("/")->children.size(), 2);
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 1);
+}
+
+TEST(RaftSnapshot, parallelApply)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore serial_store(raft_settings->dead_session_check_period_ms);
+    KeeperStore parallel_store(raft_settings->dead_session_check_period_ms);
+
+    static constexpr int tables = 8;
+    for (int i = 0; i < tables; i++)
+    {
+        setNode(serial_store, "t" + std::to_string(i), "");
+        setNode(parallel_store, "t" + std::to_string(i), "");
+    }
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    std::vector<RequestForSession> requests;
+    auto add_request = [&](const ZooKeeperRequestPtr & request)
+    {
+        request->xid = static_cast<XID>(requests.size() + 1);
+        requests.push_back({request, 1, time});
+    };
+
+    for (int j = 0; j < 10; j++)
+    {
+        for (int i = 0; i < tables; i++)
+        {
+            String path = "/t" + std::to_string(i) + "/" + std::to_string(j);
+
+            auto create = cs_new<ZooKeeperCreateRequest>();
+            create->path = path;
+            add_request(create);
+
+            auto set = cs_new<ZooKeeperSetRequest>();
+            set->path = path;
+            set->data = "value_" + std::to_string(j);
+            add_request(set);
+
+            /// Fails for the existing node
+            auto create_exists = cs_new<ZooKeeperCreateRequest>();
+            create_exists->path = path;
+            add_request(create_exists);
+        }
+
+        /// Sequential create is applied alone
+        auto create_sequential = cs_new<ZooKeeperCreateRequest>();
+        create_sequential->path = "/t0/seq-";
+        create_sequential->is_sequential = true;
+        add_request(create_sequential);
+
+        auto multi = cs_new<ZooKeeperMultiRequest>();
+        {
+            auto remove = cs_new<ZooKeeperRemoveRequest>();
+            remove->path = "/t1/" + std::to_string(j);
+            multi->requests.push_back(remove);
+
+            auto create = cs_new<ZooKeeperCreateRequest>();
+            create->path = "/t2/multi_" + std::to_string(j);
+            multi->requests.push_back(create);
+        }
+        add_request(multi);
+    }
+
+    KeeperStore::KeeperResponsesQueue serial_responses;
+    for (const auto & request : requests)
+        serial_store.processRequest(serial_responses, request);
+
+    KeeperStore::KeeperResponsesQueue parallel_responses;
+    ThreadPool thread_pool(4);
+    parallel_store.processRequests(parallel_responses, requests, thread_pool);
+
+    ASSERT_EQ(serial_store.getZxid(), parallel_store.getZxid());
+    ASSERT_EQ(serial_store.getNodesCount(), parallel_store.getNodesCount());
+    ASSERT_EQ(serial_store.getDataTree().getDataSize(), parallel_store.getDataTree().getDataSize());
+
+    ResponseForSession serial_response;
+    ResponseForSession parallel_response;
+    while (serial_responses.tryPop(serial_response))
+    {
+        ASSERT_TRUE(parallel_responses.tryPop(parallel_response));
+        ASSERT_EQ(serial_response.response->xid, parallel_response.response->xid);
+        ASSERT_EQ(serial_response.response->zxid, parallel_response.response->zxid);
+        ASSERT_EQ(serial_response.response->error, parallel_response.response->error);
+    }
+    ASSERT_FALSE(parallel_responses.tryPop(parallel_response));
+
+    for (int i = 0; i < tables; i++)
+    {
+        String table_path = "/t" + std::to_string(i);
+        auto serial_table = serial_store.getNode(table_path);
+        auto parallel_table = parallel_store.getNode(table_path);
+        ASSERT_EQ(serial_table->stat, parallel_table->stat);
+        ASSERT_EQ(*serial_table, *parallel_table);
+
+        for (const auto & child : serial_table->children)
+        {
+            auto serial_node = serial_store.getNode(table_path + "/" + child);
+            auto parallel_node = parallel_store.getNode(table_path + "/" + child);
+            ASSERT_NE(parallel_node, nullptr);
+            ASSERT_EQ(serial_node->stat, parallel_node->stat);
+            ASSERT_EQ(serial_node->data, parallel_node->data);
+        }
+    }
+}
+
+TEST(RaftSnapshot, parallelApplyRemoveLastACLUsage)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore serial_store(raft_settings->dead_session_check_period_ms);
+    KeeperStore parallel_store(raft_settings->dead_session_check_period_ms);
+
+    static constexpr int tables = 8;
+    static constexpr int rounds = 20;
+    for (int i = 0; i < tables; i++)
+    {
+        setNode(serial_store, "t" + std::to_string(i), "");
+        setNode(parallel_store, "t" + std::to_string(i), "");
+    }
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    std::vector<RequestForSession> requests;
+    auto add_request = [&](const ZooKeeperRequestPtr & request)
+    {
+        request->xid = static_cast<XID>(requests.size() + 1);
+        requests.push_back({request, 1, time});
+    };
+    auto acls_of = [](int j) { return ACLs{ACL{ACL::All, "digest", "user" + std::to_string(j) + ":password"}}; };
+
+    /// Every node before the run is the only user of its ACLs
+    for (int j = 0; j < rounds; j++)
+    {
+        auto create = cs_new<ZooKeeperCreateRequest>();
+        create->path = "/t0/" + std::to_string(j);
+        create->acls = acls_of(j);
+        add_request(create);
+    }
+    KeeperStore::KeeperResponsesQueue serial_responses;
+    KeeperStore::KeeperResponsesQueue parallel_responses;
+    for (const auto & request : requests)
+    {
+        serial_store.processRequest(serial_responses, request);
+        parallel_store.processRequest(parallel_responses, request);
+    }
+    requests.clear();
+
+    /// Remove the last user of the ACLs while nodes of other tables take them
+    for (int j = 0; j < rounds; j++)
+    {
+        auto remove = cs_new<ZooKeeperRemoveRequest>();
+        remove->path = "/t0/" + std::to_string(j);
+        add_request(remove);
+
+        for (int i = 1; i < tables; i++)
+        {
+            auto create = cs_new<ZooKeeperCreateRequest>();
+            create->path = "/t" + std::to_string(i) + "/" + std::to_string(j);
+            create->acls = acls_of(i % 2 ? j : j + rounds);
+            add_request(create);
+        }
+    }
+
+    for (const auto & request : requests)
+        serial_store.processRequest(serial_responses, request);
+    ThreadPool thread_pool(4);
+    parallel_store.processRequests(parallel_responses, requests, thread_pool);
+
+    ASSERT_EQ(serial_store.getZxid(), parallel_store.getZxid());
+    ASSERT_EQ(serial_store.getNodesCount(), parallel_store.getNodesCount());
+    ASSERT_EQ(serial_store.acl_map, parallel_store.acl_map);
+
+    for (int i = 1; i < tables; i++)
+    {
+        for (int j = 0; j < rounds; j++)
+        {
+            String path = "/t" + std::to_string(i) + "/" + std::to_string(j);
+            auto serial_node = serial_store.getNode(path);
+            auto parallel_node = parallel_store.getNode(path);
+            ASSERT_NE(parallel_node, nullptr);
+            ASSERT_EQ(serial_node->acl_id, parallel_node->acl_id);
+            ASSERT_EQ(*parallel_store.acl_map.convertNumber(parallel_node->acl_id), acls_of(i % 2 ? j : j + rounds));
+        }
+    }
+}
+
+TEST(RaftSnapshot, parallelMultiRead)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore serial_store(raft_settings->dead_session_check_period_ms);
+    KeeperStore parallel_store(raft_settings->dead_session_check_period_ms);
+    parallel_store.enableParallelMultiRead(4, 16);
+
+    for (int i = 0; i < 100; i++)
+    {
+        setNode(serial_store, std::to_string(i), "value_" + std::to_string(i));
+        setNode(parallel_store, std::to_string(i), "value_" + std::to_string(i));
+    }
+
+    auto request = cs_new<ZooKeeperMultiRequest>();
+    request->operation_type = ZooKeeperMultiRequest::OperationType::Read;
+    for (int i = 0; i < 300; i++)
+    {
+        /// A third of them are missing
+        String path = "/" + std::to_string(i % 150);
+        if (i % 2)
+        {
+            auto get = cs_new<ZooKeeperGetRequest>();
+            get->path = path;
+            request->requests.push_back(get);
+        }
+        else
+        {
+            auto exists = cs_new<ZooKeeperExistsRequest>();
+            exists->path = path;
+            request->requests.push_back(exists);
+        }
+    }
+    request->xid = 1;
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    KeeperStore::KeeperResponsesQueue serial_responses;
+    serial_store.processRequest(serial_responses, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+    KeeperStore::KeeperResponsesQueue parallel_responses;
+    parallel_store.processRequest(parallel_responses, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+    ResponseForSession serial_response;
+    ResponseForSession parallel_response;
+    ASSERT_TRUE(serial_responses.tryPop(serial_response));
+    ASSERT_TRUE(parallel_responses.tryPop(parallel_response));
+    ASSERT_EQ(parallel_response.response->getOpNum(), OpNum::MultiRead);
+
+    const auto & serial_multi = dynamic_cast<ZooKeeperMultiResponse &>(*serial_response.response);
+    const auto & parallel_multi = dynamic_cast<ZooKeeperMultiResponse &>(*parallel_response.response);
+    ASSERT_EQ(parallel_multi.error, Error::ZOK);
+    ASSERT_EQ(serial_multi.responses.size(), parallel_multi.responses.size());
+    for (size_t i = 0; i < serial_multi.responses.size(); i++)
+    {
+        ASSERT_EQ(serial_multi.responses[i]->getOpNum(), parallel_multi.responses[i]->getOpNum());
+        ASSERT_EQ(serial_multi.responses[i]->error, parallel_multi.responses[i]->error);
+        ASSERT_EQ(parallel_multi.responses[i]->error, i % 150 < 100 ? Error::ZOK : Error::ZNONODE);
+        if (const auto * get = dynamic_cast<const ZooKeeperGetResponse *>(parallel_multi.responses[i].get()))
+            ASSERT_EQ(get->data, "value_" + std::to_string(i % 150));
+    }
+}
+
+TEST(RaftSnapshot, listWithData)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    setNode(store, "dir", "");
+    std::set<String> expected;
+    for (int i = 0; i < 300; i++)
+    {
+        setNode(store, "dir/child_" + std::to_string(i), "value_" + std::to_string(i));
+        expected.insert("child_" + std::to_string(i));
+    }
+
+    /// Not readable by the session
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    auto create = cs_new<ZooKeeperCreateRequest>();
+    create->path = "/dir/secret";
+    create->data = "secret";
+    create->acls = {ACL{ACL::Write, "world", "anyone"}};
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    store.processRequest(responses_queue, {create, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    expected.insert("secret");
+
+    auto list = [&](const String & start_after, int32_t max_children, int32_t max_bytes)
+    {
+        auto request = cs_new<ZooKeeperListWithDataRequest>();
+        request->path = "/dir";
+        request->start_after = start_after;
+        request->max_children = max_children;
+        request->max_bytes = max_bytes;
+        store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+        ResponseForSession response;
+        EXPECT_TRUE(responses_queue.tryPop(response));
+        EXPECT_EQ(response.response->error, Error::ZOK);
+        return std::dynamic_pointer_cast<ZooKeeperListWithDataResponse>(response.response);
+    };
+
+    Strings walked;
+    String start_after;
+    size_t pages = 0;
+    while (true)
+    {
+        auto response = list(start_after, 64, 0);
+        ASSERT_EQ(response->stat.numChildren, 301);
+        ASSERT_LE(response->children.size(), size_t(64));
+        for (const auto & child : response->children)
+        {
+            walked.push_back(child.name);
+            if (child.name == "secret")
+            {
+                ASSERT_EQ(child.error, Error::ZNOAUTH);
+                ASSERT_TRUE(child.data.empty());
+            }
+            else
+            {
+                ASSERT_EQ(child.error, Error::ZOK);
+                ASSERT_EQ(child.data, "value_" + child.name.substr(strlen("child_")));
+                ASSERT_EQ(child.stat.dataLength, static_cast<int32_t>(child.data.size()));
+            }
+        }
+        ++pages;
+        if (!response->has_more)
+            break;
+        start_after = response->children.back().name;
+    }
+    ASSERT_EQ(walked, Strings(expected.begin(), expected.end()));
+    ASSERT_EQ(pages, size_t(5));
+
+    /// A page has one child at least
+    auto response = list("", 0, 1);
+    ASSERT_EQ(response->children.size(), size_t(1));
+    ASSERT_TRUE(response->has_more);
+
+    response = list("secret", 0, 0);
+    ASSERT_TRUE(response->children.empty());
+    ASSERT_FALSE(response->has_more);
+}
+
+TEST(RaftSnapshot, pagedList)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    setNode(store, "dir", "");
+    std::set<String> expected;
+    for (int i = 0; i < 300; i++)
+    {
+        setNode(store, "dir/child_" + std::to_string(i), "");
+        expected.insert("child_" + std::to_string(i));
+    }
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto list = [&](const String & start_after, int32_t limit)
+    {
+        auto request = cs_new<ZooKeeperPagedListRequest>();
+        request->path = "/dir";
+        request->start_after = start_after;
+        request->limit = limit;
+        store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+        ResponseForSession response;
+        EXPECT_TRUE(responses_queue.tryPop(response));
+        EXPECT_EQ(response.response->error, Error::ZOK);
+        return std::dynamic_pointer_cast<ZooKeeperPagedListResponse>(response.response);
+    };
+
+    Strings walked;
+    String start_after;
+    size_t pages = 0;
+    while (true)
+    {
+        auto response = list(start_after, 70);
+        ASSERT_EQ(response->stat.numChildren, 300);
+        ASSERT_LE(response->names.size(), size_t(70));
+        for (const auto & name : response->names.toStrings())
+            walked.push_back(name);
+        ++pages;
+        if (!response->has_more)
+            break;
+        start_after = walked.back();
+    }
+    ASSERT_EQ(walked, Strings(expected.begin(), expected.end()));
+    ASSERT_EQ(pages, size_t(5));
+
+    /// No limit is the server limit
+    auto response = list("", 0);
+    ASSERT_EQ(response->names.size(), size_t(300));
+    ASSERT_FALSE(response->has_more);
+
+    response = list("child_99", 10);
+    ASSERT_EQ(response->names.size(), size_t(0));
+    ASSERT_FALSE(response->has_more);
+}
+
+TEST(RaftSnapshot, statBatch)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    setNode(store, "a", String(1000, 'a'));
+    setNode(store, "b", "");
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto request = cs_new<ZooKeeperStatBatchRequest>();
+    request->paths = {"/a", "/missing", "/b"};
+    store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+    ResponseForSession response;
+    ASSERT_TRUE(responses_queue.tryPop(response));
+    ASSERT_EQ(response.response->error, Error::ZOK);
+    const auto & stats = dynamic_cast<const ZooKeeperStatBatchResponse &>(*response.response).stats;
+    ASSERT_EQ(stats.size(), size_t(3));
+    ASSERT_EQ(stats[0].error, Error::ZOK);
+    ASSERT_EQ(stats[0].stat, store.getNode("/a")->statForResponse());
+    ASSERT_EQ(stats[0].stat.dataLength, 1000);
+    ASSERT_EQ(stats[1].error, Error::ZNONODE);
+    ASSERT_EQ(stats[2].error, Error::ZOK);
+    ASSERT_EQ(stats[2].stat, store.getNode("/b")->statForResponse());
+}
+
+TEST(RaftSnapshot, readOnlySession)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    setNode(store, "a", "value");
+
+    /// Not known by the store
+    int64_t session_id = (int64_t(1) << 62) | 1;
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    auto get = cs_new<ZooKeeperGetRequest>();
+    get->path = "/a";
+    get->has_watch = true;
+
+    RequestForSession request{get, session_id, time};
+    store.processRequest(responses_queue, request, {}, /* check_acl = */ true, /*ignore_response*/ false);
+    ResponseForSession response;
+    ASSERT_FALSE(responses_queue.tryPop(response));
+
+    request.read_only_session = true;
+    store.processRequest(responses_queue, request, {}, /* check_acl = */ true, /*ignore_response*/ false);
+    ASSERT_TRUE(responses_queue.tryPop(response));
+    ASSERT_EQ(response.response->error, Error::ZOK);
+    ASSERT_EQ(dynamic_cast<const ZooKeeperGetResponse &>(*response.response).data, "value");
+    ASSERT_EQ(store.getSessionsWithWatchesCount(), uint64_t(1));
+
+    store.closeReadOnlySession(session_id);
+    ASSERT_EQ(store.getSessionsWithWatchesCount(), uint64_t(0));
+}
+
+TEST(RaftSnapshot, removeRecursive)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    setNode(store, "dir", "");
+    setNode(store, "dir/a", "");
+    setNode(store, "dir/a/b", "");
+    setNode(store, "dir/a/ephemeral", "", /* is_ephemeral = */ true, 1);
+    setNode(store, "dir/c", "");
+    setNode(store, "other", "");
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+
+    /// Data watch of a removed node and list watch of the parent of the subtree
+    auto get = cs_new<ZooKeeperGetRequest>();
+    get->path = "/dir/a/b";
+    get->has_watch = true;
+    store.processRequest(responses_queue, {get, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    auto list = cs_new<ZooKeeperListRequest>();
+    list->path = "/";
+    list->has_watch = true;
+    store.processRequest(responses_queue, {list, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+
+    auto remove = [&](const String & path, uint32_t limit)
+    {
+        auto request = cs_new<ZooKeeperRemoveRecursiveRequest>();
+        request->path = path;
+        request->remove_nodes_limit = limit;
+        store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+
+        std::vector<ResponseForSession> responses;
+        ResponseForSession response;
+        while (responses_queue.tryPop(response))
+            responses.push_back(response);
+        return responses;
+    };
+
+    /// Too many nodes, nothing is removed
+    auto responses = remove("/dir", 4);
+    ASSERT_EQ(responses.size(), size_t(1));
+    ASSERT_EQ(responses[0].response->error, Error::ZNOTEMPTY);
+    ASSERT_TRUE(store.getNode("/dir/a/b"));
+
+    responses = remove("/dir", 5);
+    ASSERT_EQ(responses.size(), size_t(3));
+    std::set<String> watch_paths;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const auto & watch_response = dynamic_cast<const ZooKeeperWatchResponse &>(*responses[i].response);
+        watch_paths.insert(watch_response.path);
+    }
+    ASSERT_EQ(watch_paths, std::set<String>({"/", "/dir/a/b"}));
+    ASSERT_EQ(responses[2].response->error, Error::ZOK);
+
+    for (const auto * path : {"/dir", "/dir/a", "/dir/a/b", "/dir/a/ephemeral", "/dir/c"})
+        ASSERT_FALSE(store.getNode(path)) << path;
+    ASSERT_TRUE(store.getNode("/other"));
+    ASSERT_EQ(store.getNode("/")->stat.numChildren, 1);
+    ASSERT_EQ(store.getNode("/")->children.size(), size_t(1));
+
+    responses = remove("/dir", 5);
+    ASSERT_EQ(responses[0].response->error, Error::ZNONODE);
+    responses = remove("/", 100);
+    ASSERT_EQ(responses[0].response->error, Error::ZBADARGUMENTS);
+}
+
+TEST(RaftSnapshot, ttlAndContainerNodes)
+{
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    auto & expiry_index = store.getNodeExpiryIndex();
+
+    int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+    KeeperStore::KeeperResponsesQueue responses_queue;
+
+    auto process = [&](const ZooKeeperRequestPtr & request, int64_t create_time)
+    {
+        store.processRequest(responses_queue, {request, 1, create_time}, {}, /* check_acl = */ true, /*ignore_response*/ false);
+        ResponseForSession response;
+        ResponseForSession last;
+        while (responses_queue.tryPop(response))
+            last = response;
+        return last.response;
+    };
+    auto create = [&](const String & path, OpNum op_num, int64_t ttl = 0)
+    {
+        auto request = cs_new<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->op_num = op_num;
+        request->is_container = op_num == OpNum::CreateContainer;
+        request->is_ttl = op_num == OpNum::CreateTTL;
+        request->ttl = ttl;
+        return process(request, time);
+    };
+    auto remove = [&](const String & path)
+    {
+        auto request = cs_new<ZooKeeperRemoveRequest>();
+        request->path = path;
+        return process(request, time);
+    };
+    auto remove_expired = [&](const Strings & paths, int64_t create_time)
+    {
+        auto request = cs_new<ZooKeeperRemoveExpiredRequest>();
+        request->paths = paths;
+        process(request, create_time);
+    };
+
+    ASSERT_EQ(create("/ttl", OpNum::CreateTTL, 0)->error, Error::ZBADARGUMENTS);
+    ASSERT_EQ(create("/ttl", OpNum::CreateTTL, 1000)->error, Error::ZOK);
+    auto created = std::dynamic_pointer_cast<ZooKeeperCreateResponse>(create("/container", OpNum::CreateContainer));
+    ASSERT_EQ(created->error, Error::ZOK);
+    ASSERT_EQ(created->getOpNum(), OpNum::Create2);
+    ASSERT_TRUE(isContainerOwner(created->stat.ephemeralOwner));
+    ASSERT_EQ(expiry_index.ttlNodesCount(), size_t(1));
+    /// A container never had a child is not removed
+    ASSERT_EQ(expiry_index.emptyContainersCount(), size_t(0));
+
+    ASSERT_EQ(create("/container/child", OpNum::Create)->error, Error::ZOK);
+    ASSERT_EQ(create("/ttl/child", OpNum::Create)->error, Error::ZOK);
+    ASSERT_EQ(expiry_index.ttlNodesCount(), size_t(0));
+    ASSERT_EQ(remove("/container/child")->error, Error::ZOK);
+    ASSERT_EQ(expiry_index.emptyContainersCount(), size_t(1));
+
+    /// TTL node with a child and not expired one are kept
+    remove_expired({"/ttl", "/container"}, time + 2000);
+    ASSERT_TRUE(store.getNode("/ttl"));
+    ASSERT_FALSE(store.getNode("/container"));
+    ASSERT_EQ(remove("/ttl/child")->error, Error::ZOK);
+    remove_expired({"/ttl"}, time + 500);
+    ASSERT_TRUE(store.getNode("/ttl"));
+    remove_expired({"/ttl"}, time + 1000);
+    ASSERT_FALSE(store.getNode("/ttl"));
+
+    ASSERT_EQ(expiry_index.ttlNodesCount(), size_t(0));
+    ASSERT_EQ(expiry_index.emptyContainersCount(), size_t(0));
+    ASSERT_EQ(store.getNode("/")->stat.numChildren, 0);
+}
+
 TEST(RaftSnapshot, readAndSaveSnapshot)
 {
     String snap_read_dir(SNAP_DIR + "/3");
@@ -430,6 +1153,215 @@ TEST(RaftSnapshot, readAndSaveSnapshot)
 }
 
 
+TEST(RaftSnapshot, readAndSaveSnapshotInChunks)
+{
+    String snap_read_dir(SNAP_DIR + "/8");
+    String snap_save_dir(SNAP_DIR + "/9");
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+
+    UInt32 last_index = 1024;
+    UInt32 term = 1;
+    KeeperSnapshotManager snap_mgr_read(snap_read_dir, 3, 100);
+    KeeperSnapshotManager snap_mgr_save(snap_save_dir, 3, 100);
+
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+
+    for (int i = 0; i < last_index; i++)
+    {
+        String key = std::to_string(i + 1);
+        String value = "table_" + key;
+        setNode(store, key, value);
+    }
+    snapshot meta(last_index, term, config);
+    size_t object_size = snap_mgr_read.createSnapshot(meta, store);
+
+    /// Chunks are smaller than objects, so that every object takes a few of them
+    const UInt64 chunk_size = 1000;
+    snap_mgr_save.receiveSnapshotMeta(meta);
+    size_t chunk_count = 0;
+    for (ulong obj_id = 1; snap_mgr_read.existSnapshotObject(meta, obj_id); obj_id++)
+    {
+        bool last_chunk = false;
+        for (UInt64 chunk_index = 0; !last_chunk; chunk_index++)
+        {
+            ptr<buffer> chunk;
+            last_chunk = snap_mgr_read.loadSnapshotObjectChunk(meta, obj_id, chunk_index * chunk_size, chunk_size, chunk);
+            ASSERT_LE(chunk->size(), SnapshotChunkHeader::HEADER_SIZE + chunk_size);
+            ASSERT_EQ(snap_mgr_save.existSnapshotObject(meta, obj_id), false);
+            ASSERT_EQ(snap_mgr_save.saveSnapshotObjectChunk(meta, obj_id, *chunk), last_chunk);
+            chunk_count++;
+        }
+        ASSERT_TRUE(snap_mgr_save.existSnapshotObject(meta, obj_id));
+    }
+    ASSERT_GT(chunk_count, object_size);
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr_save.parseSnapshot(meta, new_store));
+    ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+
+    cleanDirectory(snap_read_dir);
+    cleanDirectory(snap_save_dir);
+}
+
+TEST(RaftSnapshot, incrementalSnapshot)
+{
+    String snap_dir(SNAP_DIR + "/10");
+    String snap_save_dir(SNAP_DIR + "/11");
+    cleanDirectory(snap_dir);
+    cleanDirectory(snap_save_dir);
+
+    /// Keep only the latest snapshot, the ones it is based on are kept too
+    KeeperSnapshotManager snap_mgr(snap_dir, 1, 30, /* incremental_snapshot_count */ 2);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(
+        raft_settings->dead_session_check_period_ms, "", KeeperStore::DEFAULT_DATA_TREE_BUCKET_NUM, 0, false, /* track_dirty_nodes */ true);
+
+    auto process = [&](const ZooKeeperRequestPtr & request)
+    {
+        request->xid = 1;
+        KeeperStore::KeeperResponsesQueue responses_queue;
+        int64_t time = std::chrono::system_clock::now().time_since_epoch() / std::chrono::milliseconds(1);
+        store.processRequest(responses_queue, {request, 1, time}, {}, /* check_acl = */ true, /*ignore_response*/ true);
+    };
+
+    auto create_snapshot = [&](UInt64 index)
+    {
+        auto meta = cs_new<snapshot>(index, 1, config);
+        nuraft::async_result<bool>::handler_type when_done = [](bool &, nuraft::ptr<std::exception> &) {};
+        SnapTask snap_task(meta, store, when_done);
+        snap_mgr.createSnapshotAsync(snap_task, V3);
+        snap_mgr.removeSnapshots();
+        return snap_task.dirty_nodes != nullptr;
+    };
+
+    auto assert_loaded = [&](UInt64 index)
+    {
+        snapshot meta(index, 1, config);
+        KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+        ASSERT_TRUE(snap_mgr.parseSnapshot(meta, new_store));
+        ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+        for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
+        {
+            for (const auto & [path, node] : store.getDataTree().getMap(i).getMap())
+            {
+                auto new_node = new_store.getNode(path);
+                ASSERT_NE(new_node, nullptr) << path;
+                ASSERT_EQ(new_node->data, node->data);
+                ASSERT_EQ(new_node->stat, node->stat);
+                ASSERT_EQ(new_node->children, node->children);
+            }
+        }
+        ASSERT_EQ(new_store.getEphemerals(), store.getEphemerals());
+        ASSERT_EQ(new_store.getZxid(), store.getZxid());
+        ASSERT_EQ(new_store.getSessionAndTimeOut(), store.getSessionAndTimeOut());
+    };
+
+    for (int i = 0; i < 100; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i), /* is_ephemeral */ i % 10 == 0, /* session_id */ 1);
+
+    /// Dirty nodes are unknown for the first one, so it is full
+    ASSERT_FALSE(create_snapshot(1));
+    assert_loaded(1);
+
+    /// Update, create and remove a few nodes
+    auto set = cs_new<ZooKeeperSetRequest>();
+    set->path = "/1";
+    set->data = "new_value_1";
+    process(set);
+    setNode(store, "1/child", "child");
+    setNode(store, "new", "new");
+    auto remove = cs_new<ZooKeeperRemoveRequest>();
+    remove->path = "/10";
+    process(remove);
+
+    ASSERT_TRUE(create_snapshot(2));
+    assert_loaded(2);
+
+    setNode(store, "1/child/grandchild", "grandchild");
+    auto remove_new = cs_new<ZooKeeperRemoveRequest>();
+    remove_new->path = "/new";
+    process(remove_new);
+    ASSERT_TRUE(create_snapshot(3));
+    assert_loaded(3);
+
+    /// The full one and two incremental ones are kept for the latest
+    snap_mgr.removeSnapshots();
+    ASSERT_EQ(snap_mgr.getSnapshotChain(getSnapshotStoreMapKeyImpl(1, 3)).size(), 3);
+    ASSERT_EQ(snap_mgr.lastSnapshot()->get_last_log_idx(), 3);
+
+    /// Send the chain to a follower
+    snapshot meta(3, 1, config);
+    KeeperSnapshotManager snap_mgr_save(snap_save_dir, 1, 30);
+    snap_mgr_save.receiveSnapshotMeta(meta);
+    snap_mgr_save.receiveSnapshotChain(meta, snap_mgr.getSnapshotChainMembers(meta));
+    for (ulong obj_id = 1; snap_mgr.existSnapshotObject(meta, obj_id); obj_id++)
+    {
+        ptr<buffer> buffer;
+        snap_mgr.loadSnapshotObject(meta, obj_id, buffer);
+        snap_mgr_save.saveSnapshotObject(meta, obj_id, *buffer);
+    }
+    KeeperStore received_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr_save.parseSnapshot(meta, received_store));
+    ASSERT_EQ(received_store.getNodesCount(), store.getNodesCount());
+    ASSERT_EQ(received_store.getNode("/1/child/grandchild")->data, "grandchild");
+
+    /// Compacted to a full one after incremental_snapshot_count incremental ones
+    setNode(store, "last", "last");
+    create_snapshot(4);
+    ASSERT_EQ(snap_mgr.getSnapshotChain(getSnapshotStoreMapKeyImpl(1, 4)).size(), 1);
+    assert_loaded(4);
+    ASSERT_EQ(snap_mgr.loadSnapshotMetas(), 1);
+
+    cleanDirectory(snap_dir);
+    cleanDirectory(snap_save_dir);
+}
+
+TEST(RaftSnapshot, forkSnapshot)
+{
+    String snap_dir(SNAP_DIR + "/12");
+    cleanDirectory(snap_dir);
+
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 30);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 100; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i), /* is_ephemeral */ i % 10 == 0, /* session_id */ 1);
+
+    auto meta = cs_new<snapshot>(1, 1, config);
+    nuraft::async_result<bool>::handler_type when_done = [](bool &, nuraft::ptr<std::exception> &) {};
+    SnapTask snap_task(meta, store, when_done);
+    auto forked = snap_mgr.forkSnapshot(snap_task, V3);
+    ASSERT_GT(forked.pid, 0);
+    ASSERT_EQ(snap_task.data_tree, nullptr);
+
+    /// The child does not see changes after fork
+    setNode(store, "after_fork", "after_fork");
+
+    size_t object_count = snap_mgr.waitForkedSnapshot(forked);
+    ASSERT_GT(object_count, 3);
+    ASSERT_TRUE(snap_mgr.finishForkedSnapshot(forked, object_count));
+    ASSERT_TRUE(snap_mgr.existSnapshot(*meta));
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr.parseSnapshot(*meta, new_store));
+    ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount() - 1);
+    ASSERT_EQ(new_store.getNode("/1")->data, "table_1");
+    ASSERT_EQ(new_store.getNode("/after_fork"), nullptr);
+    ASSERT_EQ(new_store.getEphemerals(), store.getEphemerals());
+
+    ASSERT_EQ(snap_mgr.loadSnapshotMetas(), 1);
+
+    cleanDirectory(snap_dir);
+}
+
 void compareKeeperStore(KeeperStore & store, KeeperStore & new_store, bool compare_acl)
 {
     ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
@@ -459,10 +1391,11 @@ void compareKeeperStore(KeeperStore & store, KeeperStore & new_store, bool compa
     /// compare ephemeral
     ASSERT_EQ(new_store.getSessionWithEphemeralNodesCount(), store.getSessionWithEphemeralNodesCount());
     ASSERT_EQ(store.getSessionWithEphemeralNodesCount(), 1);
+    auto new_ephemerals = new_store.getEphemerals();
     for (const auto & [session_id, paths] : store.getEphemerals())
     {
-        ASSERT_FALSE(new_store.getEphemerals().find(session_id) == new_store.getEphemerals().end());
-        ASSERT_EQ(paths, new_store.getEphemerals().find(session_id)->second);
+        ASSERT_FALSE(new_ephemerals.find(session_id) == new_ephemerals.end());
+        ASSERT_EQ(paths, new_ephemerals.find(session_id)->second);
     }
 
     ASSERT_TRUE(true) << "compare ephemeral.";
@@ -485,7 +1418,7 @@ void compareKeeperStore(KeeperStore & store, KeeperStore & new_store, bool compa
     /// compare session_and_auth
     if (compare_acl)
     {
-        ASSERT_EQ(store.session_and_auth, new_store.session_and_auth);
+        ASSERT_EQ(store.getSessionAndAuth(), new_store.getSessionAndAuth());
     }
 
     ASSERT_TRUE(true) << "compare session_and_auth.";
@@ -497,17 +1430,17 @@ void compareKeeperStore(KeeperStore & store, KeeperStore & new_store, bool compa
         ASSERT_EQ(new_store.acl_map.getMapping().size(), 4);
         ASSERT_EQ(store.acl_map.getMapping(), new_store.acl_map.getMapping());
 
-        const auto & acls = new_store.acl_map.convertNumber(store.getNode("/1020")->acl_id);
+        const auto & acls = *new_store.acl_map.convertNumber(store.getNode("/1020")->acl_id);
         ASSERT_EQ(acls.size(), 2);
         ASSERT_EQ(acls[0].id, "user1:XDkd2dsEuhc9ImU3q8pa8UOdtpI=");
         ASSERT_EQ(acls[1].id, "user1:CGujN0OWj2wmttV5NJgM2ja68PQ=");
 
-        for (const auto & acl : new_store.acl_map.convertNumber(store.getNode("/1022")->acl_id))
+        for (const auto & acl : *new_store.acl_map.convertNumber(store.getNode("/1022")->acl_id))
         {
             ASSERT_EQ(acl.permissions, ACL::Read);
         }
 
-        for (const auto & acl : new_store.acl_map.convertNumber(store.getNode("/1024")->acl_id))
+        for (const auto & acl : *new_store.acl_map.convertNumber(store.getNode("/1024")->acl_id))
         {
             ASSERT_EQ(acl.permissions, ACL::All);
             ASSERT_EQ(acl.id, "user1:CGujN0OWj2wmttV5NJgM2ja68PQ=");
@@ -659,6 +1592,290 @@ TEST(RaftSnapshot, parseSnapshot)
 
     parseSnapshot(V2, V1);
     sleep(1);
+
+    parseSnapshot(V2, V3);
+    sleep(1);
+
+    parseSnapshot(V3, V3);
+    sleep(1);
+}
+
+TEST(RaftSnapshot, createSnapshotAsyncInParallel)
+{
+    String snap_dir(SNAP_DIR + "/13");
+    cleanDirectory(snap_dir);
+
+    UInt32 object_node_size = 30;
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, object_node_size);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 1000; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i), /* is_ephemeral */ i % 10 == 0, /* session_id */ 1);
+
+    auto meta = cs_new<snapshot>(1, 1, config);
+    nuraft::async_result<bool>::handler_type when_done = [](bool &, nuraft::ptr<std::exception> &) {};
+    SnapTask snap_task(meta, store, when_done);
+
+    /// Every bucket is saved to objects of its own
+    size_t expected_object_count = 3;
+    for (const auto & bucket : snap_task.data_tree->getBuckets())
+        expected_object_count += (bucket->size() + object_node_size - 1) / object_node_size;
+    ASSERT_EQ(snap_mgr.createSnapshotAsync(snap_task, V3), expected_object_count);
+    ASSERT_TRUE(snap_mgr.existSnapshotObject(*meta, expected_object_count));
+    ASSERT_FALSE(snap_mgr.existSnapshotObject(*meta, expected_object_count + 1));
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr.parseSnapshot(*meta, new_store));
+    ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+    for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
+    {
+        for (const auto & [path, node] : store.getDataTree().getMap(i).getMap())
+        {
+            auto new_node = new_store.getNode(path);
+            ASSERT_NE(new_node, nullptr) << path;
+            ASSERT_EQ(new_node->data, node->data);
+            ASSERT_EQ(new_node->stat, node->stat);
+            ASSERT_EQ(new_node->children, node->children);
+        }
+    }
+    ASSERT_EQ(new_store.getEphemerals(), store.getEphemerals());
+
+    cleanDirectory(snap_dir);
+}
+
+TEST(RaftSnapshot, compressBatch)
+{
+    SnapshotBatchBody batch;
+    batch.type = SnapshotBatchType::SNAPSHOT_TYPE_DATA;
+    for (int i = 0; i < 1000; i++)
+        batch.add("/ck/table/table" + std::to_string(i));
+    String data = SnapshotBatchBody::serialize(batch);
+
+    String compressed = SnapshotBatchBody::compress(data);
+    ASSERT_EQ(compressed[0], static_cast<char>(SnapshotBatchCompression::ZLIB));
+    ASSERT_LT(compressed.size(), data.size());
+    ASSERT_EQ(SnapshotBatchBody::decompress(compressed), data);
+
+    /// Stored uncompressed if it is not smaller
+    String short_data = "a";
+    String stored = SnapshotBatchBody::compress(short_data);
+    ASSERT_EQ(stored[0], static_cast<char>(SnapshotBatchCompression::NONE));
+    ASSERT_EQ(SnapshotBatchBody::decompress(stored), short_data);
+}
+
+TEST(RaftSnapshot, parseBatchView)
+{
+    SnapshotBatchBody batch;
+    batch.type = SnapshotBatchType::SNAPSHOT_TYPE_DATA;
+    for (int i = 0; i < 100; i++)
+        batch.add("/ck/table/table" + std::to_string(i));
+    String data = SnapshotBatchBody::serialize(batch);
+
+    /// Elements point into the serialized data
+    auto view = SnapshotBatchView::parse(data);
+    ASSERT_EQ(view.type, SnapshotBatchType::SNAPSHOT_TYPE_DATA);
+    ASSERT_EQ(view.size(), batch.size());
+    for (size_t i = 0; i < view.size(); i++)
+    {
+        ASSERT_EQ(view[i], batch[i]);
+        ASSERT_GE(view[i].data(), data.data());
+        ASSERT_LE(view[i].data() + view[i].size(), data.data() + data.size());
+    }
+
+    /// A batch stored uncompressed is not copied
+    String buf;
+    String stored = '\0' + data;
+    auto body = SnapshotBatchBody::decompress(std::string_view(stored), buf);
+    ASSERT_EQ(body.data(), stored.data() + 1);
+    ASSERT_TRUE(buf.empty());
+
+    String compressed = SnapshotBatchBody::compress(data);
+    ASSERT_EQ(SnapshotBatchBody::decompress(std::string_view(compressed), buf), data);
+
+    data.resize(data.size() - 1);
+    ASSERT_THROW(SnapshotBatchView::parse(data), Exception);
+}
+
+TEST(RaftSnapshot, columnarBatch)
+{
+    std::vector<std::pair<String, KeeperNodePtr>> nodes;
+    for (int i = 0; i < 100; i++)
+    {
+        auto node = KeeperNode::create();
+        node->data = i % 3 == 0 ? "" : "table_" + std::to_string(i);
+        node->acl_id = i % 7 == 0 ? std::numeric_limits<uint64_t>::max() : i % 4;
+        node->is_ephemeral = i % 5 == 0;
+        node->is_sequential = i % 2 == 0;
+        node->stat.czxid = 1000 - i;
+        node->stat.mzxid = 2000 + i;
+        node->stat.pzxid = i;
+        node->stat.ctime = 1700000000000 + i;
+        node->stat.mtime = 1700000000000 - i;
+        /// Session id with the highest bit
+        node->stat.ephemeralOwner = node->is_ephemeral ? std::numeric_limits<int64_t>::min() + i : 0;
+        node->stat.version = i;
+        node->stat.cversion = -i;
+        node->stat.aversion = std::numeric_limits<int32_t>::max() - i;
+        node->stat.numChildren = i % 10;
+        nodes.emplace_back("/ck/table/table" + std::to_string(i), node);
+    }
+
+    ColumnarNodes columnar_nodes;
+    for (const auto & [path, node] : nodes)
+        columnar_nodes.emplace_back(path, node.get());
+    auto batch = serializeColumnarBatch(columnar_nodes);
+    ASSERT_EQ(batch->type, SnapshotBatchType::SNAPSHOT_TYPE_DATA_COLUMNS);
+    String data = SnapshotBatchBody::serialize(*batch);
+
+    auto parsed = parseColumnarBatch(SnapshotBatchView::parse(data));
+    ASSERT_EQ(parsed.size(), nodes.size());
+
+    /// Nodes are sorted by path
+    std::sort(nodes.begin(), nodes.end(), [](const auto & lhs, const auto & rhs) { return lhs.first < rhs.first; });
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        ASSERT_EQ(parsed[i].first, nodes[i].first);
+        ASSERT_EQ(*parsed[i].second, *nodes[i].second);
+        ASSERT_EQ(parsed[i].second->stat, nodes[i].second->stat);
+    }
+
+    /// Columnar batch is smaller than the row one
+    SnapshotBatchBody row_batch;
+    for (const auto & [path, node] : nodes)
+        row_batch.add(serializeKeeperNode(path, node, V3));
+    ASSERT_LT(data.size(), SnapshotBatchBody::serialize(row_batch).size());
+
+    data.resize(data.size() - 1);
+    ASSERT_THROW(parseColumnarBatch(SnapshotBatchView::parse(data)), Exception);
+}
+
+TEST(RaftSnapshot, columnarBatchDistinctData)
+{
+    std::vector<std::pair<String, KeeperNodePtr>> nodes;
+    for (int i = 0; i < 100; i++)
+    {
+        auto node = KeeperNode::create();
+        node->data = "shared_config_value_" + std::to_string(i % 3);
+        node->stat.czxid = i;
+        nodes.emplace_back("/ck/replica" + std::to_string(i), node);
+    }
+    /// Short data is not referenced
+    auto short_node = KeeperNode::create();
+    short_node->data = "short";
+    nodes.emplace_back("/ck/short", short_node);
+    nodes.emplace_back("/ck/short2", short_node);
+
+    ColumnarNodes columnar_nodes;
+    for (const auto & [path, node] : nodes)
+        columnar_nodes.emplace_back(path, node.get());
+    auto batch = serializeColumnarBatch(columnar_nodes);
+
+    /// Every distinct data is written once
+    size_t data_column = 2;
+    ASSERT_EQ((*batch)[data_column].size(), 3 * String("shared_config_value_0").size() + 2 * String("short").size());
+
+    String data = SnapshotBatchBody::serialize(*batch);
+    auto parsed = parseColumnarBatch(SnapshotBatchView::parse(data));
+    ASSERT_EQ(parsed.size(), nodes.size());
+    std::sort(nodes.begin(), nodes.end(), [](const auto & lhs, const auto & rhs) { return lhs.first < rhs.first; });
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        ASSERT_EQ(parsed[i].first, nodes[i].first);
+        ASSERT_EQ(*parsed[i].second, *nodes[i].second);
+    }
+}
+
+TEST(RaftSnapshot, createColumnarSnapshot)
+{
+    String snap_dir(SNAP_DIR + "/14");
+    cleanDirectory(snap_dir);
+
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 30);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 1000; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i), /* is_ephemeral */ i % 10 == 0, /* session_id */ 1);
+
+    auto meta = cs_new<snapshot>(1, 1, config);
+    nuraft::async_result<bool>::handler_type when_done = [](bool &, nuraft::ptr<std::exception> &) {};
+    SnapTask snap_task(meta, store, when_done);
+    ASSERT_GT(snap_mgr.createSnapshotAsync(snap_task, V5), 3);
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr.parseSnapshot(*meta, new_store));
+    ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+    for (UInt32 i = 0; i < store.getDataTreeBucketNum(); i++)
+    {
+        for (const auto & [path, node] : store.getDataTree().getMap(i).getMap())
+        {
+            auto new_node = new_store.getNode(path);
+            ASSERT_NE(new_node, nullptr) << path;
+            ASSERT_EQ(new_node->data, node->data);
+            ASSERT_EQ(new_node->stat, node->stat);
+            ASSERT_EQ(new_node->children, node->children);
+        }
+    }
+    ASSERT_EQ(new_store.getEphemerals(), store.getEphemerals());
+
+    cleanDirectory(snap_dir);
+}
+
+TEST(RaftSnapshot, skipCorruptedSnapshot)
+{
+    String snap_dir(SNAP_DIR + "/15");
+    cleanDirectory(snap_dir);
+    ptr<cluster_config> config = cs_new<cluster_config>(1, 0);
+
+    RaftSettingsPtr raft_settings(RaftSettings::getDefault());
+    KeeperStore store(raft_settings->dead_session_check_period_ms);
+    for (int i = 0; i < 1000; i++)
+        setNode(store, std::to_string(i), "table_" + std::to_string(i));
+
+    {
+        KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+        snapshot meta_1(1000, 1, config);
+        snap_mgr.createSnapshot(meta_1, store);
+        snapshot meta_2(2000, 1, config);
+        snap_mgr.createSnapshot(meta_2, store);
+    }
+
+    {
+        KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+        ASSERT_EQ(snap_mgr.loadSnapshotMetas(), 2);
+        ASSERT_EQ(snap_mgr.lastIntactSnapshot()->get_last_log_idx(), 2000);
+    }
+
+    /// Flip a byte in a data object of the latest snapshot
+    std::vector<String> files;
+    Poco::File(snap_dir).list(files);
+    auto it = std::find_if(files.begin(), files.end(), [](const String & file) { return file.ends_with("_1_2000_5"); });
+    ASSERT_NE(it, files.end());
+    {
+        std::fstream file(snap_dir + "/" + *it, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekg(0, std::ios::end);
+        auto offset = file.tellg() / 2;
+        file.seekg(offset);
+        char c = static_cast<char>(file.get());
+        file.seekp(offset);
+        file.put(static_cast<char>(~c));
+    }
+
+    KeeperSnapshotManager snap_mgr(snap_dir, 3, 100);
+    ASSERT_EQ(snap_mgr.loadSnapshotMetas(), 2);
+    auto last_snapshot = snap_mgr.lastIntactSnapshot();
+    ASSERT_NE(last_snapshot, nullptr);
+    ASSERT_EQ(last_snapshot->get_last_log_idx(), 1000);
+    ASSERT_EQ(snap_mgr.lastSnapshot()->get_last_log_idx(), 1000);
+
+    KeeperStore new_store(raft_settings->dead_session_check_period_ms);
+    ASSERT_TRUE(snap_mgr.parseSnapshot(*last_snapshot, new_store));
+    ASSERT_EQ(new_store.getNodesCount(), store.getNodesCount());
+
+    cleanDirectory(snap_dir);
 }
 
 void createSnapshotWithFuzzyLog(bool async_snapshot)
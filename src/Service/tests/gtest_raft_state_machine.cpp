@@ -1,4 +1,5 @@
 #include <Service/KeeperStore.h>
+#include <Service/LastCommittedIndexManager.h>
 #include <Service/NuRaftFileLogStore.h>
 #include <Service/NuRaftStateMachine.h>
 #include <Service/KeeperCommon.h>
@@ -299,3 +300,369 @@ TEST(RaftStateMachine, initStateMachine)
     cleanDirectory(snap_dir);
     cleanDirectory(log_dir);
 }
+
+TEST(RaftStateMachine, coalesceGetRequests)
+{
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+    KeeperStore store(setting_ptr->dead_session_check_period_ms);
+    setNode(store, "coalesced", "some data");
+    store.addSessionID(2, 30000);
+
+    auto serialize = [](const ZooKeeperResponsePtr & response)
+    {
+        WriteBufferFromOwnString buf;
+        response->write(buf);
+        return buf.str();
+    };
+
+    auto process = [&store](int64_t session_id, const String & path, KeeperStore::GetResponseCache * cache)
+    {
+        auto request = std::make_shared<ZooKeeperGetRequest>();
+        request->path = path;
+        request->xid = 10;
+        KeeperStore::KeeperResponsesQueue responses_queue;
+        store.processRequest(responses_queue, {request, session_id, 0}, {}, true, false, cache);
+
+        ResponseForSession response;
+        responses_queue.tryPop(response);
+        return response.response;
+    };
+
+    auto expected = serialize(process(1, "/coalesced", nullptr));
+    auto expected_no_node = serialize(process(1, "/not_exist", nullptr));
+
+    KeeperStore::GetResponseCache cache;
+    for (int64_t session_id : {1, 2, 1})
+    {
+        ASSERT_EQ(serialize(process(session_id, "/coalesced", &cache)), expected);
+        ASSERT_EQ(serialize(process(session_id, "/not_exist", &cache)), expected_no_node);
+    }
+    ASSERT_EQ(cache.size(), 2);
+    ASSERT_TRUE(cache.at("/coalesced").serialized_body);
+}
+
+TEST(RaftStateMachine, newAndCloseSessionsInBatch)
+{
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+    KeeperStore store(setting_ptr->dead_session_check_period_ms);
+
+    auto new_sessions = std::make_shared<ZooKeeperNewSessionsRequest>();
+    new_sessions->xid = NEW_SESSION_XID;
+    for (int64_t internal_id : {101, 102, 103})
+    {
+        auto request = std::make_shared<ZooKeeperNewSessionRequest>();
+        request->xid = NEW_SESSION_XID;
+        request->internal_id = internal_id;
+        request->session_timeout_ms = 30000;
+        request->server_id = 1;
+        new_sessions->requests.push_back(request);
+    }
+
+    RequestForSession new_sessions_request;
+    new_sessions_request.request = new_sessions;
+    auto new_sessions_buf = NuRaftStateMachine::serializeRequest(new_sessions_request);
+
+    /// Sessions get a range of ids
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    store.processRequest(responses_queue, NuRaftStateMachine::parseRequest(*new_sessions_buf), {}, true, false);
+    ASSERT_EQ(store.getSessionCount(), 3);
+
+    std::vector<int64_t> session_ids;
+    ResponseForSession response;
+    while (responses_queue.tryPop(response))
+    {
+        const auto & new_session_response = dynamic_cast<const ZooKeeperNewSessionResponse &>(*response.response);
+        ASSERT_EQ(response.session_id, new_session_response.internal_id);
+        ASSERT_TRUE(new_session_response.success);
+        session_ids.push_back(new_session_response.session_id);
+    }
+    ASSERT_EQ(session_ids.size(), 3);
+    std::sort(session_ids.begin(), session_ids.end());
+    ASSERT_EQ(session_ids.back() - session_ids.front(), 2);
+
+    setNode(store, "ephemeral_1", "", true, session_ids[0]);
+    setNode(store, "ephemeral_2", "", true, session_ids[1]);
+    ASSERT_EQ(store.getSessionWithEphemeralNodesCount(), 2);
+
+    auto close_sessions = std::make_shared<ZooKeeperCloseSessionsRequest>();
+    close_sessions->xid = CLOSE_XID;
+    close_sessions->session_ids = {session_ids[0], session_ids[1]};
+
+    RequestForSession close_sessions_request;
+    close_sessions_request.request = close_sessions;
+    auto close_sessions_buf = NuRaftStateMachine::serializeRequest(close_sessions_request);
+
+    /// Every closed session gets a close response
+    store.processRequest(responses_queue, NuRaftStateMachine::parseRequest(*close_sessions_buf), {}, true, false);
+    ASSERT_EQ(store.getSessionCount(), 1);
+    ASSERT_EQ(store.getTotalEphemeralNodesCount(), 0);
+    ASSERT_EQ(store.getSessionWithEphemeralNodesCount(), 0);
+    ASSERT_FALSE(store.getNode("/ephemeral_1"));
+
+    size_t close_responses = 0;
+    while (responses_queue.tryPop(response))
+        close_responses += response.response->getOpNum() == OpNum::Close;
+    ASSERT_EQ(close_responses, 2);
+}
+
+TEST(RaftStateMachine, digestOfDataTree)
+{
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+    KeeperStore store(setting_ptr->dead_session_check_period_ms);
+    store.enableDigest();
+
+    auto process = [&store](const ZooKeeperRequestPtr & request)
+    {
+        request->xid = 10;
+        KeeperStore::KeeperResponsesQueue responses_queue;
+        store.processRequest(responses_queue, {request, 1, 1000}, {}, true, true);
+    };
+    auto recomputed = [&store]()
+    {
+        UInt64 digest = store.getNodesDigest();
+        store.recomputeDigest();
+        return digest == store.getNodesDigest();
+    };
+
+    UInt64 empty_digest = store.getNodesDigest();
+    setNode(store, "digest", "some data");
+    UInt64 created_digest = store.getNodesDigest();
+    ASSERT_NE(created_digest, empty_digest);
+    ASSERT_TRUE(recomputed());
+
+    auto set = std::make_shared<ZooKeeperSetRequest>();
+    set->path = "/digest";
+    set->data = "other data";
+    process(set);
+    ASSERT_NE(store.getNodesDigest(), created_digest);
+    ASSERT_TRUE(recomputed());
+    UInt64 set_digest = store.getNodesDigest();
+
+    /// Failed multi request is reverted
+    auto create = std::make_shared<ZooKeeperCreateRequest>();
+    create->path = "/digest/child";
+    auto remove = std::make_shared<ZooKeeperRemoveRequest>();
+    remove->path = "/digest";
+    auto bad_set = std::make_shared<ZooKeeperSetRequest>();
+    bad_set->path = "/digest";
+    bad_set->version = 100;
+    auto multi = std::make_shared<ZooKeeperMultiRequest>();
+    multi->requests = {create, set, bad_set};
+    process(multi);
+    ASSERT_EQ(store.getNodesDigest(), set_digest);
+    ASSERT_TRUE(recomputed());
+
+    /// Children do not change the digest of the parent
+    process(create);
+    remove->path = "/digest/child";
+    process(remove);
+    ASSERT_EQ(store.getNodesDigest(), set_digest);
+
+    remove->path = "/digest";
+    process(remove);
+    ASSERT_EQ(store.getNodesDigest(), empty_digest);
+
+    /// Digests of replicas are compared at the previous checkpoint
+    auto check_digest = std::make_shared<ZooKeeperCheckDigestRequest>();
+    check_digest->checkpoint = 1000;
+    process(check_digest);
+    ASSERT_EQ(store.getDigestCheckpoint(1000), empty_digest);
+    ASSERT_FALSE(store.getDigestCheckpoint(2000));
+
+    check_digest->checkpoint = 2000;
+    check_digest->checked_checkpoint = 1000;
+    check_digest->checked_digest = empty_digest;
+    process(check_digest);
+    ASSERT_EQ(store.getDigestMismatches(), 0);
+
+    check_digest->checkpoint = 3000;
+    check_digest->checked_digest = empty_digest + 1;
+    process(check_digest);
+    ASSERT_EQ(store.getDigestMismatches(), 1);
+}
+
+TEST(RaftStateMachine, lastCommittedIndexWithLogFsync)
+{
+    String log_dir(LOG_DIR + "/committed_index");
+    cleanDirectory(log_dir);
+    {
+        LastCommittedIndexManager manager(log_dir, true);
+        ASSERT_EQ(manager.get(), 0U);
+
+        /// Nothing is persisted until logs are flushed, and never more than flushed
+        manager.push(10);
+        ASSERT_EQ(manager.get(), 0U);
+        manager.persist(5);
+        ASSERT_EQ(manager.get(), 5U);
+        manager.persist(20);
+        ASSERT_EQ(manager.get(), 10U);
+
+        /// Commits after the last flush are persisted when shutting down
+        manager.push(30);
+        manager.shutDown();
+    }
+    LastCommittedIndexManager manager(log_dir, true);
+    ASSERT_EQ(manager.get(), 20U);
+    manager.shutDown();
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftStateMachine, commitLocalRequests)
+{
+    String snap_dir(SNAP_DIR + "/local_requests");
+    String log_dir(LOG_DIR + "/local_requests");
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+
+    KeeperResponsesQueue queue;
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+
+    std::mutex new_session_id_callback_mutex;
+    std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+    NuRaftStateMachine machine(queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback);
+
+    auto make_request = [&](const String & path)
+    {
+        auto request = cs_new<Coordination::ZooKeeperCreateRequest>();
+        request->path = path;
+        request->xid = 1;
+        return RequestForSession(request, createSession(machine), 0);
+    };
+
+    /// Entries are logs of /b and /c, but the local requests of the same size are committed instead
+    auto request_b = make_request("/b");
+    auto request_c = make_request("/c");
+    std::vector<ptr<buffer>> entries{NuRaftStateMachine::serializeRequest(request_b), NuRaftStateMachine::serializeRequest(request_c)};
+    machine.beginLocalAppend(entries, {make_request("/a"), make_request("/d")});
+    machine.pre_commit(1, *entries[0]);
+    machine.pre_commit(2, *entries[1]);
+    machine.endLocalAppend(entries);
+
+    /// Log 2 is overwritten by a new leader
+    machine.rollback(2, *entries[1]);
+
+    machine.commit(1, *entries[0]);
+    machine.commit(2, *entries[1]);
+    ASSERT_TRUE(machine.getStore().getNode("/a"));
+    ASSERT_FALSE(machine.getStore().getNode("/b"));
+    ASSERT_TRUE(machine.getStore().getNode("/c"));
+    ASSERT_FALSE(machine.getStore().getNode("/d"));
+
+    /// Not pre-committed in append_entries, like not leader
+    auto request_e = make_request("/e");
+    entries = {NuRaftStateMachine::serializeRequest(request_e)};
+    machine.beginLocalAppend(entries, {make_request("/f")});
+    machine.endLocalAppend(entries);
+    machine.pre_commit(3, *entries[0]);
+    machine.commit(3, *entries[0]);
+    ASSERT_TRUE(machine.getStore().getNode("/e"));
+    ASSERT_FALSE(machine.getStore().getNode("/f"));
+
+    machine.shutdown();
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftStateMachine, batchSizeHint)
+{
+    String snap_dir(SNAP_DIR + "/batch_size_hint");
+    String log_dir(LOG_DIR + "/batch_size_hint");
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+
+    KeeperResponsesQueue queue;
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+    setting_ptr->max_append_bytes = 1000;
+
+    std::mutex new_session_id_callback_mutex;
+    std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+    NuRaftStateMachine machine(queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback);
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), 1000);
+
+    auto request = cs_new<Coordination::ZooKeeperCreateRequest>();
+    request->path = "/a";
+    request->xid = 1;
+    RequestForSession request_for_session(request, createSession(machine), 0);
+    auto entry = NuRaftStateMachine::serializeRequest(request_for_session);
+    auto entry_size = static_cast<Int64>(entry->size());
+
+    /// Window is shrunk by logs appended and grown by logs committed or rolled back
+    setting_ptr->max_append_bytes = 0;
+    setting_ptr->replication_window_bytes = entry_size * 2 + 10;
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), entry_size * 2 + 10);
+    machine.pre_commit(1, *entry);
+    machine.pre_commit(2, *entry);
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), 10);
+    machine.pre_commit(3, *entry);
+    ASSERT_LT(machine.get_next_batch_size_hint_in_bytes(), 0);
+    machine.rollback(3, *entry);
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), 10);
+    machine.commit(1, *entry);
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), entry_size + 10);
+
+    /// Limited by both
+    setting_ptr->max_append_bytes = 5;
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), 5);
+
+    /// Logs replayed are not pre-committed
+    machine.commit(2, *entry);
+    machine.commit(3, *entry);
+    setting_ptr->max_append_bytes = 0;
+    ASSERT_EQ(machine.get_next_batch_size_hint_in_bytes(), entry_size * 2 + 10);
+
+    machine.shutdown();
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+}
+
+TEST(RaftStateMachine, witness)
+{
+    String snap_dir(SNAP_DIR + "/witness");
+    String log_dir(LOG_DIR + "/witness");
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+
+    KeeperResponsesQueue queue;
+    RaftSettingsPtr setting_ptr = RaftSettings::getDefault();
+
+    std::mutex new_session_id_callback_mutex;
+    std::unordered_map<int64_t, ptr<std::condition_variable>> new_session_id_callback;
+
+    {
+        NuRaftStateMachine machine(
+            queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback, nullptr, "",
+            MAX_OBJECT_NODE_SIZE, nullptr, true);
+        ASSERT_TRUE(machine.isWitness());
+        ASSERT_EQ(machine.last_snapshot(), nullptr);
+
+        /// Logs are committed but not applied
+        UInt64 nodes_count = machine.getStore().getNodesCount();
+        for (auto i = 0; i < 10; i++)
+            createZNode(machine, "/" + std::to_string(i + 1), "data");
+        ASSERT_EQ(machine.last_commit_index(), 10);
+        ASSERT_EQ(machine.getStore().getNodesCount(), nodes_count);
+
+        ASSERT_TRUE(machine.chk_create_snapshot());
+        snapshot meta(10, 1, cs_new<cluster_config>(1, 0));
+        bool created = false;
+        async_result<bool>::handler_type when_done = [&created](bool & ret, ptr<std::exception> &) { created = ret; };
+        machine.create_snapshot(meta, when_done);
+        ASSERT_TRUE(created);
+        ASSERT_EQ(machine.last_snapshot()->get_last_log_idx(), 10);
+        machine.shutdown();
+    }
+
+    /// Snapshot of indices is loaded when starting
+    NuRaftStateMachine machine(
+        queue, setting_ptr, snap_dir, log_dir, 10, 3, new_session_id_callback_mutex, new_session_id_callback, nullptr, "",
+        MAX_OBJECT_NODE_SIZE, nullptr, true);
+    ASSERT_EQ(machine.last_snapshot()->get_last_log_idx(), 10);
+    ASSERT_EQ(machine.last_snapshot()->get_last_log_term(), 1);
+    ASSERT_EQ(machine.last_commit_index(), 10);
+    machine.shutdown();
+
+    cleanDirectory(snap_dir);
+    cleanDirectory(log_dir);
+}
@@ -0,0 +1,57 @@
+#include <map>
+#include <Service/ReadIndexPolicy.h>
+#include <Common/Exception.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(ReadIndexPolicy, withheldUntilEntryOfTermCommitted)
+{
+    ReadIndexPolicy policy;
+    /// Entries 1-10 of term 1, then the entry appended by the new leader of term 2
+    std::map<UInt64, UInt64> terms;
+    for (UInt64 i = 1; i <= 10; ++i)
+        terms[i] = 1;
+    terms[11] = 2;
+    size_t lookups = 0;
+    auto term_at = [&](UInt64 index)
+    {
+        ++lookups;
+        auto it = terms.find(index);
+        return it == terms.end() ? 0 : it->second;
+    };
+
+    /// Committed index of the new leader may be behind the one of the previous leader
+    ASSERT_FALSE(policy.getReadIndex(2, 0, term_at));
+    ASSERT_FALSE(policy.getReadIndex(2, 8, term_at));
+    ASSERT_FALSE(policy.getReadIndex(2, 10, term_at));
+
+    ASSERT_EQ(policy.getReadIndex(2, 11, term_at), 11);
+    /// Known committed for the term, no more lookups
+    size_t lookups_before = lookups;
+    ASSERT_EQ(policy.getReadIndex(2, 12, term_at), 12);
+    ASSERT_EQ(lookups, lookups_before);
+
+    /// A later term is checked again, a compacted entry is not known
+    ASSERT_FALSE(policy.getReadIndex(3, 12, term_at));
+    ASSERT_FALSE(policy.getReadIndex(3, 100, term_at));
+    terms[13] = 3;
+    ASSERT_EQ(policy.getReadIndex(3, 13, term_at), 13);
+}
+
+TEST(ReadIndexPolicy, leaseShorterThanElectionTimeout)
+{
+    /// Defaults, less a heartbeat and 10% of the election timeout
+    ASSERT_EQ(ReadIndexPolicy::getLeaseMs(3000, 500), 2200);
+
+    for (UInt64 election_timeout : {1000, 3000, 10000, 60000})
+        for (UInt64 heart_beat : {10, 100, 200})
+        {
+            Int32 lease = ReadIndexPolicy::getLeaseMs(election_timeout, heart_beat);
+            ASSERT_GT(lease, static_cast<Int32>(heart_beat));
+            ASSERT_LT(static_cast<UInt64>(lease) + heart_beat, election_timeout);
+        }
+
+    ASSERT_THROW(ReadIndexPolicy::getLeaseMs(1000, 500), Exception);
+    ASSERT_THROW(ReadIndexPolicy::getLeaseMs(500, 500), Exception);
+}
@@ -0,0 +1,101 @@
+#include <thread>
+#include <Common/RequestTimeline.h>
+#include <Service/RequestCapture.h>
+#include <Service/tests/raft_test_common.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+const String CAPTURE_DIR = "./test_request_capture";
+
+}
+
+TEST(RequestCapture, CaptureAndRead)
+{
+    cleanDirectory(CAPTURE_DIR);
+    auto & capture = RequestCapture::instance();
+    capture.initialize(CAPTURE_DIR, 1, 10, 1024 * 1024, 1024 * 1024);
+
+    /// Not capturing
+    capture.capture(1, 100, "a", 1);
+
+    String file = capture.start();
+    ASSERT_TRUE(capture.isCapturing());
+    ASSERT_EQ(capture.start(), file);
+
+    UInt64 now = RequestTimeline::now();
+    capture.capture(1, now + 10, "first", 5);
+    capture.capture(0x100000a2f3, now + 2000, String(300, 'x').data(), 300);
+    capture.capture(1, now + 3000, "", 0);
+    capture.stop();
+    ASSERT_FALSE(capture.isCapturing());
+    ASSERT_EQ(capture.getStatus().records, 3);
+
+    RequestCapture::Reader reader(file);
+    ASSERT_GT(reader.startTimeUs(), 0);
+
+    RequestCapture::Record record;
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(record.session_id, 1);
+    ASSERT_EQ(record.body, "first");
+    UInt64 first_time = record.time_us;
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(record.session_id, 0x100000a2f3);
+    ASSERT_EQ(record.body, String(300, 'x'));
+    ASSERT_EQ(record.time_us - first_time, 1990);
+
+    ASSERT_TRUE(reader.next(record));
+    ASSERT_EQ(record.session_id, 1);
+    ASSERT_TRUE(record.body.empty());
+    ASSERT_FALSE(reader.next(record));
+
+    cleanDirectory(CAPTURE_DIR);
+}
+
+TEST(RequestCapture, SampleSessions)
+{
+    auto & capture = RequestCapture::instance();
+    capture.initialize(CAPTURE_DIR, 0, 10, 1024 * 1024, 1024 * 1024);
+    ASSERT_FALSE(capture.isSampled(1));
+
+    capture.initialize(CAPTURE_DIR, 0.5, 10, 1024 * 1024, 1024 * 1024);
+    size_t sampled = 0;
+    for (int64_t session_id = 0; session_id < 10000; ++session_id)
+    {
+        sampled += capture.isSampled(session_id);
+        /// A session is always or never sampled
+        ASSERT_EQ(capture.isSampled(session_id), capture.isSampled(session_id));
+    }
+    ASSERT_GT(sampled, 4500);
+    ASSERT_LT(sampled, 5500);
+}
+
+TEST(RequestCapture, DropAndFull)
+{
+    cleanDirectory(CAPTURE_DIR);
+    auto & capture = RequestCapture::instance();
+    /// Flushes are not in time for pending records over 100 bytes
+    capture.initialize(CAPTURE_DIR, 1, 1000 * 1000, 100, 1000);
+    capture.start();
+    UInt64 now = RequestTimeline::now();
+    capture.capture(1, now, String(60, 'x').data(), 60);
+    capture.capture(1, now, String(60, 'x').data(), 60);
+    ASSERT_EQ(capture.getStatus().dropped, 1);
+    capture.stop();
+    ASSERT_EQ(capture.getStatus().records, 1);
+
+    /// Capturing stops when the file is full
+    capture.initialize(CAPTURE_DIR, 1, 1, 1024 * 1024, 1000);
+    capture.start();
+    capture.capture(1, now, String(2000, 'x').data(), 2000);
+    for (size_t i = 0; i < 1000 && capture.isCapturing(); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    ASSERT_FALSE(capture.isCapturing());
+    capture.stop();
+
+    cleanDirectory(CAPTURE_DIR);
+}
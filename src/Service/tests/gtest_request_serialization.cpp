@@ -0,0 +1,320 @@
+#include <Common/IO/ReadBufferFromString.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <Service/NuRaftStateMachine.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+using namespace Coordination;
+
+namespace
+{
+
+ACLs makeACLs()
+{
+    ACL acl;
+    acl.permissions = ACL::All;
+    acl.scheme = "digest";
+    acl.id = "user:password";
+    return {acl, acl};
+}
+
+std::vector<ZooKeeperRequestPtr> makeRequests()
+{
+    std::vector<ZooKeeperRequestPtr> requests;
+
+    auto create = std::make_shared<ZooKeeperCreateRequest>();
+    create->path = "/create";
+    create->data = String(1000, 'x');
+    create->acls = makeACLs();
+    create->is_sequential = true;
+    requests.push_back(create);
+
+    auto create_ttl = std::make_shared<ZooKeeperCreateRequest>();
+    create_ttl->path = "/create_ttl";
+    create_ttl->op_num = OpNum::CreateTTL;
+    create_ttl->is_ttl = true;
+    create_ttl->ttl = 1000;
+    requests.push_back(create_ttl);
+
+    auto remove = std::make_shared<ZooKeeperRemoveRequest>();
+    remove->path = "/remove";
+    remove->version = 3;
+    requests.push_back(remove);
+
+    auto set = std::make_shared<ZooKeeperSetRequest>();
+    set->path = "/set";
+    set->data = "data";
+    requests.push_back(set);
+
+    auto check = std::make_shared<ZooKeeperCheckRequest>();
+    check->path = "/check";
+    requests.push_back(check);
+
+    auto set_acl = std::make_shared<ZooKeeperSetACLRequest>();
+    set_acl->path = "/set_acl";
+    set_acl->acls = makeACLs();
+    requests.push_back(set_acl);
+
+    auto get_acl = std::make_shared<ZooKeeperGetACLRequest>();
+    get_acl->path = "/get_acl";
+    requests.push_back(get_acl);
+
+    auto get = std::make_shared<ZooKeeperGetRequest>();
+    get->path = "/get";
+    get->has_watch = true;
+    requests.push_back(get);
+
+    auto exists = std::make_shared<ZooKeeperExistsRequest>();
+    exists->path = "/exists";
+    requests.push_back(exists);
+
+    auto list = std::make_shared<ZooKeeperSimpleListRequest>();
+    list->path = "/list";
+    requests.push_back(list);
+
+    auto filtered_list = std::make_shared<ZooKeeperFilteredListRequest>();
+    filtered_list->path = "/filtered_list";
+    filtered_list->list_request_type = ZooKeeperFilteredListRequest::ListRequestType::EPHEMERAL_ONLY;
+    requests.push_back(filtered_list);
+
+    auto list_with_data = std::make_shared<ZooKeeperListWithDataRequest>();
+    list_with_data->path = "/list_with_data";
+    list_with_data->with_stat = false;
+    list_with_data->start_after = "child_10";
+    list_with_data->max_children = 100;
+    requests.push_back(list_with_data);
+
+    auto paged_list = std::make_shared<ZooKeeperPagedListRequest>();
+    paged_list->path = "/paged_list";
+    paged_list->start_after = "child_10";
+    paged_list->limit = 100;
+    requests.push_back(paged_list);
+
+    auto stat_batch = std::make_shared<ZooKeeperStatBatchRequest>();
+    stat_batch->paths = {"/stat_a", "/stat_b"};
+    requests.push_back(stat_batch);
+
+    auto sync = std::make_shared<ZooKeeperSyncRequest>();
+    sync->path = "/sync";
+    requests.push_back(sync);
+
+    auto auth = std::make_shared<ZooKeeperAuthRequest>();
+    auth->scheme = "digest";
+    auth->data = "user:password";
+    requests.push_back(auth);
+
+    auto set_watches = std::make_shared<ZooKeeperSetWatchesRequest>();
+    set_watches->relative_zxid = 100;
+    set_watches->data_watches = {"/a", "/b"};
+    set_watches->list_watches = {"/c"};
+    requests.push_back(set_watches);
+
+    auto set_watches2 = std::make_shared<ZooKeeperSetWatchesRequest>();
+    set_watches2->op_num = OpNum::SetWatches2;
+    set_watches2->relative_zxid = 100;
+    set_watches2->exist_watches = {"/a"};
+    set_watches2->persistent_watches = {"/b"};
+    set_watches2->persistent_recursive_watches = {"/c", "/d"};
+    requests.push_back(set_watches2);
+
+    auto add_watch = std::make_shared<ZooKeeperAddWatchRequest>();
+    add_watch->path = "/add_watch";
+    requests.push_back(add_watch);
+
+    auto new_session = std::make_shared<ZooKeeperNewSessionRequest>();
+    new_session->internal_id = 1;
+    new_session->session_timeout_ms = 30000;
+    new_session->server_id = 1;
+    requests.push_back(new_session);
+
+    auto new_sessions = std::make_shared<ZooKeeperNewSessionsRequest>();
+    new_sessions->requests = {new_session, new_session};
+    requests.push_back(new_sessions);
+
+    auto update_session = std::make_shared<ZooKeeperUpdateSessionRequest>();
+    update_session->session_id = 1;
+    update_session->session_timeout_ms = 30000;
+    update_session->server_id = 1;
+    requests.push_back(update_session);
+
+    auto close_sessions = std::make_shared<ZooKeeperCloseSessionsRequest>();
+    close_sessions->session_ids = {1, 2, 3};
+    requests.push_back(close_sessions);
+
+    auto remove_expired = std::make_shared<ZooKeeperRemoveExpiredRequest>();
+    remove_expired->paths = {"/a", "/b"};
+    requests.push_back(remove_expired);
+
+    auto check_digest = std::make_shared<ZooKeeperCheckDigestRequest>();
+    check_digest->checkpoint = 2000;
+    check_digest->checked_checkpoint = 1000;
+    check_digest->checked_digest = 0x1234567890abcdefULL;
+    requests.push_back(check_digest);
+
+    auto multi = std::make_shared<ZooKeeperMultiRequest>();
+    multi->requests = {create, set, remove, check};
+    requests.push_back(multi);
+
+    requests.push_back(std::make_shared<ZooKeeperHeartbeatRequest>());
+    requests.push_back(std::make_shared<ZooKeeperCloseRequest>());
+
+    return requests;
+}
+
+}
+
+TEST(RequestSerialization, exactSize)
+{
+    for (const auto & request : makeRequests())
+    {
+        WriteBufferFromOwnString body;
+        request->writeImpl(body);
+        ASSERT_EQ(request->sizeImpl(), body.str().size()) << request->toString();
+
+        WriteBufferFromOwnString out;
+        request->write(out);
+        ASSERT_EQ(request->bytesSize(), out.str().size()) << request->toString();
+    }
+}
+
+TEST(RequestSerialization, logEntryWithoutCopy)
+{
+    for (const auto & request : makeRequests())
+    {
+        request->xid = 10;
+        RequestForSession request_for_session(request, 1, 1000);
+        auto entry = NuRaftStateMachine::serializeRequest(request_for_session);
+        /// The reserved buffer is returned as it is
+        ASSERT_EQ(entry->size(), sizeof(int64_t) + request->bytesSize() + sizeof(int64_t));
+
+        auto parsed = NuRaftStateMachine::parseRequest(*entry);
+        ASSERT_EQ(parsed.session_id, 1);
+        ASSERT_EQ(parsed.create_time, 1000);
+        ASSERT_EQ(parsed.request->xid, 10);
+        ASSERT_EQ(parsed.request->getOpNum(), request->getOpNum());
+        ASSERT_EQ(parsed.request->getPath(), request->getPath());
+    }
+}
+
+TEST(RequestSerialization, listWithDataResponse)
+{
+    ZooKeeperListWithDataRequest request;
+    request.with_data = false;
+    auto response = std::dynamic_pointer_cast<ZooKeeperListWithDataResponse>(request.makeResponse());
+    response->stat.numChildren = 2;
+    response->has_more = true;
+    response->children.resize(2);
+    response->children[0].name = "a";
+    response->children[0].stat.dataLength = 10;
+    response->children[1].name = "b";
+    response->children[1].error = Error::ZNOAUTH;
+
+    WriteBufferFromOwnString out;
+    response->writeImpl(out);
+
+    ZooKeeperListWithDataResponse parsed;
+    ReadBufferFromString in(out.str());
+    parsed.readImpl(in);
+    ASSERT_TRUE(in.eof());
+    ASSERT_FALSE(parsed.with_data);
+    ASSERT_TRUE(parsed.with_stat);
+    ASSERT_TRUE(parsed == *response);
+}
+
+TEST(RequestSerialization, statBatchResponse)
+{
+    ZooKeeperStatBatchResponse response;
+    response.stats.resize(2);
+    response.stats[0].stat.version = 3;
+    response.stats[0].stat.dataLength = 10;
+    response.stats[1].error = Error::ZNONODE;
+
+    WriteBufferFromOwnString out;
+    response.writeImpl(out);
+
+    ZooKeeperStatBatchResponse parsed;
+    ReadBufferFromString in(out.str());
+    parsed.readImpl(in);
+    ASSERT_TRUE(in.eof());
+    ASSERT_TRUE(parsed == response);
+}
+
+TEST(RequestSerialization, pagedListResponse)
+{
+    ZooKeeperPagedListResponse response;
+    response.stat.numChildren = 3;
+    response.has_more = true;
+    response.names.push_back(std::string_view("a"));
+    response.names.push_back(std::string_view("b"));
+
+    WriteBufferFromOwnString out;
+    response.writeImpl(out);
+
+    ZooKeeperPagedListResponse parsed;
+    ReadBufferFromString in(out.str());
+    parsed.readImpl(in);
+    ASSERT_TRUE(in.eof());
+    ASSERT_TRUE(parsed.has_more);
+    ASSERT_TRUE(parsed == response);
+}
+
+TEST(RequestSerialization, responseExactSize)
+{
+    Stat stat{};
+    stat.czxid = 1;
+    stat.mzxid = -2;
+    stat.ctime = 1700000000000;
+    stat.version = 7;
+    stat.ephemeralOwner = 0x1234567890;
+    stat.dataLength = 4;
+    stat.numChildren = 2;
+    stat.pzxid = 3;
+
+    std::vector<ZooKeeperResponsePtr> responses;
+    auto exists = std::make_shared<ZooKeeperExistsResponse>();
+    exists->stat = stat;
+    responses.push_back(exists);
+    auto get = std::make_shared<ZooKeeperGetResponse>();
+    get->data = "data";
+    get->stat = stat;
+    responses.push_back(get);
+    auto create = std::make_shared<ZooKeeperCreateResponse>();
+    create->path_created = "/create";
+    create->with_stat = true;
+    create->stat = stat;
+    responses.push_back(create);
+    auto list = std::make_shared<ZooKeeperListResponse>();
+    list->names.push_back(std::string_view("a"));
+    list->names.push_back(std::string_view("bc"));
+    list->stat = stat;
+    responses.push_back(list);
+    auto stat_batch = std::make_shared<ZooKeeperStatBatchResponse>();
+    stat_batch->stats.resize(2);
+    stat_batch->stats[1].error = Error::ZNONODE;
+    responses.push_back(stat_batch);
+
+    for (const auto & response : responses)
+    {
+        response->xid = 5;
+        response->zxid = 100;
+        WriteBufferFromOwnString body;
+        response->writeImpl(body);
+        ASSERT_EQ(response->sizeImpl(), body.str().size()) << response->toString();
+
+        /// Same as writing with a copy to calculate length
+        WriteBufferFromOwnString out;
+        response->writeNoCopy(out);
+        WriteBufferFromOwnString expected;
+        response->write(expected);
+        ASSERT_EQ(out.str(), expected.str()) << response->toString();
+    }
+
+    WriteBufferFromOwnString out;
+    exists->writeImpl(out);
+    ZooKeeperExistsResponse parsed;
+    ReadBufferFromString in(out.str());
+    parsed.readImpl(in);
+    ASSERT_TRUE(in.eof());
+    ASSERT_EQ(parsed.stat, stat);
+}
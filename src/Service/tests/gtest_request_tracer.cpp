@@ -0,0 +1,103 @@
+#include <Service/RequestTracer.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(RequestTracer, SpansOfStages)
+{
+    RequestTimeline timeline;
+    timeline.trace.trace_id_high = 0x1122334455667788;
+    timeline.trace.trace_id_low = 0x99aabbccddeeff00;
+    timeline.trace.span_id = 42;
+    timeline.start(1000);
+    timeline.end(RequestStage::IO, 1010);
+    timeline.end(RequestStage::FORWARD, 1050);
+    timeline.end(RequestStage::COMMIT, 2050);
+    timeline.end(RequestStage::SEND, 2060);
+
+    auto spans = RequestTracer::makeSpans(timeline, "Create", 2060, {{"zookeeper.xid", "7"}});
+    ASSERT_EQ(spans.size(), 5);
+
+    const auto & root = spans[0];
+    ASSERT_EQ(root.name, "Create");
+    ASSERT_EQ(root.span_id, 42);
+    ASSERT_EQ(root.parent_span_id, 0);
+    ASSERT_EQ(root.kind, RequestTracer::SpanKind::SERVER);
+    ASSERT_EQ(root.end_us - root.start_us, 1060);
+
+    const auto & forward = spans[2];
+    ASSERT_EQ(forward.name, "forward");
+    ASSERT_EQ(forward.kind, RequestTracer::SpanKind::CLIENT);
+    ASSERT_EQ(forward.span_id, timeline.trace.stageSpanId(RequestStage::FORWARD));
+    ASSERT_EQ(forward.parent_span_id, 42);
+    ASSERT_EQ(forward.start_us - root.start_us, 10);
+    ASSERT_EQ(forward.end_us - forward.start_us, 40);
+
+    ASSERT_EQ(spans[3].name, "commit");
+    ASSERT_EQ(spans[3].end_us - spans[3].start_us, 1000);
+    ASSERT_EQ(spans[4].name, "send");
+    ASSERT_EQ(spans[4].end_us, root.end_us);
+
+    /// Leader continues the trace under the forward span
+    RequestTimeline remote;
+    TraceContext parent{timeline.trace.trace_id_high, timeline.trace.trace_id_low, forward.span_id, 0};
+    RequestTracer::startRemote(remote, parent);
+    ASSERT_TRUE(remote.trace.sampled());
+    ASSERT_EQ(remote.trace.trace_id_low, timeline.trace.trace_id_low);
+    ASSERT_EQ(remote.trace.parent_span_id, forward.span_id);
+    ASSERT_NE(remote.trace.span_id, 0);
+}
+
+TEST(RequestTracer, OTLPFormat)
+{
+    RequestTracer::Span span;
+    span.trace_id_high = 1;
+    span.trace_id_low = 2;
+    span.span_id = 0xab;
+    span.name = "Set";
+    span.kind = RequestTracer::SpanKind::SERVER;
+    span.start_us = 1000;
+    span.end_us = 3000;
+    span.attributes = {{"zookeeper.path", "/a\"b"}};
+
+    String json = RequestTracer::formatSpans({span}, "1");
+    ASSERT_EQ(
+        json,
+        "{\"resourceSpans\":[{\"resource\":{\"attributes\":[{\"key\":\"service.name\",\"value\":{\"stringValue\":\"raftkeeper\"}},"
+        "{\"key\":\"service.instance.id\",\"value\":{\"stringValue\":\"1\"}}]},\"scopeSpans\":[{\"scope\":{\"name\":\"raftkeeper\"},"
+        "\"spans\":[{\"traceId\":\"00000000000000010000000000000002\",\"spanId\":\"00000000000000ab\",\"name\":\"Set\",\"kind\":2,"
+        "\"startTimeUnixNano\":\"1000000\",\"endTimeUnixNano\":\"3000000\","
+        "\"attributes\":[{\"key\":\"zookeeper.path\",\"value\":{\"stringValue\":\"/a\\\"b\"}}]}]}]}]}");
+}
+
+TEST(RequestTracer, Sampling)
+{
+    auto & tracer = RequestTracer::instance();
+    tracer.initialize(true, 1, "", 1000, 5, "1");
+
+    RequestTimeline timeline;
+    timeline.start(RequestTimeline::now());
+    tracer.trySample(timeline);
+    ASSERT_TRUE(timeline.trace.sampled());
+
+    auto response = std::make_shared<Coordination::ZooKeeperCreateResponse>();
+    response->xid = 7;
+    response->timeline = timeline;
+    response->timeline.end(RequestStage::SEND);
+    tracer.finishRequest(1, *response);
+    tracer.finishRequest(1, *response);
+    /// Over max_pending_spans
+    tracer.finishRequest(1, *response);
+
+    auto spans = tracer.takePendingSpans();
+    ASSERT_EQ(spans.size(), 4);
+    ASSERT_EQ(spans[0].name, "Create");
+    ASSERT_EQ(spans[0].trace_id_high, timeline.trace.trace_id_high);
+    ASSERT_EQ(tracer.droppedSpans(), 2);
+
+    tracer.initialize(true, 0, "", 1000, 10, "1");
+    RequestTimeline not_sampled;
+    tracer.trySample(not_sampled);
+    ASSERT_FALSE(not_sampled.trace.sampled());
+    tracer.shutdown();
+}
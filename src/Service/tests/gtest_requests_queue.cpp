@@ -0,0 +1,171 @@
+#include <thread>
+#include <Service/RequestsQueue.h>
+#include <Common/Stopwatch.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+RequestForSession makeRequest(int64_t session_id, bool heartbeat)
+{
+    Coordination::ZooKeeperRequestPtr request;
+    if (heartbeat)
+        request = std::make_shared<Coordination::ZooKeeperHeartbeatRequest>();
+    else
+        request = std::make_shared<Coordination::ZooKeeperGetRequest>();
+    return RequestForSession(request, session_id, 0);
+}
+
+}
+
+TEST(RequestsQueue, ControlRequestsFirst)
+{
+    RequestsQueue queue(1, 100, 2);
+
+    for (int64_t session_id = 0; session_id < 4; ++session_id)
+        queue.push(makeRequest(session_id, false));
+    for (int64_t session_id = 0; session_id < 4; ++session_id)
+        queue.push(makeRequest(session_id, true));
+
+    /// Two heartbeats, then a bulk request gets its turn
+    std::vector<Coordination::OpNum> op_nums;
+    RequestForSession request;
+    while (queue.tryPop(0, request))
+        op_nums.push_back(request.request->getOpNum());
+
+    using enum Coordination::OpNum;
+    std::vector<Coordination::OpNum> expected{Heartbeat, Heartbeat, Get, Heartbeat, Heartbeat, Get, Get, Get};
+    ASSERT_EQ(op_nums, expected);
+    ASSERT_TRUE(queue.empty());
+
+    /// Batch takes control requests first
+    queue.push(makeRequest(1, false));
+    queue.push(makeRequest(1, true));
+    std::vector<RequestForSession> requests;
+    ASSERT_EQ(queue.tryPopBatch(0, requests, 10), 2);
+    ASSERT_EQ(requests[0].request->getOpNum(), Heartbeat);
+}
+
+TEST(RequestsQueue, WaitOnBothLanes)
+{
+    RequestsQueue queue(1, 100);
+
+    RequestForSession request;
+    ASSERT_FALSE(queue.tryPop(0, request, 10));
+
+    std::thread producer(
+        [&]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            queue.push(makeRequest(1, true));
+        });
+
+    /// Waiting consumer is woken up by a control request
+    ASSERT_TRUE(queue.tryPop(0, request, 10000));
+    ASSERT_EQ(request.request->getOpNum(), Coordination::OpNum::Heartbeat);
+    producer.join();
+}
+
+TEST(RequestsQueue, PushBatch)
+{
+    RequestsQueue queue(2, 4);
+
+    std::vector<RequestForSession> requests;
+    requests.push_back(makeRequest(1, false));
+    requests.push_back(makeRequest(1, true));
+    requests.push_back(makeRequest(1, false));
+    requests.push_back(makeRequest(1, false));
+    requests.push_back(makeRequest(1, true));
+
+    /// Bulk lane of the session holds 2 requests, pushing stops at the third bulk one
+    ASSERT_EQ(queue.tryPushBatch(requests), 3);
+
+    std::vector<RequestForSession> popped;
+    ASSERT_EQ(queue.tryPopBatch(1, popped, 10), 3);
+    ASSERT_EQ(popped[0].request->getOpNum(), Coordination::OpNum::Heartbeat);
+    ASSERT_TRUE(queue.empty());
+}
+
+TEST(RequestsQueue, SetCapacity)
+{
+    RequestsQueue queue(2, 8);
+
+    /// Child queues hold 4 requests and can not grow
+    ASSERT_EQ(queue.setCapacity(100), 8);
+    ASSERT_EQ(queue.setCapacity(2), 2);
+
+    ASSERT_TRUE(queue.tryPush(makeRequest(1, false)));
+    ASSERT_FALSE(queue.tryPush(makeRequest(1, false)));
+    /// Control lane has its own capacity
+    ASSERT_TRUE(queue.tryPush(makeRequest(1, true)));
+
+    queue.setCapacity(8);
+    ASSERT_TRUE(queue.tryPush(makeRequest(1, false)));
+    ASSERT_EQ(queue.size(1), 3);
+}
+
+TEST(RequestsQueue, LeastLoadedPlacement)
+{
+    RequestsQueue queue(2, 1000, RequestsQueue::DEFAULT_CONTROL_REQUESTS_WEIGHT, true);
+
+    /// A heavy session, then sessions modulo placement puts on the same child queue
+    size_t heavy = queue.getQueueId(2);
+    for (int i = 0; i < 100; ++i)
+        queue.push(makeRequest(2, false));
+
+    for (int64_t session_id = 4; session_id < 10; session_id += 2)
+    {
+        ASSERT_NE(queue.getQueueId(session_id), heavy);
+        queue.push(makeRequest(session_id, false));
+    }
+    /// Sessions stay where they are
+    ASSERT_EQ(queue.getAssignedQueueId(2), heavy);
+    ASSERT_EQ(queue.size(heavy), 100);
+
+    /// Released by close request
+    auto close = RequestForSession(std::make_shared<Coordination::ZooKeeperCloseRequest>(), 4, 0);
+    queue.push(close);
+    size_t light = queue.getAssignedQueueId(4);
+    std::vector<RequestForSession> popped;
+    queue.tryPopBatch(light, popped, 100);
+    ASSERT_EQ(popped.size(), 4);
+    ASSERT_EQ(queue.placement->stripeOf(4).queues.count(4), 0);
+    ASSERT_EQ(queue.placement->stripeOf(6).queues.count(6), 1);
+
+    /// Modulo placement
+    RequestsQueue modulo(2, 1000);
+    ASSERT_EQ(modulo.getQueueId(3), 1);
+    ASSERT_EQ(modulo.getAssignedQueueId(4), 0);
+}
+
+TEST(RequestsQueue, PopAny)
+{
+    RequestsQueue queue(4, 100);
+
+    RequestForSession request;
+    ASSERT_FALSE(queue.tryPopAny(request));
+
+    /// Waiting consumer is woken up by a push to any child queue, not after waiting on the others in turn
+    Stopwatch watch;
+    std::thread producer(
+        [&]
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            queue.push(makeRequest(3, false));
+        });
+    ASSERT_TRUE(queue.tryPopAny(request, 10000));
+    ASSERT_EQ(request.session_id, 3);
+    ASSERT_LT(watch.elapsedMilliseconds(), 5000);
+    producer.join();
+
+    /// Batch takes requests of all child queues
+    for (int64_t session_id = 0; session_id < 8; ++session_id)
+        queue.push(makeRequest(session_id, false));
+    std::vector<RequestForSession> requests;
+    ASSERT_EQ(queue.tryPopAnyBatch(requests, 5), 5);
+    ASSERT_EQ(queue.tryPopAnyBatch(requests, 5), 3);
+    ASSERT_TRUE(queue.empty());
+    ASSERT_EQ(queue.tryPopAnyBatch(requests, 5, 10), 0);
+}
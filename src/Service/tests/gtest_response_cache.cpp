@@ -0,0 +1,73 @@
+#include <Service/ResponseCache.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+using Coordination::OpNum;
+
+namespace
+{
+
+Coordination::Stat makeStat(int64_t mzxid, int64_t pzxid)
+{
+    Coordination::Stat stat{};
+    stat.mzxid = mzxid;
+    stat.pzxid = pzxid;
+    return stat;
+}
+
+}
+
+TEST(ResponseCache, putOnSecondRead)
+{
+    ResponseCache cache(100);
+    bool should_put;
+
+    ASSERT_FALSE(cache.get(OpNum::Get, "/a", makeStat(1, 1), should_put));
+    ASSERT_FALSE(should_put);
+    ASSERT_FALSE(cache.get(OpNum::Get, "/a", makeStat(1, 1), should_put));
+    ASSERT_TRUE(should_put);
+
+    cache.put(OpNum::Get, "/a", makeStat(1, 1), std::make_shared<const String>("body"));
+    auto body = cache.get(OpNum::Get, "/a", makeStat(1, 1), should_put);
+    ASSERT_TRUE(body);
+    ASSERT_EQ(*body, "body");
+
+    /// Responses of other operations on the same path are cached separately
+    ASSERT_FALSE(cache.get(OpNum::List, "/a", makeStat(1, 1), should_put));
+    ASSERT_FALSE(should_put);
+}
+
+TEST(ResponseCache, changedStatOrWrite)
+{
+    ResponseCache cache(100);
+    bool should_put;
+
+    cache.get(OpNum::List, "/a", makeStat(1, 1), should_put);
+    cache.get(OpNum::List, "/a", makeStat(1, 1), should_put);
+    cache.put(OpNum::List, "/a", makeStat(1, 1), std::make_shared<const String>("children"));
+
+    /// A child is created
+    ASSERT_FALSE(cache.get(OpNum::List, "/a", makeStat(1, 2), should_put));
+    ASSERT_FALSE(should_put);
+
+    /// Put with a stale stat is ignored
+    cache.put(OpNum::List, "/a", makeStat(1, 1), std::make_shared<const String>("children"));
+    ASSERT_FALSE(cache.get(OpNum::List, "/a", makeStat(1, 2), should_put));
+    ASSERT_TRUE(should_put);
+    cache.put(OpNum::List, "/a", makeStat(1, 2), std::make_shared<const String>("children"));
+    ASSERT_TRUE(cache.get(OpNum::List, "/a", makeStat(1, 2), should_put));
+
+    /// Writing a child drops the entry of its parent
+    cache.invalidate("/a/b");
+    ASSERT_EQ(cache.size(), 0);
+    ASSERT_FALSE(cache.get(OpNum::List, "/a", makeStat(1, 2), should_put));
+}
+
+TEST(ResponseCache, maxEntries)
+{
+    ResponseCache cache(16);
+    bool should_put;
+    for (int i = 0; i < 1000; ++i)
+        cache.get(OpNum::Get, "/node" + std::to_string(i), makeStat(1, 1), should_put);
+    ASSERT_LE(cache.size(), 16);
+}
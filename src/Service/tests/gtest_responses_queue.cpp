@@ -0,0 +1,32 @@
+#include <Service/ResponsesQueue.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(ResponsesQueue, splitWatchEventByShard)
+{
+    ResponsesQueue queue(2);
+    auto watch_response = std::make_shared<Coordination::ZooKeeperWatchResponse>();
+    auto response = std::make_shared<Coordination::ZooKeeperHeartbeatResponse>();
+
+    ResponsesForSessions responses;
+    responses.emplace_back(2, response);
+    responses.emplace_back(1, watch_response, std::make_shared<const Watchers>(Watchers{1, 2, 3, 4}));
+    responses.emplace_back(3, response);
+    queue.pushBatch(responses);
+    ASSERT_EQ(queue.size(), 4);
+
+    /// Responses of a session keep their order, every shard gets the watchers of its own
+    ResponsesForSessions shard_responses;
+    ASSERT_EQ(queue.tryPopBatch(0, shard_responses, 10), 2);
+    ASSERT_EQ(shard_responses[0].session_id, 2);
+    ASSERT_FALSE(shard_responses[0].watchers);
+    ASSERT_EQ(*shard_responses[1].watchers, Watchers({2, 4}));
+    ASSERT_EQ(shard_responses[1].response, watch_response);
+
+    shard_responses.clear();
+    ASSERT_EQ(queue.tryPopBatch(1, shard_responses, 10), 2);
+    ASSERT_EQ(*shard_responses[0].watchers, Watchers({1, 3}));
+    ASSERT_EQ(shard_responses[1].session_id, 3);
+}
@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include <Service/SessionExpiryQueue.h>
+#include <Service/SessionManager.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+int64_t nowMilliseconds()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+std::vector<int64_t> sorted(std::vector<int64_t> sessions)
+{
+    std::sort(sessions.begin(), sessions.end());
+    return sessions;
+}
+}
+
+TEST(SessionExpiryQueue, expireAndHeartbeat)
+{
+    SessionExpiryQueue queue(500);
+    int64_t now = nowMilliseconds();
+
+    queue.setSessionExpirationTime(1, now - 1);
+    queue.setSessionExpirationTime(2, now + 10000);
+    queue.setSessionExpirationTime(3, now - 1000);
+    ASSERT_EQ(sorted(queue.getExpiredSessions()), std::vector<int64_t>({1, 3}));
+
+    /// Heartbeat moves the session out of the expired list
+    queue.addNewSessionOrUpdate(1, 10000);
+    ASSERT_EQ(queue.getExpiredSessions(), std::vector<int64_t>({3}));
+
+    ASSERT_TRUE(queue.remove(3));
+    ASSERT_FALSE(queue.remove(3));
+    ASSERT_TRUE(queue.getExpiredSessions().empty());
+
+    /// Expired again
+    queue.setSessionExpirationTime(2, now - 1);
+    ASSERT_EQ(queue.getExpiredSessions(), std::vector<int64_t>({2}));
+
+    auto session_to_expiration_time = queue.sessionToExpirationTime();
+    ASSERT_EQ(session_to_expiration_time.size(), 2);
+    ASSERT_EQ(session_to_expiration_time[2], now - 1);
+
+    queue.clear();
+    ASSERT_TRUE(queue.getExpiredSessions().empty());
+    ASSERT_TRUE(queue.sessionToExpirationTime().empty());
+}
+
+TEST(SessionExpiryQueue, expireBeyondWheelTurn)
+{
+    SessionExpiryQueue queue(10);
+    int64_t now = nowMilliseconds();
+
+    /// Share a slot with sessions expiring a turn earlier, must not expire with them
+    queue.setSessionExpirationTime(1, now - 1);
+    queue.setSessionExpirationTime(2, now - 1 + 10 * 4096 * 10);
+    ASSERT_EQ(queue.getExpiredSessions(), std::vector<int64_t>({1}));
+    ASSERT_EQ(queue.getExpiredSessions(), std::vector<int64_t>({1}));
+}
+
+TEST(SessionManager, trackOnlyLocalSessions)
+{
+    SessionManager manager(500);
+    int64_t local = manager.getSessionID(10000);
+    int64_t remote = manager.getSessionID(10000);
+    manager.addLocalSession(local);
+    ASSERT_EQ(manager.sessionToExpirationTime().size(), 2);
+
+    manager.setTrackOnlyLocalSessions(true);
+    auto session_to_expiration_time = manager.sessionToExpirationTime();
+    ASSERT_EQ(session_to_expiration_time.size(), 1);
+    ASSERT_TRUE(session_to_expiration_time.contains(local));
+
+    /// Remote sessions are not tracked by requests or new sessions
+    manager.updateSessionExpirationTime(remote);
+    int64_t new_remote = manager.getSessionID(10000);
+    ASSERT_EQ(manager.sessionToExpirationTime().size(), 1);
+    ASSERT_TRUE(manager.contains(new_remote));
+
+    manager.removeLocalSession(local);
+    ASSERT_TRUE(manager.sessionToExpirationTime().empty());
+
+    manager.setTrackOnlyLocalSessions(false);
+    ASSERT_EQ(manager.sessionToExpirationTime().size(), 3);
+    ASSERT_TRUE(manager.getDeadSessions().empty());
+}
+
+TEST(SessionManager, updateSessionExpirationTime)
+{
+    SessionManager manager(500);
+    int64_t session_id = manager.getSessionID(10000);
+    auto expiration_time = manager.sessionToExpirationTime().at(session_id);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(600));
+    ASSERT_TRUE(manager.updateSessionExpirationTime(session_id));
+    ASSERT_GT(manager.sessionToExpirationTime().at(session_id), expiration_time);
+
+    /// Heartbeat of an expired session is answered by the pipeline
+    manager.expireSessions({session_id});
+    ASSERT_FALSE(manager.updateSessionExpirationTime(session_id));
+}
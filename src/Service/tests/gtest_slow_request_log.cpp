@@ -0,0 +1,72 @@
+#include <Service/SlowRequestLog.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+
+SlowRequestLog::Record makeRecord(Coordination::XID xid)
+{
+    SlowRequestLog::Record record;
+    record.time_ms = 1000;
+    record.session_id = 1;
+    record.xid = xid;
+    record.opnum = Coordination::OpNum::Create;
+    record.path = "/a";
+    record.request_bytes = 43;
+    record.response_bytes = 21;
+    record.total_us = 2500;
+    record.stage_us[static_cast<size_t>(RequestStage::IO)] = 10;
+    record.stage_us[static_cast<size_t>(RequestStage::APPEND)] = 2490;
+    return record;
+}
+
+}
+
+TEST(SlowRequestLog, Threshold)
+{
+    auto & slow_log = SlowRequestLog::instance();
+    slow_log.initialize(true, 2, 10, "");
+
+    RequestTimeline timeline;
+    ASSERT_FALSE(slow_log.isSlow(timeline));
+
+    timeline.start(1000);
+    timeline.end(RequestStage::APPEND, 5000);
+    /// Not sent yet
+    ASSERT_FALSE(slow_log.isSlow(timeline));
+
+    timeline.end(RequestStage::SEND, 2999);
+    ASSERT_FALSE(slow_log.isSlow(timeline));
+    timeline.end(RequestStage::SEND, 3000);
+    ASSERT_TRUE(slow_log.isSlow(timeline));
+
+    slow_log.initialize(false, 2, 10, "");
+    ASSERT_FALSE(slow_log.isSlow(timeline));
+}
+
+TEST(SlowRequestLog, Ring)
+{
+    auto & slow_log = SlowRequestLog::instance();
+    slow_log.initialize(true, 1, 3, "");
+    for (Coordination::XID xid = 1; xid <= 5; ++xid)
+        slow_log.add(makeRecord(xid));
+
+    auto records = slow_log.getRecords();
+    ASSERT_EQ(records.size(), 3);
+    ASSERT_EQ(records.front().xid, 3);
+    ASSERT_EQ(records.back().xid, 5);
+
+    slow_log.reset();
+    ASSERT_TRUE(slow_log.getRecords().empty());
+}
+
+TEST(SlowRequestLog, Format)
+{
+    String line = SlowRequestLog::format(makeRecord(12));
+    /// Time is local
+    auto columns = line.substr(line.find('\t'));
+    ASSERT_EQ(columns, "\t0x1\t12\tCreate\t/a\t43\t21\tOk\t2500\tio=10,append=2490");
+    ASSERT_NE(line.find(".000\t"), String::npos);
+}
@@ -0,0 +1,49 @@
+#include <Service/SnapshotScheduler.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(SnapshotScheduler, deferUnderLoad)
+{
+    SnapshotScheduler scheduler(1000, 500, 100, 10, 0);
+    scheduler.setLastSnapshotIndex(0);
+
+    /// Rate is unknown when the snapshot becomes due
+    ASSERT_FALSE(scheduler.shouldCreate(10000, 1000, 0));
+    /// 200 commits per second
+    ASSERT_FALSE(scheduler.shouldCreate(11000, 1200, 0));
+    ASSERT_EQ(scheduler.getCommitRate(), 200);
+
+    /// 50 commits per second, but commit lag is high
+    ASSERT_FALSE(scheduler.shouldCreate(12000, 1250, 20));
+    ASSERT_EQ(scheduler.getCommitRate(), 50);
+    ASSERT_TRUE(scheduler.shouldCreate(12010, 1251, 0));
+}
+
+TEST(SnapshotScheduler, maxDeferredDistance)
+{
+    SnapshotScheduler scheduler(1000, 500, 100, 10, 0);
+    scheduler.setLastSnapshotIndex(1000);
+
+    ASSERT_FALSE(scheduler.shouldCreate(10000, 2000, 100));
+    ASSERT_FALSE(scheduler.shouldCreate(10100, 2499, 100));
+    ASSERT_TRUE(scheduler.shouldCreate(10200, 2500, 100));
+
+    /// Never deferred if max deferred distance is 0
+    SnapshotScheduler disabled(1000, 0, 100, 10, 1000);
+    ASSERT_TRUE(disabled.shouldCreate(10000, 1000, 100));
+}
+
+TEST(SnapshotScheduler, stagger)
+{
+    SnapshotScheduler first(1000, 500, 0, 0, 1000);
+    SnapshotScheduler second(1000, 500, 0, 0, 1000);
+    first.setMember(0, 2);
+    second.setMember(1, 2);
+
+    for (UInt64 now = 10000; now < 14000; now += 100)
+        ASSERT_NE(first.shouldCreate(now, 1000, 0), second.shouldCreate(now, 1000, 0));
+
+    ASSERT_TRUE(first.shouldCreate(10500, 1000, 0));
+    ASSERT_TRUE(second.shouldCreate(11500, 1000, 0));
+}
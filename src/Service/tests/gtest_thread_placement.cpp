@@ -0,0 +1,15 @@
+#include <Service/ThreadPlacement.h>
+#include <Common/Exception.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(ThreadPlacement, ParseCpuList)
+{
+    ASSERT_EQ(ThreadPlacement::parseCpuList("0-3,8"), (std::vector<int>{0, 1, 2, 3, 8}));
+    ASSERT_EQ(ThreadPlacement::parseCpuList("5"), (std::vector<int>{5}));
+    ASSERT_EQ(ThreadPlacement::parseCpuList("10-11, 2"), (std::vector<int>{10, 11, 2}));
+
+    for (const auto * list : {"", "0-3,", "3-1", "a", "1-b", "1024"})
+        ASSERT_THROW(ThreadPlacement::parseCpuList(list), Exception) << list;
+}
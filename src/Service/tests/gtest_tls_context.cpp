@@ -0,0 +1,37 @@
+#include <Poco/AutoPtr.h>
+#include <Poco/Util/MapConfiguration.h>
+
+#include <Service/TLSContext.h>
+#include <Common/Exception.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+TEST(TLSContext, Disabled)
+{
+    Poco::AutoPtr<Poco::Util::MapConfiguration> config(new Poco::Util::MapConfiguration);
+    TLSContext context;
+    context.initialize(*config);
+
+    ASSERT_FALSE(context.clientPortEnabled());
+    ASSERT_FALSE(context.forwardingEnabled());
+    ASSERT_EQ(context.serverContext(), nullptr);
+    ASSERT_EQ(context.clientContext(), nullptr);
+}
+
+TEST(TLSContext, InvalidConfig)
+{
+    Poco::AutoPtr<Poco::Util::MapConfiguration> config(new Poco::Util::MapConfiguration);
+    config->setBool("keeper.tls.client_port", true);
+
+    /// No certificate
+    ASSERT_THROW(TLSContext().initialize(*config), Exception);
+
+    config->setString("keeper.tls.certificate_file", "/nonexistent/server.crt");
+    config->setString("keeper.tls.private_key_file", "/nonexistent/server.key");
+    ASSERT_THROW(TLSContext().initialize(*config), Exception);
+
+    /// Peer can not be verified without CA
+    config->setBool("keeper.tls.verify_peer", true);
+    ASSERT_THROW(TLSContext().initialize(*config), Exception);
+}
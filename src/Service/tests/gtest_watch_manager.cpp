@@ -0,0 +1,249 @@
+#include <algorithm>
+
+#include <Service/WatchManager.h>
+#include <gtest/gtest.h>
+
+using namespace RK;
+
+namespace
+{
+struct WatchEvent
+{
+    int64_t session_id;
+    String path;
+    Coordination::Event type;
+};
+
+/// Fan out watch events like the response thread
+std::vector<WatchEvent> fanOut(const ResponsesForSessions & responses)
+{
+    std::vector<WatchEvent> events;
+    for (const auto & response : responses)
+    {
+        EXPECT_TRUE(response.watchers);
+        const auto * watch_response = dynamic_cast<const Coordination::ZooKeeperWatchResponse *>(response.response.get());
+        for (auto session_id : *response.watchers)
+            events.push_back({session_id, watch_response->path, watch_response->type});
+    }
+    return events;
+}
+}
+
+TEST(WatchManager, triggerAndCount)
+{
+    WatchManager watch_manager;
+    watch_manager.registerWatches(String("/a"), 1, Coordination::OpNum::Get);
+    watch_manager.registerWatches(String("/a"), 2, Coordination::OpNum::Exists);
+    watch_manager.registerWatches(String("/a"), 1, Coordination::OpNum::List);
+    watch_manager.registerWatches(String("/"), 3, Coordination::OpNum::List);
+
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 3);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 4);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 3);
+
+    /// Session 1 still watches children of /a, one event is shared by both sessions
+    auto responses = watch_manager.processWatches(String("/a"), Coordination::Event::CHANGED);
+    ASSERT_EQ(responses.size(), 1);
+    ASSERT_EQ(fanOut(responses).size(), 2);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 2);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 2);
+
+    auto events = fanOut(watch_manager.processWatches(String("/a"), Coordination::Event::DELETED));
+    ASSERT_EQ(events.size(), 2);
+    ASSERT_EQ(events[0].session_id, 1);
+    ASSERT_EQ(events[0].type, Coordination::Event::DELETED);
+    ASSERT_EQ(events[1].session_id, 3);
+    ASSERT_EQ(events[1].path, "/");
+    ASSERT_EQ(events[1].type, Coordination::Event::CHILD);
+
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 0);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 0);
+}
+
+TEST(WatchManager, cleanDeadWatchesAfterReregister)
+{
+    WatchManager watch_manager;
+
+    /// Stale path ids of the session are accumulated and compacted
+    for (int i = 0; i < 100; i++)
+    {
+        String path = "/node" + std::to_string(i % 10);
+        watch_manager.registerWatches(path, 1, Coordination::OpNum::Get);
+        watch_manager.registerWatches(path, 2, Coordination::OpNum::Get);
+        if (i % 3 == 0)
+            watch_manager.processWatches(path, Coordination::Event::CHANGED);
+    }
+
+    watch_manager.cleanDeadWatches(1);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 1);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), watch_manager.getWatchedPathsCount());
+
+    watch_manager.cleanDeadWatches(2);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 0);
+}
+
+TEST(WatchManager, persistentWatches)
+{
+    WatchManager watch_manager;
+    watch_manager.addPersistentWatch("/a", 1, Coordination::AddWatchMode::PersistentRecursive);
+    watch_manager.addPersistentWatch("/a/b", 2, Coordination::AddWatchMode::Persistent);
+    watch_manager.registerWatches(String("/a/b"), 2, Coordination::OpNum::Get);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 3);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 2);
+
+    /// Recursive watch gets the event of the descendant, persistent watch gets child event of the parent
+    auto events = fanOut(watch_manager.processWatches(String("/a/b/c"), Coordination::Event::CREATED));
+    ASSERT_EQ(events.size(), 2);
+    ASSERT_EQ(events[0].session_id, 1);
+    ASSERT_EQ(events[0].path, "/a/b/c");
+    ASSERT_EQ(events[0].type, Coordination::Event::CREATED);
+    ASSERT_EQ(events[1].session_id, 2);
+    ASSERT_EQ(events[1].path, "/a/b");
+    ASSERT_EQ(events[1].type, Coordination::Event::CHILD);
+
+    /// Session 2 is notified once, persistent watches are kept
+    for (int i = 0; i < 2; i++)
+        ASSERT_EQ(fanOut(watch_manager.processWatches(String("/a/b"), Coordination::Event::CHANGED)).size(), 2);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 2);
+    ASSERT_TRUE(watch_manager.processWatches(String("/b"), Coordination::Event::CHANGED).empty());
+
+    watch_manager.cleanDeadWatches(1);
+    watch_manager.cleanDeadWatches(2);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getWatchedPathsCount(), 0);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 0);
+}
+
+TEST(WatchManager, setWatches2)
+{
+    WatchManager watch_manager;
+    watch_manager.setMaxWatchesPerSession(1);
+
+    auto request = std::make_shared<Coordination::ZooKeeperSetWatchesRequest>();
+    request->op_num = Coordination::OpNum::SetWatches2;
+    request->relative_zxid = 10;
+    request->data_watches = {"/a"};
+    request->persistent_watches = {"/b"};
+    request->persistent_recursive_watches = {"/c"};
+
+    /// /a is changed after relative zxid
+    std::unordered_map<String, std::pair<int64_t, int64_t>> watch_nodes_info{{"/a", {11, 5}}, {"/b", {11, 11}}};
+    RequestForSession request_for_session(request, 1, 0);
+    auto events = fanOut(watch_manager.processRequestSetWatch(request_for_session, watch_nodes_info));
+    ASSERT_EQ(events.size(), 1);
+    ASSERT_EQ(events[0].path, "/a");
+    ASSERT_EQ(events[0].type, Coordination::Event::CHANGED);
+
+    /// Persistent watches are set again beyond the limit and kept when triggered
+    ASSERT_EQ(watch_manager.getSessionWatchesCount(1), 2);
+    for (int i = 0; i < 2; i++)
+    {
+        ASSERT_EQ(fanOut(watch_manager.processWatches(String("/b"), Coordination::Event::CHANGED)).size(), 1);
+        events = fanOut(watch_manager.processWatches(String("/c/d"), Coordination::Event::CREATED));
+        ASSERT_EQ(events.size(), 1);
+        ASSERT_EQ(events[0].session_id, 1);
+    }
+
+    watch_manager.cleanDeadWatches(1);
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+}
+
+TEST(WatchManager, maxWatchesPerSession)
+{
+    WatchManager watch_manager;
+    watch_manager.setMaxWatchesPerSession(2);
+    ASSERT_TRUE(watch_manager.registerWatches(String("/a"), 1, Coordination::OpNum::Get));
+    ASSERT_TRUE(watch_manager.addPersistentWatch("/b", 1, Coordination::AddWatchMode::Persistent));
+    ASSERT_EQ(watch_manager.getSessionWatchesCount(1), 2);
+
+    /// Paths watched already are accepted, new ones are not
+    ASSERT_TRUE(watch_manager.registerWatches(String("/a"), 1, Coordination::OpNum::List));
+    ASSERT_TRUE(watch_manager.addPersistentWatch("/b", 1, Coordination::AddWatchMode::Persistent));
+    ASSERT_FALSE(watch_manager.registerWatches(String("/c"), 1, Coordination::OpNum::Exists));
+    ASSERT_FALSE(watch_manager.addPersistentWatch("/b", 1, Coordination::AddWatchMode::PersistentRecursive));
+    ASSERT_EQ(watch_manager.getSessionWatchesCount(1), 2);
+    ASSERT_TRUE(watch_manager.registerWatches(String("/c"), 2, Coordination::OpNum::Exists));
+
+    /// Triggered watches make room
+    fanOut(watch_manager.processWatches(String("/a"), Coordination::Event::CHANGED));
+    fanOut(watch_manager.processWatches(String("/a"), Coordination::Event::CHILD));
+    ASSERT_EQ(watch_manager.getSessionWatchesCount(1), 1);
+    ASSERT_TRUE(watch_manager.registerWatches(String("/c"), 1, Coordination::OpNum::Exists));
+
+    watch_manager.setMaxWatchesPerSession(0);
+    ASSERT_TRUE(watch_manager.registerWatches(String("/d"), 1, Coordination::OpNum::Exists));
+    ASSERT_EQ(watch_manager.getSessionWatchesCount(1), 3);
+}
+
+TEST(WatchManager, processRemovedPaths)
+{
+    WatchManager watch_manager;
+    watch_manager.registerWatches(String("/a/e1"), 1, Coordination::OpNum::Exists);
+    watch_manager.registerWatches(String("/a/e2"), 2, Coordination::OpNum::Get);
+    watch_manager.registerWatches(String("/a"), 3, Coordination::OpNum::List);
+    watch_manager.addPersistentWatch("/a", 4, Coordination::AddWatchMode::Persistent);
+
+    /// Parent of removed paths is notified once
+    auto events = fanOut(watch_manager.processRemovedPaths({"/a/e1", "/a/e2", "/a/e3"}));
+    ASSERT_EQ(events.size(), 4);
+    ASSERT_EQ(events[0].session_id, 1);
+    ASSERT_EQ(events[0].path, "/a/e1");
+    ASSERT_EQ(events[0].type, Coordination::Event::DELETED);
+    ASSERT_EQ(events[1].session_id, 2);
+    ASSERT_EQ(events[1].path, "/a/e2");
+    ASSERT_EQ(events[1].type, Coordination::Event::DELETED);
+    for (size_t i = 2; i < events.size(); i++)
+    {
+        ASSERT_EQ(events[i].path, "/a");
+        ASSERT_EQ(events[i].type, Coordination::Event::CHILD);
+    }
+
+    watch_manager.cleanDeadWatches(std::vector<int64_t>{1, 2, 3, 4});
+    ASSERT_EQ(watch_manager.getTotalWatchesCount(), 0);
+    ASSERT_EQ(watch_manager.getSessionsWithWatchesCount(), 0);
+}
+
+TEST(WatchManager, memoryUsage)
+{
+    WatchManager watch_manager;
+    auto empty_usage = watch_manager.getApproximateMemoryUsage();
+
+    String long_path = "/" + String(100, 'a');
+    watch_manager.registerWatches(long_path, 1, Coordination::OpNum::Get);
+    watch_manager.registerWatches(String("/b"), 2, Coordination::OpNum::List);
+    auto usage = watch_manager.getApproximateMemoryUsage();
+    ASSERT_GT(usage, empty_usage + long_path.size());
+
+    /// Path is released, buffers of the tables are kept
+    watch_manager.cleanDeadWatches(std::vector<int64_t>{1, 2});
+    auto cleaned_usage = watch_manager.getApproximateMemoryUsage();
+    ASSERT_LT(cleaned_usage, usage - long_path.size());
+}
+
+TEST(WatchManager, dumpByChunks)
+{
+    WatchManager watch_manager;
+    size_t sessions = DUMP_CHUNK_SIZE + 10;
+    for (size_t i = 1; i <= sessions; ++i)
+        watch_manager.registerWatches(String("/a"), static_cast<int64_t>(i), Coordination::OpNum::Get);
+    watch_manager.registerWatches(String("/b"), 1, Coordination::OpNum::List);
+    watch_manager.addPersistentWatch("/c", 2, Coordination::AddWatchMode::Persistent);
+
+    Strings chunks;
+    watch_manager.dumpWatches([&chunks](String && chunk) { chunks.push_back(std::move(chunk)); });
+    ASSERT_EQ(chunks.size(), size_t(2));
+    String dump = chunks[0] + chunks[1];
+    /// A line of every session and one of every watch
+    ASSERT_EQ(std::count(dump.begin(), dump.end(), '\n'), static_cast<int64_t>(sessions * 2 + 2));
+    ASSERT_NE(dump.find("0x1\n"), String::npos);
+    ASSERT_NE(dump.find("\t/c\n"), String::npos);
+
+    String by_path;
+    watch_manager.dumpWatchesByPath([&by_path](String && chunk) { by_path += chunk; });
+    ASSERT_EQ(by_path.find("/a\n"), size_t(0));
+    ASSERT_NE(by_path.find("/b\n\t0x1\n"), String::npos);
+    ASSERT_NE(by_path.find("/c\n\t0x2\n"), String::npos);
+}
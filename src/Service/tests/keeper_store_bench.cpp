@@ -0,0 +1,354 @@
+#include <algorithm>
+#include <memory>
+#include <optional>
+#include <random>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <Service/KeeperStore.h>
+#include <Common/FlatHashMap.h>
+#include <Common/HashFunctions.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+
+/** Benchmarks of KeeperStore::processRequest over synthetic trees, for example
+  *     keeper_store_bench --benchmark_filter='Get/nodes:1000000'
+  *
+  * Arguments of every benchmark describe the tree:
+  *     nodes - leaves of the tree,
+  *     depth - depth of the leaves, at least 3: /bench/l0/.../d<dir>/n<leaf>,
+  *     fan_out - leaves of a directory,
+  *     data_size - bytes of data of a leaf,
+  *     watches - sessions holding a persistent watch on each of the hot leaves, which Set and Multi change.
+  *
+  * A tree is built once for a set of arguments and kept for the benchmarks using it, writes leave it as it was.
+  * Requests are processed like the request processor does, writes with the zxid of their log entry, and responses
+  * and watch events are popped from the responses queue as the response thread would.
+  *
+  * PathHash compares hash functions of paths of the data tree on paths of the same shape, and reports how they
+  * spread the paths: bucket_skew is the largest bucket of data tree divided by the average one, and probe_groups
+  * is the average groups of FlatHashMap probed to find a path.
+  */
+
+using namespace RK;
+using namespace Coordination;
+
+namespace
+{
+
+struct TreeParams
+{
+    int64_t nodes;
+    int64_t depth;
+    int64_t fan_out;
+    int64_t data_size;
+    int64_t watches;
+
+    bool operator==(const TreeParams &) const = default;
+};
+
+TreeParams paramsOf(const benchmark::State & state)
+{
+    return {state.range(0), std::max(state.range(1), int64_t(3)), std::max(state.range(2), int64_t(1)), state.range(3), state.range(4)};
+}
+
+/// Set and Multi change the first of the leaves, which have watches
+constexpr size_t HOT_LEAVES = 1024;
+
+class SyntheticTree
+{
+public:
+    explicit SyntheticTree(const TreeParams & params_) : params(params_), store(DEAD_SESSION_CHECK_PERIOD_MS)
+    {
+        session_id = newSession();
+
+        String base = "/bench";
+        create(base, "");
+        for (int64_t level = 0; level + 3 < params.depth; ++level)
+        {
+            base += "/l" + std::to_string(level);
+            create(base, "");
+        }
+
+        String data(static_cast<size_t>(params.data_size), 'x');
+        for (int64_t leaf = 0; leaf < params.nodes; ++leaf)
+        {
+            if (leaf % params.fan_out == 0)
+            {
+                dirs.push_back(base + "/d" + std::to_string(leaf / params.fan_out));
+                create(dirs.back(), "");
+            }
+            leaves.push_back(dirs.back() + "/n" + std::to_string(leaf));
+            create(leaves.back(), data);
+        }
+
+        for (int64_t i = 0; i < params.watches; ++i)
+        {
+            int64_t watcher = newSession();
+            for (size_t leaf = 0; leaf < std::min(leaves.size(), HOT_LEAVES); ++leaf)
+            {
+                auto request = std::make_shared<ZooKeeperAddWatchRequest>();
+                request->path = leaves[leaf];
+                request->mode = AddWatchMode::Persistent;
+                process(request, watcher);
+            }
+        }
+    }
+
+    const TreeParams params;
+
+    /// Process a request of the session of the benchmark, writes get the next zxid like when they are committed
+    void process(const ZooKeeperRequestPtr & request) { process(request, session_id); }
+
+    void create(const String & path, const String & data)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = data;
+        process(request);
+    }
+
+    void remove(const String & path)
+    {
+        auto request = std::make_shared<ZooKeeperRemoveRequest>();
+        request->path = path;
+        process(request);
+    }
+
+    const String & randomDir() { return dirs[std::uniform_int_distribution<size_t>(0, dirs.size() - 1)(rng)]; }
+    const String & randomLeaf() { return leaves[std::uniform_int_distribution<size_t>(0, leaves.size() - 1)(rng)]; }
+    const String & randomHotLeaf()
+    {
+        return leaves[std::uniform_int_distribution<size_t>(0, std::min(leaves.size(), HOT_LEAVES) - 1)(rng)];
+    }
+
+    /// Unique name of a node created by a benchmark
+    String newPath() { return randomDir() + "/t" + std::to_string(next_node++); }
+
+private:
+    static constexpr int64_t DEAD_SESSION_CHECK_PERIOD_MS = 500;
+    static constexpr int32_t SESSION_TIMEOUT_MS = 1000 * 3600;
+
+    void process(const ZooKeeperRequestPtr & request, int64_t session)
+    {
+        request->xid = ++xid;
+        std::optional<int64_t> log_zxid;
+        if (!request->isReadRequest())
+            log_zxid = store.getZxid() + 1;
+        store.processRequest(responses_queue, {request, session, 0}, log_zxid);
+
+        ResponseForSession response;
+        while (responses_queue.tryPop(response))
+            benchmark::DoNotOptimize(response);
+    }
+
+    int64_t newSession()
+    {
+        auto request = std::make_shared<ZooKeeperNewSessionRequest>();
+        request->internal_id = ++xid;
+        request->session_timeout_ms = SESSION_TIMEOUT_MS;
+        request->server_id = 1;
+        store.processRequest(responses_queue, {request, request->internal_id, 0}, store.getZxid() + 1);
+
+        ResponseForSession response;
+        if (!responses_queue.tryPop(response))
+            throw std::runtime_error("No response of new session");
+        return dynamic_cast<const ZooKeeperNewSessionResponse &>(*response.response).session_id;
+    }
+
+    KeeperStore store;
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    int64_t session_id;
+    int32_t xid = 0;
+
+    std::vector<String> dirs;
+    std::vector<String> leaves;
+    std::mt19937_64 rng{0};
+    UInt64 next_node = 0;
+};
+
+/// The tree of the last arguments, benchmarks are run one after another so that it is rebuilt when they change
+SyntheticTree & getTree(const benchmark::State & state)
+{
+    static std::unique_ptr<SyntheticTree> tree;
+    auto params = paramsOf(state);
+    if (!tree || tree->params != params)
+    {
+        tree.reset();
+        tree = std::make_unique<SyntheticTree>(params);
+    }
+    return *tree;
+}
+
+void treeArguments(benchmark::internal::Benchmark * bench)
+{
+    bench->ArgNames({"nodes", "depth", "fan_out", "data_size", "watches"});
+    /// Every row varies one of the defaults
+    const std::vector<int64_t> defaults{100000, 4, 100, 128, 0};
+    auto vary = [&](size_t arg, std::initializer_list<int64_t> values)
+    {
+        for (int64_t value : values)
+        {
+            auto args = defaults;
+            args[arg] = value;
+            bench->Args(args);
+        }
+    };
+    bench->Args(defaults);
+    vary(0, {10000, 1000000});
+    vary(1, {3, 8, 16});
+    vary(2, {10, 1000, 10000});
+    vary(3, {16, 1024, 8192});
+    vary(4, {10, 100});
+    bench->Unit(benchmark::kMicrosecond);
+}
+
+void Create(benchmark::State & state)
+{
+    auto & tree = getTree(state);
+    std::vector<String> created;
+    for (auto _ : state)
+    {
+        created.push_back(tree.newPath());
+        tree.create(created.back(), String(static_cast<size_t>(tree.params.data_size), 'x'));
+    }
+
+    /// Not timed after the loop
+    for (const auto & path : created)
+        tree.remove(path);
+}
+
+void Get(benchmark::State & state)
+{
+    auto & tree = getTree(state);
+    for (auto _ : state)
+    {
+        auto request = std::make_shared<ZooKeeperGetRequest>();
+        request->path = tree.randomLeaf();
+        tree.process(request);
+    }
+}
+
+void Set(benchmark::State & state)
+{
+    auto & tree = getTree(state);
+    String data(static_cast<size_t>(tree.params.data_size), 'y');
+    for (auto _ : state)
+    {
+        auto request = std::make_shared<ZooKeeperSetRequest>();
+        request->path = tree.randomHotLeaf();
+        request->data = data;
+        tree.process(request);
+    }
+}
+
+void List(benchmark::State & state)
+{
+    auto & tree = getTree(state);
+    for (auto _ : state)
+    {
+        auto request = std::make_shared<ZooKeeperSimpleListRequest>();
+        request->path = tree.randomDir();
+        tree.process(request);
+    }
+}
+
+void Remove(benchmark::State & state)
+{
+    auto & tree = getTree(state);
+    constexpr size_t BATCH = 10000;
+    std::vector<String> to_remove;
+    for (auto _ : state)
+    {
+        if (to_remove.empty())
+        {
+            state.PauseTiming();
+            for (size_t i = 0; i < BATCH; ++i)
+            {
+                to_remove.push_back(tree.newPath());
+                tree.create(to_remove.back(), String(static_cast<size_t>(tree.params.data_size), 'x'));
+            }
+            state.ResumeTiming();
+        }
+        tree.remove(to_remove.back());
+        to_remove.pop_back();
+    }
+
+    for (const auto & path : to_remove)
+        tree.remove(path);
+}
+
+/// Create, set and remove, the tree is not changed but the set leaf
+void Multi(benchmark::State & state)
+{
+    auto & tree = getTree(state);
+    String data(static_cast<size_t>(tree.params.data_size), 'z');
+    for (auto _ : state)
+    {
+        auto request = std::make_shared<ZooKeeperMultiRequest>();
+        String path = tree.newPath();
+
+        auto create = std::make_shared<ZooKeeperCreateRequest>();
+        create->path = path;
+        create->data = data;
+        request->requests.push_back(create);
+
+        auto set = std::make_shared<ZooKeeperSetRequest>();
+        set->path = tree.randomHotLeaf();
+        set->data = data;
+        request->requests.push_back(set);
+
+        auto remove = std::make_shared<ZooKeeperRemoveRequest>();
+        remove->path = path;
+        request->requests.push_back(remove);
+
+        tree.process(request);
+    }
+}
+
+template <typename Hash>
+void PathHash(benchmark::State & state)
+{
+    const auto params = paramsOf(state);
+    std::vector<String> paths;
+    paths.reserve(static_cast<size_t>(params.nodes));
+    String base = "/bench";
+    for (int64_t level = 0; level + 3 < params.depth; ++level)
+        base += "/l" + std::to_string(level);
+    for (int64_t leaf = 0; leaf < params.nodes; ++leaf)
+        paths.push_back(base + "/d" + std::to_string(leaf / params.fan_out) + "/n" + std::to_string(leaf));
+
+    Hash hash;
+    size_t i = 0;
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(hash(paths[i]));
+        if (++i == paths.size())
+            i = 0;
+    }
+
+    constexpr size_t BUCKETS = KeeperStore::DEFAULT_DATA_TREE_BUCKET_NUM;
+    std::vector<size_t> bucket_sizes(BUCKETS);
+    FlatHashMap<String, size_t, Hash> map;
+    for (const auto & path : paths)
+    {
+        ++bucket_sizes[hash(path) % BUCKETS];
+        map.insert_or_assign(path, 0);
+    }
+    double average = static_cast<double>(paths.size()) / static_cast<double>(BUCKETS);
+    state.counters["bucket_skew"] = static_cast<double>(*std::max_element(bucket_sizes.begin(), bucket_sizes.end())) / average;
+    state.counters["probe_groups"] = map.averageProbeGroups();
+}
+
+}
+
+BENCHMARK_TEMPLATE(PathHash, std::hash<String>)->Apply(treeArguments);
+BENCHMARK_TEMPLATE(PathHash, StringHash)->Apply(treeArguments);
+BENCHMARK(Create)->Apply(treeArguments);
+BENCHMARK(Get)->Apply(treeArguments);
+BENCHMARK(Set)->Apply(treeArguments);
+BENCHMARK(List)->Apply(treeArguments);
+BENCHMARK(Remove)->Apply(treeArguments);
+BENCHMARK(Multi)->Apply(treeArguments);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,500 @@
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <Common/IO/ReadBufferFromMemory.h>
+#include <Common/IO/WriteBufferFromString.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+#include <ZooKeeper/ZooKeeperIO.h>
+
+/** Benchmarks of the protocol work of ConnectionHandler, for example
+  *     protocol_bench --benchmark_filter='Encode/List'
+  *
+  * Decode/<op> parses a request as parseRequest does: xid, opnum, request of the factory, readImpl and the hash of the
+  * path. Encode/<op> serializes a response as the response loop does, by writeNoCopy to a buffer reused like free
+  * buffers of connections, or by getSerialized for watch events.
+  *
+  * Arguments are of the request or response:
+  *     path - bytes of paths, like the paths of replicated tables,
+  *     data - bytes of data,
+  *     count - paths of set watches, requests of multi and children of list,
+  *     cached - whether a response has the serialized body of the response cache.
+  *
+  * Counter allocs is operator new per iteration, by the operators of this file. PODArray of CompactStrings allocates
+  * by Allocator rather than operator new and is not counted, it is not used by requests and encoding responses.
+  */
+
+using namespace RK;
+using namespace Coordination;
+
+namespace
+{
+
+thread_local UInt64 allocations = 0;
+
+void * allocate(size_t size)
+{
+    ++allocations;
+    if (void * ptr = std::malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+}
+
+void * operator new(size_t size)
+{
+    return allocate(size);
+}
+
+void * operator new[](size_t size)
+{
+    return allocate(size);
+}
+
+void operator delete(void * ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void * ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+void operator delete[](void * ptr, size_t) noexcept
+{
+    std::free(ptr);
+}
+
+namespace
+{
+
+struct Shape
+{
+    size_t path = 0;
+    size_t data = 0;
+    size_t count = 0;
+    bool cached = false;
+};
+
+/// Counts operator new of the iterations, reported when destroyed after the loop
+class AllocationCounter
+{
+public:
+    explicit AllocationCounter(benchmark::State & state_) : state(state_), begin(allocations) { }
+
+    ~AllocationCounter()
+    {
+        state.counters["allocs"] = benchmark::Counter(static_cast<double>(allocations - begin), benchmark::Counter::kAvgIterations);
+    }
+
+private:
+    benchmark::State & state;
+    UInt64 begin;
+};
+
+String pathOf(size_t length, size_t i = 0)
+{
+    String path = "/clickhouse/tables/01/default/hits/replicas/r1/queue/queue-" + std::to_string(i);
+    path.resize(std::max(length, size_t(2)), '0');
+    return path;
+}
+
+Stat statOf(size_t data_size, size_t children)
+{
+    return {1, 2, 1700000000000, 1700000000000, 1, static_cast<int32_t>(children), 0, 0, static_cast<int32_t>(data_size),
+        static_cast<int32_t>(children), 3};
+}
+
+ACLs aclsOf()
+{
+    return {{ACL::All, "digest", "user:Ysl+8UIW9lkO4cvOEyF6ltm1h9E="}};
+}
+
+template <typename Request>
+std::shared_ptr<Request> withPath(const Shape & shape, size_t i = 0)
+{
+    auto request = std::make_shared<Request>();
+    request->path = pathOf(shape.path, i);
+    return request;
+}
+
+template <typename Request>
+ZooKeeperRequestPtr pathRequest(const Shape & shape)
+{
+    return withPath<Request>(shape);
+}
+
+using MakeRequest = std::function<ZooKeeperRequestPtr(const Shape &)>;
+using MakeResponse = std::function<ZooKeeperResponsePtr(const Shape &)>;
+
+ZooKeeperRequestPtr createRequest(const Shape & shape, size_t i = 0)
+{
+    auto request = withPath<ZooKeeperCreateRequest>(shape, i);
+    request->data = String(shape.data, 'x');
+    request->is_sequential = true;
+    request->acls = aclsOf();
+    return request;
+}
+
+ZooKeeperRequestPtr setRequest(const Shape & shape, size_t i = 0)
+{
+    auto request = withPath<ZooKeeperSetRequest>(shape, i);
+    request->data = String(shape.data, 'x');
+    return request;
+}
+
+ZooKeeperRequestPtr setWatchesRequest(const Shape & shape)
+{
+    auto request = std::make_shared<ZooKeeperSetWatchesRequest>();
+    request->relative_zxid = 100;
+    for (size_t i = 0; i < shape.count; ++i)
+    {
+        request->data_watches.push_back(pathOf(shape.path, i));
+        request->list_watches.push_back(pathOf(shape.path, i));
+    }
+    return request;
+}
+
+ZooKeeperRequestPtr authRequest(const Shape &)
+{
+    auto request = std::make_shared<ZooKeeperAuthRequest>();
+    request->scheme = "digest";
+    request->data = "user:password";
+    return request;
+}
+
+/// Create and set of replicated tables inserting a part, count requests of them
+ZooKeeperRequestPtr multiRequest(const Shape & shape)
+{
+    Requests requests;
+    for (size_t i = 0; i < shape.count; ++i)
+        requests.push_back(i % 2 ? setRequest(shape, i) : createRequest(shape, i));
+    return std::make_shared<ZooKeeperMultiRequest>(requests, ACLs{});
+}
+
+ZooKeeperRequestPtr multiReadRequest(const Shape & shape)
+{
+    Requests requests;
+    for (size_t i = 0; i < shape.count; ++i)
+        requests.push_back(withPath<ZooKeeperGetRequest>(shape, i));
+    return std::make_shared<ZooKeeperMultiRequest>(requests, ACLs{});
+}
+
+void decode(benchmark::State & state, const MakeRequest & make)
+{
+    Shape shape{static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1)), static_cast<size_t>(state.range(2))};
+    ZooKeeperRequestPtr request = make(shape);
+    request->xid = 7;
+
+    WriteBufferFromOwnString buf;
+    request->write(buf);
+    /// Without the length, as parseRequest gets it
+    String body = buf.str().substr(sizeof(int32_t));
+
+    {
+        AllocationCounter counter(state);
+        for (auto _ : state)
+        {
+            ReadBufferFromMemory in(body.data(), body.size());
+            XID xid;
+            OpNum opnum;
+            Coordination::read(xid, in);
+            Coordination::read(opnum, in);
+            ZooKeeperRequestPtr parsed = ZooKeeperRequestFactory::instance().get(opnum);
+            parsed->xid = xid;
+            parsed->readImpl(in);
+            benchmark::DoNotOptimize(parsed->getPathHash());
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * body.size()));
+}
+
+template <typename Response>
+std::shared_ptr<Response> withHeader(std::shared_ptr<Response> response)
+{
+    response->xid = 7;
+    response->zxid = 100;
+    response->error = Error::ZOK;
+    return response;
+}
+
+ZooKeeperResponsePtr getResponse(const Shape & shape)
+{
+    auto response = withHeader(std::make_shared<ZooKeeperGetResponse>());
+    response->data = String(shape.data, 'x');
+    response->stat = statOf(shape.data, 0);
+    return response;
+}
+
+template <typename Response>
+ZooKeeperResponsePtr listResponse(const Shape & shape)
+{
+    auto response = withHeader(std::make_shared<Response>());
+    response->names.reserve(shape.count, shape.count * shape.path);
+    for (size_t i = 0; i < shape.count; ++i)
+        response->names.push_back(pathOf(shape.path, i).substr(1));
+    if constexpr (std::is_same_v<Response, ZooKeeperListResponse>)
+        response->stat = statOf(0, shape.count);
+    return response;
+}
+
+ZooKeeperResponsePtr getACLResponse(const Shape & shape)
+{
+    auto response = withHeader(std::make_shared<ZooKeeperGetACLResponse>());
+    response->acl = aclsOf();
+    response->stat = statOf(shape.data, 0);
+    return response;
+}
+
+void fillResponses(const Requests & requests, const Responses & responses, const Shape & shape)
+{
+    for (size_t i = 0; i < responses.size(); ++i)
+    {
+        auto & response = dynamic_cast<ZooKeeperResponse &>(*responses[i]);
+        response.error = Error::ZOK;
+        if (auto * create = dynamic_cast<ZooKeeperCreateResponse *>(&response))
+            create->path_created = dynamic_cast<const ZooKeeperCreateRequest &>(*requests[i]).path + "0000000001";
+        else if (auto * set = dynamic_cast<ZooKeeperSetResponse *>(&response))
+            set->stat = statOf(shape.data, 0);
+        else if (auto * get = dynamic_cast<ZooKeeperGetResponse *>(&response))
+        {
+            get->data = String(shape.data, 'x');
+            get->stat = statOf(shape.data, 0);
+        }
+    }
+}
+
+ZooKeeperResponsePtr multiResponse(const Shape & shape)
+{
+    auto request = std::dynamic_pointer_cast<ZooKeeperMultiRequest>(multiRequest(shape));
+    auto response = withHeader(std::make_shared<ZooKeeperMultiWriteResponse>(request->requests));
+    fillResponses(request->requests, response->responses, shape);
+    return response;
+}
+
+ZooKeeperResponsePtr multiReadResponse(const Shape & shape)
+{
+    auto request = std::dynamic_pointer_cast<ZooKeeperMultiRequest>(multiReadRequest(shape));
+    auto response = withHeader(std::make_shared<ZooKeeperMultiReadResponse>(request->requests));
+    fillResponses(request->requests, response->responses, shape);
+    return response;
+}
+
+/// As the response cache keeps it, the serialized data and stat or names and stat
+void setCachedBody(ZooKeeperResponse & response)
+{
+    WriteBufferFromOwnString buf;
+    response.writeImpl(buf);
+    auto body = std::make_shared<const String>(std::move(buf.str()));
+    if (auto * get = dynamic_cast<ZooKeeperGetResponse *>(&response))
+        get->serialized_body = body;
+    else if (auto * list = dynamic_cast<ZooKeeperListResponse *>(&response))
+        list->serialized_body = body;
+    else if (auto * simple_list = dynamic_cast<ZooKeeperSimpleListResponse *>(&response))
+        simple_list->serialized_body = body;
+}
+
+void encode(benchmark::State & state, const MakeResponse & make)
+{
+    Shape shape{
+        static_cast<size_t>(state.range(0)), static_cast<size_t>(state.range(1)), static_cast<size_t>(state.range(2)), state.range(3) != 0};
+    ZooKeeperResponsePtr response = make(shape);
+    if (shape.cached)
+        setCachedBody(*response);
+
+    String free_buffer;
+    size_t bytes = 0;
+    {
+        AllocationCounter counter(state);
+        for (auto _ : state)
+        {
+            WriteBufferFromOwnString buf(std::move(free_buffer));
+            response->writeNoCopy(buf);
+            bytes = buf.str().size();
+            free_buffer = std::move(buf.str());
+        }
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * bytes));
+}
+
+/// A watch event is serialized once and shared by the watchers, an iteration is an event
+void encodeWatch(benchmark::State & state)
+{
+    String path = pathOf(static_cast<size_t>(state.range(0)));
+    AllocationCounter counter(state);
+    for (auto _ : state)
+    {
+        auto response = std::make_shared<ZooKeeperWatchResponse>();
+        response->xid = WATCH_XID;
+        response->zxid = -1;
+        response->error = Error::ZOK;
+        response->type = CHANGED;
+        response->state = CONNECTED;
+        response->path = path;
+        benchmark::DoNotOptimize(response->getSerialized().size());
+    }
+}
+
+/// Arguments path, data, count of decode benchmarks
+enum class Vary
+{
+    None,
+    Path,
+    PathAndData,
+    Count,
+    CountAndData,
+};
+
+void registerDecode(const String & name, MakeRequest make, Vary vary)
+{
+    auto * bench = benchmark::RegisterBenchmark(("Decode/" + name).c_str(), [make](benchmark::State & state) { decode(state, make); });
+    bench->ArgNames({"path", "data", "count"});
+    switch (vary)
+    {
+        case Vary::None:
+            bench->Args({64, 0, 0});
+            break;
+        case Vary::Path:
+            for (int64_t path : {16, 64, 256})
+                bench->Args({path, 0, 0});
+            break;
+        case Vary::PathAndData:
+            for (int64_t path : {16, 64, 256})
+                for (int64_t data : {0, 100, 1024, 65536})
+                    bench->Args({path, data, 0});
+            break;
+        case Vary::Count:
+            for (int64_t count : {1, 10, 100, 1000})
+                bench->Args({64, 0, count});
+            break;
+        case Vary::CountAndData:
+            for (int64_t count : {2, 10, 100})
+                for (int64_t data : {100, 1024})
+                    bench->Args({64, data, count});
+            break;
+    }
+}
+
+void registerEncode(const String & name, MakeResponse make, std::vector<std::vector<int64_t>> args)
+{
+    auto * bench = benchmark::RegisterBenchmark(("Encode/" + name).c_str(), [make](benchmark::State & state) { encode(state, make); });
+    bench->ArgNames({"path", "data", "count", "cached"});
+    for (const auto & arg : args)
+        bench->Args(arg);
+}
+
+void registerBenchmarks()
+{
+    registerDecode("Heartbeat", [](const Shape &) { return std::make_shared<ZooKeeperHeartbeatRequest>(); }, Vary::None);
+    registerDecode("Close", [](const Shape &) { return std::make_shared<ZooKeeperCloseRequest>(); }, Vary::None);
+    registerDecode("Auth", authRequest, Vary::None);
+    registerDecode("Create", [](const Shape & shape) { return createRequest(shape); }, Vary::PathAndData);
+    registerDecode("Set", [](const Shape & shape) { return setRequest(shape); }, Vary::PathAndData);
+    registerDecode("Remove", pathRequest<ZooKeeperRemoveRequest>, Vary::Path);
+    registerDecode("Exists", pathRequest<ZooKeeperExistsRequest>, Vary::Path);
+    registerDecode("Get", pathRequest<ZooKeeperGetRequest>, Vary::Path);
+    registerDecode("List", pathRequest<ZooKeeperListRequest>, Vary::Path);
+    registerDecode("SimpleList", pathRequest<ZooKeeperSimpleListRequest>, Vary::Path);
+    registerDecode("FilteredList", pathRequest<ZooKeeperFilteredListRequest>, Vary::Path);
+    registerDecode("Check", pathRequest<ZooKeeperCheckRequest>, Vary::Path);
+    registerDecode("Sync", pathRequest<ZooKeeperSyncRequest>, Vary::Path);
+    registerDecode("GetACL", pathRequest<ZooKeeperGetACLRequest>, Vary::Path);
+    registerDecode(
+        "SetACL",
+        [](const Shape & shape)
+        {
+            auto request = withPath<ZooKeeperSetACLRequest>(shape);
+            request->acls = aclsOf();
+            return request;
+        },
+        Vary::Path);
+    registerDecode("AddWatch", pathRequest<ZooKeeperAddWatchRequest>, Vary::Path);
+    registerDecode("SetWatches", setWatchesRequest, Vary::Count);
+    registerDecode("Multi", multiRequest, Vary::CountAndData);
+    registerDecode("MultiRead", multiReadRequest, Vary::Count);
+
+    registerEncode("Heartbeat", [](const Shape &) { return withHeader(std::make_shared<ZooKeeperHeartbeatResponse>()); }, {{0, 0, 0, 0}});
+    registerEncode(
+        "Create",
+        [](const Shape & shape)
+        {
+            auto response = withHeader(std::make_shared<ZooKeeperCreateResponse>());
+            response->path_created = pathOf(shape.path);
+            return response;
+        },
+        {{16, 0, 0, 0}, {64, 0, 0, 0}, {256, 0, 0, 0}});
+    registerEncode("Remove", [](const Shape &) { return withHeader(std::make_shared<ZooKeeperRemoveResponse>()); }, {{0, 0, 0, 0}});
+    registerEncode(
+        "Exists",
+        [](const Shape &)
+        {
+            auto response = withHeader(std::make_shared<ZooKeeperExistsResponse>());
+            response->stat = statOf(100, 0);
+            return response;
+        },
+        {{0, 0, 0, 0}});
+    registerEncode(
+        "Set",
+        [](const Shape &)
+        {
+            auto response = withHeader(std::make_shared<ZooKeeperSetResponse>());
+            response->stat = statOf(100, 0);
+            return response;
+        },
+        {{0, 0, 0, 0}});
+    registerEncode("Check", [](const Shape &) { return withHeader(std::make_shared<ZooKeeperCheckResponse>()); }, {{0, 0, 0, 0}});
+    registerEncode("GetACL", getACLResponse, {{0, 0, 0, 0}});
+    registerEncode(
+        "Error",
+        [](const Shape &)
+        {
+            auto response = withHeader(std::make_shared<ZooKeeperErrorResponse>());
+            response->error = Error::ZNONODE;
+            return response;
+        },
+        {{0, 0, 0, 0}});
+
+    std::vector<std::vector<int64_t>> get_args;
+    for (int64_t cached : {0, 1})
+        for (int64_t data : {0, 100, 1024, 65536, 1048576})
+            get_args.push_back({0, data, 0, cached});
+    registerEncode("Get", getResponse, get_args);
+
+    std::vector<std::vector<int64_t>> list_args;
+    for (int64_t cached : {0, 1})
+        for (int64_t path : {16, 64})
+            for (int64_t count : {10, 1000, 100000})
+                list_args.push_back({path, 0, count, cached});
+    registerEncode("List", listResponse<ZooKeeperListResponse>, list_args);
+    registerEncode("SimpleList", listResponse<ZooKeeperSimpleListResponse>, list_args);
+
+    registerEncode("Multi", multiResponse, {{64, 100, 2, 0}, {64, 100, 10, 0}, {64, 100, 100, 0}, {64, 100, 1000, 0}});
+    registerEncode("MultiRead", multiReadResponse, {{64, 100, 10, 0}, {64, 1024, 10, 0}, {64, 100, 100, 0}, {64, 1024, 100, 0}});
+
+    benchmark::RegisterBenchmark("Encode/Watch", encodeWatch)->ArgNames({"path"})->Arg(16)->Arg(64)->Arg(256);
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    registerBenchmarks();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
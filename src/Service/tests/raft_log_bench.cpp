@@ -0,0 +1,315 @@
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <Poco/File.h>
+#include <Poco/Logger.h>
+
+#include <Common/Exception.h>
+#include <Common/LogLinearHistogram.h>
+#include <Common/Stopwatch.h>
+#include <Common/TerminalSize.h>
+#include <Service/NuRaftFileLogStore.h>
+#include <Service/Settings.h>
+#include <fmt/format.h>
+
+/** Benchmark of raft log storage on the disk of --dir, for qualifying disks and comparing storage options of
+  * NuRaftFileLogStore. For every combination of entry size, batch size and fsync mode it
+  *   - appends entries in batches like a follower does, every batch ended by end_of_append_batch, and measures
+  *     throughput, latency of a batch, latency until the batch is durable (fsync_parallel and fsync_group, which
+  *     report durable indexes) and latency of the batches which rotated the segment,
+  *   - reopens the store and measures the startup load time of the written segments,
+  *   - reads all entries from the reopened store like catching up a lagging follower.
+  *
+  * --segment-size and --entries set how many segments are rotated and loaded. Options like --io-uring and
+  * --direct-io are the settings of the same names in config.xml.
+  */
+
+namespace RK::ErrorCodes
+{
+    extern const int LOGICAL_ERROR;
+}
+
+using namespace RK;
+using namespace nuraft;
+
+namespace
+{
+
+struct Run
+{
+    size_t entry_size;
+    size_t batch_size;
+    FsyncMode fsync_mode;
+};
+
+struct BenchOptions
+{
+    String dir;
+    size_t entries;
+    UInt32 segment_size;
+    bool io_uring;
+    bool direct_io;
+    bool preallocate;
+    bool compression;
+    UInt64 fsync_interval;
+    Int64 read_batch_bytes;
+};
+
+template <typename T>
+std::vector<T> parseList(const String & list, std::function<T(const String &)> parse)
+{
+    Strings items;
+    boost::split(items, list, boost::is_any_of(","));
+    std::vector<T> res;
+    for (const auto & item : items)
+        res.push_back(parse(item));
+    return res;
+}
+
+std::unique_ptr<NuRaftFileLogStore> openStore(const BenchOptions & options, FsyncMode fsync_mode, bool force_new)
+{
+    return std::make_unique<NuRaftFileLogStore>(
+        options.dir,
+        force_new,
+        fsync_mode,
+        options.fsync_interval,
+        options.segment_size,
+        LogSegmentStore::MAX_SEGMENT_COUNT,
+        options.io_uring,
+        options.preallocate,
+        options.direct_io,
+        LogEntryQueue::DEFAULT_MAX_ENTRIES,
+        LogEntryQueue::DEFAULT_MAX_BYTES,
+        options.compression);
+}
+
+String formatLatency(const LogLinearHistogram & histogram)
+{
+    auto snapshot = histogram.getSnapshot();
+    if (!snapshot.count)
+        return "-";
+    return fmt::format(
+        "p50 {:.0f} p99 {:.0f} max {:.0f}", snapshot.quantile(0.5), snapshot.quantile(0.99), snapshot.quantile(1));
+}
+
+/// Batches appended and not durable yet, by their last index
+class DurableTracker
+{
+public:
+    void appended(UInt64 last_index, UInt64 start_ns)
+    {
+        std::lock_guard lock(mutex);
+        pending.emplace_back(last_index, start_ns);
+    }
+
+    void flushed(UInt64 durable_index)
+    {
+        UInt64 now_ns = clock_gettime_ns();
+        std::lock_guard lock(mutex);
+        while (!pending.empty() && pending.front().first <= durable_index)
+        {
+            latency_us.add((now_ns - pending.front().second) / 1000);
+            pending.pop_front();
+        }
+    }
+
+    bool empty()
+    {
+        std::lock_guard lock(mutex);
+        return pending.empty();
+    }
+
+    LogLinearHistogram latency_us;
+
+private:
+    std::mutex mutex;
+    std::deque<std::pair<UInt64, UInt64>> pending;
+};
+
+void runBenchmark(const BenchOptions & options, const Run & run)
+{
+    if (Poco::File(options.dir).exists())
+        Poco::File(options.dir).remove(true);
+    Poco::File(options.dir).createDirectories();
+
+    /// Random data, so that compression is not flattered
+    std::mt19937_64 rng(run.entry_size);
+    std::vector<ptr<log_entry>> entries;
+    for (size_t i = 0; i < std::min(options.entries, size_t(1024)); ++i)
+    {
+        auto buf = buffer::alloc(run.entry_size);
+        for (size_t pos = 0; pos < run.entry_size; ++pos)
+            buf->data_begin()[pos] = static_cast<byte>(rng());
+        entries.push_back(cs_new<log_entry>(1, buf));
+    }
+
+    bool reports_durable = run.fsync_mode == FsyncMode::FSYNC_PARALLEL || run.fsync_mode == FsyncMode::FSYNC_GROUP;
+    DurableTracker durable;
+    LogLinearHistogram batch_latency_us;
+    LogLinearHistogram rotation_latency_us;
+    size_t rotations = 0;
+
+    auto store = openStore(options, run.fsync_mode, true);
+    if (reports_durable)
+        store->setFlushCallback([&durable](UInt64 durable_index) { durable.flushed(durable_index); });
+
+    Stopwatch watch;
+    for (size_t appended = 0; appended < options.entries;)
+    {
+        size_t closed_segments = store->segmentStore()->getClosedSegments().size();
+        UInt64 start_ns = clock_gettime_ns();
+
+        size_t batch = std::min(run.batch_size, options.entries - appended);
+        UInt64 first_index = 0;
+        for (size_t i = 0; i < batch; ++i, ++appended)
+        {
+            auto & entry = entries[appended % entries.size()];
+            UInt64 index = store->append(entry);
+            if (!first_index)
+                first_index = index;
+        }
+        if (reports_durable)
+            durable.appended(first_index + batch - 1, start_ns);
+        store->end_of_append_batch(first_index, batch);
+
+        UInt64 latency_us = (clock_gettime_ns() - start_ns) / 1000;
+        batch_latency_us.add(latency_us);
+        if (store->segmentStore()->getClosedSegments().size() != closed_segments)
+        {
+            rotations++;
+            rotation_latency_us.add(latency_us);
+        }
+    }
+
+    store->flush();
+    /// The last fsync of fsync thread reports the rest
+    Stopwatch wait_watch;
+    while (reports_durable && !durable.empty() && wait_watch.elapsedSeconds() < 10)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    double append_seconds = watch.elapsedSeconds();
+    store->setFlushCallback({});
+    store.reset();
+
+    /// Startup load of the segments written
+    watch.restart();
+    store = openStore(options, run.fsync_mode, true);
+    double load_seconds = watch.elapsedSeconds();
+    size_t segments = store->segmentStore()->getClosedSegments().size() + 1;
+
+    /// Catch up from the first entry
+    watch.restart();
+    UInt64 read_entries = 0;
+    UInt64 read_bytes = 0;
+    for (UInt64 index = store->start_index(); index < store->next_slot();)
+    {
+        auto batch = store->log_entries_ext(index, store->next_slot(), options.read_batch_bytes);
+        if (!batch || batch->empty())
+            throw Exception(ErrorCodes::LOGICAL_ERROR, "Cannot read log entries from {}", index);
+        for (const auto & entry : *batch)
+            read_bytes += entry->get_buf().size();
+        read_entries += batch->size();
+        index += batch->size();
+    }
+    double read_seconds = watch.elapsedSeconds();
+    store.reset();
+
+    double total_mb = static_cast<double>(options.entries * run.entry_size) / 1048576;
+    std::cout << fmt::format(
+        "mode {} entry_size {} batch_size {}\n"
+        "  append: {:.0f} entries/s {:.1f} MB/s, batch latency us {}, durable latency us {}\n"
+        "  rotation: {} segments rotated, batch latency us {}\n"
+        "  load: {} segments in {:.3f} s\n"
+        "  catch up read: {:.0f} entries/s {:.1f} MB/s\n",
+        FsyncModeNS::toString(run.fsync_mode),
+        run.entry_size,
+        run.batch_size,
+        static_cast<double>(options.entries) / append_seconds,
+        total_mb / append_seconds,
+        formatLatency(batch_latency_us),
+        reports_durable ? formatLatency(durable.latency_us) : "-",
+        rotations,
+        formatLatency(rotation_latency_us),
+        segments,
+        load_seconds,
+        static_cast<double>(read_entries) / read_seconds,
+        static_cast<double>(read_bytes) / 1048576 / read_seconds);
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    namespace po = boost::program_options;
+
+    po::options_description desc = createOptionsDescription("Allowed options", getTerminalWidth());
+    auto opt_list = desc.add_options();
+
+    opt_list("help,h", "produce help message");
+    opt_list("dir", po::value<std::string>()->required(), "Directory of the log on the disk to benchmark, it is removed");
+    opt_list("entry-sizes", po::value<std::string>()->default_value("256,1024,8192"), "Comma separated bytes of entry data");
+    opt_list("batch-sizes", po::value<std::string>()->default_value("1,16,128"), "Comma separated entries of an append batch");
+    opt_list(
+        "fsync-modes",
+        po::value<std::string>()->default_value("fsync_parallel,fsync,fsync_batch,fsync_group"),
+        "Comma separated fsync modes");
+    opt_list("entries", po::value<size_t>()->default_value(100000), "Entries appended by a run");
+    opt_list("segment-size", po::value<UInt32>()->default_value(LogSegmentStore::MAX_SEGMENT_FILE_SIZE), "Max bytes of a segment");
+    opt_list("fsync-interval", po::value<UInt64>()->default_value(1000), "Entries of an fsync of fsync_batch and fsync_group");
+    opt_list("read-batch-bytes", po::value<Int64>()->default_value(4 * 1024 * 1024), "Bytes hint of a catch up read");
+    opt_list("io-uring", "Write with io_uring");
+    opt_list("direct-io", "Write with O_DIRECT");
+    opt_list("preallocate", "Preallocate segments");
+    opt_list("compression", "Compress entries");
+
+    po::variables_map options;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
+    if (options.count("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " --dir /data/raftkeeper/bench_log --fsync-modes fsync_group --io-uring" << std::endl;
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    Poco::Logger::root().setLevel("warning");
+
+    try
+    {
+        po::notify(options);
+
+        BenchOptions bench_options;
+        bench_options.dir = options["dir"].as<std::string>();
+        bench_options.entries = options["entries"].as<size_t>();
+        bench_options.segment_size = options["segment-size"].as<UInt32>();
+        bench_options.fsync_interval = options["fsync-interval"].as<UInt64>();
+        bench_options.read_batch_bytes = options["read-batch-bytes"].as<Int64>();
+        bench_options.io_uring = options.count("io-uring");
+        bench_options.direct_io = options.count("direct-io");
+        bench_options.preallocate = options.count("preallocate");
+        bench_options.compression = options.count("compression");
+
+        auto parse_size = [](const String & item) { return static_cast<size_t>(std::stoull(item)); };
+        auto entry_sizes = parseList<size_t>(options["entry-sizes"].as<std::string>(), parse_size);
+        auto batch_sizes = parseList<size_t>(options["batch-sizes"].as<std::string>(), parse_size);
+        auto fsync_modes = parseList<FsyncMode>(options["fsync-modes"].as<std::string>(), FsyncModeNS::parseFsyncMode);
+
+        for (auto fsync_mode : fsync_modes)
+            for (auto entry_size : entry_sizes)
+                for (auto batch_size : batch_sizes)
+                    runBenchmark(bench_options, {entry_size, std::max(batch_size, size_t(1)), fsync_mode});
+
+        Poco::File(bench_options.dir).remove(true);
+    }
+    catch (...)
+    {
+        std::cerr << getCurrentExceptionMessage(true) << '\n';
+        return getCurrentExceptionCode();
+    }
+
+    return 0;
+}
@@ -0,0 +1,330 @@
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/program_options.hpp>
+#include <Poco/File.h>
+#include <Poco/Logger.h>
+
+#include <Common/Exception.h>
+#include <Common/Stopwatch.h>
+#include <Common/TerminalSize.h>
+#include <Service/KeeperStore.h>
+#include <Service/Metrics.h>
+#include <Service/NuRaftLogSnapshot.h>
+#include <ZooKeeper/ZooKeeperCommon.h>
+#include <fmt/format.h>
+
+/** Benchmark of creating and loading snapshots of a synthetic tree, for planning restart time of large trees.
+  * The tree of --nodes nodes and --depth levels under /bench is built once, leaves are ephemeral with
+  * --ephemeral-ratio and data sizes follow --data-size. For every thread count of --threads it
+  *   - creates a snapshot like the state machine does: dumping is pinning the tree and copying sessions and ACLs,
+  *     serializing is writing the objects by createObjectsAsync,
+  *   - loads the snapshot into an empty store: verifying the objects, parsing them and building the tree, which
+  *     fills buckets with nodes and builds children sets of them. Filling and building children are the sums of
+  *     the times of all buckets, so that they are thread time rather than wall time.
+  *
+  * The tree is in memory twice when loading, with the nodes of the store loaded.
+  */
+
+namespace RK::ErrorCodes
+{
+    extern const int BAD_ARGUMENTS;
+    extern const int LOGICAL_ERROR;
+}
+
+using namespace RK;
+using namespace Coordination;
+
+namespace
+{
+
+struct BenchOptions
+{
+    String dir;
+    UInt64 nodes;
+    UInt64 depth;
+    double ephemeral_ratio;
+    UInt64 sessions;
+    UInt32 bucket_num;
+    UInt32 object_node_size;
+};
+
+template <typename T>
+std::vector<T> parseList(const String & list, std::function<T(const String &)> parse)
+{
+    Strings items;
+    boost::split(items, list, boost::is_any_of(","));
+    std::vector<T> res;
+    for (const auto & item : items)
+        res.push_back(parse(item));
+    return res;
+}
+
+/// Sizes of data of nodes: fixed:<bytes>, uniform:<min>:<max> or exponential:<mean>
+class DataSizeDistribution
+{
+public:
+    explicit DataSizeDistribution(const String & spec)
+    {
+        Strings items;
+        boost::split(items, spec, boost::is_any_of(":"));
+        kind = items[0];
+        if (kind == "fixed" && items.size() == 2)
+            min = max = std::stoull(items[1]);
+        else if (kind == "uniform" && items.size() == 3)
+        {
+            min = std::stoull(items[1]);
+            max = std::stoull(items[2]);
+        }
+        else if (kind == "exponential" && items.size() == 2)
+            mean = std::stod(items[1]);
+        else
+            throw Exception(ErrorCodes::BAD_ARGUMENTS, "Unknown data size distribution {}", spec);
+    }
+
+    size_t next(std::mt19937_64 & rng)
+    {
+        if (kind == "uniform")
+            return std::uniform_int_distribution<size_t>(min, max)(rng);
+        if (kind == "exponential")
+            return static_cast<size_t>(std::exponential_distribution<double>(1 / mean)(rng));
+        return min;
+    }
+
+private:
+    String kind;
+    size_t min = 0;
+    size_t max = 0;
+    double mean = 0;
+};
+
+constexpr int64_t DEAD_SESSION_CHECK_PERIOD_MS = 500;
+constexpr int32_t SESSION_TIMEOUT_MS = 1000 * 3600;
+
+class SyntheticTree
+{
+public:
+    SyntheticTree(const BenchOptions & options, DataSizeDistribution data_size)
+        : store(DEAD_SESSION_CHECK_PERIOD_MS, "", options.bucket_num)
+    {
+        for (UInt64 i = 0; i < std::max(options.sessions, UInt64(1)); ++i)
+            sessions.push_back(newSession());
+
+        create("/bench", "", false, sessions[0]);
+
+        /// Nodes are numbered in breadth first order, the children of node i are from fan_out * (i + 1), and
+        /// fan_out is the least one for which depth levels hold all the nodes.
+        double levels = static_cast<double>(options.depth);
+        fan_out = std::max(static_cast<UInt64>(std::ceil(std::pow(static_cast<double>(options.nodes), 1 / levels))), UInt64(2));
+
+        /// Random bytes, so that data is not compressed better than real one
+        std::mt19937_64 rng(options.nodes);
+        String data_pool(1024 * 1024, '\0');
+        for (auto & c : data_pool)
+            c = static_cast<char>(rng());
+
+        Stopwatch watch;
+        for (UInt64 node = 0; node < options.nodes; ++node)
+        {
+            bool leaf = fan_out * (node + 1) >= options.nodes;
+            bool ephemeral = leaf && std::uniform_real_distribution<double>(0, 1)(rng) < options.ephemeral_ratio;
+            size_t size = std::min(data_size.next(rng), data_pool.size());
+            size_t offset = std::uniform_int_distribution<size_t>(0, data_pool.size() - size)(rng);
+            create(pathOf(node), data_pool.substr(offset, size), ephemeral, sessions[node % sessions.size()]);
+            ephemeral_nodes += ephemeral;
+
+            if ((node + 1) % 1000000 == 0)
+                std::cerr << fmt::format("Built {} nodes in {:.1f} s\n", node + 1, watch.elapsedSeconds());
+        }
+    }
+
+    KeeperStore store;
+    UInt64 fan_out;
+    UInt64 ephemeral_nodes = 0;
+
+private:
+    String pathOf(UInt64 node) const
+    {
+        if (node < fan_out)
+            return "/bench/n" + std::to_string(node);
+        return pathOf(node / fan_out - 1) + "/n" + std::to_string(node);
+    }
+
+    void create(const String & path, const String & data, bool ephemeral, int64_t session_id)
+    {
+        auto request = std::make_shared<ZooKeeperCreateRequest>();
+        request->path = path;
+        request->data = data;
+        request->is_ephemeral = ephemeral;
+        request->xid = ++xid;
+        store.processRequest(responses_queue, {request, session_id, 0}, store.getZxid() + 1);
+
+        ResponseForSession response;
+        if (!responses_queue.tryPop(response) || response.response->error != Error::ZOK)
+            throw Exception(ErrorCodes::LOGICAL_ERROR, "Cannot create {}", path);
+    }
+
+    int64_t newSession()
+    {
+        auto request = std::make_shared<ZooKeeperNewSessionRequest>();
+        request->internal_id = ++xid;
+        request->session_timeout_ms = SESSION_TIMEOUT_MS;
+        request->server_id = 1;
+        store.processRequest(responses_queue, {request, request->internal_id, 0}, store.getZxid() + 1);
+
+        ResponseForSession response;
+        if (!responses_queue.tryPop(response))
+            throw Exception(ErrorCodes::LOGICAL_ERROR, "No response of new session");
+        return dynamic_cast<const ZooKeeperNewSessionResponse &>(*response.response).session_id;
+    }
+
+    KeeperStore::KeeperResponsesQueue responses_queue;
+    std::vector<int64_t> sessions;
+    int32_t xid = 0;
+};
+
+UInt64 summarySum(const Metrics::SummaryPtr & summary)
+{
+    return dynamic_cast<const BasicSummary &>(*summary).getValues().sum;
+}
+
+void runBenchmark(const BenchOptions & options, SyntheticTree & tree, size_t thread_num)
+{
+    if (Poco::File(options.dir).exists())
+        Poco::File(options.dir).remove(true);
+    Poco::File(options.dir).createDirectories();
+
+    auto & metrics = Metrics::getMetrics();
+    metrics.reset();
+
+    /// Create
+    Stopwatch watch;
+    auto meta = nuraft::cs_new<nuraft::snapshot>(tree.store.getZxid(), 1, nuraft::cs_new<nuraft::cluster_config>());
+    nuraft::async_result<bool>::handler_type when_done = [](bool &, nuraft::ptr<std::exception> &) { };
+    auto snap_task = std::make_unique<SnapTask>(meta, tree.store, when_done);
+    meta->set_size(snap_task->nodes_count);
+    double dump_seconds = watch.elapsedSeconds();
+
+    KeeperSnapshotStore snap_store(options.dir, *meta, options.object_node_size);
+    snap_store.setThreadNum(thread_num);
+    snap_store.init("");
+    watch.restart();
+    size_t objects = snap_store.createObjectsAsync(*snap_task);
+    double serialize_seconds = watch.elapsedSeconds();
+    snap_task.reset();
+
+    UInt64 snapshot_bytes = 0;
+    std::vector<Poco::File> files;
+    Poco::File(options.dir).list(files);
+    for (const auto & file : files)
+        snapshot_bytes += file.getSize();
+
+    /// Load
+    KeeperStore loaded(DEAD_SESSION_CHECK_PERIOD_MS, "", options.bucket_num);
+    watch.restart();
+    if (!snap_store.verifyObjects())
+        throw Exception(ErrorCodes::LOGICAL_ERROR, "Snapshot objects are corrupted");
+    double verify_seconds = watch.elapsedSeconds();
+
+    watch.restart();
+    snap_store.loadLatestSnapshot(loaded);
+    double load_seconds = watch.elapsedSeconds();
+
+    if (loaded.getNodesCount() != tree.store.getNodesCount())
+        throw Exception(
+            ErrorCodes::LOGICAL_ERROR, "Loaded {} nodes of {} ones of snapshot", loaded.getNodesCount(), tree.store.getNodesCount());
+
+    double nodes = static_cast<double>(tree.store.getNodesCount());
+    std::cout << fmt::format(
+        "threads {}\n"
+        "  create: dump {:.3f} s, serialize {:.3f} s, {:.0f} nodes/s, {} objects {:.1f} MB\n"
+        "  load: verify {:.3f} s, parse {:.3f} s, build {:.3f} s (fill buckets {:.3f} s, build children {:.3f} s), {:.0f} nodes/s\n",
+        thread_num,
+        dump_seconds,
+        serialize_seconds,
+        nodes / serialize_seconds,
+        objects,
+        static_cast<double>(snapshot_bytes) / 1048576,
+        verify_seconds,
+        static_cast<double>(metrics.snapshot_progress.getLastElapsedMs(SnapshotProgress::LOAD_PARSE)) / 1000,
+        static_cast<double>(metrics.snapshot_progress.getLastElapsedMs(SnapshotProgress::LOAD_BUILD)) / 1000,
+        static_cast<double>(summarySum(metrics.snap_load_fill_bucket_time_ms)) / 1000,
+        static_cast<double>(summarySum(metrics.snap_load_build_children_time_ms)) / 1000,
+        nodes / load_seconds);
+}
+
+}
+
+int main(int argc, char ** argv)
+{
+    namespace po = boost::program_options;
+
+    po::options_description desc = createOptionsDescription("Allowed options", getTerminalWidth());
+    auto opt_list = desc.add_options();
+
+    opt_list("help,h", "produce help message");
+    opt_list("dir", po::value<std::string>()->required(), "Directory of the snapshots on the disk to benchmark, it is removed");
+    opt_list("nodes", po::value<UInt64>()->default_value(1000000), "Nodes of the tree");
+    opt_list("depth", po::value<UInt64>()->default_value(4), "Levels of the tree under /bench");
+    opt_list(
+        "data-size",
+        po::value<std::string>()->default_value("fixed:128"),
+        "Bytes of data of a node, fixed:<bytes>, uniform:<min>:<max> or exponential:<mean>");
+    opt_list("ephemeral-ratio", po::value<double>()->default_value(0), "Ratio of leaves which are ephemeral");
+    opt_list("sessions", po::value<UInt64>()->default_value(1000), "Sessions owning ephemeral nodes");
+    opt_list("threads", po::value<std::string>()->default_value("1,2,4,8,16"), "Comma separated threads of creating and loading");
+    opt_list("bucket-num", po::value<UInt32>()->default_value(KeeperStore::DEFAULT_DATA_TREE_BUCKET_NUM), "Buckets of the data tree");
+    opt_list("object-node-size", po::value<UInt32>()->default_value(MAX_OBJECT_NODE_SIZE), "Max nodes of a snapshot object");
+
+    po::variables_map options;
+    po::store(po::command_line_parser(argc, argv).options(desc).run(), options);
+    if (options.count("help"))
+    {
+        std::cout << "Usage: " << argv[0] << " --dir /data/raftkeeper/bench_snapshot --nodes 10000000 --ephemeral-ratio 0.1" << std::endl;
+        std::cout << desc << std::endl;
+        return 0;
+    }
+
+    Poco::Logger::root().setLevel("warning");
+
+    try
+    {
+        po::notify(options);
+
+        BenchOptions bench_options;
+        bench_options.dir = options["dir"].as<std::string>();
+        bench_options.nodes = options["nodes"].as<UInt64>();
+        bench_options.depth = std::max(options["depth"].as<UInt64>(), UInt64(1));
+        bench_options.ephemeral_ratio = options["ephemeral-ratio"].as<double>();
+        bench_options.sessions = options["sessions"].as<UInt64>();
+        bench_options.bucket_num = options["bucket-num"].as<UInt32>();
+        bench_options.object_node_size = options["object-node-size"].as<UInt32>();
+
+        auto parse_size = [](const String & item) { return static_cast<size_t>(std::stoull(item)); };
+        auto thread_nums = parseList<size_t>(options["threads"].as<std::string>(), parse_size);
+
+        Stopwatch watch;
+        SyntheticTree tree(bench_options, DataSizeDistribution(options["data-size"].as<std::string>()));
+        std::cout << fmt::format(
+            "tree: {} nodes, {} ephemeral, fan out {}, built in {:.1f} s\n",
+            tree.store.getNodesCount(),
+            tree.ephemeral_nodes,
+            tree.fan_out,
+            watch.elapsedSeconds());
+
+        for (auto thread_num : thread_nums)
+            runBenchmark(bench_options, tree, std::max(thread_num, size_t(1)));
+
+        Poco::File(bench_options.dir).remove(true);
+    }
+    catch (...)
+    {
+        std::cerr << getCurrentExceptionMessage(true) << '\n';
+        return getCurrentExceptionCode();
+    }
+
+    return 0;
+}
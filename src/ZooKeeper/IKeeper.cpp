@@ -54,7 +54,7 @@ Exception::Exception(const Exception & exc) = default;
 using namespace RK;
 
 
-static void addRootPath(String & path, const String & root_path)
+void addRootPath(String & path, const String & root_path)
 {
     if (path.empty())
         throw Exception("Path cannot be empty", Error::ZBADARGUMENTS);
@@ -111,6 +111,8 @@ const char * errorMessage(Error code)
         case Error::ZCLOSING:                 return "ZooKeeper is closing";
         case Error::ZNOTHING:                 return "(not error) no server responses to process";
         case Error::ZSESSIONMOVED:            return "Session moved to another server, so operation is ignored";
+        case Error::ZNOTREADONLY:             return "State-changing request is passed to read-only server";
+        case Error::ZTHROTTLEDOP:             return "Operation was throttled and not executed at all";
     }
 
     __builtin_unreachable();
@@ -132,7 +132,9 @@ enum class Error : int32_t
     ZAUTHFAILED = -115,                 /// Client authentication failed
     ZCLOSING = -116,                    /// ZooKeeper is closing
     ZNOTHING = -117,                    /// (not error) no server responses to process
-    ZSESSIONMOVED = -118                /// Session moved to another server, so operation is ignored
+    ZSESSIONMOVED = -118,               /// Session moved to another server, so operation is ignored
+    ZNOTREADONLY = -119,                /// State-changing request is passed to read-only server
+    ZTHROTTLEDOP = -127                 /// Same with ZooKeeper 3.6, operation is rejected by an overloaded server and not executed
 };
 
 /// Network errors and similar. You should reinitialize ZooKeeper session in case of these errors
@@ -143,6 +145,9 @@ bool isUserError(Error code);
 
 const char * errorMessage(Error code);
 
+/// Prefix path with chroot root_path, for addRootPath of requests
+void addRootPath(String & path, const String & root_path);
+
 
 struct Request;
 using RequestPtr = std::shared_ptr<Request>;
@@ -473,6 +478,15 @@ public:
         const Requests & requests,
         MultiCallback callback) = 0;
 
+    /// Persistent watch of path, and of all its descendants if recursive, which is not removed when triggered.
+    /// Callback gets the response of the request, watch gets every event until the session ends.
+    /// A recursive watch gets no child events, changes of children are seen as created and deleted events of them.
+    virtual void addWatch(
+        const String & path,
+        bool recursive,
+        ResponseCallback callback,
+        WatchCallback watch) = 0;
+
     /// Expire session and finish all pending requests
     virtual void finalize() = 0;
 
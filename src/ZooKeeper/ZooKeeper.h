@@ -269,6 +269,7 @@ public:
 
 private:
     friend class EphemeralNodeHolder;
+    friend class ZooKeeperTreeCache;
 
     /*void init(const std::string & implementation_, const std::string & hosts_, const std::string & identity_,
               int32_t session_timeout_ms_, int32_t operation_timeout_ms_, const std::string & chroot_);*/
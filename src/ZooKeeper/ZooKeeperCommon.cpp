@@ -1,5 +1,6 @@
 #include "ZooKeeperCommon.h"
 #include <array>
+#include <Common/SlabAllocator.h>
 #include "common/logger_useful.h"
 #include "ZooKeeperIO.h"
 
@@ -9,6 +10,19 @@ namespace Coordination
 
 using namespace RK;
 
+namespace
+{
+
+/// Responses are made by the store threads and released by IO threads once they are sent. Like requests, they are
+/// allocated with their control block in one chunk of a slab pool, whose thread caches exchange freed chunks in batches.
+template <typename ResponseT, typename... Args>
+std::shared_ptr<ResponseT> makePooledResponse(Args &&... args)
+{
+    return std::allocate_shared<ResponseT>(SlabAllocator<ResponseT>(), std::forward<Args>(args)...);
+}
+
+}
+
 void ZooKeeperResponse::write(WriteBuffer & out) const
 {
     /// Excessive copy to calculate length.
@@ -25,11 +39,19 @@ void ZooKeeperResponse::write(WriteBuffer & out) const
 void ZooKeeperResponse::writeNoCopy(WriteBufferFromOwnString & out) const
 {
     auto pre_size = out.offset();
-    /// Prepended length
-    Coordination::write(static_cast<int32_t>(0), out);
-    Coordination::write(xid, out);
-    Coordination::write(zxid, out);
-    Coordination::write(error, out);
+
+    /// Length, xid, zxid and error
+    constexpr size_t header_size = sizeof(int32_t) + sizeof(xid) + sizeof(zxid) + sizeof(int32_t);
+    out.reserve(header_size + (error == Error::ZOK ? sizeImpl() : 0));
+
+    /// Length is set after the body is written, it is 0 here
+    char header[header_size];
+    char * pos = putBigEndian(header, static_cast<int32_t>(0));
+    pos = putBigEndian(pos, xid);
+    pos = putBigEndian(pos, zxid);
+    putBigEndian(pos, static_cast<int32_t>(error));
+    out.write(header, header_size);
+
     if (error == Error::ZOK)
         writeImpl(out);
     String & result = out.str();
@@ -41,13 +63,24 @@ void ZooKeeperResponse::writeNoCopy(WriteBufferFromOwnString & out) const
 
 void ZooKeeperRequest::write(WriteBuffer & out) const
 {
-    /// Excessive copy to calculate length.
+    Coordination::write(static_cast<int32_t>(bytesSize() - sizeof(int32_t)), out);
+    Coordination::write(xid, out);
+    Coordination::write(getOpNum(), out);
+    writeImpl(out);
+    out.next();
+}
+
+size_t ZooKeeperRequest::sizeImpl() const
+{
     WriteBufferFromOwnString buf;
-    Coordination::write(xid, buf);
-    Coordination::write(getOpNum(), buf);
     writeImpl(buf);
-    Coordination::write(buf.str(), out);
-    out.next();
+    return buf.str().size();
+}
+
+size_t ZooKeeperRequest::bytesSize() const
+{
+    /// length, xid and op_num
+    return sizeof(int32_t) + sizeof(xid) + sizeof(int32_t) + sizeImpl();
 }
 
 void ZooKeeperSyncRequest::writeImpl(WriteBuffer & out) const
@@ -55,11 +88,33 @@ void ZooKeeperSyncRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(path, out);
 }
 
+size_t ZooKeeperSyncRequest::sizeImpl() const
+{
+    return writtenSize(path);
+}
+
 void ZooKeeperSyncRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
 }
 
+void ZooKeeperRemoveRecursiveRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(remove_nodes_limit, out);
+}
+
+size_t ZooKeeperRemoveRecursiveRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(remove_nodes_limit);
+}
+
+void ZooKeeperRemoveRecursiveRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    Coordination::read(remove_nodes_limit, in);
+}
+
 void ZooKeeperSyncResponse::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -70,6 +125,11 @@ void ZooKeeperSyncResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(path, out);
 }
 
+size_t ZooKeeperSyncResponse::sizeImpl() const
+{
+    return writtenSize(path);
+}
+
 void ZooKeeperWatchResponse::readImpl(ReadBuffer & in)
 {
     Coordination::read(type, in);
@@ -84,6 +144,11 @@ void ZooKeeperWatchResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(path, out);
 }
 
+size_t ZooKeeperWatchResponse::sizeImpl() const
+{
+    return sizeof(type) + sizeof(state) + writtenSize(path);
+}
+
 void ZooKeeperWatchResponse::write(WriteBuffer & out) const
 {
     if (error == Error::ZOK)
@@ -91,6 +156,25 @@ void ZooKeeperWatchResponse::write(WriteBuffer & out) const
     /// skip bad responses for watches
 }
 
+void ZooKeeperWatchResponse::writeNoCopy(WriteBufferFromOwnString & out) const
+{
+    const String & bytes = getSerialized();
+    out.write(bytes.data(), bytes.size());
+}
+
+const String & ZooKeeperWatchResponse::getSerialized() const
+{
+    std::call_once(
+        serialize_flag,
+        [this]
+        {
+            WriteBufferFromOwnString buf;
+            ZooKeeperResponse::writeNoCopy(buf);
+            serialized = std::move(buf.str());
+        });
+    return serialized;
+}
+
 void ZooKeeperAuthRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(type, out);
@@ -98,6 +182,11 @@ void ZooKeeperAuthRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(data, out);
 }
 
+size_t ZooKeeperAuthRequest::sizeImpl() const
+{
+    return sizeof(type) + writtenSize(scheme) + writtenSize(data);
+}
+
 void ZooKeeperAuthRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(type, in);
@@ -113,12 +202,28 @@ void ZooKeeperCreateRequest::writeImpl(WriteBuffer & out) const
 
     int32_t flags = 0;
 
-    if (is_ephemeral)
-        flags |= 1;
-    if (is_sequential)
-        flags |= 2;
+    /// Container and TTL modes are not bit flags
+    if (is_ttl)
+        flags = is_sequential ? 6 : 5;
+    else if (is_container)
+        flags = 4;
+    else
+    {
+        if (is_ephemeral)
+            flags |= 1;
+        if (is_sequential)
+            flags |= 2;
+    }
 
     Coordination::write(flags, out);
+    if (op_num == OpNum::CreateTTL)
+        Coordination::write(ttl, out);
+}
+
+size_t ZooKeeperCreateRequest::sizeImpl() const
+{
+    /// and flags
+    return writtenSize(path) + writtenSize(data) + writtenSize(acls) + sizeof(int32_t) + (op_num == OpNum::CreateTTL ? sizeof(ttl) : 0);
 }
 
 void ZooKeeperCreateRequest::readImpl(ReadBuffer & in)
@@ -130,20 +235,45 @@ void ZooKeeperCreateRequest::readImpl(ReadBuffer & in)
     int32_t flags = 0;
     Coordination::read(flags, in);
 
-    if (flags & 1)
-        is_ephemeral = true;
-    if (flags & 2)
-        is_sequential = true;
+    switch (flags)
+    {
+        case 4:
+            is_container = true;
+            break;
+        case 6:
+            is_sequential = true;
+            [[fallthrough]];
+        case 5:
+            is_ttl = true;
+            break;
+        default:
+            if (flags & 1)
+                is_ephemeral = true;
+            if (flags & 2)
+                is_sequential = true;
+    }
+
+    if (op_num == OpNum::CreateTTL)
+        Coordination::read(ttl, in);
 }
 
 void ZooKeeperCreateResponse::readImpl(ReadBuffer & in)
 {
     Coordination::read(path_created, in);
+    if (with_stat)
+        Coordination::read(stat, in);
 }
 
 void ZooKeeperCreateResponse::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path_created, out);
+    if (with_stat)
+        Coordination::write(stat, out);
+}
+
+size_t ZooKeeperCreateResponse::sizeImpl() const
+{
+    return writtenSize(path_created) + (with_stat ? STAT_SIZE : 0);
 }
 
 void ZooKeeperRemoveRequest::writeImpl(WriteBuffer & out) const
@@ -152,6 +282,11 @@ void ZooKeeperRemoveRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(version, out);
 }
 
+size_t ZooKeeperRemoveRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(version);
+}
+
 void ZooKeeperRemoveRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -164,6 +299,11 @@ void ZooKeeperExistsRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(has_watch, out);
 }
 
+size_t ZooKeeperExistsRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(has_watch);
+}
+
 void ZooKeeperExistsRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -180,12 +320,22 @@ void ZooKeeperExistsResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(stat, out);
 }
 
+size_t ZooKeeperExistsResponse::sizeImpl() const
+{
+    return STAT_SIZE;
+}
+
 void ZooKeeperGetRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
     Coordination::write(has_watch, out);
 }
 
+size_t ZooKeeperGetRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(has_watch);
+}
+
 void ZooKeeperGetRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -200,10 +350,20 @@ void ZooKeeperGetResponse::readImpl(ReadBuffer & in)
 
 void ZooKeeperGetResponse::writeImpl(WriteBuffer & out) const
 {
+    if (serialized_body)
+    {
+        out.write(serialized_body->data(), serialized_body->size());
+        return;
+    }
     Coordination::write(data, out);
     Coordination::write(stat, out);
 }
 
+size_t ZooKeeperGetResponse::sizeImpl() const
+{
+    return serialized_body ? serialized_body->size() : writtenSize(data) + STAT_SIZE;
+}
+
 void ZooKeeperSetRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
@@ -211,6 +371,11 @@ void ZooKeeperSetRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(version, out);
 }
 
+size_t ZooKeeperSetRequest::sizeImpl() const
+{
+    return writtenSize(path) + writtenSize(data) + sizeof(version);
+}
+
 void ZooKeeperSetRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -228,12 +393,22 @@ void ZooKeeperSetResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(stat, out);
 }
 
+size_t ZooKeeperSetResponse::sizeImpl() const
+{
+    return STAT_SIZE;
+}
+
 void ZooKeeperListRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
     Coordination::write(has_watch, out);
 }
 
+size_t ZooKeeperListRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(has_watch);
+}
+
 void ZooKeeperListRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -253,6 +428,11 @@ void ZooKeeperFilteredListRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(static_cast<uint8_t>(list_request_type), out);
 }
 
+size_t ZooKeeperFilteredListRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(has_watch) + sizeof(uint8_t);
+}
+
 void ZooKeeperFilteredListRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -263,12 +443,186 @@ void ZooKeeperFilteredListRequest::readImpl(ReadBuffer & in)
     list_request_type = static_cast<ListRequestType>(read_request_type);
 }
 
+void ZooKeeperListWithDataRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(has_watch, out);
+    Coordination::write(with_data, out);
+    Coordination::write(with_stat, out);
+    Coordination::write(start_after, out);
+    Coordination::write(max_children, out);
+    Coordination::write(max_bytes, out);
+}
+
+size_t ZooKeeperListWithDataRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(has_watch) + sizeof(with_data) + sizeof(with_stat) + writtenSize(start_after)
+        + sizeof(max_children) + sizeof(max_bytes);
+}
+
+void ZooKeeperListWithDataRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    Coordination::read(has_watch, in);
+    Coordination::read(with_data, in);
+    Coordination::read(with_stat, in);
+    Coordination::read(start_after, in);
+    Coordination::read(max_children, in);
+    Coordination::read(max_bytes, in);
+}
+
+void ZooKeeperListWithDataResponse::readImpl(ReadBuffer & in)
+{
+    Coordination::read(with_data, in);
+    Coordination::read(with_stat, in);
+    Coordination::read(stat, in);
+    Coordination::read(has_more, in);
+
+    int32_t size = 0;
+    Coordination::read(size, in);
+    if (size < 0)
+        throw Exception("Negative size while reading array from ZooKeeper", Error::ZMARSHALLINGERROR);
+    if (size > MAX_STRING_OR_ARRAY_SIZE)
+        throw Exception("Too large array size while reading from ZooKeeper", Error::ZMARSHALLINGERROR);
+
+    children.resize(size);
+    for (auto & child : children)
+    {
+        Coordination::read(child.name, in);
+        Coordination::read(child.error, in);
+        if (child.error != Error::ZOK)
+            continue;
+        if (with_data)
+            Coordination::read(child.data, in);
+        if (with_stat)
+            Coordination::read(child.stat, in);
+    }
+}
+
+void ZooKeeperListWithDataResponse::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(with_data, out);
+    Coordination::write(with_stat, out);
+    Coordination::write(stat, out);
+    Coordination::write(has_more, out);
+
+    Coordination::write(static_cast<int32_t>(children.size()), out);
+    for (const auto & child : children)
+    {
+        Coordination::write(child.name, out);
+        Coordination::write(child.error, out);
+        if (child.error != Error::ZOK)
+            continue;
+        if (with_data)
+            Coordination::write(child.data, out);
+        if (with_stat)
+            Coordination::write(child.stat, out);
+    }
+}
+
+void ZooKeeperPagedListRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(has_watch, out);
+    Coordination::write(start_after, out);
+    Coordination::write(limit, out);
+}
+
+size_t ZooKeeperPagedListRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(has_watch) + writtenSize(start_after) + sizeof(limit);
+}
+
+void ZooKeeperPagedListRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    Coordination::read(has_watch, in);
+    Coordination::read(start_after, in);
+    Coordination::read(limit, in);
+}
+
+void ZooKeeperPagedListResponse::readImpl(ReadBuffer & in)
+{
+    Coordination::read(names, in);
+    Coordination::read(stat, in);
+    Coordination::read(has_more, in);
+}
+
+void ZooKeeperPagedListResponse::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(names, out);
+    Coordination::write(stat, out);
+    Coordination::write(has_more, out);
+}
+
+void ZooKeeperStatBatchRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(paths, out);
+}
+
+size_t ZooKeeperStatBatchRequest::sizeImpl() const
+{
+    return writtenSize(paths);
+}
+
+void ZooKeeperStatBatchRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(paths, in);
+}
+
+void ZooKeeperStatBatchResponse::readImpl(ReadBuffer & in)
+{
+    int32_t size = 0;
+    Coordination::read(size, in);
+    if (size < 0)
+        throw Exception("Negative size while reading array from ZooKeeper", Error::ZMARSHALLINGERROR);
+    if (size > MAX_STRING_OR_ARRAY_SIZE)
+        throw Exception("Too large array size while reading from ZooKeeper", Error::ZMARSHALLINGERROR);
+
+    stats.resize(size);
+    for (auto & path_stat : stats)
+    {
+        Coordination::read(path_stat.error, in);
+        if (path_stat.error == Error::ZOK)
+            Coordination::read(path_stat.stat, in);
+    }
+}
+
+void ZooKeeperStatBatchResponse::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(static_cast<int32_t>(stats.size()), out);
+    for (const auto & path_stat : stats)
+    {
+        Coordination::write(path_stat.error, out);
+        if (path_stat.error == Error::ZOK)
+            Coordination::write(path_stat.stat, out);
+    }
+}
+
+size_t ZooKeeperStatBatchResponse::sizeImpl() const
+{
+    size_t size = sizeof(int32_t);
+    for (const auto & path_stat : stats)
+        size += sizeof(int32_t) + (path_stat.error == Error::ZOK ? STAT_SIZE : 0);
+    return size;
+}
+
 void ZooKeeperListResponse::writeImpl(WriteBuffer & out) const
 {
+    if (serialized_body)
+    {
+        out.write(serialized_body->data(), serialized_body->size());
+        return;
+    }
     Coordination::write(names, out);
     Coordination::write(stat, out);
 }
 
+size_t ZooKeeperListResponse::sizeImpl() const
+{
+    return serialized_body ? serialized_body->size() : writtenSize(names) + STAT_SIZE;
+}
+
 void ZooKeeperSimpleListResponse::readImpl(ReadBuffer & in)
 {
     Coordination::read(names, in);
@@ -276,9 +630,19 @@ void ZooKeeperSimpleListResponse::readImpl(ReadBuffer & in)
 
 void ZooKeeperSimpleListResponse::writeImpl(WriteBuffer & out) const
 {
+    if (serialized_body)
+    {
+        out.write(serialized_body->data(), serialized_body->size());
+        return;
+    }
     Coordination::write(names, out);
 }
 
+size_t ZooKeeperSimpleListResponse::sizeImpl() const
+{
+    return serialized_body ? serialized_body->size() : writtenSize(names);
+}
+
 void ZooKeeperSetACLRequest::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(path, out);
@@ -286,6 +650,11 @@ void ZooKeeperSetACLRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(version, out);
 }
 
+size_t ZooKeeperSetACLRequest::sizeImpl() const
+{
+    return writtenSize(path) + writtenSize(acls) + sizeof(version);
+}
+
 void ZooKeeperSetACLRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -313,6 +682,11 @@ void ZooKeeperGetACLRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(path, out);
 }
 
+size_t ZooKeeperGetACLRequest::sizeImpl() const
+{
+    return writtenSize(path);
+}
+
 void ZooKeeperGetACLResponse::writeImpl(WriteBuffer & out) const
 {
     Coordination::write(acl, out);
@@ -331,6 +705,11 @@ void ZooKeeperCheckRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(version, out);
 }
 
+size_t ZooKeeperCheckRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(version);
+}
+
 void ZooKeeperCheckRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(path, in);
@@ -439,6 +818,16 @@ void ZooKeeperMultiRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(error, out);
 }
 
+size_t ZooKeeperMultiRequest::sizeImpl() const
+{
+    /// Every request and the end have header of op_num, done and error
+    constexpr size_t header_size = sizeof(int32_t) + sizeof(bool) + sizeof(int32_t);
+    size_t size = header_size;
+    for (const auto & request : requests)
+        size += header_size + dynamic_cast<const ZooKeeperRequest &>(*request).sizeImpl();
+    return size;
+}
+
 void ZooKeeperMultiRequest::readImpl(ReadBuffer & in)
 {
 
@@ -462,6 +851,7 @@ void ZooKeeperMultiRequest::readImpl(ReadBuffer & in)
 
         ZooKeeperRequestPtr request = ZooKeeperRequestFactory::instance().get(op_num);
         request->readImpl(in);
+        request->getPathHash();
         requests.push_back(request);
 
         if (in.eof())
@@ -564,6 +954,19 @@ void ZooKeeperSetWatchesRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(data_watches, out);
     Coordination::write(exist_watches, out);
     Coordination::write(list_watches, out);
+    if (op_num == OpNum::SetWatches2)
+    {
+        Coordination::write(persistent_watches, out);
+        Coordination::write(persistent_recursive_watches, out);
+    }
+}
+
+size_t ZooKeeperSetWatchesRequest::sizeImpl() const
+{
+    size_t size = sizeof(relative_zxid) + writtenSize(data_watches) + writtenSize(exist_watches) + writtenSize(list_watches);
+    if (op_num == OpNum::SetWatches2)
+        size += writtenSize(persistent_watches) + writtenSize(persistent_recursive_watches);
+    return size;
 }
 
 void ZooKeeperSetWatchesRequest::readImpl(ReadBuffer & in)
@@ -572,32 +975,83 @@ void ZooKeeperSetWatchesRequest::readImpl(ReadBuffer & in)
     Coordination::read(data_watches, in);
     Coordination::read(exist_watches, in);
     Coordination::read(list_watches, in);
+    if (op_num == OpNum::SetWatches2)
+    {
+        Coordination::read(persistent_watches, in);
+        Coordination::read(persistent_recursive_watches, in);
+    }
 }
 
+void ZooKeeperAddWatchRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(path, out);
+    Coordination::write(static_cast<int32_t>(mode), out);
+}
 
-ZooKeeperResponsePtr ZooKeeperHeartbeatRequest::makeResponse() const { return std::make_shared<ZooKeeperHeartbeatResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetWatchesRequest::makeResponse() const { return std::make_shared<ZooKeeperSetWatchesResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSyncRequest::makeResponse() const { return std::make_shared<ZooKeeperSyncResponse>(); }
-ZooKeeperResponsePtr ZooKeeperAuthRequest::makeResponse() const { return std::make_shared<ZooKeeperAuthResponse>(); }
-ZooKeeperResponsePtr ZooKeeperCreateRequest::makeResponse() const { return std::make_shared<ZooKeeperCreateResponse>(); }
-ZooKeeperResponsePtr ZooKeeperRemoveRequest::makeResponse() const { return std::make_shared<ZooKeeperRemoveResponse>(); }
-ZooKeeperResponsePtr ZooKeeperExistsRequest::makeResponse() const { return std::make_shared<ZooKeeperExistsResponse>(); }
-ZooKeeperResponsePtr ZooKeeperGetRequest::makeResponse() const { return std::make_shared<ZooKeeperGetResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetRequest::makeResponse() const { return std::make_shared<ZooKeeperSetResponse>(); }
-ZooKeeperResponsePtr ZooKeeperListRequest::makeResponse() const { return std::make_shared<ZooKeeperListResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSimpleListRequest::makeResponse() const { return std::make_shared<ZooKeeperSimpleListResponse>(); }
-ZooKeeperResponsePtr ZooKeeperCheckRequest::makeResponse() const { return std::make_shared<ZooKeeperCheckResponse>(); }
-ZooKeeperResponsePtr ZooKeeperCloseRequest::makeResponse() const { return std::make_shared<ZooKeeperCloseResponse>(); }
-ZooKeeperResponsePtr ZooKeeperSetACLRequest::makeResponse() const { return std::make_shared<ZooKeeperSetACLResponse>(); }
-ZooKeeperResponsePtr ZooKeeperGetACLRequest::makeResponse() const { return std::make_shared<ZooKeeperGetACLResponse>(); }
+size_t ZooKeeperAddWatchRequest::sizeImpl() const
+{
+    return writtenSize(path) + sizeof(int32_t);
+}
+
+void ZooKeeperAddWatchRequest::addRootPath(const String & root_path)
+{
+    Coordination::addRootPath(path, root_path);
+}
+
+void ZooKeeperAddWatchRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(path, in);
+    int32_t raw_mode;
+    Coordination::read(raw_mode, in);
+    if (raw_mode != static_cast<int32_t>(AddWatchMode::Persistent) && raw_mode != static_cast<int32_t>(AddWatchMode::PersistentRecursive))
+        throw Exception("Unknown mode of AddWatch request: " + std::to_string(raw_mode), Error::ZBADARGUMENTS);
+    mode = static_cast<AddWatchMode>(raw_mode);
+}
+
+
+ZooKeeperResponsePtr ZooKeeperHeartbeatRequest::makeResponse() const { return makePooledResponse<ZooKeeperHeartbeatResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetWatchesRequest::makeResponse() const { return makePooledResponse<ZooKeeperSetWatchesResponse>(); }
+ZooKeeperResponsePtr ZooKeeperAddWatchRequest::makeResponse() const { return makePooledResponse<ZooKeeperAddWatchResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSyncRequest::makeResponse() const { return makePooledResponse<ZooKeeperSyncResponse>(); }
+ZooKeeperResponsePtr ZooKeeperAuthRequest::makeResponse() const { return makePooledResponse<ZooKeeperAuthResponse>(); }
+ZooKeeperResponsePtr ZooKeeperCreateRequest::makeResponse() const
+{
+    auto response = makePooledResponse<ZooKeeperCreateResponse>();
+    response->with_stat = op_num != OpNum::Create;
+    return response;
+}
+ZooKeeperResponsePtr ZooKeeperRemoveRequest::makeResponse() const { return makePooledResponse<ZooKeeperRemoveResponse>(); }
+ZooKeeperResponsePtr ZooKeeperRemoveRecursiveRequest::makeResponse() const
+{
+    return makePooledResponse<ZooKeeperRemoveRecursiveResponse>();
+}
+ZooKeeperResponsePtr ZooKeeperExistsRequest::makeResponse() const { return makePooledResponse<ZooKeeperExistsResponse>(); }
+ZooKeeperResponsePtr ZooKeeperGetRequest::makeResponse() const { return makePooledResponse<ZooKeeperGetResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetRequest::makeResponse() const { return makePooledResponse<ZooKeeperSetResponse>(); }
+ZooKeeperResponsePtr ZooKeeperListRequest::makeResponse() const { return makePooledResponse<ZooKeeperListResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSimpleListRequest::makeResponse() const { return makePooledResponse<ZooKeeperSimpleListResponse>(); }
+
+ZooKeeperResponsePtr ZooKeeperListWithDataRequest::makeResponse() const
+{
+    auto response = makePooledResponse<ZooKeeperListWithDataResponse>();
+    response->with_data = with_data;
+    response->with_stat = with_stat;
+    return response;
+}
+ZooKeeperResponsePtr ZooKeeperPagedListRequest::makeResponse() const { return makePooledResponse<ZooKeeperPagedListResponse>(); }
+ZooKeeperResponsePtr ZooKeeperStatBatchRequest::makeResponse() const { return makePooledResponse<ZooKeeperStatBatchResponse>(); }
+ZooKeeperResponsePtr ZooKeeperCheckRequest::makeResponse() const { return makePooledResponse<ZooKeeperCheckResponse>(); }
+ZooKeeperResponsePtr ZooKeeperCloseRequest::makeResponse() const { return makePooledResponse<ZooKeeperCloseResponse>(); }
+ZooKeeperResponsePtr ZooKeeperSetACLRequest::makeResponse() const { return makePooledResponse<ZooKeeperSetACLResponse>(); }
+ZooKeeperResponsePtr ZooKeeperGetACLRequest::makeResponse() const { return makePooledResponse<ZooKeeperGetACLResponse>(); }
 
 ZooKeeperResponsePtr ZooKeeperMultiRequest::makeResponse() const
 {
     std::shared_ptr<ZooKeeperMultiResponse> response;
     if (getOpNum() == OpNum::Multi)
-        response = std::make_shared<ZooKeeperMultiWriteResponse>(requests);
+        response = makePooledResponse<ZooKeeperMultiWriteResponse>(requests);
     else
-        response = std::make_shared<ZooKeeperMultiReadResponse>(requests);
+        response = makePooledResponse<ZooKeeperMultiReadResponse>(requests);
 
     return response;
 }
@@ -609,6 +1063,11 @@ void ZooKeeperNewSessionRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(server_id, out);
 }
 
+size_t ZooKeeperNewSessionRequest::sizeImpl() const
+{
+    return sizeof(internal_id) + sizeof(session_timeout_ms) + sizeof(server_id);
+}
+
 void ZooKeeperNewSessionRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(internal_id, in);
@@ -618,7 +1077,7 @@ void ZooKeeperNewSessionRequest::readImpl(ReadBuffer & in)
 
 Coordination::ZooKeeperResponsePtr ZooKeeperNewSessionRequest::makeResponse() const
 {
-    auto response = std::make_shared<ZooKeeperNewSessionResponse>();
+    auto response = makePooledResponse<ZooKeeperNewSessionResponse>();
     response->internal_id = internal_id;
     response->server_id = server_id;
     response->xid = xid;
@@ -648,6 +1107,11 @@ void ZooKeeperUpdateSessionRequest::writeImpl(WriteBuffer & out) const
     Coordination::write(server_id, out);
 }
 
+size_t ZooKeeperUpdateSessionRequest::sizeImpl() const
+{
+    return sizeof(session_id) + sizeof(session_timeout_ms) + sizeof(server_id);
+}
+
 void ZooKeeperUpdateSessionRequest::readImpl(ReadBuffer & in)
 {
     Coordination::read(session_id, in);
@@ -657,7 +1121,7 @@ void ZooKeeperUpdateSessionRequest::readImpl(ReadBuffer & in)
 
 Coordination::ZooKeeperResponsePtr ZooKeeperUpdateSessionRequest::makeResponse() const
 {
-    auto response = std::make_shared<ZooKeeperUpdateSessionResponse>();
+    auto response = makePooledResponse<ZooKeeperUpdateSessionResponse>();
     response->session_id = session_id;
     response->server_id = server_id;
     response->xid = xid;
@@ -678,6 +1142,124 @@ void ZooKeeperUpdateSessionResponse::writeImpl(WriteBuffer & out) const
     Coordination::write(success, out);
 }
 
+void ZooKeeperCloseSessionsRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(session_ids, out);
+}
+
+size_t ZooKeeperCloseSessionsRequest::sizeImpl() const
+{
+    return writtenSize(session_ids);
+}
+
+void ZooKeeperCloseSessionsRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(session_ids, in);
+}
+
+Coordination::ZooKeeperResponsePtr ZooKeeperCloseSessionsRequest::makeResponse() const
+{
+    auto response = makePooledResponse<ZooKeeperCloseSessionsResponse>();
+    response->xid = xid;
+    return response;
+}
+
+String ZooKeeperCloseSessionsRequest::toString() const
+{
+    return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", sessions " + std::to_string(session_ids.size());
+}
+
+void ZooKeeperRemoveExpiredRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(paths, out);
+}
+
+size_t ZooKeeperRemoveExpiredRequest::sizeImpl() const
+{
+    return writtenSize(paths);
+}
+
+void ZooKeeperRemoveExpiredRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(paths, in);
+}
+
+Coordination::ZooKeeperResponsePtr ZooKeeperRemoveExpiredRequest::makeResponse() const
+{
+    auto response = makePooledResponse<ZooKeeperRemoveExpiredResponse>();
+    response->xid = xid;
+    return response;
+}
+
+void ZooKeeperCheckDigestRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(checkpoint, out);
+    Coordination::write(checked_checkpoint, out);
+    Coordination::write(checked_digest, out);
+}
+
+size_t ZooKeeperCheckDigestRequest::sizeImpl() const
+{
+    return writtenSize(checkpoint) + writtenSize(checked_checkpoint) + sizeof(checked_digest);
+}
+
+void ZooKeeperCheckDigestRequest::readImpl(ReadBuffer & in)
+{
+    Coordination::read(checkpoint, in);
+    Coordination::read(checked_checkpoint, in);
+    Coordination::read(checked_digest, in);
+}
+
+Coordination::ZooKeeperResponsePtr ZooKeeperCheckDigestRequest::makeResponse() const
+{
+    auto response = makePooledResponse<ZooKeeperCheckDigestResponse>();
+    response->xid = xid;
+    return response;
+}
+
+void ZooKeeperNewSessionsRequest::writeImpl(WriteBuffer & out) const
+{
+    Coordination::write(static_cast<int32_t>(requests.size()), out);
+    for (const auto & request : requests)
+        request->writeImpl(out);
+}
+
+size_t ZooKeeperNewSessionsRequest::sizeImpl() const
+{
+    size_t size = sizeof(int32_t);
+    for (const auto & request : requests)
+        size += request->sizeImpl();
+    return size;
+}
+
+void ZooKeeperNewSessionsRequest::readImpl(ReadBuffer & in)
+{
+    int32_t size = 0;
+    Coordination::read(size, in);
+    if (size < 0)
+        throw Exception("Negative size while reading new session requests", Error::ZMARSHALLINGERROR);
+
+    requests.resize(size);
+    for (auto & request : requests)
+    {
+        request = std::make_shared<ZooKeeperNewSessionRequest>();
+        request->xid = NEW_SESSION_XID;
+        request->readImpl(in);
+    }
+}
+
+Coordination::ZooKeeperResponsePtr ZooKeeperNewSessionsRequest::makeResponse() const
+{
+    auto response = makePooledResponse<ZooKeeperNewSessionsResponse>();
+    response->xid = xid;
+    return response;
+}
+
+String ZooKeeperNewSessionsRequest::toString() const
+{
+    return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", sessions " + std::to_string(requests.size());
+}
+
 void ZooKeeperRequestFactory::registerRequest(OpNum op_num, Creator creator)
 {
     if (!op_num_to_request.try_emplace(op_num, creator).second)
@@ -718,11 +1300,16 @@ void registerZooKeeperRequest(ZooKeeperRequestFactory & factory)
 {
     factory.registerRequest(num, []
     {
-        auto res = std::make_shared<RequestT>();
+        /// Requests are created and released at the rate of client operations, mostly by different threads. They are
+        /// allocated with their control block in one chunk of a slab pool, whose thread caches exchange freed chunks in
+        /// batches, instead of asking the allocator twice per request.
+        auto res = std::allocate_shared<RequestT>(SlabAllocator<RequestT>());
         if constexpr (num == OpNum::MultiRead)
             res->operation_type = ZooKeeperMultiRequest::OperationType::Read;
         else if constexpr (num == OpNum::Multi)
             res->operation_type = ZooKeeperMultiRequest::OperationType::Write;
+        else if constexpr (num == OpNum::Create2 || num == OpNum::CreateContainer || num == OpNum::CreateTTL || num == OpNum::SetWatches2)
+            res->op_num = num;
         return res;
     });
 }
@@ -734,19 +1321,32 @@ ZooKeeperRequestFactory::ZooKeeperRequestFactory()
     registerZooKeeperRequest<OpNum::Auth, ZooKeeperAuthRequest>(*this);
     registerZooKeeperRequest<OpNum::Close, ZooKeeperCloseRequest>(*this);
     registerZooKeeperRequest<OpNum::Create, ZooKeeperCreateRequest>(*this);
+    registerZooKeeperRequest<OpNum::Create2, ZooKeeperCreateRequest>(*this);
+    registerZooKeeperRequest<OpNum::CreateContainer, ZooKeeperCreateRequest>(*this);
+    registerZooKeeperRequest<OpNum::CreateTTL, ZooKeeperCreateRequest>(*this);
     registerZooKeeperRequest<OpNum::Remove, ZooKeeperRemoveRequest>(*this);
+    registerZooKeeperRequest<OpNum::RemoveRecursive, ZooKeeperRemoveRecursiveRequest>(*this);
     registerZooKeeperRequest<OpNum::Exists, ZooKeeperExistsRequest>(*this);
     registerZooKeeperRequest<OpNum::Get, ZooKeeperGetRequest>(*this);
     registerZooKeeperRequest<OpNum::Set, ZooKeeperSetRequest>(*this);
     registerZooKeeperRequest<OpNum::SimpleList, ZooKeeperSimpleListRequest>(*this);
     registerZooKeeperRequest<OpNum::FilteredList, ZooKeeperFilteredListRequest>(*this);
+    registerZooKeeperRequest<OpNum::ListWithData, ZooKeeperListWithDataRequest>(*this);
+    registerZooKeeperRequest<OpNum::PagedList, ZooKeeperPagedListRequest>(*this);
+    registerZooKeeperRequest<OpNum::StatBatch, ZooKeeperStatBatchRequest>(*this);
     registerZooKeeperRequest<OpNum::List, ZooKeeperListRequest>(*this);
     registerZooKeeperRequest<OpNum::Check, ZooKeeperCheckRequest>(*this);
     registerZooKeeperRequest<OpNum::Multi, ZooKeeperMultiRequest>(*this);
     registerZooKeeperRequest<OpNum::MultiRead, ZooKeeperMultiRequest>(*this);
     registerZooKeeperRequest<OpNum::NewSession, ZooKeeperNewSessionRequest>(*this);
     registerZooKeeperRequest<OpNum::UpdateSession, ZooKeeperUpdateSessionRequest>(*this);
+    registerZooKeeperRequest<OpNum::CloseSessions, ZooKeeperCloseSessionsRequest>(*this);
+    registerZooKeeperRequest<OpNum::NewSessions, ZooKeeperNewSessionsRequest>(*this);
+    registerZooKeeperRequest<OpNum::RemoveExpired, ZooKeeperRemoveExpiredRequest>(*this);
+    registerZooKeeperRequest<OpNum::CheckDigest, ZooKeeperCheckDigestRequest>(*this);
     registerZooKeeperRequest<OpNum::SetWatches, ZooKeeperSetWatchesRequest>(*this);
+    registerZooKeeperRequest<OpNum::SetWatches2, ZooKeeperSetWatchesRequest>(*this);
+    registerZooKeeperRequest<OpNum::AddWatch, ZooKeeperAddWatchRequest>(*this);
     registerZooKeeperRequest<OpNum::GetACL, ZooKeeperGetACLRequest>(*this);
     registerZooKeeperRequest<OpNum::SetACL, ZooKeeperSetACLRequest>(*this);
 }
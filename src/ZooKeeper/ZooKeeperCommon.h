@@ -20,6 +20,8 @@
 #include <boost/noncopyable.hpp>
 #include <Common/IO//Operators.h>
 #include <Common/IO/ReadBufferFromString.h>
+#include <Common/HashFunctions.h>
+#include <Common/RequestTimeline.h>
 
 
 namespace Coordination
@@ -33,11 +35,18 @@ struct ZooKeeperResponse : virtual Response
     /// used to calculate request latency
     UInt64 request_created_time_ms = 0;
 
+    /// Stages of the request passed, taken from the request when applied
+    RK::RequestTimeline timeline;
+
     virtual ~ZooKeeperResponse() override = default;
     virtual void readImpl(ReadBuffer &) = 0;
     virtual void writeImpl(WriteBuffer &) const = 0;
     virtual void write(WriteBuffer & out) const;
 
+    /// Size of what writeImpl writes, so that writeNoCopy reserves the buffer once rather than growing it while writing.
+    /// Responses of Stats and names override it, 0 by default which means it is not known.
+    virtual size_t sizeImpl() const { return 0; }
+
     /// Prepended length to avoid copy
     virtual void writeNoCopy(WriteBufferFromOwnString & out) const;
     virtual OpNum getOpNum() const = 0;
@@ -68,6 +77,9 @@ struct ZooKeeperRequest : virtual Request
 
     bool restored_from_zookeeper_log = false;
 
+    /// Stages of the server pipeline passed, copies of RequestForSession share the request so that every stage records here
+    mutable RK::RequestTimeline timeline;
+
     ZooKeeperRequest() = default;
     ZooKeeperRequest(const ZooKeeperRequest &) = default;
     virtual ~ZooKeeperRequest() override = default;
@@ -80,12 +92,31 @@ struct ZooKeeperRequest : virtual Request
     virtual void writeImpl(WriteBuffer &) const = 0;
     virtual void readImpl(ReadBuffer &) = 0;
 
+    /// Exact size of what writeImpl writes, so that a request is written at once into a buffer of the right size.
+    /// By default it is measured by writing.
+    virtual size_t sizeImpl() const;
+    /// Size of what write writes
+    size_t bytesSize() const;
+
     static std::shared_ptr<ZooKeeperRequest> read(ReadBuffer & in);
 
     virtual ZooKeeperResponsePtr makeResponse() const = 0;
     virtual bool isReadRequest() const = 0;
 
     virtual String toString() const override { return Coordination::toString(getOpNum()); }
+
+    /// Hash of getPath() which is same with StringHash. It is cached, so it is better to
+    /// invoke it once right after the request is parsed, then the request processor thread
+    /// will not hash the path again and again.
+    size_t getPathHash() const
+    {
+        if (!path_hash)
+            path_hash = RK::StringHash()(getPath());
+        return *path_hash;
+    }
+
+private:
+    mutable std::optional<size_t> path_hash;
 };
 
 using ZooKeeperRequestPtr = std::shared_ptr<ZooKeeperRequest>;
@@ -110,16 +141,22 @@ struct ZooKeeperHeartbeatResponse final : ZooKeeperResponse
 
 /** Internal request.
  */
+/// SetWatches or SetWatches2, which also sets persistent watches
 struct ZooKeeperSetWatchesRequest final : ZooKeeperRequest
 {
+    OpNum op_num = OpNum::SetWatches;
     int64_t relative_zxid;
     std::vector<String> data_watches;
     std::vector<String> exist_watches;
     std::vector<String> list_watches;
+    /// Only of SetWatches2
+    std::vector<String> persistent_watches;
+    std::vector<String> persistent_recursive_watches;
 
     String getPath() const override { return {}; }
-    OpNum getOpNum() const override { return OpNum::SetWatches; }
+    OpNum getOpNum() const override { return op_num; }
     void writeImpl(WriteBuffer &) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer &) override;
     ZooKeeperResponsePtr makeResponse() const override;
     bool isReadRequest() const override { return true; }
@@ -133,12 +170,40 @@ struct ZooKeeperSetWatchesResponse final : ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::SetWatches; }
 };
 
+struct ZooKeeperAddWatchRequest final : ZooKeeperRequest
+{
+    String path;
+    AddWatchMode mode = AddWatchMode::Persistent;
+
+    String getPath() const override { return path; }
+    void addRootPath(const String & root_path) override;
+    OpNum getOpNum() const override { return OpNum::AddWatch; }
+    void writeImpl(WriteBuffer &) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer &) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", mode "
+            + std::to_string(static_cast<int32_t>(mode));
+    }
+};
+
+struct ZooKeeperAddWatchResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+    OpNum getOpNum() const override { return OpNum::AddWatch; }
+};
+
 struct ZooKeeperSyncRequest final : ZooKeeperRequest
 {
     String path;
     String getPath() const override { return path; }
     OpNum getOpNum() const override { return OpNum::Sync; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
     ZooKeeperResponsePtr makeResponse() const override;
     bool isReadRequest() const override { return false; }
@@ -150,6 +215,7 @@ struct ZooKeeperSyncResponse final : ZooKeeperResponse
     String path;
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     OpNum getOpNum() const override { return OpNum::Sync; }
 };
 
@@ -158,10 +224,20 @@ struct ZooKeeperWatchResponse final : WatchResponse, ZooKeeperResponse
 {
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
 
     void write(WriteBuffer & out) const override;
+    void writeNoCopy(WriteBufferFromOwnString & out) const override;
+
+    /// A watch event is sent to all the triggered watchers unchanged, so it is serialized only once
+    /// and the result is shared by connections. The response must not be modified after it.
+    const String & getSerialized() const;
 
     OpNum getOpNum() const override { return OpNum::Unspecified; }
+
+private:
+    mutable std::once_flag serialize_flag;
+    mutable String serialized;
 };
 
 struct ZooKeeperAuthRequest final : ZooKeeperRequest
@@ -173,6 +249,7 @@ struct ZooKeeperAuthRequest final : ZooKeeperRequest
     String getPath() const override { return {}; }
     OpNum getOpNum() const override { return OpNum::Auth; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -218,11 +295,20 @@ struct ZooKeeperCreateRequest final : public CreateRequest, ZooKeeperRequest
     /// used only during restore from zookeeper log
     int32_t parent_cversion = -1;
 
+    /// Create, Create2, CreateContainer or CreateTTL
+    OpNum op_num = OpNum::Create;
+
+    /// Create modes of ZooKeeper 3.5, ttl is sent by CreateTTL only
+    bool is_container = false;
+    bool is_ttl = false;
+    int64_t ttl = 0;
+
     ZooKeeperCreateRequest() = default;
     explicit ZooKeeperCreateRequest(const CreateRequest & base) : CreateRequest(base) { }
 
-    OpNum getOpNum() const override { return OpNum::Create; }
+    OpNum getOpNum() const override { return op_num; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -234,23 +320,30 @@ struct ZooKeeperCreateRequest final : public CreateRequest, ZooKeeperRequest
         //    bool is_ephemeral = false;
         //    bool is_sequential = false;
         return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", data " + data + ", is_ephemeral "
-            + std::to_string(is_ephemeral) + ", is_sequential " + std::to_string(is_sequential);
+            + std::to_string(is_ephemeral) + ", is_sequential " + std::to_string(is_sequential) + ", is_container "
+            + std::to_string(is_container) + ", is_ttl " + std::to_string(is_ttl) + ", ttl " + std::to_string(ttl);
     }
 };
 
 struct ZooKeeperCreateResponse final : CreateResponse, ZooKeeperResponse
 {
+    /// Stat of the created node follows path_created, a response of Create2, CreateContainer and CreateTTL
+    bool with_stat = false;
+    Stat stat{};
+
     void readImpl(ReadBuffer & in) override;
 
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
 
-    OpNum getOpNum() const override { return OpNum::Create; }
+    OpNum getOpNum() const override { return with_stat ? OpNum::Create2 : OpNum::Create; }
 
     bool operator==(const ZooKeeperResponse & response) const override
     {
         if (const ZooKeeperCreateResponse * create_response = dynamic_cast<const ZooKeeperCreateResponse *>(&response))
         {
-            return ZooKeeperResponse::operator==(response) && create_response->path_created == path_created;
+            return ZooKeeperResponse::operator==(response) && create_response->path_created == path_created
+                && create_response->with_stat == with_stat && (!with_stat || create_response->stat == stat);
         }
         return false;
     }
@@ -265,6 +358,7 @@ struct ZooKeeperRemoveRequest final : RemoveRequest, ZooKeeperRequest
 
     OpNum getOpNum() const override { return OpNum::Remove; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -285,12 +379,45 @@ struct ZooKeeperRemoveResponse final : RemoveResponse, ZooKeeperResponse
     OpNum getOpNum() const override { return OpNum::Remove; }
 };
 
+/// Remove path and all its descendants in one request, wire compatible with ClickHouse Keeper. Nothing is removed
+/// and ZNOTEMPTY is returned if the subtree has more than remove_nodes_limit nodes.
+struct ZooKeeperRemoveRecursiveRequest final : ZooKeeperRequest
+{
+    String path;
+    uint32_t remove_nodes_limit = 1;
+
+    String getPath() const override { return path; }
+    OpNum getOpNum() const override { return OpNum::RemoveRecursive; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", remove_nodes_limit "
+            + std::to_string(remove_nodes_limit);
+    }
+};
+
+struct ZooKeeperRemoveRecursiveResponse final : ZooKeeperResponse
+{
+    /// Not serialized, removed nodes whose watches are to be triggered
+    std::vector<String> removed_paths;
+
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+    OpNum getOpNum() const override { return OpNum::RemoveRecursive; }
+};
+
 struct ZooKeeperExistsRequest final : ExistsRequest, ZooKeeperRequest
 {
     ZooKeeperExistsRequest() = default;
     explicit ZooKeeperExistsRequest(const ExistsRequest & base) : ExistsRequest(base) { }
     OpNum getOpNum() const override { return OpNum::Exists; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -307,6 +434,7 @@ struct ZooKeeperExistsResponse final : ExistsResponse, ZooKeeperResponse
 {
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     OpNum getOpNum() const override { return OpNum::Exists; }
 
     bool operator==(const ZooKeeperResponse & response) const override
@@ -327,6 +455,7 @@ struct ZooKeeperGetRequest final : GetRequest, ZooKeeperRequest
     explicit ZooKeeperGetRequest(const GetRequest & base) : GetRequest(base) { }
     OpNum getOpNum() const override { return OpNum::Get; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -341,8 +470,12 @@ struct ZooKeeperGetRequest final : GetRequest, ZooKeeperRequest
 
 struct ZooKeeperGetResponse final : GetResponse, ZooKeeperResponse
 {
+    /// Serialized data and stat shared by the responses of identical get requests, written instead of them if set.
+    std::shared_ptr<const String> serialized_body;
+
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     OpNum getOpNum() const override { return OpNum::Get; }
 
     bool operator==(const ZooKeeperResponse & response) const override
@@ -367,6 +500,7 @@ struct ZooKeeperSetRequest final : SetRequest, ZooKeeperRequest
 
     OpNum getOpNum() const override { return OpNum::Set; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
     ZooKeeperResponsePtr makeResponse() const override;
     bool isReadRequest() const override { return false; }
@@ -384,6 +518,7 @@ struct ZooKeeperSetResponse final : SetResponse, ZooKeeperResponse
 {
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     OpNum getOpNum() const override { return OpNum::Set; }
 
     bool operator==(const ZooKeeperResponse & response) const override
@@ -402,6 +537,7 @@ struct ZooKeeperListRequest : ListRequest, ZooKeeperRequest
 {
     OpNum getOpNum() const override { return OpNum::List; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
     ZooKeeperResponsePtr makeResponse() const override;
     bool isReadRequest() const override { return true; }
@@ -444,6 +580,7 @@ struct ZooKeeperFilteredListRequest final : ZooKeeperListRequest
 
     OpNum getOpNum() const override { return OpNum::FilteredList; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
     String toString() const override
     {
@@ -454,8 +591,12 @@ struct ZooKeeperFilteredListRequest final : ZooKeeperListRequest
 
 struct ZooKeeperListResponse final : ListResponse, ZooKeeperResponse
 {
+    /// Serialized names and stat of a cached response, written instead of them if set.
+    std::shared_ptr<const String> serialized_body;
+
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     OpNum getOpNum() const override { return OpNum::List; }
 
     bool operator==(const ZooKeeperResponse & response) const override
@@ -482,8 +623,12 @@ struct ZooKeeperListResponse final : ListResponse, ZooKeeperResponse
 
 struct ZooKeeperSimpleListResponse final : SimpleListResponse, ZooKeeperResponse
 {
+    /// Serialized names of a cached response, written instead of them if set.
+    std::shared_ptr<const String> serialized_body;
+
     void readImpl(ReadBuffer & in) override;
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     OpNum getOpNum() const override { return OpNum::SimpleList; }
 
     bool operator==(const ZooKeeperResponse & response) const override
@@ -508,6 +653,183 @@ struct ZooKeeperSimpleListResponse final : SimpleListResponse, ZooKeeperResponse
     }
 };
 
+/// RaftKeeper extension, children of path together with their data and stat, so that reading a directory is one request
+/// instead of a list and a get for every child. Children are sorted by name and served by pages, a page starts after
+/// start_after and has at most max_children children and about max_bytes of names and data, 0 means the server limit.
+/// If has_more of the response is set, the next page starts after its last child. has_watch sets a list watch on path.
+struct ZooKeeperListWithDataRequest final : ZooKeeperListRequest
+{
+    bool with_data = true;
+    bool with_stat = true;
+    String start_after;
+    int32_t max_children = 0;
+    int32_t max_bytes = 0;
+
+    OpNum getOpNum() const override { return OpNum::ListWithData; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", start_after "
+            + start_after + ", max_children " + std::to_string(max_children) + ", max_bytes " + std::to_string(max_bytes);
+    }
+};
+
+struct ZooKeeperListWithDataResponse final : ZooKeeperResponse
+{
+    struct Child
+    {
+        String name;
+        /// Not ZOK if the session may not read the child, data and stat are not written then
+        Error error = Error::ZOK;
+        String data;
+        Stat stat{};
+    };
+
+    bool with_data = true;
+    bool with_stat = true;
+    /// Of the listed znode
+    Stat stat{};
+    std::vector<Child> children;
+    bool has_more = false;
+
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::ListWithData; }
+
+    bool operator==(const ZooKeeperResponse & response) const override
+    {
+        if (const auto * list_response = dynamic_cast<const ZooKeeperListWithDataResponse *>(&response))
+        {
+            if (!ZooKeeperResponse::operator==(response) || list_response->stat != stat || list_response->has_more != has_more
+                || list_response->children.size() != children.size())
+                return false;
+            for (size_t i = 0; i < children.size(); ++i)
+            {
+                const auto & lhs = children[i];
+                const auto & rhs = list_response->children[i];
+                if (lhs.name != rhs.name || lhs.error != rhs.error || lhs.data != rhs.data || lhs.stat != rhs.stat)
+                    return false;
+            }
+            return true;
+        }
+        return false;
+    }
+
+    String toString() const override
+    {
+        String base = "ListWithDataResponse " + ZooKeeperResponse::toString() + ", stat " + stat.toString() + ", has_more "
+            + std::to_string(has_more) + ", children ";
+        for (const auto & child : children)
+            base += ", " + child.name;
+        return base;
+    }
+};
+
+/// RaftKeeper extension, children of path sorted by name a page at a time, so that a client may walk a very wide znode
+/// without the server building the whole list. A page starts after start_after and has at most limit names, 0 means the
+/// server limit. If has_more of the response is set, the next page starts after its last name.
+struct ZooKeeperPagedListRequest final : ZooKeeperListRequest
+{
+    String start_after;
+    int32_t limit = 0;
+
+    OpNum getOpNum() const override { return OpNum::PagedList; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", path " + path + ", start_after "
+            + start_after + ", limit " + std::to_string(limit);
+    }
+};
+
+struct ZooKeeperPagedListResponse final : ListResponse, ZooKeeperResponse
+{
+    bool has_more = false;
+
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    OpNum getOpNum() const override { return OpNum::PagedList; }
+
+    bool operator==(const ZooKeeperResponse & response) const override
+    {
+        if (const auto * list_response = dynamic_cast<const ZooKeeperPagedListResponse *>(&response))
+            return ZooKeeperResponse::operator==(response) && list_response->stat == stat && list_response->has_more == has_more
+                && list_response->names.toStrings() == names.toStrings();
+        return false;
+    }
+
+    String toString() const override
+    {
+        String base = "PagedListResponse " + ZooKeeperResponse::toString() + ", stat " + stat.toString() + ", has_more "
+            + std::to_string(has_more) + ", names ";
+        auto func = [&](const StringRef & s) { base += ", " + s.toString(); };
+        std::for_each(names.begin(), names.end(), func);
+        return base;
+    }
+};
+
+/// RaftKeeper extension, stats of paths in one request, for clients polling versions of many znodes. Unlike get, no data
+/// is copied or sent, and unlike exists, no watch is set. As exists, it is not checked by ACL.
+struct ZooKeeperStatBatchRequest final : ZooKeeperRequest
+{
+    Strings paths;
+
+    OpNum getOpNum() const override { return OpNum::StatBatch; }
+    String getPath() const override { return {}; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+    ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return true; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", paths " + std::to_string(paths.size());
+    }
+};
+
+struct ZooKeeperStatBatchResponse final : ZooKeeperResponse
+{
+    struct PathStat
+    {
+        /// ZNONODE if the path does not exist, stat is not written then
+        Error error = Error::ZOK;
+        Stat stat{};
+    };
+
+    /// In the order of paths of the request
+    std::vector<PathStat> stats;
+
+    void readImpl(ReadBuffer & in) override;
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    OpNum getOpNum() const override { return OpNum::StatBatch; }
+
+    bool operator==(const ZooKeeperResponse & response) const override
+    {
+        if (const auto * stat_response = dynamic_cast<const ZooKeeperStatBatchResponse *>(&response))
+        {
+            if (!ZooKeeperResponse::operator==(response) || stat_response->stats.size() != stats.size())
+                return false;
+            for (size_t i = 0; i < stats.size(); ++i)
+                if (stats[i].error != stat_response->stats[i].error || stats[i].stat != stat_response->stats[i].stat)
+                    return false;
+            return true;
+        }
+        return false;
+    }
+
+    String toString() const override
+    {
+        return "StatBatchResponse " + ZooKeeperResponse::toString() + ", stats " + std::to_string(stats.size());
+    }
+};
+
 struct ZooKeeperCheckRequest final : CheckRequest, ZooKeeperRequest
 {
     ZooKeeperCheckRequest() = default;
@@ -515,6 +837,7 @@ struct ZooKeeperCheckRequest final : CheckRequest, ZooKeeperRequest
 
     OpNum getOpNum() const override { return OpNum::Check; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -549,6 +872,7 @@ struct ZooKeeperSetACLRequest final : SetACLRequest, ZooKeeperRequest
 {
     OpNum getOpNum() const override { return OpNum::SetACL; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
     ZooKeeperResponsePtr makeResponse() const override;
     bool isReadRequest() const override { return false; }
@@ -565,6 +889,7 @@ struct ZooKeeperGetACLRequest final : GetACLRequest, ZooKeeperRequest
 {
     OpNum getOpNum() const override { return OpNum::GetACL; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
     ZooKeeperResponsePtr makeResponse() const override;
     bool isReadRequest() const override { return true; }
@@ -585,6 +910,7 @@ struct ZooKeeperMultiRequest final : MultiRequest, ZooKeeperRequest
     ZooKeeperMultiRequest(const Requests & generic_requests, const ACLs & default_acls);
 
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     ZooKeeperResponsePtr makeResponse() const override;
@@ -686,6 +1012,7 @@ struct ZooKeeperNewSessionRequest final : ZooKeeperRequest
     Coordination::OpNum getOpNum() const override { return OpNum::NewSession; }
     String getPath() const override { return {}; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     Coordination::ZooKeeperResponsePtr makeResponse() const override;
@@ -734,6 +1061,7 @@ struct ZooKeeperUpdateSessionRequest final : ZooKeeperRequest
     Coordination::OpNum getOpNum() const override { return OpNum::UpdateSession; }
     String getPath() const override { return {}; }
     void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
     void readImpl(ReadBuffer & in) override;
 
     Coordination::ZooKeeperResponsePtr makeResponse() const override;
@@ -766,6 +1094,124 @@ struct ZooKeeperUpdateSessionResponse final : ZooKeeperResponse
     }
 };
 
+/// Fake internal RaftKeeper request. Never received from client
+/// and never send to client. Used to expire many dead sessions in one log entry.
+struct ZooKeeperCloseSessionsRequest final : ZooKeeperRequest
+{
+    std::vector<int64_t> session_ids;
+
+    Coordination::OpNum getOpNum() const override { return OpNum::CloseSessions; }
+    String getPath() const override { return {}; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+
+    Coordination::ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override;
+};
+
+/// Fake internal RaftKeeper response. Never received from client
+/// and never send to client.
+struct ZooKeeperCloseSessionsResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+
+    Coordination::OpNum getOpNum() const override { return OpNum::CloseSessions; }
+};
+
+/// Fake internal RaftKeeper request. Never received from client and never send to client.
+/// Used by leader to remove expired TTL and container nodes in one log entry, they are checked again when applied.
+struct ZooKeeperRemoveExpiredRequest final : ZooKeeperRequest
+{
+    Strings paths;
+
+    Coordination::OpNum getOpNum() const override { return OpNum::RemoveExpired; }
+    String getPath() const override { return {}; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+
+    Coordination::ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", paths " + std::to_string(paths.size());
+    }
+};
+
+/// Fake internal RaftKeeper response. Never received from client and never send to client.
+struct ZooKeeperRemoveExpiredResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+
+    Coordination::OpNum getOpNum() const override { return OpNum::RemoveExpired; }
+};
+
+/// Fake internal RaftKeeper request. Never received from client and never send to client.
+/// Used by leader to check that replicas have the same data tree. Every node records its digest of data tree under
+/// checkpoint when applying it, and compares the one recorded under checked_checkpoint with checked_digest, which is
+/// the digest the leader recorded.
+struct ZooKeeperCheckDigestRequest final : ZooKeeperRequest
+{
+    int64_t checkpoint = 0;
+    /// 0 if there is nothing to check
+    int64_t checked_checkpoint = 0;
+    UInt64 checked_digest = 0;
+
+    Coordination::OpNum getOpNum() const override { return OpNum::CheckDigest; }
+    String getPath() const override { return {}; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+
+    Coordination::ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override
+    {
+        return Coordination::toString(getOpNum()) + ", xid " + std::to_string(xid) + ", checkpoint " + std::to_string(checkpoint)
+            + ", checked checkpoint " + std::to_string(checked_checkpoint);
+    }
+};
+
+/// Fake internal RaftKeeper response. Never received from client and never send to client.
+struct ZooKeeperCheckDigestResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+
+    Coordination::OpNum getOpNum() const override { return OpNum::CheckDigest; }
+};
+
+/// Fake internal RaftKeeper request. Never received from client and never send to client.
+/// Used to create many sessions in one log entry, session ids are allocated in a range.
+struct ZooKeeperNewSessionsRequest final : ZooKeeperRequest
+{
+    std::vector<std::shared_ptr<ZooKeeperNewSessionRequest>> requests;
+
+    Coordination::OpNum getOpNum() const override { return OpNum::NewSessions; }
+    String getPath() const override { return {}; }
+    void writeImpl(WriteBuffer & out) const override;
+    size_t sizeImpl() const override;
+    void readImpl(ReadBuffer & in) override;
+
+    Coordination::ZooKeeperResponsePtr makeResponse() const override;
+    bool isReadRequest() const override { return false; }
+    String toString() const override;
+};
+
+/// Fake internal RaftKeeper response. Never received from client
+/// and never send to client.
+struct ZooKeeperNewSessionsResponse final : ZooKeeperResponse
+{
+    void readImpl(ReadBuffer &) override { }
+    void writeImpl(WriteBuffer &) const override { }
+
+    Coordination::OpNum getOpNum() const override { return OpNum::NewSessions; }
+};
+
 class ZooKeeperRequestFactory final : private boost::noncopyable
 {
 public:
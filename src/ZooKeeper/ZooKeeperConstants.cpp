@@ -20,15 +20,28 @@ static const std::unordered_set<int32_t> VALID_OPERATIONS =
     static_cast<int32_t>(OpNum::List),
     static_cast<int32_t>(OpNum::Check),
     static_cast<int32_t>(OpNum::Multi),
+    static_cast<int32_t>(OpNum::Create2),
+    static_cast<int32_t>(OpNum::RemoveRecursive),
+    static_cast<int32_t>(OpNum::CreateContainer),
+    static_cast<int32_t>(OpNum::CreateTTL),
     static_cast<int32_t>(OpNum::MultiRead),
     static_cast<int32_t>(OpNum::Auth),
     static_cast<int32_t>(OpNum::NewSession),
     static_cast<int32_t>(OpNum::OldNewSession),
     static_cast<int32_t>(OpNum::SetWatches),
+    static_cast<int32_t>(OpNum::SetWatches2),
+    static_cast<int32_t>(OpNum::AddWatch),
     static_cast<int32_t>(OpNum::SetACL),
     static_cast<int32_t>(OpNum::GetACL),
     static_cast<int32_t>(OpNum::FilteredList),
+    static_cast<int32_t>(OpNum::ListWithData),
+    static_cast<int32_t>(OpNum::PagedList),
+    static_cast<int32_t>(OpNum::StatBatch),
     static_cast<int32_t>(OpNum::UpdateSession),
+    static_cast<int32_t>(OpNum::CloseSessions),
+    static_cast<int32_t>(OpNum::NewSessions),
+    static_cast<int32_t>(OpNum::RemoveExpired),
+    static_cast<int32_t>(OpNum::CheckDigest),
 };
 
 std::string toString(OpNum op_num)
@@ -61,6 +74,14 @@ std::string toString(OpNum op_num)
             return "Check";
         case OpNum::Multi:
             return "Multi";
+        case OpNum::Create2:
+            return "Create2";
+        case OpNum::RemoveRecursive:
+            return "RemoveRecursive";
+        case OpNum::CreateContainer:
+            return "CreateContainer";
+        case OpNum::CreateTTL:
+            return "CreateTTL";
         case OpNum::MultiRead:
             return "MultiRead";
         case OpNum::Heartbeat:
@@ -73,14 +94,32 @@ std::string toString(OpNum op_num)
             return "OldNewSession";
         case OpNum::SetWatches:
             return "SetWatches";
+        case OpNum::SetWatches2:
+            return "SetWatches2";
+        case OpNum::AddWatch:
+            return "AddWatch";
         case OpNum::SetACL:
             return "SetACL";
         case OpNum::GetACL:
             return "GetACL";
         case OpNum::UpdateSession:
             return "UpdateSession";
+        case OpNum::CloseSessions:
+            return "CloseSessions";
+        case OpNum::NewSessions:
+            return "NewSessions";
+        case OpNum::RemoveExpired:
+            return "RemoveExpired";
+        case OpNum::CheckDigest:
+            return "CheckDigest";
         case OpNum::FilteredList:
             return "FilteredList";
+        case OpNum::ListWithData:
+            return "ListWithData";
+        case OpNum::PagedList:
+            return "PagedList";
+        case OpNum::StatBatch:
+            return "StatBatch";
     }
     int32_t raw_op = static_cast<int32_t>(op_num);
     throw Exception("Operation " + std::to_string(raw_op) + " is unknown", Error::ZUNIMPLEMENTED);
@@ -36,14 +36,34 @@ enum class OpNum : int32_t
     List = 12,
     Check = 13,
     Multi = 14,
+    Create2 = 15, /// Create which responds the stat of the created node.
+    RemoveRecursive = 18, /// Same with ClickHouse Keeper, remove a subtree in one request.
+    CreateContainer = 19, /// Same with ZooKeeper 3.5, a container is removed when its last child is removed.
+    CreateTTL = 21, /// Same with ZooKeeper 3.5, a TTL node is removed when it is not changed and has no child for ttl.
     MultiRead = 22,
     Auth = 100,
     SetWatches = 101,
+    SetWatches2 = 105, /// Same with ZooKeeper 3.6, SetWatches with persistent watches.
+    AddWatch = 106,
     NewSession = -10, /// Used to create new session.
     OldNewSession = 997, /// Same with NewSession, just for backward compatibility
 
     FilteredList = 500, /// Special operation only used in ClickHouse.
+    ListWithData = 501, /// RaftKeeper extension, children with their data and stat in one response.
+    PagedList = 502, /// RaftKeeper extension, a page of sorted children after a cursor.
+    StatBatch = 503, /// RaftKeeper extension, stats of a list of paths without their data.
     UpdateSession = 998, /// Special internal request. Used to session reconnect.
+    CloseSessions = 999, /// Special internal request. Used to expire dead sessions in batch.
+    NewSessions = 1000, /// Special internal request. Used to create sessions in batch.
+    RemoveExpired = 1001, /// Special internal request. Used to remove expired TTL and container nodes in batch.
+    CheckDigest = 1002, /// Special internal request. Used to compare digests of data tree between replicas.
+};
+
+/// Mode of AddWatch request, same with ZooKeeper 3.6
+enum class AddWatchMode : int32_t
+{
+    Persistent = 0, /// Data and child watch of the path, not removed when triggered
+    PersistentRecursive = 1, /// Data watch of the path and all its descendants, not removed when triggered
 };
 
 std::string toString(OpNum op_num);
@@ -53,6 +73,7 @@ static constexpr int32_t ZOOKEEPER_PROTOCOL_VERSION = 0;
 static constexpr int32_t CLIENT_HANDSHAKE_LENGTH = 44;
 static constexpr int32_t CLIENT_HANDSHAKE_LENGTH_WITH_READONLY = 45;
 static constexpr int32_t SERVER_HANDSHAKE_LENGTH = 36;
+static constexpr int32_t SERVER_HANDSHAKE_LENGTH_WITH_READONLY = 37;
 static constexpr int32_t PASSWORD_LENGTH = 16;
 
 /// ZooKeeper has 1 MB node size and serialization limit by default,
@@ -1,4 +1,5 @@
 #include "ZooKeeperIO.h"
+#include <cassert>
 
 namespace Coordination
 {
@@ -71,17 +72,21 @@ void write(const AuthID & auth_id, WriteBuffer & out)
 
 void write(const Stat & stat, WriteBuffer & out)
 {
-    write(stat.czxid, out);
-    write(stat.mzxid, out);
-    write(stat.ctime, out);
-    write(stat.mtime, out);
-    write(stat.version, out);
-    write(stat.cversion, out);
-    write(stat.aversion, out);
-    write(stat.ephemeralOwner, out);
-    write(stat.dataLength, out);
-    write(stat.numChildren, out);
-    write(stat.pzxid, out);
+    char buf[STAT_SIZE];
+    char * pos = buf;
+    pos = putBigEndian(pos, stat.czxid);
+    pos = putBigEndian(pos, stat.mzxid);
+    pos = putBigEndian(pos, stat.ctime);
+    pos = putBigEndian(pos, stat.mtime);
+    pos = putBigEndian(pos, stat.version);
+    pos = putBigEndian(pos, stat.cversion);
+    pos = putBigEndian(pos, stat.aversion);
+    pos = putBigEndian(pos, stat.ephemeralOwner);
+    pos = putBigEndian(pos, stat.dataLength);
+    pos = putBigEndian(pos, stat.numChildren);
+    pos = putBigEndian(pos, stat.pzxid);
+    assert(pos == buf + STAT_SIZE);
+    out.write(buf, STAT_SIZE);
 }
 
 void write(const Error & x, WriteBuffer & out)
@@ -93,7 +98,10 @@ void write(const CompactStrings & strings, WriteBuffer & out)
 {
     write(static_cast<int32_t>(strings.size()), out);
     for (auto elem : strings)
-        write(elem.toString(), out);
+    {
+        write(static_cast<int32_t>(elem.size), out);
+        out.write(elem.data, elem.size);
+    }
 }
 
 void read(size_t & x, ReadBuffer & in)
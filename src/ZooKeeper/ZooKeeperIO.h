@@ -1,6 +1,8 @@
 #pragma once
 #include <array>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
 #include <vector>
 
 #include <Common/CompactStrings.h>
@@ -49,6 +51,42 @@ void write(const std::vector<T> & arr, WriteBuffer & out)
         write(elem, out);
 }
 
+/// Put x big endian at pos and return the position after it. Records of fixed size are encoded so into a buffer on
+/// stack and written by one write, rather than by a bounds checked write for each field.
+template <typename T>
+inline char * putBigEndian(char * pos, T x)
+{
+    static_assert(std::is_integral_v<T> && (sizeof(T) == 4 || sizeof(T) == 8));
+    if constexpr (sizeof(T) == 8)
+        x = static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(x)));
+    else
+        x = static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(x)));
+    memcpy(pos, &x, sizeof(T));
+    return pos + sizeof(T);
+}
+
+/// Bytes of a Stat written
+constexpr size_t STAT_SIZE = 6 * sizeof(int64_t) + 5 * sizeof(int32_t);
+
+/// Sizes of what write writes, for values of variable size
+inline size_t writtenSize(int64_t) { return sizeof(int64_t); }
+inline size_t writtenSize(const std::string & s) { return sizeof(int32_t) + s.size(); }
+inline size_t writtenSize(const ACL & acl) { return sizeof(acl.permissions) + writtenSize(acl.scheme) + writtenSize(acl.id); }
+inline constexpr size_t writtenSize(const Stat &) { return STAT_SIZE; }
+inline size_t writtenSize(const CompactStrings & strings)
+{
+    return sizeof(int32_t) + strings.size() * sizeof(int32_t) + strings.bytes();
+}
+
+template <typename T>
+size_t writtenSize(const std::vector<T> & arr)
+{
+    size_t size = sizeof(int32_t);
+    for (const auto & elem : arr)
+        size += writtenSize(elem);
+    return size;
+}
+
 
 void read(size_t & x, ReadBuffer & in);
 #ifdef __APPLE__
@@ -30,6 +30,7 @@ namespace ProfileEvents
     extern const Event ZooKeeperBytesSent;
     extern const Event ZooKeeperBytesReceived;
     extern const Event ZooKeeperWatchResponse;
+    extern const Event ZooKeeperBatchedRequests;
 }
 
 namespace CurrentMetrics
@@ -304,10 +305,13 @@ ZooKeeper::ZooKeeper(
     const String & auth_data,
     Poco::Timespan session_timeout_,
     Poco::Timespan connection_timeout,
-    Poco::Timespan operation_timeout_)
+    Poco::Timespan operation_timeout_,
+    const BatchingSettings & batching_)
     : root_path(root_path_),
     session_timeout(session_timeout_),
-    operation_timeout(std::min(operation_timeout_, session_timeout_))
+    operation_timeout(std::min(operation_timeout_, session_timeout_)),
+    batching(batching_),
+    requests_queue(std::max(batching_.max_batch_size, size_t(1)))
 {
     if (!root_path.empty())
     {
@@ -523,6 +527,27 @@ void ZooKeeper::sendThread()
 
     auto prev_heartbeat_time = clock::now();
 
+    /// Popped while collecting a batch but can not join it, it is sent next
+    std::optional<RequestInfo> next_info;
+
+    /// After we popped element from the queue, we must register callbacks (even in the case when expired == true right now),
+    ///  because they must not be lost (callbacks must be called because the user will wait for them).
+    auto register_request = [this](RequestInfo & info)
+    {
+        if (info.request->xid != CLOSE_XID)
+        {
+            CurrentMetrics::add(CurrentMetrics::ZooKeeperRequest);
+            std::lock_guard lock(operations_mutex);
+            operations[info.request->xid] = info;
+        }
+
+        if (info.watch)
+        {
+            info.request->has_watch = true;
+            CurrentMetrics::add(CurrentMetrics::ZooKeeperWatch);
+        }
+    };
+
     try
     {
         while (!expired)
@@ -540,27 +565,54 @@ void ZooKeeper::sendThread()
                     UInt64(operation_timeout.totalMilliseconds()));
 
                 RequestInfo info;
-                if (requests_queue.tryPop(info, max_wait))
+                bool popped = false;
+                if (next_info)
+                {
+                    /// Already registered
+                    info = std::move(*next_info);
+                    next_info.reset();
+                    popped = true;
+                }
+                else if (requests_queue.tryPop(info, max_wait))
                 {
-                    /// After we popped element from the queue, we must register callbacks (even in the case when expired == true right now),
-                    ///  because they must not be lost (callbacks must be called because the user will wait for them).
+                    register_request(info);
+                    popped = true;
+                }
 
-                    if (info.request->xid != CLOSE_XID)
+                if (popped)
+                {
+                    if (expired)
                     {
-                        CurrentMetrics::add(CurrentMetrics::ZooKeeperRequest);
-                        std::lock_guard lock(operations_mutex);
-                        operations[info.request->xid] = info;
+                        break;
                     }
 
-                    if (info.watch)
+                    auto batch_type = getBatchType(info);
+                    if (batch_type != ZooKeeperMultiRequest::OperationType::Unspecified)
                     {
-                        info.request->has_watch = true;
-                        CurrentMetrics::add(CurrentMetrics::ZooKeeperWatch);
-                    }
+                        std::vector<ZooKeeperRequestPtr> batch{info.request};
+                        auto linger_deadline = clock::now() + std::chrono::milliseconds(batching.linger_ms);
+                        while (batch.size() < batching.max_batch_size)
+                        {
+                            auto wait_now = clock::now();
+                            UInt64 linger = linger_deadline > wait_now
+                                ? std::chrono::duration_cast<std::chrono::milliseconds>(linger_deadline - wait_now).count()
+                                : 0;
+
+                            RequestInfo more;
+                            if (!requests_queue.tryPop(more, linger))
+                                break;
+                            register_request(more);
+
+                            if (getBatchType(more) != batch_type)
+                            {
+                                next_info = std::move(more);
+                                break;
+                            }
+                            batch.push_back(more.request);
+                        }
 
-                    if (expired)
-                    {
-                        break;
+                        if (batch.size() > 1)
+                            info = makeBatch(batch, batch_type);
                     }
 
                     info.request->addRootPath(root_path);
@@ -719,17 +771,28 @@ void ZooKeeper::receiveEvent()
                 CurrentMetrics::sub(CurrentMetrics::ZooKeeperWatch, it->second.size());
                 watches.erase(it);
             }
+
+            /// Persistent watches of the path, and recursive ones of its ancestors which get no child events
+            std::string_view path = watch_response.path;
+            for (bool exact = true; !persistent_watches.empty() && !path.empty(); exact = false)
+            {
+                auto persistent_it = persistent_watches.find(String(path));
+                if (persistent_it != persistent_watches.end())
+                {
+                    for (auto & watch : persistent_it->second)
+                        if (watch.recursive ? watch_response.type != CHILD : exact)
+                            watch.callback(watch_response);
+                }
+
+                if (path == "/")
+                    break;
+                auto pos = path.rfind('/');
+                path = pos == 0 ? std::string_view("/") : path.substr(0, pos);
+            }
         };
     }
     else
     {
-        if (xid != last_received_xid + 1)
-            throw Exception(
-                "SessionId " + RK::toString(session_id) + ", Xid out of order, received " + RK::toString(xid) + ", expected " + RK::toString(last_received_xid + 1),
-                Error::ZCONNECTIONLOSS);
-
-        last_received_xid++;
-
         {
             std::lock_guard lock(operations_mutex);
 
@@ -737,6 +800,15 @@ void ZooKeeper::receiveEvent()
             if (it == operations.end())
                 throw Exception("Received response for unknown xid " + RK::toString(xid), Error::ZRUNTIMEINCONSISTENCY);
 
+            /// Responses come in order of requests, and xids are increasing with them
+            if (it != operations.begin())
+                throw Exception(
+                    "SessionId " + RK::toString(session_id) + ", Xid out of order, received " + RK::toString(xid) + ", expected "
+                        + RK::toString(operations.begin()->first),
+                    Error::ZCONNECTIONLOSS);
+
+            last_received_xid = xid;
+
             /// After this point, we must invoke callback, that we've grabbed from 'operations'.
             /// Invariant: all callbacks are invoked either in case of success or in case of error.
             /// (all callbacks in 'operations' are guaranteed to be invoked)
@@ -784,7 +856,11 @@ void ZooKeeper::receiveEvent()
                 String req_path = request_info.request->getPath();
                 removeRootPath(req_path, root_path);
                 std::lock_guard lock(watches_mutex);
-                watches[req_path].emplace_back(std::move(request_info.watch));
+                if (const auto * add_watch_request = dynamic_cast<const ZooKeeperAddWatchRequest *>(request_info.request.get()))
+                    persistent_watches[req_path].push_back(
+                        {add_watch_request->mode == AddWatchMode::PersistentRecursive, std::move(request_info.watch)});
+                else
+                    watches[req_path].emplace_back(std::move(request_info.watch));
             }
         }
 
@@ -937,6 +1013,28 @@ void ZooKeeper::finalize(bool error_send, bool error_receive)
 
             CurrentMetrics::sub(CurrentMetrics::ZooKeeperWatch, watches.size());
             watches.clear();
+
+            for (auto & path_watches : persistent_watches)
+            {
+                WatchResponse response;
+                response.type = SESSION;
+                response.state = EXPIRED_SESSION;
+                response.error = Error::ZSESSIONEXPIRED;
+
+                for (auto & watch : path_watches.second)
+                {
+                    try
+                    {
+                        watch.callback(response);
+                    }
+                    catch (...)
+                    {
+                        tryLogCurrentException(__PRETTY_FUNCTION__);
+                    }
+                }
+                CurrentMetrics::sub(CurrentMetrics::ZooKeeperWatch, path_watches.second.size());
+            }
+            persistent_watches.clear();
         }
 
         /// Drain queue
@@ -1022,6 +1120,113 @@ void ZooKeeper::pushRequest(RequestInfo && info)
 }
 
 
+ZooKeeperMultiRequest::OperationType ZooKeeper::getBatchType(const RequestInfo & info) const
+{
+    using OperationType = ZooKeeperMultiRequest::OperationType;
+
+    if (batching.max_batch_size <= 1 || info.watch || info.request->xid == CLOSE_XID)
+        return OperationType::Unspecified;
+
+    switch (info.request->getOpNum())
+    {
+        case OpNum::Get:
+        case OpNum::Exists:
+        case OpNum::List:
+        case OpNum::SimpleList:
+            return OperationType::Read;
+        case OpNum::Create:
+        case OpNum::Remove:
+        case OpNum::Set:
+            return batching.batch_writes ? OperationType::Write : OperationType::Unspecified;
+        default:
+            return OperationType::Unspecified;
+    }
+}
+
+
+ZooKeeper::RequestInfo ZooKeeper::makeBatch(const std::vector<ZooKeeperRequestPtr> & requests, ZooKeeperMultiRequest::OperationType type)
+{
+    auto multi_request = std::make_shared<ZooKeeperMultiRequest>();
+    multi_request->checkOperationType(type);
+    multi_request->xid = requests.front()->xid;
+    multi_request->requests.reserve(requests.size());
+
+    std::vector<RequestInfo> members;
+    members.reserve(requests.size());
+    {
+        std::lock_guard lock(operations_mutex);
+        for (const auto & request : requests)
+        {
+            multi_request->requests.push_back(request);
+            request->probably_sent = true;
+
+            /// Registered by send thread, and not sent yet, so no response can take it
+            auto it = operations.find(request->xid);
+            members.push_back(std::move(it->second));
+            operations.erase(it);
+        }
+    }
+    CurrentMetrics::sub(CurrentMetrics::ZooKeeperRequest, requests.size() - 1);
+    ProfileEvents::increment(ProfileEvents::ZooKeeperBatchedRequests, requests.size());
+
+    RequestInfo info;
+    info.request = multi_request;
+    info.time = members.front().time;
+    info.callback = [members = std::move(members)](const Response & response)
+    {
+        const auto & multi_response = dynamic_cast<const ZooKeeperMultiResponse &>(response);
+
+        /// Every callback is invoked even if one throws, then the first exception is thrown.
+        std::exception_ptr exception;
+        for (size_t i = 0; i < members.size(); ++i)
+        {
+            const auto & member = members[i];
+
+            ResponsePtr member_response;
+            Error error = response.error;
+            if (i < multi_response.responses.size())
+            {
+                member_response = multi_response.responses[i];
+                if (member_response->error != Error::ZOK)
+                    error = member_response->error;
+            }
+
+            /// Failed responses of multi are error responses rather than of the type of request
+            if (!member_response || error != Error::ZOK)
+            {
+                auto failed_response = member.request->makeResponse();
+                failed_response->error = error;
+                member_response = std::move(failed_response);
+            }
+
+            auto & zk_response = dynamic_cast<ZooKeeperResponse &>(*member_response);
+            zk_response.xid = member.request->xid;
+            zk_response.zxid = multi_response.zxid;
+
+            try
+            {
+                if (member.callback)
+                    member.callback(*member_response);
+            }
+            catch (...)
+            {
+                if (!exception)
+                    exception = std::current_exception();
+            }
+        }
+
+        if (exception)
+            std::rethrow_exception(exception);
+    };
+
+    {
+        std::lock_guard lock(operations_mutex);
+        operations[multi_request->xid] = info;
+    }
+    return info;
+}
+
+
 void ZooKeeper::create(
     const String & path,
     const String & data,
@@ -1156,6 +1361,25 @@ void ZooKeeper::check(
 }
 
 
+void ZooKeeper::addWatch(
+    const String & path,
+    bool recursive,
+    ResponseCallback callback,
+    WatchCallback watch)
+{
+    ZooKeeperAddWatchRequest request;
+    request.path = path;
+    request.mode = recursive ? AddWatchMode::PersistentRecursive : AddWatchMode::Persistent;
+
+    RequestInfo request_info;
+    request_info.request = std::make_shared<ZooKeeperAddWatchRequest>(std::move(request));
+    request_info.callback = std::move(callback);
+    request_info.watch = std::move(watch);
+
+    pushRequest(std::move(request_info));
+}
+
+
 void ZooKeeper::multi(
     const Requests & requests,
     MultiCallback callback)
@@ -1171,6 +1395,22 @@ void ZooKeeper::multi(
 }
 
 
+void ZooKeeper::submit(
+    const ZooKeeperRequestPtr & request,
+    ResponseCallback callback,
+    WatchCallback watch)
+{
+    request->xid = 0;
+
+    RequestInfo request_info;
+    request_info.request = request;
+    request_info.callback = std::move(callback);
+    request_info.watch = std::move(watch);
+
+    pushRequest(std::move(request_info));
+}
+
+
 void ZooKeeper::close()
 {
     ZooKeeperCloseRequest request;
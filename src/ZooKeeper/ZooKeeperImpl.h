@@ -16,6 +16,7 @@
 #include <Poco/Net/SocketAddress.h>
 
 #include <map>
+#include <unordered_map>
 #include <mutex>
 #include <chrono>
 #include <vector>
@@ -99,6 +100,24 @@ public:
 
     using Nodes = std::vector<Node>;
 
+    /** Opt-in auto batching. Requests issued one after another without a watch are sent together as a single multi
+      * request: reads (get, exists and list) as MultiRead, and writes (create, remove and set) as Multi if
+      * batch_writes is set. Only consecutive requests of the same kind are grouped, so the order of requests
+      * is kept. Every request gets its own response and callback as if it was sent alone.
+      *
+      * A multi is atomic, so a failing write of a batch fails the other writes of it with ZRUNTIMEINCONSISTENCY.
+      * Group only writes which do not depend on each other and are retried on error.
+      * Exists and list inside MultiRead are RaftKeeper extensions, do not enable it against ZooKeeper.
+      */
+    struct BatchingSettings
+    {
+        /// At most requests in a batch, 0 or 1 disables auto batching
+        size_t max_batch_size = 0;
+        /// How long send thread waits for more requests to join a batch
+        UInt64 linger_ms = 0;
+        bool batch_writes = false;
+    };
+
     /** Connection to nodes is performed in order. If you want, shuffle them manually.
       * Operation timeout couldn't be greater than session timeout.
       * Operation timeout applies independently for network read, network write, waiting for events and synchronization.
@@ -110,7 +129,8 @@ public:
         const String & auth_data,
         Poco::Timespan session_timeout_,
         Poco::Timespan connection_timeout,
-        Poco::Timespan operation_timeout_);
+        Poco::Timespan operation_timeout_,
+        const BatchingSettings & batching_ = {});
 
     ~ZooKeeper() override;
 
@@ -167,6 +187,18 @@ public:
         const Requests & requests,
         MultiCallback callback) override;
 
+    void addWatch(
+        const String & path,
+        bool recursive,
+        ResponseCallback callback,
+        WatchCallback watch) override;
+
+    /// Send a request built elsewhere, like a captured one which is replayed. Its xid is assigned like of others.
+    void submit(
+        const ZooKeeperRequestPtr & request,
+        ResponseCallback callback,
+        WatchCallback watch);
+
     /// Without forcefully invalidating (finalizing) ZooKeeper session before
     /// establishing a new one, there was a possibility that server is using
     /// two ZooKeeper sessions simultaneously in different parts of code.
@@ -187,6 +219,7 @@ private:
 
     Poco::Timespan session_timeout;
     Poco::Timespan operation_timeout;
+    BatchingSettings batching;
 
     Poco::Net::StreamSocket socket;
     std::optional<ReadBufferFromPocoSocket> in;
@@ -195,7 +228,7 @@ private:
     int64_t session_id = 0;
 
     std::atomic<XID> next_xid {1};
-    /// last received response xid
+    /// last received response xid, xids of requests sent in a batch are skipped
     std::atomic<XID> last_received_xid {0};
     std::atomic<bool> expired {false};
     /// Mark session finalization start. Used to avoid simultaneous
@@ -215,9 +248,16 @@ private:
 
     using RequestsQueue = ConcurrentBoundedQueue<RequestInfo>;
 
+    /// Capacity is max_batch_size if auto batching is enabled, so that concurrent requests can wait in it for a batch
     RequestsQueue requests_queue{1};
     void pushRequest(RequestInfo && info);
 
+    /// Kind of multi the request can be batched into, Unspecified if it is sent alone
+    ZooKeeperMultiRequest::OperationType getBatchType(const RequestInfo & info) const;
+    /// Replace the operations of requests, which are registered and not sent yet, by one multi request with xid of
+    /// the first of them, whose callback answers the callbacks of all. Caller sends the returned request.
+    RequestInfo makeBatch(const std::vector<ZooKeeperRequestPtr> & requests, ZooKeeperMultiRequest::OperationType type);
+
     using Operations = std::map<XID, RequestInfo>;
 
     Operations operations;
@@ -227,6 +267,16 @@ private:
     using Watches = std::map<String /* path, relative of root_path */, WatchCallbacks>;
 
     Watches watches;
+
+    struct PersistentWatch
+    {
+        bool recursive;
+        WatchCallback callback;
+    };
+
+    /// Watches of AddWatch requests by path, relative of root_path. They are kept until the session ends.
+    std::unordered_map<String, std::vector<PersistentWatch>> persistent_watches;
+    /// Guards watches and persistent_watches
     std::mutex watches_mutex;
 
     ThreadFromGlobalPool send_thread;
@@ -0,0 +1,336 @@
+#include "ZooKeeperTreeCache.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+
+namespace RK
+{
+    namespace ErrorCodes
+    {
+        extern const int NO_ZOOKEEPER;
+    }
+}
+
+namespace zkutil
+{
+
+namespace
+{
+
+/// Descendants of path are the keys with the prefix
+std::string childrenPrefix(const std::string & path)
+{
+    return path == "/" ? path : path + "/";
+}
+
+/// Keys of descendants of a prefix are less than it with '/' replaced by the next character
+std::string childrenEnd(std::string prefix)
+{
+    prefix.back() = '/' + 1;
+    return prefix;
+}
+
+}
+
+struct ZooKeeperTreeCache::Context
+{
+    mutable std::mutex mutex;
+    std::condition_variable loaded;
+
+    /// Changed by every start, callbacks of a previous one are ignored
+    UInt64 generation = 0;
+    Coordination::IKeeper * keeper = nullptr;
+
+    std::map<std::string, ZNode> nodes;
+    /// Reads of the initial load not answered yet
+    size_t pending_loads = 0;
+    bool ready = false;
+    bool failed = false;
+    UInt64 version = 0;
+
+    void putNode(const std::string & path, const std::string & data, const Coordination::Stat & stat)
+    {
+        auto it = nodes.find(path);
+        /// Never replaced by an older state of it
+        if (it != nodes.end() && stat.mzxid < it->second.stat.mzxid)
+            return;
+        nodes[path] = ZNode{data, stat};
+        ++version;
+    }
+
+    void removeNode(const std::string & path)
+    {
+        String prefix = childrenPrefix(path);
+        nodes.erase(path);
+        nodes.erase(nodes.lower_bound(prefix), nodes.lower_bound(childrenEnd(prefix)));
+        ++version;
+    }
+
+    template <typename F>
+    void forEachChild(const std::string & path, F && f) const
+    {
+        String prefix = childrenPrefix(path);
+        auto it = nodes.lower_bound(prefix);
+        while (it != nodes.end() && it->first.starts_with(prefix))
+        {
+            if (it->first == path)
+            {
+                ++it;
+                continue;
+            }
+            f(it->first.substr(prefix.size()));
+            /// Skip descendants of the child
+            it = nodes.lower_bound(childrenEnd(it->first + "/"));
+        }
+    }
+
+    void finishLoad()
+    {
+        if (--pending_loads == 0 && !failed)
+        {
+            ready = true;
+            loaded.notify_all();
+        }
+    }
+
+    void fail()
+    {
+        failed = true;
+        ready = false;
+        loaded.notify_all();
+    }
+};
+
+void ZooKeeperTreeCache::readChildren(const ContextPtr & context, UInt64 generation, const std::string & path)
+{
+    std::weak_ptr<Context> weak_context(context);
+    auto callback = [weak_context, generation, path](const Coordination::ListResponse & response)
+    {
+        auto owned_context = weak_context.lock();
+        if (!owned_context)
+            return;
+
+        {
+            std::lock_guard lock(owned_context->mutex);
+            if (generation != owned_context->generation)
+                return;
+            if (response.error != Coordination::Error::ZOK && response.error != Coordination::Error::ZNONODE)
+            {
+                owned_context->fail();
+                return;
+            }
+        }
+
+        /// Counted before this load is finished, so that the cache is not ready in between
+        for (const auto & name : response.names)
+            readNode(owned_context, generation, childrenPrefix(path) + name.toString(), true);
+
+        std::lock_guard lock(owned_context->mutex);
+        if (generation == owned_context->generation)
+            owned_context->finishLoad();
+    };
+
+    Coordination::IKeeper * keeper;
+    {
+        std::lock_guard lock(context->mutex);
+        if (generation != context->generation)
+            return;
+        keeper = context->keeper;
+    }
+
+    try
+    {
+        keeper->list(path, callback, {});
+    }
+    catch (...)
+    {
+        /// Session is expired, the watch gets the event of it
+        std::lock_guard lock(context->mutex);
+        if (generation == context->generation)
+            context->fail();
+    }
+}
+
+void ZooKeeperTreeCache::readNode(const ContextPtr & context, UInt64 generation, const std::string & path, bool load)
+{
+    std::weak_ptr<Context> weak_context(context);
+    auto callback = [weak_context, generation, path, load](const Coordination::GetResponse & response)
+    {
+        auto owned_context = weak_context.lock();
+        if (!owned_context)
+            return;
+
+        bool read_children = false;
+        {
+            std::lock_guard lock(owned_context->mutex);
+            if (generation != owned_context->generation)
+                return;
+
+            if (response.error == Coordination::Error::ZOK)
+                owned_context->putNode(path, response.data, response.stat);
+            else if (response.error == Coordination::Error::ZNONODE)
+                owned_context->removeNode(path);
+            else
+                owned_context->fail();
+
+            /// Children created later are read by their events
+            read_children = load && !owned_context->failed && response.error == Coordination::Error::ZOK
+                && response.stat.numChildren > 0;
+
+            if (load && read_children)
+                ++owned_context->pending_loads;
+            if (load)
+                owned_context->finishLoad();
+        }
+
+        if (read_children)
+            readChildren(owned_context, generation, path);
+    };
+
+    /// Session of the generation, callbacks of a previous one do not read by a new one
+    Coordination::IKeeper * keeper;
+    {
+        std::lock_guard lock(context->mutex);
+        if (generation != context->generation)
+            return;
+        keeper = context->keeper;
+        if (load)
+            ++context->pending_loads;
+    }
+
+    try
+    {
+        keeper->get(path, callback, {});
+    }
+    catch (...)
+    {
+        std::lock_guard lock(context->mutex);
+        if (generation == context->generation)
+            context->fail();
+    }
+}
+
+ZooKeeperTreeCache::ZooKeeperTreeCache(GetZooKeeper get_zookeeper_, const std::string & root_)
+    : get_zookeeper(std::move(get_zookeeper_)), root(root_), context(std::make_shared<Context>())
+{
+}
+
+bool ZooKeeperTreeCache::start(UInt64 timeout_ms)
+{
+    zookeeper = get_zookeeper();
+    if (!zookeeper)
+        throw RK::Exception("Could not load subtree: '" + root + "'. ZooKeeper not configured.", RK::ErrorCodes::NO_ZOOKEEPER);
+
+    UInt64 generation;
+    {
+        std::lock_guard lock(context->mutex);
+        generation = ++context->generation;
+        context->keeper = zookeeper->impl.get();
+        context->nodes.clear();
+        ++context->version;
+        context->ready = false;
+        context->failed = false;
+        /// For the watch
+        context->pending_loads = 1;
+    }
+
+    std::weak_ptr<Context> weak_context(context);
+    auto watch = [weak_context, generation](const Coordination::WatchResponse & response)
+    {
+        auto owned_context = weak_context.lock();
+        if (!owned_context)
+            return;
+
+        if (response.type == Coordination::SESSION)
+        {
+            std::lock_guard lock(owned_context->mutex);
+            if (generation == owned_context->generation && response.state == Coordination::EXPIRED_SESSION)
+                owned_context->fail();
+        }
+        else if (response.type == Coordination::DELETED)
+        {
+            std::lock_guard lock(owned_context->mutex);
+            if (generation == owned_context->generation)
+                owned_context->removeNode(response.path);
+        }
+        else if (response.type == Coordination::CREATED || response.type == Coordination::CHANGED)
+        {
+            readNode(owned_context, generation, response.path, false);
+        }
+    };
+
+    auto callback = [weak_context, generation, root = root](const Coordination::Response & response)
+    {
+        auto owned_context = weak_context.lock();
+        if (!owned_context)
+            return;
+
+        {
+            std::lock_guard lock(owned_context->mutex);
+            if (generation != owned_context->generation)
+                return;
+            if (response.error != Coordination::Error::ZOK)
+            {
+                owned_context->fail();
+                return;
+            }
+        }
+
+        /// Read after the watch is set, so that no change is missed
+        readNode(owned_context, generation, root, true);
+
+        std::lock_guard lock(owned_context->mutex);
+        if (generation == owned_context->generation)
+            owned_context->finishLoad();
+    };
+
+    zookeeper->impl->addWatch(root, true, callback, watch);
+
+    std::unique_lock lock(context->mutex);
+    return context->loaded.wait_for(
+        lock, std::chrono::milliseconds(timeout_ms), [&] { return context->ready || context->failed; })
+        && context->ready;
+}
+
+bool ZooKeeperTreeCache::isReady() const
+{
+    std::lock_guard lock(context->mutex);
+    return context->ready;
+}
+
+std::optional<ZooKeeperTreeCache::ZNode> ZooKeeperTreeCache::get(const std::string & path) const
+{
+    std::lock_guard lock(context->mutex);
+    auto it = context->nodes.find(path);
+    if (it == context->nodes.end())
+        return {};
+
+    ZNode node = it->second;
+    node.stat.numChildren = 0;
+    context->forEachChild(path, [&](const std::string &) { ++node.stat.numChildren; });
+    return node;
+}
+
+Strings ZooKeeperTreeCache::getChildren(const std::string & path) const
+{
+    Strings children;
+    std::lock_guard lock(context->mutex);
+    if (context->nodes.contains(path))
+        context->forEachChild(path, [&](const std::string & name) { children.push_back(name); });
+    return children;
+}
+
+size_t ZooKeeperTreeCache::size() const
+{
+    std::lock_guard lock(context->mutex);
+    return context->nodes.size();
+}
+
+UInt64 ZooKeeperTreeCache::getVersion() const
+{
+    std::lock_guard lock(context->mutex);
+    return context->version;
+}
+
+}
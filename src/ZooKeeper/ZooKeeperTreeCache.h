@@ -0,0 +1,70 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include "Common.h"
+#include "ZooKeeper.h"
+
+namespace zkutil
+{
+
+/** Client side cache of the subtree of root. It is loaded once and then kept up to date by a persistent recursive
+  * watch: a created or changed event reads only the node of it and a deleted event drops it, rather than reading the
+  * subtree again after each change.
+  *
+  * Responses and watch events of a session come in order, and the cache applies them in that order on the receive
+  * thread of the session, so it only moves from a state of the subtree to a later one. Reads are served from memory
+  * and are thread safe. Stat of a node is of the last read of it, except numChildren which is of the cached children.
+  *
+  * When the session expires the cache stops following changes and isReady is false until start is called with a
+  * new session. Nodes cached are still read meanwhile.
+  */
+class ZooKeeperTreeCache
+{
+public:
+    ZooKeeperTreeCache(GetZooKeeper get_zookeeper_, const std::string & root_);
+
+    ZooKeeperTreeCache(const ZooKeeperTreeCache &) = delete;
+    ZooKeeperTreeCache & operator=(const ZooKeeperTreeCache &) = delete;
+
+    struct ZNode
+    {
+        std::string data;
+        Coordination::Stat stat{};
+    };
+
+    /// Watch the subtree and load it by the current session of get_zookeeper, nodes cached before are dropped.
+    /// Returns whether all of it is loaded in timeout_ms, loading goes on after that.
+    bool start(UInt64 timeout_ms);
+
+    /// Whether the subtree is loaded and changes of it are followed
+    bool isReady() const;
+
+    /// Node at path, nullopt if there is no such node in the cache
+    std::optional<ZNode> get(const std::string & path) const;
+    /// Names of the children of path, empty if there is no such node in the cache
+    Strings getChildren(const std::string & path) const;
+
+    size_t size() const;
+    /// Grows with every change applied, so that a reader tells whether the subtree changed since it read
+    UInt64 getVersion() const;
+
+private:
+    struct Context;
+    using ContextPtr = std::shared_ptr<Context>;
+
+    /// Read node at path into the cache, and the subtree of it if load is set, which is for the initial load.
+    /// Invoked by callbacks of the receive thread, so they do not wait for responses.
+    static void readNode(const ContextPtr & context, UInt64 generation, const std::string & path, bool load);
+    static void readChildren(const ContextPtr & context, UInt64 generation, const std::string & path);
+
+    GetZooKeeper get_zookeeper;
+    const std::string root;
+
+    /// Session followed, it is not used by callbacks after it is destroyed, for it waits for them
+    ZooKeeperPtr zookeeper;
+    /// Callbacks only hold a weak pointer to it, so they do nothing after the cache is destroyed
+    ContextPtr context;
+};
+
+}
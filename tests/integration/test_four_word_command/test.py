@@ -444,6 +444,8 @@ def test_cmd_cons(started_cluster):
 
         assert result['recved'] == '11'
         assert result['sent'] == '11'
+        assert 'buf' in result
+        assert result['inflight'] == '0'
         assert 'sid' in result
         assert result['lop'] == 'Create'
         assert 'est' in result